@@ -126,6 +126,32 @@ if test "$enable_websockets" != "no"; then
             [websockets_serve_file_extraarg=no])
         AC_MSG_RESULT([$websockets_serve_file_extraarg])
 
+        # Check for libwebsocket_send_pipe_choked.
+        AC_MSG_CHECKING([for WEBSOCKETS libwebsocket_send_pipe_choked])
+        AC_LINK_IFELSE(
+           [AC_LANG_PROGRAM(
+                 [[#include <stdlib.h>
+                   #include <libwebsockets.h>]],
+                 [[return libwebsocket_send_pipe_choked(NULL);]])],
+            [websockets_pipe_choked=yes],
+            [websockets_pipe_choked=no])
+        AC_MSG_RESULT([$websockets_pipe_choked])
+
+        # Check for lws_hdr_copy and the conditional/encoding HTTP headers.
+        AC_MSG_CHECKING([for WEBSOCKETS lws_hdr_copy with HTTP request headers])
+        AC_LINK_IFELSE(
+           [AC_LANG_PROGRAM(
+                 [[#include <stdlib.h>
+                   #include <libwebsockets.h>]],
+                 [[char buf[64];
+                   lws_hdr_copy(NULL, buf, sizeof(buf),
+                                WSI_TOKEN_HTTP_ACCEPT_ENCODING);
+                   return lws_hdr_copy(NULL, buf, sizeof(buf),
+                                       WSI_TOKEN_HTTP_IF_NONE_MATCH);]])],
+            [websockets_http_headers=yes],
+            [websockets_http_headers=no])
+        AC_MSG_RESULT([$websockets_http_headers])
+
         CFLAGS="$saved_CFLAGS"
         LDFLAGS="$saved_LDFLAGS"
         LIBS="$saved_LIBS"
@@ -197,6 +223,12 @@ if test "$enable_websockets" != "no"; then
     if test "$websockets_serve_file_extraarg" = "yes"; then
         WEBSOCKETS_CFLAGS="$WEBSOCKETS_CFLAGS -DWEBSOCKETS_SERVE_FILE_EXTRAARG"
     fi
+    if test "$websockets_pipe_choked" = "yes"; then
+        WEBSOCKETS_CFLAGS="$WEBSOCKETS_CFLAGS -DWEBSOCKETS_PIPE_CHOKED"
+    fi
+    if test "$websockets_http_headers" = "yes"; then
+        WEBSOCKETS_CFLAGS="$WEBSOCKETS_CFLAGS -DWEBSOCKETS_HTTP_HEADERS"
+    fi
 
     LDFLAGS="$saved_LDFLAGS"
     LIBS="$saved_LIBS"
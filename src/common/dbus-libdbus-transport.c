@@ -737,6 +737,137 @@ static int dbus_sendmsg(mrp_transport_t *mt, mrp_msg_t *msg)
 }
 
 
+/*
+ * encode-once/send-many
+ *
+ * The message is encoded only for the first destination. For the rest
+ * we copy it with its already marshalled body and readdress the copy.
+ */
+
+typedef struct {
+    mrp_dbus_t     *dbus;                /* bus the message was created on */
+    mrp_msg_t      *msg;                 /* original message */
+    mrp_dbus_msg_t *m;                   /* encoded message */
+    char           *sender;              /* sender id in the encoded body */
+    mrp_dbusaddr_t  dst;                 /* address m was encoded for */
+    int             sent;                /* whether m itself was sent */
+} dbus_enc_t;
+
+
+static void dbus_freeencoded(void *enc)
+{
+    dbus_enc_t *e = (dbus_enc_t *)enc;
+
+    if (e != NULL) {
+        mrp_dbus_msg_unref(e->m);
+        mrp_msg_unref(e->msg);
+        mrp_dbus_unref(e->dbus);
+        mrp_free(e->sender);
+        mrp_free(e);
+    }
+}
+
+
+static void *dbus_encodemsg(mrp_transport_t *mt, mrp_msg_t *msg,
+                            mrp_sockaddr_t *addrp, socklen_t addrlen)
+{
+    dbus_t         *t = (dbus_t *)mt;
+    mrp_dbusaddr_t *addr;
+    dbus_enc_t     *e;
+
+    if (addrp == NULL) {
+        addrp   = (mrp_sockaddr_t *)&t->remote;
+        addrlen = sizeof(t->remote);
+    }
+
+    if (!check_address(addrp, addrlen)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (t->dbus == NULL && !dbus_autobind(mt, addrp))
+        return NULL;
+
+    addr = (mrp_dbusaddr_t *)addrp;
+
+    if ((e = mrp_allocz(sizeof(*e))) == NULL)
+        return NULL;
+
+    if (copy_address(&e->dst, addr) == NULL) {
+        mrp_free(e);
+        return NULL;
+    }
+
+    e->sender = mrp_strdup(t->local.db_path);
+    e->m      = msg_encode(t->dbus, addr->db_addr, addr->db_path,
+                           TRANSPORT_INTERFACE, TRANSPORT_MESSAGE,
+                           t->local.db_path, msg);
+    e->dbus   = mrp_dbus_ref(t->dbus);
+    e->msg    = mrp_msg_ref(msg);
+
+    if (e->sender == NULL || e->m == NULL) {
+        dbus_freeencoded(e);
+        return NULL;
+    }
+
+    return e;
+}
+
+
+static int dbus_sendencoded(mrp_transport_t *mt, void *enc,
+                            mrp_sockaddr_t *addrp, socklen_t addrlen)
+{
+    dbus_t         *t = (dbus_t *)mt;
+    dbus_enc_t     *e = (dbus_enc_t *)enc;
+    mrp_dbusaddr_t *addr;
+    mrp_dbus_msg_t *m;
+    int             success;
+
+    if (addrp == NULL) {
+        addrp   = (mrp_sockaddr_t *)&t->remote;
+        addrlen = sizeof(t->remote);
+    }
+
+    if (!check_address(addrp, addrlen)) {
+        errno = EINVAL;
+        return FALSE;
+    }
+
+    if (t->dbus == NULL && !dbus_autobind(mt, addrp))
+        return FALSE;
+
+    addr = (mrp_dbusaddr_t *)addrp;
+
+    /* the sender id is part of the body, we can't reuse it if it differs */
+    if (strcmp(e->sender, t->local.db_path))
+        return dbus_sendmsgto(mt, e->msg, addrp, addrlen);
+
+    if (!e->sent && e->dbus == t->dbus &&
+        !strcmp(e->dst.db_addr, addr->db_addr) &&
+        !strcmp(e->dst.db_path, addr->db_path))
+        m = mrp_dbus_msg_ref(e->m);
+    else
+        m = mrp_dbus_msg_copy(t->dbus, e->m, addr->db_addr, addr->db_path);
+
+    if (m == NULL)
+        return dbus_sendmsgto(mt, e->msg, addrp, addrlen);
+
+    if (mrp_dbus_send_msg(t->dbus, m)) {
+        if (m == e->m)
+            e->sent = TRUE;
+        success = TRUE;
+    }
+    else {
+        errno   = ECOMM;
+        success = FALSE;
+    }
+
+    mrp_dbus_msg_unref(m);
+
+    return success;
+}
+
+
 static int dbus_sendrawto(mrp_transport_t *mt, void *data, size_t size,
                           mrp_sockaddr_t *addrp, socklen_t addrlen)
 {
@@ -1742,4 +1873,7 @@ MRP_REGISTER_TRANSPORT(dbus, DBUS, dbus_t, dbus_resolve,
                        dbus_senddata, dbus_senddatato,
                        NULL, NULL,
                        NULL, NULL,
-                       NULL, NULL);
+                       NULL, NULL,
+                       .encodemsg   = dbus_encodemsg,
+                       .sendencoded = dbus_sendencoded,
+                       .freeencoded = dbus_freeencoded);
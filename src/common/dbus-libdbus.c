@@ -27,6 +27,8 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <errno.h>
+
 #include <murphy/common/macros.h>
 #include <murphy/common/mm.h>
 #include <murphy/common/log.h>
@@ -50,8 +52,15 @@ struct mrp_dbus_s {
     mrp_mainloop_t  *ml;                 /* murphy mainloop */
     mrp_htbl_t      *methods;            /* method handler table */
     mrp_htbl_t      *signals;            /* signal handler table */
-    mrp_list_hook_t  name_trackers;      /* peer (name) watchers */
+    mrp_htbl_t      *names;              /* name owner cache */
+    int              nname;              /* number of cached names */
+    mrp_list_hook_t  name_queue;         /* names with pending queries */
+    mrp_deferred_t  *name_flush;         /* deferred name queue flushing */
+    int              name_match;         /* NameOwnerChanged match installed */
+    int              name_busy;          /* notifying name trackers */
+    int              name_dead;          /* need to sweep dead trackers */
     mrp_list_hook_t  calls;              /* pending calls */
+    mrp_list_hook_t  batches;            /* pending call batches */
     uint32_t         call_id;            /* next call id */
     const char      *unique_name;        /* our unique D-BUS address */
     int              priv;               /* whether a private connection */
@@ -124,13 +133,23 @@ typedef struct {
 
 
 typedef struct {
-    mrp_list_hook_t     hook;           /* hook to name tracker list */
-    char               *name;           /* name to track */
+    char            *name;              /* tracked name */
+    char            *owner;             /* current owner, NULL if none */
+    int              known;             /* whether owner is known */
+    int              querying;          /* whether owner query is pending */
+    mrp_list_hook_t  trackers;          /* trackers of this name */
+    mrp_list_hook_t  hook;              /* to queue of names to flush */
+} name_owner_t;
+
+typedef struct {
+    mrp_list_hook_t     hook;           /* hook to name owner trackers */
     mrp_dbus_name_cb_t  cb;             /* status change callback */
     void               *user_data;      /* opaque callback user data */
-    int32_t             qid;            /* initial query ID */
+    int                 notified;       /* whether notified of status */
 } name_tracker_t;
 
+#define NAME_QUERY_TIMEOUT 5000         /* GetNameOwner timeout (msecs) */
+
 
 typedef struct {
     mrp_dbus_t          *dbus;           /* DBUS connection */
@@ -142,6 +161,39 @@ typedef struct {
 } call_t;
 
 
+/*
+ * a batch of pipelined method calls
+ *
+ * All calls of a batch live in a single slot array allocated together
+ * with the batch itself. Each pending call carries a direct pointer to
+ * its slot, so replies need no lookup to find their call.
+ */
+
+typedef struct {
+    mrp_dbus_batch_t    *batch;          /* batch we belong to */
+    mrp_dbus_msg_t      *msg;            /* method call message */
+    mrp_dbus_reply_cb_t  cb;             /* reply notification callback */
+    void                *user_data;      /* opaque callback data */
+    DBusPendingCall     *pend;           /* pending DBUS call */
+    uint32_t             serial;         /* call serial */
+} batch_call_t;
+
+struct mrp_dbus_batch_s {
+    mrp_dbus_t          *dbus;           /* DBUS connection */
+    mrp_list_hook_t      hook;           /* to list of pending batches */
+    int                  timeout;        /* call timeout */
+    int                  nslot;          /* number of call slots */
+    int                  ncall;          /* number of calls added */
+    int                  npending;       /* number of pending calls */
+    int                  nerror;         /* number of error replies */
+    mrp_dbus_batch_cb_t  cb;             /* batch completion callback */
+    void                *user_data;      /* opaque callback data */
+    int                  busy;           /* callbacks in progress */
+    int                  dead;           /* cancelled or completed */
+    batch_call_t         calls[];        /* call slots */
+};
+
+
 typedef struct {
     mrp_mainloop_t *ml;                  /* mainloop for bus connection */
     const char     *address;             /* address of bus */
@@ -155,13 +207,15 @@ static DBusHandlerResult dispatch_signal(DBusConnection *c,
                                          DBusMessage *msg, void *data);
 static DBusHandlerResult dispatch_method(DBusConnection *c,
                                          DBusMessage *msg, void *data);
-static void purge_name_trackers(mrp_dbus_t *dbus);
+static void purge_names(mrp_dbus_t *dbus);
+static void name_owner_free_cb(void *key, void *entry);
 static void purge_calls(mrp_dbus_t *dbus);
 static void handler_list_free_cb(void *key, void *entry);
 static void handler_free(handler_t *h);
 static int name_owner_change_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *m,
                                 void *data);
 static void call_free(call_t *call);
+static void purge_batches(mrp_dbus_t *dbus);
 static void free_msg_array(msg_array_t *a);
 
 
@@ -209,8 +263,9 @@ void dbus_disconnect(mrp_dbus_t *dbus)
             dbus_connection_unref(dbus->conn);
         }
 
-        purge_name_trackers(dbus);
+        purge_names(dbus);
         purge_calls(dbus);
+        purge_batches(dbus);
 
         mrp_free(dbus->address);
         dbus->conn = NULL;
@@ -294,7 +349,8 @@ mrp_dbus_t *mrp_dbus_connect(mrp_mainloop_t *ml, const char *address,
         return NULL;
 
     mrp_list_init(&dbus->calls);
-    mrp_list_init(&dbus->name_trackers);
+    mrp_list_init(&dbus->batches);
+    mrp_list_init(&dbus->name_queue);
     mrp_refcnt_init(&dbus->refcnt);
 
     dbus->ml = ml;
@@ -352,6 +408,14 @@ mrp_dbus_t *mrp_dbus_connect(mrp_mainloop_t *ml, const char *address,
     mrp_clear(&hcfg);
     hcfg.comp = mrp_string_comp;
     hcfg.hash = mrp_string_hash;
+    hcfg.free = name_owner_free_cb;
+
+    if ((dbus->names = mrp_htbl_create(&hcfg)) == NULL) {
+        dbus_set_error(errp, DBUS_ERROR_FAILED,
+                       "Failed to create DBUS name owner table.");
+        goto fail;
+    }
+
     hcfg.free = handler_list_free_cb;
 
     if ((dbus->methods = mrp_htbl_create(&hcfg)) == NULL) {
@@ -385,7 +449,6 @@ mrp_dbus_t *mrp_dbus_connect(mrp_mainloop_t *ml, const char *address,
                             DBUS_ADMIN_SERVICE, DBUS_NAME_CHANGED,
                             DBUS_ADMIN_SERVICE, NULL);
 
-    mrp_list_init(&dbus->name_trackers);
     dbus->call_id = 1;
 
     if (mrp_htbl_insert(buses, dbus->conn, dbus))
@@ -456,75 +519,357 @@ const char *mrp_dbus_get_unique_name(mrp_dbus_t *dbus)
 }
 
 
-static void name_owner_query_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *m, void *data)
+/*
+ * name owner cache
+ *
+ * We keep a single cache of name owners per bus connection. Every
+ * followed name has a single entry in the cache, with the list of
+ * trackers interested in it. All tracked names share a single match
+ * for NameOwnerChanged, and the owners of all names followed during
+ * one mainloop iteration are queried with a single batch of pipelined
+ * GetNameOwner calls. Once known, the owner of a followed name can be
+ * looked up synchronously with mrp_dbus_name_owner.
+ *
+ * Trackers forgotten from within a notification callback are only
+ * marked dead and get swept when we're done notifying.
+ */
+
+static void name_owner_free(name_owner_t *o)
 {
-    name_tracker_t *t   = (name_tracker_t *)data;
-    DBusMessage    *msg = m->msg;
-    const char     *owner;
-    int             state;
+    mrp_list_hook_t *p, *n;
+    name_tracker_t  *t;
 
-    if (t->cb != NULL) {                /* tracker still active */
-        t->qid = 0;
-        state  = dbus_message_get_type(msg) == DBUS_MESSAGE_TYPE_METHOD_RETURN;
+    if (o == NULL)
+        return;
 
-        if (!dbus_message_get_args(msg, NULL,
-                                   DBUS_TYPE_STRING, &owner,
-                                   DBUS_TYPE_INVALID))
-            owner = "<unknown>";
+    mrp_list_delete(&o->hook);
 
-        t->cb(dbus, t->name, state, owner, t->user_data);
-    }
-    else                                /* already requested to delete */
+    mrp_list_foreach(&o->trackers, p, n) {
+        t = mrp_list_entry(p, name_tracker_t, hook);
+        mrp_list_delete(&t->hook);
         mrp_free(t);
+    }
+
+    mrp_free(o->name);
+    mrp_free(o->owner);
+    mrp_free(o);
 }
 
 
-static int name_owner_change_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *m, void *data)
+static void name_owner_free_cb(void *key, void *entry)
+{
+    MRP_UNUSED(key);
+
+    name_owner_free((name_owner_t *)entry);
+}
+
+
+static name_owner_t *name_owner_create(mrp_dbus_t *dbus, const char *name)
+{
+    name_owner_t *o;
+
+    if ((o = mrp_allocz(sizeof(*o))) == NULL)
+        return NULL;
+
+    mrp_list_init(&o->trackers);
+    mrp_list_init(&o->hook);
+
+    if ((o->name = mrp_strdup(name)) == NULL ||
+        !mrp_htbl_insert(dbus->names, o->name, o)) {
+        name_owner_free(o);
+        return NULL;
+    }
+
+    dbus->nname++;
+
+    return o;
+}
+
+
+static int name_match_update(mrp_dbus_t *dbus)
 {
-    const char      *name, *prev, *next;
+    if (dbus->nname > 0 && !dbus->name_match) {
+        if (!mrp_dbus_install_filter(dbus, DBUS_ADMIN_SERVICE, DBUS_ADMIN_PATH, DBUS_ADMIN_INTERFACE,
+                                     DBUS_NAME_CHANGED, NULL))
+            return FALSE;
+
+        dbus->name_match = TRUE;
+    }
+    else if (dbus->nname == 0 && dbus->name_match) {
+        mrp_dbus_remove_filter(dbus, DBUS_ADMIN_SERVICE, DBUS_ADMIN_PATH, DBUS_ADMIN_INTERFACE,
+                               DBUS_NAME_CHANGED, NULL);
+        dbus->name_match = FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static void name_owner_release(mrp_dbus_t *dbus, name_owner_t *o)
+{
+    if (!mrp_list_empty(&o->trackers) || o->querying)
+        return;
+
+    if (dbus->name_busy) {
+        dbus->name_dead = TRUE;
+        return;
+    }
+
+    mrp_htbl_remove(dbus->names, o->name, TRUE);
+    dbus->nname--;
+
+    name_match_update(dbus);
+}
+
+
+static int sweep_names_cb(void *key, void *entry, void *user_data)
+{
+    mrp_dbus_t      *dbus = (mrp_dbus_t *)user_data;
+    name_owner_t    *o    = (name_owner_t *)entry;
     mrp_list_hook_t *p, *n;
     name_tracker_t  *t;
-    DBusMessage     *msg;
 
-    MRP_UNUSED(data);
+    MRP_UNUSED(key);
 
-    msg = m->msg;
+    mrp_list_foreach(&o->trackers, p, n) {
+        t = mrp_list_entry(p, name_tracker_t, hook);
 
-    if (dbus_message_get_type(msg) != DBUS_MESSAGE_TYPE_SIGNAL)
-        return FALSE;
+        if (t->cb == NULL) {
+            mrp_list_delete(&t->hook);
+            mrp_free(t);
+        }
+    }
 
-    if (!dbus_message_get_args(msg, NULL,
-                               DBUS_TYPE_STRING, &name,
-                               DBUS_TYPE_STRING, &prev,
-                               DBUS_TYPE_STRING, &next,
-                               DBUS_TYPE_INVALID))
-        return FALSE;
+    if (mrp_list_empty(&o->trackers) && !o->querying) {
+        dbus->nname--;
+        return MRP_HTBL_ITER_DELETE | MRP_HTBL_ITER_MORE;
+    }
+    else
+        return MRP_HTBL_ITER_MORE;
+}
+
+
+static void sweep_names(mrp_dbus_t *dbus)
+{
+    if (dbus->name_busy || !dbus->name_dead)
+        return;
+
+    dbus->name_dead = FALSE;
+    mrp_htbl_foreach(dbus->names, sweep_names_cb, dbus);
+
+    name_match_update(dbus);
+}
 
-#if 0
-    /*
-     * Notes: XXX TODO
-     *    In principle t->cb could call mrp_dbus_forget for some other D-BUS
-     *    address than name. If that happened to be n (== p->hook.next) this
-     *    would result in a crash or memory corruption in the next iteration
-     *    of this loop (when handling n). We can easily get around this
-     *    problem by
-     *
-     *     1. administering in mrp_dbus_t that we're handing a NameOwnerChange
-     *     2. checking for this in mrp_dbus_forget_name and if it is the case
-     *        only marking the affected entry for deletion
-     *     3. removing entries marked for deletion in this loop (or just
-     *        ignoring them and making another pass in the end removing any
-     *        such entry).
-     */
-#endif
 
-    mrp_list_foreach(&dbus->name_trackers, p, n) {
+static void name_owner_notify(mrp_dbus_t *dbus, name_owner_t *o, int all)
+{
+    mrp_list_hook_t *p, *n;
+    name_tracker_t  *t;
+    const char      *owner = o->owner ? o->owner : "";
+    int              up    = o->owner != NULL;
+
+    dbus->name_busy++;
+
+    mrp_list_foreach(&o->trackers, p, n) {
         t = mrp_list_entry(p, name_tracker_t, hook);
 
-        if (!strcmp(name, t->name))
-            t->cb(dbus, name, next && *next, next, t->user_data);
+        if (t->cb == NULL || (t->notified && !all))
+            continue;
+
+        t->notified = TRUE;
+        t->cb(dbus, o->name, up, owner, t->user_data);
+    }
+
+    dbus->name_busy--;
+
+    sweep_names(dbus);
+}
+
+
+static void name_owner_query_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *m, void *data)
+{
+    name_owner_t *o = (name_owner_t *)data;
+    const char   *owner;
+
+    o->querying = FALSE;
+
+    if (m != NULL) {
+        mrp_free(o->owner);
+        o->owner = NULL;
+        o->known = TRUE;
+
+        /* an error reply (NameHasNoOwner) means nobody owns the name */
+        if (!mrp_dbus_msg_is_error(m) &&
+            mrp_dbus_msg_read_basic(m, MRP_DBUS_TYPE_STRING, &owner))
+            o->owner = mrp_strdup(owner);
+    }
+
+    if (mrp_list_empty(&o->trackers))
+        name_owner_release(dbus, o);
+    else
+        name_owner_notify(dbus, o, FALSE);
+}
+
+
+static void name_batch_cb(mrp_dbus_t *dbus, int ncall, int nerror,
+                          void *user_data)
+{
+    MRP_UNUSED(dbus);
+    MRP_UNUSED(user_data);
+
+    mrp_debug("%d name owner queries done, %d failed", ncall, nerror);
+}
+
+
+static int name_query_add(mrp_dbus_batch_t *b, mrp_dbus_t *dbus,
+                          name_owner_t *o)
+{
+    mrp_dbus_msg_t *m;
+    int             slot;
+
+    m = mrp_dbus_msg_method_call(dbus, DBUS_ADMIN_SERVICE, DBUS_ADMIN_PATH, DBUS_ADMIN_INTERFACE, "GetNameOwner");
+
+    if (m == NULL)
+        return FALSE;
+
+    if (mrp_dbus_msg_append_basic(m, MRP_DBUS_TYPE_STRING, o->name))
+        slot = mrp_dbus_batch_add(b, m, name_owner_query_cb, o);
+    else
+        slot = -1;
+
+    mrp_dbus_msg_unref(m);
+
+    return slot >= 0;
+}
+
+
+static void name_flush_cb(mrp_deferred_t *d, void *user_data)
+{
+    mrp_dbus_t       *dbus = (mrp_dbus_t *)user_data;
+    mrp_dbus_batch_t *b;
+    mrp_list_hook_t   queue, sent, *p, *n;
+    name_owner_t     *o;
+    int               nquery;
+
+    mrp_disable_deferred(d);
+
+    if (mrp_list_empty(&dbus->name_queue))
+        return;
+
+    mrp_list_init(&queue);
+    mrp_list_init(&sent);
+    mrp_list_move(&queue, &dbus->name_queue);
+
+    nquery = 0;
+    mrp_list_foreach(&queue, p, n) {
+        o = mrp_list_entry(p, name_owner_t, hook);
+
+        if (!o->known)
+            nquery++;
     }
 
+    if (nquery > 0)
+        b = mrp_dbus_batch_create(dbus, nquery, NAME_QUERY_TIMEOUT);
+    else
+        b = NULL;
+
+    dbus->name_busy++;
+
+    mrp_list_foreach(&queue, p, n) {
+        o = mrp_list_entry(p, name_owner_t, hook);
+
+        mrp_list_delete(&o->hook);
+
+        if (o->known) {                   /* serve new trackers from cache */
+            name_owner_notify(dbus, o, FALSE);
+            continue;
+        }
+
+        if (b != NULL && name_query_add(b, dbus, o))
+            mrp_list_append(&sent, &o->hook);
+        else {
+            mrp_log_error("Failed to query owner of D-Bus name '%s'.",
+                          o->name);
+            o->querying = FALSE;
+            name_owner_notify(dbus, o, FALSE);
+        }
+    }
+
+    if (b != NULL) {
+        if (mrp_list_empty(&sent))
+            mrp_dbus_batch_cancel(b);
+        else if (!mrp_dbus_batch_submit(b, name_batch_cb, dbus)) {
+            mrp_list_foreach(&sent, p, n) {
+                o = mrp_list_entry(p, name_owner_t, hook);
+
+                mrp_log_error("Failed to query owner of D-Bus name '%s'.",
+                              o->name);
+                o->querying = FALSE;
+                name_owner_notify(dbus, o, FALSE);
+            }
+        }
+
+        mrp_list_foreach(&sent, p, n) {
+            o = mrp_list_entry(p, name_owner_t, hook);
+            mrp_list_delete(&o->hook);
+        }
+    }
+
+    dbus->name_busy--;
+
+    dbus->name_dead = TRUE;
+    sweep_names(dbus);
+}
+
+
+static int name_flush_schedule(mrp_dbus_t *dbus, name_owner_t *o)
+{
+    if (o->querying && mrp_list_empty(&o->hook))  /* query in flight */
+        return TRUE;
+
+    if (dbus->name_flush == NULL) {
+        dbus->name_flush = mrp_add_deferred(dbus->ml, name_flush_cb, dbus);
+
+        if (dbus->name_flush == NULL)
+            return FALSE;
+    }
+
+    if (mrp_list_empty(&o->hook))
+        mrp_list_append(&dbus->name_queue, &o->hook);
+
+    if (!o->known)
+        o->querying = TRUE;
+
+    mrp_enable_deferred(dbus->name_flush);
+
+    return TRUE;
+}
+
+
+static int name_owner_change_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *m, void *data)
+{
+    const char   *name, *prev, *next;
+    name_owner_t *o;
+
+    MRP_UNUSED(data);
+
+    if (mrp_dbus_msg_type(m) != MRP_DBUS_MESSAGE_TYPE_SIGNAL)
+        return FALSE;
+
+    if (!mrp_dbus_msg_read_basic(m, MRP_DBUS_TYPE_STRING, &name) ||
+        !mrp_dbus_msg_read_basic(m, MRP_DBUS_TYPE_STRING, &prev) ||
+        !mrp_dbus_msg_read_basic(m, MRP_DBUS_TYPE_STRING, &next))
+        return FALSE;
+
+    if ((o = mrp_htbl_lookup(dbus->names, (void *)name)) == NULL)
+        return TRUE;
+
+    mrp_free(o->owner);
+    o->owner = (next && *next) ? mrp_strdup(next) : NULL;
+    o->known = TRUE;
+
+    name_owner_notify(dbus, o, TRUE);
+
     return TRUE;
 }
 
@@ -532,34 +877,33 @@ static int name_owner_change_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *m, void *data)
 int mrp_dbus_follow_name(mrp_dbus_t *dbus, const char *name,
                          mrp_dbus_name_cb_t cb, void *user_data)
 {
+    name_owner_t   *o;
     name_tracker_t *t;
 
-    if ((t = mrp_allocz(sizeof(*t))) != NULL) {
-        if ((t->name = mrp_strdup(name)) != NULL) {
-            t->cb        = cb;
-            t->user_data = user_data;
-
-            if (mrp_dbus_install_filter(dbus,
-                                        DBUS_ADMIN_SERVICE, DBUS_ADMIN_PATH,
-                                        DBUS_ADMIN_SERVICE, DBUS_NAME_CHANGED,
-                                        name, NULL)) {
-                mrp_list_append(&dbus->name_trackers, &t->hook);
-
-                t->qid = mrp_dbus_call(dbus,
-                                       DBUS_ADMIN_SERVICE, DBUS_ADMIN_PATH,
-                                       DBUS_ADMIN_SERVICE, "GetNameOwner", 5000,
-                                       name_owner_query_cb, t,
-                                       DBUS_TYPE_STRING, t->name,
-                                       DBUS_TYPE_INVALID);
-                return TRUE;
-            }
-            else {
-                mrp_free(t->name);
-                mrp_free(t);
-            }
-        }
+    if ((o = mrp_htbl_lookup(dbus->names, (void *)name)) == NULL)
+        if ((o = name_owner_create(dbus, name)) == NULL)
+            return FALSE;
+
+    if ((t = mrp_allocz(sizeof(*t))) == NULL)
+        goto fail;
+
+    mrp_list_init(&t->hook);
+    t->cb        = cb;
+    t->user_data = user_data;
+
+    mrp_list_append(&o->trackers, &t->hook);
+
+    if (!name_match_update(dbus) || !name_flush_schedule(dbus, o)) {
+        mrp_list_delete(&t->hook);
+        mrp_free(t);
+        goto fail;
     }
 
+    return TRUE;
+
+ fail:
+    name_owner_release(dbus, o);
+
     return FALSE;
 }
 
@@ -568,26 +912,25 @@ int mrp_dbus_forget_name(mrp_dbus_t *dbus, const char *name,
                          mrp_dbus_name_cb_t cb, void *user_data)
 {
     mrp_list_hook_t *p, *n;
+    name_owner_t    *o;
     name_tracker_t  *t;
 
-    mrp_dbus_remove_filter(dbus,
-                           DBUS_ADMIN_SERVICE, DBUS_ADMIN_PATH,
-                           DBUS_ADMIN_SERVICE, DBUS_NAME_CHANGED,
-                           name, NULL);
+    if ((o = mrp_htbl_lookup(dbus->names, (void *)name)) == NULL)
+        return FALSE;
 
-    mrp_list_foreach(&dbus->name_trackers, p, n) {
+    mrp_list_foreach(&o->trackers, p, n) {
         t = mrp_list_entry(p, name_tracker_t, hook);
 
-        if (t->cb == cb && t->user_data == user_data && !strcmp(t->name,name)) {
-            mrp_list_delete(&t->hook);
-            mrp_free(t->name);
-
-            if (!t->qid)
-                mrp_free(t);
+        if (t->cb == cb && t->user_data == user_data) {
+            if (dbus->name_busy) {
+                t->cb           = NULL;
+                t->user_data    = NULL;
+                dbus->name_dead = TRUE;
+            }
             else {
-                t->cb        = NULL;
-                t->user_data = NULL;
-                t->name      = NULL;
+                mrp_list_delete(&t->hook);
+                mrp_free(t);
+                name_owner_release(dbus, o);
             }
 
             return TRUE;
@@ -598,21 +941,37 @@ int mrp_dbus_forget_name(mrp_dbus_t *dbus, const char *name,
 }
 
 
-static void purge_name_trackers(mrp_dbus_t *dbus)
+int mrp_dbus_name_owner(mrp_dbus_t *dbus, const char *name,
+                        const char **owner)
 {
-    mrp_list_hook_t *p, *n;
-    name_tracker_t  *t;
+    name_owner_t *o;
 
-    mrp_list_foreach(&dbus->name_trackers, p, n) {
-        t = mrp_list_entry(p, name_tracker_t, hook);
+    o = dbus->names ? mrp_htbl_lookup(dbus->names, (void *)name) : NULL;
 
-        mrp_list_delete(p);
-        mrp_dbus_remove_filter(dbus, DBUS_ADMIN_SERVICE, DBUS_ADMIN_PATH,
-                               DBUS_ADMIN_SERVICE, DBUS_NAME_CHANGED,
-                               t->name, NULL);
-        mrp_free(t->name);
-        mrp_free(t);
+    if (o == NULL || !o->known)
+        return FALSE;
+
+    if (owner != NULL)
+        *owner = o->owner;
+
+    return TRUE;
+}
+
+
+static void purge_names(mrp_dbus_t *dbus)
+{
+    mrp_del_deferred(dbus->name_flush);
+    dbus->name_flush = NULL;
+
+    mrp_list_init(&dbus->name_queue);
+
+    if (dbus->names != NULL) {
+        mrp_htbl_destroy(dbus->names, TRUE);
+        dbus->names = NULL;
     }
+
+    dbus->nname = 0;
+    name_match_update(dbus);
 }
 
 
@@ -1595,6 +1954,188 @@ int mrp_dbus_reply_error(mrp_dbus_t *dbus, mrp_dbus_msg_t *m,
 }
 
 
+static void batch_free(mrp_dbus_batch_t *b)
+{
+    batch_call_t *call;
+    int           i;
+
+    mrp_list_delete(&b->hook);
+
+    for (i = 0, call = b->calls; i < b->ncall; i++, call++) {
+        if (call->pend != NULL) {
+            dbus_pending_call_cancel(call->pend);
+            dbus_pending_call_unref(call->pend);
+        }
+
+        if (call->msg != NULL)
+            mrp_dbus_msg_unref(call->msg);
+    }
+
+    mrp_free(b);
+}
+
+
+mrp_dbus_batch_t *mrp_dbus_batch_create(mrp_dbus_t *dbus, int ncall,
+                                        int timeout)
+{
+    mrp_dbus_batch_t *b;
+
+    if (ncall <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    b = mrp_allocz(sizeof(*b) + ncall * sizeof(b->calls[0]));
+
+    if (b != NULL) {
+        mrp_list_init(&b->hook);
+
+        b->dbus    = dbus;
+        b->nslot   = ncall;
+        b->timeout = timeout;
+    }
+
+    return b;
+}
+
+
+int mrp_dbus_batch_add(mrp_dbus_batch_t *b, mrp_dbus_msg_t *msg,
+                       mrp_dbus_reply_cb_t cb, void *user_data)
+{
+    batch_call_t *call;
+
+    if (b->cb != NULL || b->ncall >= b->nslot || msg == NULL ||
+        !mrp_dbus_msg_is_method_call(msg)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    call = b->calls + b->ncall;
+
+    call->batch     = b;
+    call->msg       = mrp_dbus_msg_ref(msg);
+    call->cb        = cb;
+    call->user_data = user_data;
+
+    return b->ncall++;
+}
+
+
+static void batch_reply_cb(DBusPendingCall *pend, void *user_data)
+{
+    batch_call_t     *call = (batch_call_t *)user_data;
+    mrp_dbus_batch_t *b    = call->batch;
+    DBusMessage      *reply;
+    mrp_dbus_msg_t   *m;
+
+    reply = dbus_pending_call_steal_reply(pend);
+    m     = create_message(reply);
+
+    call->pend = NULL;
+    dbus_pending_call_unref(pend);
+
+    b->npending--;
+
+    if (reply == NULL ||
+        dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR)
+        b->nerror++;
+
+    b->busy++;
+
+    if (call->cb != NULL && !b->dead)
+        call->cb(b->dbus, m, call->user_data);
+
+    if (b->npending == 0 && !b->dead) {
+        b->dead = TRUE;
+        b->cb(b->dbus, b->ncall, b->nerror, b->user_data);
+    }
+
+    b->busy--;
+
+    mrp_dbus_msg_unref(m);
+    if (reply != NULL)
+        dbus_message_unref(reply);
+
+    if (b->dead && !b->busy)
+        batch_free(b);
+}
+
+
+int mrp_dbus_batch_submit(mrp_dbus_batch_t *b, mrp_dbus_batch_cb_t cb,
+                          void *user_data)
+{
+    mrp_dbus_t   *dbus = b->dbus;
+    batch_call_t *call;
+    int           i;
+
+    if (b->cb != NULL || cb == NULL || b->ncall == 0) {
+        errno = EINVAL;
+        return FALSE;
+    }
+
+    b->cb        = cb;
+    b->user_data = user_data;
+
+    /*
+     * Notes:
+     *     We queue all the calls before returning to the mainloop, so
+     *     they all go out in a single write and their replies get
+     *     dispatched together, instead of serialising on round-trips.
+     */
+
+    for (i = 0, call = b->calls; i < b->ncall; i++, call++) {
+        if (!dbus_connection_send_with_reply(dbus->conn, call->msg->msg,
+                                             &call->pend, b->timeout) ||
+            call->pend == NULL)
+            goto fail;
+
+        call->serial = dbus_message_get_serial(call->msg->msg);
+
+        if (!dbus_pending_call_set_notify(call->pend, batch_reply_cb, call,
+                                          NULL))
+            goto fail;
+
+        mrp_dbus_msg_unref(call->msg);
+        call->msg = NULL;
+
+        b->npending++;
+    }
+
+    mrp_list_append(&dbus->batches, &b->hook);
+
+    return TRUE;
+
+ fail:
+    batch_free(b);
+
+    return FALSE;
+}
+
+
+void mrp_dbus_batch_cancel(mrp_dbus_batch_t *b)
+{
+    if (b == NULL || b->dead)
+        return;
+
+    b->dead = TRUE;
+
+    if (!b->busy)
+        batch_free(b);
+}
+
+
+static void purge_batches(mrp_dbus_t *dbus)
+{
+    mrp_list_hook_t  *p, *n;
+    mrp_dbus_batch_t *b;
+
+    mrp_list_foreach(&dbus->batches, p, n) {
+        b = mrp_list_entry(p, typeof(*b), hook);
+        batch_free(b);
+    }
+}
+
+
 static void call_free(call_t *call)
 {
     if (call != NULL)
@@ -1762,6 +2303,32 @@ mrp_dbus_msg_t *mrp_dbus_msg_signal(mrp_dbus_t *bus,
 }
 
 
+
+mrp_dbus_msg_t *mrp_dbus_msg_copy(mrp_dbus_t *bus, mrp_dbus_msg_t *m,
+                                  const char *destination, const char *path)
+{
+    mrp_dbus_msg_t *mc;
+    DBusMessage    *msg;
+
+    MRP_UNUSED(bus);
+
+    msg = dbus_message_copy(m->msg);
+
+    if (msg == NULL)
+        return NULL;
+
+    if ((destination && !dbus_message_set_destination(msg, destination)) ||
+        (path && !dbus_message_set_path(msg, path)))
+        mc = NULL;
+    else
+        mc = create_message(msg);
+
+    dbus_message_unref(msg);
+
+    return mc;
+}
+
+
 mrp_dbus_msg_type_t mrp_dbus_msg_type(mrp_dbus_msg_t *m)
 {
     return (mrp_dbus_msg_type_t)dbus_message_get_type(m->msg);
@@ -79,6 +79,12 @@ int mrp_dbus_follow_name(mrp_dbus_t *dbus, const char *name,
 /** Stop tracking the given name. */
 int mrp_dbus_forget_name(mrp_dbus_t *dbus, const char *name,
                          mrp_dbus_name_cb_t cb, void *user_data);
+/**
+ * Look up the cached owner of a followed name. Returns TRUE and sets
+ * @owner (to NULL if the name has no owner) if the owner is known.
+ */
+int mrp_dbus_name_owner(mrp_dbus_t *dbus, const char *name,
+                        const char **owner);
 
 /** Export a method to the bus. */
 int mrp_dbus_export_method(mrp_dbus_t *dbus, const char *path,
@@ -164,6 +170,28 @@ int32_t mrp_dbus_call(mrp_dbus_t *dbus, const char *dest,
 /** Cancel an ongoing method call on the bus. */
 int mrp_dbus_call_cancel(mrp_dbus_t *dbus, int32_t id);
 
+/** Opaque type for a batch of pipelined method calls. */
+typedef struct mrp_dbus_batch_s mrp_dbus_batch_t;
+
+/** Type of a batch completion callback. */
+typedef void (*mrp_dbus_batch_cb_t)(mrp_dbus_t *dbus, int ncall, int nerror,
+                                    void *user_data);
+
+/** Create a batch of at most ncall pipelined method calls. */
+mrp_dbus_batch_t *mrp_dbus_batch_create(mrp_dbus_t *dbus, int ncall,
+                                        int timeout);
+
+/** Add a method call to a batch, returning its slot or -1 on error. */
+int mrp_dbus_batch_add(mrp_dbus_batch_t *b, mrp_dbus_msg_t *msg,
+                       mrp_dbus_reply_cb_t cb, void *user_data);
+
+/** Send all calls in a batch, notify cb once all of them are done. */
+int mrp_dbus_batch_submit(mrp_dbus_batch_t *b, mrp_dbus_batch_cb_t cb,
+                          void *user_data);
+
+/** Cancel all pending calls of a batch and free it. */
+void mrp_dbus_batch_cancel(mrp_dbus_batch_t *b);
+
 /** Send a reply to the given method call on the bus. */
 int mrp_dbus_reply(mrp_dbus_t *dbus, mrp_dbus_msg_t *msg, int type, ...);
 
@@ -247,6 +275,13 @@ mrp_dbus_msg_t *mrp_dbus_msg_signal(mrp_dbus_t *bus,
                                     const char *interface,
                                     const char *member);
 
+/**
+ * Create a copy of a method call or signal with the same body, but with
+ * the destination and path replaced (if not NULL).
+ */
+mrp_dbus_msg_t *mrp_dbus_msg_copy(mrp_dbus_t *bus, mrp_dbus_msg_t *m,
+                                  const char *destination, const char *path);
+
 /** Bus message types. */
 typedef enum {
 #   define TYPE(type) MRP_DBUS_MESSAGE_TYPE_##type = DBUS_MESSAGE_TYPE_##type
@@ -27,6 +27,9 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <time.h>
+#include <poll.h>
+
 #include <murphy/common/macros.h>
 #include <murphy/common/mm.h>
 #include <murphy/common/log.h>
@@ -34,107 +37,200 @@
 
 #include <murphy/common/dbus-sdbus.h>
 
-#define USEC_TO_MSEC(usec) ((unsigned int)((usec) / 1000))
-#define MSEC_TO_USEC(msec) ((uint64_t)(msec) * 1000)
+#define USEC_PER_MSEC 1000ULL
+#define USEC_PER_SEC  1000000ULL
+
+/*
+ * sd-bus mainloop integration
+ *
+ * Rather than pumping the bus through a subloop, which needs to query,
+ * (re)build and poll a set of file descriptors on every mainloop iteration,
+ * we register the bus file descriptor directly with the mainloop and map
+ * the bus timeout to a single mainloop timer. The watches and the timer
+ * are only touched when the state of the bus changes, which is after we
+ * have processed the bus or after a message has been queued to it.
+ */
+
+struct mrp_dbus_glue_s {
+    sd_bus         *bus;                 /* bus we're pumping */
+    mrp_mainloop_t *ml;                  /* mainloop we're pumped by */
+    int             fd;                  /* bus file descriptor */
+    mrp_io_watch_t *in;                  /* input watch */
+    mrp_io_watch_t *out;                 /* output watch, when needed */
+    mrp_timer_t    *timer;               /* bus timeout timer */
+    uint64_t        expiry;              /* absolute bus timeout, in usecs */
+    int             busy;                /* processing the bus */
+    int             dead;                /* destroyed while processing */
+};
 
-typedef struct {
-    sd_bus         *bus;
-    mrp_mainloop_t *ml;
-    mrp_subloop_t  *sl;
-    int             events;
-} bus_glue_t;
 
+static void bus_io_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
+                      void *user_data);
+static void bus_timer_cb(mrp_timer_t *t, void *user_data);
 
-static int bus_prepare(void *user_data)
+
+static uint64_t monotonic_usecs(void)
 {
-    MRP_UNUSED(user_data);
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    return FALSE;
+    return (uint64_t)ts.tv_sec * USEC_PER_SEC + ts.tv_nsec / 1000;
 }
 
 
-static int bus_query(void *user_data, struct pollfd *fds, int nfd, int *timeout)
+void mrp_dbus_glue_update(mrp_dbus_glue_t *g)
 {
-    bus_glue_t *b = (bus_glue_t *)user_data;
-    uint64_t    usec;
+    uint64_t     usec, now;
+    unsigned int msecs;
+    int          events;
 
-    if (nfd > 0) {
-        fds[0].fd      = sd_bus_get_fd(b->bus);
-        fds[0].events  = sd_bus_get_events(b->bus) | POLLIN | POLLHUP;
-        fds[0].revents = 0;
+    if (g == NULL || g->busy)
+        return;
 
-        if (sd_bus_get_timeout(b->bus, &usec) < 0)
-            *timeout = -1;
-        else
-            *timeout = USEC_TO_MSEC(usec);
+    if ((events = sd_bus_get_events(g->bus)) < 0)
+        events = 0;
 
-        mrp_debug("fd: %d, events: 0x%x, timeout: %u", fds[0].fd,
-                  fds[0].events, *timeout);
+    if (events & POLLOUT) {
+        if (g->out == NULL)
+            g->out = mrp_add_io_watch(g->ml, g->fd, MRP_IO_EVENT_OUT,
+                                      bus_io_cb, g);
     }
+    else {
+        if (g->out != NULL) {
+            mrp_del_io_watch(g->out);
+            g->out = NULL;
+        }
+    }
+
+    if (sd_bus_get_timeout(g->bus, &usec) <= 0 || usec == (uint64_t)-1) {
+        if (g->timer != NULL) {
+            mrp_del_timer(g->timer);
+            g->timer = NULL;
+        }
 
-    return 1;
+        return;
+    }
+
+    if (g->timer != NULL && usec == g->expiry)
+        return;
+
+    now = monotonic_usecs();
+
+    if (usec > now)
+        msecs = (unsigned int)((usec - now + USEC_PER_MSEC - 1) / USEC_PER_MSEC);
+    else
+        msecs = 0;
+
+    mrp_debug("sd_bus %p timeout in %u msecs", g->bus, msecs);
+
+    g->expiry = usec;
+
+    if (g->timer != NULL)
+        mrp_mod_timer(g->timer, msecs);
+    else
+        g->timer = mrp_add_timer(g->ml, msecs, bus_timer_cb, g);
 }
 
 
-static int bus_check(void *user_data, struct pollfd *fds, int nfd)
+static void bus_process(mrp_dbus_glue_t *g)
 {
-    bus_glue_t *b = (bus_glue_t *)user_data;
+    mrp_debug("processing sd_bus %p", g->bus);
 
-    if (nfd > 0) {
-        b->events = fds[0].revents;
+    g->busy = TRUE;
 
-        if (b->events != 0)
-            return TRUE;
-    }
-    else
-        b->events = 0;
+    while (sd_bus_process(g->bus, NULL) > 0)
+        ;
+
+    sd_bus_flush(g->bus);
 
-    return FALSE;
+    g->busy = FALSE;
+
+    if (g->dead)
+        mrp_free(g);
+    else
+        mrp_dbus_glue_update(g);
 }
 
 
-static void bus_dispatch(void *user_data)
+static void bus_io_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
+                      void *user_data)
 {
-    bus_glue_t *b = (bus_glue_t *)user_data;
+    mrp_dbus_glue_t *g = (mrp_dbus_glue_t *)user_data;
 
-    mrp_debug("dispatching events 0x%x to sd_bus %p", b->events, b->bus);
+    MRP_UNUSED(w);
+    MRP_UNUSED(fd);
 
-    if (b->events & MRP_IO_EVENT_HUP)
+    if (events & MRP_IO_EVENT_HUP)
         mrp_debug("sd_bus peer has closed the connection");
 
-    while (sd_bus_process(b->bus, NULL) > 0)
-        sd_bus_flush(b->bus);
+    bus_process(g);
+}
+
+
+static void bus_timer_cb(mrp_timer_t *t, void *user_data)
+{
+    mrp_dbus_glue_t *g = (mrp_dbus_glue_t *)user_data;
 
-    mrp_debug("done dispatching");
+    MRP_UNUSED(t);
+
+    /* force a rearm, as the bus timeout might not have changed */
+    g->expiry = 0;
+
+    bus_process(g);
 }
 
 
-int mrp_dbus_setup_with_mainloop(mrp_mainloop_t *ml, sd_bus *bus)
+mrp_dbus_glue_t *mrp_dbus_glue_create(mrp_mainloop_t *ml, sd_bus *bus)
 {
-    static mrp_subloop_ops_t bus_ops = {
-        .prepare  = bus_prepare,
-        .query    = bus_query,
-        .check    = bus_check,
-        .dispatch = bus_dispatch
-    };
+    mrp_io_event_t   mask = MRP_IO_EVENT_IN | MRP_IO_EVENT_HUP | MRP_IO_EVENT_ERR;
+    mrp_dbus_glue_t *g;
+
+    if ((g = mrp_allocz(sizeof(*g))) == NULL)
+        return NULL;
+
+    g->bus = bus;
+    g->ml  = ml;
 
-    bus_glue_t *b;
+    if ((g->fd = sd_bus_get_fd(bus)) < 0)
+        goto fail;
 
+    g->in = mrp_add_io_watch(ml, g->fd, mask, bus_io_cb, g);
 
-    if ((b = mrp_allocz(sizeof(*b))) != NULL) {
-        /* XXX TODO: Hmm... is this really needed ? */
-        while (sd_bus_process(bus, NULL) > 0)
-            sd_bus_flush(bus);
+    if (g->in == NULL)
+        goto fail;
 
-        b->bus = bus;
-        b->ml  = ml;
-        b->sl  = mrp_add_subloop(ml, &bus_ops, b);
+    /* process anything that got queued up before we were set up */
+    bus_process(g);
 
-        if (b->sl != NULL)
-            return TRUE;
+    return g;
+
+ fail:
+    mrp_free(g);
+    return NULL;
+}
+
+
+void mrp_dbus_glue_destroy(mrp_dbus_glue_t *g)
+{
+    if (g != NULL) {
+        mrp_del_io_watch(g->in);
+        mrp_del_io_watch(g->out);
+        mrp_del_timer(g->timer);
+
+        g->in    = NULL;
+        g->out   = NULL;
+        g->timer = NULL;
+
+        if (g->busy)
+            g->dead = TRUE;
         else
-            mrp_free(b);
+            mrp_free(g);
     }
+}
+
 
-    return FALSE;
+int mrp_dbus_setup_with_mainloop(mrp_mainloop_t *ml, sd_bus *bus)
+{
+    return mrp_dbus_glue_create(ml, bus) != NULL;
 }
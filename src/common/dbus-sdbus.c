@@ -64,16 +64,28 @@
 #define USEC_TO_MSEC(usec) ((unsigned int)((usec) / 1000))
 #define MSEC_TO_USEC(msec) ((uint64_t)(msec) * 1000)
 
+typedef struct match_node_s match_node_t;
+
 struct mrp_dbus_s {
     char            *address;            /* bus address */
     sd_bus          *bus;                /* actual D-BUS connection */
     mrp_mainloop_t  *ml;                 /* murphy mainloop */
-    mrp_subloop_t   *sl;                 /* subloop for pumping the bus */
+    mrp_dbus_glue_t *glue;               /* mainloop integration */
     mrp_htbl_t      *objects;            /* object path (refcount) table */
     mrp_htbl_t      *methods;            /* method handler table */
-    mrp_htbl_t      *signals;            /* signal handler table */
-    mrp_list_hook_t  name_trackers;      /* peer (name) watchers */
+    mrp_htbl_t      *strings;            /* interned signal match strings */
+    match_node_t    *signals;            /* signal handler match index */
+    mrp_list_hook_t  dead_signals;       /* handlers removed during dispatch */
+    int              signal_busy;        /* signal dispatching nesting level */
+    mrp_htbl_t      *names;              /* name owner cache */
+    int              nname;              /* number of cached names */
+    mrp_list_hook_t  name_queue;         /* names with pending queries */
+    mrp_deferred_t  *name_flush;         /* deferred name queue flushing */
+    int              name_match;         /* NameOwnerChanged match installed */
+    int              name_busy;          /* notifying name trackers */
+    int              name_dead;          /* need to sweep dead trackers */
     mrp_list_hook_t  calls;              /* pending calls */
+    mrp_list_hook_t  batches;            /* pending call batches */
     uint32_t         call_id;            /* next call id */
     const char      *unique_name;        /* our unique D-BUS address */
     int              priv;               /* whether a private connection */
@@ -100,12 +112,11 @@ typedef struct {
 /*
  * Notes:
  *
- * At the moment we administer DBUS method and signal handlers
- * in a very primitive way (subject to be changed later). For
- * every bus instance we maintain two hash tables, one for methods
- * and another for signals. Each method and signal handler is
- * hashed in only by it's method/signal name to a linked list of
- * method or signal handlers.
+ * At the moment we administer DBUS method handlers in a very
+ * primitive way (subject to be changed later). For every bus
+ * instance we maintain a hash table for methods. Each method
+ * handler is hashed in only by it's method name to a linked list
+ * of method handlers.
  *
  * When dispatching a method, we look up the chain with a matching
  * method name, or the chain for "" in case a matching chain is
@@ -113,9 +124,20 @@ typedef struct {
  * received message (by looking at the path, interface and name).
  * Only one such handler is invoked at most.
  *
- * For signals we look up both the chain with a matching name and
- * the chain for "" and invoke all signal handlers that match the
- * received message (regardless of their return value).
+ * Signal handlers are kept in a match index, a trie keyed by member,
+ * interface, path and sender, in this order. Each node of the trie
+ * also has a wildcard branch for handlers which leave the field of
+ * the corresponding level unspecified. All keys are interned strings,
+ * so the branches of a node are hashed by string pointer and a field
+ * of a received message which has not been interned can only match
+ * wildcard branches. Dispatching a signal takes at most two lookups
+ * per level, regardless of the number of registered handlers, and
+ * we invoke all signal handlers that match the received message
+ * (regardless of their return value).
+ *
+ * Senders are indexed only by unique name. Handlers for well-known
+ * names are filed under the wildcard sender branch and are left for
+ * the match rules installed on the bus to filter.
  */
 
 typedef struct {
@@ -139,17 +161,59 @@ typedef struct {
 } handler_t;
 
 #define method_t handler_t
-#define signal_t handler_t
 
+#define MATCH_MEMBER    0               /* trie levels */
+#define MATCH_INTERFACE 1
+#define MATCH_PATH      2
+#define MATCH_SENDER    3
+#define MATCH_NLEVEL    4
+
+typedef struct {
+    char *str;                          /* interned string */
+    int   cnt;                          /* reference count */
+} istr_t;
+
+struct match_node_s {
+    const char      *key;               /* interned key, NULL for wildcard */
+    match_node_t    *parent;            /* parent node, NULL for root */
+    mrp_htbl_t      *next;              /* children by key */
+    match_node_t    *any;               /* wildcard child */
+    int              nchild;            /* number of children */
+    mrp_list_hook_t  handlers;          /* handlers, on the last level */
+};
 
 typedef struct {
-    mrp_list_hook_t     hook;           /* hook to name tracker list */
-    char               *name;           /* name to track */
+    mrp_list_hook_t     hook;           /* to match node handlers */
+    mrp_list_hook_t     dead;           /* to dead signal handlers */
+    match_node_t       *node;           /* match node we're attached to */
+    const char         *sender;         /* interned sender, or NULL */
+    const char         *path;           /* interned path, or NULL */
+    const char         *interface;      /* interned interface, or NULL */
+    const char         *member;         /* interned member, or NULL */
+    mrp_dbus_handler_t  handler;
+    void               *user_data;
+    int                 dead_p;         /* removed during dispatching */
+} signal_t;
+
+
+typedef struct {
+    char            *name;              /* tracked name */
+    char            *owner;             /* current owner, NULL if none */
+    int              known;             /* whether owner is known */
+    int              querying;          /* whether owner query is pending */
+    mrp_list_hook_t  trackers;          /* trackers of this name */
+    mrp_list_hook_t  hook;              /* to queue of names to flush */
+} name_owner_t;
+
+typedef struct {
+    mrp_list_hook_t     hook;           /* hook to name owner trackers */
     mrp_dbus_name_cb_t  cb;             /* status change callback */
     void               *user_data;      /* opaque callback user data */
-    int32_t             qid;            /* initial query ID */
+    int                 notified;       /* whether notified of status */
 } name_tracker_t;
 
+#define NAME_QUERY_TIMEOUT 5000         /* GetNameOwner timeout (msecs) */
+
 
 typedef struct {
     mrp_dbus_t          *dbus;           /* DBUS connection */
@@ -162,6 +226,38 @@ typedef struct {
 } call_t;
 
 
+/*
+ * a batch of pipelined method calls
+ *
+ * All calls of a batch live in a single slot array allocated together
+ * with the batch itself. Each pending call carries a direct pointer to
+ * its slot, so replies need no lookup to find their call.
+ */
+
+typedef struct {
+    mrp_dbus_batch_t    *batch;          /* batch we belong to */
+    mrp_dbus_msg_t      *msg;            /* method call message */
+    mrp_dbus_reply_cb_t  cb;             /* reply notification callback */
+    void                *user_data;      /* opaque callback data */
+    uint64_t             serial;         /* pending call serial, or 0 */
+} batch_call_t;
+
+struct mrp_dbus_batch_s {
+    mrp_dbus_t          *dbus;           /* DBUS connection */
+    mrp_list_hook_t      hook;           /* to list of pending batches */
+    int                  timeout;        /* call timeout */
+    int                  nslot;          /* number of call slots */
+    int                  ncall;          /* number of calls added */
+    int                  npending;       /* number of pending calls */
+    int                  nerror;         /* number of error replies */
+    mrp_dbus_batch_cb_t  cb;             /* batch completion callback */
+    void                *user_data;      /* opaque callback data */
+    int                  busy;           /* callbacks in progress */
+    int                  dead;           /* cancelled or completed */
+    batch_call_t         calls[];        /* call slots */
+};
+
+
 typedef struct {
     mrp_mainloop_t *ml;                  /* mainloop for bus connection */
     const char     *address;             /* address of bus */
@@ -174,13 +270,18 @@ static mrp_htbl_t *buses;
 static int dispatch_signal(sd_bus *b, int r, sd_bus_message *msg, void *data);
 static int dispatch_method(sd_bus *b, int r, sd_bus_message *msg, void *data);
 
-static void purge_name_trackers(mrp_dbus_t *dbus);
+static void purge_names(mrp_dbus_t *dbus);
+static void name_owner_free_cb(void *key, void *entry);
 static void purge_calls(mrp_dbus_t *dbus);
 static void handler_list_free_cb(void *key, void *entry);
 static void handler_free(handler_t *h);
+static void istr_free_cb(void *key, void *entry);
+static match_node_t *match_node_create(match_node_t *parent, const char *key);
+static void purge_signals(mrp_dbus_t *dbus, match_node_t *node);
 static int name_owner_change_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *m,
                                 void *data);
 static void call_free(call_t *call);
+static void purge_batches(mrp_dbus_t *dbus);
 static void object_free_cb(void *key, void *entry);
 
 
@@ -197,45 +298,29 @@ static int purge_objects(void *key, void *entry, void *user_data)
 }
 
 
-static int purge_filters(void *key, void *entry, void *user_data)
-{
-    mrp_dbus_t      *dbus = (mrp_dbus_t *)user_data;
-    handler_list_t  *l    = (handler_list_t *)entry;
-    mrp_list_hook_t *p, *n;
-    handler_t       *h;
-
-    MRP_UNUSED(key);
-
-    mrp_list_foreach(&l->handlers, p, n) {
-        h = mrp_list_entry(p, handler_t, hook);
-        mrp_dbus_remove_filter(dbus,
-                               h->sender, h->path, h->interface,
-                               h->member, NULL);
-    }
-
-    return MRP_HTBL_ITER_MORE;
-}
-
-
 static void dbus_disconnect(mrp_dbus_t *dbus)
 {
     if (dbus) {
         mrp_htbl_remove(buses, dbus->bus, FALSE);
 
         if (dbus->objects) {
-            mrp_htbl_foreach(dbus->signals, purge_objects, dbus);
+            mrp_htbl_foreach(dbus->objects, purge_objects, dbus);
             mrp_htbl_destroy(dbus->objects, TRUE);
         }
 
-        if (dbus->signals) {
-            mrp_htbl_foreach(dbus->signals, purge_filters, dbus);
-            mrp_htbl_destroy(dbus->signals, TRUE);
-        }
+        if (dbus->signals)
+            purge_signals(dbus, dbus->signals);
+        if (dbus->strings)
+            mrp_htbl_destroy(dbus->strings, TRUE);
         if (dbus->methods)
             mrp_htbl_destroy(dbus->methods, TRUE);
 
-        purge_name_trackers(dbus);
+        purge_names(dbus);
         purge_calls(dbus);
+        purge_batches(dbus);
+
+        mrp_dbus_glue_destroy(dbus->glue);
+        dbus->glue = NULL;
 
         if (dbus->bus != NULL) {
             if (dbus->signal_filter)
@@ -326,7 +411,9 @@ mrp_dbus_t *mrp_dbus_connect(mrp_mainloop_t *ml, const char *address,
         return NULL;
 
     mrp_list_init(&dbus->calls);
-    mrp_list_init(&dbus->name_trackers);
+    mrp_list_init(&dbus->batches);
+    mrp_list_init(&dbus->name_queue);
+    mrp_list_init(&dbus->dead_signals);
     mrp_refcnt_init(&dbus->refcnt);
 
     dbus->ml = ml;
@@ -367,7 +454,7 @@ mrp_dbus_t *mrp_dbus_connect(mrp_mainloop_t *ml, const char *address,
      * set up with mainloop
      */
 
-    if (!mrp_dbus_setup_with_mainloop(ml, dbus->bus))
+    if ((dbus->glue = mrp_dbus_glue_create(ml, dbus->bus)) == NULL)
         goto fail;
 
     /*
@@ -399,6 +486,14 @@ mrp_dbus_t *mrp_dbus_connect(mrp_mainloop_t *ml, const char *address,
         goto fail;
     }
 
+    hcfg.free = name_owner_free_cb;
+
+    if ((dbus->names = mrp_htbl_create(&hcfg)) == NULL) {
+        mrp_dbus_error_set(errp, SDBUS_ERROR_FAILED,
+                       "Failed to create DBUS name owner table.");
+        goto fail;
+    }
+
     hcfg.free = handler_list_free_cb;
 
     if ((dbus->methods = mrp_htbl_create(&hcfg)) == NULL) {
@@ -407,7 +502,10 @@ mrp_dbus_t *mrp_dbus_connect(mrp_mainloop_t *ml, const char *address,
         goto fail;
     }
 
-    if ((dbus->signals = mrp_htbl_create(&hcfg)) == NULL) {
+    hcfg.free = istr_free_cb;
+
+    if ((dbus->strings = mrp_htbl_create(&hcfg)) == NULL ||
+        (dbus->signals = match_node_create(NULL, NULL)) == NULL) {
         mrp_dbus_error_set(errp, SDBUS_ERROR_FAILED,
                            "Failed to create DBUS signal table.");
         goto fail;
@@ -432,7 +530,6 @@ mrp_dbus_t *mrp_dbus_connect(mrp_mainloop_t *ml, const char *address,
                             BUS_SERVICE, BUS_PATH, BUS_INTERFACE,
                             BUS_NAME_CHANGED, BUS_SERVICE, NULL);
 
-    mrp_list_init(&dbus->name_trackers);
     dbus->call_id = 1;
 
     if (mrp_htbl_insert(buses, dbus->bus, dbus))
@@ -471,6 +568,7 @@ int mrp_dbus_acquire_name(mrp_dbus_t *dbus, const char *name,
     mrp_dbus_error_init(error);
 
     status = sd_bus_request_name(dbus->bus, name, flags);
+    mrp_dbus_glue_update(dbus->glue);
 
     if (status == SDBUS_NAME_STATUS_OWNER || status == SDBUS_NAME_STATUS_GOTIT)
         return TRUE;
@@ -490,6 +588,7 @@ int mrp_dbus_release_name(mrp_dbus_t *dbus, const char *name,
     mrp_dbus_error_init(error);
 
     status = sd_bus_release_name(dbus->bus, name);
+    mrp_dbus_glue_update(dbus->glue);
 
     if (status == SDBUS_NAME_STATUS_RELEASED)
         return TRUE;
@@ -507,31 +606,337 @@ const char *mrp_dbus_get_unique_name(mrp_dbus_t *dbus)
 }
 
 
-static void name_owner_query_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *m, void *data)
+/*
+ * name owner cache
+ *
+ * We keep a single cache of name owners per bus connection. Every
+ * followed name has a single entry in the cache, with the list of
+ * trackers interested in it. All tracked names share a single match
+ * for NameOwnerChanged, and the owners of all names followed during
+ * one mainloop iteration are queried with a single batch of pipelined
+ * GetNameOwner calls. Once known, the owner of a followed name can be
+ * looked up synchronously with mrp_dbus_name_owner.
+ *
+ * Trackers forgotten from within a notification callback are only
+ * marked dead and get swept when we're done notifying.
+ */
+
+static void name_owner_free(name_owner_t *o)
+{
+    mrp_list_hook_t *p, *n;
+    name_tracker_t  *t;
+
+    if (o == NULL)
+        return;
+
+    mrp_list_delete(&o->hook);
+
+    mrp_list_foreach(&o->trackers, p, n) {
+        t = mrp_list_entry(p, name_tracker_t, hook);
+        mrp_list_delete(&t->hook);
+        mrp_free(t);
+    }
+
+    mrp_free(o->name);
+    mrp_free(o->owner);
+    mrp_free(o);
+}
+
+
+static void name_owner_free_cb(void *key, void *entry)
 {
-    name_tracker_t *t = (name_tracker_t *)data;
-    const char     *owner;
-    int             state;
+    MRP_UNUSED(key);
 
-    if (t->cb != NULL) {                /* tracker still active */
-        t->qid = 0;
-        state  = !mrp_dbus_msg_is_error(m);
+    name_owner_free((name_owner_t *)entry);
+}
 
-        if (!mrp_dbus_msg_read_basic(m, MRP_DBUS_TYPE_STRING, &owner))
-            owner = "<unknown>";
 
-        t->cb(dbus, t->name, state, owner, t->user_data);
+static name_owner_t *name_owner_create(mrp_dbus_t *dbus, const char *name)
+{
+    name_owner_t *o;
+
+    if ((o = mrp_allocz(sizeof(*o))) == NULL)
+        return NULL;
+
+    mrp_list_init(&o->trackers);
+    mrp_list_init(&o->hook);
+
+    if ((o->name = mrp_strdup(name)) == NULL ||
+        !mrp_htbl_insert(dbus->names, o->name, o)) {
+        name_owner_free(o);
+        return NULL;
     }
-    else                                /* already requested to delete */
-        mrp_free(t);
+
+    dbus->nname++;
+
+    return o;
 }
 
 
-static int name_owner_change_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *m, void *data)
+static int name_match_update(mrp_dbus_t *dbus)
+{
+    if (dbus->nname > 0 && !dbus->name_match) {
+        if (!mrp_dbus_install_filter(dbus, BUS_SERVICE, BUS_PATH, BUS_INTERFACE,
+                                     BUS_NAME_CHANGED, NULL))
+            return FALSE;
+
+        dbus->name_match = TRUE;
+    }
+    else if (dbus->nname == 0 && dbus->name_match) {
+        mrp_dbus_remove_filter(dbus, BUS_SERVICE, BUS_PATH, BUS_INTERFACE,
+                               BUS_NAME_CHANGED, NULL);
+        dbus->name_match = FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static void name_owner_release(mrp_dbus_t *dbus, name_owner_t *o)
+{
+    if (!mrp_list_empty(&o->trackers) || o->querying)
+        return;
+
+    if (dbus->name_busy) {
+        dbus->name_dead = TRUE;
+        return;
+    }
+
+    mrp_htbl_remove(dbus->names, o->name, TRUE);
+    dbus->nname--;
+
+    name_match_update(dbus);
+}
+
+
+static int sweep_names_cb(void *key, void *entry, void *user_data)
+{
+    mrp_dbus_t      *dbus = (mrp_dbus_t *)user_data;
+    name_owner_t    *o    = (name_owner_t *)entry;
+    mrp_list_hook_t *p, *n;
+    name_tracker_t  *t;
+
+    MRP_UNUSED(key);
+
+    mrp_list_foreach(&o->trackers, p, n) {
+        t = mrp_list_entry(p, name_tracker_t, hook);
+
+        if (t->cb == NULL) {
+            mrp_list_delete(&t->hook);
+            mrp_free(t);
+        }
+    }
+
+    if (mrp_list_empty(&o->trackers) && !o->querying) {
+        dbus->nname--;
+        return MRP_HTBL_ITER_DELETE | MRP_HTBL_ITER_MORE;
+    }
+    else
+        return MRP_HTBL_ITER_MORE;
+}
+
+
+static void sweep_names(mrp_dbus_t *dbus)
+{
+    if (dbus->name_busy || !dbus->name_dead)
+        return;
+
+    dbus->name_dead = FALSE;
+    mrp_htbl_foreach(dbus->names, sweep_names_cb, dbus);
+
+    name_match_update(dbus);
+}
+
+
+static void name_owner_notify(mrp_dbus_t *dbus, name_owner_t *o, int all)
 {
-    const char      *name, *prev, *next;
     mrp_list_hook_t *p, *n;
     name_tracker_t  *t;
+    const char      *owner = o->owner ? o->owner : "";
+    int              up    = o->owner != NULL;
+
+    dbus->name_busy++;
+
+    mrp_list_foreach(&o->trackers, p, n) {
+        t = mrp_list_entry(p, name_tracker_t, hook);
+
+        if (t->cb == NULL || (t->notified && !all))
+            continue;
+
+        t->notified = TRUE;
+        t->cb(dbus, o->name, up, owner, t->user_data);
+    }
+
+    dbus->name_busy--;
+
+    sweep_names(dbus);
+}
+
+
+static void name_owner_query_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *m, void *data)
+{
+    name_owner_t *o = (name_owner_t *)data;
+    const char   *owner;
+
+    o->querying = FALSE;
+
+    if (m != NULL) {
+        mrp_free(o->owner);
+        o->owner = NULL;
+        o->known = TRUE;
+
+        /* an error reply (NameHasNoOwner) means nobody owns the name */
+        if (!mrp_dbus_msg_is_error(m) &&
+            mrp_dbus_msg_read_basic(m, MRP_DBUS_TYPE_STRING, &owner))
+            o->owner = mrp_strdup(owner);
+    }
+
+    if (mrp_list_empty(&o->trackers))
+        name_owner_release(dbus, o);
+    else
+        name_owner_notify(dbus, o, FALSE);
+}
+
+
+static void name_batch_cb(mrp_dbus_t *dbus, int ncall, int nerror,
+                          void *user_data)
+{
+    MRP_UNUSED(dbus);
+    MRP_UNUSED(user_data);
+
+    mrp_debug("%d name owner queries done, %d failed", ncall, nerror);
+}
+
+
+static int name_query_add(mrp_dbus_batch_t *b, mrp_dbus_t *dbus,
+                          name_owner_t *o)
+{
+    mrp_dbus_msg_t *m;
+    int             slot;
+
+    m = mrp_dbus_msg_method_call(dbus, BUS_SERVICE, BUS_PATH, BUS_INTERFACE, BUS_GET_OWNER);
+
+    if (m == NULL)
+        return FALSE;
+
+    if (mrp_dbus_msg_append_basic(m, MRP_DBUS_TYPE_STRING, o->name))
+        slot = mrp_dbus_batch_add(b, m, name_owner_query_cb, o);
+    else
+        slot = -1;
+
+    mrp_dbus_msg_unref(m);
+
+    return slot >= 0;
+}
+
+
+static void name_flush_cb(mrp_deferred_t *d, void *user_data)
+{
+    mrp_dbus_t       *dbus = (mrp_dbus_t *)user_data;
+    mrp_dbus_batch_t *b;
+    mrp_list_hook_t   queue, sent, *p, *n;
+    name_owner_t     *o;
+    int               nquery;
+
+    mrp_disable_deferred(d);
+
+    if (mrp_list_empty(&dbus->name_queue))
+        return;
+
+    mrp_list_init(&queue);
+    mrp_list_init(&sent);
+    mrp_list_move(&queue, &dbus->name_queue);
+
+    nquery = 0;
+    mrp_list_foreach(&queue, p, n) {
+        o = mrp_list_entry(p, name_owner_t, hook);
+
+        if (!o->known)
+            nquery++;
+    }
+
+    if (nquery > 0)
+        b = mrp_dbus_batch_create(dbus, nquery, NAME_QUERY_TIMEOUT);
+    else
+        b = NULL;
+
+    dbus->name_busy++;
+
+    mrp_list_foreach(&queue, p, n) {
+        o = mrp_list_entry(p, name_owner_t, hook);
+
+        mrp_list_delete(&o->hook);
+
+        if (o->known) {                   /* serve new trackers from cache */
+            name_owner_notify(dbus, o, FALSE);
+            continue;
+        }
+
+        if (b != NULL && name_query_add(b, dbus, o))
+            mrp_list_append(&sent, &o->hook);
+        else {
+            mrp_log_error("Failed to query owner of D-Bus name '%s'.",
+                          o->name);
+            o->querying = FALSE;
+            name_owner_notify(dbus, o, FALSE);
+        }
+    }
+
+    if (b != NULL) {
+        if (mrp_list_empty(&sent))
+            mrp_dbus_batch_cancel(b);
+        else if (!mrp_dbus_batch_submit(b, name_batch_cb, dbus)) {
+            mrp_list_foreach(&sent, p, n) {
+                o = mrp_list_entry(p, name_owner_t, hook);
+
+                mrp_log_error("Failed to query owner of D-Bus name '%s'.",
+                              o->name);
+                o->querying = FALSE;
+                name_owner_notify(dbus, o, FALSE);
+            }
+        }
+
+        mrp_list_foreach(&sent, p, n) {
+            o = mrp_list_entry(p, name_owner_t, hook);
+            mrp_list_delete(&o->hook);
+        }
+    }
+
+    dbus->name_busy--;
+
+    dbus->name_dead = TRUE;
+    sweep_names(dbus);
+}
+
+
+static int name_flush_schedule(mrp_dbus_t *dbus, name_owner_t *o)
+{
+    if (o->querying && mrp_list_empty(&o->hook))  /* query in flight */
+        return TRUE;
+
+    if (dbus->name_flush == NULL) {
+        dbus->name_flush = mrp_add_deferred(dbus->ml, name_flush_cb, dbus);
+
+        if (dbus->name_flush == NULL)
+            return FALSE;
+    }
+
+    if (mrp_list_empty(&o->hook))
+        mrp_list_append(&dbus->name_queue, &o->hook);
+
+    if (!o->known)
+        o->querying = TRUE;
+
+    mrp_enable_deferred(dbus->name_flush);
+
+    return TRUE;
+}
+
+
+static int name_owner_change_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *m, void *data)
+{
+    const char   *name, *prev, *next;
+    name_owner_t *o;
 
     MRP_UNUSED(data);
 
@@ -543,30 +948,14 @@ static int name_owner_change_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *m, void *data)
         !mrp_dbus_msg_read_basic(m, MRP_DBUS_TYPE_STRING, &next))
         return FALSE;
 
-#if 0
-    /*
-     * Notes: XXX TODO
-     *    In principle t->cb could call mrp_dbus_forget for some other D-BUS
-     *    address than name. If that happened to be n (== p->hook.next) this
-     *    would result in a crash or memory corruption in the next iteration
-     *    of this loop (when handling n). We can easily get around this
-     *    problem by
-     *
-     *     1. administering in mrp_dbus_t that we're handing a NameOwnerChange
-     *     2. checking for this in mrp_dbus_forget_name and if it is the case
-     *        only marking the affected entry for deletion
-     *     3. removing entries marked for deletion in this loop (or just
-     *        ignoring them and making another pass in the end removing any
-     *        such entry).
-     */
-#endif
+    if ((o = mrp_htbl_lookup(dbus->names, (void *)name)) == NULL)
+        return TRUE;
 
-    mrp_list_foreach(&dbus->name_trackers, p, n) {
-        t = mrp_list_entry(p, name_tracker_t, hook);
+    mrp_free(o->owner);
+    o->owner = (next && *next) ? mrp_strdup(next) : NULL;
+    o->known = TRUE;
 
-        if (!strcmp(name, t->name))
-            t->cb(dbus, name, next && *next, next, t->user_data);
-    }
+    name_owner_notify(dbus, o, TRUE);
 
     return TRUE;
 }
@@ -575,34 +964,33 @@ static int name_owner_change_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *m, void *data)
 int mrp_dbus_follow_name(mrp_dbus_t *dbus, const char *name,
                          mrp_dbus_name_cb_t cb, void *user_data)
 {
+    name_owner_t   *o;
     name_tracker_t *t;
 
-    if ((t = mrp_allocz(sizeof(*t))) != NULL) {
-        if ((t->name = mrp_strdup(name)) != NULL) {
-            t->cb        = cb;
-            t->user_data = user_data;
-
-            if (mrp_dbus_install_filter(dbus,
-                                        BUS_SERVICE, BUS_PATH, BUS_INTERFACE,
-                                        BUS_NAME_CHANGED, name,
-                                        NULL)) {
-                mrp_list_append(&dbus->name_trackers, &t->hook);
-
-                t->qid = mrp_dbus_call(dbus,
-                                       BUS_SERVICE, BUS_PATH, BUS_INTERFACE,
-                                       BUS_GET_OWNER, 5000,
-                                       name_owner_query_cb, t,
-                                       MRP_DBUS_TYPE_STRING, t->name,
-                                       MRP_DBUS_TYPE_INVALID);
-                return TRUE;
-            }
-            else {
-                mrp_free(t->name);
-                mrp_free(t);
-            }
-        }
+    if ((o = mrp_htbl_lookup(dbus->names, (void *)name)) == NULL)
+        if ((o = name_owner_create(dbus, name)) == NULL)
+            return FALSE;
+
+    if ((t = mrp_allocz(sizeof(*t))) == NULL)
+        goto fail;
+
+    mrp_list_init(&t->hook);
+    t->cb        = cb;
+    t->user_data = user_data;
+
+    mrp_list_append(&o->trackers, &t->hook);
+
+    if (!name_match_update(dbus) || !name_flush_schedule(dbus, o)) {
+        mrp_list_delete(&t->hook);
+        mrp_free(t);
+        goto fail;
     }
 
+    return TRUE;
+
+ fail:
+    name_owner_release(dbus, o);
+
     return FALSE;
 }
 
@@ -611,26 +999,25 @@ int mrp_dbus_forget_name(mrp_dbus_t *dbus, const char *name,
                          mrp_dbus_name_cb_t cb, void *user_data)
 {
     mrp_list_hook_t *p, *n;
+    name_owner_t    *o;
     name_tracker_t  *t;
 
-    mrp_dbus_remove_filter(dbus,
-                           BUS_SERVICE, BUS_PATH, BUS_INTERFACE,
-                           BUS_NAME_CHANGED, name,
-                           NULL);
+    if ((o = mrp_htbl_lookup(dbus->names, (void *)name)) == NULL)
+        return FALSE;
 
-    mrp_list_foreach(&dbus->name_trackers, p, n) {
+    mrp_list_foreach(&o->trackers, p, n) {
         t = mrp_list_entry(p, name_tracker_t, hook);
 
-        if (t->cb == cb && t->user_data == user_data && !strcmp(t->name,name)) {
-            mrp_list_delete(&t->hook);
-            mrp_free(t->name);
-
-            if (!t->qid)
-                mrp_free(t);
+        if (t->cb == cb && t->user_data == user_data) {
+            if (dbus->name_busy) {
+                t->cb           = NULL;
+                t->user_data    = NULL;
+                dbus->name_dead = TRUE;
+            }
             else {
-                t->cb        = NULL;
-                t->user_data = NULL;
-                t->name      = NULL;
+                mrp_list_delete(&t->hook);
+                mrp_free(t);
+                name_owner_release(dbus, o);
             }
 
             return TRUE;
@@ -641,22 +1028,37 @@ int mrp_dbus_forget_name(mrp_dbus_t *dbus, const char *name,
 }
 
 
-static void purge_name_trackers(mrp_dbus_t *dbus)
+int mrp_dbus_name_owner(mrp_dbus_t *dbus, const char *name,
+                        const char **owner)
 {
-    mrp_list_hook_t *p, *n;
-    name_tracker_t  *t;
+    name_owner_t *o;
 
-    mrp_list_foreach(&dbus->name_trackers, p, n) {
-        t = mrp_list_entry(p, name_tracker_t, hook);
+    o = dbus->names ? mrp_htbl_lookup(dbus->names, (void *)name) : NULL;
 
-        mrp_list_delete(p);
-        mrp_dbus_remove_filter(dbus,
-                               BUS_SERVICE, BUS_PATH, BUS_INTERFACE,
-                               BUS_NAME_CHANGED, t->name,
-                               NULL);
-        mrp_free(t->name);
-        mrp_free(t);
+    if (o == NULL || !o->known)
+        return FALSE;
+
+    if (owner != NULL)
+        *owner = o->owner;
+
+    return TRUE;
+}
+
+
+static void purge_names(mrp_dbus_t *dbus)
+{
+    mrp_del_deferred(dbus->name_flush);
+    dbus->name_flush = NULL;
+
+    mrp_list_init(&dbus->name_queue);
+
+    if (dbus->names != NULL) {
+        mrp_htbl_destroy(dbus->names, TRUE);
+        dbus->names = NULL;
     }
+
+    dbus->nname = 0;
+    name_match_update(dbus);
 }
 
 
@@ -733,88 +1135,391 @@ static inline void handler_list_free(handler_list_t *l)
 }
 
 
-static void handler_list_free_cb(void *key, void *entry)
-{
-    MRP_UNUSED(key);
+static void handler_list_free_cb(void *key, void *entry)
+{
+    MRP_UNUSED(key);
+
+    handler_list_free((handler_list_t *)entry);
+}
+
+
+static inline int handler_specificity(handler_t *h)
+{
+    int score = 0;
+
+    if (h->path && *h->path)
+        score |= 0x4;
+    if (h->interface && *h->interface)
+        score |= 0x2;
+    if (h->member && *h->member)
+        score |= 0x1;
+
+    return score;
+}
+
+
+static void handler_list_insert(handler_list_t *l, handler_t *handler)
+{
+    mrp_list_hook_t *p, *n;
+    handler_t       *h;
+    int              score;
+
+    score = handler_specificity(handler);
+
+    mrp_list_foreach(&l->handlers, p, n) {
+        h = mrp_list_entry(p, handler_t, hook);
+
+        if (score >= handler_specificity(h)) {
+            mrp_list_append(h->hook.prev, &handler->hook);  /* add before h */
+            return;
+        }
+    }
+
+    mrp_list_append(&l->handlers, &handler->hook);
+}
+
+
+static handler_t *handler_list_lookup(handler_list_t *l, const char *path,
+                                      const char *interface, const char *member,
+                                      mrp_dbus_handler_t handler,
+                                      void *user_data)
+{
+    mrp_list_hook_t *p, *n;
+    handler_t       *h;
+
+    mrp_list_foreach(&l->handlers, p, n) {
+        h = mrp_list_entry(p, handler_t, hook);
+
+        if (h->handler == handler && user_data == h->user_data &&
+            path      && !strcmp(path, h->path) &&
+            interface && !strcmp(interface, h->interface) &&
+            member    && !strcmp(member, h->member))
+            return h;
+    }
+
+    return NULL;
+}
+
+
+static handler_t *handler_list_find(handler_list_t *l, const char *path,
+                                    const char *interface, const char *member)
+{
+#define MATCHES(h, field) (!*field || !*h->field || !strcmp(field, h->field))
+    mrp_list_hook_t *p, *n;
+    handler_t       *h;
+
+    mrp_list_foreach(&l->handlers, p, n) {
+        h = mrp_list_entry(p, handler_t, hook);
+
+        if (MATCHES(h, path) && MATCHES(h, interface) && MATCHES(h, member))
+            return h;
+    }
+
+    return NULL;
+#undef MATCHES
+}
+
+
+static void istr_free_cb(void *key, void *entry)
+{
+    istr_t *s = (istr_t *)entry;
+
+    MRP_UNUSED(key);
+
+    mrp_free(s->str);
+    mrp_free(s);
+}
+
+
+static int intern_string(mrp_dbus_t *dbus, const char *str, const char **ip)
+{
+    istr_t *s;
+
+    if (str == NULL || !*str) {
+        *ip = NULL;
+        return TRUE;
+    }
+
+    if ((s = mrp_htbl_lookup(dbus->strings, (void *)str)) != NULL) {
+        s->cnt++;
+        *ip = s->str;
+        return TRUE;
+    }
+
+    if ((s = mrp_allocz(sizeof(*s))) == NULL)
+        return FALSE;
+
+    if ((s->str = mrp_strdup(str)) == NULL) {
+        mrp_free(s);
+        return FALSE;
+    }
+
+    s->cnt = 1;
+
+    if (!mrp_htbl_insert(dbus->strings, s->str, s)) {
+        istr_free_cb(NULL, s);
+        return FALSE;
+    }
+
+    *ip = s->str;
+
+    return TRUE;
+}
+
+
+static void release_string(mrp_dbus_t *dbus, const char *str)
+{
+    istr_t *s;
+
+    if (str == NULL)
+        return;
+
+    if ((s = mrp_htbl_lookup(dbus->strings, (void *)str)) != NULL)
+        if (--s->cnt <= 0)
+            mrp_htbl_remove(dbus->strings, (void *)str, TRUE);
+}
+
+
+static int interned_string(mrp_dbus_t *dbus, const char *str, const char **ip)
+{
+    istr_t *s;
+
+    if (str == NULL || !*str) {
+        *ip = NULL;
+        return TRUE;
+    }
+
+    if ((s = mrp_htbl_lookup(dbus->strings, (void *)str)) != NULL) {
+        *ip = s->str;
+        return TRUE;
+    }
+    else {
+        *ip = NULL;
+        return FALSE;
+    }
+}
+
+
+static inline const char *sender_key(const char *sender)
+{
+    /* only unique names are indexed, see the notes above */
+    if (sender != NULL && sender[0] == ':')
+        return sender;
+    else
+        return NULL;
+}
+
+
+static match_node_t *match_node_create(match_node_t *parent, const char *key)
+{
+    match_node_t *node;
+
+    if ((node = mrp_allocz(sizeof(*node))) != NULL) {
+        node->parent = parent;
+        node->key    = key;
+        mrp_list_init(&node->handlers);
+    }
+
+    return node;
+}
+
+
+static match_node_t *match_node_child(match_node_t *node, const char *key,
+                                      int create)
+{
+    mrp_htbl_config_t  hcfg;
+    match_node_t      *child;
+
+    if (key == NULL)
+        child = node->any;
+    else if (node->next != NULL)
+        child = mrp_htbl_lookup(node->next, (void *)key);
+    else
+        child = NULL;
+
+    if (child != NULL || !create)
+        return child;
+
+    if (key != NULL && node->next == NULL) {
+        /* keys are interned, so hash and compare them by address */
+        mrp_clear(&hcfg);
+        hcfg.comp = bus_cmp;
+        hcfg.hash = bus_hash;
+
+        if ((node->next = mrp_htbl_create(&hcfg)) == NULL)
+            return NULL;
+    }
+
+    if ((child = match_node_create(node, key)) == NULL)
+        return NULL;
+
+    if (key == NULL)
+        node->any = child;
+    else {
+        if (!mrp_htbl_insert(node->next, (void *)key, child)) {
+            mrp_free(child);
+            return NULL;
+        }
+    }
+
+    node->nchild++;
+
+    return child;
+}
+
+
+static void match_node_prune(match_node_t *node)
+{
+    match_node_t *parent;
+
+    while ((parent = node->parent) != NULL &&
+           node->nchild == 0 && mrp_list_empty(&node->handlers)) {
+        if (node->key == NULL)
+            parent->any = NULL;
+        else
+            mrp_htbl_remove(parent->next, (void *)node->key, FALSE);
+
+        parent->nchild--;
+
+        if (node->next != NULL)
+            mrp_htbl_destroy(node->next, FALSE);
+        mrp_free(node);
+
+        node = parent;
+    }
+}
+
+
+static match_node_t *match_node_lookup(match_node_t *root, const char **keys,
+                                       int create)
+{
+    match_node_t *node, *child;
+    int           i;
+
+    for (i = 0, node = root; i < MATCH_NLEVEL; i++, node = child) {
+        if ((child = match_node_child(node, keys[i], create)) == NULL) {
+            if (create)
+                match_node_prune(node);
+            return NULL;
+        }
+    }
+
+    return node;
+}
+
+
+static void signal_free(mrp_dbus_t *dbus, signal_t *s)
+{
+    if (s != NULL) {
+        release_string(dbus, s->sender);
+        release_string(dbus, s->path);
+        release_string(dbus, s->interface);
+        release_string(dbus, s->member);
+
+        mrp_free(s);
+    }
+}
+
+
+static signal_t *signal_alloc(mrp_dbus_t *dbus, const char *sender,
+                              const char *path, const char *interface,
+                              const char *member, mrp_dbus_handler_t handler,
+                              void *user_data)
+{
+    signal_t *s;
+
+    if ((s = mrp_allocz(sizeof(*s))) == NULL)
+        return NULL;
+
+    mrp_list_init(&s->hook);
+    mrp_list_init(&s->dead);
+
+    if (!intern_string(dbus, sender   , &s->sender)    ||
+        !intern_string(dbus, path     , &s->path)      ||
+        !intern_string(dbus, interface, &s->interface) ||
+        !intern_string(dbus, member   , &s->member)) {
+        signal_free(dbus, s);
+        return NULL;
+    }
+
+    s->handler   = handler;
+    s->user_data = user_data;
 
-    handler_list_free((handler_list_t *)entry);
+    return s;
 }
 
 
-static inline int handler_specificity(handler_t *h)
+static void signal_remove(mrp_dbus_t *dbus, signal_t *s)
 {
-    int score = 0;
+    match_node_t *node;
 
-    if (h->path && *h->path)
-        score |= 0x4;
-    if (h->interface && *h->interface)
-        score |= 0x2;
-    if (h->member && *h->member)
-        score |= 0x1;
+    /* don't pull the index from under an ongoing dispatch */
+    if (dbus->signal_busy) {
+        if (!s->dead_p) {
+            s->dead_p = TRUE;
+            mrp_list_append(&dbus->dead_signals, &s->dead);
+        }
+        return;
+    }
 
-    return score;
+    node = s->node;
+
+    mrp_list_delete(&s->hook);
+    mrp_list_delete(&s->dead);
+    signal_free(dbus, s);
+
+    if (node != NULL)
+        match_node_prune(node);
 }
 
 
-static void handler_list_insert(handler_list_t *l, handler_t *handler)
+static void purge_dead_signals(mrp_dbus_t *dbus)
 {
     mrp_list_hook_t *p, *n;
-    handler_t       *h;
-    int              score;
-
-    score = handler_specificity(handler);
+    signal_t        *s;
 
-    mrp_list_foreach(&l->handlers, p, n) {
-        h = mrp_list_entry(p, handler_t, hook);
-
-        if (score >= handler_specificity(h)) {
-            mrp_list_append(h->hook.prev, &handler->hook);  /* add before h */
-            return;
-        }
+    mrp_list_foreach(&dbus->dead_signals, p, n) {
+        s = mrp_list_entry(p, signal_t, dead);
+        signal_remove(dbus, s);
     }
-
-    mrp_list_append(&l->handlers, &handler->hook);
 }
 
 
-static handler_t *handler_list_lookup(handler_list_t *l, const char *path,
-                                      const char *interface, const char *member,
-                                      mrp_dbus_handler_t handler,
-                                      void *user_data)
+static int purge_signals_cb(void *key, void *entry, void *user_data)
 {
-    mrp_list_hook_t *p, *n;
-    handler_t       *h;
-
-    mrp_list_foreach(&l->handlers, p, n) {
-        h = mrp_list_entry(p, handler_t, hook);
+    MRP_UNUSED(key);
 
-        if (h->handler == handler && user_data == h->user_data &&
-            path      && !strcmp(path, h->path) &&
-            interface && !strcmp(interface, h->interface) &&
-            member    && !strcmp(member, h->member))
-            return h;
-    }
+    purge_signals((mrp_dbus_t *)user_data, (match_node_t *)entry);
 
-    return NULL;
+    return MRP_HTBL_ITER_MORE;
 }
 
 
-static handler_t *handler_list_find(handler_list_t *l, const char *path,
-                                    const char *interface, const char *member)
+static void purge_signals(mrp_dbus_t *dbus, match_node_t *node)
 {
-#define MATCHES(h, field) (!*field || !*h->field || !strcmp(field, h->field))
     mrp_list_hook_t *p, *n;
-    handler_t       *h;
+    signal_t        *s;
 
-    mrp_list_foreach(&l->handlers, p, n) {
-        h = mrp_list_entry(p, handler_t, hook);
+    if (node->next != NULL) {
+        mrp_htbl_foreach(node->next, purge_signals_cb, dbus);
+        mrp_htbl_destroy(node->next, FALSE);
+    }
 
-        if (MATCHES(h, path) && MATCHES(h, interface) && MATCHES(h, member))
-            return h;
+    if (node->any != NULL)
+        purge_signals(dbus, node->any);
+
+    mrp_list_foreach(&node->handlers, p, n) {
+        s = mrp_list_entry(p, signal_t, hook);
+
+        mrp_dbus_remove_filter(dbus,
+                               s->sender, s->path, s->interface,
+                               s->member, NULL);
+        mrp_list_delete(&s->hook);
+        mrp_list_delete(&s->dead);
+        signal_free(dbus, s);
     }
 
-    return NULL;
-#undef MATCHES
+    mrp_free(node);
 }
 
 
@@ -960,32 +1665,30 @@ int mrp_dbus_add_signal_handler(mrp_dbus_t *dbus, const char *sender,
                                 const char *member, mrp_dbus_handler_t handler,
                                 void *user_data)
 {
-    handler_list_t *signals;
-    handler_t      *s;
+    const char   *keys[MATCH_NLEVEL];
+    match_node_t *node;
+    signal_t     *s;
 
-    if ((signals = mrp_htbl_lookup(dbus->signals, (void *)member)) == NULL) {
-        if ((signals = handler_list_alloc(member)) == NULL)
-            return FALSE;
+    s = signal_alloc(dbus, sender, path, interface, member, handler, user_data);
 
-        if (!mrp_htbl_insert(dbus->signals, signals->member, signals)) {
-            handler_list_free(signals);
-            return FALSE;
-        }
-    }
+    if (s == NULL)
+        return FALSE;
 
-    s = handler_alloc(sender, path, interface, member, handler, user_data);
-    if (s != NULL) {
-        handler_list_insert(signals, s);
-        return TRUE;
-    }
-    else {
-        handler_free(s);
-        if (mrp_list_empty(&signals->handlers))
-            mrp_htbl_remove(dbus->signals, signals->member, TRUE);
+    keys[MATCH_MEMBER]    = s->member;
+    keys[MATCH_INTERFACE] = s->interface;
+    keys[MATCH_PATH]      = s->path;
+    keys[MATCH_SENDER]    = sender_key(s->sender);
+
+    if ((node = match_node_lookup(dbus->signals, keys, TRUE)) == NULL) {
+        signal_free(dbus, s);
         return FALSE;
     }
-}
 
+    s->node = node;
+    mrp_list_append(&node->handlers, &s->hook);
+
+    return TRUE;
+}
 
 
 int mrp_dbus_del_signal_handler(mrp_dbus_t *dbus, const char *sender,
@@ -993,27 +1696,32 @@ int mrp_dbus_del_signal_handler(mrp_dbus_t *dbus, const char *sender,
                                 const char *member, mrp_dbus_handler_t handler,
                                 void *user_data)
 {
-    handler_list_t *signals;
-    handler_t      *s;
-
-    MRP_UNUSED(sender);
+    const char      *keys[MATCH_NLEVEL], *isender;
+    match_node_t    *node;
+    mrp_list_hook_t *p, *n;
+    signal_t        *s;
 
-    if ((signals = mrp_htbl_lookup(dbus->signals, (void *)member)) == NULL)
+    if (!interned_string(dbus, sender   , &isender)               ||
+        !interned_string(dbus, path     , &keys[MATCH_PATH])      ||
+        !interned_string(dbus, interface, &keys[MATCH_INTERFACE]) ||
+        !interned_string(dbus, member   , &keys[MATCH_MEMBER]))
         return FALSE;
 
-    s = handler_list_lookup(signals, path, interface, member,
-                            handler, user_data);
-    if (s != NULL) {
-        mrp_list_delete(&s->hook);
-        handler_free(s);
+    keys[MATCH_SENDER] = sender_key(isender);
+
+    if ((node = match_node_lookup(dbus->signals, keys, FALSE)) == NULL)
+        return FALSE;
 
-        if (mrp_list_empty(&signals->handlers))
-            mrp_htbl_remove(dbus->signals, (void *)member, TRUE);
+    mrp_list_foreach(&node->handlers, p, n) {
+        s = mrp_list_entry(p, signal_t, hook);
 
-        return TRUE;
+        if (s->handler == handler && s->user_data == user_data && !s->dead_p) {
+            signal_remove(dbus, s);
+            return TRUE;
+        }
     }
-    else
-        return FALSE;
+
+    return FALSE;
 }
 
 
@@ -1081,7 +1789,7 @@ int mrp_dbus_install_filterv(mrp_dbus_t *dbus, const char *sender,
 
     va_list   ap;
     char      filter[1024], *p, argn[16], *val;
-    int       n, l, i;
+    int       n, l, i, status;
 
     p = filter;
     n = sizeof(filter);
@@ -1101,7 +1809,10 @@ int mrp_dbus_install_filterv(mrp_dbus_t *dbus, const char *sender,
     }
     va_end(ap);
 
-    if (sd_bus_add_match(dbus->bus, filter, NULL, NULL) != 0) {
+    status = sd_bus_add_match(dbus->bus, filter, NULL, NULL);
+    mrp_dbus_glue_update(dbus->glue);
+
+    if (status != 0) {
         mrp_log_error("Failed to install filter '%s'.", filter);
 
         return FALSE;
@@ -1155,6 +1866,7 @@ int mrp_dbus_remove_filterv(mrp_dbus_t *dbus, const char *sender,
     va_end(ap);
 
     sd_bus_remove_match(dbus->bus, filter, NULL, NULL);
+    mrp_dbus_glue_update(dbus->glue);
 
     return TRUE;
 #undef ADD_TAG
@@ -1346,20 +2058,52 @@ static int dispatch_method(sd_bus *bus,int ret, sd_bus_message *msg, void *data)
 }
 
 
+static void dispatch_matches(mrp_dbus_t *dbus, match_node_t *node, int level,
+                             const char **keys, sd_bus_message *msg,
+                             mrp_dbus_msg_t **mp, int *handled)
+{
+    mrp_list_hook_t *p, *n;
+    match_node_t    *child;
+    signal_t        *s;
+
+    if (level == MATCH_NLEVEL) {
+        mrp_list_foreach(&node->handlers, p, n) {
+            s = mrp_list_entry(p, signal_t, hook);
+
+            if (s->dead_p)
+                continue;
+
+            sd_bus_message_rewind(msg, TRUE);
+
+            if (*mp == NULL)
+                *mp = create_message(msg, TRUE);
+
+            s->handler(dbus, *mp, s->user_data);
+            *handled = TRUE;
+        }
+
+        return;
+    }
+
+    if (keys[level] != NULL &&
+        (child = match_node_child(node, keys[level], FALSE)) != NULL)
+        dispatch_matches(dbus, child, level + 1, keys, msg, mp, handled);
+
+    if ((child = node->any) != NULL)
+        dispatch_matches(dbus, child, level + 1, keys, msg, mp, handled);
+}
+
+
 static int dispatch_signal(sd_bus *bus,int ret, sd_bus_message *msg, void *data)
 {
-#define MATCHES(h, field) (!*field || !h->field || !*h->field || \
-                           !strcmp(field, h->field))
     mrp_dbus_t     *dbus      = (mrp_dbus_t *)data;
     mrp_dbus_msg_t *m         = NULL;
     const char     *path      = sd_bus_message_get_path(msg);
     const char     *interface = sd_bus_message_get_interface(msg);
     const char     *member    = sd_bus_message_get_member(msg);
-    mrp_list_hook_t *p, *n;
-    handler_list_t  *l;
-    handler_t       *h;
-    int              retried = FALSE;
-    int              handled = FALSE;
+    const char     *sender    = sd_bus_message_get_sender(msg);
+    const char     *keys[MATCH_NLEVEL];
+    int             handled = FALSE;
 
     MRP_UNUSED(bus);
     MRP_UNUSED(ret);
@@ -1370,29 +2114,19 @@ static int dispatch_signal(sd_bus *bus,int ret, sd_bus_message *msg, void *data)
     mrp_debug("%s(path='%s', interface='%s', member='%s')...",
               __FUNCTION__, SAFESTR(path), SAFESTR(interface), SAFESTR(member));
 
-    if ((l = mrp_htbl_lookup(dbus->signals, (void *)member)) != NULL) {
-    retry:
-        mrp_list_foreach(&l->handlers, p, n) {
-            h = mrp_list_entry(p, handler_t, hook);
-
-            if (MATCHES(h,path) && MATCHES(h,interface) && MATCHES(h,member)) {
-                sd_bus_message_rewind(msg, TRUE);
+    /* fields we have never interned can only match wildcards */
+    interned_string(dbus, member   , &keys[MATCH_MEMBER]);
+    interned_string(dbus, interface, &keys[MATCH_INTERFACE]);
+    interned_string(dbus, path     , &keys[MATCH_PATH]);
+    interned_string(dbus, sender   , &keys[MATCH_SENDER]);
+    keys[MATCH_SENDER] = sender_key(keys[MATCH_SENDER]);
 
-                if (m == NULL)
-                    m = create_message(msg, TRUE);
-
-                h->handler(dbus, m, h->user_data);
-                handled = TRUE;
-            }
-        }
-    }
+    dbus->signal_busy++;
+    dispatch_matches(dbus, dbus->signals, 0, keys, msg, &m, &handled);
+    dbus->signal_busy--;
 
-    if (!retried) {
-        if ((l = mrp_htbl_lookup(dbus->signals, "")) != NULL) {
-            retried = TRUE;
-            goto retry;
-        }
-    }
+    if (!dbus->signal_busy)
+        purge_dead_signals(dbus);
 
     if (!handled)
         mrp_debug("Unhandled signal path=%s, %s.%s.", SAFESTR(path),
@@ -1401,7 +2135,6 @@ static int dispatch_signal(sd_bus *bus,int ret, sd_bus_message *msg, void *data)
     mrp_dbus_msg_unref(m);
 
     return FALSE;
-#undef MATCHES
 #undef SAFESTR
 }
 
@@ -1499,7 +2232,7 @@ static int call_reply_cb(sd_bus *bus, int ret, sd_bus_message *msg,
                          void *user_data)
 {
     call_t         *call  = (call_t *)user_data;
-    mrp_dbus_msg_t *reply = create_message(msg, TRUE);
+    mrp_dbus_msg_t *reply;
     sd_bus_error    error;
 
     MRP_UNUSED(bus);
@@ -1594,6 +2327,8 @@ int32_t mrp_dbus_call(mrp_dbus_t *dbus, const char *dest, const char *path,
         call->msg = msg;
     }
 
+    mrp_dbus_glue_update(dbus->glue);
+
     return id;
 
  fail:
@@ -1608,8 +2343,10 @@ int mrp_dbus_send_msg(mrp_dbus_t *dbus, mrp_dbus_msg_t *m)
 {
     /*bus_message_dump(m->msg);*/
 
-    if (sd_bus_send(dbus->bus, m->msg, NULL) == 0)
+    if (sd_bus_send(dbus->bus, m->msg, NULL) == 0) {
+        mrp_dbus_glue_update(dbus->glue);
         return TRUE;
+    }
     else
         return FALSE;
 }
@@ -1657,6 +2394,7 @@ int mrp_dbus_reply(mrp_dbus_t *dbus, mrp_dbus_msg_t *m, int type, ...)
     if (sd_bus_send(dbus->bus, rpl, NULL) != 0)
         goto fail;
 
+    mrp_dbus_glue_update(dbus->glue);
     sd_bus_message_unref(rpl);
 
     return TRUE;
@@ -1691,6 +2429,7 @@ int mrp_dbus_reply_error(mrp_dbus_t *dbus, mrp_dbus_msg_t *m,
     if (sd_bus_send(dbus->bus, rpl, NULL) != 0)
         goto fail;
 
+    mrp_dbus_glue_update(dbus->glue);
     sd_bus_message_unref(rpl);
 
     return TRUE;
@@ -1702,6 +2441,198 @@ int mrp_dbus_reply_error(mrp_dbus_t *dbus, mrp_dbus_msg_t *m,
 }
 
 
+static void batch_free(mrp_dbus_batch_t *b)
+{
+    batch_call_t *call;
+    int           i;
+
+    mrp_list_delete(&b->hook);
+
+    for (i = 0, call = b->calls; i < b->ncall; i++, call++) {
+        if (call->serial != 0)
+            sd_bus_send_with_reply_cancel(b->dbus->bus, call->serial);
+
+        mrp_dbus_msg_unref(call->msg);
+    }
+
+    mrp_free(b);
+}
+
+
+mrp_dbus_batch_t *mrp_dbus_batch_create(mrp_dbus_t *dbus, int ncall,
+                                        int timeout)
+{
+    mrp_dbus_batch_t *b;
+
+    if (ncall <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    b = mrp_allocz(sizeof(*b) + ncall * sizeof(b->calls[0]));
+
+    if (b != NULL) {
+        mrp_list_init(&b->hook);
+
+        b->dbus    = dbus;
+        b->nslot   = ncall;
+        b->timeout = timeout;
+    }
+
+    return b;
+}
+
+
+int mrp_dbus_batch_add(mrp_dbus_batch_t *b, mrp_dbus_msg_t *msg,
+                       mrp_dbus_reply_cb_t cb, void *user_data)
+{
+    batch_call_t *call;
+
+    if (b->cb != NULL || b->ncall >= b->nslot || msg == NULL ||
+        !mrp_dbus_msg_is_method_call(msg)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    call = b->calls + b->ncall;
+
+    call->batch     = b;
+    call->msg       = mrp_dbus_msg_ref(msg);
+    call->cb        = cb;
+    call->user_data = user_data;
+
+    return b->ncall++;
+}
+
+
+static int batch_reply_cb(sd_bus *bus, int ret, sd_bus_message *msg,
+                          void *user_data)
+{
+    batch_call_t     *call = (batch_call_t *)user_data;
+    mrp_dbus_batch_t *b    = call->batch;
+    mrp_dbus_msg_t   *reply;
+    sd_bus_message   *err;
+    sd_bus_error      error;
+
+    call->serial = 0;
+    b->npending--;
+
+    if (ret == 0) {
+        reply = create_message(msg, TRUE);
+        sd_bus_message_rewind(reply->msg, TRUE);
+
+        if (mrp_dbus_msg_is_error(reply))
+            b->nerror++;
+    }
+    else {
+        if (ret == ETIMEDOUT || ret == -ETIMEDOUT)
+            error = SD_BUS_ERROR_MAKE(MRP_DBUS_ERROR_TIMEOUT,
+                                      "D-Bus call timed out");
+        else
+            error = SD_BUS_ERROR_MAKE(MRP_DBUS_ERROR_FAILED,
+                                      "D-Bus call failed");
+
+        err = NULL;
+
+        if (sd_bus_message_new_method_error(bus, call->msg->msg,
+                                            &error, &err) == 0)
+            reply = create_message(err, FALSE);
+        else
+            reply = NULL;
+
+        b->nerror++;
+    }
+
+    b->busy++;
+
+    if (call->cb != NULL && !b->dead)
+        call->cb(b->dbus, reply, call->user_data);
+
+    if (b->npending == 0 && !b->dead) {
+        b->dead = TRUE;
+        b->cb(b->dbus, b->ncall, b->nerror, b->user_data);
+    }
+
+    b->busy--;
+
+    mrp_dbus_msg_unref(reply);
+
+    if (b->dead && !b->busy)
+        batch_free(b);
+
+    return TRUE;
+}
+
+
+int mrp_dbus_batch_submit(mrp_dbus_batch_t *b, mrp_dbus_batch_cb_t cb,
+                          void *user_data)
+{
+    mrp_dbus_t   *dbus = b->dbus;
+    batch_call_t *call;
+    int           i;
+
+    if (b->cb != NULL || cb == NULL || b->ncall == 0) {
+        errno = EINVAL;
+        return FALSE;
+    }
+
+    b->cb        = cb;
+    b->user_data = user_data;
+
+    /*
+     * Notes:
+     *     We queue all the calls before returning to the mainloop, so
+     *     they all go out together and their replies get dispatched in
+     *     one go, instead of serialising on round-trips.
+     */
+
+    for (i = 0, call = b->calls; i < b->ncall; i++, call++) {
+        if (sd_bus_send_with_reply(dbus->bus, call->msg->msg, batch_reply_cb,
+                                   call, b->timeout * 1000,
+                                   &call->serial) != 0) {
+            call->serial = 0;
+            goto fail;
+        }
+
+        b->npending++;
+    }
+
+    mrp_dbus_glue_update(dbus->glue);
+    mrp_list_append(&dbus->batches, &b->hook);
+
+    return TRUE;
+
+ fail:
+    batch_free(b);
+
+    return FALSE;
+}
+
+
+void mrp_dbus_batch_cancel(mrp_dbus_batch_t *b)
+{
+    if (b == NULL || b->dead)
+        return;
+
+    b->dead = TRUE;
+
+    if (!b->busy)
+        batch_free(b);
+}
+
+
+static void purge_batches(mrp_dbus_t *dbus)
+{
+    mrp_list_hook_t  *p, *n;
+    mrp_dbus_batch_t *b;
+
+    mrp_list_foreach(&dbus->batches, p, n) {
+        b = mrp_list_entry(p, typeof(*b), hook);
+        batch_free(b);
+    }
+}
+
+
 static void call_free(call_t *call)
 {
     if (call != NULL) {
@@ -1754,6 +2685,7 @@ int mrp_dbus_signal(mrp_dbus_t *dbus, const char *dest, const char *path,
     if (sd_bus_send(dbus->bus, msg, NULL) != 0)
         goto fail;
 
+    mrp_dbus_glue_update(dbus->glue);
     sd_bus_message_unref(msg);
 
     return TRUE;
@@ -1831,6 +2763,61 @@ mrp_dbus_msg_t *mrp_dbus_msg_signal(mrp_dbus_t *dbus,
 }
 
 
+
+mrp_dbus_msg_t *mrp_dbus_msg_copy(mrp_dbus_t *dbus, mrp_dbus_msg_t *m,
+                                  const char *destination, const char *path)
+{
+    sd_bus_message *msg = NULL;
+    const char     *interface, *member;
+    uint8_t         type;
+    int             r;
+
+    if (sd_bus_message_get_type(m->msg, &type) != 0)
+        return NULL;
+
+    if (destination == NULL)
+        destination = sd_bus_message_get_destination(m->msg);
+    if (path == NULL)
+        path = sd_bus_message_get_path(m->msg);
+
+    interface = sd_bus_message_get_interface(m->msg);
+    member    = sd_bus_message_get_member(m->msg);
+
+    switch (type) {
+    case MRP_DBUS_MESSAGE_TYPE_METHOD_CALL:
+        r = sd_bus_message_new_method_call(dbus->bus, destination, path,
+                                           interface, member, &msg);
+        break;
+
+    case MRP_DBUS_MESSAGE_TYPE_SIGNAL:
+        r = sd_bus_message_new_signal(dbus->bus, path, interface, member,
+                                      &msg);
+        if (r == 0 && destination != NULL)
+            r = sd_bus_message_set_destination(msg, destination);
+        break;
+
+    default:
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (r != 0)
+        goto fail;
+
+    if (sd_bus_message_rewind(m->msg, TRUE) < 0 ||
+        sd_bus_message_copy(msg, m->msg, TRUE) < 0)
+        goto fail;
+
+    return create_message(msg, FALSE);
+
+ fail:
+    if (msg != NULL)
+        sd_bus_message_unref(msg);
+
+    return NULL;
+}
+
+
 mrp_dbus_msg_type_t mrp_dbus_msg_type(mrp_dbus_msg_t *m)
 {
     uint8_t type;
@@ -80,6 +80,12 @@ int mrp_dbus_follow_name(mrp_dbus_t *dbus, const char *name,
 /** Stop tracking the given name. */
 int mrp_dbus_forget_name(mrp_dbus_t *dbus, const char *name,
                          mrp_dbus_name_cb_t cb, void *user_data);
+/**
+ * Look up the cached owner of a followed name. Returns TRUE and sets
+ * @owner (to NULL if the name has no owner) if the owner is known.
+ */
+int mrp_dbus_name_owner(mrp_dbus_t *dbus, const char *name,
+                        const char **owner);
 
 /** Export a method to the bus. */
 int mrp_dbus_export_method(mrp_dbus_t *dbus, const char *path,
@@ -165,6 +171,28 @@ int32_t mrp_dbus_call(mrp_dbus_t *dbus, const char *dest,
 /** Cancel an ongoing method call on the bus. */
 int mrp_dbus_call_cancel(mrp_dbus_t *dbus, int32_t id);
 
+/** Opaque type for a batch of pipelined method calls. */
+typedef struct mrp_dbus_batch_s mrp_dbus_batch_t;
+
+/** Type of a batch completion callback. */
+typedef void (*mrp_dbus_batch_cb_t)(mrp_dbus_t *dbus, int ncall, int nerror,
+                                    void *user_data);
+
+/** Create a batch of at most ncall pipelined method calls. */
+mrp_dbus_batch_t *mrp_dbus_batch_create(mrp_dbus_t *dbus, int ncall,
+                                        int timeout);
+
+/** Add a method call to a batch, returning its slot or -1 on error. */
+int mrp_dbus_batch_add(mrp_dbus_batch_t *b, mrp_dbus_msg_t *msg,
+                       mrp_dbus_reply_cb_t cb, void *user_data);
+
+/** Send all calls in a batch, notify cb once all of them are done. */
+int mrp_dbus_batch_submit(mrp_dbus_batch_t *b, mrp_dbus_batch_cb_t cb,
+                          void *user_data);
+
+/** Cancel all pending calls of a batch and free it. */
+void mrp_dbus_batch_cancel(mrp_dbus_batch_t *b);
+
 /** Send a reply to the given method call on the bus. */
 int mrp_dbus_reply(mrp_dbus_t *dbus, mrp_dbus_msg_t *msg, int type, ...);
 
@@ -243,6 +271,16 @@ mrp_dbus_msg_t *mrp_dbus_msg_signal(mrp_dbus_t *bus,
                                     const char *interface,
                                     const char *member);
 
+/**
+ * Create a copy of a method call or signal with the same body, but with
+ * the destination and path replaced (if not NULL).
+ * Notes:
+ *     With sd-bus the body can only be copied from a sealed message, ie.
+ *     one which has already been sent.
+ */
+mrp_dbus_msg_t *mrp_dbus_msg_copy(mrp_dbus_t *bus, mrp_dbus_msg_t *m,
+                                  const char *destination, const char *path);
+
 /** Bus message types. */
 typedef enum {
 #ifndef SD_BUS_MESSAGE_TYPE_INVALID
@@ -393,6 +431,18 @@ int mrp_dbus_msg_read_basic(mrp_dbus_msg_t *m, char type, void *valuep);
 int mrp_dbus_msg_read_array(mrp_dbus_msg_t *m, char type,
                             void **itemsp, size_t *nitemp);
 
+/** Opaque sd_bus mainloop integration context. */
+typedef struct mrp_dbus_glue_s mrp_dbus_glue_t;
+
 /** Set up an sd_bus to be pumped by a murphy mainloop. */
 int mrp_dbus_setup_with_mainloop(mrp_mainloop_t *ml, sd_bus *bus);
+
+/** Hook an sd_bus directly to a murphy mainloop, returning the context. */
+mrp_dbus_glue_t *mrp_dbus_glue_create(mrp_mainloop_t *ml, sd_bus *bus);
+
+/** Rearm the mainloop integration after messages were queued to the bus. */
+void mrp_dbus_glue_update(mrp_dbus_glue_t *g);
+
+/** Tear down the mainloop integration of an sd_bus. */
+void mrp_dbus_glue_destroy(mrp_dbus_glue_t *g);
 #endif /* __MURPHY_SD_BUS_H__ */
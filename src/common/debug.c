@@ -30,6 +30,7 @@
 #define _GNU_SOURCE
 #include <link.h>
 #include <elf.h>
+#include <dlfcn.h>
 
 #include <stdarg.h>
 #include <limits.h>
@@ -45,11 +46,26 @@
 #define WILDCARD  "*"
 
 int mrp_debug_stamp = 0;                    /* debug config stamp */
+int mrp_debug_on    = FALSE;                /* debug messages enabled */
 
-static int         debug_enabled;           /* debug messages enabled */
 static mrp_htbl_t *rules_on;                /* enabling rules */
 static mrp_htbl_t *rules_off;               /* disabling rules */
 
+/*
+ * Debug sites register themselves here when they are first hit. Sites are
+ * indexed by function and by the basename of their file, so whenever a
+ * rule is added or removed only the sites the rule can affect need to be
+ * re-evaluated. Sites that pass their location explicitly (mrp_debug_at)
+ * and trace points are still checked lazily using mrp_debug_stamp.
+ */
+
+static mrp_debug_site_t *sites;             /* registered sites */
+static mrp_htbl_t       *site_funcs;        /* sites by function */
+static mrp_htbl_t       *site_bases;        /* sites by file basename */
+
+static void update_sites(const char *func, const char *file);
+static void reset_sites(void);
+
 static void free_rule_cb(void *key, void *entry)
 {
     MRP_UNUSED(key);
@@ -92,16 +108,17 @@ static void reset_rules(void)
 
 void mrp_debug_reset(void)
 {
-    debug_enabled = FALSE;
+    mrp_debug_on = FALSE;
     reset_rules();
+    reset_sites();
 }
 
 
 int mrp_debug_enable(int enabled)
 {
-    int prev = debug_enabled;
+    int prev = mrp_debug_on;
 
-    debug_enabled = !!enabled;
+    mrp_debug_on = !!enabled;
     mrp_log_enable(MRP_LOG_MASK_DEBUG);
     mrp_debug_stamp++;
 
@@ -154,6 +171,7 @@ static int add_rule(const char *func, const char *file, int line, int off)
 
     if (mrp_htbl_insert(ht, rule, rule)) {
         mrp_debug_stamp++;
+        update_sites(func, file);
 
         return TRUE;
     }
@@ -199,6 +217,7 @@ static int del_rule(const char *func, const char *file, int line, int off)
 
     if (r != NULL) {
         mrp_debug_stamp++;
+        update_sites(func, file);
 
         return TRUE;
     }
@@ -314,7 +333,7 @@ int mrp_debug_dump_config(FILE *fp)
 {
     dump_t d;
 
-    fprintf(fp, "Debugging is %sabled\n", debug_enabled ? "en" : "dis");
+    fprintf(fp, "Debugging is %sabled\n", mrp_debug_on ? "en" : "dis");
 
     if (rules_on != NULL) {
         fprintf(fp, "Debugging rules:\n");
@@ -343,14 +362,42 @@ void mrp_debug_msg(const char *file, int line, const char *func,
 }
 
 
+static int check_rules(const char *func, const char *file, int line);
+
+
 int mrp_debug_check(const char *func, const char *file, int line)
+{
+    if (!mrp_debug_on || rules_on == NULL)
+        return FALSE;
+
+    return check_rules(func, file, line);
+}
+
+
+static int any_rule_cb(void *key, void *object, void *user_data)
+{
+    MRP_UNUSED(key);
+    MRP_UNUSED(object);
+    MRP_UNUSED(user_data);
+
+    return TRUE;
+}
+
+
+int mrp_debug_match(const char *func, const char *file, int line)
+{
+    if (rules_on == NULL || mrp_htbl_find(rules_on, any_rule_cb, NULL) == NULL)
+        return TRUE;
+
+    return check_rules(func, file, line);
+}
+
+
+static int check_rules(const char *func, const char *file, int line)
 {
     char  buf[2 * PATH_MAX], *base;
     void *key;
 
-    if (!debug_enabled || rules_on == NULL)
-        return FALSE;
-
     base = NULL;
     key  = (void *)func;
     if (mrp_htbl_lookup(rules_on, key) != NULL)
@@ -416,3 +463,149 @@ int mrp_debug_check(const char *func, const char *file, int line)
 }
 
 
+static const char *base_name(const char *file)
+{
+    const char *base = strrchr(file, '/');
+
+    return base ? base + 1 : file;
+}
+
+
+static inline int match_site(mrp_debug_site_t *site)
+{
+    return rules_on != NULL && check_rules(site->func, site->file, site->line);
+}
+
+
+static int index_site(mrp_debug_site_t *site)
+{
+    mrp_htbl_config_t  hcfg;
+    mrp_debug_site_t  *fhead, *bhead;
+    const char        *base;
+
+    if (site_funcs == NULL) {
+        mrp_clear(&hcfg);
+        hcfg.comp = mrp_string_comp;
+        hcfg.hash = mrp_string_hash;
+        hcfg.free = NULL;
+
+        site_funcs = mrp_htbl_create(&hcfg);
+        site_bases = mrp_htbl_create(&hcfg);
+
+        if (site_funcs == NULL || site_bases == NULL) {
+            mrp_htbl_destroy(site_funcs, FALSE);
+            mrp_htbl_destroy(site_bases, FALSE);
+            site_funcs = site_bases = NULL;
+
+            return FALSE;
+        }
+    }
+
+    base  = base_name(site->file);
+    fhead = mrp_htbl_lookup(site_funcs, (void *)site->func);
+    bhead = mrp_htbl_lookup(site_bases, (void *)base);
+
+    site->fnext = site->bnext = NULL;
+
+    if (fhead == NULL && !mrp_htbl_insert(site_funcs, (void *)site->func, site))
+        return FALSE;
+
+    if (bhead == NULL && !mrp_htbl_insert(site_bases, (void *)base, site)) {
+        if (fhead == NULL)
+            mrp_htbl_remove(site_funcs, (void *)site->func, FALSE);
+        return FALSE;
+    }
+
+    if (fhead != NULL) {
+        site->fnext  = fhead->fnext;
+        fhead->fnext = site;
+    }
+
+    if (bhead != NULL) {
+        site->bnext  = bhead->bnext;
+        bhead->bnext = site;
+    }
+
+    return TRUE;
+}
+
+
+void mrp_debug_register_site(mrp_debug_site_t *site)
+{
+    site->enabled = match_site(site);
+
+    if (index_site(site)) {
+        site->next       = sites;
+        sites            = site;
+        site->registered = TRUE;
+    }
+}
+
+
+static void update_sites(const char *func, const char *file)
+{
+    mrp_debug_site_t *s;
+
+    if (func != NULL && !strcmp(func, WILDCARD)) {
+        for (s = sites; s != NULL; s = s->next)
+            s->enabled = match_site(s);
+    }
+    else if (func != NULL) {
+        if (site_funcs == NULL)
+            return;
+
+        s = mrp_htbl_lookup(site_funcs, (void *)func);
+        for ( ; s != NULL; s = s->fnext)
+            s->enabled = match_site(s);
+    }
+    else if (file != NULL) {
+        if (site_bases == NULL)
+            return;
+
+        s = mrp_htbl_lookup(site_bases, (void *)base_name(file));
+        for ( ; s != NULL; s = s->bnext)
+            s->enabled = match_site(s);
+    }
+}
+
+
+static void reset_sites(void)
+{
+    mrp_debug_site_t *s;
+
+    for (s = sites; s != NULL; s = s->next)
+        s->enabled = FALSE;
+}
+
+
+void mrp_debug_forget_module(void *handle)
+{
+    struct link_map  *map, *lm;
+    mrp_debug_site_t *s, **p;
+    Dl_info           info;
+
+    if (handle == NULL || sites == NULL)
+        return;
+
+    if (dlinfo(handle, RTLD_DI_LINKMAP, &map) != 0)
+        return;
+
+    for (p = &sites; (s = *p) != NULL; ) {
+        lm = NULL;
+
+        if (dladdr1(s, &info, (void **)&lm, RTLD_DL_LINKMAP) && lm == map) {
+            *p = s->next;
+            s->registered = FALSE;
+        }
+        else
+            p = &s->next;
+    }
+
+    mrp_htbl_reset(site_funcs, FALSE);
+    mrp_htbl_reset(site_bases, FALSE);
+
+    for (s = sites; s != NULL; s = s->next)
+        if (!index_site(s))
+            mrp_log_error("Failed to reindex debug site %s@%s:%d.",
+                          s->func, s->file, s->line);
+}
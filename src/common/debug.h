@@ -37,18 +37,38 @@
 
 MRP_CDECL_BEGIN
 
+/**
+ * A debug site.
+ *
+ * Debug sites register themselves at their first hit, after which they are
+ * kept up to date whenever a debug rule that might affect them changes.
+ */
+typedef struct mrp_debug_site_s mrp_debug_site_t;
+
+struct mrp_debug_site_s {
+    const char       *func;              /* function of the site */
+    const char       *file;              /* file of the site */
+    int               line;              /* line of the site */
+    int               registered;        /* whether registered */
+    int               enabled;           /* whether enabled by the rules */
+    mrp_debug_site_t *next;              /* next registered site */
+    mrp_debug_site_t *fnext;             /* next site in the same function */
+    mrp_debug_site_t *bnext;             /* next site in the same file */
+};
+
+#define __MRP_DEBUG_SITE(_site)                                           \
+        static mrp_debug_site_t _site = {                                 \
+            __FUNCTION__, __FILE__, __LINE__, 0, 0, NULL, NULL, NULL      \
+        };                                                                \
+                                                                          \
+        if (MRP_UNLIKELY(!_site.registered))                              \
+            mrp_debug_register_site(&_site)
+
 /** Log a debug message if the invoking debug site is enabled. */
 #define mrp_debug(fmt, args...)        do {                               \
-        static int __site_stamp = -1;                                     \
-        static int __site_enabled;                                        \
+        __MRP_DEBUG_SITE(__site);                                         \
                                                                           \
-        if (MRP_UNLIKELY(__site_stamp != mrp_debug_stamp)) {              \
-            __site_enabled = mrp_debug_check(__FUNCTION__,                \
-                                             __FILE__, __LINE__);         \
-            __site_stamp   = mrp_debug_stamp;                             \
-        }                                                                 \
-                                                                          \
-        if (MRP_UNLIKELY(__site_enabled))                                 \
+        if (MRP_UNLIKELY(__site.enabled && mrp_debug_on))                 \
             mrp_debug_msg(__LOC__, fmt, ## args);                         \
     } while (0)
 
@@ -70,16 +90,9 @@ MRP_CDECL_BEGIN
 
 /** Run a block of code if the invoking debug site is enabled. */
 #define mrp_debug_code(...)         do {                                  \
-        static int __site_stamp = -1;                                     \
-        static int __site_enabled;                                        \
-                                                                          \
-        if (MRP_UNLIKELY(__site_stamp != mrp_debug_stamp)) {              \
-            __site_enabled = mrp_debug_check(__FUNCTION__,                \
-                                             __FILE__, __LINE__);         \
-            __site_stamp   = mrp_debug_stamp;                             \
-        }                                                                 \
+        __MRP_DEBUG_SITE(__site);                                         \
                                                                           \
-        if (MRP_UNLIKELY(__site_enabled)) {                               \
+        if (MRP_UNLIKELY(__site.enabled && mrp_debug_on)) {               \
             __VA_ARGS__;                                                  \
         }                                                                 \
     } while (0)
@@ -87,6 +100,9 @@ MRP_CDECL_BEGIN
 /** Global debug configuration stamp, exported for minimum-overhead checking. */
 extern int mrp_debug_stamp;
 
+/** Whether debug messages are globally enabled. */
+extern int mrp_debug_on;
+
 /** Enable/disable debug messages globally. */
 int mrp_debug_enable(int enabled);
 
@@ -106,6 +122,15 @@ void mrp_debug_msg(const char *file, int line, const char *func,
 /** Check if the given debug site is enabled. */
 int mrp_debug_check(const char *func, const char *file, int line);
 
+/** Register a debug site at its first hit (used by the debug macros). */
+void mrp_debug_register_site(mrp_debug_site_t *site);
+
+/** Forget the debug sites of a loaded module before it is unloaded. */
+void mrp_debug_forget_module(void *dlhandle);
+
+/** Check if the given site matches the debug rules, TRUE if there are none. */
+int mrp_debug_match(const char *func, const char *file, int line);
+
 MRP_CDECL_END
 
 #endif /* __MURPHY_DEBUG_H__ */
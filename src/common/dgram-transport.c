@@ -27,6 +27,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
@@ -55,6 +56,44 @@
 
 
 #define DEFAULT_SIZE 1024                /* default input buffer size */
+#define DGRM_BATCH   8                   /* max datagrams per batch */
+#define DGRM_MAXSIZE 65536               /* max size of an UDP datagram */
+#define DGRM_IDLE    32                  /* quiet wakeups before unbatching */
+
+/*
+ * batched receive buffers
+ *
+ * UDP datagrams are bounded in size, so we can receive a batch of them
+ * with a single recvmmsg into fixed-size slots without ever truncating
+ * any. Other datagram sockets are received one by one, peeking at the
+ * size of each datagram first.
+ *
+ * The slots take half a megabyte, so UDP sockets start out receiving one
+ * by one as well, into an input buffer sized by the actual datagrams. The
+ * slots are only allocated once a wakeup finds a full batch waiting, and
+ * are freed again after DGRM_IDLE consecutive wakeups with at most a
+ * single datagram.
+ */
+
+typedef struct {
+    struct mmsghdr  msgs[DGRM_BATCH];    /* message headers */
+    struct iovec    iov[DGRM_BATCH];     /* slot I/O vectors */
+    mrp_sockaddr_t  addr[DGRM_BATCH];    /* source addresses */
+    char            buf[DGRM_BATCH][DGRM_MAXSIZE]; /* slots */
+} dgrm_rx_t;
+
+/*
+ * queued unconnected datagram, flushed with a single sendmmsg
+ */
+
+typedef struct {
+    uint32_t        len;                 /* length prefix, if not in buf */
+    int             prefix;              /* whether to send len */
+    void           *buf;                 /* datagram data */
+    size_t          size;                /* data size */
+    mrp_sockaddr_t  addr;                /* destination address */
+    socklen_t       addrlen;             /* address length */
+} dgrm_tx_t;
 
 typedef struct {
     MRP_TRANSPORT_PUBLIC_FIELDS;         /* common transport fields */
@@ -64,6 +103,11 @@ typedef struct {
     void           *ibuf;                /* input buffer */
     size_t          isize;               /* input buffer size */
     size_t          idata;               /* amount of input data */
+    dgrm_rx_t      *rx;                  /* batched receive buffers */
+    int             idle;                /* quiet batched wakeups */
+    dgrm_tx_t      *txq;                 /* queued datagrams */
+    int             ntx;                 /* number of queued datagrams */
+    mrp_deferred_t *txd;                 /* deferred queue flushing */
 } dgrm_t;
 
 
@@ -71,6 +115,7 @@ static void dgrm_recv_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
                          void *user_data);
 static int dgrm_disconnect(mrp_transport_t *mu);
 static int open_socket(dgrm_t *u, int family);
+static void flush_queue(dgrm_t *u);
 
 
 /*
@@ -254,12 +299,47 @@ static socklen_t dgrm_resolve(const char *str, mrp_sockaddr_t *addr,
 }
 
 
+static void *dgrm_steal_data(mrp_transport_t *mu, void *data, size_t size)
+{
+    dgrm_t *u = (dgrm_t *)mu;
+    void   *stolen;
+
+    /*
+     * A datagram received into one of the batch slots is copied out, as
+     * the slots are reused. A datagram in the input buffer is handed over
+     * with the buffer, moved to its beginning and trimmed to its size.
+     */
+
+    if (data < u->ibuf || data + size > u->ibuf + u->isize) {
+        if (u->rx == NULL || data < (void *)u->rx->buf ||
+            data + size > (void *)u->rx->buf + sizeof(u->rx->buf))
+            return NULL;
+
+        if ((stolen = mrp_alloc(size)) != NULL)
+            memcpy(stolen, data, size);
+
+        return stolen;
+    }
+
+    stolen = u->ibuf;
+    memmove(stolen, data, size);
+    mrp_realloc(stolen, size);
+
+    u->ibuf  = NULL;
+    u->isize = 0;
+    u->idata = 0;
+
+    return stolen;
+}
+
+
 static int dgrm_open(mrp_transport_t *mu)
 {
     dgrm_t *u = (dgrm_t *)mu;
 
-    u->sock   = -1;
-    u->family = -1;
+    u->sock       = -1;
+    u->family     = -1;
+    u->steal_data = dgrm_steal_data;
 
     return TRUE;
 }
@@ -269,11 +349,18 @@ static int dgrm_createfrom(mrp_transport_t *mu, void *conn)
 {
     dgrm_t         *u = (dgrm_t *)mu;
     int             on;
+    socklen_t       len;
     mrp_io_event_t  events;
 
-    u->sock = *(int *)conn;
+    u->sock       = *(int *)conn;
+    u->family     = -1;
+    u->steal_data = dgrm_steal_data;
 
     if (u->sock >= 0) {
+        len = sizeof(u->family);
+        if (getsockopt(u->sock, SOL_SOCKET, SO_DOMAIN, &u->family, &len) < 0)
+            u->family = -1;
+
         if (mu->flags & MRP_TRANSPORT_REUSEADDR) {
             on = 1;
             setsockopt(u->sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
@@ -325,11 +412,22 @@ static void dgrm_close(mrp_transport_t *mu)
     mrp_del_io_watch(u->iow);
     u->iow = NULL;
 
+    if (u->sock >= 0)
+        flush_queue(u);
+
+    mrp_del_deferred(u->txd);
+    u->txd = NULL;
+    mrp_free(u->txq);
+    u->txq = NULL;
+
     mrp_free(u->ibuf);
     u->ibuf  = NULL;
     u->isize = 0;
     u->idata = 0;
 
+    mrp_free(u->rx);
+    u->rx = NULL;
+
     if (u->sock >= 0){
         close(u->sock);
         u->sock = -1;
@@ -337,6 +435,108 @@ static void dgrm_close(mrp_transport_t *mu)
 }
 
 
+/*
+ * Receive a single datagram into the input buffer, peeking at its size
+ * first. Returns 1 if a datagram was received, 0 if there was none to
+ * receive without blocking, and -1 with *errorp set on errors.
+ */
+
+static int recv_single(dgrm_t *u, int fd, int flags, mrp_sockaddr_t *addr,
+                       socklen_t *addrlen, uint32_t *sizep, int *errorp)
+{
+    uint32_t size;
+    ssize_t  n;
+    int      old;
+
+    if (u->idata == u->isize) {
+        if (u->isize != 0) {
+            old      = u->isize;
+            u->isize *= 2;
+        }
+        else {
+            old      = 0;
+            u->isize = DEFAULT_SIZE;
+        }
+        if (!mrp_reallocz(u->ibuf, old, u->isize)) {
+            *errorp = ENOMEM;
+            return -1;
+        }
+    }
+
+    n = recv(fd, &size, sizeof(size), MSG_PEEK | flags);
+
+    if (n < 0 && (flags & MSG_DONTWAIT) &&
+        (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+
+    if (n != sizeof(size)) {
+        *errorp = EIO;
+        return -1;
+    }
+
+    size = ntohl(size);
+
+    if (u->isize < size + sizeof(size)) {
+        old      = u->isize;
+        u->isize = size + sizeof(size);
+
+        if (!mrp_reallocz(u->ibuf, old, u->isize)) {
+            *errorp = ENOMEM;
+            return -1;
+        }
+    }
+
+    *addrlen = sizeof(*addr);
+    n = recvfrom(fd, u->ibuf, size + sizeof(size), 0, &addr->any, addrlen);
+
+    if (n != (ssize_t)(size + sizeof(size))) {
+        *errorp = n < 0 ? EIO : EPROTO;
+        return -1;
+    }
+
+    *sizep = size;
+
+    return 1;
+}
+
+
+/*
+ * Receive a batch of UDP datagrams. Returns the number of datagrams
+ * received, or -1 with *errorp set on errors.
+ */
+
+static int recv_batch(dgrm_t *u, int fd, int *errorp)
+{
+    dgrm_rx_t *rx = u->rx;
+    int        i, n;
+
+    for (i = 0; i < DGRM_BATCH; i++) {
+        rx->iov[i].iov_base = rx->buf[i];
+        rx->iov[i].iov_len  = sizeof(rx->buf[i]);
+
+        mrp_clear(&rx->msgs[i]);
+        rx->msgs[i].msg_hdr.msg_name    = &rx->addr[i];
+        rx->msgs[i].msg_hdr.msg_namelen = sizeof(rx->addr[i]);
+        rx->msgs[i].msg_hdr.msg_iov     = &rx->iov[i];
+        rx->msgs[i].msg_hdr.msg_iovlen  = 1;
+    }
+
+    do {
+        n = recvmmsg(fd, rx->msgs, DGRM_BATCH, MSG_DONTWAIT, NULL);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+
+        *errorp = EIO;
+        return -1;
+    }
+
+    return n;
+}
+
+
 static void dgrm_recv_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
                          void *user_data)
 {
@@ -344,78 +544,107 @@ static void dgrm_recv_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
     mrp_transport_t *mu = (mrp_transport_t *)u;
     mrp_sockaddr_t   addr;
     socklen_t        addrlen;
+    struct msghdr   *hdr;
     uint32_t         size;
-    ssize_t          n;
     void            *data;
-    int              old, error;
+    int              error, i, n;
 
     MRP_UNUSED(w);
 
+    error = 0;
+
     if (events & MRP_IO_EVENT_IN) {
-        if (u->idata == u->isize) {
-            if (u->isize != 0) {
-                old      = u->isize;
-                u->isize *= 2;
-            }
-            else {
-                old      = 0;
-                u->isize = DEFAULT_SIZE;
-            }
-            if (!mrp_reallocz(u->ibuf, old, u->isize)) {
-                error = ENOMEM;
-            fatal_error:
-            closed:
-                dgrm_disconnect(mu);
-
-                if (u->evt.closed != NULL)
-                    MRP_TRANSPORT_BUSY(mu, {
-                            mu->evt.closed(mu, error, mu->user_data);
-                        });
-
-                u->check_destroy(mu);
-                return;
-            }
-        }
+        /*
+         * Drain up to DGRM_BATCH datagrams per wakeup. Each one is still
+         * delivered with a separate recv_data, and we stop if any of the
+         * callbacks destroys the transport.
+         */
+
+        if (u->rx != NULL) {
+            if ((n = recv_batch(u, fd, &error)) < 0)
+                goto fatal_error;
 
-        if (recv(fd, &size, sizeof(size), MSG_PEEK) != sizeof(size)) {
-            error = EIO;
-            goto fatal_error;
-        }
+            for (i = 0; i < n; i++) {
+                hdr  = &u->rx->msgs[i].msg_hdr;
+                data = u->rx->buf[i];
+
+                if (u->rx->msgs[i].msg_len < sizeof(size) ||
+                    (hdr->msg_flags & MSG_TRUNC)) {
+                    error = EPROTO;
+                    goto fatal_error;
+                }
 
-        size = ntohl(size);
+                memcpy(&size, data, sizeof(size));
+                size = ntohl(size);
 
-        if (u->isize < size + sizeof(size)) {
-            old      = u->isize;
-            u->isize = size + sizeof(size);
+                if (size + sizeof(size) != u->rx->msgs[i].msg_len) {
+                    error = EPROTO;
+                    goto fatal_error;
+                }
 
-            if (!mrp_reallocz(u->ibuf, old, u->isize)) {
-                error = ENOMEM;
-                goto fatal_error;
+                error = mu->recv_data(mu, data + sizeof(size), size,
+                                      hdr->msg_name, hdr->msg_namelen);
+
+                if (error)
+                    goto fatal_error;
+
+                if (u->check_destroy(mu))
+                    return;
+            }
+
+            if (n > 1)
+                u->idle = 0;
+            else if (++u->idle >= DGRM_IDLE) {
+                mrp_free(u->rx);
+                u->rx   = NULL;
+                u->idle = 0;
             }
         }
+        else {
+            for (i = 0; i < DGRM_BATCH; i++) {
+                n = recv_single(u, fd, i ? MSG_DONTWAIT : 0, &addr, &addrlen,
+                                &size, &error);
 
-        addrlen = sizeof(addr);
-        n = recvfrom(fd, u->ibuf, size + sizeof(size), 0, &addr.any, &addrlen);
+                if (n < 0)
+                    goto fatal_error;
 
-        if (n != (ssize_t)(size + sizeof(size))) {
-            error = n < 0 ? EIO : EPROTO;
-            goto fatal_error;
-        }
+                if (n == 0)
+                    break;
 
-        data  = u->ibuf + sizeof(size);
-        error = mu->recv_data(mu, data, size, &addr, addrlen);
+                data  = u->ibuf + sizeof(size);
+                error = mu->recv_data(mu, data, size, &addr, addrlen);
 
-        if (error)
-            goto fatal_error;
+                if (error)
+                    goto fatal_error;
 
-        if (u->check_destroy(mu))
-            return;
+                if (u->check_destroy(mu))
+                    return;
+            }
+
+            /* a full batch was waiting, switch to batched receiving */
+            if (i == DGRM_BATCH &&
+                (u->family == AF_INET || u->family == AF_INET6))
+                u->rx = mrp_alloc(sizeof(*u->rx));
+        }
     }
 
     if (events & MRP_IO_EVENT_HUP) {
         error = 0;
         goto closed;
     }
+
+    return;
+
+ fatal_error:
+ closed:
+    dgrm_disconnect(mu);
+
+    if (u->evt.closed != NULL)
+        MRP_TRANSPORT_BUSY(mu, {
+                mu->evt.closed(mu, error, mu->user_data);
+            });
+
+    u->check_destroy(mu);
 }
 
 
@@ -428,6 +657,8 @@ static int open_socket(dgrm_t *u, int family)
     u->sock = socket(family, SOCK_DGRAM, 0);
 
     if (u->sock != -1) {
+        u->family = family;
+
         if (u->flags & MRP_TRANSPORT_REUSEADDR) {
             on = 1;
             setsockopt(u->sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
@@ -500,35 +731,143 @@ static int dgrm_disconnect(mrp_transport_t *mu)
 }
 
 
-static int dgrm_send(mrp_transport_t *mu, mrp_msg_t *msg)
+static void flush_queue(dgrm_t *u)
+{
+    struct mmsghdr  msgs[DGRM_BATCH];
+    struct iovec    iov[2 * DGRM_BATCH], *v;
+    dgrm_tx_t      *tx;
+    int             i, n;
+
+    if (u->ntx == 0)
+        return;
+
+    mrp_disable_deferred(u->txd);
+
+    for (i = 0, tx = u->txq, v = iov; i < u->ntx; i++, tx++) {
+        mrp_clear(&msgs[i]);
+        msgs[i].msg_hdr.msg_name    = &tx->addr;
+        msgs[i].msg_hdr.msg_namelen = tx->addrlen;
+        msgs[i].msg_hdr.msg_iov     = v;
+        msgs[i].msg_hdr.msg_iovlen  = tx->prefix ? 2 : 1;
+
+        if (tx->prefix) {
+            v->iov_base = &tx->len;
+            v->iov_len  = sizeof(tx->len);
+            v++;
+        }
+
+        v->iov_base = tx->buf;
+        v->iov_len  = tx->size;
+        v++;
+    }
+
+    for (i = 0; i < u->ntx; ) {
+        n = sendmmsg(u->sock, msgs + i, u->ntx - i, 0);
+
+        if (n > 0) {
+            i += n;
+            continue;
+        }
+
+        if (errno == EINTR)
+            continue;
+
+        mrp_log_error("%s(): XXX TODO: dgrm-transport send failed (%d: %s)",
+                      __FUNCTION__, errno, strerror(errno));
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+
+        i++;                             /* skip the failed datagram */
+    }
+
+    for (i = 0, tx = u->txq; i < u->ntx; i++, tx++)
+        mrp_free(tx->buf);
+
+    u->ntx = 0;
+}
+
+
+static void flush_cb(mrp_deferred_t *d, void *user_data)
+{
+    dgrm_t *u = (dgrm_t *)user_data;
+
+    MRP_UNUSED(d);
+
+    flush_queue(u);
+}
+
+
+/*
+ * Queue an unconnected datagram for sending. The datagrams queued during
+ * a mainloop iteration are sent with a single sendmmsg. Takes ownership
+ * of buf. If prefix is set, the datagram is sent with a length prefix.
+ */
+
+static int queue_datagram(dgrm_t *u, int prefix, void *buf, size_t size,
+                          mrp_sockaddr_t *addr, socklen_t addrlen)
+{
+    dgrm_tx_t *tx;
+
+    if (u->txq == NULL) {
+        if ((u->txq = mrp_allocz_array(dgrm_tx_t, DGRM_BATCH)) == NULL)
+            goto fail;
+    }
+
+    if (u->txd == NULL) {
+        if ((u->txd = mrp_add_deferred(u->ml, flush_cb, u)) == NULL)
+            goto fail;
+    }
+
+    if (u->ntx == DGRM_BATCH)
+        flush_queue(u);
+
+    if (addrlen > sizeof(tx->addr))
+        goto fail;
+
+    tx = u->txq + u->ntx++;
+    tx->len     = htonl(size);
+    tx->prefix  = prefix;
+    tx->buf     = buf;
+    tx->size    = size;
+    tx->addrlen = addrlen;
+    memcpy(&tx->addr, addr, addrlen);
+
+    mrp_enable_deferred(u->txd);
+
+    return TRUE;
+
+ fail:
+    mrp_free(buf);
+    return FALSE;
+}
+
+
+static int dgrm_sendencmsg(mrp_transport_t *mu, void *buf, size_t size)
 {
     dgrm_t       *u = (dgrm_t *)mu;
     struct iovec  iov[2];
-    void         *buf;
-    ssize_t       size, n;
+    ssize_t       n;
     uint32_t      len;
 
     if (u->connected) {
-        size = mrp_msg_default_encode(msg, &buf);
+        flush_queue(u);
 
-        if (size >= 0) {
-            len = htonl(size);
-            iov[0].iov_base = &len;
-            iov[0].iov_len  = sizeof(len);
-            iov[1].iov_base = buf;
-            iov[1].iov_len  = size;
+        len = htonl(size);
+        iov[0].iov_base = &len;
+        iov[0].iov_len  = sizeof(len);
+        iov[1].iov_base = buf;
+        iov[1].iov_len  = size;
 
-            n = writev(u->sock, iov, 2);
-            mrp_free(buf);
+        n = writev(u->sock, iov, 2);
 
-            if (n == (ssize_t)(size + sizeof(len)))
-                return TRUE;
-            else {
-                if (n == -1 && errno == EAGAIN) {
-                    mrp_log_error("%s(): XXX TODO: this sucks, need to add "
-                                  "output queuing for dgrm-transport.",
-                                  __FUNCTION__);
-                }
+        if (n == (ssize_t)(size + sizeof(len)))
+            return TRUE;
+        else {
+            if (n == -1 && errno == EAGAIN) {
+                mrp_log_error("%s(): XXX TODO: this sucks, need to add "
+                              "output queuing for dgrm-transport.",
+                              __FUNCTION__);
             }
         }
     }
@@ -537,47 +876,32 @@ static int dgrm_send(mrp_transport_t *mu, mrp_msg_t *msg)
 }
 
 
-static int dgrm_sendto(mrp_transport_t *mu, mrp_msg_t *msg,
-                       mrp_sockaddr_t *addr, socklen_t addrlen)
+static int dgrm_send(mrp_transport_t *mu, mrp_msg_t *msg)
 {
-    dgrm_t          *u = (dgrm_t *)mu;
-    struct iovec     iov[2];
-    void            *buf;
-    ssize_t          size, n;
-    uint32_t         len;
-    struct msghdr    hdr;
+    dgrm_t        *u = (dgrm_t *)mu;
+    mrp_msg_iov_t  miov;
+    ssize_t        size, n;
+    uint32_t       len;
 
-    if (MRP_UNLIKELY(u->sock == -1)) {
-        if (!open_socket(u, ((struct sockaddr *)addr)->sa_family))
+    if (u->connected) {
+        if ((size = mrp_transport_encode_iov(mu, msg, &miov)) < 0)
             return FALSE;
-    }
 
-    size = mrp_msg_default_encode(msg, &buf);
+        flush_queue(u);
 
-    if (size >= 0) {
         len = htonl(size);
-        iov[0].iov_base = &len;
-        iov[0].iov_len  = sizeof(len);
-        iov[1].iov_base = buf;
-        iov[1].iov_len  = size;
-
-        hdr.msg_name    = addr;
-        hdr.msg_namelen = addrlen;
-        hdr.msg_iov     = iov;
-        hdr.msg_iovlen  = MRP_ARRAY_SIZE(iov);
+        miov.iov[0].iov_base = &len;
+        miov.iov[0].iov_len  = sizeof(len);
 
-        hdr.msg_control    = NULL;
-        hdr.msg_controllen = 0;
-        hdr.msg_flags      = 0;
-
-        n = sendmsg(u->sock, &hdr, 0);
-        mrp_free(buf);
+        n = writev(u->sock, miov.iov, miov.iovcnt);
+        mrp_msg_iov_release(&miov);
 
         if (n == (ssize_t)(size + sizeof(len)))
             return TRUE;
         else {
             if (n == -1 && errno == EAGAIN) {
-                mrp_log_error("%s(): XXX TODO: dgrm-transport send failed",
+                mrp_log_error("%s(): XXX TODO: this sucks, need to add "
+                              "output queuing for dgrm-transport.",
                               __FUNCTION__);
             }
         }
@@ -587,12 +911,35 @@ static int dgrm_sendto(mrp_transport_t *mu, mrp_msg_t *msg,
 }
 
 
+static int dgrm_sendto(mrp_transport_t *mu, mrp_msg_t *msg,
+                       mrp_sockaddr_t *addr, socklen_t addrlen)
+{
+    dgrm_t          *u = (dgrm_t *)mu;
+    void            *buf;
+    ssize_t          size;
+
+    if (MRP_UNLIKELY(u->sock == -1)) {
+        if (!open_socket(u, ((struct sockaddr *)addr)->sa_family))
+            return FALSE;
+    }
+
+    size = mrp_transport_encode(mu, msg, &buf);
+
+    if (size >= 0)
+        return queue_datagram(u, TRUE, buf, size, addr, addrlen);
+
+    return FALSE;
+}
+
+
 static int dgrm_sendraw(mrp_transport_t *mu, void *data, size_t size)
 {
     dgrm_t  *u = (dgrm_t *)mu;
     ssize_t  n;
 
     if (u->connected) {
+        flush_queue(u);
+
         n = write(u->sock, data, size);
 
         if (n == (ssize_t)size)
@@ -614,25 +961,17 @@ static int dgrm_sendrawto(mrp_transport_t *mu, void *data, size_t size,
                           mrp_sockaddr_t *addr, socklen_t addrlen)
 {
     dgrm_t  *u = (dgrm_t *)mu;
-    ssize_t  n;
+    void    *buf;
 
     if (MRP_UNLIKELY(u->sock == -1)) {
         if (!open_socket(u, ((struct sockaddr *)addr)->sa_family))
             return FALSE;
     }
 
-    n = sendto(u->sock, data, size, 0, &addr->any, addrlen);
-
-    if (n == (ssize_t)size)
-        return TRUE;
-    else {
-        if (n == -1 && errno == EAGAIN) {
-            mrp_log_error("%s(): XXX TODO: dgrm-transport send failed",
-                          __FUNCTION__);
-        }
-    }
+    if ((buf = mrp_datadup(data, size)) == NULL)
+        return FALSE;
 
-    return FALSE;
+    return queue_datagram(u, FALSE, buf, size, addr, addrlen);
 }
 
 
@@ -665,12 +1004,12 @@ static int senddatato(mrp_transport_t *mu, void *data, uint16_t tag,
             *lenp = htobe32(len);
             *tagp = htobe16(tag);
 
-            if (u->connected)
-                n = send(u->sock, buf, len + sizeof(*lenp), 0);
-            else
-                n = sendto(u->sock, buf, len + sizeof(*lenp), 0, &addr->any,
-                           addrlen);
+            if (!u->connected)
+                return queue_datagram(u, FALSE, buf, len + sizeof(*lenp),
+                                      addr, addrlen);
 
+            flush_queue(u);
+            n = send(u->sock, buf, len + sizeof(*lenp), 0);
             mrp_free(buf);
 
             if (n == (ssize_t)(len + sizeof(*lenp)))
@@ -721,15 +1060,15 @@ static int sendnativeto(mrp_transport_t *mu, void *data, uint32_t type_id,
 
     reserve = sizeof(*lenp);
 
-    if (mrp_encode_native(data, type_id, reserve, &buf, &size, map) > 0) {
+    if (mrp_encode_native(data, type_id, reserve, &buf, &size, map) == 0) {
         lenp  = buf;
         *lenp = htobe32(size - sizeof(*lenp));
 
-        if (u->connected)
-            n = send(u->sock, buf, size, 0);
-        else
-            n = sendto(u->sock, buf, size, 0, &addr->any, addrlen);
+        if (!u->connected)
+            return queue_datagram(u, FALSE, buf, size, addr, addrlen);
 
+        flush_queue(u);
+        n = send(u->sock, buf, size, 0);
         mrp_free(buf);
 
         if (n == (ssize_t)size)
@@ -841,7 +1180,8 @@ MRP_REGISTER_TRANSPORT(udp4, UDP4, dgrm_t, dgrm_resolve,
                        dgrm_senddata, dgrm_senddatato,
                        NULL, NULL,
                        dgrm_sendnative, dgrm_sendnativeto,
-                       dgrm_sendjson, dgrm_sendjsonto);
+                       dgrm_sendjson, dgrm_sendjsonto,
+                       .sendencmsg = dgrm_sendencmsg);
 
 MRP_REGISTER_TRANSPORT(udp6, UDP6, dgrm_t, dgrm_resolve,
                        dgrm_open, dgrm_createfrom, dgrm_close, NULL,
@@ -852,7 +1192,8 @@ MRP_REGISTER_TRANSPORT(udp6, UDP6, dgrm_t, dgrm_resolve,
                        dgrm_senddata, dgrm_senddatato,
                        NULL, NULL,
                        dgrm_sendnative, dgrm_sendnativeto,
-                       dgrm_sendjson, dgrm_sendjsonto);
+                       dgrm_sendjson, dgrm_sendjsonto,
+                       .sendencmsg = dgrm_sendencmsg);
 
 MRP_REGISTER_TRANSPORT(unxdgrm, UNXD, dgrm_t, dgrm_resolve,
                        dgrm_open, dgrm_createfrom, dgrm_close, NULL,
@@ -863,4 +1204,5 @@ MRP_REGISTER_TRANSPORT(unxdgrm, UNXD, dgrm_t, dgrm_resolve,
                        dgrm_senddata, dgrm_senddatato,
                        NULL, NULL,
                        dgrm_sendnative, dgrm_sendnativeto,
-                       dgrm_sendjson, dgrm_sendjsonto);
+                       dgrm_sendjson, dgrm_sendjsonto,
+                       .sendencmsg = dgrm_sendencmsg);
@@ -27,6 +27,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <string.h>
 #include <endian.h>
 
 #include <murphy/common/macros.h>
@@ -34,18 +35,70 @@
 #include <murphy/common/log.h>
 #include <murphy/common/fragbuf.h>
 
+/*
+ * Data between head and used is unconsumed. Pulling a message only
+ * advances head, so a chunk carrying many small messages is taken apart
+ * without moving any data. The remaining tail of a partial message is moved
+ * to the beginning of the buffer only once more space is needed, and the
+ * buffer is rewound without moving anything when all data is consumed.
+ */
+
 struct mrp_fragbuf_s {
-    void *data;                          /* actual data buffer */
-    int   size;                          /* size of the buffer */
-    int   used;                          /* amount of data in the bufer */
-    int   framed : 1;                    /* whether data is framed */
+    void   *data;                        /* actual data buffer */
+    int     size;                        /* size of the buffer */
+    int     head;                        /* start of unconsumed data */
+    int     used;                        /* end of data in the buffer */
+    size_t  max_frame;                   /* max. frame size, 0 for any */
+    int     framed : 1;                  /* whether data is framed */
+    unsigned oversized : 1;              /* got a frame above max_frame */
 };
 
 
+static inline uint32_t frame_size(mrp_fragbuf_t *buf, int offs)
+{
+    uint32_t size;
+
+    memcpy(&size, buf->data + offs, sizeof(size));
+
+    return be32toh(size);
+}
+
+
+static int check_frame(mrp_fragbuf_t *buf)
+{
+    uint32_t size;
+
+    if (!buf->framed || !buf->max_frame || buf->oversized)
+        return !buf->oversized;
+
+    if (buf->used - buf->head < (int)sizeof(size))
+        return TRUE;
+
+    size = frame_size(buf, buf->head);
+
+    if (size > buf->max_frame) {
+        mrp_log_error("Oversized frame (%u > %zu bytes) in buffer %p.",
+                      size, buf->max_frame, buf);
+        buf->oversized = TRUE;
+    }
+
+    return !buf->oversized;
+}
+
+
 static void *fragbuf_ensure(mrp_fragbuf_t *buf, size_t size)
 {
     int more;
 
+    if (!check_frame(buf))
+        return NULL;
+
+    if (buf->size - buf->used < (int)size && buf->head > 0) {
+        memmove(buf->data, buf->data + buf->head, buf->used - buf->head);
+        buf->used -= buf->head;
+        buf->head  = 0;
+    }
+
     if (buf->size - buf->used < (int)size) {
         more = size - (buf->size - buf->used);
 
@@ -59,29 +112,40 @@ static void *fragbuf_ensure(mrp_fragbuf_t *buf, size_t size)
 }
 
 
+static void fragbuf_consume(mrp_fragbuf_t *buf, int amount)
+{
+    buf->head += amount;
+
+    if (buf->head >= buf->used)
+        buf->head = buf->used = 0;
+}
+
+
 size_t mrp_fragbuf_used(mrp_fragbuf_t *buf)
 {
-    return buf->used;
+    return buf->used - buf->head;
 }
 
 
 size_t mrp_fragbuf_missing(mrp_fragbuf_t *buf)
 {
-    void     *ptr;
     int       offs;
     uint32_t  size;
 
-    if (!buf->framed || !buf->used)
+    if (!buf->framed || buf->used == buf->head)
         return 0;
 
     /* find the last frame */
-    ptr  = buf->data;
-    offs = 0;
-    while (offs < buf->used) {
-        size  = be32toh(*(uint32_t *)ptr);
+    offs = buf->head;
+    while (offs + (int)sizeof(size) <= buf->used) {
+        size  = frame_size(buf, offs);
         offs += sizeof(size) + size;
     }
 
+    /* a partial size prefix, we can't tell how much is missing yet */
+    if (offs < buf->used)
+        return sizeof(size) - (buf->used - offs);
+
     /* get the amount of data missing */
     return offs - buf->used;
 }
@@ -89,10 +153,13 @@ size_t mrp_fragbuf_missing(mrp_fragbuf_t *buf)
 
 int fragbuf_init(mrp_fragbuf_t *buf, int framed, int pre_alloc)
 {
-    buf->data   = NULL;
-    buf->size   = 0;
-    buf->used   = 0;
-    buf->framed = framed;
+    buf->data      = NULL;
+    buf->size      = 0;
+    buf->head      = 0;
+    buf->used      = 0;
+    buf->max_frame = 0;
+    buf->framed    = framed;
+    buf->oversized = FALSE;
 
     if (pre_alloc <= 0 || fragbuf_ensure(buf, pre_alloc))
         return TRUE;
@@ -118,16 +185,51 @@ mrp_fragbuf_t *mrp_fragbuf_create(int framed, size_t pre_alloc)
 }
 
 
+void mrp_fragbuf_set_max_frame(mrp_fragbuf_t *buf, size_t max_frame)
+{
+    buf->max_frame = max_frame;
+    buf->oversized = FALSE;
+}
+
+
+int mrp_fragbuf_oversized(mrp_fragbuf_t *buf)
+{
+    return buf->oversized;
+}
+
+
 void mrp_fragbuf_reset(mrp_fragbuf_t *buf)
 {
     if (buf != NULL) {
+        buf->head      = 0;
+        buf->used      = 0;
+        buf->oversized = FALSE;
+    }
+}
+
+void mrp_fragbuf_shrink(mrp_fragbuf_t *buf)
+{
+    int used;
+
+    if (buf == NULL || (used = buf->used - buf->head) == buf->size)
+        return;
+
+    if (used > 0 && buf->head > 0)
+        memmove(buf->data, buf->data + buf->head, used);
+
+    buf->head = 0;
+    buf->used = used;
+
+    if (used == 0) {
         mrp_free(buf->data);
         buf->data = NULL;
         buf->size = 0;
-        buf->used = 0;
     }
+    else if (mrp_realloc(buf->data, used) != NULL)
+        buf->size = used;
 }
 
+
 void mrp_fragbuf_destroy(mrp_fragbuf_t *buf)
 {
     if (buf != NULL) {
@@ -159,6 +261,9 @@ int mrp_fragbuf_trim(mrp_fragbuf_t *buf, void *ptr, size_t osize, size_t nsize)
             diff = osize - nsize;
             buf->used -= diff;
 
+            if (buf->used == buf->head)
+                buf->head = buf->used = 0;
+
             return TRUE;
         }
     }
@@ -186,91 +291,107 @@ int mrp_fragbuf_push(mrp_fragbuf_t *buf, void *data, size_t size)
 
 int mrp_fragbuf_pull(mrp_fragbuf_t *buf, void **datap, size_t *sizep)
 {
-    void     *data;
+    void     *head, *data;
     uint32_t  size;
 
-    if (buf == NULL || buf->used <= 0)
+    if (buf == NULL || buf->used <= buf->head)
         return FALSE;
 
+    head = buf->data + buf->head;
+
     if (MRP_UNLIKELY(*datap &&
-                     (*datap < buf->data || *datap > buf->data + buf->used))) {
+                     (*datap < head || *datap > buf->data + buf->used))) {
         mrp_log_warning("%s(): *** looks like we're called with an unreset "
                         "datap pointer... ***", __FUNCTION__);
     }
 
-    /* start of iteration */
-    if (*datap == NULL) {
+    /* continue iteration, consume the previous message */
+    if (*datap != NULL) {
         if (!buf->framed) {
-            *datap = buf->data;
-            *sizep = buf->used;
+            data = *datap + *sizep;
 
-            return TRUE;
+            if (data < head || data > buf->data + buf->used)
+                return FALSE;
+
+            fragbuf_consume(buf, data - head);
         }
         else {
-            if (buf->used < (int)sizeof(size))
+            if (*datap != head + sizeof(size))
                 return FALSE;
 
-            size = be32toh(*(uint32_t *)buf->data);
-
-            if (buf->used >= (int)(sizeof(size) + size)) {
-                *datap = buf->data + sizeof(size);
-                *sizep = size;
+            size = frame_size(buf, buf->head);
 
-                return TRUE;
-            }
-            else
+            if ((int)(size + sizeof(size)) > buf->used - buf->head)
                 return FALSE;
+
+            fragbuf_consume(buf, size + sizeof(size));
         }
+
+        if (buf->used <= buf->head)
+            return FALSE;
+
+        head = buf->data + buf->head;
     }
-    /* continue iteration */
-    else {
-        if (!buf->framed) {
-            data = *datap + *sizep;
 
-            if (buf->data <= data && data < buf->data + buf->used) {
-                memmove(buf->data, data, buf->used - (data - buf->data));
-                buf->used -= (data - buf->data);
+    if (!buf->framed) {
+        *datap = head;
+        *sizep = buf->used - buf->head;
 
-                *datap = buf->data;
-                *sizep = buf->used;
+        return TRUE;
+    }
 
-                return TRUE;
-            }
-            else {
-                if (data == buf->data + buf->used)
-                    buf->used = 0;
+    if (buf->used - buf->head < (int)sizeof(size) || !check_frame(buf))
+        return FALSE;
 
-                return FALSE;
-            }
-        }
-        else {
-            if (*datap != buf->data + sizeof(size))
-                return FALSE;
+    size = frame_size(buf, buf->head);
 
-            size = be32toh(*(uint32_t *)buf->data);
+    if (buf->used - buf->head >= (int)(sizeof(size) + size)) {
+        *datap = head + sizeof(size);
+        *sizep = size;
 
-            if ((int)(size + sizeof(size)) <= buf->used) {
-                memmove(buf->data, buf->data + size + sizeof(size),
-                        buf->used - (size + sizeof(size)));
-                buf->used -= size + sizeof(size);
-            }
-            else
-                return FALSE;
+        return TRUE;
+    }
+    else
+        return FALSE;
+}
 
-            if (buf->used <= (int)sizeof(size))
-                return FALSE;
 
-            size = be32toh(*(uint32_t *)buf->data);
-            data = buf->data + sizeof(size);
+void *mrp_fragbuf_steal(mrp_fragbuf_t *buf, void *data, size_t size)
+{
+    void *stolen;
 
-            if (buf->used >= (int)(size + sizeof(size))) {
-                *datap = data;
-                *sizep = size;
+    if (buf == NULL || size == 0 || data < buf->data + buf->head ||
+        data + size > buf->data + buf->used)
+        return NULL;
 
-                return TRUE;
-            }
+    /*
+     * If more data follows the message, copy out only the message and
+     * consume it from the buffer, leaving the rest where it is. Otherwise
+     * hand over the buffer itself with the message moved to its beginning
+     * and trimmed down to the message size.
+     */
 
-            return FALSE;
-        }
+    if (data + size < buf->data + buf->used) {
+        if ((stolen = mrp_alloc(size)) == NULL)
+            return NULL;
+
+        memcpy(stolen, data, size);
+        fragbuf_consume(buf, (data + size) - (buf->data + buf->head));
+
+        return stolen;
     }
+
+    stolen = buf->data;
+
+    if (data != stolen)
+        memmove(stolen, data, size);
+
+    mrp_realloc(stolen, size);
+
+    buf->data = NULL;
+    buf->size = 0;
+    buf->head = 0;
+    buf->used = 0;
+
+    return stolen;
 }
@@ -55,6 +55,12 @@ MRP_CDECL_BEGIN
  * You can also create a collector buffer in frameless mode. Such a
  * buffer will always return immediately all available data as you
  * iterate through it.
+ *
+ * Messages are always returned as a single contiguous piece pointing
+ * into the buffer. A message stays valid until the next call to
+ * mrp_fragbuf_pull, or until the buffer is pushed to or reset. Pulling
+ * messages does not move any data, and resetting a buffer keeps its
+ * allocated memory for reuse.
  */
 
 /** Buffer for collecting fragments of (framed or unframed) message data. */
@@ -66,9 +72,24 @@ mrp_fragbuf_t *mrp_fragbuf_create(int framed, size_t pre_alloc);
 /** Initialize the given data collector buffer. */
 int mrp_fragbuf_init(mrp_fragbuf_t *buf, int framed, size_t pre_alloc);
 
-/** Reset the given data collector buffer. */
+/**
+ * Limit the size of frames accepted by the given buffer.
+ *
+ * Once a frame larger than max_frame bytes is seen, no more messages are
+ * pulled and pushing or allocating from the buffer fails, until the buffer
+ * is reset. A max_frame of 0 accepts frames of any size.
+ */
+void mrp_fragbuf_set_max_frame(mrp_fragbuf_t *buf, size_t max_frame);
+
+/** Check whether the buffer has seen a frame larger than allowed. */
+int mrp_fragbuf_oversized(mrp_fragbuf_t *buf);
+
+/** Reset the given data collector buffer, keeping its memory. */
 void mrp_fragbuf_reset(mrp_fragbuf_t *buf);
 
+/** Give back any memory not needed for the data still in the buffer. */
+void mrp_fragbuf_shrink(mrp_fragbuf_t *buf);
+
 /** Destroy the given data collector buffer, freeing all associated memory. */
 void mrp_fragbuf_destroy(mrp_fragbuf_t *buf);
 
@@ -90,6 +111,19 @@ int mrp_fragbuf_push(mrp_fragbuf_t *buf, void *data, size_t size);
 /** Iterate through the given buffer, pulling and freeing assembled messages. */
 int mrp_fragbuf_pull(mrp_fragbuf_t *buf, void **data, size_t *size);
 
+/**
+ * Take over the memory of the message last pulled from the buffer.
+ *
+ * Returns an allocation of exactly size bytes starting with the message
+ * and removes the message from the buffer. If the message is the last one
+ * in the buffer, the buffer memory itself is handed over, otherwise only
+ * the message is copied and any data following it is left in place. The
+ * caller becomes responsible for freeing the returned memory. Any iteration
+ * must be restarted after a successful steal. Returns NULL, leaving the
+ * buffer intact, on failure.
+ */
+void *mrp_fragbuf_steal(mrp_fragbuf_t *buf, void *data, size_t size);
+
 MRP_CDECL_END
 
 #endif /* __MURPHY_FRAGBUF_H__ */
@@ -28,36 +28,68 @@
  */
 
 #include <stdint.h>
+#include <string.h>
 
 #include "murphy/common/mm.h"
-#include "murphy/common/list.h"
 #include "murphy/common/hashtbl.h"
 
-#define MIN_NBUCKET   8
-#define MAX_NBUCKET 128
-
-typedef struct {                        /* a hash bucket */
-    mrp_list_hook_t entries;            /* hook to hash table entries */
-    mrp_list_hook_t used;               /* hook to list of buckets in use */
-} bucket_t;
+/*
+ * An open-addressing hash table with linear probing.
+ *
+ * Every slot has a control byte which is either CTRL_EMPTY, CTRL_DELETED,
+ * or the lowest 7 bits of the hash of the key in the slot. Probing scans
+ * the compact control byte array and only looks at slots with a matching
+ * control byte. The full hash is stored in the slot so the table can be
+ * grown without rehashing any of the keys.
+ *
+ * When the table fills up, a new larger table is allocated and becomes
+ * the active one. Entries are then migrated from the old table a few
+ * slots at a time by every subsequent insertion and removal. Lookups
+ * check both tables until the migration is done.
+ *
+ * Removed entries leave behind a tombstone, so entries never move within
+ * a table. Iterators stamp every entry they have visited with the current
+ * iteration generation. This lets them restart cleanly whenever the table
+ * is reorganized underneath them without visiting any entry twice.
+ */
 
-typedef struct {                        /* a hash table entry */
-    mrp_list_hook_t  hook;              /* hook to bucket chain */
-    void            *key;               /* key for this entry */
-    void            *obj;               /* object for this entry */
-} entry_t;
+#define MIN_SIZE      8                 /* minimum number of slots */
+#define MIGRATE_STEP  8                 /* slots to migrate per update */
+
+#define CTRL_EMPTY    0x80              /* slot has never been used */
+#define CTRL_DELETED  0xfe              /* slot had an entry removed */
+#define CTRL_HASH(h)  ((h) & 0x7f)      /* control byte for used slots */
+#define CTRL_USED(c)  (!((c) & 0x80))   /* slot is in use */
+
+typedef struct {                        /* a hash table slot */
+    void     *key;                      /* key for this entry */
+    void     *obj;                      /* object for this entry */
+    uint32_t  hash;                     /* (mixed) hash of the key */
+    uint32_t  stamp;                    /* last iteration to visit this */
+} slot_t;
+
+typedef struct {                        /* a table of slots */
+    slot_t  *slots;                     /* slots, followed by control bytes */
+    uint8_t *ctrl;                      /* slot control bytes */
+    size_t   size;                      /* number of slots */
+    size_t   nused;                     /* slots in use */
+    size_t   ndeleted;                  /* slots with tombstones */
+} table_t;
 
 typedef struct {                        /* iterator state */
-    mrp_list_hook_t *bp, *bn;           /* current bucket hook pointers */
-    mrp_list_hook_t *ep, *en;           /* current entry hook pointers */
-    entry_t         *entry;             /* current entry */
-    int              verdict;           /* remove-from-cb verdict */
+    void     *key;                      /* key of current entry */
+    void     *obj;                      /* object of current entry */
+    uint32_t  hash;                     /* hash of current entry */
+    int       removed;                  /* removed from the callback */
+    int       verdict;                  /* remove-from-cb verdict */
 } iter_t;
 
 struct mrp_htbl_s {
-    bucket_t           *buckets;        /* hash table buckets */
-    size_t              nbucket;        /* this many of them */
-    mrp_list_hook_t     used;           /* buckets in use */
+    table_t             tbl;            /* active table */
+    table_t             old;            /* table being migrated, if any */
+    size_t              migrate;        /* next slot to migrate */
+    uint32_t            version;        /* bumped when tables change */
+    uint32_t            gen;            /* iteration generation */
     mrp_htbl_comp_fn_t  comp;           /* key comparison function */
     mrp_htbl_hash_fn_t  hash;           /* key hash function */
     mrp_htbl_free_fn_t  free;           /* function to free an entry */
@@ -65,58 +97,220 @@ struct mrp_htbl_s {
 };
 
 
-static size_t calc_buckets(size_t nbucket)
+static inline uint32_t mix_hash(uint32_t h)
 {
-    size_t n;
+    /* spread user hashes (often just a cast pointer) over all the bits */
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+
+    return h;
+}
 
-    if (nbucket < MIN_NBUCKET)
-        nbucket = MIN_NBUCKET;
-    if (nbucket > MAX_NBUCKET)
-        nbucket = MAX_NBUCKET;
 
-    for (n = MIN_NBUCKET; n < nbucket; n <<= 1)
+static size_t calc_size(size_t nentry)
+{
+    size_t n;
+
+    for (n = MIN_SIZE; n * 7 < nentry * 8; n <<= 1)
         ;
 
     return n;
 }
 
 
+static int table_alloc(table_t *t, size_t size)
+{
+    t->slots = mrp_alloc(size * (sizeof(*t->slots) + sizeof(*t->ctrl)));
+
+    if (t->slots == NULL)
+        return FALSE;
+
+    t->ctrl     = (uint8_t *)(t->slots + size);
+    t->size     = size;
+    t->nused    = 0;
+    t->ndeleted = 0;
+    memset(t->ctrl, CTRL_EMPTY, size);
+
+    return TRUE;
+}
+
+
+static void table_free(table_t *t)
+{
+    mrp_free(t->slots);
+    mrp_clear(t);
+}
+
+
+static inline int table_full(table_t *t)
+{
+    return (t->nused + t->ndeleted + 1) * 8 > t->size * 7;
+}
+
+
+static slot_t *table_find(mrp_htbl_t *ht, table_t *t, uint32_t hash,
+                          const void *key, const void *obj, int exact)
+{
+    size_t   mask, i, n;
+    uint8_t  c, h;
+    slot_t  *s;
+
+    if (t->size == 0)
+        return NULL;
+
+    mask = t->size - 1;
+    h    = CTRL_HASH(hash);
+
+    for (i = (hash >> 7) & mask, n = 0; n < t->size; i = (i + 1) & mask, n++) {
+        c = t->ctrl[i];
+
+        if (c == CTRL_EMPTY)
+            return NULL;
+
+        if (c != h)
+            continue;
+
+        s = t->slots + i;
+
+        if (s->hash != hash)
+            continue;
+
+        if (exact) {
+            if (s->key == key && s->obj == obj)
+                return s;
+        }
+        else {
+            if (!ht->comp(s->key, key))
+                return s;
+        }
+    }
+
+    return NULL;
+}
+
+
+static void table_place(table_t *t, uint32_t hash, void *key, void *obj,
+                        uint32_t stamp)
+{
+    size_t  mask, i;
+    slot_t *s;
+
+    mask = t->size - 1;
+
+    for (i = (hash >> 7) & mask; CTRL_USED(t->ctrl[i]); i = (i + 1) & mask)
+        ;
+
+    if (t->ctrl[i] == CTRL_DELETED)
+        t->ndeleted--;
+
+    t->ctrl[i] = CTRL_HASH(hash);
+    t->nused++;
+
+    s        = t->slots + i;
+    s->key   = key;
+    s->obj   = obj;
+    s->hash  = hash;
+    s->stamp = stamp;
+}
+
+
+static void table_delete(table_t *t, slot_t *s)
+{
+    size_t i    = s - t->slots;
+    size_t next = (i + 1) & (t->size - 1);
+
+    /* no probe sequence continues past an empty slot, no tombstone needed */
+    if (t->ctrl[next] == CTRL_EMPTY)
+        t->ctrl[i] = CTRL_EMPTY;
+    else {
+        t->ctrl[i] = CTRL_DELETED;
+        t->ndeleted++;
+    }
+
+    t->nused--;
+}
+
+
+static void migrate(mrp_htbl_t *ht, size_t nslot)
+{
+    table_t *o = &ht->old;
+    slot_t  *s;
+
+    while (nslot-- > 0 && ht->migrate < o->size) {
+        if (CTRL_USED(o->ctrl[ht->migrate])) {
+            s = o->slots + ht->migrate;
+            table_place(&ht->tbl, s->hash, s->key, s->obj, s->stamp);
+            o->ctrl[ht->migrate] = CTRL_DELETED;
+            o->nused--;
+        }
+
+        ht->migrate++;
+    }
+
+    if (o->nused == 0 || ht->migrate >= o->size) {
+        table_free(o);
+        ht->migrate = 0;
+        ht->version++;
+    }
+}
+
+
+static int grow(mrp_htbl_t *ht)
+{
+    table_t t;
+    size_t  size;
+
+    if (ht->old.size != 0)               /* should not happen, but... */
+        migrate(ht, ht->old.size);
+
+    /* double until at most half full, or just get rid of tombstones */
+    for (size = ht->tbl.size; (ht->tbl.nused + 1) * 2 > size; size <<= 1)
+        ;
+
+    if (!table_alloc(&t, size))
+        return FALSE;
+
+    ht->old     = ht->tbl;
+    ht->tbl     = t;
+    ht->migrate = 0;
+    ht->version++;
+
+    if (ht->old.nused == 0) {
+        table_free(&ht->old);
+        ht->version++;
+    }
+
+    return TRUE;
+}
+
+
 mrp_htbl_t *mrp_htbl_create(mrp_htbl_config_t *cfg)
 {
     mrp_htbl_t *ht;
-    size_t     i, nbucket;
+    size_t      nentry;
 
     if (cfg->comp && cfg->hash) {
         if ((ht = mrp_allocz(sizeof(*ht))) != NULL) {
-            if (cfg->nbucket != 0)
-                nbucket = cfg->nbucket;
+            if (cfg->nentry != 0)
+                nentry = cfg->nentry;
             else {
-                if (cfg->nentry != 0)
-                    nbucket = cfg->nentry / 4;
+                if (cfg->nbucket != 0)
+                    nentry = 4 * cfg->nbucket;
                 else
-                    nbucket = 4 * MIN_NBUCKET;
+                    nentry = 0;
             }
 
-            ht->nbucket = calc_buckets(nbucket);
-            ht->comp    = cfg->comp;
-            ht->hash    = cfg->hash;
-            ht->free    = cfg->free;
-
-            mrp_list_init(&ht->used);
-
-            ht->buckets = mrp_allocz(sizeof(*ht->buckets) * ht->nbucket);
-            if (ht->buckets != NULL) {
-                for (i = 0; i < ht->nbucket; i++) {
-                    mrp_list_init(&ht->buckets[i].entries);
-                    mrp_list_init(&ht->buckets[i].used);
-                }
+            ht->comp = cfg->comp;
+            ht->hash = cfg->hash;
+            ht->free = cfg->free;
 
+            if (table_alloc(&ht->tbl, calc_size(nentry)))
                 return ht;
-            }
-            else {
+            else
                 mrp_free(ht);
-                ht = NULL;
-            }
         }
     }
 
@@ -130,172 +324,200 @@ void mrp_htbl_destroy(mrp_htbl_t *ht, int free)
         if (free)
             mrp_htbl_reset(ht, free);
 
-        mrp_free(ht->buckets);
+        table_free(&ht->tbl);
+        table_free(&ht->old);
         mrp_free(ht);
     }
 }
 
 
-static inline void free_entry(mrp_htbl_t *ht, entry_t *entry, int free)
+static inline void free_entry(mrp_htbl_t *ht, void *key, void *obj, int free)
 {
     if (free && ht->free)
-        ht->free(entry->key, entry->obj);
-    mrp_free(entry);
+        ht->free(key, obj);
 }
 
 
-void mrp_htbl_reset(mrp_htbl_t *ht, int free)
+static void table_reset(mrp_htbl_t *ht, table_t *t, int free)
 {
-    mrp_list_hook_t *bp, *bn, *ep, *en;
-    bucket_t        *bucket;
-    entry_t         *entry;
+    size_t i;
 
-    mrp_list_foreach(&ht->used, bp, bn) {
-        bucket = mrp_list_entry(bp, bucket_t, used);
+    if (t->size == 0)
+        return;
 
-        mrp_list_foreach(&bucket->entries, ep, en) {
-            entry = mrp_list_entry(ep, entry_t, hook);
-            mrp_list_delete(ep);
-            free_entry(ht, entry, free);
-        }
+    for (i = 0; i < t->size; i++)
+        if (CTRL_USED(t->ctrl[i]))
+            free_entry(ht, t->slots[i].key, t->slots[i].obj, free);
 
-        mrp_list_delete(&bucket->used);
-    }
+    memset(t->ctrl, CTRL_EMPTY, t->size);
+    t->nused    = 0;
+    t->ndeleted = 0;
+}
+
+
+void mrp_htbl_reset(mrp_htbl_t *ht, int free)
+{
+    table_reset(ht, &ht->old, free);
+    table_reset(ht, &ht->tbl, free);
+
+    table_free(&ht->old);
+    ht->migrate = 0;
+    ht->version++;
 }
 
 
 int mrp_htbl_insert(mrp_htbl_t *ht, void *key, void *object)
 {
-    uint32_t  idx    = ht->hash(key) & (ht->nbucket - 1);
-    bucket_t *bucket = ht->buckets + idx;
-    int       first  = mrp_list_empty(&bucket->entries);
-    entry_t  *entry;
-
-    if ((entry = mrp_allocz(sizeof(*entry))) != NULL) {
-        entry->key = key;
-        entry->obj = object;
-        mrp_list_append(&bucket->entries, &entry->hook);
-        if (first)
-            mrp_list_append(&ht->used, &bucket->used);
-
-        return TRUE;
+    uint32_t hash = mix_hash(ht->hash(key));
+
+    if (ht->old.size != 0)
+        migrate(ht, MIGRATE_STEP);
+
+    if (table_full(&ht->tbl)) {
+        if (!grow(ht) && ht->tbl.nused + ht->tbl.ndeleted >= ht->tbl.size)
+            return FALSE;
     }
-    else
-        return FALSE;
+
+    /* entries added during iteration are not iterated over */
+    table_place(&ht->tbl, hash, key, object, ht->iter ? ht->gen : 0);
+
+    return TRUE;
 }
 
 
-static inline entry_t *lookup(mrp_htbl_t *ht, void *key, bucket_t **bucketp)
+static inline slot_t *lookup(mrp_htbl_t *ht, uint32_t hash, const void *key,
+                             const void *obj, int exact, table_t **tp)
 {
-    uint32_t        idx    = ht->hash(key) & (ht->nbucket - 1);
-    bucket_t       *bucket = ht->buckets + idx;
-    mrp_list_hook_t *p, *n;
-    entry_t        *entry;
-
-    mrp_list_foreach(&bucket->entries, p, n) {
-        entry = mrp_list_entry(p, entry_t, hook);
-
-        if (!ht->comp(entry->key, key)) {
-            if (bucketp != NULL)
-                *bucketp = bucket;
-            return entry;
-        }
-    }
+    slot_t *s;
 
-    return NULL;
+    if ((s = table_find(ht, &ht->tbl, hash, key, obj, exact)) != NULL)
+        *tp = &ht->tbl;
+    else if ((s = table_find(ht, &ht->old, hash, key, obj, exact)) != NULL)
+        *tp = &ht->old;
+
+    return s;
 }
 
 
 void *mrp_htbl_lookup(mrp_htbl_t *ht, void *key)
 {
-    entry_t *entry;
+    table_t *t;
+    slot_t  *s;
 
-    entry = lookup(ht, key, NULL);
-    if (entry != NULL)
-        return entry->obj;
+    s = lookup(ht, mix_hash(ht->hash(key)), key, NULL, FALSE, &t);
+
+    if (s != NULL)
+        return s->obj;
     else
         return NULL;
 }
 
 
-static void delete_from_bucket(mrp_htbl_t *ht, bucket_t *bucket, entry_t *entry)
+void *mrp_htbl_remove(mrp_htbl_t *ht, void *key, int free)
 {
-    mrp_list_hook_t *eh = &entry->hook;
+    uint32_t  hash = mix_hash(ht->hash(key));
+    iter_t   *it   = ht->iter;
+    table_t  *t;
+    slot_t   *s;
+    void     *k, *object;
+
+    if (ht->old.size != 0)
+        migrate(ht, MIGRATE_STEP);
+
+    if ((s = lookup(ht, hash, key, NULL, FALSE, &t)) == NULL)
+        return NULL;
 
+    k      = s->key;
+    object = s->obj;
+    table_delete(t, s);
 
     /*
-     * If there is an iterator active and this entry would
-     * have been the next one to iterate over, we need to
-     * update the iterator to skip to the next entry instead
-     * as this one will be removed. Failing to update the
-     * iterator could crash mrp_htbl_foreach or drive it into
-     * an infinite loop.
+     * If the entry is being iterated over, we only mark it removed and
+     * let mrp_htbl_foreach take care of freeing it once the callback has
+     * returned.
      */
 
-    if (ht->iter != NULL && ht->iter->en == eh)
-        ht->iter->en = eh->next;
+    if (it != NULL && !it->removed && it->key == k && it->obj == object) {
+        it->removed = TRUE;
+        it->verdict = free ? MRP_HTBL_ITER_DELETE : 0;
+    }
+    else
+        free_entry(ht, k, object, free);
+
+    return object;
+}
 
-    mrp_list_delete(eh);
 
+static void next_generation(mrp_htbl_t *ht)
+{
+    size_t i;
 
-    /*
-     * If the bucket became empty, unlink it from the used list.
-     * If also there is an iterator active and this bucket would
-     * have been the next one to iterate over, we need to
-     * update the iterator to skip to the next bucket instead
-     * as this one just became empty and will be removed from
-     * the used bucket list. Failing to update the iterator
-     * could drive mrp_htbl_foreach into an infinite loop
-     * because of the unexpected hop from the used bucket list
-     * (to a single empty bucket).
-     */
+    if (++ht->gen != 0)
+        return;
 
-    if (mrp_list_empty(&bucket->entries)) {
-        if (ht->iter != NULL && ht->iter->bn == &bucket->used)
-                ht->iter->bn = bucket->used.next;
+    /* wrapped around, clear stale stamps */
+    for (i = 0; i < ht->tbl.size; i++)
+        ht->tbl.slots[i].stamp = 0;
+    for (i = 0; i < ht->old.size; i++)
+        ht->old.slots[i].stamp = 0;
 
-        mrp_list_delete(&bucket->used);
-    }
+    ht->gen = 1;
 }
 
 
-void *mrp_htbl_remove(mrp_htbl_t *ht, void *key, int free)
+/*
+ * Pick the next entry to iterate over, or return FALSE when done. Both
+ * tables are scanned for entries not yet visited by this iteration and
+ * the scan is restarted if the tables have been reorganized since the
+ * last call.
+ */
+static int iter_next(mrp_htbl_t *ht, uint32_t *version, int *tbl, size_t *idx)
 {
-    bucket_t *bucket;
-    entry_t  *entry;
-    void     *object;
+    table_t *t;
+    slot_t  *s;
 
-    /*
-     * We need to check the found entry and its hash-bucket
-     * against any potentially active iterator. Special care
-     * needs to be taken if the entry is being iterated over
-     * or if the bucket becomes empty and it would be the next
-     * bucket to iterate over. The former is taken care of
-     * here while the latter is handled in delete_from_bucket.
-     */
-    if ((entry = lookup(ht, key, &bucket)) != NULL) {
-        delete_from_bucket(ht, bucket, entry);
-        object = entry->obj;
+    if (*version != ht->version) {
+        *version = ht->version;
+        *tbl     = 0;
+        *idx     = 0;
+    }
 
-        if (ht->iter != NULL && entry == ht->iter->entry) /* being iterated */
-            ht->iter->verdict = free ? MRP_HTBL_ITER_DELETE : 0;
-        else {
-            free_entry(ht, entry, free);
+    for (; *tbl < 2; (*tbl)++, *idx = 0) {
+        t = *tbl == 0 ? &ht->old : &ht->tbl;
+
+        for (; *idx < t->size; (*idx)++) {
+            if (!CTRL_USED(t->ctrl[*idx]))
+                continue;
+
+            s = t->slots + *idx;
+
+            if (s->stamp == ht->gen)
+                continue;
+
+            s->stamp = ht->gen;
+            ht->iter->key     = s->key;
+            ht->iter->obj     = s->obj;
+            ht->iter->hash    = s->hash;
+            ht->iter->removed = FALSE;
+            ht->iter->verdict = 0;
+            (*idx)++;
+
+            return TRUE;
         }
     }
-    else
-        object = NULL;
 
-    return object;
+    return FALSE;
 }
 
 
 int mrp_htbl_foreach(mrp_htbl_t *ht, mrp_htbl_iter_cb_t cb, void *user_data)
 {
     iter_t    iter;
-    bucket_t *bucket;
-    entry_t  *entry;
-    int       cb_verdict, ht_verdict;
+    table_t  *t;
+    slot_t   *s;
+    uint32_t  version;
+    size_t    idx;
+    int       tbl, cb_verdict, ht_verdict;
 
     /*
      * Now we can only handle a single callback-based iterator.
@@ -306,35 +528,38 @@ int mrp_htbl_foreach(mrp_htbl_t *ht, mrp_htbl_iter_cb_t cb, void *user_data)
 
     mrp_clear(&iter);
     ht->iter = &iter;
+    next_generation(ht);
 
-    mrp_list_foreach(&ht->used, iter.bp, iter.bn) {
-        bucket = mrp_list_entry(iter.bp, bucket_t, used);
+    version = ht->version;
+    tbl     = 0;
+    idx     = 0;
 
-        mrp_list_foreach(&bucket->entries, iter.ep, iter.en) {
-            iter.entry = entry = mrp_list_entry(iter.ep, entry_t, hook);
-            cb_verdict = cb(entry->key, entry->obj, user_data);
-            ht_verdict = iter.verdict;
+    while (iter_next(ht, &version, &tbl, &idx)) {
+        cb_verdict = cb(iter.key, iter.obj, user_data);
+        ht_verdict = iter.verdict;
 
-            /* delete was called from cb (unhashed entry and marked it) */
-            if (ht_verdict & MRP_HTBL_ITER_DELETE) {
-                free_entry(ht, entry, TRUE);
-            }
-            else {
-                /* cb wants us to unhash (safe even if unhashed in remove) */
-                if (cb_verdict & MRP_HTBL_ITER_UNHASH)
-                    mrp_list_delete(iter.ep);
-                /* cb want us to free entry (and remove was not called) */
-                if (cb_verdict & MRP_HTBL_ITER_DELETE)
-                    free_entry(ht, entry, TRUE);
-
-                /* cb wants to stop iterating */
-                if (!(cb_verdict & MRP_HTBL_ITER_MORE))
-                    goto out;
+        /* delete was called from cb (unhashed entry and marked it) */
+        if (ht_verdict & MRP_HTBL_ITER_DELETE) {
+            free_entry(ht, iter.key, iter.obj, TRUE);
+        }
+        else {
+            /* cb wants us to unhash (unless already unhashed in remove) */
+            if ((cb_verdict & MRP_HTBL_ITER_UNHASH) && !iter.removed) {
+                s = lookup(ht, iter.hash, iter.key, iter.obj, TRUE, &t);
+
+                if (s != NULL)
+                    table_delete(t, s);
             }
+            /* cb want us to free entry (and remove was not called) */
+            if (cb_verdict & MRP_HTBL_ITER_DELETE)
+                free_entry(ht, iter.key, iter.obj, TRUE);
+
+            /* cb wants to stop iterating */
+            if (!(cb_verdict & MRP_HTBL_ITER_MORE))
+                break;
         }
     }
 
- out:
     ht->iter = NULL;
 
     return TRUE;
@@ -344,8 +569,10 @@ int mrp_htbl_foreach(mrp_htbl_t *ht, mrp_htbl_iter_cb_t cb, void *user_data)
 void *mrp_htbl_find(mrp_htbl_t *ht, mrp_htbl_find_cb_t cb, void *user_data)
 {
     iter_t    iter;
-    bucket_t *bucket;
-    entry_t  *entry, *found;
+    uint32_t  version;
+    size_t    idx;
+    int       tbl;
+    void     *found;
 
     /*
      * Bail out if there is also an iterator active...
@@ -355,22 +582,20 @@ void *mrp_htbl_find(mrp_htbl_t *ht, mrp_htbl_find_cb_t cb, void *user_data)
 
     mrp_clear(&iter);
     ht->iter = &iter;
-    found    = NULL;
+    next_generation(ht);
 
-    mrp_list_foreach(&ht->used, iter.bp, iter.bn) {
-        bucket = mrp_list_entry(iter.bp, bucket_t, used);
+    version = ht->version;
+    tbl     = 0;
+    idx     = 0;
+    found   = NULL;
 
-        mrp_list_foreach(&bucket->entries, iter.ep, iter.en) {
-            entry = mrp_list_entry(iter.ep, entry_t, hook);
-
-            if (cb(entry->key, entry->obj, user_data)) {
-                found = entry->obj;
-                goto out;
-            }
+    while (iter_next(ht, &version, &tbl, &idx)) {
+        if (cb(iter.key, iter.obj, user_data)) {
+            found = iter.obj;
+            break;
         }
     }
 
- out:
     ht->iter = NULL;
 
     return found;
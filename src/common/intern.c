@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <pthread.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
+#include <murphy/common/log.h>
+#include <murphy/common/utils.h>
+#include <murphy/common/hashtbl.h>
+#include <murphy/common/intern.h>
+
+/*
+ * Interned strings are stored inline after their reference count, so
+ * the canonical pointer handed out is enough to get back to the entry.
+ * The table is keyed by the string itself and only ever looked up with
+ * the lock held.
+ */
+
+typedef struct {
+    int  refcnt;                         /* number of references */
+    char str[0];                         /* the interned string */
+} intern_t;
+
+static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
+static mrp_htbl_t      *strings;
+
+
+static inline intern_t *intern_entry(const char *str)
+{
+    return (intern_t *)(str - MRP_OFFSET(intern_t, str));
+}
+
+
+static int create_table(void)
+{
+    mrp_htbl_config_t hcfg;
+
+    if (strings != NULL)
+        return 0;
+
+    mrp_clear(&hcfg);
+    hcfg.comp    = mrp_string_comp;
+    hcfg.hash    = mrp_string_hash;
+    hcfg.free    = NULL;
+    hcfg.nbucket = 256;
+
+    strings = mrp_htbl_create(&hcfg);
+
+    return strings != NULL ? 0 : -1;
+}
+
+
+const char *mrp_intern(const char *str)
+{
+    intern_t *e;
+    size_t    len;
+
+    if (str == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&lock);
+
+    if (create_table() < 0)
+        goto fail;
+
+    if ((e = mrp_htbl_lookup(strings, (void *)str)) != NULL) {
+        e->refcnt++;
+        pthread_mutex_unlock(&lock);
+
+        return e->str;
+    }
+
+    len = strlen(str);
+    e   = mrp_alloc(sizeof(*e) + len + 1);
+
+    if (e == NULL)
+        goto fail;
+
+    e->refcnt = 1;
+    memcpy(e->str, str, len + 1);
+
+    if (!mrp_htbl_insert(strings, e->str, e)) {
+        mrp_free(e);
+        goto fail;
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return e->str;
+
+ fail:
+    pthread_mutex_unlock(&lock);
+
+    return NULL;
+}
+
+
+const char *mrp_intern_ref(const char *str)
+{
+    if (str != NULL) {
+        pthread_mutex_lock(&lock);
+        intern_entry(str)->refcnt++;
+        pthread_mutex_unlock(&lock);
+    }
+
+    return str;
+}
+
+
+void mrp_intern_unref(const char *str)
+{
+    intern_t *e;
+
+    if (str == NULL)
+        return;
+
+    pthread_mutex_lock(&lock);
+
+    e = intern_entry(str);
+
+    if (--e->refcnt == 0) {
+        mrp_htbl_remove(strings, e->str, FALSE);
+        mrp_free(e);
+    }
+    else if (e->refcnt < 0)
+        mrp_log_error("Reference-counting bug for interned string '%s'.", str);
+
+    pthread_mutex_unlock(&lock);
+}
+
+
+const char *mrp_intern_lookup(const char *str)
+{
+    intern_t *e;
+
+    if (str == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&lock);
+
+    if (strings != NULL && (e = mrp_htbl_lookup(strings, (void *)str)) != NULL)
+        str = e->str;
+    else
+        str = NULL;
+
+    pthread_mutex_unlock(&lock);
+
+    return str;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MURPHY_INTERN_H__
+#define __MURPHY_INTERN_H__
+
+/** \file
+ * Process-wide interning of strings.
+ *
+ * Interning a string returns a canonical, reference-counted copy of it.
+ * All interned copies of equal strings are the same pointer, so names
+ * interned by different subsystems share memory and can be compared for
+ * (case-sensitive) equality by pointer. The table is thread-safe.
+ */
+
+#include <murphy/common/macros.h>
+
+MRP_CDECL_BEGIN
+
+/** Intern str, returning its canonical copy with a new reference or NULL. */
+const char *mrp_intern(const char *str);
+
+/** Add a reference to an already interned string. */
+const char *mrp_intern_ref(const char *str);
+
+/** Drop a reference to an interned string, freeing it with the last one. */
+void mrp_intern_unref(const char *str);
+
+/** Look up the canonical copy of str without adding a reference. */
+const char *mrp_intern_lookup(const char *str);
+
+MRP_CDECL_END
+
+#endif /* __MURPHY_INTERN_H__ */
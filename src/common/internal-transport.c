@@ -49,16 +49,22 @@ struct internal_s {
     internal_t *endpoint; /* that we are connected to */
 };
 
+/*
+ * A queued message. Messages are passed to the receiving endpoint by
+ * reference without encoding them, unless the receiver is not in message
+ * mode or the message lives in the dispatch arena of the mainloop (and
+ * would be gone by the time it gets delivered), in which case we fall
+ * back to passing it encoded. Other data is always passed encoded.
+ */
 typedef struct {
     void *data;
     size_t size;
     internal_t *u;
-    mrp_sockaddr_t *addr;
+    mrp_sockaddr_t addr;
     socklen_t addrlen;
     bool free_data;
     int offset;
-    bool custom;
-    uint16_t tag;
+    mrp_msg_t *msg; /* message passed by reference */
 
     mrp_list_hook_t hook;
 } internal_message_t;
@@ -72,6 +78,83 @@ static mrp_deferred_t *d;
 static uint32_t cid;
 
 
+static void free_message(internal_message_t *msg)
+{
+    mrp_list_delete(&msg->hook);
+
+    if (msg->msg)
+        mrp_msg_unref(msg->msg);
+
+    if (msg->free_data)
+        mrp_free(msg->data);
+
+    mrp_free(msg);
+}
+
+
+static internal_message_t *queue_message(internal_t *u, mrp_sockaddr_t *addr,
+                                         socklen_t addrlen)
+{
+    internal_message_t *msg;
+
+    msg = mrp_allocz(sizeof(internal_message_t));
+
+    if (!msg)
+        return NULL;
+
+    if (addr) {
+        memcpy(msg->addr.data, addr->data, MRP_SOCKADDR_SIZE);
+        msg->addrlen = addrlen;
+    }
+
+    msg->u = u;
+
+    mrp_list_init(&msg->hook);
+    mrp_list_append(&msg_queue, &msg->hook);
+
+    mrp_enable_deferred(d);
+
+    return msg;
+}
+
+
+static void deliver_message(internal_t *endpoint, internal_message_t *msg)
+{
+    mrp_transport_t *t = (mrp_transport_t *) endpoint;
+    void *buf;
+    ssize_t size;
+
+    if (t->mode == MRP_TRANSPORT_MODE_MSG) {
+        if (t->connected) {
+            MRP_TRANSPORT_BUSY(t, {
+                    t->evt.recvmsg(t, msg->msg, t->user_data);
+                });
+        }
+        else {
+            MRP_TRANSPORT_BUSY(t, {
+                    t->evt.recvmsgfrom(t, msg->msg, &msg->u->address,
+                                       MRP_SOCKADDR_SIZE, t->user_data);
+                });
+        }
+
+        t->check_destroy(t);
+        return;
+    }
+
+    /* receiver expects something else, let it decode what it needs */
+    size = mrp_msg_default_encode(msg->msg, &buf);
+
+    if (size <= 0 || buf == NULL) {
+        mrp_log_error("failed to encode message for endpoint");
+        return;
+    }
+
+    endpoint->recv_data(t, buf, size, &msg->u->address, MRP_SOCKADDR_SIZE);
+
+    mrp_free(buf);
+}
+
+
 static void process_queue(mrp_deferred_t *d, void *user_data)
 {
     internal_message_t *msg;
@@ -86,24 +169,19 @@ static void process_queue(mrp_deferred_t *d, void *user_data)
 
         msg = mrp_list_entry(p, typeof(*msg), hook);
 
-        if (!msg) {
-            mrp_log_error("no message!");
-            goto end;
-        }
-
         if (!msg->u->connected) {
-            if (!msg->addr) {
+            if (!msg->addrlen) {
                 mrp_log_error("connected transport without address!");
                 goto end;
             }
 
             /* Find the recipient. Look first from the server table.*/
-            endpoint = mrp_htbl_lookup(servers, msg->addr->data);
+            endpoint = mrp_htbl_lookup(servers, msg->addr.data);
 
             if (!endpoint) {
 
                 /* Look next from the general connections table. */
-                endpoint = mrp_htbl_lookup(connections, msg->addr->data);
+                endpoint = mrp_htbl_lookup(connections, msg->addr.data);
             }
         }
         else {
@@ -115,26 +193,25 @@ static void process_queue(mrp_deferred_t *d, void *user_data)
             goto end;
         }
 
-        /* skip the length word when sending */
-        endpoint->recv_data(
+        /*
+         * Notice that the receiver can close transports from its callback,
+         * which in turn removes queued messages. Take the message off the
+         * queue first and pick up the next one only once we're done.
+         */
+        mrp_list_delete(&msg->hook);
+
+        if (msg->msg)
+            deliver_message(endpoint, msg);
+        else
+            /* skip the length word when sending */
+            endpoint->recv_data(
                 (mrp_transport_t *) endpoint, msg->data + msg->offset,
                 msg->size, &msg->u->address, MRP_SOCKADDR_SIZE);
 
-end:
-        if (msg) {
-
-            if (msg->free_data) {
-                if (msg->custom) {
-                    /* FIXME: should be mrp_data_free(msg->data, msg->tag); */
-                    mrp_free(msg->data);
-                }
-                else
-                    mrp_msg_unref(msg->data);
-            }
+        n = msg_queue.next;
 
-            mrp_list_delete(&msg->hook);
-            mrp_free(msg);
-        }
+end:
+        free_message(msg);
     }
 }
 
@@ -301,24 +378,16 @@ static void remove_messages(internal_t *u)
     internal_message_t *msg;
     mrp_list_hook_t *p, *n;
 
+    /* remove all messages from or to the given transport */
     mrp_list_foreach(&msg_queue, p, n) {
         msg = mrp_list_entry(p, typeof(*msg), hook);
 
-        if (strcmp(msg->addr->data, u->name) == 0
-            || strcmp(msg->addr->data, u->address.data) == 0) {
-
-            if (msg->free_data) {
-                if (msg->custom) {
-                    /* FIXME: should be mrp_data_free(msg->data, msg->tag); */
-                    mrp_free(msg->data);
-                }
-                else
-                    mrp_msg_unref(msg->data);
-            }
-
-            mrp_list_delete(&msg->hook);
-            mrp_free(msg);
-        }
+        if (msg->u == u
+            || (!msg->addrlen && msg->u->endpoint == u)
+            || (msg->addrlen && (strcmp(msg->addr.data, u->name) == 0
+                                 || strcmp(msg->addr.data,
+                                           u->address.data) == 0)))
+            free_message(msg);
     }
 }
 
@@ -400,33 +469,39 @@ static int internal_sendto(mrp_transport_t *mu, mrp_msg_t *data,
 {
     internal_t *u = (internal_t *)mu;
     void *buf;
-    size_t size;
+    ssize_t size;
     internal_message_t *msg;
 
-    size = mrp_msg_default_encode(data, &buf);
+    if (data->arena) {
+        size = mrp_msg_default_encode(data, &buf);
 
-    if (size == 0 || buf == NULL) {
-        return FALSE;
+        if (size <= 0 || buf == NULL) {
+            return FALSE;
+        }
+    }
+    else {
+        buf = NULL;
+        size = 0;
     }
 
-    msg = mrp_allocz(sizeof(internal_message_t));
+    msg = queue_message(u, addr, addrlen);
 
-    if (!msg)
+    if (!msg) {
+        mrp_free(buf);
         return FALSE;
+    }
 
-    msg->addr = addr;
-    msg->addrlen = addrlen;
-    msg->data = buf;
-    msg->free_data = FALSE;
-    msg->offset = 0;
-    msg->size = size;
-    msg->u = u;
-    msg->custom = FALSE;
-
-    mrp_list_init(&msg->hook);
-    mrp_list_append(&msg_queue, &msg->hook);
+    if (buf) {
+        msg->data = buf;
+        msg->size = size;
+        msg->free_data = TRUE;
+    }
+    else {
+        if (mu->flags & MRP_TRANSPORT_FREEZE)
+            mrp_msg_freeze(data);
 
-    mrp_enable_deferred(d);
+        msg->msg = mrp_msg_ref(data);
+    }
 
     return TRUE;
 }
@@ -448,24 +523,20 @@ static int internal_sendrawto(mrp_transport_t *mu, void *data, size_t size,
     internal_t *u = (internal_t *)mu;
     internal_message_t *msg;
 
-    msg = mrp_allocz(sizeof(internal_message_t));
+    msg = queue_message(u, addr, addrlen);
 
     if (!msg)
         return FALSE;
 
-    msg->addr = addr;
-    msg->addrlen = addrlen;
-    msg->data = data;
-    msg->free_data = FALSE;
-    msg->offset = 0;
+    /* delivery is deferred, so we can't hang on to the caller's buffer */
+    msg->data = mrp_datadup(data, size);
     msg->size = size;
-    msg->u = u;
-    msg->custom = FALSE;
-
-    mrp_list_init(&msg->hook);
-    mrp_list_append(&msg_queue, &msg->hook);
+    msg->free_data = TRUE;
 
-    mrp_enable_deferred(d);
+    if (!msg->data) {
+        free_message(msg);
+        return FALSE;
+    }
 
     return TRUE;
 }
@@ -529,33 +600,24 @@ static int internal_senddatato(mrp_transport_t *mu, void *data, uint16_t tag,
     if (type == NULL)
         return FALSE;
 
-    msg = mrp_allocz(sizeof(internal_message_t));
-
-    if (!msg)
-        return FALSE;
-
     size = encode_custom_data(data, &newdata, tag);
 
     if (!newdata) {
         mrp_log_error("custom data encoding failed");
-        mrp_free(msg);
         return FALSE;
     }
 
-    msg->addr = addr;
-    msg->addrlen = addrlen;
+    msg = queue_message(u, addr, addrlen);
+
+    if (!msg) {
+        mrp_free(newdata);
+        return FALSE;
+    }
+
     msg->data = newdata;
     msg->free_data = TRUE;
     msg->offset = 4;
     msg->size = size;
-    msg->u = u;
-    msg->custom = TRUE;
-    msg->tag = tag;
-
-    mrp_list_init(&msg->hook);
-    mrp_list_append(&msg_queue, &msg->hook);
-
-    mrp_enable_deferred(d);
 
     return TRUE;
 }
@@ -28,6 +28,9 @@
  */
 
 #include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 #include <stdarg.h>
 #include <string.h>
 
@@ -35,6 +38,7 @@
 #include <murphy/common/macros.h>
 #include <murphy/common/log.h>
 #include <murphy/common/debug.h>
+#include <murphy/common/mm.h>
 #include <murphy/common/json.h>
 
 /** Type for a JSON parser. */
@@ -597,3 +601,713 @@ int mrp_json_parse_object(char **strp, int *lenp, mrp_json_t **op)
     *op = o;
     return res;
 }
+
+
+/*
+ * streaming JSON writer
+ */
+
+#define WRITER_CHUNK 256
+
+int mrp_json_writer_init(mrp_json_writer_t *w, size_t size)
+{
+    mrp_clear(w);
+
+    if (size > 0) {
+        if ((w->buf = mrp_alloc(size)) == NULL)
+            return FALSE;
+
+        w->size = size;
+    }
+
+    return TRUE;
+}
+
+
+void mrp_json_writer_reset(mrp_json_writer_t *w)
+{
+    w->used  = 0;
+    w->depth = 0;
+    w->items = 0;
+    w->error = 0;
+}
+
+
+void mrp_json_writer_cleanup(mrp_json_writer_t *w)
+{
+    mrp_free(w->buf);
+    mrp_clear(w);
+}
+
+
+static int writer_reserve(mrp_json_writer_t *w, size_t n)
+{
+    size_t size;
+
+    if (w->error)
+        return FALSE;
+
+    if (w->used + n + 1 <= w->size)
+        return TRUE;
+
+    size = w->size ? w->size : WRITER_CHUNK;
+
+    while (size < w->used + n + 1)
+        size *= 2;
+
+    if (!mrp_realloc(w->buf, size)) {
+        w->error = ENOMEM;
+        return FALSE;
+    }
+
+    w->size = size;
+
+    return TRUE;
+}
+
+
+static inline int writer_put(mrp_json_writer_t *w, const char *s, size_t n)
+{
+    if (!writer_reserve(w, n))
+        return FALSE;
+
+    memcpy(w->buf + w->used, s, n);
+    w->used += n;
+
+    return TRUE;
+}
+
+
+static int writer_quote(mrp_json_writer_t *w, const char *s)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *p;
+    char        esc[6];
+    size_t      n;
+    int         c;
+
+    if (!writer_put(w, "\"", 1))
+        return FALSE;
+
+    /* copy runs of characters that need no escaping in one go */
+    for (p = s; *p; s = ++p) {
+        while (*p && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20)
+            p++;
+
+        if (p > s && !writer_put(w, s, p - s))
+            return FALSE;
+
+        if (!*p)
+            break;
+
+        c      = (unsigned char)*p;
+        esc[0] = '\\';
+        n      = 2;
+
+        switch (c) {
+        case '"':  esc[1] = '"';  break;
+        case '\\': esc[1] = '\\'; break;
+        case '\b': esc[1] = 'b';  break;
+        case '\f': esc[1] = 'f';  break;
+        case '\n': esc[1] = 'n';  break;
+        case '\r': esc[1] = 'r';  break;
+        case '\t': esc[1] = 't';  break;
+        default:
+            esc[1] = 'u';
+            esc[2] = '0';
+            esc[3] = '0';
+            esc[4] = hex[c >> 4];
+            esc[5] = hex[c & 0xf];
+            n      = 6;
+        }
+
+        if (!writer_put(w, esc, n))
+            return FALSE;
+    }
+
+    return writer_put(w, "\"", 1);
+}
+
+
+static int writer_begin_item(mrp_json_writer_t *w, const char *key)
+{
+    uint32_t bit = 1 << w->depth;
+
+    if (w->error)
+        return FALSE;
+
+    if (w->depth == 0 && w->used > 0) {
+        w->error = EINVAL;
+        return FALSE;
+    }
+
+    if (w->items & bit) {
+        if (!writer_put(w, ",", 1))
+            return FALSE;
+    }
+    else
+        w->items |= bit;
+
+    if (key != NULL)
+        return writer_quote(w, key) && writer_put(w, ":", 1);
+    else
+        return TRUE;
+}
+
+
+static int writer_open(mrp_json_writer_t *w, const char *key, char c)
+{
+    if (w->depth >= MRP_JSON_STREAM_MAXDEPTH) {
+        w->error = EOVERFLOW;
+        return FALSE;
+    }
+
+    if (!writer_begin_item(w, key) || !writer_put(w, &c, 1))
+        return FALSE;
+
+    w->depth++;
+    w->items &= ~(1 << w->depth);
+
+    return TRUE;
+}
+
+
+static int writer_close(mrp_json_writer_t *w, char c)
+{
+    if (w->error)
+        return FALSE;
+
+    if (w->depth <= 0) {
+        w->error = EINVAL;
+        return FALSE;
+    }
+
+    w->depth--;
+
+    return writer_put(w, &c, 1);
+}
+
+
+const char *mrp_json_writer_output(mrp_json_writer_t *w, size_t *sizep)
+{
+    if (w->error || w->depth != 0 || w->used == 0) {
+        errno = w->error ? w->error : EINVAL;
+        return NULL;
+    }
+
+    w->buf[w->used] = '\0';
+
+    if (sizep != NULL)
+        *sizep = w->used;
+
+    return w->buf;
+}
+
+
+int mrp_json_write_object_begin(mrp_json_writer_t *w, const char *key)
+{
+    return writer_open(w, key, '{');
+}
+
+
+int mrp_json_write_object_end(mrp_json_writer_t *w)
+{
+    return writer_close(w, '}');
+}
+
+
+int mrp_json_write_array_begin(mrp_json_writer_t *w, const char *key)
+{
+    return writer_open(w, key, '[');
+}
+
+
+int mrp_json_write_array_end(mrp_json_writer_t *w)
+{
+    return writer_close(w, ']');
+}
+
+
+int mrp_json_write_string(mrp_json_writer_t *w, const char *key,
+                          const char *s)
+{
+    if (!writer_begin_item(w, key))
+        return FALSE;
+
+    if (s != NULL)
+        return writer_quote(w, s);
+    else
+        return writer_put(w, "null", 4);
+}
+
+
+int mrp_json_write_integer(mrp_json_writer_t *w, const char *key, int i)
+{
+    char num[32];
+    int  n;
+
+    if (!writer_begin_item(w, key))
+        return FALSE;
+
+    n = snprintf(num, sizeof(num), "%d", i);
+
+    return writer_put(w, num, n);
+}
+
+
+int mrp_json_write_unsigned(mrp_json_writer_t *w, const char *key,
+                            uint32_t u)
+{
+    char num[32];
+    int  n;
+
+    if (!writer_begin_item(w, key))
+        return FALSE;
+
+    n = snprintf(num, sizeof(num), "%u", u);
+
+    return writer_put(w, num, n);
+}
+
+
+int mrp_json_write_double(mrp_json_writer_t *w, const char *key, double d)
+{
+    char num[64];
+    int  n;
+
+    if (!writer_begin_item(w, key))
+        return FALSE;
+
+    if (!isfinite(d))
+        return writer_put(w, "null", 4);
+
+    n = snprintf(num, sizeof(num), "%.17g", d);
+
+    /* make sure the value is read back as a double, not an integer */
+    if (strpbrk(num, ".eE") == NULL && n < (int)sizeof(num) - 2) {
+        num[n++] = '.';
+        num[n++] = '0';
+    }
+
+    return writer_put(w, num, n);
+}
+
+
+int mrp_json_write_boolean(mrp_json_writer_t *w, const char *key, int b)
+{
+    if (!writer_begin_item(w, key))
+        return FALSE;
+
+    if (b)
+        return writer_put(w, "true", 4);
+    else
+        return writer_put(w, "false", 5);
+}
+
+
+int mrp_json_write_null(mrp_json_writer_t *w, const char *key)
+{
+    if (!writer_begin_item(w, key))
+        return FALSE;
+
+    return writer_put(w, "null", 4);
+}
+
+
+/*
+ * pull-style JSON reader
+ */
+
+enum {
+    READER_VALUE = 0,                    /* expecting a value */
+    READER_FIRST,                        /* first item or end of container */
+    READER_KEY,                          /* expecting a member name */
+    READER_NEXT,                         /* a comma or end of container */
+    READER_DONE,                         /* done with the top-level value */
+    READER_ERROR,                        /* encountered an error */
+};
+
+
+void mrp_json_reader_init(mrp_json_reader_t *r, char *buf, size_t size)
+{
+    mrp_clear(r);
+
+    r->p     = buf;
+    r->end   = buf + size;
+    r->state = READER_VALUE;
+}
+
+
+static inline void reader_skip_space(mrp_json_reader_t *r)
+{
+    while (r->p < r->end &&
+           (*r->p == ' ' || *r->p == '\t' || *r->p == '\n' || *r->p == '\r'))
+        r->p++;
+}
+
+
+static int reader_hex4(const char *p, uint32_t *cp)
+{
+    uint32_t v;
+    int      i, c;
+
+    for (i = 0, v = 0; i < 4; i++) {
+        c = (unsigned char)p[i];
+
+        if      (c >= '0' && c <= '9') v = (v << 4) | (c - '0');
+        else if (c >= 'a' && c <= 'f') v = (v << 4) | (c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') v = (v << 4) | (c - 'A' + 10);
+        else
+            return FALSE;
+    }
+
+    *cp = v;
+
+    return TRUE;
+}
+
+
+static char *reader_utf8(char *q, uint32_t cp)
+{
+    if (cp < 0x80)
+        *q++ = cp;
+    else if (cp < 0x800) {
+        *q++ = 0xc0 | (cp >> 6);
+        *q++ = 0x80 | (cp & 0x3f);
+    }
+    else if (cp < 0x10000) {
+        *q++ = 0xe0 | (cp >> 12);
+        *q++ = 0x80 | ((cp >> 6) & 0x3f);
+        *q++ = 0x80 | (cp & 0x3f);
+    }
+    else {
+        *q++ = 0xf0 | (cp >> 18);
+        *q++ = 0x80 | ((cp >> 12) & 0x3f);
+        *q++ = 0x80 | ((cp >> 6) & 0x3f);
+        *q++ = 0x80 | (cp & 0x3f);
+    }
+
+    return q;
+}
+
+
+static int reader_string(mrp_json_reader_t *r, mrp_json_token_t *tok)
+{
+    char     *p, *q, *s;
+    uint32_t  cp, lo;
+
+    /*
+     * Notes:
+     *     Strings are decoded in place. An escape sequence never decodes
+     *     to more bytes than it takes up in the input, so the output can
+     *     trail the input safely. Once done we NUL-terminate the string,
+     *     overwriting at most the closing quote.
+     */
+
+    s = q = p = r->p + 1;
+
+    while (p < r->end && *p != '"') {
+        if ((unsigned char)*p < 0x20)
+            return FALSE;
+
+        if (*p != '\\') {
+            *q++ = *p++;
+            continue;
+        }
+
+        if (++p >= r->end)
+            return FALSE;
+
+        switch (*p++) {
+        case '"':  *q++ = '"';  break;
+        case '\\': *q++ = '\\'; break;
+        case '/':  *q++ = '/';  break;
+        case 'b':  *q++ = '\b'; break;
+        case 'f':  *q++ = '\f'; break;
+        case 'n':  *q++ = '\n'; break;
+        case 'r':  *q++ = '\r'; break;
+        case 't':  *q++ = '\t'; break;
+        case 'u':
+            if (r->end - p < 4 || !reader_hex4(p, &cp))
+                return FALSE;
+            p += 4;
+
+            if (cp >= 0xd800 && cp <= 0xdbff) {
+                if (r->end - p < 6 || p[0] != '\\' || p[1] != 'u' ||
+                    !reader_hex4(p + 2, &lo) || lo < 0xdc00 || lo > 0xdfff)
+                    return FALSE;
+                p += 6;
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+            }
+
+            if (cp == 0)
+                return FALSE;
+
+            q = reader_utf8(q, cp);
+            break;
+        default:
+            return FALSE;
+        }
+    }
+
+    if (p >= r->end)
+        return FALSE;
+
+    r->p = p + 1;
+    *q   = '\0';
+
+    tok->str = s;
+    tok->len = q - s;
+
+    return TRUE;
+}
+
+
+static int reader_number(mrp_json_reader_t *r, mrp_json_token_t *tok)
+{
+    char  num[64], *e;
+    int   n, dbl;
+    long  l;
+
+    for (n = 0, dbl = FALSE; r->p < r->end; r->p++, n++) {
+        switch (*r->p) {
+        case '.': case 'e': case 'E':
+            dbl = TRUE;
+            /* fall through */
+        case '0' ... '9': case '-': case '+':
+            if (n >= (int)sizeof(num) - 1)
+                return FALSE;
+            num[n] = *r->p;
+            continue;
+        }
+        break;
+    }
+
+    num[n] = '\0';
+    errno  = 0;
+
+    if (!dbl) {
+        l = strtol(num, &e, 10);
+
+        if (*e || e == num || errno || l < INT32_MIN || l > INT32_MAX)
+            dbl = TRUE;
+        else {
+            tok->type    = MRP_JSON_TOKEN_INTEGER;
+            tok->integer = (int)l;
+            return TRUE;
+        }
+    }
+
+    tok->dbl = strtod(num, &e);
+
+    if (*e || e == num)
+        return FALSE;
+
+    tok->type = MRP_JSON_TOKEN_DOUBLE;
+
+    return TRUE;
+}
+
+
+static int reader_literal(mrp_json_reader_t *r, const char *lit, size_t len)
+{
+    if ((size_t)(r->end - r->p) < len || strncmp(r->p, lit, len))
+        return FALSE;
+
+    r->p += len;
+
+    return TRUE;
+}
+
+
+static inline int reader_in_object(mrp_json_reader_t *r)
+{
+    return r->objects & (1 << r->depth);
+}
+
+
+static mrp_json_token_type_t reader_nest(mrp_json_reader_t *r,
+                                         mrp_json_token_t *tok, int object)
+{
+    if (r->depth >= MRP_JSON_STREAM_MAXDEPTH)
+        return MRP_JSON_TOKEN_ERROR;
+
+    r->p++;
+    r->depth++;
+
+    if (object)
+        r->objects |= (1 << r->depth);
+    else
+        r->objects &= ~(1 << r->depth);
+
+    r->state = READER_FIRST;
+
+    return tok->type = object ?
+        MRP_JSON_TOKEN_OBJECT_BEGIN : MRP_JSON_TOKEN_ARRAY_BEGIN;
+}
+
+
+static mrp_json_token_type_t reader_unnest(mrp_json_reader_t *r,
+                                           mrp_json_token_t *tok)
+{
+    int object = reader_in_object(r);
+
+    if (*r->p != (object ? '}' : ']'))
+        return MRP_JSON_TOKEN_ERROR;
+
+    r->p++;
+    r->depth--;
+    r->state = r->depth > 0 ? READER_NEXT : READER_DONE;
+
+    return tok->type = object ?
+        MRP_JSON_TOKEN_OBJECT_END : MRP_JSON_TOKEN_ARRAY_END;
+}
+
+
+static mrp_json_token_type_t reader_value(mrp_json_reader_t *r,
+                                          mrp_json_token_t *tok)
+{
+    switch (*r->p) {
+    case '{':
+        return reader_nest(r, tok, TRUE);
+    case '[':
+        return reader_nest(r, tok, FALSE);
+    case '"':
+        if (!reader_string(r, tok))
+            return MRP_JSON_TOKEN_ERROR;
+        tok->type = MRP_JSON_TOKEN_STRING;
+        break;
+    case 't':
+        if (!reader_literal(r, "true", 4))
+            return MRP_JSON_TOKEN_ERROR;
+        tok->type    = MRP_JSON_TOKEN_BOOLEAN;
+        tok->boolean = TRUE;
+        break;
+    case 'f':
+        if (!reader_literal(r, "false", 5))
+            return MRP_JSON_TOKEN_ERROR;
+        tok->type    = MRP_JSON_TOKEN_BOOLEAN;
+        tok->boolean = FALSE;
+        break;
+    case 'n':
+        if (!reader_literal(r, "null", 4))
+            return MRP_JSON_TOKEN_ERROR;
+        tok->type = MRP_JSON_TOKEN_NULL;
+        break;
+    case '-': case '0' ... '9':
+        if (!reader_number(r, tok))
+            return MRP_JSON_TOKEN_ERROR;
+        break;
+    default:
+        return MRP_JSON_TOKEN_ERROR;
+    }
+
+    r->state = r->depth > 0 ? READER_NEXT : READER_DONE;
+
+    return tok->type;
+}
+
+
+mrp_json_token_type_t mrp_json_reader_next(mrp_json_reader_t *r,
+                                           mrp_json_token_t *tok)
+{
+    mrp_json_token_type_t type;
+
+    mrp_clear(tok);
+
+    if (r->state == READER_ERROR)
+        return tok->type = MRP_JSON_TOKEN_ERROR;
+
+    if (r->state == READER_DONE)
+        return tok->type = MRP_JSON_TOKEN_END;
+
+    reader_skip_space(r);
+
+    if (r->p >= r->end) {
+        type = MRP_JSON_TOKEN_ERROR;
+        goto out;
+    }
+
+    switch (r->state) {
+    case READER_NEXT:
+        if (*r->p != ',') {
+            type = reader_unnest(r, tok);
+            goto out;
+        }
+
+        r->p++;
+        reader_skip_space(r);
+
+        if (r->p >= r->end) {
+            type = MRP_JSON_TOKEN_ERROR;
+            goto out;
+        }
+
+        r->state = reader_in_object(r) ? READER_KEY : READER_VALUE;
+        break;
+
+    case READER_FIRST:
+        if (*r->p == '}' || *r->p == ']') {
+            type = reader_unnest(r, tok);
+            goto out;
+        }
+
+        r->state = reader_in_object(r) ? READER_KEY : READER_VALUE;
+        break;
+    }
+
+    if (r->state == READER_KEY) {
+        if (*r->p != '"' || !reader_string(r, tok)) {
+            type = MRP_JSON_TOKEN_ERROR;
+            goto out;
+        }
+
+        reader_skip_space(r);
+
+        if (r->p >= r->end || *r->p != ':') {
+            type = MRP_JSON_TOKEN_ERROR;
+            goto out;
+        }
+
+        r->p++;
+        r->state = READER_VALUE;
+        type     = tok->type = MRP_JSON_TOKEN_KEY;
+    }
+    else
+        type = reader_value(r, tok);
+
+ out:
+    if (type == MRP_JSON_TOKEN_ERROR) {
+        r->state  = READER_ERROR;
+        tok->type = MRP_JSON_TOKEN_ERROR;
+        errno     = EINVAL;
+    }
+
+    return type;
+}
+
+
+int mrp_json_reader_skip(mrp_json_reader_t *r, mrp_json_token_t *tok)
+{
+    mrp_json_token_t t;
+    int              depth;
+
+    if (tok->type == MRP_JSON_TOKEN_KEY) {
+        if (mrp_json_reader_next(r, &t) == MRP_JSON_TOKEN_ERROR)
+            return FALSE;
+        tok = &t;
+    }
+
+    if (tok->type != MRP_JSON_TOKEN_OBJECT_BEGIN &&
+        tok->type != MRP_JSON_TOKEN_ARRAY_BEGIN)
+        return tok->type != MRP_JSON_TOKEN_ERROR;
+
+    depth = r->depth;
+
+    while (r->depth >= depth) {
+        if (mrp_json_reader_next(r, &t) == MRP_JSON_TOKEN_ERROR)
+            return FALSE;
+    }
+
+    return TRUE;
+}
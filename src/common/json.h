@@ -32,6 +32,7 @@
 
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "murphy/config.h"
 
@@ -243,6 +244,106 @@ int mrp_json_array_get_item(mrp_json_t *a, int idx, mrp_json_type_t type, ...);
 /** Parse a JSON object from the given string. */
 int mrp_json_parse_object(char **str, int *len, mrp_json_t **op);
 
+/*
+ * Streaming JSON writer and pull reader.
+ *
+ * These do not build an object graph. The writer serializes straight
+ * into a flat, reusable buffer, and the reader tokenizes a mutable
+ * buffer in place, decoding strings without copying them out.
+ */
+
+/** Maximum nesting depth supported by the JSON writer and reader. */
+#define MRP_JSON_STREAM_MAXDEPTH 31
+
+/** Streaming JSON writer. */
+typedef struct {
+    char     *buf;                       /* output buffer */
+    size_t    size;                      /* allocated buffer size */
+    size_t    used;                      /* amount of buffer used */
+    int       depth;                     /* current nesting depth */
+    uint32_t  items;                     /* mask of non-empty levels */
+    int       error;                     /* sticky error code, if any */
+} mrp_json_writer_t;
+
+/** Initialize a JSON writer, preallocating size bytes of buffer. */
+int mrp_json_writer_init(mrp_json_writer_t *w, size_t size);
+
+/** Reset a JSON writer for a new message, keeping its buffer. */
+void mrp_json_writer_reset(mrp_json_writer_t *w);
+
+/** Free the buffer of a JSON writer. */
+void mrp_json_writer_cleanup(mrp_json_writer_t *w);
+
+/** Get the serialized, NUL-terminated output of a complete message. */
+const char *mrp_json_writer_output(mrp_json_writer_t *w, size_t *sizep);
+
+/** Begin/end an object, as a member if key is non-NULL. */
+int mrp_json_write_object_begin(mrp_json_writer_t *w, const char *key);
+int mrp_json_write_object_end(mrp_json_writer_t *w);
+
+/** Begin/end an array, as a member if key is non-NULL. */
+int mrp_json_write_array_begin(mrp_json_writer_t *w, const char *key);
+int mrp_json_write_array_end(mrp_json_writer_t *w);
+
+/** Write a value of a basic type, as a member if key is non-NULL. */
+int mrp_json_write_string(mrp_json_writer_t *w, const char *key,
+                          const char *s);
+int mrp_json_write_integer(mrp_json_writer_t *w, const char *key, int i);
+int mrp_json_write_unsigned(mrp_json_writer_t *w, const char *key,
+                            uint32_t u);
+int mrp_json_write_double(mrp_json_writer_t *w, const char *key, double d);
+int mrp_json_write_boolean(mrp_json_writer_t *w, const char *key, int b);
+int mrp_json_write_null(mrp_json_writer_t *w, const char *key);
+
+/** JSON reader token types. */
+typedef enum {
+    MRP_JSON_TOKEN_ERROR = -1,           /* malformed input */
+    MRP_JSON_TOKEN_END   = 0,            /* end of input */
+    MRP_JSON_TOKEN_OBJECT_BEGIN,         /* { */
+    MRP_JSON_TOKEN_OBJECT_END,           /* } */
+    MRP_JSON_TOKEN_ARRAY_BEGIN,          /* [ */
+    MRP_JSON_TOKEN_ARRAY_END,            /* ] */
+    MRP_JSON_TOKEN_KEY,                  /* member name */
+    MRP_JSON_TOKEN_STRING,               /* string value */
+    MRP_JSON_TOKEN_INTEGER,              /* integer value */
+    MRP_JSON_TOKEN_DOUBLE,               /* floating-point value */
+    MRP_JSON_TOKEN_BOOLEAN,              /* true or false */
+    MRP_JSON_TOKEN_NULL,                 /* null */
+} mrp_json_token_type_t;
+
+/** A single JSON reader token. */
+typedef struct {
+    mrp_json_token_type_t type;          /* token type */
+    union {
+        struct {                         /* key or string */
+            const char *str;             /* NUL-terminated, in input buf */
+            size_t      len;             /* length of string */
+        };
+        int     integer;                 /* integer value */
+        double  dbl;                     /* floating-point value */
+        int     boolean;                 /* boolean value */
+    };
+} mrp_json_token_t;
+
+/** Pull-style JSON reader. */
+typedef struct {
+    char     *p;                         /* next input character */
+    char     *end;                       /* end of input */
+    int       state;                     /* what we expect next */
+    int       depth;                     /* current nesting depth */
+    uint32_t  objects;                   /* mask of object levels */
+} mrp_json_reader_t;
+
+/** Initialize a JSON reader. The input is decoded and modified in place. */
+void mrp_json_reader_init(mrp_json_reader_t *r, char *buf, size_t size);
+
+/** Read the next token from the input. */
+mrp_json_token_type_t mrp_json_reader_next(mrp_json_reader_t *r,
+                                           mrp_json_token_t *tok);
+
+/** Skip the rest of the value tok starts (a no-op for basic values). */
+int mrp_json_reader_skip(mrp_json_reader_t *r, mrp_json_token_t *tok);
+
 MRP_CDECL_END
 
 #endif /* __MURPHY_JSON_H__ */
@@ -29,10 +29,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stddef.h>
 #include <string.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <time.h>
 #include <syslog.h>
+#include <pthread.h>
 
 #include <murphy/common/mm.h>
 #include <murphy/common/list.h>
@@ -42,6 +46,7 @@ typedef struct {
     mrp_list_hook_t  hook;
     char            *name;
     mrp_logger_t     logger;
+    mrp_log_writer_t writer;
     void            *data;
     int              builtin;
 } log_target_t;
@@ -56,6 +61,65 @@ static int           log_mask   = MRP_LOG_MASK_ERROR;
 static log_target_t *log_target = NULL;
 
 
+/*
+ * asynchronous logging
+ *
+ * With an async:<target> log target messages are formatted by the caller
+ * into a preallocated ring of fixed-size records and written out to the
+ * real target by a writer thread, so logging never blocks on I/O. The
+ * ring is a bounded multi-producer/single-consumer queue: producers claim
+ * a record by advancing head, the record sequence number tells whether it
+ * is free, filled or still being written. If the ring is full messages are
+ * dropped and counted, and the writer reports the number of drops.
+ */
+
+#ifndef MRP_LOG_ASYNC_RECORDS
+#    define MRP_LOG_ASYNC_RECORDS 1024   /* must be a power of 2 */
+#endif
+
+#define ASYNC_PREFIX      "async:"
+#define ASYNC_RECORD_SIZE 512
+#define ASYNC_IDLE_MSEC   250
+
+typedef struct {
+    uint32_t        seq;                 /* record sequence number */
+    uint16_t        level;               /* mrp_log_level_t */
+    uint16_t        file;                /* offset of file name in text */
+    uint16_t        msg;                 /* offset of message in text */
+    uint16_t        len;                 /* length of message */
+    int             line;                /* line number */
+    char            text[ASYNC_RECORD_SIZE - 4 * sizeof(uint32_t)];
+} log_record_t;                          /* function, file, then message */
+
+static struct {
+    log_record_t    *records;            /* ring of records */
+    uint32_t         mask;               /* ring size - 1 */
+    uint32_t         head;               /* next record to claim */
+    uint32_t         tail;               /* next record to write out */
+    uint64_t         dropped;            /* messages dropped on overflow */
+    uint64_t         reported;           /* drops reported so far */
+    int              running;            /* whether writer is running */
+    int              stop;               /* writer asked to stop */
+    int              sleeping;           /* writer waiting for records */
+    pthread_t        writer;             /* writer thread */
+    pthread_mutex_t  lock;               /* for sleeping/waking writer */
+    pthread_cond_t   cond;               /* signalled on new records */
+    char             name[64];           /* async:<target> */
+} async = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static int async_start(void);
+static void async_stop(void);
+static void async_log(mrp_log_level_t level, const char *file, int line,
+                      const char *func, const char *format, va_list ap);
+
+static uint32_t log_rate  = MRP_LOG_RATE;
+static uint32_t log_burst = MRP_LOG_BURST;
+static uint64_t log_suppressed;
+
+
 mrp_log_mask_t mrp_log_parse_levels(const char *levels)
 {
     const char *p;
@@ -192,6 +256,14 @@ int mrp_log_set_target(const char *name)
 {
     log_target_t *target;
     const char   *path;
+    int           asynchronous;
+
+    if (!strncmp(name, ASYNC_PREFIX, sizeof(ASYNC_PREFIX) - 1)) {
+        asynchronous = TRUE;
+        name += sizeof(ASYNC_PREFIX) - 1;
+    }
+    else
+        asynchronous = FALSE;
 
     if (!strncmp(name, "file:", 5)) {
         path = name + 5;
@@ -205,6 +277,10 @@ int mrp_log_set_target(const char *name)
     if (target == NULL || (target == &file_target && path == NULL))
         return FALSE;
 
+    /* write out pending messages to, and stop using, the old target */
+    if (async.running)
+        async_stop();
+
     /* close files opened by us, if any */
     if (log_target == &file_target) {
         if (file_target.data != NULL) {
@@ -226,13 +302,45 @@ int mrp_log_set_target(const char *name)
         }
     }
 
+    if (asynchronous) {
+        snprintf(async.name, sizeof(async.name), ASYNC_PREFIX"%s",
+                 target->name);
+
+        if (async_start() < 0)
+            return FALSE;
+    }
+
     return TRUE;
 }
 
 
 const char *mrp_log_get_target(void)
 {
-    return log_target->name;
+    if (async.running)
+        return async.name;
+    else
+        return log_target->name;
+}
+
+
+uint64_t mrp_log_get_dropped(void)
+{
+    return __atomic_load_n(&async.dropped, __ATOMIC_RELAXED);
+}
+
+
+void mrp_log_flush(void)
+{
+    struct timespec ms = { 0, 1000000 };
+
+    while (async.running &&
+           __atomic_load_n(&async.head, __ATOMIC_ACQUIRE) !=
+           __atomic_load_n(&async.tail, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&async.lock);
+        pthread_cond_signal(&async.cond);
+        pthread_mutex_unlock(&async.lock);
+        nanosleep(&ms, NULL);
+    }
 }
 
 
@@ -255,18 +363,21 @@ int mrp_log_get_targets(const char **targets, size_t size)
 }
 
 
-int mrp_log_register_target(const char *name, mrp_logger_t logger, void *data)
+static int register_target(const char *name, mrp_logger_t logger,
+                           mrp_log_writer_t writer, void *data)
 {
     log_target_t *target;
 
     if (find_target(name) != NULL)
         return FALSE;
 
-    target = mrp_allocz(sizeof(*target));
+    if ((target = mrp_allocz(sizeof(*target))) == NULL)
+        return FALSE;
 
     mrp_list_init(&target->hook);
     target->name   = mrp_strdup(name);
     target->logger = logger;
+    target->writer = writer;
     target->data   = data;
 
     if (target->name != NULL) {
@@ -282,6 +393,19 @@ int mrp_log_register_target(const char *name, mrp_logger_t logger, void *data)
 }
 
 
+int mrp_log_register_target(const char *name, mrp_logger_t logger, void *data)
+{
+    return register_target(name, logger, NULL, data);
+}
+
+
+int mrp_log_register_writer(const char *name, mrp_log_writer_t writer,
+                            void *data)
+{
+    return register_target(name, NULL, writer, data);
+}
+
+
 int mrp_log_unregister_target(const char *name)
 {
     log_target_t *target;
@@ -291,8 +415,11 @@ int mrp_log_unregister_target(const char *name)
     if (target == NULL || target->builtin)
         return FALSE;
 
-    if (log_target == target)
+    if (log_target == target) {
+        if (async.running)
+            async_stop();
         log_target = &stderr_target;
+    }
 
     mrp_list_delete(&target->hook);
     mrp_free(target->name);
@@ -345,17 +472,35 @@ void mrp_log_msgv(mrp_log_level_t level, const char *file,
                   va_list ap)
 {
     static int    busy   = 0;
-    mrp_logger_t  logger = log_target->logger;
-    void         *data   = log_target->data;
+    log_target_t *target = log_target;
+    char          msg[ASYNC_RECORD_SIZE];
+    int           len;
 
-    if (MRP_UNLIKELY(busy != 0))
+    if (!(log_mask & (1 << level)))
         return;
 
-    if (!(log_mask & (1 << level)))
+    if (async.running) {
+        async_log(level, file, line, func, format, ap);
+        return;
+    }
+
+    if (MRP_UNLIKELY(busy != 0))
         return;
 
     busy++;
-    logger(data, level, file, line, func, format, ap);
+
+    if (target->writer != NULL) {
+        len = vsnprintf(msg, sizeof(msg), format, ap);
+
+        if (len >= (int)sizeof(msg))
+            len = sizeof(msg) - 1;
+
+        if (len >= 0)
+            target->writer(target->data, level, file, line, func, msg, len);
+    }
+    else
+        target->logger(target->data, level, file, line, func, format, ap);
+
     busy--;
 }
 
@@ -374,6 +519,360 @@ void mrp_log_msg(mrp_log_level_t level, const char *file,
 }
 
 
+void mrp_log_set_ratelimit(uint32_t rate, uint32_t burst)
+{
+    log_rate  = rate;
+    log_burst = burst ? burst : 1;
+}
+
+
+void mrp_log_get_ratelimit(uint32_t *rate, uint32_t *burst)
+{
+    *rate  = log_rate;
+    *burst = log_burst;
+}
+
+
+uint64_t mrp_log_get_suppressed(void)
+{
+    return __atomic_load_n(&log_suppressed, __ATOMIC_RELAXED);
+}
+
+
+static uint64_t log_msecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+static int site_admit(mrp_log_site_t *site, uint32_t *suppressed)
+{
+    uint64_t now, tokens, max;
+    int      admit;
+
+    now = log_msecs();
+    max = (uint64_t)log_burst * 1000;
+
+    while (__atomic_test_and_set(&site->lock, __ATOMIC_ACQUIRE))
+        ;
+
+    if (site->stamp == 0)
+        tokens = max;
+    else
+        tokens = site->tokens + (now - site->stamp) * log_rate;
+
+    if (tokens > max)
+        tokens = max;
+
+    site->stamp = now ? now : 1;
+
+    if (tokens >= 1000) {
+        site->tokens     = tokens - 1000;
+        *suppressed      = site->suppressed;
+        site->suppressed = 0;
+        admit = TRUE;
+    }
+    else {
+        site->tokens = tokens;
+        site->suppressed++;
+        admit = FALSE;
+
+        __atomic_add_fetch(&log_suppressed, 1, __ATOMIC_RELAXED);
+    }
+
+    __atomic_clear(&site->lock, __ATOMIC_RELEASE);
+
+    return admit;
+}
+
+
+void mrp_log_site_msg(mrp_log_site_t *site, mrp_log_level_t level,
+                      const char *file, int line, const char *func,
+                      const char *format, ...)
+{
+    va_list  ap;
+    uint32_t suppressed;
+
+    if (!(log_mask & (1 << level)))
+        return;
+
+    suppressed = 0;
+
+    if (log_rate != 0 && !site_admit(site, &suppressed))
+        return;
+
+    if (MRP_UNLIKELY(suppressed != 0))
+        mrp_log_msg(level, file, line, func,
+                    "(%u similar messages suppressed)", suppressed);
+
+    va_start(ap, format);
+    mrp_log_msgv(level, file, line, func, format, ap);
+    va_end(ap);
+}
+
+
+static int async_copy(char *dst, size_t size, const char *src)
+{
+    size_t n = src ? strnlen(src, size - 1) : 0;
+
+    if (n > 0)
+        memcpy(dst, src, n);
+    dst[n] = '\0';
+
+    return n + 1;
+}
+
+
+static void async_log(mrp_log_level_t level, const char *file, int line,
+                      const char *func, const char *format, va_list ap)
+{
+    log_record_t *r;
+    uint32_t      pos, seq;
+    int           n;
+
+    pos = __atomic_load_n(&async.head, __ATOMIC_RELAXED);
+
+    for (;;) {
+        r   = async.records + (pos & async.mask);
+        seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&async.head, &pos, pos + 1, TRUE,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        }
+        else if ((int32_t)(seq - pos) < 0) {
+            __atomic_add_fetch(&async.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+            pos = __atomic_load_n(&async.head, __ATOMIC_RELAXED);
+    }
+
+    r->level = level;
+    r->line  = line;
+    r->file  = async_copy(r->text, sizeof(r->text) / 4, func);
+    r->msg   = r->file + async_copy(r->text + r->file, sizeof(r->text) / 4,
+                                    file);
+
+    n = vsnprintf(r->text + r->msg, sizeof(r->text) - r->msg, format, ap);
+
+    if (n >= (int)(sizeof(r->text) - r->msg))
+        n = sizeof(r->text) - r->msg - 1;
+
+    r->len = n > 0 ? n : 0;
+
+    __atomic_store_n(&r->seq, pos + 1, __ATOMIC_RELEASE);
+
+    if (__atomic_load_n(&async.sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&async.lock);
+        pthread_cond_signal(&async.cond);
+        pthread_mutex_unlock(&async.lock);
+    }
+}
+
+
+static void async_write(mrp_log_level_t level, const char *file, int line,
+                        const char *func, const char *format, ...)
+{
+    log_target_t *t = log_target;
+    char          msg[ASYNC_RECORD_SIZE];
+    va_list       ap;
+    int           len;
+
+    va_start(ap, format);
+
+    if (t->writer != NULL) {
+        len = vsnprintf(msg, sizeof(msg), format, ap);
+
+        if (len >= (int)sizeof(msg))
+            len = sizeof(msg) - 1;
+
+        if (len >= 0)
+            t->writer(t->data, level, file, line, func, msg, len);
+    }
+    else
+        t->logger(t->data, level, file, line, func, format, ap);
+
+    va_end(ap);
+}
+
+
+static void async_record(log_record_t *r)
+{
+    const char *func = r->text;
+    const char *file = r->text + r->file;
+    const char *msg  = r->text + r->msg;
+
+    /* writers take the message as is, no need to go through printf */
+    if (log_target->writer != NULL)
+        log_target->writer(log_target->data, r->level, file, r->line, func,
+                           msg, r->len);
+    else
+        async_write(r->level, file, r->line, func, "%s", msg);
+}
+
+
+static int async_drain(void)
+{
+    log_record_t *r;
+    uint64_t      dropped;
+    int           n;
+
+    for (n = 0; ; n++) {
+        r = async.records + (async.tail & async.mask);
+
+        if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != async.tail + 1)
+            break;
+
+        async_record(r);
+
+        __atomic_store_n(&r->seq, async.tail + async.mask + 1,
+                         __ATOMIC_RELEASE);
+        __atomic_store_n(&async.tail, async.tail + 1, __ATOMIC_RELEASE);
+    }
+
+    dropped = __atomic_load_n(&async.dropped, __ATOMIC_RELAXED);
+
+    if (dropped != async.reported) {
+        async_write(MRP_LOG_WARNING, __FILE__, __LINE__, __FUNCTION__,
+                    "%llu log messages dropped (log ring full)",
+                    (unsigned long long)(dropped - async.reported));
+        async.reported = dropped;
+    }
+
+    return n;
+}
+
+
+static void *async_writer(void *data)
+{
+    struct timespec ts;
+
+    MRP_UNUSED(data);
+
+    for (;;) {
+        if (async_drain() > 0)
+            continue;
+
+        if (__atomic_load_n(&async.stop, __ATOMIC_ACQUIRE))
+            break;
+
+        __atomic_store_n(&async.sleeping, TRUE, __ATOMIC_SEQ_CST);
+
+        pthread_mutex_lock(&async.lock);
+
+        if (!__atomic_load_n(&async.stop, __ATOMIC_ACQUIRE) &&
+            async_drain() == 0) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += ASYNC_IDLE_MSEC * 1000000;
+            ts.tv_sec  += ts.tv_nsec / 1000000000;
+            ts.tv_nsec %= 1000000000;
+            pthread_cond_timedwait(&async.cond, &async.lock, &ts);
+        }
+
+        pthread_mutex_unlock(&async.lock);
+
+        __atomic_store_n(&async.sleeping, FALSE, __ATOMIC_SEQ_CST);
+    }
+
+    return NULL;
+}
+
+
+static void async_atfork_prepare(void)
+{
+    /* don't let the child inherit messages we have not written yet */
+    mrp_log_flush();
+}
+
+
+static void async_atfork_child(void)
+{
+    /* the writer thread does not survive fork, start a new one */
+    pthread_mutex_init(&async.lock, NULL);
+    pthread_cond_init(&async.cond, NULL);
+
+    if (async.running) {
+        async.sleeping = FALSE;
+
+        if (pthread_create(&async.writer, NULL, async_writer, NULL) != 0)
+            async.running = FALSE;
+    }
+}
+
+
+static int async_start(void)
+{
+    static int atfork;
+    uint32_t   i, size;
+
+    size = MRP_LOG_ASYNC_RECORDS;
+
+    if (async.records == NULL) {
+        async.records = mrp_allocz(size * sizeof(async.records[0]));
+
+        if (async.records == NULL)
+            return -1;
+    }
+
+    for (i = 0; i < size; i++)
+        async.records[i].seq = i;
+
+    async.mask     = size - 1;
+    async.head     = 0;
+    async.tail     = 0;
+    async.stop     = FALSE;
+    async.sleeping = FALSE;
+    async.reported = async.dropped;
+
+    if (!atfork) {
+        if (pthread_atfork(async_atfork_prepare, NULL,
+                           async_atfork_child) != 0)
+            return -1;
+        atfork = TRUE;
+    }
+
+    if (pthread_create(&async.writer, NULL, async_writer, NULL) != 0)
+        return -1;
+
+    __atomic_store_n(&async.running, TRUE, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+
+static void async_stop(void)
+{
+    if (!async.running)
+        return;
+
+    __atomic_store_n(&async.stop, TRUE, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&async.lock);
+    pthread_cond_signal(&async.cond);
+    pthread_mutex_unlock(&async.lock);
+
+    pthread_join(async.writer, NULL);
+
+    __atomic_store_n(&async.running, FALSE, __ATOMIC_RELEASE);
+
+    /* write out anything logged while we were stopping */
+    async_drain();
+}
+
+
+static __attribute__((destructor)) void flush_async_logging(void)
+{
+    async_stop();
+}
+
+
 /*
  * workaround for not being able to initialize log_fp to stderr
  */
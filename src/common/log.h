@@ -35,6 +35,7 @@
  */
 
 #include <stdarg.h>
+#include <stdint.h>
 
 #include <murphy/common/macros.h>
 #include <murphy/common/debug.h>
@@ -104,6 +105,7 @@ mrp_log_mask_t mrp_log_disable(mrp_log_mask_t mask);
 #define MRP_LOG_TO_STDERR     "stderr"
 #define MRP_LOG_TO_SYSLOG     "syslog"
 #define MRP_LOG_TO_FILE(path) ((const char *)(path))
+#define MRP_LOG_TO_ASYNC(t)   "async:"t  /**< log to t from a writer thread */
 
 
 /** Parse a log target name to MRP_LOG_TO_*. */
@@ -118,17 +120,61 @@ const char *mrp_log_get_target(void);
 /** Get all available logging targets. */
 int mrp_log_get_targets(const char **targets, size_t size);
 
+/** Get the number of messages dropped by asynchronous logging. */
+uint64_t mrp_log_get_dropped(void);
+
+/** Wait until all asynchronously logged messages are written out. */
+void mrp_log_flush(void);
+
+/**
+ * A rate-limited logging site.
+ *
+ * Every mrp_log_error, mrp_log_warning and mrp_log_info call site has a
+ * token bucket of its own. Messages in excess of the configured rate are
+ * suppressed and counted, and the count is reported along with the next
+ * message that gets through.
+ */
+typedef struct {
+    uint64_t stamp;                      /**< last refill, in msecs */
+    uint32_t tokens;                     /**< tokens, in 1/1000 messages */
+    uint32_t suppressed;                 /**< suppressed since last one */
+    char     lock;                       /**< spinlock for the above */
+} mrp_log_site_t;
+
+#define MRP_LOG_RATE  20                 /**< default messages per second */
+#define MRP_LOG_BURST 200                /**< default burst size */
+
+/** Set the per-site message rate and burst, a rate of 0 turns limiting off. */
+void mrp_log_set_ratelimit(uint32_t rate, uint32_t burst);
+
+/** Get the per-site message rate and burst. */
+void mrp_log_get_ratelimit(uint32_t *rate, uint32_t *burst);
+
+/** Get the number of messages suppressed by rate limiting. */
+uint64_t mrp_log_get_suppressed(void);
+
+#define __MRP_LOG_SITE(_level, fmt, args...) ({                           \
+        static mrp_log_site_t __log_site;                                 \
+                                                                          \
+        mrp_log_site_msg(&__log_site, _level, __LOC__, fmt , ## args);    \
+    })
+
 /** Log an error. */
 #define mrp_log_error(fmt, args...) \
-    mrp_log_msg(MRP_LOG_ERROR, __LOC__, fmt , ## args)
+    __MRP_LOG_SITE(MRP_LOG_ERROR, fmt , ## args)
 
 /** Log a warning. */
 #define mrp_log_warning(fmt, args...) \
-    mrp_log_msg(MRP_LOG_WARNING, __LOC__, fmt , ## args)
+    __MRP_LOG_SITE(MRP_LOG_WARNING, fmt , ## args)
 
 /** Log an informational message. */
 #define mrp_log_info(fmt, args...) \
-    mrp_log_msg(MRP_LOG_INFO, __LOC__, fmt , ## args)
+    __MRP_LOG_SITE(MRP_LOG_INFO, fmt , ## args)
+
+/** Log a message if the rate limit of the given site allows it. */
+void mrp_log_site_msg(mrp_log_site_t *site, mrp_log_level_t level,
+                      const char *file, int line, const char *func,
+                      const char *format, ...) MRP_PRINTF_LIKE(6, 7);
 
 /** Generic logging function. */
 void mrp_log_msg(mrp_log_level_t level,
@@ -149,6 +195,21 @@ typedef void (*mrp_logger_t)(void *user_data,
 int mrp_log_register_target(const char *name, mrp_logger_t logger,
                             void *user_data);
 
+/**
+ * Type for logging functions taking an already formatted message.
+ *
+ * Unlike loggers, writers get the message with its location as separate
+ * fields. With asynchronous logging they are called from the log writer
+ * thread straight with the queued record, without formatting it again.
+ */
+typedef void (*mrp_log_writer_t)(void *user_data, mrp_log_level_t level,
+                                 const char *file, int line, const char *func,
+                                 const char *msg, size_t len);
+
+/** Register a new logging target with a writer function. */
+int mrp_log_register_writer(const char *name, mrp_log_writer_t writer,
+                            void *user_data);
+
 /** Unregister the given logging target. */
 int mrp_log_unregister_target(const char *name);
 
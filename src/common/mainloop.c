@@ -27,15 +27,34 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE                      /* we want dladdr */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <time.h>
+#include <dlfcn.h>
 #include <signal.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <sys/epoll.h>
 #include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "murphy/config.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+#    include <linux/io_uring.h>
+#    if defined(__NR_io_uring_setup) && defined(IORING_FEAT_RSRC_TAGS)
+#        define URING_BACKEND
+#    endif
+#endif
 
 #include <murphy/common/macros.h>
 #include <murphy/common/mm.h>
@@ -45,9 +64,14 @@
 #include <murphy/common/json.h>
 #include <murphy/common/msg.h>
 #include <murphy/common/mainloop.h>
+#include <murphy/common/trace.h>
 
 #define USECS_PER_SEC  (1000 * 1000)
 #define USECS_PER_MSEC (1000)
+
+#define EVENTS_MIN       8                    /* min. epoll buffer size */
+#define EVENTS_INIT     64                    /* max. initial buffer size */
+#define EVENTS_WINDOW   64                    /* iterations per resize check */
 #define NSECS_PER_USEC (1000)
 
 /*
@@ -66,6 +90,8 @@ struct mrp_io_watch_s {
     struct pollfd     *pollfd;                   /* associated pollfd */
     mrp_list_hook_t    slave;                    /* watches with the same fd */
     int                wrhup;                    /* EPOLLHUPs delivered */
+    uint32_t           ugen;                     /* io_uring poll generation */
+    uint32_t           umask;                    /* io_uring polled events */
 };
 
 #define is_master(w) !mrp_list_empty(&(w)->hook)
@@ -77,17 +103,42 @@ struct mrp_io_watch_s {
  */
 
 struct mrp_timer_s {
-    mrp_list_hook_t  hook;                       /* to list of timers */
+    mrp_list_hook_t  hook;                       /* to list of stopped timers */
     mrp_list_hook_t  deleted;                    /* to list of pending delete */
     int            (*free)(void *ptr);           /* cb to free memory */
     mrp_mainloop_t  *ml;                         /* mainloop */
-    unsigned int     msecs;                      /* timer interval */
+    uint64_t         usecs;                      /* timer interval */
+    uint64_t         slack;                      /* allowed dispatch delay */
+    int              precise;                    /* usecs timer, use timerfd */
     uint64_t         expire;                     /* next expiration time */
+    uint32_t         seq;                        /* insertion order, for ties */
+    uint32_t         gen;                        /* dispatch round of insert */
+    int              idx;                        /* index in timer heap */
     mrp_timer_cb_t   cb;                         /* user callback */
     void            *user_data;                  /* opaque user data */
 };
 
 
+/*
+ * timer heap
+ *
+ * Active timers are kept in a binary min-heap ordered by expiration
+ * time, with ties broken by insertion order. This gives us O(1) lookup
+ * of the next expiring timer and O(log n) insertion, modification and
+ * removal, regardless of the number of timers running.
+ */
+
+typedef struct {
+    mrp_timer_t **t;                             /* heap of active timers */
+    int           n;                             /* number of timers */
+    int           size;                          /* allocated heap size */
+    uint32_t      seq;                           /* next insertion seqno */
+    uint32_t      gen;                           /* current dispatch round */
+} timer_heap_t;
+
+#define TIMER_HEAP_MIN 16
+
+
 /*
  * deferred callbacks
  */
@@ -100,6 +151,7 @@ struct mrp_deferred_s {
     mrp_deferred_cb_t  cb;                       /* user callback */
     void              *user_data;                /* opaque user data */
     int                inactive : 1;
+    int                idle : 1;                 /* idle priority */
 };
 
 
@@ -202,11 +254,31 @@ struct mrp_subloop_s {
     mrp_io_watch_t      *w;                      /* watch for epollfd */
     struct pollfd       *pollfds;                /* pollfds for this subloop */
     int                  npollfd;                /* number of pollfds */
+    int                  maxpollfd;              /* allocated pollfds */
+    struct pollfd       *qfds;                   /* buffer for querying */
+    int                  nqfd;                   /* query buffer size */
+    int                 *ready;                  /* pollfds with revents */
+    int                  nready;                 /* number of ready pollfds */
     int                  pending;                /* pending events */
     int                  poll;                   /* need to poll for events */
 };
 
 
+/*
+ * event subscribers
+ *
+ * Besides being on the list of watches of their bus, watches are kept in
+ * per-event arrays of subscribers, so emitting an event only visits the
+ * watches interested in it. A watch for a mask of events is added to the
+ * subscribers of every event in the mask when the watch is registered.
+ */
+
+typedef struct {
+    mrp_event_watch_t **watches;                 /* watches for this event */
+    int                 nwatch;                  /* number of watches */
+} event_subs_t;
+
+
 /*
  * event busses
  */
@@ -216,6 +288,8 @@ struct mrp_event_bus_s {
     mrp_list_hook_t  hook;                       /* to list of busses */
     mrp_mainloop_t  *ml;                         /* associated mainloop */
     mrp_list_hook_t  watches;                    /* event watches on this bus */
+    event_subs_t    *subs;                       /* subscribers by event id */
+    int              nsub;                       /* size of subs */
     int              busy;                       /* whether pumping events */
     int              dead;
 };
@@ -239,6 +313,8 @@ struct mrp_event_watch_s {
  * pending events
  */
 
+#define EVENT_POOL_MAX 32                        /* max. pooled free events */
+
 typedef struct {
     mrp_list_hook_t  hook;                       /* to event queue */
     mrp_event_bus_t *bus;                        /* bus for this event */
@@ -248,12 +324,65 @@ typedef struct {
 } pending_event_t;
 
 
+/*
+ * dispatch statistics
+ *
+ * When enabled, we account the invocations of and the time spent in the
+ * callbacks dispatched by the mainloop. Statistics are collected per
+ * callback site, a callback function of a given type, since that is what
+ * identifies the module responsible for it. Latencies are collected into
+ * log-linear histograms (HDR-style): exact up to 16 usecs, and 8 buckets
+ * per power of 2 above that, ie. with a precision of at least 12.5%. For
+ * timers we also collect how late they were dispatched with respect to
+ * their scheduled expiration. Times of nested dispatching (eg. of events
+ * pumped by a deferred callback) are included in the times of the outer
+ * callback.
+ */
+
+typedef enum {
+    STATS_IO = 0,                                /* I/O watch */
+    STATS_TIMER,                                 /* timer */
+    STATS_DEFERRED,                              /* deferred callback */
+    STATS_SUBLOOP,                               /* subloop */
+    STATS_EVENT,                                 /* event bus watch */
+} stats_type_t;
+
+#define STATS_EXACT     16                       /* exact buckets */
+#define STATS_SUBBITS   3                        /* log2 buckets per power */
+#define STATS_BUCKETS   (STATS_EXACT + (32 - 4) * (1 << STATS_SUBBITS))
+#define STATS_SITES     64                       /* initial table size */
+
+typedef struct {
+    uint64_t count;                              /* number of samples */
+    uint64_t total;                              /* sum of samples */
+    uint64_t max;                                /* maximum sample */
+    uint32_t buckets[STATS_BUCKETS];             /* histogram */
+} stats_hist_t;
+
+typedef struct {
+    stats_type_t  type;                          /* callback type */
+    void         *cb;                            /* callback function */
+    stats_hist_t  latency;                       /* time spent in callback */
+    stats_hist_t  lateness;                      /* timer lateness */
+} stats_site_t;
+
+typedef struct {
+    stats_site_t **sites;                        /* hashed callback sites */
+    int            nsite;                        /* number of sites */
+    int            size;                         /* size of site table */
+    uint64_t       started;                      /* collection start time */
+} loop_stats_t;
+
+
 /*
  * main loop
  */
 
+typedef struct uring_s uring_t;
+
 struct mrp_mainloop_s {
     int                  epollfd;                /* our epoll descriptor */
+    uring_t             *uring;                  /* io_uring, if used */
     struct epoll_event  *events;                 /* epoll event buffer */
     int                  nevent;                 /* epoll event buffer size */
     fdtbl_t             *fdtbl;                  /* file descriptor table */
@@ -262,16 +391,31 @@ struct mrp_mainloop_s {
     int                  niowatch;               /* number of I/O watches */
     mrp_io_event_t       iomode;                 /* default event trigger mode */
 
-    mrp_list_hook_t      timers;                 /* list of timers */
-    mrp_timer_t         *next_timer;             /* next expiring timer */
+    timer_heap_t         timers;                 /* heap of active timers */
+    mrp_list_hook_t      stopped;                /* stopped timers */
+    int                  timerfd;                /* precise timer fd */
+    uint64_t             timerfd_armed;          /* timerfd expiry, or 0 */
+    mrp_io_watch_t      *timerwatch;             /* timerfd I/O watch */
 
     mrp_list_hook_t      deferred;               /* list of deferred cbs */
     mrp_list_hook_t      inactive_deferred;      /* inactive defferred cbs */
+    mrp_list_hook_t      idle_deferred;          /* idle deferred cbs */
+    int                  idle_usecs;             /* idle slice/iteration */
+
+    uint64_t             vclock;                 /* virtual clock, or 0 */
+    uint64_t             vdeadline;              /* virtual wakeup deadline */
 
     mrp_list_hook_t      wakeups;                /* list of wakeup cbs */
 
     int                  poll_timeout;           /* next poll timeout */
     int                  poll_result;            /* return value from poll */
+    int                  poll_next;              /* next event to dispatch */
+    int                  ready_max;              /* max. ready in window */
+    int                  ready_rounds;           /* polls in window */
+
+    int                  budget_events;          /* I/O events/iteration */
+    int                  budget_usecs;           /* dispatch time/iteration */
+    uint64_t             dispatch_start;         /* dispatch start time */
 
     int                  sigfd;                  /* signal polling fd */
     sigset_t             sigmask;                /* signal mask */
@@ -281,6 +425,8 @@ struct mrp_mainloop_s {
     mrp_list_hook_t      subloops;               /* external main loops */
 
     mrp_list_hook_t      deleted;                /* unfreed deleted items */
+    mrp_arena_t         *arena;                  /* dispatch arena */
+    int                  dispatching;            /* dispatch nesting level */
     int                  quit;                   /* TRUE if _quit called */
     int                  exit_code;              /* returned from _run */
 
@@ -292,19 +438,47 @@ struct mrp_mainloop_s {
 
     mrp_list_hook_t      busses;                 /* known event busses */
     mrp_list_hook_t      eventq;                 /* pending events */
+    mrp_list_hook_t      eventpool;              /* free pending events */
+    int                  npooled;                /* number of free events */
     mrp_deferred_t      *eventd;                 /* deferred event pump cb */
+
+    loop_stats_t        *stats;                  /* dispatch statistics */
 };
 
 
 static mrp_event_def_t *events;                  /* registered events */
 static int              nevent;                  /* number of events */
-static MRP_LIST_HOOK   (ewatches);               /* global, synchronous 'bus' */
+static mrp_event_bus_t  gbus = {                 /* global, synchronous bus */
+    .name    = MRP_GLOBAL_BUS_NAME,
+    .hook    = { &gbus.hook, &gbus.hook },
+    .watches = { &gbus.watches, &gbus.watches },
+};
 
 
 static void dump_pollfds(const char *prefix, struct pollfd *fds, int nfd);
 static void adjust_superloop_timer(mrp_mainloop_t *ml);
 static size_t poll_events(void *id, mrp_mainloop_t *ml, void **bufp);
 static void pump_events(mrp_deferred_t *d, void *user_data);
+static void purge_events(mrp_mainloop_t *ml);
+static uint64_t time_now(void);
+static void stats_record(loop_stats_t *stats, stats_type_t type, void *cb,
+                         uint64_t start, uint64_t expire);
+static int uring_arm(mrp_io_watch_t *master, uint32_t mask);
+static int uring_disarm(mrp_io_watch_t *master);
+
+
+static inline uint64_t stats_begin(mrp_mainloop_t *ml)
+{
+    return MRP_UNLIKELY(ml->stats != NULL) ? time_now() : 0;
+}
+
+
+static inline void stats_end(mrp_mainloop_t *ml, stats_type_t type, void *cb,
+                             uint64_t start, uint64_t expire)
+{
+    if (MRP_UNLIKELY(start != 0 && ml->stats != NULL))
+        stats_record(ml->stats, type, cb, start, expire);
+}
 
 /*
  * fd table manipulation
@@ -445,7 +619,8 @@ static int epoll_add_slave(mrp_io_watch_t *master, mrp_io_watch_t *slave)
     evt.data.u64 = 0;
     evt.data.fd  = master->fd;
 
-    if (epoll_ctl(ml->epollfd, EPOLL_CTL_MOD, master->fd, &evt) == 0) {
+    if ((ml->uring != NULL ? uring_arm(master, evt.events) :
+         epoll_ctl(ml->epollfd, EPOLL_CTL_MOD, master->fd, &evt)) == 0) {
         mrp_list_append(&master->slave, &slave->slave);
 
         return 0;
@@ -466,7 +641,8 @@ static int epoll_add(mrp_io_watch_t *w)
         evt.data.u64 = 0;                /* init full union for valgrind... */
         evt.data.fd  = w->fd;
 
-        if (epoll_ctl(ml->epollfd, EPOLL_CTL_ADD, w->fd, &evt) == 0) {
+        if ((ml->uring != NULL ? uring_arm(w, evt.events) :
+             epoll_ctl(ml->epollfd, EPOLL_CTL_ADD, w->fd, &evt)) == 0) {
             mrp_list_append(&ml->iowatches, &w->hook);
             ml->niowatch++;
 
@@ -488,6 +664,22 @@ static int epoll_add(mrp_io_watch_t *w)
 }
 
 
+static void drop_pending_events(mrp_mainloop_t *ml, int fd)
+{
+    struct epoll_event *e;
+    int                 i;
+
+    /*
+     * Forget any events polled but not dispatched yet for fd, so they
+     * won't get delivered to a watch later added for a reused fd.
+     */
+
+    for (i = ml->poll_next, e = ml->events + i; i < ml->poll_result; i++, e++)
+        if (e->data.fd == fd)
+            e->data.fd = -1;
+}
+
+
 static int epoll_del(mrp_io_watch_t *w)
 {
     mrp_mainloop_t     *ml = w->ml;
@@ -507,11 +699,18 @@ static int epoll_del(mrp_io_watch_t *w)
 
         if ((evt.events & MRP_IO_EVENT_ALL) == 0) {
             fdtbl_remove(ml->fdtbl, w->fd);
-            status = epoll_ctl(ml->epollfd, EPOLL_CTL_DEL, w->fd, &evt);
+            drop_pending_events(ml, w->fd);
+
+            if (ml->uring != NULL)
+                status = uring_disarm(master);
+            else
+                status = epoll_ctl(ml->epollfd, EPOLL_CTL_DEL, w->fd, &evt);
 
             if (status == 0 || (errno == EBADF || errno == ENOENT))
                 ml->niowatch--;
         }
+        else if (ml->uring != NULL)
+            status = uring_arm(master, evt.events);
         else
             status = epoll_ctl(ml->epollfd, EPOLL_CTL_MOD, w->fd, &evt);
 
@@ -547,6 +746,10 @@ static int free_io_watch(void *ptr)
             master = mrp_list_entry(w->slave.next, typeof(*master), slave);
             mrp_list_append(&ml->iowatches, &master->hook);
 
+            /* the new master inherits any io_uring poll in progress */
+            master->ugen  = w->ugen;
+            master->umask = w->umask;
+
             fdtbl_insert(ml->fdtbl, master->fd, master);
         }
     }
@@ -627,6 +830,48 @@ void mrp_del_io_watch(mrp_io_watch_t *w)
 }
 
 
+int mrp_mod_io_watch(mrp_io_watch_t *w, mrp_io_event_t events)
+{
+    mrp_mainloop_t     *ml;
+    mrp_io_watch_t     *master;
+    struct epoll_event  evt;
+    uint32_t            old;
+
+    if (w == NULL || is_deleted(w)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ml     = w->ml;
+    master = fdtbl_lookup(ml->fdtbl, w->fd);
+
+    /* the fd might have been dropped from polling after a hangup */
+    if (master == NULL || (is_master(w) && master != w)) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    old       = w->events;
+    w->events = (events & MRP_IO_EVENT_ALL) | (old & MRP_IO_TRIGGER_EDGE);
+    w->wrhup  = 0;
+
+    evt.events   = epoll_event_mask(master, NULL);
+    evt.data.u64 = 0;                    /* init full union for valgrind... */
+    evt.data.fd  = w->fd;
+
+    if ((ml->uring != NULL ? uring_arm(master, evt.events) :
+         epoll_ctl(ml->epollfd, EPOLL_CTL_MOD, w->fd, &evt)) != 0) {
+        w->events = old;
+        return -1;
+    }
+
+    mrp_debug("modified I/O watch %p (fd %d, events 0x%x)", w, w->fd,
+              w->events);
+
+    return 0;
+}
+
+
 mrp_mainloop_t *mrp_get_io_watch_mainloop(mrp_io_watch_t *w)
 {
     return w ? w->ml : NULL;
@@ -653,251 +898,1441 @@ mrp_io_event_t mrp_get_io_event_mode(mrp_mainloop_t *ml)
 
 
 /*
- * timers
+ * io_uring polling backend
+ *
+ * Instead of epoll, a mainloop can poll its file descriptors with an
+ * io_uring. Every master I/O watch has a poll request in the ring, its
+ * user data consisting of the fd and a generation number, so completions
+ * of removed or replaced requests can be recognized and ignored. Level-
+ * triggered fds are polled with single-shot requests which are re-armed
+ * right before waiting for new completions, so re-arming, submitting any
+ * other queued requests and waiting all take a single io_uring_enter per
+ * iteration. Edge-triggered fds are polled with multishot requests. Poll
+ * completions are converted to epoll events, so they are dispatched just
+ * like events polled with epoll.
+ *
+ * Besides polling, asynchronous read and write requests can be submitted
+ * to the same ring. These are only queued when submitted and then sent
+ * to the kernel in a batch together with the next poll. Every request is
+ * linked to a poll for the readiness of its fd, so the transfer is only
+ * attempted once it can make progress and requests work for non-blocking
+ * fds, too. Completion callbacks are invoked after the I/O watches have
+ * been dispatched.
+ *
+ * The backend is selected by setting MRP_MAINLOOP_BACKEND_ENVVAR to
+ * "io_uring" in the environment. If io_uring is not available, or the
+ * kernel lacks any of the features we need (5.13 or later is required),
+ * we fall back to epoll.
  */
 
-static uint64_t time_now(void)
-{
-    struct timespec ts;
-    uint64_t        now;
-
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    now  = ts.tv_sec  * USECS_PER_SEC;
-    now += ts.tv_nsec / NSECS_PER_USEC;
+#ifdef URING_BACKEND
+
+#define URING_ENTRIES 256                        /* submission queue size */
+#define URING_UD_REQ  (1ULL << 63)               /* user data of I/O request */
+#define URING_UD_LINK 0x1ULL                     /* I/O request readiness poll */
+#define URING_GEN_MAX 0x7fffffffU                /* max. poll generation */
+#define URING_FEATURES (IORING_FEAT_NODROP | IORING_FEAT_RW_CUR_POS |   \
+                        IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS)
+
+struct uring_s {
+    int                  fd;                     /* io_uring fd */
+    void                *sq_ring;                /* mmapped SQ ring */
+    size_t               sq_size;                /* SQ ring mapping size */
+    void                *cq_ring;                /* mmapped CQ ring */
+    size_t               cq_size;                /* CQ ring mapping size */
+    struct io_uring_sqe *sqes;                   /* mmapped SQE array */
+    size_t               sqes_size;              /* SQE array mapping size */
+    unsigned            *sq_head;                /* kernel SQ head */
+    unsigned            *sq_tail;                /* SQ tail */
+    unsigned            *sq_flags;               /* SQ ring flags */
+    unsigned            *sq_array;               /* SQ index array */
+    unsigned             sq_mask;                /* SQ ring mask */
+    unsigned             sq_entries;             /* SQ ring size */
+    unsigned             tail;                   /* our (unpublished) tail */
+    unsigned            *cq_head;                /* CQ head */
+    unsigned            *cq_tail;                /* kernel CQ tail */
+    struct io_uring_cqe *cqes;                   /* CQE array */
+    unsigned             cq_mask;                /* CQ ring mask */
+    uint32_t             gen;                    /* last poll generation */
+    int                 *rearm;                  /* fds to re-arm */
+    int                  nrearm;                 /* number of fds to re-arm */
+    int                  rearm_size;             /* allocated re-arm size */
+    mrp_list_hook_t      reqs;                   /* I/O requests in flight */
+    mrp_list_hook_t      done;                   /* completed I/O requests */
+};
 
-    return now;
-}
+struct mrp_io_req_s {
+    mrp_list_hook_t  hook;                       /* to in flight or done */
+    mrp_mainloop_t  *ml;                         /* mainloop */
+    mrp_io_req_cb_t  cb;                         /* completion callback */
+    void            *user_data;                  /* opaque user data */
+    ssize_t          result;                     /* result of the request */
+    int              done;                       /* completed */
+    int              cancelled;                  /* cancelled or notified */
+    struct iovec     iov[MRP_IO_REQ_MAXIOV];     /* I/O vector */
+    void           **release;                    /* buffers to free when done */
+    int              nrelease;                   /* number of buffers */
+    int              nslot;                      /* size of release */
+    void            *slots[MRP_IO_REQ_MAXIOV];   /* initial release slots */
+};
 
 
-static inline int usecs_to_msecs(uint64_t usecs)
+static inline int uring_enter(uring_t *u, unsigned to_submit,
+                              unsigned min_complete, unsigned flags,
+                              struct io_uring_getevents_arg *arg)
 {
-    int msecs;
+    return (int)syscall(__NR_io_uring_enter, u->fd, to_submit, min_complete,
+                        flags, arg, arg ? sizeof(*arg) : 0);
+}
 
-    msecs = (usecs + USECS_PER_MSEC - 1) / USECS_PER_MSEC;
 
-    return msecs;
+static inline unsigned uring_unsubmitted(uring_t *u)
+{
+    return u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
 }
 
 
-static void insert_timer(mrp_timer_t *t)
+static int uring_submit(uring_t *u)
 {
-    mrp_mainloop_t  *ml = t->ml;
-    mrp_list_hook_t *p, *n;
-    mrp_timer_t     *t1, *next;
-    int              inserted;
+    int n;
 
-    /*
-     * Notes:
-     *     If there is ever a need to run a large number of
-     *     simultaneous timers, we need to change this to a
-     *     self-balancing data structure, eg. an red-black tree.
-     */
+    __atomic_store_n(u->sq_tail, u->tail, __ATOMIC_RELEASE);
 
-    inserted = FALSE;
-    next     = NULL;
-    mrp_list_foreach(&ml->timers, p, n) {
-        t1 = mrp_list_entry(p, mrp_timer_t, hook);
+    while (uring_unsubmitted(u) > 0) {
+        n = uring_enter(u, uring_unsubmitted(u), 0, 0, NULL);
 
-        if (!is_deleted(t1)) {
-            if (t->expire <= t1->expire) {
-                mrp_list_prepend(p->prev, &t->hook);
-                inserted = TRUE;
-                break;
-            }
-            if (next == NULL)
-                next = t1;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
         }
     }
 
-    if (!inserted)
-        mrp_list_append(&ml->timers, &t->hook);
+    return 0;
+}
+
 
-    if (next)
-        ml->next_timer = next;
-    else {
-        ml->next_timer = t;
-        adjust_superloop_timer(ml);
+static struct io_uring_sqe *uring_get_sqe(uring_t *u)
+{
+    struct io_uring_sqe *sqe;
+    unsigned             idx;
+
+    if (uring_unsubmitted(u) >= u->sq_entries) {
+        if (uring_submit(u) < 0 || uring_unsubmitted(u) >= u->sq_entries) {
+            mrp_log_error("io_uring submission queue full (%d: %s).",
+                          errno, strerror(errno));
+            return NULL;
+        }
     }
+
+    idx = u->tail & u->sq_mask;
+    sqe = u->sqes + idx;
+    memset(sqe, 0, sizeof(*sqe));
+
+    u->sq_array[idx] = idx;
+    u->tail++;
+
+    return sqe;
 }
 
 
-static inline void rearm_timer(mrp_timer_t *t)
+static inline void uring_kick(mrp_mainloop_t *ml)
 {
-    mrp_list_delete(&t->hook);
-    t->expire = time_now() + t->msecs * USECS_PER_MSEC;
-    insert_timer(t);
+    /*
+     * Normally queued requests are submitted when we poll next time. If
+     * we're pumped by a superloop, that only happens once the ring fd
+     * becomes readable, so we need to submit right away.
+     */
+
+    if (ml->super_ops != NULL)
+        uring_submit(ml->uring);
 }
 
 
-static mrp_timer_t *find_next_timer(mrp_mainloop_t *ml)
+static inline uint64_t uring_poll_data(int fd, uint32_t gen)
 {
-    mrp_list_hook_t *p, *n;
-    mrp_timer_t     *t = NULL;
+    return ((uint64_t)gen << 32) | (uint32_t)fd;
+}
 
-    mrp_list_foreach(&ml->timers, p, n) {
-        t = mrp_list_entry(p, typeof(*t), hook);
 
-        if (!is_deleted(t))
-            break;
-        else
-            t = NULL;
+static int uring_arm(mrp_io_watch_t *master, uint32_t mask)
+{
+    mrp_mainloop_t      *ml = master->ml;
+    uring_t             *u  = ml->uring;
+    struct io_uring_sqe *sqe;
+
+    if (master->ugen != 0) {
+        if (master->umask == mask)
+            return 0;
+
+        uring_disarm(master);
     }
 
-    ml->next_timer = t;
-    return t;
+    if (!(mask & MRP_IO_EVENT_ALL))
+        return 0;
+
+    /* epoll would fail right away for an invalid fd, so we do too */
+    if (fcntl(master->fd, F_GETFD) < 0)
+        return -1;
+
+    if ((sqe = uring_get_sqe(u)) == NULL)
+        return -1;
+
+    if (++u->gen > URING_GEN_MAX)
+        u->gen = 1;
+
+    sqe->opcode        = IORING_OP_POLL_ADD;
+    sqe->fd            = master->fd;
+    sqe->poll32_events = mask & MRP_IO_EVENT_ALL;
+    sqe->len           = (mask & MRP_IO_TRIGGER_EDGE) ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data     = uring_poll_data(master->fd, u->gen);
+
+    master->ugen  = u->gen;
+    master->umask = mask;
+
+    uring_kick(ml);
+
+    return 0;
 }
 
 
-static int free_timer(void *ptr)
+static int uring_disarm(mrp_io_watch_t *master)
 {
-    mrp_timer_t *t = (mrp_timer_t *)ptr;
+    mrp_mainloop_t      *ml = master->ml;
+    struct io_uring_sqe *sqe;
 
-    mrp_free(t);
+    if (master->ugen == 0)
+        return 0;
 
-    return TRUE;
-}
+    if ((sqe = uring_get_sqe(ml->uring)) == NULL)
+        return -1;
 
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd     = -1;
+    sqe->addr   = uring_poll_data(master->fd, master->ugen);
 
+    master->ugen  = 0;
+    master->umask = 0;
 
-mrp_timer_t *mrp_add_timer(mrp_mainloop_t *ml, unsigned int msecs,
-                           mrp_timer_cb_t cb, void *user_data)
-{
-    mrp_timer_t *t;
+    uring_kick(ml);
 
-    if (cb == NULL)
-        return NULL;
+    return 0;
+}
 
-    if ((t = mrp_allocz(sizeof(*t))) != NULL) {
-        mrp_list_init(&t->hook);
-        mrp_list_init(&t->deleted);
-        t->ml        = ml;
-        t->expire    = time_now() + msecs * USECS_PER_MSEC;
-        t->msecs     = msecs;
-        t->cb        = cb;
-        t->user_data = user_data;
-        t->free      = free_timer;
 
-        insert_timer(t);
+static void uring_push_rearm(uring_t *u, int fd)
+{
+    if (u->nrearm >= u->rearm_size) {
+        int size = u->rearm_size ? 2 * u->rearm_size : EVENTS_INIT;
+
+        if (!mrp_reallocz(u->rearm, u->rearm_size, size)) {
+            mrp_log_error("Failed to re-arm io_uring poll for fd %d.", fd);
+            return;
+        }
+
+        u->rearm_size = size;
     }
 
-    return t;
+    u->rearm[u->nrearm++] = fd;
 }
 
 
-void mrp_mod_timer(mrp_timer_t *t, unsigned int msecs)
+static void uring_flush_rearm(mrp_mainloop_t *ml)
 {
-    if (t != NULL && !is_deleted(t)) {
-        if (msecs != MRP_TIMER_RESTART)
-            t->msecs = msecs;
+    uring_t        *u = ml->uring;
+    mrp_io_watch_t *w;
+    int             i;
 
-        rearm_timer(t);
+    for (i = 0; i < u->nrearm; i++) {
+        w = fdtbl_lookup(ml->fdtbl, u->rearm[i]);
+
+        if (w != NULL && w->ugen == 0)
+            uring_arm(w, epoll_event_mask(w, NULL));
     }
+
+    u->nrearm = 0;
 }
 
 
-void mrp_del_timer(mrp_timer_t *t)
+static void uring_cancel_req(uring_t *u, mrp_io_req_t *req)
 {
-    /*
-     * Notes: It is not safe to simply free this entry here as we might
-     *        be dispatching with this entry being the next to process.
-     *        We check for this and if it is not the case we relink this
-     *        to the list of deleted items which will be then processed
-     *        at end of the mainloop iteration. Otherwise we only mark the
-     *        this entry for deletion and the rest will be taken care of in
-     *        dispatch_timers().
-     */
+    struct io_uring_sqe *sqe;
+    uint64_t             data;
+    int                  i;
 
-    if (t != NULL && !is_deleted(t)) {
-        mrp_debug("marking timer %p deleted", t);
+    /* cancel both the readiness poll and the linked transfer */
+    data = (uint64_t)(ptrdiff_t)req | URING_UD_REQ;
 
-        mark_deleted(t);
+    for (i = 0; i < 2; i++) {
+        if ((sqe = uring_get_sqe(u)) == NULL)
+            return;
 
-        if (t->ml->next_timer == t) {
-            find_next_timer(t->ml);
-            adjust_superloop_timer(t->ml);
-        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd     = -1;
+        sqe->addr   = data | (i ? 0 : URING_UD_LINK);
     }
 }
 
 
-mrp_mainloop_t *mrp_get_timer_mainloop(mrp_timer_t *t)
+static void free_io_req(mrp_io_req_t *req)
 {
-    return t ? t->ml : NULL;
-}
+    int i;
 
+    mrp_list_delete(&req->hook);
 
-/*
- * deferred/idle callbacks
- */
+    for (i = 0; i < req->nrelease; i++)
+        mrp_free(req->release[i]);
 
-mrp_deferred_t *mrp_add_deferred(mrp_mainloop_t *ml, mrp_deferred_cb_t cb,
-                                 void *user_data)
-{
-    mrp_deferred_t *d;
+    if (req->release != req->slots)
+        mrp_free(req->release);
 
-    if (cb == NULL)
-        return NULL;
+    mrp_free(req);
+}
 
-    if ((d = mrp_allocz(sizeof(*d))) != NULL) {
-        mrp_list_init(&d->hook);
-        mrp_list_init(&d->deleted);
-        d->ml        = ml;
-        d->cb        = cb;
-        d->user_data = user_data;
 
-        mrp_list_append(&ml->deferred, &d->hook);
+static void uring_complete_req(mrp_mainloop_t *ml, mrp_io_req_t *req, int res)
+{
+    if (req->cancelled) {
+        free_io_req(req);
+        return;
     }
 
-    return d;
+    req->result = res;
+    req->done   = TRUE;
+
+    mrp_list_delete(&req->hook);
+    mrp_list_append(&ml->uring->done, &req->hook);
 }
 
 
-void mrp_del_deferred(mrp_deferred_t *d)
+static int uring_reap(mrp_mainloop_t *ml, struct epoll_event *buf, int max)
 {
-    /*
-     * Notes: It is not safe to simply free this entry here as we might
-     *        be dispatching with this entry being the next to process.
-     *        We just mark this here deleted and take care of the rest
-     *        in the dispatching loop.
-     */
+    uring_t             *u = ml->uring;
+    struct io_uring_cqe *cqe;
+    struct epoll_event  *e;
+    mrp_io_watch_t      *w;
+    unsigned             head, tail;
+    uint32_t             gen, events;
+    int                  fd, n, i;
+
+    head = *u->cq_head;
+    tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    n    = 0;
+
+    for ( ; head != tail && n < max; head++) {
+        cqe = u->cqes + (head & u->cq_mask);
+
+        if (cqe->user_data & URING_UD_REQ) {
+            if (cqe->user_data & URING_UD_LINK)  /* readiness poll */
+                continue;
+            uring_complete_req(ml, (mrp_io_req_t *)(ptrdiff_t)
+                               (cqe->user_data & ~URING_UD_REQ), cqe->res);
+            continue;
+        }
 
-    if (d != NULL && !is_deleted(d)) {
-        mrp_debug("marking deferred %p deleted", d);
-        mark_deleted(d);
-    }
-}
+        fd  = (int)(uint32_t)cqe->user_data;
+        gen = (uint32_t)(cqe->user_data >> 32);
 
+        if (gen == 0)                            /* poll removal */
+            continue;
 
-void mrp_disable_deferred(mrp_deferred_t *d)
-{
-    if (d != NULL)
-        d->inactive = TRUE;
-}
+        if ((w = fdtbl_lookup(ml->fdtbl, fd)) == NULL || w->ugen != gen)
+            continue;
 
+        if (cqe->res < 0 || !(cqe->flags & IORING_CQE_F_MORE)) {
+            w->ugen  = 0;
+            w->umask = 0;
+            uring_push_rearm(u, fd);
+        }
 
-static inline void disable_deferred(mrp_deferred_t *d)
-{
-    if (MRP_LIKELY(d->inactive)) {
-        mrp_list_delete(&d->hook);
-        mrp_list_append(&d->ml->inactive_deferred, &d->hook);
+        if (cqe->res < 0) {
+            if (cqe->res == -ECANCELED)
+                continue;
+            events = EPOLLERR | EPOLLHUP;
+        }
+        else
+            events = (uint32_t)cqe->res;
+
+        /* a multishot poll can complete several times per round */
+        for (i = 0, e = buf; i < n; i++, e++)
+            if (e->data.fd == fd)
+                break;
+
+        if (i < n)
+            e->events |= events;
+        else {
+            e->events   = events;
+            e->data.u64 = 0;
+            e->data.fd  = fd;
+            n++;
+        }
     }
 
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+    return n;
 }
 
 
-void mrp_enable_deferred(mrp_deferred_t *d)
+static int uring_poll(mrp_mainloop_t *ml, struct epoll_event *buf, int max,
+                      int timeout)
 {
-    if (d != NULL) {
-        if (!is_deleted(d)) {
-            d->inactive = FALSE;
-            mrp_list_delete(&d->hook);
-            mrp_list_append(&d->ml->deferred, &d->hook);
+    uring_t                       *u = ml->uring;
+    struct io_uring_getevents_arg  arg;
+    struct __kernel_timespec       ts;
+    unsigned                       to_submit, wait, ready;
+    int                            overflow;
+
+    uring_flush_rearm(ml);
+
+    __atomic_store_n(u->sq_tail, u->tail, __ATOMIC_RELEASE);
+
+    to_submit = uring_unsubmitted(u);
+    ready     = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE) - *u->cq_head;
+    overflow  = __atomic_load_n(u->sq_flags, __ATOMIC_RELAXED) &
+        IORING_SQ_CQ_OVERFLOW;
+    wait      = (timeout != 0 && ready == 0 && mrp_list_empty(&u->done));
+
+    /* we can skip entering the kernel if there is nothing to do there */
+    if (to_submit > 0 || wait || overflow) {
+        mrp_clear(&arg);
+
+        if (wait && timeout > 0) {
+            ts.tv_sec  = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000LL;
+            arg.ts     = (uint64_t)(ptrdiff_t)&ts;
+        }
+
+        if (uring_enter(u, to_submit, wait ? 1 : 0,
+                        IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                        &arg) < 0) {
+            if (errno != EINTR && errno != ETIME && errno != EBUSY)
+                mrp_log_error("io_uring_enter failed (%d: %s).",
+                              errno, strerror(errno));
         }
     }
+
+    return uring_reap(ml, buf, max);
 }
 
 
-mrp_mainloop_t *mrp_get_deferred_mainloop(mrp_deferred_t *d)
+static inline int uring_fd(mrp_mainloop_t *ml)
+{
+    return ml->uring->fd;
+}
+
+
+static void uring_prepare(mrp_mainloop_t *ml)
+{
+    if (ml->uring == NULL)
+        return;
+
+    if (!mrp_list_empty(&ml->uring->done))
+        ml->poll_timeout = 0;
+
+    if (ml->super_ops != NULL) {
+        uring_flush_rearm(ml);
+        uring_submit(ml->uring);
+    }
+}
+
+
+static void uring_destroy(mrp_mainloop_t *ml)
+{
+    uring_t                       *u = ml->uring;
+    struct io_uring_getevents_arg  arg;
+    struct __kernel_timespec       ts;
+    mrp_list_hook_t               *p, *n;
+    mrp_io_req_t                  *req;
+    int                            i;
+
+    if (u == NULL)
+        return;
+
+    /*
+     * Cancel any I/O requests still in flight and give the kernel a
+     * moment to finish them, so it will not touch their buffers once
+     * we have freed them.
+     */
+
+    mrp_list_foreach(&u->reqs, p, n) {
+        req = mrp_list_entry(p, typeof(*req), hook);
+        req->cancelled = TRUE;
+        uring_cancel_req(u, req);
+    }
+
+    for (i = 0; i < 10 && !mrp_list_empty(&u->reqs); i++) {
+        mrp_clear(&arg);
+        ts.tv_sec  = 0;
+        ts.tv_nsec = 10 * 1000000LL;
+        arg.ts     = (uint64_t)(ptrdiff_t)&ts;
+
+        __atomic_store_n(u->sq_tail, u->tail, __ATOMIC_RELEASE);
+        uring_enter(u, uring_unsubmitted(u), 1,
+                    IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg);
+
+        while (uring_reap(ml, ml->events, ml->nevent) > 0)
+            ;
+    }
+
+    mrp_list_foreach(&u->reqs, p, n) {
+        req = mrp_list_entry(p, typeof(*req), hook);
+        free_io_req(req);
+    }
+
+    mrp_list_foreach(&u->done, p, n) {
+        req = mrp_list_entry(p, typeof(*req), hook);
+        free_io_req(req);
+    }
+
+    if (u->sqes != NULL && u->sqes != MAP_FAILED)
+        munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring != NULL && u->cq_ring != MAP_FAILED &&
+        u->cq_ring != u->sq_ring)
+        munmap(u->cq_ring, u->cq_size);
+    if (u->sq_ring != NULL && u->sq_ring != MAP_FAILED)
+        munmap(u->sq_ring, u->sq_size);
+
+    close(u->fd);
+    mrp_free(u->rearm);
+    mrp_free(u);
+
+    ml->uring = NULL;
+}
+
+
+static int uring_create(mrp_mainloop_t *ml)
+{
+    struct io_uring_params  p;
+    uring_t                *u;
+    char                   *ring;
+
+    if ((u = mrp_allocz(sizeof(*u))) == NULL)
+        return FALSE;
+
+    mrp_list_init(&u->reqs);
+    mrp_list_init(&u->done);
+    ml->uring = u;
+
+    mrp_clear(&p);
+    p.flags = IORING_SETUP_CLAMP;
+
+    if ((u->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) < 0)
+        goto fail;
+
+    fcntl(u->fd, F_SETFD, FD_CLOEXEC);
+
+    if ((p.features & URING_FEATURES) != URING_FEATURES) {
+        errno = ENOTSUP;
+        goto fail;
+    }
+
+    u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        u->sq_size = u->cq_size = MRP_MAX(u->sq_size, u->cq_size);
+
+    u->sq_ring = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+
+    if (u->sq_ring == MAP_FAILED)
+        goto fail;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        u->cq_ring = u->sq_ring;
+    else {
+        u->cq_ring = mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+
+        if (u->cq_ring == MAP_FAILED)
+            goto fail;
+    }
+
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes      = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+
+    if (u->sqes == MAP_FAILED)
+        goto fail;
+
+    ring = u->sq_ring;
+    u->sq_head    = (unsigned *)(ring + p.sq_off.head);
+    u->sq_tail    = (unsigned *)(ring + p.sq_off.tail);
+    u->sq_flags   = (unsigned *)(ring + p.sq_off.flags);
+    u->sq_array   = (unsigned *)(ring + p.sq_off.array);
+    u->sq_mask    = *(unsigned *)(ring + p.sq_off.ring_mask);
+    u->sq_entries = *(unsigned *)(ring + p.sq_off.ring_entries);
+    u->tail       = *u->sq_tail;
+
+    ring = u->cq_ring;
+    u->cq_head = (unsigned *)(ring + p.cq_off.head);
+    u->cq_tail = (unsigned *)(ring + p.cq_off.tail);
+    u->cqes    = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+    u->cq_mask = *(unsigned *)(ring + p.cq_off.ring_mask);
+
+    mrp_debug("mainloop %p using io_uring (%u/%u entries)", ml,
+              p.sq_entries, p.cq_entries);
+
+    return TRUE;
+
+ fail:
+    mrp_log_warning("Failed to set up io_uring for mainloop (%d: %s), "
+                    "falling back to epoll.", errno, strerror(errno));
+
+    uring_destroy(ml);
+
+    return FALSE;
+}
+
+
+static mrp_io_req_t *submit_io_req(mrp_mainloop_t *ml, int opcode, int fd,
+                                   const struct iovec *iov, int iovcnt,
+                                   mrp_io_req_cb_t cb, void *user_data)
+{
+    struct io_uring_sqe *poll, *sqe;
+    mrp_io_req_t        *req;
+    uint64_t             data;
+
+    if (ml->uring == NULL) {
+        errno = EOPNOTSUPP;
+        return NULL;
+    }
+
+    if (fd < 0 || cb == NULL || iovcnt <= 0 || iovcnt > MRP_IO_REQ_MAXIOV) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if ((req = mrp_allocz(sizeof(*req))) == NULL)
+        return NULL;
+
+    /* make sure the poll and the transfer end up in the same submission */
+    if (ml->uring->sq_entries - uring_unsubmitted(ml->uring) < 2)
+        uring_submit(ml->uring);
+
+    if ((poll = uring_get_sqe(ml->uring)) == NULL) {
+        mrp_free(req);
+        errno = EBUSY;
+        return NULL;
+    }
+
+    if ((sqe = uring_get_sqe(ml->uring)) == NULL) {
+        poll->opcode = IORING_OP_NOP;            /* can't take it back */
+        mrp_free(req);
+        errno = EBUSY;
+        return NULL;
+    }
+
+    mrp_list_init(&req->hook);
+    req->ml        = ml;
+    req->cb        = cb;
+    req->user_data = user_data;
+    req->release   = req->slots;
+    req->nslot     = MRP_IO_REQ_MAXIOV;
+    memcpy(req->iov, iov, iovcnt * sizeof(iov[0]));
+
+    data = (uint64_t)(ptrdiff_t)req | URING_UD_REQ;
+
+    poll->opcode        = IORING_OP_POLL_ADD;
+    poll->fd            = fd;
+    poll->poll32_events = opcode == IORING_OP_WRITEV ? EPOLLOUT : EPOLLIN;
+    poll->flags         = IOSQE_IO_LINK;
+    poll->user_data     = data | URING_UD_LINK;
+
+    sqe->opcode    = opcode;
+    sqe->fd        = fd;
+    sqe->off       = (uint64_t)-1;
+    sqe->addr      = (uint64_t)(ptrdiff_t)req->iov;
+    sqe->len       = iovcnt;
+    sqe->user_data = data;
+
+    mrp_list_append(&ml->uring->reqs, &req->hook);
+
+    uring_kick(ml);
+
+    return req;
+}
+
+
+int mrp_io_req_supported(mrp_mainloop_t *ml)
+{
+    return ml->uring != NULL;
+}
+
+
+mrp_io_req_t *mrp_io_submit_writev(mrp_mainloop_t *ml, int fd,
+                                   const struct iovec *iov, int iovcnt,
+                                   mrp_io_req_cb_t cb, void *user_data)
+{
+    return submit_io_req(ml, IORING_OP_WRITEV, fd, iov, iovcnt,
+                         cb, user_data);
+}
+
+
+mrp_io_req_t *mrp_io_submit_readv(mrp_mainloop_t *ml, int fd,
+                                  const struct iovec *iov, int iovcnt,
+                                  mrp_io_req_cb_t cb, void *user_data)
+{
+    return submit_io_req(ml, IORING_OP_READV, fd, iov, iovcnt,
+                         cb, user_data);
+}
+
+
+/*
+ * Adopted buffers are collected into a growable release list. Adopting
+ * always leaves a free slot behind, so the final buffer handed over by
+ * mrp_io_req_cancel is guaranteed to fit without allocating memory.
+ */
+
+int mrp_io_req_adopt(mrp_io_req_t *req, void *buf)
+{
+    void **release;
+    int    nslot;
+
+    if (req->nrelease + 1 >= req->nslot) {
+        nslot = 2 * req->nslot;
+
+        if ((release = mrp_alloc_array(void *, nslot)) == NULL)
+            return FALSE;
+
+        memcpy(release, req->release, req->nrelease * sizeof(release[0]));
+
+        if (req->release != req->slots)
+            mrp_free(req->release);
+
+        req->release = release;
+        req->nslot   = nslot;
+    }
+
+    req->release[req->nrelease++] = buf;
+
+    return TRUE;
+}
+
+
+void mrp_io_req_cancel(mrp_io_req_t *req, void *buf)
+{
+    mrp_mainloop_t *ml;
+
+    if (req == NULL) {
+        mrp_free(buf);
+        return;
+    }
+
+    ml = req->ml;
+
+    if (buf != NULL && !mrp_io_req_adopt(req, buf))
+        req->release[req->nrelease++] = buf;     /* the reserved free slot */
+
+    if (req->cancelled)
+        return;
+
+    req->cancelled = TRUE;
+    req->cb        = NULL;
+
+    if (req->done) {                             /* completed, not notified */
+        free_io_req(req);
+        return;
+    }
+
+    uring_cancel_req(ml->uring, req);
+    uring_kick(ml);
+}
+
+
+static void dispatch_io_requests(mrp_mainloop_t *ml)
+{
+    mrp_io_req_t *req;
+    void         *cb;
+    uint64_t      start;
+
+    if (ml->uring == NULL)
+        return;
+
+    while (!mrp_list_empty(&ml->uring->done) && !ml->quit) {
+        req = mrp_list_entry(ml->uring->done.next, typeof(*req), hook);
+
+        mrp_list_delete(&req->hook);
+        mrp_list_init(&req->hook);
+
+        mrp_debug("dispatching I/O request %p (result %zd)", req, req->result);
+
+        req->cancelled = TRUE;                   /* too late to cancel */
+
+        cb    = req->cb;
+        start = stats_begin(ml);
+        req->cb(req, req->result, req->user_data);
+        stats_end(ml, STATS_IO, cb, start, 0);
+
+        free_io_req(req);
+    }
+}
+
+#else /* !URING_BACKEND */
+
+struct mrp_io_req_s {
+    int dummy;
+};
+
+static int uring_arm(mrp_io_watch_t *master, uint32_t mask)
+{
+    MRP_UNUSED(master);
+    MRP_UNUSED(mask);
+
+    errno = EOPNOTSUPP;
+    return -1;
+}
+
+
+static int uring_disarm(mrp_io_watch_t *master)
+{
+    MRP_UNUSED(master);
+
+    errno = EOPNOTSUPP;
+    return -1;
+}
+
+
+static int uring_poll(mrp_mainloop_t *ml, struct epoll_event *buf, int max,
+                      int timeout)
+{
+    MRP_UNUSED(ml);
+    MRP_UNUSED(buf);
+    MRP_UNUSED(max);
+    MRP_UNUSED(timeout);
+
+    return 0;
+}
+
+
+static int uring_create(mrp_mainloop_t *ml)
+{
+    MRP_UNUSED(ml);
+
+    mrp_log_warning("io_uring mainloop backend not available, "
+                    "falling back to epoll.");
+
+    return FALSE;
+}
+
+
+static inline int uring_fd(mrp_mainloop_t *ml)
+{
+    MRP_UNUSED(ml);
+
+    return -1;
+}
+
+
+static inline void uring_prepare(mrp_mainloop_t *ml)
+{
+    MRP_UNUSED(ml);
+}
+
+
+static inline void uring_destroy(mrp_mainloop_t *ml)
+{
+    MRP_UNUSED(ml);
+}
+
+
+static inline void dispatch_io_requests(mrp_mainloop_t *ml)
+{
+    MRP_UNUSED(ml);
+}
+
+
+int mrp_io_req_supported(mrp_mainloop_t *ml)
+{
+    MRP_UNUSED(ml);
+
+    return FALSE;
+}
+
+
+mrp_io_req_t *mrp_io_submit_writev(mrp_mainloop_t *ml, int fd,
+                                   const struct iovec *iov, int iovcnt,
+                                   mrp_io_req_cb_t cb, void *user_data)
+{
+    MRP_UNUSED(ml);
+    MRP_UNUSED(fd);
+    MRP_UNUSED(iov);
+    MRP_UNUSED(iovcnt);
+    MRP_UNUSED(cb);
+    MRP_UNUSED(user_data);
+
+    errno = EOPNOTSUPP;
+    return NULL;
+}
+
+
+mrp_io_req_t *mrp_io_submit_readv(mrp_mainloop_t *ml, int fd,
+                                  const struct iovec *iov, int iovcnt,
+                                  mrp_io_req_cb_t cb, void *user_data)
+{
+    return mrp_io_submit_writev(ml, fd, iov, iovcnt, cb, user_data);
+}
+
+
+int mrp_io_req_adopt(mrp_io_req_t *req, void *buf)
+{
+    MRP_UNUSED(req);
+    MRP_UNUSED(buf);
+
+    return FALSE;
+}
+
+
+void mrp_io_req_cancel(mrp_io_req_t *req, void *buf)
+{
+    MRP_UNUSED(req);
+
+    mrp_free(buf);
+}
+
+#endif /* !URING_BACKEND */
+
+
+const char *mrp_mainloop_backend(mrp_mainloop_t *ml)
+{
+    return ml->uring != NULL ? "io_uring" : "epoll";
+}
+
+
+/*
+ * timers
+ */
+
+static uint64_t time_now(void)
+{
+    struct timespec ts;
+    uint64_t        now;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now  = ts.tv_sec  * USECS_PER_SEC;
+    now += ts.tv_nsec / NSECS_PER_USEC;
+
+    return now;
+}
+
+
+/*
+ * In virtual clock mode timers and wakeups run on ml->vclock, which
+ * mrp_mainloop_poll advances straight to the next timer deadline instead
+ * of sleeping until it. Statistics and dispatch budgets stay real-time.
+ */
+static inline uint64_t ml_now(mrp_mainloop_t *ml)
+{
+    return ml->vclock ? ml->vclock : time_now();
+}
+
+
+static inline int usecs_to_msecs(uint64_t usecs)
+{
+    int msecs;
+
+    msecs = (usecs + USECS_PER_MSEC - 1) / USECS_PER_MSEC;
+
+    return msecs;
+}
+
+
+static inline int timer_before(mrp_timer_t *a, mrp_timer_t *b)
+{
+    if (a->expire != b->expire)
+        return a->expire < b->expire;
+    else
+        return (int32_t)(a->seq - b->seq) < 0;
+}
+
+
+static inline void heap_set(timer_heap_t *h, int i, mrp_timer_t *t)
+{
+    h->t[i] = t;
+    t->idx  = i;
+}
+
+
+static void heap_sift_up(timer_heap_t *h, int i)
+{
+    mrp_timer_t *t = h->t[i];
+    int          parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+
+        if (!timer_before(t, h->t[parent]))
+            break;
+
+        heap_set(h, i, h->t[parent]);
+        i = parent;
+    }
+
+    heap_set(h, i, t);
+}
+
+
+static void heap_sift_down(timer_heap_t *h, int i)
+{
+    mrp_timer_t *t = h->t[i];
+    int          child;
+
+    while ((child = 2 * i + 1) < h->n) {
+        if (child + 1 < h->n && timer_before(h->t[child + 1], h->t[child]))
+            child++;
+
+        if (!timer_before(h->t[child], t))
+            break;
+
+        heap_set(h, i, h->t[child]);
+        i = child;
+    }
+
+    heap_set(h, i, t);
+}
+
+
+static int heap_insert(timer_heap_t *h, mrp_timer_t *t)
+{
+    mrp_timer_t **heap;
+    int           size;
+
+    if (h->n >= h->size) {
+        size = h->size ? 2 * h->size : TIMER_HEAP_MIN;
+        heap = mrp_realloc(h->t, size * sizeof(h->t[0]));
+
+        if (heap == NULL)
+            return FALSE;
+
+        h->t    = heap;
+        h->size = size;
+    }
+
+    t->seq = h->seq++;
+    t->gen = h->gen;
+
+    heap_set(h, h->n++, t);
+    heap_sift_up(h, t->idx);
+
+    return TRUE;
+}
+
+
+static void heap_remove(timer_heap_t *h, mrp_timer_t *t)
+{
+    mrp_timer_t *last;
+    int          i = t->idx;
+
+    if (i < 0)
+        return;
+
+    t->idx = -1;
+    last   = h->t[--h->n];
+
+    if (last != t) {
+        heap_set(h, i, last);
+
+        if (i > 0 && timer_before(last, h->t[(i - 1) / 2]))
+            heap_sift_up(h, i);
+        else
+            heap_sift_down(h, i);
+    }
+}
+
+
+static void heap_update(timer_heap_t *h, mrp_timer_t *t)
+{
+    t->seq = h->seq++;
+    t->gen = h->gen;
+
+    heap_sift_up(h, t->idx);
+    heap_sift_down(h, t->idx);
+}
+
+
+static inline mrp_timer_t *next_timer(mrp_mainloop_t *ml)
+{
+    return ml->timers.n > 0 ? ml->timers.t[0] : NULL;
+}
+
+
+static void update_timer(mrp_timer_t *t)
+{
+    mrp_mainloop_t *ml = t->ml;
+    timer_heap_t   *h  = &ml->timers;
+    mrp_timer_t    *next;
+
+    next = next_timer(ml);
+
+    if (t->idx >= 0)
+        heap_update(h, t);
+    else {
+        if (!heap_insert(h, t)) {
+            mrp_log_error("Failed to restart timer %p.", t);
+            return;
+        }
+
+        mrp_list_delete(&t->hook);
+    }
+
+    if (next_timer(ml) != next || next == t)
+        adjust_superloop_timer(ml);
+}
+
+
+static inline void rearm_timer(mrp_timer_t *t)
+{
+    t->expire = ml_now(t->ml) + t->usecs;
+    update_timer(t);
+}
+
+
+static int free_timer(void *ptr)
+{
+    mrp_timer_t *t = (mrp_timer_t *)ptr;
+
+    mrp_free(t);
+
+    return TRUE;
+}
+
+
+static void dispatch_timerfd(mrp_io_watch_t *w, int fd,
+                             mrp_io_event_t events, void *user_data)
+{
+    mrp_mainloop_t *ml = (mrp_mainloop_t *)user_data;
+    uint64_t        nexp;
+
+    MRP_UNUSED(w);
+    MRP_UNUSED(events);
+
+    /* the timers themselves get dispatched by dispatch_timers */
+    while (read(fd, &nexp, sizeof(nexp)) > 0)
+        ;
+
+    ml->timerfd_armed = 0;
+}
+
+
+static int setup_timerfd(mrp_mainloop_t *ml)
+{
+    if (ml->timerfd == -1) {
+        ml->timerfd = timerfd_create(CLOCK_MONOTONIC,
+                                     TFD_NONBLOCK | TFD_CLOEXEC);
+
+        if (ml->timerfd == -1)
+            return FALSE;
+
+        ml->timerwatch = mrp_add_io_watch(ml, ml->timerfd, MRP_IO_EVENT_IN,
+                                          dispatch_timerfd, ml);
+
+        if (ml->timerwatch == NULL) {
+            close(ml->timerfd);
+            ml->timerfd = -1;
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static int arm_timerfd(mrp_mainloop_t *ml, uint64_t expire)
+{
+    struct itimerspec it;
+
+    /*
+     * Notes:
+     *     The timerfd is armed with an absolute CLOCK_MONOTONIC expiry
+     *     (0 disarms it), so that is exactly time_now() of the deadline.
+     *     We only reprogram it when the deadline actually changes.
+     */
+
+    if (ml->timerfd == -1)
+        return FALSE;
+
+    if (expire == ml->timerfd_armed)
+        return TRUE;
+
+    memset(&it, 0, sizeof(it));
+    it.it_value.tv_sec  = expire / USECS_PER_SEC;
+    it.it_value.tv_nsec = (expire % USECS_PER_SEC) * NSECS_PER_USEC;
+
+    if (timerfd_settime(ml->timerfd, TFD_TIMER_ABSTIME, &it, NULL) < 0)
+        return FALSE;
+
+    ml->timerfd_armed = expire;
+
+    return TRUE;
+}
+
+
+static void coalesce_timers(timer_heap_t *h, int i, uint64_t *deadline,
+                            int *precise)
+{
+    mrp_timer_t *t;
+    uint64_t     d;
+
+    /*
+     * Notes:
+     *     A timer can be dispatched anywhere between its expiry and its
+     *     expiry plus slack. We want to wake up as late as possible but
+     *     before the deadline of any of the timers, so we find the smallest
+     *     deadline among the timers expiring before the current candidate.
+     *     Subtrees of the heap expiring after the candidate are skipped,
+     *     so this only looks at the timers which are dispatched together.
+     */
+
+    if (i >= h->n || (t = h->t[i])->expire > *deadline)
+        return;
+
+    d = t->expire + MRP_MIN(t->slack, UINT64_MAX - t->expire);
+
+    if (d < *deadline)
+        *deadline = d;
+
+    *precise |= t->precise;
+
+    coalesce_timers(h, 2 * i + 1, deadline, precise);
+    coalesce_timers(h, 2 * i + 2, deadline, precise);
+}
+
+
+static mrp_timer_t *add_timer(mrp_mainloop_t *ml, uint64_t usecs,
+                              uint64_t slack, int precise,
+                              mrp_timer_cb_t cb, void *user_data)
+{
+    mrp_timer_t *t;
+
+    if (cb == NULL)
+        return NULL;
+
+    if ((t = mrp_allocz(sizeof(*t))) != NULL) {
+        mrp_list_init(&t->hook);
+        mrp_list_init(&t->deleted);
+        t->ml        = ml;
+        t->expire    = ml_now(ml) + usecs;
+        t->usecs     = usecs;
+        t->slack     = slack;
+        t->precise   = precise;
+        t->cb        = cb;
+        t->user_data = user_data;
+        t->free      = free_timer;
+        t->idx       = -1;
+
+        if (!heap_insert(&ml->timers, t)) {
+            mrp_free(t);
+            return NULL;
+        }
+
+        if (next_timer(ml) == t)
+            adjust_superloop_timer(ml);
+    }
+
+    return t;
+}
+
+
+mrp_timer_t *mrp_add_timer(mrp_mainloop_t *ml, unsigned int msecs,
+                           mrp_timer_cb_t cb, void *user_data)
+{
+    return add_timer(ml, (uint64_t)msecs * USECS_PER_MSEC, 0, FALSE,
+                     cb, user_data);
+}
+
+
+mrp_timer_t *mrp_add_timer_usecs(mrp_mainloop_t *ml, uint64_t usecs,
+                                 uint64_t slack, mrp_timer_cb_t cb,
+                                 void *user_data)
+{
+    if (!setup_timerfd(ml))
+        mrp_debug("no timerfd, usecs timers will have msec precision");
+
+    return add_timer(ml, usecs, slack, TRUE, cb, user_data);
+}
+
+
+void mrp_mod_timer(mrp_timer_t *t, unsigned int msecs)
+{
+    if (t != NULL && !is_deleted(t)) {
+        if (msecs != MRP_TIMER_RESTART)
+            t->usecs = (uint64_t)msecs * USECS_PER_MSEC;
+
+        rearm_timer(t);
+    }
+}
+
+
+void mrp_mod_timer_usecs(mrp_timer_t *t, uint64_t usecs)
+{
+    if (t != NULL && !is_deleted(t)) {
+        if (usecs != MRP_TIMER_RESTART_USECS)
+            t->usecs = usecs;
+
+        rearm_timer(t);
+    }
+}
+
+
+void mrp_set_timer_slack(mrp_timer_t *t, uint64_t slack)
+{
+    if (t != NULL && !is_deleted(t)) {
+        t->slack = slack;
+
+        if (next_timer(t->ml) == t)
+            adjust_superloop_timer(t->ml);
+    }
+}
+
+
+void mrp_stop_timer(mrp_timer_t *t)
+{
+    mrp_mainloop_t *ml;
+    int             first;
+
+    if (t != NULL && !is_deleted(t) && t->idx >= 0) {
+        mrp_debug("stopping timer %p", t);
+
+        ml    = t->ml;
+        first = (next_timer(ml) == t);
+
+        heap_remove(&ml->timers, t);
+        mrp_list_append(&ml->stopped, &t->hook);
+
+        if (first)
+            adjust_superloop_timer(ml);
+    }
+}
+
+
+void mrp_del_timer(mrp_timer_t *t)
+{
+    mrp_mainloop_t *ml;
+    int             first;
+
+    /*
+     * Notes: It is not safe to simply free this entry here as we might
+     *        be dispatching with this entry being the one currently
+     *        processed. We remove the timer from the heap right away
+     *        and link it to the list of deleted items which will be then
+     *        processed at end of the mainloop iteration.
+     */
+
+    if (t != NULL && !is_deleted(t)) {
+        mrp_debug("marking timer %p deleted", t);
+
+        ml    = t->ml;
+        first = (next_timer(ml) == t);
+
+        heap_remove(&ml->timers, t);
+        mark_deleted(t);
+
+        if (first)
+            adjust_superloop_timer(ml);
+    }
+}
+
+
+mrp_mainloop_t *mrp_get_timer_mainloop(mrp_timer_t *t)
+{
+    return t ? t->ml : NULL;
+}
+
+
+/*
+ * deferred/idle callbacks
+ */
+
+static inline mrp_list_hook_t *deferred_list(mrp_deferred_t *d)
+{
+    return d->idle ? &d->ml->idle_deferred : &d->ml->deferred;
+}
+
+
+static mrp_deferred_t *add_deferred(mrp_mainloop_t *ml, mrp_deferred_cb_t cb,
+                                    void *user_data, int idle)
+{
+    mrp_deferred_t *d;
+
+    if (cb == NULL)
+        return NULL;
+
+    if ((d = mrp_allocz(sizeof(*d))) != NULL) {
+        mrp_list_init(&d->hook);
+        mrp_list_init(&d->deleted);
+        d->ml        = ml;
+        d->cb        = cb;
+        d->user_data = user_data;
+        d->idle      = idle ? 1 : 0;
+
+        mrp_list_append(deferred_list(d), &d->hook);
+    }
+
+    return d;
+}
+
+
+mrp_deferred_t *mrp_add_deferred(mrp_mainloop_t *ml, mrp_deferred_cb_t cb,
+                                 void *user_data)
+{
+    return add_deferred(ml, cb, user_data, FALSE);
+}
+
+
+mrp_deferred_t *mrp_add_idle_deferred(mrp_mainloop_t *ml, mrp_deferred_cb_t cb,
+                                      void *user_data)
+{
+    return add_deferred(ml, cb, user_data, TRUE);
+}
+
+
+void mrp_del_deferred(mrp_deferred_t *d)
+{
+    /*
+     * Notes: It is not safe to simply free this entry here as we might
+     *        be dispatching with this entry being the next to process.
+     *        We just mark this here deleted and take care of the rest
+     *        in the dispatching loop.
+     */
+
+    if (d != NULL && !is_deleted(d)) {
+        mrp_debug("marking deferred %p deleted", d);
+        mark_deleted(d);
+    }
+}
+
+
+void mrp_disable_deferred(mrp_deferred_t *d)
+{
+    if (d != NULL)
+        d->inactive = TRUE;
+}
+
+
+static inline void disable_deferred(mrp_deferred_t *d)
+{
+    if (MRP_LIKELY(d->inactive)) {
+        mrp_list_delete(&d->hook);
+        mrp_list_append(&d->ml->inactive_deferred, &d->hook);
+    }
+
+}
+
+
+void mrp_enable_deferred(mrp_deferred_t *d)
+{
+    if (d != NULL) {
+        if (!is_deleted(d)) {
+            d->inactive = FALSE;
+            mrp_list_delete(&d->hook);
+            mrp_list_append(deferred_list(d), &d->hook);
+        }
+    }
+}
+
+
+mrp_mainloop_t *mrp_get_deferred_mainloop(mrp_deferred_t *d)
 {
     return d ? d->ml : NULL;
 }
@@ -1050,7 +2485,7 @@ static void forced_wakeup_cb(mrp_timer_t *t, void *user_data)
 
     mrp_debug("dispatching forced wakeup cb %p", w);
 
-    wakeup_cb(w, MRP_WAKEUP_EVENT_LIMIT, time_now());
+    wakeup_cb(w, MRP_WAKEUP_EVENT_LIMIT, ml_now(w->ml));
 }
 
 
@@ -1077,7 +2512,7 @@ mrp_wakeup_t *mrp_add_wakeup(mrp_mainloop_t *ml, mrp_wakeup_event_t events,
         w->lpf = lpf_msecs * USECS_PER_MSEC;
 
         if (lpf_msecs != MRP_WAKEUP_NOLIMIT)
-            w->next = time_now() + w->lpf;
+            w->next = ml_now(ml) + w->lpf;
 
         if (force_msecs != MRP_WAKEUP_NOLIMIT) {
             w->timer = mrp_add_timer(ml, force_msecs, forced_wakeup_cb, w);
@@ -1128,6 +2563,8 @@ static int free_subloop(void *ptr)
     mrp_debug("freeing subloop %p", sl);
 
     mrp_free(sl->pollfds);
+    mrp_free(sl->qfds);
+    mrp_free(sl->ready);
     mrp_free(sl->events);
     mrp_free(sl);
 
@@ -1331,8 +2768,9 @@ int mrp_set_superloop(mrp_mainloop_t *ml, mrp_superloop_ops_t *ops,
         mrp_mainloop_prepare(ml);
 
         events    = MRP_IO_EVENT_IN | MRP_IO_EVENT_OUT | MRP_IO_EVENT_HUP;
-        ml->iow   = ops->add_io(ml->super_data, ml->epollfd, events,
-                                super_io_cb, ml);
+        ml->iow   = ops->add_io(ml->super_data,
+                                ml->uring ? uring_fd(ml) : ml->epollfd,
+                                events, super_io_cb, ml);
         ml->work  = ops->add_defer(ml->super_data, super_work_cb, ml);
 
         /*
@@ -1428,15 +2866,25 @@ static void purge_io_watches(mrp_mainloop_t *ml)
 
 static void purge_timers(mrp_mainloop_t *ml)
 {
+    timer_heap_t    *h = &ml->timers;
     mrp_list_hook_t *p, *n;
     mrp_timer_t     *t;
+    int              i;
+
+    for (i = 0; i < h->n; i++)
+        mrp_free(h->t[i]);
 
-    mrp_list_foreach(&ml->timers, p, n) {
+    mrp_list_foreach(&ml->stopped, p, n) {
         t = mrp_list_entry(p, typeof(*t), hook);
         mrp_list_delete(&t->hook);
         mrp_list_delete(&t->deleted);
         mrp_free(t);
     }
+
+    mrp_free(h->t);
+    h->t    = NULL;
+    h->n    = 0;
+    h->size = 0;
 }
 
 
@@ -1458,6 +2906,13 @@ static void purge_deferred(mrp_mainloop_t *ml)
         mrp_list_delete(&d->deleted);
         mrp_free(d);
     }
+
+    mrp_list_foreach(&ml->idle_deferred, p, n) {
+        d = mrp_list_entry(p, typeof(*d), hook);
+        mrp_list_delete(&d->hook);
+        mrp_list_delete(&d->deleted);
+        mrp_free(d);
+    }
 }
 
 
@@ -1531,22 +2986,34 @@ mrp_mainloop_t *mrp_mainloop_create(void)
 {
     mrp_mainloop_t *ml;
 
+    const char     *backend;
+
     if ((ml = mrp_allocz(sizeof(*ml))) != NULL) {
-        ml->epollfd = epoll_create1(EPOLL_CLOEXEC);
+        backend = getenv(MRP_MAINLOOP_BACKEND_ENVVAR);
+
+        if (backend != NULL && !strcmp(backend, "io_uring") &&
+            uring_create(ml))
+            ml->epollfd = -1;
+        else
+            ml->epollfd = epoll_create1(EPOLL_CLOEXEC);
+
         ml->sigfd   = -1;
+        ml->timerfd = -1;
         ml->fdtbl   = fdtbl_create();
 
-        if (ml->epollfd >= 0 && ml->fdtbl != NULL) {
+        if ((ml->epollfd >= 0 || ml->uring != NULL) && ml->fdtbl != NULL) {
             mrp_list_init(&ml->iowatches);
-            mrp_list_init(&ml->timers);
+            mrp_list_init(&ml->stopped);
             mrp_list_init(&ml->deferred);
             mrp_list_init(&ml->inactive_deferred);
+            mrp_list_init(&ml->idle_deferred);
             mrp_list_init(&ml->sighandlers);
             mrp_list_init(&ml->wakeups);
             mrp_list_init(&ml->deleted);
             mrp_list_init(&ml->subloops);
             mrp_list_init(&ml->busses);
             mrp_list_init(&ml->eventq);
+            mrp_list_init(&ml->eventpool);
 
             ml->eventd = mrp_add_deferred(ml, pump_events, ml);
             if (ml->eventd == NULL)
@@ -1558,6 +3025,7 @@ mrp_mainloop_t *mrp_mainloop_create(void)
         }
         else {
         fail:
+            uring_destroy(ml);
             close(ml->epollfd);
             fdtbl_destroy(ml->fdtbl);
             mrp_free(ml);
@@ -1582,10 +3050,15 @@ void mrp_mainloop_destroy(mrp_mainloop_t *ml)
         purge_wakeups(ml);
         purge_subloops(ml);
         purge_deleted(ml);
+        purge_events(ml);
 
+        uring_destroy(ml);
         close(ml->sigfd);
+        close(ml->timerfd);
         close(ml->epollfd);
         fdtbl_destroy(ml->fdtbl);
+        mrp_arena_destroy(ml->arena);
+        mrp_mainloop_enable_stats(ml, FALSE);
 
         mrp_free(ml->events);
         mrp_free(ml);
@@ -1593,6 +3066,99 @@ void mrp_mainloop_destroy(mrp_mainloop_t *ml)
 }
 
 
+static void update_subloop_fds(mrp_subloop_t *sl, struct pollfd *fds, int nfd)
+{
+    struct epoll_event  evt;
+    struct pollfd      *pollfds;
+    int                 npollfd, fd, idx, op, i;
+
+    /*
+     * Notes:
+     *
+     *     Rather than tearing down and rebuilding the whole epoll set
+     *     whenever the subloop fds change, we only add the fds that came
+     *     and remove the ones that went. Fds present in both sets are
+     *     modified in place, which also takes care of fds that have been
+     *     closed (and hence dropped by epoll) and reopened in between.
+     *
+     *     While we go through the new set, the fd table maps the old fds
+     *     to their old index + 1 and the already processed new ones to
+     *     -(new index + 1). Duplicates end up using the first entry.
+     */
+
+    pollfds = sl->pollfds;
+    npollfd = sl->npollfd;
+
+    for (i = 0; i < nfd; i++) {
+        fd  = fds[i].fd;
+        idx = (int)(ptrdiff_t)fdtbl_lookup(sl->fdtbl, fd);
+
+        fds[i].revents = 0;
+
+        if (idx < 0)
+            continue;
+
+        if (idx > 0) {
+            fdtbl_remove(sl->fdtbl, fd);
+            op = EPOLL_CTL_MOD;
+        }
+        else
+            op = EPOLL_CTL_ADD;
+
+        evt.events   = fds[i].events;
+        evt.data.u64 = 0;                /* init full union for valgrind... */
+        evt.data.fd  = fd;
+
+        if (epoll_ctl(sl->epollfd, op, fd, &evt) != 0) {
+            if (op != EPOLL_CTL_MOD || errno != ENOENT ||
+                epoll_ctl(sl->epollfd, EPOLL_CTL_ADD, fd, &evt) != 0)
+                mrp_log_error("Failed to add subloop fd %d to epoll "
+                              "(%d: %s)", fd, errno, strerror(errno));
+        }
+
+        if (fdtbl_insert(sl->fdtbl, fd, (void *)(ptrdiff_t)-(i + 1)) != 0)
+            mrp_log_error("Failed to add subloop fd %d to fd table "
+                          "(%d: %s)", fd, errno, strerror(errno));
+    }
+
+    for (i = 0; i < npollfd; i++) {
+        fd = pollfds[i].fd;
+
+        if (fdtbl_lookup(sl->fdtbl, fd) != (void *)(ptrdiff_t)(i + 1))
+            continue;
+
+        fdtbl_remove(sl->fdtbl, fd);
+        if (epoll_ctl(sl->epollfd, EPOLL_CTL_DEL, fd, &evt) < 0) {
+            if (errno != EBADF && errno != ENOENT)
+                mrp_log_error("Failed to delete subloop fd %d from epoll "
+                              "(%d: %s)", fd, errno, strerror(errno));
+        }
+    }
+
+    for (i = 0; i < nfd; i++) {
+        fd = fds[i].fd;
+
+        if (fdtbl_lookup(sl->fdtbl, fd) == (void *)(ptrdiff_t)-(i + 1)) {
+            fdtbl_remove(sl->fdtbl, fd);
+            fdtbl_insert(sl->fdtbl, fd, (void *)(ptrdiff_t)(i + 1));
+        }
+    }
+
+    if (sl->maxpollfd < nfd) {
+        sl->pollfds   = mrp_reallocz(sl->pollfds, sl->maxpollfd, nfd);
+        sl->maxpollfd = nfd;
+
+        MRP_ASSERT(sl->pollfds != NULL, "failed to allocate pollfd's");
+    }
+
+    if (nfd > 0)
+        memcpy(sl->pollfds, fds, nfd * sizeof(*fds));
+
+    sl->npollfd = nfd;
+    sl->nready  = 0;
+}
+
+
 static int prepare_subloop(mrp_subloop_t *sl)
 {
     /*
@@ -1615,12 +3181,9 @@ static int prepare_subloop(mrp_subloop_t *sl)
      */
 
 
-    struct epoll_event  evt;
-    struct pollfd      *fds, *pollfds;
-    int                 timeout;
-    int                 nfd, npollfd, n, i;
-    int                 nmatch;
-    int                 fd, idx;
+    struct pollfd *fds, *pollfds;
+    int            timeout;
+    int            nfd, npollfd, n, i;
 
     MRP_UNUSED(dump_pollfds);
 
@@ -1635,17 +3198,23 @@ static int prepare_subloop(mrp_subloop_t *sl)
     }
     sl->poll = FALSE;
 
-    nfd = npollfd;
-    fds = nfd ? mrp_allocz(nfd * sizeof(*fds)) : NULL;
+    /*
+     * query into a buffer of our own which we keep around, so that an
+     * unchanged set of fds costs us neither allocations nor syscalls
+     */
 
-    MRP_ASSERT(nfd == 0 || fds != NULL, "failed to allocate pollfd's");
+    fds = sl->qfds;
+    nfd = sl->nqfd;
 
     while ((n = sl->cb->query(sl->user_data, fds, nfd, &timeout)) > nfd) {
         fds = mrp_reallocz(fds, nfd, n);
         nfd = n;
         MRP_ASSERT(fds != NULL, "failed to allocate pollfd's");
     }
-    nfd = n;
+
+    sl->qfds = fds;
+    sl->nqfd = nfd;
+    nfd      = n;
 
 
 #if 0
@@ -1656,76 +3225,30 @@ static int prepare_subloop(mrp_subloop_t *sl)
 #endif
 
 
-    /*
-     * skip over the identical portion of the old and new pollfd's
-     */
-
-    for (i = nmatch = 0; i < npollfd && i < n; i++, nmatch++) {
-        if (fds[i].fd     != pollfds[i].fd ||
-            fds[i].events != pollfds[i].events)
-            break;
-        else
-            fds[i].revents = pollfds[i].revents = 0;
-    }
-
-
-    if (nmatch == npollfd && npollfd == nfd) {
-        mrp_free(fds);
-        goto out;
-    }
-
-
-    /*
-     * replace file descriptors with the new set (remove old, add new)
-     */
-
-    for (i = 0; i < npollfd; i++) {
-        fd = pollfds[i].fd;
-        fdtbl_remove(sl->fdtbl, fd);
-        if (epoll_ctl(sl->epollfd, EPOLL_CTL_DEL, fd, &evt) < 0) {
-            if (errno != EBADF && errno != ENOENT)
-                mrp_log_error("Failed to delete subloop fd %d from epoll "
-                              "(%d: %s)", fd, errno, strerror(errno));
-        }
-    }
-
-    for (i = 0; i < nfd; i++) {
-        fd  = fds[i].fd;
-        idx = i + 1;
-
-        evt.events   = fds[i].events;
-        evt.data.u64 = 0;                /* init full union for valgrind... */
-        evt.data.fd  = fd;
-
-        if (fdtbl_insert(sl->fdtbl, fd, (void *)(ptrdiff_t)idx) == 0) {
-            if (epoll_ctl(sl->epollfd, EPOLL_CTL_ADD, fd, &evt) != 0) {
-                mrp_log_error("Failed to add subloop fd %d to epoll "
-                              "(%d: %s)", fd, errno, strerror(errno));
-            }
-        }
-        else {
-            mrp_log_error("Failed to add subloop fd %d to fd table "
-                          "(%d: %s)", fd, errno, strerror(errno));
-        }
+    if (nfd == npollfd) {
+        for (i = 0; i < nfd; i++)
+            if (fds[i].fd     != pollfds[i].fd ||
+                fds[i].events != pollfds[i].events)
+                break;
 
-        fds[i].revents = 0;
+        if (i == nfd)
+            goto out;
     }
 
-    mrp_free(sl->pollfds);
-    sl->pollfds = fds;
-    sl->npollfd = nfd;
+    update_subloop_fds(sl, fds, nfd);
 
 
     /*
-     * resize event buffer if needed
+     * resize event buffers if needed
      */
 
     if (sl->nevent < nfd) {
+        sl->ready  = mrp_reallocz(sl->ready, sl->nevent, nfd);
         sl->nevent = nfd;
         sl->events = mrp_realloc(sl->events, sl->nevent * sizeof(*sl->events));
 
-        MRP_ASSERT(sl->events != NULL || sl->nevent == 0,
-                   "can't allocate epoll event buffer");
+        MRP_ASSERT((sl->events != NULL && sl->ready != NULL) ||
+                   sl->nevent == 0, "can't allocate epoll event buffer");
     }
 
  out:
@@ -1762,58 +3285,121 @@ static int prepare_subloops(mrp_mainloop_t *ml)
 #if 0
 static inline void dump_timers(mrp_mainloop_t *ml)
 {
-    mrp_timer_t     *t;
-    mrp_list_hook_t *p, *n;
-    int              i;
-    mrp_timer_t     *next = NULL;
+    timer_heap_t *h = &ml->timers;
+    mrp_timer_t  *t;
+    int           i;
 
     mrp_debug("timer dump:");
-    i = 0;
-    mrp_list_foreach(&ml->timers, p, n) {
-        t = mrp_list_entry(p, typeof(*t), hook);
+    for (i = 0; i < h->n; i++) {
+        t = h->t[i];
 
         mrp_debug("  #%d: %p, @%u, next %llu (%s)", i, t, t->msecs, t->expire,
                   is_deleted(t) ? "DEAD" : "alive");
 
-        if (!is_deleted(t) && next == NULL)
-            next = t;
-
-        i++;
+        if ((i > 0 && timer_before(t, h->t[(i - 1) / 2])) || t->idx != i) {
+            mrp_debug("*** BUG timer heap is corrupt at #%d !!! ***", i);
+            if (getenv("__MURPHY_TIMER_CHECK_ABORT") != NULL)
+                abort();
+        }
     }
 
-    mrp_debug("next timer: %p", ml->next_timer);
+    mrp_debug("next timer: %p", next_timer(ml));
     mrp_debug("poll timer: %d", ml->poll_timeout);
+}
+#endif
+
+
+static void resize_events(mrp_mainloop_t *ml)
+{
+    int size, max, pending;
+
+    /*
+     * Size the epoll event buffer according to the observed number of
+     * ready events: double it whenever a poll fills it up and halve it
+     * if it stays mostly unused for a window of EVENTS_WINDOW polls. A
+     * shorter buffer never loses events, epoll just reports the rest of
+     * the ready descriptors in the next round.
+     */
+
+    max     = MRP_MAX(ml->niowatch, EVENTS_MIN);
+    pending = ml->poll_result - ml->poll_next;
+    size    = ml->nevent;
+
+    if (size == 0)
+        size = MRP_MIN(max, EVENTS_INIT);
+    else if (ml->ready_max >= size)
+        size *= 2;
+    else if (ml->ready_rounds >= EVENTS_WINDOW) {
+        if (ml->ready_max * 4 < size)
+            size /= 2;
+
+        ml->ready_max    = 0;
+        ml->ready_rounds = 0;
+    }
+
+    size = MRP_MIN(size, max);
+    size = MRP_MAX(size, EVENTS_MIN);
+    size = MRP_MAX(size, pending + 1);
+
+    if (size != ml->nevent) {
+        if (pending > 0 && ml->poll_next > 0) {
+            memmove(ml->events, ml->events + ml->poll_next,
+                    pending * sizeof(*ml->events));
+            ml->poll_result = pending;
+            ml->poll_next   = 0;
+        }
+
+        mrp_debug("resizing epoll event buffer of mainloop %p: %d -> %d",
+                  ml, ml->nevent, size);
+
+        ml->nevent    = size;
+        ml->events    = mrp_realloc(ml->events, size * sizeof(*ml->events));
+        ml->ready_max = 0;
 
-    if (next != NULL && ml->next_timer != NULL &&
-        !is_deleted(ml->next_timer) && next != ml->next_timer) {
-        mrp_debug("*** BUG ml->next_timer is not the nearest !!! ***");
-        if (getenv("__MURPHY_TIMER_CHECK_ABORT") != NULL)
-            abort();
+        MRP_ASSERT(ml->events != NULL, "can't allocate epoll event buffer");
     }
 }
-#endif
 
 
 int mrp_mainloop_prepare(mrp_mainloop_t *ml)
 {
-    mrp_timer_t *next_timer;
-    int          timeout, ext_timeout;
-    uint64_t     now;
+    mrp_timer_t *next;
+    int          timeout, ext_timeout, precise;
+    uint64_t     now, deadline;
+
+    ml->vdeadline = 0;
 
     if (!mrp_list_empty(&ml->deferred)) {
         timeout = 0;
     }
     else {
-        next_timer = ml->next_timer;
+        next = next_timer(ml);
 
-        if (next_timer == NULL)
+        if (next == NULL) {
             timeout = -1;
+            arm_timerfd(ml, 0);
+        }
         else {
-            now = time_now();
-            if (MRP_UNLIKELY(next_timer->expire <= now))
+            now = ml_now(ml);
+            if (MRP_UNLIKELY(next->expire <= now))
                 timeout = 0;
-            else
-                timeout = usecs_to_msecs(next_timer->expire - now);
+            else {
+                deadline = UINT64_MAX;
+                precise  = FALSE;
+                coalesce_timers(&ml->timers, 0, &deadline, &precise);
+
+                if (ml->vclock) {
+                    ml->vdeadline = deadline;
+                    precise       = FALSE;
+                }
+
+                if (precise && arm_timerfd(ml, deadline))
+                    timeout = -1;
+                else {
+                    timeout = usecs_to_msecs(deadline - now);
+                    arm_timerfd(ml, 0);
+                }
+            }
         }
     }
 
@@ -1826,12 +3412,14 @@ int mrp_mainloop_prepare(mrp_mainloop_t *ml)
     else
         ml->poll_timeout = ext_timeout;
 
-    if (ml->nevent < ml->niowatch) {
-        ml->nevent = ml->niowatch;
-        ml->events = mrp_realloc(ml->events, ml->nevent * sizeof(*ml->events));
+    if (ml->poll_next < ml->poll_result)             /* undispatched events */
+        ml->poll_timeout = 0;
 
-        MRP_ASSERT(ml->events != NULL, "can't allocate epoll event buffer");
-    }
+    if (!mrp_list_empty(&ml->idle_deferred))         /* pending idle work */
+        ml->poll_timeout = 0;
+
+    resize_events(ml);
+    uring_prepare(ml);
 
     mrp_debug("mainloop %p prepared: %d I/O watches, timeout %d", ml,
               ml->niowatch, ml->poll_timeout);
@@ -1855,7 +3443,10 @@ static size_t poll_events(void *id, mrp_mainloop_t *ml, void **bufp)
     buf = mrp_allocz(ml->nevent * sizeof(ml->events[0]));
 
     if (buf != NULL) {
-        n = epoll_wait(ml->epollfd, buf, ml->nevent, 0);
+        if (ml->uring != NULL)
+            n = uring_poll(ml, buf, ml->nevent, 0);
+        else
+            n = epoll_wait(ml->epollfd, buf, ml->nevent, 0);
 
         if (n < 0)
             n = 0;
@@ -1868,18 +3459,80 @@ static size_t poll_events(void *id, mrp_mainloop_t *ml, void **bufp)
 }
 
 
+static int merge_events(mrp_mainloop_t *ml, int pending, int n)
+{
+    struct epoll_event *e, *o;
+    int                 i, j, cnt;
+
+    /*
+     * Fold newly polled events for descriptors which still have events
+     * pending from the previous round into the pending ones.
+     */
+
+    for (i = 0, cnt = 0; i < n; i++) {
+        e = ml->events + pending + i;
+
+        for (j = 0, o = ml->events; j < pending; j++, o++) {
+            if (o->data.fd == e->data.fd) {
+                o->events |= e->events;
+                break;
+            }
+        }
+
+        if (j == pending)
+            ml->events[pending + cnt++] = *e;
+    }
+
+    return cnt;
+}
+
+
 int mrp_mainloop_poll(mrp_mainloop_t *ml, int may_block)
 {
-    int n, timeout;
+    struct epoll_event *buf;
+    int                 n, max, pending, timeout;
 
     timeout = may_block && mrp_list_empty(&ml->deferred) ? ml->poll_timeout : 0;
 
-    if (ml->nevent > 0) {
+    /* with a virtual clock, only peek at I/O if we'd sleep until a timer */
+    if (ml->vclock && ml->vdeadline && timeout != 0)
+        timeout = 0;
+    else
+        ml->vdeadline = 0;
+
+    /* move any events left undispatched by the last round to the front */
+    pending = ml->poll_result - ml->poll_next;
+
+    if (pending > 0) {
+        if (ml->poll_next > 0)
+            memmove(ml->events, ml->events + ml->poll_next,
+                    pending * sizeof(*ml->events));
+        timeout = 0;
+    }
+    else
+        pending = 0;
+
+    ml->poll_next   = 0;
+    ml->poll_result = pending;
+
+    max = ml->nevent - pending;
+
+    if (ml->budget_events > 0 && max > ml->budget_events - pending)
+        max = ml->budget_events - pending;
+
+    if (max > 0) {
+        buf = ml->events + pending;
+
         if (ml->super_ops == NULL || ml->super_ops->poll_io == NULL) {
             mrp_debug("polling %d descriptors with timeout %d",
-                      ml->nevent, timeout);
+                      max, timeout);
 
-            n = epoll_wait(ml->epollfd, ml->events, ml->nevent, timeout);
+            mrp_trace_begin("mainloop-poll", max, timeout);
+            if (ml->uring != NULL)
+                n = uring_poll(ml, buf, max, timeout);
+            else
+                n = epoll_wait(ml->epollfd, buf, max, timeout);
+            mrp_trace_end("mainloop-poll", n);
 
             if (n < 0 && errno == EINTR)
                 n = 0;
@@ -1888,8 +3541,7 @@ int mrp_mainloop_poll(mrp_mainloop_t *ml, int may_block)
             mrp_superloop_ops_t *super_ops  = ml->super_ops;
             void                *super_data = ml->super_data;
             void                *id         = ml->iow;
-            void                *buf        = ml->events;
-            size_t               size       = ml->nevent * sizeof(ml->events[0]);
+            size_t               size       = max * sizeof(ml->events[0]);
 
             size = super_ops->poll_io(super_data, id, buf, size);
             n    = size / sizeof(ml->events[0]);
@@ -1898,20 +3550,33 @@ int mrp_mainloop_poll(mrp_mainloop_t *ml, int may_block)
                        "superloop passed us a partial epoll_event");
         }
 
-        mrp_debug("mainloop %p has %d/%d I/O events waiting", ml, n,
-                  ml->nevent);
+        if (n < 0)
+            n = 0;
+
+        ml->ready_max = MRP_MAX(ml->ready_max, pending + n);
+        ml->ready_rounds++;
 
-        ml->poll_result = n;
+        if (pending > 0 && n > 0)
+            n = merge_events(ml, pending, n);
+
+        mrp_debug("mainloop %p has %d/%d I/O events waiting", ml,
+                  pending + n, ml->nevent);
+
+        ml->poll_result = pending + n;
     }
-    else {
+    else if (pending == 0) {
         /*
          * Notes: Practically we should never branch here because
          *     we always have at least ml->sigfd registered for epoll.
          */
         if (timeout > 0)
             usleep(timeout * USECS_PER_MSEC);
+    }
 
-        ml->poll_result = 0;
+    if (ml->vdeadline && ml->poll_result == 0 && ml->vclock < ml->vdeadline) {
+        mrp_debug("advancing virtual clock by %llu usecs",
+                  (unsigned long long)(ml->vdeadline - ml->vclock));
+        ml->vclock = ml->vdeadline;
     }
 
     return TRUE;
@@ -1924,10 +3589,15 @@ static int poll_subloop(mrp_subloop_t *sl)
     struct pollfd      *pfd;
     int                 fd, idx, n, i;
 
+    /* clear only the revents we set last time around */
+    for (i = 0; i < sl->nready; i++)
+        sl->pollfds[sl->ready[i]].revents = 0;
+    sl->nready = 0;
+
     if (sl->poll) {
         n = epoll_wait(sl->epollfd, sl->events, sl->nevent, 0);
 
-        if (n < 0 && errno == EINTR)
+        if (n < 0)
             n = 0;
 
         for (i = 0, e = sl->events; i < n; i++, e++) {
@@ -1937,6 +3607,7 @@ static int poll_subloop(mrp_subloop_t *sl)
             if (0 <= idx && idx < sl->npollfd) {
                 pfd = sl->pollfds + idx;
                 pfd->revents = e->events;
+                sl->ready[sl->nready++] = idx;
             }
         }
 
@@ -1973,7 +3644,7 @@ static void dispatch_wakeup(mrp_mainloop_t *ml)
         event = MRP_WAKEUP_EVENT_IO;
     }
 
-    now = time_now();
+    now = ml_now(ml);
 
     mrp_list_foreach(&ml->wakeups, p, n) {
         w = mrp_list_entry(p, typeof(*w), hook);
@@ -1986,7 +3657,57 @@ static void dispatch_wakeup(mrp_mainloop_t *ml)
             wakeup_cb(w, event, now);
         }
         else
-            mrp_debug("skipping deleted wakeup cb %p", w);
+            mrp_debug("skipping deleted wakeup cb %p", w);
+
+        if (ml->quit)
+            break;
+    }
+}
+
+
+static inline int budget_exhausted(mrp_mainloop_t *ml)
+{
+    if (ml->budget_usecs <= 0)
+        return FALSE;
+
+    return time_now() - ml->dispatch_start >= (uint64_t)ml->budget_usecs;
+}
+
+
+static void dispatch_deferred(mrp_mainloop_t *ml)
+{
+    mrp_list_hook_t *p, *n;
+    mrp_deferred_t  *d;
+    void            *cb;
+    uint64_t         start;
+
+    mrp_list_foreach(&ml->deferred, p, n) {
+        d = mrp_list_entry(p, typeof(*d), hook);
+
+        if (p != ml->deferred.next && budget_exhausted(ml)) {
+            /*
+             * Out of time, rotate the list so that we continue from
+             * the first undispatched callback during the next round.
+             */
+            mrp_list_delete(&ml->deferred);
+            mrp_list_insert_before(p, &ml->deferred);
+            break;
+        }
+
+        if (!is_deleted(d) && !d->inactive) {
+            mrp_debug("dispatching active deferred cb %p", d);
+
+            cb    = d->cb;
+            start = stats_begin(ml);
+            d->cb(d, d->user_data);
+            stats_end(ml, STATS_DEFERRED, cb, start, 0);
+        }
+        else
+            mrp_debug("skipping %s deferred cb %p",
+                      is_deleted(d) ? "deleted" : "inactive", d);
+
+        if (!is_deleted(d) && d->inactive)
+            disable_deferred(d);
 
         if (ml->quit)
             break;
@@ -1994,21 +3715,50 @@ static void dispatch_wakeup(mrp_mainloop_t *ml)
 }
 
 
-static void dispatch_deferred(mrp_mainloop_t *ml)
+/*
+ * Idle deferred callbacks are dispatched last. An iteration is idle if it
+ * polled no I/O, had no ordinary deferred callbacks, and has no expired
+ * timers left over. Only idle iterations run idle callbacks, unless we
+ * have an idle slice, which they may then use in any iteration with
+ * dispatch budget to spare.
+ */
+static void dispatch_idle(mrp_mainloop_t *ml, int idle)
 {
     mrp_list_hook_t *p, *n;
     mrp_deferred_t  *d;
+    mrp_timer_t     *t;
+    void            *cb;
+    uint64_t         start, end;
 
-    mrp_list_foreach(&ml->deferred, p, n) {
+    if (mrp_list_empty(&ml->idle_deferred) || ml->dispatching > 1)
+        return;
+
+    if (idle && (t = next_timer(ml)) != NULL && t->expire <= ml_now(ml))
+        idle = FALSE;
+
+    if (!idle && (ml->idle_usecs <= 0 || budget_exhausted(ml)))
+        return;
+
+    end = ml->idle_usecs > 0 ? time_now() + ml->idle_usecs : 0;
+
+    mrp_list_foreach(&ml->idle_deferred, p, n) {
         d = mrp_list_entry(p, typeof(*d), hook);
 
+        if (p != ml->idle_deferred.next && end && time_now() >= end) {
+            /* out of time, continue from here during the next round */
+            mrp_list_delete(&ml->idle_deferred);
+            mrp_list_insert_before(p, &ml->idle_deferred);
+            break;
+        }
+
         if (!is_deleted(d) && !d->inactive) {
-            mrp_debug("dispatching active deferred cb %p", d);
+            mrp_debug("dispatching idle deferred cb %p", d);
+
+            cb    = d->cb;
+            start = stats_begin(ml);
             d->cb(d, d->user_data);
+            stats_end(ml, STATS_DEFERRED, cb, start, 0);
         }
-        else
-            mrp_debug("skipping %s deferred cb %p",
-                      is_deleted(d) ? "deleted" : "inactive", d);
 
         if (!is_deleted(d) && d->inactive)
             disable_deferred(d);
@@ -2021,29 +3771,38 @@ static void dispatch_deferred(mrp_mainloop_t *ml)
 
 static void dispatch_timers(mrp_mainloop_t *ml)
 {
-    mrp_list_hook_t *p, *n;
-    mrp_timer_t     *t;
-    uint64_t         now;
+    timer_heap_t *h = &ml->timers;
+    mrp_timer_t  *t;
+    uint32_t      gen;
+    uint64_t      now, start, expire;
+    void         *cb;
 
-    now = time_now();
+    /*
+     * Notes:
+     *     Timers (re)armed during this round get tagged with the new
+     *     round and, being the most recently inserted ones, they sort
+     *     after any timers that have already expired. Hence we can stop
+     *     as soon as we see a timer (re)armed during this round, which
+     *     guarantees that we dispatch each expired timer at most once.
+     */
 
-    mrp_list_foreach(&ml->timers, p, n) {
-        t = mrp_list_entry(p, typeof(*t), hook);
+    now = ml_now(ml);
+    gen = ++h->gen;
 
-        if (!is_deleted(t)) {
-            if (t->expire <= now) {
-                mrp_debug("dispatching expired timer %p", t);
+    while ((t = next_timer(ml)) != NULL) {
+        if (t->expire > now || t->gen == gen)
+            break;
 
-                t->cb(t, t->user_data);
+        mrp_debug("dispatching expired timer %p", t);
 
-                if (!is_deleted(t))
-                    rearm_timer(t);
-            }
-            else
-                break;
-        }
-        else
-            mrp_debug("skipping deleted timer %p", t);
+        cb     = t->cb;
+        expire = t->expire;
+        start  = stats_begin(ml);
+        t->cb(t, t->user_data);
+        stats_end(ml, STATS_TIMER, cb, start, ml->vclock ? 0 : expire);
+
+        if (!is_deleted(t) && t->idx >= 0 && t->gen != gen)
+            rearm_timer(t);
 
         if (ml->quit)
             break;
@@ -2055,6 +3814,8 @@ static void dispatch_subloops(mrp_mainloop_t *ml)
 {
     mrp_list_hook_t *p, *n;
     mrp_subloop_t   *sl;
+    void            *cb;
+    uint64_t         start;
 
     mrp_list_foreach(&ml->subloops, p, n) {
         sl = mrp_list_entry(p, typeof(*sl), hook);
@@ -2065,7 +3826,11 @@ static void dispatch_subloops(mrp_mainloop_t *ml)
             if (sl->cb->check(sl->user_data, sl->pollfds,
                               sl->npollfd)) {
                 mrp_debug("dispatching subloop %p", sl);
+
+                cb    = sl->cb->dispatch;
+                start = stats_begin(ml);
                 sl->cb->dispatch(sl->user_data);
+                stats_end(ml, STATS_SUBLOOP, cb, start, 0);
             }
             else
                 mrp_debug("skipping subloop %p, check said no", sl);
@@ -2079,6 +3844,8 @@ static void dispatch_slaves(mrp_io_watch_t *w, struct epoll_event *e)
     mrp_io_watch_t  *s;
     mrp_list_hook_t *p, *n;
     mrp_io_event_t   events;
+    void            *cb;
+    uint64_t         start;
 
     events = e->events & ~(MRP_IO_EVENT_INOUT & w->events);
 
@@ -2090,7 +3857,11 @@ static void dispatch_slaves(mrp_io_watch_t *w, struct epoll_event *e)
 
         if (!is_deleted(s)) {
             mrp_debug("dispatching slave I/O watch %p (fd %d)", s, s->fd);
+
+            cb    = s->cb;
+            start = stats_begin(w->ml);
             s->cb(s, s->fd, events, s->user_data);
+            stats_end(w->ml, STATS_IO, cb, start, 0);
         }
         else
             mrp_debug("skipping slave I/O watch %p (fd %d)", s, s->fd);
@@ -2104,12 +3875,24 @@ static void dispatch_poll_events(mrp_mainloop_t *ml)
 {
     struct epoll_event *e;
     mrp_io_watch_t     *w, *tblw;
-    int                 i, fd;
+    int                 first, i, fd;
+    void               *cb;
+    uint64_t            start;
+
+    for (i = first = ml->poll_next; i < ml->poll_result; i++) {
+        if (i > first && budget_exhausted(ml)) {
+            mrp_debug("dispatch budget exhausted, %d I/O events left",
+                      ml->poll_result - i);
+            ml->poll_next = i;
+            return;
+        }
 
-    for (i = 0, e = ml->events; i < ml->poll_result; i++, e++) {
+        e  = ml->events + i;
         fd = e->data.fd;
         w  = fdtbl_lookup(ml->fdtbl, fd);
 
+        ml->poll_next = i + 1;
+
         if (w == NULL) {
             mrp_debug("ignoring event for deleted fd %d", fd);
             continue;
@@ -2117,113 +3900,569 @@ static void dispatch_poll_events(mrp_mainloop_t *ml)
 
         if (!is_deleted(w)) {
             mrp_debug("dispatching I/O watch %p (fd %d)", w, fd);
+
+            cb    = w->cb;
+            start = stats_begin(ml);
             w->cb(w, w->fd, e->events, w->user_data);
+            stats_end(ml, STATS_IO, cb, start, 0);
         }
         else
             mrp_debug("skipping deleted I/O watch %p (fd %d)", w, fd);
 
-        if (!mrp_list_empty(&w->slave))
-            dispatch_slaves(w, e);
+        if (!mrp_list_empty(&w->slave))
+            dispatch_slaves(w, e);
+
+        if (e->events & EPOLLRDHUP) {
+            tblw = fdtbl_lookup(ml->fdtbl, w->fd);
+
+            if (tblw == w) {
+                mrp_debug("forcibly stop polling fd %d for watch %p", w->fd, w);
+                epoll_del(w);
+            }
+            else if (tblw != NULL)
+                mrp_debug("don't stop polling reused fd %d of watch %p",
+                          w->fd, w);
+        }
+        else {
+            if ((e->events & EPOLLHUP) && !is_deleted(w)) {
+                /*
+                 * Notes:
+                 *
+                 *    If the user does not react to EPOLLHUPs delivered
+                 *    we stop monitoring the fd to avoid sitting in an
+                 *    infinite busy loop just delivering more EPOLLHUP
+                 *    notifications...
+                 */
+
+                if (w->wrhup++ > 5) {
+                    tblw = fdtbl_lookup(ml->fdtbl, w->fd);
+
+                    if (tblw == w) {
+                        mrp_debug("forcibly stop polling fd %d for watch %p",
+                                  w->fd, w);
+                        epoll_del(w);
+                    }
+                    else if (tblw != NULL)
+                        mrp_debug("don't stop polling reused fd %d of watch %p",
+                                  w->fd, w);
+                }
+            }
+        }
+
+        if (ml->quit)
+            break;
+    }
+
+    if (ml->quit)
+        return;
+
+    ml->poll_next = ml->poll_result;
+
+    dispatch_subloops(ml);
+
+    mrp_debug("done dispatching poll events");
+}
+
+
+int mrp_mainloop_dispatch(mrp_mainloop_t *ml)
+{
+    int idle;
+
+    if (ml->dispatching++ == 0 && ml->budget_usecs > 0)
+        ml->dispatch_start = time_now();
+
+    idle = ml->poll_result == 0 && mrp_list_empty(&ml->deferred);
+
+    dispatch_wakeup(ml);
+
+    if (ml->quit)
+        goto quit;
+
+    dispatch_deferred(ml);
+
+    if (ml->quit)
+        goto quit;
+
+    dispatch_timers(ml);
+
+    if (ml->quit)
+        goto quit;
+
+    dispatch_poll_events(ml);
+
+    if (ml->quit)
+        goto quit;
+
+    dispatch_io_requests(ml);
+
+    if (ml->quit)
+        goto quit;
+
+    dispatch_idle(ml, idle);
+
+ quit:
+    purge_deleted(ml);
+
+    if (--ml->dispatching == 0)
+        mrp_arena_reset(ml->arena);
+
+    return !ml->quit;
+}
+
+
+int mrp_mainloop_iterate(mrp_mainloop_t *ml)
+{
+    return
+        mrp_mainloop_prepare(ml) &&
+        mrp_mainloop_poll(ml, TRUE) &&
+        mrp_mainloop_dispatch(ml) &&
+        !ml->quit;
+}
+
+
+int mrp_mainloop_run(mrp_mainloop_t *ml)
+{
+    while (mrp_mainloop_iterate(ml))
+        ;
+
+    return ml->exit_code;
+}
+
+
+void mrp_mainloop_quit(mrp_mainloop_t *ml, int exit_code)
+{
+    ml->exit_code = exit_code;
+    ml->quit      = TRUE;
+}
+
+
+void mrp_mainloop_set_budget(mrp_mainloop_t *ml, int max_events,
+                             int max_usecs)
+{
+    ml->budget_events = max_events > 0 ? max_events : 0;
+    ml->budget_usecs  = max_usecs  > 0 ? max_usecs  : 0;
+}
+
+
+void mrp_mainloop_set_idle_slice(mrp_mainloop_t *ml, int usecs)
+{
+    ml->idle_usecs = usecs > 0 ? usecs : 0;
+}
+
+
+int mrp_mainloop_set_virtual_clock(mrp_mainloop_t *ml, int enable)
+{
+    timer_heap_t *h = &ml->timers;
+    uint64_t      now;
+    int           i;
+
+    if (ml->super_ops != NULL)
+        return FALSE;
+
+    if (enable) {
+        if (!ml->vclock)
+            ml->vclock = time_now();
+    }
+    else if (ml->vclock) {
+        /* shifting every timer by the same amount keeps the heap valid */
+        now = time_now();
+
+        for (i = 0; i < h->n; i++)
+            h->t[i]->expire = h->t[i]->expire - ml->vclock + now;
+
+        ml->vclock    = 0;
+        ml->vdeadline = 0;
+    }
+
+    return TRUE;
+}
+
+
+uint64_t mrp_mainloop_time(mrp_mainloop_t *ml)
+{
+    return ml_now(ml);
+}
+
+
+mrp_arena_t *mrp_mainloop_arena(mrp_mainloop_t *ml)
+{
+    if (ml->arena == NULL)
+        ml->arena = mrp_arena_create(0);
+
+    return ml->arena;
+}
+
+
+/*
+ * dispatch statistics
+ */
+
+static inline int stats_bucket(uint64_t v)
+{
+    int e;
+
+    if (v < STATS_EXACT)
+        return (int)v;
+
+    if (v >= (1ULL << 32))
+        return STATS_BUCKETS - 1;
+
+    e = 63 - __builtin_clzll(v);
+
+    return STATS_EXACT + ((e - 4) << STATS_SUBBITS) +
+        (int)((v >> (e - STATS_SUBBITS)) & ((1 << STATS_SUBBITS) - 1));
+}
+
+
+static inline uint64_t stats_bucket_min(int idx)
+{
+    int e, sub;
+
+    if (idx < STATS_EXACT)
+        return idx;
+
+    e   = ((idx - STATS_EXACT) >> STATS_SUBBITS) + 4;
+    sub = (idx - STATS_EXACT) & ((1 << STATS_SUBBITS) - 1);
+
+    return (uint64_t)((1 << STATS_SUBBITS) + sub) << (e - STATS_SUBBITS);
+}
+
+
+static void stats_add(stats_hist_t *h, uint64_t v)
+{
+    h->count++;
+    h->total += v;
+    h->buckets[stats_bucket(v)]++;
+
+    if (v > h->max)
+        h->max = v;
+}
+
+
+static uint64_t stats_percentile(stats_hist_t *h, int percent)
+{
+    uint64_t limit, sum;
+    int      i;
+
+    if (h->count == 0)
+        return 0;
+
+    limit = (h->count * percent + 99) / 100;
+    sum   = 0;
+
+    for (i = 0; i < STATS_BUCKETS; i++) {
+        sum += h->buckets[i];
+
+        if (sum >= limit)
+            break;
+    }
+
+    if (i >= STATS_BUCKETS - 1)
+        return h->max;
+
+    /* report the upper end of the bucket, but never above the maximum */
+    return MRP_MIN(stats_bucket_min(i + 1) - 1, h->max);
+}
+
+
+static inline uint32_t stats_hash(stats_type_t type, void *cb)
+{
+    uint64_t key = (uint64_t)(ptrdiff_t)cb ^ type;
+
+    return (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+
+static stats_site_t *stats_lookup(loop_stats_t *stats, stats_type_t type,
+                                  void *cb)
+{
+    stats_site_t **sites, *site;
+    uint32_t       i, mask;
+    int            size, j;
+
+    mask = stats->size - 1;
+
+    for (i = stats_hash(type, cb) & mask; (site = stats->sites[i]); ) {
+        if (site->cb == cb && site->type == type)
+            return site;
+        i = (i + 1) & mask;
+    }
+
+    if ((site = mrp_allocz(sizeof(*site))) == NULL)
+        return NULL;
+
+    site->type = type;
+    site->cb   = cb;
+
+    stats->sites[i] = site;
+    stats->nsite++;
+
+    /* keep the table at most half full */
+    if (stats->nsite * 2 > stats->size) {
+        size  = stats->size * 2;
+        sites = mrp_allocz_array(stats_site_t *, size);
+
+        if (sites != NULL) {
+            mask = size - 1;
+
+            for (j = 0; j < stats->size; j++) {
+                if (stats->sites[j] == NULL)
+                    continue;
+
+                i = stats_hash(stats->sites[j]->type,
+                               stats->sites[j]->cb) & mask;
+                while (sites[i] != NULL)
+                    i = (i + 1) & mask;
+
+                sites[i] = stats->sites[j];
+            }
+
+            mrp_free(stats->sites);
+            stats->sites = sites;
+            stats->size  = size;
+        }
+    }
+
+    return site;
+}
+
+
+static void stats_record(loop_stats_t *stats, stats_type_t type, void *cb,
+                         uint64_t start, uint64_t expire)
+{
+    stats_site_t *site;
+    uint64_t      end;
+
+    end = time_now();
 
-        if (e->events & EPOLLRDHUP) {
-            tblw = fdtbl_lookup(ml->fdtbl, w->fd);
+    if ((site = stats_lookup(stats, type, cb)) == NULL)
+        return;
 
-            if (tblw == w) {
-                mrp_debug("forcibly stop polling fd %d for watch %p", w->fd, w);
-                epoll_del(w);
-            }
-            else if (tblw != NULL)
-                mrp_debug("don't stop polling reused fd %d of watch %p",
-                          w->fd, w);
-        }
-        else {
-            if ((e->events & EPOLLHUP) && !is_deleted(w)) {
-                /*
-                 * Notes:
-                 *
-                 *    If the user does not react to EPOLLHUPs delivered
-                 *    we stop monitoring the fd to avoid sitting in an
-                 *    infinite busy loop just delivering more EPOLLHUP
-                 *    notifications...
-                 */
+    stats_add(&site->latency, end - start);
 
-                if (w->wrhup++ > 5) {
-                    tblw = fdtbl_lookup(ml->fdtbl, w->fd);
+    if (type == STATS_TIMER)
+        stats_add(&site->lateness, start > expire ? start - expire : 0);
+}
 
-                    if (tblw == w) {
-                        mrp_debug("forcibly stop polling fd %d for watch %p",
-                                  w->fd, w);
-                        epoll_del(w);
-                    }
-                    else if (tblw != NULL)
-                        mrp_debug("don't stop polling reused fd %d of watch %p",
-                                  w->fd, w);
-                }
-            }
-        }
 
-        if (ml->quit)
-            break;
-    }
+static void stats_free(loop_stats_t *stats)
+{
+    int i;
 
-    if (ml->quit)
+    if (stats == NULL)
         return;
 
-    dispatch_subloops(ml);
+    for (i = 0; i < stats->size; i++)
+        mrp_free(stats->sites[i]);
 
-    mrp_debug("done dispatching poll events");
+    mrp_free(stats->sites);
+    mrp_free(stats);
 }
 
 
-int mrp_mainloop_dispatch(mrp_mainloop_t *ml)
+int mrp_mainloop_enable_stats(mrp_mainloop_t *ml, int enable)
 {
-    dispatch_wakeup(ml);
+    loop_stats_t *stats;
 
-    if (ml->quit)
-        goto quit;
+    if (!enable) {
+        stats_free(ml->stats);
+        ml->stats = NULL;
 
-    dispatch_deferred(ml);
+        return TRUE;
+    }
 
-    if (ml->quit)
-        goto quit;
+    if (ml->stats != NULL)
+        return TRUE;
 
-    dispatch_timers(ml);
+    if ((stats = mrp_allocz(sizeof(*stats))) == NULL)
+        return FALSE;
 
-    if (ml->quit)
-        goto quit;
+    stats->size    = STATS_SITES;
+    stats->sites   = mrp_allocz_array(stats_site_t *, stats->size);
+    stats->started = time_now();
 
-    dispatch_poll_events(ml);
+    if (stats->sites == NULL) {
+        mrp_free(stats);
+        return FALSE;
+    }
 
- quit:
-    purge_deleted(ml);
+    ml->stats = stats;
 
-    return !ml->quit;
+    return TRUE;
 }
 
 
-int mrp_mainloop_iterate(mrp_mainloop_t *ml)
+int mrp_mainloop_stats_enabled(mrp_mainloop_t *ml)
 {
-    return
-        mrp_mainloop_prepare(ml) &&
-        mrp_mainloop_poll(ml, TRUE) &&
-        mrp_mainloop_dispatch(ml) &&
-        !ml->quit;
+    return ml->stats != NULL;
 }
 
 
-int mrp_mainloop_run(mrp_mainloop_t *ml)
+void mrp_mainloop_reset_stats(mrp_mainloop_t *ml)
 {
-    while (mrp_mainloop_iterate(ml))
-        ;
+    if (ml->stats != NULL) {
+        mrp_mainloop_enable_stats(ml, FALSE);
+        mrp_mainloop_enable_stats(ml, TRUE);
+    }
+}
 
-    return ml->exit_code;
+
+static int stats_cmp(const void *p1, const void *p2)
+{
+    const stats_site_t *s1 = *(const stats_site_t **)p1;
+    const stats_site_t *s2 = *(const stats_site_t **)p2;
+
+    if (s1->latency.total != s2->latency.total)
+        return s1->latency.total < s2->latency.total ? 1 : -1;
+    else
+        return 0;
 }
 
 
-void mrp_mainloop_quit(mrp_mainloop_t *ml, int exit_code)
+static void stats_symbol(void *cb, const char **sym, const char **module)
 {
-    ml->exit_code = exit_code;
-    ml->quit      = TRUE;
+    Dl_info     info;
+    const char *base;
+
+    if (dladdr(cb, &info) == 0) {
+        *sym    = NULL;
+        *module = NULL;
+        return;
+    }
+
+    *sym    = info.dli_sname;
+    *module = info.dli_fname;
+
+    if (*module != NULL && (base = strrchr(*module, '/')) != NULL)
+        *module = base + 1;
+}
+
+
+static void stats_dump_hist(FILE *fp, stats_hist_t *h)
+{
+    const char *sep = "";
+    int         i;
+
+    fprintf(fp, "{\"count\":%llu,\"total\":%llu,\"max\":%llu,"
+            "\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"histogram\":[",
+            (unsigned long long)h->count, (unsigned long long)h->total,
+            (unsigned long long)h->max,
+            (unsigned long long)stats_percentile(h, 50),
+            (unsigned long long)stats_percentile(h, 90),
+            (unsigned long long)stats_percentile(h, 99));
+
+    for (i = 0; i < STATS_BUCKETS; i++) {
+        if (h->buckets[i] == 0)
+            continue;
+
+        fprintf(fp, "%s[%llu,%u]", sep,
+                (unsigned long long)stats_bucket_min(i), h->buckets[i]);
+        sep = ",";
+    }
+
+    fprintf(fp, "]}");
+}
+
+
+int mrp_mainloop_dump_stats(mrp_mainloop_t *ml, FILE *fp, int json)
+{
+    static const char *types[] = {
+        [STATS_IO]       = "io",
+        [STATS_TIMER]    = "timer",
+        [STATS_DEFERRED] = "deferred",
+        [STATS_SUBLOOP]  = "subloop",
+        [STATS_EVENT]    = "event",
+    };
+    loop_stats_t  *stats = ml->stats;
+    stats_site_t **sites, *s;
+    const char    *sym, *module;
+    uint64_t       elapsed;
+    int            i, n;
+
+    if (stats == NULL) {
+        if (json)
+            fprintf(fp, "{\"enabled\":false}\n");
+        else
+            fprintf(fp, "Mainloop statistics are disabled.\n");
+
+        return TRUE;
+    }
+
+    if ((sites = mrp_allocz_array(stats_site_t *, stats->nsite + 1)) == NULL)
+        return FALSE;
+
+    for (i = n = 0; i < stats->size; i++)
+        if (stats->sites[i] != NULL)
+            sites[n++] = stats->sites[i];
+
+    qsort(sites, n, sizeof(sites[0]), stats_cmp);
+
+    elapsed = time_now() - stats->started;
+
+    if (json)
+        fprintf(fp, "{\"enabled\":true,\"elapsed\":%llu,\"sites\":[",
+                (unsigned long long)elapsed);
+    else {
+        fprintf(fp, "Mainloop statistics of %.3f seconds "
+                "(times in usecs):\n", elapsed / 1000000.0);
+        fprintf(fp, "%-8s %10s %12s %8s %8s %8s %8s  %s\n", "type", "count",
+                "total", "p50", "p90", "p99", "max", "callback");
+    }
+
+    for (i = 0; i < n; i++) {
+        s = sites[i];
+        stats_symbol(s->cb, &sym, &module);
+
+        if (json) {
+            fprintf(fp, "%s\n{\"type\":\"%s\",\"callback\":\"%p\"",
+                    i ? "," : "", types[s->type], s->cb);
+            if (sym != NULL)
+                fprintf(fp, ",\"symbol\":\"%s\"", sym);
+            if (module != NULL)
+                fprintf(fp, ",\"module\":\"%s\"", module);
+            fprintf(fp, ",\"latency\":");
+            stats_dump_hist(fp, &s->latency);
+            if (s->type == STATS_TIMER) {
+                fprintf(fp, ",\"lateness\":");
+                stats_dump_hist(fp, &s->lateness);
+            }
+            fprintf(fp, "}");
+        }
+        else {
+            fprintf(fp, "%-8s %10llu %12llu %8llu %8llu %8llu %8llu  ",
+                    types[s->type],
+                    (unsigned long long)s->latency.count,
+                    (unsigned long long)s->latency.total,
+                    (unsigned long long)stats_percentile(&s->latency, 50),
+                    (unsigned long long)stats_percentile(&s->latency, 90),
+                    (unsigned long long)stats_percentile(&s->latency, 99),
+                    (unsigned long long)s->latency.max);
+
+            if (sym != NULL)
+                fprintf(fp, "%s", sym);
+            else
+                fprintf(fp, "%p", s->cb);
+            if (module != NULL)
+                fprintf(fp, " (%s)", module);
+            fprintf(fp, "\n");
+
+            if (s->type == STATS_TIMER)
+                fprintf(fp, "%-8s %10s %12llu %8llu %8llu %8llu %8llu  "
+                        "(lateness)\n", "", "",
+                        (unsigned long long)s->lateness.total,
+                        (unsigned long long)stats_percentile(&s->lateness,50),
+                        (unsigned long long)stats_percentile(&s->lateness,90),
+                        (unsigned long long)stats_percentile(&s->lateness,99),
+                        (unsigned long long)s->lateness.max);
+        }
+    }
+
+    if (json)
+        fprintf(fp, "\n]}\n");
+
+    mrp_free(sites);
+
+    return TRUE;
 }
 
 
@@ -2375,12 +4614,71 @@ char *mrp_event_dump_mask(mrp_event_mask_t *mask, char *buf, size_t size)
 }
 
 
-mrp_event_watch_t *mrp_event_add_watch(mrp_event_bus_t *bus, uint32_t id,
-                                       mrp_event_watch_cb_t cb, void *user_data)
+static void unsubscribe(mrp_event_bus_t *bus, mrp_event_watch_t *w)
+{
+    event_subs_t *s;
+    int           id, i;
+
+    MRP_MASK_FOREACH_SET(&w->mask, id, 0) {
+        if (id >= bus->nsub)
+            break;
+
+        s = bus->subs + id;
+
+        for (i = 0; i < s->nwatch; i++) {
+            if (s->watches[i] == w) {
+                memmove(s->watches + i, s->watches + i + 1,
+                        (s->nwatch - i - 1) * sizeof(s->watches[0]));
+                s->nwatch--;
+                break;
+            }
+        }
+
+        if (s->nwatch == 0) {
+            mrp_free(s->watches);
+            s->watches = NULL;
+        }
+    }
+}
+
+
+static int subscribe(mrp_event_bus_t *bus, mrp_event_watch_t *w)
+{
+    event_subs_t *s;
+    int           id;
+
+    MRP_MASK_FOREACH_SET(&w->mask, id, 0) {
+        if (id >= bus->nsub) {
+            if (!mrp_reallocz(bus->subs, bus->nsub, id + 1))
+                goto fail;
+            bus->nsub = id + 1;
+        }
+
+        s = bus->subs + id;
+
+        if (!mrp_reallocz(s->watches, s->nwatch, s->nwatch + 1))
+            goto fail;
+
+        s->watches[s->nwatch++] = w;
+    }
+
+    return TRUE;
+
+ fail:
+    unsubscribe(bus, w);
+    return FALSE;
+}
+
+
+static mrp_event_watch_t *add_watch(mrp_event_bus_t *bus,
+                                    mrp_event_mask_t *mask, uint32_t id,
+                                    mrp_event_watch_cb_t cb, void *user_data)
 {
-    mrp_list_hook_t   *watches = bus ? &bus->watches : &ewatches;
     mrp_event_watch_t *w;
 
+    if (bus == NULL)
+        bus = &gbus;
+
     w = mrp_allocz(sizeof(*w));
 
     if (w == NULL)
@@ -2392,15 +4690,46 @@ mrp_event_watch_t *mrp_event_add_watch(mrp_event_bus_t *bus, uint32_t id,
     w->cb        = cb;
     w->user_data = user_data;
 
-    if (!mrp_mask_set(&w->mask, id)) {
-        mrp_free(w);
-        return NULL;
-    }
+    if (mask != NULL ? !mrp_mask_copy(&w->mask, mask) :
+        !mrp_mask_set(&w->mask, id))
+        goto fail;
+
+    if (!subscribe(bus, w))
+        goto fail;
+
+    mrp_list_append(&bus->watches, &w->hook);
+
+    return w;
+
+ fail:
+    mrp_mask_reset(&w->mask);
+    mrp_free(w);
+
+    return NULL;
+}
+
+
+static void free_watch(mrp_event_watch_t *w)
+{
+    unsubscribe(w->bus, w);
+    mrp_list_delete(&w->hook);
+    mrp_mask_reset(&w->mask);
+    mrp_free(w);
+}
+
+
+mrp_event_watch_t *mrp_event_add_watch(mrp_event_bus_t *bus, uint32_t id,
+                                       mrp_event_watch_cb_t cb, void *user_data)
+{
+    mrp_event_watch_t *w;
 
-    mrp_list_append(watches, &w->hook);
+    w = add_watch(bus, NULL, id, cb, user_data);
+
+    if (w == NULL)
+        return NULL;
 
     mrp_debug("added event watch %p for event %d (%s) on bus %s", w, id,
-              mrp_event_name(id), bus ? bus->name : MRP_GLOBAL_BUS_NAME);
+              mrp_event_name(id), w->bus->name);
 
     return w;
 }
@@ -2411,31 +4740,17 @@ mrp_event_watch_t *mrp_event_add_watch_mask(mrp_event_bus_t *bus,
                                             mrp_event_watch_cb_t cb,
                                             void *user_data)
 {
-    mrp_list_hook_t   *watches = bus ? &bus->watches : &ewatches;
     mrp_event_watch_t *w;
     char               events[512];
 
-    w = mrp_allocz(sizeof(*w));
+    w = add_watch(bus, mask, 0, cb, user_data);
 
     if (w == NULL)
         return NULL;
 
-    mrp_list_init(&w->hook);
-    mrp_mask_init(&w->mask);
-    w->bus       = bus;
-    w->cb        = cb;
-    w->user_data = user_data;
-
-    if (!mrp_mask_copy(&w->mask, mask)) {
-        mrp_free(w);
-        return NULL;
-    }
-
-    mrp_list_append(watches, &w->hook);
-
     mrp_debug("added event watch %p for events <%s> on bus %s", w,
               mrp_event_dump_mask(&w->mask, events, sizeof(events)),
-              bus ? bus->name : MRP_GLOBAL_BUS_NAME);
+              w->bus->name);
 
     return w;
 }
@@ -2446,15 +4761,15 @@ void mrp_event_del_watch(mrp_event_watch_t *w)
     if (w == NULL)
         return;
 
-    if (w->bus != NULL && w->bus->busy) {
-        w->dead = TRUE;
-        w->bus->dead++;
+    if (w->bus->busy) {
+        if (!w->dead) {
+            w->dead = TRUE;
+            w->bus->dead++;
+        }
         return;
     }
 
-    mrp_list_delete(&w->hook);
-    mrp_mask_reset(&w->mask);
-    mrp_free(w);
+    free_watch(w);
 }
 
 
@@ -2469,24 +4784,70 @@ void bus_purge_dead(mrp_event_bus_t *bus)
     mrp_list_foreach(&bus->watches, p, n) {
         w = mrp_list_entry(p, typeof(*w), hook);
 
-        if (!w->dead)
-            continue;
-
-        mrp_list_delete(&w->hook);
-        mrp_mask_reset(&w->mask);
-        mrp_free(w);
+        if (w->dead)
+            free_watch(w);
     }
 
     bus->dead = 0;
 }
 
 
+static pending_event_t *alloc_event(mrp_mainloop_t *ml)
+{
+    pending_event_t *e;
+
+    if (mrp_list_empty(&ml->eventpool))
+        return mrp_allocz(sizeof(*e));
+
+    e = mrp_list_entry(ml->eventpool.next, typeof(*e), hook);
+    mrp_list_delete(&e->hook);
+    ml->npooled--;
+
+    return e;
+}
+
+
+static void free_event(mrp_mainloop_t *ml, pending_event_t *e)
+{
+    if (ml->npooled < EVENT_POOL_MAX) {
+        mrp_list_append(&ml->eventpool, &e->hook);
+        ml->npooled++;
+    }
+    else
+        mrp_free(e);
+}
+
+
+static void purge_events(mrp_mainloop_t *ml)
+{
+    mrp_list_hook_t *p, *n;
+    pending_event_t *e;
+
+    mrp_list_foreach(&ml->eventq, p, n) {
+        e = mrp_list_entry(p, typeof(*e), hook);
+
+        mrp_list_delete(&e->hook);
+        unref_event_data(e->data, e->format);
+        mrp_free(e);
+    }
+
+    mrp_list_foreach(&ml->eventpool, p, n) {
+        e = mrp_list_entry(p, typeof(*e), hook);
+
+        mrp_list_delete(&e->hook);
+        mrp_free(e);
+    }
+
+    ml->npooled = 0;
+}
+
+
 static int queue_event(mrp_event_bus_t *bus, uint32_t id, void *data,
                        mrp_event_flag_t flags)
 {
     pending_event_t *e;
 
-    e = mrp_allocz(sizeof(*e));
+    e = alloc_event(bus->ml);
 
     if (e == NULL)
         return -1;
@@ -2507,42 +4868,50 @@ static int queue_event(mrp_event_bus_t *bus, uint32_t id, void *data,
 static int emit_event(mrp_event_bus_t *bus, uint32_t id, void *data,
                       mrp_event_flag_t flags)
 {
-    mrp_list_hook_t   *watches;
     mrp_event_watch_t *w;
-    mrp_list_hook_t   *p, *n;
+    void              *cb;
+    uint64_t           start;
+    int                i;
 
-    if (bus)
-        watches = &bus->watches;
-    else {
+    if (bus == NULL) {
         if (!(flags & MRP_EVENT_SYNCHRONOUS)) {
             errno = EINVAL;
             return -1;
         }
-        watches = &ewatches;
+        bus = &gbus;
     }
 
-    if (bus)
-        bus->busy++;
+    bus->busy++;
 
     mrp_debug("emitting event 0x%x (%s) on bus <%s>", id, mrp_event_name(id),
-              bus ? bus->name : MRP_GLOBAL_BUS_NAME);
+              bus->name);
 
-    mrp_list_foreach(watches, p, n) {
-        w = mrp_list_entry(p, typeof(*w), hook);
+    /*
+     * Notice that we don't cache the subscriber array, as a callback can
+     * add new watches and thus reallocate it. Deleted watches are only
+     * marked dead while the bus is busy, so indices stay valid.
+     */
+
+    for (i = 0; (int)id < bus->nsub && i < bus->subs[id].nwatch; i++) {
+        w = bus->subs[id].watches[i];
 
         if (w->dead)
             continue;
 
-        if (mrp_mask_test(&w->mask, id))
+        if (bus->ml == NULL)
+            w->cb(w, id, flags & MRP_EVENT_FORMAT_MASK, data, w->user_data);
+        else {
+            cb    = w->cb;
+            start = stats_begin(bus->ml);
             w->cb(w, id, flags & MRP_EVENT_FORMAT_MASK, data, w->user_data);
+            stats_end(bus->ml, STATS_EVENT, cb, start, 0);
+        }
     }
 
-    if (bus) {
-        bus->busy--;
+    bus->busy--;
 
-        if (!bus->busy)
-            bus_purge_dead(bus);
-    }
+    if (!bus->busy)
+        bus_purge_dead(bus);
 
     return 0;
 }
@@ -2563,7 +4932,7 @@ static void pump_events(mrp_deferred_t *d, void *user_data)
         mrp_list_delete(&e->hook);
         unref_event_data(e->data, e->format);
 
-        mrp_free(e);
+        free_event(ml, e);
     }
 
     if (!mrp_list_empty(&ml->eventq))
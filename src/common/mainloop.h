@@ -30,12 +30,16 @@
 #ifndef __MURPHY_MAINLOOP_H__
 #define __MURPHY_MAINLOOP_H__
 
+#include <stdio.h>
 #include <signal.h>
 #include <stdint.h>
 #include <sys/poll.h>
 #include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/types.h>
 
 #include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
 
 MRP_CDECL_BEGIN
 
@@ -75,6 +79,9 @@ mrp_io_watch_t *mrp_add_io_watch(mrp_mainloop_t *ml, int fd,
 /** Unregister an I/O watch. */
 void mrp_del_io_watch(mrp_io_watch_t *watch);
 
+/** Change the events an I/O watch is interested in, keeping the watch. */
+int mrp_mod_io_watch(mrp_io_watch_t *watch, mrp_io_event_t events);
+
 /** Get the mainloop of an I/O watch. */
 mrp_mainloop_t *mrp_get_io_watch_mainloop(mrp_io_watch_t *watch);
 
@@ -84,6 +91,51 @@ int mrp_set_io_event_mode(mrp_mainloop_t *ml, mrp_io_event_t mode);
 /** Get the default event trigger mode of the given mainloop. */
 mrp_io_event_t mrp_get_io_event_mode(mrp_mainloop_t *ml);
 
+/*
+ * asynchronous I/O requests
+ *
+ * With the io_uring backend, reads and writes can be submitted to the
+ * kernel asynchronously instead of being done once an I/O watch reports
+ * the fd ready. Requests are submitted in a batch with the next poll and
+ * their completion callbacks are invoked from the mainloop. The I/O vector
+ * is copied, but the buffers it points to must stay intact until either
+ * the completion callback has been invoked or the request is cancelled.
+ */
+
+typedef struct mrp_io_req_s mrp_io_req_t;
+
+/** Maximum number of I/O vector entries (and adopted buffers) per request. */
+#define MRP_IO_REQ_MAXIOV 4
+
+/** I/O request completion callback, result is the bytes read/written or -errno. */
+typedef void (*mrp_io_req_cb_t)(mrp_io_req_t *req, ssize_t result,
+                                void *user_data);
+
+/** Check if the mainloop supports asynchronous I/O requests. */
+int mrp_io_req_supported(mrp_mainloop_t *ml);
+
+/** Submit an asynchronous write of the given I/O vector to fd. */
+mrp_io_req_t *mrp_io_submit_writev(mrp_mainloop_t *ml, int fd,
+                                   const struct iovec *iov, int iovcnt,
+                                   mrp_io_req_cb_t cb, void *user_data);
+
+/** Submit an asynchronous read from fd to the given I/O vector. */
+mrp_io_req_t *mrp_io_submit_readv(mrp_mainloop_t *ml, int fd,
+                                  const struct iovec *iov, int iovcnt,
+                                  mrp_io_req_cb_t cb, void *user_data);
+
+/**
+ * Pass ownership of buf to req, to be freed once req is over. Returns
+ * FALSE, leaving buf with the caller, if the release list can't grow.
+ */
+int mrp_io_req_adopt(mrp_io_req_t *req, void *buf);
+
+/**
+ * Cancel req without notification, freeing buf once the kernel is done.
+ * Never fails; must be called at most once for any request.
+ */
+void mrp_io_req_cancel(mrp_io_req_t *req, void *buf);
+
 /*
  * timers
  */
@@ -100,6 +152,25 @@ mrp_timer_t *mrp_add_timer(mrp_mainloop_t *ml, unsigned int msecs,
 #define MRP_TIMER_RESTART (unsigned int)-1
 void mrp_mod_timer(mrp_timer_t *t, unsigned int msecs);
 
+/**
+ * Add a new timer with a microsecond interval. The timer may be dispatched
+ * up to slack microseconds late, which allows timers expiring close to each
+ * other to be dispatched with a single wakeup. Microsecond timers are kept
+ * precise with a timerfd instead of relying on millisecond poll timeouts.
+ */
+mrp_timer_t *mrp_add_timer_usecs(mrp_mainloop_t *ml, uint64_t usecs,
+                                 uint64_t slack, mrp_timer_cb_t cb,
+                                 void *user_data);
+/** Modify the timeout (in microseconds) or rearm the given timer. */
+#define MRP_TIMER_RESTART_USECS (uint64_t)-1
+void mrp_mod_timer_usecs(mrp_timer_t *t, uint64_t usecs);
+
+/** Change the slack of the given timer. */
+void mrp_set_timer_slack(mrp_timer_t *t, uint64_t slack);
+
+/** Stop a timer without deleting it. mrp_mod_timer* restarts it. */
+void mrp_stop_timer(mrp_timer_t *t);
+
 /** Delete a timer. */
 void mrp_del_timer(mrp_timer_t *t);
 
@@ -131,6 +202,17 @@ void mrp_enable_deferred(mrp_deferred_t *d);
 /** Get the mainloop of a deferred callback. */
 mrp_mainloop_t *mrp_get_deferred_mainloop(mrp_deferred_t *d);
 
+/**
+ * Add an idle deferred callback. Idle callbacks are meant for background
+ * maintenance. They are run only in iterations with no I/O, no expired
+ * timers and no pending ordinary deferred callbacks, unless an idle slice
+ * has been set with mrp_mainloop_set_idle_slice. Otherwise they behave
+ * like ordinary deferred callbacks and are removed, disabled and enabled
+ * with the same functions.
+ */
+mrp_deferred_t *mrp_add_idle_deferred(mrp_mainloop_t *ml, mrp_deferred_cb_t cb,
+                                      void *user_data);
+
 
 /*
  * signals
@@ -283,9 +365,18 @@ int mrp_mainloop_unregister(mrp_mainloop_t *ml);
  * mainloop
  */
 
+/**
+ * Environment variable to select the polling backend of new mainloops.
+ * Set it to "io_uring" to poll with an io_uring instead of epoll.
+ */
+#define MRP_MAINLOOP_BACKEND_ENVVAR "__MURPHY_MAINLOOP_BACKEND"
+
 /** Create a new mainloop. */
 mrp_mainloop_t *mrp_mainloop_create(void);
 
+/** Get the name of the polling backend ("epoll" or "io_uring") of ml. */
+const char *mrp_mainloop_backend(mrp_mainloop_t *ml);
+
 /** Destroy an existing mainloop, free all I/O watches, timers, etc. */
 void mrp_mainloop_destroy(mrp_mainloop_t *ml);
 
@@ -307,6 +398,64 @@ int mrp_mainloop_iterate(mrp_mainloop_t *ml);
 /** Quit the mainloop. */
 void mrp_mainloop_quit(mrp_mainloop_t *ml, int exit_code);
 
+/**
+ * Set the dispatch budget of the mainloop. At most max_events I/O events
+ * are polled and dispatched per iteration, and the dispatching of deferred
+ * callbacks and I/O events is cut short once max_usecs has elapsed. Events
+ * left undispatched are dispatched first during the next iteration. A
+ * budget of 0 means unlimited, which is the default.
+ */
+void mrp_mainloop_set_budget(mrp_mainloop_t *ml, int max_events,
+                             int max_usecs);
+
+/**
+ * Set the idle slice of the mainloop. With a non-zero slice, idle deferred
+ * callbacks also get to run in busy iterations, as long as the dispatch
+ * budget is not exhausted, and every iteration stops dispatching them once
+ * usecs has elapsed. The next iteration continues with the first callback
+ * not yet run. A slice of 0 means idle callbacks only run in idle
+ * iterations and then all of them run. This is the default.
+ */
+void mrp_mainloop_set_idle_slice(mrp_mainloop_t *ml, int usecs);
+
+/**
+ * Run the timers of the mainloop on a virtual clock. Instead of sleeping
+ * until the next timer expires, the mainloop checks for I/O without
+ * blocking and, if there is none, advances the clock straight to the
+ * deadline. This lets timer-driven tests cover long periods in little
+ * real time and with deterministic results. Disabling the virtual clock
+ * shifts pending timers back to real time. Returns FALSE if ml is pumped
+ * by a superloop, which does not support virtual time.
+ */
+int mrp_mainloop_set_virtual_clock(mrp_mainloop_t *ml, int enable);
+
+/** Get the current time of the mainloop clock, in microseconds. */
+uint64_t mrp_mainloop_time(mrp_mainloop_t *ml);
+
+/**
+ * Get the dispatch arena of the mainloop. The arena is reset at the end
+ * of every (outermost) dispatch cycle, so it can be used for transient
+ * objects which are released before returning to the mainloop.
+ */
+mrp_arena_t *mrp_mainloop_arena(mrp_mainloop_t *ml);
+
+/**
+ * Enable or disable collecting dispatch statistics for the mainloop. When
+ * enabled, invocation counts and latency histograms are collected for each
+ * I/O watch, timer, deferred, subloop and event bus callback function, and
+ * for timers also how late they were dispatched. Disabling discards them.
+ */
+int mrp_mainloop_enable_stats(mrp_mainloop_t *ml, int enable);
+
+/** Check whether dispatch statistics are collected for the mainloop. */
+int mrp_mainloop_stats_enabled(mrp_mainloop_t *ml);
+
+/** Discard the dispatch statistics collected so far. */
+void mrp_mainloop_reset_stats(mrp_mainloop_t *ml);
+
+/** Dump the dispatch statistics of the mainloop, as text or as JSON. */
+int mrp_mainloop_dump_stats(mrp_mainloop_t *ml, FILE *fp, int json);
+
 /*
  * event bus and and events
  */
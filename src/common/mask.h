@@ -31,6 +31,7 @@
 #define __MURPHY_MASK_H__
 
 #include <stdint.h>
+#include <string.h>
 
 #include <murphy/common/macros.h>
 #include <murphy/common/mm.h>
@@ -164,7 +165,7 @@ static inline mrp_mask_t *mrp_mask_set(mrp_mask_t *m, int bit)
 {
     int w, b;
 
-    if (!mrp_mask_ensure(m, bit))
+    if (!mrp_mask_ensure(m, bit + 1))
         return NULL;
 
     b = _BIT(bit);
@@ -230,12 +231,14 @@ static inline mrp_mask_t *mrp_mask_copy(mrp_mask_t *dst, mrp_mask_t *src)
     if (src->nbit == _BITS_PER_WORD)
         *dst = *src;
     else {
-        dst->bitp = (_mask_t *)mrp_alloc(dst->nbit * _BITS_PER_WORD);
+        dst->bitp = (_mask_t *)mrp_alloc(dst->nbit / 8);
 
-        if (dst->bitp == NULL)
+        if (dst->bitp == NULL) {
+            mrp_mask_init(dst);
             return NULL;
+        }
 
-        memcpy(dst->bitp, src->bitp, dst->nbit * _BITS_PER_WORD);
+        memcpy(dst->bitp, src->bitp, dst->nbit / 8);
     }
 
     return dst;
@@ -302,9 +305,9 @@ static inline mrp_mask_t *mrp_mask_xor(mrp_mask_t *dst, mrp_mask_t *src)
 
     if (src->nbit == _BITS_PER_WORD) {
         if (dst->nbit == _BITS_PER_WORD)
-            dst->bits |= src->bits;
+            dst->bits ^= src->bits;
         else
-            dst->bitp[0] |= src->bits;
+            dst->bitp[0] ^= src->bits;
 
 #if 0
         /*
@@ -339,6 +342,52 @@ static inline mrp_mask_t *mrp_mask_xor(mrp_mask_t *dst, mrp_mask_t *src)
 }
 
 
+/*
+ * Notice that the tests below are written as branchless loops over the
+ * words of the masks, which the compiler can vectorize for large masks.
+ */
+
+/** Check if the given masks have any bits in common ((m1 & m2) != 0). */
+static inline int mrp_mask_intersects(mrp_mask_t *m1, mrp_mask_t *m2)
+{
+    const _mask_t *w1, *w2;
+    _mask_t        acc;
+    int            i, n;
+
+    if (m1->nbit == _BITS_PER_WORD && m2->nbit == _BITS_PER_WORD)
+        return !!(m1->bits & m2->bits);
+
+    w1  = m1->nbit == _BITS_PER_WORD ? &m1->bits : m1->bitp;
+    w2  = m2->nbit == _BITS_PER_WORD ? &m2->bits : m2->bitp;
+    n   = MRP_MIN(m1->nbit, m2->nbit) / _BITS_PER_WORD;
+    acc = 0;
+
+    for (i = 0; i < n; i++)
+        acc |= w1[i] & w2[i];
+
+    return acc != 0;
+}
+
+
+/** Check if the given mask has no bits set. */
+static inline int mrp_mask_empty(mrp_mask_t *m)
+{
+    _mask_t acc;
+    int     i, n;
+
+    if (m->nbit == _BITS_PER_WORD)
+        return m->bits == 0;
+
+    n   = m->nbit / _BITS_PER_WORD;
+    acc = 0;
+
+    for (i = 0; i < n; i++)
+        acc |= m->bitp[i];
+
+    return acc == 0;
+}
+
+
 /** Negate all bits in mask (~mask). */
 static inline mrp_mask_t *mrp_mask_neg(mrp_mask_t *m)
 {
@@ -396,7 +445,7 @@ static inline int mrp_mask_next_set(mrp_mask_t *m, int bit)
     _mask_t wrd, clr;
     int     w, b, n;
 
-    while (bit < m->nbit - 1) {
+    while (bit < m->nbit) {
         w = _WORD(bit);
         b = _BIT(bit);
 
@@ -424,7 +473,7 @@ static inline int mrp_mask_next_clear(mrp_mask_t *m, int bit)
     _mask_t wrd, clr;
     int     w, b, n;
 
-    while (bit < m->nbit - 1) {
+    while (bit < m->nbit) {
         w = _WORD(bit);
         b = _BIT(bit);
 
@@ -0,0 +1,417 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
+#include <murphy/common/list.h>
+#include <murphy/common/log.h>
+#include <murphy/common/metrics.h>
+
+#define METRIC_SHARDS    16               /* number of update shards */
+#define METRIC_CACHELINE 64               /* assumed cacheline size */
+#define SLOTS_PER_LINE   (METRIC_CACHELINE / sizeof(int64_t))
+
+/*
+ * Counters and histograms are sharded: every thread is assigned one of
+ * the shards, and only updates the slots of that shard. Each shard is
+ * cacheline-aligned, so threads updating the same metric do not bounce
+ * cachelines between each other. Threads may share a shard if there are
+ * more of them than shards, hence updates are atomic (but relaxed) adds.
+ * Gauges can be set as well as updated, so they are kept in a single slot.
+ *
+ * The slots of a histogram shard are the per-bucket sample counts (the
+ * last bucket being +Inf) followed by the sum of the samples.
+ */
+
+struct mrp_metric_s {
+    mrp_list_hook_t    hook;              /* to list of metrics */
+    char              *name;              /* metric name */
+    char              *help;              /* metric description */
+    mrp_metric_type_t  type;              /* metric type */
+    int64_t           *bounds;            /* histogram bucket upper bounds */
+    int                nbound;            /* number of bounds */
+    mrp_metric_cb_t    cb;                /* value callback */
+    void              *user_data;         /* opaque callback data */
+    int                nshard;            /* number of shards */
+    int                stride;            /* slots per shard */
+    void              *mem;               /* allocated slots */
+    int64_t           *slots;             /* cacheline-aligned slots */
+};
+
+static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
+static MRP_LIST_HOOK(metrics);
+static __thread int     thread_shard = -1;
+static int              next_shard;
+
+
+static inline int64_t *shard_slots(mrp_metric_t *m)
+{
+    int s = thread_shard;
+
+    if (MRP_UNLIKELY(s < 0)) {
+        s = __atomic_fetch_add(&next_shard, 1, __ATOMIC_RELAXED);
+        s = thread_shard = s % METRIC_SHARDS;
+    }
+
+    return m->slots + (s % m->nshard) * m->stride;
+}
+
+
+static int valid_name(const char *name)
+{
+    const char *p;
+
+    if (name == NULL || !*name || isdigit(*name))
+        return FALSE;
+
+    for (p = name; *p; p++)
+        if (!isalnum(*p) && *p != '_' && *p != ':')
+            return FALSE;
+
+    return TRUE;
+}
+
+
+static mrp_metric_t *lookup_metric(const char *name)
+{
+    mrp_list_hook_t *p, *n;
+    mrp_metric_t    *m;
+
+    mrp_list_foreach(&metrics, p, n) {
+        m = mrp_list_entry(p, typeof(*m), hook);
+
+        if (!strcmp(m->name, name))
+            return m;
+    }
+
+    return NULL;
+}
+
+
+static void free_metric(mrp_metric_t *m)
+{
+    if (m != NULL) {
+        mrp_free(m->name);
+        mrp_free(m->help);
+        mrp_free(m->bounds);
+        mrp_free(m->mem);
+        mrp_free(m);
+    }
+}
+
+
+static mrp_metric_t *register_metric(const char *name, const char *help,
+                                     mrp_metric_type_t type,
+                                     const int64_t *bounds, int nbound,
+                                     mrp_metric_cb_t cb, void *user_data)
+{
+    mrp_metric_t *m;
+    size_t        size;
+    int           i;
+
+    if (!valid_name(name) || nbound < 0 || (nbound > 0 && bounds == NULL) ||
+        (type == MRP_METRIC_HISTOGRAM && cb != NULL)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    for (i = 1; i < nbound; i++) {
+        if (bounds[i - 1] >= bounds[i]) {
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    pthread_mutex_lock(&lock);
+
+    if ((m = lookup_metric(name)) != NULL) {
+        if (m->type != type || m->nbound != nbound || cb != NULL ||
+            m->cb != NULL ||
+            (nbound && memcmp(m->bounds, bounds, nbound * sizeof(*bounds)))) {
+            mrp_log_error("Conflicting registration of metric '%s'.", name);
+            m     = NULL;
+            errno = EEXIST;
+        }
+
+        pthread_mutex_unlock(&lock);
+
+        return m;
+    }
+
+    if ((m = mrp_allocz(sizeof(*m))) == NULL)
+        goto fail;
+
+    mrp_list_init(&m->hook);
+    m->name      = mrp_strdup(name);
+    m->help      = mrp_strdup(help ? help : "");
+    m->type      = type;
+    m->cb        = cb;
+    m->user_data = user_data;
+
+    if (m->name == NULL || m->help == NULL)
+        goto fail;
+
+    if (nbound > 0) {
+        if ((m->bounds = mrp_allocz_array(int64_t, nbound)) == NULL)
+            goto fail;
+
+        memcpy(m->bounds, bounds, nbound * sizeof(*bounds));
+        m->nbound = nbound;
+    }
+
+    if (cb == NULL) {
+        switch (type) {
+        case MRP_METRIC_COUNTER:
+            m->nshard = METRIC_SHARDS;
+            m->stride = SLOTS_PER_LINE;
+            break;
+        case MRP_METRIC_HISTOGRAM:
+            m->nshard = METRIC_SHARDS;
+            m->stride = (nbound + 2 + SLOTS_PER_LINE - 1) / SLOTS_PER_LINE;
+            m->stride *= SLOTS_PER_LINE;
+            break;
+        default:
+            m->nshard = 1;
+            m->stride = 1;
+            break;
+        }
+
+        size   = m->nshard * m->stride * sizeof(int64_t) + METRIC_CACHELINE;
+        m->mem = mrp_allocz(size);
+
+        if (m->mem == NULL)
+            goto fail;
+
+        m->slots = (int64_t *)MRP_ALIGN((ptrdiff_t)m->mem, METRIC_CACHELINE);
+    }
+
+    mrp_list_append(&metrics, &m->hook);
+
+    pthread_mutex_unlock(&lock);
+
+    return m;
+
+ fail:
+    pthread_mutex_unlock(&lock);
+    free_metric(m);
+    errno = ENOMEM;
+
+    return NULL;
+}
+
+
+mrp_metric_t *mrp_metric_counter(const char *name, const char *help)
+{
+    return register_metric(name, help, MRP_METRIC_COUNTER, NULL, 0,
+                           NULL, NULL);
+}
+
+
+mrp_metric_t *mrp_metric_gauge(const char *name, const char *help)
+{
+    return register_metric(name, help, MRP_METRIC_GAUGE, NULL, 0,
+                           NULL, NULL);
+}
+
+
+mrp_metric_t *mrp_metric_histogram(const char *name, const char *help,
+                                   const int64_t *bounds, int nbound)
+{
+    return register_metric(name, help, MRP_METRIC_HISTOGRAM, bounds, nbound,
+                           NULL, NULL);
+}
+
+
+mrp_metric_t *mrp_metric_callback(const char *name, const char *help,
+                                  mrp_metric_type_t type,
+                                  mrp_metric_cb_t cb, void *user_data)
+{
+    if (cb == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return register_metric(name, help, type, NULL, 0, cb, user_data);
+}
+
+
+void mrp_metric_unregister(mrp_metric_t *m)
+{
+    if (m == NULL)
+        return;
+
+    pthread_mutex_lock(&lock);
+    mrp_list_delete(&m->hook);
+    pthread_mutex_unlock(&lock);
+
+    free_metric(m);
+}
+
+
+void mrp_metric_add(mrp_metric_t *m, int64_t value)
+{
+    if (MRP_UNLIKELY(m == NULL || m->slots == NULL ||
+                     m->type == MRP_METRIC_HISTOGRAM))
+        return;
+
+    __atomic_fetch_add(shard_slots(m), value, __ATOMIC_RELAXED);
+}
+
+
+void mrp_metric_set(mrp_metric_t *m, int64_t value)
+{
+    if (MRP_UNLIKELY(m == NULL || m->slots == NULL ||
+                     m->type != MRP_METRIC_GAUGE))
+        return;
+
+    __atomic_store_n(m->slots, value, __ATOMIC_RELAXED);
+}
+
+
+void mrp_metric_observe(mrp_metric_t *m, int64_t value)
+{
+    int64_t *slots;
+    int      lo, hi, mid;
+
+    if (MRP_UNLIKELY(m == NULL || m->type != MRP_METRIC_HISTOGRAM))
+        return;
+
+    /* find the first bucket with value <= bound, with +Inf as the last */
+    lo = 0;
+    hi = m->nbound;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+
+        if (value <= m->bounds[mid])
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    slots = shard_slots(m);
+
+    __atomic_fetch_add(slots + lo, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(slots + m->nbound + 1, value, __ATOMIC_RELAXED);
+}
+
+
+static int64_t sum_slot(mrp_metric_t *m, int idx)
+{
+    int64_t sum;
+    int     i;
+
+    for (i = 0, sum = 0; i < m->nshard; i++)
+        sum += __atomic_load_n(m->slots + i * m->stride + idx,
+                               __ATOMIC_RELAXED);
+
+    return sum;
+}
+
+
+int64_t mrp_metric_value(mrp_metric_t *m)
+{
+    if (m == NULL || m->type == MRP_METRIC_HISTOGRAM)
+        return 0;
+
+    if (m->cb != NULL)
+        return m->cb(m->user_data);
+    else
+        return sum_slot(m, 0);
+}
+
+
+static void dump_help(FILE *fp, const char *help)
+{
+    const char *p;
+
+    for (p = help; *p; p++) {
+        switch (*p) {
+        case '\\': fputs("\\\\", fp); break;
+        case '\n': fputs("\\n", fp);  break;
+        default:   fputc(*p, fp);     break;
+        }
+    }
+}
+
+
+int mrp_metrics_dump(FILE *fp)
+{
+    static const char *types[] = {
+        [MRP_METRIC_COUNTER]   = "counter",
+        [MRP_METRIC_GAUGE]     = "gauge",
+        [MRP_METRIC_HISTOGRAM] = "histogram",
+    };
+    mrp_list_hook_t *p, *n;
+    mrp_metric_t    *m;
+    int64_t          cnt;
+    int              i;
+
+    pthread_mutex_lock(&lock);
+
+    mrp_list_foreach(&metrics, p, n) {
+        m = mrp_list_entry(p, typeof(*m), hook);
+
+        fprintf(fp, "# HELP %s ", m->name);
+        dump_help(fp, m->help);
+        fprintf(fp, "\n# TYPE %s %s\n", m->name, types[m->type]);
+
+        if (m->type != MRP_METRIC_HISTOGRAM) {
+            fprintf(fp, "%s %lld\n", m->name,
+                    (long long)mrp_metric_value(m));
+            continue;
+        }
+
+        for (i = 0, cnt = 0; i <= m->nbound; i++) {
+            cnt += sum_slot(m, i);
+
+            if (i < m->nbound)
+                fprintf(fp, "%s_bucket{le=\"%lld\"} %lld\n", m->name,
+                        (long long)m->bounds[i], (long long)cnt);
+            else
+                fprintf(fp, "%s_bucket{le=\"+Inf\"} %lld\n", m->name,
+                        (long long)cnt);
+        }
+
+        fprintf(fp, "%s_sum %lld\n", m->name,
+                (long long)sum_slot(m, m->nbound + 1));
+        fprintf(fp, "%s_count %lld\n", m->name, (long long)cnt);
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return ferror(fp) ? FALSE : TRUE;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MURPHY_METRICS_H__
+#define __MURPHY_METRICS_H__
+
+/** \file
+ * A lightweight registry of counters, gauges and histograms.
+ *
+ * Metrics are registered once, by name, and updated through the returned
+ * handle. Updates go to one of a few per-thread shards, so an update is a
+ * single (relaxed atomic) add without any locking or cacheline contention
+ * between threads. Shards are only summed up when the metrics are dumped,
+ * which produces the Prometheus text exposition format. Callback metrics
+ * get their value from a user callback at dump time, which is handy for
+ * exposing counters and queue depths maintained elsewhere. All update
+ * functions accept a NULL metric, so a failed registration does not need
+ * to be checked for at every update site.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <murphy/common/macros.h>
+
+MRP_CDECL_BEGIN
+
+/**
+ * Types of metrics.
+ */
+typedef enum {
+    MRP_METRIC_COUNTER = 0,              /**< monotonically increasing */
+    MRP_METRIC_GAUGE,                    /**< arbitrary current value */
+    MRP_METRIC_HISTOGRAM,                /**< distribution of samples */
+} mrp_metric_type_t;
+
+typedef struct mrp_metric_s mrp_metric_t;
+
+/** Callback to get the current value of a callback metric. */
+typedef int64_t (*mrp_metric_cb_t)(void *user_data);
+
+/** Register (or look up an already registered) counter. */
+mrp_metric_t *mrp_metric_counter(const char *name, const char *help);
+
+/** Register (or look up an already registered) gauge. */
+mrp_metric_t *mrp_metric_gauge(const char *name, const char *help);
+
+/** Register (or look up) a histogram with the given ascending bounds. */
+mrp_metric_t *mrp_metric_histogram(const char *name, const char *help,
+                                   const int64_t *bounds, int nbound);
+
+/** Register a counter or gauge the value of which is given by cb. */
+mrp_metric_t *mrp_metric_callback(const char *name, const char *help,
+                                  mrp_metric_type_t type,
+                                  mrp_metric_cb_t cb, void *user_data);
+
+/** Unregister and free the given metric. */
+void mrp_metric_unregister(mrp_metric_t *m);
+
+/** Add the given value to a counter or gauge. */
+void mrp_metric_add(mrp_metric_t *m, int64_t value);
+
+/** Increase a counter or gauge by one. */
+#define mrp_metric_inc(m) mrp_metric_add((m), 1)
+
+/** Decrease a gauge by one. */
+#define mrp_metric_dec(m) mrp_metric_add((m), -1)
+
+/** Set the value of a gauge. */
+void mrp_metric_set(mrp_metric_t *m, int64_t value);
+
+/** Add a sample to a histogram. */
+void mrp_metric_observe(mrp_metric_t *m, int64_t value);
+
+/** Get the current value of a counter or gauge. */
+int64_t mrp_metric_value(mrp_metric_t *m);
+
+/** Dump all registered metrics in the Prometheus text format. */
+int mrp_metrics_dump(FILE *fp);
+
+MRP_CDECL_END
+
+#endif /* __MURPHY_METRICS_H__ */
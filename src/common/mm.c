@@ -32,6 +32,8 @@
 #include <stdint.h>
 #include <errno.h>
 #include <unistd.h>
+#include <malloc.h>
+#include <pthread.h>
 #include <execinfo.h>
 
 #include <murphy/common/macros.h>
@@ -49,6 +51,7 @@
  */
 
 typedef struct {
+    pthread_mutex_t lock;                     /* protects debug blocks */
     mrp_list_hook_t blocks;                   /* list of allocated blocks */
     size_t          hdrsize;                  /* header size */
     int             depth;                    /* backtrace depth */
@@ -58,7 +61,7 @@ typedef struct {
     uint64_t        max_alloc;                /* max allocated memory */
     int             poison;                   /* poisoning pattern */
     size_t          chunk_size;               /* object pool chunk size */
-    mrp_mm_type_t   mode;                     /* passthru/debug mode */
+    mrp_mm_type_t   mode;                     /* passthru/debug/slab mode */
 
     void *(*alloc)(size_t size, const char *file, int line, const char *func);
     void *(*realloc)(void *ptr, size_t size, const char *file,
@@ -86,6 +89,7 @@ typedef struct {
 
 
 static mm_t __mm = {                          /* allocator state */
+    .lock    = PTHREAD_MUTEX_INITIALIZER,
     .hdrsize = MRP_ALIGN(MRP_OFFSET(memblk_t, bt[DEFAULT_DEPTH]),
                          MRP_MM_ALIGN),
     .depth   = DEFAULT_DEPTH,
@@ -235,10 +239,18 @@ static void __attribute__((constructor)) setup(void)
     __mm.poison     = get_config_uint32(config, "poison", 0xdeadbeef);
     __mm.chunk_size = sysconf(_SC_PAGESIZE) * 2;
 
-    if (config == NULL || !get_config_bool(config, "debug", FALSE))
-        mrp_mm_config(MRP_MM_PASSTHRU);
-    else
+    if (config != NULL && get_config_bool(config, "debug", FALSE))
         mrp_mm_config(MRP_MM_DEBUG);
+    else if (config != NULL && get_config_bool(config, "slab", FALSE))
+        mrp_mm_config(MRP_MM_SLAB);
+    else
+        mrp_mm_config(MRP_MM_PASSTHRU);
+
+    if (config != NULL && get_config_bool(config, "account", FALSE))
+        mrp_mm_account(TRUE);
+
+    if (config != NULL && get_config_uint32(config, "sample", 0) != 0)
+        mrp_mm_sample(get_config_uint32(config, "sample", 0));
 }
 
 
@@ -291,6 +303,8 @@ static memblk_t *memblk_alloc(size_t size, const char *file, int line,
         blk = NULL;
     else {
         if ((blk = malloc(__mm.hdrsize + size)) != NULL) {
+            pthread_mutex_lock(&__mm.lock);
+
             mrp_list_init(&blk->hook);
             mrp_list_init(&blk->more);
             mrp_list_append(&__mm.blocks, &blk->hook);
@@ -307,6 +321,8 @@ static memblk_t *memblk_alloc(size_t size, const char *file, int line,
 
             __mm.max_blocks = MRP_MAX(__mm.max_blocks, __mm.cur_blocks);
             __mm.max_alloc  = MRP_MAX(__mm.max_alloc , __mm.cur_alloc);
+
+            pthread_mutex_unlock(&__mm.lock);
         }
     }
 
@@ -323,11 +339,15 @@ static void memblk_free(memblk_t *blk, const char *file, int line,
     MRP_UNUSED(bt);
 
     if (blk != NULL) {
+        pthread_mutex_lock(&__mm.lock);
+
         mrp_list_delete(&blk->hook);
 
         __mm.cur_blocks--;
         __mm.cur_alloc -= blk->size;
 
+        pthread_mutex_unlock(&__mm.lock);
+
         if (__mm.poison != 0)
             memset(&blk->bt[__mm.depth], __mm.poison, blk->size);
 
@@ -342,9 +362,10 @@ static memblk_t *memblk_resize(memblk_t *blk, size_t size, const char *file,
     memblk_t *resized;
 
     if (blk != NULL) {
-        mrp_list_delete(&blk->hook);
-
         if (size != 0) {
+            pthread_mutex_lock(&__mm.lock);
+
+            mrp_list_delete(&blk->hook);
             resized = realloc(blk, __mm.hdrsize + size);
 
             if (resized != NULL) {
@@ -366,6 +387,8 @@ static memblk_t *memblk_resize(memblk_t *blk, size_t size, const char *file,
             }
             else
                 mrp_list_append(&__mm.blocks, &blk->hook);
+
+            pthread_mutex_unlock(&__mm.lock);
         }
         else {
             resized = NULL;
@@ -535,311 +558,2003 @@ static void __passthru_free(void *ptr, const char *file, int line,
 
 
 /*
- * common public interface - uses either passthru or debugging
+ * slab allocator
+ *
+ * Small allocations are served from a fixed set of size classes. Each
+ * class keeps a per-thread cache of free objects, which is refilled
+ * from and flushed back to a shared per-class depot in batches. The
+ * depot carves new objects out of SLAB_SIZE slabs as necessary. Slab
+ * memory is retained for reuse and is never given back to the system.
+ * Allocations larger than the largest class, and ones with an alignment
+ * stricter than MRP_MM_ALIGN, are handed over to the system allocator.
+ *
+ * Every object is preceded by a small header identifying its class,
+ * which lets us free and resize objects without any lookups.
  */
 
-void *mrp_mm_alloc(size_t size, const char *file, int line, const char *func)
-{
-    return __mm.alloc(size, file, line, func);
-}
+#define SLAB_SIZE     (64 * 1024)             /* slab size */
+#define SLAB_MAGIC    0x5ab1                  /* header magic */
+#define SLAB_LARGE    0xfffe                  /* system allocator */
+#define SLAB_ALIGNED  0xffff                  /* system, aligned */
+#define SLAB_HDRSIZE  sizeof(slabhdr_t)       /* object header size */
+#define SLAB_QUANTUM  16                      /* class lookup granularity */
+#define SLAB_BATCH    8192                    /* bytes per refill/flush */
 
+typedef struct {
+    uint32_t offs;                            /* offset to block start */
+    uint16_t magic;                           /* SLAB_MAGIC */
+    uint16_t cls;                             /* size class */
+} slabhdr_t;
+
+typedef struct slabobj_s slabobj_t;
+struct slabobj_s {
+    slabobj_t *next;                          /* next free object */
+};
 
-void *mrp_mm_realloc(void *ptr, size_t size, const char *file, int line,
-                     const char *func)
-{
-    return __mm.realloc(ptr, size, file, line, func);
-}
+static const uint32_t slab_sizes[] = {        /* object (+ header) sizes */
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
 
+#define SLAB_NCLASS MRP_ARRAY_SIZE(slab_sizes)
+#define SLAB_MAXOBJ 2048
 
-char *mrp_mm_strdup(const char *s, const char *file, int line, const char *func)
-{
-    char   *p;
-    size_t  size;
+typedef struct {
+    slabobj_t *head;                          /* cached free objects */
+    uint32_t   count;                         /* number of cached objects */
+    uint64_t   nalloc;                        /* allocations */
+    uint64_t   nfree;                         /* frees */
+} slabcache_t;
 
-    if (s != NULL) {
-        size = strlen(s) + 1;
-        p    = mrp_mm_alloc(size, file, line, func);
+typedef struct {
+    mrp_list_hook_t hook;                     /* to list of thread caches */
+    slabcache_t     cache[SLAB_NCLASS + 1];   /* classes + large objects */
+} slabtls_t;
 
-        if (p != NULL)
-            strcpy(p, s);
-    }
-    else
-        p = NULL;
+typedef struct {
+    slabobj_t *head;                          /* free objects */
+    uint32_t   count;                         /* number of free objects */
+    uint32_t   batch;                         /* refill/flush batch size */
+    uint32_t   nslab;                         /* allocated slabs */
+    uint64_t   nalloc;                        /* allocations by dead threads */
+    uint64_t   nfree;                         /* frees by dead threads */
+} slabdepot_t;
+
+static struct {
+    pthread_mutex_t lock;                     /* protects depots and caches */
+    pthread_key_t   key;                      /* for thread cache cleanup */
+    pthread_once_t  once;                     /* cleanup key initializer */
+    mrp_list_hook_t caches;                   /* all thread caches */
+    slabdepot_t     depot[SLAB_NCLASS + 1];   /* classes + large objects */
+    uint8_t         lookup[SLAB_MAXOBJ / SLAB_QUANTUM + 1];
+} slab = {
+    .lock   = PTHREAD_MUTEX_INITIALIZER,
+    .once   = PTHREAD_ONCE_INIT,
+    .caches = MRP_LIST_INIT(slab.caches),
+};
 
-    return p;
-}
+static __thread slabtls_t *slab_tls;          /* our thread cache */
 
 
-int mrp_mm_memalign(void **ptr, size_t align, size_t size, const char *file,
-                    int line, const char *func)
+static inline slabhdr_t *slab_hdr(void *ptr)
 {
-    return __mm.memalign(ptr, align, size, file, line, func);
+    return ptr - SLAB_HDRSIZE;
 }
 
 
-void mrp_mm_free(void *ptr, const char *file, int line, const char *func)
+static inline void *slab_ptr(slabhdr_t *hdr)
 {
-    return __mm.free(ptr, file, line, func);
+    return ((void *)hdr) + SLAB_HDRSIZE;
 }
 
 
-int mrp_mm_config(mrp_mm_type_t type)
+static void slab_tls_destroy(void *ptr)
 {
-    if (__mm.cur_blocks != 0)
-        return FALSE;
+    slabtls_t   *tls = ptr;
+    slabcache_t *c;
+    slabdepot_t *d;
+    slabobj_t   *obj;
+    size_t       i;
+
+    pthread_mutex_lock(&slab.lock);
+
+    for (i = 0; i < SLAB_NCLASS + 1; i++) {
+        c = tls->cache + i;
+        d = slab.depot + i;
+
+        while ((obj = c->head) != NULL) {
+            c->head   = obj->next;
+            obj->next = d->head;
+            d->head   = obj;
+            d->count++;
+        }
 
-    switch (type) {
-    case MRP_MM_PASSTHRU:
-        __mm.alloc    = __passthru_alloc;
-        __mm.realloc  = __passthru_realloc;
-        __mm.memalign = __passthru_memalign;
-        __mm.free     = __passthru_free;
-        __mm.mode     = MRP_MM_PASSTHRU;
-        return TRUE;
+        d->nalloc += c->nalloc;
+        d->nfree  += c->nfree;
+    }
 
-    case MRP_MM_DEBUG:
-        __mm.alloc    = __mm_alloc;
-        __mm.realloc  = __mm_realloc;
-        __mm.memalign = __mm_memalign;
-        __mm.free     = __mm_free;
-        __mm.mode     = MRP_MM_DEBUG;
-        return TRUE;
+    mrp_list_delete(&tls->hook);
 
-    default:
-        mrp_log_error("Invalid memory allocator type 0x%x requested.", type);
-        return FALSE;
-    }
-}
+    pthread_mutex_unlock(&slab.lock);
 
+    if (slab_tls == tls)
+        slab_tls = NULL;
 
-#define NBUCKET 1024
+    free(tls);
+}
 
-static int btcmp(void **bt1, void **bt2)
+
+static void slab_init(void)
 {
-    ptrdiff_t diff;
-    int       i;
+    size_t i, cls, size;
 
-    for (i = 0; i < __mm.depth; i++) {
-        diff = bt1[i] - bt2[i];
+    pthread_key_create(&slab.key, slab_tls_destroy);
 
-        if (diff < 0)
-            return -1;
-        else if (diff > 0)
-            return +1;
+    for (i = 0, cls = 0; i < MRP_ARRAY_SIZE(slab.lookup); i++) {
+        size = i * SLAB_QUANTUM;
+
+        while (slab_sizes[cls] < size)
+            cls++;
+
+        slab.lookup[i] = cls;
     }
 
-    return 0;
+    for (cls = 0; cls < SLAB_NCLASS; cls++) {
+        slab.depot[cls].batch = SLAB_BATCH / slab_sizes[cls];
+
+        if (slab.depot[cls].batch < 4)
+            slab.depot[cls].batch = 4;
+        if (slab.depot[cls].batch > 64)
+            slab.depot[cls].batch = 64;
+    }
 }
 
 
-static uint32_t blkhash(memblk_t *blk)
+static slabtls_t *slab_tls_get(void)
 {
-    uint32_t h;
-    int      i;
+    slabtls_t *tls = slab_tls;
 
-    h = 0;
-    for (i = 0; i < __mm.depth; i++)
-        h ^= (blk->bt[i] - NULL) & 0xffffffffUL;
+    if (MRP_LIKELY(tls != NULL))
+        return tls;
 
-    return h % NBUCKET;
+    if ((tls = calloc(1, sizeof(*tls))) == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&slab.lock);
+    mrp_list_append(&slab.caches, &tls->hook);
+    pthread_mutex_unlock(&slab.lock);
+
+    pthread_setspecific(slab.key, tls);
+    slab_tls = tls;
+
+    return tls;
 }
 
 
-static memblk_t *blkfind(mrp_list_hook_t *buckets, memblk_t *blk)
+static int slab_grow(int cls)
 {
-    uint32_t         h    = blkhash(blk);
-    mrp_list_hook_t *head = buckets + h;
-    mrp_list_hook_t *p, *n;
-    memblk_t        *b;
+    slabdepot_t *d = slab.depot + cls;
+    slabhdr_t   *hdr;
+    slabobj_t   *obj;
+    void        *mem;
+    uint32_t     size, n, i;
 
-    mrp_list_foreach(head, p, n) {
-        b = mrp_list_entry(p, typeof(*b), hook);
-        if (!btcmp(&b->bt[0], &blk->bt[0]))
-            return b;
+    if ((mem = malloc(SLAB_SIZE)) == NULL)
+        return FALSE;
+
+    size = slab_sizes[cls];
+    n    = SLAB_SIZE / size;
+
+    for (i = 0; i < n; i++) {
+        hdr = mem + i * size;
+        obj = slab_ptr(hdr);
+
+        hdr->offs  = 0;
+        hdr->magic = SLAB_MAGIC;
+        hdr->cls   = cls;
+
+        obj->next = d->head;
+        d->head   = obj;
     }
 
-    return NULL;
+    d->count += n;
+    d->nslab++;
+
+    return TRUE;
 }
 
 
-static void collect_blocks(mrp_list_hook_t *buckets)
+static int slab_refill(slabcache_t *c, int cls)
 {
-    mrp_list_hook_t *p, *n;
-    memblk_t        *head, *blk;
-    uint32_t         h;
-    int              i;
-
-    for (i = 0; i < NBUCKET; i++)
-        mrp_list_init(buckets + i);
+    slabdepot_t *d = slab.depot + cls;
+    slabobj_t   *obj;
+    uint32_t     n;
 
-    mrp_list_foreach(&__mm.blocks, p, n) {
-        blk = mrp_list_entry(p, typeof(*blk), hook);
+    pthread_mutex_lock(&slab.lock);
 
-        mrp_list_init(&blk->more);
-        head = blkfind(buckets, blk);
+    if (d->head == NULL && !slab_grow(cls)) {
+        pthread_mutex_unlock(&slab.lock);
+        return FALSE;
+    }
 
-        if (head != NULL) {
-            mrp_list_append(&head->more, &blk->more);
-            head->size += blk->size;
-        }
-        else {
-            h = blkhash(blk);
-            mrp_list_delete(&blk->hook);
-            mrp_list_append(buckets + h, &blk->hook);
-        }
+    for (n = 0; n < d->batch && (obj = d->head) != NULL; n++) {
+        d->head   = obj->next;
+        obj->next = c->head;
+        c->head   = obj;
     }
+
+    d->count -= n;
+    c->count += n;
+
+    pthread_mutex_unlock(&slab.lock);
+
+    return TRUE;
 }
 
 
-static uint32_t group_usage(memblk_t *head, int exclude_head)
+static void slab_flush(slabcache_t *c, int cls)
 {
-    mrp_list_hook_t *p, *n;
-    memblk_t        *blk;
-    uint32_t         total;
+    slabdepot_t *d = slab.depot + cls;
+    slabobj_t   *obj;
+    uint32_t     n;
 
-    total = exclude_head ? 0 : head->size;
-    mrp_list_foreach(&head->more, p, n) {
-        blk = mrp_list_entry(p, typeof(*blk), more);
-        total += blk->size;
+    pthread_mutex_lock(&slab.lock);
+
+    for (n = 0; n < d->batch && (obj = c->head) != NULL; n++) {
+        c->head   = obj->next;
+        obj->next = d->head;
+        d->head   = obj;
     }
 
-    return total;
+    c->count -= n;
+    d->count += n;
+
+    pthread_mutex_unlock(&slab.lock);
 }
 
 
-static void dump_group(FILE *fp, memblk_t *head)
+static inline int slab_class(size_t size)
 {
-    mrp_list_hook_t  *p, *n;
-    memblk_t         *blk;
-    char            **syms, *sym;
-    uint32_t          total;
-    int               nblk, i;
+    size += SLAB_HDRSIZE;
 
-    fprintf(fp, "Allocations with call stack fingerprint:\n");
-    syms = backtrace_symbols(head->bt, __mm.depth);
-    for (i = 0; i < __mm.depth && head->bt[i]; i++) {
-        sym = syms && syms[i] ? strrchr(syms[i], '/') : NULL;
-        fprintf(fp, "    %p (%s)\n", head->bt[i], sym ? sym + 1 : "<unknown>");
-    }
-    free(syms);
+    if (size > SLAB_MAXOBJ)
+        return -1;
+    else
+        return slab.lookup[(size + SLAB_QUANTUM - 1) / SLAB_QUANTUM];
+}
 
-    total = head->size - group_usage(head, TRUE);
-    nblk  = 1;
 
-    fprintf(fp, "        %lu bytes at %p\n", (unsigned long)total,
-            memblk_to_ptr(head));
+static void *slab_alloc_large(slabtls_t *tls, size_t size)
+{
+    slabhdr_t *hdr;
 
-    mrp_list_foreach(&head->more, p, n) {
-        blk = mrp_list_entry(p, typeof(*blk), more);
+    if ((hdr = malloc(SLAB_HDRSIZE + size)) == NULL)
+        return NULL;
 
-        total += blk->size;
-        nblk++;
+    hdr->offs  = 0;
+    hdr->magic = SLAB_MAGIC;
+    hdr->cls   = SLAB_LARGE;
 
-        fprintf(fp, "        %zd bytes at %p\n", blk->size, memblk_to_ptr(blk));
-    }
+    tls->cache[SLAB_NCLASS].nalloc++;
 
-    if (nblk > 1)
-        fprintf(fp, "    total %lu bytes in %d blocks\n",
-                (unsigned long)total, nblk);
+    return slab_ptr(hdr);
 }
 
 
-static void sort_blocks(mrp_list_hook_t *buckets, mrp_list_hook_t *sorted)
+static void *__slab_alloc(size_t size, const char *file, int line,
+                          const char *func)
 {
-    mrp_list_hook_t *bp, *bn, *sp, *sn;
-    memblk_t        *head, *entry, *next;
-    int              i;
+    slabtls_t   *tls;
+    slabcache_t *c;
+    slabobj_t   *obj;
+    int          cls;
 
-    mrp_list_init(sorted);
+    MRP_UNUSED(file);
+    MRP_UNUSED(line);
+    MRP_UNUSED(func);
 
-    for (i = 0; i < NBUCKET; i++) {
-        mrp_list_foreach(buckets + i, bp, bn) {
-            head = mrp_list_entry(bp, typeof(*head), hook);
+    if (MRP_UNLIKELY(size == 0))
+        return NULL;
 
-            next = NULL;
-            mrp_list_foreach(sorted, sp, sn) {
-                entry = mrp_list_entry(sp, typeof(*entry), hook);
+    if ((tls = slab_tls_get()) == NULL)
+        return NULL;
 
-                if (head->size <= entry->size) {
-                    next = entry;
-                    break;
-                }
-            }
+    if ((cls = slab_class(size)) < 0)
+        return slab_alloc_large(tls, size);
 
-            mrp_list_delete(&head->hook);
+    c = tls->cache + cls;
 
-            if (next != NULL)
-                mrp_list_insert_before(&next->hook, &head->hook);
-            else
-                mrp_list_append(sorted, &head->hook);
-        }
-    }
+    if (MRP_UNLIKELY(c->head == NULL) && !slab_refill(c, cls))
+        return NULL;
+
+    obj     = c->head;
+    c->head = obj->next;
+    c->count--;
+    c->nalloc++;
+
+    return obj;
 }
 
 
-static void dump_blocks(FILE *fp, mrp_list_hook_t *sorted)
+static void __slab_free(void *ptr, const char *file, int line,
+                        const char *func)
 {
-    mrp_list_hook_t *p, *n;
-    memblk_t        *head;
+    slabtls_t   *tls;
+    slabcache_t *c;
+    slabhdr_t   *hdr;
+    slabobj_t   *obj;
+    int          cls;
 
-    mrp_list_foreach(sorted, p, n) {
-        head = mrp_list_entry(p, typeof(*head), hook);
-        dump_group(fp, head);
+    MRP_UNUSED(file);
+    MRP_UNUSED(line);
+    MRP_UNUSED(func);
+
+    if (ptr == NULL)
+        return;
+
+    hdr = slab_hdr(ptr);
+
+    if (MRP_UNLIKELY(hdr->magic != SLAB_MAGIC)) {
+        mrp_log_error("%s@%s:%d: freeing invalid memory block %p.",
+                      func, file, line, ptr);
+        return;
     }
-}
 
+    cls = hdr->cls;
+    tls = slab_tls_get();
 
-static void relink_blocks(mrp_list_hook_t *sorted)
-{
-    mrp_list_hook_t *p, *n;
-    memblk_t        *head;
-    uint32_t         rest;
+    if (cls >= (int)SLAB_NCLASS) {
+        if (tls != NULL)
+            tls->cache[SLAB_NCLASS].nfree++;
 
-    mrp_list_foreach(sorted, p, n) {
-        head = mrp_list_entry(p, typeof(*head), hook);
-        mrp_list_delete(&head->hook);
-        mrp_list_append(&__mm.blocks, &head->hook);
+        if (cls == SLAB_ALIGNED)
+            free(ptr - hdr->offs);
+        else
+            free(hdr);
 
-        rest = group_usage(head, TRUE);
-        head->size -= rest;
+        return;
+    }
+
+    if (MRP_UNLIKELY(tls == NULL)) {          /* put it straight to depot */
+        pthread_mutex_lock(&slab.lock);
+        obj = ptr;
+        obj->next = slab.depot[cls].head;
+        slab.depot[cls].head = obj;
+        slab.depot[cls].count++;
+        slab.depot[cls].nfree++;
+        pthread_mutex_unlock(&slab.lock);
+        return;
+    }
+
+    c   = tls->cache + cls;
+    obj = ptr;
+
+    obj->next = c->head;
+    c->head   = obj;
+    c->count++;
+    c->nfree++;
+
+    if (MRP_UNLIKELY(c->count > 2 * slab.depot[cls].batch))
+        slab_flush(c, cls);
+}
+
+
+static void *__slab_realloc(void *ptr, size_t size, const char *file,
+                            int line, const char *func)
+{
+    slabhdr_t *hdr, *resized;
+    void      *p;
+    size_t     old;
+    int        cls;
+
+    if (ptr == NULL)
+        return __slab_alloc(size, file, line, func);
+
+    if (size == 0) {
+        __slab_free(ptr, file, line, func);
+        return NULL;
+    }
+
+    hdr = slab_hdr(ptr);
+
+    if (MRP_UNLIKELY(hdr->magic != SLAB_MAGIC)) {
+        mrp_log_error("%s@%s:%d: resizing invalid memory block %p.",
+                      func, file, line, ptr);
+        return NULL;
+    }
+
+    cls = slab_class(size);
+
+    switch (hdr->cls) {
+    case SLAB_LARGE:
+        if (cls >= 0)
+            break;
+        if ((resized = realloc(hdr, SLAB_HDRSIZE + size)) == NULL)
+            return NULL;
+        return slab_ptr(resized);
+
+    case SLAB_ALIGNED:
+        old = malloc_usable_size(ptr - hdr->offs) - hdr->offs;
+        goto copy;
+
+    default:
+        if (cls == hdr->cls)
+            return ptr;
+        break;
+    }
+
+    if (hdr->cls == SLAB_LARGE)
+        old = malloc_usable_size(hdr) - SLAB_HDRSIZE;
+    else
+        old = slab_sizes[hdr->cls] - SLAB_HDRSIZE;
+
+ copy:
+    if ((p = __slab_alloc(size, file, line, func)) == NULL)
+        return NULL;
+
+    memcpy(p, ptr, MRP_MIN(old, size));
+    __slab_free(ptr, file, line, func);
+
+    return p;
+}
+
+
+static int __slab_memalign(void **ptr, size_t align, size_t size,
+                           const char *file, int line, const char *func)
+{
+    slabtls_t *tls;
+    slabhdr_t *hdr;
+    void      *mem;
+    int        err;
+
+    *ptr = NULL;
+
+    if (align <= MRP_MM_ALIGN) {
+        if ((*ptr = __slab_alloc(size, file, line, func)) == NULL)
+            return size ? ENOMEM : 0;
+        else
+            return 0;
+    }
+
+    if ((align & (align - 1)) != 0 || align > UINT32_MAX)
+        return EINVAL;
+
+    if ((tls = slab_tls_get()) == NULL)
+        return ENOMEM;
+
+    if ((err = posix_memalign(&mem, align, align + size)) != 0)
+        return err;
+
+    hdr = mem + align - SLAB_HDRSIZE;
+
+    hdr->offs  = align;
+    hdr->magic = SLAB_MAGIC;
+    hdr->cls   = SLAB_ALIGNED;
+
+    tls->cache[SLAB_NCLASS].nalloc++;
+
+    *ptr = slab_ptr(hdr);
+
+    return 0;
+}
+
+
+static void slab_usage(size_t cls, uint64_t *nalloc, uint64_t *nfree,
+                       uint32_t *ncached)
+{
+    mrp_list_hook_t *p, *n;
+    slabtls_t       *tls;
+
+    *nalloc  = slab.depot[cls].nalloc;
+    *nfree   = slab.depot[cls].nfree;
+    *ncached = slab.depot[cls].count;
+
+    mrp_list_foreach(&slab.caches, p, n) {
+        tls = mrp_list_entry(p, typeof(*tls), hook);
+
+        *nalloc  += tls->cache[cls].nalloc;
+        *nfree   += tls->cache[cls].nfree;
+        *ncached += tls->cache[cls].count;
+    }
+}
+
+
+static uint64_t slab_inuse(void)
+{
+    uint64_t nalloc, nfree, total;
+    uint32_t ncached;
+    size_t   cls;
+
+    total = 0;
+
+    pthread_mutex_lock(&slab.lock);
+    for (cls = 0; cls < SLAB_NCLASS + 1; cls++) {
+        slab_usage(cls, &nalloc, &nfree, &ncached);
+        total += nalloc - nfree;
+    }
+    pthread_mutex_unlock(&slab.lock);
+
+    return total;
+}
+
+
+static void slab_dump(FILE *fp)
+{
+    uint64_t nalloc, nfree, inuse, bytes, total, reserved;
+    uint32_t ncached, size;
+    size_t   cls;
+
+    total    = 0;
+    reserved = 0;
+
+    fprintf(fp, "Slab allocator size classes:\n");
+    fprintf(fp, "%6s %8s %12s %12s %10s %10s %12s\n", "size", "slabs",
+            "allocs", "frees", "in use", "cached", "bytes");
+
+    pthread_mutex_lock(&slab.lock);
+
+    for (cls = 0; cls < SLAB_NCLASS; cls++) {
+        slab_usage(cls, &nalloc, &nfree, &ncached);
+
+        size   = slab_sizes[cls];
+        inuse  = nalloc - nfree;
+        bytes  = inuse * size;
+        total += bytes;
+
+        reserved += (uint64_t)slab.depot[cls].nslab * SLAB_SIZE;
+
+        fprintf(fp, "%6u %8u %12llu %12llu %10llu %10u %12llu\n", size,
+                slab.depot[cls].nslab, (unsigned long long)nalloc,
+                (unsigned long long)nfree, (unsigned long long)inuse,
+                ncached, (unsigned long long)bytes);
+    }
+
+    slab_usage(SLAB_NCLASS, &nalloc, &nfree, &ncached);
+
+    pthread_mutex_unlock(&slab.lock);
+
+    fprintf(fp, "%6s %8s %12llu %12llu %10llu\n", "large", "-",
+            (unsigned long long)nalloc, (unsigned long long)nfree,
+            (unsigned long long)(nalloc - nfree));
+    fprintf(fp, "Slabs: %llu bytes (%.2f M) reserved, %llu bytes "
+            "(%.2f M) in use.\n", (unsigned long long)reserved,
+            1.0 * reserved / (1024 * 1024), (unsigned long long)total,
+            1.0 * total / (1024 * 1024));
+}
+
+
+/*
+ * tables of tracked blocks
+ *
+ * Both the sampling profiler and allocation accounting need to find the
+ * blocks they track by address when the blocks are freed. These are kept
+ * in open-addressed tables with linear probing, which are allocated from
+ * the system allocator to keep them out of the way of the trackers.
+ */
+
+#define PTRTAB_MINSIZE 256                    /* initial table size */
+
+typedef struct {
+    void   *ptr;                              /* tracked block, or NULL */
+    size_t  size;                             /* block size */
+    void   *data;                             /* tracker-specific data */
+} mm_live_t;
+
+typedef struct {
+    mm_live_t *live;                          /* tracked blocks */
+    size_t     nlive;                         /* number of tracked blocks */
+    size_t     size;                          /* table size, 2^n */
+} mm_ptrtab_t;
+
+
+static inline uint32_t ptrtab_hash(void *ptr)
+{
+    uint64_t h = (uint64_t)(uintptr_t)ptr >> 3;
+
+    return (uint32_t)((h * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+
+static mm_live_t *ptrtab_lookup(mm_ptrtab_t *t, void *ptr)
+{
+    size_t i, mask = t->size - 1;
+
+    if (t->live == NULL)
+        return NULL;
+
+    for (i = ptrtab_hash(ptr) & mask; t->live[i].ptr; i = (i + 1) & mask)
+        if (t->live[i].ptr == ptr)
+            return t->live + i;
+
+    return NULL;
+}
+
+
+static void ptrtab_remove(mm_ptrtab_t *t, mm_live_t *l)
+{
+    size_t i, j, k, mask = t->size - 1;
+
+    __atomic_sub_fetch(&t->nlive, 1, __ATOMIC_RELAXED);
+
+    /* backward-shift deletion to keep probe sequences intact */
+    i = l - t->live;
+    j = i;
+
+    for (;;) {
+        t->live[i].ptr = NULL;
+
+        do {
+            j = (j + 1) & mask;
+
+            if (t->live[j].ptr == NULL)
+                return;
+
+            k = ptrtab_hash(t->live[j].ptr) & mask;
+        } while (i <= j ? (i < k && k <= j) : (i < k || k <= j));
+
+        t->live[i] = t->live[j];
+        i = j;
+    }
+}
+
+
+static mm_live_t *ptrtab_insert(mm_ptrtab_t *t, void *ptr, size_t size,
+                                void *data)
+{
+    mm_live_t *old;
+    size_t     i, n, mask;
+
+    if (2 * (t->nlive + 1) > t->size) {
+        n   = t->size ? 2 * t->size : PTRTAB_MINSIZE;
+        old = t->live;
+
+        if ((t->live = calloc(n, sizeof(*t->live))) == NULL) {
+            t->live = old;
+            return NULL;
+        }
+
+        t->size = n;
+        mask    = n - 1;
+
+        for (n = 0; old != NULL && n < t->size / 2; n++) {
+            if (old[n].ptr == NULL)
+                continue;
+            for (i = ptrtab_hash(old[n].ptr) & mask; t->live[i].ptr;
+                 i = (i + 1) & mask)
+                ;
+            t->live[i] = old[n];
+        }
+
+        free(old);
+    }
+
+    mask = t->size - 1;
+
+    for (i = ptrtab_hash(ptr) & mask; t->live[i].ptr; i = (i + 1) & mask)
+        ;
+
+    t->live[i].ptr  = ptr;
+    t->live[i].size = size;
+    t->live[i].data = data;
+
+    /* read without locking to skip lookups in empty tables */
+    __atomic_add_fetch(&t->nlive, 1, __ATOMIC_RELAXED);
+
+    return t->live + i;
+}
+
+
+static void ptrtab_reset(mm_ptrtab_t *t)
+{
+    free(t->live);
+    t->live = NULL;
+    t->size = 0;
+    __atomic_store_n(&t->nlive, 0, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * sampling allocation profiler
+ *
+ * When enabled, the allocator functions of the active mode are wrapped.
+ * Every thread counts down the bytes it allocates and records the call
+ * stack of the allocation that crosses zero. It then draws the next
+ * countdown from an exponential distribution with the sampling rate as
+ * its mean, which makes the samples a Poisson process over allocated
+ * bytes. Sampled blocks are tracked by address, so their stack's live
+ * counters can be updated when they are freed. With sampling disabled
+ * the wrappers are not installed, so there is no overhead.
+ */
+
+#define SAMPLE_DEPTH  32                      /* max. recorded stack depth */
+#define SAMPLE_SKIP    2                      /* profiler frames to skip */
+#define SAMPLE_NSTACK 1021                    /* stack hash buckets */
+
+typedef struct sample_stack_s sample_stack_t;
+
+struct sample_stack_s {
+    sample_stack_t *next;                     /* hash chain */
+    uint32_t        hash;                     /* stack hash */
+    int             depth;                    /* number of frames */
+    uint64_t        live_objs;                /* sampled blocks alive */
+    uint64_t        live_bytes;               /* sampled bytes alive */
+    uint64_t        total_objs;               /* sampled blocks ever */
+    uint64_t        total_bytes;              /* sampled bytes ever */
+    void           *bt[];                     /* call stack */
+};
+
+static struct {
+    pthread_mutex_t  lock;                    /* protects everything below */
+    size_t           rate;                    /* mean bytes between samples */
+    sample_stack_t  *stacks[SAMPLE_NSTACK];   /* stacks by hash */
+    mm_ptrtab_t      live;                    /* sampled live blocks */
+
+    void *(*alloc)(size_t size, const char *file, int line, const char *func);
+    void *(*realloc)(void *ptr, size_t size, const char *file,
+                     int line, const char *func);
+    int   (*memalign)(void **ptr, size_t align, size_t size,
+                      const char *file, int line, const char *func);
+    void  (*free)(void *ptr, const char *file, int line, const char *func);
+} sample = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread int64_t  sample_left;        /* bytes until next sample */
+static __thread uint64_t sample_rng;         /* xorshift state, 0 if unset */
+static __thread int      sample_busy;        /* recording a sample */
+
+
+static int64_t sample_next(size_t rate)
+{
+    uint64_t x;
+    uint32_t q;
+    double   m, l2;
+    int      e;
+
+    if (MRP_UNLIKELY(sample_rng == 0))
+        sample_rng = (uint64_t)(uintptr_t)&x ^ ((uint64_t)getpid() << 32) ^
+            0x2545f4914f6cdd1dULL;
+
+    x  = sample_rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    sample_rng = x;
+
+    /* -ln(u) for u uniform in (0, 1], with u = q / 2^26 */
+    q  = (uint32_t)(x >> 38) + 1;
+    e  = 31 - __builtin_clz(q);
+    m  = (double)q / (double)(1U << e);
+    l2 = e + (-0.34484843 * m + 2.02466578) * m - 1.67487759;
+
+    return (int64_t)((26.0 - l2) * 0.6931471805599453 * rate) + 1;
+}
+
+
+static sample_stack_t *sample_stack(void **bt, int depth)
+{
+    sample_stack_t *st;
+    uint32_t        h;
+    int             i;
+
+    for (i = 0, h = depth; i < depth; i++)
+        h = (h ^ ptrtab_hash(bt[i])) * 16777619U;
+
+    for (st = sample.stacks[h % SAMPLE_NSTACK]; st != NULL; st = st->next)
+        if (st->hash == h && st->depth == depth &&
+            !memcmp(st->bt, bt, depth * sizeof(bt[0])))
+            return st;
+
+    if ((st = calloc(1, sizeof(*st) + depth * sizeof(bt[0]))) == NULL)
+        return NULL;
+
+    st->hash  = h;
+    st->depth = depth;
+    memcpy(st->bt, bt, depth * sizeof(bt[0]));
+
+    st->next = sample.stacks[h % SAMPLE_NSTACK];
+    sample.stacks[h % SAMPLE_NSTACK] = st;
+
+    return st;
+}
+
+
+static void sample_remove(mm_live_t *l)
+{
+    sample_stack_t *st = l->data;
+
+    st->live_objs--;
+    st->live_bytes -= l->size;
+
+    ptrtab_remove(&sample.live, l);
+}
+
+
+static int sample_insert(void *ptr, size_t size, sample_stack_t *st)
+{
+    mm_live_t *l;
+
+    if ((l = ptrtab_lookup(&sample.live, ptr)) != NULL)  /* stale address */
+        sample_remove(l);
+
+    if (ptrtab_insert(&sample.live, ptr, size, st) == NULL)
+        return -1;
+
+    st->live_objs++;
+    st->live_bytes  += size;
+    st->total_objs++;
+    st->total_bytes += size;
+
+    return 0;
+}
+
+
+static void __attribute__((noinline)) sample_record(void *ptr, size_t size)
+{
+    void           *bt[SAMPLE_DEPTH + SAMPLE_SKIP];
+    sample_stack_t *st;
+    int             n;
+
+    sample_busy = TRUE;
+    n = backtrace(bt, MRP_ARRAY_SIZE(bt));
+    sample_busy = FALSE;
+
+    if (n <= SAMPLE_SKIP)
+        return;
+
+    pthread_mutex_lock(&sample.lock);
+
+    if (sample.rate != 0 && (st = sample_stack(bt + SAMPLE_SKIP,
+                                               n - SAMPLE_SKIP)) != NULL)
+        sample_insert(ptr, size, st);
+
+    pthread_mutex_unlock(&sample.lock);
+}
+
+
+static inline void sample_check(void *ptr, size_t size)
+{
+    if (ptr == NULL || sample_busy)
+        return;
+
+    if (MRP_UNLIKELY(sample_rng == 0))
+        sample_left = sample_next(sample.rate);
+
+    if ((sample_left -= size) > 0)
+        return;
+
+    sample_left = sample_next(sample.rate);
+    sample_record(ptr, size);
+}
+
+
+static inline void sample_forget(void *ptr)
+{
+    mm_live_t *l;
+
+    if (ptr == NULL ||
+        __atomic_load_n(&sample.live.nlive, __ATOMIC_RELAXED) == 0)
+        return;
+
+    pthread_mutex_lock(&sample.lock);
+
+    if ((l = ptrtab_lookup(&sample.live, ptr)) != NULL)
+        sample_remove(l);
+
+    pthread_mutex_unlock(&sample.lock);
+}
+
+
+static void *__sample_alloc(size_t size, const char *file, int line,
+                            const char *func)
+{
+    void *ptr = sample.alloc(size, file, line, func);
+
+    sample_check(ptr, size);
+
+    return ptr;
+}
+
+
+static void *__sample_realloc(void *ptr, size_t size, const char *file,
+                              int line, const char *func)
+{
+    void *p = sample.realloc(ptr, size, file, line, func);
+
+    if (p != NULL || size == 0) {
+        sample_forget(ptr);
+        sample_check(p, size);
+    }
+
+    return p;
+}
+
+
+static int __sample_memalign(void **ptr, size_t align, size_t size,
+                             const char *file, int line, const char *func)
+{
+    int status = sample.memalign(ptr, align, size, file, line, func);
+
+    if (status == 0)
+        sample_check(*ptr, size);
+
+    return status;
+}
+
+
+static void __sample_free(void *ptr, const char *file, int line,
+                          const char *func)
+{
+    sample_forget(ptr);
+    sample.free(ptr, file, line, func);
+}
+
+
+int mrp_mm_sample(size_t rate)
+{
+    sample_stack_t *st;
+    size_t          i;
+
+    pthread_mutex_lock(&sample.lock);
+
+    if (rate != 0) {
+        if (sample.rate == 0) {
+            sample.alloc    = __mm.alloc;
+            sample.realloc  = __mm.realloc;
+            sample.memalign = __mm.memalign;
+            sample.free     = __mm.free;
+
+            __mm.alloc    = __sample_alloc;
+            __mm.realloc  = __sample_realloc;
+            __mm.memalign = __sample_memalign;
+            __mm.free     = __sample_free;
+        }
+    }
+    else if (sample.rate != 0) {
+        __mm.alloc    = sample.alloc;
+        __mm.realloc  = sample.realloc;
+        __mm.memalign = sample.memalign;
+        __mm.free     = sample.free;
+
+        /* we can't track frees any more, so forget live blocks */
+        ptrtab_reset(&sample.live);
+
+        for (i = 0; i < SAMPLE_NSTACK; i++)
+            for (st = sample.stacks[i]; st != NULL; st = st->next)
+                st->live_objs = st->live_bytes = 0;
+    }
+
+    sample.rate = rate;
+
+    pthread_mutex_unlock(&sample.lock);
+
+    return TRUE;
+}
+
+
+size_t mrp_mm_sample_rate(void)
+{
+    return sample.rate;
+}
+
+
+void mrp_mm_sample_dump(FILE *fp)
+{
+    sample_stack_t *st;
+    uint64_t        lo, lb, to, tb;
+    size_t          i;
+    int             j;
+    FILE           *maps;
+    char            buf[4096];
+    size_t          n;
+
+    pthread_mutex_lock(&sample.lock);
+
+    for (i = 0, lo = lb = to = tb = 0; i < SAMPLE_NSTACK; i++) {
+        for (st = sample.stacks[i]; st != NULL; st = st->next) {
+            lo += st->live_objs;
+            lb += st->live_bytes;
+            to += st->total_objs;
+            tb += st->total_bytes;
+        }
+    }
+
+    fprintf(fp, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%zu\n",
+            (unsigned long long)lo, (unsigned long long)lb,
+            (unsigned long long)to, (unsigned long long)tb, sample.rate);
+
+    for (i = 0; i < SAMPLE_NSTACK; i++) {
+        for (st = sample.stacks[i]; st != NULL; st = st->next) {
+            fprintf(fp, "%llu: %llu [%llu: %llu] @",
+                    (unsigned long long)st->live_objs,
+                    (unsigned long long)st->live_bytes,
+                    (unsigned long long)st->total_objs,
+                    (unsigned long long)st->total_bytes);
+
+            for (j = 0; j < st->depth; j++)
+                fprintf(fp, " %p", st->bt[j]);
+
+            fprintf(fp, "\n");
+        }
+    }
+
+    pthread_mutex_unlock(&sample.lock);
+
+    fprintf(fp, "\nMAPPED_LIBRARIES:\n");
+
+    if ((maps = fopen("/proc/self/maps", "r")) != NULL) {
+        while ((n = fread(buf, 1, sizeof(buf), maps)) > 0)
+            fwrite(buf, 1, n, fp);
+        fclose(maps);
+    }
+
+    fflush(fp);
+}
+
+
+/*
+ * allocation accounting
+ *
+ * Memory can be charged to tags, typically one per subsystem and, where
+ * it makes sense, one per client of a subsystem, with client tags being
+ * children of their subsystem's tag. Charges to a tag are propagated to
+ * all of its ancestors. While accounting is enabled, the allocator
+ * functions of the active mode are wrapped (beneath the sampling
+ * profiler, if that is active) and blocks allocated by a thread with a
+ * current tag are tracked by address and charged to that tag until they
+ * are freed. A resized block stays charged to the tag it was allocated
+ * with. Subsystems with allocators of their own can charge the memory
+ * they manage explicitly. Every tracked block holds a reference to its
+ * tag, so a destroyed tag lingers, with whatever is still charged to it,
+ * until its last block is freed. Blocks allocated without a current tag
+ * or with accounting disabled are not charged.
+ */
+
+#define ACCOUNT_NSHARD 16                     /* tracking table shards */
+
+struct mrp_mm_tag_s {
+    mrp_list_hook_t  hook;                    /* to list of tags */
+    char            *name;                    /* full tag name */
+    mrp_mm_tag_t    *parent;                  /* parent tag, if any */
+    int              refcnt;                  /* creator + tracked blocks */
+    int              dead;                    /* destroyed by creator */
+    int64_t          bytes;                   /* charged live bytes */
+    int64_t          objs;                    /* charged live blocks */
+    uint64_t         total;                   /* charged blocks ever */
+};
+
+typedef struct {
+    pthread_mutex_t  lock;                    /* protects table */
+    mm_ptrtab_t      live;                    /* tracked blocks */
+} account_shard_t;
+
+static struct {
+    pthread_mutex_t  lock;                    /* protects the tag list */
+    mrp_list_hook_t  tags;                    /* all tags */
+    int              init;                    /* shard locks initialized */
+    int              enabled;                 /* whether wrappers installed */
+    size_t           nlive;                   /* number of tracked blocks */
+    account_shard_t  shards[ACCOUNT_NSHARD];  /* tracked blocks by address */
+
+    void *(*alloc)(size_t size, const char *file, int line, const char *func);
+    void *(*realloc)(void *ptr, size_t size, const char *file,
+                     int line, const char *func);
+    int   (*memalign)(void **ptr, size_t align, size_t size,
+                      const char *file, int line, const char *func);
+    void  (*free)(void *ptr, const char *file, int line, const char *func);
+} account = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .tags = MRP_LIST_INIT(account.tags),
+};
+
+static __thread mrp_mm_tag_t *account_tag;   /* current tag of the thread */
+
+
+static void account_charge(mrp_mm_tag_t *tag, int64_t bytes, int64_t objs)
+{
+    for (; tag != NULL; tag = tag->parent) {
+        __atomic_add_fetch(&tag->bytes, bytes, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&tag->objs, objs, __ATOMIC_RELAXED);
+
+        if (objs > 0)
+            __atomic_add_fetch(&tag->total, objs, __ATOMIC_RELAXED);
+    }
+}
+
+
+static void tag_unref(mrp_mm_tag_t *tag)
+{
+    mrp_mm_tag_t *parent;
+
+    while (tag != NULL) {
+        if (__atomic_sub_fetch(&tag->refcnt, 1, __ATOMIC_ACQ_REL) != 0)
+            return;
+
+        pthread_mutex_lock(&account.lock);
+        mrp_list_delete(&tag->hook);
+        pthread_mutex_unlock(&account.lock);
+
+        parent = tag->parent;
+
+        free(tag->name);
+        free(tag);
+
+        tag = parent;
+    }
+}
+
+
+static inline account_shard_t *account_shard(void *ptr)
+{
+    return account.shards + (ptrtab_hash(ptr) % ACCOUNT_NSHARD);
+}
+
+
+static void account_track(void *ptr, size_t size, mrp_mm_tag_t *tag)
+{
+    account_shard_t *s = account_shard(ptr);
+    mm_live_t       *l;
+    mrp_mm_tag_t    *stale;
+    size_t           ssize;
+
+    stale = NULL;
+    ssize = 0;
+
+    pthread_mutex_lock(&s->lock);
+
+    if ((l = ptrtab_lookup(&s->live, ptr)) != NULL) {
+        stale = l->data;
+        ssize = l->size;
+        ptrtab_remove(&s->live, l);
+        __atomic_sub_fetch(&account.nlive, 1, __ATOMIC_RELAXED);
+    }
+
+    if (ptrtab_insert(&s->live, ptr, size, tag) != NULL) {
+        __atomic_add_fetch(&account.nlive, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&tag->refcnt, 1, __ATOMIC_RELAXED);
+        account_charge(tag, size, 1);
+    }
+
+    pthread_mutex_unlock(&s->lock);
+
+    if (stale != NULL) {
+        account_charge(stale, -(int64_t)ssize, -1);
+        tag_unref(stale);
+    }
+}
+
+
+static mrp_mm_tag_t *account_untrack(void *ptr, size_t *sizep)
+{
+    account_shard_t *s;
+    mm_live_t       *l;
+    mrp_mm_tag_t    *tag;
+
+    if (ptr == NULL || __atomic_load_n(&account.nlive, __ATOMIC_RELAXED) == 0)
+        return NULL;
+
+    s   = account_shard(ptr);
+    tag = NULL;
+
+    pthread_mutex_lock(&s->lock);
+
+    if ((l = ptrtab_lookup(&s->live, ptr)) != NULL) {
+        tag    = l->data;
+        *sizep = l->size;
+        ptrtab_remove(&s->live, l);
+        __atomic_sub_fetch(&account.nlive, 1, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_unlock(&s->lock);
+
+    if (tag != NULL)
+        account_charge(tag, -(int64_t)*sizep, -1);
+
+    return tag;
+}
+
+
+static void *__account_alloc(size_t size, const char *file, int line,
+                             const char *func)
+{
+    void *ptr = account.alloc(size, file, line, func);
+
+    if (ptr != NULL && account_tag != NULL)
+        account_track(ptr, size, account_tag);
+
+    return ptr;
+}
+
+
+static void *__account_realloc(void *ptr, size_t size, const char *file,
+                               int line, const char *func)
+{
+    mrp_mm_tag_t *tag;
+    size_t        old;
+    void         *p;
+
+    /* untrack first, so a concurrently reused address is not confused */
+    if ((tag = account_untrack(ptr, &old)) == NULL) {
+        if ((tag = account_tag) != NULL)
+            __atomic_add_fetch(&tag->refcnt, 1, __ATOMIC_RELAXED);
+    }
+
+    p = account.realloc(ptr, size, file, line, func);
+
+    if (tag != NULL) {
+        if (p != NULL)
+            account_track(p, size, tag);
+        else if (size != 0 && ptr != NULL)
+            account_track(ptr, old, tag);
+
+        tag_unref(tag);
+    }
+
+    return p;
+}
+
+
+static int __account_memalign(void **ptr, size_t align, size_t size,
+                              const char *file, int line, const char *func)
+{
+    int status = account.memalign(ptr, align, size, file, line, func);
+
+    if (status == 0 && *ptr != NULL && account_tag != NULL)
+        account_track(*ptr, size, account_tag);
+
+    return status;
+}
+
+
+static void __account_free(void *ptr, const char *file, int line,
+                           const char *func)
+{
+    mrp_mm_tag_t *tag;
+    size_t        size;
+
+    tag = account_untrack(ptr, &size);
+    account.free(ptr, file, line, func);
+    tag_unref(tag);
+}
+
+
+int mrp_mm_account(int enable)
+{
+    account_shard_t *s;
+    mm_live_t       *l;
+    size_t           i, j;
+
+    /* the profiler lock serializes (un)wrapping the allocator */
+    pthread_mutex_lock(&sample.lock);
+
+    if (enable && !account.enabled) {
+        if (!account.init) {
+            for (i = 0; i < ACCOUNT_NSHARD; i++)
+                pthread_mutex_init(&account.shards[i].lock, NULL);
+            account.init = TRUE;
+        }
+
+        if (sample.rate != 0) {
+            account.alloc    = sample.alloc;
+            account.realloc  = sample.realloc;
+            account.memalign = sample.memalign;
+            account.free     = sample.free;
+
+            sample.alloc    = __account_alloc;
+            sample.realloc  = __account_realloc;
+            sample.memalign = __account_memalign;
+            sample.free     = __account_free;
+        }
+        else {
+            account.alloc    = __mm.alloc;
+            account.realloc  = __mm.realloc;
+            account.memalign = __mm.memalign;
+            account.free     = __mm.free;
+
+            __mm.alloc    = __account_alloc;
+            __mm.realloc  = __account_realloc;
+            __mm.memalign = __account_memalign;
+            __mm.free     = __account_free;
+        }
+
+        account.enabled = TRUE;
+    }
+    else if (!enable && account.enabled) {
+        if (sample.rate != 0) {
+            sample.alloc    = account.alloc;
+            sample.realloc  = account.realloc;
+            sample.memalign = account.memalign;
+            sample.free     = account.free;
+        }
+        else {
+            __mm.alloc    = account.alloc;
+            __mm.realloc  = account.realloc;
+            __mm.memalign = account.memalign;
+            __mm.free     = account.free;
+        }
+
+        account.enabled = FALSE;
+
+        /* we can't track frees any more, so discharge tracked blocks */
+        for (i = 0; i < ACCOUNT_NSHARD; i++) {
+            s = account.shards + i;
+
+            pthread_mutex_lock(&s->lock);
+
+            for (j = 0, l = s->live.live; j < s->live.size; j++, l++) {
+                if (l->ptr == NULL)
+                    continue;
+
+                account_charge(l->data, -(int64_t)l->size, -1);
+                tag_unref(l->data);
+            }
+
+            __atomic_sub_fetch(&account.nlive, s->live.nlive,
+                               __ATOMIC_RELAXED);
+            ptrtab_reset(&s->live);
+
+            pthread_mutex_unlock(&s->lock);
+        }
+    }
+
+    pthread_mutex_unlock(&sample.lock);
+
+    return TRUE;
+}
+
+
+int mrp_mm_accounting(void)
+{
+    return account.enabled;
+}
+
+
+mrp_mm_tag_t *mrp_mm_tag_create(const char *name, mrp_mm_tag_t *parent)
+{
+    mrp_mm_tag_t *tag;
+    size_t        size;
+
+    if ((tag = calloc(1, sizeof(*tag))) == NULL)
+        return NULL;
+
+    size = strlen(name) + 1 + (parent ? strlen(parent->name) + 1 : 0);
+
+    if ((tag->name = malloc(size)) == NULL) {
+        free(tag);
+        return NULL;
+    }
+
+    if (parent != NULL)
+        snprintf(tag->name, size, "%s/%s", parent->name, name);
+    else
+        snprintf(tag->name, size, "%s", name);
+
+    mrp_list_init(&tag->hook);
+    tag->refcnt = 1;
+
+    if ((tag->parent = parent) != NULL)
+        __atomic_add_fetch(&parent->refcnt, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&account.lock);
+    mrp_list_append(&account.tags, &tag->hook);
+    pthread_mutex_unlock(&account.lock);
+
+    return tag;
+}
+
+
+void mrp_mm_tag_destroy(mrp_mm_tag_t *tag)
+{
+    if (tag == NULL || tag->dead)
+        return;
+
+    tag->dead = TRUE;
+
+    if (account_tag == tag)
+        account_tag = NULL;
+
+    tag_unref(tag);
+}
+
+
+mrp_mm_tag_t *mrp_mm_tag_set(mrp_mm_tag_t *tag)
+{
+    mrp_mm_tag_t *prev = account_tag;
+
+    account_tag = tag;
+
+    return prev;
+}
+
+
+void mrp_mm_tag_charge(mrp_mm_tag_t *tag, ssize_t bytes, int objs)
+{
+    if (tag != NULL)
+        account_charge(tag, bytes, objs);
+}
+
+
+int mrp_mm_tag_foreach(mrp_mm_tag_cb_t cb, void *user_data)
+{
+    mrp_list_hook_t  *p, *n;
+    mrp_mm_tag_t     *tag;
+    mrp_mm_tag_stat_t st;
+    int               cnt;
+
+    cnt = 0;
+
+    pthread_mutex_lock(&account.lock);
+
+    mrp_list_foreach(&account.tags, p, n) {
+        tag = mrp_list_entry(p, typeof(*tag), hook);
+
+        st.name  = tag->name;
+        st.dead  = tag->dead;
+        st.bytes = __atomic_load_n(&tag->bytes, __ATOMIC_RELAXED);
+        st.objs  = __atomic_load_n(&tag->objs, __ATOMIC_RELAXED);
+        st.total = __atomic_load_n(&tag->total, __ATOMIC_RELAXED);
+
+        cnt++;
+
+        if (!cb(&st, user_data))
+            break;
+    }
+
+    pthread_mutex_unlock(&account.lock);
+
+    return cnt;
+}
+
+
+static int dump_tag(const mrp_mm_tag_stat_t *st, void *user_data)
+{
+    FILE *fp = user_data;
+
+    fprintf(fp, "%-40s %12lld %10lld %12llu%s\n", st->name,
+            (long long)st->bytes, (long long)st->objs,
+            (unsigned long long)st->total, st->dead ? " (destroyed)" : "");
+
+    return TRUE;
+}
+
+
+void mrp_mm_tag_dump(FILE *fp)
+{
+    fprintf(fp, "%-40s %12s %10s %12s\n", "tag", "bytes", "blocks", "total");
+    mrp_mm_tag_foreach(dump_tag, fp);
+    fflush(fp);
+}
+
+
+/*
+ * common public interface - uses passthru, debugging or slab
+ */
+
+void *mrp_mm_alloc(size_t size, const char *file, int line, const char *func)
+{
+    return __mm.alloc(size, file, line, func);
+}
+
+
+void *mrp_mm_realloc(void *ptr, size_t size, const char *file, int line,
+                     const char *func)
+{
+    return __mm.realloc(ptr, size, file, line, func);
+}
+
+
+char *mrp_mm_strdup(const char *s, const char *file, int line, const char *func)
+{
+    char   *p;
+    size_t  size;
+
+    if (s != NULL) {
+        size = strlen(s) + 1;
+        p    = mrp_mm_alloc(size, file, line, func);
+
+        if (p != NULL)
+            strcpy(p, s);
+    }
+    else
+        p = NULL;
+
+    return p;
+}
+
+
+int mrp_mm_memalign(void **ptr, size_t align, size_t size, const char *file,
+                    int line, const char *func)
+{
+    return __mm.memalign(ptr, align, size, file, line, func);
+}
+
+
+void mrp_mm_free(void *ptr, const char *file, int line, const char *func)
+{
+    return __mm.free(ptr, file, line, func);
+}
+
+
+int mrp_mm_config(mrp_mm_type_t type)
+{
+    if (__mm.cur_blocks != 0 || sample.rate != 0 || account.enabled)
+        return FALSE;
+
+    if (__mm.mode == MRP_MM_SLAB && type != MRP_MM_SLAB && slab_inuse() != 0)
+        return FALSE;
+
+    switch (type) {
+    case MRP_MM_PASSTHRU:
+        __mm.alloc    = __passthru_alloc;
+        __mm.realloc  = __passthru_realloc;
+        __mm.memalign = __passthru_memalign;
+        __mm.free     = __passthru_free;
+        __mm.mode     = MRP_MM_PASSTHRU;
+        return TRUE;
+
+    case MRP_MM_DEBUG:
+        __mm.alloc    = __mm_alloc;
+        __mm.realloc  = __mm_realloc;
+        __mm.memalign = __mm_memalign;
+        __mm.free     = __mm_free;
+        __mm.mode     = MRP_MM_DEBUG;
+        return TRUE;
+
+    case MRP_MM_SLAB:
+        pthread_once(&slab.once, slab_init);
+        __mm.alloc    = __slab_alloc;
+        __mm.realloc  = __slab_realloc;
+        __mm.memalign = __slab_memalign;
+        __mm.free     = __slab_free;
+        __mm.mode     = MRP_MM_SLAB;
+        return TRUE;
+
+    default:
+        mrp_log_error("Invalid memory allocator type 0x%x requested.", type);
+        return FALSE;
+    }
+}
+
+
+int mrp_mm_reserve(size_t bytes)
+{
+    size_t  cls, total;
+    void   *mem;
+
+    /*
+     * Notes:
+     *     Slabs are never given back, so growing the depots is enough. The
+     *     system allocator would happily trim or unmap what we touch here,
+     *     so in the other modes we turn that off before prefaulting.
+     */
+
+    if (__mm.mode != MRP_MM_SLAB) {
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+
+        if ((mem = malloc(bytes)) == NULL)
+            return FALSE;
+
+        memset(mem, 0, bytes);
+        free(mem);
+
+        return TRUE;
+    }
+
+    pthread_mutex_lock(&slab.lock);
+
+    for (total = 0, cls = 0; total < bytes; total += SLAB_SIZE) {
+        if (!slab_grow(cls)) {
+            pthread_mutex_unlock(&slab.lock);
+            return FALSE;
+        }
+
+        cls = (cls + 1) % SLAB_NCLASS;
+    }
+
+    pthread_mutex_unlock(&slab.lock);
+
+    return TRUE;
+}
+
+
+#define NBUCKET 1024
+
+static int btcmp(void **bt1, void **bt2)
+{
+    ptrdiff_t diff;
+    int       i;
+
+    for (i = 0; i < __mm.depth; i++) {
+        diff = bt1[i] - bt2[i];
+
+        if (diff < 0)
+            return -1;
+        else if (diff > 0)
+            return +1;
+    }
+
+    return 0;
+}
+
+
+static uint32_t blkhash(memblk_t *blk)
+{
+    uint32_t h;
+    int      i;
+
+    h = 0;
+    for (i = 0; i < __mm.depth; i++)
+        h ^= (blk->bt[i] - NULL) & 0xffffffffUL;
+
+    return h % NBUCKET;
+}
+
+
+static memblk_t *blkfind(mrp_list_hook_t *buckets, memblk_t *blk)
+{
+    uint32_t         h    = blkhash(blk);
+    mrp_list_hook_t *head = buckets + h;
+    mrp_list_hook_t *p, *n;
+    memblk_t        *b;
+
+    mrp_list_foreach(head, p, n) {
+        b = mrp_list_entry(p, typeof(*b), hook);
+        if (!btcmp(&b->bt[0], &blk->bt[0]))
+            return b;
+    }
+
+    return NULL;
+}
+
+
+static void collect_blocks(mrp_list_hook_t *buckets)
+{
+    mrp_list_hook_t *p, *n;
+    memblk_t        *head, *blk;
+    uint32_t         h;
+    int              i;
+
+    for (i = 0; i < NBUCKET; i++)
+        mrp_list_init(buckets + i);
+
+    mrp_list_foreach(&__mm.blocks, p, n) {
+        blk = mrp_list_entry(p, typeof(*blk), hook);
+
+        mrp_list_init(&blk->more);
+        head = blkfind(buckets, blk);
+
+        if (head != NULL) {
+            mrp_list_append(&head->more, &blk->more);
+            head->size += blk->size;
+        }
+        else {
+            h = blkhash(blk);
+            mrp_list_delete(&blk->hook);
+            mrp_list_append(buckets + h, &blk->hook);
+        }
+    }
+}
+
+
+static uint32_t group_usage(memblk_t *head, int exclude_head)
+{
+    mrp_list_hook_t *p, *n;
+    memblk_t        *blk;
+    uint32_t         total;
+
+    total = exclude_head ? 0 : head->size;
+    mrp_list_foreach(&head->more, p, n) {
+        blk = mrp_list_entry(p, typeof(*blk), more);
+        total += blk->size;
+    }
+
+    return total;
+}
+
+
+static void dump_group(FILE *fp, memblk_t *head)
+{
+    mrp_list_hook_t  *p, *n;
+    memblk_t         *blk;
+    char            **syms, *sym;
+    uint32_t          total;
+    int               nblk, i;
+
+    fprintf(fp, "Allocations with call stack fingerprint:\n");
+    syms = backtrace_symbols(head->bt, __mm.depth);
+    for (i = 0; i < __mm.depth && head->bt[i]; i++) {
+        sym = syms && syms[i] ? strrchr(syms[i], '/') : NULL;
+        fprintf(fp, "    %p (%s)\n", head->bt[i], sym ? sym + 1 : "<unknown>");
+    }
+    free(syms);
+
+    total = head->size - group_usage(head, TRUE);
+    nblk  = 1;
+
+    fprintf(fp, "        %lu bytes at %p\n", (unsigned long)total,
+            memblk_to_ptr(head));
+
+    mrp_list_foreach(&head->more, p, n) {
+        blk = mrp_list_entry(p, typeof(*blk), more);
+
+        total += blk->size;
+        nblk++;
+
+        fprintf(fp, "        %zd bytes at %p\n", blk->size, memblk_to_ptr(blk));
+    }
+
+    if (nblk > 1)
+        fprintf(fp, "    total %lu bytes in %d blocks\n",
+                (unsigned long)total, nblk);
+}
+
+
+static void sort_blocks(mrp_list_hook_t *buckets, mrp_list_hook_t *sorted)
+{
+    mrp_list_hook_t *bp, *bn, *sp, *sn;
+    memblk_t        *head, *entry, *next;
+    int              i;
+
+    mrp_list_init(sorted);
+
+    for (i = 0; i < NBUCKET; i++) {
+        mrp_list_foreach(buckets + i, bp, bn) {
+            head = mrp_list_entry(bp, typeof(*head), hook);
+
+            next = NULL;
+            mrp_list_foreach(sorted, sp, sn) {
+                entry = mrp_list_entry(sp, typeof(*entry), hook);
+
+                if (head->size <= entry->size) {
+                    next = entry;
+                    break;
+                }
+            }
+
+            mrp_list_delete(&head->hook);
+
+            if (next != NULL)
+                mrp_list_insert_before(&next->hook, &head->hook);
+            else
+                mrp_list_append(sorted, &head->hook);
+        }
+    }
+}
+
+
+static void dump_blocks(FILE *fp, mrp_list_hook_t *sorted)
+{
+    mrp_list_hook_t *p, *n;
+    memblk_t        *head;
+
+    mrp_list_foreach(sorted, p, n) {
+        head = mrp_list_entry(p, typeof(*head), hook);
+        dump_group(fp, head);
+    }
+}
+
+
+static void relink_blocks(mrp_list_hook_t *sorted)
+{
+    mrp_list_hook_t *p, *n;
+    memblk_t        *head;
+    uint32_t         rest;
+
+    mrp_list_foreach(sorted, p, n) {
+        head = mrp_list_entry(p, typeof(*head), hook);
+        mrp_list_delete(&head->hook);
+        mrp_list_append(&__mm.blocks, &head->hook);
+
+        rest = group_usage(head, TRUE);
+        head->size -= rest;
     }
 }
 
 
 void mrp_mm_dump(FILE *fp)
 {
-    mrp_list_hook_t buckets[NBUCKET];
-    mrp_list_hook_t sorted;
+    mrp_list_hook_t buckets[NBUCKET];
+    mrp_list_hook_t sorted;
+
+    if (__mm.mode == MRP_MM_SLAB) {
+        slab_dump(fp);
+        return;
+    }
+
+    mrp_list_init(&sorted);
+
+    pthread_mutex_lock(&__mm.lock);
+    collect_blocks(buckets);
+    sort_blocks(buckets, &sorted);
+    dump_blocks(fp, &sorted);
+    relink_blocks(&sorted);
+    pthread_mutex_unlock(&__mm.lock);
+
+    fprintf(fp, "Max: %llu bytes (%.2f M, %.2f G), %ld blocks\n",
+            (unsigned long long)__mm.max_alloc,
+            1.0 * __mm.max_alloc / (1024 * 1024),
+            1.0 * __mm.max_alloc / (1024 * 1024 * 1024),
+            (unsigned long)__mm.max_blocks);
+    fprintf(fp, "Current: %llu bytes (%.2f M, %.2f G) in %ld blocks.\n",
+            (unsigned long long)__mm.cur_alloc,
+            1.0 * __mm.cur_alloc / (1024 * 1024),
+            1.0 * __mm.cur_alloc / (1024 * 1024 * 1024),
+            (unsigned long)__mm.cur_blocks);
+}
+
+
+void mrp_mm_check(FILE *fp)
+{
+    mrp_mm_dump(fp);
+}
+
+
+/*
+ * memory arenas
+ */
+
+typedef struct arena_chunk_s arena_chunk_t;
+
+struct arena_chunk_s {
+    arena_chunk_t *next;                      /* next chunk */
+    size_t         size;                      /* usable chunk size */
+    size_t         used;                      /* bytes allocated */
+    uint64_t       data[];                    /* chunk data */
+};
+
+struct mrp_arena_s {
+    arena_chunk_t *chunks;                    /* chunks, retained on reset */
+    arena_chunk_t *cur;                       /* chunk being allocated from */
+    arena_chunk_t *large;                     /* oversized allocations */
+    size_t         chunk_size;                /* size of regular chunks */
+};
+
+
+static arena_chunk_t *arena_chunk(size_t size)
+{
+    arena_chunk_t *chunk;
+
+    if ((chunk = mrp_alloc(sizeof(*chunk) + size)) != NULL) {
+        chunk->next = NULL;
+        chunk->size = size;
+        chunk->used = 0;
+    }
+
+    return chunk;
+}
+
+
+mrp_arena_t *mrp_arena_create(size_t chunk_size)
+{
+    mrp_arena_t *arena;
+
+    if (chunk_size == 0)
+        chunk_size = MRP_ARENA_CHUNK_SIZE;
+
+    if ((arena = mrp_allocz(sizeof(*arena))) != NULL)
+        arena->chunk_size = MRP_ALIGN(chunk_size, MRP_MM_ALIGN);
+
+    return arena;
+}
+
+
+static void arena_free_chunks(arena_chunk_t *chunk)
+{
+    arena_chunk_t *next;
+
+    while (chunk != NULL) {
+        next = chunk->next;
+        mrp_free(chunk);
+        chunk = next;
+    }
+}
+
+
+void mrp_arena_destroy(mrp_arena_t *arena)
+{
+    if (arena != NULL) {
+        arena_free_chunks(arena->chunks);
+        arena_free_chunks(arena->large);
+        mrp_free(arena);
+    }
+}
+
+
+void *mrp_arena_alloc(mrp_arena_t *arena, size_t size)
+{
+    arena_chunk_t *chunk;
+    void          *ptr;
+
+    if (MRP_UNLIKELY(size == 0))
+        return NULL;
+
+    size  = MRP_ALIGN(size, MRP_MM_ALIGN);
+    chunk = arena->cur;
+
+    if (MRP_LIKELY(chunk != NULL && chunk->size - chunk->used >= size)) {
+        ptr          = ((char *)chunk->data) + chunk->used;
+        chunk->used += size;
+
+        return ptr;
+    }
+
+    /* allocate oversized objects in a dedicated chunk of their own */
+    if (size > arena->chunk_size / 4) {
+        if ((chunk = arena_chunk(size)) == NULL)
+            return NULL;
+
+        chunk->next  = arena->large;
+        chunk->used  = size;
+        arena->large = chunk;
+
+        return chunk->data;
+    }
+
+    /* move on to the next retained chunk or add a new one */
+    if (chunk != NULL && chunk->next != NULL)
+        chunk = chunk->next;
+    else {
+        if ((chunk = arena_chunk(arena->chunk_size)) == NULL)
+            return NULL;
+
+        if (arena->cur != NULL)
+            arena->cur->next = chunk;
+        else
+            arena->chunks = chunk;
+    }
+
+    arena->cur  = chunk;
+    chunk->used = size;
+
+    return chunk->data;
+}
+
+
+void *mrp_arena_allocz(mrp_arena_t *arena, size_t size)
+{
+    void *ptr;
+
+    if ((ptr = mrp_arena_alloc(arena, size)) != NULL)
+        memset(ptr, 0, size);
+
+    return ptr;
+}
+
+
+char *mrp_arena_strdup(mrp_arena_t *arena, const char *s)
+{
+    char   *p;
+    size_t  size;
 
-    mrp_list_init(&sorted);
+    if (s == NULL)
+        return NULL;
 
-    collect_blocks(buckets);
-    sort_blocks(buckets, &sorted);
-    dump_blocks(fp, &sorted);
-    relink_blocks(&sorted);
+    size = strlen(s) + 1;
 
-    fprintf(fp, "Max: %llu bytes (%.2f M, %.2f G), %ld blocks\n",
-            (unsigned long long)__mm.max_alloc,
-            1.0 * __mm.max_alloc / (1024 * 1024),
-            1.0 * __mm.max_alloc / (1024 * 1024 * 1024),
-            (unsigned long)__mm.max_blocks);
-    fprintf(fp, "Current: %llu bytes (%.2f M, %.2f G) in %ld blocks.\n",
-            (unsigned long long)__mm.cur_alloc,
-            1.0 * __mm.cur_alloc / (1024 * 1024),
-            1.0 * __mm.cur_alloc / (1024 * 1024 * 1024),
-            (unsigned long)__mm.cur_blocks);
+    if ((p = mrp_arena_alloc(arena, size)) != NULL)
+        memcpy(p, s, size);
+
+    return p;
 }
 
 
-void mrp_mm_check(FILE *fp)
+void mrp_arena_reset(mrp_arena_t *arena)
 {
-    mrp_mm_dump(fp);
+    if (arena == NULL)
+        return;
+
+    arena_free_chunks(arena->large);
+    arena->large = NULL;
+
+    if ((arena->cur = arena->chunks) != NULL)
+        arena->cur->used = 0;
 }
 
 
 
 
 
+
 /*
  * object pool interface
  */
@@ -871,8 +2586,21 @@ static void chunk_foreach_object(pool_chunk_t *chunk,
 
 /*
  * an object pool
+ *
+ * Pools are usable from multiple threads. The chunks with their slot
+ * bitmaps form a depot protected by the pool lock. In front of it every
+ * thread has a magazine of free objects it allocates from and frees to
+ * without locking. Empty magazines are refilled from the depot in
+ * batches. Objects freed while the magazine of the freeing thread is
+ * full are pushed to a lock-free list of remote frees, which is drained
+ * by the next refill. As cached objects look allocated to the depot,
+ * every chunk also has a live bitmap of the objects handed out to users,
+ * updated atomically, to catch frees of objects that are not allocated.
  */
 
+#define MAG_SIZE  32                             /* objects per magazine */
+#define MAG_BATCH (MAG_SIZE / 2)                 /* objects per refill */
+
 struct mrp_objpool_s {
     char             *name;                      /* verbose pool name */
     size_t            limit;                     /* max. number of objects */
@@ -885,14 +2613,38 @@ struct mrp_objpool_s {
     int               poison;                    /* poisoning pattern */
 
     size_t            nperchunk;                 /* objects per chunk */
+    size_t            liveidx;                   /* live bitmap */
     size_t            dataidx;                   /* data  */
     mrp_list_hook_t   space;                     /* chunk with frees slots */
     size_t            nspace;                    /* number of such chunks */
     mrp_list_hook_t   full;                      /* fully allocated chunks */
     size_t            nfull;                     /* number of such chunks */
+
+    pthread_mutex_t   lock;                      /* protects the depot */
+    pthread_key_t     key;                       /* per-thread magazine */
+    int               haskey;                    /* whether key is valid */
+    mrp_list_hook_t   mags;                      /* all magazines */
+    void             *remote;                    /* lock-free remote frees */
+    mrp_list_hook_t   hook;                      /* to list of all pools */
 };
 
 
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static MRP_LIST_HOOK(pools);                     /* all object pools */
+
+
+/*
+ * a per-thread magazine of free objects
+ */
+
+typedef struct {
+    mrp_list_hook_t  hook;                       /* to pool magazines */
+    mrp_objpool_t   *pool;                       /* pool we cache for */
+    int              n;                          /* number of objects */
+    void            *objs[MAG_SIZE];             /* cached free objects */
+} pool_mag_t;
+
+
 /*
  * a chunk of memory allocated to an object pool
  */
@@ -905,12 +2657,18 @@ struct pool_chunk_s {
 };
 
 
+static void mag_destroy(void *ptr);
+
 
 mrp_objpool_t *mrp_objpool_create(mrp_objpool_config_t *cfg)
 {
     mrp_objpool_t *pool;
 
     if ((pool = mrp_allocz(sizeof(*pool))) != NULL) {
+        pthread_mutex_init(&pool->lock, NULL);
+        mrp_list_init(&pool->mags);
+        mrp_list_init(&pool->hook);
+
         if ((pool->name = mrp_strdup(cfg->name)) == NULL)
             goto fail;
 
@@ -927,12 +2685,21 @@ mrp_objpool_t *mrp_objpool_create(mrp_objpool_config_t *cfg)
         pool->nspace = 0;
         pool->nfull  = 0;
 
+        if (pthread_key_create(&pool->key, mag_destroy) != 0)
+            goto fail;
+
+        pool->haskey = TRUE;
+
         if (!pool_calc_sizes(pool))
             goto fail;
 
         if (!mrp_objpool_grow(pool, pool->prealloc))
             goto fail;
 
+        pthread_mutex_lock(&pools_lock);
+        mrp_list_append(&pools, &pool->hook);
+        pthread_mutex_unlock(&pools_lock);
+
         mrp_debug("pool <%s> created, with %zd/%zd objects.", pool->name,
                   pool->prealloc, pool->limit);
 
@@ -946,36 +2713,12 @@ mrp_objpool_t *mrp_objpool_create(mrp_objpool_config_t *cfg)
 }
 
 
-static void free_object(void *obj, void *user_data)
-{
-    mrp_objpool_t *pool = (mrp_objpool_t *)user_data;
-
-    printf("Releasing unfreed object %p from pool <%s>.\n", obj, pool->name);
-    mrp_objpool_free(obj);
-}
-
-
-void mrp_objpool_destroy(mrp_objpool_t *pool)
-{
-    if (pool != NULL) {
-        if (pool->cleanup != NULL)
-            pool_foreach_object(pool, free_object, pool);
-
-        mrp_free(pool->name);
-        mrp_free(pool);
-    }
-}
-
-
-void *mrp_objpool_alloc(mrp_objpool_t *pool)
+static void *chunk_take(mrp_objpool_t *pool)
 {
     pool_chunk_t *chunk;
     void         *obj;
     unsigned int  cidx, uidx, sidx;
 
-    if (pool->limit && pool->nobj >= pool->limit)
-        return NULL;
-
     if (mrp_list_empty(&pool->space)) {
         if (!pool_grow(pool, 1))
             return NULL;
@@ -1019,12 +2762,273 @@ void *mrp_objpool_alloc(mrp_objpool_t *pool)
         }
     }
 
+    return obj;
+}
+
+
+static pool_chunk_t *obj_chunk(void *obj, unsigned int *cidxp,
+                               unsigned int *uidxp)
+{
+    pool_chunk_t  *chunk;
+    mrp_objpool_t *pool;
+    unsigned int   sidx;
+    void          *base;
+
+    chunk = (pool_chunk_t *)(((ptrdiff_t)obj) & ~(__mm.chunk_size - 1));
+    pool  = chunk->pool;
+
+    base = (void *)&chunk->used[pool->dataidx];
+    sidx = (obj - base) / pool->objsize;
+
+    *cidxp = sidx / MASK_BITS;
+    *uidxp = sidx & (MASK_BITS - 1);
+
+    return chunk;
+}
+
+
+static inline void obj_set_live(void *obj)
+{
+    pool_chunk_t *chunk;
+    unsigned int  cidx, uidx;
+
+    chunk = obj_chunk(obj, &cidx, &uidx);
+    __atomic_or_fetch(&chunk->used[chunk->pool->liveidx + cidx],
+                      (mask_t)1 << uidx, __ATOMIC_RELAXED);
+}
+
+
+static inline int obj_clear_live(void *obj)
+{
+    pool_chunk_t *chunk;
+    unsigned int  cidx, uidx;
+    mask_t        bit, old;
+
+    chunk = obj_chunk(obj, &cidx, &uidx);
+    bit   = (mask_t)1 << uidx;
+    old   = __atomic_fetch_and(&chunk->used[chunk->pool->liveidx + cidx],
+                               ~bit, __ATOMIC_RELAXED);
+
+    return (old & bit) != 0;
+}
+
+
+static void chunk_put(mrp_objpool_t *pool, void *obj)
+{
+    pool_chunk_t *chunk;
+    unsigned int  cidx, uidx;
+    mask_t        cache;
+
+    chunk = obj_chunk(obj, &cidx, &uidx);
+    cache = chunk->cache;
+
+    if (chunk->used[cidx] & (1 << uidx)) {
+        mrp_log_error("Trying to free unallocated object %p of pool <%s>.",
+                      obj, pool->name);
+        return;
+    }
+
+    chunk->used[cidx] |= (1 << uidx);
+    chunk->cache      |= (1 << cidx);
+
+    if (cache == MASK_FULL) {                    /* chunk was full */
+        mrp_list_delete(&chunk->hook);
+        pool->nfull--;
+        mrp_list_append(&pool->space, &chunk->hook);
+        pool->nspace++;
+    }
+}
+
+
+static void mag_flush(pool_mag_t *mag)
+{
+    while (mag->n > 0)
+        chunk_put(mag->pool, mag->objs[--mag->n]);
+}
+
+
+static void mag_destroy(void *ptr)
+{
+    pool_mag_t    *mag  = (pool_mag_t *)ptr;
+    mrp_objpool_t *pool = mag->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    mag_flush(mag);
+    mrp_list_delete(&mag->hook);
+    pthread_mutex_unlock(&pool->lock);
+
+    mrp_free(mag);
+}
+
+
+static pool_mag_t *pool_mag(mrp_objpool_t *pool)
+{
+    pool_mag_t *mag;
+
+    if ((mag = pthread_getspecific(pool->key)) != NULL)
+        return mag;
+
+    if ((mag = mrp_allocz(sizeof(*mag))) == NULL)
+        return NULL;
+
+    mrp_list_init(&mag->hook);
+    mag->pool = pool;
+
+    if (pthread_setspecific(pool->key, mag) != 0) {
+        mrp_free(mag);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    mrp_list_append(&pool->mags, &mag->hook);
+    pthread_mutex_unlock(&pool->lock);
+
+    return mag;
+}
+
+
+static void remote_push(mrp_objpool_t *pool, void *obj)
+{
+    void *head = __atomic_load_n(&pool->remote, __ATOMIC_RELAXED);
+
+    do {
+        *(void **)obj = head;
+    } while (!__atomic_compare_exchange_n(&pool->remote, &head, obj, TRUE,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+
+static void *pool_refill(mrp_objpool_t *pool, pool_mag_t *mag)
+{
+    void *obj, *list, *next;
+    int   want = mag != NULL ? MAG_BATCH : 0;
+
+    list = __atomic_exchange_n(&pool->remote, NULL, __ATOMIC_ACQUIRE);
+    obj  = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (; list != NULL; list = next) {
+        next = *(void **)list;
+
+        if (obj == NULL)
+            obj = list;
+        else if (mag != NULL && mag->n < MAG_SIZE)
+            mag->objs[mag->n++] = list;
+        else
+            chunk_put(pool, list);
+    }
+
+    while (obj == NULL || (mag != NULL && mag->n < want)) {
+        if ((list = chunk_take(pool)) == NULL)
+            break;
+
+        if (obj == NULL)
+            obj = list;
+        else
+            mag->objs[mag->n++] = list;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return obj;
+}
+
+
+static void pool_drain(mrp_objpool_t *pool)
+{
+    mrp_list_hook_t *p, *n;
+    pool_mag_t      *mag;
+    void            *list, *next;
+
+    list = __atomic_exchange_n(&pool->remote, NULL, __ATOMIC_ACQUIRE);
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (; list != NULL; list = next) {
+        next = *(void **)list;
+        chunk_put(pool, list);
+    }
+
+    mrp_list_foreach(&pool->mags, p, n) {
+        mag = mrp_list_entry(p, pool_mag_t, hook);
+        mag_flush(mag);
+        mrp_list_delete(&mag->hook);
+        mrp_free(mag);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+static void free_object(void *obj, void *user_data)
+{
+    mrp_objpool_t *pool = (mrp_objpool_t *)user_data;
+
+    printf("Releasing unfreed object %p from pool <%s>.\n", obj, pool->name);
+    mrp_objpool_free(obj);
+}
+
+
+void mrp_objpool_destroy(mrp_objpool_t *pool)
+{
+    if (pool != NULL) {
+        pthread_mutex_lock(&pools_lock);
+        mrp_list_delete(&pool->hook);
+        pthread_mutex_unlock(&pools_lock);
+
+        /*
+         * Delete the key before freeing the magazines of other threads,
+         * so that none of them exiting meanwhile destroys its magazine
+         * again. Cached objects are already cleaned up, return them first.
+         */
+        if (pool->haskey) {
+            pthread_setspecific(pool->key, NULL);
+            pthread_key_delete(pool->key);
+            pool->haskey = FALSE;
+            pool_drain(pool);
+        }
+
+        if (pool->cleanup != NULL)
+            pool_foreach_object(pool, free_object, pool);
+
+        pthread_mutex_destroy(&pool->lock);
+
+        mrp_free(pool->name);
+        mrp_free(pool);
+    }
+}
+
+
+void *mrp_objpool_alloc(mrp_objpool_t *pool)
+{
+    pool_mag_t *mag;
+    void       *obj;
+
+    if (pool->limit &&
+        __atomic_load_n(&pool->nobj, __ATOMIC_RELAXED) >= pool->limit)
+        return NULL;
+
+    mag = pool->haskey ? pool_mag(pool) : NULL;
+
+    if (mag != NULL && mag->n > 0)
+        obj = mag->objs[--mag->n];
+    else if ((obj = pool_refill(pool, mag)) == NULL)
+        return NULL;
+
     if (pool->setup == NULL || pool->setup(obj)) {
-        pool->nobj++;
+        __atomic_add_fetch(&pool->nobj, 1, __ATOMIC_RELAXED);
+        obj_set_live(obj);
         return obj;
     }
     else {
-        mrp_objpool_free(obj);
+        if (pool->cleanup != NULL)
+            pool->cleanup(obj);
+
+        pthread_mutex_lock(&pool->lock);
+        chunk_put(pool, obj);
+        pthread_mutex_unlock(&pool->lock);
+
         return NULL;
     }
 }
@@ -1034,28 +3038,18 @@ void mrp_objpool_free(void *obj)
 {
     pool_chunk_t  *chunk;
     mrp_objpool_t *pool;
-    unsigned int   cidx, uidx, sidx;
-    mask_t         cache, used;
-    void          *base;
+    pool_mag_t    *mag;
+    unsigned int   cidx, uidx;
 
     if (obj == NULL)
         return;
 
-    chunk = (pool_chunk_t *)(((ptrdiff_t)obj) & ~(__mm.chunk_size - 1));
+    chunk = obj_chunk(obj, &cidx, &uidx);
     pool  = chunk->pool;
 
-    base = (void *)&chunk->used[pool->dataidx];
-    sidx = (obj - base) / pool->objsize;
-    cidx = sidx / MASK_BITS;
-    uidx = sidx & (MASK_BITS - 1);
-
-    mrp_debug("%p: %u/%u: %u, offs %zd\n", obj, cidx, uidx, sidx,
-              sidx * pool->objsize);
-
-    cache = chunk->cache;
-    used  = chunk->used[cidx];
+    mrp_debug("%p: %u/%u", obj, cidx, uidx);
 
-    if (used & (1 << uidx)) {
+    if (!obj_clear_live(obj)) {
         mrp_log_error("Trying to free unallocated object %p of pool <%s>.",
                       obj, pool->name);
         return;
@@ -1067,33 +3061,81 @@ void mrp_objpool_free(void *obj)
     if (pool->flags & MRP_OBJPOOL_FLAG_POISON)
         memset(obj, pool->poison, pool->objsize);
 
-    chunk->used[cidx] |= (1 << uidx);
-    chunk->cache      |= (1 << cidx);
+    __atomic_sub_fetch(&pool->nobj, 1, __ATOMIC_RELAXED);
 
-    if (cache == MASK_FULL) {                    /* chunk was full */
-        mrp_list_delete(&chunk->hook);
-        pool->nfull--;
-        mrp_list_append(&pool->space, &chunk->hook);
-        pool->nspace++;
-    }
+    mag = pool->haskey ? pool_mag(pool) : NULL;
 
-    pool->nobj--;
+    /* the remote list links through the object, which breaks poisoning */
+    if (mag != NULL && mag->n < MAG_SIZE)
+        mag->objs[mag->n++] = obj;
+    else if (pool->haskey && !(pool->flags & MRP_OBJPOOL_FLAG_POISON))
+        remote_push(pool, obj);
+    else {
+        pthread_mutex_lock(&pool->lock);
+        chunk_put(pool, obj);
+        pthread_mutex_unlock(&pool->lock);
+    }
 }
 
 
 int mrp_objpool_grow(mrp_objpool_t *pool, int nobj)
 {
     int nchunk = (nobj + pool->nperchunk - 1) / pool->nperchunk;
+    int n;
+
+    pthread_mutex_lock(&pool->lock);
+    n = pool_grow(pool, nchunk);
+    pthread_mutex_unlock(&pool->lock);
+
+    return n == nchunk;
+}
 
-    return pool_grow(pool, nchunk) == nchunk;
+
+int mrp_objpool_reserve(int nobj)
+{
+    mrp_objpool_t   *pool;
+    mrp_list_hook_t *p, *n;
+    size_t           want, room;
+    int              nchunk, success;
+
+    success = TRUE;
+
+    pthread_mutex_lock(&pools_lock);
+
+    mrp_list_foreach(&pools, p, n) {
+        pool = mrp_list_entry(p, typeof(*pool), hook);
+
+        pthread_mutex_lock(&pool->lock);
+
+        want = pool->limit ? MRP_MIN((size_t)nobj, pool->limit) : (size_t)nobj;
+        room = pool->nspace * pool->nperchunk;
+
+        if (room < want) {
+            nchunk = (want - room + pool->nperchunk - 1) / pool->nperchunk;
+
+            if (pool_grow(pool, nchunk) != nchunk)
+                success = FALSE;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    pthread_mutex_unlock(&pools_lock);
+
+    return success;
 }
 
 
 int mrp_objpool_shrink(mrp_objpool_t *pool, int nobj)
 {
     int nchunk = (nobj + pool->nperchunk - 1) / pool->nperchunk;
+    int n;
+
+    pthread_mutex_lock(&pool->lock);
+    n = pool_shrink(pool, nchunk);
+    pthread_mutex_unlock(&pool->lock);
 
-    return pool_shrink(pool, nchunk) == nchunk;
+    return n == nchunk;
 }
 
 
@@ -1111,7 +3153,8 @@ static int pool_calc_sizes(mrp_objpool_t *pool)
      * Pool chunks consist of an administrative header followed by object
      * slots each of which can be either claimed/allocated or free. The
      * header contains a back pointer to the pool, a hook to one of the
-     * chunk lists and a two-level bit-mask for slot allocation status.
+     * chunk lists, a two-level bit-mask for slot allocation status and a
+     * live bit-mask of the slots currently handed out to users.
      * The two-level mask consists of a 32-bit cache word and actual slot
      * status words. The nth bit of the cache word caches whether there are
      * any free among the nth - (n + 31)th slots. The slot status words keep
@@ -1126,7 +3169,7 @@ static int pool_calc_sizes(mrp_objpool_t *pool)
      * the status of these. To do this we use the following equations:
      *
      *     1) Hf + Hv + n * S = C
-     *     2) Hv = W + (n + B - 1) / B * W
+     *     2) Hv = W + 2 * (n + B - 1) / B * W
      * where
      *     C: chunk size
      *     S: object size (aligned to our minimum alignment)
@@ -1137,7 +3180,7 @@ static int pool_calc_sizes(mrp_objpool_t *pool)
      *     B: bitmask word size in bits
      *
      * Solving the equations for n gives us
-     *     n = (B*C - B*Hf - W*(2*B - 1)) / (B*S + W)
+     *     n = (B*C - B*Hf - W*(3*B - 2)) / (B*S + 2*W)
      *
      * If any, the only non-obvious thing below is that instead of trying
      * to express padding as part of the equation system (which seems to be
@@ -1150,8 +3193,8 @@ static int pool_calc_sizes(mrp_objpool_t *pool)
     P  = 0;
 
     S  = MRP_ALIGN(pool->objsize, MRP_MM_ALIGN);
-    n  = (B * C - B * Hf - W * (2*B - 1)) / (B * S + W);
-    Hv = W + W * (n + B - 1) / B;
+    n  = (B * C - B * Hf - W * (3*B - 2)) / (B * S + 2*W);
+    Hv = W + 2 * W * ((n + B - 1) / B);
 
     P = (Hf + Hv) % sizeof(void *);
     if (P != 0) {
@@ -1159,7 +3202,7 @@ static int pool_calc_sizes(mrp_objpool_t *pool)
 
         if (Hv + Hf + P + n * S > C) {
             n--;
-            Hv = W + W * (n + B - 1) / B;
+            Hv = W + 2 * W * ((n + B - 1) / B);
         }
     }
 
@@ -1171,7 +3214,8 @@ static int pool_calc_sizes(mrp_objpool_t *pool)
     }
 
     pool->nperchunk = n;
-    pool->dataidx   = (n + B - 1) / B;
+    pool->liveidx   = (n + B - 1) / B;
+    pool->dataidx   = 2 * pool->liveidx;
 
     if (pool->limit && (pool->limit % pool->nperchunk) != 0)
         pool->limit += (pool->nperchunk - (pool->limit % pool->nperchunk));
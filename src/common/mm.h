@@ -34,6 +34,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 #include <murphy/common/macros.h>
 
@@ -103,7 +104,8 @@ MRP_CDECL_BEGIN
 typedef enum {
     MRP_MM_PASSTHRU = 0,                 /* passthru allocator */
     MRP_MM_DEFAULT  = MRP_MM_PASSTHRU,   /* default is passthru */
-    MRP_MM_DEBUG                         /* debugging allocator */
+    MRP_MM_DEBUG,                        /* debugging allocator */
+    MRP_MM_SLAB                          /* size-class slab allocator */
 } mrp_mm_type_t;
 
 
@@ -111,6 +113,9 @@ int mrp_mm_config(mrp_mm_type_t type);
 void mrp_mm_check(FILE *fp);
 void mrp_mm_dump(FILE *fp);
 
+/** Pre-grow the allocator with @bytes of prefaulted memory. */
+int mrp_mm_reserve(size_t bytes);
+
 void *mrp_mm_alloc(size_t size, const char *file, int line, const char *func);
 void *mrp_mm_realloc(void *ptr, size_t size, const char *file, int line,
                      const char *func);
@@ -123,6 +128,39 @@ void mrp_mm_free(void *ptr, const char *file, int line, const char *func);
 
 
 
+/*
+ * memory arenas
+ *
+ * An arena is a bump-pointer allocator for objects which share the
+ * same, short lifetime. Objects cannot be freed individually. Instead
+ * all objects allocated from an arena are released at once by resetting
+ * the arena. By default the mainloop provides an arena which it resets
+ * after every dispatch cycle (see mrp_mainloop_arena).
+ */
+
+#define MRP_ARENA_CHUNK_SIZE (16 * 1024)         /* default chunk size */
+
+typedef struct mrp_arena_s mrp_arena_t;
+
+/** Create a new arena allocating memory in chunks of @chunk_size. */
+mrp_arena_t *mrp_arena_create(size_t chunk_size);
+
+/** Destroy an arena, freeing all associated memory. */
+void mrp_arena_destroy(mrp_arena_t *arena);
+
+/** Allocate @size bytes from the arena. */
+void *mrp_arena_alloc(mrp_arena_t *arena, size_t size);
+
+/** Allocate @size zero-initialized bytes from the arena. */
+void *mrp_arena_allocz(mrp_arena_t *arena, size_t size);
+
+/** Duplicate the given string in the arena. */
+char *mrp_arena_strdup(mrp_arena_t *arena, const char *s);
+
+/** Release all memory allocated from the arena since the last reset. */
+void mrp_arena_reset(mrp_arena_t *arena);
+
+
 #define MRP_MM_OBJSIZE_MIN 16                    /* minimum object size */
 
 enum {
@@ -163,9 +201,73 @@ void mrp_objpool_free(void *obj);
 /** Grow @pool to accomodate @nobj new objects. */
 int mrp_objpool_grow(mrp_objpool_t *pool, int nobj);
 
+/** Grow every existing pool to roughly @nobj free slots (or its limit). */
+int mrp_objpool_reserve(int nobj);
+
 /** Shrink @pool by @nobj new objects, if possible. */
 int mrp_objpool_shrink(mrp_objpool_t *pool, int nobj);
 
+/*
+ * sampling allocation profiler
+ *
+ * Enable sampling with a mean of @rate allocated bytes between samples,
+ * or disable it with a @rate of 0. Sampling can also be enabled with
+ * sample=<rate> in MRP_MM_CONFIG_ENVVAR. mrp_mm_sample_dump() writes
+ * the sampled live and total bytes per call stack in the pprof legacy
+ * heap profile format (heap_v2).
+ */
+int mrp_mm_sample(size_t rate);
+size_t mrp_mm_sample_rate(void);
+void mrp_mm_sample_dump(FILE *fp);
+
+/*
+ * allocation accounting
+ *
+ * Memory can be charged to tags, typically one per subsystem and, where
+ * it makes sense, one per client of a subsystem, created as a child of
+ * the subsystem's tag. Charges propagate to all ancestors of a tag. With
+ * accounting enabled (mrp_mm_account, or account=1 in the configuration),
+ * blocks allocated while a thread has a current tag are charged to that
+ * tag until they are freed. Subsystems with their own allocators can use
+ * mrp_mm_tag_charge to account for the memory they manage. A destroyed
+ * tag lingers until the last block charged to it is freed.
+ */
+typedef struct mrp_mm_tag_s mrp_mm_tag_t;
+
+typedef struct {
+    const char *name;                    /* full name, parent/child */
+    int         dead;                    /* destroyed, but still charged */
+    int64_t     bytes;                   /* charged live bytes */
+    int64_t     objs;                    /* charged live blocks */
+    uint64_t    total;                   /* charged blocks ever */
+} mrp_mm_tag_stat_t;
+
+typedef int (*mrp_mm_tag_cb_t)(const mrp_mm_tag_stat_t *st, void *user_data);
+
+/** Enable or disable allocation accounting. */
+int mrp_mm_account(int enable);
+
+/** Check whether allocation accounting is enabled. */
+int mrp_mm_accounting(void);
+
+/** Create a new tag, optionally as a child of @parent. */
+mrp_mm_tag_t *mrp_mm_tag_create(const char *name, mrp_mm_tag_t *parent);
+
+/** Destroy the given tag. */
+void mrp_mm_tag_destroy(mrp_mm_tag_t *tag);
+
+/** Set the current tag of the calling thread, returning the previous one. */
+mrp_mm_tag_t *mrp_mm_tag_set(mrp_mm_tag_t *tag);
+
+/** Charge (or with negative values discharge) memory to @tag explicitly. */
+void mrp_mm_tag_charge(mrp_mm_tag_t *tag, ssize_t bytes, int objs);
+
+/** Call @cb with the statistics of every tag, until it returns FALSE. */
+int mrp_mm_tag_foreach(mrp_mm_tag_cb_t cb, void *user_data);
+
+/** Dump the statistics of all tags. */
+void mrp_mm_tag_dump(FILE *fp);
+
 /** Get the value of a boolean key from the configuration. */
 int mrp_mm_config_bool(const char *key, int defval);
 
@@ -45,14 +45,51 @@ static mrp_data_descr_t **direct_types;  /* directly indexed types */
 static mrp_data_descr_t **other_types;   /* linearly searched types */
 static int                nother_type;
 
+/*
+ * fields of a zero-copy view are laid out contiguously with a fixed stride
+ * that leaves room for the size of blobs and arrays
+ */
+#define VIEW_FIELD_SIZE                                                   \
+    MRP_ALIGN(MRP_OFFSET(mrp_msg_field_t, size[1]), sizeof(uint64_t))
+
+#define VIEW_FIELD(msg, i)                                                \
+    ((mrp_msg_field_t *)(((char *)(msg)->view) + (i) * VIEW_FIELD_SIZE))
+
+
+/*
+ * Lookups by tag in messages of at least INDEX_MIN fields go through an
+ * open-addressed tag index that maps each tag to its first field. The
+ * index is built on the first lookup and kept up to date when fields are
+ * added or replaced. If it would get too full it is simply dropped, and
+ * rebuilt with a larger size on the next lookup.
+ */
+#define INDEX_MIN  8
+
+#define INDEX_SLOT(tag, mask) (((uint32_t)(tag) * 40503U) & (mask))
 
-static inline void destroy_field(mrp_msg_field_t *f)
+
+static inline int view_field(mrp_msg_t *msg, mrp_msg_field_t *f)
+{
+    if (msg == NULL || msg->view == NULL)
+        return FALSE;
+
+    return (msg->view <= f && f < VIEW_FIELD(msg, msg->nview));
+}
+
+
+static inline void destroy_field(mrp_msg_t *msg, mrp_msg_field_t *f)
 {
     uint32_t i;
 
     if (f != NULL) {
         mrp_list_delete(&f->hook);
 
+        if (view_field(msg, f))          /* part of the view allocation */
+            return;
+
+        if (msg != NULL && msg->arena != NULL)  /* freed with the arena */
+            return;
+
         switch (f->type) {
         case MRP_MSG_FIELD_STRING:
             mrp_free(f->str);
@@ -80,7 +117,123 @@ static inline void destroy_field(mrp_msg_field_t *f)
 }
 
 
-static inline mrp_msg_field_t *create_field(uint16_t tag, va_list *ap)
+static inline void *field_alloc(mrp_msg_t *msg, size_t size)
+{
+    if (msg->arena != NULL)
+        return mrp_arena_allocz(msg->arena, size);
+    else
+        return mrp_allocz(size);
+}
+
+
+static inline char *field_strdup(mrp_msg_t *msg, const char *s)
+{
+    if (msg->arena != NULL)
+        return mrp_arena_strdup(msg->arena, s);
+    else
+        return mrp_strdup(s);
+}
+
+
+static void index_drop(mrp_msg_t *msg)
+{
+    if (msg->arena == NULL)              /* otherwise freed with the arena */
+        mrp_free(msg->index);
+
+    msg->index  = NULL;
+    msg->nindex = 0;
+    msg->idups  = FALSE;
+}
+
+
+static mrp_msg_field_t **index_slot(mrp_msg_t *msg, uint16_t tag)
+{
+    mrp_msg_field_t **slot;
+    size_t            mask, i;
+
+    mask = msg->nindex - 1;
+
+    for (i = INDEX_SLOT(tag, mask); ; i = (i + 1) & mask) {
+        slot = msg->index + i;
+
+        if (*slot == NULL || (*slot)->tag == tag)
+            return slot;
+    }
+}
+
+
+static int index_build(mrp_msg_t *msg)
+{
+    mrp_list_hook_t  *p, *n;
+    mrp_msg_field_t  *f, **slot;
+    size_t            size;
+
+    for (size = 16; size < 2 * msg->nfield; size <<= 1)
+        ;
+
+    msg->index = field_alloc(msg, size * sizeof(msg->index[0]));
+
+    if (msg->index == NULL)
+        return FALSE;
+
+    msg->nindex = size;
+
+    mrp_list_foreach(&msg->fields, p, n) {
+        f    = mrp_list_entry(p, typeof(*f), hook);
+        slot = index_slot(msg, f->tag);
+
+        if (*slot == NULL)
+            *slot = f;
+        else
+            msg->idups = TRUE;
+    }
+
+    return TRUE;
+}
+
+
+/* update the index with a new field, first tells if it's the first one */
+static void index_add(mrp_msg_t *msg, mrp_msg_field_t *f, int first)
+{
+    mrp_msg_field_t **slot;
+
+    if (msg->index == NULL)
+        return;
+
+    if (2 * msg->nfield > msg->nindex) {
+        index_drop(msg);
+        return;
+    }
+
+    slot = index_slot(msg, f->tag);
+
+    if (*slot == NULL || first) {
+        if (*slot != NULL)
+            msg->idups = TRUE;
+        *slot = f;
+    }
+    else
+        msg->idups = TRUE;
+}
+
+
+static mrp_msg_field_t *index_find(mrp_msg_t *msg, uint16_t tag, int *found)
+{
+    if (msg->index == NULL) {
+        if (msg->nfield < INDEX_MIN || !index_build(msg)) {
+            *found = FALSE;
+            return NULL;
+        }
+    }
+
+    *found = TRUE;
+
+    return *index_slot(msg, tag);
+}
+
+
+static inline mrp_msg_field_t *create_field(mrp_msg_t *msg, uint16_t tag,
+                                            va_list *ap)
 {
     mrp_msg_field_t *f;
     uint16_t         type, base;
@@ -91,8 +244,8 @@ static inline mrp_msg_field_t *create_field(uint16_t tag, va_list *ap)
 
 #define CREATE(_f, _tag, _type, _fldtype, _fld, _last, _errlbl) do {      \
                                                                           \
-            (_f) = mrp_allocz(MRP_OFFSET(typeof(*_f), _last) +            \
-                              sizeof(_f->_last));                         \
+            (_f) = field_alloc(msg, MRP_OFFSET(typeof(*_f), _last) +      \
+                               sizeof(_f->_last));                        \
                                                                           \
             if ((_f) != NULL) {                                           \
                 mrp_list_init(&(_f)->hook);                             \
@@ -109,7 +262,7 @@ static inline mrp_msg_field_t *create_field(uint16_t tag, va_list *ap)
             uint16_t _base;                                               \
             uint32_t _i;                                                  \
                                                                           \
-            (_f) = mrp_allocz(MRP_OFFSET(typeof(*_f), size[1]));          \
+            (_f) = field_alloc(msg, MRP_OFFSET(typeof(*_f), size[1]));    \
                                                                           \
             if ((_f) != NULL) {                                           \
                 mrp_list_init(&(_f)->hook);                               \
@@ -118,8 +271,8 @@ static inline mrp_msg_field_t *create_field(uint16_t tag, va_list *ap)
                 _base      = _type & ~MRP_MSG_FIELD_ARRAY;                \
                                                                           \
                 _f->size[0] = va_arg(*ap, uint32_t);                      \
-                _f->_fld    = mrp_allocz_array(typeof(*_f->_fld),         \
-                                               _f->size[0]);              \
+                _f->_fld    = field_alloc(msg, _f->size[0] *              \
+                                          sizeof(*_f->_fld));             \
                                                                           \
                 if (_f->_fld == NULL && _f->size[0] != 0)                 \
                     goto _errlbl;                                         \
@@ -129,7 +282,7 @@ static inline mrp_msg_field_t *create_field(uint16_t tag, va_list *ap)
                                                                           \
                 if (_base == MRP_MSG_FIELD_STRING) {                      \
                     for (_i = 0; _i < _f->size[0]; _i++) {                \
-                        _f->astr[_i] = mrp_strdup(_f->astr[_i]);          \
+                        _f->astr[_i] = field_strdup(msg, _f->astr[_i]);   \
                         if (_f->astr[_i] == NULL)                         \
                             goto _errlbl;                                 \
                     }                                                     \
@@ -144,7 +297,7 @@ static inline mrp_msg_field_t *create_field(uint16_t tag, va_list *ap)
     switch (type) {
     case MRP_MSG_FIELD_STRING:
         CREATE(f, tag, type, char *, str, str, fail);
-        f->str = mrp_strdup(f->str);
+        f->str = field_strdup(msg, f->str);
         if (f->str == NULL)
             goto fail;
         break;
@@ -185,7 +338,7 @@ static inline mrp_msg_field_t *create_field(uint16_t tag, va_list *ap)
 
         blb        = f->blb;
         f->size[0] = size;
-        f->blb     = mrp_allocz(size);
+        f->blb     = field_alloc(msg, size);
 
         if (f->blb != NULL) {
             memcpy(f->blb, blb, size);
@@ -247,7 +400,7 @@ static inline mrp_msg_field_t *create_field(uint16_t tag, va_list *ap)
     return f;
 
  fail:
-    destroy_field(f);
+    destroy_field(msg, f);
     return NULL;
 
 #undef CREATE
@@ -263,27 +416,38 @@ static void msg_destroy(mrp_msg_t *msg)
     if (msg != NULL) {
         mrp_list_foreach(&msg->fields, p, n) {
             f = mrp_list_entry(p, typeof(*f), hook);
-            destroy_field(f);
+            destroy_field(msg, f);
         }
 
+        if (msg->arena != NULL)          /* freed with the arena */
+            return;
+
+        mrp_free(msg->index);
+        mrp_free(msg->vowned);
         mrp_free(msg);
     }
 }
 
 
-mrp_msg_t *mrp_msg_createv(uint16_t tag, va_list ap)
+static mrp_msg_t *msg_createv(mrp_arena_t *arena, uint16_t tag, va_list ap)
 {
     mrp_msg_t       *msg;
     mrp_msg_field_t *f;
     va_list          aq;
 
+    if (arena != NULL)
+        msg = mrp_arena_allocz(arena, sizeof(*msg));
+    else
+        msg = mrp_allocz(sizeof(*msg));
+
     va_copy(aq, ap);
-    if ((msg = mrp_allocz(sizeof(*msg))) != NULL) {
+    if (msg != NULL) {
         mrp_list_init(&msg->fields);
         mrp_refcnt_init(&msg->refcnt);
+        msg->arena = arena;
 
         while (tag != MRP_MSG_FIELD_INVALID) {
-            f = create_field(tag, &aq);
+            f = create_field(msg, tag, &aq);
 
             if (f != NULL) {
                 mrp_list_append(&msg->fields, &f->hook);
@@ -304,6 +468,12 @@ mrp_msg_t *mrp_msg_createv(uint16_t tag, va_list ap)
 }
 
 
+mrp_msg_t *mrp_msg_createv(uint16_t tag, va_list ap)
+{
+    return msg_createv(NULL, tag, ap);
+}
+
+
 mrp_msg_t *mrp_msg_create(uint16_t tag, ...)
 {
     mrp_msg_t *msg;
@@ -317,6 +487,25 @@ mrp_msg_t *mrp_msg_create(uint16_t tag, ...)
 }
 
 
+mrp_msg_t *mrp_msg_createv_arena(mrp_arena_t *arena, uint16_t tag, va_list ap)
+{
+    return msg_createv(arena, tag, ap);
+}
+
+
+mrp_msg_t *mrp_msg_create_arena(mrp_arena_t *arena, uint16_t tag, ...)
+{
+    mrp_msg_t *msg;
+    va_list    ap;
+
+    va_start(ap, tag);
+    msg = msg_createv(arena, tag, ap);
+    va_end(ap);
+
+    return msg;
+}
+
+
 mrp_msg_t *mrp_msg_ref(mrp_msg_t *msg)
 {
     return mrp_ref_obj(msg, refcnt);
@@ -330,18 +519,37 @@ void mrp_msg_unref(mrp_msg_t *msg)
 }
 
 
+void mrp_msg_freeze(mrp_msg_t *msg)
+{
+    if (msg != NULL)
+        msg->frozen = TRUE;
+}
+
+
+int mrp_msg_frozen(mrp_msg_t *msg)
+{
+    return msg != NULL && msg->frozen;
+}
+
+
 int mrp_msg_append(mrp_msg_t *msg, uint16_t tag, ...)
 {
     mrp_msg_field_t *f;
     va_list          ap;
 
+    if (msg->frozen) {
+        errno = EPERM;
+        return FALSE;
+    }
+
     va_start(ap, tag);
-    f = create_field(tag, &ap);
+    f = create_field(msg, tag, &ap);
     va_end(ap);
 
     if (f != NULL) {
         mrp_list_append(&msg->fields, &f->hook);
         msg->nfield++;
+        index_add(msg, f, FALSE);
         return TRUE;
     }
     else
@@ -354,13 +562,19 @@ int mrp_msg_prepend(mrp_msg_t *msg, uint16_t tag, ...)
     mrp_msg_field_t *f;
     va_list          ap;
 
+    if (msg->frozen) {
+        errno = EPERM;
+        return FALSE;
+    }
+
     va_start(ap, tag);
-    f = create_field(tag, &ap);
+    f = create_field(msg, tag, &ap);
     va_end(ap);
 
     if (f != NULL) {
         mrp_list_prepend(&msg->fields, &f->hook);
         msg->nfield++;
+        index_add(msg, f, TRUE);
         return TRUE;
     }
     else
@@ -373,16 +587,25 @@ int mrp_msg_set(mrp_msg_t *msg, uint16_t tag, ...)
     mrp_msg_field_t *of, *nf;
     va_list          ap;
 
+    if (msg->frozen) {
+        errno = EPERM;
+        return FALSE;
+    }
+
     of = mrp_msg_find(msg, tag);
 
     if (of != NULL) {
         va_start(ap, tag);
-        nf = create_field(tag, &ap);
+        nf = create_field(msg, tag, &ap);
         va_end(ap);
 
         if (nf != NULL) {
             mrp_list_append(&of->hook, &nf->hook);
-            destroy_field(of);
+
+            if (msg->index != NULL)      /* of was the first one of tag */
+                *index_slot(msg, tag) = nf;
+
+            destroy_field(msg, of);
 
             return TRUE;
         }
@@ -461,6 +684,12 @@ mrp_msg_field_t *mrp_msg_find(mrp_msg_t *msg, uint16_t tag)
 {
     mrp_msg_field_t *f;
     mrp_list_hook_t *p, *n;
+    int              indexed;
+
+    f = index_find(msg, tag, &indexed);
+
+    if (indexed)
+        return f;
 
     mrp_list_foreach(&msg->fields, p, n) {
         f = mrp_list_entry(p, typeof(*f), hook);
@@ -494,7 +723,7 @@ int mrp_msg_get(mrp_msg_t *msg, ...)
     uint32_t        *cntp;
     mrp_list_hook_t *start, *p;
     uint16_t         tag, type;
-    int              found;
+    int              found, indexed;
     va_list          ap;
 
     va_start(ap, msg);
@@ -510,16 +739,27 @@ int mrp_msg_get(mrp_msg_t *msg, ...)
      * we end up running the outer and inner loops in a 'phase lock'.
      * So if the caller fetches the fields in the correct order we end
      * up scanning the message at most once but only up to the last
-     * field to fetch.
+     * field to fetch. If the message is indexed and has no repeated
+     * tags we simply start the scan at the field itself.
      */
 
     start = msg->fields.next;
     found = FALSE;
 
+    index_find(msg, MRP_MSG_FIELD_INVALID, &indexed);
+    indexed = indexed && !msg->idups;
+
     while ((tag = va_arg(ap, unsigned int)) != MRP_MSG_FIELD_INVALID) {
         type  = va_arg(ap, unsigned int);
         found = FALSE;
 
+        if (indexed) {
+            if ((f = *index_slot(msg, tag)) == NULL)
+                break;
+
+            start = &f->hook;
+        }
+
         for (p = start; p != start->prev; p = p->next) {
             if (p == &msg->fields)
                 continue;
@@ -929,381 +1169,1373 @@ int mrp_msg_dump(mrp_msg_t *msg, FILE *fp)
 
 #define MSG_MIN_CHUNK 32
 
-ssize_t mrp_msg_default_encode(mrp_msg_t *msg, void **bufp)
+/*
+ * default message encoder
+ *
+ * The encoder runs in two passes over the message. The first one only
+ * sizes the encoded message, the second one produces it. It can either
+ * produce a single flat buffer, or an I/O vector where the headers and
+ * small fields are collected into a scratch area while large strings and
+ * blobs are referenced directly from the message.
+ */
+
+typedef struct {
+    mrp_msg_iov_t *miov;                 /* I/O vector, or NULL if flat */
+    char          *p;                    /* write pointer, NULL if sizing */
+    char          *seg;                  /* start of current scratch segment */
+    size_t         size;                 /* total encoded size */
+    size_t         nscratch;             /* bytes in scratch area */
+    int            nref;                 /* number of in-place references */
+} encoder_t;
+
+
+static void encode_segment(encoder_t *e)
 {
-    mrp_msg_field_t *f;
-    mrp_list_hook_t *p, *n;
-    mrp_msgbuf_t     mb;
-    uint32_t         len, asize, i;
-    uint16_t         type;
-    size_t           size;
+    mrp_msg_iov_t *miov = e->miov;
 
-    size = msg->nfield * (2 * sizeof(uint16_t) + sizeof(uint64_t));
+    if (e->p > e->seg) {
+        miov->iov[miov->iovcnt].iov_base = e->seg;
+        miov->iov[miov->iovcnt].iov_len  = e->p - e->seg;
+        miov->iovcnt++;
+        e->seg = e->p;
+    }
+}
 
-    if (mrp_msgbuf_write(&mb, size)) {
-        MRP_MSGBUF_PUSH(&mb, htobe16(MRP_MSG_TAG_DEFAULT), 1, nomem);
-        MRP_MSGBUF_PUSH(&mb, htobe16(msg->nfield), 1, nomem);
 
-        mrp_list_foreach(&msg->fields, p, n) {
-            f = mrp_list_entry(p, typeof(*f), hook);
+static void encode_data(encoder_t *e, const void *data, size_t size, int ref)
+{
+    mrp_msg_iov_t *miov = e->miov;
 
-            MRP_MSGBUF_PUSH(&mb, htobe16(f->tag) , 1, nomem);
-            MRP_MSGBUF_PUSH(&mb, htobe16(f->type), 1, nomem);
+    /*
+     * Notes:
+     *     Every reference can take two vector entries: one for itself
+     *     and one for the scratch segment following it. The number of
+     *     references is limited accordingly, and the rest of the data
+     *     is copied. Since the decision only depends on the order and
+     *     the size of the data, it is the same during both passes.
+     */
 
-            switch (f->type) {
-            case MRP_MSG_FIELD_STRING:
-                len = strlen(f->str) + 1;
-                MRP_MSGBUF_PUSH(&mb, htobe32(len), 1, nomem);
-                MRP_MSGBUF_PUSH_DATA(&mb, f->str, len, 1, nomem);
-                break;
+    e->size += size;
 
-            case MRP_MSG_FIELD_BOOL:
-                MRP_MSGBUF_PUSH(&mb, htobe32(f->bln ? TRUE : FALSE), 1, nomem);
-                break;
+    if (miov != NULL && ref && size >= MRP_MSG_IOV_MINREF &&
+        e->nref < (MRP_MSG_IOV_MAX - 1) / 2) {
+        e->nref++;
 
-            case MRP_MSG_FIELD_UINT8:
-                MRP_MSGBUF_PUSH(&mb, f->u8, 1, nomem);
-                break;
+        if (e->p != NULL) {
+            encode_segment(e);
+            miov->iov[miov->iovcnt].iov_base = (void *)data;
+            miov->iov[miov->iovcnt].iov_len  = size;
+            miov->iovcnt++;
+        }
+    }
+    else {
+        e->nscratch += size;
 
-            case MRP_MSG_FIELD_SINT8:
-                MRP_MSGBUF_PUSH(&mb, f->s8, 1, nomem);
-                break;
+        if (e->p != NULL) {
+            memcpy(e->p, data, size);
+            e->p += size;
+        }
+    }
+}
 
-            case MRP_MSG_FIELD_UINT16:
-                MRP_MSGBUF_PUSH(&mb, htobe16(f->u16), 1, nomem);
-                break;
 
-            case MRP_MSG_FIELD_SINT16:
-                MRP_MSGBUF_PUSH(&mb, htobe16(f->s16), 1, nomem);
-                break;
+#define ENCODE(_e, _v) do {                                               \
+        typeof(_v) __v = (_v);                                            \
+        encode_data(_e, &__v, sizeof(__v), FALSE);                        \
+    } while (0)
 
-            case MRP_MSG_FIELD_UINT32:
-                MRP_MSGBUF_PUSH(&mb, htobe32(f->u32), 1, nomem);
-                break;
 
-            case MRP_MSG_FIELD_SINT32:
-                MRP_MSGBUF_PUSH(&mb, htobe32(f->s32), 1, nomem);
-                break;
+static int encode_fields(encoder_t *e, mrp_msg_t *msg)
+{
+    mrp_msg_field_t *f;
+    mrp_list_hook_t *p, *n;
+    uint32_t         len, asize, i;
+    uint16_t         type;
 
-            case MRP_MSG_FIELD_UINT64:
-                MRP_MSGBUF_PUSH(&mb, htobe64(f->u64), 1, nomem);
-                break;
+    ENCODE(e, htobe16(MRP_MSG_TAG_DEFAULT));
+    ENCODE(e, htobe16(msg->nfield));
 
-            case MRP_MSG_FIELD_SINT64:
-                MRP_MSGBUF_PUSH(&mb, htobe64(f->s64), 1, nomem);
-                break;
+    mrp_list_foreach(&msg->fields, p, n) {
+        f = mrp_list_entry(p, typeof(*f), hook);
 
-            case MRP_MSG_FIELD_DOUBLE:
-                MRP_MSGBUF_PUSH(&mb, f->dbl, 1, nomem);
-                break;
+        ENCODE(e, htobe16(f->tag));
+        ENCODE(e, htobe16(f->type));
 
-            case MRP_MSG_FIELD_BLOB:
-                len   = f->size[0];
-                MRP_MSGBUF_PUSH(&mb, htobe32(len), 1, nomem);
-                MRP_MSGBUF_PUSH_DATA(&mb, f->blb, len, 1, nomem);
-                break;
+        switch (f->type) {
+        case MRP_MSG_FIELD_STRING:
+            len = strlen(f->str) + 1;
+            ENCODE(e, htobe32(len));
+            encode_data(e, f->str, len, TRUE);
+            break;
 
-            default:
-                if (f->type & MRP_MSG_FIELD_ARRAY) {
-                    type  = f->type & ~(MRP_MSG_FIELD_ARRAY);
-                    asize = f->size[0];
-                    MRP_MSGBUF_PUSH(&mb, htobe32(asize), 1, nomem);
+        case MRP_MSG_FIELD_BOOL:
+            ENCODE(e, htobe32(f->bln ? TRUE : FALSE));
+            break;
 
-                    for (i = 0; i < asize; i++) {
-                        switch (type) {
-                        case MRP_MSG_FIELD_STRING:
-                            len = strlen(f->astr[i]) + 1;
-                            MRP_MSGBUF_PUSH(&mb, htobe32(len), 1, nomem);
-                            MRP_MSGBUF_PUSH_DATA(&mb, f->astr[i], len,
-                                                 1, nomem);
-                            break;
+        case MRP_MSG_FIELD_UINT8:
+            ENCODE(e, f->u8);
+            break;
 
-                        case MRP_MSG_FIELD_BOOL:
-                            MRP_MSGBUF_PUSH(&mb, htobe32(f->abln[i]?TRUE:FALSE),
-                                            1, nomem);
-                            break;
+        case MRP_MSG_FIELD_SINT8:
+            ENCODE(e, f->s8);
+            break;
 
-                        case MRP_MSG_FIELD_UINT8:
-                            MRP_MSGBUF_PUSH(&mb, f->au8[i], 1, nomem);
-                            break;
+        case MRP_MSG_FIELD_UINT16:
+            ENCODE(e, htobe16(f->u16));
+            break;
 
-                        case MRP_MSG_FIELD_SINT8:
-                            MRP_MSGBUF_PUSH(&mb, f->as8[i], 1, nomem);
-                            break;
+        case MRP_MSG_FIELD_SINT16:
+            ENCODE(e, htobe16(f->s16));
+            break;
 
-                        case MRP_MSG_FIELD_UINT16:
-                            MRP_MSGBUF_PUSH(&mb, htobe16(f->au16[i]), 1, nomem);
-                            break;
+        case MRP_MSG_FIELD_UINT32:
+            ENCODE(e, htobe32(f->u32));
+            break;
 
-                        case MRP_MSG_FIELD_SINT16:
-                            MRP_MSGBUF_PUSH(&mb, htobe16(f->as16[i]), 1, nomem);
-                            break;
+        case MRP_MSG_FIELD_SINT32:
+            ENCODE(e, htobe32(f->s32));
+            break;
 
-                        case MRP_MSG_FIELD_UINT32:
-                            MRP_MSGBUF_PUSH(&mb, htobe32(f->au32[i]), 1, nomem);
-                            break;
+        case MRP_MSG_FIELD_UINT64:
+            ENCODE(e, htobe64(f->u64));
+            break;
 
-                        case MRP_MSG_FIELD_SINT32:
-                            MRP_MSGBUF_PUSH(&mb, htobe32(f->as32[i]), 1, nomem);
-                            break;
+        case MRP_MSG_FIELD_SINT64:
+            ENCODE(e, htobe64(f->s64));
+            break;
 
-                        case MRP_MSG_FIELD_UINT64:
-                            MRP_MSGBUF_PUSH(&mb, htobe64(f->au64[i]), 1, nomem);
-                            break;
+        case MRP_MSG_FIELD_DOUBLE:
+            ENCODE(e, f->dbl);
+            break;
 
-                        case MRP_MSG_FIELD_SINT64:
-                            MRP_MSGBUF_PUSH(&mb, htobe64(f->as64[i]), 1, nomem);
-                            break;
+        case MRP_MSG_FIELD_BLOB:
+            len = f->size[0];
+            ENCODE(e, htobe32(len));
+            encode_data(e, f->blb, len, TRUE);
+            break;
 
-                        case MRP_MSG_FIELD_DOUBLE:
-                            MRP_MSGBUF_PUSH(&mb, f->adbl[i], 1, nomem);
-                            break;
+        default:
+            if (!(f->type & MRP_MSG_FIELD_ARRAY)) {
+            invalid_type:
+                errno = EINVAL;
+                return FALSE;
+            }
 
-                        default:
-                            goto invalid_type;
-                        }
-                    }
-                }
-                else {
-                invalid_type:
+            type  = f->type & ~(MRP_MSG_FIELD_ARRAY);
+            asize = f->size[0];
+            ENCODE(e, htobe32(asize));
+
+            for (i = 0; i < asize; i++) {
+                switch (type) {
+                case MRP_MSG_FIELD_STRING:
+                    len = strlen(f->astr[i]) + 1;
+                    ENCODE(e, htobe32(len));
+                    encode_data(e, f->astr[i], len, TRUE);
+                    break;
+
+                case MRP_MSG_FIELD_BOOL:
+                    ENCODE(e, htobe32(f->abln[i] ? TRUE : FALSE));
+                    break;
+
+                case MRP_MSG_FIELD_UINT8:
+                    ENCODE(e, f->au8[i]);
+                    break;
+
+                case MRP_MSG_FIELD_SINT8:
+                    ENCODE(e, f->as8[i]);
+                    break;
+
+                case MRP_MSG_FIELD_UINT16:
+                    ENCODE(e, htobe16(f->au16[i]));
+                    break;
+
+                case MRP_MSG_FIELD_SINT16:
+                    ENCODE(e, htobe16(f->as16[i]));
+                    break;
+
+                case MRP_MSG_FIELD_UINT32:
+                    ENCODE(e, htobe32(f->au32[i]));
+                    break;
+
+                case MRP_MSG_FIELD_SINT32:
+                    ENCODE(e, htobe32(f->as32[i]));
+                    break;
+
+                case MRP_MSG_FIELD_UINT64:
+                    ENCODE(e, htobe64(f->au64[i]));
+                    break;
+
+                case MRP_MSG_FIELD_SINT64:
+                    ENCODE(e, htobe64(f->as64[i]));
+                    break;
+
+                case MRP_MSG_FIELD_DOUBLE:
+                    ENCODE(e, f->adbl[i]);
+                    break;
+
+                default:
+                    goto invalid_type;
+                }
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+
+typedef int (*encode_pass_t)(encoder_t *e, mrp_msg_t *msg);
+
+
+static ssize_t encode_flat(mrp_msg_t *msg, encode_pass_t encode,
+                           void *(*alloc)(size_t size), void **bufp)
+{
+    encoder_t  e;
+    char      *buf;
+
+    *bufp = NULL;
+
+    mrp_clear(&e);
+
+    if (!encode(&e, msg))
+        return -1;
+
+    if ((buf = alloc(e.size)) == NULL)
+        return -1;
+
+    mrp_clear(&e);
+    e.p = buf;
+
+    encode(&e, msg);
+
+    *bufp = buf;
+    return e.size;
+}
+
+
+static ssize_t encode_iov(mrp_msg_t *msg, encode_pass_t encode,
+                          mrp_msg_iov_t *miov)
+{
+    encoder_t e;
+
+    miov->iovcnt  = 1;
+    miov->size    = 0;
+    miov->scratch = NULL;
+
+    mrp_clear(&e);
+    e.miov = miov;
+
+    if (!encode(&e, msg))
+        return -1;
+
+    if (e.nscratch <= sizeof(miov->inl))
+        miov->scratch = miov->inl;
+    else {
+        if ((miov->scratch = mrp_alloc(e.nscratch)) == NULL)
+            return -1;
+    }
+
+    mrp_clear(&e);
+    e.miov = miov;
+    e.p    = e.seg = miov->scratch;
+
+    encode(&e, msg);
+    encode_segment(&e);
+
+    miov->size = e.size;
+
+    return e.size;
+}
+
+
+static void *default_alloc(size_t size)
+{
+    return mrp_alloc(size);
+}
+
+
+ssize_t mrp_msg_default_encode(mrp_msg_t *msg, void **bufp)
+{
+    return encode_flat(msg, encode_fields, default_alloc, bufp);
+}
+
+
+ssize_t mrp_msg_default_encode_alloc(mrp_msg_t *msg,
+                                     void *(*alloc)(size_t size), void **bufp)
+{
+    return encode_flat(msg, encode_fields, alloc, bufp);
+}
+
+
+ssize_t mrp_msg_default_encode_iov(mrp_msg_t *msg, mrp_msg_iov_t *miov)
+{
+    return encode_iov(msg, encode_fields, miov);
+}
+
+
+/*
+ * compact message encoder
+ *
+ * An alternative to the default encoding for messages dominated by small
+ * integers and short strings, such as those of the resource protocol.
+ * Field tags, types, lengths and array sizes are encoded as base-128
+ * varints, unsigned integers as varints, signed ones as zigzag varints
+ * and booleans as a single byte. Array items are packed back to back.
+ * Compact messages are tagged with MRP_MSG_TAG_COMPACT instead of
+ * MRP_MSG_TAG_DEFAULT, so a receiver can always tell the two apart.
+ */
+
+#define VARINT_MAX 10                    /* max. bytes of a 64-bit varint */
+
+#define ZIGZAG(v)   (((uint64_t)(v) << 1) ^ (uint64_t)((int64_t)(v) >> 63))
+#define UNZIGZAG(v) ((int64_t)((v) >> 1) ^ -(int64_t)((v) & 1))
+
+static size_t scalar_size(uint16_t type);
+
+
+static void encode_varint(encoder_t *e, uint64_t v)
+{
+    uint8_t *p;
+    int      n;
+
+    /* varints are never referenced, so write them to scratch directly */
+    if (e->p == NULL) {
+        for (n = 1; v >= 0x80; v >>= 7)
+            n++;
+    }
+    else {
+        p = (uint8_t *)e->p;
+
+        for (n = 0; v >= 0x80; v >>= 7)
+            p[n++] = (uint8_t)(v | 0x80);
+        p[n++] = (uint8_t)v;
+
+        e->p += n;
+    }
+
+    e->size     += n;
+    e->nscratch += n;
+}
+
+
+static int encode_compact_value(encoder_t *e, uint16_t type, const void *ptr)
+{
+    const mrp_msg_value_t *v = ptr;
+    uint32_t               len;
+
+    switch (type) {
+    case MRP_MSG_FIELD_STRING:
+        len = strlen(v->str) + 1;
+        encode_varint(e, len);
+        encode_data(e, v->str, len, TRUE);
+        break;
+
+    case MRP_MSG_FIELD_BOOL:
+        ENCODE(e, (uint8_t)(v->bln ? TRUE : FALSE));
+        break;
+
+    case MRP_MSG_FIELD_UINT8:  ENCODE(e, v->u8);                   break;
+    case MRP_MSG_FIELD_SINT8:  ENCODE(e, v->s8);                   break;
+    case MRP_MSG_FIELD_UINT16: encode_varint(e, v->u16);           break;
+    case MRP_MSG_FIELD_SINT16: encode_varint(e, ZIGZAG(v->s16));   break;
+    case MRP_MSG_FIELD_UINT32: encode_varint(e, v->u32);           break;
+    case MRP_MSG_FIELD_SINT32: encode_varint(e, ZIGZAG(v->s32));   break;
+    case MRP_MSG_FIELD_UINT64: encode_varint(e, v->u64);           break;
+    case MRP_MSG_FIELD_SINT64: encode_varint(e, ZIGZAG(v->s64));   break;
+    case MRP_MSG_FIELD_DOUBLE: ENCODE(e, v->dbl);                  break;
+
+    default:
+        errno = EINVAL;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static int encode_compact(encoder_t *e, mrp_msg_t *msg)
+{
+    mrp_msg_field_t *f;
+    mrp_list_hook_t *p, *n;
+    uint32_t         i;
+    uint16_t         type;
+    size_t           size;
+
+    ENCODE(e, htobe16(MRP_MSG_TAG_COMPACT));
+    encode_varint(e, msg->nfield);
+
+    mrp_list_foreach(&msg->fields, p, n) {
+        f = mrp_list_entry(p, typeof(*f), hook);
+
+        encode_varint(e, f->tag);
+        encode_varint(e, f->type);
+
+        switch (f->type) {
+        case MRP_MSG_FIELD_BLOB:
+            encode_varint(e, f->size[0]);
+            encode_data(e, f->blb, f->size[0], TRUE);
+            break;
+
+        default:
+            if (!(f->type & MRP_MSG_FIELD_ARRAY)) {
+                if (!encode_compact_value(e, f->type, &f->str))
+                    return FALSE;
+                break;
+            }
+
+            type = f->type & ~(MRP_MSG_FIELD_ARRAY);
+
+            switch (type) {
+            case MRP_MSG_FIELD_STRING: size = sizeof(f->astr[0]); break;
+            case MRP_MSG_FIELD_BOOL:   size = sizeof(f->abln[0]); break;
+            default:                   size = scalar_size(type);  break;
+            }
+
+            if (size == 0) {
+                errno = EINVAL;
+                return FALSE;
+            }
+
+            encode_varint(e, f->size[0]);
+
+            for (i = 0; i < f->size[0]; i++)
+                encode_compact_value(e, type, (char *)f->aany + i * size);
+        }
+    }
+
+    return TRUE;
+}
+
+
+ssize_t mrp_msg_compact_encode(mrp_msg_t *msg, void **bufp)
+{
+    return encode_flat(msg, encode_compact, default_alloc, bufp);
+}
+
+
+ssize_t mrp_msg_compact_encode_iov(mrp_msg_t *msg, mrp_msg_iov_t *miov)
+{
+    return encode_iov(msg, encode_compact, miov);
+}
+
+
+void mrp_msg_iov_release(mrp_msg_iov_t *miov)
+{
+    if (miov->scratch != miov->inl)
+        mrp_free(miov->scratch);
+
+    miov->scratch = NULL;
+    miov->iovcnt  = 0;
+    miov->size    = 0;
+}
+
+
+/*
+ * pre-encoded message templates
+ */
+
+typedef struct {
+    uint16_t tag;                        /* field tag */
+    uint16_t type;                       /* field type */
+    size_t   offs;                       /* value offset in encoded data */
+} tmpl_field_t;
+
+struct mrp_msg_tmpl_s {
+    void         *data;                  /* encoded message */
+    size_t        size;                  /* encoded size */
+    tmpl_field_t *fields;                /* patchable fields */
+    int           nfield;                /* number of patchable fields */
+};
+
+
+static size_t scalar_size(uint16_t type)
+{
+    switch (type) {
+    case MRP_MSG_FIELD_BOOL:   return sizeof(uint32_t);
+    case MRP_MSG_FIELD_UINT8:
+    case MRP_MSG_FIELD_SINT8:  return sizeof(uint8_t);
+    case MRP_MSG_FIELD_UINT16:
+    case MRP_MSG_FIELD_SINT16: return sizeof(uint16_t);
+    case MRP_MSG_FIELD_UINT32:
+    case MRP_MSG_FIELD_SINT32: return sizeof(uint32_t);
+    case MRP_MSG_FIELD_UINT64:
+    case MRP_MSG_FIELD_SINT64: return sizeof(uint64_t);
+    case MRP_MSG_FIELD_DOUBLE: return sizeof(double);
+    default:                   return 0;
+    }
+}
+
+
+static size_t encoded_size(mrp_msg_field_t *f)
+{
+    uint16_t type;
+    size_t   size;
+    uint32_t i;
+
+    switch (f->type) {
+    case MRP_MSG_FIELD_STRING:
+        return sizeof(uint32_t) + strlen(f->str) + 1;
+
+    case MRP_MSG_FIELD_BLOB:
+        return sizeof(uint32_t) + f->size[0];
+
+    default:
+        if (!(f->type & MRP_MSG_FIELD_ARRAY))
+            return scalar_size(f->type);
+
+        type = f->type & ~(MRP_MSG_FIELD_ARRAY);
+        size = sizeof(uint32_t);
+
+        if (type == MRP_MSG_FIELD_STRING) {
+            for (i = 0; i < f->size[0]; i++)
+                size += sizeof(uint32_t) + strlen(f->astr[i]) + 1;
+        }
+        else
+            size += f->size[0] * scalar_size(type);
+
+        return size;
+    }
+}
+
+
+mrp_msg_tmpl_t *mrp_msg_tmpl_create(mrp_msg_t *msg)
+{
+    mrp_msg_tmpl_t  *tmpl;
+    mrp_msg_field_t *f;
+    mrp_list_hook_t *p, *n;
+    ssize_t          size;
+    size_t           offs;
+
+    if ((tmpl = mrp_allocz(sizeof(*tmpl))) == NULL)
+        return NULL;
+
+    if ((size = mrp_msg_default_encode(msg, &tmpl->data)) < 0)
+        goto fail;
+
+    tmpl->size   = (size_t)size;
+    tmpl->fields = mrp_allocz_array(tmpl_field_t, msg->nfield);
+
+    if (tmpl->fields == NULL && msg->nfield > 0)
+        goto fail;
+
+    offs = 2 * sizeof(uint16_t);
+
+    mrp_list_foreach(&msg->fields, p, n) {
+        f     = mrp_list_entry(p, typeof(*f), hook);
+        offs += 2 * sizeof(uint16_t);
+
+        if (scalar_size(f->type) > 0) {
+            tmpl->fields[tmpl->nfield].tag  = f->tag;
+            tmpl->fields[tmpl->nfield].type = f->type;
+            tmpl->fields[tmpl->nfield].offs = offs;
+            tmpl->nfield++;
+        }
+
+        offs += encoded_size(f);
+    }
+
+    if (offs != tmpl->size) {
+        errno = EINVAL;
+        goto fail;
+    }
+
+    return tmpl;
+
+ fail:
+    mrp_msg_tmpl_destroy(tmpl);
+    return NULL;
+}
+
+
+void mrp_msg_tmpl_destroy(mrp_msg_tmpl_t *tmpl)
+{
+    if (tmpl != NULL) {
+        mrp_free(tmpl->data);
+        mrp_free(tmpl->fields);
+        mrp_free(tmpl);
+    }
+}
+
+
+int mrp_msg_tmpl_set(mrp_msg_tmpl_t *tmpl, uint16_t tag, uint16_t type, ...)
+{
+    tmpl_field_t *f;
+    void         *v;
+    va_list       ap;
+    uint8_t       u8;
+    uint16_t      u16;
+    uint32_t      u32;
+    uint64_t      u64;
+    double        dbl;
+    int           i;
+
+    for (i = 0, f = tmpl->fields; i < tmpl->nfield; i++, f++)
+        if (f->tag == tag && f->type == type)
+            break;
+
+    if (i >= tmpl->nfield) {
+        errno = ENOENT;
+        return FALSE;
+    }
+
+    v = tmpl->data + f->offs;
+
+    va_start(ap, type);
+
+    switch (type) {
+    case MRP_MSG_FIELD_BOOL:
+        u32 = htobe32(va_arg(ap, int) ? TRUE : FALSE);
+        memcpy(v, &u32, sizeof(u32));
+        break;
+    case MRP_MSG_FIELD_UINT8:
+    case MRP_MSG_FIELD_SINT8:
+        u8 = (uint8_t)va_arg(ap, unsigned int);
+        memcpy(v, &u8, sizeof(u8));
+        break;
+    case MRP_MSG_FIELD_UINT16:
+    case MRP_MSG_FIELD_SINT16:
+        u16 = htobe16((uint16_t)va_arg(ap, unsigned int));
+        memcpy(v, &u16, sizeof(u16));
+        break;
+    case MRP_MSG_FIELD_UINT32:
+    case MRP_MSG_FIELD_SINT32:
+        u32 = htobe32((uint32_t)va_arg(ap, unsigned int));
+        memcpy(v, &u32, sizeof(u32));
+        break;
+    case MRP_MSG_FIELD_UINT64:
+    case MRP_MSG_FIELD_SINT64:
+        u64 = htobe64(va_arg(ap, uint64_t));
+        memcpy(v, &u64, sizeof(u64));
+        break;
+    case MRP_MSG_FIELD_DOUBLE:
+        dbl = va_arg(ap, double);
+        memcpy(v, &dbl, sizeof(dbl));
+        break;
+    }
+
+    va_end(ap);
+
+    return TRUE;
+}
+
+
+void *mrp_msg_tmpl_data(mrp_msg_tmpl_t *tmpl, size_t *sizep)
+{
+    *sizep = tmpl->size;
+
+    return tmpl->data;
+}
+
+
+mrp_msg_t *mrp_msg_default_decode(void *buf, size_t size)
+{
+    mrp_msg_t       *msg;
+    mrp_msgbuf_t     mb;
+    mrp_msg_value_t  v;
+    void            *value;
+    uint16_t         nfield, tag, type, base;
+    uint32_t         len, n, i, j;
+
+    msg = mrp_msg_create_empty();
+
+    if (msg == NULL)
+        return NULL;
+
+    mrp_msgbuf_read(&mb, buf, size);
+
+    nfield = be16toh(MRP_MSGBUF_PULL(&mb, typeof(nfield), 1, nodata));
+
+    for (i = 0; i < nfield; i++) {
+        tag  = be16toh(MRP_MSGBUF_PULL(&mb, typeof(tag) , 1, nodata));
+        type = be16toh(MRP_MSGBUF_PULL(&mb, typeof(type), 1, nodata));
+
+        switch (type) {
+        case MRP_MSG_FIELD_STRING:
+            len = be32toh(MRP_MSGBUF_PULL(&mb, typeof(len), 1, nodata));
+            if (len > 0)
+                value = MRP_MSGBUF_PULL_DATA(&mb, len, 1, nodata);
+            else
+                value = "";
+            if (!mrp_msg_append(msg, tag, type, value))
+                goto fail;
+            break;
+
+        case MRP_MSG_FIELD_BOOL:
+            v.bln = be32toh(MRP_MSGBUF_PULL(&mb, uint32_t, 1, nodata));
+            if (!mrp_msg_append(msg, tag, type, v.bln))
+                goto fail;
+            break;
+
+        case MRP_MSG_FIELD_UINT8:
+            v.u8 = MRP_MSGBUF_PULL(&mb, typeof(v.u8), 1, nodata);
+            if (!mrp_msg_append(msg, tag, type, v.u8))
+                goto fail;
+            break;
+
+        case MRP_MSG_FIELD_SINT8:
+            v.s8 = MRP_MSGBUF_PULL(&mb, typeof(v.s8), 1, nodata);
+            if (!mrp_msg_append(msg, tag, type, v.s8))
+                goto fail;
+            break;
+
+        case MRP_MSG_FIELD_UINT16:
+            v.u16 = be16toh(MRP_MSGBUF_PULL(&mb, typeof(v.u16), 1, nodata));
+            if (!mrp_msg_append(msg, tag, type, v.u16))
+                goto fail;
+            break;
+
+        case MRP_MSG_FIELD_SINT16:
+            v.s16 = be16toh(MRP_MSGBUF_PULL(&mb, typeof(v.s16), 1, nodata));
+            if (!mrp_msg_append(msg, tag, type, v.s16))
+                goto fail;
+            break;
+
+        case MRP_MSG_FIELD_UINT32:
+            v.u32 = be32toh(MRP_MSGBUF_PULL(&mb, typeof(v.u32), 1, nodata));
+            if (!mrp_msg_append(msg, tag, type, v.u32))
+                goto fail;
+            break;
+
+        case MRP_MSG_FIELD_SINT32:
+            v.s32 = be32toh(MRP_MSGBUF_PULL(&mb, typeof(v.s32), 1, nodata));
+            if (!mrp_msg_append(msg, tag, type, v.s32))
+                goto fail;
+            break;
+
+        case MRP_MSG_FIELD_UINT64:
+            v.u64 = be64toh(MRP_MSGBUF_PULL(&mb, typeof(v.u64), 1, nodata));
+            if (!mrp_msg_append(msg, tag, type, v.u64))
+                goto fail;
+            break;
+
+        case MRP_MSG_FIELD_SINT64:
+            v.s64 = be64toh(MRP_MSGBUF_PULL(&mb, typeof(v.s64), 1, nodata));
+            if (!mrp_msg_append(msg, tag, type, v.s64))
+                goto fail;
+            break;
+
+        case MRP_MSG_FIELD_DOUBLE:
+            v.dbl = MRP_MSGBUF_PULL(&mb, typeof(v.dbl), 1, nodata);
+            if (!mrp_msg_append(msg, tag, type, v.dbl))
+                goto fail;
+            break;
+
+        case MRP_MSG_FIELD_BLOB:
+            len   = be32toh(MRP_MSGBUF_PULL(&mb, typeof(len), 1, nodata));
+            value = MRP_MSGBUF_PULL_DATA(&mb, len, 1, nodata);
+            if (!mrp_msg_append(msg, tag, type, len, value))
+                goto fail;
+            break;
+
+        default:
+            if (!(type & MRP_MSG_FIELD_ARRAY)) {
+                errno = EINVAL;
+                goto fail;
+            }
+
+            base  = type & ~MRP_MSG_FIELD_ARRAY;
+            n     = be32toh(MRP_MSGBUF_PULL(&mb, typeof(n), 1, nodata));
+            {
+                char    *astr[n];
+                bool     abln[n];
+                uint8_t  au8 [n];
+                int8_t   as8 [n];
+                uint16_t au16[n];
+                int16_t  as16[n];
+                uint32_t au32[n];
+                int32_t  as32[n];
+                uint64_t au64[n];
+                int64_t  as64[n];
+                double   adbl[n];
+
+                for (j = 0; j < n; j++) {
+
+                    switch (base) {
+                    case MRP_MSG_FIELD_STRING:
+                        len = be32toh(MRP_MSGBUF_PULL(&mb, typeof(len),
+                                                      1, nodata));
+                        if (len > 0)
+                            astr[j] = MRP_MSGBUF_PULL_DATA(&mb, len, 1, nodata);
+                        else
+                            astr[j] = "";
+                        break;
+
+                    case MRP_MSG_FIELD_BOOL:
+                        abln[j] = be32toh(MRP_MSGBUF_PULL(&mb, uint32_t, 1,
+                                                          nodata));
+                        break;
+
+                    case MRP_MSG_FIELD_UINT8:
+                        au8[j] = MRP_MSGBUF_PULL(&mb, typeof(v.u8), 1, nodata);
+                        break;
+
+                    case MRP_MSG_FIELD_SINT8:
+                        as8[j] = MRP_MSGBUF_PULL(&mb, typeof(v.s8), 1, nodata);
+                        break;
+
+                    case MRP_MSG_FIELD_UINT16:
+                        au16[j] = be16toh(MRP_MSGBUF_PULL(&mb, typeof(v.u16),
+                                                          1, nodata));
+                        break;
+
+                    case MRP_MSG_FIELD_SINT16:
+                        as16[j] = be16toh(MRP_MSGBUF_PULL(&mb, typeof(v.s16),
+                                                          1, nodata));
+                        break;
+
+                    case MRP_MSG_FIELD_UINT32:
+                        au32[j] = be32toh(MRP_MSGBUF_PULL(&mb, typeof(v.u32),
+                                                          1, nodata));
+                        break;
+
+                    case MRP_MSG_FIELD_SINT32:
+                        as32[j] = be32toh(MRP_MSGBUF_PULL(&mb, typeof(v.s32),
+                                                          1, nodata));
+                        break;
+
+                    case MRP_MSG_FIELD_UINT64:
+                        au64[j] = be64toh(MRP_MSGBUF_PULL(&mb, typeof(v.u64),
+                                                          1, nodata));
+                        break;
+
+                    case MRP_MSG_FIELD_SINT64:
+                        as64[j] = be64toh(MRP_MSGBUF_PULL(&mb, typeof(v.s64),
+                                                          1, nodata));
+                        break;
+
+                    case MRP_MSG_FIELD_DOUBLE:
+                        adbl[j] = MRP_MSGBUF_PULL(&mb, typeof(v.dbl),
+                                                  1, nodata);
+                    break;
+
+                    default:
+                        errno = EINVAL;
+                        goto fail;
+                    }
+                }
+
+#define HANDLE_TYPE(_type, _var)                                          \
+                case _type:                                               \
+                    if (!mrp_msg_append(msg, tag,                         \
+                                        MRP_MSG_FIELD_ARRAY |_type,       \
+                                        n, _var))                         \
+                        goto fail;                                        \
+                    break
+
+                switch (base) {
+                    HANDLE_TYPE(MRP_MSG_FIELD_STRING, astr);
+                    HANDLE_TYPE(MRP_MSG_FIELD_BOOL  , abln);
+                    HANDLE_TYPE(MRP_MSG_FIELD_UINT8 , au8 );
+                    HANDLE_TYPE(MRP_MSG_FIELD_SINT8 , as8 );
+                    HANDLE_TYPE(MRP_MSG_FIELD_UINT16, au16);
+                    HANDLE_TYPE(MRP_MSG_FIELD_SINT16, as16);
+                    HANDLE_TYPE(MRP_MSG_FIELD_UINT32, au32);
+                    HANDLE_TYPE(MRP_MSG_FIELD_SINT32, as32);
+                    HANDLE_TYPE(MRP_MSG_FIELD_UINT64, au64);
+                    HANDLE_TYPE(MRP_MSG_FIELD_SINT64, as64);
+                    HANDLE_TYPE(MRP_MSG_FIELD_DOUBLE, adbl);
+                default:
                     errno = EINVAL;
-                    mrp_msgbuf_cancel(&mb);
-                nomem:
-                    *bufp = NULL;
-                    return -1;
+                    goto fail;
                 }
+#undef HANDLE_TYPE
+            }
+        }
+    }
+
+    return msg;
+
+
+ fail:
+ nodata:
+    mrp_msg_unref(msg);
+    return NULL;
+}
+
+
+/*
+ * compact message decoder
+ */
+
+static int pull_varint(mrp_msgbuf_t *mb, uint64_t *vp)
+{
+    uint8_t  *p = mb->p;
+    uint64_t  v;
+    size_t    i;
+
+    for (i = 0, v = 0; i < VARINT_MAX && i < mb->l; i++) {
+        v |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+
+        if (!(p[i] & 0x80)) {
+            mb->p += i + 1;
+            mb->l -= i + 1;
+            *vp    = v;
+
+            return TRUE;
+        }
+    }
+
+    errno = EINVAL;
+    return FALSE;
+}
+
+
+static int decode_compact_value(mrp_msgbuf_t *mb, uint16_t type, void *ptr)
+{
+    mrp_msg_value_t *v = ptr;
+    uint64_t         u;
+    int64_t          s;
+    char            *str;
+
+    switch (type) {
+    case MRP_MSG_FIELD_STRING:
+        if (!pull_varint(mb, &u) || u == 0 || u > mb->l)
+            goto invalid;
+        str = MRP_MSGBUF_PULL_DATA(mb, u, 1, nodata);
+        if (str[u - 1] != '\0')
+            goto invalid;
+        v->str = str;
+        return TRUE;
+
+    case MRP_MSG_FIELD_BOOL:
+        v->bln = MRP_MSGBUF_PULL(mb, uint8_t, 1, nodata) ? TRUE : FALSE;
+        return TRUE;
+
+    case MRP_MSG_FIELD_UINT8:
+        v->u8 = MRP_MSGBUF_PULL(mb, typeof(v->u8), 1, nodata);
+        return TRUE;
+
+    case MRP_MSG_FIELD_SINT8:
+        v->s8 = MRP_MSGBUF_PULL(mb, typeof(v->s8), 1, nodata);
+        return TRUE;
+
+    case MRP_MSG_FIELD_DOUBLE:
+        v->dbl = MRP_MSGBUF_PULL(mb, typeof(v->dbl), 1, nodata);
+        return TRUE;
+
+    default:
+        break;
+    }
+
+    if (!pull_varint(mb, &u))
+        return FALSE;
+
+    s = UNZIGZAG(u);
+
+    switch (type) {
+    case MRP_MSG_FIELD_UINT16:
+        if (u > UINT16_MAX)
+            goto invalid;
+        v->u16 = u;
+        break;
+    case MRP_MSG_FIELD_SINT16:
+        if (s < INT16_MIN || s > INT16_MAX)
+            goto invalid;
+        v->s16 = s;
+        break;
+    case MRP_MSG_FIELD_UINT32:
+        if (u > UINT32_MAX)
+            goto invalid;
+        v->u32 = u;
+        break;
+    case MRP_MSG_FIELD_SINT32:
+        if (s < INT32_MIN || s > INT32_MAX)
+            goto invalid;
+        v->s32 = s;
+        break;
+    case MRP_MSG_FIELD_UINT64:
+        v->u64 = u;
+        break;
+    case MRP_MSG_FIELD_SINT64:
+        v->s64 = s;
+        break;
+    default:
+        goto invalid;
+    }
+
+    return TRUE;
+
+ invalid:
+    errno = EINVAL;
+ nodata:
+    return FALSE;
+}
+
+
+mrp_msg_t *mrp_msg_compact_decode(void *buf, size_t size)
+{
+    mrp_msg_t       *msg;
+    mrp_msg_field_t *f;
+    mrp_msgbuf_t     mb;
+    uint64_t         nfield, tag, type, n;
+    uint16_t         base;
+    size_t           isize;
+    uint64_t         i, j;
+    void            *value;
+
+    msg = mrp_msg_create_empty();
+
+    if (msg == NULL)
+        return NULL;
+
+    mrp_msgbuf_read(&mb, buf, size);
+
+    if (!pull_varint(&mb, &nfield))
+        goto fail;
+
+    for (i = 0; i < nfield; i++) {
+        if (!pull_varint(&mb, &tag) || tag > UINT16_MAX ||
+            !pull_varint(&mb, &type) || type > UINT16_MAX)
+            goto invalid;
+
+        f = mrp_allocz(MRP_OFFSET(typeof(*f), size[1]));
+
+        if (f == NULL)
+            goto fail;
+
+        /*
+         * Notes:
+         *     The field is linked to the message right away, so on errors
+         *     it gets freed together with the message. Anything not yet
+         *     decoded is NULL, which destroy_field copes with.
+         */
+
+        mrp_list_init(&f->hook);
+        f->tag  = tag;
+        f->type = type;
+        mrp_list_append(&msg->fields, &f->hook);
+        msg->nfield++;
+
+        switch (type) {
+        case MRP_MSG_FIELD_BLOB:
+            if (!pull_varint(&mb, &n) || n > mb.l)
+                goto invalid;
+            value      = MRP_MSGBUF_PULL_DATA(&mb, n, 1, nodata);
+            f->size[0] = n;
+            if ((f->blb = mrp_alloc(n)) == NULL && n > 0)
+                goto fail;
+            memcpy(f->blb, value, n);
+            break;
+
+        case MRP_MSG_FIELD_STRING:
+            if (!decode_compact_value(&mb, type, &f->str))
+                goto fail;
+            if ((f->str = mrp_strdup(f->str)) == NULL)
+                goto fail;
+            break;
+
+        default:
+            if (!(type & MRP_MSG_FIELD_ARRAY)) {
+                if (!decode_compact_value(&mb, type, &f->str))
+                    goto fail;
+                break;
+            }
+
+            base = type & ~MRP_MSG_FIELD_ARRAY;
+
+            switch (base) {
+            case MRP_MSG_FIELD_STRING: isize = sizeof(f->astr[0]); break;
+            case MRP_MSG_FIELD_BOOL:   isize = sizeof(f->abln[0]); break;
+            default:                   isize = scalar_size(base);  break;
+            }
+
+            /* every item takes at least a byte, bound the size by that */
+            if (isize == 0 || !pull_varint(&mb, &n) || n > mb.l)
+                goto invalid;
+
+            f->size[0] = n;
+
+            if (n > 0 && (f->aany = mrp_allocz(n * isize)) == NULL)
+                goto fail;
+
+            for (j = 0; j < n; j++) {
+                value = (char *)f->aany + j * isize;
+
+                if (!decode_compact_value(&mb, base, value))
+                    goto fail;
+
+                if (base == MRP_MSG_FIELD_STRING &&
+                    (f->astr[j] = mrp_strdup(f->astr[j])) == NULL)
+                    goto fail;
             }
         }
     }
 
-    *bufp = mb.buf;
-    return mb.p - mb.buf;
+    return msg;
+
+ invalid:
+    errno = EINVAL;
+ fail:
+ nodata:
+    mrp_msg_unref(msg);
+    return NULL;
 }
 
 
-mrp_msg_t *mrp_msg_default_decode(void *buf, size_t size)
+/*
+ * zero-copy message decoding
+ *
+ * A message view is decoded in two passes. The first one validates the
+ * buffer and calculates the amount of memory needed for the fields and
+ * arrays, the second one fills them in. The message, its fields and its
+ * arrays live in a single allocation. Strings, blobs and byte arrays point
+ * directly into the decoded buffer, other arrays are converted to host
+ * byte order into the array area of the allocation.
+ */
+
+#define VIEW_ASIS(v) (v)
+
+static int view_decode(void *buf, size_t size, mrp_msg_t *msg, char *arena,
+                       uint16_t *nfieldp, size_t *asizep)
 {
-    mrp_msg_t       *msg;
     mrp_msgbuf_t     mb;
-    mrp_msg_value_t  v;
-    void            *value;
-    uint16_t         nfield, tag, type, base;
+    mrp_msg_field_t *f;
+    uint64_t         scratch[VIEW_FIELD_SIZE / sizeof(uint64_t)];
+    uint16_t         nfield, base;
     uint32_t         len, n, i, j;
+    size_t           asize, esize;
+    char            *str;
 
-    msg = mrp_msg_create_empty();
-
-    if (msg == NULL)
-        return NULL;
+#define PULL_ELEM(_fld, _type, _conv) do {                                \
+        _type _v = _conv(MRP_MSGBUF_PULL(&mb, _type, 1, nodata));         \
+                                                                          \
+        if (arena != NULL)                                                \
+            f->_fld[j] = _v;                                              \
+    } while (0)
 
     mrp_msgbuf_read(&mb, buf, size);
 
     nfield = be16toh(MRP_MSGBUF_PULL(&mb, typeof(nfield), 1, nodata));
+    asize  = 0;
 
     for (i = 0; i < nfield; i++) {
-        tag  = be16toh(MRP_MSGBUF_PULL(&mb, typeof(tag) , 1, nodata));
-        type = be16toh(MRP_MSGBUF_PULL(&mb, typeof(type), 1, nodata));
+        if (msg != NULL)
+            f = VIEW_FIELD(msg, i);
+        else
+            f = (mrp_msg_field_t *)scratch;
 
-        switch (type) {
+        f->tag  = be16toh(MRP_MSGBUF_PULL(&mb, typeof(f->tag) , 1, nodata));
+        f->type = be16toh(MRP_MSGBUF_PULL(&mb, typeof(f->type), 1, nodata));
+
+        switch (f->type) {
         case MRP_MSG_FIELD_STRING:
             len = be32toh(MRP_MSGBUF_PULL(&mb, typeof(len), 1, nodata));
-            if (len > 0)
-                value = MRP_MSGBUF_PULL_DATA(&mb, len, 1, nodata);
+            if (len > 0) {
+                f->str = MRP_MSGBUF_PULL_DATA(&mb, len, 1, nodata);
+                if (f->str[len - 1] != '\0')
+                    goto invalid;
+            }
             else
-                value = "";
-            if (!mrp_msg_append(msg, tag, type, value))
-                goto fail;
+                f->str = "";
             break;
 
         case MRP_MSG_FIELD_BOOL:
-            v.bln = be32toh(MRP_MSGBUF_PULL(&mb, uint32_t, 1, nodata));
-            if (!mrp_msg_append(msg, tag, type, v.bln))
-                goto fail;
+            f->bln = be32toh(MRP_MSGBUF_PULL(&mb, uint32_t, 1, nodata));
             break;
-
         case MRP_MSG_FIELD_UINT8:
-            v.u8 = MRP_MSGBUF_PULL(&mb, typeof(v.u8), 1, nodata);
-            if (!mrp_msg_append(msg, tag, type, v.u8))
-                goto fail;
+            f->u8 = MRP_MSGBUF_PULL(&mb, typeof(f->u8), 1, nodata);
             break;
-
         case MRP_MSG_FIELD_SINT8:
-            v.s8 = MRP_MSGBUF_PULL(&mb, typeof(v.s8), 1, nodata);
-            if (!mrp_msg_append(msg, tag, type, v.s8))
-                goto fail;
+            f->s8 = MRP_MSGBUF_PULL(&mb, typeof(f->s8), 1, nodata);
             break;
-
         case MRP_MSG_FIELD_UINT16:
-            v.u16 = be16toh(MRP_MSGBUF_PULL(&mb, typeof(v.u16), 1, nodata));
-            if (!mrp_msg_append(msg, tag, type, v.u16))
-                goto fail;
+            f->u16 = be16toh(MRP_MSGBUF_PULL(&mb, typeof(f->u16), 1, nodata));
             break;
-
         case MRP_MSG_FIELD_SINT16:
-            v.s16 = be16toh(MRP_MSGBUF_PULL(&mb, typeof(v.s16), 1, nodata));
-            if (!mrp_msg_append(msg, tag, type, v.s16))
-                goto fail;
+            f->s16 = be16toh(MRP_MSGBUF_PULL(&mb, typeof(f->s16), 1, nodata));
             break;
-
         case MRP_MSG_FIELD_UINT32:
-            v.u32 = be32toh(MRP_MSGBUF_PULL(&mb, typeof(v.u32), 1, nodata));
-            if (!mrp_msg_append(msg, tag, type, v.u32))
-                goto fail;
+            f->u32 = be32toh(MRP_MSGBUF_PULL(&mb, typeof(f->u32), 1, nodata));
             break;
-
         case MRP_MSG_FIELD_SINT32:
-            v.s32 = be32toh(MRP_MSGBUF_PULL(&mb, typeof(v.s32), 1, nodata));
-            if (!mrp_msg_append(msg, tag, type, v.s32))
-                goto fail;
+            f->s32 = be32toh(MRP_MSGBUF_PULL(&mb, typeof(f->s32), 1, nodata));
             break;
-
         case MRP_MSG_FIELD_UINT64:
-            v.u64 = be64toh(MRP_MSGBUF_PULL(&mb, typeof(v.u64), 1, nodata));
-            if (!mrp_msg_append(msg, tag, type, v.u64))
-                goto fail;
+            f->u64 = be64toh(MRP_MSGBUF_PULL(&mb, typeof(f->u64), 1, nodata));
             break;
-
         case MRP_MSG_FIELD_SINT64:
-            v.s64 = be64toh(MRP_MSGBUF_PULL(&mb, typeof(v.s64), 1, nodata));
-            if (!mrp_msg_append(msg, tag, type, v.s64))
-                goto fail;
+            f->s64 = be64toh(MRP_MSGBUF_PULL(&mb, typeof(f->s64), 1, nodata));
             break;
-
         case MRP_MSG_FIELD_DOUBLE:
-            v.dbl = MRP_MSGBUF_PULL(&mb, typeof(v.dbl), 1, nodata);
-            if (!mrp_msg_append(msg, tag, type, v.dbl))
-                goto fail;
+            f->dbl = MRP_MSGBUF_PULL(&mb, typeof(f->dbl), 1, nodata);
             break;
 
         case MRP_MSG_FIELD_BLOB:
-            len   = be32toh(MRP_MSGBUF_PULL(&mb, typeof(len), 1, nodata));
-            value = MRP_MSGBUF_PULL_DATA(&mb, len, 1, nodata);
-            if (!mrp_msg_append(msg, tag, type, len, value))
-                goto fail;
+            len        = be32toh(MRP_MSGBUF_PULL(&mb, typeof(len), 1, nodata));
+            f->blb     = MRP_MSGBUF_PULL_DATA(&mb, len, 1, nodata);
+            f->size[0] = len;
             break;
 
         default:
-            if (!(type & MRP_MSG_FIELD_ARRAY)) {
-                errno = EINVAL;
-                goto fail;
+            if (!(f->type & MRP_MSG_FIELD_ARRAY))
+                goto invalid;
+
+            base       = f->type & ~MRP_MSG_FIELD_ARRAY;
+            n          = be32toh(MRP_MSGBUF_PULL(&mb, typeof(n), 1, nodata));
+            f->size[0] = n;
+
+            if (base == MRP_MSG_FIELD_UINT8 || base == MRP_MSG_FIELD_SINT8) {
+                f->aany = MRP_MSGBUF_PULL_DATA(&mb, n, 1, nodata);
+                break;
             }
 
-            base  = type & ~MRP_MSG_FIELD_ARRAY;
-            n     = be32toh(MRP_MSGBUF_PULL(&mb, typeof(n), 1, nodata));
-            {
-                char    *astr[n];
-                bool     abln[n];
-                uint8_t  au8 [n];
-                int8_t   as8 [n];
-                uint16_t au16[n];
-                int16_t  as16[n];
-                uint32_t au32[n];
-                int32_t  as32[n];
-                uint64_t au64[n];
-                int64_t  as64[n];
-                double   adbl[n];
+            switch (base) {
+            case MRP_MSG_FIELD_STRING: esize = sizeof(f->astr[0]); break;
+            case MRP_MSG_FIELD_BOOL:   esize = sizeof(f->abln[0]); break;
+            case MRP_MSG_FIELD_UINT16: esize = sizeof(f->au16[0]); break;
+            case MRP_MSG_FIELD_SINT16: esize = sizeof(f->as16[0]); break;
+            case MRP_MSG_FIELD_UINT32: esize = sizeof(f->au32[0]); break;
+            case MRP_MSG_FIELD_SINT32: esize = sizeof(f->as32[0]); break;
+            case MRP_MSG_FIELD_UINT64: esize = sizeof(f->au64[0]); break;
+            case MRP_MSG_FIELD_SINT64: esize = sizeof(f->as64[0]); break;
+            case MRP_MSG_FIELD_DOUBLE: esize = sizeof(f->adbl[0]); break;
+            default:
+                goto invalid;
+            }
 
-                for (j = 0; j < n; j++) {
+            if (n > mb.l)                /* every item takes >= 1 byte */
+                goto nodata;
 
-                    switch (base) {
-                    case MRP_MSG_FIELD_STRING:
-                        len = be32toh(MRP_MSGBUF_PULL(&mb, typeof(len),
-                                                      1, nodata));
-                        if (len > 0)
-                            astr[j] = MRP_MSGBUF_PULL_DATA(&mb, len, 1, nodata);
-                        else
-                            astr[j] = "";
-                        break;
+            asize   = MRP_ALIGN(asize, sizeof(uint64_t));
+            f->aany = arena != NULL ? arena + asize : NULL;
+            asize  += n * esize;
 
-                    case MRP_MSG_FIELD_BOOL:
-                        abln[j] = be32toh(MRP_MSGBUF_PULL(&mb, uint32_t, 1,
-                                                          nodata));
-                        break;
+            for (j = 0; j < n; j++) {
+                switch (base) {
+                case MRP_MSG_FIELD_STRING:
+                    len = be32toh(MRP_MSGBUF_PULL(&mb, typeof(len), 1, nodata));
+                    if (len > 0) {
+                        str = MRP_MSGBUF_PULL_DATA(&mb, len, 1, nodata);
+                        if (str[len - 1] != '\0')
+                            goto invalid;
+                    }
+                    else
+                        str = "";
+                    if (arena != NULL)
+                        f->astr[j] = str;
+                    break;
 
-                    case MRP_MSG_FIELD_UINT8:
-                        au8[j] = MRP_MSGBUF_PULL(&mb, typeof(v.u8), 1, nodata);
-                        break;
+                case MRP_MSG_FIELD_BOOL:
+                    PULL_ELEM(abln, uint32_t, be32toh);
+                    break;
+                case MRP_MSG_FIELD_UINT16:
+                    PULL_ELEM(au16, uint16_t, be16toh);
+                    break;
+                case MRP_MSG_FIELD_SINT16:
+                    PULL_ELEM(as16, int16_t, be16toh);
+                    break;
+                case MRP_MSG_FIELD_UINT32:
+                    PULL_ELEM(au32, uint32_t, be32toh);
+                    break;
+                case MRP_MSG_FIELD_SINT32:
+                    PULL_ELEM(as32, int32_t, be32toh);
+                    break;
+                case MRP_MSG_FIELD_UINT64:
+                    PULL_ELEM(au64, uint64_t, be64toh);
+                    break;
+                case MRP_MSG_FIELD_SINT64:
+                    PULL_ELEM(as64, int64_t, be64toh);
+                    break;
+                case MRP_MSG_FIELD_DOUBLE:
+                    PULL_ELEM(adbl, double, VIEW_ASIS);
+                    break;
+                }
+            }
+            break;
+        }
+    }
 
-                    case MRP_MSG_FIELD_SINT8:
-                        as8[j] = MRP_MSGBUF_PULL(&mb, typeof(v.s8), 1, nodata);
-                        break;
+#undef PULL_ELEM
 
-                    case MRP_MSG_FIELD_UINT16:
-                        au16[j] = be16toh(MRP_MSGBUF_PULL(&mb, typeof(v.u16),
-                                                          1, nodata));
-                        break;
+    *nfieldp = nfield;
+    *asizep  = asize;
 
-                    case MRP_MSG_FIELD_SINT16:
-                        as16[j] = be16toh(MRP_MSGBUF_PULL(&mb, typeof(v.s16),
-                                                          1, nodata));
-                        break;
+    return 0;
 
-                    case MRP_MSG_FIELD_UINT32:
-                        au32[j] = be32toh(MRP_MSGBUF_PULL(&mb, typeof(v.u32),
-                                                          1, nodata));
-                        break;
+ invalid:
+ nodata:
+    errno = EINVAL;
+    return -1;
+}
 
-                    case MRP_MSG_FIELD_SINT32:
-                        as32[j] = be32toh(MRP_MSGBUF_PULL(&mb, typeof(v.s32),
-                                                          1, nodata));
-                        break;
 
-                    case MRP_MSG_FIELD_UINT64:
-                        au64[j] = be64toh(MRP_MSGBUF_PULL(&mb, typeof(v.u64),
-                                                          1, nodata));
-                        break;
+static mrp_msg_t *decode_view(mrp_arena_t *arena, void *buf, size_t size)
+{
+    mrp_msg_t       *msg;
+    mrp_msg_field_t *f;
+    uint16_t         nfield, i;
+    size_t           hsize, fsize, asize, bsize;
+    void            *copy;
 
-                    case MRP_MSG_FIELD_SINT64:
-                        as64[j] = be64toh(MRP_MSGBUF_PULL(&mb, typeof(v.s64),
-                                                          1, nodata));
-                        break;
+    if (view_decode(buf, size, NULL, NULL, &nfield, &asize) < 0)
+        return NULL;
 
-                    case MRP_MSG_FIELD_DOUBLE:
-                        adbl[j] = MRP_MSGBUF_PULL(&mb, typeof(v.dbl),
-                                                  1, nodata);
-                    break;
+    hsize = MRP_ALIGN(sizeof(*msg), sizeof(uint64_t));
+    fsize = nfield * VIEW_FIELD_SIZE;
+    bsize = arena != NULL ? size : 0;
 
-                    default:
-                        errno = EINVAL;
-                        goto fail;
-                    }
-                }
+    if (arena != NULL)
+        msg = mrp_arena_allocz(arena, hsize + fsize + asize + bsize);
+    else
+        msg = mrp_allocz(hsize + fsize + asize);
 
-#define HANDLE_TYPE(_type, _var)                                          \
-                case _type:                                               \
-                    if (!mrp_msg_append(msg, tag,                         \
-                                        MRP_MSG_FIELD_ARRAY |_type,       \
-                                        n, _var))                         \
-                        goto fail;                                        \
-                    break
+    if (msg == NULL)
+        return NULL;
 
-                switch (base) {
-                    HANDLE_TYPE(MRP_MSG_FIELD_STRING, astr);
-                    HANDLE_TYPE(MRP_MSG_FIELD_BOOL  , abln);
-                    HANDLE_TYPE(MRP_MSG_FIELD_UINT8 , au8 );
-                    HANDLE_TYPE(MRP_MSG_FIELD_SINT8 , as8 );
-                    HANDLE_TYPE(MRP_MSG_FIELD_UINT16, au16);
-                    HANDLE_TYPE(MRP_MSG_FIELD_SINT16, as16);
-                    HANDLE_TYPE(MRP_MSG_FIELD_UINT32, au32);
-                    HANDLE_TYPE(MRP_MSG_FIELD_SINT32, as32);
-                    HANDLE_TYPE(MRP_MSG_FIELD_UINT64, au64);
-                    HANDLE_TYPE(MRP_MSG_FIELD_SINT64, as64);
-                    HANDLE_TYPE(MRP_MSG_FIELD_DOUBLE, adbl);
-                default:
-                    errno = EINVAL;
-                    goto fail;
-                }
-#undef HANDLE_TYPE
-            }
-        }
+    mrp_list_init(&msg->fields);
+    mrp_refcnt_init(&msg->refcnt);
+
+    msg->view  = (void *)msg + hsize;
+    msg->nview = nfield;
+
+    /* in an arena we can't own the buffer, so view a copy of it instead */
+    if (arena != NULL) {
+        copy = (char *)msg->view + fsize + asize;
+        buf  = memcpy(copy, buf, size);
+    }
+
+    if (view_decode(buf, size, msg, (char *)msg->view + fsize,
+                    &nfield, &asize) < 0) {
+        if (arena == NULL)
+            mrp_free(msg);
+        return NULL;
+    }
+
+    for (i = 0; i < nfield; i++) {
+        f = VIEW_FIELD(msg, i);
+        mrp_list_init(&f->hook);
+        mrp_list_append(&msg->fields, &f->hook);
     }
 
+    msg->nfield = nfield;
+    msg->arena  = arena;
+
     return msg;
+}
 
 
- fail:
- nodata:
-    mrp_msg_unref(msg);
-    return NULL;
+mrp_msg_t *mrp_msg_default_decode_view(void *buf, size_t size)
+{
+    return decode_view(NULL, buf, size);
+}
+
+
+mrp_msg_t *mrp_msg_default_decode_arena(mrp_arena_t *arena, void *buf,
+                                        size_t size)
+{
+    if (arena == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return decode_view(arena, buf, size);
+}
+
+
+void mrp_msg_view_own(mrp_msg_t *msg, void *owned)
+{
+    if (msg->view != NULL && msg->vowned == NULL)
+        msg->vowned = owned;
 }
 
 
@@ -1468,7 +2700,7 @@ int mrp_msg_register_type(mrp_data_descr_t *type)
             return FALSE;
     }
 
-    if (type->tag == MRP_MSG_TAG_DEFAULT) {
+    if (type->tag == MRP_MSG_TAG_DEFAULT || type->tag == MRP_MSG_TAG_COMPACT) {
         errno = EINVAL;
         return FALSE;
     }
@@ -1553,6 +2785,9 @@ size_t mrp_data_encode(void **bufp, void *data, mrp_data_descr_t *descr,
     int                i, cnt;
     size_t             size;
 
+    if (descr->encode != NULL)
+        return descr->encode(bufp, data, reserve);
+
     fields = descr->fields;
     nfield = descr->nfield;
     size   = reserve + nfield * (2 * sizeof(uint16_t) + sizeof(uint64_t));
@@ -1732,6 +2967,9 @@ void *mrp_data_decode(void **bufp, size_t *sizep, mrp_data_descr_t *descr)
     uint32_t           len, n, j, size;
     int                i;
 
+    if (descr->decode != NULL)
+        return descr->decode(bufp, sizep);
+
     fields = descr->fields;
     nfield = descr->nfield;
     data   = mrp_allocz(descr->size);
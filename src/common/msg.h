@@ -34,9 +34,11 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 #include <murphy/common/list.h>
 #include <murphy/common/refcnt.h>
+#include <murphy/common/mm.h>
 
 MRP_CDECL_BEGIN
 
@@ -184,9 +186,17 @@ typedef struct {
 
 
 typedef struct {
-    mrp_list_hook_t fields;              /* list of message fields */
-    size_t          nfield;              /* number of fields */
-    mrp_refcnt_t    refcnt;              /* reference count */
+    mrp_list_hook_t  fields;             /* list of message fields */
+    size_t           nfield;             /* number of fields */
+    mrp_refcnt_t     refcnt;             /* reference count */
+    mrp_msg_field_t *view;               /* fields of a zero-copy view */
+    size_t           nview;              /* number of view fields */
+    void            *vowned;             /* buffer owned by the view */
+    mrp_arena_t     *arena;              /* arena the message lives in */
+    int              frozen;             /* whether modifications refused */
+    mrp_msg_field_t **index;             /* tag index, built on lookup */
+    size_t           nindex;             /* index size, a power of 2 */
+    int              idups;              /* whether any tag is repeated */
 } mrp_msg_t;
 
 
@@ -196,6 +206,18 @@ mrp_msg_t *mrp_msg_create(uint16_t tag, ...) MRP_NULLTERM;
 /** Create a new message. */
 mrp_msg_t *mrp_msg_createv(uint16_t tag, va_list ap);
 
+/**
+ * Create a new message in the given arena. The message and all of its
+ * fields, including ones added later, are allocated from the arena and
+ * are released only when the arena is reset. Hence the message must not
+ * be referenced beyond the lifetime of the arena allocations.
+ */
+mrp_msg_t *mrp_msg_create_arena(mrp_arena_t *arena, uint16_t tag, ...)
+    MRP_NULLTERM;
+
+/** Create a new message in the given arena. */
+mrp_msg_t *mrp_msg_createv_arena(mrp_arena_t *arena, uint16_t tag, va_list ap);
+
 /** Macro to create an empty message. */
 #define mrp_msg_create_empty() mrp_msg_create(MRP_MSG_FIELD_INVALID, NULL)
 
@@ -205,6 +227,12 @@ mrp_msg_t *mrp_msg_ref(mrp_msg_t *msg);
 /** Decrease the refcount, free the message if refcount drops to zero. */
 void mrp_msg_unref(mrp_msg_t *msg);
 
+/** Freeze a message, making any further attempts to modify it fail. */
+void mrp_msg_freeze(mrp_msg_t *msg);
+
+/** Check if a message is frozen. */
+int mrp_msg_frozen(mrp_msg_t *msg);
+
 /** Append a field to a message. */
 int mrp_msg_append(mrp_msg_t *msg, uint16_t tag, ...);
 
@@ -240,9 +268,111 @@ int mrp_msg_dump(mrp_msg_t *msg, FILE *fp);
 /** Encode the given message using the default message encoder. */
 ssize_t mrp_msg_default_encode(mrp_msg_t *msg, void **bufp);
 
+/** Encode the given message into a buffer obtained from the given allocator. */
+ssize_t mrp_msg_default_encode_alloc(mrp_msg_t *msg,
+                                     void *(*alloc)(size_t size), void **bufp);
+
+/*
+ * I/O vector encoding
+ *
+ * Encode a message into an I/O vector instead of a single buffer. Headers
+ * and small fields are collected into a scratch area, which is inline for
+ * small messages, while large strings and blobs are referenced directly
+ * from the message. The message must stay intact until the vector has
+ * been written out. iov[0] is left unused by the encoder, so transports
+ * can put their framing header there. The vector must not be copied, and
+ * it must be released with mrp_msg_iov_release once written out.
+ */
+
+#define MRP_MSG_IOV_MAX    32            /* max. entries, excluding iov[0] */
+#define MRP_MSG_IOV_MINREF 256           /* min. size to reference in place */
+
+typedef struct {
+    struct iovec  iov[1 + MRP_MSG_IOV_MAX]; /* I/O vector */
+    int           iovcnt;                /* used entries, including iov[0] */
+    size_t        size;                  /* total encoded size */
+    char         *scratch;               /* headers and copied fields */
+    char          inl[256];              /* inline scratch area */
+} mrp_msg_iov_t;
+
+/** Encode the given message into an I/O vector. */
+ssize_t mrp_msg_default_encode_iov(mrp_msg_t *msg, mrp_msg_iov_t *miov);
+
+/** Release any resources allocated for the given I/O vector. */
+void mrp_msg_iov_release(mrp_msg_iov_t *miov);
+
 /** Decode the given message using the default message decoder. */
 mrp_msg_t *mrp_msg_default_decode(void *buf, size_t size);
 
+/**
+ * Decode the given message as a zero-copy view of buf. Strings, blobs
+ * and byte arrays of the message point directly into buf and all the
+ * fields are allocated in a single block together with the message.
+ * The message can only be used as long as buf stays intact, unless the
+ * ownership of buf is transferred to it using mrp_msg_view_own.
+ */
+mrp_msg_t *mrp_msg_default_decode_view(void *buf, size_t size);
+
+/** Transfer the ownership of the allocation containing the view buffer. */
+void mrp_msg_view_own(mrp_msg_t *msg, void *owned);
+
+/**
+ * Decode the given message into an arena. The message is a view of a
+ * copy of buf made in the arena, so buf can be reused right away. The
+ * same restrictions apply as for messages created by mrp_msg_create_arena.
+ */
+mrp_msg_t *mrp_msg_default_decode_arena(mrp_arena_t *arena, void *buf,
+                                        size_t size);
+
+
+/*
+ * compact message encoding
+ *
+ * An alternative encoding using varints for tags, types, lengths and
+ * integers, and packing array items back to back. It is considerably
+ * smaller for messages consisting mostly of small integers and short
+ * strings. Compact messages carry MRP_MSG_TAG_COMPACT in place of
+ * MRP_MSG_TAG_DEFAULT, and transports decode both of them.
+ */
+
+/** Encode the given message using the compact message encoder. */
+ssize_t mrp_msg_compact_encode(mrp_msg_t *msg, void **bufp);
+
+/** Encode the given message into an I/O vector using the compact encoder. */
+ssize_t mrp_msg_compact_encode_iov(mrp_msg_t *msg, mrp_msg_iov_t *miov);
+
+/** Decode the given message using the compact message decoder. */
+mrp_msg_t *mrp_msg_compact_decode(void *buf, size_t size);
+
+
+/*
+ * pre-encoded message templates
+ *
+ * A message template is a message encoded once with the default encoder.
+ * The fixed-size fields (integers, booleans and doubles) of the encoded
+ * message can then be patched in place, which allows sending a series of
+ * messages differing only in a few such fields without rebuilding and
+ * re-encoding them from scratch.
+ */
+
+typedef struct mrp_msg_tmpl_s mrp_msg_tmpl_t;
+
+/** Create a template by pre-encoding the given message. */
+mrp_msg_tmpl_t *mrp_msg_tmpl_create(mrp_msg_t *msg);
+
+/** Destroy the given message template. */
+void mrp_msg_tmpl_destroy(mrp_msg_tmpl_t *tmpl);
+
+/**
+ * Patch the first fixed-size field of the template with the given tag
+ * and type to the given value. The value is passed the same way as for
+ * mrp_msg_append.
+ */
+int mrp_msg_tmpl_set(mrp_msg_tmpl_t *tmpl, uint16_t tag, uint16_t type, ...);
+
+/** Get the encoded data of the given message template. */
+void *mrp_msg_tmpl_data(mrp_msg_tmpl_t *tmpl, size_t *sizep);
+
 
 /*
  * custom data types
@@ -257,13 +387,21 @@ mrp_msg_t *mrp_msg_default_decode(void *buf, size_t size);
  * The data type tag is used to identify the descriptor and consequently
  * the custom data type both during sending and receiving (ie. encoding and
  * decoding). It is assigned by the registering entity, it must be unique,
- * and it cannot be MRP_MSG_TAG_DEFAULT (0x0), or else registration will
- * fail. The size is used to allocate necessary memory for the data on the
- * receiving end. The member descriptors are used to describe the offset
- * and types of the members within the custom data type.
+ * and it cannot be MRP_MSG_TAG_DEFAULT (0x0) or MRP_MSG_TAG_COMPACT (0xffff),
+ * or else registration will fail. The size is used to allocate necessary
+ * memory for the data on the receiving end. The member descriptors are used
+ * to describe the offset and types of the members within the custom data
+ * type.
+ *
+ * A descriptor can optionally carry specialised encoder and decoder
+ * functions, typically generated by utils/gen-data-codec from a type
+ * description. If set, mrp_data_encode and mrp_data_decode use these
+ * instead of interpreting the member descriptors. They must produce and
+ * accept the same wire format as the interpreting codec.
  */
 
 #define MRP_MSG_TAG_DEFAULT 0x0          /* tag for default encode/decoder */
+#define MRP_MSG_TAG_COMPACT 0xffff       /* tag for compact encoder/decoder */
 
 typedef struct {
     uint16_t        offs;                /* offset within structure */
@@ -282,6 +420,8 @@ typedef struct {
     int                nfield;           /* number of members */
     mrp_data_member_t *fields;           /* member descriptors */
     mrp_list_hook_t    allocated;        /* fields needing extra allocation */
+    size_t           (*encode)(void **bufp, void *data, size_t reserve);
+    void            *(*decode)(void **bufp, size_t *sizep);
 } mrp_data_descr_t;
 
 
@@ -28,12 +28,15 @@
  */
 
 #include <errno.h>
+#include <endian.h>
 
 #include <murphy/common/macros.h>
 #include <murphy/common/debug.h>
 #include <murphy/common/log.h>
 #include <murphy/common/mm.h>
 #include <murphy/common/list.h>
+#include <murphy/common/utils.h>
+#include <murphy/common/hashtbl.h>
 #include <murphy/common/tlv.h>
 #include <murphy/common/native-types.h>
 
@@ -61,6 +64,29 @@ typedef struct {
 } chunk_t;
 
 
+/*
+ * precompiled encoding/decoding plan of a type
+ *
+ * Consecutive scalar members with a fixed-size encoding are collected
+ * into a single step, so that they can be encoded and decoded with one
+ * buffer reservation/consumption instead of separate push/pull calls.
+ * All other members get a step of their own.
+ */
+
+#define MEMBER_HDR_SIZE (2 * sizeof(uint32_t)) /* TAG_MEMBER + index */
+
+typedef struct {
+    uint32_t first;                      /* index of first member */
+    uint32_t nscalar;                    /* scalar members, 0 for generic */
+    size_t   size;                       /* encoded size of scalar run */
+} step_t;
+
+typedef struct {
+    step_t *steps;                       /* encoding/decoding steps */
+    int     nstep;                       /* number of steps */
+} plan_t;
+
+
 static int encode_struct(mrp_tlv_t *tlv, void *data, mrp_native_type_t *t,
                          mrp_typemap_t *idmap);
 static int decode_struct(mrp_tlv_t *tlv, mrp_list_hook_t **chunks,
@@ -80,7 +106,9 @@ static void free_chunks(mrp_list_hook_t *chunks);
 static MRP_LIST_HOOK(types);
 static int           ntype;
 
-static mrp_native_type_t **typetbl;
+static mrp_native_type_t **typetbl;      /* types by id */
+static plan_t             *plantbl;      /* plans by type id */
+static mrp_htbl_t         *namehtbl;     /* types by name */
 
 
 static mrp_native_member_t *native_member(mrp_native_type_t *t, int idx)
@@ -139,41 +167,19 @@ static int copy_member(mrp_native_type_t *t, mrp_native_member_t *m)
 
 static mrp_native_type_t *find_type(const char *type_name)
 {
-    mrp_native_type_t *t;
-    mrp_list_hook_t   *p, *n;
-
-    mrp_list_foreach(&types, p, n) {
-        t = mrp_list_entry(p, typeof(*t), hook);
-
-        if (!strcmp(t->name, type_name))
-            return t;
-    }
+    if (namehtbl == NULL)
+        return NULL;
 
-    return NULL;
+    return mrp_htbl_lookup(namehtbl, (void *)type_name);
 }
 
 
 static mrp_native_type_t *lookup_type(uint32_t id)
 {
-    mrp_native_type_t *t;
-    mrp_list_hook_t   *p, *n;
-
-    /* XXX TODO: turn this into a real lookup instead of linear search */
-
-    if (1 <= id && id <= (uint32_t)ntype)
-        if ((t = typetbl[id]) != NULL && t->id == id)
-            return t;
-
-    mrp_log_warning("Type lookup for %u failed, doing linear search...\n", id);
-
-    mrp_list_foreach(&types, p, n) {
-        t = mrp_list_entry(p, typeof(*t), hook);
-
-        if (t->id == id)
-            return t;
-    }
-
-    return NULL;
+    if (id < (uint32_t)ntype)
+        return typetbl[id];
+    else
+        return NULL;
 }
 
 
@@ -281,15 +287,29 @@ static void register_default_types(void)
         .hook    = { NULL, NULL }               \
     }
 
-#define REGISTER_TYPE(_type)                    \
-    mrp_list_init(&(_type)->hook);              \
-    mrp_list_append(&types, &(_type)->hook);    \
-    typetbl[(_type)->id] = (_type)
+#define REGISTER_TYPE(_type)                                    \
+    mrp_list_init(&(_type)->hook);                              \
+    mrp_list_append(&types, &(_type)->hook);                    \
+    typetbl[(_type)->id] = (_type);                             \
+    if (!mrp_htbl_insert(namehtbl, (_type)->name, (_type)))     \
+        goto fail
 
-    if (mrp_reallocz(typetbl, 0, DEFAULT_NTYPE) == NULL) {
-        mrp_log_error("Failed to initialize native type table.");
-        abort();
-    }
+    mrp_htbl_config_t hcfg;
+
+    mrp_clear(&hcfg);
+    hcfg.nentry = 64;
+    hcfg.comp   = mrp_string_comp;
+    hcfg.hash   = mrp_string_hash;
+    hcfg.free   = NULL;
+
+    if ((namehtbl = mrp_htbl_create(&hcfg)) == NULL)
+        goto fail;
+
+    if (mrp_reallocz(typetbl, 0, DEFAULT_NTYPE) == NULL)
+        goto fail;
+
+    if (mrp_reallocz(plantbl, 0, DEFAULT_NTYPE) == NULL)
+        goto fail;
 
     DECLARE_TYPE( int8_t       , INT8  );
     DECLARE_TYPE(uint8_t       , UINT8 );
@@ -337,16 +357,96 @@ static void register_default_types(void)
 
     ntype = DEFAULT_NTYPE;
 
+    return;
+
+ fail:
+    mrp_log_error("Failed to initialize native type table.");
+    abort();
+
 #undef DECLARE_TYPE
 #undef REGISTER_TYPE
 }
 
 
+static size_t scalar_size(mrp_native_member_t *m)
+{
+    if (m->any.layout == MRP_LAYOUT_INDIRECT)
+        return 0;
+
+    switch (m->any.type) {
+    case MRP_TYPE_INT8:
+    case MRP_TYPE_UINT8:
+        return sizeof(uint8_t);
+    case MRP_TYPE_INT16:
+    case MRP_TYPE_UINT16:
+        return sizeof(uint16_t);
+    case MRP_TYPE_INT32:
+    case MRP_TYPE_UINT32:
+    case MRP_TYPE_INT:
+    case MRP_TYPE_UINT:
+    case MRP_TYPE_SHORT:
+    case MRP_TYPE_USHORT:
+    case MRP_TYPE_SIZET:
+    case MRP_TYPE_SSIZET:
+        return sizeof(uint32_t);
+    case MRP_TYPE_INT64:
+    case MRP_TYPE_UINT64:
+        return sizeof(uint64_t);
+    case MRP_TYPE_FLOAT:
+        return sizeof(float);
+    case MRP_TYPE_DOUBLE:
+        return sizeof(double);
+    case MRP_TYPE_BOOL:
+        return sizeof(bool);
+    default:
+        return 0;
+    }
+}
+
+
+static int compile_plan(mrp_native_type_t *t, plan_t *plan)
+{
+    step_t   *s;
+    uint32_t  idx;
+    size_t    size;
+
+    plan->steps = NULL;
+    plan->nstep = 0;
+
+    if (t->nmember == 0)
+        return 0;
+
+    if ((plan->steps = mrp_allocz_array(step_t, t->nmember)) == NULL)
+        return -1;
+
+    for (idx = 0, s = NULL; idx < t->nmember; idx++) {
+        size = scalar_size(t->members + idx);
+
+        if (size > 0 && s != NULL && s->nscalar > 0) {
+            s->nscalar++;
+            s->size += MEMBER_HDR_SIZE + size;
+        }
+        else {
+            s = plan->steps + plan->nstep++;
+            s->first = idx;
+
+            if (size > 0) {
+                s->nscalar = 1;
+                s->size    = MEMBER_HDR_SIZE + size;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
 uint32_t mrp_register_native(mrp_native_type_t *type)
 {
     mrp_native_type_t   *existing = find_type(type->name);
     mrp_native_type_t   *t, *elemt;
     mrp_native_member_t *s, *d, *m;
+    plan_t               plan = { NULL, 0 };
     int                  idx;
 
     (void)member_type;
@@ -499,17 +599,28 @@ uint32_t mrp_register_native(mrp_native_type_t *type)
         }
     }
 
+    if (compile_plan(t, &plan) < 0)
+        goto fail;
+
     if (mrp_reallocz(typetbl, ntype, ntype + 1) == NULL)
         goto fail;
 
+    if (mrp_reallocz(plantbl, ntype, ntype + 1) == NULL)
+        goto fail;
+
+    if (!mrp_htbl_insert(namehtbl, t->name, t))
+        goto fail;
+
     t->id = ntype;
     mrp_list_append(&types, &t->hook);
     typetbl[ntype] = t;
+    plantbl[ntype] = plan;
     ntype++;
 
     return t->id;
 
  fail:
+    mrp_free(plan.steps);
     free_native(t);
 
     return MRP_INVALID_TYPE;
@@ -770,6 +881,27 @@ static int encode_array(mrp_tlv_t *tlv, void *arrp, mrp_native_array_t *m,
     if ((t = lookup_type(m->elem.id)) == NULL)
         return -1;
 
+    /* arrays of fixed-size scalars are written in one go */
+    switch (t->id) {
+    case MRP_TYPE_INT8:
+    case MRP_TYPE_UINT8:
+    case MRP_TYPE_FLOAT:
+    case MRP_TYPE_DOUBLE:
+    case MRP_TYPE_BOOL:
+        return mrp_tlv_push_data(tlv, TAG_NONE, arrp, nelem * elem_size);
+    case MRP_TYPE_INT16:
+    case MRP_TYPE_UINT16:
+        return mrp_tlv_push_uint16_array(tlv, TAG_NONE, arrp, nelem);
+    case MRP_TYPE_INT32:
+    case MRP_TYPE_UINT32:
+        return mrp_tlv_push_uint32_array(tlv, TAG_NONE, arrp, nelem);
+    case MRP_TYPE_INT64:
+    case MRP_TYPE_UINT64:
+        return mrp_tlv_push_uint64_array(tlv, TAG_NONE, arrp, nelem);
+    default:
+        break;
+    }
+
     for (i = 0, elem = arrp; i < nelem; i++, elem += elem_size) {
         v = elem;
 
@@ -815,75 +947,170 @@ static int encode_array(mrp_tlv_t *tlv, void *arrp, mrp_native_array_t *m,
 }
 
 
-static int encode_struct(mrp_tlv_t *tlv, void *data, mrp_native_type_t *t,
-                         mrp_typemap_t *idmap)
+static int encode_scalars(mrp_tlv_t *tlv, void *data, mrp_native_type_t *t,
+                          step_t *s)
 {
     mrp_native_member_t *m;
-    mrp_native_type_t   *mt;
     mrp_value_t         *v;
-    uint32_t             idx;
-    size_t               size, nelem;
+    char                *p;
+    uint16_t             u16;
+    uint32_t             idx, u32;
+    uint64_t             u64;
 
-    if (t == NULL)
+    if ((p = mrp_tlv_reserve(tlv, s->size, 1)) == NULL)
         return -1;
 
-    if (mrp_tlv_push_uint32(tlv, TAG_STRUCT, map_type(t->id, idmap)) < 0)
-        return -1;
+#define PUT(_p, _v) do { memcpy(_p, &(_v), sizeof(_v)); _p += sizeof(_v); } \
+    while (0)
 
-    for (idx = 0, m = t->members; idx < t->nmember; idx++, m++) {
-        if (mrp_tlv_push_uint32(tlv, TAG_MEMBER, idx) < 0)
-            return -1;
+    for (idx = s->first; idx < s->first + s->nscalar; idx++) {
+        m = t->members + idx;
+        v = data + m->any.offs;
 
-        if (m->any.layout == MRP_LAYOUT_INDIRECT)
-            v = *(void **)(data + m->any.offs);
-        else
-            v = data + m->any.offs;
+        u32 = htobe32(TAG_MEMBER);
+        PUT(p, u32);
+        u32 = htobe32(idx);
+        PUT(p, u32);
 
         switch (m->any.type) {
         case MRP_TYPE_INT8:
         case MRP_TYPE_UINT8:
+            *p++ = v->u8;
+            break;
         case MRP_TYPE_INT16:
         case MRP_TYPE_UINT16:
+            u16 = htobe16(v->u16);
+            PUT(p, u16);
+            break;
         case MRP_TYPE_INT32:
         case MRP_TYPE_UINT32:
+            u32 = htobe32(v->u32);
+            PUT(p, u32);
+            break;
         case MRP_TYPE_INT64:
         case MRP_TYPE_UINT64:
-        case MRP_TYPE_FLOAT:
-        case MRP_TYPE_DOUBLE:
-        case MRP_TYPE_BOOL:
-        case MRP_TYPE_STRING:
+            u64 = htobe64(v->u64);
+            PUT(p, u64);
+            break;
+        case MRP_TYPE_FLOAT:  PUT(p, v->flt); break;
+        case MRP_TYPE_DOUBLE: PUT(p, v->dbl); break;
+        case MRP_TYPE_BOOL:   PUT(p, v->bln); break;
         case MRP_TYPE_INT:
+            u32 = htobe32((uint32_t)(int32_t)v->i);
+            PUT(p, u32);
+            break;
         case MRP_TYPE_UINT:
+            u32 = htobe32((uint32_t)v->ui);
+            PUT(p, u32);
+            break;
         case MRP_TYPE_SHORT:
+            u32 = htobe32((uint32_t)(int32_t)v->si);
+            PUT(p, u32);
+            break;
         case MRP_TYPE_USHORT:
+            u32 = htobe32((uint32_t)v->usi);
+            PUT(p, u32);
+            break;
         case MRP_TYPE_SIZET:
+            u32 = htobe32((uint32_t)v->sz);
+            PUT(p, u32);
+            break;
         case MRP_TYPE_SSIZET:
-            if (encode_basic(tlv, m->any.type, v) < 0)
-                return -1;
+            u32 = htobe32((uint32_t)(int32_t)v->ssz);
+            PUT(p, u32);
             break;
+        default:
+            return -1;
+        }
+    }
 
-        case MRP_TYPE_BLOB: /* XXX TODO implement blobs */
-            if (get_blob_size(data, t, &m->blob, &size) < 0)
-                return -1;
+#undef PUT
+
+    return 0;
+}
+
+
+static int encode_member(mrp_tlv_t *tlv, void *data, mrp_native_type_t *t,
+                         uint32_t idx, mrp_typemap_t *idmap)
+{
+    mrp_native_member_t *m = t->members + idx;
+    mrp_native_type_t   *mt;
+    mrp_value_t         *v;
+    size_t               size, nelem;
+
+    if (mrp_tlv_push_uint32(tlv, TAG_MEMBER, idx) < 0)
+        return -1;
+
+    if (m->any.layout == MRP_LAYOUT_INDIRECT)
+        v = *(void **)(data + m->any.offs);
+    else
+        v = data + m->any.offs;
+
+    switch (m->any.type) {
+    case MRP_TYPE_INT8:
+    case MRP_TYPE_UINT8:
+    case MRP_TYPE_INT16:
+    case MRP_TYPE_UINT16:
+    case MRP_TYPE_INT32:
+    case MRP_TYPE_UINT32:
+    case MRP_TYPE_INT64:
+    case MRP_TYPE_UINT64:
+    case MRP_TYPE_FLOAT:
+    case MRP_TYPE_DOUBLE:
+    case MRP_TYPE_BOOL:
+    case MRP_TYPE_STRING:
+    case MRP_TYPE_INT:
+    case MRP_TYPE_UINT:
+    case MRP_TYPE_SHORT:
+    case MRP_TYPE_USHORT:
+    case MRP_TYPE_SIZET:
+    case MRP_TYPE_SSIZET:
+        return encode_basic(tlv, m->any.type, v);
+
+    case MRP_TYPE_BLOB: /* XXX TODO implement blobs */
+        if (get_blob_size(data, t, &m->blob, &size) < 0)
             return -1;
+        return -1;
 
-        case MRP_TYPE_ARRAY:
-            if (get_array_size(data, t, v->ptr, &m->array, &nelem, &size) < 0)
-                return -1;
-            if (encode_array(tlv, v->ptr, &m->array, nelem,
-                             size, idmap) < 0)
-                return -1;
-            break;
+    case MRP_TYPE_ARRAY:
+        if (get_array_size(data, t, v->ptr, &m->array, &nelem, &size) < 0)
+            return -1;
+        return encode_array(tlv, v->ptr, &m->array, nelem, size, idmap);
 
-        case MRP_TYPE_STRUCT:
-            if ((mt = lookup_type(m->strct.data_type.id)) == NULL)
+    case MRP_TYPE_STRUCT:
+        if ((mt = lookup_type(m->strct.data_type.id)) == NULL)
+            return -1;
+        return encode_struct(tlv, v->ptr, mt, idmap);
+
+    default:
+        return -1;
+    }
+}
+
+
+static int encode_struct(mrp_tlv_t *tlv, void *data, mrp_native_type_t *t,
+                         mrp_typemap_t *idmap)
+{
+    plan_t *plan;
+    step_t *s;
+    int     i;
+
+    if (t == NULL)
+        return -1;
+
+    if (mrp_tlv_push_uint32(tlv, TAG_STRUCT, map_type(t->id, idmap)) < 0)
+        return -1;
+
+    plan = plantbl + t->id;
+
+    for (i = 0, s = plan->steps; i < plan->nstep; i++, s++) {
+        if (s->nscalar > 0) {
+            if (encode_scalars(tlv, data, t, s) < 0)
                 return -1;
-            if (encode_struct(tlv, v->ptr, mt, idmap) < 0)
+        }
+        else {
+            if (encode_member(tlv, data, t, s->first, idmap) < 0)
                 return -1;
-            break;
-
-        default:
-            return -1;
         }
     }
 
@@ -903,7 +1130,7 @@ int mrp_encode_native(void *data, uint32_t id, size_t reserve, void **bufp,
     if (t == NULL)
         return -1;
 
-    if (mrp_tlv_setup_write(&tlv, reserve + 4096) < 0)
+    if (mrp_tlv_setup_scratch(&tlv, reserve + 4096) < 0)
         return -1;
 
     if (reserve > 0)
@@ -916,7 +1143,7 @@ int mrp_encode_native(void *data, uint32_t id, size_t reserve, void **bufp,
     mrp_tlv_trim(&tlv);
     mrp_tlv_steal(&tlv, bufp, sizep);
 
-    return 0;
+    return *bufp != NULL ? 0 : -1;
 
  fail:
     mrp_tlv_cleanup(&tlv);
@@ -1144,16 +1371,167 @@ static int decode_array(mrp_tlv_t *tlv, mrp_list_hook_t **chunks,
 }
 
 
-static int decode_struct(mrp_tlv_t *tlv, mrp_list_hook_t **chunks,
-                         void **datap, uint32_t *idp, mrp_typemap_t *idmap)
+static int decode_scalars(mrp_tlv_t *tlv, void *data, mrp_native_type_t *t,
+                          step_t *s)
 {
-    mrp_native_type_t   *t;
     mrp_native_member_t *m;
     mrp_value_t         *v;
+    char                *p;
+    uint16_t             u16;
+    uint32_t             idx, u32;
+    uint64_t             u64;
+
+    if ((p = mrp_tlv_consume(tlv, s->size)) == NULL)
+        return -1;
+
+#define GET(_v, _p) do { memcpy(&(_v), _p, sizeof(_v)); _p += sizeof(_v); } \
+    while (0)
+
+    for (idx = s->first; idx < s->first + s->nscalar; idx++) {
+        m = t->members + idx;
+        v = data + m->any.offs;
+
+        GET(u32, p);
+        if (be32toh(u32) != TAG_MEMBER)
+            return -1;
+        p += sizeof(uint32_t);           /* member index */
+
+        switch (m->any.type) {
+        case MRP_TYPE_INT8:
+        case MRP_TYPE_UINT8:
+            v->u8 = *p++;
+            break;
+        case MRP_TYPE_INT16:
+        case MRP_TYPE_UINT16:
+            GET(u16, p);
+            v->u16 = be16toh(u16);
+            break;
+        case MRP_TYPE_INT32:
+        case MRP_TYPE_UINT32:
+            GET(u32, p);
+            v->u32 = be32toh(u32);
+            break;
+        case MRP_TYPE_INT64:
+        case MRP_TYPE_UINT64:
+            GET(u64, p);
+            v->u64 = be64toh(u64);
+            break;
+        case MRP_TYPE_FLOAT:  GET(v->flt, p); break;
+        case MRP_TYPE_DOUBLE: GET(v->dbl, p); break;
+        case MRP_TYPE_BOOL:   GET(v->bln, p); break;
+        case MRP_TYPE_INT:
+            GET(u32, p);
+            v->i = (int)(int32_t)be32toh(u32);
+            break;
+        case MRP_TYPE_UINT:
+            GET(u32, p);
+            v->ui = (unsigned int)be32toh(u32);
+            break;
+        case MRP_TYPE_SHORT:
+            GET(u32, p);
+            v->si = (short)(int32_t)be32toh(u32);
+            break;
+        case MRP_TYPE_USHORT:
+            GET(u32, p);
+            v->usi = (unsigned short)be32toh(u32);
+            break;
+        case MRP_TYPE_SIZET:
+            GET(u32, p);
+            v->sz = (size_t)be32toh(u32);
+            break;
+        case MRP_TYPE_SSIZET:
+            GET(u32, p);
+            v->ssz = (ssize_t)(int32_t)be32toh(u32);
+            break;
+        default:
+            return -1;
+        }
+    }
+
+#undef GET
+
+    return 0;
+}
+
+
+static int decode_member(mrp_tlv_t *tlv, mrp_list_hook_t **chunks,
+                         void *data, mrp_native_type_t *t, uint32_t i,
+                         mrp_typemap_t *idmap)
+{
+    mrp_native_member_t *m = t->members + i;
+    mrp_value_t         *v;
     char                *str, **strp;
-    size_t               max, i;
+    size_t               max;
     uint32_t             idx, id;
 
+    if (mrp_tlv_pull_uint32(tlv, TAG_MEMBER, &idx) < 0)
+        return -1;
+
+    v = data + m->any.offs;
+
+    if (m->any.layout == MRP_LAYOUT_INDIRECT) {
+        if ((v = allocate_indirect(chunks, v, m, idmap)) == NULL)
+            return -1;
+    }
+
+    switch (m->any.type) {
+    case MRP_TYPE_INT8:
+    case MRP_TYPE_UINT8:
+    case MRP_TYPE_INT16:
+    case MRP_TYPE_UINT16:
+    case MRP_TYPE_INT32:
+    case MRP_TYPE_UINT32:
+    case MRP_TYPE_INT64:
+    case MRP_TYPE_UINT64:
+    case MRP_TYPE_FLOAT:
+    case MRP_TYPE_DOUBLE:
+    case MRP_TYPE_BOOL:
+    case MRP_TYPE_INT:
+    case MRP_TYPE_UINT:
+    case MRP_TYPE_SHORT:
+    case MRP_TYPE_USHORT:
+    case MRP_TYPE_SIZET:
+    case MRP_TYPE_SSIZET:
+        return decode_basic(tlv, chunks, m->any.type, v);
+
+    case MRP_TYPE_STRING:
+        if (m->any.layout == MRP_LAYOUT_INLINED) {
+            max  = m->str.size;
+            str  = v->str;
+            strp = &str;
+        }
+        else {
+            max  = (size_t)-1;
+            strp = &v->strp;
+        }
+        return mrp_tlv_pull_string(tlv, TAG_NONE, strp, max,
+                                   alloc_str_chunk, chunks);
+
+    case MRP_TYPE_BLOB: /* XXX TODO implement blobs */
+        return -1;
+
+    case MRP_TYPE_ARRAY:
+        return decode_array(tlv, chunks, &v->ptr, &m->array, data, t, idmap);
+
+    case MRP_TYPE_STRUCT:
+        id = m->strct.data_type.id;
+        return decode_struct(tlv, chunks, &v->ptr, &id, idmap);
+
+    default:
+        return -1;
+    }
+}
+
+
+static int decode_struct(mrp_tlv_t *tlv, mrp_list_hook_t **chunks,
+                         void **datap, uint32_t *idp, mrp_typemap_t *idmap)
+{
+    mrp_native_type_t *t;
+    plan_t            *plan;
+    step_t            *s;
+    uint32_t           id;
+    int                i;
+
     if (datap == NULL) {
         errno = EFAULT;
         return -1;
@@ -1180,71 +1558,16 @@ static int decode_struct(mrp_tlv_t *tlv, mrp_list_hook_t **chunks,
         if ((*datap = alloc_chunk(chunks, t->size)) == NULL)
             return -1;
 
-    for (i = 0, m = t->members; i < t->nmember; i++, m++) {
-        if (mrp_tlv_pull_uint32(tlv, TAG_MEMBER, &idx) < 0)
-            return -1;
-
-        v = *datap + m->any.offs;
+    plan = plantbl + t->id;
 
-        if (m->any.layout == MRP_LAYOUT_INDIRECT) {
-            if ((v = allocate_indirect(chunks, v, m, idmap)) == NULL)
+    for (i = 0, s = plan->steps; i < plan->nstep; i++, s++) {
+        if (s->nscalar > 0) {
+            if (decode_scalars(tlv, *datap, t, s) < 0)
                 return -1;
         }
-
-        switch (m->any.type) {
-        case MRP_TYPE_INT8:
-        case MRP_TYPE_UINT8:
-        case MRP_TYPE_INT16:
-        case MRP_TYPE_UINT16:
-        case MRP_TYPE_INT32:
-        case MRP_TYPE_UINT32:
-        case MRP_TYPE_INT64:
-        case MRP_TYPE_UINT64:
-        case MRP_TYPE_FLOAT:
-        case MRP_TYPE_DOUBLE:
-        case MRP_TYPE_BOOL:
-        case MRP_TYPE_INT:
-        case MRP_TYPE_UINT:
-        case MRP_TYPE_SHORT:
-        case MRP_TYPE_USHORT:
-        case MRP_TYPE_SIZET:
-        case MRP_TYPE_SSIZET:
-            if (decode_basic(tlv, chunks, m->any.type, v) < 0)
+        else {
+            if (decode_member(tlv, chunks, *datap, t, s->first, idmap) < 0)
                 return -1;
-            break;
-
-        case MRP_TYPE_STRING:
-            if (m->any.layout == MRP_LAYOUT_INLINED) {
-                max  = m->str.size;
-                str  = v->str;
-                strp = &str;
-            }
-            else {
-                max  = (size_t)-1;
-                strp = &v->strp;
-            }
-            if (mrp_tlv_pull_string(tlv, TAG_NONE, strp, max,
-                                    alloc_str_chunk, chunks) < 0)
-                return -1;
-            break;
-
-        case MRP_TYPE_BLOB: /* XXX TODO implement blobs */
-            return -1;
-
-        case MRP_TYPE_ARRAY:
-            if (decode_array(tlv, chunks, &v->ptr, &m->array,
-                             *datap, t, idmap) < 0)
-                return -1;
-            break;
-
-        case MRP_TYPE_STRUCT:
-            id = m->strct.data_type.id;
-            if (decode_struct(tlv, chunks, &v->ptr, &id, idmap) < 0)
-                return -1;
-            break;
-
-        default:
-            return -1;
         }
     }
 
@@ -1593,7 +1916,7 @@ static void *alloc_chunk(mrp_list_hook_t **chunks, size_t size)
         return NULL;
 
     if (*chunks == NULL) {
-        if ((*chunks = mrp_allocz(sizeof(*chunks))) == NULL)
+        if ((*chunks = mrp_allocz(sizeof(**chunks))) == NULL)
             return NULL;
         else
             mrp_list_init(*chunks);
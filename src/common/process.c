@@ -34,12 +34,20 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 
 #include <linux/cn_proc.h>
 #include <linux/netlink.h>
 #include <linux/connector.h>
 #include <linux/filter.h>
 
+#include "murphy/config.h"
+
+#ifdef HAVE_LINUX_BPF_H
+#    include <sys/syscall.h>
+#    include <linux/bpf.h>
+#endif
+
 #include <murphy/common/process.h>
 #include <murphy/common.h>
 
@@ -62,6 +70,7 @@ typedef struct {
 
     void *userdata;
     mrp_io_watch_t *inotify_cb;
+    mrp_process_state_t state; /* kept up to date by inotify */
 } i_watch_t;
 
 typedef struct {
@@ -80,6 +89,12 @@ typedef struct {
     int n_clients;
     int busy : 1;
     int dead : 1;
+    int netlink : 1; /* tracked by the proc connector, not a pidfd */
+    int exited : 1; /* seen exiting, or gone before we got to watch it */
+
+    int pidfd;
+    mrp_io_watch_t *pidfd_wd;
+    mrp_list_hook_t exit_hook; /* to queue of exited pids */
 } nl_pid_watch_t;
 
 /* murphy pid file directory notify */
@@ -97,6 +112,20 @@ static bool subscribed;
 static mrp_io_watch_t *nl_wd;
 static mrp_htbl_t *nl_watches;
 static int nl_n_pid_watches;
+static int nl_n_netlink_watches;
+
+/* exited pids, delivered once per mainloop iteration */
+static MRP_LIST_HOOK(nl_exited);
+static mrp_deferred_t *nl_exit_deferred;
+static mrp_pid_batch_handler_t nl_batch_cb;
+static void *nl_batch_data;
+
+#ifdef HAVE_LINUX_BPF_H
+/* eBPF pid filter */
+static int ebpf_map;
+static int ebpf_prog;
+static bool ebpf_unavailable;
+#endif
 
 static bool id_ok(const char *id)
 {
@@ -123,23 +152,60 @@ static bool id_ok(const char *id)
 }
 
 
-static char *path_from_id(const char *id)
+static int print_path(const char *id, char *buf, size_t size)
 {
-    char buf[PATH_MAX];
     int ret;
 
     if (!id || !id_ok(id))
-        return NULL;
+        return -1;
 
-    ret = snprintf(buf, PATH_MAX, "%s/%s", MURPHY_PROCESS_INOTIFY_DIR, id);
+    ret = snprintf(buf, size, "%s/%s", MURPHY_PROCESS_INOTIFY_DIR, id);
 
-    if (ret < 0 || ret >= PATH_MAX)
+    if (ret < 0 || ret >= (int) size)
+        return -1;
+
+    return 0;
+}
+
+
+static char *path_from_id(const char *id)
+{
+    char buf[PATH_MAX];
+
+    if (print_path(id, buf, sizeof(buf)) < 0)
         return NULL;
 
     return mrp_strdup(buf);
 }
 
 
+static mrp_process_state_t path_state(const char *path)
+{
+    FILE *f = fopen(path, "r");
+
+    if (f) {
+        fclose(f);
+        return MRP_PROCESS_STATE_READY;
+    }
+
+    return MRP_PROCESS_STATE_NOT_READY;
+}
+
+
+static void free_nl_watch(nl_pid_watch_t *w)
+{
+    mrp_list_delete(&w->exit_hook);
+
+    if (w->pidfd_wd)
+        mrp_del_io_watch(w->pidfd_wd);
+
+    if (w->pidfd >= 0)
+        close(w->pidfd);
+
+    mrp_free(w);
+}
+
+
 static void htbl_free_nl_watch(void *key, void *object)
 {
     nl_pid_watch_t *w = (nl_pid_watch_t *) object;
@@ -147,7 +213,7 @@ static void htbl_free_nl_watch(void *key, void *object)
     MRP_UNUSED(key);
 
     if (!w->busy)
-        mrp_free(w);
+        free_nl_watch(w);
     else
         w->dead = TRUE;
 }
@@ -180,7 +246,6 @@ static void process_change(mrp_io_watch_t *wd, int fd, mrp_io_event_t events,
     int bufsize = sizeof(struct inotify_event) + PATH_MAX;
     char buf[bufsize];
     i_watch_t *w;
-    FILE *f;
 
     MRP_UNUSED(wd);
     MRP_UNUSED(user_data);
@@ -226,17 +291,12 @@ static void process_change(mrp_io_watch_t *wd, int fd, mrp_io_event_t events,
             w = (i_watch_t *) mrp_htbl_lookup(i_watches, filename);
 
             if (w) {
-                f = fopen(filename, "r");
+                w->state = path_state(filename);
 
-                if (f) {
-                    fclose(f);
-                    mrp_log_info("Received inotify event for %s, READY", w->path);
-                    w->process_cb(w->path, MRP_PROCESS_STATE_READY, w->userdata);
-                }
-                else {
-                    mrp_log_info("Received inotify event for %s, NOT READY", w->path);
-                    w->process_cb(w->path, MRP_PROCESS_STATE_NOT_READY, w->userdata);
-                }
+                mrp_log_info("Received inotify event for %s, %s", w->path,
+                        w->state == MRP_PROCESS_STATE_READY ?
+                        "READY" : "NOT READY");
+                w->process_cb(w->path, w->state, w->userdata);
             }
             mrp_free(filename);
         }
@@ -316,6 +376,85 @@ static int unsubscribe_proc_events()
 }
 
 
+static void dispatch_exits(mrp_deferred_t *d, void *user_data)
+{
+    mrp_list_hook_t *p, *n;
+    nl_pid_watch_t *nl_w;
+    nl_pid_client_t *client;
+
+    MRP_UNUSED(user_data);
+
+    mrp_disable_deferred(d);
+
+    if (nl_batch_cb)
+        nl_batch_cb(TRUE, nl_batch_data);
+
+    while (!mrp_list_empty(&nl_exited)) {
+        nl_w = mrp_list_entry(nl_exited.next, typeof(*nl_w), exit_hook);
+        mrp_list_delete(&nl_w->exit_hook);
+
+        nl_w->busy = TRUE;
+        mrp_list_foreach(&nl_w->clients, p, n) {
+            client = mrp_list_entry(p, typeof(*client), hook);
+            client->cb(nl_w->pid, MRP_PROCESS_STATE_NOT_READY,
+                    client->user_data);
+        }
+        if (nl_w->dead)
+            free_nl_watch(nl_w);
+        else
+            nl_w->busy = FALSE;
+
+        /* TODO: should we automatically free the wathces? Or let
+         * client do that to preserver symmetricity? */
+    }
+
+    if (nl_batch_cb)
+        nl_batch_cb(FALSE, nl_batch_data);
+}
+
+
+static void queue_exit(nl_pid_watch_t *nl_w)
+{
+    mrp_log_info("process %d exited", nl_w->pid);
+
+    nl_w->exited = TRUE;
+
+    if (!mrp_list_empty(&nl_w->exit_hook))
+        return;
+
+    mrp_list_append(&nl_exited, &nl_w->exit_hook);
+    mrp_enable_deferred(nl_exit_deferred);
+}
+
+
+static void pidfd_exit(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
+        void *user_data)
+{
+    nl_pid_watch_t *nl_w = (nl_pid_watch_t *) user_data;
+
+    MRP_UNUSED(fd);
+    MRP_UNUSED(events);
+
+    /* a pidfd stays readable once the process has exited */
+    mrp_del_io_watch(w);
+    nl_w->pidfd_wd = NULL;
+
+    queue_exit(nl_w);
+}
+
+
+static int open_pidfd(pid_t pid)
+{
+#ifdef __NR_pidfd_open
+    return syscall(__NR_pidfd_open, pid, 0);
+#else
+    MRP_UNUSED(pid);
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
 static void nl_watch(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
         void *user_data)
 {
@@ -368,14 +507,10 @@ static void nl_watch(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
             switch (ev->what) {
                 case PROC_EVENT_EXIT:
                 {
-                    mrp_list_hook_t *p, *n;
                     nl_pid_watch_t *nl_w;
                     char pid_s[16];
                     int ret;
 
-                    mrp_log_info("process %d exited",
-                            ev->event_data.exit.process_pid);
-
                     ret = snprintf(pid_s, sizeof(pid_s), "%u",
                             (unsigned int) ev->event_data.exit.process_pid);
 
@@ -390,21 +525,7 @@ static void nl_watch(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
                         break;
                     }
 
-                    nl_w->busy = TRUE;
-                    mrp_list_foreach(&nl_w->clients, p, n) {
-                        nl_pid_client_t *client;
-
-                        client = mrp_list_entry(p, typeof(*client), hook);
-                        client->cb(nl_w->pid, MRP_PROCESS_STATE_NOT_READY,
-                                client->user_data);
-                    }
-                    if (nl_w->dead)
-                        mrp_free(nl_w);
-                    else
-                        nl_w->busy = FALSE;
-
-                    /* TODO: should we automatically free the wathces? Or let
-                     * client do that to preserver symmetricity? */
+                    queue_exit(nl_w);
                     break;
                 }
                 default:
@@ -466,46 +587,13 @@ static int initialize(mrp_mainloop_t *ml, bool process, bool pid)
     }
 
     if (pid) {
-        if (nl_sock <= 0) {
-            struct sockaddr_nl nl_addr;
-            int nl_options = SOCK_NONBLOCK | SOCK_DGRAM | SOCK_CLOEXEC;
-            struct sock_filter block[] = {
-                BPF_STMT(BPF_RET | BPF_K, 0x0),
-            };
-            struct sock_fprog fp;
+        if (!nl_exit_deferred) {
+            nl_exit_deferred = mrp_add_deferred(ml, dispatch_exits, NULL);
 
-            /* socket creation */
-
-            nl_sock = socket(PF_NETLINK, nl_options, NETLINK_CONNECTOR);
-
-            if (nl_sock <= 0)
-                goto error;
-
-            memset(&nl_addr, 0, sizeof(struct sockaddr_nl));
-            memset(&fp, 0, sizeof(struct sock_fprog));
-
-            /* bind the socket to the address */
-
-            nl_addr.nl_pid = getpid();
-            nl_addr.nl_family = AF_NETLINK;
-            nl_addr.nl_groups = CN_IDX_PROC;
-
-            if (bind(nl_sock, (struct sockaddr *) &nl_addr,
-                    sizeof(struct sockaddr_nl)) < 0)
-                goto error;
-
-            fp.filter = block;
-            fp.len = 1;
-
-            /* set socket filter that blocks everything */
-            if (setsockopt(nl_sock, SOL_SOCKET, SO_ATTACH_FILTER, &fp,
-                    sizeof(struct sock_fprog)) < 0) {
-                mrp_log_error("setting blocking socket filter failed: %s",
-                        strerror(errno));
+            if (!nl_exit_deferred)
                 goto error;
-            }
 
-            nl_wd = mrp_add_io_watch(ml, nl_sock, MRP_IO_EVENT_IN, nl_watch, NULL);
+            mrp_disable_deferred(nl_exit_deferred);
         }
 
         if (!nl_watches) {
@@ -549,14 +637,66 @@ error:
         i_n_process_watches = 0;
     }
 
-    if (pid) {
+    if (pid)
+        nl_n_pid_watches = 0;
 
-        if (nl_sock > 0) {
-            close(nl_sock);
-            nl_sock = -1;
-        }
+    return -1;
+}
 
-        nl_n_pid_watches = 0;
+
+static int initialize_netlink(mrp_mainloop_t *ml)
+{
+    struct sockaddr_nl nl_addr;
+    int nl_options = SOCK_NONBLOCK | SOCK_DGRAM | SOCK_CLOEXEC;
+    struct sock_filter block[] = {
+        BPF_STMT(BPF_RET | BPF_K, 0x0),
+    };
+    struct sock_fprog fp;
+
+    if (nl_sock > 0)
+        return 0;
+
+    /* socket creation */
+
+    nl_sock = socket(PF_NETLINK, nl_options, NETLINK_CONNECTOR);
+
+    if (nl_sock <= 0)
+        goto error;
+
+    memset(&nl_addr, 0, sizeof(struct sockaddr_nl));
+    memset(&fp, 0, sizeof(struct sock_fprog));
+
+    /* bind the socket to the address */
+
+    nl_addr.nl_pid = getpid();
+    nl_addr.nl_family = AF_NETLINK;
+    nl_addr.nl_groups = CN_IDX_PROC;
+
+    if (bind(nl_sock, (struct sockaddr *) &nl_addr,
+            sizeof(struct sockaddr_nl)) < 0)
+        goto error;
+
+    fp.filter = block;
+    fp.len = 1;
+
+    /* set socket filter that blocks everything */
+    if (setsockopt(nl_sock, SOL_SOCKET, SO_ATTACH_FILTER, &fp,
+            sizeof(struct sock_fprog)) < 0) {
+        mrp_log_error("setting blocking socket filter failed: %s",
+                strerror(errno));
+        goto error;
+    }
+
+    nl_wd = mrp_add_io_watch(ml, nl_sock, MRP_IO_EVENT_IN, nl_watch, NULL);
+
+    return 0;
+
+error:
+    mrp_log_error("netlink initialization error");
+
+    if (nl_sock > 0) {
+        close(nl_sock);
+        nl_sock = -1;
     }
 
     return -1;
@@ -578,6 +718,7 @@ static int initialize_pid(mrp_mainloop_t *ml)
 int mrp_process_set_state(const char *id, mrp_process_state_t state)
 {
     char *path = NULL;
+    i_watch_t *w;
     FILE *f;
     int ret = -1;
 
@@ -607,6 +748,11 @@ int mrp_process_set_state(const char *id, mrp_process_state_t state)
             break;
     }
 
+    /* don't wait for inotify to tell us what we just did */
+    if (i_watches && (w = (i_watch_t *) mrp_htbl_lookup(i_watches, path)))
+        w->state = state == MRP_PROCESS_STATE_READY ?
+            MRP_PROCESS_STATE_READY : MRP_PROCESS_STATE_NOT_READY;
+
     ret = 0;
 
 end:
@@ -758,6 +904,9 @@ static int gather_pids_cb(void *key, void *object, void *user_data)
 
     MRP_UNUSED(key);
 
+    if (!w->netlink)
+        return MRP_HTBL_ITER_MORE;
+
     kd->pids[kd->index] = w->pid;
     kd->index++;
 
@@ -767,7 +916,7 @@ static int gather_pids_cb(void *key, void *object, void *user_data)
 
 static int pid_filter_update()
 {
-    pid_t pids[nl_n_pid_watches];
+    pid_t pids[nl_n_netlink_watches + 1];
 
     struct key_data_s kd;
 
@@ -780,33 +929,257 @@ static int pid_filter_update()
 }
 
 
-mrp_process_state_t mrp_process_query_state(const char *id)
+#ifdef HAVE_LINUX_BPF_H
+
+/*
+ * Where the kernel lets us, the watched pids are kept in an eBPF hash map
+ * which is looked up by an eBPF socket filter doing the same checks as the
+ * classic one. Adding or removing a pid is then a single map update, and
+ * the kernel matches exit events in constant time instead of running
+ * through a comparison per watched pid. If the map or the program cannot
+ * be created (old kernel, no privileges, locked memory limits), we fall
+ * back to rebuilding the classic filter on every change.
+ */
+
+#define EBPF_MAX_PIDS 16384
+
+#define EBPF_INSN(_code, _dst, _src, _off, _imm)                        \
+    ((struct bpf_insn) {                                                \
+        .code = _code, .dst_reg = _dst, .src_reg = _src,                \
+        .off  = _off,  .imm     = _imm,                                 \
+    })
+
+#define EBPF_MOV64_REG(_dst, _src)                                      \
+    EBPF_INSN(BPF_ALU64 | BPF_MOV | BPF_X, _dst, _src, 0, 0)
+#define EBPF_MOV64_IMM(_dst, _imm)                                      \
+    EBPF_INSN(BPF_ALU64 | BPF_MOV | BPF_K, _dst, 0, 0, _imm)
+#define EBPF_MOV32_IMM(_dst, _imm)                                      \
+    EBPF_INSN(BPF_ALU | BPF_MOV | BPF_K, _dst, 0, 0, _imm)
+#define EBPF_ADD64_IMM(_dst, _imm)                                      \
+    EBPF_INSN(BPF_ALU64 | BPF_ADD | BPF_K, _dst, 0, 0, _imm)
+#define EBPF_LD_ABS(_size, _offs)                                       \
+    EBPF_INSN(BPF_LD | BPF_ABS | _size, 0, 0, 0, _offs)
+#define EBPF_STX_W(_dst, _src, _off)                                    \
+    EBPF_INSN(BPF_STX | BPF_MEM | BPF_W, _dst, _src, _off, 0)
+#define EBPF_JEQ_IMM(_dst, _imm, _off)                                  \
+    EBPF_INSN(BPF_JMP | BPF_JEQ | BPF_K, _dst, 0, _off, _imm)
+#define EBPF_JNE_IMM(_dst, _imm, _off)                                  \
+    EBPF_INSN(BPF_JMP | BPF_JNE | BPF_K, _dst, 0, _off, _imm)
+#define EBPF_LD_MAP_FD(_dst, _fd)                                       \
+    EBPF_INSN(BPF_LD | BPF_DW | BPF_IMM, _dst, BPF_PSEUDO_MAP_FD, 0, _fd), \
+    EBPF_INSN(0, 0, 0, 0, 0)
+#define EBPF_CALL(_func)                                                \
+    EBPF_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, _func)
+#define EBPF_EXIT()                                                     \
+    EBPF_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+
+static int ebpf(int cmd, union bpf_attr *attr)
 {
-    char *path;
-    FILE *f;
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
 
-    if (initialize_dir() < 0)
-        return MRP_PROCESS_STATE_UNKNOWN;
 
-    path = path_from_id(id);
+static void ebpf_close(void)
+{
+    if (ebpf_prog > 0)
+        close(ebpf_prog);
+    if (ebpf_map > 0)
+        close(ebpf_map);
 
-    if (!path)
-        return MRP_PROCESS_STATE_UNKNOWN;
+    ebpf_prog = ebpf_map = 0;
+    ebpf_unavailable = TRUE;
+}
 
-    f = fopen(path, "r");
 
-    mrp_free(path);
+static int ebpf_setup(void)
+{
+    int nl_type_offset = offsetof(struct nlmsghdr, nlmsg_type);
+    int cn_offset = NLMSG_LENGTH(0);
+    int cn_id_offset = cn_offset + offsetof(struct cn_msg, id);
+    int cn_idx_offset = cn_id_offset + offsetof(struct cb_id, idx);
+    int cn_val_offset = cn_id_offset + offsetof(struct cb_id, val);
+    int proc_offset = cn_offset + offsetof(struct cn_msg, data);
+    int proc_what_offset = proc_offset + offsetof(struct proc_event, what);
+    int proc_pid_offset = proc_offset + offsetof(struct proc_event, event_data)
+        + offsetof(struct exit_proc_event, process_pid);
 
-    if (f) {
-        fclose(f);
-        return MRP_PROCESS_STATE_READY;
+    union bpf_attr attr;
+
+    if (ebpf_unavailable || nl_sock <= 0)
+        return -1;
+
+    if (ebpf_prog > 0)
+        return 0;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type    = BPF_MAP_TYPE_HASH;
+    attr.key_size    = sizeof(uint32_t);
+    attr.value_size  = sizeof(uint8_t);
+    attr.max_entries = EBPF_MAX_PIDS;
+    attr.map_flags   = BPF_F_NO_PREALLOC;
+
+    if ((ebpf_map = ebpf(BPF_MAP_CREATE, &attr)) < 0) {
+        mrp_debug("failed to create eBPF pid map: %s", strerror(errno));
+        ebpf_map = 0;
+        goto fail;
     }
 
-    return MRP_PROCESS_STATE_NOT_READY;
+    {
+        /*
+         * Same checks as the classic filter, then look up the exit pid.
+         * The absolute loads convert to network byte order, so the map
+         * is keyed by the pids in network byte order.
+         */
+        struct bpf_insn prog[] = {
+            EBPF_MOV64_REG(BPF_REG_6, BPF_REG_1),
+
+            EBPF_LD_ABS(BPF_H, nl_type_offset),
+            EBPF_JEQ_IMM(BPF_REG_0, htons(NLMSG_ERROR), 16),
+            EBPF_JNE_IMM(BPF_REG_0, htons(NLMSG_DONE), 17),
+
+            EBPF_LD_ABS(BPF_W, cn_idx_offset),
+            EBPF_JNE_IMM(BPF_REG_0, htonl(CN_IDX_PROC), 15),
+            EBPF_LD_ABS(BPF_W, cn_val_offset),
+            EBPF_JNE_IMM(BPF_REG_0, htonl(CN_VAL_PROC), 13),
+
+            EBPF_LD_ABS(BPF_W, proc_what_offset),
+            EBPF_JNE_IMM(BPF_REG_0, htonl(PROC_EVENT_EXIT), 11),
+
+            EBPF_LD_ABS(BPF_W, proc_pid_offset),
+            EBPF_STX_W(BPF_REG_10, BPF_REG_0, -4),
+            EBPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+            EBPF_ADD64_IMM(BPF_REG_2, -4),
+            EBPF_LD_MAP_FD(BPF_REG_1, ebpf_map),
+            EBPF_CALL(BPF_FUNC_map_lookup_elem),
+            EBPF_JEQ_IMM(BPF_REG_0, 0, 2),
+
+            /* accept */
+            EBPF_MOV32_IMM(BPF_REG_0, -1),
+            EBPF_EXIT(),
+
+            /* drop */
+            EBPF_MOV64_IMM(BPF_REG_0, 0),
+            EBPF_EXIT(),
+        };
+
+        memset(&attr, 0, sizeof(attr));
+        attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+        attr.insns     = (uintptr_t)prog;
+        attr.insn_cnt  = MRP_ARRAY_SIZE(prog);
+        attr.license   = (uintptr_t)"BSD";
+
+        if ((ebpf_prog = ebpf(BPF_PROG_LOAD, &attr)) < 0) {
+            mrp_debug("failed to load eBPF pid filter: %s", strerror(errno));
+            ebpf_prog = 0;
+            goto fail;
+        }
+    }
+
+    if (setsockopt(nl_sock, SOL_SOCKET, SO_ATTACH_BPF, &ebpf_prog,
+                   sizeof(ebpf_prog)) < 0) {
+        mrp_debug("failed to attach eBPF pid filter: %s", strerror(errno));
+        goto fail;
+    }
+
+    mrp_log_info("using eBPF map for process exit filtering");
+
+    return 0;
+
+ fail:
+    mrp_log_info("eBPF unavailable, using classic process exit filter");
+    ebpf_close();
+
+    return -1;
 }
 
 
-mrp_process_state_t mrp_pid_query_state(pid_t pid)
+static int ebpf_update(pid_t pid, bool add)
+{
+    union bpf_attr attr;
+    uint32_t       key = htonl(pid);
+    uint8_t        value = 1;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = ebpf_map;
+    attr.key    = (uintptr_t)&key;
+
+    if (add) {
+        attr.value = (uintptr_t)&value;
+        attr.flags = BPF_ANY;
+
+        return ebpf(BPF_MAP_UPDATE_ELEM, &attr);
+    }
+    else {
+        if (ebpf(BPF_MAP_DELETE_ELEM, &attr) < 0 && errno != ENOENT)
+            return -1;
+
+        return 0;
+    }
+}
+
+#endif /* HAVE_LINUX_BPF_H */
+
+
+static int pid_filter_add(pid_t pid)
+{
+#ifdef HAVE_LINUX_BPF_H
+    if (ebpf_setup() == 0) {
+        if (ebpf_update(pid, TRUE) == 0)
+            return 0;
+
+        mrp_log_warning("failed to add pid %d to eBPF map (%s), falling "
+                        "back to classic filter", pid, strerror(errno));
+        ebpf_close();
+    }
+#else
+    MRP_UNUSED(pid);
+#endif
+
+    return pid_filter_update();
+}
+
+
+static int pid_filter_del(pid_t pid)
+{
+#ifdef HAVE_LINUX_BPF_H
+    if (ebpf_prog > 0) {
+        if (ebpf_update(pid, FALSE) == 0)
+            return 0;
+
+        mrp_log_warning("failed to remove pid %d from eBPF map (%s), "
+                        "falling back to classic filter", pid,
+                        strerror(errno));
+        ebpf_close();
+    }
+#else
+    MRP_UNUSED(pid);
+#endif
+
+    return pid_filter_update();
+}
+
+
+mrp_process_state_t mrp_process_query_state(const char *id)
+{
+    char path[PATH_MAX];
+    i_watch_t *w;
+
+    if (initialize_dir() < 0)
+        return MRP_PROCESS_STATE_UNKNOWN;
+
+    if (print_path(id, path, sizeof(path)) < 0)
+        return MRP_PROCESS_STATE_UNKNOWN;
+
+    /* watched ids are kept up to date by inotify */
+    if (i_watches && (w = (i_watch_t *) mrp_htbl_lookup(i_watches, path)))
+        return w->state;
+
+    return path_state(path);
+}
+
+
+static mrp_process_state_t procfs_state(pid_t pid)
 {
     char path[64];
     struct stat s;
@@ -832,6 +1205,26 @@ end:
 }
 
 
+mrp_process_state_t mrp_pid_query_state(pid_t pid)
+{
+    nl_pid_watch_t *nl_w;
+    char pid_s[16];
+    int ret;
+
+    /* watched pids are kept up to date by their exit notifications */
+    if (nl_watches) {
+        ret = snprintf(pid_s, sizeof(pid_s), "%u", (unsigned int) pid);
+
+        if (ret > 0 && ret < (int) sizeof(pid_s) &&
+                (nl_w = (nl_pid_watch_t *) mrp_htbl_lookup(nl_watches, pid_s)))
+            return nl_w->exited ?
+                MRP_PROCESS_STATE_NOT_READY : MRP_PROCESS_STATE_READY;
+    }
+
+    return procfs_state(pid);
+}
+
+
 int mrp_process_set_watch(const char *id, mrp_mainloop_t *ml,
         mrp_process_watch_handler_t cb, void *userdata)
 {
@@ -857,6 +1250,8 @@ int mrp_process_set_watch(const char *id, mrp_mainloop_t *ml,
     if (!w->filename)
         goto error;
 
+    w->state = path_state(w->filename);
+
     if (mrp_htbl_insert(i_watches, w->filename, w) < 0)
         goto error;
 
@@ -875,6 +1270,50 @@ error:
 }
 
 
+static int watch_pid(nl_pid_watch_t *nl_w, mrp_mainloop_t *ml)
+{
+    /*
+     * Prefer a pidfd of our own for every watched pid: it becomes readable
+     * once the process exits, without any wakeups for unrelated processes.
+     * Only if the kernel does not support pidfds we fall back to following
+     * exit events from the process connector.
+     */
+
+    nl_w->pidfd = open_pidfd(nl_w->pid);
+
+    if (nl_w->pidfd >= 0) {
+        nl_w->pidfd_wd = mrp_add_io_watch(ml, nl_w->pidfd, MRP_IO_EVENT_IN,
+                pidfd_exit, nl_w);
+
+        if (nl_w->pidfd_wd)
+            return 0;
+
+        close(nl_w->pidfd);
+        nl_w->pidfd = -1;
+    }
+
+    if (initialize_netlink(ml) < 0)
+        return -1;
+
+    nl_w->netlink = TRUE;
+    nl_n_netlink_watches++;
+
+    pid_filter_add(nl_w->pid);
+
+    if (!subscribed)
+        subscribe_proc_events();
+
+    return 0;
+}
+
+
+void mrp_pid_set_batch_handler(mrp_pid_batch_handler_t cb, void *user_data)
+{
+    nl_batch_cb = cb;
+    nl_batch_data = user_data;
+}
+
+
 mrp_pid_watch_t *mrp_pid_set_watch(pid_t pid, mrp_mainloop_t *ml,
         mrp_pid_watch_handler_t cb, void *userdata)
 {
@@ -902,7 +1341,9 @@ mrp_pid_watch_t *mrp_pid_set_watch(pid_t pid, mrp_mainloop_t *ml,
             goto error;
 
         mrp_list_init(&nl_w->clients);
+        mrp_list_init(&nl_w->exit_hook);
         nl_w->pid = pid;
+        nl_w->pidfd = -1;
         memcpy(nl_w->pid_s, pid_s, sizeof(nl_w->pid_s));
 
         already_inserted = FALSE;
@@ -921,7 +1362,8 @@ mrp_pid_watch_t *mrp_pid_set_watch(pid_t pid, mrp_mainloop_t *ml,
     client->w = (mrp_pid_watch_t *) mrp_allocz(sizeof(mrp_pid_watch_t));
 
     if (!client->w) {
-        mrp_free(nl_w);
+        if (!already_inserted)
+            mrp_free(nl_w);
         goto error;
     }
 
@@ -939,15 +1381,21 @@ mrp_pid_watch_t *mrp_pid_set_watch(pid_t pid, mrp_mainloop_t *ml,
         }
 
         nl_n_pid_watches++;
-    }
-
-    pid_filter_update();
 
-    if (!subscribed)
-        subscribe_proc_events();
+        if (watch_pid(nl_w, ml) < 0) {
+            mrp_list_delete(&client->hook);
+            mrp_htbl_remove(nl_watches, nl_w->pid_s, TRUE);
+            nl_n_pid_watches--;
+            goto error;
+        }
+    }
 
     /* check that the pid is still there -- return error if not */
 
+    if (!already_inserted &&
+            procfs_state(pid) != MRP_PROCESS_STATE_READY)
+        nl_w->exited = TRUE;
+
     if (mrp_pid_query_state(pid) != MRP_PROCESS_STATE_READY)
         goto error_process;
 
@@ -959,8 +1407,8 @@ error_process:
 
 error:
     if (client) {
-        mrp_free(client);
         mrp_free(client->w);
+        mrp_free(client);
     }
 
     return NULL;
@@ -1053,16 +1501,22 @@ int mrp_pid_remove_watch(mrp_pid_watch_t *w)
     nl_w->n_clients--;
 
     if (nl_w->n_clients == 0) {
+        bool netlink = nl_w->netlink;
+
         /* no-one is interested in this pid anymore */
         mrp_htbl_remove(nl_watches, pid_s, TRUE);
         nl_n_pid_watches--;
 
-        pid_filter_update();
+        if (netlink) {
+            nl_n_netlink_watches--;
 
-        if (nl_n_pid_watches == 0) {
-            /* no-one is following pids anymore */
-            if (subscribed)
-                unsubscribe_proc_events();
+            pid_filter_del(w->pid);
+
+            if (nl_n_netlink_watches == 0) {
+                /* no-one is following pids anymore */
+                if (subscribed)
+                    unsubscribe_proc_events();
+            }
         }
     }
 
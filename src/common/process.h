@@ -69,6 +69,16 @@ mrp_pid_watch_t *mrp_pid_set_watch(pid_t pid, mrp_mainloop_t *ml,
 
 int mrp_pid_remove_watch(mrp_pid_watch_t *w);
 
+/*
+ * Exits noticed during one mainloop iteration are delivered together. If a
+ * batch handler is set, it is called with begin TRUE before and begin FALSE
+ * after the pid watch callbacks of such a batch.
+ */
+
+typedef void (*mrp_pid_batch_handler_t)(bool begin, void *user_data);
+
+void mrp_pid_set_batch_handler(mrp_pid_batch_handler_t cb, void *user_data);
+
 
 MRP_CDECL_END
 
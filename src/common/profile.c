@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
+#include <murphy/common/profile.h>
+
+#define PHASE_NAME_MAX 128
+
+/*
+ * Recorded phases are kept in the order they were opened, which together
+ * with the nesting depth is enough to print them as an indented tree. A
+ * phase which is still open when dumped is reported up to the dump time.
+ * Closing a phase closes all the phases nested in it as well.
+ */
+
+typedef struct {
+    char     name[PHASE_NAME_MAX];       /* phase name */
+    int      depth;                      /* nesting depth */
+    int      open;                       /* whether not closed yet */
+    uint64_t wall_start;                 /* nsecs of CLOCK_MONOTONIC */
+    uint64_t wall_end;
+    uint64_t cpu_start;                  /* nsecs of process CPU time */
+    uint64_t cpu_end;
+} phase_t;
+
+static int      active;                  /* whether recording */
+static phase_t *phases;                  /* recorded phases */
+static int      nphase;                  /* number of phases */
+static int      depth;                   /* current nesting depth */
+static uint64_t started;                 /* start of recording */
+
+
+static inline uint64_t clock_ns(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+int mrp_profile_start(void)
+{
+    mrp_profile_stop();
+
+    started = clock_ns(CLOCK_MONOTONIC);
+    active  = TRUE;
+
+    return TRUE;
+}
+
+
+void mrp_profile_stop(void)
+{
+    mrp_free(phases);
+    phases = NULL;
+    nphase = 0;
+    depth  = 0;
+    active = FALSE;
+}
+
+
+int mrp_profile_active(void)
+{
+    return active;
+}
+
+
+int mrp_profile_begin(const char *format, ...)
+{
+    phase_t *p;
+    va_list  ap;
+
+    if (MRP_LIKELY(!active))
+        return -1;
+
+    if (!mrp_reallocz(phases, nphase, nphase + 1))
+        return -1;
+
+    p = phases + nphase;
+
+    va_start(ap, format);
+    vsnprintf(p->name, sizeof(p->name), format, ap);
+    va_end(ap);
+
+    p->depth      = depth++;
+    p->open       = TRUE;
+    p->cpu_start  = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    p->wall_start = clock_ns(CLOCK_MONOTONIC);
+
+    return nphase++;
+}
+
+
+void mrp_profile_end(int id)
+{
+    uint64_t wall, cpu;
+    phase_t *p;
+    int      i;
+
+    if (id < 0 || id >= nphase || !phases[id].open)
+        return;
+
+    wall = clock_ns(CLOCK_MONOTONIC);
+    cpu  = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+
+    /* also close any nested phase left open, eg. by a Lua error */
+    for (i = id, p = phases + id; i < nphase; i++, p++) {
+        if (p->open) {
+            p->wall_end = wall;
+            p->cpu_end  = cpu;
+            p->open     = FALSE;
+        }
+    }
+
+    depth = phases[id].depth;
+}
+
+
+static void dump_text(FILE *fp, phase_t *p, uint64_t wall, uint64_t cpu)
+{
+    fprintf(fp, "%10.3f %10.3f  %*s%s%s\n", wall / 1000000.0, cpu / 1000000.0,
+            2 * p->depth, "", p->name, p->open ? " (unfinished)" : "");
+}
+
+
+static void dump_chrome(FILE *fp, phase_t *p, uint64_t wall, uint64_t cpu,
+                        int first)
+{
+    const char *c;
+    uint64_t    ts = p->wall_start - started;
+
+    fprintf(fp, "%s\n{\"name\":\"", first ? "" : ",");
+
+    for (c = p->name; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            fputc('\\', fp);
+        if ((unsigned char)*c >= ' ')
+            fputc(*c, fp);
+    }
+
+    fprintf(fp, "\",\"cat\":\"startup\",\"ph\":\"X\","
+            "\"ts\":%llu.%03llu,\"dur\":%llu.%03llu,\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"cpu_us\":%llu.%03llu}}",
+            (unsigned long long)(ts / 1000), (unsigned long long)(ts % 1000),
+            (unsigned long long)(wall / 1000),
+            (unsigned long long)(wall % 1000),
+            (int)getpid(), (int)getpid(),
+            (unsigned long long)(cpu / 1000), (unsigned long long)(cpu % 1000));
+}
+
+
+int mrp_profile_dump(FILE *fp, mrp_trace_format_t format)
+{
+    uint64_t wall, cpu, wall_now, cpu_now;
+    phase_t *p;
+    int      i;
+
+    wall_now = clock_ns(CLOCK_MONOTONIC);
+    cpu_now  = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+
+    if (format == MRP_TRACE_FORMAT_CHROME)
+        fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    else
+        fprintf(fp, "%10s %10s  %s\n", "wall (ms)", "cpu (ms)", "phase");
+
+    for (i = 0, p = phases; i < nphase; i++, p++) {
+        wall = (p->open ? wall_now : p->wall_end) - p->wall_start;
+        cpu  = (p->open ? cpu_now  : p->cpu_end ) - p->cpu_start;
+
+        if (format == MRP_TRACE_FORMAT_CHROME)
+            dump_chrome(fp, p, wall, cpu, i == 0);
+        else
+            dump_text(fp, p, wall, cpu);
+    }
+
+    if (format == MRP_TRACE_FORMAT_CHROME)
+        fprintf(fp, "\n]}\n");
+    else
+        fprintf(fp, "%10.3f %10.3f  total\n",
+                (wall_now - started) / 1000000.0, cpu_now / 1000000.0);
+
+    fflush(fp);
+
+    return TRUE;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MURPHY_PROFILE_H__
+#define __MURPHY_PROFILE_H__
+
+/** \file
+ * Coarse-grained phase profiling, mainly for daemon startup.
+ *
+ * A phase is opened with mrp_profile_begin and closed with mrp_profile_end
+ * and records both the wall clock and the process CPU time spent in it.
+ * Phases can nest, eg. the initialization of a plugin within loading the
+ * configuration. While profiling is not started, beginning a phase costs
+ * a single check. Phases are meant to be opened and closed by the main
+ * thread only.
+ */
+
+#include <stdio.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/trace.h>
+
+MRP_CDECL_BEGIN
+
+/** Start recording phases. */
+int mrp_profile_start(void);
+
+/** Stop recording phases and forget the recorded ones. */
+void mrp_profile_stop(void);
+
+/** Check whether phases are being recorded. */
+int mrp_profile_active(void);
+
+/** Open a phase, returning its id to pass to mrp_profile_end, or -1. */
+int mrp_profile_begin(const char *format, ...) MRP_PRINTF_LIKE(1, 2);
+
+/** Close the phase with the given id. */
+void mrp_profile_end(int id);
+
+/** Dump the recorded phases as a report or as a Chrome trace. */
+int mrp_profile_dump(FILE *fp, mrp_trace_format_t format);
+
+MRP_CDECL_END
+
+#endif /* __MURPHY_PROFILE_H__ */
@@ -28,6 +28,8 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 #include <sys/time.h>
 
 #include <murphy/common/debug.h>
@@ -35,16 +37,27 @@
 #include <murphy/common/list.h>
 #include <murphy/common/pulse-subloop.h>
 
+/* set in tv_usec by PulseAudio for CLOCK_MONOTONIC-based time events */
+#ifndef PA_TIMEVAL_RTCLOCK
+#    define PA_TIMEVAL_RTCLOCK ((time_t)(1LU << 30))
+#endif
+
+/* max. number of freed time events kept around with their timers */
+#define TIME_SPARE_MAX 16
 
 struct pa_murphy_mainloop {
     mrp_mainloop_t  *ml;
     pa_mainloop_api  api;
     mrp_list_hook_t  io_events;
     mrp_list_hook_t  time_events;
-    mrp_list_hook_t  defer_events;
+    mrp_list_hook_t  defer_events;               /* enabled defer events */
+    mrp_list_hook_t  defer_disabled;             /* disabled defer events */
     mrp_list_hook_t  io_dead;
     mrp_list_hook_t  time_dead;
     mrp_list_hook_t  defer_dead;
+    mrp_list_hook_t  time_spare;                 /* freed, with timer kept */
+    int              ntime_spare;
+    mrp_deferred_t  *defer;                      /* runs all defer events */
 };
 
 
@@ -76,21 +89,58 @@ struct pa_time_event {
 
 struct pa_defer_event {
     pa_murphy_mainloop          *m;
-    mrp_deferred_t              *d;
     pa_defer_event_cb_t          cb;
     pa_defer_event_destroy_cb_t  destroy;
     void                        *userdata;
     mrp_list_hook_t              hook;
     int                          busy : 1;
     int                          dead : 1;
+    int                          enabled : 1;
 };
 
 
+/*
+ * PulseAudio creates, toggles and frees its events all the time, so they
+ * are allocated from object pools shared by all PA main loop objects.
+ */
+
+static mrp_objpool_t *io_pool;
+static mrp_objpool_t *time_pool;
+static mrp_objpool_t *defer_pool;
+
+static void defer_batch_cb(mrp_deferred_t *def, void *userdata);
+
+
+static mrp_objpool_t *create_pool(const char *name, size_t size)
+{
+    mrp_objpool_config_t cfg;
+
+    mrp_clear(&cfg);
+    cfg.name    = (char *)name;
+    cfg.objsize = size;
+
+    return mrp_objpool_create(&cfg);
+}
+
+
+static bool create_pools(void)
+{
+    if (io_pool == NULL)
+        io_pool = create_pool("pa-io-event", sizeof(pa_io_event));
+    if (time_pool == NULL)
+        time_pool = create_pool("pa-time-event", sizeof(pa_time_event));
+    if (defer_pool == NULL)
+        defer_pool = create_pool("pa-defer-event", sizeof(pa_defer_event));
+
+    return io_pool != NULL && time_pool != NULL && defer_pool != NULL;
+}
+
+
 pa_murphy_mainloop *pa_murphy_mainloop_new(mrp_mainloop_t *ml)
 {
     pa_murphy_mainloop *m;
 
-    if (ml == NULL)
+    if (ml == NULL || !create_pools())
         return NULL;
 
     m = mrp_allocz(sizeof(*m));
@@ -102,9 +152,20 @@ pa_murphy_mainloop *pa_murphy_mainloop_new(mrp_mainloop_t *ml)
     mrp_list_init(&m->io_events);
     mrp_list_init(&m->time_events);
     mrp_list_init(&m->defer_events);
+    mrp_list_init(&m->defer_disabled);
     mrp_list_init(&m->io_dead);
     mrp_list_init(&m->time_dead);
     mrp_list_init(&m->defer_dead);
+    mrp_list_init(&m->time_spare);
+
+    m->defer = mrp_add_deferred(ml, defer_batch_cb, m);
+
+    if (m->defer == NULL) {
+        mrp_free(m);
+        return NULL;
+    }
+
+    mrp_disable_deferred(m->defer);
 
     return m;
 }
@@ -127,13 +188,13 @@ static void cleanup_io_events(pa_murphy_mainloop *m)
             io->destroy(&io->m->api, io, io->userdata);
         }
 
-        mrp_free(io);
+        mrp_objpool_free(io);
     }
 
     mrp_list_foreach(&m->io_dead, p, n) {
         io = mrp_list_entry(p, typeof(*io), hook);
         mrp_list_delete(&io->hook);
-        mrp_free(io);
+        mrp_objpool_free(io);
     }
 }
 
@@ -155,42 +216,65 @@ static void cleanup_time_events(pa_murphy_mainloop *m)
             t->destroy(&t->m->api, t, t->userdata);
         }
 
-        mrp_free(t);
+        mrp_objpool_free(t);
     }
 
     mrp_list_foreach(&m->time_dead, p, n) {
         t = mrp_list_entry(p, typeof(*t), hook);
         mrp_list_delete(&t->hook);
-        mrp_free(t);
+        mrp_del_timer(t->t);
+        mrp_objpool_free(t);
+    }
+
+    mrp_list_foreach(&m->time_spare, p, n) {
+        t = mrp_list_entry(p, typeof(*t), hook);
+        mrp_list_delete(&t->hook);
+        mrp_del_timer(t->t);
+        mrp_objpool_free(t);
     }
+
+    m->ntime_spare = 0;
 }
 
 
-static void cleanup_defer_events(pa_murphy_mainloop *m)
+static void cleanup_defer_list(pa_murphy_mainloop *m, mrp_list_hook_t *list)
 {
     mrp_list_hook_t *p, *n;
     pa_defer_event  *d;
 
-    mrp_list_foreach(&m->defer_events, p, n) {
+    MRP_UNUSED(m);
+
+    mrp_list_foreach(list, p, n) {
         d = mrp_list_entry(p, typeof(*d), hook);
 
         mrp_list_delete(&d->hook);
-        mrp_del_deferred(d->d);
-        d->d = NULL;
 
         if (d->destroy != NULL) {
             d->dead = true;
             d->destroy(&d->m->api, d, d->userdata);
         }
 
-        mrp_free(d);
+        mrp_objpool_free(d);
     }
+}
+
+
+static void cleanup_defer_events(pa_murphy_mainloop *m)
+{
+    mrp_list_hook_t *p, *n;
+    pa_defer_event  *d;
+
+    cleanup_defer_list(m, &m->defer_events);
+    cleanup_defer_list(m, &m->defer_disabled);
 
     mrp_list_foreach(&m->defer_dead, p, n) {
         d = mrp_list_entry(p, typeof(*d), hook);
         mrp_list_delete(&d->hook);
-        mrp_free(d);
+        mrp_objpool_free(d);
     }
+
+    mrp_del_deferred(m->defer);
+    m->defer = NULL;
 }
 
 
@@ -202,6 +286,32 @@ void pa_murphy_mainloop_free(pa_murphy_mainloop *m)
     cleanup_io_events(m);
     cleanup_time_events(m);
     cleanup_defer_events(m);
+
+    mrp_free(m);
+}
+
+
+static mrp_io_event_t io_event_mask(pa_io_event_flags_t e)
+{
+    mrp_io_event_t events = 0;
+
+    if (e & PA_IO_EVENT_INPUT)  events |= MRP_IO_EVENT_IN;
+    if (e & PA_IO_EVENT_OUTPUT) events |= MRP_IO_EVENT_OUT;
+    if (e & PA_IO_EVENT_HANGUP) events |= MRP_IO_EVENT_HUP; /* RDHUP ? */
+    if (e & PA_IO_EVENT_ERROR)  events |= MRP_IO_EVENT_ERR;
+
+    return events;
+}
+
+
+static void io_release(pa_io_event *io)
+{
+    mrp_list_delete(&io->hook);
+
+    if (io->destroy != NULL)
+        io->destroy(&io->m->api, io, io->userdata);
+
+    mrp_objpool_free(io);
 }
 
 
@@ -224,44 +334,38 @@ static void io_event_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
     io->cb(&io->m->api, io, fd, flags, io->userdata);
     io->busy = false;
 
-    if (io->dead) {
-        mrp_list_delete(&io->hook);
-        mrp_free(io);
-    }
+    if (io->dead)
+        io_release(io);
 }
 
 
 static pa_io_event *io_new(pa_mainloop_api *api, int fd, pa_io_event_flags_t e,
                            pa_io_event_cb_t cb, void *userdata)
 {
-    pa_murphy_mainloop *m      = (pa_murphy_mainloop *)api->userdata;
-    mrp_io_event_t      events = 0;
+    pa_murphy_mainloop *m = (pa_murphy_mainloop *)api->userdata;
     pa_io_event        *io;
 
     mrp_debug("PA create I/O watch for fd %d, events 0x%x", fd, e);
 
-    io = mrp_allocz(sizeof(*io));
+    io = mrp_objpool_alloc(io_pool);
 
     if (io == NULL)
         return NULL;
 
+    mrp_clear(io);
     mrp_list_init(&io->hook);
 
-    if (e & PA_IO_EVENT_INPUT)  events |= MRP_IO_EVENT_IN;
-    if (e & PA_IO_EVENT_OUTPUT) events |= MRP_IO_EVENT_OUT;
-    if (e & PA_IO_EVENT_HANGUP) events |= MRP_IO_EVENT_HUP; /* RDHUP ? */
-    if (e & PA_IO_EVENT_ERROR)  events |= MRP_IO_EVENT_ERR;
-
     io->m        = m;
     io->fd       = fd;
     io->cb       = cb;
     io->userdata = userdata;
-    io->w        = mrp_add_io_watch(m->ml, fd, events, io_event_cb, io);
+    io->w        = mrp_add_io_watch(m->ml, fd, io_event_mask(e),
+                                    io_event_cb, io);
 
     if (io->w != NULL)
         mrp_list_append(&m->io_events, &io->hook);
     else {
-        mrp_free(io);
+        mrp_objpool_free(io);
         io = NULL;
     }
 
@@ -272,18 +376,15 @@ static pa_io_event *io_new(pa_mainloop_api *api, int fd, pa_io_event_flags_t e,
 static void io_enable(pa_io_event *io, pa_io_event_flags_t e)
 {
     pa_murphy_mainloop *m      = io->m;
-    mrp_io_event_t      events = 0;
+    mrp_io_event_t      events = io_event_mask(e);
 
     mrp_debug("PA enable events 0x%x for I/O watch %p (fd %d)", e, io, io->fd);
 
-    mrp_del_io_watch(io->w);
-    io->w = NULL;
-
-    if (e & PA_IO_EVENT_INPUT)  events |= MRP_IO_EVENT_IN;
-    if (e & PA_IO_EVENT_OUTPUT) events |= MRP_IO_EVENT_OUT;
-    if (e & PA_IO_EVENT_HANGUP) events |= MRP_IO_EVENT_HUP; /* RDHUP ? */
-    if (e & PA_IO_EVENT_ERROR)  events |= MRP_IO_EVENT_ERR;
+    if (mrp_mod_io_watch(io->w, events) == 0)
+        return;
 
+    /* polling was stopped for the fd (eg. on hangup), so start over */
+    mrp_del_io_watch(io->w);
     io->w = mrp_add_io_watch(m->ml, io->fd, events, io_event_cb, io);
 }
 
@@ -294,20 +395,17 @@ static void io_free(pa_io_event *io)
 
     mrp_debug("PA free I/O watch %p (fd %d)", io, io->fd);
 
-    mrp_list_delete(&io->hook);
     mrp_del_io_watch(io->w);
     io->w = NULL;
 
     io->dead = true;
 
-    if (!io->busy && !io->dead) {
-        io->busy = true;
-        if (io->destroy != NULL)
-            io->destroy(&io->m->api, io, io->userdata);
-        mrp_free(io);
-    }
-    else
+    if (!io->busy)
+        io_release(io);
+    else {
+        mrp_list_delete(&io->hook);
         mrp_list_append(&m->io_dead, &io->hook);
+    }
 }
 
 
@@ -322,6 +420,28 @@ static void io_set_destroy(pa_io_event *io, pa_io_event_destroy_cb_t cb)
 
 
 
+static void time_release(pa_time_event *t)
+{
+    pa_murphy_mainloop *m = t->m;
+
+    mrp_list_delete(&t->hook);
+
+    if (t->destroy != NULL)
+        t->destroy(&m->api, t, t->userdata);
+
+    /* keep a few stopped timers around for the next time_new */
+    if (m->ntime_spare < TIME_SPARE_MAX) {
+        mrp_stop_timer(t->t);
+        mrp_list_append(&m->time_spare, &t->hook);
+        m->ntime_spare++;
+    }
+    else {
+        mrp_del_timer(t->t);
+        mrp_objpool_free(t);
+    }
+}
+
+
 static void time_event_cb(mrp_timer_t *tmr, void *userdata)
 {
     pa_time_event *t = (pa_time_event *)userdata;
@@ -330,33 +450,38 @@ static void time_event_cb(mrp_timer_t *tmr, void *userdata)
 
     mrp_debug("PA time event for timer %p", t);
 
-    mrp_del_timer(t->t);
-    t->t = NULL;
+    mrp_stop_timer(t->t);
 
     t->busy = true;
     t->cb(&t->m->api, t, &t->tv, t->userdata);
     t->busy = false;
 
-    if (t->dead) {
-        mrp_del_timer(t->t);
-        mrp_list_delete(&t->hook);
-        mrp_free(t);
-    }
+    if (t->dead)
+        time_release(t);
 }
 
 
-static unsigned int timeval_diff(const struct timeval *from,
-                                 const struct timeval *to)
+static uint64_t timeval_diff(const struct timeval *tv)
 {
-    int msecs, musecs, diff;
-
-    msecs  = (to->tv_sec - from->tv_sec) * 1000;
-    musecs = ((int)to->tv_usec - (int)from->tv_usec) / 1000;
+    struct timeval  now;
+    struct timespec ts;
+    int64_t         usec, diff;
+
+    if (tv->tv_usec & PA_TIMEVAL_RTCLOCK) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now.tv_sec  = ts.tv_sec;
+        now.tv_usec = ts.tv_nsec / 1000;
+        usec        = tv->tv_usec & ~PA_TIMEVAL_RTCLOCK;
+    }
+    else {
+        gettimeofday(&now, NULL);
+        usec = tv->tv_usec;
+    }
 
-    diff = msecs + musecs;
+    diff = ((int64_t)tv->tv_sec - now.tv_sec) * 1000000 + (usec - now.tv_usec);
 
     if (diff >= 0)
-        return (unsigned int)diff;
+        return (uint64_t)diff;
     else
         return 0;
 }
@@ -367,30 +492,52 @@ static pa_time_event *time_new(pa_mainloop_api *api, const struct timeval *tv,
 {
     pa_murphy_mainloop *m = (pa_murphy_mainloop *)api->userdata;
     pa_time_event      *t;
-    struct timeval      now;
+    mrp_timer_t        *tmr;
+    uint64_t            usecs;
 
-    gettimeofday(&now, NULL);
+    usecs = tv ? timeval_diff(tv) : 0;
 
-    mrp_debug("PA create timer for %u msecs", timeval_diff(&now, tv));
+    mrp_debug("PA create timer for %llu usecs", (unsigned long long)usecs);
 
-    t = mrp_allocz(sizeof(*t));
+    if (!mrp_list_empty(&m->time_spare)) {
+        t   = mrp_list_entry(m->time_spare.next, typeof(*t), hook);
+        tmr = t->t;
 
-    if (t == NULL)
-        return NULL;
+        mrp_list_delete(&t->hook);
+        m->ntime_spare--;
+
+        if (tv != NULL)
+            mrp_mod_timer_usecs(tmr, usecs);
+    }
+    else {
+        t = mrp_objpool_alloc(time_pool);
+
+        if (t == NULL)
+            return NULL;
 
+        tmr = mrp_add_timer_usecs(m->ml, usecs, 0, time_event_cb, t);
+
+        if (tmr == NULL) {
+            mrp_objpool_free(t);
+            return NULL;
+        }
+
+        if (tv == NULL)
+            mrp_stop_timer(tmr);
+    }
+
+    mrp_clear(t);
     mrp_list_init(&t->hook);
 
     t->m        = m;
+    t->t        = tmr;
     t->cb       = cb;
     t->userdata = userdata;
-    t->t        = mrp_add_timer(m->ml, timeval_diff(&now, tv), time_event_cb, t);
 
-    if (t->t != NULL)
-        mrp_list_append(&m->time_events, &t->hook);
-    else {
-        mrp_free(t);
-        t = NULL;
-    }
+    if (tv != NULL)
+        t->tv = *tv;
+
+    mrp_list_append(&m->time_events, &t->hook);
 
     return t;
 }
@@ -398,17 +545,24 @@ static pa_time_event *time_new(pa_mainloop_api *api, const struct timeval *tv,
 
 static void time_restart(pa_time_event *t, const struct timeval *tv)
 {
-    pa_murphy_mainloop *m = t->m;
-    struct timeval      now;
-
-    gettimeofday(&now, NULL);
-
-    mrp_debug("PA restart timer %p with %u msecs", t, timeval_diff(&now, tv));
-
-    mrp_del_timer(t->t);
-    t->t = NULL;
+    /*
+     * Notes:
+     *     The timer is modified in place instead of being deleted and
+     *     recreated, as PulseAudio restarts its time events all the time.
+     *     A NULL tv disables the time event.
+     */
+
+    if (tv == NULL) {
+        mrp_debug("PA disable timer %p", t);
+        mrp_stop_timer(t->t);
+    }
+    else {
+        mrp_debug("PA restart timer %p with %llu usecs", t,
+                  (unsigned long long)timeval_diff(tv));
 
-    t->t = mrp_add_timer(m->ml, timeval_diff(&now, tv), time_event_cb, t);
+        t->tv = *tv;
+        mrp_mod_timer_usecs(t->t, timeval_diff(tv));
+    }
 }
 
 
@@ -418,20 +572,16 @@ static void time_free(pa_time_event *t)
 
     mrp_debug("PA free timer %p",  t);
 
-    mrp_list_delete(&t->hook);
-    mrp_del_timer(t->t);
-    t->t = NULL;
+    mrp_stop_timer(t->t);
 
     t->dead = true;
 
-    if (!t->busy && !t->dead) {
-        t->busy = true;
-        if (t->destroy != NULL)
-            t->destroy(&t->m->api, t, t->userdata);
-        mrp_free(t);
-    }
-    else
+    if (!t->busy)
+        time_release(t);
+    else {
+        mrp_list_delete(&t->hook);
         mrp_list_append(&m->time_dead, &t->hook);
+    }
 }
 
 
@@ -445,23 +595,60 @@ static void time_set_destroy(pa_time_event *t, pa_time_event_destroy_cb_t cb)
 
 
 
-static void defer_event_cb(mrp_deferred_t *def, void *userdata)
+static void defer_release(pa_defer_event *d)
 {
-    pa_defer_event *d = (pa_defer_event *)userdata;
+    mrp_list_delete(&d->hook);
+
+    if (d->destroy != NULL)
+        d->destroy(&d->m->api, d, d->userdata);
+
+    mrp_objpool_free(d);
+}
+
+
+static void defer_batch_cb(mrp_deferred_t *def, void *userdata)
+{
+    pa_murphy_mainloop *m = (pa_murphy_mainloop *)userdata;
+    pa_defer_event     *d;
+    mrp_list_hook_t     batch;
 
     MRP_UNUSED(def);
 
-    mrp_debug("PA defer event for %p", d);
+    /*
+     * Notes:
+     *     All enabled defer events are run from a single deferred callback.
+     *     Events are taken from the head of the batch one by one, so the
+     *     callbacks can enable, disable or free any of the defer events,
+     *     including the ones still waiting in the batch. Events enabled
+     *     by the callbacks are run on the next round.
+     */
+
+    mrp_list_init(&batch);
+
+    if (!mrp_list_empty(&m->defer_events))
+        mrp_list_move(&batch, &m->defer_events);
 
-    d->busy = true;
-    d->cb(&d->m->api, d, d->userdata);
-    d->busy = false;
+    while (!mrp_list_empty(&batch)) {
+        d = mrp_list_entry(batch.next, typeof(*d), hook);
 
-    if (d->dead) {
-        mrp_del_deferred(d->d);
         mrp_list_delete(&d->hook);
-        mrp_free(d);
+        mrp_list_append(&m->defer_events, &d->hook);
+
+        mrp_debug("PA defer event for %p", d);
+
+        d->busy = true;
+        d->cb(&m->api, d, d->userdata);
+        d->busy = false;
+
+        if (d->dead)
+            defer_release(d);
     }
+
+    /* the callbacks might have disabled us while events were still left */
+    if (mrp_list_empty(&m->defer_events))
+        mrp_disable_deferred(m->defer);
+    else
+        mrp_enable_deferred(m->defer);
 }
 
 
@@ -473,24 +660,21 @@ static pa_defer_event *defer_new(pa_mainloop_api *api, pa_defer_event_cb_t cb,
 
     mrp_debug("PA create defer event");
 
-    d = mrp_allocz(sizeof(*d));
+    d = mrp_objpool_alloc(defer_pool);
 
     if (d == NULL)
         return NULL;
 
+    mrp_clear(d);
     mrp_list_init(&d->hook);
 
     d->m        = m;
     d->cb       = cb;
     d->userdata = userdata;
-    d->d        = mrp_add_deferred(m->ml, defer_event_cb, d);
+    d->enabled  = true;
 
-    if (d->d != NULL)
-        mrp_list_append(&m->defer_events, &d->hook);
-    else {
-        mrp_free(d);
-        d = NULL;
-    }
+    mrp_list_append(&m->defer_events, &d->hook);
+    mrp_enable_deferred(m->defer);
 
     return d;
 }
@@ -498,12 +682,26 @@ static pa_defer_event *defer_new(pa_mainloop_api *api, pa_defer_event_cb_t cb,
 
 static void defer_enable(pa_defer_event *d, int enable)
 {
+    pa_murphy_mainloop *m = d->m;
+
     mrp_debug("PA %s defer event %p", enable ? "enable" : "disable", d);
 
-    if (enable)
-        mrp_enable_deferred(d->d);
-    else
-        mrp_disable_deferred(d->d);
+    if (!enable == !d->enabled)
+        return;
+
+    d->enabled = !!enable;
+    mrp_list_delete(&d->hook);
+
+    if (enable) {
+        mrp_list_append(&m->defer_events, &d->hook);
+        mrp_enable_deferred(m->defer);
+    }
+    else {
+        mrp_list_append(&m->defer_disabled, &d->hook);
+
+        if (mrp_list_empty(&m->defer_events))
+            mrp_disable_deferred(m->defer);
+    }
 }
 
 
@@ -513,20 +711,17 @@ static void defer_free(pa_defer_event *d)
 
     mrp_debug("PA free defer event %p", d);
 
-    mrp_list_delete(&d->hook);
-    mrp_del_deferred(d->d);
-    d->d = NULL;
-
     d->dead = true;
 
-    if (!d->busy && !d->dead) {
-        d->busy = true;
-        if (d->destroy != NULL)
-            d->destroy(&d->m->api, d, d->userdata);
-        mrp_free(d);
-    }
-    else
+    if (!d->busy)
+        defer_release(d);
+    else {
+        mrp_list_delete(&d->hook);
         mrp_list_append(&m->defer_dead, &d->hook);
+    }
+
+    if (mrp_list_empty(&m->defer_events))
+        mrp_disable_deferred(m->defer);
 }
 
 
@@ -0,0 +1,862 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE                      /* we want accept4 */
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
+#include <murphy/common/log.h>
+#include <murphy/common/list.h>
+#include <murphy/common/msg.h>
+#include <murphy/common/socket-utils.h>
+#include <murphy/common/transport.h>
+
+#ifndef UNIX_PATH_MAX
+#    define UNIX_PATH_MAX sizeof(((struct sockaddr_un *)NULL)->sun_path)
+#endif
+
+#define SQPK  "seqpkt"
+#define SQPKL 6
+
+#define DEFAULT_SIZE 1024                /* default input buffer size */
+#define MAX_PACKET   (16 * 1024 * 1024)  /* max. size of received messages */
+#define RECV_BATCH   16                  /* max. packets received per event */
+#define ACCEPT_BATCH 64                  /* max. connections accepted per event */
+
+/*
+ * SOCK_SEQPACKET UNIX transport
+ *
+ * The kernel preserves message boundaries on sequenced-packet sockets,
+ * so unlike the stream transports we send every message as a single
+ * packet without any length framing and receive it with a single recv
+ * into an input buffer that is reused from one packet to the next. If
+ * the message decoder takes over the buffer, a new one is allocated for
+ * the next packet. Packets that cannot be sent without blocking are
+ * queued whole and sent once the socket becomes writable again.
+ */
+
+typedef struct {
+    mrp_list_hook_t hook;                /* to output queue */
+    size_t          size;                /* packet size */
+    char            data[0];             /* packet data */
+} sqpk_pkt_t;
+
+typedef struct {
+    MRP_TRANSPORT_PUBLIC_FIELDS;         /* common transport fields */
+    int              sock;               /* seqpacket socket */
+    mrp_io_watch_t  *iow;                /* socket I/O watch */
+    mrp_io_watch_t  *ow;                 /* output watch, if any */
+    void            *ibuf;               /* input buffer */
+    size_t           isize;              /* input buffer size */
+    mrp_list_hook_t  outq;               /* queued output packets */
+    size_t           qlen;               /* number of queued bytes */
+    int              backlog;            /* listen backlog, if set */
+    int              consumed;           /* accept consumed a connection */
+    mrp_transport_peer_t peer;           /* peer credentials, if known */
+    int              has_peer;           /* peer credentials captured */
+} sqpk_t;
+
+
+static void sqpk_recv_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
+                         void *user_data);
+static int sqpk_disconnect(mrp_transport_t *mt);
+static void *sqpk_steal_data(mrp_transport_t *mt, void *data, size_t size);
+
+
+static socklen_t sqpk_resolve(const char *str, mrp_sockaddr_t *addr,
+                              socklen_t size, const char **typep)
+{
+    struct sockaddr_un *un;
+    const char         *path;
+    size_t              plen;
+    socklen_t           len;
+
+    if (strncmp(str, SQPK":", SQPKL + 1))
+        return 0;
+
+    path = str + SQPKL + 1;
+    plen = strlen(path);
+
+    if (plen == 0 || plen >= UNIX_PATH_MAX) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    /* when binding the socket, we don't need the null at the end */
+    len = MRP_OFFSET(typeof(*un), sun_path) + plen;
+
+    if (size < len + 1) {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    un = &addr->unx;
+    un->sun_family = AF_UNIX;
+    memcpy(un->sun_path, path, plen + 1);
+    if (un->sun_path[0] == '@')
+        un->sun_path[0] = '\0';
+
+    if (typep != NULL)
+        *typep = SQPK;
+
+    return len;
+}
+
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+
+static int set_cloexec(int fd)
+{
+    int flags = fcntl(fd, F_GETFD);
+
+    return flags < 0 ? -1 : fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+}
+
+
+static int watch_input(sqpk_t *t)
+{
+    mrp_io_event_t events = MRP_IO_EVENT_IN | MRP_IO_EVENT_HUP;
+
+    t->iow = mrp_add_io_watch(t->ml, t->sock, events, sqpk_recv_cb, t);
+
+    return t->iow != NULL;
+}
+
+
+static int sqpk_open(mrp_transport_t *mt)
+{
+    sqpk_t *t = (sqpk_t *)mt;
+
+    t->sock       = -1;
+    t->steal_data = sqpk_steal_data;
+    mrp_list_init(&t->outq);
+
+    return TRUE;
+}
+
+
+static int sqpk_createfrom(mrp_transport_t *mt, void *conn)
+{
+    sqpk_t *t = (sqpk_t *)mt;
+
+    t->sock       = *(int *)conn;
+    t->steal_data = sqpk_steal_data;
+    mrp_list_init(&t->outq);
+
+    if (t->sock < 0)
+        return FALSE;
+
+    if (mt->flags & MRP_TRANSPORT_NONBLOCK || t->listened)
+        if (set_nonblocking(t->sock) < 0)
+            return FALSE;
+
+    if (t->connected || t->listened)
+        return watch_input(t);
+
+    return FALSE;
+}
+
+
+static int sqpk_setopt(mrp_transport_t *mt, const char *opt, const void *val)
+{
+    sqpk_t *t = (sqpk_t *)mt;
+
+    if (val == NULL)
+        return FALSE;
+
+    if (!strcmp(opt, MRP_TRANSPORT_OPT_BACKLOG)) {
+        t->backlog = *(const int *)val;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+static void outq_reset(sqpk_t *t)
+{
+    mrp_list_hook_t *p, *n;
+    sqpk_pkt_t      *pkt;
+
+    mrp_del_io_watch(t->ow);
+    t->ow = NULL;
+
+    mrp_list_foreach(&t->outq, p, n) {
+        pkt = mrp_list_entry(p, typeof(*pkt), hook);
+        mrp_list_delete(&pkt->hook);
+        mrp_free(pkt);
+    }
+
+    t->qlen = 0;
+}
+
+
+static void sqpk_close(mrp_transport_t *mt)
+{
+    sqpk_t *t = (sqpk_t *)mt;
+
+    mrp_debug("closing transport %p", mt);
+
+    outq_reset(t);
+
+    mrp_del_io_watch(t->iow);
+    t->iow = NULL;
+
+    mrp_free(t->ibuf);
+    t->ibuf  = NULL;
+    t->isize = 0;
+
+    if (t->sock >= 0) {
+        close(t->sock);
+        t->sock = -1;
+    }
+
+    mrp_free(t->peer.label);
+    t->peer.label = NULL;
+    t->has_peer   = FALSE;
+}
+
+
+static int open_socket(sqpk_t *t)
+{
+    t->sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+
+    if (t->sock < 0)
+        return FALSE;
+
+    if ((t->flags & MRP_TRANSPORT_NONBLOCK && set_nonblocking(t->sock) < 0) ||
+        (t->flags & MRP_TRANSPORT_CLOEXEC  && set_cloexec(t->sock) < 0) ||
+        !watch_input(t)) {
+        close(t->sock);
+        t->sock = -1;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static int sqpk_bind(mrp_transport_t *mt, mrp_sockaddr_t *addr,
+                     socklen_t addrlen)
+{
+    sqpk_t *t = (sqpk_t *)mt;
+
+    if (addr->any.sa_family != AF_UNIX) {
+        errno = EAFNOSUPPORT;
+        return FALSE;
+    }
+
+    if (t->sock != -1 || open_socket(t)) {
+        if (bind(t->sock, &addr->any, addrlen) == 0) {
+            mrp_debug("transport %p bound", mt);
+            return TRUE;
+        }
+    }
+
+    mrp_debug("failed to bind transport %p", mt);
+    return FALSE;
+}
+
+
+static int sqpk_listen(mrp_transport_t *mt, int backlog)
+{
+    sqpk_t *t = (sqpk_t *)mt;
+
+    if (t->sock != -1 && t->iow != NULL && t->evt.connection != NULL) {
+        if (set_nonblocking(t->sock) < 0)
+            return FALSE;
+
+        if (t->backlog > 0)
+            backlog = t->backlog;
+        else if (backlog <= 0)
+            backlog = SOMAXCONN;
+
+        if (listen(t->sock, backlog) == 0) {
+            mrp_debug("transport %p listening", mt);
+            t->listened = TRUE;
+            return TRUE;
+        }
+    }
+
+    mrp_debug("transport %p failed to listen", mt);
+    return FALSE;
+}
+
+
+static int sqpk_accept(mrp_transport_t *mt, mrp_transport_t *mlt)
+{
+    sqpk_t *t, *lt;
+    int     flags;
+
+    t  = (sqpk_t *)mt;
+    lt = (sqpk_t *)mlt;
+
+    t->steal_data = sqpk_steal_data;
+    mrp_list_init(&t->outq);
+
+    if (lt->sock < 0) {
+        errno = EBADF;
+        return FALSE;
+    }
+
+    flags  = (mt->flags & MRP_TRANSPORT_NONBLOCK) ? SOCK_NONBLOCK : 0;
+    flags |= (mt->flags & MRP_TRANSPORT_CLOEXEC)  ? SOCK_CLOEXEC  : 0;
+
+    do {
+        t->sock = accept4(lt->sock, NULL, NULL, flags);
+    } while (t->sock < 0 && errno == EINTR);
+
+    if (t->sock < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        lt->consumed = FALSE;            /* no more pending connections */
+        return FALSE;
+    }
+
+    lt->consumed = TRUE;
+
+    if (t->sock < 0) {
+        if (mrp_reject_connection(lt->sock, NULL, 0) < 0)
+            mrp_log_error("%s(): accept failed on transport %p (%d: %s).",
+                          __FUNCTION__, mlt, errno, strerror(errno));
+        return FALSE;
+    }
+
+    t->has_peer = (mrp_peer_credentials(t->sock, &t->peer.pid, &t->peer.uid,
+                                        &t->peer.gid, &t->peer.label) == 0);
+
+    if (watch_input(t)) {
+        mrp_debug("accepted connection on transport %p/%p", mlt, mt);
+        return TRUE;
+    }
+
+    close(t->sock);
+    t->sock = -1;
+    mrp_free(t->peer.label);
+    t->peer.label = NULL;
+    t->has_peer   = FALSE;
+
+    return FALSE;
+}
+
+
+static const mrp_transport_peer_t *sqpk_peer(mrp_transport_t *mt)
+{
+    sqpk_t *t = (sqpk_t *)mt;
+
+    return t->has_peer ? &t->peer : NULL;
+}
+
+
+static int sqpk_connect(mrp_transport_t *mt, mrp_sockaddr_t *addr,
+                        socklen_t addrlen)
+{
+    sqpk_t *t = (sqpk_t *)mt;
+
+    if (addr->any.sa_family != AF_UNIX) {
+        errno = EAFNOSUPPORT;
+        goto fail;
+    }
+
+    t->sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+
+    if (t->sock < 0)
+        goto fail;
+
+    if (connect(t->sock, &addr->any, addrlen) == 0 &&
+        set_nonblocking(t->sock) == 0 &&
+        (!(t->flags & MRP_TRANSPORT_CLOEXEC) || set_cloexec(t->sock) == 0) &&
+        watch_input(t)) {
+        mrp_debug("connected transport %p", mt);
+        return TRUE;
+    }
+
+    close(t->sock);
+    t->sock = -1;
+
+ fail:
+    mrp_debug("failed to connect transport %p", mt);
+
+    return FALSE;
+}
+
+
+static void *sqpk_steal_data(mrp_transport_t *mt, void *data, size_t size)
+{
+    sqpk_t *t = (sqpk_t *)mt;
+    void   *stolen;
+
+    if (data != t->ibuf)
+        return NULL;
+
+    stolen   = t->ibuf;
+    mrp_realloc(stolen, size);
+    t->ibuf  = NULL;
+    t->isize = 0;
+
+    return stolen;
+}
+
+
+/*
+ * Receive a single packet into the input buffer. Returns the size of the
+ * packet, 0 if there was none to receive without blocking, and -1 with
+ * *errorp set if the peer has closed the connection (error 0) or on
+ * errors.
+ */
+
+static ssize_t recv_packet(sqpk_t *t, int fd, int *errorp)
+{
+    ssize_t n, size;
+
+    do {
+        size = recv(fd, NULL, 0, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+    } while (size < 0 && errno == EINTR);
+
+    if (size < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+
+        *errorp = EIO;
+        return -1;
+    }
+
+    if (size == 0) {                     /* orderly shutdown by peer */
+        *errorp = 0;
+        return -1;
+    }
+
+    if (size > MAX_PACKET) {
+        *errorp = EMSGSIZE;
+        return -1;
+    }
+
+    if (t->isize < (size_t)size) {
+        mrp_free(t->ibuf);
+        t->isize = MRP_MAX((size_t)size, (size_t)DEFAULT_SIZE);
+        t->ibuf  = mrp_alloc(t->isize);
+
+        if (t->ibuf == NULL) {
+            t->isize = 0;
+            *errorp  = ENOMEM;
+            return -1;
+        }
+    }
+
+    do {
+        n = recv(fd, t->ibuf, size, MSG_DONTWAIT);
+    } while (n < 0 && errno == EINTR);
+
+    if (n != size) {
+        *errorp = n < 0 ? EIO : EPROTO;
+        return -1;
+    }
+
+    return size;
+}
+
+
+static void sqpk_recv_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
+                         void *user_data)
+{
+    sqpk_t          *t  = (sqpk_t *)user_data;
+    mrp_transport_t *mt = (mrp_transport_t *)t;
+    mrp_json_t      *msg;
+    ssize_t          size;
+    int              error, cnt, max;
+
+    MRP_UNUSED(w);
+
+    mrp_debug("event 0x%x for transport %p", events, t);
+
+    if (events & MRP_IO_EVENT_IN) {
+        if (MRP_UNLIKELY(mt->listened != 0)) {
+            cnt = 0;
+
+            do {
+                t->consumed = FALSE;
+
+                MRP_TRANSPORT_BUSY(mt, {
+                        mrp_debug("connection event on transport %p", mt);
+                        mt->evt.connection(mt, mt->user_data);
+                    });
+
+                if (t->check_destroy(mt))
+                    return;
+            } while (t->consumed && t->sock >= 0 && ++cnt < ACCEPT_BATCH);
+
+            return;
+        }
+
+        /* drain everything the peer sent before hanging up */
+        max = (events & MRP_IO_EVENT_HUP) ? MAX_PACKET : RECV_BATCH;
+
+        for (cnt = 0; cnt < max; cnt++) {
+            if ((size = recv_packet(t, fd, &error)) < 0)
+                goto closed;
+
+            if (size == 0)
+                break;
+
+            if (t->mode != MRP_TRANSPORT_MODE_JSON)
+                error = t->recv_data(mt, t->ibuf, size, NULL, 0);
+            else {
+                msg = mrp_json_string_to_object(t->ibuf, size);
+
+                if (msg != NULL) {
+                    error = t->recv_data(mt, msg, 0, NULL, 0);
+                    mrp_json_unref(msg);
+                }
+                else
+                    error = EILSEQ;
+            }
+
+            if (error)
+                goto closed;
+
+            if (t->check_destroy(mt))
+                return;
+        }
+    }
+
+    if (events & MRP_IO_EVENT_HUP) {
+        mrp_debug("transport %p closed by peer", mt);
+        error = 0;
+        goto closed;
+    }
+
+    return;
+
+ closed:
+    mrp_debug("transport %p closed with error %d", mt, error);
+
+    sqpk_disconnect(mt);
+
+    if (t->evt.closed != NULL)
+        MRP_TRANSPORT_BUSY(mt, {
+                mt->evt.closed(mt, error, mt->user_data);
+            });
+
+    t->check_destroy(mt);
+}
+
+
+static int outq_flush(sqpk_t *t)
+{
+    mrp_list_hook_t *p, *n;
+    sqpk_pkt_t      *pkt;
+    ssize_t          len;
+
+    mrp_list_foreach(&t->outq, p, n) {
+        pkt = mrp_list_entry(p, typeof(*pkt), hook);
+
+        do {
+            len = send(t->sock, pkt->data, pkt->size,
+                       MSG_NOSIGNAL | MSG_DONTWAIT);
+        } while (len < 0 && errno == EINTR);
+
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            mrp_debug("transport %p failed to flush output (%d: %s)", t,
+                      errno, strerror(errno));
+            return -1;
+        }
+
+        t->qlen -= pkt->size;
+        mrp_list_delete(&pkt->hook);
+        mrp_free(pkt);
+    }
+
+    if (mrp_list_empty(&t->outq)) {
+        mrp_del_io_watch(t->ow);
+        t->ow = NULL;
+    }
+
+    return 0;
+}
+
+
+static void sqpk_send_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
+                         void *user_data)
+{
+    sqpk_t          *t  = (sqpk_t *)user_data;
+    mrp_transport_t *mt = (mrp_transport_t *)t;
+
+    MRP_UNUSED(w);
+    MRP_UNUSED(fd);
+
+    if (!(events & MRP_IO_EVENT_OUT))
+        return;
+
+    if (outq_flush(t) < 0)
+        outq_reset(t);                   /* input watch delivers closed */
+
+    t->check_destroy(mt);
+}
+
+
+static int outq_append(sqpk_t *t, struct iovec *iov, int iovcnt, size_t size)
+{
+    sqpk_pkt_t *pkt;
+    char       *p;
+    int         i;
+
+    if ((pkt = mrp_alloc(sizeof(*pkt) + size)) == NULL)
+        return FALSE;
+
+    mrp_list_init(&pkt->hook);
+    pkt->size = size;
+
+    for (i = 0, p = pkt->data; i < iovcnt; i++) {
+        memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
+
+    if (t->ow == NULL) {
+        t->ow = mrp_add_io_watch(t->ml, t->sock, MRP_IO_EVENT_OUT,
+                                 sqpk_send_cb, t);
+
+        if (t->ow == NULL) {
+            mrp_log_error("Failed to create output watch for transport %p.",
+                          t);
+            mrp_free(pkt);
+            return FALSE;
+        }
+    }
+
+    mrp_list_append(&t->outq, &pkt->hook);
+    t->qlen += size;
+
+    return TRUE;
+}
+
+
+static int sqpk_write(sqpk_t *t, struct iovec *iov, int iovcnt)
+{
+    struct msghdr hdr;
+    ssize_t       n;
+    size_t        size;
+    int           i;
+
+    for (i = 0, size = 0; i < iovcnt; i++)
+        size += iov[i].iov_len;
+
+    if (mrp_list_empty(&t->outq)) {
+        mrp_clear(&hdr);
+        hdr.msg_iov    = iov;
+        hdr.msg_iovlen = iovcnt;
+
+        do {
+            n = sendmsg(t->sock, &hdr, MSG_NOSIGNAL | MSG_DONTWAIT);
+        } while (n < 0 && errno == EINTR);
+
+        if (n >= 0)
+            return TRUE;
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return FALSE;
+    }
+
+    if (!outq_append(t, iov, iovcnt, size)) {
+        mrp_log_error("Failed to queue output for transport %p.", t);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static int sqpk_disconnect(mrp_transport_t *mt)
+{
+    sqpk_t *t = (sqpk_t *)mt;
+
+    if (t->connected) {
+        mrp_del_io_watch(t->iow);
+        t->iow = NULL;
+
+        if (!mrp_list_empty(&t->outq)) {
+            outq_flush(t);
+
+            if (t->qlen > 0)
+                mrp_log_warning("Discarding %zu bytes of unsent data of "
+                                "transport %p.", t->qlen, t);
+        }
+        outq_reset(t);
+
+        shutdown(t->sock, SHUT_RDWR);
+
+        mrp_debug("disconnected transport %p", mt);
+
+        return TRUE;
+    }
+    else
+        return FALSE;
+}
+
+
+static int sqpk_sendencmsg(mrp_transport_t *mt, void *buf, size_t size)
+{
+    sqpk_t       *t = (sqpk_t *)mt;
+    struct iovec  iov[1];
+
+    if (t->connected) {
+        iov[0].iov_base = buf;
+        iov[0].iov_len  = size;
+
+        return sqpk_write(t, iov, 1);
+    }
+
+    return FALSE;
+}
+
+
+static int sqpk_send(mrp_transport_t *mt, mrp_msg_t *msg)
+{
+    sqpk_t        *t = (sqpk_t *)mt;
+    mrp_msg_iov_t  miov;
+    int            success;
+
+    if (t->connected) {
+        if (mrp_transport_encode_iov(mt, msg, &miov) >= 0) {
+            /* iov[0] is reserved for the length prefix, which we skip */
+            success = sqpk_write(t, miov.iov + 1, miov.iovcnt - 1);
+            mrp_msg_iov_release(&miov);
+
+            return success;
+        }
+    }
+
+    return FALSE;
+}
+
+
+static int sqpk_sendraw(mrp_transport_t *mt, void *data, size_t size)
+{
+    return sqpk_sendencmsg(mt, data, size);
+}
+
+
+static int sqpk_senddata(mrp_transport_t *mt, void *data, uint16_t tag)
+{
+    sqpk_t           *t = (sqpk_t *)mt;
+    mrp_data_descr_t *type;
+    struct iovec      iov[1];
+    void             *buf;
+    size_t            size;
+    uint16_t         *tagp;
+    int               success;
+
+    if (t->connected) {
+        type = mrp_msg_find_type(tag);
+
+        if (type != NULL) {
+            size = mrp_data_encode(&buf, data, type, sizeof(*tagp));
+
+            if (size > 0) {
+                tagp  = buf;
+                *tagp = htobe16(tag);
+
+                iov[0].iov_base = buf;
+                iov[0].iov_len  = size;
+
+                success = sqpk_write(t, iov, 1);
+                mrp_free(buf);
+
+                return success;
+            }
+        }
+    }
+
+    return FALSE;
+}
+
+
+static int sqpk_sendnative(mrp_transport_t *mt, void *data, uint32_t type_id)
+{
+    sqpk_t        *t   = (sqpk_t *)mt;
+    mrp_typemap_t *map = t->map;
+    struct iovec   iov[1];
+    void          *buf;
+    size_t         size;
+    int            success;
+
+    if (t->connected) {
+        if (mrp_encode_native(data, type_id, 0, &buf, &size, map) == 0) {
+            iov[0].iov_base = buf;
+            iov[0].iov_len  = size;
+
+            success = sqpk_write(t, iov, 1);
+            mrp_free(buf);
+
+            return success;
+        }
+    }
+
+    return FALSE;
+}
+
+
+static int sqpk_sendjson(mrp_transport_t *mt, mrp_json_t *msg)
+{
+    sqpk_t     *t = (sqpk_t *)mt;
+    const char *s;
+
+    if (t->connected && (s = mrp_json_object_to_string(msg)) != NULL)
+        return sqpk_sendencmsg(mt, (void *)s, strlen(s));
+
+    return FALSE;
+}
+
+
+MRP_REGISTER_TRANSPORT(seqpkt, SQPK, sqpk_t, sqpk_resolve,
+                       sqpk_open, sqpk_createfrom, sqpk_close, sqpk_setopt,
+                       sqpk_bind, sqpk_listen, sqpk_accept,
+                       sqpk_connect, sqpk_disconnect,
+                       sqpk_send, NULL,
+                       sqpk_sendraw, NULL,
+                       sqpk_senddata, NULL,
+                       NULL, NULL,
+                       sqpk_sendnative, NULL,
+                       sqpk_sendjson, NULL,
+                       .sendencmsg = sqpk_sendencmsg,
+                       .peer       = sqpk_peer);
@@ -27,14 +27,35 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE                      /* we want struct ucred */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 
 #include <murphy/common/macros.h>
+#include <murphy/common/debug.h>
+#include <murphy/common/log.h>
+#include <murphy/common/mm.h>
+
+#define LISTEN_FDS_START 3               /* first socket-activated fd */
+#define HANDOVER_MAX     32              /* max. sockets to hand over */
+#define HANDOVER_READY   "MURPHY_HANDOVER_READY" /* readiness pipe fd */
+
+typedef struct {
+    char                    *name;       /* socket name */
+    struct sockaddr_storage  addr;       /* local socket address */
+    socklen_t                alen;       /* address length */
+} handover_t;
+
+static handover_t handover[HANDOVER_MAX];
+static int        nhandover;
 
 static int reject_fd = -1;
 
@@ -99,3 +120,289 @@ int mrp_reject_connection(int sock, struct sockaddr *addr, socklen_t *alen)
 
     return (fd >= 0 ? 0 : -1);
 }
+
+
+int mrp_peer_credentials(int sock, pid_t *pidp, uid_t *uidp, gid_t *gidp,
+                         char **labelp)
+{
+    struct ucred cred;
+    socklen_t    len;
+    char         label[256];
+
+    len = sizeof(cred);
+
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+        return -1;
+
+    *pidp = cred.pid;
+    *uidp = cred.uid;
+    *gidp = cred.gid;
+
+    if (labelp == NULL)
+        return 0;
+
+    len = sizeof(label) - 1;
+
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERSEC, label, &len) == 0 && len > 0) {
+        label[len] = '\0';
+        *labelp = mrp_strdup(label);
+    }
+    else
+        *labelp = NULL;
+
+    return 0;
+}
+
+
+static int activated_fds(void)
+{
+    const char *e;
+    char       *end;
+    long        n;
+
+    if ((e = getenv("LISTEN_PID")) == NULL)
+        return 0;
+
+    if (strtol(e, &end, 10) != (long)getpid() || *end)
+        return 0;
+
+    if ((e = getenv("LISTEN_FDS")) == NULL)
+        return 0;
+
+    n = strtol(e, &end, 10);
+
+    if (*end || n <= 0 || n > 1024)
+        return 0;
+
+    return (int)n;
+}
+
+
+static int match_address(int fd, struct sockaddr *addr, socklen_t alen)
+{
+    struct sockaddr_storage  buf;
+    char                    *sa = (char *)&buf;
+    socklen_t                len = sizeof(buf);
+
+    if (getsockname(fd, (struct sockaddr *)&buf, &len) < 0)
+        return FALSE;
+
+    /* unix socket paths may or may not include the terminating '\0' */
+    if (len == alen + 1 && sa[alen] == '\0')
+        len = alen;
+
+    return len == alen && !memcmp(sa, addr, alen);
+}
+
+
+int mrp_activated_socket(const char *name, struct sockaddr *addr,
+                         socklen_t alen)
+{
+    const char *names, *n;
+    size_t      nlen, l;
+    int         nfd, fd, i, match;
+
+    if ((nfd = activated_fds()) <= 0)
+        return -1;
+
+    names = name != NULL ? getenv("LISTEN_FDNAMES") : NULL;
+    nlen  = name != NULL ? strlen(name) : 0;
+
+    for (i = 0; i < nfd; i++) {
+        fd    = LISTEN_FDS_START + i;
+        match = FALSE;
+
+        if (names != NULL) {
+            n = strchr(names, ':');
+            l = n != NULL ? (size_t)(n - names) : strlen(names);
+
+            match = (l == nlen && !strncmp(names, name, l));
+            names = n != NULL ? n + 1 : NULL;
+        }
+
+        if (!match && addr != NULL)
+            match = match_address(fd, addr, alen);
+
+        if (match) {
+            mrp_debug("using socket-activated fd %d for %s", fd,
+                      name ? name : "<unnamed>");
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            return fd;
+        }
+    }
+
+    return -1;
+}
+
+
+int mrp_handover_register(const char *name, struct sockaddr *addr,
+                          socklen_t alen)
+{
+    handover_t *h;
+
+    if (nhandover >= HANDOVER_MAX || alen > sizeof(h->addr) ||
+        (name != NULL && strchr(name, ':') != NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    h = handover + nhandover;
+
+    if ((h->name = mrp_strdup(name ? name : "unknown")) == NULL)
+        return -1;
+
+    memcpy(&h->addr, addr, alen);
+    h->alen = alen;
+    nhandover++;
+
+    return 0;
+}
+
+
+static int handover_socket(handover_t *h)
+{
+    int       fd, max, type, on;
+    socklen_t len;
+
+    max = getdtablesize();
+
+    for (fd = 0; fd < max; fd++) {
+        if (!match_address(fd, (struct sockaddr *)&h->addr, h->alen))
+            continue;
+
+        len = sizeof(type);
+        if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0)
+            continue;
+
+        if (type == SOCK_DGRAM)
+            return fd;
+
+        /* accepted connections share the address of their listener */
+        len = sizeof(on);
+        if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &on, &len) == 0 && on)
+            return fd;
+    }
+
+    return -1;
+}
+
+
+static void close_fds_from(int first)
+{
+    int fd, max;
+
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, first, ~0U, 0) == 0)
+        return;
+#endif
+
+    max = getdtablesize();
+
+    for (fd = first; fd < max; fd++)
+        close(fd);
+}
+
+
+pid_t mrp_handover_exec(const char *path, char **argv, int *readyp)
+{
+    int    fds[HANDOVER_MAX], nfd, ready[2], i;
+    char   names[HANDOVER_MAX * 64], *p, buf[32];
+    size_t l;
+    pid_t  pid;
+
+    for (i = nfd = 0, p = names; i < nhandover; i++) {
+        if ((fds[nfd] = handover_socket(handover + i)) < 0) {
+            mrp_log_warning("No socket to hand over for '%s'.",
+                            handover[i].name);
+            continue;
+        }
+
+        l = strlen(handover[i].name);
+
+        if (p + l + 1 >= names + sizeof(names))
+            break;
+
+        if (p != names)
+            *p++ = ':';
+        memcpy(p, handover[i].name, l + 1);
+        p += l;
+        nfd++;
+    }
+
+    if (nfd == 0) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (pipe2(ready, O_CLOEXEC) < 0)
+        return -1;
+
+    if ((pid = fork()) != 0) {
+        close(ready[1]);
+
+        if (pid < 0)
+            close(ready[0]);
+        else
+            *readyp = ready[0];
+
+        return pid;
+    }
+
+    /*
+     * Move the sockets and the readiness pipe out of the way first, then
+     * to their final slots, and close everything else, in particular any
+     * connections we have accepted, before executing the new instance.
+     */
+
+    for (i = 0; i < nfd; i++)
+        if ((fds[i] = fcntl(fds[i], F_DUPFD, LISTEN_FDS_START + nfd + 1)) < 0)
+            _exit(1);
+
+    if ((ready[1] = fcntl(ready[1], F_DUPFD, LISTEN_FDS_START + nfd + 1)) < 0)
+        _exit(1);
+
+    for (i = 0; i < nfd; i++)
+        if (dup2(fds[i], LISTEN_FDS_START + i) < 0)
+            _exit(1);
+
+    if (dup2(ready[1], LISTEN_FDS_START + nfd) < 0)
+        _exit(1);
+
+    close_fds_from(LISTEN_FDS_START + nfd + 1);
+
+    snprintf(buf, sizeof(buf), "%d", nfd);
+    setenv("LISTEN_FDS", buf, 1);
+    setenv("LISTEN_FDNAMES", names, 1);
+    snprintf(buf, sizeof(buf), "%u", (unsigned int)getpid());
+    setenv("LISTEN_PID", buf, 1);
+    snprintf(buf, sizeof(buf), "%d", LISTEN_FDS_START + nfd);
+    setenv(HANDOVER_READY, buf, 1);
+
+    execv(path, argv);
+    _exit(1);
+}
+
+
+void mrp_handover_ready(void)
+{
+    const char *e;
+    char       *end;
+    long        fd;
+    char        c;
+
+    if ((e = getenv(HANDOVER_READY)) == NULL)
+        return;
+
+    fd = strtol(e, &end, 10);
+    unsetenv(HANDOVER_READY);
+
+    if (*end || fd < LISTEN_FDS_START || fd > 1024)
+        return;
+
+    c = 1;
+    if (write((int)fd, &c, 1) != 1)
+        mrp_log_warning("Failed to notify previous instance (%d: %s).",
+                        errno, strerror(errno));
+
+    close((int)fd);
+}
@@ -30,6 +30,7 @@
 #ifndef __MURPHY_SOCKET_UTILS_H__
 #define __MURPHY_SOCKET_UTILS_H__
 
+#include <sys/types.h>
 #include <sys/socket.h>
 
 #include <murphy/common/macros.h>
@@ -38,6 +39,45 @@ MRP_CDECL_BEGIN
 
 int mrp_reject_connection(int sock, struct sockaddr *addr, socklen_t alen);
 
+/*
+ * Get the credentials (SO_PEERCRED) and, if the kernel provides one, the
+ * security label (SO_PEERSEC) of the peer of a connected unix socket. If
+ * there is no label *labelp is set to NULL, otherwise to a string the
+ * caller needs to free with mrp_free.
+ */
+int mrp_peer_credentials(int sock, pid_t *pidp, uid_t *uidp, gid_t *gidp,
+                         char **labelp);
+
+/*
+ * Look up a socket passed to us by the service manager using the
+ * systemd socket activation protocol (LISTEN_PID, LISTEN_FDS and
+ * LISTEN_FDNAMES). A socket is matched either by its name, if name is
+ * given and names were passed, or by its local address, if addr is given.
+ * Returns the socket or -1 if no matching one was passed to us.
+ */
+int mrp_activated_socket(const char *name, struct sockaddr *addr,
+                         socklen_t alen);
+
+/*
+ * Register a listening socket by name and local address for handover.
+ * mrp_handover_exec() forks and executes argv with all registered
+ * sockets passed on using the socket activation protocol, so a new
+ * instance picks them up with mrp_activated_socket() while clients
+ * keep queuing up on them. No other file descriptors are inherited.
+ * Returns the pid of the new instance or -1. *readyp is set to a pipe
+ * which becomes readable with a single byte once the new instance has
+ * called mrp_handover_ready(), or hits end of file if it exits first.
+ */
+int mrp_handover_register(const char *name, struct sockaddr *addr,
+                          socklen_t alen);
+pid_t mrp_handover_exec(const char *path, char **argv, int *readyp);
+
+/*
+ * Tell the instance we were handed over from, if any, that we are up
+ * and running and it can stop.
+ */
+void mrp_handover_ready(void);
+
 MRP_CDECL_END
 
 #endif /* __MURPHY_SOCKET_UTILS_H__ */
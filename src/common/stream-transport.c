@@ -27,8 +27,10 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE                      /* we want accept4 */
 #include <unistd.h>
 #include <string.h>
+#include <endian.h>
 #include <errno.h>
 #include <netdb.h>
 #include <fcntl.h>
@@ -46,6 +48,7 @@
 #include <murphy/common/fragbuf.h>
 #include <murphy/common/socket-utils.h>
 #include <murphy/common/transport.h>
+#include <murphy/common/trace.h>
 
 #ifndef UNIX_PATH_MAX
 #    define UNIX_PATH_MAX sizeof(((struct sockaddr_un *)NULL)->sun_path)
@@ -59,18 +62,78 @@
 #define UNXSL 4
 
 #define DEFAULT_SIZE 128                 /* default input buffer size */
+#define OUTQ_MIN     4096                /* minimum output queue size */
+#define OUTQ_HIGH    (256 * 1024)        /* default high watermark */
+#define OUTQ_LOW     (64 * 1024)         /* default low watermark */
+#define MAX_FRAME    (16 * 1024 * 1024)  /* max. size of received messages */
+#define ACCEPT_BATCH 64                  /* max. connections accepted per event */
+#define SCRATCH_SIZE (16 * 1024)         /* shared receive buffer size */
+
+/*
+ * output queue
+ *
+ * A ring buffer of data pending to be written to the socket. Data
+ * is only ever queued if it could not be written out immediately.
+ * If the mainloop supports asynchronous I/O requests, queued data
+ * is written out by a write request submitted to the mainloop rather
+ * than from an output watch. While a request is in flight the part
+ * of the buffer it was submitted with must stay intact, so a buffer
+ * replaced by growing the queue is passed to the request to be freed
+ * once it is over. A corked queue also takes data that could be written
+ * right away and is flushed from a deferred callback once per iteration.
+ */
+
+typedef struct {
+    char                        *buf;    /* ring buffer */
+    size_t                       size;   /* allocated buffer size */
+    size_t                       head;   /* offset of first queued byte */
+    size_t                       len;    /* amount of queued data */
+    size_t                       high;   /* high watermark */
+    size_t                       low;    /* low watermark */
+    mrp_io_watch_t              *w;      /* socket output watch, if any */
+    mrp_io_req_t                *wreq;   /* write request in flight */
+    char                        *wbuf;   /* buffer of write request */
+    mrp_transport_outq_notify_t  notify; /* congestion notification */
+    mrp_deferred_t              *d;      /* deferred flush when corked */
+    unsigned                     congested : 1; /* above high watermark */
+    unsigned                     cork : 1; /* coalesce output per iteration */
+} outq_t;
+
+/*
+ * Most connections are idle most of the time, so we keep the per-connection
+ * state small and don't keep receive buffers around. When nothing is
+ * buffered for a connection, we read into a per-thread scratch buffer and
+ * deliver complete frames straight from there. Only the tail of a frame not
+ * fully received yet is copied to the fragment buffer of the connection,
+ * which gives its memory back once it has been emptied again.
+ */
 
 typedef struct {
     MRP_TRANSPORT_PUBLIC_FIELDS;         /* common transport fields */
-    int             sock;                /* TCP socket */
     mrp_io_watch_t *iow;                 /* socket I/O watch */
     mrp_fragbuf_t  *buf;                 /* fragment buffer */
+    outq_t          oq;                  /* output queue */
+    int             sock;                /* TCP socket */
+    int             backlog;             /* listen backlog, if set */
+    mrp_transport_peer_t peer;           /* peer credentials, if known */
+    unsigned        has_peer : 1;        /* peer credentials captured */
+    unsigned        stolen : 1;          /* buffer taken by a message */
+    unsigned        reuseport : 1;       /* bind with SO_REUSEPORT */
+    unsigned        consumed : 1;        /* accept consumed a connection */
 } strm_t;
 
+static __thread char *scratch;           /* shared receive buffer */
+static __thread int   scratch_busy;      /* delivering from scratch */
+
 
 static void strm_recv_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
                          void *user_data);
+static void strm_send_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
+                         void *user_data);
+static void strm_sent_cb(mrp_io_req_t *req, ssize_t result, void *user_data);
+static void strm_uncork_cb(mrp_deferred_t *d, void *user_data);
 static int strm_disconnect(mrp_transport_t *mt);
+static void *strm_steal_data(mrp_transport_t *mt, void *data, size_t size);
 static int open_socket(strm_t *t, int family);
 
 
@@ -251,12 +314,450 @@ static int strm_open(mrp_transport_t *mt)
 {
     strm_t *t = (strm_t *)mt;
 
-    t->sock = -1;
+    t->sock       = -1;
+    t->oq.high    = OUTQ_HIGH;
+    t->oq.low     = OUTQ_LOW;
+    t->steal_data = strm_steal_data;
 
     return TRUE;
 }
 
 
+static int strm_setopt(mrp_transport_t *mt, const char *opt, const void *val)
+{
+    strm_t *t  = (strm_t *)mt;
+    outq_t *oq = &t->oq;
+
+    if (val == NULL)
+        return FALSE;
+
+    if (!strcmp(opt, MRP_TRANSPORT_OPT_OUTQ_HIGH))
+        oq->high = *(const size_t *)val;
+    else if (!strcmp(opt, MRP_TRANSPORT_OPT_OUTQ_LOW))
+        oq->low = *(const size_t *)val;
+    else if (!strcmp(opt, MRP_TRANSPORT_OPT_OUTQ_NOTIFY))
+        oq->notify = *(const mrp_transport_outq_notify_t *)val;
+    else if (!strcmp(opt, MRP_TRANSPORT_OPT_CORK))
+        oq->cork = *(const int *)val ? TRUE : FALSE;
+    else if (!strcmp(opt, MRP_TRANSPORT_OPT_BACKLOG))
+        t->backlog = *(const int *)val;
+    else if (!strcmp(opt, MRP_TRANSPORT_OPT_REUSEPORT))
+        t->reuseport = *(const int *)val ? TRUE : FALSE;
+    else
+        return FALSE;
+
+    if (oq->low > oq->high)
+        oq->low = oq->high;
+
+    return TRUE;
+}
+
+
+static void outq_notify(strm_t *t)
+{
+    mrp_transport_t *mt = (mrp_transport_t *)t;
+    outq_t          *oq = &t->oq;
+    int              congested;
+
+    if (!oq->congested)
+        congested = (oq->len > oq->high);
+    else
+        congested = !(oq->len <= oq->low);
+
+    if (congested == oq->congested)
+        return;
+
+    oq->congested = congested;
+
+    mrp_debug("transport %p output %s (%zu bytes queued)", t,
+              congested ? "congested" : "decongested", oq->len);
+
+    if (oq->notify.cb != NULL)
+        MRP_TRANSPORT_BUSY(mt, {
+                oq->notify.cb(mt, congested, oq->notify.user_data);
+            });
+}
+
+
+static int outq_grow(outq_t *oq, size_t need)
+{
+    char   *buf;
+    size_t  size, tail;
+
+    if (oq->size - oq->len >= need)
+        return TRUE;
+
+    size = oq->size ? oq->size : OUTQ_MIN;
+    while (size - oq->len < need)
+        size *= 2;
+
+    if ((buf = mrp_alloc(size)) == NULL)
+        return FALSE;
+
+    /* linearize the queued data to the beginning of the new buffer */
+    tail = MRP_MIN(oq->len, oq->size - oq->head);
+    if (tail > 0)
+        memcpy(buf, oq->buf + oq->head, tail);
+    if (oq->len > tail)
+        memcpy(buf + tail, oq->buf, oq->len - tail);
+
+    if (oq->wreq != NULL && oq->buf == oq->wbuf) {
+        if (!mrp_io_req_adopt(oq->wreq, oq->buf)) {
+            mrp_free(buf);
+            return FALSE;
+        }
+    }
+    else
+        mrp_free(oq->buf);
+
+    oq->buf  = buf;
+    oq->size = size;
+    oq->head = 0;
+
+    return TRUE;
+}
+
+
+static int outq_append(outq_t *oq, struct iovec *iov, int iovcnt, size_t skip)
+{
+    size_t  need, tail, n, chunk;
+    char   *data;
+    int     i;
+
+    for (i = 0, need = 0; i < iovcnt; i++)
+        need += iov[i].iov_len;
+    need -= skip;
+
+    if (!outq_grow(oq, need))
+        return FALSE;
+
+    for (i = 0; i < iovcnt; i++) {
+        data = iov[i].iov_base;
+        n    = iov[i].iov_len;
+
+        if (skip >= n) {
+            skip -= n;
+            continue;
+        }
+
+        data += skip;
+        n    -= skip;
+        skip  = 0;
+
+        while (n > 0) {
+            tail  = (oq->head + oq->len) % oq->size;
+            chunk = MRP_MIN(n, oq->size - tail);
+
+            if (tail < oq->head)
+                chunk = MRP_MIN(chunk, oq->head - tail);
+
+            memcpy(oq->buf + tail, data, chunk);
+            oq->len += chunk;
+            data    += chunk;
+            n       -= chunk;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static void outq_reset(strm_t *t)
+{
+    outq_t *oq = &t->oq;
+
+    mrp_del_io_watch(oq->w);
+    oq->w = NULL;
+
+    mrp_del_deferred(oq->d);
+    oq->d = NULL;
+
+    if (oq->wreq != NULL) {
+        mrp_io_req_cancel(oq->wreq, oq->buf);
+        oq->wreq = NULL;
+        oq->wbuf = NULL;
+    }
+    else
+        mrp_free(oq->buf);
+
+    oq->buf  = NULL;
+    oq->size = 0;
+    oq->head = 0;
+    oq->len  = 0;
+    oq->congested = FALSE;
+}
+
+
+static int outq_iov(outq_t *oq, struct iovec *iov)
+{
+    size_t tail;
+
+    tail = MRP_MIN(oq->len, oq->size - oq->head);
+
+    iov[0].iov_base = oq->buf + oq->head;
+    iov[0].iov_len  = tail;
+
+    if (oq->len == tail)
+        return 1;
+
+    iov[1].iov_base = oq->buf;
+    iov[1].iov_len  = oq->len - tail;
+
+    return 2;
+}
+
+
+static void outq_consume(outq_t *oq, size_t n)
+{
+    oq->head  = (oq->head + n) % oq->size;
+    oq->len  -= n;
+
+    if (oq->len == 0)
+        oq->head = 0;
+}
+
+
+static int outq_watch(strm_t *t)
+{
+    outq_t *oq = &t->oq;
+
+    if (oq->w == NULL) {
+        oq->w = mrp_add_io_watch(t->ml, t->sock, MRP_IO_EVENT_OUT,
+                                 strm_send_cb, t);
+
+        if (oq->w == NULL) {
+            mrp_log_error("Failed to create output watch for transport %p.",
+                          t);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static int outq_uncork(strm_t *t)
+{
+    outq_t *oq = &t->oq;
+
+    if (oq->d == NULL) {
+        oq->d = mrp_add_deferred(t->ml, strm_uncork_cb, t);
+
+        if (oq->d == NULL) {
+            mrp_log_error("Failed to create output flush for transport %p.",
+                          t);
+            return FALSE;
+        }
+    }
+    else
+        mrp_enable_deferred(oq->d);
+
+    return TRUE;
+}
+
+
+static int outq_submit(strm_t *t)
+{
+    outq_t       *oq = &t->oq;
+    struct iovec  iov[2];
+    int           cnt;
+
+    if (!mrp_io_req_supported(t->ml))
+        return FALSE;
+
+    cnt      = outq_iov(oq, iov);
+    oq->wreq = mrp_io_submit_writev(t->ml, t->sock, iov, cnt,
+                                    strm_sent_cb, t);
+
+    if (oq->wreq == NULL) {
+        mrp_debug("transport %p failed to submit output (%d: %s)", t,
+                  errno, strerror(errno));
+        return FALSE;
+    }
+
+    oq->wbuf = oq->buf;
+
+    return TRUE;
+}
+
+
+static int outq_flush(strm_t *t)
+{
+    outq_t       *oq = &t->oq;
+    struct iovec  iov[2];
+    ssize_t       n;
+    int           cnt;
+
+    if (oq->wreq != NULL)                /* can't write past a request */
+        return 0;
+
+    while (oq->len > 0) {
+        cnt = outq_iov(oq, iov);
+        n   = writev(t->sock, iov, cnt);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            mrp_debug("transport %p failed to flush output (%d: %s)", t,
+                      errno, strerror(errno));
+            return -1;
+        }
+
+        outq_consume(oq, n);
+    }
+
+    if (oq->len == 0) {
+        mrp_del_io_watch(oq->w);
+        oq->w = NULL;
+    }
+
+    return 0;
+}
+
+
+static int strm_write(strm_t *t, struct iovec *iov, int iovcnt)
+{
+    outq_t  *oq = &t->oq;
+    ssize_t  n;
+    int      i;
+
+    /*
+     * Notes:
+     *     If there is nothing queued, we try to write the data out right
+     *     away. Anything that could not be written without blocking (or
+     *     everything, if there is already queued data) is appended to the
+     *     output queue and written out once the socket becomes writable,
+     *     either by an asynchronous write request or from an output watch.
+     *     A corked transport queues everything and flushes the queue once
+     *     per mainloop iteration, unless it is already waiting for the
+     *     socket to become writable.
+     */
+
+    if (oq->len == 0 && !oq->cork) {
+        do {
+            n = writev(t->sock, iov, iovcnt);
+        } while (n < 0 && errno == EINTR);
+
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return FALSE;
+            n = 0;
+        }
+
+        for (i = 0; i < iovcnt && n >= (ssize_t)iov[i].iov_len; i++)
+            n -= iov[i].iov_len;
+
+        if (i == iovcnt)
+            return TRUE;
+
+        iov    += i;
+        iovcnt -= i;
+    }
+    else
+        n = 0;
+
+    if (!outq_append(oq, iov, iovcnt, (size_t)n)) {
+        mrp_log_error("Failed to queue output for transport %p.", t);
+        return FALSE;
+    }
+
+    if (oq->wreq == NULL && oq->w == NULL) {
+        if (oq->cork) {
+            if (!outq_uncork(t))
+                return FALSE;
+        }
+        else if (!outq_submit(t) && !outq_watch(t))
+            return FALSE;
+    }
+
+    outq_notify(t);
+
+    return TRUE;
+}
+
+
+static void strm_send_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
+                         void *user_data)
+{
+    strm_t          *t  = (strm_t *)user_data;
+    mrp_transport_t *mt = (mrp_transport_t *)t;
+
+    MRP_UNUSED(w);
+    MRP_UNUSED(fd);
+
+    if (!(events & MRP_IO_EVENT_OUT))
+        return;
+
+    if (outq_flush(t) < 0) {
+        /* let the input watch deliver the closed event on HUP */
+        outq_reset(t);
+        return;
+    }
+
+    outq_notify(t);
+    t->check_destroy(mt);
+}
+
+
+static void strm_uncork_cb(mrp_deferred_t *d, void *user_data)
+{
+    strm_t          *t  = (strm_t *)user_data;
+    mrp_transport_t *mt = (mrp_transport_t *)t;
+    outq_t          *oq = &t->oq;
+
+    mrp_disable_deferred(d);
+
+    if (outq_flush(t) < 0) {
+        /* let the input watch deliver the closed event on HUP */
+        outq_reset(t);
+        return;
+    }
+
+    if (oq->len > 0 && oq->wreq == NULL && oq->w == NULL)
+        if (!outq_submit(t))
+            outq_watch(t);
+
+    outq_notify(t);
+    t->check_destroy(mt);
+}
+
+
+static void strm_sent_cb(mrp_io_req_t *req, ssize_t result, void *user_data)
+{
+    strm_t          *t  = (strm_t *)user_data;
+    mrp_transport_t *mt = (mrp_transport_t *)t;
+    outq_t          *oq = &t->oq;
+
+    MRP_UNUSED(req);
+
+    oq->wreq = NULL;
+    oq->wbuf = NULL;
+
+    if (result < 0 && result != -EAGAIN && result != -EINTR) {
+        mrp_debug("transport %p failed to flush output (%d: %s)", t,
+                  (int)-result, strerror((int)-result));
+        /* let the input watch deliver the closed event on HUP */
+        outq_reset(t);
+        return;
+    }
+
+    if (result > 0)
+        outq_consume(oq, (size_t)result);
+
+    if (oq->len > 0) {
+        /* fall back to an output watch if we could not make progress */
+        if (result <= 0 || !outq_submit(t))
+            outq_watch(t);
+    }
+
+    outq_notify(t);
+    t->check_destroy(mt);
+}
+
+
 static int set_nonblocking(int sock, int nonblocking)
 {
     long nb = (nonblocking ? 1 : 0);
@@ -286,12 +787,40 @@ static int set_reuseaddr(int sock, int reuseaddr)
 }
 
 
+static int set_reuseport(int sock, int family)
+{
+    int on = 1;
+
+    /* the kernel only balances connections between inet sockets */
+    if (family != AF_INET && family != AF_INET6) {
+        mrp_debug("ignoring SO_REUSEPORT for socket family %d", family);
+        return 0;
+    }
+
+    return setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+}
+
+
+static mrp_fragbuf_t *create_fragbuf(void)
+{
+    mrp_fragbuf_t *buf = mrp_fragbuf_create(TRUE, 0);
+
+    if (buf != NULL)
+        mrp_fragbuf_set_max_frame(buf, MAX_FRAME);
+
+    return buf;
+}
+
+
 static int strm_createfrom(mrp_transport_t *mt, void *conn)
 {
     strm_t           *t = (strm_t *)mt;
     mrp_io_event_t   events;
 
-    t->sock = *(int *)conn;
+    t->sock       = *(int *)conn;
+    t->oq.high    = OUTQ_HIGH;
+    t->oq.low     = OUTQ_LOW;
+    t->steal_data = strm_steal_data;
 
     if (t->sock >= 0) {
         if (mt->flags & MRP_TRANSPORT_REUSEADDR)
@@ -304,7 +833,7 @@ static int strm_createfrom(mrp_transport_t *mt, void *conn)
 
         if (t->connected || t->listened) {
             if (!t->connected ||
-                (t->buf = mrp_fragbuf_create(TRUE, 0)) != NULL) {
+                (t->buf = create_fragbuf()) != NULL) {
                 events = MRP_IO_EVENT_IN | MRP_IO_EVENT_HUP;
                 t->iow = mrp_add_io_watch(t->ml, t->sock, events,
                                           strm_recv_cb, t);
@@ -328,6 +857,8 @@ static void strm_close(mrp_transport_t *mt)
 
     mrp_debug("closing transport %p", mt);
 
+    outq_reset(t);
+
     mrp_del_io_watch(t->iow);
     t->iow = NULL;
 
@@ -338,6 +869,10 @@ static void strm_close(mrp_transport_t *mt)
         close(t->sock);
         t->sock = -1;
     }
+
+    mrp_free(t->peer.label);
+    t->peer.label = NULL;
+    t->has_peer   = FALSE;
 }
 
 
@@ -347,6 +882,11 @@ static int strm_bind(mrp_transport_t *mt, mrp_sockaddr_t *addr,
     strm_t *t = (strm_t *)mt;
 
     if (t->sock != -1 || open_socket(t, addr->any.sa_family)) {
+        if (t->reuseport && set_reuseport(t->sock, addr->any.sa_family) < 0) {
+            mrp_debug("failed to set SO_REUSEPORT for transport %p", mt);
+            return FALSE;
+        }
+
         if (bind(t->sock, &addr->any, addrlen) == 0) {
             mrp_debug("transport %p bound", mt);
             return TRUE;
@@ -366,6 +906,11 @@ static int strm_listen(mrp_transport_t *mt, int backlog)
         if (set_nonblocking(t->sock, true) < 0)
             return FALSE;
 
+        if (t->backlog > 0)
+            backlog = t->backlog;
+        else if (backlog <= 0)
+            backlog = SOMAXCONN;
+
         if (listen(t->sock, backlog) == 0) {
             mrp_debug("transport %p listening", mt);
             t->listened = TRUE;
@@ -384,6 +929,7 @@ static int strm_accept(mrp_transport_t *mt, mrp_transport_t *mlt)
     mrp_sockaddr_t  addr;
     socklen_t       addrlen;
     mrp_io_event_t  events;
+    int             flags;
 
     t  = (strm_t *)mt;
     lt = (strm_t *)mlt;
@@ -394,23 +940,40 @@ static int strm_accept(mrp_transport_t *mt, mrp_transport_t *mlt)
         return FALSE;
     }
 
+    /* accepted transports inherit the output queue settings */
+    t->oq.high   = lt->oq.high;
+    t->oq.low    = lt->oq.low;
+    t->oq.notify = lt->oq.notify;
+    t->oq.cork   = lt->oq.cork;
+    t->steal_data = strm_steal_data;
+
+    flags  = (mt->flags & MRP_TRANSPORT_NONBLOCK) ? SOCK_NONBLOCK : 0;
+    flags |= (mt->flags & MRP_TRANSPORT_CLOEXEC)  ? SOCK_CLOEXEC  : 0;
+
     addrlen = sizeof(addr);
-    t->sock = accept(lt->sock, &addr.any, &addrlen);
+
+    do {
+        t->sock = accept4(lt->sock, &addr.any, &addrlen, flags);
+    } while (t->sock < 0 && errno == EINTR);
+
+    if (t->sock < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        lt->consumed = FALSE;                /* no more pending connections */
+        return FALSE;
+    }
+
+    lt->consumed = TRUE;
 
     if (t->sock >= 0) {
         if (mt->flags & MRP_TRANSPORT_REUSEADDR)
             if (set_reuseaddr(t->sock, true) < 0)
                 goto reject;
 
-        if (mt->flags & MRP_TRANSPORT_NONBLOCK)
-            if (set_nonblocking(t->sock, true) < 0)
-                goto reject;
-
-        if (mt->flags & MRP_TRANSPORT_CLOEXEC)
-            if (set_cloexec(t->sock, true) < 0)
-                goto reject;
+        if (addr.any.sa_family == AF_UNIX)
+            t->has_peer = (mrp_peer_credentials(t->sock, &t->peer.pid,
+                                                &t->peer.uid, &t->peer.gid,
+                                                &t->peer.label) == 0);
 
-        t->buf = mrp_fragbuf_create(TRUE, 0);
+        t->buf = create_fragbuf();
         events = MRP_IO_EVENT_IN | MRP_IO_EVENT_HUP;
         t->iow = mrp_add_io_watch(t->ml, t->sock, events, strm_recv_cb, t);
 
@@ -423,6 +986,9 @@ static int strm_accept(mrp_transport_t *mt, mrp_transport_t *mlt)
             t->buf = NULL;
             close(t->sock);
             t->sock = -1;
+            mrp_free(t->peer.label);
+            t->peer.label = NULL;
+            t->has_peer   = FALSE;
         }
     }
     else {
@@ -452,6 +1018,84 @@ static int strm_accept(mrp_transport_t *mt, mrp_transport_t *mlt)
 }
 
 
+static int strm_deliver(strm_t *t, void *data, size_t size)
+{
+    mrp_transport_t *mt = (mrp_transport_t *)t;
+    mrp_json_t      *msg;
+    int              error;
+
+    mrp_trace("strm-message", t->sock, size);
+
+    if (t->mode != MRP_TRANSPORT_MODE_JSON)
+        return t->recv_data(mt, data, size, NULL, 0);
+
+    if ((msg = mrp_json_string_to_object(data, size)) == NULL)
+        return EILSEQ;
+
+    error = t->recv_data(mt, msg, 0, NULL, 0);
+    mrp_json_unref(msg);
+
+    return error;
+}
+
+
+static int strm_recv_scratch(strm_t *t, int fd, size_t pending,
+                             int *destroyed)
+{
+    mrp_transport_t *mt = (mrp_transport_t *)t;
+    char            *p, *end;
+    uint32_t         size;
+    ssize_t          n;
+    int              error;
+
+    if (scratch == NULL && (scratch = mrp_alloc(SCRATCH_SIZE)) == NULL)
+        return ENOMEM;
+
+    if ((n = read(fd, scratch, pending)) < 0)
+        return errno == EAGAIN ? 0 : EIO;
+
+    scratch_busy = TRUE;
+
+    p     = scratch;
+    end   = scratch + n;
+    error = 0;
+
+    while (end - p >= (ssize_t)sizeof(size)) {
+        memcpy(&size, p, sizeof(size));
+        size = be32toh(size);
+
+        if (size > MAX_FRAME) {
+            error = EMSGSIZE;
+            break;
+        }
+
+        if ((size_t)(end - p) - sizeof(size) < size)
+            break;
+
+        p += sizeof(size);
+
+        if ((error = strm_deliver(t, p, size)) != 0)
+            break;
+
+        p += size;
+
+        if ((*destroyed = t->check_destroy(mt)) || t->buf == NULL)
+            break;
+    }
+
+    scratch_busy = FALSE;
+
+    if (error || *destroyed || t->buf == NULL)
+        return error;
+
+    /* buffer the beginning of a frame we don't have fully yet */
+    if (p < end && !mrp_fragbuf_push(t->buf, p, end - p))
+        return mrp_fragbuf_oversized(t->buf) ? EMSGSIZE : ENOMEM;
+
+    return 0;
+}
+
+
 static void strm_recv_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
                          void *user_data)
 {
@@ -461,28 +1105,57 @@ static void strm_recv_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
     uint32_t         pending;
     size_t           size;
     ssize_t          n;
-    int              error;
+    int              error, cnt, destroyed;
 
     MRP_UNUSED(w);
 
     mrp_debug("event 0x%x for transport %p", events, t);
+    mrp_trace("strm-recv", fd, events);
 
     if (events & MRP_IO_EVENT_IN) {
         if (MRP_UNLIKELY(mt->listened != 0)) {
-            MRP_TRANSPORT_BUSY(mt, {
-                    mrp_debug("connection event on transport %p", mt);
-                    mt->evt.connection(mt, mt->user_data);
-                });
+            /*
+             * Keep delivering connection events until accepting runs
+             * out of pending connections (or the owner stops accepting
+             * them), but at most ACCEPT_BATCH of them not to starve the
+             * rest of the mainloop. We'll get called again for the rest.
+             */
+            cnt = 0;
+
+            do {
+                t->consumed = FALSE;
+
+                MRP_TRANSPORT_BUSY(mt, {
+                        mrp_debug("connection event on transport %p", mt);
+                        mt->evt.connection(mt, mt->user_data);
+                    });
+
+                if (t->check_destroy(mt))
+                    return;
+            } while (t->consumed && t->sock >= 0 && ++cnt < ACCEPT_BATCH);
 
-            t->check_destroy(mt);
             return;
         }
 
         while (ioctl(fd, FIONREAD, &pending) == 0 && pending > 0) {
+            if (mrp_fragbuf_used(t->buf) == 0 && pending <= SCRATCH_SIZE &&
+                !scratch_busy) {
+                destroyed = FALSE;
+                error     = strm_recv_scratch(t, fd, pending, &destroyed);
+
+                if (error)
+                    goto fatal_error;
+
+                if (destroyed || t->buf == NULL)
+                    return;
+
+                continue;
+            }
+
             buf = mrp_fragbuf_alloc(t->buf, pending);
 
             if (buf == NULL) {
-                error = ENOMEM;
+                error = mrp_fragbuf_oversized(t->buf) ? EMSGSIZE : ENOMEM;
             fatal_error:
                 mrp_debug("transport %p closed with error %d", mt, error);
             closed:
@@ -513,25 +1186,28 @@ static void strm_recv_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
         data = NULL;
         size = 0;
         while (mrp_fragbuf_pull(t->buf, &data, &size)) {
-            if (t->mode != MRP_TRANSPORT_MODE_JSON)
-                error = t->recv_data(mt, data, size, NULL, 0);
-            else {
-                mrp_json_t *msg = mrp_json_string_to_object(data, size);
-
-                if (msg != NULL) {
-                    error = t->recv_data((mrp_transport_t *)t, msg, 0, NULL, 0);
-                    mrp_json_unref(msg);
-                }
-                else
-                    error = EILSEQ;
-            }
+            error = strm_deliver(t, data, size);
 
             if (error)
                 goto fatal_error;
 
             if (t->check_destroy(mt))
                 return;
+
+            if (t->stolen) {             /* restart with the remaining data */
+                t->stolen = FALSE;
+                data      = NULL;
+                size      = 0;
+            }
         }
+
+        if (mrp_fragbuf_oversized(t->buf)) {
+            error = EMSGSIZE;
+            goto fatal_error;
+        }
+
+        if (t->buf != NULL && mrp_fragbuf_used(t->buf) == 0)
+            mrp_fragbuf_shrink(t->buf);
     }
 
     if (events & MRP_IO_EVENT_HUP) {
@@ -593,7 +1269,7 @@ static int strm_connect(mrp_transport_t *mt, mrp_sockaddr_t *addr,
             set_nonblocking(t->sock, true) < 0)
             goto close_and_fail;
 
-        t->buf = mrp_fragbuf_create(TRUE, 0);
+        t->buf = create_fragbuf();
 
         if (t->buf != NULL) {
             events = MRP_IO_EVENT_IN | MRP_IO_EVENT_HUP;
@@ -623,6 +1299,42 @@ static int strm_connect(mrp_transport_t *mt, mrp_sockaddr_t *addr,
 }
 
 
+static void *strm_steal_data(mrp_transport_t *mt, void *data, size_t size)
+{
+    strm_t *t = (strm_t *)mt;
+    void   *stolen;
+
+    /*
+     * Frames delivered from the shared scratch buffer are copied out, as
+     * the buffer is reused for the next read. That is a single copy of
+     * the frame, still cheaper than a full decode into fresh fields.
+     */
+
+    if (scratch_busy && data >= (void *)scratch &&
+        data + size <= (void *)scratch + SCRATCH_SIZE) {
+        if ((stolen = mrp_alloc(size)) != NULL)
+            memcpy(stolen, data, size);
+
+        return stolen;
+    }
+
+    stolen = mrp_fragbuf_steal(t->buf, data, size);
+
+    if (stolen != NULL)
+        t->stolen = TRUE;
+
+    return stolen;
+}
+
+
+static const mrp_transport_peer_t *strm_peer(mrp_transport_t *mt)
+{
+    strm_t *t = (strm_t *)mt;
+
+    return t->has_peer ? &t->peer : NULL;
+}
+
+
 static int strm_disconnect(mrp_transport_t *mt)
 {
     strm_t *t = (strm_t *)mt;
@@ -631,6 +1343,15 @@ static int strm_disconnect(mrp_transport_t *mt)
         mrp_del_io_watch(t->iow);
         t->iow = NULL;
 
+        if (t->oq.len > 0) {
+            outq_flush(t);
+
+            if (t->oq.len > 0)
+                mrp_log_warning("Discarding %zu bytes of unsent data of "
+                                "transport %p.", t->oq.len, t);
+        }
+        outq_reset(t);
+
         shutdown(t->sock, SHUT_RDWR);
 
         mrp_fragbuf_destroy(t->buf);
@@ -645,36 +1366,43 @@ static int strm_disconnect(mrp_transport_t *mt)
 }
 
 
-static int strm_send(mrp_transport_t *mt, mrp_msg_t *msg)
+static int strm_sendencmsg(mrp_transport_t *mt, void *buf, size_t size)
 {
-    strm_t        *t = (strm_t *)mt;
+    strm_t       *t = (strm_t *)mt;
     struct iovec  iov[2];
-    void         *buf;
-    ssize_t       size, n;
     uint32_t      len;
 
     if (t->connected) {
-        size = mrp_msg_default_encode(msg, &buf);
+        len = htobe32(size);
+        iov[0].iov_base = &len;
+        iov[0].iov_len  = sizeof(len);
+        iov[1].iov_base = buf;
+        iov[1].iov_len  = size;
 
-        if (size >= 0) {
-            len = htobe32(size);
-            iov[0].iov_base = &len;
-            iov[0].iov_len  = sizeof(len);
-            iov[1].iov_base = buf;
-            iov[1].iov_len  = size;
+        return strm_write(t, iov, 2);
+    }
 
-            n = writev(t->sock, iov, 2);
-            mrp_free(buf);
+    return FALSE;
+}
 
-            if (n == (ssize_t)(size + sizeof(len)))
-                return TRUE;
-            else {
-                if (n == -1 && errno == EAGAIN) {
-                    mrp_log_error("%s(): XXX TODO: this sucks, need to add "
-                                  "output queuing for strm-transport.",
-                                  __FUNCTION__);
-                }
-            }
+
+static int strm_send(mrp_transport_t *mt, mrp_msg_t *msg)
+{
+    strm_t        *t = (strm_t *)mt;
+    mrp_msg_iov_t  miov;
+    uint32_t       len;
+    int            success;
+
+    if (t->connected) {
+        if (mrp_transport_encode_iov(mt, msg, &miov) >= 0) {
+            len = htobe32(miov.size);
+            miov.iov[0].iov_base = &len;
+            miov.iov[0].iov_len  = sizeof(len);
+
+            success = strm_write(t, miov.iov, miov.iovcnt);
+            mrp_msg_iov_release(&miov);
+
+            return success;
         }
     }
 
@@ -684,21 +1412,14 @@ static int strm_send(mrp_transport_t *mt, mrp_msg_t *msg)
 
 static int strm_sendraw(mrp_transport_t *mt, void *data, size_t size)
 {
-    strm_t  *t = (strm_t *)mt;
-    ssize_t  n;
+    strm_t       *t = (strm_t *)mt;
+    struct iovec  iov[1];
 
     if (t->connected) {
-        n = write(t->sock, data, size);
+        iov[0].iov_base = data;
+        iov[0].iov_len  = size;
 
-        if (n == (ssize_t)size)
-            return TRUE;
-        else {
-            if (n == -1 && errno == EAGAIN) {
-                mrp_log_error("%s(): XXX TODO: this sucks, need to add "
-                              "output queuing for strm-transport.",
-                              __FUNCTION__);
-            }
-        }
+        return strm_write(t, iov, 1);
     }
 
     return FALSE;
@@ -709,11 +1430,12 @@ static int strm_senddata(mrp_transport_t *mt, void *data, uint16_t tag)
 {
     strm_t           *t = (strm_t *)mt;
     mrp_data_descr_t *type;
-    ssize_t           n;
+    struct iovec      iov[1];
     void             *buf;
     size_t            size, reserve, len;
     uint32_t         *lenp;
     uint16_t         *tagp;
+    int               success;
 
     if (t->connected) {
         type = mrp_msg_find_type(tag);
@@ -729,19 +1451,13 @@ static int strm_senddata(mrp_transport_t *mt, void *data, uint16_t tag)
                 *lenp = htobe32(len);
                 *tagp = htobe16(tag);
 
-                n = write(t->sock, buf, len + sizeof(*lenp));
+                iov[0].iov_base = buf;
+                iov[0].iov_len  = len + sizeof(*lenp);
 
+                success = strm_write(t, iov, 1);
                 mrp_free(buf);
 
-                if (n == (ssize_t)(len + sizeof(*lenp)))
-                    return TRUE;
-                else {
-                    if (n == -1 && errno == EAGAIN) {
-                        mrp_log_error("%s(): XXX TODO: this sucks, need to add"
-                                      " output queueing for strm-transport.",
-                                      __FUNCTION__);
-                    }
-                }
+                return success;
             }
         }
     }
@@ -754,10 +1470,11 @@ static int strm_sendnative(mrp_transport_t *mt, void *data, uint32_t type_id)
 {
     strm_t        *t   = (strm_t *)mt;
     mrp_typemap_t *map = t->map;
+    struct iovec   iov[1];
     void          *buf;
     size_t         size, reserve;
     uint32_t      *lenp;
-    ssize_t        n;
+    int            success;
 
     if (t->connected) {
         reserve = sizeof(*lenp);
@@ -766,19 +1483,13 @@ static int strm_sendnative(mrp_transport_t *mt, void *data, uint32_t type_id)
             lenp  = buf;
             *lenp = htobe32(size - sizeof(*lenp));
 
-            n = write(t->sock, buf, size);
+            iov[0].iov_base = buf;
+            iov[0].iov_len  = size;
 
+            success = strm_write(t, iov, 1);
             mrp_free(buf);
 
-            if (n == (ssize_t)size)
-                return TRUE;
-            else {
-                if (n == -1 && errno == EAGAIN) {
-                    mrp_log_error("%s(): XXX TODO: this sucks, need to add"
-                                  " output queueing for strm-transport.",
-                                  __FUNCTION__);
-                }
-            }
+            return success;
         }
     }
 
@@ -791,7 +1502,7 @@ static int strm_sendjson(mrp_transport_t *mt, mrp_json_t *msg)
     strm_t       *t = (strm_t *)mt;
     struct iovec  iov[2];
     const char   *s;
-    ssize_t       size, n;
+    ssize_t       size;
     uint32_t      len;
 
     if (t->connected && (s = mrp_json_object_to_string(msg)) != NULL) {
@@ -802,17 +1513,7 @@ static int strm_sendjson(mrp_transport_t *mt, mrp_json_t *msg)
         iov[1].iov_base = (void *)s;
         iov[1].iov_len  = size;
 
-        n = writev(t->sock, iov, 2);
-
-        if (n == (ssize_t)(size + sizeof(len)))
-            return TRUE;
-        else {
-            if (n == -1 && errno == EAGAIN) {
-                mrp_log_error("%s(): XXX TODO: this sucks, need to add "
-                              "output queuing for strm-transport.",
-                              __FUNCTION__);
-            }
-        }
+        return strm_write(t, iov, 2);
     }
 
     return FALSE;
@@ -820,7 +1521,7 @@ static int strm_sendjson(mrp_transport_t *mt, mrp_json_t *msg)
 
 
 MRP_REGISTER_TRANSPORT(tcp4, TCP4, strm_t, strm_resolve,
-                       strm_open, strm_createfrom, strm_close, NULL,
+                       strm_open, strm_createfrom, strm_close, strm_setopt,
                        strm_bind, strm_listen, strm_accept,
                        strm_connect, strm_disconnect,
                        strm_send, NULL,
@@ -828,10 +1529,12 @@ MRP_REGISTER_TRANSPORT(tcp4, TCP4, strm_t, strm_resolve,
                        strm_senddata, NULL,
                        NULL, NULL,
                        strm_sendnative, NULL,
-                       strm_sendjson, NULL);
+                       strm_sendjson, NULL,
+                       .sendencmsg = strm_sendencmsg,
+                       .peer       = strm_peer);
 
 MRP_REGISTER_TRANSPORT(tcp6, TCP6, strm_t, strm_resolve,
-                       strm_open, strm_createfrom, strm_close, NULL,
+                       strm_open, strm_createfrom, strm_close, strm_setopt,
                        strm_bind, strm_listen, strm_accept,
                        strm_connect, strm_disconnect,
                        strm_send, NULL,
@@ -839,10 +1542,12 @@ MRP_REGISTER_TRANSPORT(tcp6, TCP6, strm_t, strm_resolve,
                        strm_senddata, NULL,
                        NULL, NULL,
                        strm_sendnative, NULL,
-                       strm_sendjson, NULL);
+                       strm_sendjson, NULL,
+                       .sendencmsg = strm_sendencmsg,
+                       .peer       = strm_peer);
 
 MRP_REGISTER_TRANSPORT(unxstrm, UNXS, strm_t, strm_resolve,
-                       strm_open, strm_createfrom, strm_close, NULL,
+                       strm_open, strm_createfrom, strm_close, strm_setopt,
                        strm_bind, strm_listen, strm_accept,
                        strm_connect, strm_disconnect,
                        strm_send, NULL,
@@ -850,4 +1555,6 @@ MRP_REGISTER_TRANSPORT(unxstrm, UNXS, strm_t, strm_resolve,
                        strm_senddata, NULL,
                        NULL, NULL,
                        strm_sendnative, NULL,
-                       strm_sendjson, NULL);
+                       strm_sendjson, NULL,
+                       .sendencmsg = strm_sendencmsg,
+                       .peer       = strm_peer);
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
+#include <murphy/common/msg.h>
+
+typedef struct {
+    uint32_t  seq;
+    char     *name;
+    bool      shared;
+    int16_t   prio;
+    uint64_t  stamp;
+    double    volume;
+    uint8_t   nzone;
+    char    **zones;
+    uint32_t  nid;
+    int32_t  *ids;
+} codec_test_t;
+
+/* generated from data-codec-test.codec */
+#include "data-codec-test-codec.c"
+
+MRP_DATA_DESCRIPTOR(interp_descr, 0x102, codec_test_t,
+    MRP_DATA_MEMBER(codec_test_t, seq, MRP_MSG_FIELD_UINT32),
+    MRP_DATA_MEMBER(codec_test_t, name, MRP_MSG_FIELD_STRING),
+    MRP_DATA_MEMBER(codec_test_t, shared, MRP_MSG_FIELD_BOOL),
+    MRP_DATA_MEMBER(codec_test_t, prio, MRP_MSG_FIELD_SINT16),
+    MRP_DATA_MEMBER(codec_test_t, stamp, MRP_MSG_FIELD_UINT64),
+    MRP_DATA_MEMBER(codec_test_t, volume, MRP_MSG_FIELD_DOUBLE),
+    MRP_DATA_MEMBER(codec_test_t, nzone, MRP_MSG_FIELD_UINT8),
+    MRP_DATA_ARRAY_COUNT(codec_test_t, zones, nzone, MRP_MSG_FIELD_STRING),
+    MRP_DATA_MEMBER(codec_test_t, nid, MRP_MSG_FIELD_UINT32),
+    MRP_DATA_ARRAY_COUNT(codec_test_t, ids, nid, MRP_MSG_FIELD_SINT32));
+
+
+static int check_equal(codec_test_t *a, codec_test_t *b)
+{
+    uint32_t i;
+
+    if (a->seq != b->seq || strcmp(a->name, b->name) ||
+        a->shared != b->shared || a->prio != b->prio ||
+        a->stamp != b->stamp || a->volume != b->volume ||
+        a->nzone != b->nzone || a->nid != b->nid)
+        return FALSE;
+
+    for (i = 0; i < a->nzone; i++)
+        if (strcmp(a->zones[i], b->zones[i]))
+            return FALSE;
+
+    for (i = 0; i < a->nid; i++)
+        if (a->ids[i] != b->ids[i])
+            return FALSE;
+
+    return TRUE;
+}
+
+
+static void *encode(codec_test_t *data, mrp_data_descr_t *descr, size_t *size)
+{
+    void *buf;
+
+    *size = mrp_data_encode(&buf, data, descr, 0);
+
+    if (*size == 0 || buf == NULL) {
+        printf("failed to encode data with descriptor 0x%x\n", descr->tag);
+        exit(1);
+    }
+
+    return buf;
+}
+
+
+static codec_test_t *decode(void *buf, size_t size, mrp_data_descr_t *descr)
+{
+    void         *p = buf;
+    codec_test_t *data;
+
+    data = mrp_data_decode(&p, &size, descr);
+
+    if (data == NULL) {
+        printf("failed to decode data with descriptor 0x%x\n", descr->tag);
+        exit(1);
+    }
+
+    return data;
+}
+
+
+int main(int argc, char *argv[])
+{
+    char         *zones[] = { "driver", "passenger" };
+    int32_t       ids[]   = { 1, -2, 3, -4 };
+    codec_test_t  data = {
+        .seq    = 7,
+        .name   = "player",
+        .shared = true,
+        .prio   = -3,
+        .stamp  = 0x1234567890abcdefULL,
+        .volume = 0.75,
+        .nzone  = MRP_ARRAY_SIZE(zones),
+        .zones  = zones,
+        .nid    = MRP_ARRAY_SIZE(ids),
+        .ids    = ids,
+    };
+    codec_test_t *gen, *itp;
+    void         *gbuf, *ibuf;
+    size_t        gsize, isize, size;
+    void         *p;
+
+    MRP_UNUSED(argc);
+    MRP_UNUSED(argv);
+
+    if (!mrp_msg_register_type(&codec_test_descr) ||
+        !mrp_msg_register_type(&interp_descr)) {
+        printf("failed to register data types\n");
+        exit(1);
+    }
+
+    gbuf = encode(&data, &codec_test_descr, &gsize);
+    ibuf = encode(&data, &interp_descr, &isize);
+
+    if (gsize != isize || memcmp(gbuf, ibuf, gsize)) {
+        printf("generated and interpreted encoding differ (%zu vs. %zu)\n",
+               gsize, isize);
+        exit(1);
+    }
+
+    gen = decode(ibuf, isize, &codec_test_descr);
+    itp = decode(gbuf, gsize, &interp_descr);
+
+    if (!check_equal(&data, gen) || !check_equal(&data, itp)) {
+        printf("decoded data does not match the original\n");
+        exit(1);
+    }
+
+    p    = gbuf;
+    size = gsize - 1;
+
+    if (mrp_data_decode(&p, &size, &codec_test_descr) != NULL) {
+        printf("decoding truncated data did not fail\n");
+        exit(1);
+    }
+
+    mrp_data_free(gen, codec_test_descr.tag);
+    mrp_data_free(itp, interp_descr.tag);
+    mrp_free(gbuf);
+    mrp_free(ibuf);
+
+    printf("generated codec tests: OK\n");
+
+    return 0;
+}
@@ -37,6 +37,7 @@
 #include <murphy/common/list.h>
 #include <murphy/common/macros.h>
 #include <murphy/common/hashtbl.h>
+#include <murphy/common/utils.h>
 
 #define MEMBER_OFFSET MRP_OFFSET
 #define ALLOC_ARR(type, n) mrp_allocz(sizeof(type) * (n))
@@ -168,6 +169,34 @@ evict(void)
 }
 
 
+int
+evict_cb(void *key, void *object, void *user_data)
+{
+    entry_t *entry = object;
+
+    (void)user_data;
+
+    if (PATTERN_BIT(test.pattern, entry->int1)) {
+        INFO("unhashing entry '%s' (%p)", (char *)key, entry);
+        return MRP_HTBL_ITER_MORE | MRP_HTBL_ITER_UNHASH;
+    }
+    else
+        return MRP_HTBL_ITER_MORE;
+}
+
+
+void
+evict_foreach(void)
+{
+    INFO("evicting while iterating...");
+
+    if (!mrp_htbl_foreach(test.ht, evict_cb, NULL))
+        FATAL("failed to iterate through hash table");
+
+    INFO("done.");
+}
+
+
 void
 readd(void)
 {
@@ -367,7 +396,10 @@ test_run(void)
         for (j = 0; j < NPHASE; j++) {
             INFO("Running test phase #%d...", j);
 
-            evict();
+            if (j & 0x1)
+                evict_foreach();
+            else
+                evict();
             check();
             readd();
 
@@ -384,6 +416,65 @@ test_run(void)
 }
 
 
+/*
+ * chain length statistics for the old shift-xor and the current string hash
+ */
+
+#define NDIST_KEY    4096
+#define NDIST_CHAIN  256
+#define MAX_CHAIN    64                  /* mean chain length is 16 */
+
+static int max_chain(unsigned int (*hash)(const void *), const char *fmt)
+{
+    int  chains[NDIST_CHAIN], i, max;
+    char key[256];
+
+    memset(chains, 0, sizeof(chains));
+
+    for (i = 0; i < NDIST_KEY; i++) {
+        snprintf(key, sizeof(key), fmt, i);
+        chains[hash(key) % NDIST_CHAIN]++;
+    }
+
+    for (i = max = 0; i < NDIST_CHAIN; i++)
+        if (chains[i] > max)
+            max = chains[i];
+
+    return max;
+}
+
+
+static unsigned int string_hash(const void *key)
+{
+    return mrp_string_hash(key);
+}
+
+
+static void test_distribution(void)
+{
+    static const char *formats[] = {
+        "audio_playback_%d",
+        "/org/murphy/resource/0/%d",
+        "%d/a/key/with/a/suffix/that/is/longer/than/32/characters",
+        NULL
+    };
+    const char **fmt;
+    int          old, cur;
+
+    for (fmt = formats; *fmt != NULL; fmt++) {
+        old = max_chain(hash_func, *fmt);
+        cur = max_chain(string_hash, *fmt);
+
+        INFO("'%s': longest chain %d (shift-xor: %d), mean %d", *fmt,
+             cur, old, NDIST_KEY / NDIST_CHAIN);
+
+        if (cur > MAX_CHAIN)
+            FATAL("poor hash distribution for '%s' (longest chain %d)",
+                  *fmt, cur);
+    }
+}
+
+
 int
 main(int argc, char *argv[])
 {
@@ -394,6 +485,7 @@ main(int argc, char *argv[])
     if (argc < 2 || (test.nentry = (int)strtoul(argv[1], NULL, 10)) <= 16)
         test.nentry = 16;
 
+    test_distribution();
     test_init();
 
     for (i = 0; i < NKEY; i++) {
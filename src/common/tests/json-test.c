@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/json.h>
+
+#define FAIL(fmt, args...) do {                               \
+        printf("FAILED: "fmt"\n", ## args);                   \
+        exit(1);                                              \
+    } while (0)
+
+
+static void write_message(mrp_json_writer_t *w, int seq)
+{
+    mrp_json_writer_reset(w);
+
+    if (!mrp_json_write_object_begin(w, NULL)                  ||
+        !mrp_json_write_string      (w, "type", "ev\"ent\n\t") ||
+        !mrp_json_write_integer     (w, "seq" , seq)           ||
+        !mrp_json_write_array_begin (w, "resources")           ||
+        !mrp_json_write_object_begin(w, NULL)                  ||
+        !mrp_json_write_string      (w, "name", "audio")       ||
+        !mrp_json_write_double      (w, "gain", 0.5)           ||
+        !mrp_json_write_boolean     (w, "shared", TRUE)        ||
+        !mrp_json_write_object_end  (w)                        ||
+        !mrp_json_write_null        (w, NULL)                  ||
+        !mrp_json_write_array_end   (w)                        ||
+        !mrp_json_write_array_begin (w, "empty")               ||
+        !mrp_json_write_array_end   (w)                        ||
+        !mrp_json_write_object_end  (w))
+        FAIL("writing message #%d", seq);
+}
+
+
+static void check_writer(mrp_json_writer_t *w)
+{
+    const char *expected =
+        "{\"type\":\"ev\\\"ent\\n\\t\",\"seq\":3,"
+        "\"resources\":[{\"name\":\"audio\",\"gain\":0.5,\"shared\":true},"
+        "null],\"empty\":[]}";
+    const char *s;
+    size_t      size;
+    mrp_json_t *o;
+    int         seq;
+
+    s = mrp_json_writer_output(w, &size);
+
+    if (s == NULL || strcmp(s, expected) || size != strlen(expected))
+        FAIL("writer output '%s', expected '%s'", s ? s : "<none>", expected);
+
+    /* make sure json-c agrees with the output */
+    if ((o = mrp_json_string_to_object(s, size)) == NULL)
+        FAIL("json-c failed to parse '%s'", s);
+
+    if (!mrp_json_get_integer(o, "seq", &seq) || seq != 3)
+        FAIL("json-c parsed seq %d, expected 3", seq);
+
+    mrp_json_unref(o);
+
+    printf("writer: OK\n");
+}
+
+
+static void check_reader(void)
+{
+    char buf[] = " { \"a\" : [ 1, -2.5e1, \"x\\u00e9\\/\", {\"k\": {}} ],"
+        " \"skip\": {\"x\": [1, [2, 3]]}, \"b\" : true, \"c\":null } ";
+    mrp_json_token_type_t expected[] = {
+        MRP_JSON_TOKEN_OBJECT_BEGIN,
+        MRP_JSON_TOKEN_KEY, MRP_JSON_TOKEN_ARRAY_BEGIN,
+        MRP_JSON_TOKEN_INTEGER, MRP_JSON_TOKEN_DOUBLE, MRP_JSON_TOKEN_STRING,
+        MRP_JSON_TOKEN_OBJECT_BEGIN, MRP_JSON_TOKEN_KEY,
+        MRP_JSON_TOKEN_OBJECT_BEGIN, MRP_JSON_TOKEN_OBJECT_END,
+        MRP_JSON_TOKEN_OBJECT_END, MRP_JSON_TOKEN_ARRAY_END,
+        MRP_JSON_TOKEN_KEY,
+        MRP_JSON_TOKEN_KEY, MRP_JSON_TOKEN_BOOLEAN,
+        MRP_JSON_TOKEN_KEY, MRP_JSON_TOKEN_NULL,
+        MRP_JSON_TOKEN_OBJECT_END,
+        MRP_JSON_TOKEN_END
+    };
+    char              bad[] = "{\"a\":1,}";
+    mrp_json_reader_t r;
+    mrp_json_token_t  tok;
+    int               i;
+
+    mrp_json_reader_init(&r, buf, sizeof(buf) - 1);
+
+    for (i = 0; i < (int)MRP_ARRAY_SIZE(expected); i++) {
+        if (mrp_json_reader_next(&r, &tok) != expected[i])
+            FAIL("token #%d: got type %d, expected %d", i, tok.type,
+                 expected[i]);
+
+        switch (tok.type) {
+        case MRP_JSON_TOKEN_KEY:
+            if (!strcmp(tok.str, "skip") && !mrp_json_reader_skip(&r, &tok))
+                FAIL("skipping member 'skip'");
+            break;
+        case MRP_JSON_TOKEN_INTEGER:
+            if (tok.integer != 1)
+                FAIL("integer %d, expected 1", tok.integer);
+            break;
+        case MRP_JSON_TOKEN_DOUBLE:
+            if (tok.dbl != -25.0)
+                FAIL("double %f, expected -25.0", tok.dbl);
+            break;
+        case MRP_JSON_TOKEN_STRING:
+            if (strcmp(tok.str, "x\xc3\xa9/") || tok.len != 4)
+                FAIL("string '%s', expected 'x\xc3\xa9/'", tok.str);
+            break;
+        default:
+            break;
+        }
+    }
+
+    mrp_json_reader_init(&r, bad, sizeof(bad) - 1);
+
+    while (mrp_json_reader_next(&r, &tok) > MRP_JSON_TOKEN_END)
+        ;
+
+    if (tok.type != MRP_JSON_TOKEN_ERROR)
+        FAIL("malformed input not detected");
+
+    printf("reader: OK\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    mrp_json_writer_t w;
+    int               i;
+
+    MRP_UNUSED(argc);
+    MRP_UNUSED(argv);
+
+    if (!mrp_json_writer_init(&w, 16))
+        FAIL("initializing writer");
+
+    /* reusing the writer must produce identical output */
+    for (i = 0; i < 4; i++)
+        write_message(&w, i);
+
+    check_writer(&w);
+    mrp_json_writer_cleanup(&w);
+
+    check_reader();
+
+    return 0;
+}
@@ -32,6 +32,7 @@
 #include <errno.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 
@@ -145,6 +146,7 @@ typedef struct {
     int              log_mask;
     const char      *log_target;
     uint32_t         seqno;
+    int              fanout;
 } context_t;
 
 
@@ -448,6 +450,80 @@ void server_init(context_t *c)
 }
 
 
+static uint64_t time_usecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+
+void fanout_msg(context_t *c, mrp_msg_t *msg)
+{
+    mrp_transport_t **ts;
+    mrp_sockaddr_t   *addrs;
+    socklen_t        *alens;
+    uint64_t          start, once, each;
+    int               n, i, nsent;
+
+    n     = c->fanout;
+    ts    = mrp_allocz_array(mrp_transport_t *, n);
+    addrs = mrp_allocz_array(mrp_sockaddr_t, n);
+    alens = mrp_allocz_array(socklen_t, n);
+
+    if (ts == NULL || addrs == NULL || alens == NULL) {
+        mrp_log_error("Failed to allocate fan-out destinations.");
+        exit(1);
+    }
+
+    for (i = 0; i < n; i++) {
+        ts[i] = c->t;
+        mrp_sockaddr_cpy(addrs + i, &c->addr, c->alen);
+        alens[i] = c->alen;
+    }
+
+    /* encode for every destination */
+    start = time_usecs();
+    for (i = 0, nsent = 0; i < n; i++) {
+        if (c->connect)
+            nsent += mrp_transport_send(c->t, msg) ? 1 : 0;
+        else
+            nsent += mrp_transport_sendto(c->t, msg, addrs + i, alens[i]) ?
+                1 : 0;
+    }
+    each = time_usecs() - start;
+
+    if (nsent != n) {
+        mrp_log_error("Failed to send %d of %d messages.", n - nsent, n);
+        exit(1);
+    }
+
+    /* encode once, send many */
+    start = time_usecs();
+    if (c->connect)
+        nsent = mrp_transport_sendmany(ts, n, msg);
+    else
+        nsent = mrp_transport_sendmanyto(c->t, msg, addrs, alens, n);
+    once = time_usecs() - start;
+
+    if (nsent != n) {
+        mrp_log_error("Failed to send %d of %d messages.", n - nsent, n);
+        exit(1);
+    }
+
+    mrp_log_info("fan-out of %d: %.1f msg/s encoding each, "
+                 "%.1f msg/s encoding once", n,
+                 each ? 1000000.0 * n / each : 0.0,
+                 once ? 1000000.0 * n / once : 0.0);
+
+    mrp_free(ts);
+    mrp_free(addrs);
+    mrp_free(alens);
+}
+
+
 void send_msg(context_t *c)
 {
     mrp_msg_t *msg;
@@ -481,6 +557,12 @@ void send_msg(context_t *c)
         exit(1);
     }
 
+    if (c->fanout > 0) {
+        fanout_msg(c, msg);
+        mrp_msg_unref(msg);
+        return;
+    }
+
     if (c->connect)
         status = mrp_transport_send(c->t, msg);
     else
@@ -667,6 +749,8 @@ static void print_usage(const char *argv0, int exit_code, const char *fmt, ...)
            "  -m, --message                  use generic messages (default)\n"
            "  -r, --raw                      use raw messages\n"
            "  -b, --buggy                    use buggy data descriptors\n"
+           "  -F, --fanout=N                 benchmark sending each message\n"
+           "      N times, encoding it for each send and only once\n"
            "  -t, --log-target=TARGET        log target to use\n"
            "      TARGET is one of stderr,stdout,syslog, or a logfile path\n"
            "  -l, --log-level=LEVELS         logging level to use\n"
@@ -695,7 +779,7 @@ static void config_set_defaults(context_t *ctx)
 
 int parse_cmdline(context_t *ctx, int argc, char **argv)
 {
-#   define OPTIONS "scmrbCa:l:t:v:d:h"
+#   define OPTIONS "scmrbCa:F:l:t:v:d:h"
     struct option options[] = {
         { "server"    , no_argument      , NULL, 's' },
         { "address"   , required_argument, NULL, 'a' },
@@ -705,6 +789,7 @@ int parse_cmdline(context_t *ctx, int argc, char **argv)
         { "connect"   , no_argument      , NULL, 'C' },
 
         { "buggy"     , no_argument      , NULL, 'b' },
+        { "fanout"    , required_argument, NULL, 'F' },
         { "log-level" , required_argument, NULL, 'l' },
         { "log-target", required_argument, NULL, 't' },
         { "verbose"   , optional_argument, NULL, 'v' },
@@ -762,6 +847,12 @@ int parse_cmdline(context_t *ctx, int argc, char **argv)
             ctx->addrstr = optarg;
             break;
 
+        case 'F':
+            ctx->fanout = (int)strtol(optarg, NULL, 10);
+            if (ctx->fanout <= 0)
+                print_usage(argv[0], EINVAL, "invalid fan-out '%s'", optarg);
+            break;
+
         case 'v':
             ctx->log_mask <<= 1;
             ctx->log_mask  |= 1;
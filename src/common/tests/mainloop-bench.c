@@ -0,0 +1,451 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * mainloop benchmark
+ *
+ * Scale the number of I/O watches, timers and deferred callbacks up and
+ * measure what using them costs. In each round only a configurable share
+ * of them is active, while the rest just sit in the mainloop, much like
+ * the watches of the idle clients of a busy daemon. The benchmark runs in
+ * whichever mainloop was selected on the command line, so comparing the
+ * results of a native and a superloop run shows the overhead the latter
+ * adds.
+ */
+
+#include <time.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+#define BENCH_IDLE_MSECS  (3600 * 1000)           /* idle timer interval */
+#define BENCH_WAKEUP_USECS 1000                   /* wakeup test interval */
+#define BENCH_WAKEUPS      1000                   /* wakeups to measure */
+
+typedef enum {
+    BENCH_IO = 0,                                 /* I/O dispatch */
+    BENCH_TIMER,                                  /* timer dispatch */
+    BENCH_DEFERRED,                               /* deferred dispatch */
+    BENCH_WAKEUP,                                 /* timer wakeup latency */
+    BENCH_DONE
+} bench_phase_t;
+
+typedef struct {
+    bench_phase_t     phase;                      /* current phase */
+    mrp_deferred_t   *driver;                     /* round driver */
+    int               round;                      /* current round */
+    int               next;                       /* next object to activate */
+    int               pending;                    /* events pending in round */
+    uint64_t          start;                      /* start of round */
+    uint64_t          busy[BENCH_DONE];           /* time spent per phase */
+    uint64_t          events[BENCH_DONE];         /* events per phase */
+    uint64_t          ops[3];                     /* timer add, mod, del */
+
+    int              *pipes;                      /* pipe fds */
+    mrp_io_watch_t  **ios;                        /* I/O watches */
+    int               nio;
+    mrp_timer_t     **timers;                     /* timers */
+    int               ntimer;
+    mrp_deferred_t  **deferreds;                  /* deferred callbacks */
+    int               ndeferred;
+
+    mrp_timer_t      *wakeup;                     /* wakeup latency timer */
+    uint64_t          expected;                   /* expected wakeup */
+    uint64_t         *late;                       /* wakeup latencies */
+    int               nlate;
+} bench_t;
+
+static bench_t bench;
+
+
+static uint64_t bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static int bench_active(int n)
+{
+    int active = n * cfg.active / 100;
+
+    return n > 0 && active == 0 ? 1 : active;
+}
+
+
+static void bench_next_phase(void)
+{
+    do {
+        bench.phase++;
+        bench.round = 0;
+        bench.next  = 0;
+    } while ((bench.phase == BENCH_IO       && bench.nio       == 0) ||
+             (bench.phase == BENCH_TIMER    && bench.ntimer    == 0) ||
+             (bench.phase == BENCH_DEFERRED && bench.ndeferred == 0));
+}
+
+
+static void bench_event(bench_phase_t phase)
+{
+    bench.events[phase]++;
+
+    if (--bench.pending > 0)
+        return;
+
+    bench.busy[phase] += bench_now() - bench.start;
+
+    if (++bench.round >= cfg.rounds)
+        bench_next_phase();
+
+    mrp_enable_deferred(bench.driver);
+}
+
+
+static void bench_io_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
+                        void *user_data)
+{
+    char buf[8];
+
+    MRP_UNUSED(w);
+    MRP_UNUSED(events);
+    MRP_UNUSED(user_data);
+
+    if (read(fd, buf, sizeof(buf)) > 0)
+        bench_event(BENCH_IO);
+}
+
+
+static void bench_timer_cb(mrp_timer_t *t, void *user_data)
+{
+    MRP_UNUSED(user_data);
+
+    mrp_stop_timer(t);
+    bench_event(BENCH_TIMER);
+}
+
+
+static void bench_deferred_cb(mrp_deferred_t *d, void *user_data)
+{
+    MRP_UNUSED(user_data);
+
+    mrp_disable_deferred(d);
+    bench_event(BENCH_DEFERRED);
+}
+
+
+static void bench_wakeup_cb(mrp_timer_t *t, void *user_data)
+{
+    uint64_t now = bench_now();
+
+    MRP_UNUSED(user_data);
+
+    bench.late[bench.nlate++] = now > bench.expected ? now - bench.expected : 0;
+
+    if (bench.nlate >= BENCH_WAKEUPS) {
+        mrp_del_timer(t);
+        bench.wakeup = NULL;
+        bench.phase  = BENCH_DONE;
+        mrp_enable_deferred(bench.driver);
+        return;
+    }
+
+    mrp_mod_timer_usecs(t, BENCH_WAKEUP_USECS);
+    bench.expected = bench_now() + BENCH_WAKEUP_USECS * 1000ULL;
+}
+
+
+static void bench_driver(mrp_deferred_t *d, void *user_data)
+{
+    mrp_mainloop_t *ml = (mrp_mainloop_t *)user_data;
+    int             n, i, k;
+
+    mrp_disable_deferred(d);
+
+    switch (bench.phase) {
+    case BENCH_IO:
+        n = bench_active(bench.nio);
+        for (k = 0; k < n; k++) {
+            i = bench.next++ % bench.nio;
+            if (write(bench.pipes[2 * i + 1], "x", 1) != 1)
+                fatal("failed to write to pipe (%d: %s)", errno,
+                      strerror(errno));
+        }
+        break;
+
+    case BENCH_TIMER:
+        n = bench_active(bench.ntimer);
+        for (k = 0; k < n; k++)
+            mrp_mod_timer(bench.timers[bench.next++ % bench.ntimer], 0);
+        break;
+
+    case BENCH_DEFERRED:
+        n = bench_active(bench.ndeferred);
+        for (k = 0; k < n; k++)
+            mrp_enable_deferred(bench.deferreds[bench.next++ %
+                                                bench.ndeferred]);
+        break;
+
+    case BENCH_WAKEUP:
+        bench.wakeup = mrp_add_timer_usecs(ml, BENCH_WAKEUP_USECS, 0,
+                                           bench_wakeup_cb, NULL);
+        if (bench.wakeup == NULL)
+            fatal("failed to create wakeup timer");
+        bench.expected = bench_now() + BENCH_WAKEUP_USECS * 1000ULL;
+        return;
+
+    case BENCH_DONE:
+    default:
+        mainloop_quit(&cfg);
+        return;
+    }
+
+    bench.pending = n;
+    bench.start   = bench_now();
+}
+
+
+static void bench_setup_io(mrp_mainloop_t *ml)
+{
+    struct rlimit rl;
+    int           i, need;
+
+    need = 2 * cfg.nio + 64;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)need) {
+        rl.rlim_cur = rl.rlim_max < (rlim_t)need ? rl.rlim_max : (rlim_t)need;
+        setrlimit(RLIMIT_NOFILE, &rl);
+
+        if ((int)rl.rlim_cur < need) {
+            cfg.nio = ((int)rl.rlim_cur - 64) / 2;
+            warning("file descriptor limit allows only %d I/O watches",
+                    cfg.nio);
+        }
+    }
+
+    bench.pipes = mrp_allocz_array(int, 2 * cfg.nio);
+    bench.ios   = mrp_allocz_array(mrp_io_watch_t *, cfg.nio);
+
+    if (cfg.nio > 0 && (bench.pipes == NULL || bench.ios == NULL))
+        fatal("failed to allocate I/O watches");
+
+    for (i = 0; i < cfg.nio; i++) {
+        if (pipe(bench.pipes + 2 * i) < 0)
+            fatal("failed to create pipe #%d (%d: %s)", i, errno,
+                  strerror(errno));
+
+        fcntl(bench.pipes[2 * i], F_SETFL, O_NONBLOCK);
+
+        bench.ios[i] = mrp_add_io_watch(ml, bench.pipes[2 * i],
+                                        MRP_IO_EVENT_IN, bench_io_cb, NULL);
+
+        if (bench.ios[i] == NULL)
+            fatal("failed to create I/O watch #%d", i);
+
+        bench.nio++;
+    }
+}
+
+
+static void bench_setup_timers(mrp_mainloop_t *ml)
+{
+    uint64_t start;
+    int      i;
+
+    bench.timers = mrp_allocz_array(mrp_timer_t *, cfg.ntimer);
+
+    if (cfg.ntimer > 0 && bench.timers == NULL)
+        fatal("failed to allocate timers");
+
+    /* measure the raw cost of adding, modifying and deleting timers */
+    start = bench_now();
+    for (i = 0; i < cfg.ntimer; i++)
+        if ((bench.timers[i] = mrp_add_timer(ml, BENCH_IDLE_MSECS + i % 1000,
+                                             bench_timer_cb, NULL)) == NULL)
+            fatal("failed to create timer #%d", i);
+    bench.ops[0] = bench_now() - start;
+
+    start = bench_now();
+    for (i = 0; i < cfg.ntimer; i++)
+        mrp_mod_timer(bench.timers[i],
+                      BENCH_IDLE_MSECS + (i * 7919) % BENCH_IDLE_MSECS);
+    bench.ops[1] = bench_now() - start;
+
+    start = bench_now();
+    for (i = 0; i < cfg.ntimer; i++)
+        mrp_del_timer(bench.timers[i]);
+    bench.ops[2] = bench_now() - start;
+
+    /* then set up the ones we use for measuring dispatching */
+    for (i = 0; i < cfg.ntimer; i++) {
+        bench.timers[i] = mrp_add_timer(ml, BENCH_IDLE_MSECS + i % 1000,
+                                        bench_timer_cb, NULL);
+        if (bench.timers[i] == NULL)
+            fatal("failed to create timer #%d", i);
+        bench.ntimer++;
+    }
+}
+
+
+static void bench_setup_deferreds(mrp_mainloop_t *ml)
+{
+    int i;
+
+    bench.deferreds = mrp_allocz_array(mrp_deferred_t *, cfg.deferred);
+
+    if (cfg.deferred > 0 && bench.deferreds == NULL)
+        fatal("failed to allocate deferred callbacks");
+
+    for (i = 0; i < cfg.deferred; i++) {
+        bench.deferreds[i] = mrp_add_deferred(ml, bench_deferred_cb, NULL);
+
+        if (bench.deferreds[i] == NULL)
+            fatal("failed to create deferred callback #%d", i);
+
+        mrp_disable_deferred(bench.deferreds[i]);
+        bench.ndeferred++;
+    }
+}
+
+
+static void bench_cleanup(void)
+{
+    int i;
+
+    for (i = 0; i < bench.nio; i++) {
+        mrp_del_io_watch(bench.ios[i]);
+        close(bench.pipes[2 * i]);
+        close(bench.pipes[2 * i + 1]);
+    }
+
+    for (i = 0; i < bench.ntimer; i++)
+        mrp_del_timer(bench.timers[i]);
+
+    for (i = 0; i < bench.ndeferred; i++)
+        mrp_del_deferred(bench.deferreds[i]);
+
+    mrp_del_deferred(bench.driver);
+
+    mrp_free(bench.pipes);
+    mrp_free(bench.ios);
+    mrp_free(bench.timers);
+    mrp_free(bench.deferreds);
+    mrp_free(bench.late);
+}
+
+
+static int bench_cmp(const void *a, const void *b)
+{
+    uint64_t la = *(const uint64_t *)a, lb = *(const uint64_t *)b;
+
+    return la < lb ? -1 : (la > lb ? 1 : 0);
+}
+
+
+static void bench_report_phase(const char *what, bench_phase_t phase)
+{
+    if (bench.events[phase] == 0)
+        return;
+
+    printf("%-20s %10.1f ns/event (%llu events)\n", what,
+           (double)bench.busy[phase] / bench.events[phase],
+           (unsigned long long)bench.events[phase]);
+}
+
+
+static void bench_report(void)
+{
+    static const char *types[] = {
+        [MAINLOOP_NATIVE] = "native",
+        [MAINLOOP_PULSE]  = "pulse",
+        [MAINLOOP_ECORE]  = "ecore",
+        [MAINLOOP_GLIB]   = "glib",
+        [MAINLOOP_QT]     = "qt",
+    };
+    uint64_t sum;
+    int      i;
+
+    printf("%s mainloop, %d I/O watches, %d timers, %d deferreds, "
+           "%d%% active, %d rounds\n", types[cfg.mainloop_type],
+           bench.nio, bench.ntimer, bench.ndeferred, cfg.active, cfg.rounds);
+
+    if (bench.ntimer > 0) {
+        printf("%-20s %10.1f ns/op\n", "timer add:",
+               (double)bench.ops[0] / bench.ntimer);
+        printf("%-20s %10.1f ns/op\n", "timer mod:",
+               (double)bench.ops[1] / bench.ntimer);
+        printf("%-20s %10.1f ns/op\n", "timer del:",
+               (double)bench.ops[2] / bench.ntimer);
+    }
+
+    bench_report_phase("I/O dispatch:", BENCH_IO);
+    bench_report_phase("timer dispatch:", BENCH_TIMER);
+    bench_report_phase("deferred dispatch:", BENCH_DEFERRED);
+
+    if (bench.nlate > 0) {
+        qsort(bench.late, bench.nlate, sizeof(bench.late[0]), bench_cmp);
+
+        for (i = 0, sum = 0; i < bench.nlate; i++)
+            sum += bench.late[i];
+
+        printf("%-20s avg %.1f, p50 %.1f, p99 %.1f, max %.1f us\n",
+               "wakeup latency:", sum / 1000.0 / bench.nlate,
+               bench.late[bench.nlate / 2] / 1000.0,
+               bench.late[(bench.nlate * 99) / 100] / 1000.0,
+               bench.late[bench.nlate - 1] / 1000.0);
+    }
+}
+
+
+static void run_benchmark(mrp_mainloop_t *ml)
+{
+    if (cfg.virtual_clock)
+        fatal("benchmarking needs a real clock");
+
+    bench.late = mrp_allocz_array(uint64_t, BENCH_WAKEUPS);
+
+    if (bench.late == NULL)
+        fatal("failed to allocate wakeup latency buffer");
+
+    bench_setup_io(ml);
+    bench_setup_timers(ml);
+    bench_setup_deferreds(ml);
+
+    if ((bench.driver = mrp_add_deferred(ml, bench_driver, ml)) == NULL)
+        fatal("failed to create benchmark driver");
+
+    bench.phase = -1;
+    bench_next_phase();
+
+    mainloop_run(&cfg);
+
+    bench_report();
+    bench_cleanup();
+}
@@ -143,6 +143,11 @@ typedef struct {
     pid_t        child;
     unsigned int wlpf;
     unsigned int wfrc;
+    int          virtual_clock;
+
+    int benchmark;
+    int active;
+    int rounds;
 } test_config_t;
 
 
@@ -197,7 +202,15 @@ static int timeval_diff(struct timeval *tv1, struct timeval *tv2)
 
 static void timeval_now(struct timeval *tv)
 {
-    gettimeofday(tv, NULL);
+    uint64_t now;
+
+    if (cfg.virtual_clock) {
+        now = mrp_mainloop_time(cfg.ml);
+        tv->tv_sec  = now / USECS_PER_SEC;
+        tv->tv_usec = now % USECS_PER_SEC;
+    }
+    else
+        gettimeofday(tv, NULL);
 }
 
 
@@ -1319,6 +1332,7 @@ static void check_dbus(void)
 
 
 #include "dbus-pump.c"
+#include "mainloop-bench.c"
 
 
 
@@ -1326,11 +1340,12 @@ static void config_set_defaults(test_config_t *cfg)
 {
     mrp_clear(cfg);
 
-    cfg->nio     = 5;
-    cfg->ntimer  = 10;
-    cfg->nsignal = 5;
-    cfg->ngio    = 5;
-    cfg->ngtimer = 10;
+    cfg->nio      = -1;              /* 5 or 10000 with --benchmark */
+    cfg->ntimer   = -1;              /* 10 or 100000 with --benchmark */
+    cfg->deferred = -1;              /* 0 or 10000 with --benchmark */
+    cfg->nsignal  = 5;
+    cfg->ngio     = 5;
+    cfg->ngtimer  = 10;
 
     cfg->ndbus_method = 10;
     cfg->ndbus_signal = 10;
@@ -1342,6 +1357,9 @@ static void config_set_defaults(test_config_t *cfg)
     cfg->wfrc = 5000;
 
     cfg->runtime = DEFAULT_RUNTIME;
+
+    cfg->active = 10;
+    cfg->rounds = 100;
 }
 
 
@@ -1371,6 +1389,11 @@ static void print_usage(const char *argv0, int exit_code, const char *fmt, ...)
            "      LEVELS is a comma separated list of info, error and warning\n"
            "  -v, --verbose                  increase logging verbosity\n"
            "  -d, --debug site               enable debug messages for <site>\n"
+           "  -V, --virtual-clock            run timers on a virtual clock\n"
+           "  -B, --benchmark                measure mainloop scalability\n"
+           "  -D, --deferreds                number of deferred callbacks\n"
+           "  -A, --active=PERCENT           share of objects active per round\n"
+           "  -R, --rounds                   number of benchmark rounds\n"
 #ifdef PULSE_ENABLED
            "  -p, --pulse                    use pulse mainloop\n"
 #endif
@@ -1417,7 +1440,7 @@ int parse_cmdline(test_config_t *cfg, int argc, char **argv)
 #endif
 
 
-#   define OPTIONS "r:i:t:s:I:T:S:M:l:w:W:o:vd:h" \
+#   define OPTIONS "r:i:t:s:I:T:S:M:l:w:W:o:vd:VBD:A:R:h" \
         PULSE_OPTION""ECORE_OPTION""GLIB_OPTION""QT_OPTION
     struct option options[] = {
         { "runtime"     , required_argument, NULL, 'r' },
@@ -1446,6 +1469,11 @@ int parse_cmdline(test_config_t *cfg, int argc, char **argv)
         { "log-target"  , required_argument, NULL, 'o' },
         { "verbose"     , optional_argument, NULL, 'v' },
         { "debug"       , required_argument, NULL, 'd' },
+        { "virtual-clock", no_argument     , NULL, 'V' },
+        { "benchmark"   , no_argument      , NULL, 'B' },
+        { "deferreds"   , required_argument, NULL, 'D' },
+        { "active"      , required_argument, NULL, 'A' },
+        { "rounds"      , required_argument, NULL, 'R' },
         { "help"        , no_argument      , NULL, 'h' },
         { NULL, 0, NULL, 0 }
     };
@@ -1575,6 +1603,37 @@ int parse_cmdline(test_config_t *cfg, int argc, char **argv)
             mrp_debug_enable(TRUE);
             break;
 
+        case 'V':
+            cfg->virtual_clock = TRUE;
+            break;
+
+        case 'B':
+            cfg->benchmark = TRUE;
+            break;
+
+        case 'D':
+            cfg->deferred = (int)strtoul(optarg, &end, 10);
+            if (end && *end)
+                print_usage(argv[0], EINVAL,
+                            "invalid number of deferred callbacks '%s'.",
+                            optarg);
+            break;
+
+        case 'A':
+            cfg->active = (int)strtoul(optarg, &end, 10);
+            if ((end && *end) || cfg->active < 1 || cfg->active > 100)
+                print_usage(argv[0], EINVAL,
+                            "invalid active percentage '%s'.", optarg);
+            break;
+
+        case 'R':
+            cfg->rounds = (int)strtoul(optarg, &end, 10);
+            if ((end && *end) || cfg->rounds < 1)
+                print_usage(argv[0], EINVAL,
+                            "invalid number of benchmark rounds '%s'.",
+                            optarg);
+            break;
+
         case 'h':
             print_usage(argv[0], -1, "");
             exit(0);
@@ -1585,6 +1644,13 @@ int parse_cmdline(test_config_t *cfg, int argc, char **argv)
         }
     }
 
+    if (cfg->nio < 0)
+        cfg->nio = cfg->benchmark ? 10000 : 5;
+    if (cfg->ntimer < 0)
+        cfg->ntimer = cfg->benchmark ? 100000 : 10;
+    if (cfg->deferred < 0)
+        cfg->deferred = cfg->benchmark ? 10000 : 0;
+
     return TRUE;
 }
 
@@ -1739,6 +1805,15 @@ int main(int argc, char *argv[])
     if (ml == NULL)
         fatal("failed to create main loop.");
 
+    if (cfg.virtual_clock && !mrp_mainloop_set_virtual_clock(ml, TRUE))
+        fatal("virtual clock is only supported by the native mainloop.");
+
+    if (cfg.benchmark) {
+        run_benchmark(ml);
+        mainloop_cleanup(&cfg);
+        return 0;
+    }
+
     dbus_test.ml = ml;
     setup_dbus_tests(ml);
     ml = dbus_test.ml;
@@ -6,11 +6,143 @@
 
 #include <murphy/common/mask.h>
 
+#define CHECK(cond, what) do {                          \
+        if (!(cond)) {                                  \
+            printf("%s: FAILED\n", what);               \
+            exit(1);                                    \
+        }                                               \
+    } while (0)
+
+
+static void grow_copy_tests(void)
+{
+    mrp_mask_t m = MRP_MASK_EMPTY, c = MRP_MASK_EMPTY;
+    int        i;
+
+    /* setting a bit beyond the current size grows the mask */
+    CHECK(mrp_mask_set(&m, 200) != NULL, "set bit 200");
+    CHECK(m.nbit > 200, "mask growth on set");
+    CHECK(mrp_mask_test(&m, 200), "test grown bit 200");
+
+    for (i = 0; i < 200; i++)
+        CHECK(!mrp_mask_test(&m, i), "negative test in grown mask");
+
+    mrp_mask_set(&m, 3);
+    mrp_mask_set(&m, 64);
+
+    /* a copy has the same size and bits as the original */
+    CHECK(mrp_mask_copy(&c, &m) != NULL, "copy multi-word mask");
+    CHECK(c.nbit == m.nbit, "size of copied mask");
+
+    for (i = 0; i < m.nbit; i++)
+        CHECK(mrp_mask_test(&c, i) == mrp_mask_test(&m, i), "copied bits");
+
+    mrp_mask_reset(&c);
+    mrp_mask_reset(&m);
+
+    printf("mask grow/copy tests: OK\n");
+}
+
+
+static void xor_tests(void)
+{
+    mrp_mask_t a = MRP_MASK_EMPTY, b = MRP_MASK_EMPTY;
+
+    mrp_mask_set(&a, 1);
+    mrp_mask_set(&a, 3);
+    mrp_mask_set(&b, 3);
+    mrp_mask_set(&b, 5);
+
+    mrp_mask_xor(&a, &b);
+
+    CHECK(mrp_mask_test(&a, 1) && mrp_mask_test(&a, 5), "single-word xor");
+    CHECK(!mrp_mask_test(&a, 3), "single-word xor of common bit");
+
+    mrp_mask_set(&b, 100);
+    mrp_mask_xor(&a, &b);
+
+    CHECK(mrp_mask_test(&a, 1) && mrp_mask_test(&a, 3) &&
+          !mrp_mask_test(&a, 5) && mrp_mask_test(&a, 100), "multi-word xor");
+
+    mrp_mask_reset(&a);
+    mrp_mask_reset(&b);
+
+    printf("mask xor tests: OK\n");
+}
+
+
+static void scan_tests(void)
+{
+    mrp_mask_t m = MRP_MASK_EMPTY;
+    int        last;
+
+    /* the last bit of a mask must be found by both scans */
+    mrp_mask_set(&m, 63);
+    CHECK(mrp_mask_next_set(&m, 0) == 63, "next set at last bit");
+    CHECK(mrp_mask_next_set(&m, 63) == 63, "next set from last bit");
+
+    mrp_mask_neg(&m);
+    CHECK(mrp_mask_next_clear(&m, 0) == 63, "next clear at last bit");
+
+    mrp_mask_reset(&m);
+    mrp_mask_set(&m, 130);
+    last = m.nbit - 1;
+
+    mrp_mask_set(&m, last);
+    mrp_mask_clear(&m, 130);
+    CHECK(mrp_mask_next_set(&m, 0) == last, "next set at last word bit");
+
+    mrp_mask_neg(&m);
+    CHECK(mrp_mask_next_clear(&m, 0) == last, "next clear at last word bit");
+    CHECK(mrp_mask_next_clear(&m, last + 1) == -1, "next clear past end");
+
+    mrp_mask_reset(&m);
+
+    printf("mask scan tests: OK\n");
+}
+
+
+static void intersect_tests(void)
+{
+    mrp_mask_t a = MRP_MASK_EMPTY, b = MRP_MASK_EMPTY;
+
+    CHECK(mrp_mask_empty(&a), "empty single-word mask");
+    CHECK(!mrp_mask_intersects(&a, &b), "intersection of empty masks");
+
+    mrp_mask_set(&a, 7);
+    mrp_mask_set(&b, 8);
+    CHECK(!mrp_mask_empty(&a), "non-empty single-word mask");
+    CHECK(!mrp_mask_intersects(&a, &b), "disjoint single-word masks");
+
+    mrp_mask_set(&b, 7);
+    CHECK(mrp_mask_intersects(&a, &b), "overlapping single-word masks");
+
+    /* single-word vs. multi-word and multi-word vs. multi-word */
+    mrp_mask_clear(&b, 7);
+    mrp_mask_set(&b, 150);
+    CHECK(!mrp_mask_intersects(&a, &b), "disjoint mixed-size masks");
+    CHECK(!mrp_mask_intersects(&b, &a), "disjoint mixed-size masks, swapped");
+
+    mrp_mask_set(&a, 150);
+    CHECK(mrp_mask_intersects(&a, &b), "overlapping multi-word masks");
+
+    mrp_mask_clear(&a, 7);
+    mrp_mask_clear(&a, 150);
+    CHECK(mrp_mask_empty(&a), "cleared multi-word mask");
+    CHECK(!mrp_mask_intersects(&a, &b), "cleared vs. multi-word mask");
+
+    mrp_mask_reset(&a);
+    mrp_mask_reset(&b);
+
+    printf("mask intersection tests: OK\n");
+}
+
+
 int main(int argc, char *argv[])
 {
     uint64_t   bits;
     int        i, j, prev, set, n, cnt, clr, bit;
-    mrp_mask_t m = MRP_MASK_EMPTY, m1;
+    mrp_mask_t m = MRP_MASK_EMPTY, m1 = MRP_MASK_EMPTY;
     int        b[] = { 0, 1, 5, 16, 32, 48, 97, 112, 113, 114, 295, 313, -1 };
 
     cnt = argc > 1 ? strtoul(argv[1], NULL, 10) : 100;
@@ -125,6 +257,12 @@ int main(int argc, char *argv[])
     }
 
     mrp_mask_reset(&m);
+    mrp_mask_reset(&m1);
+
+    grow_copy_tests();
+    xor_tests();
+    scan_tests();
+    intersect_tests();
 
     return 0;
 }
@@ -28,6 +28,7 @@
  */
 
 #include <stdio.h>
+#include <pthread.h>
 #include <murphy/common/mm.h>
 
 #define fatal(fmt, args...) do {                                          \
@@ -102,6 +103,212 @@ static int basic_tests(int n)
 }
 
 
+static int slab_tests(int n)
+{
+    void   **ptrs, *p;
+    size_t   size;
+    int      i, j, success;
+
+    if (!mrp_mm_config(MRP_MM_SLAB)) {
+        error("Failed to switch to slab allocator.");
+        return FALSE;
+    }
+
+    success = TRUE;
+
+    if (!mrp_mm_reserve(1024 * 1024)) {
+        error("Failed to reserve slab memory.");
+        success = FALSE;
+    }
+
+    ptrs    = mrp_allocz(n * sizeof(*ptrs));
+
+    if (ptrs == NULL)
+        fatal("Failed to allocate pointer table.");
+
+    for (i = 0; i < n; i++) {
+        size    = 1 + (i * 37) % 4096;
+        ptrs[i] = mrp_alloc(size);
+
+        if (ptrs[i] == NULL)
+            fatal("Failed to allocate %zu bytes.", size);
+
+        memset(ptrs[i], i & 0xff, size);
+    }
+
+    for (i = 0; i < n; i++) {
+        size = 1 + (i * 37) % 4096;
+        p    = mrp_realloc(ptrs[i], 2 * size);
+
+        if (p == NULL)
+            fatal("Failed to reallocate %zu bytes.", 2 * size);
+
+        for (j = 0; j < (int)size; j++) {
+            if (((unsigned char *)p)[j] != (i & 0xff)) {
+                error("Reallocated block %d corrupted at offset %d.", i, j);
+                success = FALSE;
+                break;
+            }
+        }
+    }
+
+    if (mrp_mm_memalign(&p, 64, 100, __LOC__) != 0 || ((ptrdiff_t)p & 63))
+        error("Failed to allocate aligned memory.");
+    else
+        mrp_free(p);
+
+    mrp_mm_dump(stdout);
+
+    if (mrp_mm_config(MRP_MM_PASSTHRU)) {
+        error("Switched allocator with blocks still in use.");
+        success = FALSE;
+    }
+
+    for (i = 0; i < n; i++)
+        mrp_free(ptrs[i]);
+
+    mrp_free(ptrs);
+
+    mrp_mm_dump(stdout);
+
+    if (!mrp_mm_config(MRP_MM_PASSTHRU)) {
+        error("Failed to switch back to passthru allocator.");
+        success = FALSE;
+    }
+
+    return success;
+}
+
+
+static int sample_tests(int n)
+{
+    void   **ptrs;
+    int      i, success;
+
+    if (!mrp_mm_sample(1024)) {
+        error("Failed to enable allocation sampling.");
+        return FALSE;
+    }
+
+    success = TRUE;
+    ptrs    = mrp_allocz(n * sizeof(*ptrs));
+
+    if (ptrs == NULL)
+        fatal("Failed to allocate pointer table.");
+
+    if (mrp_mm_config(MRP_MM_SLAB)) {
+        error("Switched allocator with sampling enabled.");
+        success = FALSE;
+    }
+
+    for (i = 0; i < n; i++)
+        if ((ptrs[i] = mrp_alloc(1 + (i * 37) % 4096)) == NULL)
+            fatal("Failed to allocate sampled block %d.", i);
+
+    for (i = 0; i < n; i += 2)
+        ptrs[i] = mrp_realloc(ptrs[i], 8192);
+
+    for (i = 0; i < n; i++)
+        mrp_free(ptrs[i]);
+
+    mrp_free(ptrs);
+
+    mrp_mm_sample_dump(stdout);
+    mrp_mm_sample(0);
+
+    if (mrp_mm_sample_rate() != 0) {
+        error("Failed to disable allocation sampling.");
+        success = FALSE;
+    }
+
+    return success;
+}
+
+
+static int tag_stat_cb(const mrp_mm_tag_stat_t *st, void *user_data)
+{
+    mrp_mm_tag_stat_t *stats = user_data;
+
+    if (!strcmp(st->name, "test"))
+        stats[0] = *st;
+    else if (!strcmp(st->name, "test/client"))
+        stats[1] = *st;
+
+    return TRUE;
+}
+
+
+static int account_tests(int n)
+{
+    mrp_mm_tag_stat_t  stats[2];
+    mrp_mm_tag_t      *sys, *cli, *prev;
+    void             **ptrs;
+    int                i, success;
+
+    if (!mrp_mm_account(TRUE) || !mrp_mm_accounting()) {
+        error("Failed to enable allocation accounting.");
+        return FALSE;
+    }
+
+    success = TRUE;
+    sys     = mrp_mm_tag_create("test", NULL);
+    cli     = mrp_mm_tag_create("client", sys);
+    ptrs    = mrp_allocz(n * sizeof(*ptrs));
+
+    if (sys == NULL || cli == NULL || ptrs == NULL)
+        fatal("Failed to create accounting tags.");
+
+    prev = mrp_mm_tag_set(sys);
+    for (i = 0; i < n / 2; i++)
+        ptrs[i] = mrp_alloc(100);
+    mrp_mm_tag_set(cli);
+    for (; i < n; i++)
+        ptrs[i] = mrp_alloc(50);
+    mrp_mm_tag_set(prev);
+
+    /* a resized block stays charged to the tag it was allocated with */
+    ptrs[0] = mrp_realloc(ptrs[0], 200);
+
+    mrp_clear(&stats);
+    mrp_mm_tag_foreach(tag_stat_cb, stats);
+
+    if (stats[0].objs != n || stats[0].bytes != 100 * (n/2) + 50 * (n - n/2)
+        + 100) {
+        error("Wrong subsystem tag charges (%lld bytes in %lld blocks).",
+              (long long)stats[0].bytes, (long long)stats[0].objs);
+        success = FALSE;
+    }
+
+    if (stats[1].objs != n - n/2 || stats[1].bytes != 50 * (n - n/2)) {
+        error("Wrong client tag charges (%lld bytes in %lld blocks).",
+              (long long)stats[1].bytes, (long long)stats[1].objs);
+        success = FALSE;
+    }
+
+    mrp_mm_tag_dump(stdout);
+
+    /* a destroyed tag lingers until its blocks are freed */
+    mrp_mm_tag_destroy(cli);
+
+    for (i = 0; i < n; i++)
+        mrp_free(ptrs[i]);
+
+    mrp_clear(&stats);
+    mrp_mm_tag_foreach(tag_stat_cb, stats);
+
+    if (stats[0].objs != 0 || stats[0].bytes != 0 || stats[1].name != NULL) {
+        error("Tag charges not released.");
+        success = FALSE;
+    }
+
+    mrp_free(ptrs);
+    mrp_mm_tag_destroy(sys);
+    mrp_mm_account(FALSE);
+
+    return success;
+}
+
+
 typedef struct {
     char    name[32];
     int     i;
@@ -194,6 +401,14 @@ static int pool_tests(void)
         return FALSE;
     }
 
+    success = TRUE;
+
+    info("Reserving objects...");
+    if (!mrp_objpool_reserve(max)) {
+        error("Failed to reserve %d objects.", max);
+        success = FALSE;
+    }
+
     info("Allocating objects...");
     for (i = 0; i < max; i++) {
         ptrs[i] = mrp_objpool_alloc(pool);
@@ -265,6 +480,181 @@ static int pool_tests(void)
 }
 
 
+#define NTHREAD   4
+#define NTHREADOBJ 4096
+
+typedef struct {
+    mrp_objpool_t *pool;
+    void         **objs;                 /* objects allocated by another */
+    int            failed;
+} thread_test_t;
+
+
+static void *pool_thread(void *ptr)
+{
+    thread_test_t *t = ptr;
+    void          *objs[64];
+    int            i, j;
+
+    /* free what another thread allocated, then churn our own objects */
+    for (i = 0; i < NTHREADOBJ; i++)
+        mrp_objpool_free(t->objs[i]);
+
+    for (i = 0; i < 100; i++) {
+        for (j = 0; j < (int)MRP_ARRAY_SIZE(objs); j++) {
+            if ((objs[j] = mrp_objpool_alloc(t->pool)) == NULL) {
+                t->failed = TRUE;
+                return NULL;
+            }
+            *(int *)objs[j] = j;
+        }
+
+        for (j = 0; j < (int)MRP_ARRAY_SIZE(objs); j++) {
+            if (*(int *)objs[j] != j)
+                t->failed = TRUE;
+            mrp_objpool_free(objs[j]);
+        }
+    }
+
+    return NULL;
+}
+
+
+static int pool_thread_tests(void)
+{
+    mrp_objpool_config_t cfg;
+    mrp_objpool_t       *pool;
+    thread_test_t        tests[NTHREAD];
+    pthread_t            tids[NTHREAD];
+    int                  i, j, success;
+
+    mrp_clear(&cfg);
+    cfg.name    = "threaded test pool";
+    cfg.objsize = sizeof(obj_t);
+
+    if ((pool = mrp_objpool_create(&cfg)) == NULL) {
+        error("Failed to create threaded test pool.");
+        return FALSE;
+    }
+
+    for (i = 0; i < NTHREAD; i++) {
+        tests[i].pool   = pool;
+        tests[i].failed = FALSE;
+        tests[i].objs   = mrp_allocz(NTHREADOBJ * sizeof(void *));
+
+        for (j = 0; j < NTHREADOBJ; j++)
+            if ((tests[i].objs[j] = mrp_objpool_alloc(pool)) == NULL)
+                fatal("Failed to allocate threaded test object.");
+    }
+
+    for (i = 0; i < NTHREAD; i++)
+        pthread_create(tids + i, NULL, pool_thread, tests + i);
+
+    success = TRUE;
+
+    for (i = 0; i < NTHREAD; i++) {
+        pthread_join(tids[i], NULL);
+
+        if (tests[i].failed) {
+            error("Threaded pool test #%d failed.", i);
+            success = FALSE;
+        }
+
+        mrp_free(tests[i].objs);
+    }
+
+    mrp_objpool_destroy(pool);
+
+    return success;
+}
+
+
+static int pool_double_free_tests(void)
+{
+    mrp_objpool_config_t cfg;
+    mrp_objpool_t       *pool;
+    obj_t               *obj, *a, *b;
+    int                  success;
+
+    mrp_clear(&cfg);
+    cfg.name    = "double free test pool";
+    cfg.objsize = sizeof(obj_t);
+    cfg.setup   = obj_setup;
+    cfg.cleanup = obj_cleanup;
+
+    if ((pool = mrp_objpool_create(&cfg)) == NULL) {
+        error("Failed to create double free test pool.");
+        return FALSE;
+    }
+
+    success = TRUE;
+
+    /* the second free must not put the object in the magazine again */
+    obj = mrp_objpool_alloc(pool);
+    mrp_objpool_free(obj);
+    mrp_objpool_free(obj);
+
+    a = mrp_objpool_alloc(pool);
+    b = mrp_objpool_alloc(pool);
+
+    if (a == NULL || b == NULL || a == b) {
+        error("Double free handed out object %p twice.", a);
+        success = FALSE;
+    }
+
+    mrp_objpool_free(a);
+    mrp_objpool_free(b);
+    mrp_objpool_destroy(pool);
+
+    return success;
+}
+
+
+static pthread_barrier_t exit_barrier;
+
+static void *pool_exit_thread(void *ptr)
+{
+    mrp_objpool_t *pool = ptr;
+
+    /* get a magazine, then exit only after the pool is gone */
+    mrp_objpool_free(mrp_objpool_alloc(pool));
+
+    pthread_barrier_wait(&exit_barrier);
+    pthread_barrier_wait(&exit_barrier);
+
+    return NULL;
+}
+
+
+static int pool_exit_tests(void)
+{
+    mrp_objpool_config_t cfg;
+    mrp_objpool_t       *pool;
+    pthread_t            tid;
+
+    mrp_clear(&cfg);
+    cfg.name    = "thread exit test pool";
+    cfg.objsize = sizeof(obj_t);
+
+    if ((pool = mrp_objpool_create(&cfg)) == NULL) {
+        error("Failed to create thread exit test pool.");
+        return FALSE;
+    }
+
+    pthread_barrier_init(&exit_barrier, NULL, 2);
+    pthread_create(&tid, NULL, pool_exit_thread, pool);
+
+    pthread_barrier_wait(&exit_barrier);
+    mrp_objpool_destroy(pool);
+    pthread_barrier_wait(&exit_barrier);
+
+    pthread_join(tid, NULL);
+    pthread_barrier_destroy(&exit_barrier);
+
+    return TRUE;
+}
+
+
 int main(int argc, char *argv[])
 {
     int max;
@@ -274,11 +664,29 @@ int main(int argc, char *argv[])
     else
         max = 256;
 
+    info("Running slab allocator tests...");
+    slab_tests(max);
+
+    info("Running allocation sampling tests...");
+    sample_tests(max);
+
+    info("Running allocation accounting tests...");
+    account_tests(max);
+
     info("Running basic tests...");
     basic_tests(max);
 
     info("Running object pool tests...");
     pool_tests();
 
+    info("Running threaded object pool tests...");
+    pool_thread_tests();
+
+    info("Running object pool double free tests...");
+    pool_double_free_tests();
+
+    info("Running object pool thread exit tests...");
+    pool_exit_tests();
+
     return 0;
 }
@@ -27,6 +27,8 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <time.h>
+
 #include <murphy/common.h>
 
 #include <murphy/common/msg.h>
@@ -67,22 +69,23 @@ uint16_t get_type(const char **types, const char *name)
 
 void test_default_encode_decode(int argc, char **argv)
 {
-    mrp_msg_t *msg, *decoded;
-    void      *encoded;
-    ssize_t    size;
-    uint16_t   tag, type, prev_tag;
-    uint8_t    u8;
-    int8_t     s8;
-    uint16_t   u16;
-    int16_t    s16;
-    uint32_t   u32;
-    int32_t    s32;
-    uint64_t   u64;
-    int64_t    s64;
-    double     dbl;
-    bool       bln;
-    char      *val, *end;
-    int        i, ok;
+    mrp_msg_t   *msg, *decoded, *view, *inarena;
+    mrp_arena_t *arena;
+    void        *encoded;
+    ssize_t     size;
+    uint16_t    tag, type, prev_tag;
+    uint8_t     u8;
+    int8_t      s8;
+    uint16_t    u16;
+    int16_t     s16;
+    uint32_t    u32;
+    int32_t     s32;
+    uint64_t    u64;
+    int64_t     s64;
+    double      dbl;
+    bool        bln;
+    char        *val, *end;
+    int         i, ok;
 
     if ((msg = mrp_msg_create_empty()) == NULL) {
         mrp_log_error("Failed to create new message.");
@@ -201,8 +204,342 @@ void test_default_encode_decode(int argc, char **argv)
 
     mrp_msg_dump(decoded, stdout);
 
+    view = mrp_msg_default_decode_view(encoded, size);
+    if (view == NULL) {
+        mrp_log_error("Failed to decode message view with default decoder.");
+        exit(1);
+    }
+
+    mrp_msg_dump(view, stdout);
+
+    arena   = mrp_arena_create(0);
+    inarena = arena ? mrp_msg_default_decode_arena(arena, encoded, size) : NULL;
+    if (inarena == NULL) {
+        mrp_log_error("Failed to decode message into arena.");
+        exit(1);
+    }
+
+    if (!mrp_msg_append(inarena, MRP_MSG_TAG_STRING(0x100, "in arena"))) {
+        mrp_log_error("Failed to append to arena message.");
+        exit(1);
+    }
+
+    mrp_msg_dump(inarena, stdout);
+
+    mrp_msg_unref(msg);
+    mrp_msg_unref(decoded);
+    mrp_msg_unref(view);
+    mrp_msg_unref(inarena);
+    mrp_arena_destroy(arena);
+}
+
+
+void test_template(void)
+{
+    mrp_msg_t       *msg, *decoded;
+    mrp_msg_tmpl_t  *tmpl;
+    mrp_msg_field_t *f;
+    void            *data;
+    size_t           size;
+
+    msg = mrp_msg_create(MRP_MSG_TAG_UINT32(1, 1),
+                         MRP_MSG_TAG_STRING(2, "template"),
+                         MRP_MSG_TAG_UINT16(3, 2),
+                         MRP_MSG_TAG_DOUBLE(4, 3.0),
+                         MRP_MSG_TAG_UINT32(1, 4),
+                         NULL);
+
+    if (msg == NULL || (tmpl = mrp_msg_tmpl_create(msg)) == NULL) {
+        mrp_log_error("Failed to create message template.");
+        exit(1);
+    }
+
+    if (!mrp_msg_tmpl_set(tmpl, 1, MRP_MSG_FIELD_UINT32, 100) ||
+        !mrp_msg_tmpl_set(tmpl, 3, MRP_MSG_FIELD_UINT16, 200) ||
+        !mrp_msg_tmpl_set(tmpl, 4, MRP_MSG_FIELD_DOUBLE, 300.0)) {
+        mrp_log_error("Failed to patch message template.");
+        exit(1);
+    }
+
+    if (mrp_msg_tmpl_set(tmpl, 2, MRP_MSG_FIELD_STRING, "foo")) {
+        mrp_log_error("Patching a string field of a template succeeded.");
+        exit(1);
+    }
+
+    data    = mrp_msg_tmpl_data(tmpl, &size);
+    decoded = mrp_msg_default_decode(data + sizeof(uint16_t),
+                                     size - sizeof(uint16_t));
+
+    if (decoded == NULL) {
+        mrp_log_error("Failed to decode message template.");
+        exit(1);
+    }
+
+    mrp_msg_dump(decoded, stdout);
+
+    if ((f = mrp_msg_find(decoded, 1)) == NULL || f->u32 != 100 ||
+        (f = mrp_msg_find(decoded, 3)) == NULL || f->u16 != 200 ||
+        (f = mrp_msg_find(decoded, 4)) == NULL || f->dbl != 300.0 ||
+        (f = mrp_msg_find(decoded, 2)) == NULL || strcmp(f->str, "template")) {
+        mrp_log_error("Patched message template mismatch.");
+        exit(1);
+    }
+
     mrp_msg_unref(msg);
     mrp_msg_unref(decoded);
+    mrp_msg_tmpl_destroy(tmpl);
+}
+
+
+void test_encode_iov(void)
+{
+    mrp_msg_t     *msg;
+    mrp_msg_iov_t  miov;
+    char           big[1024], blob[512], *strs[40], *flat, *p;
+    uint32_t       u32s[] = { 1, 2, 3, 4 };
+    void          *buf;
+    ssize_t        size;
+    int            i;
+
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    memset(blob, 0xa5, sizeof(blob));
+
+    for (i = 0; i < (int)MRP_ARRAY_SIZE(strs); i++)
+        strs[i] = (i & 1) ? "short" : big;
+
+    msg = mrp_msg_create(MRP_MSG_TAG_STRING(1, big),
+                         MRP_MSG_TAG_STRING(2, "small"),
+                         3, MRP_MSG_FIELD_BLOB, (uint32_t)sizeof(blob), blob,
+                         MRP_MSG_TAG_ARRAY(4, STRING,
+                                           MRP_ARRAY_SIZE(strs), strs),
+                         MRP_MSG_TAG_ARRAY(5, UINT32,
+                                           MRP_ARRAY_SIZE(u32s), u32s),
+                         MRP_MSG_TAG_DOUBLE(6, 3.141),
+                         NULL);
+
+    if (msg == NULL) {
+        mrp_log_error("Failed to create message.");
+        exit(1);
+    }
+
+    size = mrp_msg_default_encode(msg, &buf);
+
+    if (size < 0 || mrp_msg_default_encode_iov(msg, &miov) != size) {
+        mrp_log_error("Failed to encode message into an I/O vector.");
+        exit(1);
+    }
+
+    if (miov.iovcnt > 1 + MRP_MSG_IOV_MAX) {
+        mrp_log_error("Too many I/O vector entries (%d).", miov.iovcnt);
+        exit(1);
+    }
+
+    flat = p = mrp_alloc(size);
+
+    for (i = 1; i < miov.iovcnt; i++) {
+        memcpy(p, miov.iov[i].iov_base, miov.iov[i].iov_len);
+        p += miov.iov[i].iov_len;
+    }
+
+    if (p - flat != size || memcmp(flat, buf, size)) {
+        mrp_log_error("I/O vector encoding mismatch.");
+        exit(1);
+    }
+
+    mrp_log_info("Encoded %zd bytes into %d I/O vector entries.", size,
+                 miov.iovcnt - 1);
+
+    mrp_msg_iov_release(&miov);
+    mrp_free(flat);
+    mrp_free(buf);
+    mrp_msg_unref(msg);
+}
+
+
+static mrp_msg_t *create_resource_like_msg(void)
+{
+    char     *names[] = { "audio_playback", "audio_recording", "video" };
+    uint32_t  masks[] = { 0x1, 0x2, 0x4 };
+    int16_t   deltas[] = { -3, 0, 12, -300 };
+
+    return mrp_msg_create(MRP_MSG_TAG_UINT32(1, 42),
+                          MRP_MSG_TAG_UINT16(2, 3),
+                          MRP_MSG_TAG_SINT16(3, -1),
+                          MRP_MSG_TAG_STRING(4, "player"),
+                          MRP_MSG_TAG_STRING(5, "default"),
+                          MRP_MSG_TAG_BOOL(6, TRUE),
+                          MRP_MSG_TAG_UINT32(7, 0x5),
+                          MRP_MSG_TAG_SINT32(8, -100000),
+                          MRP_MSG_TAG_UINT64(9, 1ULL << 40),
+                          MRP_MSG_TAG_SINT64(10, INT64_MIN),
+                          MRP_MSG_TAG_UINT8(11, 0xff),
+                          MRP_MSG_TAG_SINT8(12, -128),
+                          MRP_MSG_TAG_DOUBLE(13, 0.5),
+                          MRP_MSG_TAG_ARRAY(14, STRING,
+                                            MRP_ARRAY_SIZE(names), names),
+                          MRP_MSG_TAG_ARRAY(15, UINT32,
+                                            MRP_ARRAY_SIZE(masks), masks),
+                          MRP_MSG_TAG_ARRAY(16, SINT16,
+                                            MRP_ARRAY_SIZE(deltas), deltas),
+                          17, MRP_MSG_FIELD_BLOB, 4, "blob",
+                          NULL);
+}
+
+
+void test_compact_encode_decode(void)
+{
+    mrp_msg_t     *msg, *decoded;
+    mrp_msg_iov_t  miov;
+    void          *v1, *v2, *re, *flat, *p;
+    ssize_t        s1, s2, sre;
+    int            i;
+
+    if ((msg = create_resource_like_msg()) == NULL) {
+        mrp_log_error("Failed to create message.");
+        exit(1);
+    }
+
+    s1 = mrp_msg_default_encode(msg, &v1);
+    s2 = mrp_msg_compact_encode(msg, &v2);
+
+    if (s1 < 0 || s2 < 0) {
+        mrp_log_error("Failed to encode message.");
+        exit(1);
+    }
+
+    mrp_log_info("default encoding: %zd bytes, compact encoding: %zd bytes",
+                 s1, s2);
+
+    if (be16toh(*(uint16_t *)v2) != MRP_MSG_TAG_COMPACT || s2 >= s1) {
+        mrp_log_error("Unexpected compact encoding.");
+        exit(1);
+    }
+
+    decoded = mrp_msg_compact_decode(v2 + sizeof(uint16_t),
+                                     s2 - sizeof(uint16_t));
+
+    if (decoded == NULL) {
+        mrp_log_error("Failed to decode compact message.");
+        exit(1);
+    }
+
+    mrp_msg_dump(decoded, stdout);
+
+    /* a faithful round-trip re-encodes to the very same bytes */
+    sre = mrp_msg_default_encode(decoded, &re);
+
+    if (sre != s1 || memcmp(re, v1, s1)) {
+        mrp_log_error("Compact round-trip mismatch.");
+        exit(1);
+    }
+
+    if (mrp_msg_compact_encode_iov(msg, &miov) != s2) {
+        mrp_log_error("Failed to compact-encode message into I/O vector.");
+        exit(1);
+    }
+
+    flat = p = mrp_alloc(s2);
+
+    for (i = 1; i < miov.iovcnt; i++) {
+        memcpy(p, miov.iov[i].iov_base, miov.iov[i].iov_len);
+        p += miov.iov[i].iov_len;
+    }
+
+    if (memcmp(flat, v2, s2)) {
+        mrp_log_error("Compact I/O vector encoding mismatch.");
+        exit(1);
+    }
+
+    /* every truncation of the message must be rejected */
+    for (i = sizeof(uint16_t); i < s2; i++) {
+        if (mrp_msg_compact_decode(v2 + sizeof(uint16_t),
+                                   i - sizeof(uint16_t)) != NULL) {
+            mrp_log_error("Truncated compact message decoded (%d bytes).", i);
+            exit(1);
+        }
+    }
+
+    mrp_msg_iov_release(&miov);
+    mrp_free(flat);
+    mrp_free(re);
+    mrp_free(v1);
+    mrp_free(v2);
+    mrp_msg_unref(decoded);
+    mrp_msg_unref(msg);
+}
+
+
+static double now_usecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+
+static void benchmark(const char *name, mrp_msg_t *msg, int n,
+                      ssize_t (*encode)(mrp_msg_t *, void **),
+                      mrp_msg_t *(*decode)(void *, size_t))
+{
+    mrp_msg_t *decoded;
+    void      *buf;
+    ssize_t    size;
+    double     start, mid, end;
+    int        i;
+
+    size  = 0;
+    start = now_usecs();
+
+    for (i = 0; i < n; i++) {
+        if ((size = encode(msg, &buf)) < 0) {
+            mrp_log_error("Failed to encode with %s encoder.", name);
+            return;
+        }
+        mrp_free(buf);
+    }
+
+    mid = now_usecs();
+
+    size = encode(msg, &buf);
+
+    for (i = 0; i < n; i++) {
+        decoded = decode(buf + sizeof(uint16_t), size - sizeof(uint16_t));
+
+        if (decoded == NULL) {
+            mrp_log_error("Failed to decode with %s decoder.", name);
+            break;
+        }
+
+        mrp_msg_unref(decoded);
+    }
+
+    end = now_usecs();
+    mrp_free(buf);
+
+    mrp_log_info("%s: %zd bytes, %.3f usecs per encoding, "
+                 "%.3f usecs per decoding", name, size,
+                 (mid - start) / n, (end - mid) / n);
+}
+
+
+void benchmark_encodings(int n)
+{
+    mrp_msg_t *msg;
+
+    if ((msg = create_resource_like_msg()) == NULL) {
+        mrp_log_error("Failed to create message.");
+        exit(1);
+    }
+
+    benchmark("default", msg, n, mrp_msg_default_encode,
+              mrp_msg_default_decode);
+    benchmark("compact", msg, n, mrp_msg_compact_encode,
+              mrp_msg_compact_decode);
+
+    mrp_msg_unref(msg);
 }
 
 
@@ -589,16 +926,88 @@ static void test_basic(void)
 }
 
 
+static void test_index(void)
+{
+    mrp_msg_t       *msg;
+    mrp_msg_field_t *f;
+    uint32_t         u32;
+    int              i;
+
+    msg = mrp_msg_create_empty();
+
+    for (i = 0; i < 40; i++) {
+        if (!mrp_msg_append(msg, MRP_MSG_TAG_UINT32(i + 1, i))) {
+            mrp_log_error("Failed to append field #%d.", i);
+            exit(1);
+        }
+    }
+
+    for (i = 39; i >= 0; i--) {
+        if ((f = mrp_msg_find(msg, i + 1)) == NULL || f->u32 != (uint32_t)i) {
+            mrp_log_error("Indexed lookup of field #%d failed.", i);
+            exit(1);
+        }
+    }
+
+    /* a repeated tag, then one that shadows an existing field */
+    if (!mrp_msg_append(msg, MRP_MSG_TAG_UINT32(1, 100)) ||
+        !mrp_msg_prepend(msg, MRP_MSG_TAG_UINT32(2, 200)) ||
+        !mrp_msg_set(msg, 3, MRP_MSG_FIELD_UINT32, 300)) {
+        mrp_log_error("Failed to modify indexed message.");
+        exit(1);
+    }
+
+    if ((f = mrp_msg_find(msg, 1)) == NULL || f->u32 != 0   ||
+        (f = mrp_msg_find(msg, 2)) == NULL || f->u32 != 200 ||
+        (f = mrp_msg_find(msg, 3)) == NULL || f->u32 != 300 ||
+        mrp_msg_find(msg, 41) != NULL) {
+        mrp_log_error("Indexed lookup mismatch after modifications.");
+        exit(1);
+    }
+
+    if (!mrp_msg_get(msg, 40, MRP_MSG_FIELD_UINT32, &u32, MRP_MSG_END) ||
+        u32 != 39) {
+        mrp_log_error("Failed to get field from indexed message.");
+        exit(1);
+    }
+
+    for (i = 0; i < 40; i++)
+        mrp_msg_append(msg, MRP_MSG_TAG_UINT32(i + 100, i));
+
+    if ((f = mrp_msg_find(msg, 139)) == NULL || f->u32 != 39) {
+        mrp_log_error("Lookup after reindexing failed.");
+        exit(1);
+    }
+
+    mrp_log_info("Indexed message lookups OK.");
+
+    mrp_msg_unref(msg);
+}
+
+
 int main(int argc, char *argv[])
 {
+    const char *bench;
+
     mrp_log_set_mask(MRP_LOG_UPTO(MRP_LOG_DEBUG));
     mrp_log_set_target(MRP_LOG_TO_STDOUT);
 
     test_basic();
+    test_index();
 
     test_default_encode_decode(argc, argv);
+    test_template();
+    test_encode_iov();
+    test_compact_encode_decode();
     test_custom_encode_decode();
 
+    /*
+     * To compare the encodings, run with MSG_TEST_BENCHMARK set to the
+     * number of rounds, for instance MSG_TEST_BENCHMARK=1000000.
+     */
+    if ((bench = getenv("MSG_TEST_BENCHMARK")) != NULL && atoi(bench) > 0)
+        benchmark_encodings(atoi(bench));
+
     return 0;
 }
 
@@ -1,5 +1,7 @@
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -7,6 +9,7 @@
 #include <murphy/common/macros.h>
 #include <murphy/common/debug.h>
 #include <murphy/common/log.h>
+#include <murphy/common/mm.h>
 #include <murphy/common/native-types.h>
 
 
@@ -63,6 +66,12 @@ typedef struct {
 } family_t;
 
 
+typedef struct {
+    uint32_t  nsample;
+    uint16_t *samples;
+} readings_t;
+
+
 art_t paps_favourites[] = {
     {
         BOOK ,
@@ -202,6 +211,46 @@ person_t tom_dick_and_harry[] = {
 family_t family = { &pap, &mom, &tom_dick_and_harry[0] };
 
 
+uint16_t   samples[512];
+readings_t readings = { MRP_ARRAY_SIZE(samples), samples };
+
+
+static double now_usecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+
+static void benchmark(const char *name, void *data, uint32_t id,
+                      mrp_typemap_t *map, int n)
+{
+    void   *buf;
+    size_t  size;
+    double  start, end;
+    int     i;
+
+    size  = 0;
+    start = now_usecs();
+
+    for (i = 0; i < n; i++) {
+        if (mrp_encode_native(data, id, 4, &buf, &size, map) < 0) {
+            mrp_log_error("Failed to encode %s.", name);
+            return;
+        }
+        mrp_free(buf);
+    }
+
+    end = now_usecs();
+
+    mrp_log_info("%s: %d encodings of %zu bytes, %.3f usecs per encoding",
+                 name, n, size, (end - start) / n);
+}
+
+
 int main(int argc, char *argv[])
 {
     MRP_NATIVE_TYPE(art_type, art_t,
@@ -230,18 +279,21 @@ int main(int argc, char *argv[])
                     MRP_STRUCT(family_t, mother  , DEFAULT, person_t),
                     MRP_ARRAY (family_t, children, DEFAULT, GUARDED,
                                person_t, name, .strp = NULL));
-    mrp_typemap_t map[4];
-
-    uint32_t  art_type_id, person_type_id, family_type_id;
-    void     *ebuf;
-    size_t    esize;
-    int       fd;
-    void     *dbuf;
-    family_t *decoded;
-    char      dump[16 * 1024];
-
-    MRP_UNUSED(argc);
-    MRP_UNUSED(argv);
+    MRP_NATIVE_TYPE(readings_type, readings_t,
+                    MRP_UINT32(readings_t, nsample, DEFAULT),
+                    MRP_ARRAY (readings_t, samples, DEFAULT, SIZED,
+                               uint16_t, nsample));
+    mrp_typemap_t map[5];
+
+    uint32_t    art_type_id, person_type_id, family_type_id;
+    uint32_t    readings_type_id;
+    void       *ebuf;
+    size_t      esize;
+    int         fd, i, n;
+    void       *dbuf;
+    family_t   *decoded;
+    readings_t *rdecoded;
+    char        dump[16 * 1024];
 
     mrp_log_set_mask(MRP_LOG_UPTO(MRP_LOG_INFO));
 
@@ -266,12 +318,20 @@ int main(int argc, char *argv[])
     else
         mrp_log_info("Type family_t sucessfully registered.");
 
+    readings_type_id = mrp_register_native(&readings_type);
+
+    if (readings_type_id == MRP_INVALID_TYPE)
+        mrp_log_error("Failed to register readings_t type.");
+    else
+        mrp_log_info("Type readings_t sucessfully registered.");
+
     ebuf = NULL;
 
-    map[0] = (mrp_typemap_t)MRP_TYPEMAP(1, art_type_id   );
-    map[1] = (mrp_typemap_t)MRP_TYPEMAP(2, person_type_id);
-    map[2] = (mrp_typemap_t)MRP_TYPEMAP(3, family_type_id);
-    map[3] = (mrp_typemap_t)MRP_TYPEMAP_END;
+    map[0] = (mrp_typemap_t)MRP_TYPEMAP(1, art_type_id     );
+    map[1] = (mrp_typemap_t)MRP_TYPEMAP(2, person_type_id  );
+    map[2] = (mrp_typemap_t)MRP_TYPEMAP(3, family_type_id  );
+    map[3] = (mrp_typemap_t)MRP_TYPEMAP(4, readings_type_id);
+    map[4] = (mrp_typemap_t)MRP_TYPEMAP_END;
 
     if (mrp_encode_native(&family, family_type_id, 0, &ebuf, &esize, map) < 0) {
         mrp_log_error("Failed to encode test data.");
@@ -303,5 +363,47 @@ int main(int argc, char *argv[])
 
     mrp_free_native(dbuf, family_type_id);
 
+    for (i = 0; i < (int)MRP_ARRAY_SIZE(samples); i++)
+        samples[i] = i * 129;
+
+    if (mrp_encode_native(&readings, readings_type_id, 0, &ebuf, &esize,
+                          map) < 0) {
+        mrp_log_error("Failed to encode readings.");
+        exit(1);
+    }
+
+    if (mrp_decode_native(&ebuf, &esize, &dbuf, &readings_type_id, map) < 0) {
+        mrp_log_error("Failed to decode readings.");
+        exit(1);
+    }
+
+    rdecoded = dbuf;
+
+    if (rdecoded->nsample != readings.nsample ||
+        memcmp(rdecoded->samples, samples, sizeof(samples)))
+        mrp_log_error("Decoded readings differ from the original.");
+    else
+        mrp_log_info("Readings sucessfully encoded and decoded.");
+
+    mrp_free_native(dbuf, readings_type_id);
+
+    /*
+     * With an iteration count given, time encoding the test data. Before
+     * the TLV buffers grew geometrically, reused a scratch buffer and had
+     * batched array writes this gave (-O2, 100000 iterations):
+     *
+     *     family:   2454 bytes, ~4.0 usecs per encoding
+     *     readings: 1072 bytes, ~4.8 usecs per encoding
+     *
+     * and with them:
+     *
+     *     family:   2454 bytes, ~4.0 usecs per encoding
+     *     readings: 1072 bytes, ~0.55 usecs per encoding
+     */
+    if (argc > 1 && (n = atoi(argv[1])) > 0) {
+        benchmark("family", &family, family_type_id, map, n);
+        benchmark("readings", &readings, readings_type_id, map, n);
+    }
+
     return 0;
 }
@@ -0,0 +1,1132 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <alloca.h>
+#include <time.h>
+#include <endian.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include <murphy/common.h>
+
+/*
+ * A throughput and round-trip latency benchmark for the transports.
+ *
+ * For every combination of transport address, message mode, payload size
+ * and number of concurrent connections we set up an echo server and the
+ * given number of clients in the same process, let every client push a
+ * fixed number of messages through the server keeping at most a window
+ * of them in flight, and report the achieved message rate together with
+ * the median and 99th percentile round-trip times.
+ */
+
+#define TAG_SEQ    ((uint16_t)0x1)
+#define TAG_DATA   ((uint16_t)0x2)
+#define TAG_BENCH  ((uint16_t)0x1)
+
+#define MAX_CONN   256                   /* max. concurrent connections */
+
+typedef enum {
+    MODE_MSG = 0,                        /* mrp_transport_send */
+    MODE_RAW,                            /* mrp_transport_sendraw */
+    MODE_DATA,                           /* mrp_transport_senddata */
+    MODE_NATIVE,                         /* mrp_transport_sendnative */
+    MODE_JSON,                           /* mrp_transport_sendjson */
+    MODE_MAX
+} bench_mode_t;
+
+static const char *mode_names[MODE_MAX] = {
+    [MODE_MSG]    = "msg",
+    [MODE_RAW]    = "raw",
+    [MODE_DATA]   = "data",
+    [MODE_NATIVE] = "native",
+    [MODE_JSON]   = "json",
+};
+
+static const int mode_flags[MODE_MAX] = {
+    [MODE_MSG]    = MRP_TRANSPORT_MODE_MSG,
+    [MODE_RAW]    = MRP_TRANSPORT_MODE_RAW,
+    [MODE_DATA]   = MRP_TRANSPORT_MODE_DATA,
+    [MODE_NATIVE] = MRP_TRANSPORT_MODE_NATIVE,
+    [MODE_JSON]   = MRP_TRANSPORT_MODE_JSON,
+};
+
+typedef struct {
+    uint32_t  seq;
+    char     *data;
+} payload_t;
+
+MRP_DATA_DESCRIPTOR(payload_descr, TAG_BENCH, payload_t,
+                    MRP_DATA_MEMBER(payload_t,  seq, MRP_MSG_FIELD_UINT32),
+                    MRP_DATA_MEMBER(payload_t, data, MRP_MSG_FIELD_STRING));
+
+static uint32_t native_id;
+
+typedef struct bench_s bench_t;
+
+typedef struct {
+    bench_t         *b;                  /* benchmark we belong to */
+    mrp_transport_t *t;                  /* client transport */
+    uint32_t         sent;               /* messages sent */
+    uint32_t         rcvd;               /* replies received */
+    uint64_t        *stamps;             /* send times by sequence number */
+} conn_t;
+
+struct bench_s {
+    mrp_mainloop_t  *ml;                 /* mainloop */
+    char           **addrs;              /* addresses to benchmark */
+    int              naddr;
+    int              own_addrs;          /* addrs allocated by us */
+    int              modes;              /* mask of modes to benchmark */
+    int             *sizes;              /* payload sizes to benchmark */
+    int              nsize;
+    int             *conns;              /* connection counts to benchmark */
+    int              nconns;
+    int              count;              /* messages per connection */
+    int              window;             /* max. messages in flight */
+    int              timeout;            /* run timeout in seconds */
+    int              log_mask;
+    const char      *log_target;
+
+    int              ai, mi, si, ci;     /* current combination */
+    const char      *addrstr;            /* current address */
+    mrp_sockaddr_t   addr;
+    socklen_t        alen;
+    const char      *atype;
+    int              framed;             /* raw needs explicit length */
+    int              mode;               /* current mode */
+    int              size;               /* current payload size */
+    int              nconn;              /* current number of connections */
+
+    char            *payload;            /* payload of current size */
+    mrp_transport_t *lt;                 /* server transport */
+    mrp_transport_t *srv[MAX_CONN];      /* accepted connections */
+    conn_t          *clients;            /* client connections */
+    int              ndone;              /* finished clients */
+    uint64_t        *rtt;                /* round-trip times */
+    size_t           nrtt;
+    uint64_t         start;              /* start of current run */
+    int              running;            /* a run has been started */
+    int              failed;             /* current run failed */
+    int              unsupported;        /* mode not supported */
+    mrp_timer_t     *timer;              /* timeout/next run timer */
+};
+
+
+static uint64_t time_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+
+static void run_next(mrp_timer_t *t, void *user_data);
+
+
+/*
+ * server side: echo everything back the way it came in
+ */
+
+static int send_raw(bench_t *b, mrp_transport_t *t, void *data, size_t size,
+                    mrp_sockaddr_t *addr, socklen_t alen)
+{
+    uint32_t *buf;
+
+    /*
+     * Stream and datagram transports expect incoming data to be prefixed
+     * with its length even in raw mode, so we need to supply it ourselves.
+     */
+
+    if (b->framed) {
+        buf = alloca(sizeof(*buf) + size);
+        *buf = htobe32(size);
+        memcpy(buf + 1, data, size);
+        data  = buf;
+        size += sizeof(*buf);
+    }
+
+    if (addr != NULL)
+        return mrp_transport_sendrawto(t, data, size, addr, alen);
+    else
+        return mrp_transport_sendraw(t, data, size);
+}
+
+
+static void srv_msgfrom(mrp_transport_t *t, mrp_msg_t *msg,
+                        mrp_sockaddr_t *addr, socklen_t alen, void *user_data)
+{
+    MRP_UNUSED(user_data);
+
+    if (addr != NULL)
+        mrp_transport_sendto(t, msg, addr, alen);
+    else
+        mrp_transport_send(t, msg);
+}
+
+
+static void srv_msg(mrp_transport_t *t, mrp_msg_t *msg, void *user_data)
+{
+    srv_msgfrom(t, msg, NULL, 0, user_data);
+}
+
+
+static void srv_rawfrom(mrp_transport_t *t, void *data, size_t size,
+                        mrp_sockaddr_t *addr, socklen_t alen, void *user_data)
+{
+    send_raw((bench_t *)user_data, t, data, size, addr, alen);
+}
+
+
+static void srv_raw(mrp_transport_t *t, void *data, size_t size,
+                    void *user_data)
+{
+    srv_rawfrom(t, data, size, NULL, 0, user_data);
+}
+
+
+static void srv_datafrom(mrp_transport_t *t, void *data, uint16_t tag,
+                         mrp_sockaddr_t *addr, socklen_t alen, void *user_data)
+{
+    MRP_UNUSED(user_data);
+
+    if (addr != NULL)
+        mrp_transport_senddatato(t, data, tag, addr, alen);
+    else
+        mrp_transport_senddata(t, data, tag);
+
+    mrp_data_free(data, tag);
+}
+
+
+static void srv_data(mrp_transport_t *t, void *data, uint16_t tag,
+                     void *user_data)
+{
+    srv_datafrom(t, data, tag, NULL, 0, user_data);
+}
+
+
+static void srv_nativefrom(mrp_transport_t *t, void *data, uint32_t type_id,
+                           mrp_sockaddr_t *addr, socklen_t alen,
+                           void *user_data)
+{
+    MRP_UNUSED(user_data);
+
+    if (addr != NULL)
+        mrp_transport_sendnativeto(t, data, type_id, addr, alen);
+    else
+        mrp_transport_sendnative(t, data, type_id);
+
+    mrp_free_native(data, type_id);
+}
+
+
+static void srv_native(mrp_transport_t *t, void *data, uint32_t type_id,
+                       void *user_data)
+{
+    srv_nativefrom(t, data, type_id, NULL, 0, user_data);
+}
+
+
+static void srv_jsonfrom(mrp_transport_t *t, mrp_json_t *msg,
+                         mrp_sockaddr_t *addr, socklen_t alen, void *user_data)
+{
+    MRP_UNUSED(user_data);
+
+    if (addr != NULL)
+        mrp_transport_sendjsonto(t, msg, addr, alen);
+    else
+        mrp_transport_sendjson(t, msg);
+}
+
+
+static void srv_json(mrp_transport_t *t, mrp_json_t *msg, void *user_data)
+{
+    srv_jsonfrom(t, msg, NULL, 0, user_data);
+}
+
+
+static void srv_closed(mrp_transport_t *t, int error, void *user_data)
+{
+    bench_t *b = (bench_t *)user_data;
+    int      i;
+
+    MRP_UNUSED(error);
+
+    /* datagram servers get closed events for unreachable peers */
+    if (t == b->lt)
+        return;
+
+    for (i = 0; i < MAX_CONN; i++) {
+        if (b->srv[i] == t) {
+            b->srv[i] = NULL;
+            break;
+        }
+    }
+
+    mrp_transport_destroy(t);
+}
+
+
+static void srv_connection(mrp_transport_t *lt, void *user_data)
+{
+    bench_t         *b = (bench_t *)user_data;
+    mrp_transport_t *t;
+    int              i;
+
+    t = mrp_transport_accept(lt, b, MRP_TRANSPORT_NONBLOCK);
+
+    /* we're called until there are no more pending connections */
+    if (t == NULL)
+        return;
+
+    for (i = 0; i < MAX_CONN; i++) {
+        if (b->srv[i] == NULL) {
+            b->srv[i] = t;
+            return;
+        }
+    }
+
+    mrp_transport_destroy(t);
+}
+
+
+static int mode_supported(mrp_transport_t *t, int mode)
+{
+    switch (mode) {
+    case MODE_MSG:    return t->descr->req.sendmsg    != NULL;
+    case MODE_RAW:    return t->descr->req.sendraw    != NULL;
+    case MODE_DATA:   return t->descr->req.senddata   != NULL;
+    case MODE_NATIVE: return t->descr->req.sendnative != NULL;
+    case MODE_JSON:   return t->descr->req.sendjson   != NULL;
+    default:          return FALSE;
+    }
+}
+
+
+static int server_init(bench_t *b)
+{
+    static mrp_transport_evt_t evt[MODE_MAX] = {
+        [MODE_MSG] = {
+            { .recvmsg = srv_msg },
+            { .recvmsgfrom = srv_msgfrom },
+            .closed = srv_closed, .connection = srv_connection,
+        },
+        [MODE_RAW] = {
+            { .recvraw = srv_raw },
+            { .recvrawfrom = srv_rawfrom },
+            .closed = srv_closed, .connection = srv_connection,
+        },
+        [MODE_DATA] = {
+            { .recvdata = srv_data },
+            { .recvdatafrom = srv_datafrom },
+            .closed = srv_closed, .connection = srv_connection,
+        },
+        [MODE_NATIVE] = {
+            { .recvnative = srv_native },
+            { .recvnativefrom = srv_nativefrom },
+            .closed = srv_closed, .connection = srv_connection,
+        },
+        [MODE_JSON] = {
+            { .recvjson = srv_json },
+            { .recvjsonfrom = srv_jsonfrom },
+            .closed = srv_closed, .connection = srv_connection,
+        },
+    };
+
+    int flags = MRP_TRANSPORT_REUSEADDR | mode_flags[b->mode];
+
+    b->lt = mrp_transport_create(b->ml, b->atype, evt + b->mode, b, flags);
+
+    if (b->lt == NULL) {
+        mrp_log_error("Failed to create %s server transport.", b->atype);
+        return FALSE;
+    }
+
+    if (!mode_supported(b->lt, b->mode)) {
+        b->unsupported = TRUE;
+        return FALSE;
+    }
+
+    if (!mrp_transport_bind(b->lt, &b->addr, b->alen)) {
+        mrp_log_error("Failed to bind server to %s.", b->addrstr);
+        return FALSE;
+    }
+
+    if (!mrp_transport_listen(b->lt, 0))
+        mrp_debug("%s transport does not listen, assuming datagrams", b->atype);
+
+    return TRUE;
+}
+
+
+/*
+ * client side
+ */
+
+static int send_next(conn_t *c);
+
+
+static void client_reply(conn_t *c, uint32_t seq)
+{
+    bench_t *b = c->b;
+
+    if (seq >= (uint32_t)b->count || c->stamps[seq] == 0) {
+        mrp_log_error("Unexpected reply #%u.", seq);
+        b->failed = TRUE;
+        return;
+    }
+
+    b->rtt[b->nrtt++] = time_now() - c->stamps[seq];
+    c->stamps[seq]    = 0;
+
+    if (++c->rcvd == (uint32_t)b->count) {
+        if (++b->ndone == b->nconn)
+            mrp_mod_timer(b->timer, 0);
+        return;
+    }
+
+    if (c->sent < (uint32_t)b->count && !send_next(c))
+        b->failed = TRUE;
+}
+
+
+static void cli_msg(mrp_transport_t *t, mrp_msg_t *msg, void *user_data)
+{
+    mrp_msg_field_t *f   = mrp_msg_find(msg, TAG_SEQ);
+    uint32_t         seq = (uint32_t)-1;
+
+    MRP_UNUSED(t);
+
+    if (f != NULL && f->type == MRP_MSG_FIELD_UINT32)
+        seq = f->u32;
+
+    client_reply(user_data, seq);
+}
+
+
+static void cli_msgfrom(mrp_transport_t *t, mrp_msg_t *msg,
+                        mrp_sockaddr_t *addr, socklen_t alen, void *user_data)
+{
+    MRP_UNUSED(addr);
+    MRP_UNUSED(alen);
+
+    cli_msg(t, msg, user_data);
+}
+
+
+static void cli_raw(mrp_transport_t *t, void *data, size_t size,
+                    void *user_data)
+{
+    uint32_t seq;
+
+    MRP_UNUSED(t);
+
+    if (size < sizeof(seq))
+        seq = -1;
+    else {
+        memcpy(&seq, data, sizeof(seq));
+        seq = be32toh(seq);
+    }
+
+    client_reply(user_data, seq);
+}
+
+
+static void cli_rawfrom(mrp_transport_t *t, void *data, size_t size,
+                        mrp_sockaddr_t *addr, socklen_t alen, void *user_data)
+{
+    MRP_UNUSED(addr);
+    MRP_UNUSED(alen);
+
+    cli_raw(t, data, size, user_data);
+}
+
+
+static void cli_data(mrp_transport_t *t, void *data, uint16_t tag,
+                     void *user_data)
+{
+    uint32_t seq = ((payload_t *)data)->seq;
+
+    MRP_UNUSED(t);
+
+    mrp_data_free(data, tag);
+    client_reply(user_data, seq);
+}
+
+
+static void cli_datafrom(mrp_transport_t *t, void *data, uint16_t tag,
+                         mrp_sockaddr_t *addr, socklen_t alen, void *user_data)
+{
+    MRP_UNUSED(addr);
+    MRP_UNUSED(alen);
+
+    cli_data(t, data, tag, user_data);
+}
+
+
+static void cli_native(mrp_transport_t *t, void *data, uint32_t type_id,
+                       void *user_data)
+{
+    uint32_t seq = ((payload_t *)data)->seq;
+
+    MRP_UNUSED(t);
+
+    mrp_free_native(data, type_id);
+    client_reply(user_data, seq);
+}
+
+
+static void cli_nativefrom(mrp_transport_t *t, void *data, uint32_t type_id,
+                           mrp_sockaddr_t *addr, socklen_t alen,
+                           void *user_data)
+{
+    MRP_UNUSED(addr);
+    MRP_UNUSED(alen);
+
+    cli_native(t, data, type_id, user_data);
+}
+
+
+static void cli_json(mrp_transport_t *t, mrp_json_t *msg, void *user_data)
+{
+    int seq;
+
+    MRP_UNUSED(t);
+
+    if (!mrp_json_get_integer(msg, "seq", &seq))
+        seq = -1;
+
+    client_reply(user_data, (uint32_t)seq);
+}
+
+
+static void cli_jsonfrom(mrp_transport_t *t, mrp_json_t *msg,
+                         mrp_sockaddr_t *addr, socklen_t alen, void *user_data)
+{
+    MRP_UNUSED(addr);
+    MRP_UNUSED(alen);
+
+    cli_json(t, msg, user_data);
+}
+
+
+static void cli_closed(mrp_transport_t *t, int error, void *user_data)
+{
+    conn_t *c = (conn_t *)user_data;
+
+    mrp_log_error("Client connection closed (%d: %s).", error,
+                  strerror(error));
+
+    mrp_transport_destroy(t);
+    c->t         = NULL;
+    c->b->failed = TRUE;
+    mrp_mod_timer(c->b->timer, 0);
+}
+
+
+static int send_next(conn_t *c)
+{
+    bench_t    *b   = c->b;
+    uint32_t    seq = c->sent;
+    mrp_msg_t  *msg;
+    mrp_json_t *json;
+    payload_t   data;
+    char       *raw;
+    int         success;
+
+    c->stamps[seq] = time_now();
+
+    switch (b->mode) {
+    case MODE_MSG:
+        msg = mrp_msg_create(TAG_SEQ , MRP_MSG_FIELD_UINT32, seq,
+                             TAG_DATA, MRP_MSG_FIELD_STRING, b->payload,
+                             MRP_MSG_FIELD_END);
+        if (msg == NULL)
+            return FALSE;
+        success = mrp_transport_send(c->t, msg);
+        mrp_msg_unref(msg);
+        break;
+
+    case MODE_RAW:
+        raw = alloca(sizeof(seq) + b->size);
+        seq = htobe32(seq);
+        memcpy(raw, &seq, sizeof(seq));
+        memcpy(raw + sizeof(seq), b->payload, b->size);
+        success = send_raw(b, c->t, raw, sizeof(seq) + b->size, NULL, 0);
+        break;
+
+    case MODE_DATA:
+        data.seq  = seq;
+        data.data = b->payload;
+        success   = mrp_transport_senddata(c->t, &data, TAG_BENCH);
+        break;
+
+    case MODE_NATIVE:
+        data.seq  = seq;
+        data.data = b->payload;
+        success   = mrp_transport_sendnative(c->t, &data, native_id);
+        break;
+
+    case MODE_JSON:
+        if ((json = mrp_json_create(MRP_JSON_OBJECT)) == NULL)
+            return FALSE;
+        mrp_json_add_integer(json, "seq", (int)seq);
+        mrp_json_add_string(json, "data", b->payload);
+        success = mrp_transport_sendjson(c->t, json);
+        mrp_json_unref(json);
+        break;
+
+    default:
+        success = FALSE;
+    }
+
+    if (success)
+        c->sent++;
+
+    return success;
+}
+
+
+static int client_init(bench_t *b, conn_t *c)
+{
+    static mrp_transport_evt_t evt[MODE_MAX] = {
+        [MODE_MSG] = {
+            { .recvmsg = cli_msg },
+            { .recvmsgfrom = cli_msgfrom },
+            .closed = cli_closed, .connection = NULL,
+        },
+        [MODE_RAW] = {
+            { .recvraw = cli_raw },
+            { .recvrawfrom = cli_rawfrom },
+            .closed = cli_closed, .connection = NULL,
+        },
+        [MODE_DATA] = {
+            { .recvdata = cli_data },
+            { .recvdatafrom = cli_datafrom },
+            .closed = cli_closed, .connection = NULL,
+        },
+        [MODE_NATIVE] = {
+            { .recvnative = cli_native },
+            { .recvnativefrom = cli_nativefrom },
+            .closed = cli_closed, .connection = NULL,
+        },
+        [MODE_JSON] = {
+            { .recvjson = cli_json },
+            { .recvjsonfrom = cli_jsonfrom },
+            .closed = cli_closed, .connection = NULL,
+        },
+    };
+
+    char           name[64];
+    mrp_sockaddr_t addr;
+    socklen_t      alen;
+
+    c->b      = b;
+    c->stamps = mrp_allocz_array(uint64_t, b->count);
+    c->t      = mrp_transport_create(b->ml, b->atype, evt + b->mode, c,
+                                     mode_flags[b->mode]);
+
+    if (c->stamps == NULL || c->t == NULL)
+        return FALSE;
+
+    /* unix datagram clients need an address of their own to get replies */
+    if (!strcmp(b->atype, "unxd")) {
+        snprintf(name, sizeof(name), "unxd:@transport-bench-%u-%zd",
+                 getpid(), c - b->clients);
+        alen = mrp_transport_resolve(NULL, name, &addr, sizeof(addr), NULL);
+
+        if (alen <= 0 || !mrp_transport_bind(c->t, &addr, alen))
+            return FALSE;
+    }
+
+    return mrp_transport_connect(c->t, &b->addr, b->alen);
+}
+
+
+/*
+ * benchmark runs
+ */
+
+static int cmp_rtt(const void *a, const void *b)
+{
+    uint64_t ra = *(const uint64_t *)a, rb = *(const uint64_t *)b;
+
+    return ra < rb ? -1 : (ra > rb ? 1 : 0);
+}
+
+
+static void run_report(bench_t *b)
+{
+    uint64_t elapsed = time_now() - b->start;
+
+    printf("%-28s %-6s %7d %5d ", b->addrstr, mode_names[b->mode],
+           b->size, b->nconn);
+
+    if (b->failed || b->ndone < b->nconn || b->nrtt == 0) {
+        printf("%10s %9s %9s\n", b->unsupported ? "n/a" :
+               b->failed ? "failed" : "timeout", "-", "-");
+        fflush(stdout);
+        return;
+    }
+
+    qsort(b->rtt, b->nrtt, sizeof(b->rtt[0]), cmp_rtt);
+
+    printf("%10.0f %9llu %9llu\n", b->nrtt * 1000000.0 / elapsed,
+           (unsigned long long)b->rtt[b->nrtt / 2],
+           (unsigned long long)b->rtt[(b->nrtt * 99) / 100]);
+    fflush(stdout);
+}
+
+
+static void run_cleanup(bench_t *b)
+{
+    int i;
+
+    for (i = 0; i < b->nconn && b->clients != NULL; i++) {
+        if (b->clients[i].t != NULL) {
+            mrp_transport_disconnect(b->clients[i].t);
+            mrp_transport_destroy(b->clients[i].t);
+        }
+        mrp_free(b->clients[i].stamps);
+    }
+
+    for (i = 0; i < MAX_CONN; i++) {
+        if (b->srv[i] != NULL) {
+            mrp_transport_disconnect(b->srv[i]);
+            mrp_transport_destroy(b->srv[i]);
+            b->srv[i] = NULL;
+        }
+    }
+
+    mrp_transport_destroy(b->lt);
+    mrp_free(b->clients);
+    mrp_free(b->rtt);
+    mrp_free(b->payload);
+
+    b->running = FALSE;
+    b->lt      = NULL;
+    b->clients = NULL;
+    b->rtt     = NULL;
+    b->payload = NULL;
+}
+
+
+static int run_start(bench_t *b)
+{
+    int i, j;
+
+    b->addrstr = b->addrs[b->ai];
+    b->mode    = b->mi;
+    b->size    = b->sizes[b->si];
+    b->nconn   = b->conns[b->ci];
+    b->ndone   = 0;
+    b->nrtt    = 0;
+    b->failed  = FALSE;
+    b->running = TRUE;
+
+    b->unsupported = FALSE;
+
+    b->alen = mrp_transport_resolve(NULL, b->addrstr, &b->addr,
+                                    sizeof(b->addr), &b->atype);
+
+    if (b->alen <= 0) {
+        mrp_log_error("Failed to resolve address '%s'.", b->addrstr);
+        return FALSE;
+    }
+
+    b->framed = (!strcmp(b->atype, "tcp4") || !strcmp(b->atype, "tcp6") ||
+                 !strcmp(b->atype, "unxs") || !strcmp(b->atype, "udp4") ||
+                 !strcmp(b->atype, "udp6") || !strcmp(b->atype, "unxd"));
+
+    b->payload = mrp_allocz(b->size + 1);
+    b->clients = mrp_allocz_array(conn_t, b->nconn);
+    b->rtt     = mrp_allocz_array(uint64_t, (size_t)b->nconn * b->count);
+
+    if (b->payload == NULL || b->clients == NULL || b->rtt == NULL)
+        return FALSE;
+
+    memset(b->payload, 'x', b->size);
+
+    if (!server_init(b))
+        return FALSE;
+
+    for (i = 0; i < b->nconn; i++)
+        if (!client_init(b, b->clients + i))
+            return FALSE;
+
+    b->start = time_now();
+
+    for (i = 0; i < b->nconn; i++)
+        for (j = 0; j < b->window && j < b->count; j++)
+            if (!send_next(b->clients + i))
+                return FALSE;
+
+    return TRUE;
+}
+
+
+static int run_advance(bench_t *b)
+{
+    do {
+        if (++b->ci < b->nconns)
+            break;
+        b->ci = 0;
+        if (++b->si < b->nsize)
+            break;
+        b->si = 0;
+        while (++b->mi < MODE_MAX && !(b->modes & (1 << b->mi)))
+            ;
+        if (b->mi < MODE_MAX)
+            break;
+        b->mi = 0;
+        while (!(b->modes & (1 << b->mi)))
+            b->mi++;
+        if (++b->ai < b->naddr)
+            break;
+        return FALSE;
+    } while (0);
+
+    return TRUE;
+}
+
+
+static void run_next(mrp_timer_t *t, void *user_data)
+{
+    bench_t *b = (bench_t *)user_data;
+
+    if (b->running) {
+        run_report(b);
+        run_cleanup(b);
+
+        if (!run_advance(b)) {
+            mrp_mainloop_quit(b->ml, 0);
+            return;
+        }
+    }
+
+    if (!run_start(b))
+        b->failed = TRUE;
+
+    mrp_mod_timer(t, b->failed ? 0 : b->timeout * 1000);
+}
+
+
+/*
+ * command line processing
+ */
+
+static int parse_list(const char *str, int **listp)
+{
+    const char *p;
+    char       *end;
+    int        *list, n;
+
+    for (n = 1, p = str; *p; p++)
+        if (*p == ',')
+            n++;
+
+    if ((list = mrp_allocz_array(int, n)) == NULL)
+        return -1;
+
+    for (n = 0, p = str; *p; p = *end ? end + 1 : end) {
+        list[n] = (int)strtol(p, &end, 10);
+
+        if ((*end && *end != ',') || list[n] <= 0) {
+            mrp_free(list);
+            return -1;
+        }
+
+        n++;
+    }
+
+    mrp_free(*listp);
+    *listp = list;
+
+    return n;
+}
+
+
+static int parse_modes(const char *str)
+{
+    const char *p, *e;
+    int         mask, m;
+    size_t      l;
+
+    for (mask = 0, p = str; *p; p = *e ? e + 1 : e) {
+        if ((e = strchr(p, ',')) == NULL)
+            e = p + strlen(p);
+        l = e - p;
+
+        for (m = 0; m < MODE_MAX; m++)
+            if (strlen(mode_names[m]) == l && !strncmp(p, mode_names[m], l))
+                break;
+
+        if (m == MODE_MAX)
+            return -1;
+
+        mask |= 1 << m;
+    }
+
+    return mask;
+}
+
+
+static void print_usage(const char *argv0, int exit_code, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (fmt && *fmt) {
+        va_start(ap, fmt);
+        vprintf(fmt, ap);
+        va_end(ap);
+        printf("\n");
+    }
+
+    printf("usage: %s [options]\n\n"
+           "The possible options are:\n"
+           "  -a, --address <address>        transport address to benchmark\n"
+           "      Can be given multiple times. The default is to benchmark\n"
+           "      unxs, tcp4, udp4 and internal transports.\n"
+           "  -m, --modes <list>             modes to benchmark, a comma\n"
+           "      separated list of msg, raw, data, native and json\n"
+           "  -s, --sizes <list>             payload sizes to benchmark\n"
+           "  -c, --connections <list>       concurrent connections to use\n"
+           "  -n, --count <n>                messages to send per connection\n"
+           "  -w, --window <n>               messages in flight per connection\n"
+           "  -T, --timeout <secs>           timeout for a single run\n"
+           "  -t, --log-target=TARGET        log target to use\n"
+           "      TARGET is one of stderr,stdout,syslog, or a logfile path\n"
+           "  -l, --log-level=LEVELS         logging level to use\n"
+           "      LEVELS is a comma separated list of info, error and warning\n"
+           "  -v, --verbose                  increase logging verbosity\n"
+           "  -d, --debug                    enable debug messages\n"
+           "  -h, --help                     show help on usage\n",
+           argv0);
+
+    if (exit_code < 0)
+        return;
+    else
+        exit(exit_code);
+}
+
+
+static void config_set_defaults(bench_t *b)
+{
+    static char *addrs[] = {
+        "unxs:@transport-bench",
+        "tcp4:127.0.0.1:3000",
+        "udp4:127.0.0.1:3000",
+        "internal:transport-bench",
+    };
+
+    mrp_clear(b);
+    b->addrs      = addrs;
+    b->naddr      = MRP_ARRAY_SIZE(addrs);
+    b->modes      = (1 << MODE_MAX) - 1;
+    b->count      = 10000;
+    b->window     = 8;
+    b->timeout    = 30;
+    b->log_mask   = MRP_LOG_UPTO(MRP_LOG_WARNING);
+    b->log_target = MRP_LOG_TO_STDERR;
+
+    parse_list("16,1024,16384", &b->sizes);
+    b->nsize  = 3;
+    parse_list("1,8", &b->conns);
+    b->nconns = 2;
+}
+
+
+static void parse_cmdline(bench_t *b, int argc, char **argv)
+{
+#   define OPTIONS "a:m:s:c:n:w:T:l:t:vd:h"
+    struct option options[] = {
+        { "address"    , required_argument, NULL, 'a' },
+        { "modes"      , required_argument, NULL, 'm' },
+        { "sizes"      , required_argument, NULL, 's' },
+        { "connections", required_argument, NULL, 'c' },
+        { "count"      , required_argument, NULL, 'n' },
+        { "window"     , required_argument, NULL, 'w' },
+        { "timeout"    , required_argument, NULL, 'T' },
+        { "log-level"  , required_argument, NULL, 'l' },
+        { "log-target" , required_argument, NULL, 't' },
+        { "verbose"    , no_argument      , NULL, 'v' },
+        { "debug"      , required_argument, NULL, 'd' },
+        { "help"       , no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt, naddr = 0, i;
+
+    config_set_defaults(b);
+
+    while ((opt = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+        switch (opt) {
+        case 'a':
+            if (naddr == 0) {
+                b->addrs     = mrp_allocz_array(char *, argc);
+                b->own_addrs = TRUE;
+            }
+            b->addrs[naddr++] = optarg;
+            b->naddr = naddr;
+            break;
+
+        case 'm':
+            if ((b->modes = parse_modes(optarg)) <= 0)
+                print_usage(argv[0], EINVAL, "invalid modes '%s'", optarg);
+            break;
+
+        case 's':
+            if ((b->nsize = parse_list(optarg, &b->sizes)) <= 0)
+                print_usage(argv[0], EINVAL, "invalid sizes '%s'", optarg);
+            break;
+
+        case 'c':
+            if ((b->nconns = parse_list(optarg, &b->conns)) <= 0)
+                print_usage(argv[0], EINVAL, "invalid connections '%s'",
+                            optarg);
+            for (i = 0; i < b->nconns; i++)
+                if (b->conns[i] > MAX_CONN)
+                    print_usage(argv[0], EINVAL, "at most %d connections",
+                                MAX_CONN);
+            break;
+
+        case 'n':
+            if ((b->count = atoi(optarg)) <= 0)
+                print_usage(argv[0], EINVAL, "invalid count '%s'", optarg);
+            break;
+
+        case 'w':
+            if ((b->window = atoi(optarg)) <= 0)
+                print_usage(argv[0], EINVAL, "invalid window '%s'", optarg);
+            break;
+
+        case 'T':
+            if ((b->timeout = atoi(optarg)) <= 0)
+                print_usage(argv[0], EINVAL, "invalid timeout '%s'", optarg);
+            break;
+
+        case 'v':
+            b->log_mask <<= 1;
+            b->log_mask  |= 1;
+            break;
+
+        case 'l':
+            b->log_mask = mrp_log_parse_levels(optarg);
+            if (b->log_mask < 0)
+                print_usage(argv[0], EINVAL, "invalid log level '%s'", optarg);
+            break;
+
+        case 't':
+            b->log_target = mrp_log_parse_target(optarg);
+            if (!b->log_target)
+                print_usage(argv[0], EINVAL, "invalid log target '%s'", optarg);
+            break;
+
+        case 'd':
+            b->log_mask |= MRP_LOG_MASK_DEBUG;
+            mrp_debug_set_config(optarg);
+            mrp_debug_enable(TRUE);
+            break;
+
+        case 'h':
+            print_usage(argv[0], 0, "");
+            break;
+
+        default:
+            print_usage(argv[0], EINVAL, "invalid option '%c'", opt);
+        }
+    }
+}
+
+
+static void register_types(void)
+{
+    MRP_NATIVE_TYPE(native_type, payload_t,
+                    MRP_UINT32(payload_t, seq , DEFAULT),
+                    MRP_STRING(payload_t, data, DEFAULT));
+
+    if (!mrp_msg_register_type(&payload_descr)) {
+        mrp_log_error("Failed to register data type.");
+        exit(1);
+    }
+
+    if ((native_id = mrp_register_native(&native_type)) == MRP_INVALID_TYPE) {
+        mrp_log_error("Failed to register native type.");
+        exit(1);
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    bench_t b;
+
+    parse_cmdline(&b, argc, argv);
+
+    mrp_log_set_mask(b.log_mask);
+    mrp_log_set_target(b.log_target);
+
+    register_types();
+
+    while (!(b.modes & (1 << b.mi)))
+        b.mi++;
+
+    if ((b.ml = mrp_mainloop_create()) == NULL) {
+        mrp_log_error("Failed to create mainloop.");
+        exit(1);
+    }
+
+    if ((b.timer = mrp_add_timer(b.ml, 0, run_next, &b)) == NULL) {
+        mrp_log_error("Failed to create benchmark timer.");
+        exit(1);
+    }
+
+    printf("%-28s %-6s %7s %5s %10s %9s %9s\n", "address", "mode", "size",
+           "conns", "msgs/s", "p50 (us)", "p99 (us)");
+
+    mrp_mainloop_run(b.ml);
+
+    mrp_del_timer(b.timer);
+    mrp_mainloop_destroy(b.ml);
+
+    if (b.own_addrs)
+        mrp_free(b.addrs);
+    mrp_free(b.sizes);
+    mrp_free(b.conns);
+
+    return 0;
+}
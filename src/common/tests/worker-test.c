@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
+#include <murphy/common/mainloop.h>
+#include <murphy/common/worker.h>
+
+#define NJOB 1000
+
+static mrp_mainloop_t *ml;
+static int             ndone;
+static int             ncancelled;
+static int             nfailed;
+
+
+static int run_job(void *user_data)
+{
+    long  i = (long)user_data;
+    char *buf;
+
+    /* allocate in the worker to exercise the allocator from threads */
+    if ((buf = mrp_allocz(64 + i)) == NULL)
+        return -ENOMEM;
+
+    snprintf(buf, 64, "job #%ld", i);
+    mrp_free(buf);
+
+    return (int)(i % 128);
+}
+
+
+static void job_done(mrp_worker_pool_t *pool, uint32_t id, int status,
+                     void *user_data)
+{
+    long i = (long)user_data;
+
+    MRP_UNUSED(pool);
+    MRP_UNUSED(id);
+
+    if (status == -ECANCELED)
+        ncancelled++;
+    else if (status != (int)(i % 128)) {
+        printf("job #%ld: unexpected status %d\n", i, status);
+        nfailed++;
+    }
+
+    if (++ndone == NJOB)
+        mrp_mainloop_quit(ml, 0);
+}
+
+
+int main(int argc, char *argv[])
+{
+    mrp_worker_pool_t *pool;
+    uint32_t           last;
+    long               i;
+    int                nthread;
+
+    nthread = argc > 1 ? (int)strtol(argv[1], NULL, 10) : 4;
+
+    if ((ml = mrp_mainloop_create()) == NULL) {
+        printf("failed to create mainloop\n");
+        exit(1);
+    }
+
+    if ((pool = mrp_worker_pool_create(ml, nthread)) == NULL) {
+        printf("failed to create worker pool\n");
+        exit(1);
+    }
+
+    for (i = 0, last = MRP_WORKER_JOB_INVALID; i < NJOB; i++) {
+        last = mrp_worker_submit(pool, run_job, job_done, (void *)i);
+
+        if (last == MRP_WORKER_JOB_INVALID) {
+            printf("failed to submit job #%ld\n", i);
+            exit(1);
+        }
+    }
+
+    if (mrp_worker_cancel(pool, last))
+        ndone++;
+
+    mrp_mainloop_run(ml);
+
+    printf("%d jobs completed, %d cancelled, %d failed\n", ndone,
+           ncancelled, nfailed);
+
+    ndone = 0;
+    for (i = 0; i < NJOB / 10; i++)
+        mrp_worker_submit(pool, run_job, job_done, (void *)i);
+
+    if (mrp_worker_pool_wait(pool) < 0 || ndone != NJOB / 10) {
+        printf("%d jobs not completed by wait\n", NJOB / 10 - ndone);
+        nfailed++;
+    }
+
+    ndone = 0;
+    for (i = 0; i < NJOB / 10; i++)
+        mrp_worker_submit(pool, run_job, job_done, (void *)i);
+
+    mrp_worker_pool_destroy(pool);
+
+    if (ndone != NJOB / 10) {
+        printf("%d jobs not completed by destroy\n", NJOB / 10 - ndone);
+        nfailed++;
+    }
+
+    mrp_mainloop_destroy(ml);
+
+    return nfailed ? 1 : 0;
+}
@@ -28,6 +28,7 @@
  */
 
 #include <errno.h>
+#include <pthread.h>
 
 #include <murphy/common/macros.h>
 #include <murphy/common/debug.h>
@@ -35,8 +36,23 @@
 #include <murphy/common/mm.h>
 #include <murphy/common/tlv.h>
 
-#define TLV_MIN_PREALLOC 4096
-#define TLV_MIN_CHUNK      64
+#define TLV_MIN_PREALLOC  4096
+#define TLV_MIN_CHUNK       64
+#define TLV_SCRATCH_MAX   (64 * 1024)
+
+/*
+ * Every thread has a scratch buffer for encoding messages which are only
+ * needed until they have been copied or sent. The buffer is kept for the
+ * next encoding unless it has grown above TLV_SCRATCH_MAX. If the scratch
+ * buffer is already in use (a nested encoding), a plain buffer is used.
+ */
+
+static pthread_once_t  scratch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t   scratch_key;
+static __thread void  *scratch_buf;
+static __thread size_t scratch_size;
+static __thread int    scratch_busy;
+
 
 int mrp_tlv_setup_write(mrp_tlv_t *tlv, size_t prealloc)
 {
@@ -46,14 +62,77 @@ int mrp_tlv_setup_write(mrp_tlv_t *tlv, size_t prealloc)
     if ((tlv->buf = mrp_allocz(prealloc)) == NULL)
         return -1;
 
-    tlv->size  = prealloc;
-    tlv->p     = tlv->buf;
-    tlv->write = 1;
+    tlv->size    = prealloc;
+    tlv->p       = tlv->buf;
+    tlv->write   = 1;
+    tlv->scratch = 0;
+
+    return 0;
+}
+
+
+static void scratch_free(void *buf)
+{
+    mrp_free(buf);
+}
+
+
+static void scratch_create_key(void)
+{
+    pthread_key_create(&scratch_key, scratch_free);
+}
+
+
+int mrp_tlv_setup_scratch(mrp_tlv_t *tlv, size_t prealloc)
+{
+    if (scratch_busy)
+        return mrp_tlv_setup_write(tlv, prealloc);
+
+    pthread_once(&scratch_once, scratch_create_key);
+
+    if (prealloc < TLV_MIN_PREALLOC)
+        prealloc = TLV_MIN_PREALLOC;
+
+    if (scratch_size < prealloc) {
+        if (mrp_reallocz(scratch_buf, scratch_size, prealloc) == NULL)
+            return -1;
+
+        scratch_size = prealloc;
+    }
+
+    tlv->buf     = scratch_buf;
+    tlv->size    = scratch_size;
+    tlv->p       = tlv->buf;
+    tlv->write   = 1;
+    tlv->scratch = 1;
+
+    scratch_busy = TRUE;
 
     return 0;
 }
 
 
+static void scratch_release(mrp_tlv_t *tlv)
+{
+    if (tlv->size > TLV_SCRATCH_MAX) {
+        mrp_free(tlv->buf);
+        scratch_buf  = NULL;
+        scratch_size = 0;
+    }
+    else {
+        scratch_buf  = tlv->buf;
+        scratch_size = tlv->size;
+    }
+
+    pthread_setspecific(scratch_key, scratch_buf);
+    scratch_busy = FALSE;
+
+    tlv->buf     = tlv->p = NULL;
+    tlv->size    = 0;
+    tlv->scratch = 0;
+}
+
+
 static inline size_t tlv_space(mrp_tlv_t *tlv)
 {
     if (tlv->size > 0 && tlv->write)
@@ -74,16 +153,19 @@ static inline size_t tlv_data(mrp_tlv_t *tlv)
 
 int mrp_tlv_ensure(mrp_tlv_t *tlv, size_t size)
 {
-    size_t left, diff;
+    size_t left, need, nsize, diff;
 
     if (!tlv->write)
         return -1;
 
     if ((left = tlv_space(tlv)) < size) {
-        diff = size - left;
+        need  = tlv->size - left + size;
+        nsize = tlv->size > TLV_MIN_CHUNK ? tlv->size : TLV_MIN_CHUNK;
+
+        while (nsize < need)
+            nsize *= 2;
 
-        if (diff < TLV_MIN_CHUNK)
-            diff = TLV_MIN_CHUNK;
+        diff = nsize - tlv->size;
 
         tlv->p -= (ptrdiff_t)tlv->buf;
 
@@ -133,9 +215,10 @@ void *mrp_tlv_reserve(mrp_tlv_t *tlv, size_t size, int align)
 
 int mrp_tlv_setup_read(mrp_tlv_t *tlv, void *buf, size_t size)
 {
-    tlv->buf   = tlv->p = buf;
-    tlv->size  = size;
-    tlv->write = 0;
+    tlv->buf     = tlv->p = buf;
+    tlv->size    = size;
+    tlv->write   = 0;
+    tlv->scratch = 0;
 
     return 0;
 }
@@ -155,11 +238,17 @@ static void *tlv_consume(mrp_tlv_t *tlv, size_t size)
 }
 
 
+void *mrp_tlv_consume(mrp_tlv_t *tlv, size_t size)
+{
+    return tlv_consume(tlv, size);
+}
+
+
 void mrp_tlv_trim(mrp_tlv_t *tlv)
 {
     size_t left;
 
-    if (!tlv->write)
+    if (!tlv->write || tlv->scratch)
         return;
 
     if ((left = tlv_space(tlv)) == 0)
@@ -182,6 +271,11 @@ size_t mrp_tlv_offset(mrp_tlv_t *tlv)
 
 void mrp_tlv_cleanup(mrp_tlv_t *tlv)
 {
+    if (tlv->scratch) {
+        scratch_release(tlv);
+        return;
+    }
+
     if (tlv->write)
         mrp_free(tlv->buf);
 
@@ -192,7 +286,18 @@ void mrp_tlv_cleanup(mrp_tlv_t *tlv)
 
 void mrp_tlv_steal(mrp_tlv_t *tlv, void **bufp, size_t *sizep)
 {
-    if (tlv->write) {
+    if (tlv->scratch) {
+        *sizep = tlv->p - tlv->buf;
+        *bufp  = mrp_alloc(*sizep);
+
+        if (*bufp != NULL)
+            memcpy(*bufp, tlv->buf, *sizep);
+        else
+            *sizep = 0;
+
+        scratch_release(tlv);
+    }
+    else if (tlv->write) {
         *bufp  = tlv->buf;
         *sizep = tlv->p - tlv->buf;
 
@@ -433,6 +538,87 @@ int mrp_tlv_push_string(mrp_tlv_t *tlv, uint32_t tag, const char *str)
 }
 
 
+static void *reserve_array(mrp_tlv_t *tlv, uint32_t tag, size_t nelem,
+                           size_t size)
+{
+    if (push_tag(tlv, tag) < 0)
+        return NULL;
+
+    return mrp_tlv_reserve(tlv, nelem * size, 1);
+}
+
+
+int mrp_tlv_push_data(mrp_tlv_t *tlv, uint32_t tag, const void *data,
+                      size_t size)
+{
+    void *p;
+
+    if ((p = reserve_array(tlv, tag, size, 1)) == NULL)
+        return -1;
+
+    memcpy(p, data, size);
+
+    return 0;
+}
+
+
+int mrp_tlv_push_uint16_array(mrp_tlv_t *tlv, uint32_t tag,
+                              const uint16_t *v, size_t nelem)
+{
+    uint8_t  *p;
+    uint16_t  be;
+    size_t    i;
+
+    if ((p = reserve_array(tlv, tag, nelem, sizeof(*v))) == NULL)
+        return -1;
+
+    for (i = 0; i < nelem; i++, p += sizeof(be)) {
+        be = htobe16(v[i]);
+        memcpy(p, &be, sizeof(be));
+    }
+
+    return 0;
+}
+
+
+int mrp_tlv_push_uint32_array(mrp_tlv_t *tlv, uint32_t tag,
+                              const uint32_t *v, size_t nelem)
+{
+    uint8_t  *p;
+    uint32_t  be;
+    size_t    i;
+
+    if ((p = reserve_array(tlv, tag, nelem, sizeof(*v))) == NULL)
+        return -1;
+
+    for (i = 0; i < nelem; i++, p += sizeof(be)) {
+        be = htobe32(v[i]);
+        memcpy(p, &be, sizeof(be));
+    }
+
+    return 0;
+}
+
+
+int mrp_tlv_push_uint64_array(mrp_tlv_t *tlv, uint32_t tag,
+                              const uint64_t *v, size_t nelem)
+{
+    uint8_t  *p;
+    uint64_t  be;
+    size_t    i;
+
+    if ((p = reserve_array(tlv, tag, nelem, sizeof(*v))) == NULL)
+        return -1;
+
+    for (i = 0; i < nelem; i++, p += sizeof(be)) {
+        be = htobe64(v[i]);
+        memcpy(p, &be, sizeof(be));
+    }
+
+    return 0;
+}
+
+
 int pull_tag(mrp_tlv_t *tlv, uint32_t tag)
 {
     uint32_t *tagp;
@@ -48,11 +48,21 @@ typedef struct {
     size_t  size;                        /* allocated buffer size */
     void   *p;                           /* encoding/decoding pointer */
     int     write : 1;                   /* whether set up for writing */
+    int     scratch : 1;                 /* whether using scratch buffer */
 } mrp_tlv_t;
 
 /** Set up the given TLV buffer for encoding. */
 int mrp_tlv_setup_write(mrp_tlv_t *tlv, size_t prealloc);
 
+/**
+ * Set up the given TLV buffer for encoding into a per-thread scratch buffer.
+ *
+ * The scratch buffer is reused by the next encoding once the TLV buffer is
+ * cleaned up. Stealing the data from a scratch TLV buffer returns a copy of
+ * the encoded data and releases the scratch buffer.
+ */
+int mrp_tlv_setup_scratch(mrp_tlv_t *tlv, size_t prealloc);
+
 /** Set up the given TLV buffer for decoding. */
 int mrp_tlv_setup_read(mrp_tlv_t *tlv, void *buf, size_t size);
 
@@ -65,6 +75,9 @@ int mrp_tlv_ensure(mrp_tlv_t *tlv, size_t size);
 /** Reserve the given amount of buffer space from the TLV buffer. */
 void *mrp_tlv_reserve(mrp_tlv_t *tlv, size_t size, int align);
 
+/** Consume the given amount of data from the TLV buffer. */
+void *mrp_tlv_consume(mrp_tlv_t *tlv, size_t size);
+
 /** Take ownership of the data buffer from the TLV buffer. */
 void mrp_tlv_steal(mrp_tlv_t *tlv, void **bufp, size_t *sizep);
 
@@ -110,6 +123,28 @@ int mrp_tlv_push_bool(mrp_tlv_t *tlv, uint32_t tag, bool v);
 /** Add a string with an optional tag to the TLV buffer. */
 int mrp_tlv_push_string(mrp_tlv_t *tlv, uint32_t tag, const char *str);
 
+/*
+ * Batch variants writing an array of values at once. The optional tag is
+ * written once, the values follow it untagged and packed, exactly as if
+ * they were pushed one by one with MRP_TLV_UNTAGGED.
+ */
+
+/** Add raw bytes, eg. int8_t, uint8_t, float, double or bool values. */
+int mrp_tlv_push_data(mrp_tlv_t *tlv, uint32_t tag, const void *data,
+                      size_t size);
+
+/** Add an array of int16_t or uint16_t values to the TLV buffer. */
+int mrp_tlv_push_uint16_array(mrp_tlv_t *tlv, uint32_t tag,
+                              const uint16_t *v, size_t nelem);
+
+/** Add an array of int32_t or uint32_t values to the TLV buffer. */
+int mrp_tlv_push_uint32_array(mrp_tlv_t *tlv, uint32_t tag,
+                              const uint32_t *v, size_t nelem);
+
+/** Add an array of int64_t or uint64_t values to the TLV buffer. */
+int mrp_tlv_push_uint64_array(mrp_tlv_t *tlv, uint32_t tag,
+                              const uint64_t *v, size_t nelem);
+
 
 int mrp_tlv_pull_int8(mrp_tlv_t *tlv, uint32_t tag, int8_t *v);
 int mrp_tlv_pull_uint8(mrp_tlv_t *tlv, uint32_t tag, uint8_t *v);
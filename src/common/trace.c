@@ -0,0 +1,376 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
+#include <murphy/common/list.h>
+#include <murphy/common/debug.h>
+#include <murphy/common/trace.h>
+
+#define DEFAULT_EVENTS 8192               /* events per thread */
+
+/*
+ * Every thread records events into a ring buffer of its own, so recording
+ * needs no locking and no atomic operations, and once the ring is full the
+ * oldest events are overwritten. The buffers are allocated on the first
+ * event of a thread and reset on the first event of every new trace (ie.
+ * when the trace session differs from the one of the buffer). Buffers of
+ * exited threads are kept around until the next trace is started, so that
+ * their events can still be dumped.
+ */
+
+typedef struct {
+    uint64_t                 stamp;      /* nsecs of CLOCK_MONOTONIC */
+    const mrp_trace_point_t *tp;         /* trace point */
+    uint32_t                 nargs;      /* number of arguments */
+    uint64_t                 args[MRP_TRACE_MAXARGS];
+} trace_event_t;
+
+typedef struct {
+    mrp_list_hook_t  hook;               /* to list of buffers */
+    pid_t            tid;                /* recording thread */
+    int              exited;             /* whether thread has exited */
+    uint32_t         session;            /* trace session of events */
+    uint32_t         mask;               /* number of events - 1 */
+    uint64_t         total;              /* events recorded during session */
+    trace_event_t    events[0];          /* ring of events */
+} trace_buf_t;
+
+static pthread_mutex_t       lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t        once = PTHREAD_ONCE_INIT;
+static pthread_key_t         key;
+static MRP_LIST_HOOK(buffers);
+static __thread trace_buf_t *thread_buf;
+
+static int      active;                  /* whether tracing */
+static uint32_t session;                 /* current trace session */
+static uint32_t nevent;                  /* events per buffer */
+static uint64_t started;                 /* start of current session */
+
+
+static inline uint64_t now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static void thread_exit_cb(void *ptr)
+{
+    trace_buf_t *buf = ptr;
+
+    pthread_mutex_lock(&lock);
+    buf->exited = TRUE;
+    pthread_mutex_unlock(&lock);
+}
+
+
+static void create_key(void)
+{
+    pthread_key_create(&key, thread_exit_cb);
+}
+
+
+static trace_buf_t *get_buffer(void)
+{
+    trace_buf_t *buf = thread_buf;
+
+    pthread_once(&once, create_key);
+    pthread_mutex_lock(&lock);
+
+    if (buf != NULL && buf->mask + 1 != nevent) {
+        mrp_list_delete(&buf->hook);
+        mrp_free(buf);
+        buf = NULL;
+    }
+
+    if (buf == NULL) {
+        buf = mrp_alloc(sizeof(*buf) + nevent * sizeof(buf->events[0]));
+
+        if (buf != NULL) {
+            mrp_list_init(&buf->hook);
+            buf->tid    = syscall(SYS_gettid);
+            buf->exited = FALSE;
+            buf->mask   = nevent - 1;
+
+            mrp_list_append(&buffers, &buf->hook);
+        }
+
+        pthread_setspecific(key, buf);
+        thread_buf = buf;
+    }
+
+    if (buf != NULL) {
+        buf->session = session;
+        buf->total   = 0;
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return buf;
+}
+
+
+int mrp_trace_start(size_t n)
+{
+    mrp_list_hook_t *p, *q;
+    trace_buf_t     *buf;
+
+    if (n == 0)
+        n = DEFAULT_EVENTS;
+
+    if (n > 1024 * 1024)
+        return FALSE;
+
+    pthread_mutex_lock(&lock);
+
+    /* round up to a power of 2 */
+    for (nevent = 1; nevent < n; nevent <<= 1)
+        ;
+
+    mrp_list_foreach(&buffers, p, q) {
+        buf = mrp_list_entry(p, typeof(*buf), hook);
+
+        if (buf->exited) {
+            mrp_list_delete(&buf->hook);
+            mrp_free(buf);
+        }
+    }
+
+    session++;
+    started = now();
+    active  = TRUE;
+
+    pthread_mutex_unlock(&lock);
+
+    mrp_debug_stamp++;
+
+    return TRUE;
+}
+
+
+void mrp_trace_stop(void)
+{
+    if (!active)
+        return;
+
+    active = FALSE;
+    mrp_debug_stamp++;
+}
+
+
+int mrp_trace_active(void)
+{
+    return active;
+}
+
+
+int mrp_trace_check(const char *func, const char *file, int line)
+{
+    if (!active)
+        return FALSE;
+
+    return mrp_debug_match(func, file, line);
+}
+
+
+void mrp_trace_event(const mrp_trace_point_t *tp, int nargs,
+                     const uint64_t *args)
+{
+    trace_buf_t   *buf = thread_buf;
+    trace_event_t *e;
+    int            i;
+
+    if (MRP_UNLIKELY(!active))
+        return;
+
+    if (MRP_UNLIKELY(buf == NULL || buf->session != session))
+        if ((buf = get_buffer()) == NULL)
+            return;
+
+    e = buf->events + (buf->total++ & buf->mask);
+
+    e->stamp = now();
+    e->tp    = tp;
+    e->nargs = nargs;
+
+    for (i = 0; i < nargs; i++)
+        e->args[i] = args[i];
+}
+
+
+static const char *basename_of(const char *path)
+{
+    const char *base = strrchr(path, '/');
+
+    return base ? base + 1 : path;
+}
+
+
+static void dump_text(FILE *fp, trace_buf_t *buf, trace_event_t *e)
+{
+    static const char *types[] = { "", "begin ", "end " };
+    uint64_t           t;
+    uint32_t           i;
+
+    t = e->stamp - started;
+
+    fprintf(fp, "%llu.%09llu %d %s%s [%s@%s:%d]",
+            (unsigned long long)(t / 1000000000ULL),
+            (unsigned long long)(t % 1000000000ULL), buf->tid,
+            types[e->tp->type], e->tp->name, e->tp->func,
+            basename_of(e->tp->file), e->tp->line);
+
+    for (i = 0; i < e->nargs; i++)
+        fprintf(fp, " %lld", (long long)e->args[i]);
+
+    fputc('\n', fp);
+}
+
+
+static void dump_chrome(FILE *fp, trace_buf_t *buf, trace_event_t *e,
+                        int first)
+{
+    static const char *phases[] = { "i", "B", "E" };
+    uint64_t           t;
+    uint32_t           i;
+
+    t = e->stamp - started;
+
+    fprintf(fp, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\","
+            "\"ts\":%llu.%03llu,\"pid\":%d,\"tid\":%d,%s"
+            "\"args\":{\"func\":\"%s\",\"line\":%d",
+            first ? "" : ",", e->tp->name, basename_of(e->tp->file),
+            phases[e->tp->type],
+            (unsigned long long)(t / 1000), (unsigned long long)(t % 1000),
+            (int)getpid(), buf->tid,
+            e->tp->type == MRP_TRACE_INSTANT ? "\"s\":\"t\"," : "",
+            e->tp->func, e->tp->line);
+
+    for (i = 0; i < e->nargs; i++)
+        fprintf(fp, ",\"a%u\":%lld", i, (long long)e->args[i]);
+
+    fputs("}}", fp);
+}
+
+
+int mrp_trace_dump(FILE *fp, mrp_trace_format_t format)
+{
+    mrp_list_hook_t *p, *q;
+    trace_buf_t     *buf;
+    uint64_t         i, n, lost;
+    int              first;
+
+    mrp_trace_stop();
+
+    pthread_mutex_lock(&lock);
+
+    if (format == MRP_TRACE_FORMAT_CHROME)
+        fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    first = TRUE;
+    lost  = 0;
+
+    mrp_list_foreach(&buffers, p, q) {
+        buf = mrp_list_entry(p, typeof(*buf), hook);
+
+        if (buf->session != session)
+            continue;
+
+        n     = MRP_MIN(buf->total, (uint64_t)buf->mask + 1);
+        lost += buf->total - n;
+
+        for (i = buf->total - n; i < buf->total; i++) {
+            if (format == MRP_TRACE_FORMAT_CHROME)
+                dump_chrome(fp, buf, buf->events + (i & buf->mask), first);
+            else
+                dump_text(fp, buf, buf->events + (i & buf->mask));
+
+            first = FALSE;
+        }
+    }
+
+    if (format == MRP_TRACE_FORMAT_CHROME)
+        fprintf(fp, "\n],\"otherData\":{\"overwritten\":%llu}}\n",
+                (unsigned long long)lost);
+    else if (lost > 0)
+        fprintf(fp, "%llu older events were overwritten\n",
+                (unsigned long long)lost);
+
+    pthread_mutex_unlock(&lock);
+
+    fflush(fp);
+
+    return TRUE;
+}
+
+
+int mrp_trace_dump_status(FILE *fp)
+{
+    mrp_list_hook_t *p, *q;
+    trace_buf_t     *buf;
+    int              nbuf;
+    uint64_t         total, kept;
+
+    pthread_mutex_lock(&lock);
+
+    nbuf = 0;
+    total = kept = 0;
+
+    mrp_list_foreach(&buffers, p, q) {
+        buf = mrp_list_entry(p, typeof(*buf), hook);
+
+        if (buf->session != session)
+            continue;
+
+        nbuf++;
+        total += buf->total;
+        kept  += MRP_MIN(buf->total, (uint64_t)buf->mask + 1);
+    }
+
+    fprintf(fp, "Tracing is %s, %u events per thread.\n",
+            active ? "active" : "stopped", nevent ? nevent : DEFAULT_EVENTS);
+    fprintf(fp, "%d threads recorded %llu events, %llu kept.\n", nbuf,
+            (unsigned long long)total, (unsigned long long)kept);
+
+    pthread_mutex_unlock(&lock);
+
+    return TRUE;
+}
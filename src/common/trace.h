@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MURPHY_TRACE_H__
+#define __MURPHY_TRACE_H__
+
+/** \file
+ * Lightweight binary trace points.
+ *
+ * A trace point records a timestamped event consisting of the static
+ * trace point (name and location) and up to MRP_TRACE_MAXARGS integer
+ * arguments into a per-thread ring buffer. Nothing is formatted while
+ * tracing, that only happens when the collected trace is dumped. Trace
+ * points are only active while tracing is started and, if there are any
+ * debug rules, only those which match the debug rules (cf. mrp_debug).
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/debug.h>
+
+MRP_CDECL_BEGIN
+
+/** Maximum number of integer arguments to a trace point. */
+#define MRP_TRACE_MAXARGS 4
+
+/**
+ * Types of trace events.
+ */
+typedef enum {
+    MRP_TRACE_INSTANT = 0,               /**< a single point in time */
+    MRP_TRACE_BEGIN,                     /**< beginning of a duration */
+    MRP_TRACE_END,                       /**< end of a duration */
+} mrp_trace_type_t;
+
+/**
+ * A static trace point.
+ */
+typedef struct {
+    const char       *name;              /**< event name */
+    const char       *file;              /**< source file */
+    const char       *func;              /**< function */
+    int               line;              /**< line number */
+    mrp_trace_type_t  type;              /**< event type */
+} mrp_trace_point_t;
+
+/** Trace an event with up to MRP_TRACE_MAXARGS integer arguments. */
+#define mrp_trace(name, args...) \
+    __mrp_trace(MRP_TRACE_INSTANT, name , ## args)
+
+/** Trace the beginning of a duration, eg. a function call. */
+#define mrp_trace_begin(name, args...) \
+    __mrp_trace(MRP_TRACE_BEGIN, name , ## args)
+
+/** Trace the end of a duration opened by mrp_trace_begin. */
+#define mrp_trace_end(name, args...) \
+    __mrp_trace(MRP_TRACE_END, name , ## args)
+
+#define __mrp_trace(_type, _name, args...)  do {                          \
+        static int __site_stamp = -1;                                     \
+        static int __site_enabled;                                        \
+                                                                          \
+        if (MRP_UNLIKELY(__site_stamp != mrp_debug_stamp)) {              \
+            __site_enabled = mrp_trace_check(__FUNCTION__,                \
+                                             __FILE__, __LINE__);         \
+            __site_stamp   = mrp_debug_stamp;                             \
+        }                                                                 \
+                                                                          \
+        if (MRP_UNLIKELY(__site_enabled)) {                               \
+            static const mrp_trace_point_t __tp = {                       \
+                _name, __FILE__, __FUNCTION__, __LINE__, _type            \
+            };                                                            \
+            uint64_t __args[] = { 0 , ## args };                          \
+                                                                          \
+            (void)sizeof(char[MRP_ARRAY_SIZE(__args) <=                   \
+                              MRP_TRACE_MAXARGS + 1 ? 1 : -1]);           \
+            mrp_trace_event(&__tp, MRP_ARRAY_SIZE(__args) - 1,            \
+                            __args + 1);                                  \
+        }                                                                 \
+    } while (0)
+
+/**
+ * Trace dump formats.
+ */
+typedef enum {
+    MRP_TRACE_FORMAT_TEXT = 0,           /**< one line per event */
+    MRP_TRACE_FORMAT_CHROME,             /**< Chrome trace event JSON */
+} mrp_trace_format_t;
+
+/** Start a new trace with the given number of events per thread. */
+int mrp_trace_start(size_t nevent);
+
+/** Stop tracing, keeping the collected events for dumping. */
+void mrp_trace_stop(void);
+
+/** Check whether tracing is active. */
+int mrp_trace_active(void);
+
+/** Dump the collected events in the given format. */
+int mrp_trace_dump(FILE *fp, mrp_trace_format_t format);
+
+/** Print a summary of the trace buffers. */
+int mrp_trace_dump_status(FILE *fp);
+
+/** Check if the given trace site is enabled. */
+int mrp_trace_check(const char *func, const char *file, int line);
+
+/** Record a trace event. */
+void mrp_trace_event(const mrp_trace_point_t *tp, int nargs,
+                     const uint64_t *args);
+
+MRP_CDECL_END
+
+#endif /* __MURPHY_TRACE_H__ */
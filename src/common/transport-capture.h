@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MURPHY_TRANSPORT_CAPTURE_H__
+#define __MURPHY_TRANSPORT_CAPTURE_H__
+
+#include <stdint.h>
+#include <endian.h>
+
+#include <murphy/common/macros.h>
+
+MRP_CDECL_BEGIN
+
+/*
+ * Transport traffic capture files.
+ *
+ * A capture file starts with MRP_CAPTURE_MAGIC, followed by records of a
+ * fixed-size big-endian header and a payload of header.size bytes. Each
+ * accepted connection is announced by an OPEN record with the transport
+ * type as its payload, followed by one FRAME record per received frame
+ * and a final CLOSE record. Frames are recorded as they came off the wire,
+ * ie. including the tag of the encoding but without any transport framing.
+ * JSON frames are recorded as their string representation. Timestamps are
+ * in microseconds since the start of the capture.
+ */
+
+#define MRP_CAPTURE_MAGIC     "MRPCAP01"
+#define MRP_CAPTURE_MAGIC_LEN 8
+
+typedef enum {
+    MRP_CAPTURE_OPEN = 1,                /* new connection */
+    MRP_CAPTURE_FRAME,                   /* frame received */
+    MRP_CAPTURE_CLOSE,                   /* connection closed */
+} mrp_capture_kind_t;
+
+typedef struct {
+    uint64_t usecs;                      /* time since start of capture */
+    uint32_t conn;                       /* connection id */
+    uint32_t size;                       /* payload size */
+    uint16_t kind;                       /* mrp_capture_kind_t */
+    uint16_t mode;                       /* transport mode */
+    uint32_t reserved;                   /* for future use, 0 */
+} mrp_capture_hdr_t;
+
+
+/** Convert a capture record header between host and file byte order. */
+static inline void mrp_capture_hdr_swap(mrp_capture_hdr_t *h, int to_file)
+{
+    if (to_file) {
+        h->usecs = htobe64(h->usecs);
+        h->conn  = htobe32(h->conn);
+        h->size  = htobe32(h->size);
+        h->kind  = htobe16(h->kind);
+        h->mode  = htobe16(h->mode);
+    }
+    else {
+        h->usecs = be64toh(h->usecs);
+        h->conn  = be32toh(h->conn);
+        h->size  = be32toh(h->size);
+        h->kind  = be16toh(h->kind);
+        h->mode  = be16toh(h->mode);
+    }
+}
+
+MRP_CDECL_END
+
+#endif /* __MURPHY_TRANSPORT_CAPTURE_H__ */
@@ -27,23 +27,62 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include <murphy/common/mm.h>
 #include <murphy/common/list.h>
 #include <murphy/common/log.h>
+#include <murphy/common/json.h>
 #include <murphy/common/native-types.h>
 #include <murphy/common/transport.h>
+#include <murphy/common/transport-capture.h>
+#include <murphy/common/metrics.h>
 
 static int check_destroy(mrp_transport_t *t);
 static int recv_data(mrp_transport_t *t, void *data, size_t size,
                      mrp_sockaddr_t *addr, socklen_t addrlen);
 static inline int purge_destroyed(mrp_transport_t *t);
+static void capture_open(mrp_transport_t *t);
+static void capture_frame(mrp_transport_t *t, void *data, size_t size);
+static void capture_close(mrp_transport_t *t);
 
 
 static MRP_LIST_HOOK(transports);
 static mrp_sighandler_t *pipe_handler;
+static mrp_metric_t     *sent_metric;
+static mrp_metric_t     *failed_metric;
+
+
+static void count_sends(int nsent, int nfailed)
+{
+    if (MRP_UNLIKELY(sent_metric == NULL)) {
+        sent_metric   = mrp_metric_counter("murphy_transport_sent_total",
+                                           "Number of messages sent.");
+        failed_metric =
+            mrp_metric_counter("murphy_transport_send_failures_total",
+                               "Number of failed message sends.");
+    }
+
+    if (nsent > 0)
+        mrp_metric_add(sent_metric, nsent);
+    if (nfailed > 0)
+        mrp_metric_add(failed_metric, nfailed);
+}
+
+
+static inline int count_send(int result)
+{
+    if (result)
+        count_sends(1, 0);
+    else
+        count_sends(0, 1);
+
+    return result;
+}
 
 
 static int check_request_callbacks(mrp_transport_req_t *req)
@@ -233,14 +272,26 @@ mrp_transport_t *mrp_transport_create_from(mrp_mainloop_t *ml, const char *type,
 int mrp_transport_setopt(mrp_transport_t *t, const char *opt, const void *val)
 {
     if (t != NULL) {
-        if (t->descr->req.setopt != NULL)
-            return t->descr->req.setopt(t, opt, val);
-        else {
-            if (t->mode == MRP_TRANSPORT_MODE_NATIVE) {
-                if (!strcmp(opt, MRP_TRANSPORT_OPT_TYPEMAP)) {
-                    t->map = (void *)val;
-                    return TRUE;
-                }
+        if (t->descr->req.setopt != NULL && t->descr->req.setopt(t, opt, val))
+            return TRUE;
+
+        if (t->mode == MRP_TRANSPORT_MODE_NATIVE) {
+            if (!strcmp(opt, MRP_TRANSPORT_OPT_TYPEMAP)) {
+                t->map = (void *)val;
+                return TRUE;
+            }
+        }
+
+        if (t->mode == MRP_TRANSPORT_MODE_MSG && val != NULL) {
+            if (!strcmp(opt, MRP_TRANSPORT_OPT_ENCODING)) {
+                if (!strcmp(val, MRP_TRANSPORT_ENCODING_COMPACT))
+                    t->flags |= MRP_TRANSPORT_COMPACT;
+                else if (!strcmp(val, MRP_TRANSPORT_ENCODING_DEFAULT))
+                    t->flags &= ~MRP_TRANSPORT_COMPACT;
+                else
+                    return FALSE;
+
+                return TRUE;
             }
         }
     }
@@ -249,6 +300,25 @@ int mrp_transport_setopt(mrp_transport_t *t, const char *opt, const void *val)
 }
 
 
+ssize_t mrp_transport_encode(mrp_transport_t *t, mrp_msg_t *msg, void **bufp)
+{
+    if (t->flags & MRP_TRANSPORT_COMPACT)
+        return mrp_msg_compact_encode(msg, bufp);
+    else
+        return mrp_msg_default_encode(msg, bufp);
+}
+
+
+ssize_t mrp_transport_encode_iov(mrp_transport_t *t, mrp_msg_t *msg,
+                                 mrp_msg_iov_t *miov)
+{
+    if (t->flags & MRP_TRANSPORT_COMPACT)
+        return mrp_msg_compact_encode_iov(msg, miov);
+    else
+        return mrp_msg_default_encode_iov(msg, miov);
+}
+
+
 static inline int type_matches(const char *type, const char *addr)
 {
     while (*type == *addr)
@@ -348,6 +418,8 @@ mrp_transport_t *mrp_transport_accept(mrp_transport_t *lt,
             mrp_free(t);
             t = NULL;
         }
+        else
+            capture_open(t);
     }
 
     return t;
@@ -371,6 +443,9 @@ void mrp_transport_destroy(mrp_transport_t *t)
     if (t != NULL) {
         t->destroyed = TRUE;
 
+        if (MRP_UNLIKELY(t->capture_id != 0))
+            capture_close(t);
+
         MRP_TRANSPORT_BUSY(t, {
                 t->descr->req.disconnect(t);
                 t->descr->req.close(t);
@@ -420,6 +495,22 @@ int mrp_transport_connect(mrp_transport_t *t, mrp_sockaddr_t *addr,
 }
 
 
+const mrp_transport_peer_t *mrp_transport_peer(mrp_transport_t *t)
+{
+    const mrp_transport_peer_t *peer;
+
+    if (t == NULL || t->descr->req.peer == NULL) {
+        errno = EOPNOTSUPP;
+        return NULL;
+    }
+
+    if ((peer = t->descr->req.peer(t)) == NULL)
+        errno = ENOENT;
+
+    return peer;
+}
+
+
 int mrp_transport_disconnect(mrp_transport_t *t)
 {
     int result;
@@ -457,7 +548,42 @@ int mrp_transport_send(mrp_transport_t *t, mrp_msg_t *msg)
     else
         result = FALSE;
 
-    return result;
+    return count_send(result);
+}
+
+
+int mrp_transport_sendtmpl(mrp_transport_t *t, mrp_msg_tmpl_t *tmpl)
+{
+    mrp_msg_t *msg;
+    void      *data;
+    size_t     size;
+    int        result;
+
+    data = mrp_msg_tmpl_data(tmpl, &size);
+
+    if (!t->connected || t->mode != MRP_TRANSPORT_MODE_MSG)
+        return count_send(FALSE);
+
+    if (t->descr->req.sendencmsg == NULL) {
+        msg = mrp_msg_default_decode(data + sizeof(uint16_t),
+                                     size - sizeof(uint16_t));
+
+        if (msg == NULL)
+            return count_send(FALSE);
+
+        result = mrp_transport_send(t, msg);
+        mrp_msg_unref(msg);
+
+        return result;
+    }
+
+    MRP_TRANSPORT_BUSY(t, {
+            result = t->descr->req.sendencmsg(t, data, size);
+        });
+
+    purge_destroyed(t);
+
+    return count_send(result);
 }
 
 
@@ -476,7 +602,130 @@ int mrp_transport_sendto(mrp_transport_t *t, mrp_msg_t *msg,
     else
         result = FALSE;
 
-    return result;
+    return count_send(result);
+}
+
+
+/*
+ * encode-once/send-many
+ *
+ * Transports which can readdress an already encoded message provide the
+ * optional encodemsg, sendencoded and freeencoded requests. For these we
+ * encode a message delivered to several destinations only once (per type
+ * of transport) and let the transport clone or reference the encoded form
+ * for each destination. Other transports simply get a send per target.
+ */
+
+#define MAX_ENCODED 4                    /* max. different transport types */
+
+int mrp_transport_sendmany(mrp_transport_t **ts, int nt, mrp_msg_t *msg)
+{
+    struct {
+        mrp_transport_descr_t *descr;    /* transport type */
+        void                  *enc;      /* message encoded for this type */
+    } cache[MAX_ENCODED];
+    mrp_transport_descr_t *descr;
+    mrp_transport_t       *t;
+    void                  *enc;
+    int                    ncache, nsent, result, i, j;
+
+    ncache = 0;
+    nsent  = 0;
+
+    for (i = 0; i < nt; i++) {
+        t     = ts[i];
+        descr = t->descr;
+        enc   = NULL;
+
+        if (!t->connected) {
+            count_send(FALSE);
+            continue;
+        }
+
+        if (descr->req.encodemsg == NULL) {
+            if (mrp_transport_send(t, msg))
+                nsent++;
+            continue;
+        }
+
+        for (j = 0; j < ncache; j++) {
+            if (cache[j].descr == descr) {
+                enc = cache[j].enc;
+                break;
+            }
+        }
+
+        MRP_TRANSPORT_BUSY(t, {
+                if (enc == NULL && ncache < MAX_ENCODED) {
+                    enc = descr->req.encodemsg(t, msg, NULL, 0);
+
+                    if (enc != NULL) {
+                        cache[ncache].descr = descr;
+                        cache[ncache].enc   = enc;
+                        ncache++;
+                    }
+                }
+
+                if (enc != NULL)
+                    result = descr->req.sendencoded(t, enc, NULL, 0);
+                else
+                    result = descr->req.sendmsg(t, msg);
+            });
+
+        purge_destroyed(t);
+
+        if (count_send(result))
+            nsent++;
+    }
+
+    for (j = 0; j < ncache; j++)
+        cache[j].descr->req.freeencoded(cache[j].enc);
+
+    return nsent;
+}
+
+
+int mrp_transport_sendmanyto(mrp_transport_t *t, mrp_msg_t *msg,
+                             mrp_sockaddr_t *addrs, socklen_t *addrlens,
+                             int naddr)
+{
+    mrp_transport_req_t *req = &t->descr->req;
+    void                *enc;
+    int                  nsent, i;
+
+    if (req->sendmsgto == NULL || naddr <= 0) {
+        count_sends(0, naddr);
+        return 0;
+    }
+
+    nsent = 0;
+
+    MRP_TRANSPORT_BUSY(t, {
+            if (req->encodemsg != NULL)
+                enc = req->encodemsg(t, msg, addrs, addrlens[0]);
+            else
+                enc = NULL;
+
+            for (i = 0; i < naddr; i++) {
+                if (enc != NULL) {
+                    if (req->sendencoded(t, enc, addrs + i, addrlens[i]))
+                        nsent++;
+                }
+                else {
+                    if (req->sendmsgto(t, msg, addrs + i, addrlens[i]))
+                        nsent++;
+                }
+            }
+
+            if (enc != NULL)
+                req->freeencoded(enc);
+        });
+
+    purge_destroyed(t);
+
+    count_sends(nsent, naddr - nsent);
+
+    return nsent;
 }
 
 
@@ -484,8 +733,16 @@ int mrp_transport_sendraw(mrp_transport_t *t, void *data, size_t size)
 {
     int result;
 
+    /*
+     * Notes:
+     *     Custom-mode transports also take raw data. This lets clients
+     *     send messages they have already encoded themselves, e.g. with
+     *     the streaming JSON writer, without building a custom object.
+     */
+
     if (t->connected &&
-        t->mode == MRP_TRANSPORT_MODE_RAW && t->descr->req.sendraw) {
+        (t->mode == MRP_TRANSPORT_MODE_RAW ||
+         t->mode == MRP_TRANSPORT_MODE_CUSTOM) && t->descr->req.sendraw) {
         MRP_TRANSPORT_BUSY(t, {
                 result = t->descr->req.sendraw(t, data, size);
             });
@@ -495,7 +752,7 @@ int mrp_transport_sendraw(mrp_transport_t *t, void *data, size_t size)
     else
         result = FALSE;
 
-    return result;
+    return count_send(result);
 }
 
 
@@ -514,7 +771,7 @@ int mrp_transport_sendrawto(mrp_transport_t *t, void *data, size_t size,
     else
         result = FALSE;
 
-    return result;
+    return count_send(result);
 }
 
 
@@ -533,7 +790,7 @@ int mrp_transport_senddata(mrp_transport_t *t, void *data, uint16_t tag)
     else
         result = FALSE;
 
-    return result;
+    return count_send(result);
 }
 
 
@@ -552,7 +809,7 @@ int mrp_transport_senddatato(mrp_transport_t *t, void *data, uint16_t tag,
     else
         result = FALSE;
 
-    return result;
+    return count_send(result);
 }
 
 
@@ -570,7 +827,7 @@ int mrp_transport_sendcustom(mrp_transport_t *t, void *data)
     else
         result = FALSE;
 
-    return result;
+    return count_send(result);
 }
 
 
@@ -589,7 +846,7 @@ int mrp_transport_sendcustomto(mrp_transport_t *t, void *data,
     else
         result = FALSE;
 
-    return result;
+    return count_send(result);
 }
 
 
@@ -607,7 +864,7 @@ int mrp_transport_sendnative(mrp_transport_t *t, void *data, uint32_t type_id)
     else
         result = FALSE;
 
-    return result;
+    return count_send(result);
 }
 
 
@@ -627,7 +884,7 @@ int mrp_transport_sendnativeto(mrp_transport_t *t, void *data, uint32_t type_id,
     else
         result = FALSE;
 
-    return result;
+    return count_send(result);
 }
 
 
@@ -645,7 +902,7 @@ int mrp_transport_sendjson(mrp_transport_t *t, mrp_json_t *msg)
     else
         result = FALSE;
 
-    return result;
+    return count_send(result);
 }
 
 
@@ -674,8 +931,12 @@ static int recv_data(mrp_transport_t *t, void *data, size_t size,
     mrp_data_descr_t *type;
     uint16_t          tag;
     mrp_msg_t        *msg;
+    mrp_arena_t      *arena;
     uint32_t          type_id;
-    void             *decoded;
+    void             *decoded, *frame, *owned;
+
+    if (MRP_UNLIKELY(t->capture_id != 0))
+        capture_frame(t, data, size);
 
     switch (t->mode) {
     case MRP_TRANSPORT_MODE_DATA:
@@ -732,14 +993,47 @@ static int recv_data(mrp_transport_t *t, void *data, size_t size,
         return 0;
 
     case MRP_TRANSPORT_MODE_MSG:
+        frame = data;
         tag   = be16toh(*(uint16_t *)data);
         data += sizeof(tag);
         size -= sizeof(tag);
 
-        if (tag != MRP_MSG_TAG_DEFAULT ||
-            (msg = mrp_msg_default_decode(data, size)) == NULL) {
+        if (tag == MRP_MSG_TAG_COMPACT) {
+            /* a connected peer speaking compact gets answered in kind */
+            if (t->connected)
+                t->flags |= MRP_TRANSPORT_COMPACT;
+            msg = mrp_msg_compact_decode(data, size);
+            goto dispatch;
+        }
+
+        if (tag != MRP_MSG_TAG_DEFAULT)
             return -EPROTO;
+
+        /*
+         * If the transport was asked to, decode the message into the
+         * dispatch arena of the mainloop. If the transport can hand over
+         * its receive buffer, decode the message as a zero-copy view of
+         * the buffer and let the message take ownership of the buffer.
+         * Otherwise decode by copying.
+         */
+
+        if ((t->flags & MRP_TRANSPORT_ARENA) &&
+            (arena = mrp_mainloop_arena(t->ml)) != NULL)
+            msg = mrp_msg_default_decode_arena(arena, data, size);
+        else if (t->steal_data != NULL &&
+            (owned = t->steal_data(t, frame, size + sizeof(tag))) != NULL) {
+            data = owned + sizeof(tag);
+            if ((msg = mrp_msg_default_decode_view(data, size)) != NULL)
+                mrp_msg_view_own(msg, owned);
+            else
+                mrp_free(owned);
         }
+        else
+            msg = mrp_msg_default_decode(data, size);
+
+    dispatch:
+        if (msg == NULL)
+            return -EPROTO;
         else {
             if (t->connected) {
                 MRP_TRANSPORT_BUSY(t, {
@@ -827,3 +1121,131 @@ static int recv_data(mrp_transport_t *t, void *data, size_t size,
     }
 }
 
+
+/*
+ * traffic capture
+ */
+
+static struct {
+    FILE     *fp;                        /* capture file, if capturing */
+    uint64_t  start;                     /* start of capture */
+    uint32_t  next_id;                   /* next connection id */
+    int       checked;                   /* environment checked */
+} capture;
+
+
+static uint64_t capture_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+
+static void capture_record(mrp_transport_t *t, int kind, const void *data,
+                           size_t size)
+{
+    mrp_capture_hdr_t hdr;
+
+    if (capture.fp == NULL)
+        return;
+
+    hdr.usecs    = capture_time() - capture.start;
+    hdr.conn     = t->capture_id;
+    hdr.size     = size;
+    hdr.kind     = kind;
+    hdr.mode     = t->mode;
+    hdr.reserved = 0;
+
+    mrp_capture_hdr_swap(&hdr, TRUE);
+
+    if (fwrite(&hdr, sizeof(hdr), 1, capture.fp) != 1 ||
+        (size > 0 && fwrite(data, size, 1, capture.fp) != 1)) {
+        mrp_log_error("Failed to write capture file (%d: %s), giving up.",
+                      errno, strerror(errno));
+        mrp_transport_capture_stop();
+        return;
+    }
+
+    if (kind == MRP_CAPTURE_CLOSE)
+        fflush(capture.fp);
+}
+
+
+int mrp_transport_capture_start(const char *path)
+{
+    FILE *fp;
+
+    mrp_transport_capture_stop();
+    capture.checked = TRUE;
+
+    if ((fp = fopen(path, "w")) == NULL)
+        return FALSE;
+
+    if (fwrite(MRP_CAPTURE_MAGIC, MRP_CAPTURE_MAGIC_LEN, 1, fp) != 1) {
+        fclose(fp);
+        return FALSE;
+    }
+
+    capture.fp    = fp;
+    capture.start = capture_time();
+
+    mrp_log_info("Capturing inbound transport traffic to %s.", path);
+
+    return TRUE;
+}
+
+
+void mrp_transport_capture_stop(void)
+{
+    if (capture.fp != NULL) {
+        fclose(capture.fp);
+        capture.fp = NULL;
+    }
+}
+
+
+static void capture_open(mrp_transport_t *t)
+{
+    const char *path;
+
+    if (!capture.checked) {
+        capture.checked = TRUE;
+
+        if ((path = getenv(MRP_TRANSPORT_CAPTURE_ENVVAR)) != NULL && *path)
+            if (!mrp_transport_capture_start(path))
+                mrp_log_error("Failed to open capture file %s.", path);
+    }
+
+    if (capture.fp == NULL || t->mode == MRP_TRANSPORT_MODE_CUSTOM)
+        return;
+
+    if ((t->capture_id = ++capture.next_id) == 0)
+        t->capture_id = ++capture.next_id;
+
+    capture_record(t, MRP_CAPTURE_OPEN, t->descr->type,
+                   strlen(t->descr->type) + 1);
+}
+
+
+static void capture_frame(mrp_transport_t *t, void *data, size_t size)
+{
+    const char *json;
+
+    if (t->mode == MRP_TRANSPORT_MODE_JSON) {
+        /* JSON transports hand us the already parsed object */
+        if ((json = mrp_json_object_to_string(data)) != NULL)
+            capture_record(t, MRP_CAPTURE_FRAME, json, strlen(json));
+    }
+    else
+        capture_record(t, MRP_CAPTURE_FRAME, data, size);
+}
+
+
+static void capture_close(mrp_transport_t *t)
+{
+    capture_record(t, MRP_CAPTURE_CLOSE, NULL, 0);
+    t->capture_id = 0;
+}
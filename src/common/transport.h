@@ -115,6 +115,9 @@ typedef enum {
     MRP_TRANSPORT_NONBLOCK  = 0x020,
     MRP_TRANSPORT_CLOEXEC   = 0x040,
     MRP_TRANSPORT_CONNECTED = 0x080,
+    MRP_TRANSPORT_ARENA     = 0x100,     /* decode into dispatch arena */
+    MRP_TRANSPORT_FREEZE    = 0x200,     /* freeze messages passed in-process */
+    MRP_TRANSPORT_COMPACT   = 0x400,     /* send compact-encoded messages */
     MRP_TRANSPORT_LISTENED  = 0x001,
 } mrp_transport_flag_t;
 
@@ -123,6 +126,91 @@ typedef enum {
 
 #define MRP_TRANSPORT_OPT_TYPEMAP "type-map"
 
+/*
+ * message encoding option for message-mode transports
+ *
+ * Takes a string, either MRP_TRANSPORT_ENCODING_DEFAULT or _COMPACT, and
+ * selects the encoding of outgoing generic messages. Incoming messages
+ * are always accepted in either encoding, and a transport receiving a
+ * compact message switches itself to compact encoding for its replies.
+ * Hence it is enough to select compact encoding on the connecting side,
+ * once it knows the peer understands it.
+ */
+
+#define MRP_TRANSPORT_OPT_ENCODING     "message-encoding"
+#define MRP_TRANSPORT_ENCODING_DEFAULT "default"
+#define MRP_TRANSPORT_ENCODING_COMPACT "compact"
+
+
+/*
+ * output queue options for stream transports
+ *
+ * Stream transports queue any data that cannot be written to the socket
+ * without blocking and flush the queue once the socket becomes writable.
+ * When the amount of queued data rises above the high watermark the
+ * transport is reported congested via the notification callback. Once
+ * it drains below the low watermark, the congestion is reported cleared.
+ * The watermarks take a pointer to a size_t, the notification option a
+ * pointer to an mrp_transport_outq_notify_t. Transports accepted on a
+ * listening transport inherit its output queue settings.
+ */
+
+#define MRP_TRANSPORT_OPT_OUTQ_HIGH   "outq-high-watermark"
+#define MRP_TRANSPORT_OPT_OUTQ_LOW    "outq-low-watermark"
+#define MRP_TRANSPORT_OPT_OUTQ_NOTIFY "outq-notify"
+
+/*
+ * output corking for stream transports
+ *
+ * With the cork option (a pointer to an int used as a boolean) set, a
+ * stream transport does not write messages out as they are sent. They
+ * are appended to the output queue instead, and everything sent during
+ * one mainloop iteration is flushed with a single writev from a deferred
+ * callback, ie. before the mainloop blocks again. Transports accepted on
+ * a listening transport inherit the setting.
+ */
+
+#define MRP_TRANSPORT_OPT_CORK "cork"
+
+/*
+ * listening options for stream transports
+ *
+ * The backlog option (a pointer to an int) overrides the backlog passed
+ * to mrp_transport_listen. If neither is given (ie. both are 0), the
+ * backlog defaults to SOMAXCONN. If the reuse-port option (a pointer
+ * to an int used as a boolean) is set before binding, a TCP transport
+ * is bound with SO_REUSEPORT, so several listening transports, for
+ * instance in mainloops of different threads or processes, can share
+ * the same address with the kernel distributing connections among them.
+ */
+
+#define MRP_TRANSPORT_OPT_BACKLOG   "listen-backlog"
+#define MRP_TRANSPORT_OPT_REUSEPORT "reuse-port"
+
+/*
+ * peer credentials
+ *
+ * Local connection-oriented transports (unix stream and seqpacket ones)
+ * capture the credentials of their peer once, when the connection is
+ * accepted. Authenticating requests on the connection can then use these
+ * instead of querying the socket over and over again. The label is the
+ * security (for instance Smack) label of the peer, or NULL if there is
+ * none.
+ */
+
+typedef struct {
+    pid_t  pid;                          /* peer process id */
+    uid_t  uid;                          /* peer user id */
+    gid_t  gid;                          /* peer group id */
+    char  *label;                        /* peer security label, or NULL */
+} mrp_transport_peer_t;
+
+typedef struct {
+    /** Output congestion set (@congested is TRUE) or cleared. */
+    void (*cb)(mrp_transport_t *t, int congested, void *user_data);
+    void  *user_data;                    /* opaque callback data */
+} mrp_transport_outq_notify_t;
+
 /*
  * transport requests
  *
@@ -165,6 +253,8 @@ typedef struct {
     int (*sendnative)(mrp_transport_t *t, void *data, uint32_t type_id);
     /** Send a JSON message over a (connected) transport. */
     int (*sendjson)(mrp_transport_t *t, mrp_json_t *msg);
+    /** Send a pre-encoded message over a (connected) transport. */
+    int (*sendencmsg)(mrp_transport_t *t, void *buf, size_t size);
 
     /** Send a message over a(n unconnected) transport. */
     int (*sendmsgto)(mrp_transport_t *t, mrp_msg_t *msg, mrp_sockaddr_t *addr,
@@ -184,6 +274,18 @@ typedef struct {
     /** Send a JSON messgae over a(n unconnected) transport. */
     int (*sendjsonto)(mrp_transport_t *t, mrp_json_t *msg, mrp_sockaddr_t *addr,
                       socklen_t addrlen);
+
+    /** Encode a message once for delivery to several destinations. */
+    void *(*encodemsg)(mrp_transport_t *t, mrp_msg_t *msg,
+                       mrp_sockaddr_t *addr, socklen_t addrlen);
+    /** Send an encoded message (to addr, or the peer if addr is NULL). */
+    int (*sendencoded)(mrp_transport_t *t, void *enc, mrp_sockaddr_t *addr,
+                       socklen_t addrlen);
+    /** Free a message encoded by encodemsg. */
+    void (*freeencoded)(void *enc);
+
+    /** Get the credentials of the peer of a connected transport. */
+    const mrp_transport_peer_t *(*peer)(mrp_transport_t *t);
 } mrp_transport_req_t;
 
 
@@ -279,11 +381,14 @@ typedef struct {
                                         size_t size,                      \
                                         mrp_sockaddr_t *addr,             \
                                         socklen_t addrlen);               \
+    void                  *(*steal_data)(mrp_transport_t *t, void *data,  \
+                                         size_t size);                    \
     void                    *user_data;                                   \
     mrp_typemap_t           *map;                                         \
     int                      flags;                                       \
     int                      mode;                                        \
     int                      busy;                                        \
+    uint32_t                 capture_id;                                  \
     int                      connected : 1;                               \
     int                      listened : 1;                                \
     int                      destroyed : 1                                \
@@ -413,7 +518,10 @@ struct mrp_transport_s {
 
 
 
-/** Automatically register a transport on startup. */
+/**
+ * Automatically register a transport on startup. Optional requests, for
+ * instance sendencmsg, can be given as trailing designated initializers.
+ */
 #define MRP_REGISTER_TRANSPORT(_prfx, _typename, _structtype, _resolve,   \
                                _open, _createfrom, _close, _setopt,       \
                                _bind, _listen, _accept,                   \
@@ -423,7 +531,7 @@ struct mrp_transport_s {
                                _senddata, _senddatato,                    \
                                _sendcustom, _sendcustomto,                \
                                _sendnative, _sendnativeto,                \
-                               _sendjson, _sendjsonto)                    \
+                               _sendjson, _sendjsonto, ...)               \
     static void _prfx##_register_transport(void)                          \
          __attribute__((constructor));                                    \
                                                                           \
@@ -454,6 +562,7 @@ struct mrp_transport_s {
                 .sendnativeto = _sendnativeto,                            \
                 .sendjson     = _sendjson,                                \
                 .sendjsonto   = _sendjsonto,                              \
+                ## __VA_ARGS__                                            \
             },                                                            \
         };                                                                \
                                                                           \
@@ -487,6 +596,13 @@ mrp_transport_t *mrp_transport_create_from(mrp_mainloop_t *ml, const char *type,
 /** Set a (possibly type-specific) transport option. */
 int mrp_transport_setopt(mrp_transport_t *t, const char *opt, const void *val);
 
+/** Encode a message for the given transport using its selected encoding. */
+ssize_t mrp_transport_encode(mrp_transport_t *t, mrp_msg_t *msg, void **bufp);
+
+/** Encode a message for the given transport into an I/O vector. */
+ssize_t mrp_transport_encode_iov(mrp_transport_t *t, mrp_msg_t *msg,
+                                 mrp_msg_iov_t *miov);
+
 /** Resolve an address string to a transport-specific address. */
 socklen_t mrp_transport_resolve(mrp_transport_t *t, const char *str,
                                 mrp_sockaddr_t *addr, socklen_t addrlen,
@@ -510,17 +626,35 @@ void mrp_transport_destroy(mrp_transport_t *t);
 int mrp_transport_connect(mrp_transport_t *t, mrp_sockaddr_t  *addr,
                           socklen_t addrlen);
 
+/** Get the credentials captured for the peer of an accepted transport. */
+const mrp_transport_peer_t *mrp_transport_peer(mrp_transport_t *t);
+
 /** Disconnect a transport. */
 int mrp_transport_disconnect(mrp_transport_t *t);
 
 /** Send a message through the given (connected) transport. */
 int mrp_transport_send(mrp_transport_t *t, mrp_msg_t *msg);
 
+/** Send a pre-encoded message template through the given transport. */
+int mrp_transport_sendtmpl(mrp_transport_t *t, mrp_msg_tmpl_t *tmpl);
+
+/**
+ * Send the same message through several (connected) transports. Transports
+ * that support it encode the message only once and reuse the encoded form
+ * for every destination. Returns the number of successful sends.
+ */
+int mrp_transport_sendmany(mrp_transport_t **ts, int nt, mrp_msg_t *msg);
+
+/** Send the same message through a transport to several remote addresses. */
+int mrp_transport_sendmanyto(mrp_transport_t *t, mrp_msg_t *msg,
+                             mrp_sockaddr_t *addrs, socklen_t *addrlens,
+                             int naddr);
+
 /** Send a message through the given transport to the remote address. */
 int mrp_transport_sendto(mrp_transport_t *t, mrp_msg_t *msg,
                          mrp_sockaddr_t *addr, socklen_t addrlen);
 
-/** Send raw data through the given (connected) transport. */
+/** Send raw (or pre-encoded custom) data through the given transport. */
 int mrp_transport_sendraw(mrp_transport_t *t, void *data, size_t size);
 
 /** Send raw data through the given transport to the remote address. */
@@ -554,6 +688,25 @@ int mrp_transport_sendjson(mrp_transport_t *t, mrp_json_t *msg);
 /** Send a JSON message through the given transport to the remote address. */
 int mrp_transport_sendjsonto(mrp_transport_t *t, mrp_json_t *msg,
                              mrp_sockaddr_t *addr, socklen_t addrlen);
+
+/*
+ * traffic capture
+ *
+ * While capturing, every frame received on an accepted connection is
+ * recorded with a timestamp to a capture file (cf. transport-capture.h),
+ * which murphy-replay can re-drive against a daemon. Capturing can also
+ * be turned on by setting MRP_TRANSPORT_CAPTURE_ENVVAR to the path of the
+ * capture file.
+ */
+
+#define MRP_TRANSPORT_CAPTURE_ENVVAR "__MURPHY_TRANSPORT_CAPTURE"
+
+/** Start capturing inbound traffic to the given file. */
+int mrp_transport_capture_start(const char *path);
+
+/** Stop capturing inbound traffic. */
+void mrp_transport_capture_stop(void);
+
 MRP_CDECL_END
 
 #endif /* __MURPHY_TRANSPORT_H__ */
@@ -32,11 +32,15 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <stdarg.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/auxv.h>
 
+#include <murphy/common/macros.h>
 #include <murphy/common/log.h>
 #include <murphy/common/utils.h>
 
@@ -191,6 +195,148 @@ int mrp_daemonize(const char *dir, const char *new_out, const char *new_err)
 }
 
 
+/*
+ * wyhash-style hashing
+ *
+ * Input is consumed with 64-bit loads and folded in with 64x64->128-bit
+ * multiplications. Long inputs are processed 48 bytes at a time in three
+ * independent lanes, so the multiplications can overlap in the pipeline.
+ */
+
+#define HASH_P0 0xa0761d6478bd642fULL
+#define HASH_P1 0xe7037ed1a0b428dbULL
+#define HASH_P2 0x8ebc6af09c88c6e3ULL
+#define HASH_P3 0x589965cc75374cc3ULL
+
+static uint64_t hash_seed = HASH_P3;
+
+
+static inline void hash_mum(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)*a * *b;
+
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t  = rl + (rm0 << 32), c = t < rl, lo, hi;
+
+    lo  = t + (rm1 << 32);
+    c  += lo < t;
+    hi  = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    *a  = lo;
+    *b  = hi;
+#endif
+}
+
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b)
+{
+    hash_mum(&a, &b);
+
+    return a ^ b;
+}
+
+
+static inline uint64_t hash_r8(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+
+    return v;
+}
+
+
+static inline uint64_t hash_r4(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+
+    return v;
+}
+
+
+uint64_t mrp_hash_bytes(const void *data, size_t size, uint64_t seed)
+{
+    const uint8_t *p = data;
+    uint64_t       a, b, s1, s2;
+    size_t         i;
+
+    seed ^= hash_mix(seed ^ HASH_P0, HASH_P1);
+
+    if (MRP_LIKELY(size <= 16)) {
+        if (size >= 4) {
+            i = (size >> 3) << 2;
+            a = (hash_r4(p) << 32) | hash_r4(p + i);
+            b = (hash_r4(p + size - 4) << 32) | hash_r4(p + size - 4 - i);
+        }
+        else if (size > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[size >> 1] << 8) |
+                p[size - 1];
+            b = 0;
+        }
+        else
+            a = b = 0;
+    }
+    else {
+        i = size;
+
+        if (i > 48) {
+            s1 = s2 = seed;
+
+            do {
+                seed = hash_mix(hash_r8(p)      ^ HASH_P1, hash_r8(p +  8) ^ seed);
+                s1   = hash_mix(hash_r8(p + 16) ^ HASH_P2, hash_r8(p + 24) ^ s1);
+                s2   = hash_mix(hash_r8(p + 32) ^ HASH_P3, hash_r8(p + 40) ^ s2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+
+            seed ^= s1 ^ s2;
+        }
+
+        while (i > 16) {
+            seed = hash_mix(hash_r8(p) ^ HASH_P1, hash_r8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+
+        a = hash_r8(p + i - 16);
+        b = hash_r8(p + i - 8);
+    }
+
+    a ^= HASH_P1;
+    b ^= seed;
+    hash_mum(&a, &b);
+
+    return hash_mix(a ^ HASH_P0 ^ size, b ^ HASH_P1);
+}
+
+
+uint64_t mrp_hash_seed(void)
+{
+    return hash_seed;
+}
+
+
+static void MRP_INIT init_hash_seed(void)
+{
+    const uint8_t *rnd = (const uint8_t *)getauxval(AT_RANDOM);
+    uint64_t       s;
+
+    if (rnd != NULL)
+        memcpy(&s, rnd + 8, sizeof(s));
+    else
+        s = (uint64_t)getpid() ^ (uint64_t)(uintptr_t)&s;
+
+    hash_seed = hash_mix(s ^ HASH_P0, HASH_P2);
+}
+
+
 int mrp_string_comp(const void *key1, const void *key2)
 {
     return strcmp(key1, key2);
@@ -199,13 +345,33 @@ int mrp_string_comp(const void *key1, const void *key2)
 
 uint32_t mrp_string_hash(const void *key)
 {
-    uint32_t    h;
-    const char *p;
+    return (uint32_t)mrp_hash_bytes(key, strlen(key), hash_seed);
+}
 
-    for (h = 0, p = key; *p; p++) {
-        h <<= 1;
-        h  ^= *p;
-    }
 
-    return h;
+int mrp_string_casecomp(const void *key1, const void *key2)
+{
+    return strcasecmp(key1, key2);
+}
+
+
+uint32_t mrp_string_casehash(const void *key)
+{
+    const char *p = key;
+    char        buf[64];
+    uint64_t    h;
+    size_t      n;
+
+    /* hash case-folded chunks, chaining each chunk into the seed */
+    h = hash_seed;
+
+    do {
+        for (n = 0; n < sizeof(buf) && p[n]; n++)
+            buf[n] = tolower((unsigned char)p[n]);
+
+        h  = mrp_hash_bytes(buf, n, h);
+        p += n;
+    } while (n == sizeof(buf));
+
+    return (uint32_t)h;
 }
@@ -30,11 +30,25 @@
 #ifndef __MURPHY_UTILS_H__
 #define __MURPHY_UTILS_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
 int mrp_daemonize(const char *dir, const char *new_out, const char *new_err);
 
+/*
+ * Hash size bytes of data. This is a wyhash-style multiply-mix hash
+ * which uses every byte of the input. The per-process seed is picked
+ * randomly at startup, so hash values must not be stored or sent to
+ * other processes.
+ */
+uint64_t mrp_hash_bytes(const void *data, size_t size, uint64_t seed);
+uint64_t mrp_hash_seed(void);
+
 int mrp_string_comp(const void *key1, const void *key2);
 uint32_t mrp_string_hash(const void *key);
 
+/* case-insensitive variants of the above, for case-folded name indices */
+int mrp_string_casecomp(const void *key1, const void *key2);
+uint32_t mrp_string_casehash(const void *key);
+
 #endif /* __MURPHY_UTILS_H__ */
@@ -89,6 +89,24 @@ int mrp_websock_send(mrp_websock_t *sck, void *payload, size_t size)
 }
 
 
+void *mrp_websock_alloc_payload(size_t size)
+{
+    return wsl_alloc_payload(size);
+}
+
+
+void mrp_websock_free_payload(void *payload)
+{
+    wsl_free_payload(payload);
+}
+
+
+int mrp_websock_send_payload(mrp_websock_t *sck, void *payload, size_t size)
+{
+    return wsl_send_payload(sck, payload, size);
+}
+
+
 int mrp_websock_server_http_file(mrp_websock_t *sck, const char *path,
                                  const char *mime)
 {
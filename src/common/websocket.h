@@ -103,6 +103,15 @@ void *mrp_websock_close(mrp_websock_t *sck);
 /** Send data over a connected websocket. */
 int mrp_websock_send(mrp_websock_t *sck, void *payload, size_t size);
 
+/** Allocate a buffer for a payload of at most size bytes. */
+void *mrp_websock_alloc_payload(size_t size);
+
+/** Free an unsent payload buffer. */
+void mrp_websock_free_payload(void *payload);
+
+/** Send a buffer from mrp_websock_alloc_payload without copying it. */
+int mrp_websock_send_payload(mrp_websock_t *sck, void *payload, size_t size);
+
 /** Serve the given file, with MIME type, over the given websocket. */
 int mrp_websock_server_http_file(mrp_websock_t *sck, const char *path,
                                  const char *mime);
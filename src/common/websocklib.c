@@ -27,9 +27,14 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
@@ -42,6 +47,7 @@
 #include <murphy/common/mainloop.h>
 #include <murphy/common/fragbuf.h>
 #include <murphy/common/hashtbl.h>
+#include <murphy/common/utils.h>
 
 #include "websocklib.h"
 
@@ -132,13 +138,15 @@ struct wsl_ctx_s {
     int              epollfd;             /* epoll descriptor */
     mrp_io_watch_t  *w;                   /* I/O watch for epollfd */
     mrp_mainloop_t  *ml;                  /* pumping mainloop */
-    pollfd_t        *fds;                 /* polled descriptors */
+    pollfd_t        *fds;                 /* polled descriptors, by fd */
+    int              nfdtbl;              /* size of fds */
     int              nfd;                 /* number descriptors */
     void            *user_data;           /* opaque user data */
     lws_t           *pending;             /* pending connection */
     void            *pending_user;        /* user_data of pending */
     wsl_proto_t     *pending_proto;       /* protocol of pending */
     mrp_list_hook_t  pure_http;           /* pure HTTP sockets */
+    int              deflate;             /* accept compression extensions */
 };
 
 /*
@@ -157,9 +165,25 @@ struct wsl_sck_s {
     int              pure_http : 1;      /* pure HTTP socket */
     int              busy;               /* upper-layer callback(s) active */
     mrp_list_hook_t  hook;               /* to pure HTTP list, if such */
+    mrp_list_hook_t  outq;               /* queued outgoing payloads */
 };
 
 
+/*
+ * a payload buffer with room for libwebsockets padding and our framing
+ */
+
+typedef struct {
+    mrp_list_hook_t  hook;               /* to socket output queue */
+    size_t           room;               /* allocated payload size */
+    size_t           size;               /* actual payload size */
+    unsigned char    data[0];            /* padding, frame length, payload */
+} wsl_buf_t;
+
+#define WSL_BUF_HEAD (LWS_SEND_BUFFER_PRE_PADDING + sizeof(uint32_t))
+#define WSL_BUF_TAIL (LWS_SEND_BUFFER_POST_PADDING)
+
+
 /*
  * mark a socket busy while executing a piece of code
  */
@@ -177,6 +201,8 @@ static int http_event(lws_ctx_t *ws_ctx, lws_t *ws, lws_event_t event,
 static int wsl_event(lws_ctx_t *ws_ctx, lws_t *ws, lws_event_t event,
                      void *user, void *in, size_t len);
 static void destroy_context(wsl_ctx_t *ctx);
+static void purge_output(wsl_sck_t *sck);
+static int drain_output(wsl_sck_t *sck);
 
 static void MRP_EXIT destroy_context_table(void);
 
@@ -209,25 +235,53 @@ static inline short map_event_to_poll(uint32_t in)
 }
 
 
+/*
+ * Descriptors are small integers, so we keep them in a table indexed
+ * directly by the fd. Unused slots have an fd of -1.
+ */
+
+static int grow_fds(wsl_ctx_t *wsc, int fd)
+{
+    int size, i;
+
+    if (fd < wsc->nfdtbl)
+        return TRUE;
+
+    for (size = wsc->nfdtbl ? wsc->nfdtbl : 16; size <= fd; size *= 2)
+        ;
+
+    if (mrp_realloc(wsc->fds, size * sizeof(*wsc->fds)) == NULL)
+        return FALSE;
+
+    for (i = wsc->nfdtbl; i < size; i++) {
+        wsc->fds[i].fd     = -1;
+        wsc->fds[i].events = 0;
+    }
+
+    wsc->nfdtbl = size;
+
+    return TRUE;
+}
+
+
 static int add_fd(wsl_ctx_t *wsc, int fd, int events)
 {
     struct epoll_event e;
 
-    if (wsc != NULL) {
+    if (wsc != NULL && fd >= 0) {
         e.data.u64 = 0;
         e.data.fd  = fd;
         e.events   = map_poll_to_event(events);
 
+        if (!grow_fds(wsc, fd))
+            return FALSE;
+
         if (epoll_ctl(wsc->epollfd, EPOLL_CTL_ADD, fd, &e) == 0) {
-            if (mrp_reallocz(wsc->fds, wsc->nfd, wsc->nfd + 1) != NULL) {
-                wsc->fds[wsc->nfd].fd     = fd;
-                wsc->fds[wsc->nfd].events = e.events;
-                wsc->nfd++;
+            wsc->fds[fd].fd     = fd;
+            wsc->fds[fd].events = e.events;
+            wsc->nfd++;
 
-                return TRUE;
-            }
-            else
-                epoll_ctl(wsc->epollfd, EPOLL_CTL_DEL, fd, &e);
+            return TRUE;
         }
     }
 
@@ -238,7 +292,6 @@ static int add_fd(wsl_ctx_t *wsc, int fd, int events)
 static int del_fd(wsl_ctx_t *wsc, int fd)
 {
     struct epoll_event e;
-    int                i;
 
     if (wsc != NULL) {
         e.data.u64 = 0;
@@ -246,17 +299,12 @@ static int del_fd(wsl_ctx_t *wsc, int fd)
         e.events   = 0;
         epoll_ctl(wsc->epollfd, EPOLL_CTL_DEL, fd, &e);
 
-        for (i = 0; i < wsc->nfd; i++) {
-            if (wsc->fds[i].fd == fd) {
-                if (i < wsc->nfd - 1)
-                    memmove(wsc->fds + i, wsc->fds + i + 1,
-                            (wsc->nfd - i - 1) * sizeof(*wsc->fds));
-
-                mrp_reallocz(wsc->fds, wsc->nfd, wsc->nfd - 1);
-                wsc->nfd--;
+        if (fd >= 0 && fd < wsc->nfdtbl && wsc->fds[fd].fd == fd) {
+            wsc->fds[fd].fd     = -1;
+            wsc->fds[fd].events = 0;
+            wsc->nfd--;
 
-                return TRUE;
-            }
+            return TRUE;
         }
     }
 
@@ -266,13 +314,8 @@ static int del_fd(wsl_ctx_t *wsc, int fd)
 
 static pollfd_t *find_fd(wsl_ctx_t *wsc, int fd)
 {
-    int i;
-
-    if (wsc != NULL) {
-        for (i = 0; i < wsc->nfd; i++)
-            if (wsc->fds[i].fd == fd)
-                return wsc->fds + i;
-    }
+    if (wsc != NULL && fd >= 0 && fd < wsc->nfdtbl && wsc->fds[fd].fd == fd)
+        return wsc->fds + fd;
 
     return NULL;
 }
@@ -317,8 +360,9 @@ static void purge_fds(wsl_ctx_t *wsc)
 {
     if (wsc != NULL) {
         mrp_free(wsc->fds);
-        wsc->fds = NULL;
-        wsc->nfd = 0;
+        wsc->fds    = NULL;
+        wsc->nfdtbl = 0;
+        wsc->nfd    = 0;
     }
 }
 
@@ -571,6 +615,33 @@ static lws_ctx_t *lws_create_ctx(lws_cci_t *cci)
 
 #endif /* !WEBSOCKETS_OLD */
 
+static int deflate_extension(const char *name)
+{
+    /*
+     * Notes:
+     *     We only let through the per-message/per-frame compression
+     *     extensions. The old deflate-stream extension compresses the
+     *     whole stream, including control frames, and is deprecated.
+     */
+    static const char *deflate[] = {
+        "permessage-deflate",
+        "deflate-frame",
+        "x-webkit-deflate-frame",
+        NULL
+    };
+    const char **n;
+
+    if (name == NULL)
+        return FALSE;
+
+    for (n = deflate; *n != NULL; n++)
+        if (!strcmp(*n, name))
+            return TRUE;
+
+    return FALSE;
+}
+
+
 static lws_ext_t *lws_get_internal_extensions(void)
 {
 #ifdef WEBSOCKETS_QUERY_EXTENSIONS
@@ -685,8 +756,9 @@ wsl_ctx_t *wsl_create_context(mrp_mainloop_t *ml, wsl_ctx_cfg_t *cfg)
     mrp_refcnt_init(&ctx->refcnt);
     mrp_list_init(&ctx->pure_http);
 
-    ctx->protos = cfg->protos;
-    ctx->nproto = cfg->nproto;
+    ctx->protos  = cfg->protos;
+    ctx->nproto  = cfg->nproto;
+    ctx->deflate = cfg->deflate;
 
     if (!strcmp(cfg->protos[0].name, "http") ||
         !strcmp(cfg->protos[0].name, "http-only"))
@@ -925,6 +997,7 @@ wsl_sck_t *wsl_connect(wsl_ctx_t *ctx, struct sockaddr *sa,
          */
 
         mrp_list_init(&sck->hook);
+        mrp_list_init(&sck->outq);
         sck->ctx   = wsl_ref_context(ctx);
         sck->proto = up;
         sck->buf   = mrp_fragbuf_create(/*up->framed*/TRUE, 0);
@@ -976,6 +1049,7 @@ wsl_sck_t *wsl_accept_pending(wsl_ctx_t *ctx, void *user_data)
 
     if (sck != NULL) {
         mrp_list_init(&sck->hook);
+        mrp_list_init(&sck->outq);
 
         /*
          * Notes:
@@ -1076,6 +1150,8 @@ void *wsl_close(wsl_sck_t *sck)
             mrp_fragbuf_destroy(sck->buf);
             sck->buf = NULL;
 
+            purge_output(sck);
+
             mrp_debug("freeing websocket %p", sck);
             mrp_free(sck);
         }
@@ -1150,6 +1226,8 @@ void *wsl_close(wsl_sck_t *sck)
             mrp_fragbuf_destroy(sck->buf);
             sck->buf = NULL;
 
+            purge_output(sck);
+
             mrp_debug("freeing websocket %p", sck);
             mrp_free(sck);
 
@@ -1197,50 +1275,569 @@ int wsl_set_sendmode(wsl_sck_t *sck, wsl_sendmode_t mode)
 }
 
 
-int wsl_send(wsl_sck_t *sck, void *payload, size_t size)
+static inline wsl_buf_t *payload_buf(void *payload)
+{
+    return (wsl_buf_t *)((unsigned char *)payload - WSL_BUF_HEAD -
+                         MRP_OFFSET(wsl_buf_t, data));
+}
+
+
+void *wsl_alloc_payload(size_t size)
+{
+    wsl_buf_t *b;
+
+    b = mrp_alloc(sizeof(*b) + WSL_BUF_HEAD + size + WSL_BUF_TAIL);
+
+    if (b == NULL)
+        return NULL;
+
+    mrp_list_init(&b->hook);
+    b->room = size;
+    b->size = 0;
+
+    return b->data + WSL_BUF_HEAD;
+}
+
+
+void wsl_free_payload(void *payload)
+{
+    if (payload != NULL)
+        mrp_free(payload_buf(payload));
+}
+
+
+static inline int pipe_choked(wsl_sck_t *sck)
 {
-    unsigned char *buf;
-    size_t         pre, post, total;
+#ifdef WEBSOCKETS_PIPE_CHOKED
+    return libwebsocket_send_pipe_choked(sck->sck);
+#else
+    MRP_UNUSED(sck);
+    return FALSE;
+#endif
+}
+
+
+static int write_buf(wsl_sck_t *sck, wsl_buf_t *b)
+{
+    unsigned char *p;
     uint32_t      *len;
+    size_t         total;
 
-    if (sck != NULL && sck->sck != NULL) {
-        if (sck->proto->framed) {
-            pre  = LWS_SEND_BUFFER_PRE_PADDING;
-            post = LWS_SEND_BUFFER_POST_PADDING;
-            buf  = alloca(pre + sizeof(*len) + size + post);
-            len  = (uint32_t *)(buf + pre);
-            *len = htobe32(size);
+    if (sck->proto->framed) {
+        p     = b->data + LWS_SEND_BUFFER_PRE_PADDING;
+        len   = (uint32_t *)p;
+        *len  = htobe32(b->size);
+        total = sizeof(*len) + b->size;
+    }
+    else {
+        p     = b->data + WSL_BUF_HEAD;
+        total = b->size;
+    }
 
-            memcpy(buf + pre + sizeof(*len), payload, size);
-            total = sizeof(*len) + size;
+#if (WSL_SEND_TEXT != 0)
+    if (!sck->send_mode)
+        sck->send_mode = WSL_SEND_TEXT;
+#endif
+
+    return libwebsocket_write(sck->sck, p, total, sck->send_mode) >= 0;
+}
+
+
+int wsl_send_payload(wsl_sck_t *sck, void *payload, size_t size)
+{
+    wsl_buf_t *b;
+    int        success;
+
+    if (payload == NULL)
+        return FALSE;
+
+    b = payload_buf(payload);
+
+    if (sck == NULL || sck->sck == NULL || size > b->room) {
+        mrp_free(b);
+        return FALSE;
+    }
+
+    b->size = size;
+
+    /*
+     * Notes:
+     *     If the socket cannot take more data right now, or there is
+     *     already data waiting to be sent, we queue the payload and
+     *     send it once libwebsockets tells us the socket is writeable.
+     *     Sending right away would reorder or drop messages.
+     */
+
+    if (!mrp_list_empty(&sck->outq) || pipe_choked(sck)) {
+        mrp_debug("queuing %zu bytes for websocket %p/%p", size, sck,
+                  sck->sck);
+        mrp_list_append(&sck->outq, &b->hook);
+        libwebsocket_callback_on_writable(sck->ctx->ctx, sck->sck);
+
+        return TRUE;
+    }
+
+    success = write_buf(sck, b);
+    mrp_free(b);
+
+    return success;
+}
+
+
+static int drain_output(wsl_sck_t *sck)
+{
+    mrp_list_hook_t *p, *n;
+    wsl_buf_t       *b;
+
+    mrp_list_foreach(&sck->outq, p, n) {
+        if (pipe_choked(sck)) {
+            libwebsocket_callback_on_writable(sck->ctx->ctx, sck->sck);
+            break;
         }
-        else {
-            pre  = LWS_SEND_BUFFER_PRE_PADDING;
-            post = LWS_SEND_BUFFER_POST_PADDING;
-            buf  = alloca(pre + size + post);
 
-            memcpy(buf + pre, payload, size);
-            total = size;
+        b = mrp_list_entry(p, typeof(*b), hook);
+        mrp_list_delete(&b->hook);
+
+        if (!write_buf(sck, b)) {
+            mrp_log_error("failed to send queued data on websocket %p/%p",
+                          sck, sck->sck);
+            mrp_free(b);
+            purge_output(sck);
+
+            return FALSE;
         }
 
-#if (WSL_SEND_TEXT != 0)
-        if (!sck->send_mode)
-            sck->send_mode = WSL_SEND_TEXT;
+        mrp_free(b);
+    }
+
+    return TRUE;
+}
+
+
+static void purge_output(wsl_sck_t *sck)
+{
+    mrp_list_hook_t *p, *n;
+    wsl_buf_t       *b;
+
+    mrp_list_foreach(&sck->outq, p, n) {
+        b = mrp_list_entry(p, typeof(*b), hook);
+        mrp_list_delete(&b->hook);
+        mrp_free(b);
+    }
+}
+
+
+int wsl_send(wsl_sck_t *sck, void *payload, size_t size)
+{
+    void *buf;
+
+    if (sck == NULL || sck->sck == NULL)
+        return FALSE;
+
+    if ((buf = wsl_alloc_payload(size)) == NULL)
+        return FALSE;
+
+    memcpy(buf, payload, size);
+
+    return wsl_send_payload(sck, buf, size);
+}
+
+
+#ifndef WEBSOCKETS_OLD
+
+/*
+ * static file cache
+ *
+ * HTTP clients, most notably browsers running the WRT resource client,
+ * keep fetching the same handful of small static files, typically all
+ * of them at once while the system is booting. To avoid going to the
+ * disk for each of these we keep the full response for small files in
+ * memory, keyed by the path of the file served. Entries are validated
+ * against the file with a stat(2) per request, and carry an entity tag
+ * derived from the identity of the file so clients can revalidate with
+ * If-None-Match. If a precompressed (.br or .gz) sibling of a file
+ * exists and the client accepts that encoding, we serve the sibling
+ * instead. Anything too large for the cache is left for libwebsockets
+ * to stream as before.
+ */
+
+#define FILE_CACHE_MAXFILE (64 * 1024)   /* max. size of a cached file */
+#define FILE_CACHE_MAXSIZE (1024 * 1024) /* max. total size of the cache */
+
+#ifdef WEBSOCKETS_HTTP_HEADERS
+#    define HDR_ACCEPT_ENCODING WSI_TOKEN_HTTP_ACCEPT_ENCODING
+#    define HDR_IF_NONE_MATCH   WSI_TOKEN_HTTP_IF_NONE_MATCH
+#else
+#    define HDR_ACCEPT_ENCODING 0
+#    define HDR_IF_NONE_MATCH   0
 #endif
 
-        if (libwebsocket_write(sck->sck, buf + pre, total, sck->send_mode) >= 0)
-            return TRUE;
+typedef struct {
+    char   *path;                        /* path of the cached file */
+    char   *rsp;                         /* full response, header and body */
+    size_t  size;                        /* response size */
+    dev_t   dev;                         /* device of the cached file */
+    ino_t   ino;                         /* inode of the cached file */
+    off_t   fsize;                       /* size of the cached file */
+    time_t  mtime;                       /* modification time of the file */
+    char    etag[64];                    /* entity tag for the file */
+} file_entry_t;
+
+
+static struct {
+    const char *suffix;                  /* suffix of precompressed sibling */
+    const char *encoding;                /* content encoding of sibling */
+} file_variants[] = {
+    { ".br", "br"   },
+    { ".gz", "gzip" },
+    { ""   , NULL   },
+};
+
+
+static mrp_htbl_t *filetbl;
+static size_t      filetbl_size;
+
+static void MRP_EXIT destroy_file_cache(void);
+
+
+static void free_file_entry(void *key, void *object)
+{
+    file_entry_t *e = (file_entry_t *)object;
+
+    MRP_UNUSED(key);
+
+    filetbl_size -= e->size;
+
+    mrp_free(e->path);
+    mrp_free(e->rsp);
+    mrp_free(e);
+}
+
+
+static int create_file_cache(void)
+{
+    mrp_htbl_config_t hcfg;
+
+    if (filetbl == NULL) {
+        mrp_clear(&hcfg);
+
+        hcfg.comp = mrp_string_comp;
+        hcfg.hash = mrp_string_hash;
+        hcfg.free = free_file_entry;
+
+        filetbl = mrp_htbl_create(&hcfg);
+    }
+
+    return (filetbl != NULL);
+}
+
+
+static void destroy_file_cache(void)
+{
+    if (filetbl != NULL) {
+        mrp_htbl_destroy(filetbl, TRUE);
+        filetbl = NULL;
+    }
+}
+
+
+static void get_http_header(lws_t *ws, int hdr, char *buf, int size)
+{
+#ifdef WEBSOCKETS_HTTP_HEADERS
+    if (lws_hdr_copy(ws, buf, size, hdr) < 0)
+        buf[0] = '\0';
+#else
+    MRP_UNUSED(ws);
+    MRP_UNUSED(hdr);
+    MRP_UNUSED(size);
+
+    buf[0] = '\0';
+#endif
+}
+
+
+static int accepts_encoding(const char *accept, const char *encoding)
+{
+    const char *p, *e;
+    size_t      len;
+
+    len = strlen(encoding);
+    p   = accept;
+
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            p++;
+
+        e = p;
+        while (*e && *e != ',' && *e != ';' && *e != ' ')
+            e++;
+
+        if ((size_t)(e - p) == len && !strncasecmp(p, encoding, len)) {
+            while (*e == ' ')
+                e++;
+
+            if (*e != ';')
+                return TRUE;
+
+            /* reject explicitly unacceptable (q=0) encodings */
+            e++;
+            while (*e == ' ')
+                e++;
+
+            if (strncmp(e, "q=0", 3))
+                return TRUE;
+
+            for (e += 3; *e == '.' || *e == '0'; e++)
+                ;
+
+            return (*e >= '1' && *e <= '9');
+        }
+
+        while (*e && *e != ',')
+            e++;
+        p = e;
     }
 
     return FALSE;
 }
 
 
+static int etag_matches(const char *inm, const char *etag)
+{
+    const char *p;
+
+    if (!*inm)
+        return FALSE;
+
+    if (inm[0] == '*' && inm[1] == '\0')
+        return TRUE;
+
+    /* the tag itself is quoted, so a plain substring match is enough */
+    p = strstr(inm, etag);
+
+    return (p != NULL);
+}
+
+
+static file_entry_t *load_file(const char *path, const char *type,
+                               const char *encoding)
+{
+    file_entry_t *e;
+    struct stat   st;
+    char          hdr[512], etag[64];
+    int           fd, hlen;
+    ssize_t       n;
+    size_t        size, offs;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return NULL;
+
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+        st.st_size > FILE_CACHE_MAXFILE) {
+        close(fd);
+        return NULL;
+    }
+
+    size = (size_t)st.st_size;
+
+    snprintf(etag, sizeof(etag), "\"%lx-%lx-%lx\"", (unsigned long)st.st_ino,
+             (unsigned long)st.st_size, (unsigned long)st.st_mtime);
+
+    hlen = snprintf(hdr, sizeof(hdr),
+                    "HTTP/1.1 200 OK\r\n"
+                    "Server: murphy\r\n"
+                    "Content-Type: %s\r\n"
+                    "Content-Length: %zu\r\n"
+                    "%s%s%s"
+                    "ETag: %s\r\n"
+                    "Vary: Accept-Encoding\r\n"
+                    "Connection: close\r\n"
+                    "\r\n", type, size,
+                    encoding ? "Content-Encoding: " : "",
+                    encoding ? encoding : "", encoding ? "\r\n" : "",
+                    etag);
+
+    if (hlen < 0 || hlen >= (int)sizeof(hdr)) {
+        close(fd);
+        return NULL;
+    }
+
+    e = mrp_allocz(sizeof(*e));
+
+    if (e == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    e->path  = mrp_strdup(path);
+    e->rsp   = mrp_alloc(hlen + size);
+    e->size  = hlen + size;
+    e->dev   = st.st_dev;
+    e->ino   = st.st_ino;
+    e->fsize = st.st_size;
+    e->mtime = st.st_mtime;
+    strcpy(e->etag, etag);
+
+    if (e->path == NULL || e->rsp == NULL)
+        goto fail;
+
+    memcpy(e->rsp, hdr, hlen);
+
+    for (offs = 0; offs < size; offs += n) {
+        n = read(fd, e->rsp + hlen + offs, size - offs);
+
+        if (n < 0 && errno == EINTR) {
+            n = 0;
+            continue;
+        }
+
+        if (n <= 0)
+            goto fail;
+    }
+
+    close(fd);
+
+    return e;
+
+ fail:
+    close(fd);
+    mrp_free(e->path);
+    mrp_free(e->rsp);
+    mrp_free(e);
+
+    return NULL;
+}
+
+
+static file_entry_t *lookup_file(const char *path, struct stat *st,
+                                 const char *type, const char *encoding)
+{
+    file_entry_t *e;
+
+    if (!create_file_cache())
+        return NULL;
+
+    e = mrp_htbl_lookup(filetbl, (void *)path);
+
+    if (e != NULL) {
+        if (e->dev == st->st_dev && e->ino == st->st_ino &&
+            e->fsize == st->st_size && e->mtime == st->st_mtime)
+            return e;
+
+        mrp_debug("cached file '%s' has changed, reloading", path);
+        mrp_htbl_remove(filetbl, (void *)path, TRUE);
+    }
+
+    if ((e = load_file(path, type, encoding)) == NULL)
+        return NULL;
+
+    /* simply start over once the cache would grow too large */
+    if (filetbl_size + e->size > FILE_CACHE_MAXSIZE) {
+        mrp_debug("HTTP file cache full, flushing it");
+        mrp_htbl_reset(filetbl, TRUE);
+    }
+
+    if (!mrp_htbl_insert(filetbl, e->path, e)) {
+        e->size = 0;
+        free_file_entry(e->path, e);
+        return NULL;
+    }
+
+    filetbl_size += e->size;
+
+    return e;
+}
+
+
+/*
+ * Try to serve a file from the cache. Returns TRUE if the request was
+ * answered, FALSE if the file should be left for libwebsockets to serve.
+ */
+
+static int serve_cached_file(wsl_sck_t *sck, const char *path,
+                             const char *type)
+{
+    wsl_proto_t  *up;
+    file_entry_t *e;
+    struct stat   st;
+    char          accept[256], inm[256], vpath[PATH_MAX], rsp[256];
+    const char   *encoding;
+    size_t        i, n;
+    int           len;
+
+    get_http_header(sck->sck, HDR_ACCEPT_ENCODING, accept, sizeof(accept));
+    get_http_header(sck->sck, HDR_IF_NONE_MATCH, inm, sizeof(inm));
+
+    for (i = 0; i < MRP_ARRAY_SIZE(file_variants); i++) {
+        encoding = file_variants[i].encoding;
+
+        if (encoding != NULL && !accepts_encoding(accept, encoding))
+            continue;
+
+        n = snprintf(vpath, sizeof(vpath), "%s%s", path,
+                     file_variants[i].suffix);
+
+        if (n >= sizeof(vpath))
+            continue;
+
+        if (stat(vpath, &st) == 0 && S_ISREG(st.st_mode))
+            break;
+    }
+
+    if (i >= MRP_ARRAY_SIZE(file_variants) || st.st_size > FILE_CACHE_MAXFILE)
+        return FALSE;
+
+    if ((e = lookup_file(vpath, &st, type, encoding)) == NULL)
+        return FALSE;
+
+    if (etag_matches(inm, e->etag)) {
+        mrp_debug("'%s' not modified, etag %s", vpath, e->etag);
+
+        len = snprintf(rsp, sizeof(rsp),
+                       "HTTP/1.1 304 Not Modified\r\n"
+                       "Server: murphy\r\n"
+                       "ETag: %s\r\n"
+                       "Vary: Accept-Encoding\r\n"
+                       "Connection: close\r\n"
+                       "\r\n", e->etag);
+
+        if (libwebsocket_write(sck->sck, (unsigned char *)rsp, len,
+                               LWS_WRITE_HTTP) < 0)
+            return FALSE;
+    }
+    else {
+        mrp_debug("serving '%s' from cache", vpath);
+
+        if (libwebsocket_write(sck->sck, (unsigned char *)e->rsp, e->size,
+                               LWS_WRITE_HTTP) < 0)
+            return FALSE;
+    }
+
+    /* emulate the completion event libwebsockets would have given us */
+    up = sck->proto;
+
+    if (up != NULL && up->cbs.http_done != NULL) {
+        SOCKET_BUSY_REGION(sck, {
+                up->cbs.http_done(sck, path, sck->user_data, up->proto_data);
+            });
+
+        check_closed(sck);
+    }
+
+    return TRUE;
+}
+
+#endif /* !WEBSOCKETS_OLD */
+
+
 int wsl_serve_http_file(wsl_sck_t *sck, const char *path, const char *type)
 {
     mrp_debug("serving file '%s' (%s) over websocket %p", path, type, sck->sck);
 
 #ifndef WEBSOCKETS_OLD
+    if (serve_cached_file(sck, path, type))
+        return TRUE;
+
 #  ifdef WEBSOCKETS_SERVE_FILE_EXTRAARG
     if (libwebsockets_serve_http_file(sck->ctx->ctx, sck->sck, path,
                                       type, NULL) == 0)
@@ -1665,13 +2262,21 @@ static int http_event(lws_ctx_t *ws_ctx, lws_t *ws, lws_event_t event,
 
     case LWS_CALLBACK_CONFIRM_EXTENSION_OKAY:
         ext = (const char *)in;
-        /* deny all extensions on the server side */
+        /* only allow compression on the server side, if enabled */
+        if (ctx != NULL && ctx->deflate && deflate_extension(ext)) {
+            mrp_debug("accepting server extension '%s'", ext);
+            return LWS_EVENT_OK;
+        }
         mrp_debug("denying server extension '%s'", ext);
         return LWS_EVENT_DENY;
 
     case LWS_CALLBACK_CLIENT_CONFIRM_EXTENSION_SUPPORTED:
         ext = (const char *)in;
-        /* deny all extensions on the client side */
+        /* only allow compression on the client side, if enabled */
+        if (ctx != NULL && ctx->deflate && deflate_extension(ext)) {
+            mrp_debug("accepting client extension '%s'", ext);
+            return LWS_EVENT_OK;
+        }
         mrp_debug("denying client extension '%s'", ext);
         return LWS_EVENT_DENY;
 
@@ -1861,29 +2466,22 @@ static int wsl_event(lws_ctx_t *ws_ctx, lws_t *ws, lws_event_t event,
         return LWS_EVENT_OK;
 
     case LWS_CALLBACK_SERVER_WRITEABLE:
-#ifndef WEBSOCKETS_CLOSE_SESSION
-        sck = *(wsl_sck_t **)user;
+    case LWS_CALLBACK_CLIENT_WRITEABLE:
+        sck = user != NULL ? *(wsl_sck_t **)user : NULL;
 
+#ifndef WEBSOCKETS_CLOSE_SESSION
         if (sck == NULL) {
             mrp_debug("asking to close unassociated websocket %p", ws);
 
             return LWS_EVENT_CLOSE;
         }
 #endif
-        mrp_debug("socket server side writeable again");
-        return LWS_EVENT_OK;
+        mrp_debug("socket %s side writeable again",
+                  event == LWS_CALLBACK_SERVER_WRITEABLE ? "server" : "client");
 
-    case LWS_CALLBACK_CLIENT_WRITEABLE:
-#ifndef WEBSOCKETS_CLOSE_SESSION
-        sck = *(wsl_sck_t **)user;
-
-        if (sck == NULL) {
-            mrp_debug("asking to close unassociated websocket %p", ws);
+        if (sck != NULL && !drain_output(sck))
+            return LWS_EVENT_ERROR;
 
-            return LWS_EVENT_CLOSE;
-        }
-#endif
-        mrp_debug("socket client side writeable again");
         return LWS_EVENT_OK;
 
     default:
@@ -196,6 +196,7 @@ typedef struct {
     int              timeout;            /* keepalive timeout */
     int              nprobe;             /* number of keepalive probes */
     int              interval;           /* keepalive probe interval */
+    int              deflate;            /* accept compression extensions */
 } wsl_ctx_cfg_t;
 
 
@@ -230,6 +231,15 @@ int wsl_set_sendmode(wsl_sck_t *sck, wsl_sendmode_t mode);
 /** Send data over a wbesocket. */
 int wsl_send(wsl_sck_t *sck, void *payload, size_t size);
 
+/** Allocate a buffer for a payload of at most size bytes. */
+void *wsl_alloc_payload(size_t size);
+
+/** Free a payload buffer allocated with wsl_alloc_payload. */
+void wsl_free_payload(void *payload);
+
+/** Send (and always take ownership of) a buffer from wsl_alloc_payload. */
+int wsl_send_payload(wsl_sck_t *sck, void *payload, size_t size);
+
 /** Serve the given file over the given socket. */
 int wsl_serve_http_file(wsl_sck_t *sck, const char *path, const char *mime);
 
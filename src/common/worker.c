@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
+#include <murphy/common/log.h>
+#include <murphy/common/list.h>
+#include <murphy/common/mainloop.h>
+#include <murphy/common/worker.h>
+
+/*
+ * a worker job
+ */
+
+typedef struct {
+    mrp_list_hook_t       hook;          /* to pending or finished jobs */
+    uint32_t              id;            /* job id */
+    mrp_worker_run_cb_t   run;           /* run callback */
+    mrp_worker_done_cb_t  done;          /* completion callback */
+    void                 *user_data;     /* opaque callback data */
+    int                   status;        /* status returned by run */
+} job_t;
+
+
+/*
+ * a worker pool
+ */
+
+struct mrp_worker_pool_s {
+    mrp_mainloop_t  *ml;                 /* mainloop we deliver to */
+    pthread_t       *threads;            /* worker threads */
+    int              nthread;            /* number of worker threads */
+    pthread_mutex_t  lock;               /* protects the job queues */
+    pthread_cond_t   cond;               /* signalled on new pending jobs */
+    pthread_cond_t   idle;               /* signalled when all jobs ran */
+    int              running;            /* jobs being run */
+    mrp_list_hook_t  pending;            /* jobs waiting for a worker */
+    mrp_list_hook_t  finished;           /* jobs waiting for completion */
+    int              efd;                /* completion eventfd */
+    mrp_io_watch_t  *w;                  /* I/O watch for efd */
+    uint32_t         next_id;            /* next job id */
+    int              stop;               /* stop worker threads */
+    int              busy;               /* delivering completions */
+    int              destroyed;          /* destroyed while busy */
+};
+
+
+static void pool_free(mrp_worker_pool_t *pool);
+
+
+static void *worker_thread(void *ptr)
+{
+    mrp_worker_pool_t *pool = ptr;
+    job_t             *job;
+    uint64_t           one  = 1;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (;;) {
+        while (!pool->stop && mrp_list_empty(&pool->pending))
+            pthread_cond_wait(&pool->cond, &pool->lock);
+
+        if (pool->stop)
+            break;
+
+        job = mrp_list_entry(pool->pending.next, typeof(*job), hook);
+        mrp_list_delete(&job->hook);
+        pool->running++;
+
+        pthread_mutex_unlock(&pool->lock);
+        job->status = job->run(job->user_data);
+        pthread_mutex_lock(&pool->lock);
+
+        mrp_list_append(&pool->finished, &job->hook);
+
+        if (--pool->running == 0 && mrp_list_empty(&pool->pending))
+            pthread_cond_broadcast(&pool->idle);
+
+        if (write(pool->efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            mrp_log_error("Worker failed to signal job completion (%d: %s).",
+                          errno, strerror(errno));
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+
+static void complete_jobs(mrp_worker_pool_t *pool)
+{
+    mrp_list_hook_t  finished, *p, *n;
+    job_t           *job;
+
+    mrp_list_init(&finished);
+
+    pthread_mutex_lock(&pool->lock);
+    if (!mrp_list_empty(&pool->finished))
+        mrp_list_move(&finished, &pool->finished);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool->busy = TRUE;
+
+    mrp_list_foreach(&finished, p, n) {
+        job = mrp_list_entry(p, typeof(*job), hook);
+        mrp_list_delete(&job->hook);
+
+        if (job->done != NULL)
+            job->done(pool, job->id, job->status, job->user_data);
+
+        mrp_free(job);
+    }
+
+    pool->busy = FALSE;
+}
+
+
+static void completion_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
+                          void *user_data)
+{
+    mrp_worker_pool_t *pool = user_data;
+    uint64_t           cnt;
+
+    MRP_UNUSED(w);
+    MRP_UNUSED(events);
+
+    if (read(fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+        mrp_log_error("Failed to read worker completion count (%d: %s).",
+                      errno, strerror(errno));
+
+    complete_jobs(pool);
+
+    if (pool->destroyed) {
+        complete_jobs(pool);             /* cancelled by destroy */
+        pool_free(pool);
+    }
+}
+
+
+mrp_worker_pool_t *mrp_worker_pool_create(mrp_mainloop_t *ml, int nthread)
+{
+    mrp_worker_pool_t *pool;
+    mrp_io_event_t     events;
+    int                i;
+
+    if (nthread <= 0) {
+        nthread = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (nthread <= 0)
+            nthread = 1;
+    }
+
+    if ((pool = mrp_allocz(sizeof(*pool))) == NULL)
+        return NULL;
+
+    mrp_list_init(&pool->pending);
+    mrp_list_init(&pool->finished);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    pool->ml      = ml;
+    pool->next_id = MRP_WORKER_JOB_INVALID + 1;
+    pool->efd     = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (pool->efd < 0)
+        goto fail;
+
+    events  = MRP_IO_EVENT_IN;
+    pool->w = mrp_add_io_watch(ml, pool->efd, events, completion_cb, pool);
+
+    if (pool->w == NULL)
+        goto fail;
+
+    if ((pool->threads = mrp_allocz_array(pthread_t, nthread)) == NULL)
+        goto fail;
+
+    for (i = 0; i < nthread; i++) {
+        if (pthread_create(pool->threads + i, NULL, worker_thread, pool) != 0)
+            goto fail;
+
+        pool->nthread++;
+    }
+
+    return pool;
+
+ fail:
+    mrp_log_error("Failed to create worker pool (%d: %s).", errno,
+                  strerror(errno));
+    pool_free(pool);
+
+    return NULL;
+}
+
+
+static void pool_free(mrp_worker_pool_t *pool)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = TRUE;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->nthread; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    mrp_del_io_watch(pool->w);
+
+    if (pool->efd >= 0)
+        close(pool->efd);
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_cond_destroy(&pool->idle);
+    pthread_mutex_destroy(&pool->lock);
+
+    mrp_free(pool->threads);
+    mrp_free(pool);
+}
+
+
+void mrp_worker_pool_destroy(mrp_worker_pool_t *pool)
+{
+    mrp_list_hook_t *p, *n;
+    job_t           *job;
+    int              i;
+
+    if (pool == NULL || pool->destroyed)
+        return;
+
+    /*
+     * Stop the workers, letting them finish the jobs they are running,
+     * then cancel the remaining pending jobs and complete everything.
+     */
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = TRUE;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->nthread; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pool->nthread = 0;
+
+    mrp_list_foreach(&pool->pending, p, n) {
+        job = mrp_list_entry(p, typeof(*job), hook);
+        mrp_list_delete(&job->hook);
+
+        job->status = -ECANCELED;
+        mrp_list_append(&pool->finished, &job->hook);
+    }
+
+    if (pool->busy) {
+        pool->destroyed = TRUE;          /* called from a done callback */
+        return;
+    }
+
+    complete_jobs(pool);
+    pool_free(pool);
+}
+
+
+uint32_t mrp_worker_submit(mrp_worker_pool_t *pool, mrp_worker_run_cb_t run,
+                           mrp_worker_done_cb_t done, void *user_data)
+{
+    job_t *job;
+
+    if (pool == NULL || run == NULL || pool->destroyed) {
+        errno = EINVAL;
+        return MRP_WORKER_JOB_INVALID;
+    }
+
+    if ((job = mrp_allocz(sizeof(*job))) == NULL)
+        return MRP_WORKER_JOB_INVALID;
+
+    mrp_list_init(&job->hook);
+    job->run       = run;
+    job->done      = done;
+    job->user_data = user_data;
+    job->id        = pool->next_id++;
+
+    if (pool->next_id == MRP_WORKER_JOB_INVALID)
+        pool->next_id++;
+
+    pthread_mutex_lock(&pool->lock);
+    mrp_list_append(&pool->pending, &job->hook);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    return job->id;
+}
+
+
+int mrp_worker_pool_wait(mrp_worker_pool_t *pool)
+{
+    if (pool == NULL || pool->destroyed || pool->busy) {
+        errno = pool != NULL && pool->busy ? EBUSY : EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0 || !mrp_list_empty(&pool->pending))
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    /*
+     * Any wakeups of the completion eventfd left pending will find
+     * nothing to complete, which is harmless.
+     */
+    complete_jobs(pool);
+
+    return 0;
+}
+
+
+int mrp_worker_cancel(mrp_worker_pool_t *pool, uint32_t id)
+{
+    mrp_list_hook_t *p, *n;
+    job_t           *job;
+
+    if (pool == NULL || id == MRP_WORKER_JOB_INVALID)
+        return FALSE;
+
+    pthread_mutex_lock(&pool->lock);
+
+    mrp_list_foreach(&pool->pending, p, n) {
+        job = mrp_list_entry(p, typeof(*job), hook);
+
+        if (job->id == id) {
+            mrp_list_delete(&job->hook);
+            pthread_mutex_unlock(&pool->lock);
+
+            mrp_free(job);
+            return TRUE;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return FALSE;
+}
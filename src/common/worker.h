@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MURPHY_WORKER_H__
+#define __MURPHY_WORKER_H__
+
+#include <stdint.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mainloop.h>
+
+MRP_CDECL_BEGIN
+
+/*
+ * Mainloop worker pools.
+ *
+ * A worker pool is a set of threads bound to a mainloop, which can be
+ * used to offload CPU-heavy but thread-safe processing (decoding, JSON
+ * serialization, native type encoding, etc.) from the mainloop thread.
+ *
+ * You submit a job with a run and a completion callback. The run callback
+ * gets called in one of the worker threads. Once it returns, its result
+ * is delivered back to the mainloop thread (through an eventfd wakeup),
+ * where the completion callback gets called with it. Jobs are started in
+ * the order they were submitted, but with more than one worker thread
+ * they can complete in any order.
+ *
+ * Apart from the run callbacks, everything else, including all calls to
+ * the worker pool API, must take place in the mainloop thread.
+ */
+
+/** Invalid job id. */
+#define MRP_WORKER_JOB_INVALID 0
+
+/** Opaque worker pool type. */
+typedef struct mrp_worker_pool_s mrp_worker_pool_t;
+
+/** Job callback, called in a worker thread, returns the job status. */
+typedef int (*mrp_worker_run_cb_t)(void *user_data);
+
+/** Job completion callback, called in the mainloop thread. */
+typedef void (*mrp_worker_done_cb_t)(mrp_worker_pool_t *pool, uint32_t id,
+                                     int status, void *user_data);
+
+/**
+ * Create a worker pool with nthread threads for the given mainloop. If
+ * nthread is 0, a thread is created for each available CPU.
+ */
+mrp_worker_pool_t *mrp_worker_pool_create(mrp_mainloop_t *ml, int nthread);
+
+/**
+ * Destroy the given worker pool. Jobs still running are waited for and
+ * completed normally. Jobs not yet started are completed with status
+ * -ECANCELED. All completion callbacks are called before returning.
+ */
+void mrp_worker_pool_destroy(mrp_worker_pool_t *pool);
+
+/** Submit a new job, return its id or MRP_WORKER_JOB_INVALID on error. */
+uint32_t mrp_worker_submit(mrp_worker_pool_t *pool, mrp_worker_run_cb_t run,
+                           mrp_worker_done_cb_t done, void *user_data);
+
+/**
+ * Wait until all submitted jobs have run, then call their completion
+ * callbacks before returning. This turns the pool into a fork-join pool
+ * for callers which need the results right away. Must not be called from
+ * a completion callback. Returns 0 on success, -1 on error.
+ */
+int mrp_worker_pool_wait(mrp_worker_pool_t *pool);
+
+/**
+ * Cancel a job that has not been started yet. Returns TRUE if the job
+ * was cancelled, in which case its completion callback is not called.
+ */
+int mrp_worker_cancel(mrp_worker_pool_t *pool, uint32_t id);
+
+MRP_CDECL_END
+
+#endif /* __MURPHY_WORKER_H__ */
@@ -71,6 +71,7 @@ typedef struct {
     const char         *ssl_pkey;        /* path to SSL private key */
     const char         *ssl_ca;          /* path to SSL CA */
     wsl_ssl_t           ssl;             /* SSL mode (wsl_ssl_t) */
+    int                 deflate;         /* allow compression extensions */
     char               *protocol;        /* websocket protocol name */
     wsl_proto_t         proto[2];        /* protocol setup */
     mrp_list_hook_t     http_clients;    /* pure HTTP clients */
@@ -149,6 +150,10 @@ static int wsck_open(mrp_transport_t *mt)
     mrp_list_init(&t->http_clients);
     wsl_set_loglevel(WSL_LOG_ALL/* | WSL_LOG_EXTRA*/);
 
+    /* native types are binary, send them in binary frames by default */
+    if (t->mode == MRP_TRANSPORT_MODE_NATIVE)
+        t->send_mode = WSL_SEND_BINARY;
+
     return TRUE;
 }
 
@@ -219,6 +224,8 @@ static int wsck_setopt(mrp_transport_t *mt, const char *opt, const void *val)
         t->ssl_ca = (const char *)val;
     else if (!strcmp(opt, MRP_WSCK_OPT_SSL))
         t->ssl = *(wsl_ssl_t *)val;
+    else if (!strcmp(opt, MRP_WSCK_OPT_DEFLATE) && val != NULL)
+        t->deflate = *(int *)val;
     else
         success = FALSE;
 
@@ -292,6 +299,7 @@ static int wsck_bind(mrp_transport_t *mt, mrp_sockaddr_t *addr,
     cfg.gid       = WSL_NO_GID;
     cfg.uid       = WSL_NO_UID;
     cfg.user_data = t;
+    cfg.deflate   = t->deflate;
 
     t->ctx = wsl_create_context(t->ml, &cfg);
 
@@ -391,6 +399,7 @@ static int wsck_connect(mrp_transport_t *mt, mrp_sockaddr_t *addr,
     cfg.gid       = WSL_NO_GID;
     cfg.uid       = WSL_NO_UID;
     cfg.user_data = t;
+    cfg.deflate   = t->deflate;
 
     t->ctx = wsl_create_context(t->ml, &cfg);
 
@@ -401,6 +410,7 @@ static int wsck_connect(mrp_transport_t *mt, mrp_sockaddr_t *addr,
 
     if (t->sck != NULL) {
         t->connected = TRUE;
+        wsl_set_sendmode(t->sck, t->send_mode);
 
         return TRUE;
     }
@@ -439,15 +449,13 @@ static int wsck_send(mrp_transport_t *mt, mrp_msg_t *msg)
     ssize_t  size;
     int      success;
 
-    size = mrp_msg_default_encode(msg, &buf);
+    size = mrp_msg_default_encode_alloc(msg, wsl_alloc_payload, &buf);
 
-    if (wsl_send(t->sck, buf, size))
+    if (size >= 0 && wsl_send_payload(t->sck, buf, size))
         success = TRUE;
     else
         success = FALSE;
 
-    mrp_free(buf);
-
     return success;
 }
 
@@ -515,6 +523,30 @@ static int wsck_sendcustom(mrp_transport_t *mt, void *data)
 }
 
 
+static int wsck_sendnative(mrp_transport_t *mt, void *data, uint32_t type_id)
+{
+    wsck_t        *t   = (wsck_t *)mt;
+    mrp_typemap_t *map = t->map;
+    void          *buf;
+    size_t         size;
+    int            status;
+
+    /*
+     * Notes:
+     *     Websocket frames carry their own length, so unlike the stream
+     *     transports we do not need to prefix the encoded data with it.
+     */
+
+    if (mrp_encode_native(data, type_id, 0, &buf, &size, map) < 0)
+        return FALSE;
+
+    status = wsl_send(t->sck, buf, size);
+    mrp_free(buf);
+
+    return status;
+}
+
+
 static inline int looks_ipv4(const char *p)
 {
     if (isdigit(p[0])) {
@@ -991,5 +1023,5 @@ MRP_REGISTER_TRANSPORT(wsck, WSCKP, wsck_t, wsck_resolve,
                        wsck_sendraw, NULL,
                        wsck_senddata, NULL,
                        wsck_sendcustom, NULL,
-                       NULL, NULL,
+                       wsck_sendnative, NULL,
                        NULL, NULL);
@@ -81,6 +81,7 @@ typedef struct {
 #define MRP_WSCK_OPT_SSL_PKEY "ssl-pkey"      /* path to SSL priv. key */
 #define MRP_WSCK_OPT_SSL_CA   "ssl-ca"        /* path to SSL CA */
 #define MRP_WSCK_OPT_SSL      "ssl"           /* whether to connect with SSL */
+#define MRP_WSCK_OPT_DEFLATE  "deflate"       /* allow compression (int *) */
 
 /*
  * It is also possible to serve content over HTTP on a websocket transport.
@@ -44,4 +44,10 @@ static int deny_auth(const char *target, mrp_auth_mode_t mode, const char *id,
 }
 
 
-MRP_REGISTER_AUTHENTICATOR("deny", NULL, deny_auth);
+static void deny_refresh(void *auth_data)
+{
+    MRP_UNUSED(auth_data);               /* our policy never changes */
+}
+
+
+MRP_REGISTER_CACHEABLE_AUTHENTICATOR("deny", NULL, deny_auth, deny_refresh);
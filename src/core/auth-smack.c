@@ -27,21 +27,193 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
 #include <sys/smack.h>
 
 #include <murphy/common/debug.h>
+#include <murphy/common/mm.h>
+#include <murphy/common/list.h>
+#include <murphy/common/hashtbl.h>
+#include <murphy/common/utils.h>
 #include <murphy/core/context.h>
 #include <murphy/core/auth.h>
 
+#define CACHE_MAX     256                /* max. number of cached decisions */
+#define SMACKFS_PATH  "/sys/fs/smackfs"  /* default smackfs mount point */
+
+
+/*
+ * Notes:
+ *
+ *     Checking access with libsmack involves a handful of syscalls and a
+ *     rule lookup in the kernel, so we cache the decisions by subject,
+ *     object and access mode. Any change to the Smack policy gets written
+ *     to some file in smackfs, so we watch smackfs with inotify and flush
+ *     the cache if anything there has been modified since the last check.
+ *     Without inotify we do not cache at all. Policy changes are also
+ *     reported to the core, so decisions cached per connection (see
+ *     mrp_authenticate_cached) get dropped as well.
+ */
+
+typedef struct {
+    mrp_list_hook_t  hook;               /* to LRU list */
+    char            *key;                /* access, subject and object */
+    int              status;             /* cached decision */
+} decision_t;
+
+typedef struct {
+    mrp_htbl_t      *decisions;          /* cached decisions by key */
+    mrp_list_hook_t  lru;                /* least recently used last */
+    int              ndecision;          /* number of cached decisions */
+    int              ifd;                /* inotify fd for policy changes */
+} smack_cache_t;
+
+
+static void free_decision(void *key, void *object)
+{
+    decision_t *d = (decision_t *)object;
+
+    MRP_UNUSED(key);
+
+    mrp_list_delete(&d->hook);
+    mrp_free(d->key);
+    mrp_free(d);
+}
+
+
+static int smack_init(void **auth_data)
+{
+    smack_cache_t     *c;
+    mrp_htbl_config_t  hcfg;
+    const char        *path;
+
+    if ((c = mrp_allocz(sizeof(*c))) == NULL)
+        return FALSE;
+
+    mrp_list_init(&c->lru);
+
+    mrp_clear(&hcfg);
+    hcfg.comp    = mrp_string_comp;
+    hcfg.hash    = mrp_string_hash;
+    hcfg.free    = free_decision;
+    hcfg.nentry  = CACHE_MAX;
+    hcfg.nbucket = CACHE_MAX / 4;
+
+    if ((c->decisions = mrp_htbl_create(&hcfg)) == NULL) {
+        mrp_free(c);
+        return FALSE;
+    }
+
+    if ((path = smack_smackfs_path()) == NULL)
+        path = SMACKFS_PATH;
+
+    c->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (c->ifd >= 0 && inotify_add_watch(c->ifd, path, IN_MODIFY) < 0) {
+        mrp_debug("can't watch %s for Smack policy changes, not caching",
+                  path);
+        close(c->ifd);
+        c->ifd = -1;
+    }
+
+    *auth_data = c;
+
+    return TRUE;
+}
+
+
+static void flush_cache(smack_cache_t *c)
+{
+    mrp_htbl_reset(c->decisions, TRUE);
+    c->ndecision = 0;
+}
+
+
+static int cache_valid(smack_cache_t *c)
+{
+    char buf[4096];
+    int  changed;
+
+    if (c == NULL || c->ifd < 0)
+        return FALSE;
+
+    changed = FALSE;
+    while (read(c->ifd, buf, sizeof(buf)) > 0)
+        changed = TRUE;
+
+    if (changed) {
+        mrp_debug("Smack policy changed, flushing %d cached decisions",
+                  c->ndecision);
+        flush_cache(c);
+        mrp_auth_policy_changed();
+    }
+
+    return TRUE;
+}
+
+
+static void smack_refresh(void *auth_data)
+{
+    /* if we can't tell, we must assume that the policy has changed */
+    if (!cache_valid((smack_cache_t *)auth_data))
+        mrp_auth_policy_changed();
+}
+
+
+static decision_t *cache_lookup(smack_cache_t *c, const char *key)
+{
+    decision_t *d;
+
+    if ((d = mrp_htbl_lookup(c->decisions, (void *)key)) != NULL) {
+        mrp_list_delete(&d->hook);
+        mrp_list_prepend(&c->lru, &d->hook);
+    }
+
+    return d;
+}
+
+
+static void cache_insert(smack_cache_t *c, const char *key, int status)
+{
+    decision_t *d;
+
+    if (c->ndecision >= CACHE_MAX) {
+        d = mrp_list_entry(c->lru.prev, typeof(*d), hook);
+        mrp_htbl_remove(c->decisions, d->key, TRUE);
+        c->ndecision--;
+    }
+
+    if ((d = mrp_allocz(sizeof(*d))) == NULL)
+        return;
+
+    mrp_list_init(&d->hook);
+    d->key    = mrp_strdup(key);
+    d->status = status;
+
+    if (d->key == NULL || !mrp_htbl_insert(c->decisions, d->key, d)) {
+        mrp_free(d->key);
+        mrp_free(d);
+        return;
+    }
+
+    mrp_list_prepend(&c->lru, &d->hook);
+    c->ndecision++;
+}
+
 
 static int smack_auth(const char *target, mrp_auth_mode_t mode, const char *id,
                       const char *token, void *auth_data)
 {
-    char access[4];
-    int  status;
+    smack_cache_t *c = (smack_cache_t *)auth_data;
+    decision_t    *d;
+    char           access[4], key[1024];
+    int            status, cache;
 
     MRP_UNUSED(token);
-    MRP_UNUSED(auth_data);
 
     if (target == NULL || id == NULL)
         goto error;
@@ -51,9 +223,25 @@ static int smack_auth(const char *target, mrp_auth_mode_t mode, const char *id,
     access[2] = (mode & MRP_AUTH_MODE_EXEC)  ? 'x' : '-';
     access[3] = '\0';
 
-    status = smack_have_access(target, id, access);
+    /* Smack labels cannot contain whitespace, so this is unambiguous */
+    cache = cache_valid(c) &&
+        snprintf(key, sizeof(key), "%s %s %s", access, id, target) <
+        (int)sizeof(key);
 
-    mrp_debug("SMACK '%s' access of %s to %s: %d", access, id, target, status);
+    if (cache && (d = cache_lookup(c, key)) != NULL) {
+        status = d->status;
+        mrp_debug("SMACK '%s' access of %s to %s: %d (cached)", access,
+                  id, target, status);
+    }
+    else {
+        status = smack_have_access(target, id, access);
+
+        mrp_debug("SMACK '%s' access of %s to %s: %d", access, id, target,
+                  status);
+
+        if (cache && (status == 0 || status == 1))
+            cache_insert(c, key, status);
+    }
 
     switch (status) {
     case 1:
@@ -67,4 +255,5 @@ static int smack_auth(const char *target, mrp_auth_mode_t mode, const char *id,
 }
 
 
-MRP_REGISTER_AUTHENTICATOR("smack", NULL, smack_auth);
+MRP_REGISTER_CACHEABLE_AUTHENTICATOR("smack", smack_init, smack_auth,
+                                     smack_refresh);
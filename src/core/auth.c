@@ -27,25 +27,46 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdio.h>
 #include <errno.h>
 
 #include <murphy/common/macros.h>
 #include <murphy/common/mm.h>
 #include <murphy/common/log.h>
+#include <murphy/common/list.h>
 
 #include <murphy/core/context.h>
 #include <murphy/core/auth.h>
 
 
+#define AUTH_CACHE_MAX 32                /* max. decisions per cache */
+
+typedef struct mrp_auth_backend_s auth_backend_t;
+
+struct mrp_auth_backend_s {
+    char                  *name;         /* backend name */
+    mrp_auth_cb_t          cb;           /* backend method */
+    mrp_auth_refresh_cb_t  refresh;      /* policy change check, if any */
+    void                  *auth_data;    /* backend data */
+    mrp_list_hook_t        hook;         /* to list of backends */
+};
+
 typedef struct {
-    char            *name;               /* backend name */
-    mrp_auth_cb_t    cb;                 /* backend method */
-    void            *auth_data;          /* backend data */
-    mrp_list_hook_t  hook;               /* to list of backends */
-} auth_backend_t;
+    mrp_list_hook_t  hook;               /* to cache LRU list */
+    char            *key;                /* backend, target, mode and id */
+    int              status;             /* cached decision */
+} auth_decision_t;
+
+struct mrp_auth_cache_s {
+    mrp_context_t   *ctx;                /* murphy context */
+    mrp_list_hook_t  decisions;          /* least recently used last */
+    int              ndecision;          /* number of cached decisions */
+    uint32_t         generation;         /* policy generation of decisions */
+};
 
 
 static MRP_LIST_HOOK(pending);
+static uint32_t generation;              /* bumped on any policy change */
 
 
 static auth_backend_t *find_auth(mrp_list_hook_t *backends, const char *name)
@@ -65,7 +86,8 @@ static auth_backend_t *find_auth(mrp_list_hook_t *backends, const char *name)
 
 
 static int register_auth(mrp_list_hook_t *backends, const char *name,
-                         mrp_auth_cb_t cb, void *auth_data)
+                         mrp_auth_cb_t cb, mrp_auth_refresh_cb_t refresh,
+                         void *auth_data)
 {
     auth_backend_t *auth;
 
@@ -79,6 +101,7 @@ static int register_auth(mrp_list_hook_t *backends, const char *name,
 
         auth->name      = mrp_strdup(name);
         auth->cb        = cb;
+        auth->refresh   = refresh;
         auth->auth_data = auth_data;
 
         if (auth->name != NULL) {
@@ -92,6 +115,7 @@ static int register_auth(mrp_list_hook_t *backends, const char *name,
              */
 
             mrp_list_prepend(backends, &auth->hook);
+            mrp_auth_policy_changed();
 
             mrp_debug("registered authentication backend %s", auth->name);
 
@@ -115,12 +139,23 @@ static void unregister_auth(mrp_list_hook_t *backends, const char *name)
         mrp_list_delete(&auth->hook);
         mrp_free(auth->name);
         mrp_free(auth);
+        mrp_auth_policy_changed();
     }
 }
 
 
 int mrp_register_authenticator(mrp_context_t *ctx, const char *name,
                                mrp_auth_cb_t cb, void *auth_data)
+{
+    return mrp_register_cacheable_authenticator(ctx, name, cb, NULL,
+                                                auth_data);
+}
+
+
+int mrp_register_cacheable_authenticator(mrp_context_t *ctx, const char *name,
+                                         mrp_auth_cb_t cb,
+                                         mrp_auth_refresh_cb_t refresh,
+                                         void *auth_data)
 {
     mrp_list_hook_t *backends;
 
@@ -133,10 +168,13 @@ int mrp_register_authenticator(mrp_context_t *ctx, const char *name,
     else
         backends = &pending;
 
-    if (register_auth(backends, name, cb, auth_data) == 0)
-        return TRUE;
-    else
-        return FALSE;
+    return register_auth(backends, name, cb, refresh, auth_data);
+}
+
+
+void mrp_auth_policy_changed(void)
+{
+    generation++;
 }
 
 
@@ -148,6 +186,36 @@ void mrp_unregister_authenticator(mrp_context_t *ctx, const char *name)
 }
 
 
+mrp_auth_backend_t *mrp_lookup_authenticator(mrp_context_t *ctx,
+                                             const char *name)
+{
+    auth_backend_t *auth;
+
+    if (MRP_UNLIKELY(!mrp_list_empty(&pending)))
+        mrp_list_move(&ctx->auth, &pending);
+
+    if ((auth = find_auth(&ctx->auth, name)) == NULL)
+        errno = ENOENT;
+
+    return auth;
+}
+
+
+int mrp_authenticate_with(mrp_auth_backend_t *auth, const char *target,
+                          mrp_auth_mode_t mode, const char *id,
+                          const char *token)
+{
+    int status;
+
+    status = auth->cb(target, mode, id, token, auth->auth_data);
+
+    mrp_debug("backend %s, access 0x%x of %s/%s to %s: %d", auth->name,
+              mode, id, token ? token : "<none>", target, status);
+
+    return status;
+}
+
+
 int mrp_authenticate(mrp_context_t *ctx, const char *backend,
                      const char *target, mrp_auth_mode_t mode,
                      const char *id, const char *token)
@@ -174,31 +242,187 @@ int mrp_authenticate(mrp_context_t *ctx, const char *backend,
      * of multiple available backends.
      */
 
+    if (backend != MRP_AUTH_ANY) {
+        if ((auth = find_auth(&ctx->auth, backend)) == NULL)
+            return MRP_AUTH_RESULT_ERROR;
+
+        return mrp_authenticate_with(auth, target, mode, id, token);
+    }
+
     result = MRP_AUTH_RESULT_ERROR;
 
     mrp_list_foreach(&ctx->auth, p, n) {
+        auth   = mrp_list_entry(p, typeof(*auth), hook);
+        status = mrp_authenticate_with(auth, target, mode, id, token);
+
+        switch (status) {
+        case MRP_AUTH_RESULT_GRANT:
+            return MRP_AUTH_RESULT_GRANT;
+        case MRP_AUTH_RESULT_DENY:
+            result = MRP_AUTH_RESULT_DENY;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return result;
+}
+
+
+mrp_auth_cache_t *mrp_auth_cache_create(mrp_context_t *ctx)
+{
+    mrp_auth_cache_t *cache;
+
+    if ((cache = mrp_allocz(sizeof(*cache))) != NULL) {
+        mrp_list_init(&cache->decisions);
+        cache->ctx        = ctx;
+        cache->generation = generation;
+    }
+
+    return cache;
+}
+
+
+static void cache_flush(mrp_auth_cache_t *cache)
+{
+    mrp_list_hook_t *p, *n;
+    auth_decision_t *d;
+
+    mrp_list_foreach(&cache->decisions, p, n) {
+        d = mrp_list_entry(p, typeof(*d), hook);
+
+        mrp_list_delete(&d->hook);
+        mrp_free(d->key);
+        mrp_free(d);
+    }
+
+    cache->ndecision = 0;
+}
+
+
+void mrp_auth_cache_destroy(mrp_auth_cache_t *cache)
+{
+    if (cache != NULL) {
+        cache_flush(cache);
+        mrp_free(cache);
+    }
+}
+
+
+static int cache_refresh(mrp_auth_cache_t *cache, const char *backend)
+{
+    mrp_list_hook_t *p, *n;
+    auth_backend_t  *auth;
+
+    /*
+     * Give the backends a chance to notice policy changes, bailing out
+     * if any of them can't tell. Then drop everything we have cached if
+     * anything has changed since we last looked.
+     */
+
+    mrp_list_foreach(&cache->ctx->auth, p, n) {
         auth = mrp_list_entry(p, typeof(*auth), hook);
 
-        if (backend == MRP_AUTH_ANY || !strcmp(backend, auth->name)) {
-            status = auth->cb(target, mode, id, token, auth->auth_data);
+        if (backend != MRP_AUTH_ANY && strcmp(auth->name, backend))
+            continue;
+
+        if (auth->refresh == NULL)
+            return FALSE;
+
+        auth->refresh(auth->auth_data);
+    }
 
-            mrp_debug("backend %s, access 0x%x of %s/%s to %s: %d", auth->name,
-                      mode, id, token ? token : "<none>", target, status);
+    if (cache->generation != generation) {
+        cache_flush(cache);
+        cache->generation = generation;
+    }
+
+    return TRUE;
+}
 
-            if (backend != MRP_AUTH_ANY)
-                return status;
 
-            switch (status) {
-            case MRP_AUTH_RESULT_GRANT:
-                return MRP_AUTH_RESULT_GRANT;
-            case MRP_AUTH_RESULT_DENY:
-                result = MRP_AUTH_RESULT_DENY;
-                break;
-            default:
-                break;
-            }
+static auth_decision_t *cache_lookup(mrp_auth_cache_t *cache, const char *key)
+{
+    mrp_list_hook_t *p, *n;
+    auth_decision_t *d;
+
+    mrp_list_foreach(&cache->decisions, p, n) {
+        d = mrp_list_entry(p, typeof(*d), hook);
+
+        if (!strcmp(d->key, key)) {
+            mrp_list_delete(&d->hook);
+            mrp_list_prepend(&cache->decisions, &d->hook);
+
+            return d;
         }
     }
 
-    return result;
+    return NULL;
+}
+
+
+static void cache_insert(mrp_auth_cache_t *cache, const char *key, int status)
+{
+    auth_decision_t *d;
+
+    if (cache->ndecision >= AUTH_CACHE_MAX) {
+        d = mrp_list_entry(cache->decisions.prev, typeof(*d), hook);
+        mrp_list_delete(&d->hook);
+        mrp_free(d->key);
+        mrp_free(d);
+        cache->ndecision--;
+    }
+
+    if ((d = mrp_allocz(sizeof(*d))) == NULL)
+        return;
+
+    mrp_list_init(&d->hook);
+    d->status = status;
+
+    if ((d->key = mrp_strdup(key)) == NULL) {
+        mrp_free(d);
+        return;
+    }
+
+    mrp_list_prepend(&cache->decisions, &d->hook);
+    cache->ndecision++;
+}
+
+
+int mrp_authenticate_cached(mrp_auth_cache_t *cache, const char *backend,
+                            const char *target, mrp_auth_mode_t mode,
+                            const char *id, const char *token)
+{
+    mrp_context_t   *ctx = cache->ctx;
+    auth_decision_t *d;
+    char             key[1024];
+    int              status, n;
+
+    if (MRP_UNLIKELY(!mrp_list_empty(&pending)))
+        mrp_list_move(&ctx->auth, &pending);
+
+    if (target == NULL || id == NULL || !cache_refresh(cache, backend))
+        return mrp_authenticate(ctx, backend, target, mode, id, token);
+
+    n = snprintf(key, sizeof(key), "%s\n%s\n%x\n%s\n%s",
+                 backend ? backend : "", target, mode, id, token ? token : "");
+
+    if (n < 0 || n >= (int)sizeof(key))
+        return mrp_authenticate(ctx, backend, target, mode, id, token);
+
+    if ((d = cache_lookup(cache, key)) != NULL) {
+        mrp_debug("access 0x%x of %s to %s: %d (cached)", mode, id, target,
+                  d->status);
+
+        return d->status;
+    }
+
+    status = mrp_authenticate(ctx, backend, target, mode, id, token);
+
+    /* a refresh during the check might have changed the policy */
+    if (status != MRP_AUTH_RESULT_ERROR && cache->generation == generation)
+        cache_insert(cache, key, status);
+
+    return status;
 }
@@ -65,10 +65,30 @@ typedef int (*mrp_auth_cb_t)(const char *target, mrp_auth_mode_t mode,
                              const char *id, const char *token,
                              void *user_data);
 
+/** Type for backend callback to check for (and report) policy changes. */
+typedef void (*mrp_auth_refresh_cb_t)(void *user_data);
+
 /** Register an authentication backend. */
 int mrp_register_authenticator(mrp_context_t *ctx, const char *name,
                                mrp_auth_cb_t cb, void *user_data);
 
+/*
+ * Decisions of a backend registered with a refresh callback can be cached
+ * per connection (see mrp_authenticate_cached below). Before serving a
+ * cached decision the refresh callback gets called, and the backend is
+ * expected to call mrp_auth_policy_changed if its policy has changed in
+ * a way that might change any decisions since the previous check.
+ */
+
+/** Register an authentication backend with cacheable decisions. */
+int mrp_register_cacheable_authenticator(mrp_context_t *ctx, const char *name,
+                                         mrp_auth_cb_t cb,
+                                         mrp_auth_refresh_cb_t refresh,
+                                         void *user_data);
+
+/** Invalidate all cached decisions after a policy change. */
+void mrp_auth_policy_changed(void);
+
 /** Unregister an authentication backend. */
 void mrp_unregister_authenticator(mrp_context_t *ctx, const char *name);
 
@@ -77,15 +97,58 @@ int mrp_authenticate(mrp_context_t *ctx, const char *backend,
                      const char *target, mrp_auth_mode_t mode,
                      const char *id, const char *token);
 
+/** Opaque type for a registered authentication backend. */
+typedef struct mrp_auth_backend_s mrp_auth_backend_t;
+
+/** Look up a backend by name, valid until the backend is unregistered. */
+mrp_auth_backend_t *mrp_lookup_authenticator(mrp_context_t *ctx,
+                                             const char *name);
+
+/** Check access with a backend without looking it up by name. */
+int mrp_authenticate_with(mrp_auth_backend_t *backend, const char *target,
+                          mrp_auth_mode_t mode, const char *id,
+                          const char *token);
+
+/*
+ * per-connection authentication cache
+ *
+ * Clients usually keep using the same identity for accessing the same
+ * targets over a connection. Authenticating through a per-connection
+ * cache avoids going to the backends for every request. The cache gets
+ * flushed if any backend reports a policy change, or if backends get
+ * registered or unregistered. Decisions involving backends that have
+ * no refresh callback are never cached.
+ */
+
+/** Opaque type for a per-connection authentication cache. */
+typedef struct mrp_auth_cache_s mrp_auth_cache_t;
+
+/** Create a new authentication cache, typically one per connection. */
+mrp_auth_cache_t *mrp_auth_cache_create(mrp_context_t *ctx);
+
+/** Destroy an authentication cache. */
+void mrp_auth_cache_destroy(mrp_auth_cache_t *cache);
+
+/** Check access like mrp_authenticate, using and updating the cache. */
+int mrp_authenticate_cached(mrp_auth_cache_t *cache, const char *backend,
+                            const char *target, mrp_auth_mode_t mode,
+                            const char *id, const char *token);
+
 /** Convenience macro for autoregistering an authentication backend. */
 #define MRP_REGISTER_AUTHENTICATOR(name, init_cb, auth_cb)              \
+    MRP_REGISTER_CACHEABLE_AUTHENTICATOR(name, init_cb, auth_cb, NULL)
+
+/** Convenience macro for autoregistering a cacheable backend. */
+#define MRP_REGISTER_CACHEABLE_AUTHENTICATOR(name, init_cb, auth_cb,    \
+                                             refresh_cb)                \
     MRP_INIT static void register_authenticator(void)                   \
     {                                                                   \
         int  (*initfn)(void **) = init_cb;                              \
         void  *user_data        = NULL;                                 \
                                                                         \
         if (initfn == NULL || initfn(&user_data))                       \
-            mrp_register_authenticator(NULL, name, auth_cb, user_data); \
+            mrp_register_cacheable_authenticator(NULL, name, auth_cb,   \
+                                                 refresh_cb, user_data);\
         else                                                            \
             mrp_log_error("Failed to initialize user data for "         \
                           "authenticator '%s'.", name);                 \
@@ -31,3 +31,6 @@
 #include "console-debug.c"
 #include "console-db.c"
 #include "console-log.c"
+#include "console-mainloop.c"
+#include "console-trace.c"
+#include "console-mm.c"
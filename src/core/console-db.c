@@ -32,37 +32,42 @@
  * DB commands
  */
 
-#include <stdarg.h>
-
 #include <murphy-db/mql.h>
 #include <murphy-db/mqi.h>
+#include <murphy-db/mdb.h>
 
-static void db_cmd(char *fmt, ...)
+static void db_cmd(mrp_console_t *c, const char *cmd)
 {
     mql_result_t *r;
-    char          buf[1024];
-    va_list       ap;
-    int           n, error;
-    const char   *msg;
+    const char   *str, *msg;
+    char         *buf;
+    int           len, error;
 
-    va_start(ap, fmt);
-    n = vsnprintf(buf, sizeof(buf), fmt, ap);
-    va_end(ap);
+    r = mql_exec_string(mql_result_string, cmd);
 
-    if (n < (int)sizeof(buf) && n > 0) {
-        r = mql_exec_string(mql_result_string, buf);
+    if (mql_result_is_success(r)) {
+        str = mql_result_string_get(r);
+        len = strlen(str);
 
-        if (mql_result_is_success(r))
-            printf("%s\n", mql_result_string_get(r));
-        else {
-            error = mql_result_error_get_code(r);
-            msg   = mql_result_error_get_message(r);
+        /* results can be whole table dumps, so stream them out in chunks */
+        if ((buf = mrp_alloc(len + 1)) != NULL) {
+            memcpy(buf, str, len);
+            buf[len] = '\n';
 
-            printf("DB error %d: %s\n", error, msg ? msg : "unknown error");
+            if (mrp_console_stream_buffer(c, buf, len + 1) < 0)
+                printf("%s\n", str);
         }
+        else
+            printf("%s\n", str);
+    }
+    else {
+        error = mql_result_error_get_code(r);
+        msg   = mql_result_error_get_message(r);
 
-        mql_result_free(r);
+        printf("DB error %d: %s\n", error, msg ? msg : "unknown error");
     }
+
+    mql_result_free(r);
 }
 
 
@@ -71,13 +76,12 @@ static void db_exec(mrp_console_t *c, void *user_data, const char *grp,
 {
     mqi_handle_t tx;
 
-    MRP_UNUSED(c);
     MRP_UNUSED(user_data);
     MRP_UNUSED(grp);
     MRP_UNUSED(cmd);
 
     tx = mqi_begin_transaction();
-    db_cmd(args);
+    db_cmd(c, args);
     mqi_commit_transaction(tx);
 }
 
@@ -111,6 +115,70 @@ void db_source(mrp_console_t *c, void *user_data, int argc, char **argv)
 }
 
 
+void db_hash_stats(mrp_console_t *c, void *user_data, int argc, char **argv)
+{
+    mdb_table_t *tbl;
+    char         buf[4096];
+    int          i;
+
+    MRP_UNUSED(c);
+    MRP_UNUSED(user_data);
+
+    if (argc < 3) {
+        printf("Missing table name.\n");
+        return;
+    }
+
+    for (i = 2; i < argc; i++) {
+        if ((tbl = mdb_table_find(argv[i])) == NULL) {
+            printf("Unknown table '%s'.\n", argv[i]);
+            continue;
+        }
+
+        if (mdb_table_print_hash_statistics(tbl, buf, sizeof(buf)) > 0)
+            printf("%s", buf);
+    }
+}
+
+
+void db_log_stats(mrp_console_t *c, void *user_data, int argc, char **argv)
+{
+    char buf[1024];
+
+    MRP_UNUSED(c);
+    MRP_UNUSED(user_data);
+    MRP_UNUSED(argc);
+    MRP_UNUSED(argv);
+
+    if (mdb_log_print_statistics(buf, sizeof(buf)) > 0)
+        printf("%s", buf);
+}
+
+
+void db_log_limit(mrp_console_t *c, void *user_data, int argc, char **argv)
+{
+    char *end;
+    long  limit;
+
+    MRP_UNUSED(c);
+    MRP_UNUSED(user_data);
+
+    if (argc < 3) {
+        printf("transaction log limit: %u changes\n", mdb_log_get_limit());
+        return;
+    }
+
+    limit = strtol(argv[2], &end, 10);
+
+    if (*end || limit < 0 || argc > 3) {
+        printf("Invalid transaction log limit '%s'.\n", argv[2]);
+        return;
+    }
+
+    mdb_log_set_limit((uint32_t)limit);
+}
+
+
 #define DB_GROUP_DESCRIPTION                                                \
     "Database commands provide means to manipulate the Murphy database\n"   \
     "from the console. Commands are provided for listing, describing,\n"    \
@@ -128,10 +196,36 @@ void db_source(mrp_console_t *c, void *user_data, int argc, char **argv)
 #define DBSRC_SUMMARY     "evaluate the MQL script in the given <file>"
 #define DBSRC_DESCRIPTION "Read and evaluate the contents of <file>.\n"
 
+#define DBHASH_SYNTAX      "hash-stats <table> [<table> ...]"
+#define DBHASH_SUMMARY     "show index hash statistics of the given tables"
+#define DBHASH_DESCRIPTION "Show the size, chain lengths, maximum chain\n"  \
+    "depth and resize history of the index hash table of the given\n"     \
+    "tables.\n"
+
+#define DBLOGSTAT_SYNTAX      "log-stats"
+#define DBLOGSTAT_SUMMARY     "show transaction log statistics"
+#define DBLOGSTAT_DESCRIPTION "Show the number of pending changes, the size\n" \
+    "of the transaction log entry pool and its usage history.\n"
+
+#define DBLOGLIM_SYNTAX      "log-limit [<changes>]"
+#define DBLOGLIM_SUMMARY     "show or set the transaction log limit"
+#define DBLOGLIM_DESCRIPTION "Show or set the maximum number of changes\n"  \
+    "the open transactions can have pending. Writes beyond the limit\n"   \
+    "fail and the transaction that hit it is rolled back at commit.\n"   \
+    "A limit of 0 turns the check off.\n"
+
 
 MRP_CORE_CONSOLE_GROUP(db_group, "db", DB_GROUP_DESCRIPTION, NULL, {
         MRP_TOKENIZED_CMD("source", db_source, FALSE,
                           DBSRC_SYNTAX, DBSRC_SUMMARY, DBSRC_DESCRIPTION),
+        MRP_TOKENIZED_CMD("hash-stats", db_hash_stats, FALSE,
+                          DBHASH_SYNTAX, DBHASH_SUMMARY, DBHASH_DESCRIPTION),
+        MRP_TOKENIZED_CMD("log-stats", db_log_stats, FALSE,
+                          DBLOGSTAT_SYNTAX, DBLOGSTAT_SUMMARY,
+                          DBLOGSTAT_DESCRIPTION),
+        MRP_TOKENIZED_CMD("log-limit", db_log_limit, FALSE,
+                          DBLOGLIM_SYNTAX, DBLOGLIM_SUMMARY,
+                          DBLOGLIM_DESCRIPTION),
         MRP_RAWINPUT_CMD("eval", db_exec,
                          MRP_CONSOLE_CATCHALL | MRP_CONSOLE_SELECTABLE,
                          DBEXEC_SYNTAX, DBEXEC_SUMMARY, DBEXEC_DESCRIPTION),
@@ -67,6 +67,10 @@ static void log_target(mrp_console_t *c, void *user_data,
         for (i = 0; i < n; i++)
             printf("    %s%s\n", targets[i],
                    !strcmp(targets[i], target) ? " (active)" : "");
+
+        if (!strncmp(target, "async:", 6))
+            printf("logging asynchronously to %s, %llu messages dropped\n",
+                   target + 6, (unsigned long long)mrp_log_get_dropped());
     }
     else if (argc == 3) {
         target = argv[2];
@@ -85,6 +89,48 @@ static void log_target(mrp_console_t *c, void *user_data,
 }
 
 
+static void log_ratelimit(mrp_console_t *c, void *user_data,
+                          int argc, char **argv)
+{
+    uint32_t  rate, burst;
+    char     *end;
+
+    MRP_UNUSED(c);
+    MRP_UNUSED(user_data);
+
+    mrp_log_get_ratelimit(&rate, &burst);
+
+    if (argc == 2) {
+        if (rate != 0)
+            printf("logging at most %u messages/s per site, bursts of %u\n",
+                   rate, burst);
+        else
+            printf("log rate limiting is off\n");
+
+        printf("%llu messages suppressed\n",
+               (unsigned long long)mrp_log_get_suppressed());
+        return;
+    }
+
+    if (argc > 4) {
+        printf("%s/%s invoked with wrong number of arguments\n",
+               argv[0], argv[1]);
+        return;
+    }
+
+    rate = (uint32_t)strtoul(argv[2], &end, 10);
+
+    if (*end == '\0' && argc == 4)
+        burst = (uint32_t)strtoul(argv[3], &end, 10);
+
+    if (*end != '\0') {
+        printf("invalid rate limit '%s'\n", argv[argc - 1]);
+        return;
+    }
+
+    mrp_log_set_ratelimit(rate, burst);
+    printf("changed log rate limit to %u/s, bursts of %u\n", rate, burst);
+}
 
 
 #define LOG_GROUP_DESCRIPTION                                               \
@@ -98,15 +144,28 @@ static void log_target(mrp_console_t *c, void *user_data,
     "Changes the logging level to the given one. Without arguments it\n" \
     "prints out the current logging level.\n"
 
-#define TARGET_SYNTAX      "[stdout|stderr|syslog|<other targets>]"
+#define TARGET_SYNTAX      "[[async:]stdout|stderr|syslog|<other targets>]"
 #define TARGET_SUMMARY     "change or show the active logging target"
 #define TARGET_DESCRIPTION \
     "Changes the active logging target to the given one. Without arguments\n" \
-    "it lists the available targets and the currently active one."
+    "it lists the available targets and the currently active one. With\n"  \
+    "the async: prefix messages are queued and written out to the target\n"\
+    "by a separate thread, dropping messages if the queue gets full."
+
+#define RATELIMIT_SYNTAX      "[rate [burst]]"
+#define RATELIMIT_SUMMARY     "change or show log rate limiting"
+#define RATELIMIT_DESCRIPTION \
+    "Changes the number of messages per second (and the burst size) any\n" \
+    "single error, warning or info call site can log. Messages beyond the\n"\
+    "limit are suppressed and counted. A rate of 0 turns limiting off.\n"  \
+    "Without arguments it shows the current limit and suppressed count.\n"
 
 MRP_CORE_CONSOLE_GROUP(log_group, "log", LOG_GROUP_DESCRIPTION, NULL, {
         MRP_TOKENIZED_CMD("level" , log_level , FALSE,
                           LEVEL_SYNTAX , LEVEL_SUMMARY , LEVEL_DESCRIPTION),
         MRP_TOKENIZED_CMD("target", log_target, FALSE,
-                          TARGET_SYNTAX, TARGET_SUMMARY, TARGET_DESCRIPTION)
+                          TARGET_SYNTAX, TARGET_SUMMARY, TARGET_DESCRIPTION),
+        MRP_TOKENIZED_CMD("ratelimit", log_ratelimit, FALSE,
+                          RATELIMIT_SYNTAX, RATELIMIT_SUMMARY,
+                          RATELIMIT_DESCRIPTION)
 });
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include <murphy/common/mainloop.h>
+
+
+static void mainloop_stats(mrp_console_t *c, void *user_data,
+                           int argc, char **argv)
+{
+    mrp_mainloop_t *ml = c->ctx->ml;
+    const char     *cmd;
+    FILE           *fp;
+
+    MRP_UNUSED(user_data);
+
+    if (argc < 2 || argc > 4) {
+        printf("%s/%s invoked with wrong number of arguments\n",
+               argv[0], argv[1]);
+        return;
+    }
+
+    cmd = argc > 2 ? argv[2] : "show";
+
+    if (!strcmp(cmd, "enable")) {
+        if (mrp_mainloop_enable_stats(ml, TRUE))
+            printf("Mainloop statistics are now enabled.\n");
+        else
+            printf("Failed to enable mainloop statistics.\n");
+    }
+    else if (!strcmp(cmd, "disable")) {
+        mrp_mainloop_enable_stats(ml, FALSE);
+        printf("Mainloop statistics are now disabled.\n");
+    }
+    else if (!strcmp(cmd, "reset")) {
+        mrp_mainloop_reset_stats(ml);
+        printf("Mainloop statistics reset.\n");
+    }
+    else if (!strcmp(cmd, "show") || !strcmp(cmd, "json")) {
+        if (argc < 4)
+            mrp_mainloop_dump_stats(ml, c->stdout, !strcmp(cmd, "json"));
+        else {
+            if ((fp = fopen(argv[3], "w")) == NULL) {
+                printf("failed to open '%s' (%d: %s)\n", argv[3],
+                       errno, strerror(errno));
+                return;
+            }
+
+            mrp_mainloop_dump_stats(ml, fp, !strcmp(cmd, "json"));
+            fclose(fp);
+
+            printf("Mainloop statistics dumped to '%s'.\n", argv[3]);
+        }
+    }
+    else
+        printf("unknown mainloop stats command '%s'\n", cmd);
+}
+
+
+#define MAINLOOP_GROUP_DESCRIPTION                                          \
+    "Mainloop commands provide means to inspect the Murphy mainloop.\n"
+
+#define STATS_SYNTAX      "[enable|disable|reset|show [file]|json [file]]"
+#define STATS_SUMMARY     "control or show mainloop dispatch statistics"
+#define STATS_DESCRIPTION                                                   \
+    "Enables, disables, resets or shows the mainloop dispatch statistics.\n"\
+    "When enabled, invocation counts and latency percentiles are collected\n"\
+    "for each I/O watch, timer, deferred, subloop and event bus callback,\n"\
+    "and for timers also their lateness relative to the scheduled expiry.\n"\
+    "Use json to get the full latency histograms in JSON format.\n"
+
+MRP_CORE_CONSOLE_GROUP(mainloop_group, "mainloop", MAINLOOP_GROUP_DESCRIPTION,
+                       NULL, {
+        MRP_TOKENIZED_CMD("stats", mainloop_stats, FALSE,
+                          STATS_SYNTAX, STATS_SUMMARY, STATS_DESCRIPTION),
+});
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <murphy/common/mm.h>
+
+
+static void mm_sample(mrp_console_t *c, void *user_data,
+                      int argc, char **argv)
+{
+    char   *end;
+    size_t  rate;
+
+    MRP_UNUSED(c);
+    MRP_UNUSED(user_data);
+
+    if (argc == 2) {
+        if ((rate = mrp_mm_sample_rate()) != 0)
+            printf("Sampling one allocation per %zu bytes.\n", rate);
+        else
+            printf("Allocation sampling is off.\n");
+        return;
+    }
+
+    if (argc != 3) {
+        printf("%s/%s invoked with wrong number of arguments\n",
+               argv[0], argv[1]);
+        return;
+    }
+
+    if (!strcmp(argv[2], "off"))
+        rate = 0;
+    else {
+        rate = (size_t)strtoul(argv[2], &end, 10);
+
+        if (*end || !*argv[2]) {
+            printf("invalid sampling rate '%s'\n", argv[2]);
+            return;
+        }
+    }
+
+    mrp_mm_sample(rate);
+
+    if (rate != 0)
+        printf("Sampling one allocation per %zu bytes.\n", rate);
+    else
+        printf("Allocation sampling is now off.\n");
+}
+
+
+static void mm_dump(mrp_console_t *c, void *user_data,
+                    int argc, char **argv)
+{
+    FILE *fp;
+
+    MRP_UNUSED(user_data);
+
+    if (argc < 2 || argc > 3) {
+        printf("%s/%s invoked with wrong number of arguments\n",
+               argv[0], argv[1]);
+        return;
+    }
+
+    if (argc < 3)
+        mrp_mm_sample_dump(c->stdout);
+    else {
+        if ((fp = fopen(argv[2], "w")) == NULL) {
+            printf("failed to open '%s' (%d: %s)\n", argv[2],
+                   errno, strerror(errno));
+            return;
+        }
+
+        mrp_mm_sample_dump(fp);
+        fclose(fp);
+
+        printf("Heap profile dumped to '%s'.\n", argv[2]);
+    }
+}
+
+
+static void mm_account(mrp_console_t *c, void *user_data,
+                       int argc, char **argv)
+{
+    MRP_UNUSED(c);
+    MRP_UNUSED(user_data);
+
+    if (argc == 3 && !strcmp(argv[2], "on"))
+        mrp_mm_account(TRUE);
+    else if (argc == 3 && !strcmp(argv[2], "off"))
+        mrp_mm_account(FALSE);
+    else if (argc != 2) {
+        printf("%s/%s invoked with wrong arguments\n", argv[0], argv[1]);
+        return;
+    }
+
+    printf("Allocation accounting is %s.\n",
+           mrp_mm_accounting() ? "on" : "off");
+}
+
+
+static void mm_tags(mrp_console_t *c, void *user_data,
+                    int argc, char **argv)
+{
+    MRP_UNUSED(user_data);
+
+    if (argc != 2) {
+        printf("%s/%s invoked with wrong number of arguments\n",
+               argv[0], argv[1]);
+        return;
+    }
+
+    mrp_mm_tag_dump(c->stdout);
+}
+
+
+#define MM_GROUP_DESCRIPTION                                                \
+    "Memory commands control the sampling allocation profiler. Sampled\n"  \
+    "allocations are accounted to their call stacks, which can be dumped\n"\
+    "as a heap profile for pprof. SIGUSR1 also dumps the profile. They\n"  \
+    "also control accounting of allocations to subsystem and client tags.\n"
+
+#define SAMPLE_SYNTAX      "[bytes|off]"
+#define SAMPLE_SUMMARY     "show or set the allocation sampling rate"
+#define SAMPLE_DESCRIPTION                                                  \
+    "Samples on average one allocation per the given number of allocated\n"\
+    "bytes, or turns sampling off. Turning sampling off forgets the live\n" \
+    "sampled blocks but keeps the cumulative counts.\n"
+
+#define MMDUMP_SYNTAX      "[file]"
+#define MMDUMP_SUMMARY     "dump the sampled heap profile"
+#define MMDUMP_DESCRIPTION                                                  \
+    "Dumps the live and cumulative sampled bytes per call stack in the\n"  \
+    "pprof legacy heap profile format to the console or the given file.\n"
+
+#define ACCOUNT_SYNTAX      "[on|off]"
+#define ACCOUNT_SUMMARY     "show or set whether allocations are accounted"
+#define ACCOUNT_DESCRIPTION                                                 \
+    "Turns accounting of allocations to subsystem and client tags on or\n" \
+    "off. Turning accounting off discharges all tracked allocations.\n"
+
+#define TAGS_SYNTAX         ""
+#define TAGS_SUMMARY        "show memory charged to accounting tags"
+#define TAGS_DESCRIPTION                                                    \
+    "Lists the live bytes and blocks, and the total number of blocks\n"   \
+    "charged to each subsystem and client accounting tag.\n"
+
+MRP_CORE_CONSOLE_GROUP(mm_group, "mm", MM_GROUP_DESCRIPTION, NULL, {
+        MRP_TOKENIZED_CMD("sample" , mm_sample , FALSE,
+                          SAMPLE_SYNTAX, SAMPLE_SUMMARY, SAMPLE_DESCRIPTION),
+        MRP_TOKENIZED_CMD("dump"   , mm_dump   , FALSE,
+                          MMDUMP_SYNTAX, MMDUMP_SUMMARY, MMDUMP_DESCRIPTION),
+        MRP_TOKENIZED_CMD("account", mm_account, FALSE,
+                          ACCOUNT_SYNTAX, ACCOUNT_SUMMARY, ACCOUNT_DESCRIPTION),
+        MRP_TOKENIZED_CMD("tags"   , mm_tags   , FALSE,
+                          TAGS_SYNTAX, TAGS_SUMMARY, TAGS_DESCRIPTION)
+});
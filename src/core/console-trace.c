@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <murphy/common/trace.h>
+
+
+static void trace_start(mrp_console_t *c, void *user_data,
+                        int argc, char **argv)
+{
+    char   *end;
+    size_t  n;
+
+    MRP_UNUSED(c);
+    MRP_UNUSED(user_data);
+
+    if (argc == 2)
+        n = 0;
+    else if (argc == 3) {
+        n = (size_t)strtoul(argv[2], &end, 10);
+
+        if (*end || !*argv[2]) {
+            printf("invalid number of events '%s'\n", argv[2]);
+            return;
+        }
+    }
+    else {
+        printf("%s/%s invoked with wrong number of arguments\n",
+               argv[0], argv[1]);
+        return;
+    }
+
+    if (mrp_trace_start(n))
+        printf("Tracing is now active.\n");
+    else
+        printf("Failed to start tracing.\n");
+}
+
+
+static void trace_stop(mrp_console_t *c, void *user_data,
+                       int argc, char **argv)
+{
+    MRP_UNUSED(c);
+    MRP_UNUSED(user_data);
+    MRP_UNUSED(argc);
+    MRP_UNUSED(argv);
+
+    mrp_trace_stop();
+
+    printf("Tracing is now stopped.\n");
+}
+
+
+static void trace_status(mrp_console_t *c, void *user_data,
+                         int argc, char **argv)
+{
+    MRP_UNUSED(user_data);
+    MRP_UNUSED(argc);
+    MRP_UNUSED(argv);
+
+    mrp_trace_dump_status(c->stdout);
+}
+
+
+static void trace_dump(mrp_console_t *c, void *user_data,
+                       int argc, char **argv)
+{
+    mrp_trace_format_t  format;
+    FILE               *fp;
+
+    MRP_UNUSED(user_data);
+
+    if (argc < 2 || argc > 4) {
+        printf("%s/%s invoked with wrong number of arguments\n",
+               argv[0], argv[1]);
+        return;
+    }
+
+    if (argc < 3 || !strcmp(argv[2], "text"))
+        format = MRP_TRACE_FORMAT_TEXT;
+    else if (!strcmp(argv[2], "chrome"))
+        format = MRP_TRACE_FORMAT_CHROME;
+    else {
+        printf("unknown trace format '%s'\n", argv[2]);
+        return;
+    }
+
+    if (argc < 4)
+        mrp_trace_dump(c->stdout, format);
+    else {
+        if ((fp = fopen(argv[3], "w")) == NULL) {
+            printf("failed to open '%s' (%d: %s)\n", argv[3],
+                   errno, strerror(errno));
+            return;
+        }
+
+        mrp_trace_dump(fp, format);
+        fclose(fp);
+
+        printf("Trace dumped to '%s'.\n", argv[3]);
+    }
+}
+
+
+#define TRACE_GROUP_DESCRIPTION                                             \
+    "Trace commands provide means to record and dump the binary trace\n"    \
+    "events of the trace points in Murphy. Debug rules (see debug set)\n"   \
+    "select which trace points get recorded, all of them without rules.\n"
+
+#define START_SYNTAX       "[events-per-thread]"
+#define START_SUMMARY      "start a new trace"
+#define START_DESCRIPTION                                                   \
+    "Starts a new trace, discarding any previously collected events. Each\n"\
+    "thread records its events to a ring buffer of the given size, with\n"  \
+    "the oldest events overwritten once the buffer is full.\n"
+
+#define STOP_SYNTAX        ""
+#define STOP_SUMMARY       "stop tracing"
+#define STOP_DESCRIPTION   "Stops tracing, keeping the collected events.\n"
+
+#define STATUS_SYNTAX      ""
+#define STATUS_SUMMARY     "show tracing status"
+#define STATUS_DESCRIPTION \
+    "Shows whether tracing is active and how many events were recorded.\n"
+
+#define DUMP_SYNTAX        "[text|chrome [file]]"
+#define DUMP_SUMMARY       "dump the collected trace events"
+#define DUMP_DESCRIPTION                                                    \
+    "Stops tracing and dumps the collected events either as text or in\n"   \
+    "the Chrome trace event format (for chrome://tracing or Perfetto) to\n" \
+    "the console or to the given file.\n"
+
+MRP_CORE_CONSOLE_GROUP(trace_group, "trace", TRACE_GROUP_DESCRIPTION, NULL, {
+        MRP_TOKENIZED_CMD("start" , trace_start , FALSE,
+                          START_SYNTAX , START_SUMMARY , START_DESCRIPTION),
+        MRP_TOKENIZED_CMD("stop"  , trace_stop  , FALSE,
+                          STOP_SYNTAX  , STOP_SUMMARY  , STOP_DESCRIPTION),
+        MRP_TOKENIZED_CMD("status", trace_status, FALSE,
+                          STATUS_SYNTAX, STATUS_SUMMARY, STATUS_DESCRIPTION),
+        MRP_TOKENIZED_CMD("dump"  , trace_dump  , FALSE,
+                          DUMP_SYNTAX  , DUMP_SUMMARY  , DUMP_DESCRIPTION)
+});
@@ -61,6 +61,7 @@
 
 #define MRP_CFG_MAXLINE 4096             /* input line length limit */
 #define MRP_CFG_MAXARGS   64             /* command argument limit */
+#define MRP_CFG_CHUNK   4096             /* streamed output chunk size */
 
 typedef struct {
     char  buf[MRP_CFG_MAXLINE];          /* input buffer */
@@ -97,15 +98,41 @@ typedef struct {
     int                  oblk;               /* saved O_NONBLOCK for ofd */
     int                  efd;                /* saved fileno(stderr) */
     int                  eblk;               /* saved O_NONBLOCK for efd */
+    mrp_list_hook_t      streams;            /* pending output streams */
+    mrp_deferred_t      *sout;               /* stream pump */
 } console_t;
 
 
+/*
+ * a pending output stream
+ */
+
+typedef struct {
+    mrp_list_hook_t          hook;           /* to list of streams */
+    mrp_console_stream_cb_t  cb;             /* chunk producer */
+    void                    *user_data;      /* opaque producer data */
+} stream_t;
+
+
+/*
+ * a buffer being streamed out
+ */
+
+typedef struct {
+    char   *buf;                             /* buffer to stream */
+    size_t  size;                            /* amount of data */
+    size_t  offs;                            /* amount already written */
+} stream_buf_t;
+
+
 static int check_destroy(mrp_console_t *mc);
 static int purge_destroyed(mrp_console_t *mc);
 static FILE *console_fopen(mrp_console_t *mc);
 static int console_read_output(console_t *c, void *buf, size_t size);
 static void console_flush_output(console_t *c, int copy_orig);
 static void console_release_output(console_t *c);
+static void console_grab_output(console_t *c);
+static void purge_streams(console_t *c);
 
 static ssize_t input_evt(mrp_console_t *mc, void *buf, size_t size);
 static void disconnected_evt(mrp_console_t *c, int error);
@@ -177,6 +204,7 @@ mrp_console_t *mrp_create_console(mrp_context_t *ctx, mrp_console_req_t *req,
 
     if ((c = mrp_allocz(sizeof(*c))) != NULL) {
         mrp_list_init(&c->hook);
+        mrp_list_init(&c->streams);
         c->ctx = ctx;
         c->req = *req;
         c->evt = evt;
@@ -230,6 +258,8 @@ static int purge_destroyed(mrp_console_t *mc)
 
         mrp_list_delete(&c->hook);
 
+        purge_streams(c);
+
         fclose(c->stdout);
         fclose(c->stderr);
 
@@ -303,6 +333,145 @@ void mrp_console_vprintf(mrp_console_t *mc, const char *fmt, va_list ap)
 }
 
 
+static void purge_streams(console_t *c)
+{
+    mrp_list_hook_t *p, *n;
+    stream_t        *s;
+
+    mrp_list_foreach(&c->streams, p, n) {
+        s = mrp_list_entry(p, typeof(*s), hook);
+
+        mrp_list_delete(&s->hook);
+        s->cb(NULL, s->user_data);
+        mrp_free(s);
+    }
+
+    mrp_del_deferred(c->sout);
+    c->sout = NULL;
+}
+
+
+static void stream_cb(mrp_deferred_t *d, void *user_data)
+{
+    console_t *c = (console_t *)user_data;
+    stream_t  *s;
+    int        more;
+
+    MRP_UNUSED(d);
+
+    if (c->destroyed || mrp_list_empty(&c->streams)) {
+        mrp_disable_deferred(c->sout);
+        return;
+    }
+
+    /*
+     * Produce one chunk of the oldest stream per mainloop iteration. The
+     * chunk producer can use the same means of output as commands do, so
+     * we grab and proxy stdout and stderr around it as for commands.
+     */
+
+    s = mrp_list_entry(c->streams.next, typeof(*s), hook);
+
+    console_grab_output(c);
+
+    MRP_CONSOLE_BUSY(c, {
+            more = s->cb((mrp_console_t *)c, s->user_data);
+        });
+
+    console_flush_output(c, TRUE);
+    console_release_output(c);
+
+    if (!more) {
+        mrp_list_delete(&s->hook);
+        s->cb(NULL, s->user_data);
+        mrp_free(s);
+    }
+
+    if (c->check_destroy((mrp_console_t *)c))
+        return;
+
+    fflush(c->stdout);
+
+    if (mrp_list_empty(&c->streams))
+        mrp_disable_deferred(c->sout);
+}
+
+
+int mrp_console_stream(mrp_console_t *mc, mrp_console_stream_cb_t cb,
+                       void *user_data)
+{
+    console_t *c = (console_t *)mc;
+    stream_t  *s;
+
+    if (c->destroyed) {
+        errno = EPIPE;
+        return -1;
+    }
+
+    if (c->sout == NULL) {
+        c->sout = mrp_add_deferred(c->ctx->ml, stream_cb, c);
+
+        if (c->sout == NULL)
+            return -1;
+    }
+
+    if ((s = mrp_allocz(sizeof(*s))) == NULL)
+        return -1;
+
+    mrp_list_init(&s->hook);
+    s->cb        = cb;
+    s->user_data = user_data;
+
+    mrp_list_append(&c->streams, &s->hook);
+    mrp_enable_deferred(c->sout);
+
+    return 0;
+}
+
+
+static int stream_buffer_cb(mrp_console_t *mc, void *user_data)
+{
+    stream_buf_t *sb = (stream_buf_t *)user_data;
+    size_t        n;
+
+    if (mc == NULL) {
+        mrp_free(sb->buf);
+        mrp_free(sb);
+
+        return FALSE;
+    }
+
+    n = MRP_MIN(sb->size - sb->offs, (size_t)MRP_CFG_CHUNK);
+
+    fwrite(sb->buf + sb->offs, 1, n, mc->stdout);
+    fflush(mc->stdout);
+
+    sb->offs += n;
+
+    return sb->offs < sb->size;
+}
+
+
+int mrp_console_stream_buffer(mrp_console_t *mc, char *buf, size_t size)
+{
+    stream_buf_t *sb;
+
+    if ((sb = mrp_allocz(sizeof(*sb))) != NULL) {
+        sb->buf  = buf;
+        sb->size = size;
+
+        if (mrp_console_stream(mc, stream_buffer_cb, sb) == 0)
+            return 0;
+
+        mrp_free(sb);
+    }
+
+    mrp_free(buf);
+
+    return -1;
+}
+
+
 void mrp_set_console_prompt(mrp_console_t *mc)
 {
     console_t *c = (console_t *)mc;
@@ -182,4 +182,23 @@ void mrp_console_vprintf(mrp_console_t *mc, const char *fmt, va_list ap);
 /** Set the prompt of a console. */
 void mrp_set_console_prompt(mrp_console_t *mc);
 
+/**
+ * Callback to produce the next chunk of streamed console output.
+ *
+ * The callback is called once per mainloop iteration and should produce
+ * a reasonably small chunk of output, either with mrp_console_printf or
+ * with printf, as console commands do. It returns TRUE if there is more
+ * output to produce and FALSE once it is done. Finally, the callback is
+ * called with a NULL console to let it release user_data. This also
+ * happens if the console goes away before all output has been produced.
+ */
+typedef int (*mrp_console_stream_cb_t)(mrp_console_t *mc, void *user_data);
+
+/** Stream output to a console chunk by chunk from the mainloop. */
+int mrp_console_stream(mrp_console_t *mc, mrp_console_stream_cb_t cb,
+                       void *user_data);
+
+/** Stream the given buffer to a console, taking ownership of it. */
+int mrp_console_stream_buffer(mrp_console_t *mc, char *buf, size_t size);
+
 #endif /* __MURPHY_CONSOLE_H__ */
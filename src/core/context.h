@@ -30,6 +30,7 @@
 #ifndef __MURPHY_CONTEXT_H__
 #define __MURPHY_CONTEXT_H__
 
+#include <stdint.h>
 #include <stdbool.h>
 
 typedef struct mrp_context_s mrp_context_t;
@@ -56,6 +57,9 @@ struct mrp_context_s {
     const char *config_file;               /* configuration file */
     const char *config_dir;                /* plugin configuration directory */
     const char *plugin_dir;                /* plugin directory */
+    const char *state_dir;                 /* persistent state directory */
+    const char *precompile;                /* Lua path to precompile, or NULL */
+    const char *profile_startup;           /* startup profile output, or NULL */
     bool        foreground;                /* whether to stay in foreground*/
 
     char       *resolver_ruleset;          /* resolver ruleset file */
@@ -69,6 +73,13 @@ struct mrp_context_s {
     bool        disable_runtime_load;      /* disallow post-startup loading */
     bool        disable_console;           /* disable murphy console */
 
+    /* real-time mode settings */
+    uint64_t    rt_cpus;                   /* CPUs to pin the mainloop to */
+    int         rt_priority;               /* SCHED_FIFO priority, or 0 */
+    bool        rt_lock;                   /* prefault and lock memory */
+    size_t      rt_reserve;                /* bytes to pre-grow heap by */
+    int         rt_objects;                /* free slots per object pool */
+
     /* actual runtime context data */
     int              state;                /* context/daemon state */
     mrp_mainloop_t  *ml;                   /* mainloop */
@@ -96,6 +96,7 @@ typedef enum {
     MRP_DOMAIN_NOTFOUND,                 /* domain not found */
     MRP_DOMAIN_NOMETHOD,                 /* call domain method not found */
     MRP_DOMAIN_FAILED,                   /* called method remotely failed */
+    MRP_DOMAIN_TIMEOUT,                  /* no reply within the timeout */
 } mrp_domain_error_t;
 
 /* Type for a proxied invocation argument. */
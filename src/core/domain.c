@@ -27,11 +27,15 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <string.h>
+#include <stdbool.h>
+
 #include <murphy/common/macros.h>
 #include <murphy/common/debug.h>
 #include <murphy/common/log.h>
 #include <murphy/common/mm.h>
 #include <murphy/common/list.h>
+#include <murphy/common/mainloop.h>
 
 #include <murphy/core/context.h>
 #include <murphy/core/domain.h>
@@ -45,6 +49,29 @@ typedef struct {
 } method_t;
 
 
+/*
+ * a multicast invocation
+ */
+
+typedef struct multicast_s multicast_t;
+
+typedef struct {
+    multicast_t *mc;                     /* multicast we belong to */
+    int          idx;                    /* index of our return */
+} mcast_slot_t;
+
+struct multicast_s {
+    mrp_domain_return_t          *rets;  /* aggregated returns */
+    mcast_slot_t                 *slots; /* per-domain return contexts */
+    int                           nret;  /* number of domains */
+    int                           nleft; /* replies still outstanding */
+    mrp_timer_t                  *timer; /* timeout timer */
+    bool                          done;  /* returns already delivered */
+    mrp_domain_multi_return_cb_t  cb;    /* aggregated return callback */
+    void                         *user_data; /* opaque callback data */
+};
+
+
 void domain_setup(mrp_context_t *ctx)
 {
     mrp_list_init(&ctx->domain_methods);
@@ -145,3 +172,254 @@ int mrp_invoke_domain(mrp_context_t *ctx, const char *domain,
     return handler(handler_data, domain,
                    method, narg, args, return_cb, user_data);
 }
+
+
+static size_t arg_size(mrp_domctl_type_t type)
+{
+    switch (type) {
+    case MRP_DOMCTL_STRING: return sizeof(char *);
+    case MRP_DOMCTL_DOUBLE: return sizeof(double);
+    case MRP_DOMCTL_BOOL:   return sizeof(int);
+    case MRP_DOMCTL_UINT8:  return sizeof(uint8_t);
+    case MRP_DOMCTL_INT8:   return sizeof(int8_t);
+    case MRP_DOMCTL_UINT16: return sizeof(uint16_t);
+    case MRP_DOMCTL_INT16:  return sizeof(int16_t);
+    case MRP_DOMCTL_UINT32: return sizeof(uint32_t);
+    case MRP_DOMCTL_INT32:  return sizeof(int32_t);
+    case MRP_DOMCTL_UINT64: return sizeof(uint64_t);
+    case MRP_DOMCTL_INT64:  return sizeof(int64_t);
+    default:                return 0;
+    }
+}
+
+
+static void free_args(int narg, mrp_domctl_arg_t *args)
+{
+    mrp_domctl_type_t type;
+    uint32_t          j;
+    int               i;
+
+    for (i = 0; i < narg; i++) {
+        if (args[i].type == MRP_DOMCTL_STRING)
+            mrp_free((char *)args[i].str);
+        else if (MRP_DOMCTL_IS_ARRAY(args[i].type)) {
+            type = MRP_DOMCTL_ARRAY_TYPE(args[i].type);
+
+            if (type == MRP_DOMCTL_STRING && args[i].arr != NULL)
+                for (j = 0; j < args[i].size; j++)
+                    mrp_free(((char **)args[i].arr)[j]);
+
+            mrp_free(args[i].arr);
+        }
+    }
+
+    mrp_free(args);
+}
+
+
+static mrp_domctl_arg_t *copy_args(int narg, mrp_domctl_arg_t *args)
+{
+    mrp_domctl_arg_t  *copy;
+    mrp_domctl_type_t  type;
+    char             **src, **dst;
+    size_t             size;
+    uint32_t           j;
+    int                i;
+
+    if (narg <= 0)
+        return NULL;
+
+    if ((copy = mrp_allocz_array(typeof(*copy), narg)) == NULL)
+        return NULL;
+
+    for (i = 0; i < narg; i++) {
+        copy[i] = args[i];
+
+        if (args[i].type == MRP_DOMCTL_STRING) {
+            if ((copy[i].str = mrp_strdup(args[i].str)) == NULL &&
+                args[i].str != NULL)
+                goto fail;
+        }
+        else if (MRP_DOMCTL_IS_ARRAY(args[i].type)) {
+            type = MRP_DOMCTL_ARRAY_TYPE(args[i].type);
+            size = arg_size(type) * args[i].size;
+
+            if ((copy[i].arr = mrp_allocz(size)) == NULL && size != 0)
+                goto fail;
+
+            if (type != MRP_DOMCTL_STRING) {
+                if (size != 0)
+                    memcpy(copy[i].arr, args[i].arr, size);
+                continue;
+            }
+
+            src = args[i].arr;
+            dst = copy[i].arr;
+
+            for (j = 0; j < args[i].size; j++)
+                if ((dst[j] = mrp_strdup(src[j])) == NULL && src[j] != NULL)
+                    goto fail;
+        }
+    }
+
+    return copy;
+
+ fail:
+    free_args(i + 1, copy);
+    return NULL;
+}
+
+
+static void multicast_free(multicast_t *mc)
+{
+    int i;
+
+    if (mc->rets != NULL) {
+        for (i = 0; i < mc->nret; i++) {
+            mrp_free((char *)mc->rets[i].domain);
+            free_args(mc->rets[i].narg, mc->rets[i].args);
+        }
+    }
+
+    mrp_del_timer(mc->timer);
+    mrp_free(mc->rets);
+    mrp_free(mc->slots);
+    mrp_free(mc);
+}
+
+
+static void multicast_complete(multicast_t *mc)
+{
+    mrp_debug("multicast invocation %p completed, %d replies missing",
+              mc, mc->nleft);
+
+    mc->done = true;
+    mrp_del_timer(mc->timer);
+    mc->timer = NULL;
+
+    mc->cb(mc->nret, mc->rets, mc->user_data);
+
+    /*
+     * Notes:
+     *     Late replies might still arrive for domains that timed out.
+     *     We need to hang around until all of them did (or the domains
+     *     went away) so their return contexts stay valid.
+     */
+
+    if (mc->nleft == 0)
+        multicast_free(mc);
+}
+
+
+static void multicast_return_cb(int error, int retval, int narg,
+                                mrp_domctl_arg_t *args, void *user_data)
+{
+    mcast_slot_t        *slot = (mcast_slot_t *)user_data;
+    multicast_t         *mc   = slot->mc;
+    mrp_domain_return_t *r    = mc->rets + slot->idx;
+
+    mc->nleft--;
+
+    if (mc->done) {
+        if (mc->nleft == 0)
+            multicast_free(mc);
+        return;
+    }
+
+    r->error  = error;
+    r->retval = retval;
+
+    if (error == MRP_DOMAIN_OK && narg > 0) {
+        if ((r->args = copy_args(narg, args)) != NULL)
+            r->narg = narg;
+        else
+            r->error = MRP_DOMAIN_FAILED;
+    }
+
+    if (mc->nleft == 0)
+        multicast_complete(mc);
+}
+
+
+static void multicast_timeout_cb(mrp_timer_t *t, void *user_data)
+{
+    multicast_t *mc = (multicast_t *)user_data;
+
+    MRP_UNUSED(t);
+
+    mrp_log_warning("Multicast invocation timed out with %d replies missing.",
+                    mc->nleft);
+
+    multicast_complete(mc);
+}
+
+
+int mrp_invoke_domains(mrp_context_t *ctx, const char **domains, int ndomain,
+                       const char *method, int narg, mrp_domctl_arg_t *args,
+                       unsigned int timeout,
+                       mrp_domain_multi_return_cb_t return_cb, void *user_data)
+{
+    multicast_t *mc;
+    int          i, nsent;
+
+    if (return_cb == NULL) {
+        for (i = nsent = 0; i < ndomain; i++)
+            if (mrp_invoke_domain(ctx, domains[i], method, narg, args,
+                                  NULL, NULL))
+                nsent++;
+
+        return nsent > 0;
+    }
+
+    if (ndomain <= 0 || (mc = mrp_allocz(sizeof(*mc))) == NULL)
+        return FALSE;
+
+    mc->rets      = mrp_allocz_array(typeof(*mc->rets) , ndomain);
+    mc->slots     = mrp_allocz_array(typeof(*mc->slots), ndomain);
+    mc->nret      = ndomain;
+    mc->cb        = return_cb;
+    mc->user_data = user_data;
+
+    if (mc->rets == NULL || mc->slots == NULL)
+        goto fail;
+
+    for (i = 0; i < ndomain; i++) {
+        mc->slots[i].mc  = mc;
+        mc->slots[i].idx = i;
+
+        mc->rets[i].domain = mrp_strdup(domains[i]);
+        mc->rets[i].error  = MRP_DOMAIN_TIMEOUT;
+
+        if (mc->rets[i].domain == NULL)
+            goto fail;
+    }
+
+    /*
+     * Notes:
+     *     Replies are delivered from the mainloop, so we can fire off all
+     *     the invocations first and only then start waiting for them. A
+     *     domain we fail to invoke is marked as not found right away.
+     */
+
+    for (i = nsent = 0; i < ndomain; i++) {
+        if (mrp_invoke_domain(ctx, domains[i], method, narg, args,
+                              multicast_return_cb, mc->slots + i)) {
+            nsent++;
+            mc->nleft++;
+        }
+        else
+            mc->rets[i].error = MRP_DOMAIN_NOTFOUND;
+    }
+
+    if (nsent == 0)
+        goto fail;
+
+    if (timeout > 0)
+        mc->timer = mrp_add_timer(ctx->ml, timeout, multicast_timeout_cb, mc);
+
+    return TRUE;
+
+ fail:
+    multicast_free(mc);
+    return FALSE;
+}
@@ -47,6 +47,20 @@ typedef int (*mrp_domain_invoke_cb_t)(uint32_t narg, mrp_domctl_arg_t *args,
 typedef void (*mrp_domain_return_cb_t)(int error, int retval, int narg,
                                        mrp_domctl_arg_t *args, void *user_data);
 
+/* Return of a single domain in a multicast invocation. */
+typedef struct {
+    const char       *domain;            /* domain invoked */
+    int               error;             /* MRP_DOMAIN_* error code */
+    int               retval;            /* method return value */
+    int               narg;              /* number of returned arguments */
+    mrp_domctl_arg_t *args;              /* returned arguments */
+} mrp_domain_return_t;
+
+/* Type for an aggregated multicast invocation return handler. */
+typedef void (*mrp_domain_multi_return_cb_t)(int nret,
+                                             mrp_domain_return_t *rets,
+                                             void *user_data);
+
 typedef struct {
     char                   *name;        /* method name */
     int                     max_out;     /* max. number of return arguments */
@@ -80,6 +94,19 @@ int mrp_invoke_domain(mrp_context_t *ctx, const char *domain, const char *method
                       int narg, mrp_domctl_arg_t *args,
                       mrp_domain_return_cb_t return_cb, void *user_data);
 
+/*
+ * Invoke the named method of several domains concurrently. The aggregated
+ * returns are passed to return_cb once every domain has replied, or when
+ * the timeout (in milliseconds, 0 for none) expires, whichever happens
+ * first. Domains that did not reply in time have their error set to
+ * MRP_DOMAIN_TIMEOUT. The returns are only valid during the callback.
+ */
+int mrp_invoke_domains(mrp_context_t *ctx, const char **domains, int ndomain,
+                       const char *method, int narg, mrp_domctl_arg_t *args,
+                       unsigned int timeout,
+                       mrp_domain_multi_return_cb_t return_cb,
+                       void *user_data);
+
 /* Set the domain invoke handler. */
 int mrp_set_domain_invoke_handler(mrp_context_t *ctx,
                                   mrp_domain_invoke_handler_t handler,
@@ -33,6 +33,7 @@
 #include <murphy/common/mm.h>
 #include <murphy/common/list.h>
 #include <murphy/common/msg.h>
+#include <murphy/common/intern.h>
 
 #include <murphy/core/event.h>
 
@@ -42,44 +43,89 @@
  */
 
 typedef struct {
-    char            *name;                    /* event name */
-    int              id;                      /* associated event id */
-    mrp_list_hook_t  watches;                 /* single-event watches */
+    const char         *name;             /* event name */
+    int                 id;               /* associated event id */
+    mrp_event_watch_t **watches;          /* watches for this event */
+    int                 nwatch;           /* number of watches */
 } event_def_t;
 
 
 /*
  * an event watch
+ *
+ * Watches are kept in per-event arrays of subscribers, a watch for several
+ * events being added to the subscribers of each of its events, so that an
+ * emitted event only visits the watches interested in it.
  */
 
 struct mrp_event_watch_s {
-    mrp_list_hook_t   hook;                   /* hook to event watch list */
     mrp_list_hook_t   purge;                  /* hook to deleted event list */
     mrp_event_cb_t    cb;                     /* notification callback */
     mrp_event_mask_t  events;                 /* events to watch */
     void             *user_data;              /* opaque callback data */
+    int               dead;                   /* deleted during emit */
 };
 
 
 static event_def_t     events[MRP_EVENT_MAX]; /* event table */
 static int             nevent;                /* number of events */
 static int             nemit;                 /* events being emitted */
-static mrp_list_hook_t watches;               /* multi-event watches */
-static mrp_list_hook_t deleted;               /* events deleted during emit */
+static MRP_LIST_HOOK  (deleted);              /* events deleted during emit */
 
 
 static int single_event(mrp_event_mask_t *mask);
 
 
-MRP_INIT static void init_watch_lists(void)
+static void unsubscribe(mrp_event_watch_t *w)
 {
-    int i;
+    event_def_t *def;
+    uint64_t     bits;
+    int          id, i;
+
+    for (bits = w->events; bits != 0; bits &= bits - 1) {
+        if ((id = __builtin_ffsll(bits)) >= MRP_EVENT_MAX)
+            break;
 
-    for (i = 0; i < MRP_EVENT_MAX; i++)
-        mrp_list_init(&events[i].watches);
+        def = events + id;
 
-    mrp_list_init(&watches);
-    mrp_list_init(&deleted);
+        for (i = 0; i < def->nwatch; i++) {
+            if (def->watches[i] == w) {
+                memmove(def->watches + i, def->watches + i + 1,
+                        (def->nwatch - i - 1) * sizeof(def->watches[0]));
+                def->nwatch--;
+                break;
+            }
+        }
+
+        if (def->nwatch == 0) {
+            mrp_free(def->watches);
+            def->watches = NULL;
+        }
+    }
+}
+
+
+static int subscribe(mrp_event_watch_t *w)
+{
+    event_def_t *def;
+    uint64_t     bits;
+    int          id;
+
+    for (bits = w->events; bits != 0; bits &= bits - 1) {
+        if ((id = __builtin_ffsll(bits)) >= MRP_EVENT_MAX)
+            break;
+
+        def = events + id;
+
+        if (!mrp_reallocz(def->watches, def->nwatch, def->nwatch + 1)) {
+            unsubscribe(w);
+            return FALSE;
+        }
+
+        def->watches[def->nwatch++] = w;
+    }
+
+    return TRUE;
 }
 
 
@@ -87,77 +133,40 @@ mrp_event_watch_t *mrp_add_event_watch(mrp_event_mask_t *mask,
                                        mrp_event_cb_t cb, void *user_data)
 {
     mrp_event_watch_t *w;
-    event_def_t       *def;
     int                id;
 
-    if (cb != NULL) {
-        w = mrp_allocz(sizeof(*w));
-
-        if (w != NULL) {
-            mrp_list_init(&w->hook);
-            mrp_list_init(&w->purge);
-            w->cb        = cb;
-            w->user_data = user_data;
-            w->events    = *mask;
-
-            id = single_event(mask);
-
-            if (id != MRP_EVENT_UNKNOWN) {
-                if (MRP_EVENT_UNKNOWN < id && id <= nevent) {
-                    def = events + id;
-
-                    if (def->name != NULL)
-                        mrp_list_append(&def->watches, &w->hook);
-                    else {
-                        mrp_free(w);
-                        w = NULL;
-                    }
-                }
-                else {
-                    mrp_free(w);
-                    w = NULL;
-                }
-            }
-            else
-                mrp_list_append(&watches, &w->hook);
-        }
-    }
-    else
-        w = NULL;
-
-    return w;
+    if (cb == NULL)
+        return NULL;
 
-#if 0
-    if (MRP_EVENT_UNKNOWN < id && id <= nevent) {
-        def = events + id;
+    /* a single-event watch must be for a registered event */
+    id = single_event(mask);
 
-        if (def->name != NULL && cb != NULL) {
-            w = mrp_allocz(sizeof(*w));
+    if (id != MRP_EVENT_UNKNOWN)
+        if (!(id <= nevent && events[id].name != NULL))
+            return NULL;
 
-            if (w != NULL) {
-                mrp_list_init(&w->hook);
-                mrp_list_init(&w->purge);
-                w->cb        = cb;
-                w->user_data = user_data;
+    w = mrp_allocz(sizeof(*w));
 
-                if (single_event(mask)) {
-                    id = single_event(mask);
+    if (w == NULL)
+        return NULL;
 
-                mrp_list_append(&def->watches, &w->hook);
+    mrp_list_init(&w->purge);
+    w->cb        = cb;
+    w->user_data = user_data;
+    w->events    = *mask;
 
-                return w;
-            }
-        }
+    if (!subscribe(w)) {
+        mrp_free(w);
+        return NULL;
     }
 
-    return NULL;
-#endif
+    return w;
 }
 
 
 static void delete_watch(mrp_event_watch_t *w)
 {
-    mrp_list_delete(&w->hook);
+    unsubscribe(w);
     mrp_list_delete(&w->purge);
     mrp_free(w);
 }
@@ -178,8 +187,12 @@ static void purge_deleted(void)
 void mrp_del_event_watch(mrp_event_watch_t *w)
 {
     if (w != NULL) {
-        if (nemit > 0)
-            mrp_list_append(&deleted, &w->purge);
+        if (nemit > 0) {
+            if (!w->dead) {
+                w->dead = TRUE;
+                mrp_list_append(&deleted, &w->purge);
+            }
+        }
         else
             delete_watch(w);
     }
@@ -192,17 +205,16 @@ int mrp_get_event_id(const char *name, int create)
     int          i;
 
     for (i = MRP_EVENT_UNKNOWN + 1, def = events + i; i <= nevent; i++, def++) {
-        if (!strcmp(name, def->name))
+        if (name == def->name || !strcmp(name, def->name))
             return i;
     }
 
     if (create) {
         if (nevent < MRP_EVENT_MAX - 1) {
             def       = events + 1 + nevent;
-            def->name = mrp_strdup(name);
+            def->name = mrp_intern(name);
 
             if (def->name != NULL) {
-                mrp_list_init(&def->watches);
                 def->id = 1 + nevent++;
 
                 return def->id;
@@ -231,8 +243,8 @@ const char *mrp_get_event_name(int id)
 int mrp_emit_event_msg(int id, mrp_msg_t *event_data)
 {
     event_def_t       *def;
-    mrp_list_hook_t   *p, *n;
     mrp_event_watch_t *w;
+    int                i;
 
     if (MRP_EVENT_UNKNOWN < id && id <= nevent) {
         def = events + id;
@@ -246,14 +258,10 @@ int mrp_emit_event_msg(int id, mrp_msg_t *event_data)
             mrp_msg_dump(event_data, stdout);
 #endif
 
-            mrp_list_foreach(&def->watches, p, n) {
-                w = mrp_list_entry(p, typeof(*w), hook);
-                w->cb(w, def->id, event_data, w->user_data);
-            }
-
-            mrp_list_foreach(&watches, p, n) {
-                w = mrp_list_entry(p, typeof(*w), hook);
-                if (mrp_test_event(&w->events, id))
+            /* callbacks might add watches, so don't cache def->watches */
+            for (i = 0; i < def->nwatch; i++) {
+                w = def->watches[i];
+                if (!w->dead)
                     w->cb(w, def->id, event_data, w->user_data);
             }
 
@@ -343,7 +351,7 @@ static int lowest_bit(mrp_event_mask_t *mask)
 {
     uint64_t bits = *mask;
 
-    return __builtin_ffs(bits);
+    return __builtin_ffsll(bits);
 }
 
 
@@ -282,6 +282,19 @@ static void gc_cb(mrp_console_t *c, void *user_data, int argc, char **argv)
     }
 }
 
+static void reload_cb(mrp_console_t *c, void *user_data, int argc, char **argv)
+{
+    MRP_UNUSED(c);
+    MRP_UNUSED(user_data);
+    MRP_UNUSED(argc);
+    MRP_UNUSED(argv);
+
+    if (mrp_lua_reload_config())
+        printf("Lua configuration will be reloaded.\n");
+    else
+        printf("Failed to schedule reloading the Lua configuration.\n");
+}
+
 #define LUA_GROUP_DESCRIPTION                                    \
     "Lua commands allows one to evaluate Lua code either from\n" \
     "the console command line itself, or from sourced files.\n"
@@ -324,6 +337,13 @@ static void gc_cb(mrp_console_t *c, void *user_data, int argc, char **argv)
 #define GC_SUMMARY       "trigger or configure the Lua garbage collector"
 #define GC_DESCRIPTION   "Trigger or configure the Lua garbage collector."
 
+#define RELOAD_SYNTAX      "reload"
+#define RELOAD_SUMMARY     "reload the main Lua configuration"
+#define RELOAD_DESCRIPTION                                              \
+    "Re-execute the main Lua configuration without a daemon restart.\n" \
+    "Functions of decision elements, sinks and resource methods are\n"  \
+    "rebound, already existing zones, classes and tables are kept.\n"
+
 MRP_CORE_CONSOLE_GROUP(lua_group, "lua", LUA_GROUP_DESCRIPTION, NULL, {
         MRP_TOKENIZED_CMD("source", source_cb, FALSE,
                           SOURCE_SYNTAX, SOURCE_SUMMARY, SOURCE_DESCRIPTION),
@@ -336,4 +356,6 @@ MRP_CORE_CONSOLE_GROUP(lua_group, "lua", LUA_GROUP_DESCRIPTION, NULL, {
                           DUMP_SYNTAX, DUMP_SUMMARY, DUMP_DESCRIPTION),
         MRP_TOKENIZED_CMD("gc", gc_cb, FALSE,
                           GC_SYNTAX, GC_SUMMARY, GC_DESCRIPTION),
+        MRP_TOKENIZED_CMD("reload", reload_cb, FALSE,
+                          RELOAD_SYNTAX, RELOAD_SUMMARY, RELOAD_DESCRIPTION),
     });
@@ -0,0 +1,456 @@
+/*
+ * Copyright (c) 2012, 2013, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <alloca.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/debug.h>
+#include <murphy/common/log.h>
+#include <murphy/common/mm.h>
+#include <murphy/common/mainloop.h>
+#include <murphy/core/domain.h>
+#include <murphy/core/lua-utils/lua-utils.h>
+#include <murphy/core/lua-bindings/murphy.h>
+
+/*
+ * Lua coroutines driven by the mainloop
+ *
+ * Handlers invoked through mrp_lua_coro_call() run in a coroutine of
+ * their own. A C binding called from such a handler can park it with
+ * mrp_lua_coro_suspend() and lua_yield(), then push its results onto
+ * mrp_lua_coro_state() and mrp_lua_coro_resume() it once the awaited
+ * event has happened. Until then the thread is anchored in the registry.
+ */
+
+struct mrp_lua_coro_s {
+    lua_State  *L;                       /* state the coroutine belongs to */
+    lua_State  *T;                       /* coroutine thread */
+    int         ref;                     /* registry reference to T */
+    const char *what;                    /* what we're running, for errors */
+    bool        suspended;               /* waiting to be resumed */
+};
+
+
+static mrp_lua_coro_t *current;          /* coroutine being run, if any */
+
+
+static int coro_resume(lua_State *T, lua_State *from, int narg)
+{
+#if LUA_VERSION_NUM >= 504
+    int nres;
+
+    return lua_resume(T, from, narg, &nres);
+#elif LUA_VERSION_NUM >= 502
+    return lua_resume(T, from, narg);
+#else
+    MRP_UNUSED(from);
+
+    return lua_resume(T, narg);
+#endif
+}
+
+
+static void coro_free(mrp_lua_coro_t *co)
+{
+    luaL_unref(co->L, LUA_REGISTRYINDEX, co->ref);
+    mrp_free(co);
+}
+
+
+static int coro_run(mrp_lua_coro_t *co, int narg)
+{
+    mrp_lua_coro_t *prev = current;
+    int             status;
+
+    current = co;
+    status  = coro_resume(co->T, co->L, narg);
+    current = prev;
+
+    switch (status) {
+    case 0:
+        coro_free(co);
+        return 0;
+
+    case LUA_YIELD:
+        if (co->suspended)
+            return 0;
+        mrp_log_error("%s yielded without awaiting anything, dropping it",
+                      co->what);
+        coro_free(co);
+        return -1;
+
+    default:
+        mrp_log_error("failed to invoke %s (%s)", co->what,
+                      lua_type(co->T, -1) == LUA_TSTRING ?
+                      lua_tostring(co->T, -1) : "unknown error");
+        coro_free(co);
+        return -1;
+    }
+}
+
+
+int mrp_lua_coro_call(lua_State *L, int narg, const char *what)
+{
+    mrp_lua_coro_t *co;
+
+    co = mrp_allocz(sizeof(*co));
+
+    if (co == NULL) {
+        lua_pop(L, narg + 1);
+        return -1;
+    }
+
+    co->L    = mrp_lua_main_state(L);
+    co->what = what;
+    co->T    = lua_newthread(L);
+    co->ref  = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    lua_xmove(L, co->T, narg + 1);
+
+    return coro_run(co, narg);
+}
+
+
+mrp_lua_coro_t *mrp_lua_coro_suspend(lua_State *L)
+{
+    mrp_lua_coro_t *co = current;
+
+    if (co == NULL || co->T != L || co->suspended) {
+        luaL_error(L, "can only await from a murphy handler or m:spawn");
+        return NULL;
+    }
+
+    co->suspended = true;
+
+    return co;
+}
+
+
+lua_State *mrp_lua_coro_state(mrp_lua_coro_t *co)
+{
+    return co->T;
+}
+
+
+int mrp_lua_coro_resume(mrp_lua_coro_t *co, int nres)
+{
+    if (!co->suspended) {
+        mrp_log_error("attempt to resume running coroutine of %s", co->what);
+        return -1;
+    }
+
+    co->suspended = false;
+
+    return coro_run(co, nres);
+}
+
+
+void mrp_lua_coro_cancel(mrp_lua_coro_t *co)
+{
+    if (co != NULL && co->suspended)
+        coro_free(co);
+}
+
+
+lua_State *mrp_lua_main_state(lua_State *L)
+{
+    lua_State *M = mrp_lua_get_lua_state();
+
+    return M != NULL ? M : L;
+}
+
+
+/*
+ * Lua API: m:spawn(f, ...), m:sleep(msecs) and m:invoke(domain, method, ...)
+ */
+
+static void drop_self(lua_State *L)
+{
+    if (lua_isuserdata(L, 1))
+        lua_remove(L, 1);
+}
+
+
+static int coro_lua_spawn(lua_State *L)
+{
+    int narg;
+
+    drop_self(L);
+
+    narg = lua_gettop(L);
+
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+
+    lua_pushboolean(L, mrp_lua_coro_call(L, narg - 1, "spawned Lua coroutine")
+                    == 0);
+
+    return 1;
+}
+
+
+static void sleep_cb(mrp_timer_t *t, void *user_data)
+{
+    mrp_lua_coro_t *co = (mrp_lua_coro_t *)user_data;
+
+    mrp_del_timer(t);
+
+    lua_pushboolean(mrp_lua_coro_state(co), true);
+    mrp_lua_coro_resume(co, 1);
+}
+
+
+static int coro_lua_sleep(lua_State *L)
+{
+    mrp_context_t  *ctx = mrp_lua_get_murphy_context();
+    mrp_lua_coro_t *co;
+    lua_Number      msecs;
+
+    drop_self(L);
+
+    msecs = luaL_checknumber(L, 1);
+
+    if (msecs < 0)
+        return luaL_error(L, "invalid sleep interval %f", msecs);
+
+    co = mrp_lua_coro_suspend(L);
+
+    if (mrp_add_timer(ctx->ml, (unsigned int)msecs, sleep_cb, co) == NULL) {
+        co->suspended = false;
+        return luaL_error(L, "failed to create Murphy timer");
+    }
+
+    return lua_yield(L, 0);
+}
+
+
+static void push_domctl_value(lua_State *L, mrp_domctl_value_t *v)
+{
+    switch (v->type) {
+    case MRP_DOMCTL_STRING: lua_pushstring(L, v->str);          break;
+    case MRP_DOMCTL_BOOL:   lua_pushboolean(L, v->bln);         break;
+    case MRP_DOMCTL_DOUBLE: lua_pushnumber(L, v->dbl);          break;
+    case MRP_DOMCTL_UINT8:  lua_pushinteger(L, v->u8);          break;
+    case MRP_DOMCTL_INT8:   lua_pushinteger(L, v->s8);          break;
+    case MRP_DOMCTL_UINT16: lua_pushinteger(L, v->u16);         break;
+    case MRP_DOMCTL_INT16:  lua_pushinteger(L, v->s16);         break;
+    case MRP_DOMCTL_UINT32: lua_pushnumber(L, v->u32);          break;
+    case MRP_DOMCTL_INT32:  lua_pushinteger(L, v->s32);         break;
+    case MRP_DOMCTL_UINT64: lua_pushnumber(L, (lua_Number)v->u64); break;
+    case MRP_DOMCTL_INT64:  lua_pushnumber(L, (lua_Number)v->s64); break;
+    default:                lua_pushnil(L);                     break;
+    }
+}
+
+
+static void invoke_return_cb(int error, int retval, int narg,
+                             mrp_domctl_arg_t *args, void *user_data)
+{
+    mrp_lua_coro_t *co = (mrp_lua_coro_t *)user_data;
+    lua_State      *T  = mrp_lua_coro_state(co);
+    int             i;
+
+    lua_pushinteger(T, error);
+    lua_pushinteger(T, retval);
+
+    if (error != 0)
+        narg = 0;
+
+    luaL_checkstack(T, narg, "too many domain method return values");
+
+    for (i = 0; i < narg; i++)
+        push_domctl_value(T, args + i);
+
+    mrp_lua_coro_resume(co, 2 + narg);
+}
+
+
+static int check_invoke_args(lua_State *L, int first, int narg,
+                             mrp_domctl_arg_t *args, const char *domain,
+                             const char *method)
+{
+    int i, idx;
+
+    for (i = 0; i < narg; i++) {
+        idx = first + i;
+
+        switch (lua_type(L, idx)) {
+        case LUA_TSTRING:
+            args[i].type = MRP_DOMCTL_STRING;
+            args[i].str  = lua_tostring(L, idx);
+            break;
+        case LUA_TNUMBER:
+            if (lua_tonumber(L, idx) == (int32_t)lua_tonumber(L, idx)) {
+                args[i].type = MRP_DOMCTL_INT32;
+                args[i].s32  = (int32_t)lua_tonumber(L, idx);
+            }
+            else {
+                args[i].type = MRP_DOMCTL_DOUBLE;
+                args[i].dbl  = lua_tonumber(L, idx);
+            }
+            break;
+        case LUA_TBOOLEAN:
+            args[i].type = MRP_DOMCTL_BOOL;
+            args[i].bln  = lua_toboolean(L, idx);
+            break;
+        default:
+            return luaL_error(L, "invalid argument #%d (%s) for %s.%s",
+                              i + 1, luaL_typename(L, idx), domain, method);
+        }
+    }
+
+    return 0;
+}
+
+
+static int coro_lua_invoke(lua_State *L)
+{
+    mrp_context_t    *ctx = mrp_lua_get_murphy_context();
+    const char       *domain, *method;
+    mrp_domctl_arg_t *args;
+    mrp_lua_coro_t   *co;
+    int               narg;
+
+    drop_self(L);
+
+    domain = luaL_checkstring(L, 1);
+    method = luaL_checkstring(L, 2);
+    narg   = lua_gettop(L) - 2;
+    args   = alloca(narg * sizeof(*args) + 1);
+
+    check_invoke_args(L, 3, narg, args, domain, method);
+
+    co = mrp_lua_coro_suspend(L);
+
+    /*
+     * Notes:
+     *     The arguments stay on the stack of the suspended thread, so the
+     *     strings we passed remain valid until the reply arrives.
+     */
+
+    if (!mrp_invoke_domain(ctx, domain, method, narg, args,
+                           invoke_return_cb, co)) {
+        co->suspended = false;
+        lua_pushinteger(L, MRP_DOMAIN_NOTFOUND);
+        lua_pushnil(L);
+        return 2;
+    }
+
+    return lua_yield(L, 0);
+}
+
+
+static void invoke_all_return_cb(int nret, mrp_domain_return_t *rets,
+                                 void *user_data)
+{
+    mrp_lua_coro_t *co = (mrp_lua_coro_t *)user_data;
+    lua_State      *T  = mrp_lua_coro_state(co);
+    int             i, j;
+
+    lua_createtable(T, 0, nret);
+
+    for (i = 0; i < nret; i++) {
+        lua_createtable(T, rets[i].narg, 2);
+
+        lua_pushinteger(T, rets[i].error);
+        lua_setfield(T, -2, "error");
+        lua_pushinteger(T, rets[i].retval);
+        lua_setfield(T, -2, "retval");
+
+        for (j = 0; j < rets[i].narg; j++) {
+            push_domctl_value(T, rets[i].args + j);
+            lua_rawseti(T, -2, j + 1);
+        }
+
+        lua_setfield(T, -2, rets[i].domain);
+    }
+
+    mrp_lua_coro_resume(co, 1);
+}
+
+
+/*
+ * m:invoke_all({ domain, ... }, method, timeout, ...) invokes method of
+ * all the given domains at once, then returns a table of the replies by
+ * domain, each with error, retval and the returned values.
+ */
+static int coro_lua_invoke_all(lua_State *L)
+{
+    mrp_context_t    *ctx = mrp_lua_get_murphy_context();
+    const char      **domains, *method;
+    mrp_domctl_arg_t *args;
+    mrp_lua_coro_t   *co;
+    lua_Number        timeout;
+    int               ndomain, narg, i;
+
+    drop_self(L);
+
+    luaL_checktype(L, 1, LUA_TTABLE);
+    method  = luaL_checkstring(L, 2);
+    timeout = luaL_optnumber(L, 3, 0);
+    ndomain = lua_objlen(L, 1);
+    narg    = lua_gettop(L) > 3 ? lua_gettop(L) - 3 : 0;
+    domains = alloca(ndomain * sizeof(*domains) + 1);
+    args    = alloca(narg * sizeof(*args) + 1);
+
+    if (timeout < 0)
+        return luaL_error(L, "invalid invocation timeout %f", timeout);
+
+    for (i = 0; i < ndomain; i++) {
+        lua_rawgeti(L, 1, i + 1);
+        domains[i] = lua_tostring(L, -1);
+        lua_pop(L, 1);
+
+        if (domains[i] == NULL)
+            return luaL_error(L, "invalid domain #%d for %s", i + 1, method);
+    }
+
+    check_invoke_args(L, 4, narg, args, "*", method);
+
+    co = mrp_lua_coro_suspend(L);
+
+    if (!mrp_invoke_domains(ctx, domains, ndomain, method, narg, args,
+                            (unsigned int)timeout, invoke_all_return_cb, co)) {
+        co->suspended = false;
+        lua_pushnil(L);
+        return 1;
+    }
+
+    return lua_yield(L, 0);
+}
+
+
+MURPHY_REGISTER_LUA_BINDINGS(murphy, NULL,
+                             { "spawn"     , coro_lua_spawn      },
+                             { "sleep"     , coro_lua_sleep      },
+                             { "invoke"    , coro_lua_invoke     },
+                             { "invoke_all", coro_lua_invoke_all });
@@ -114,8 +114,8 @@ static void deferred_lua_cb(mrp_deferred_t *deferred, void *user_data)
     if (mrp_lua_object_deref_value(d, d->L, d->callback, false)) {
         mrp_lua_push_object(d->L, d);
 
-        if (lua_pcall(d->L, 1, 0, 0) != 0) {
-            mrp_log_error("failed to invoke Lua deferred callback, disabling");
+        if (mrp_lua_coro_call(d->L, 1, "Lua deferred callback") != 0) {
+            mrp_log_error("Lua deferred callback failed, disabling");
             mrp_disable_deferred(d->d);
             d->disabled = true;
         }
@@ -181,7 +181,7 @@ static int deferred_lua_create(lua_State *L)
 
     d = (deferred_lua_t *)mrp_lua_create_object(L, DEFERRED_LUA_CLASS, NULL, 0);
 
-    d->L        = L;
+    d->L        = mrp_lua_main_state(L);
     d->ml       = ctx->ml;
     d->d        = mrp_add_deferred(d->ml, deferred_lua_cb, d);
     d->callback = LUA_NOREF;
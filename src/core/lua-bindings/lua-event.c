@@ -155,9 +155,8 @@ static void evtwatch_lua_cb(mrp_event_watch_t *watch, uint32_t id,
         mrp_lua_push_object(w->L, w);
         lua_pushinteger(w->L, id);
 
-        if (lua_pcall(w->L, 2, 0, 0) != 0) {
-            mrp_log_error("failed to invoke Lua event watch callback (%s), "
-                          "stopping", lua_tostring(w->L, -1));
+        if (mrp_lua_coro_call(w->L, 2, "Lua event watch callback") != 0) {
+            mrp_log_error("Lua event watch callback failed, stopping");
             evtwatch_stop(w);
         }
 
@@ -238,7 +237,7 @@ static int evtwatch_lua_create(lua_State *L)
         return luaL_error(L, "expected 0, or 1 arguments, got %d", narg - 1);
 
     w = (evtwatch_lua_t *)mrp_lua_create_object(L, EVTWATCH_LUA_CLASS, NULL, 0);
-    w->L        = L;
+    w->L        = mrp_lua_main_state(L);
     w->ctx      = mrp_lua_get_murphy_context();
     w->init     = true;
     w->callback = LUA_NOREF;
@@ -27,6 +27,11 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
 #include <murphy/common/macros.h>
 #include <murphy/common/debug.h>
 #include <murphy/common/log.h>
@@ -56,6 +61,8 @@ static int  json_lua_setfield(lua_State *L);
 static int  json_lua_stringify(lua_State *L);
 static json_lua_t *json_lua_get(lua_State *L, int idx);
 static mrp_json_t *json_lua_table_to_object(lua_State *L, int t);
+static int  json_lua_decode(lua_State *L);
+static int  json_lua_encode(lua_State *L);
 
 
 /*
@@ -452,5 +459,686 @@ static int json_lua_stringify(lua_State *L)
 }
 
 
+/*
+ * direct conversion between JSON text and Lua values
+ *
+ * These bypass json-c altogether: text is parsed in a single pass straight
+ * into Lua tables and Lua values are serialized straight into text. JSON
+ * objects become tables with string keys, arrays become 1-based tables and
+ * null becomes nil (so it disappears from objects and leaves holes in
+ * arrays). When serializing, a table is an array if its keys are exactly
+ * 1...n, otherwise an object. Wrapped JSON objects are serialized as is.
+ */
+
+#define JSON_MAX_DEPTH 64
+
+typedef struct {
+    lua_State  *L;                       /* Lua state to push values to */
+    const char *p;                       /* parser position */
+    const char *end;                     /* end of input */
+    int         depth;                   /* current nesting depth */
+    const char *error;                   /* error, if any */
+} json_parser_t;
+
+typedef struct {
+    char       *buf;                     /* output buffer */
+    size_t      len;                     /* used buffer length */
+    size_t      size;                    /* allocated buffer size */
+    int         depth;                   /* current nesting depth */
+    const char *error;                   /* error, if any */
+} json_writer_t;
+
+static int parse_value(json_parser_t *ps);
+static int write_value(lua_State *L, int idx, json_writer_t *w);
+
+
+static inline void skip_space(json_parser_t *ps)
+{
+    while (ps->p < ps->end &&
+           (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\n' || *ps->p == '\r'))
+        ps->p++;
+}
+
+
+static inline int parse_error(json_parser_t *ps, const char *error)
+{
+    if (ps->error == NULL)
+        ps->error = error;
+
+    return FALSE;
+}
+
+
+static int parse_hex4(json_parser_t *ps, uint32_t *cp)
+{
+    int i, c;
+
+    if (ps->end - ps->p < 4)
+        return parse_error(ps, "truncated \\u escape");
+
+    for (*cp = 0, i = 0; i < 4; i++) {
+        c = *ps->p++;
+
+        if      (c >= '0' && c <= '9') c -= '0';
+        else if (c >= 'a' && c <= 'f') c -= 'a' - 10;
+        else if (c >= 'A' && c <= 'F') c -= 'A' - 10;
+        else
+            return parse_error(ps, "invalid \\u escape");
+
+        *cp = (*cp << 4) | c;
+    }
+
+    return TRUE;
+}
+
+
+static void add_utf8(luaL_Buffer *b, uint32_t cp)
+{
+    if (cp < 0x80)
+        luaL_addchar(b, cp);
+    else if (cp < 0x800) {
+        luaL_addchar(b, 0xc0 | (cp >> 6));
+        luaL_addchar(b, 0x80 | (cp & 0x3f));
+    }
+    else if (cp < 0x10000) {
+        luaL_addchar(b, 0xe0 | (cp >> 12));
+        luaL_addchar(b, 0x80 | ((cp >> 6) & 0x3f));
+        luaL_addchar(b, 0x80 | (cp & 0x3f));
+    }
+    else {
+        luaL_addchar(b, 0xf0 | (cp >> 18));
+        luaL_addchar(b, 0x80 | ((cp >> 12) & 0x3f));
+        luaL_addchar(b, 0x80 | ((cp >> 6) & 0x3f));
+        luaL_addchar(b, 0x80 | (cp & 0x3f));
+    }
+}
+
+
+static int parse_string(json_parser_t *ps)
+{
+    const char  *beg;
+    luaL_Buffer  b;
+    uint32_t     cp, lo;
+
+    beg = ++ps->p;
+
+    /* fast path: no escapes, push the string as is */
+    while (ps->p < ps->end && *ps->p != '"' && *ps->p != '\\' &&
+           (unsigned char)*ps->p >= 0x20)
+        ps->p++;
+
+    if (ps->p >= ps->end)
+        return parse_error(ps, "unterminated string");
+
+    if (*ps->p == '"') {
+        lua_pushlstring(ps->L, beg, ps->p - beg);
+        ps->p++;
+        return TRUE;
+    }
+
+    luaL_buffinit(ps->L, &b);
+    luaL_addlstring(&b, beg, ps->p - beg);
+
+    while (ps->p < ps->end && *ps->p != '"') {
+        if ((unsigned char)*ps->p < 0x20)
+            return parse_error(ps, "control character in string");
+
+        if (*ps->p != '\\') {
+            luaL_addchar(&b, *ps->p++);
+            continue;
+        }
+
+        if (++ps->p >= ps->end)
+            break;
+
+        switch (*ps->p++) {
+        case '"':  luaL_addchar(&b, '"');  break;
+        case '\\': luaL_addchar(&b, '\\'); break;
+        case '/':  luaL_addchar(&b, '/');  break;
+        case 'b':  luaL_addchar(&b, '\b'); break;
+        case 'f':  luaL_addchar(&b, '\f'); break;
+        case 'n':  luaL_addchar(&b, '\n'); break;
+        case 'r':  luaL_addchar(&b, '\r'); break;
+        case 't':  luaL_addchar(&b, '\t'); break;
+        case 'u':
+            if (!parse_hex4(ps, &cp))
+                return FALSE;
+
+            if (cp >= 0xd800 && cp <= 0xdbff) {
+                if (ps->end - ps->p < 2 || ps->p[0] != '\\' || ps->p[1] != 'u')
+                    return parse_error(ps, "unpaired surrogate");
+
+                ps->p += 2;
+
+                if (!parse_hex4(ps, &lo))
+                    return FALSE;
+
+                if (lo < 0xdc00 || lo > 0xdfff)
+                    return parse_error(ps, "invalid surrogate pair");
+
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+            }
+            else if (cp >= 0xdc00 && cp <= 0xdfff)
+                return parse_error(ps, "unpaired surrogate");
+
+            add_utf8(&b, cp);
+            break;
+        default:
+            return parse_error(ps, "invalid escape sequence");
+        }
+    }
+
+    if (ps->p >= ps->end)
+        return parse_error(ps, "unterminated string");
+
+    ps->p++;
+    luaL_pushresult(&b);
+
+    return TRUE;
+}
+
+
+static int parse_number(json_parser_t *ps)
+{
+    const char *beg = ps->p;
+    char        buf[64], *e;
+    size_t      len;
+
+    if (ps->p < ps->end && *ps->p == '-')
+        ps->p++;
+
+    if (ps->p >= ps->end || *ps->p < '0' || *ps->p > '9')
+        return parse_error(ps, "invalid number");
+
+    if (*ps->p == '0')
+        ps->p++;
+    else
+        while (ps->p < ps->end && *ps->p >= '0' && *ps->p <= '9')
+            ps->p++;
+
+    if (ps->p < ps->end && *ps->p == '.') {
+        if (++ps->p >= ps->end || *ps->p < '0' || *ps->p > '9')
+            return parse_error(ps, "invalid number");
+        while (ps->p < ps->end && *ps->p >= '0' && *ps->p <= '9')
+            ps->p++;
+    }
+
+    if (ps->p < ps->end && (*ps->p == 'e' || *ps->p == 'E')) {
+        if (++ps->p < ps->end && (*ps->p == '+' || *ps->p == '-'))
+            ps->p++;
+        if (ps->p >= ps->end || *ps->p < '0' || *ps->p > '9')
+            return parse_error(ps, "invalid number");
+        while (ps->p < ps->end && *ps->p >= '0' && *ps->p <= '9')
+            ps->p++;
+    }
+
+    if ((len = ps->p - beg) >= sizeof(buf))
+        return parse_error(ps, "number too long");
+
+    memcpy(buf, beg, len);
+    buf[len] = '\0';
+
+    lua_pushnumber(ps->L, strtod(buf, &e));
+
+    return TRUE;
+}
+
+
+static int parse_literal(json_parser_t *ps, const char *lit, size_t len)
+{
+    if ((size_t)(ps->end - ps->p) < len || memcmp(ps->p, lit, len))
+        return parse_error(ps, "invalid literal");
+
+    ps->p += len;
+
+    return TRUE;
+}
+
+
+static int parse_object(json_parser_t *ps)
+{
+    lua_State *L = ps->L;
+
+    ps->p++;
+    lua_newtable(L);
+    skip_space(ps);
+
+    if (ps->p < ps->end && *ps->p == '}') {
+        ps->p++;
+        return TRUE;
+    }
+
+    for (;;) {
+        skip_space(ps);
+
+        if (ps->p >= ps->end || *ps->p != '"')
+            return parse_error(ps, "expecting object member name");
+
+        if (!parse_string(ps))
+            return FALSE;
+
+        skip_space(ps);
+
+        if (ps->p >= ps->end || *ps->p != ':')
+            return parse_error(ps, "expecting ':' after member name");
+
+        ps->p++;
+
+        if (!parse_value(ps))
+            return FALSE;
+
+        lua_rawset(L, -3);
+        skip_space(ps);
+
+        if (ps->p < ps->end && *ps->p == ',') {
+            ps->p++;
+            continue;
+        }
+
+        if (ps->p < ps->end && *ps->p == '}') {
+            ps->p++;
+            return TRUE;
+        }
+
+        return parse_error(ps, "expecting ',' or '}' in object");
+    }
+}
+
+
+static int parse_array(json_parser_t *ps)
+{
+    lua_State *L = ps->L;
+    int        n;
+
+    ps->p++;
+    lua_newtable(L);
+    skip_space(ps);
+
+    if (ps->p < ps->end && *ps->p == ']') {
+        ps->p++;
+        return TRUE;
+    }
+
+    for (n = 1; ; n++) {
+        if (!parse_value(ps))
+            return FALSE;
+
+        lua_rawseti(L, -2, n);
+        skip_space(ps);
+
+        if (ps->p < ps->end && *ps->p == ',') {
+            ps->p++;
+            continue;
+        }
+
+        if (ps->p < ps->end && *ps->p == ']') {
+            ps->p++;
+            return TRUE;
+        }
+
+        return parse_error(ps, "expecting ',' or ']' in array");
+    }
+}
+
+
+static int parse_value(json_parser_t *ps)
+{
+    int success;
+
+    skip_space(ps);
+
+    if (ps->p >= ps->end)
+        return parse_error(ps, "unexpected end of input");
+
+    if (!lua_checkstack(ps->L, 4))
+        return parse_error(ps, "Lua stack exhausted");
+
+    switch (*ps->p) {
+    case '{':
+    case '[':
+        if (++ps->depth > JSON_MAX_DEPTH)
+            return parse_error(ps, "nesting too deep");
+
+        success = *ps->p == '{' ? parse_object(ps) : parse_array(ps);
+        ps->depth--;
+
+        return success;
+
+    case '"':
+        return parse_string(ps);
+
+    case 't':
+        if (!parse_literal(ps, "true", 4))
+            return FALSE;
+        lua_pushboolean(ps->L, TRUE);
+        return TRUE;
+
+    case 'f':
+        if (!parse_literal(ps, "false", 5))
+            return FALSE;
+        lua_pushboolean(ps->L, FALSE);
+        return TRUE;
+
+    case 'n':
+        if (!parse_literal(ps, "null", 4))
+            return FALSE;
+        lua_pushnil(ps->L);
+        return TRUE;
+
+    default:
+        return parse_number(ps);
+    }
+}
+
+
+int mrp_json_lua_decode(lua_State *L, const char *str, size_t len,
+                        const char **errmsg)
+{
+    json_parser_t ps;
+    int           top;
+
+    ps.L     = L;
+    ps.p     = str;
+    ps.end   = str + len;
+    ps.depth = 0;
+    ps.error = NULL;
+
+    top = lua_gettop(L);
+
+    if (parse_value(&ps)) {
+        skip_space(&ps);
+
+        /* tolerate a terminating NUL, some senders include it */
+        if (ps.p < ps.end && *ps.p == '\0')
+            ps.p++;
+
+        if (ps.p == ps.end)
+            return TRUE;
+
+        parse_error(&ps, "trailing garbage after JSON value");
+    }
+
+    lua_settop(L, top);
+
+    if (errmsg != NULL)
+        *errmsg = ps.error;
+
+    return FALSE;
+}
+
+
+static int write_data(json_writer_t *w, const char *data, size_t len)
+{
+    size_t size;
+
+    if (w->len + len + 1 > w->size) {
+        for (size = w->size ? 2 * w->size : 256; size < w->len + len + 1; )
+            size *= 2;
+
+        if (mrp_realloc(w->buf, size) == NULL) {
+            w->error = "out of memory";
+            return FALSE;
+        }
+
+        w->size = size;
+    }
+
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+    w->buf[w->len] = '\0';
+
+    return TRUE;
+}
+
+
+static int write_string(json_writer_t *w, const char *s, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *beg, *end;
+    char        esc[8];
+    int         n;
+
+    if (!write_data(w, "\"", 1))
+        return FALSE;
+
+    for (beg = s, end = s + len; s < end; s++) {
+        if ((unsigned char)*s >= 0x20 && *s != '"' && *s != '\\')
+            continue;
+
+        if (s > beg && !write_data(w, beg, s - beg))
+            return FALSE;
+
+        switch (*s) {
+        case '"':  n = 2; esc[0] = '\\'; esc[1] = '"';  break;
+        case '\\': n = 2; esc[0] = '\\'; esc[1] = '\\'; break;
+        case '\b': n = 2; esc[0] = '\\'; esc[1] = 'b';  break;
+        case '\f': n = 2; esc[0] = '\\'; esc[1] = 'f';  break;
+        case '\n': n = 2; esc[0] = '\\'; esc[1] = 'n';  break;
+        case '\r': n = 2; esc[0] = '\\'; esc[1] = 'r';  break;
+        case '\t': n = 2; esc[0] = '\\'; esc[1] = 't';  break;
+        default:
+            n = 6;
+            memcpy(esc, "\\u00", 4);
+            esc[4] = hex[(*s >> 4) & 0xf];
+            esc[5] = hex[*s & 0xf];
+        }
+
+        if (!write_data(w, esc, n))
+            return FALSE;
+
+        beg = s + 1;
+    }
+
+    if (s > beg && !write_data(w, beg, s - beg))
+        return FALSE;
+
+    return write_data(w, "\"", 1);
+}
+
+
+static int write_number(json_writer_t *w, double d)
+{
+    char buf[64];
+    int  n;
+
+    if (!isfinite(d)) {
+        w->error = "can't serialize NaN or infinity";
+        return FALSE;
+    }
+
+    if (d == floor(d) && fabs(d) < 9007199254740992.0)
+        n = snprintf(buf, sizeof(buf), "%.0f", d);
+    else
+        n = snprintf(buf, sizeof(buf), "%.17g", d);
+
+    return write_data(w, buf, n);
+}
+
+
+static int write_table(lua_State *L, int idx, json_writer_t *w)
+{
+    json_lua_t *lson;
+    const char *str;
+    size_t      len;
+    int         n, cnt, i, first;
+
+    if ((lson = json_lua_get(L, idx)) != NULL) {
+        str = mrp_json_object_to_string(lson->json);
+        return write_data(w, str, strlen(str));
+    }
+
+    if (++w->depth > JSON_MAX_DEPTH) {
+        w->error = "nesting too deep (or a reference loop)";
+        return FALSE;
+    }
+
+    n   = lua_objlen(L, idx);
+    cnt = 0;
+
+    for (lua_pushnil(L); lua_next(L, idx); lua_pop(L, 1))
+        cnt++;
+
+    if (n > 0 && cnt == n) {
+        if (!write_data(w, "[", 1))
+            return FALSE;
+
+        for (i = 1; i <= n; i++) {
+            lua_rawgeti(L, idx, i);
+
+            if ((i > 1 && !write_data(w, ",", 1)) ||
+                !write_value(L, lua_gettop(L), w)) {
+                lua_pop(L, 1);
+                return FALSE;
+            }
+
+            lua_pop(L, 1);
+        }
+
+        w->depth--;
+
+        return write_data(w, "]", 1);
+    }
+
+    if (!write_data(w, "{", 1))
+        return FALSE;
+
+    first = TRUE;
+
+    for (lua_pushnil(L); lua_next(L, idx); lua_pop(L, 1)) {
+        switch (lua_type(L, -2)) {
+        case LUA_TSTRING:
+        case LUA_TNUMBER:
+            /* convert a copy, lua_tolstring would confuse lua_next */
+            lua_pushvalue(L, -2);
+            str = lua_tolstring(L, -1, &len);
+
+            if ((!first && !write_data(w, ",", 1)) ||
+                !write_string(w, str, len) || !write_data(w, ":", 1)) {
+                lua_pop(L, 3);
+                return FALSE;
+            }
+
+            lua_pop(L, 1);
+            break;
+
+        default:
+            w->error = "invalid key type for JSON object";
+            lua_pop(L, 2);
+            return FALSE;
+        }
+
+        if (!write_value(L, lua_gettop(L), w)) {
+            lua_pop(L, 2);
+            return FALSE;
+        }
+
+        first = FALSE;
+    }
+
+    w->depth--;
+
+    return write_data(w, "}", 1);
+}
+
+
+static int write_value(lua_State *L, int idx, json_writer_t *w)
+{
+    const char *str;
+    size_t      len;
+
+    if (!lua_checkstack(L, 4)) {
+        w->error = "Lua stack exhausted";
+        return FALSE;
+    }
+
+    switch (lua_type(L, idx)) {
+    case LUA_TNIL:
+        return write_data(w, "null", 4);
+
+    case LUA_TBOOLEAN:
+        return lua_toboolean(L, idx) ?
+            write_data(w, "true", 4) : write_data(w, "false", 5);
+
+    case LUA_TNUMBER:
+        return write_number(w, lua_tonumber(L, idx));
+
+    case LUA_TSTRING:
+        str = lua_tolstring(L, idx, &len);
+        return write_string(w, str, len);
+
+    case LUA_TTABLE:
+        return write_table(L, idx, w);
+
+    default:
+        w->error = "can't serialize Lua value of this type to JSON";
+        return FALSE;
+    }
+}
+
+
+char *mrp_json_lua_encode(lua_State *L, int idx, size_t *lenp,
+                          const char **errmsg)
+{
+    json_writer_t w;
+    int           top;
+
+    mrp_clear(&w);
+
+    top = lua_gettop(L);
+
+    if (idx < 0)
+        idx = top + idx + 1;
+
+    if (!write_value(L, idx, &w)) {
+        lua_settop(L, top);
+        mrp_free(w.buf);
+
+        if (errmsg != NULL)
+            *errmsg = w.error;
+
+        return NULL;
+    }
+
+    if (lenp != NULL)
+        *lenp = w.len;
+
+    return w.buf;
+}
+
+
+static int json_lua_decode(lua_State *L)
+{
+    const char *str, *err;
+    size_t      len;
+
+    /* called either as m.json_decode(str) or as m:json_decode(str) */
+    str = luaL_checklstring(L, lua_gettop(L), &len);
+
+    if (!mrp_json_lua_decode(L, str, len, &err))
+        return luaL_error(L, "failed to parse JSON (%s)", err);
+
+    return 1;
+}
+
+
+static int json_lua_encode(lua_State *L)
+{
+    const char *err;
+    char       *str;
+    size_t      len;
+
+    /* called either as m.json_encode(v) or as m:json_encode(v) */
+    if ((str = mrp_json_lua_encode(L, lua_gettop(L), &len, &err)) == NULL)
+        return luaL_error(L, "failed to serialize JSON (%s)", err);
+
+    lua_pushlstring(L, str, len);
+    mrp_free(str);
+
+    return 1;
+}
+
+
 MURPHY_REGISTER_LUA_BINDINGS(murphy, JSON_LUA_CLASS,
-                             { "JSON", mrp_json_lua_create });
+                             { "JSON"       , mrp_json_lua_create },
+                             { "json_decode", json_lua_decode     },
+                             { "json_encode", json_lua_encode     });
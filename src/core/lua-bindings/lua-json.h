@@ -48,4 +48,12 @@ int mrp_json_lua_push(lua_State *L, mrp_json_t *json);
 /** Get the JSON object at the given stack position, increase refcount. */
 mrp_json_t *mrp_json_lua_get(lua_State *L, int idx);
 
+/** Parse JSON text directly into a Lua value and push it on the stack. */
+int mrp_json_lua_decode(lua_State *L, const char *str, size_t len,
+                        const char **errmsg);
+
+/** Serialize the Lua value at the given stack position into JSON text. */
+char *mrp_json_lua_encode(lua_State *L, int idx, size_t *lenp,
+                          const char **errmsg);
+
 #endif /* __MURPHY_LUA_JSON_H__ */
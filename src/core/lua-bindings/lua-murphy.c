@@ -28,17 +28,22 @@
  */
 
 #include <unistd.h>
+#include <time.h>
 
 #include <lualib.h>
 #include <lauxlib.h>
 
 #include <murphy/common/mm.h>
 #include <murphy/common/log.h>
+#include <murphy/common/mainloop.h>
+#include <murphy/common/metrics.h>
 #include <murphy/core/plugin.h>
 #include <murphy/core/lua-utils/funcbridge.h>
+#include <murphy/core/lua-utils/include.h>
 #include <murphy/core/lua-decision/mdb.h>
 #include <murphy/core/lua-decision/element.h>
 #include <murphy/core/lua-bindings/murphy.h>
+#include <murphy/resolver/resolver.h>
 
 static mrp_context_t *context;
 static MRP_LIST_HOOK(bindings);
@@ -46,8 +51,12 @@ static MRP_LIST_HOOK(pending);
 static int debug_level;
 static char *config_file;
 static char *config_dir;
+static mrp_deferred_t *reload;
+static int reloading;
 
 static lua_Alloc setup_allocator(void);
+static void gc_account(size_t osize, size_t nsize);
+static mrp_mm_tag_t *lua_mmtag;                 /* Lua heap accounting */
 
 
 static int create_murphy_object(lua_State *L)
@@ -142,6 +151,9 @@ static lua_State *init_lua(void)
     lua_Alloc  A = setup_allocator();
     lua_State *L;
 
+    if (lua_mmtag == NULL)
+        lua_mmtag = mrp_mm_tag_create("lua", NULL);
+
     if (A == NULL)
         L = luaL_newstate();
     else
@@ -200,6 +212,83 @@ void mrp_lua_set_murphy_lua_config_file(const char *path)
 }
 
 
+/*
+ * Reloading the configuration re-executes it in the running Lua state.
+ * Objects which are referenced from the C side (zones, application and
+ * resource classes, MDB tables, decision elements and sinks) are looked up
+ * by name and kept, rebinding the functions of elements and sinks, while
+ * resource methods simply get reassigned. The file is compiled before it
+ * is executed, so a syntax error leaves the current policy intact, and
+ * execution is deferred to a mainloop idle point so that no resolver or
+ * resource set processing is in progress while it takes place.
+ */
+
+static void reload_cb(mrp_deferred_t *d, void *user_data)
+{
+    lua_State *L = context->lua_state;
+    int        top, status;
+
+    MRP_UNUSED(user_data);
+
+    mrp_del_deferred(d);
+    reload = NULL;
+
+    top = lua_gettop(L);
+
+    if (mrp_lua_load_file(L, config_file) != 0) {
+        mrp_log_error("Failed to load Lua configuration '%s', keeping the "
+                      "current one (%s).", config_file, lua_tostring(L, -1));
+        lua_settop(L, top);
+        return;
+    }
+
+    reloading = TRUE;
+    status    = lua_pcall(L, 0, 0, 0);
+    reloading = FALSE;
+
+    if (status != 0) {
+        mrp_log_error("Failed to reload Lua configuration '%s', it was only "
+                      "partially applied (%s).", config_file,
+                      lua_tostring(L, -1));
+        lua_settop(L, top);
+    }
+    else
+        mrp_log_info("Reloaded Lua configuration '%s'.", config_file);
+
+    if (context->r != NULL) {
+        mrp_resolver_prepare(context->r);
+        mrp_resolver_invalidate(context->r);
+    }
+
+    mrp_event_emit_msg(NULL, mrp_event_id(MRP_LUA_CONFIG_RELOADED),
+                       MRP_EVENT_SYNCHRONOUS, MRP_MSG_END);
+}
+
+
+int mrp_lua_reload_config(void)
+{
+    if (context == NULL || context->lua_state == NULL || config_file == NULL) {
+        mrp_log_error("No Lua configuration to reload.");
+        return FALSE;
+    }
+
+    if (reload == NULL) {
+        reload = mrp_add_deferred(context->ml, reload_cb, NULL);
+
+        if (reload == NULL)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+int mrp_lua_reloading(void)
+{
+    return reloading;
+}
+
+
 mrp_context_t *mrp_lua_check_murphy_context(lua_State *L, int index)
 {
     mrp_lua_murphy_t *m;
@@ -564,6 +653,7 @@ static void *lua_alloc(void *ud, void *optr, size_t olsize, size_t nlsize)
     mrp_debug("Lua allocation request <%p, %zd, %zd>", optr, olsize, nlsize);
 
     oblk = ptr_to_memblk(optr);
+    gc_account(oblk ? olsize : 0, nlsize);
 
     if (nlsize > 0) {
         nbsize = MEMBLK_SIZE(nlsize);
@@ -586,6 +676,142 @@ static void *lua_alloc(void *ud, void *optr, size_t olsize, size_t nlsize)
 }
 
 
+/*
+ * pooled Lua allocator
+ *
+ * Most Lua allocations are small (strings, table nodes, closures, upvalues)
+ * and short-lived, so we serve blocks up to POOL_MAXSIZE bytes from object
+ * pools, one per size class, and only pass larger ones on to the heap. Lua
+ * always tells us the size of the block it reallocates or frees, so blocks
+ * carry no header: a block of size n always lives in the pool of the class
+ * of n. All allocators also account the bytes allocated since the last GC
+ * step, which is what drives idle-time garbage collection (see below).
+ */
+
+#define POOL_MAXSIZE 256
+
+static const size_t pool_sizes[] = { 16, 32, 48, 64, 96, 128, 192, 256 };
+static mrp_objpool_t *pools[MRP_ARRAY_SIZE(pool_sizes)];
+static int8_t pool_class[POOL_MAXSIZE / 16 + 1];
+
+static mrp_lua_alloc_t alloc_type = MRP_LUA_ALLOC_POOL;
+static ssize_t         alloc_debt;
+
+
+static int pool_init(void)
+{
+    mrp_objpool_config_t cfg;
+    char                 name[32];
+    size_t               i, c;
+
+    for (i = c = 0; i < MRP_ARRAY_SIZE(pool_class); i++) {
+        while (pool_sizes[c] < i * 16)
+            c++;
+        pool_class[i] = c;
+    }
+
+    for (c = 0; c < MRP_ARRAY_SIZE(pools); c++) {
+        snprintf(name, sizeof(name), "lua-%zu", pool_sizes[c]);
+
+        mrp_clear(&cfg);
+        cfg.name    = name;
+        cfg.objsize = pool_sizes[c];
+
+        if ((pools[c] = mrp_objpool_create(&cfg)) == NULL)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static inline mrp_objpool_t *pool_of(size_t size)
+{
+    if (size > POOL_MAXSIZE)
+        return NULL;
+    else
+        return pools[pool_class[(size + 15) / 16]];
+}
+
+
+static void *pool_alloc(void *ud, void *optr, size_t osize, size_t nsize)
+{
+    mrp_objpool_t *opool, *npool;
+    void          *nptr;
+
+    MRP_UNUSED(ud);
+
+    if (optr == NULL)                    /* Lua 5.2+ passes a type here */
+        osize = 0;
+
+    gc_account(osize, nsize);
+
+    opool = optr ? pool_of(osize) : NULL;
+
+    if (nsize == 0) {
+        if (opool != NULL)
+            mrp_objpool_free(optr);
+        else
+            free(optr);
+
+        return NULL;
+    }
+
+    npool = pool_of(nsize);
+
+    if (npool == NULL && opool == NULL)
+        return realloc(optr, nsize);
+
+    if (npool != NULL && npool == opool)
+        return optr;
+
+    if (npool != NULL)
+        nptr = mrp_objpool_alloc(npool);
+    else
+        nptr = malloc(nsize);
+
+    if (nptr == NULL)
+        return NULL;
+
+    if (optr != NULL) {
+        memcpy(nptr, optr, MRP_MIN(osize, nsize));
+
+        if (opool != NULL)
+            mrp_objpool_free(optr);
+        else
+            free(optr);
+    }
+
+    return nptr;
+}
+
+
+static void *heap_alloc(void *ud, void *optr, size_t osize, size_t nsize)
+{
+    MRP_UNUSED(ud);
+
+    gc_account(optr ? osize : 0, nsize);
+
+    if (nsize == 0) {
+        free(optr);
+        return NULL;
+    }
+    else
+        return realloc(optr, nsize);
+}
+
+
+void mrp_lua_set_allocator(mrp_lua_alloc_t type)
+{
+    if (context != NULL) {
+        mrp_log_warning("Lua state already created, ignoring allocator.");
+        return;
+    }
+
+    alloc_type = type;
+}
+
+
 static lua_Alloc setup_allocator(void)
 {
     int debug;
@@ -593,9 +819,18 @@ static lua_Alloc setup_allocator(void)
     debug = mrp_mm_config_bool("lua", FALSE);
 
     if (!debug) {
-        mrp_debug("%s not set to debug*, using native Lua allocator",
+        if (alloc_type == MRP_LUA_ALLOC_POOL) {
+            if (pool_init()) {
+                mrp_debug("using pooled Lua allocator");
+                return pool_alloc;
+            }
+
+            mrp_log_warning("Failed to create Lua memory pools, using heap.");
+        }
+
+        mrp_debug("%s not set to debug*, using heap Lua allocator",
                   MRP_MM_CONFIG_ENVVAR);
-        return NULL;
+        return heap_alloc;
     }
     else {
         mrp_debug("Lua memory tracking enabled, overriding native allocator");
@@ -606,3 +841,156 @@ static lua_Alloc setup_allocator(void)
         return lua_alloc;
     }
 }
+
+
+/*
+ * garbage collection
+ *
+ * The collector can be tuned (pause, step multiplier and, if the Lua
+ * version supports it, the mode) from the configuration. Additionally,
+ * with a non-zero idle step, whenever at least that many kilobytes have
+ * been allocated since the last step, a deferred callback is enabled to
+ * perform a step of that size once the mainloop is done dispatching the
+ * work at hand. This keeps the collector mostly ahead of the allocations,
+ * so the steps forced on allocation by the automatic collector, which hit
+ * whatever happens to be running (eg. a resource arbitration pass), are
+ * fewer and shorter. The idle steps are timed and exported as metrics.
+ */
+
+static mrp_deferred_t *gc_idle;
+static ssize_t         gc_idle_bytes;
+static mrp_metric_t   *gc_step_usecs;
+static mrp_metric_t   *gc_cycles;
+
+
+static uint64_t gc_usecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static void gc_account(size_t osize, size_t nsize)
+{
+    alloc_debt += (ssize_t)nsize - (ssize_t)osize;
+
+    mrp_mm_tag_charge(lua_mmtag, (ssize_t)nsize - (ssize_t)osize,
+                      (nsize != 0) - (osize != 0));
+
+    if (gc_idle_bytes && alloc_debt >= gc_idle_bytes) {
+        alloc_debt = 0;
+        mrp_enable_deferred(gc_idle);
+    }
+}
+
+
+static void gc_idle_cb(mrp_deferred_t *d, void *user_data)
+{
+    lua_State *L = context ? context->lua_state : NULL;
+    uint64_t   start;
+    int        done;
+
+    MRP_UNUSED(user_data);
+
+    mrp_disable_deferred(d);
+
+    if (L == NULL)
+        return;
+
+    start = gc_usecs();
+    done  = lua_gc(L, LUA_GCSTEP, (int)(gc_idle_bytes / 1024));
+    mrp_metric_observe(gc_step_usecs, gc_usecs() - start);
+
+    if (done)
+        mrp_metric_inc(gc_cycles);
+
+    alloc_debt = 0;
+}
+
+
+static int64_t gc_heap_kbytes(void *user_data)
+{
+    lua_State *L = context ? context->lua_state : NULL;
+
+    MRP_UNUSED(user_data);
+
+    return L ? lua_gc(L, LUA_GCCOUNT, 0) : 0;
+}
+
+
+static void gc_init_metrics(void)
+{
+    static const int64_t bounds[] = {
+        10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000
+    };
+
+    if (gc_step_usecs != NULL)
+        return;
+
+    gc_step_usecs = mrp_metric_histogram("murphy_lua_gc_step_usecs",
+                                         "Time spent in idle Lua GC steps.",
+                                         bounds, MRP_ARRAY_SIZE(bounds));
+    gc_cycles = mrp_metric_counter("murphy_lua_gc_cycles_total",
+                                   "Lua GC cycles finished by idle steps.");
+    mrp_metric_callback("murphy_lua_heap_kbytes",
+                        "Memory in use by the Lua state.",
+                        MRP_METRIC_GAUGE, gc_heap_kbytes, NULL);
+}
+
+
+int mrp_lua_set_gc(const mrp_lua_gc_config_t *cfg)
+{
+    lua_State *L = context ? context->lua_state : NULL;
+
+    if (L == NULL)
+        return FALSE;
+
+    if (cfg->mode != NULL && strcmp(cfg->mode, "incremental")) {
+#ifdef LUA_GCGEN
+        if (!strcmp(cfg->mode, "generational"))
+            lua_gc(L, LUA_GCGEN, 0, 0);
+        else
+#endif
+        {
+            mrp_log_error("Unsupported Lua GC mode '%s'.", cfg->mode);
+            return FALSE;
+        }
+    }
+#ifdef LUA_GCINC
+    else
+        lua_gc(L, LUA_GCINC, 0, 0, 0);
+#endif
+
+    if (cfg->pause > 0)
+        lua_gc(L, LUA_GCSETPAUSE, cfg->pause);
+    if (cfg->stepmul > 0)
+        lua_gc(L, LUA_GCSETSTEPMUL, cfg->stepmul);
+
+    gc_init_metrics();
+
+    if (cfg->idle_step > 0) {
+        if (gc_idle == NULL) {
+            gc_idle = mrp_add_deferred(context->ml, gc_idle_cb, NULL);
+
+            if (gc_idle == NULL)
+                return FALSE;
+
+            mrp_disable_deferred(gc_idle);
+        }
+
+        gc_idle_bytes = (ssize_t)cfg->idle_step * 1024;
+    }
+    else {
+        gc_idle_bytes = 0;
+        mrp_disable_deferred(gc_idle);
+    }
+
+    mrp_log_info("Lua GC: mode %s, pause %d, stepmul %d, idle step %d kB.",
+                 cfg->mode ? cfg->mode : "incremental", cfg->pause,
+                 cfg->stepmul, cfg->idle_step);
+
+    return TRUE;
+}
@@ -118,8 +118,7 @@ static void sighandler_lua_cb(mrp_sighandler_t *hlr, int sig, void *user_data)
         else
             lua_pushinteger(h->L, sig);
 
-        if (lua_pcall(h->L, 2, 0, 0) != 0)
-            mrp_log_error("failed to invoke Lua sighandler callback");
+        mrp_lua_coro_call(h->L, 2, "Lua sighandler callback");
     }
 
     if (one) {
@@ -158,7 +157,7 @@ static int sighandler_lua_create(lua_State *L)
 
     h = (sighandler_lua_t *)mrp_lua_create_object(L, SIGHANDLER_LUA_CLASS,
                                                   NULL, 0);
-    h->L        = L;
+    h->L        = mrp_lua_main_state(L);
     h->ml       = ctx->ml;
     h->callback = LUA_NOREF;
 
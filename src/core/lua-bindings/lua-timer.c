@@ -116,8 +116,8 @@ static void timer_lua_cb(mrp_timer_t *timer, void *user_data)
     if (mrp_lua_object_deref_value(t, t->L, t->callback, false)) {
         mrp_lua_push_object(t->L, t);
 
-        if (lua_pcall(t->L, 1, 0, 0) != 0) {
-            mrp_log_error("failed to invoke Lua timer callback, stopping");
+        if (mrp_lua_coro_call(t->L, 1, "Lua timer callback") != 0) {
+            mrp_log_error("Lua timer callback failed, stopping");
             mrp_del_timer(t->t);
             t->t = NULL;
         }
@@ -185,7 +185,7 @@ static int timer_lua_create(lua_State *L)
 
     t = (timer_lua_t *)mrp_lua_create_object(L, TIMER_LUA_CLASS, NULL, 0);
 
-    t->L        = L;
+    t->L        = mrp_lua_main_state(L);
     t->ctx      = ctx;
     t->callback = LUA_NOREF;
     t->msecs    = 5000;
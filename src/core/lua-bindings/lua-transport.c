@@ -53,6 +53,31 @@
 
 #define TRANSPORT_LUA_CLASS MRP_LUA_CLASS(transport, lua)
 
+/*
+ * A message filter is a Lua table of message fields and the values they
+ * are allowed to have, for instance
+ *
+ *     filter = { type = 'request', op = { 'get', 'set' } }
+ *
+ * Messages with any of the fields missing or not having any of the listed
+ * values are dropped before they are passed to Lua at all.
+ */
+
+typedef struct {
+    int       type;                      /* LUA_T{STRING,NUMBER,BOOLEAN} */
+    union {
+        char   *str;                     /* string value */
+        double  num;                     /* numeric value */
+        bool    bln;                     /* boolean value */
+    };
+} filter_value_t;
+
+typedef struct {
+    char           *field;               /* message field to check */
+    filter_value_t *values;              /* allowed values */
+    int             nvalue;              /* number of allowed values */
+} filter_rule_t;
+
 typedef struct {
     lua_State       *L;                  /* Lua execution context */
     mrp_context_t   *ctx;                /* murphy context */
@@ -70,6 +95,10 @@ typedef struct {
         int recvfrom;                    /*     unconnected recv event */
     }                callback;           /* event callback references */
     int              data;               /* referece to callback data */
+    int              filter;             /* reference to message filter */
+    filter_rule_t   *rules;              /* parsed message filter */
+    int              nrule;              /* number of filter rules */
+    mrp_lua_coro_t  *waiter;             /* coroutine awaiting a message */
 } transport_lua_t;
 
 
@@ -80,11 +109,22 @@ static int transport_connect(transport_lua_t *t, char *err, size_t elen);
 static transport_lua_t *transport_accept(transport_lua_t *lt);
 static void transport_disconnect(transport_lua_t *t);
 
+static int set_filter(transport_lua_t *t, char *err, size_t elen);
+static int copy_filter(transport_lua_t *dst, transport_lua_t *src);
+static void clear_filter(transport_lua_t *t);
+static bool filter_message(transport_lua_t *t, mrp_json_t *msg);
+static bool filter_table(transport_lua_t *t, int idx);
+
 static void event_connect(mrp_transport_t *mt, void *user_data);
 static void event_closed(mrp_transport_t *mt, int error, void *user_data);
 static void event_recv(mrp_transport_t *mt, void *msg, void *user_data);
 static void event_recvfrom(mrp_transport_t *mt, void *msg, mrp_sockaddr_t *addr,
                            socklen_t alen, void *user_data);
+static void event_recvraw(mrp_transport_t *mt, void *data, size_t size,
+                          void *user_data);
+static void event_recvrawfrom(mrp_transport_t *mt, void *data, size_t size,
+                              mrp_sockaddr_t *addr, socklen_t alen,
+                              void *user_data);
 
 /* Lua transport handling */
 static int transport_lua_create(lua_State *L);
@@ -93,6 +133,7 @@ static int transport_lua_connect(lua_State *L);
 static int transport_lua_accept(lua_State *L);
 static void transport_lua_destroy(void *data);
 static int transport_lua_disconnect(lua_State *L);
+static int transport_lua_wait(lua_State *L);
 static void transport_lua_changed(void *data, lua_State *L, int member);
 static ssize_t transport_lua_tostring(mrp_lua_tostr_mode_t mode, char *buf,
                                       size_t size, lua_State *L, void *data);
@@ -113,6 +154,7 @@ MRP_LUA_METHOD_LIST_TABLE(transport_lua_methods,
                           MRP_LUA_METHOD(listen    , transport_lua_listen )
                           MRP_LUA_METHOD(connect   , transport_lua_connect)
                           MRP_LUA_METHOD(accept    , transport_lua_accept)
+                          MRP_LUA_METHOD(wait      , transport_lua_wait)
                           MRP_LUA_METHOD(disconnect, transport_lua_disconnect));
 
 MRP_LUA_METHOD_LIST_TABLE(transport_lua_overrides,
@@ -126,6 +168,7 @@ MRP_LUA_MEMBER_LIST_TABLE(transport_lua_members,
     MRP_LUA_CLASS_ANY    ("data"    , OFFS(data)    , NULL, NULL, NOTIFY   )
     MRP_LUA_CLASS_STRING ("address" , OFFS(address) , NULL, NULL, NOTIFY|RO)
     MRP_LUA_CLASS_STRING ("encoding", OFFS(encoding), NULL, NULL, NOTIFY|RO)
+    MRP_LUA_CLASS_ANY    ("filter"  , OFFS(filter)  , NULL, NULL, NOTIFY   )
 );
 
 typedef enum {
@@ -136,6 +179,7 @@ typedef enum {
     TRANSPORT_MEMBER_DATA,
     TRANSPORT_MEMBER_ADDRESS,
     TRANSPORT_MEMBER_ENCODING,
+    TRANSPORT_MEMBER_FILTER,
 } transport_member_t;
 
 
@@ -196,6 +240,20 @@ static int set_address(transport_lua_t *t, const char *address,
 }
 
 
+/*
+ * By default messages are parsed into JSON objects by the transport and
+ * passed to Lua wrapped, with fields converted on access. With encoding
+ * 'lua' messages are instead received raw and parsed straight into Lua
+ * tables, without any intermediate JSON objects. This is only possible
+ * with transports that preserve message boundaries, ie. websockets.
+ */
+
+static bool lua_encoding(transport_lua_t *t)
+{
+    return t->encoding != NULL && !strcmp(t->encoding, "lua");
+}
+
+
 static int transport_create(transport_lua_t *t, char *err, size_t elen)
 {
     MRP_LUA_ERRUSE(err, elen);
@@ -206,8 +264,15 @@ static int transport_create(transport_lua_t *t, char *err, size_t elen)
           .connection     = event_connect,
           .closed         = event_closed,
     };
-    const char *opt, *val;
-    int         flags;
+    static mrp_transport_evt_t raw_events = {
+        { .recvraw        = event_recvraw     },
+        { .recvrawfrom    = event_recvrawfrom },
+          .connection     = event_connect,
+          .closed         = event_closed,
+    };
+    mrp_transport_evt_t *evt;
+    const char          *opt, *val;
+    int                  flags;
 
     if (t->alen <= 0) {
         errno = EADDRNOTAVAIL;
@@ -217,8 +282,31 @@ static int transport_create(transport_lua_t *t, char *err, size_t elen)
     if (t->t != NULL)
         return 0;
 
-    flags = MRP_TRANSPORT_REUSEADDR | MRP_TRANSPORT_MODE_CUSTOM;
-    t->t  = mrp_transport_create(t->ctx->ml, t->atype, &events, t, flags);
+    flags = MRP_TRANSPORT_REUSEADDR;
+
+    if (!lua_encoding(t)) {
+        if (t->encoding != NULL && *t->encoding &&
+            strcmp(t->encoding, "json")) {
+            errno = EINVAL;
+            return mrp_lua_error(-1, t->L, "invalid encoding '%s'",
+                                 t->encoding);
+        }
+
+        evt    = &events;
+        flags |= MRP_TRANSPORT_MODE_CUSTOM;
+    }
+    else {
+        if (t->atype == NULL || strcmp(t->atype, "wsck")) {
+            errno = EINVAL;
+            return mrp_lua_error(-1, t->L, "encoding 'lua' needs a "
+                                 "websocket transport");
+        }
+
+        evt    = &raw_events;
+        flags |= MRP_TRANSPORT_MODE_RAW;
+    }
+
+    t->t = mrp_transport_create(t->ctx->ml, t->atype, evt, t, flags);
 
     if (t->t == NULL)
         return mrp_lua_error(-1, t->L, "failed to create transport");
@@ -294,19 +382,25 @@ static transport_lua_t *transport_accept(transport_lua_t *lt)
     t = (transport_lua_t *)mrp_lua_create_object(lt->L, TRANSPORT_LUA_CLASS,
                                                  NULL, 0);
 
-    t->L   = lt->L;
-    t->ctx = lt->ctx;
+    t->L        = lt->L;
+    t->ctx      = lt->ctx;
+    t->encoding = lt->encoding ? mrp_strdup(lt->encoding) : NULL;
     t->callback.connect  = LUA_NOREF;
     t->callback.closed   = LUA_NOREF;
     t->callback.recv     = LUA_NOREF;
     t->callback.recvfrom = LUA_NOREF;
     t->data              = LUA_NOREF;
+    t->filter            = LUA_NOREF;
 
     t->t = mrp_transport_accept(lt->t, t, MRP_TRANSPORT_REUSEADDR);
 
     if (t->t != NULL) {
         t->callback.recv = mrp_lua_object_getref(lt, t, t->L,lt->callback.recv);
         t->data          = mrp_lua_object_getref(lt, t, t->L,lt->data);
+        t->filter        = mrp_lua_object_getref(lt, t, t->L,lt->filter);
+
+        if (!copy_filter(t, lt))
+            mrp_log_error("failed to copy transport message filter");
 
         return t;
     }
@@ -330,6 +424,283 @@ static void transport_disconnect(transport_lua_t *t)
 
 
 
+static int parse_filter_value(lua_State *L, int idx, filter_value_t *v)
+{
+    switch ((v->type = lua_type(L, idx))) {
+    case LUA_TSTRING:
+        return (v->str = mrp_strdup(lua_tostring(L, idx))) != NULL;
+    case LUA_TNUMBER:
+        v->num = lua_tonumber(L, idx);
+        return TRUE;
+    case LUA_TBOOLEAN:
+        v->bln = lua_toboolean(L, idx);
+        return TRUE;
+    default:
+        v->type = LUA_TNIL;
+        errno   = EINVAL;
+        return FALSE;
+    }
+}
+
+
+static int parse_filter_rule(lua_State *L, filter_rule_t *r)
+{
+    int n, i;
+
+    /* key at -2, allowed value or array of allowed values at -1 */
+    if (lua_type(L, -2) != LUA_TSTRING) {
+        errno = EINVAL;
+        return FALSE;
+    }
+
+    if ((r->field = mrp_strdup(lua_tostring(L, -2))) == NULL)
+        return FALSE;
+
+    n = lua_type(L, -1) == LUA_TTABLE ? lua_objlen(L, -1) : 1;
+
+    if (n == 0 || (r->values = mrp_allocz_array(filter_value_t, n)) == NULL) {
+        errno = n ? ENOMEM : EINVAL;
+        return FALSE;
+    }
+
+    if (lua_type(L, -1) != LUA_TTABLE) {
+        r->nvalue = 1;
+        return parse_filter_value(L, -1, r->values);
+    }
+
+    for (i = 0; i < n; i++) {
+        lua_rawgeti(L, -1, i + 1);
+
+        if (!parse_filter_value(L, -1, r->values + i)) {
+            lua_pop(L, 1);
+            return FALSE;
+        }
+
+        r->nvalue++;
+        lua_pop(L, 1);
+    }
+
+    return TRUE;
+}
+
+
+static int set_filter(transport_lua_t *t, char *err, size_t elen)
+{
+    lua_State *L = t->L;
+    int        top, n;
+
+    MRP_LUA_ERRUSE(err, elen);
+
+    clear_filter(t);
+
+    top = lua_gettop(L);
+    mrp_lua_object_deref_value(t, L, t->filter, true);
+
+    switch (lua_type(L, -1)) {
+    case LUA_TNIL:
+        lua_settop(L, top);
+        return 0;
+    case LUA_TTABLE:
+        break;
+    default:
+        lua_settop(L, top);
+        return mrp_lua_error(-1, L, "transport filter must be a table");
+    }
+
+    for (n = 0, lua_pushnil(L); lua_next(L, -2); lua_pop(L, 1))
+        n++;
+
+    if (n > 0 && (t->rules = mrp_allocz_array(filter_rule_t, n)) == NULL) {
+        lua_settop(L, top);
+        return mrp_lua_error(-1, L, "failed to allocate transport filter");
+    }
+
+    for (lua_pushnil(L); lua_next(L, -2); lua_pop(L, 1)) {
+        if (!parse_filter_rule(L, t->rules + t->nrule++)) {
+            lua_settop(L, top);
+            clear_filter(t);
+            return mrp_lua_error(-1, L, "invalid transport filter");
+        }
+    }
+
+    lua_settop(L, top);
+
+    return 0;
+}
+
+
+static int copy_filter(transport_lua_t *dst, transport_lua_t *src)
+{
+    filter_rule_t  *sr, *dr;
+    filter_value_t *sv, *dv;
+    int             i, j;
+
+    if (src->nrule == 0)
+        return TRUE;
+
+    if ((dst->rules = mrp_allocz_array(filter_rule_t, src->nrule)) == NULL)
+        return FALSE;
+
+    for (i = 0; i < src->nrule; i++) {
+        sr = src->rules + i;
+        dr = dst->rules + dst->nrule++;
+
+        dr->field  = mrp_strdup(sr->field);
+        dr->values = mrp_allocz_array(filter_value_t, sr->nvalue);
+
+        if (dr->field == NULL || dr->values == NULL)
+            goto fail;
+
+        for (j = 0; j < sr->nvalue; j++) {
+            sv = sr->values + j;
+            dv = dr->values + dr->nvalue++;
+
+            *dv = *sv;
+
+            if (sv->type == LUA_TSTRING &&
+                (dv->str = mrp_strdup(sv->str)) == NULL) {
+                dv->type = LUA_TNIL;
+                goto fail;
+            }
+        }
+    }
+
+    return TRUE;
+
+ fail:
+    clear_filter(dst);
+    return FALSE;
+}
+
+
+static void clear_filter(transport_lua_t *t)
+{
+    filter_rule_t *r;
+    int            i, j;
+
+    for (i = 0; i < t->nrule; i++) {
+        r = t->rules + i;
+
+        for (j = 0; j < r->nvalue; j++)
+            if (r->values[j].type == LUA_TSTRING)
+                mrp_free(r->values[j].str);
+
+        mrp_free(r->values);
+        mrp_free(r->field);
+    }
+
+    mrp_free(t->rules);
+    t->rules = NULL;
+    t->nrule = 0;
+}
+
+
+static bool filter_value(filter_value_t *v, mrp_json_t *val)
+{
+    switch (mrp_json_get_type(val)) {
+    case MRP_JSON_STRING:
+        return v->type == LUA_TSTRING &&
+            !strcmp(v->str, mrp_json_string_value(val));
+    case MRP_JSON_INTEGER:
+        return v->type == LUA_TNUMBER &&
+            v->num == (double)mrp_json_integer_value(val);
+    case MRP_JSON_DOUBLE:
+        return v->type == LUA_TNUMBER &&
+            v->num == mrp_json_double_value(val);
+    case MRP_JSON_BOOLEAN:
+        return v->type == LUA_TBOOLEAN &&
+            !v->bln == !mrp_json_boolean_value(val);
+    default:
+        return false;
+    }
+}
+
+
+static bool filter_message(transport_lua_t *t, mrp_json_t *msg)
+{
+    filter_rule_t *r;
+    mrp_json_t    *val;
+    int            i, j;
+
+    for (i = 0; i < t->nrule; i++) {
+        r = t->rules + i;
+
+        if (mrp_json_get_type(msg) != MRP_JSON_OBJECT ||
+            (val = mrp_json_get(msg, r->field)) == NULL)
+            goto drop;
+
+        for (j = 0; j < r->nvalue; j++)
+            if (filter_value(r->values + j, val))
+                break;
+
+        if (j >= r->nvalue)
+            goto drop;
+    }
+
+    return true;
+
+ drop:
+    mrp_debug("message filtered out by <transport <%s> %p(%p)>.filter.%s",
+              t->address ? t->address : "no address", t, t->t, r->field);
+
+    return false;
+}
+
+
+static bool filter_table(transport_lua_t *t, int idx)
+{
+    lua_State      *L = t->L;
+    filter_rule_t  *r;
+    filter_value_t *v;
+    const char     *str;
+    bool            match;
+    int             i, j;
+
+    for (i = 0; i < t->nrule; i++) {
+        r = t->rules + i;
+
+        if (lua_type(L, idx) != LUA_TTABLE)
+            goto drop;
+
+        lua_pushstring(L, r->field);
+        lua_rawget(L, idx);
+
+        for (j = 0, match = false; !match && j < r->nvalue; j++) {
+            v = r->values + j;
+
+            if (v->type != lua_type(L, -1))
+                continue;
+
+            switch (v->type) {
+            case LUA_TSTRING:
+                str   = lua_tostring(L, -1);
+                match = !strcmp(v->str, str);
+                break;
+            case LUA_TNUMBER:
+                match = v->num == lua_tonumber(L, -1);
+                break;
+            case LUA_TBOOLEAN:
+                match = !v->bln == !lua_toboolean(L, -1);
+                break;
+            }
+        }
+
+        lua_pop(L, 1);
+
+        if (!match)
+            goto drop;
+    }
+
+    return true;
+
+ drop:
+    mrp_debug("message filtered out by <transport <%s> %p(%p)>.filter.%s",
+              t->address ? t->address : "no address", t, t->t, r->field);
+
+    return false;
+}
+
+
 static void transport_lua_changed(void *data, lua_State *L, int member)
 {
     MRP_LUA_ERRBUF();
@@ -358,6 +729,11 @@ static void transport_lua_changed(void *data, lua_State *L, int member)
     case TRANSPORT_MEMBER_ENCODING:
         break;
 
+    case TRANSPORT_MEMBER_FILTER:
+        if (set_filter(t, MRP_LUA_ERRPASS) < 0)
+            mrp_lua_error(-1, L, "%s", MRP_LUA_ERR);
+        return;
+
     default:
         break;
     }
@@ -377,7 +753,7 @@ static int transport_lua_create(lua_State *L)
 
     t = (transport_lua_t *)mrp_lua_create_object(L, TRANSPORT_LUA_CLASS,
                                                  NULL, 0);
-    t->L   = L;
+    t->L   = mrp_lua_main_state(L);
     t->ctx = ctx;
 
     t->callback.connect  = LUA_NOREF;
@@ -385,6 +761,7 @@ static int transport_lua_create(lua_State *L)
     t->callback.recv     = LUA_NOREF;
     t->callback.recvfrom = LUA_NOREF;
     t->data              = LUA_NOREF;
+    t->filter            = LUA_NOREF;
 
     switch (narg) {
     case 1:
@@ -485,25 +862,66 @@ static int transport_lua_disconnect(lua_State *L)
 }
 
 
+static int transport_lua_wait(lua_State *L)
+{
+    transport_lua_t *t    = transport_lua_check(L, 1);
+    int              narg = lua_gettop(L);
+
+    if (narg != 1)
+        return mrp_lua_error(-1, L, "wait takes no arguments, got %d",
+                             narg - 1);
+
+    if (t->t == NULL)
+        return mrp_lua_error(-1, L, "can't wait, transport not active");
+
+    if (t->waiter != NULL)
+        return mrp_lua_error(-1, L, "transport already being waited on");
+
+    t->waiter = mrp_lua_coro_suspend(L);
+
+    return lua_yield(L, 0);
+}
+
+
+static void resume_waiter(transport_lua_t *t, int nval)
+{
+    mrp_lua_coro_t *co = t->waiter;
+
+    t->waiter = NULL;
+
+    lua_xmove(t->L, mrp_lua_coro_state(co), nval);
+    mrp_lua_coro_resume(co, nval);
+}
+
+
 static void transport_lua_destroy(void *data)
 {
     transport_lua_t *t = (transport_lua_t *)data;
 
+    mrp_lua_coro_cancel(t->waiter);
+    t->waiter = NULL;
+
     mrp_transport_disconnect(t->t);
     t->t = NULL;
     mrp_free(t->address);
     t->address = NULL;
+    mrp_free(t->encoding);
+    t->encoding = NULL;
 
     mrp_lua_object_unref_value(t, t->L, t->callback.connect);
     mrp_lua_object_unref_value(t, t->L, t->callback.closed);
     mrp_lua_object_unref_value(t, t->L, t->callback.recv);
     mrp_lua_object_unref_value(t, t->L, t->callback.recvfrom);
     mrp_lua_object_unref_value(t, t->L, t->data);
+    mrp_lua_object_unref_value(t, t->L, t->filter);
     t->callback.connect  = LUA_NOREF;
     t->callback.closed   = LUA_NOREF;
     t->callback.recv     = LUA_NOREF;
     t->callback.recvfrom = LUA_NOREF;
     t->data              = LUA_NOREF;
+    t->filter            = LUA_NOREF;
+
+    clear_filter(t);
 }
 
 
@@ -541,8 +959,7 @@ static void event_connect(mrp_transport_t *mt, void *user_data)
         lua_pushliteral(t->L, "<remote address should be here>");
         mrp_lua_object_deref_value(t, t->L, t->data, true);
 
-        if (lua_pcall(t->L, 3, 0, 0) != 0)
-            mrp_log_error("failed to invoke transport connect callback");
+        mrp_lua_coro_call(t->L, 3, "transport connect callback");
     }
 
     lua_settop(t->L, top);
@@ -561,13 +978,18 @@ static void event_closed(mrp_transport_t *mt, int error, void *user_data)
 
     top = lua_gettop(t->L);
 
+    if (t->waiter != NULL) {
+        lua_pushnil(t->L);
+        lua_pushinteger(t->L, error);
+        resume_waiter(t, 2);
+    }
+
     if (mrp_lua_object_deref_value(t, t->L, t->callback.closed, false)) {
         mrp_lua_push_object(t->L, t);
         lua_pushinteger(t->L, error);
         mrp_lua_object_deref_value(t, t->L, t->data, true);
 
-        if (lua_pcall(t->L, 3, 0, 0) != 0)
-            mrp_log_error("failed to invoke transport closed callback");
+        mrp_lua_coro_call(t->L, 3, "transport closed callback");
 
         mrp_transport_destroy(t->t);
         t->t = NULL;
@@ -587,15 +1009,21 @@ static void event_recv(mrp_transport_t *mt, void *msg, void *user_data)
     mrp_debug("received message on <transport <%s> %p(%p)>",
               t->address ? t->address : "no address", t, t->t);
 
+    if (!filter_message(t, msg))
+        return;
+
     top = lua_gettop(t->L);
 
-    if (mrp_lua_object_deref_value(t, t->L, t->callback.recv, false)) {
+    if (t->waiter != NULL) {
+        mrp_json_lua_push(t->L, msg);
+        resume_waiter(t, 1);
+    }
+    else if (mrp_lua_object_deref_value(t, t->L, t->callback.recv, false)) {
         mrp_lua_push_object(t->L, t);
         mrp_json_lua_push(t->L, msg);
         mrp_lua_object_deref_value(t, t->L, t->data, true);
 
-        if (lua_pcall(t->L, 3, 0, 0) != 0)
-            mrp_log_error("failed to invoke transport recv callback");
+        mrp_lua_coro_call(t->L, 3, "transport recv callback");
     }
 
     lua_settop(t->L, top);
@@ -615,18 +1043,111 @@ static void event_recvfrom(mrp_transport_t *mt, void *msg, mrp_sockaddr_t *addr,
     mrp_debug("received message on <transport <%s> %p(%p)>",
               t->address ? t->address : "no address", t, t->t);
 
+    if (!filter_message(t, msg))
+        return;
+
     top = lua_gettop(t->L);
 
-    if (mrp_lua_object_deref_value(t, t->L, t->callback.recvfrom, false)) {
+    if (t->waiter != NULL) {
+        mrp_json_lua_push(t->L, msg);
+        lua_pushliteral(t->L, "<remote address should be here>");
+        resume_waiter(t, 2);
+    }
+    else if (mrp_lua_object_deref_value(t, t->L, t->callback.recvfrom, false)) {
         mrp_lua_push_object(t->L, t);
         mrp_json_lua_push(t->L, msg);
         lua_pushliteral(t->L, "<remote address should be here>");
         mrp_lua_object_deref_value(t, t->L, t->data, true);
 
-        if (lua_pcall(t->L, 4, 0, 0) != 0)
-            mrp_log_error("failed to invoke transport recvfrom callback");
+        mrp_lua_coro_call(t->L, 4, "transport recvfrom callback");
+    }
+
+    lua_settop(t->L, top);
+}
+
+
+static int push_raw_message(transport_lua_t *t, void *data, size_t size)
+{
+    const char *err = NULL;
+
+    if (!mrp_json_lua_decode(t->L, data, size, &err)) {
+        mrp_log_error("failed to parse message on transport %s (%s)",
+                      t->address ? t->address : "<no address>",
+                      err ? err : "unknown error");
+        return FALSE;
+    }
+
+    if (!filter_table(t, lua_gettop(t->L)))
+        return FALSE;
+
+    return TRUE;
+}
+
+
+static void event_recvraw(mrp_transport_t *mt, void *data, size_t size,
+                          void *user_data)
+{
+    transport_lua_t *t = (transport_lua_t *)user_data;
+    int              top;
+
+    MRP_UNUSED(mt);
+
+    mrp_debug("received %zu bytes on <transport <%s> %p(%p)>", size,
+              t->address ? t->address : "no address", t, t->t);
+
+    top = lua_gettop(t->L);
+
+    if (!push_raw_message(t, data, size))
+        goto out;
+
+    if (t->waiter != NULL)
+        resume_waiter(t, 1);
+    else if (mrp_lua_object_deref_value(t, t->L, t->callback.recv, false)) {
+        mrp_lua_push_object(t->L, t);
+        lua_pushvalue(t->L, top + 1);
+        mrp_lua_object_deref_value(t, t->L, t->data, true);
+
+        mrp_lua_coro_call(t->L, 3, "transport recv callback");
+    }
+
+ out:
+    lua_settop(t->L, top);
+}
+
+
+static void event_recvrawfrom(mrp_transport_t *mt, void *data, size_t size,
+                              mrp_sockaddr_t *addr, socklen_t alen,
+                              void *user_data)
+{
+    transport_lua_t *t = (transport_lua_t *)user_data;
+    int              top;
+
+    MRP_UNUSED(mt);
+    MRP_UNUSED(addr);
+    MRP_UNUSED(alen);
+
+    mrp_debug("received %zu bytes on <transport <%s> %p(%p)>", size,
+              t->address ? t->address : "no address", t, t->t);
+
+    top = lua_gettop(t->L);
+
+    if (!push_raw_message(t, data, size))
+        goto out;
+
+    if (t->waiter != NULL) {
+        lua_pushliteral(t->L, "<remote address should be here>");
+        resume_waiter(t, 2);
+    }
+    else if (mrp_lua_object_deref_value(t, t->L, t->callback.recvfrom, false)) {
+        mrp_lua_push_object(t->L, t);
+        lua_pushvalue(t->L, top + 1);
+        lua_pushliteral(t->L, "<remote address should be here>");
+        mrp_lua_object_deref_value(t, t->L, t->data, true);
+
+        mrp_lua_coro_call(t->L, 4, "transport recvfrom callback");
     }
 
+ out:
     lua_settop(t->L, top);
 }
 
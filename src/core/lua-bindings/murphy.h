@@ -92,6 +92,39 @@ int mrp_lua_register_murphy_bindings(mrp_lua_bindings_t *b);
 /** Check and get murphy context for the bindings. */
 mrp_context_t *mrp_lua_check_murphy_context(lua_State *L, int index);
 
+/** Event emitted on the global bus after the Lua configuration is reloaded. */
+#define MRP_LUA_CONFIG_RELOADED "lua-config-reloaded"
+
+/** Reload the main Lua configuration at the next quiescent point. */
+int mrp_lua_reload_config(void);
+
+/** Check whether the main Lua configuration is being reloaded. */
+int mrp_lua_reloading(void);
+
+/*
+ * coroutines for asynchronous Lua handlers
+ */
+
+typedef struct mrp_lua_coro_s mrp_lua_coro_t;
+
+/** Call the function below @narg arguments in a new coroutine, like pcall. */
+int mrp_lua_coro_call(lua_State *L, int narg, const char *what);
+
+/** Mark the running coroutine suspended, follow with return lua_yield(). */
+mrp_lua_coro_t *mrp_lua_coro_suspend(lua_State *L);
+
+/** Get the thread of a suspended coroutine to push results onto. */
+lua_State *mrp_lua_coro_state(mrp_lua_coro_t *co);
+
+/** Resume a suspended coroutine with @nres results pushed to its thread. */
+int mrp_lua_coro_resume(mrp_lua_coro_t *co, int nres);
+
+/** Drop a suspended coroutine without resuming it. */
+void mrp_lua_coro_cancel(mrp_lua_coro_t *co);
+
+/** Get the main thread for @L, to keep in objects outliving a coroutine. */
+lua_State *mrp_lua_main_state(lua_State *L);
+
 /** Produce a debugging dump of the Lua stack (using mrp_debug). */
 void mrp_lua_dump_stack(lua_State *L, const char *prefix);
 
@@ -108,4 +141,26 @@ typedef enum {
 /** Configure murphy lua debugging. */
 int mrp_lua_set_debug(mrp_lua_debug_t level);
 
+/*
+ * Lua memory allocation and garbage collection
+ */
+
+typedef enum {
+    MRP_LUA_ALLOC_POOL = 0,              /* small blocks from object pools */
+    MRP_LUA_ALLOC_HEAP,                  /* everything from the heap */
+} mrp_lua_alloc_t;
+
+typedef struct {
+    const char *mode;                    /* incremental or generational */
+    int         pause;                   /* GC pause, or 0 for default */
+    int         stepmul;                 /* GC step multiplier, or 0 */
+    int         idle_step;               /* kB per idle step, 0 disables */
+} mrp_lua_gc_config_t;
+
+/** Select the Lua allocator, must be called before the state is created. */
+void mrp_lua_set_allocator(mrp_lua_alloc_t type);
+
+/** Configure the Lua garbage collector. */
+int mrp_lua_set_gc(const mrp_lua_gc_config_t *cfg);
+
 #endif /* __MURPHY_LUA_BINDINGS_H__ */
@@ -54,6 +54,7 @@
 #define ELEMENT_IDX 1
 #define INPUT_IDX   1
 #define OUTPUT_IDX  2
+#define CHANGES_IDX 3
 
 #define INPUT_MAX      (sizeof(mrp_lua_element_mask_t) * 8)
 #define INPUT_BIT(_i)  (((mrp_lua_element_mask_t)1) << (_i))
@@ -73,6 +74,8 @@ enum field_e {
     PROPERTY,
     TYPE,
     INITIATE,
+    INCREMENTAL,
+    CHANGES,
 };
 
 enum input_type_e {
@@ -88,11 +91,13 @@ struct mrp_lua_element_input_s {
         mrp_funcbridge_value_t constant;
         mrp_lua_mdb_select_t *select;
     };
+    uint32_t seen;              /* generation of select seen by update */
 };
 
 
 struct mrp_lua_element_s {
     MRP_LUA_ELEMENT_FIELDS;
+    bool incremental;           /* whether update gets input changes */
 };
 
 struct mrp_lua_sink_s {
@@ -411,7 +416,8 @@ double mrp_lua_element_get_floating(mrp_lua_element_t *el, int inpidx,
 
 static int element_create_from_lua(lua_State *L)
 {
-    mrp_lua_element_t *el;
+    mrp_lua_element_t *el, *old;
+    mrp_funcbridge_t *fb;
     int table;
     size_t fldnamlen;
     const char *fldnam;
@@ -448,6 +454,11 @@ static int element_create_from_lua(lua_State *L)
             el->update = mrp_funcbridge_create_luafunc(L, -1);
             break;
 
+        case INCREMENTAL:
+            luaL_checktype(L, -1, LUA_TBOOLEAN);
+            el->incremental = lua_toboolean(L, -1);
+            break;
+
         default:
             lua_pushvalue(L, -2);
             lua_pushvalue(L, -2);
@@ -466,6 +477,23 @@ static int element_create_from_lua(lua_State *L)
     if (!el->update)
         luaL_error(L, "missing or invalid mandatory 'update' field");
 
+    if (mrp_lua_reloading()) {
+        mrp_lua_find_object(L, ELEMENT_CLASS, el->name);
+
+        if ((old = mrp_lua_to_object(L, ELEMENT_CLASS, -1)) != NULL) {
+            fb          = old->update;
+            old->update = el->update;
+            el->update  = NULL;
+            mrp_funcbridge_unref(L, fb);
+
+            mrp_debug("element '%s' rebound", old->name);
+
+            MRP_LUA_LEAVE(1);
+        }
+
+        lua_pop(L, 1);
+    }
+
     mrp_lua_set_object_name(L, ELEMENT_CLASS, el->name);
 
     mrp_debug("element '%s' created", el->name);
@@ -492,6 +520,8 @@ static int element_getfield(lua_State *L)
     case INPUTS:    lua_rawgeti(L, 1, INPUT_IDX);         break;
     case OUTPUTS:   lua_pushnil(L);                       break;
     case UPDATE:    mrp_funcbridge_push(L, el->update);   break;
+    case INCREMENTAL: lua_pushboolean(L, el->incremental);break;
+    case CHANGES:   lua_rawgeti(L, 1, CHANGES_IDX);       break;
     default:        lua_pushnil(L);                       break;
     }
 
@@ -542,6 +572,85 @@ static mrp_lua_element_t *element_check(lua_State *L, int idx)
     return (mrp_lua_element_t *)mrp_lua_check_object(L, ELEMENT_CLASS, idx);
 }
 
+static void element_changes_set(lua_State *L, mrp_lua_element_t *el, bool set)
+{
+    mrp_lua_element_input_t *inp;
+    size_t i;
+
+    /*
+     * Notes:
+     *   While the update of an incremental element runs, el.changes has
+     *   the changes of each select input since the previous update, ie.
+     *   el.changes.<input> = { inserted = {...}, updated = {...},
+     *   deleted = {...} }, or { reset = true } if the element has to
+     *   look at the full input (eg. on the first update). The element is
+     *   expected to apply the corresponding changes to its outputs with
+     *   insert/replace/update/delete, and the selects on them pass these
+     *   on to any incremental elements further down.
+     */
+
+    mrp_lua_push_object(L, el);
+    lua_pushinteger(L, CHANGES_IDX);
+
+    if (!set)
+        lua_pushnil(L);
+    else {
+        lua_createtable(L, 0, el->ninput);
+
+        for (i = 0;   i < el->ninput;   i++) {
+            inp = el->inputs + i;
+
+            if (inp->type != SELECT)
+                continue;
+
+            mrp_lua_push_select_changes(L, inp->select, inp->seen);
+            lua_setfield(L, -2, inp->name);
+        }
+    }
+
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+}
+
+static bool element_inputs_seen(mrp_lua_element_t *el, bool mark)
+{
+    mrp_lua_element_input_t *inp;
+    uint32_t gen;
+    size_t i;
+    bool seen, select;
+
+    /*
+     * Notes:
+     *   An element is installed as the update of every one of its output
+     *   tables, so the resolver would run it once per output. It is also
+     *   enough to run it once for a given set of select results, so we
+     *   remember the generation of every input seen by the last update
+     *   and skip updates that would see nothing new.
+     */
+
+    seen   = true;
+    select = false;
+
+    for (i = 0;   i < el->ninput;   i++) {
+        inp = el->inputs + i;
+
+        if (inp->type != SELECT)
+            continue;
+
+        select = true;
+        gen    = mrp_lua_select_get_generation(inp->select);
+
+        if (inp->seen != gen) {
+            seen = false;
+
+            if (mark)
+                inp->seen = gen;
+        }
+    }
+
+    return select && seen;
+}
+
 static int element_update_cb(mrp_scriptlet_t *script, mrp_context_tbl_t *ctbl)
 {
     lua_State *L = mrp_lua_get_lua_state();
@@ -549,14 +658,38 @@ static int element_update_cb(mrp_scriptlet_t *script, mrp_context_tbl_t *ctbl)
     mrp_funcbridge_value_t args[1] = { { .pointer = el } };
     mrp_funcbridge_value_t ret;
     char t;
+    size_t i;
+    int success;
 
     MRP_UNUSED(ctbl);
 
     mrp_debug("'%s'", el->name);
 
     if (el->update) {
+        if (element_inputs_seen(el, false)) {
+            mrp_debug("'%s' already up to date", el->name);
+            return TRUE;
+        }
+
+        if (el->incremental)
+            element_changes_set(L, el, true);
+
         memset(&ret, 0, sizeof(ret));
-        if (!mrp_funcbridge_call_from_c(L, el->update, "o", args, &t, &ret)) {
+        success = mrp_funcbridge_call_from_c(L, el->update, "o", args,
+                                             &t, &ret);
+
+        if (el->incremental)
+            element_changes_set(L, el, false);
+
+        if (success)
+            element_inputs_seen(el, true);
+        else {
+            /* make sure the next update is a full one */
+            for (i = 0;   i < el->ninput;   i++)
+                el->inputs[i].seen = 0;
+        }
+
+        if (!success) {
             mrp_log_error("failed to call element.lua.%s:update method (%s)",
                           el->name, ret.string ? ret.string : "NULL");
             mrp_free((void *)ret.string);
@@ -591,8 +724,6 @@ static void element_install(lua_State *L, void *void_el)
     char *p, *e;
     size_t len;
 
-    MRP_UNUSED(L);
-
     MRP_LUA_ENTER;
 
     ctx = mrp_lua_get_murphy_context();
@@ -609,6 +740,9 @@ static void element_install(lua_State *L, void *void_el)
         inp = el->inputs + i;
 
         if (inp->type == SELECT) {
+            if (el->incremental)
+                mrp_lua_select_track_changes(L, inp->select);
+
             d  = mrp_lua_select_name(inp->select);
             p += snprintf(p, e-p, " _select_%s", d);
 
@@ -641,7 +775,8 @@ static void element_install(lua_State *L, void *void_el)
 
 static int sink_create_from_lua(lua_State *L)
 {
-    mrp_lua_sink_t *sink;
+    mrp_lua_sink_t *sink, *old;
+    mrp_funcbridge_t *fb;
     int table;
     size_t fldnamlen;
     const char *fldnam;
@@ -714,6 +849,28 @@ static int sink_create_from_lua(lua_State *L)
     if (!sink->update)
         luaL_error(L, "missing or invalid mandatory 'update' field");
 
+    if (mrp_lua_reloading()) {
+        mrp_lua_find_object(L, SINK_CLASS, sink->name);
+
+        if ((old = mrp_lua_to_object(L, SINK_CLASS, -1)) != NULL) {
+            fb             = old->update;
+            old->update    = sink->update;
+            sink->update   = NULL;
+            mrp_funcbridge_unref(L, fb);
+
+            fb             = old->initiate;
+            old->initiate  = sink->initiate;
+            sink->initiate = NULL;
+            mrp_funcbridge_unref(L, fb);
+
+            mrp_debug("sink '%s' rebound", old->name);
+
+            MRP_LUA_LEAVE(1);
+        }
+
+        lua_pop(L, 1);
+    }
+
     mrp_lua_set_object_name(L, SINK_CLASS, sink->name);
 
     mrp_debug("sink '%s' created", sink->name);
@@ -1184,6 +1341,8 @@ static field_t field_name_to_type(const char *name, size_t len)
     case 7:
         if (!strcmp(name, "outputs"))
             return OUTPUTS;
+        if (!strcmp(name, "changes"))
+            return CHANGES;
         break;
 
     case 8:
@@ -1198,6 +1357,11 @@ static field_t field_name_to_type(const char *name, size_t len)
             return INTERFACE;
         break;
 
+    case 11:
+        if (!strcmp(name, "incremental"))
+            return INCREMENTAL;
+        break;
+
     default:
         break;
     }
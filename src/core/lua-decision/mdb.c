@@ -31,12 +31,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <ctype.h>
 
 #include <lualib.h>
 #include <lauxlib.h>
 
 #include <murphy/common.h>
 #include <murphy/common/debug.h>
+#include <murphy/common/profile.h>
 #include <murphy-db/mqi.h>
 #include <murphy-db/mql.h>
 
@@ -59,6 +61,8 @@ typedef enum   field_e        field_t;
 typedef struct row_s          row_t;
 typedef union  value_u        value_t;
 typedef struct const_def_s    const_def_t;
+typedef struct view_column_s  view_column_t;
+typedef struct delta_s        delta_t;
 
 
 
@@ -70,7 +74,11 @@ enum field_e {
     CONDITION,
     STATEMENT,
     SINGLEVAL,
-    CREATE
+    CREATE,
+    DATA,
+    ROWSIZE,
+    LAYOUT,
+    MATERIALIZED
 };
 
 
@@ -85,17 +93,50 @@ struct mrp_lua_mdb_table_s {
 };
 
 
+struct delta_s {
+    bool track;                          /* whether changes are tracked */
+    bool valid;                          /* changes of the last update known */
+    uint32_t gen;                        /* bumped on every update */
+    mql_result_t *prev;                  /* previous result, for deletions */
+    void *prev_data;                     /* row buffer of the previous one */
+    int nkey;                            /* number of key columns, or 0 */
+    int *keys;                           /* key columns identifying a row */
+    int *rows;                           /* inserted, updated, deleted rows */
+    int size;                            /* allocated size of rows */
+    int ninsert;                         /* rows inserted by the last update */
+    int nupdate;                         /* rows updated by the last update */
+    int ndelete;                         /* rows deleted by the last update */
+};
+
 struct mrp_lua_mdb_select_s {
     const char *name;
     const char *table_name;
     mrp_lua_strarray_t *columns;
     const char *condition;
+    bool materialized;                   /* selects from a view of its own */
+    mqi_handle_t mview;                  /* the view table */
+    uint32_t stamp;                      /* view table stamp at last update */
     struct {
         const char *string;
         mql_statement_t *precomp;
     } statement;
     mql_result_t *result;
     size_t nrow;
+    bool changed;                        /* result changed by last update */
+    uint32_t epoch;                      /* select_epoch at last update */
+    struct {
+        void *data;                      /* row buffer of the result */
+        int rowsize;                     /* size of a single row */
+        int ncol;                        /* number of columns */
+        view_column_t *cols;             /* precomputed column layout */
+        char *layout;                    /* C declaration of a row */
+    } view;
+    delta_t delta;
+};
+
+struct view_column_s {
+    mqi_data_type_t type;
+    int offset;
 };
 
 struct row_s {
@@ -123,6 +164,8 @@ static int  table_setfield(lua_State *);
 static int  table_tostring(lua_State *);
 static int  table_insert(lua_State *);
 static int  table_replace(lua_State *);
+static int  table_insert_rows(lua_State *);
+static int  table_replace_rows(lua_State *);
 static int  table_update(lua_State *);
 static int  table_delete(lua_State *);
 static void table_destroy_from_lua(void *);
@@ -152,6 +195,14 @@ static void select_row_class_create(lua_State *);
 static int  select_row_getfield(lua_State *);
 static int  select_row_setfield(lua_State *);
 static int  select_row_getlength(lua_State *);
+static void select_view_update(mrp_lua_mdb_select_t *);
+static const char *select_view_layout(mrp_lua_mdb_select_t *);
+static void select_view_push(lua_State *, mrp_lua_mdb_select_t *, int, int);
+static bool select_result_equal(mrp_lua_mdb_select_t *, mql_result_t *);
+static void select_delta_update(mrp_lua_mdb_select_t *, mql_result_t *);
+static void select_failed_watch(mrp_context_t *);
+static void select_delta_push_rows(lua_State *, mrp_lua_mdb_select_t *,
+                                   const char *, void *, int *, int);
 static mrp_lua_mdb_select_t *select_row_check(lua_State *, int, int *);
 
 static bool define_constants(lua_State *);
@@ -171,12 +222,23 @@ static void adjust_lua_table_size(lua_State *, int, void *, size_t, size_t,
 static bool create_mdb_table(mrp_lua_mdb_table_t *);
 static mqi_cond_entry_t *condition_check(lua_State *,int,mrp_lua_mdb_table_t*);
 
+/*
+ * Selection results live outside of the database, so they are not rolled
+ * back with a failed resolution. Since that would make us consider the
+ * results of the next update unchanged we force all selections to be
+ * changed on their next update whenever a resolution fails.
+ */
+static uint32_t select_epoch;
+static mrp_event_watch_t *select_failed;
+
 
 MRP_LUA_METHOD_LIST_TABLE (
     table_methods,           /* methodlist name */
     MRP_LUA_METHOD_CONSTRUCTOR  (table_create_from_lua)
     MRP_LUA_METHOD     (insert,  table_insert         )
     MRP_LUA_METHOD     (replace, table_replace        )
+    MRP_LUA_METHOD     (insert_rows,  table_insert_rows  )
+    MRP_LUA_METHOD     (replace_rows, table_replace_rows )
     MRP_LUA_METHOD     (update,  table_update         )
     MRP_LUA_METHOD     (delete,  table_delete         )
 );
@@ -391,6 +453,105 @@ double mrp_lua_select_get_floating(mrp_lua_mdb_select_t *sel,
     return sel ? mql_result_rows_get_floating(sel->result,colidx,rowidx) : 0.0;
 }
 
+void mrp_lua_select_track_changes(lua_State *L, mrp_lua_mdb_select_t *sel)
+{
+    mrp_lua_mdb_table_t *tbl;
+    mrp_lua_strarray_t *index;
+    int *keys, nkey, colidx;
+    size_t i;
+
+    if (!sel || sel->delta.track)
+        return;
+
+    /*
+     * Rows of the selection are identified by the index columns of the
+     * table, if all of them are selected. Otherwise a row is identified by
+     * all of its columns and a changed row shows up as a deletion and an
+     * insertion instead of an update.
+     */
+
+    mrp_lua_find_object(L, TABLE_CLASS, sel->table_name);
+    tbl = mrp_lua_to_object(L, TABLE_CLASS, -1);
+    lua_pop(L, 1);
+
+    keys = NULL;
+    nkey = 0;
+
+    if (tbl && (index = tbl->index) && index->nstring > 0) {
+        if ((keys = mrp_allocz_array(int, index->nstring)) != NULL) {
+            for (i = 0;   i < index->nstring;   i++) {
+                colidx = mrp_lua_select_get_column_index(sel,
+                                                         index->strings[i]);
+                if (colidx < 0)
+                    break;
+
+                keys[nkey++] = colidx;
+            }
+
+            if (i < index->nstring) {
+                mrp_free(keys);
+                keys = NULL;
+                nkey = 0;
+            }
+        }
+    }
+
+    sel->delta.keys  = keys;
+    sel->delta.nkey  = nkey;
+    sel->delta.track = true;
+    sel->delta.valid = false;
+
+    mrp_debug("tracking changes of select '%s' (%d key columns)",
+              sel->name, nkey);
+}
+
+uint32_t mrp_lua_select_get_generation(mrp_lua_mdb_select_t *sel)
+{
+    return sel ? sel->delta.gen : 0;
+}
+
+int mrp_lua_push_select_changes(lua_State *L, mrp_lua_mdb_select_t *sel,
+                                uint32_t since)
+{
+    delta_t *d;
+
+    /*
+     * Notes:
+     *   Pushes { inserted = {...}, updated = {...}, deleted = {...} } with
+     *   the changed rows as plain tables of column values, relative to
+     *   generation 'since' of the selection. If the changes since then are
+     *   not known (eg. 'since' is older than the previous update) it pushes
+     *   { reset = true } and the caller needs to look at all rows.
+     */
+
+    lua_createtable(L, 0, 3);
+
+    if (!sel || !(d = &sel->delta)->track ||
+        (since != d->gen && (since != d->gen - 1 || !d->valid)))
+    {
+        lua_pushboolean(L, true);
+        lua_setfield(L, -2, "reset");
+
+        return 1;
+    }
+
+    if (since == d->gen) {
+        select_delta_push_rows(L, sel, "inserted", NULL, NULL, 0);
+        select_delta_push_rows(L, sel, "updated" , NULL, NULL, 0);
+        select_delta_push_rows(L, sel, "deleted" , NULL, NULL, 0);
+    }
+    else {
+        select_delta_push_rows(L, sel, "inserted", sel->view.data,
+                               d->rows, d->ninsert);
+        select_delta_push_rows(L, sel, "updated" , sel->view.data,
+                               d->rows + d->ninsert, d->nupdate);
+        select_delta_push_rows(L, sel, "deleted" , d->prev_data,
+                               d->rows + d->ninsert + d->nupdate, d->ndelete);
+    }
+
+    return 1;
+}
+
 
 static int table_create_from_lua(lua_State *L)
 {
@@ -446,6 +607,17 @@ static int table_create_from_lua(lua_State *L)
     if (!tbl->name)
         luaL_error(L, "mandatory 'name' field is unspecified");
 
+    if (mrp_lua_reloading()) {
+        mrp_lua_find_object(L, TABLE_CLASS, tbl->name);
+
+        if (mrp_lua_to_object(L, TABLE_CLASS, -1) != NULL) {
+            mrp_debug("table '%s' kept", tbl->name);
+            MRP_LUA_LEAVE(1);
+        }
+
+        lua_pop(L, 1);
+    }
+
     if (tbl->builtin) {
         if (tbl->handle == MQI_HANDLE_INVALID)
             luaL_error(L, "table '%s' do not exist", tbl->name);
@@ -656,6 +828,128 @@ static int table_replace(lua_State *L)
     MRP_LUA_LEAVE(1);
 }
 
+static void table_rows_freevalues(mrp_lua_mdb_table_t *tbl, value_t *values,
+                                  size_t nrow)
+{
+    size_t r, c;
+
+    for (r = 0; r < nrow; r++, values += tbl->ncolumn)
+        for (c = 0; c < tbl->ncolumn; c++)
+            if (tbl->columns[c].type == mqi_string)
+                mrp_free(values[c].string);
+}
+
+/*
+ * Bulk loading a Lua array of rows into a table. All rows are passed to
+ * MDB in a single insert within a single transaction, so any triggers
+ * only see the batch once, at commit. If purge is set, all existing rows
+ * are deleted first within the same transaction, IOW the table ends up
+ * holding exactly the given rows.
+ */
+static int table_load_rows(lua_State *L, mrp_lua_mdb_table_t *tbl, int idx,
+                           bool replace, bool purge)
+{
+    mqi_column_desc_t desc[MQI_COLUMN_MAX+1];
+    value_t *values, *v;
+    void **data;
+    mqi_handle_t th;
+    size_t nrow, i;
+    int loaded;
+
+    luaL_checktype(L, idx, LUA_TTABLE);
+
+    nrow = lua_objlen(L, idx);
+
+    if (nrow == 0 && !purge)
+        return 0;
+
+    /*
+     * Notes:
+     *     Both arrays are allocated as userdata, so they get collected
+     *     even if we bail out with a Lua error while collecting the rows.
+     */
+
+    values = lua_newuserdata(L, sizeof(*values) * tbl->ncolumn * (nrow + 1));
+    data   = lua_newuserdata(L, sizeof(*data) * (nrow + 1));
+
+    memset(values, 0, sizeof(*values) * tbl->ncolumn * (nrow + 1));
+
+    for (i = 0; i < nrow; i++) {
+        v = values + i * tbl->ncolumn;
+
+        lua_rawgeti(L, idx, i + 1);
+
+        if (lua_type(L, -1) != LUA_TTABLE ||
+            !table_row_getvalues(L, tbl, -1, true, desc, v)) {
+            table_rows_freevalues(tbl, values, i);
+            return luaL_error(L, "row #%zu: some columns do not have value",
+                              i + 1);
+        }
+
+        lua_pop(L, 1);
+
+        data[i] = v;
+    }
+
+    data[nrow] = NULL;
+
+    th = mqi_begin_transaction();
+
+    if (purge && MQI_DELETE(tbl->handle, NULL) < 0)
+        loaded = -1;
+    else if (nrow == 0)
+        loaded = 0;
+    else
+        loaded = mqi_insert_into(tbl->handle, replace, desc, data);
+
+    if (loaded >= 0 && (replace || loaded == (int)nrow))
+        mqi_commit_transaction(th);
+    else {
+        mqi_rollback_transaction(th);
+        loaded = -1;
+    }
+
+    table_rows_freevalues(tbl, values, nrow);
+
+    lua_pop(L, 2);
+
+    if (loaded < 0)
+        return luaL_error(L, "bulk %s failed: %s",
+                          replace ? "replace" : "insert", strerror(errno));
+
+    return loaded;
+}
+
+static int table_insert_rows(lua_State *L)
+{
+    mrp_lua_mdb_table_t *tbl;
+    int inserted;
+
+    MRP_LUA_ENTER;
+
+    tbl = mrp_lua_table_check(L, 1);
+    inserted = table_load_rows(L, tbl, 2, false, false);
+
+    lua_pushinteger(L, inserted);
+
+    MRP_LUA_LEAVE(1);
+}
+
+static int table_replace_rows(lua_State *L)
+{
+    mrp_lua_mdb_table_t *tbl;
+    int replaced;
+
+    MRP_LUA_ENTER;
+
+    tbl = mrp_lua_table_check(L, 1);
+    replaced = table_load_rows(L, tbl, 2, true, lua_toboolean(L, 3));
+
+    lua_pushinteger(L, replaced);
+
+    MRP_LUA_LEAVE(1);
+}
+
 static int table_update(lua_State *L)
 {
     int narg;
@@ -925,6 +1219,9 @@ static int select_create_from_lua(lua_State *L)
     const char *condition;
     char  cols[1024];
     char  qry[2048];
+    char  view[256];
+    char  ddl[2048 + 256];
+    mql_result_t *r;
 
     MRP_LUA_ENTER;
 
@@ -958,6 +1255,10 @@ static int select_create_from_lua(lua_State *L)
                 sel->condition = mrp_strdup(condition);
             break;
 
+        case MATERIALIZED:
+            sel->materialized = lua_toboolean(L, -1);
+            break;
+
         default:
             luaL_error(L, "unexpected field '%s'", fldnam);
             break;
@@ -982,6 +1283,29 @@ static int select_create_from_lua(lua_State *L)
                  cols, sel->table_name, sel->condition);
     }
 
+    /*
+     * A materialized select has its result maintained in a view by the
+     * database as the table changes, and reads the whole view instead.
+     */
+    if (sel->materialized) {
+        snprintf(view, sizeof(view), "_view_%s", sel->name);
+        snprintf(ddl, sizeof(ddl), "CREATE VIEW %s AS %s", view, qry);
+
+        r = mql_exec_string(mql_result_string, ddl);
+
+        if (!mql_result_is_success(r)) {
+            mrp_log_error("failed to create view for select '%s': %s",
+                          sel->name, mql_result_error_get_message(r));
+            sel->materialized = false;
+        }
+        else {
+            sel->mview = mqi_get_table_handle(view);
+            snprintf(qry, sizeof(qry), "SELECT %s FROM %s", cols, view);
+        }
+
+        mql_result_free(r);
+    }
+
     sel->statement.string = mrp_strdup(qry);
 
     mrp_lua_set_object_name(L, SELECT_CLASS, sel->name);
@@ -1024,7 +1348,16 @@ static int select_getfield(lua_State *L)
                 case COLUMNS:   mrp_lua_push_strarray(L, sel->columns);  break;
                 case CONDITION: lua_pushstring(L, sel->condition);       break;
                 case STATEMENT: lua_pushstring(L,sel->statement.string); break;
+                case MATERIALIZED: lua_pushboolean(L, sel->materialized); break;
                 case SINGLEVAL: mrp_lua_push_select(L, sel, true);       break;
+                case ROWSIZE:   lua_pushinteger(L, sel->view.rowsize);   break;
+                case LAYOUT:    lua_pushstring(L,select_view_layout(sel));break;
+                case DATA:
+                    if (sel->view.data && sel->nrow > 0)
+                        lua_pushlightuserdata(L, sel->view.data);
+                    else
+                        lua_pushnil(L);
+                    break;
                 default:        lua_pushnil(L);                          break;
                 }
             }
@@ -1064,6 +1397,13 @@ static void select_destroy_from_lua(void *data)
         mrp_free((void *)sel->table_name);
         mrp_free((void *)sel->condition);
         mrp_free((void *)sel->statement.string);
+        if (sel->materialized)
+            mqi_drop_table(sel->mview);
+        mrp_free(sel->view.cols);
+        mrp_free(sel->view.layout);
+        mql_result_free(sel->delta.prev);
+        mrp_free(sel->delta.keys);
+        mrp_free(sel->delta.rows);
     }
 
     MRP_LUA_LEAVE_NOARG;
@@ -1072,7 +1412,8 @@ static void select_destroy_from_lua(void *data)
 static int select_update(lua_State *L, int tbl, mrp_lua_mdb_select_t *sel)
 {
     mql_statement_t *statement;
-    mql_result_t *result;
+    mql_result_t *result, *prev;
+    uint32_t stamp;
     int nrow;
 
     MRP_LUA_ENTER;
@@ -1080,10 +1421,23 @@ static int select_update(lua_State *L, int tbl, mrp_lua_mdb_select_t *sel)
     if (!sel->statement.precomp)
         sel->statement.precomp = mql_precompile(sel->statement.string);
 
+    /* an untouched view has the same rows as the last time */
+    if (sel->materialized && sel->result && sel->epoch == select_epoch) {
+        stamp = mqi_get_table_stamp(sel->mview);
+
+        if (stamp && stamp == sel->stamp) {
+            sel->changed = false;
+            MRP_LUA_LEAVE((int)sel->nrow);
+        }
+
+        sel->stamp = stamp;
+    }
+
+    prev = sel->result;
+
     if (!(statement = sel->statement.precomp))
         nrow = 0;
     else {
-        mql_result_free(sel->result);
         sel->result = NULL;
 
         result = mql_exec_statement(mql_result_rows, statement);
@@ -1096,6 +1450,29 @@ static int select_update(lua_State *L, int tbl, mrp_lua_mdb_select_t *sel)
         }
     }
 
+    select_view_update(sel);
+
+    if (sel->result == prev)
+        sel->changed = false;
+    else if (sel->epoch == select_epoch && select_result_equal(sel, prev)) {
+        sel->changed = false;
+        mql_result_free(prev);
+    }
+    else {
+        sel->changed = true;
+        sel->delta.gen++;
+
+        if (sel->epoch != select_epoch)
+            sel->delta.valid = false;
+
+        if (sel->delta.track && sel->epoch == select_epoch)
+            select_delta_update(sel, prev);
+        else
+            mql_result_free(prev);
+    }
+
+    sel->epoch = select_epoch;
+
     mrp_debug("\"%s\" resulted %d rows", sel->statement.string, nrow);
 
     if (nrow >= 0) {
@@ -1146,10 +1523,40 @@ static int select_update_from_resolver(mrp_scriptlet_t *script,
 
     lua_pop(L, 1);
 
-    MRP_LUA_LEAVE(nrow >= 0);
+    if (nrow < 0)
+        MRP_LUA_LEAVE(FALSE);
+
+    MRP_LUA_LEAVE(sel->changed ? TRUE : MRP_SCRIPT_UNCHANGED);
 }
 
 
+static void select_failed_cb(mrp_event_watch_t *w, uint32_t id, int format,
+                             void *data, void *user_data)
+{
+    MRP_UNUSED(w);
+    MRP_UNUSED(id);
+    MRP_UNUSED(format);
+    MRP_UNUSED(data);
+    MRP_UNUSED(user_data);
+
+    select_epoch++;
+}
+
+static void select_failed_watch(mrp_context_t *ctx)
+{
+    mrp_event_bus_t *bus;
+    uint32_t id;
+
+    if (select_failed != NULL || ctx->ml == NULL)
+        return;
+
+    if ((bus = mrp_event_bus_get(ctx->ml, MRP_RESOLVER_BUS)) == NULL)
+        return;
+
+    id = mrp_event_id(MRP_RESOLVER_EVENT_FAILED);
+    select_failed = mrp_event_add_watch(bus, id, select_failed_cb, NULL);
+}
+
 static void select_install(lua_State *L, mrp_lua_mdb_select_t *sel)
 {
     static mrp_interpreter_t select_updater = {
@@ -1177,6 +1584,8 @@ static void select_install(lua_State *L, mrp_lua_mdb_select_t *sel)
         return;
     }
 
+    select_failed_watch(ctx);
+
     snprintf(target, sizeof(target), "_select_%s", sel->name);
     snprintf(table , sizeof(table) , "$%s" , sel->table_name);
 
@@ -1230,9 +1639,6 @@ static int select_row_getfield(lua_State *L)
     const char *fldnam;
     int rowidx;
     int colidx;
-    const char *string;
-    lua_Number number;
-    char buf[1024];
 
     MRP_LUA_ENTER;
 
@@ -1244,8 +1650,7 @@ static int select_row_getfield(lua_State *L)
               rowidx+1, sel ? sel->name : "<unknwon>");
 
     if (!sel || !rslt || (size_t)rowidx >= sel->nrow)
-        lua_pushnil(L); /* we should never get here actually */
-
+        goto no_data; /* we should never get here actually */
 
     switch (lua_type(L, 2)) {
     case LUA_TSTRING:
@@ -1264,21 +1669,10 @@ static int select_row_getfield(lua_State *L)
         if (colidx < 0 || colidx >= (int)cols->nstring)
             goto no_data;
 
-        switch (mql_result_rows_get_row_column_type(rslt, colidx)) {
-        case mqi_string:
-            string = mql_result_rows_get_string(rslt, colidx, rowidx,
-                                                buf, sizeof(buf));
-            lua_pushstring(L, string);
-            break;
-        case mqi_integer:
-        case mqi_unsignd:
-        case mqi_floating:
-            number = mql_result_rows_get_floating(rslt, colidx, rowidx);
-            lua_pushnumber(L, number);
-            break;
-        default:
+        if (colidx >= sel->view.ncol)
             goto no_data;
-        }
+
+        select_view_push(L, sel, colidx, rowidx);
         break;
 
     default:
@@ -1330,6 +1724,443 @@ static mrp_lua_mdb_select_t *select_row_check(lua_State *L,
     return (mrp_lua_mdb_select_t *)row->data;
 }
 
+static void select_view_update(mrp_lua_mdb_select_t *sel)
+{
+    mql_result_t *rslt = sel->result;
+    view_column_t *col;
+    int ncol, i;
+
+    /*
+     * Notes:
+     *   Row objects are just views to the result buffer of the selection.
+     *   We precompute the type and offset of every column here, once per
+     *   update, so that reading a field is a single direct memory access
+     *   instead of a series of checked mql_result_rows_get_* calls.
+     */
+
+    sel->view.data = NULL;
+    sel->view.rowsize = 0;
+
+    if (!rslt || (ncol = mql_result_rows_get_row_column_count(rslt)) <= 0) {
+        sel->view.ncol = 0;
+        return;
+    }
+
+    if (ncol != sel->view.ncol || !sel->view.cols) {
+        mrp_free(sel->view.cols);
+        mrp_free(sel->view.layout);
+        sel->view.layout = NULL;
+        sel->view.ncol = 0;
+
+        if (!(sel->view.cols = mrp_allocz_array(view_column_t, ncol)))
+            return;
+    }
+
+    for (i = 0, col = sel->view.cols;   i < ncol;   i++, col++) {
+        col->type   = mql_result_rows_get_row_column_type(rslt, i);
+        col->offset = mql_result_rows_get_row_column_offset(rslt, i);
+    }
+
+    sel->view.ncol = ncol;
+    sel->view.data = mql_result_rows_get_data(rslt, &sel->view.rowsize);
+}
+
+static void view_value_push(lua_State *L, view_column_t *col, void *addr)
+{
+    switch (col->type) {
+    case mqi_string:   lua_pushstring(L, *(char **)addr);     break;
+    case mqi_integer:  lua_pushinteger(L, *(int32_t *)addr);  break;
+    case mqi_unsignd:  lua_pushnumber(L, *(uint32_t *)addr);  break;
+    case mqi_floating: lua_pushnumber(L, *(double *)addr);    break;
+    default:           lua_pushnil(L);                        break;
+    }
+}
+
+static void select_view_push(lua_State *L, mrp_lua_mdb_select_t *sel,
+                             int colidx, int rowidx)
+{
+    view_column_t *col = sel->view.cols + colidx;
+    void *addr;
+
+    addr = sel->view.data + (sel->view.rowsize * rowidx + col->offset);
+
+    view_value_push(L, col, addr);
+}
+
+static uint32_t view_row_hash(mrp_lua_mdb_select_t *sel, void *row,
+                              int *cols, int ncol)
+{
+    view_column_t *col;
+    uint32_t h;
+    const char *s;
+    uint8_t *p;
+    int i, j, size;
+
+    h = 2166136261U;
+
+    for (i = 0;   i < ncol;   i++) {
+        col = sel->view.cols + (cols ? cols[i] : i);
+
+        switch (col->type) {
+        case mqi_string:
+            if ((s = *(char **)(row + col->offset)) != NULL) {
+                while (*s)
+                    h = (h ^ (uint8_t)*s++) * 16777619U;
+            }
+            h = (h ^ 0xff) * 16777619U;
+            continue;
+        case mqi_integer:   size = sizeof(int32_t);    break;
+        case mqi_unsignd:   size = sizeof(uint32_t);   break;
+        case mqi_floating:  size = sizeof(double);     break;
+        default:            continue;
+        }
+
+        for (j = 0, p = row + col->offset;   j < size;   j++)
+            h = (h ^ p[j]) * 16777619U;
+    }
+
+    return h;
+}
+
+static bool view_row_equal(mrp_lua_mdb_select_t *sel, void *row1, void *row2,
+                           int *cols, int ncol)
+{
+    view_column_t *col;
+    const char *s1, *s2;
+    int i, o;
+
+    for (i = 0;   i < ncol;   i++) {
+        col = sel->view.cols + (cols ? cols[i] : i);
+        o   = col->offset;
+
+        switch (col->type) {
+        case mqi_string:
+            s1 = *(char **)(row1 + o);
+            s2 = *(char **)(row2 + o);
+            if (s1 != s2 && (!s1 || !s2 || strcmp(s1, s2)))
+                return false;
+            break;
+        case mqi_integer:
+            if (*(int32_t *)(row1 + o) != *(int32_t *)(row2 + o))
+                return false;
+            break;
+        case mqi_unsignd:
+            if (*(uint32_t *)(row1 + o) != *(uint32_t *)(row2 + o))
+                return false;
+            break;
+        case mqi_floating:
+            if (*(double *)(row1 + o) != *(double *)(row2 + o))
+                return false;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return true;
+}
+
+static bool select_result_equal(mrp_lua_mdb_select_t *sel, mql_result_t *prev)
+{
+    void *data, *pdata;
+    int nrow, rowsize, prowsize, i;
+
+    /*
+     * Notes:
+     *   Compare the new result row by row to the previous one, in order,
+     *   so an unchanged result keeps the row indices of the previous one
+     *   which the tracked changes of the selection may refer to.
+     */
+
+    if (!sel->result || !prev)
+        return !sel->result && !prev;
+
+    nrow = mql_result_rows_get_row_count(sel->result);
+
+    if (nrow != mql_result_rows_get_row_count(prev))
+        return false;
+
+    if (mql_result_rows_get_row_column_count(prev) != sel->view.ncol)
+        return false;
+
+    if (nrow == 0)
+        return true;
+
+    data    = sel->view.data;
+    rowsize = sel->view.rowsize;
+    pdata   = mql_result_rows_get_data(prev, &prowsize);
+
+    if (!data || !pdata || rowsize != prowsize)
+        return false;
+
+    for (i = 0;   i < nrow;   i++) {
+        if (!view_row_equal(sel, data + i * rowsize, pdata + i * rowsize,
+                            NULL, sel->view.ncol))
+            return false;
+    }
+
+    return true;
+}
+
+static void select_delta_update(mrp_lua_mdb_select_t *sel, mql_result_t *prev)
+{
+    delta_t *d = &sel->delta;
+    void *data, *pdata, *row;
+    int rowsize, prowsize, nnew, nold, nkey, *keys;
+    int *slots, *match, nslot, mask, size, i, j, k;
+    uint32_t h;
+    bool *used;
+
+    /*
+     * Notes:
+     *   The previous result is diffed against the new one by hashing the
+     *   key columns of the previous rows, so this is linear in the size
+     *   of the selection. The previous result is kept around until the
+     *   next update, as the deleted rows are pointers to its row buffer.
+     */
+
+    mql_result_free(d->prev);
+
+    d->prev      = prev;
+    d->prev_data = NULL;
+    d->valid     = false;
+    d->ninsert   = d->nupdate = d->ndelete = 0;
+
+    data  = sel->view.data;
+    pdata = NULL;
+    nnew  = sel->result ? mql_result_rows_get_row_count(sel->result) : 0;
+    nold  = 0;
+
+    if (prev != NULL) {
+        pdata = mql_result_rows_get_data(prev, &prowsize);
+        nold  = mql_result_rows_get_row_count(prev);
+
+        if (mql_result_rows_get_row_column_count(prev) != sel->view.ncol)
+            return;
+
+        if (nnew > 0 && nold > 0 && prowsize != sel->view.rowsize)
+            return;
+    }
+
+    if (nnew > 0 && !data)
+        return;
+
+    if (nold > 0 && !pdata)
+        return;
+
+    rowsize = sel->view.rowsize;
+    size    = nnew + nold;
+
+    if (size > d->size) {
+        if (!mrp_reallocz(d->rows, d->size, size))
+            return;
+        d->size = size;
+    }
+
+    if ((nkey = d->nkey) > 0)
+        keys = d->keys;
+    else {
+        nkey = sel->view.ncol;
+        keys = NULL;
+    }
+
+    for (nslot = 16;   nslot < 2 * nold;   nslot <<= 1)
+        ;
+    mask = nslot - 1;
+
+    slots = mrp_alloc(nslot * sizeof(slots[0]));
+    match = mrp_alloc((nnew + 1) * sizeof(match[0]));
+    used  = mrp_allocz((nold + 1) * sizeof(used[0]));
+
+    if (!slots || !match || !used)
+        goto out;
+
+    memset(slots, -1, nslot * sizeof(slots[0]));
+
+    for (j = 0;   j < nold;   j++) {
+        row = pdata + j * prowsize;
+        h   = view_row_hash(sel, row, keys, nkey);
+
+        for (k = h & mask;   slots[k] >= 0;   k = (k + 1) & mask)
+            ;
+        slots[k] = j;
+    }
+
+    for (i = 0;   i < nnew;   i++) {
+        row = data + i * rowsize;
+        h   = view_row_hash(sel, row, keys, nkey);
+
+        for (k = h & mask;   (j = slots[k]) >= 0;   k = (k + 1) & mask) {
+            if (!used[j] &&
+                view_row_equal(sel, row, pdata + j * prowsize, keys, nkey))
+                break;
+        }
+
+        if (j < 0)
+            match[i] = -1;
+        else {
+            used[j] = true;
+
+            if (keys && !view_row_equal(sel, row, pdata + j * prowsize,
+                                        NULL, sel->view.ncol))
+                match[i] = j;
+            else
+                match[i] = -2;
+        }
+    }
+
+    for (i = 0;   i < nnew;   i++)
+        if (match[i] == -1)
+            d->rows[d->ninsert++] = i;
+
+    for (i = 0;   i < nnew;   i++)
+        if (match[i] >= 0)
+            d->rows[d->ninsert + d->nupdate++] = i;
+
+    for (j = 0;   j < nold;   j++)
+        if (!used[j])
+            d->rows[d->ninsert + d->nupdate + d->ndelete++] = j;
+
+    d->prev_data = pdata;
+    d->valid     = true;
+
+    mrp_debug("select '%s': %d inserted, %d updated, %d deleted rows",
+              sel->name, d->ninsert, d->nupdate, d->ndelete);
+
+ out:
+    mrp_free(slots);
+    mrp_free(match);
+    mrp_free(used);
+}
+
+static void select_delta_push_rows(lua_State *L, mrp_lua_mdb_select_t *sel,
+                                   const char *name, void *data, int *rows,
+                                   int nrow)
+{
+    mrp_lua_strarray_t *names = sel->columns;
+    view_column_t *col;
+    void *row;
+    int i, j, ncol;
+    bool named;
+
+    ncol  = sel->view.ncol;
+    named = names && (int)names->nstring == ncol;
+
+    lua_createtable(L, nrow, 0);
+
+    for (i = 0;   i < nrow;   i++) {
+        row = data + rows[i] * sel->view.rowsize;
+
+        lua_createtable(L, named ? 0 : ncol, named ? ncol : 0);
+
+        for (j = 0, col = sel->view.cols;   j < ncol;   j++, col++) {
+            view_value_push(L, col, row + col->offset);
+
+            if (named)
+                lua_setfield(L, -2, names->strings[j]);
+            else
+                lua_rawseti(L, -2, j + 1);
+        }
+
+        lua_rawseti(L, -2, i + 1);
+    }
+
+    lua_setfield(L, -2, name);
+}
+
+static const char *select_view_layout(mrp_lua_mdb_select_t *sel)
+{
+    mrp_lua_strarray_t *names = sel->columns;
+    view_column_t *col;
+    int *order;
+    char decl[4096], name[64], *p, *e;
+    const char *type, *n;
+    int ncol, size, pos, npad, i, j, k;
+
+    /*
+     * Notes:
+     *   The returned declaration describes a single row of the current
+     *   result so that with LuaJIT the rows can be accessed directly, eg.
+     *
+     *       local rows = ffi.cast(ffi.typeof(sel.layout .. '*'), sel.data)
+     *
+     *   without going through any metamethods. String columns are plain
+     *   C string pointers. The row buffer is replaced on every update of
+     *   the selection, so sel.data must be re-read after an update.
+     */
+
+    if (sel->view.layout || !sel->view.cols || !sel->view.rowsize)
+        return sel->view.layout;
+
+    ncol  = sel->view.ncol;
+    order = alloca(ncol * sizeof(order[0]));
+
+    for (i = 0;   i < ncol;   i++) {
+        for (j = i;  j > 0;  j--) {
+            if (sel->view.cols[order[j-1]].offset <= sel->view.cols[i].offset)
+                break;
+            order[j] = order[j-1];
+        }
+        order[j] = i;
+    }
+
+    p = decl;
+    e = decl + sizeof(decl);
+    p += snprintf(p, e - p, "struct {");
+
+    for (i = 0, pos = 0, npad = 0;   i < ncol && p < e;   i++) {
+        col = sel->view.cols + order[i];
+
+        switch (col->type) {
+        case mqi_string:   type = "const char *"; size = sizeof(char *); break;
+        case mqi_integer:  type = "int32_t ";     size = sizeof(int32_t); break;
+        case mqi_unsignd:  type = "uint32_t ";    size = sizeof(uint32_t);break;
+        case mqi_floating: type = "double ";      size = sizeof(double); break;
+        default:                                                 continue;
+        }
+
+        if (col->offset < pos)
+            continue;
+
+        if (col->offset > pos)
+            p += snprintf(p, e - p, " uint8_t _pad%d[%d];", npad++,
+                          col->offset - pos);
+
+        if (names && (int)names->nstring == ncol) {
+            for (n = names->strings[order[i]], k = 0;
+                 *n && k < (int)sizeof(name) - 1;  n++, k++) {
+                if (isalnum((unsigned char)*n) || *n == '_')
+                    name[k] = *n;
+                else
+                    name[k] = '_';
+            }
+            name[k] = '\0';
+        }
+        else
+            snprintf(name, sizeof(name), "column%d", order[i]);
+
+        if (p < e)
+            p += snprintf(p, e - p, " %s%s%s;", type,
+                          isdigit((unsigned char)name[0]) ? "_" : "", name);
+
+        pos = col->offset + size;
+    }
+
+    if (p < e && sel->view.rowsize > pos)
+        p += snprintf(p, e - p, " uint8_t _pad%d[%d];", npad,
+                      sel->view.rowsize - pos);
+
+    if (p < e)
+        snprintf(p, e - p, " }");
+
+    if (p >= e - 2)
+        return NULL;
+
+    sel->view.layout = mrp_strdup(decl);
+
+    return sel->view.layout;
+}
+
 static bool define_constants(lua_State *L)
 {
     static const_def_t const_defs[] = {
@@ -1383,6 +2214,8 @@ static field_t field_name_to_type(const char *name, size_t len)
     case 4:
         if (!strcmp(name, "name"))
             return NAME;
+        if (!strcmp(name, "data"))
+            return DATA;
         break;
 
     case 5:
@@ -1395,11 +2228,15 @@ static field_t field_name_to_type(const char *name, size_t len)
     case 6:
         if (!strcmp(name, "create"))
             return CREATE;
+        if (!strcmp(name, "layout"))
+            return LAYOUT;
         break;
 
     case 7:
         if (!strcmp(name, "columns"))
             return COLUMNS;
+        if (!strcmp(name, "rowsize"))
+            return ROWSIZE;
         break;
 
     case 9:
@@ -1412,6 +2249,8 @@ static field_t field_name_to_type(const char *name, size_t len)
     case 12:
         if (!strcmp(name, "single_value"))
             return SINGLEVAL;
+        if (!strcmp(name, "materialized"))
+            return MATERIALIZED;
         break;
 
     default:
@@ -1604,6 +2443,7 @@ static void adjust_lua_table_size(lua_State *L,
 static bool create_mdb_table(mrp_lua_mdb_table_t *tbl)
 {
     char **index;
+    int    prof;
 
     if (!tbl->columns || !tbl->ncolumn)
         tbl->handle = MQI_HANDLE_INVALID;
@@ -1613,8 +2453,10 @@ static bool create_mdb_table(mrp_lua_mdb_table_t *tbl)
         else
             index = (char **)tbl->index->strings;
 
+        prof = mrp_profile_begin("create table %s", tbl->name);
         tbl->handle = mqi_create_table((char *)tbl->name, MQI_TEMPORARY,
                                        index, tbl->columns);
+        mrp_profile_end(prof);
 
         if (tbl->handle == MQI_HANDLE_INVALID)
             mrp_debug("failed to create table '%s'", tbl->name);
@@ -64,6 +64,10 @@ uint32_t mrp_lua_select_get_unsigned(mrp_lua_mdb_select_t *sel,
                                      int colidx, int rowidx);
 double mrp_lua_select_get_floating(mrp_lua_mdb_select_t *sel,
                                    int colidx, int rowidx);
+void mrp_lua_select_track_changes(lua_State *L, mrp_lua_mdb_select_t *sel);
+uint32_t mrp_lua_select_get_generation(mrp_lua_mdb_select_t *sel);
+int mrp_lua_push_select_changes(lua_State *L, mrp_lua_mdb_select_t *sel,
+                                uint32_t since);
 
 int mrp_lua_dependency_add(lua_State *L, const char *name);
 
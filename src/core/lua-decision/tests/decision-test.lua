@@ -124,6 +124,27 @@ element.lua.speed2volume.inputs.bar = mdb.select {name = "rpm",
 
 element.lua.speed2volume:update()
 print("speed2volume.inputs.param="..element.lua.speed2volume.inputs.param)
+
+element.lua {
+   name        = "amb_changes",
+   incremental = true,
+   inputs      = { amb = mdb.select { name = "amb_all",
+                                      table = "amb",
+                                      columns = {"key", "value"} } },
+   outputs     = { mdb.table.speedvol },
+   update      = function(self)
+                    local c = self.changes and self.changes.amb
+
+                    if not c or c.reset then
+                       print("*** element "..self.name.." full update")
+                    else
+                       print("*** element "..self.name.." "..
+                             #c.inserted.." inserted "..
+                             #c.updated.." updated "..
+                             #c.deleted.." deleted rows")
+                    end
+                 end
+}
 -- print("speed2volume.inputs.foo[0].value="..element.lua.speed2volume.inputs.foo[0].value)
 
 volume.limit {
@@ -62,6 +62,15 @@ static int funcarray_destructor(lua_State *);
 
 static int make_lua_call(lua_State *, mrp_funcbridge_t *, int);
 
+/*
+ * precompiled argument descriptor of a C function bridge
+ */
+struct mrp_funcbridge_op_s {
+    char   type;                         /* argument type */
+    char   elem;                         /* array element type, if any */
+    size_t size;                         /* array element size, if any */
+};
+
 
 void mrp_create_funcbridge_class(lua_State *L)
 {
@@ -264,6 +273,72 @@ int parse_signature(const char *signature, char **sigp, mrp_lua_type_t **typep)
 }
 
 
+static int compile_signature(mrp_funcbridge_t *fb)
+{
+    const char          *sig   = fb->c.signature;
+    mrp_lua_type_t      *types = fb->c.sigtypes;
+    mrp_funcbridge_op_t *op;
+    int                  nop, i;
+
+    /*
+     * Notes:
+     *   We turn the parsed signature into a per-argument descriptor once,
+     *   so that calls from Lua do not need to rescan the signature or
+     *   look up array element types. The argument frame used to pass the
+     *   collected arguments to the C function is allocated together with
+     *   the descriptor. An invalid type is intentionally compiled as is,
+     *   to be rejected at call time just like before.
+     */
+
+    nop = sig ? strlen(sig) : 0;
+
+    fb->c.frame = mrp_allocz(sizeof(*fb->c.frame) * (nop + 1) +
+                             sizeof(*fb->c.ops) * nop);
+
+    if (fb->c.frame == NULL)
+        return -1;
+
+    fb->c.ops = (mrp_funcbridge_op_t *)(fb->c.frame + nop + 1);
+    fb->c.nop = nop;
+
+    for (i = 0, op = fb->c.ops; i < nop; i++, op++) {
+        op->type = sig[i];
+
+        if (op->type != MRP_FUNCBRIDGE_ARRAY)
+            continue;
+
+        switch (types != NULL ? *types++ : MRP_LUA_NONE) {
+        case MRP_LUA_STRING_ARRAY:
+            op->elem = MRP_FUNCBRIDGE_STRING;
+            op->size = sizeof(char *);
+            break;
+        case MRP_LUA_INTEGER_ARRAY:
+            op->elem = MRP_FUNCBRIDGE_INTEGER;
+            op->size = sizeof(int32_t);
+            break;
+        case MRP_LUA_DOUBLE_ARRAY:
+            op->elem = MRP_FUNCBRIDGE_DOUBLE;
+            op->size = sizeof(double);
+            break;
+        case MRP_LUA_BOOLEAN_ARRAY:
+            op->elem = MRP_FUNCBRIDGE_BOOLEAN;
+            op->size = sizeof(bool);
+            break;
+        case MRP_LUA_ANY:
+            op->elem = MRP_FUNCBRIDGE_ANY;
+            op->size = sizeof(double);
+            break;
+        default:
+            types    = NULL;
+            op->elem = MRP_FUNCBRIDGE_UNSUPPORTED;
+            op->size = 0;
+            break;
+        }
+    }
+
+    return 0;
+}
+
 
 mrp_funcbridge_t *mrp_funcbridge_create_cfunc(lua_State *L, const char *name,
                                               const char *signature,
@@ -291,6 +366,9 @@ mrp_funcbridge_t *mrp_funcbridge_create_cfunc(lua_State *L, const char *name,
             mrp_debug("signature '%s' parsed into '%s'", signature,
                       fb->c.signature);
 
+        if (compile_signature(fb) < 0)
+            mrp_log_error("Failed to compile signature '%s'.", signature);
+
         fb->c.func = func;
         fb->c.data = data;
 
@@ -360,6 +438,10 @@ void mrp_funcbridge_unref(lua_State *L, mrp_funcbridge_t *fb)
     else {
         free((void *)fb->c.signature);
         fb->c.signature = NULL;
+        mrp_free(fb->c.frame);
+        fb->c.frame = NULL;
+        fb->c.ops   = NULL;
+        fb->c.nop   = 0;
 
         if (fb->luatbl) {
             luaL_unref(L, LUA_REGISTRYINDEX, fb->luatbl);
@@ -390,7 +472,9 @@ bool mrp_funcbridge_call_from_c(lua_State *L,
         switch (fb->type) {
 
         case MRP_C_FUNCTION:
-            if (!strcmp(signature, fb->c.signature))
+            if (signature == fb->c.signature ||
+                (signature && fb->c.signature &&
+                 !strcmp(signature, fb->c.signature)))
                 success = fb->c.func(L, fb->c.data, signature, args, ret_type,
                                      ret_value);
             else {
@@ -972,19 +1056,17 @@ static void autobridge_restore(lua_State *L, void *object, int npop, int *refs)
 
 static int make_lua_call(lua_State *L, mrp_funcbridge_t *fb, int f)
 {
-#define ARG_MAX   256
 #define ARRAY_MAX 256
 
     int ret;
-    int i, n, m, b, e, tidx;
-    const char *s;
+    int i, n, m, b, e;
     char t;
-    mrp_funcbridge_value_t args[ARG_MAX];
-    mrp_funcbridge_value_t *a, r;
+    mrp_funcbridge_value_t *args, *a, r;
+    mrp_funcbridge_op_t    *op;
     mrp_lua_type_t          type;
     int                     elem;
-    size_t                  tlen;
     int                     status;
+    void                   *data;
     int                     refs[3] = { LUA_NOREF, LUA_NOREF, LUA_NOREF };
 
     e = lua_gettop(L);
@@ -997,16 +1079,30 @@ static int make_lua_call(lua_State *L, mrp_funcbridge_t *fb, int f)
     switch (fb->type) {
 
     case MRP_C_FUNCTION:
-        m = strlen(fb->c.signature);
+        if (fb->c.frame == NULL)
+            return luaL_error(L, "missing call descriptor for C function");
+
+        m = fb->c.nop;
 
-        if (n >= ARG_MAX - 1 || n > m)
+        if (n > m)
             return luaL_error(L, "too many arguments (%d > %d)", n, m);
         if (n < m)
             return luaL_error(L, "too few arguments (%d < %d)", n, m);
 
-        tidx = 0;
-        for (i = b, s = fb->c.signature, a= args;    i <= e;    i++, s++, a++){
-            switch (*s) {
+        /*
+         * Use the preallocated frame unless it is already in use by an
+         * outer invocation of the same bridge (ie. we got called back
+         * recursively from the C function). If the C function raises a
+         * Lua error we never get to release the frame, in which case we
+         * will keep on falling back to a frame on the stack.
+         */
+        if (!fb->busy)
+            args = fb->c.frame;
+        else
+            args = alloca(sizeof(*args) * (m + 1));
+
+        for (i = b, op = fb->c.ops, a = args;    i <= e;    i++, op++, a++){
+            switch (op->type) {
             case MRP_FUNCBRIDGE_STRING:
                 a->string = luaL_checklstring(L, i, NULL);
                 break;
@@ -1023,38 +1119,13 @@ static int make_lua_call(lua_State *L, mrp_funcbridge_t *fb, int f)
                 a->boolean = lua_toboolean(L, i);
                 break;
             case MRP_FUNCBRIDGE_ARRAY:
-                if (fb->c.sigtypes == NULL ||
-                    (type = fb->c.sigtypes[tidx++]) == MRP_LUA_NONE) {
+                if ((elem = op->elem) == MRP_FUNCBRIDGE_UNSUPPORTED) {
                 invalid_array_type:
                     return luaL_error(L, "type info missing for array or "
                                       "array argument %d", (i - b + 1));
                 }
 
-                switch (type) {
-                case MRP_LUA_STRING_ARRAY:
-                    tlen = sizeof(char  *);
-                    elem = MRP_FUNCBRIDGE_STRING;
-                    break;
-                case MRP_LUA_INTEGER_ARRAY:
-                    tlen = sizeof(int32_t);
-                    elem = MRP_FUNCBRIDGE_INTEGER;
-                    break;
-                case MRP_LUA_DOUBLE_ARRAY:
-                    tlen = sizeof(double );
-                    elem = MRP_FUNCBRIDGE_DOUBLE;
-                    break;
-                case MRP_LUA_BOOLEAN_ARRAY:
-                    tlen = sizeof(bool   );
-                    elem = MRP_FUNCBRIDGE_BOOLEAN;
-                    break;
-                case MRP_LUA_ANY:
-                    tlen = sizeof(double);
-                    elem = MRP_FUNCBRIDGE_ANY;
-                    break;
-                default: goto invalid_array_type;
-                }
-
-                a->array.items = alloca(tlen * ARRAY_MAX);
+                a->array.items = alloca(op->size * ARRAY_MAX);
                 a->array.nitem = ARRAY_MAX;
 
                 if (mrp_lua_object_collect_array(L, i, &a->array.items,
@@ -1073,27 +1144,38 @@ static int make_lua_call(lua_State *L, mrp_funcbridge_t *fb, int f)
 
             default:
                 return luaL_error(L, "argument %d has unsupported type '%c'",
-                                  (i - b) + 1, i);
+                                  (i - b) + 1, op->type);
             }
         }
         memset(a, 0, sizeof(*a));
 
+        /* class-wide autobridges get the object they are invoked for */
+        data = fb->c.data;
+        if (fb->autobridge && data == NULL)
+            data = mrp_lua_check_object(L, NULL, f + 1);
+
         if (fb->autobridge && fb->usestack) {
             mrp_debug("patching stack for autobridge %p", fb->c.func);
 
-            if (autobridge_patch(L, fb->c.data, 1, refs) < 0) {
-                autobridge_restore(L, fb->c.data, 1, refs);
+            if (autobridge_patch(L, data, 1, refs) < 0) {
+                autobridge_restore(L, data, 1, refs);
                 return luaL_error(L, "incorrect stack to call autobridge %p",
                                   fb->c.func);
             }
         }
 
-        status = fb->c.func(L, fb->c.data, fb->c.signature, args, &t, &r);
+        if (args == fb->c.frame)
+            fb->busy = true;
+
+        status = fb->c.func(L, data, fb->c.signature, args, &t, &r);
+
+        if (args == fb->c.frame)
+            fb->busy = false;
 
         if (fb->autobridge && fb->usestack) {
             mrp_debug("restoring stack after autobridge call");
 
-            autobridge_restore(L, fb->c.data, 1, refs);
+            autobridge_restore(L, data, 1, refs);
         }
 
         if (!status)
@@ -1135,7 +1217,6 @@ static int make_lua_call(lua_State *L, mrp_funcbridge_t *fb, int f)
 
     return ret;
 
-#undef ARG_MAX
 #undef ARRAY_MAX
 }
 
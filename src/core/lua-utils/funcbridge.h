@@ -37,6 +37,7 @@ typedef union  mrp_funcbridge_value_u  mrp_funcbridge_value_t;
 typedef enum   mrp_funcbridge_type_e   mrp_funcbridge_type_t;
 typedef struct mrp_funcbridge_s        mrp_funcbridge_t;
 typedef struct mrp_funcarray_s         mrp_funcarray_t;
+typedef struct mrp_funcbridge_op_s     mrp_funcbridge_op_t;
 
 typedef bool (*mrp_funcbridge_cfunc_t)(lua_State *, void *,
                                        const char *, mrp_funcbridge_value_t *,
@@ -83,12 +84,16 @@ struct mrp_funcbridge_s {
         mrp_lua_type_t *sigtypes;
         mrp_funcbridge_cfunc_t func;
         void *data;
+        mrp_funcbridge_op_t *ops;        /* precompiled call descriptor */
+        int nop;                         /* number of arguments */
+        mrp_funcbridge_value_t *frame;   /* preallocated argument frame */
     }                       c;
     int                     luatbl;
     int                     refcnt;
     int                     dead : 1;
     int                     autobridge : 1;  /* autobridged member */
     int                     usestack : 1;    /* also uses the Lua stack */
+    int                     busy : 1;        /* argument frame in use */
 };
 
 struct mrp_funcarray_s {
@@ -27,12 +27,18 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #include <murphy/common/debug.h>
+#include <murphy/common/log.h>
 #include <murphy/common/mm.h>
 #include <murphy/common/list.h>
 #include <murphy/common/file-utils.h>
@@ -92,6 +98,347 @@ static int save_included(mrp_list_hook_t *files, const char *path, dev_t dev,
 }
 
 
+/*
+ * bytecode cache
+ *
+ * Compiled chunks are cached in files named after a hash of the absolute
+ * source path. Each cache file starts with a header identifying the source
+ * (path, device, inode, size and modification time) and the Lua version
+ * that produced it. A cached chunk is only used if all of these match the
+ * source file, otherwise the source is recompiled and the cache updated.
+ */
+
+#define CACHE_MAGIC   0x4d4c4243         /* 'MLBC' */
+#define CACHE_SUFFIX  ".luac"
+
+typedef struct {
+    uint32_t magic;                      /* CACHE_MAGIC */
+    uint32_t version;                    /* LUA_VERSION_NUM */
+    uint64_t dev;                        /* source device id */
+    uint64_t ino;                        /* source file id */
+    uint64_t size;                       /* source size */
+    int64_t  mtime;                      /* source modification time */
+    int64_t  mtime_ns;                   /* ... nanoseconds */
+    uint32_t pathlen;                    /* source path length */
+    uint32_t codelen;                    /* length of compiled chunk */
+} cache_hdr_t;
+
+typedef struct {
+    char   *buf;                         /* dump buffer */
+    size_t  size;                        /* buffer size */
+    size_t  used;                        /* amount of buffer used */
+} dump_buf_t;
+
+static char *cache_dir;                  /* bytecode cache directory */
+
+
+int mrp_lua_set_bytecode_cache(const char *dir)
+{
+    char *d;
+
+    if (dir != NULL) {
+        if (mrp_mkdir(dir, 0700) < 0) {
+            mrp_log_warning("Lua bytecode cache '%s' unavailable (%d: %s).",
+                            dir, errno, strerror(errno));
+            return -1;
+        }
+
+        if ((d = mrp_strdup(dir)) == NULL)
+            return -1;
+    }
+    else
+        d = NULL;
+
+    mrp_free(cache_dir);
+    cache_dir = d;
+
+    return 0;
+}
+
+
+static void init_header(cache_hdr_t *hdr, const char *path, struct stat *st)
+{
+    mrp_clear(hdr);
+
+    hdr->magic    = CACHE_MAGIC;
+    hdr->version  = LUA_VERSION_NUM;
+    hdr->dev      = st->st_dev;
+    hdr->ino      = st->st_ino;
+    hdr->size     = st->st_size;
+    hdr->mtime    = st->st_mtim.tv_sec;
+    hdr->mtime_ns = st->st_mtim.tv_nsec;
+    hdr->pathlen  = strlen(path);
+}
+
+
+static char *cache_file(const char *path, char *buf, size_t size)
+{
+    const char *p;
+    uint32_t    h;
+    int         n;
+
+    for (h = 2166136261U, p = path; *p; p++) {      /* FNV-1a */
+        h ^= (unsigned char)*p;
+        h *= 16777619U;
+    }
+
+    n = snprintf(buf, size, "%s/%08x"CACHE_SUFFIX, cache_dir, h);
+
+    if (n < 0 || n >= (int)size)
+        return NULL;
+
+    return buf;
+}
+
+
+static int load_cached(lua_State *L, const char *path, struct stat *st,
+                       const char *cpath)
+{
+    cache_hdr_t  hdr, chk;
+    struct stat  cst;
+    char        *buf, chunk[PATH_MAX + 1];
+    size_t       size;
+    ssize_t      n;
+    int          fd, status;
+
+    if ((fd = open(cpath, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+
+    buf    = NULL;
+    status = -1;
+
+    if (fstat(fd, &cst) < 0 || cst.st_size < (off_t)sizeof(hdr))
+        goto out;
+
+    size = cst.st_size;
+
+    if ((buf = mrp_alloc(size)) == NULL)
+        goto out;
+
+    if ((n = read(fd, buf, size)) < 0 || (size_t)n != size)
+        goto out;
+
+    init_header(&chk, path, st);
+    memcpy(&hdr, buf, sizeof(hdr));
+
+    if (hdr.magic != chk.magic || hdr.version != chk.version ||
+        hdr.dev != chk.dev || hdr.ino != chk.ino || hdr.size != chk.size ||
+        hdr.mtime != chk.mtime || hdr.mtime_ns != chk.mtime_ns ||
+        hdr.pathlen != chk.pathlen ||
+        sizeof(hdr) + hdr.pathlen + hdr.codelen != size ||
+        memcmp(buf + sizeof(hdr), path, hdr.pathlen)) {
+        mrp_debug("stale bytecode cache '%s' for '%s'", cpath, path);
+        goto out;
+    }
+
+    snprintf(chunk, sizeof(chunk), "@%s", path);
+
+    if (luaL_loadbuffer(L, buf + sizeof(hdr) + hdr.pathlen, hdr.codelen,
+                        chunk) != 0) {
+        mrp_debug("failed to load bytecode cache '%s' for '%s'", cpath, path);
+        lua_pop(L, 1);
+        goto out;
+    }
+
+    mrp_debug("loaded '%s' from bytecode cache '%s'", path, cpath);
+    status = 0;
+
+ out:
+    mrp_free(buf);
+    close(fd);
+
+    return status;
+}
+
+
+static int dump_writer(lua_State *L, const void *p, size_t size, void *data)
+{
+    dump_buf_t *d = data;
+    size_t      nsize;
+
+    MRP_UNUSED(L);
+
+    if (d->used + size > d->size) {
+        for (nsize = d->size ? d->size : 4096; nsize < d->used + size; )
+            nsize *= 2;
+
+        if (!mrp_realloc(d->buf, nsize))
+            return -1;
+
+        d->size = nsize;
+    }
+
+    memcpy(d->buf + d->used, p, size);
+    d->used += size;
+
+    return 0;
+}
+
+
+static void store_cached(lua_State *L, const char *path, struct stat *st,
+                         const char *cpath)
+{
+    cache_hdr_t hdr;
+    dump_buf_t  d;
+    char        tmp[PATH_MAX];
+    int         fd, n, ok;
+
+    mrp_clear(&d);
+
+#if LUA_VERSION_NUM >= 503
+    if (lua_dump(L, dump_writer, &d, 0) != 0)
+#else
+    if (lua_dump(L, dump_writer, &d) != 0)
+#endif
+        goto out;
+
+    init_header(&hdr, path, st);
+    hdr.codelen = d.used;
+
+    n = snprintf(tmp, sizeof(tmp), "%s.XXXXXX", cpath);
+
+    if (n < 0 || n >= (int)sizeof(tmp) || (fd = mkstemp(tmp)) < 0)
+        goto out;
+
+    /* write to a temporary file then rename, so readers never see partials */
+    ok = (write(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr) &&
+          write(fd, path, hdr.pathlen) == (ssize_t)hdr.pathlen &&
+          write(fd, d.buf, d.used) == (ssize_t)d.used);
+
+    if (close(fd) < 0)
+        ok = FALSE;
+
+    if (!ok || rename(tmp, cpath) < 0) {
+        mrp_log_warning("Failed to update Lua bytecode cache '%s' (%d: %s).",
+                        cpath, errno, strerror(errno));
+        unlink(tmp);
+    }
+    else
+        mrp_debug("stored '%s' in bytecode cache '%s'", path, cpath);
+
+ out:
+    mrp_free(d.buf);
+}
+
+
+int mrp_lua_load_file(lua_State *L, const char *file)
+{
+    struct stat  st;
+    char         path[PATH_MAX], cpath[PATH_MAX];
+    int          status;
+
+    if (cache_dir == NULL || stat(file, &st) < 0 ||
+        realpath(file, path) == NULL ||
+        cache_file(path, cpath, sizeof(cpath)) == NULL)
+        return luaL_loadfile(L, file);
+
+    if (load_cached(L, path, &st, cpath) == 0)
+        return 0;
+
+    status = luaL_loadfile(L, file);
+
+    if (status == 0)
+        store_cached(L, path, &st, cpath);
+
+    return status;
+}
+
+
+typedef struct {
+    lua_State  *L;                       /* Lua state to compile with */
+    const char *dir;                     /* directory being scanned */
+    int         nfail;                   /* number of failed files */
+} precompile_t;
+
+
+static int precompile_file(lua_State *L, const char *path)
+{
+    int status;
+
+    if ((status = mrp_lua_load_file(L, path)) != 0)
+        mrp_log_error("Failed to precompile '%s' (%s).", path,
+                      lua_tostring(L, -1));
+    else
+        mrp_log_info("Precompiled '%s'.", path);
+
+    lua_settop(L, 0);
+
+    return status == 0 ? 0 : -1;
+}
+
+
+static int precompile_cb(const char *entry, mrp_dirent_type_t type,
+                         void *user_data)
+{
+    precompile_t *pc = user_data;
+    precompile_t  sub;
+    char          path[PATH_MAX];
+    size_t        len;
+
+    if (entry[0] == '.')
+        return TRUE;
+
+    snprintf(path, sizeof(path), "%s/%s", pc->dir, entry);
+
+    if (type == MRP_DIRENT_DIR) {
+        sub     = *pc;
+        sub.dir = path;
+        mrp_scan_dir(path, NULL, MRP_DIRENT_DIR | MRP_DIRENT_REG,
+                     precompile_cb, &sub);
+        pc->nfail = sub.nfail;
+    }
+    else {
+        len = strlen(entry);
+
+        if (len > 4 && !strcmp(entry + len - 4, ".lua"))
+            if (precompile_file(pc->L, path) < 0)
+                pc->nfail++;
+    }
+
+    return TRUE;
+}
+
+
+int mrp_lua_precompile(const char *path)
+{
+    precompile_t pc;
+    struct stat  st;
+
+    if (cache_dir == NULL) {
+        mrp_log_error("No Lua bytecode cache to precompile into.");
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (stat(path, &st) < 0) {
+        mrp_log_error("Can't precompile '%s' (%d: %s).", path,
+                      errno, strerror(errno));
+        return -1;
+    }
+
+    if ((pc.L = luaL_newstate()) == NULL)
+        return -1;
+
+    pc.dir   = path;
+    pc.nfail = 0;
+
+    if (S_ISDIR(st.st_mode))
+        mrp_scan_dir(path, NULL, MRP_DIRENT_DIR | MRP_DIRENT_REG,
+                     precompile_cb, &pc);
+    else
+        pc.nfail = precompile_file(pc.L, path) < 0 ? 1 : 0;
+
+    lua_close(pc.L);
+
+    if (pc.nfail > 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+
 int mrp_lua_include_file(lua_State *L, const char *file, const char **dirs,
                          mrp_list_hook_t *files)
 {
@@ -111,7 +458,7 @@ int mrp_lua_include_file(lua_State *L, const char *file, const char **dirs,
 
     mrp_debug("file '%s' resolved to '%s' for inclusion", file, path);
 
-    if (!luaL_loadfile(L, path) && !lua_pcall(L, 0, 0, 0)) {
+    if (!mrp_lua_load_file(L, path) && !lua_pcall(L, 0, 0, 0)) {
         if (files != NULL)
             save_included(files, path, st.st_dev, st.st_ino);
 
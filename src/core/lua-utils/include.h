@@ -39,6 +39,15 @@
 
 #include <murphy/common/list.h>
 
+/** Cache compiled chunks in the given directory, NULL disables caching. */
+int mrp_lua_set_bytecode_cache(const char *dir);
+
+/** Load (compile but don't run) the given Lua file, using the cache. */
+int mrp_lua_load_file(lua_State *L, const char *file);
+
+/** Compile a Lua file, or all Lua files under a directory, to the cache. */
+int mrp_lua_precompile(const char *path);
+
 /** Include (read and evaluate) the given Lua file. */
 int mrp_lua_include_file(lua_State *L, const char *file, const char **dirs,
                          mrp_list_hook_t *files);
@@ -43,6 +43,8 @@
 #include <murphy/common/env.h>
 #include <murphy/common/mm.h>
 #include <murphy/common/refcnt.h>
+#include <murphy/common/hashtbl.h>
+#include <murphy/common/utils.h>
 
 #include <murphy/core/lua-bindings/murphy.h>
 #include <murphy/core/lua-utils/object.h>
@@ -74,14 +76,16 @@ typedef struct {
 static bool valid_id(const char *);
 static int  userdata_destructor(lua_State *);
 
-static void object_create_reftbl(userdata_t *u, lua_State *L);
+static bool object_create_reftbl(userdata_t *u, lua_State *L);
 static void object_delete_reftbl(userdata_t *u, lua_State *L);
-static void object_create_exttbl(userdata_t *u, lua_State *L);
+static bool object_create_exttbl(userdata_t *u, lua_State *L);
 static void object_delete_exttbl(userdata_t *u, lua_State *L);
 static int  override_setfield(lua_State *L);
 static int  override_getfield(lua_State *L);
 static int override_tostring(lua_State *L);
-static int  object_setup_bridges(userdata_t *u, lua_State *L);
+static int  class_setup_bridges(mrp_lua_classdef_t *def, lua_State *L);
+static void class_setup_lookup(mrp_lua_classdef_t *def, lua_State *L);
+static int  index_class(mrp_lua_classdef_t *def);
 
 static void invalid_destructor(void *data);
 static inline int is_native(userdata_t *u, const char *name);
@@ -125,6 +129,19 @@ static struct {
 static mrp_lua_classdef_t **classdefs;
 static int                  nclassdef;
 
+/**
+ * hashed indexes to look up classdefs by their various names and ids
+ */
+enum {
+    INDEX_TYPE_NAME = 0,                 /* by type name */
+    INDEX_CLASS_NAME,                    /* by class name */
+    INDEX_CLASS_ID,                      /* by class id */
+    INDEX_USERDATA_ID,                   /* by userdata id */
+    INDEX_MAX
+};
+
+static mrp_htbl_t *classidx[INDEX_MAX];
+
 /**
  * Macros to convert between userdata and user-visible data addresses.
  */
@@ -249,6 +266,7 @@ int mrp_lua_create_object_class(lua_State *L, mrp_lua_classdef_t *def)
 
     /* make a metatatable for userdata, ie for 'c' part of object instances*/
     luaL_newmetatable(L, def->userdata_id);
+    def->udata_meta = lua_topointer(L, -1);
     lua_pushliteral(L, "__index");
     lua_pushvalue(L, -2);
     lua_settable(L, -3);        /* metatable.__index = metatable */
@@ -284,6 +302,8 @@ int mrp_lua_create_object_class(lua_State *L, mrp_lua_classdef_t *def)
         }
     }
 
+    class_setup_lookup(def, L);
+
     mrp_list_init(&def->objects);
 
     /* make the class table */
@@ -295,6 +315,9 @@ int mrp_lua_create_object_class(lua_State *L, mrp_lua_classdef_t *def)
     if (mrp_reallocz(classdefs, nclassdef, nclassdef + 1) != NULL) {
         def->type_id = MRP_LUA_OBJECT + nclassdef;
         classdefs[nclassdef++] = def;
+
+        if (!index_class(def))
+            mrp_log_error("Failed to index class %s.", def->class_name);
     }
     else {
         mrp_log_error("Failed to store class %s in lookup table.",
@@ -403,79 +426,76 @@ static mrp_lua_classdef_t *class_by_type(int type_id)
 }
 
 
-static mrp_lua_classdef_t *class_by_type_name(const char *type_name)
+static int index_class(mrp_lua_classdef_t *def)
 {
-    mrp_lua_classdef_t *def;
-    int                 i;
+    mrp_htbl_config_t  hcfg;
+    const char        *keys[INDEX_MAX];
+    int                i;
 
-    for (i = 0; i < nclassdef; i++) {
-        def = classdefs[i];
+    keys[INDEX_TYPE_NAME]   = def->type_name;
+    keys[INDEX_CLASS_NAME]  = def->class_name;
+    keys[INDEX_CLASS_ID]    = def->class_id;
+    keys[INDEX_USERDATA_ID] = def->userdata_id;
+
+    for (i = 0; i < INDEX_MAX; i++) {
+        if (classidx[i] == NULL) {
+            mrp_clear(&hcfg);
+            hcfg.nentry = 32;
+            hcfg.comp   = mrp_string_comp;
+            hcfg.hash   = mrp_string_hash;
+            hcfg.free   = NULL;
 
-        if (def->type_name[0] != type_name[0])
+            if ((classidx[i] = mrp_htbl_create(&hcfg)) == NULL)
+                return FALSE;
+        }
+
+        /* keep the first class registered with a given name */
+        if (mrp_htbl_lookup(classidx[i], (void *)keys[i]) != NULL)
             continue;
 
-        if (!strcmp(def->type_name + 1, type_name + 1))
-            return def;
+        if (!mrp_htbl_insert(classidx[i], (void *)keys[i], def))
+            return FALSE;
     }
 
-    return invalid_class;
+    return TRUE;
 }
 
 
-static mrp_lua_classdef_t *class_by_class_name(const char *class_name)
+static mrp_lua_classdef_t *class_by_index(int idx, const char *key)
 {
     mrp_lua_classdef_t *def;
-    int                 i;
 
-    for (i = 0; i < nclassdef; i++) {
-        def = classdefs[i];
-
-        if (def->class_name[0] != class_name[0])
-            continue;
+    if (classidx[idx] == NULL)
+        return invalid_class;
 
-        if (!strcmp(def->class_name + 1, class_name + 1))
-            return def;
-    }
+    if ((def = mrp_htbl_lookup(classidx[idx], (void *)key)) == NULL)
+        return invalid_class;
 
-    return invalid_class;
+    return def;
 }
 
 
-static mrp_lua_classdef_t *class_by_class_id(const char *class_id)
+static mrp_lua_classdef_t *class_by_type_name(const char *type_name)
 {
-    mrp_lua_classdef_t *def;
-    int                 i;
+    return class_by_index(INDEX_TYPE_NAME, type_name);
+}
 
-    for (i = 0; i < nclassdef; i++) {
-        def = classdefs[i];
 
-        if (def->class_id[0] != class_id[0])
-            continue;
+static mrp_lua_classdef_t *class_by_class_name(const char *class_name)
+{
+    return class_by_index(INDEX_CLASS_NAME, class_name);
+}
 
-        if (!strcmp(def->class_id + 1, class_id + 1))
-            return def;
-    }
 
-    return invalid_class;
+static mrp_lua_classdef_t *class_by_class_id(const char *class_id)
+{
+    return class_by_index(INDEX_CLASS_ID, class_id);
 }
 
 
 static mrp_lua_classdef_t *class_by_userdata_id(const char *userdata_id)
 {
-    mrp_lua_classdef_t *def;
-    int                 i;
-
-    for (i = 0; i < nclassdef; i++) {
-        def = classdefs[i];
-
-        if (def->userdata_id[0] != userdata_id[0])
-            continue;
-
-        if (!strcmp(def->userdata_id + 1, userdata_id + 1))
-            return def;
-    }
-
-    return invalid_class;
+    return class_by_index(INDEX_USERDATA_ID, userdata_id);
 }
 
 /** Get the type_id for the given class name. */
@@ -720,11 +740,14 @@ void *mrp_lua_create_object(lua_State *L, mrp_lua_classdef_t *def,
     if (class)
         lua_remove(L, class);
 
-    object_create_reftbl(userdata, L);
-    if (def->flags & MRP_LUA_CLASS_EXTENSIBLE)
-        object_create_exttbl(userdata, L);
+    /*
+     * Notes:
+     *     The private reference and extension tables are only created
+     *     once something is first stored in them. Most objects created
+     *     from C never need either of them.
+     */
 
-    if (object_setup_bridges(userdata, L) < 0) {
+    if (!def->brready && class_setup_bridges(def, L) < 0) {
         luaL_error(L, "Failed to set up bridged methods.");
         return NULL;                     /* not reached */
     }
@@ -873,7 +896,22 @@ void *mrp_lua_check_object(lua_State *L, mrp_lua_classdef_t *def, int idx)
             userdata = *userdatap;
     }
     else {
-        userdatap = (userdata_t **)luaL_checkudata(L, -1, def->userdata_id);
+        /*
+         * Notes:
+         *     Rather than looking up the userdata metatable from the
+         *     registry by name, as luaL_checkudata does, we compare the
+         *     metatable against the one cached in the classdef.
+         */
+
+        userdatap = (userdata_t **)lua_touserdata(L, -1);
+
+        if (userdatap != NULL && lua_getmetatable(L, -1)) {
+            if (lua_topointer(L, -1) != def->udata_meta)
+                userdatap = NULL;
+            lua_pop(L, 1);
+        }
+        else
+            userdatap = NULL;
 
         if (!userdatap || def != (userdata = *userdatap)->def) {
             snprintf(errmsg, sizeof(errmsg), "'%s' expected", def->class_name);
@@ -999,9 +1037,8 @@ void *mrp_lua_to_object(lua_State *L, mrp_lua_classdef_t *def, int idx)
 
     userdata = *userdatap;
 
-    lua_getfield(L, LUA_REGISTRYINDEX, def->userdata_id);
-
-    if (!lua_rawequal(L, -1, -2) || userdata != userdata_getself(userdata))
+    if (lua_topointer(L, -1) != def->udata_meta ||
+        userdata != userdata_getself(userdata))
         userdata = NULL;
 
     lua_settop(L, top);
@@ -1568,87 +1605,102 @@ int mrp_lua_declare_members(mrp_lua_classdef_t *def, mrp_lua_class_flag_t flags,
 }
 
 
-static int object_setup_bridges(userdata_t *u, lua_State *L)
+/*
+ * Bridged methods are shared by all instances of a class. They are
+ * created without any bound data, so the function bridge passes the
+ * object the method is invoked for (self) to the bridged C function.
+ */
+static int class_setup_bridges(mrp_lua_classdef_t *def, lua_State *L)
 {
-    mrp_lua_classdef_t     *def = u->def;
     mrp_lua_class_bridge_t *b;
+    mrp_funcbridge_t       *fb;
     int                     i, class_usestack;
 
     class_usestack = (def->flags & MRP_LUA_CLASS_USESTACK) ? true : false;
     for (i = 0, b = def->bridges; i < def->nbridge; i++, b++) {
-        b->fb = mrp_funcbridge_create_cfunc(L, b->name, b->signature, b->fc,
-                                            USER_TO_DATA(u));
+        fb = mrp_funcbridge_create_cfunc(L, b->name, b->signature, b->fc,
+                                         NULL);
 
-        if (b->fb == NULL)
+        if (fb == NULL)
             return -1;
 
-        b->fb->autobridge = true;
-        b->fb->usestack   = (b->flags & MRP_LUA_CLASS_USESTACK) ? true : false;
-        b->fb->usestack  |= class_usestack;
+        fb->autobridge = true;
+        fb->usestack   = (b->flags & MRP_LUA_CLASS_USESTACK) ? true : false;
+        fb->usestack  |= class_usestack;
+
+        b->fb = fb;
     }
 
+    def->brready = true;
+
     return 0;
 }
 
 
-static int class_member(userdata_t *u, lua_State *L, int index)
+static void class_setup_lookup(mrp_lua_classdef_t *def, lua_State *L)
 {
-    mrp_lua_class_member_t *members = u->def->members;
-    int                     nmember = u->def->nmember;
-    mrp_lua_class_member_t *m;
-    int                     i;
-    const char              *name;
-
-    if (lua_type(L, index) != LUA_TSTRING)
-        return -1;
-
-    name = lua_tostring(L, index);
+    int i;
 
     /*
-     * XXX TODO, check how to speed this up. For instance if Lua
-     * strings or references to string happened to be always
-     * represented by the same value as long as they are interned
-     * (ie. not collected) we could simply check for numeric
-     * equality of the stack item or a reference to thereof to one
-     * store in the object classdef...
-     *
-     * Alternatively if all else fails, at least pass in the length
-     * here and store it alongside all native names, to speed up
-     * negtive tests.
+     * Notes:
+     *     Lua strings are interned, so looking up a member name from a
+     *     table keyed by the names is a hash lookup followed by a pointer
+     *     comparison, unlike a strcmp over all the declared names.
      */
 
-    for (i = 0, m = members; i < nmember; i++, m++)
-        if (!strcmp(m->name, name))
-            return i;
+    lua_createtable(L, 0, def->nmember);
+    for (i = 0; i < def->nmember; i++) {
+        lua_pushstring(L, def->members[i].name);
+        lua_pushinteger(L, i);
+        lua_rawset(L, -3);
+    }
+    def->mbrmap = luaL_ref(L, LUA_REGISTRYINDEX);
 
-    return -1;
+    lua_createtable(L, 0, def->nbridge);
+    for (i = 0; i < def->nbridge; i++) {
+        lua_pushstring(L, def->bridges[i].name);
+        lua_pushinteger(L, i);
+        lua_rawset(L, -3);
+    }
+    def->brmap = luaL_ref(L, LUA_REGISTRYINDEX);
 }
 
 
-static int class_bridge(userdata_t *u, lua_State *L, int index)
+static int class_lookup(lua_State *L, int map, int index)
 {
-    mrp_lua_class_bridge_t *bridges, *b;
-    int                     nbridge;
-    const char             *name;
-    int                     bidx;
+    int idx;
 
-    if ((bridges = u->def->bridges) == NULL || (nbridge = u->def->nbridge) == 0)
+    if (lua_type(L, index) != LUA_TSTRING)
         return -1;
 
-    if (lua_type(L, index) != LUA_TSTRING)
+    lua_pushvalue(L, index);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, map);
+    lua_insert(L, -2);
+    lua_rawget(L, -2);
+
+    idx = lua_isnumber(L, -1) ? lua_tointeger(L, -1) : -1;
+
+    lua_pop(L, 2);
+
+    return idx;
+}
+
+
+static int class_member(userdata_t *u, lua_State *L, int index)
+{
+    if (u->def->nmember == 0)
         return -1;
 
-    name = lua_tostring(L, index);
+    return class_lookup(L, u->def->mbrmap, index);
+}
 
-    /*
-     * XXX TODO, ditto as for class_member()
-     */
 
-    for (bidx = 0, b = bridges; bidx < nbridge; bidx++, b++)
-        if (!strcmp(b->name, name))
-            return bidx;
+static int class_bridge(userdata_t *u, lua_State *L, int index)
+{
+    if (u->def->nbridge == 0)
+        return -1;
 
-    return -1;
+    return class_lookup(L, u->def->brmap, index);
 }
 
 
@@ -1670,15 +1722,22 @@ static int seterr(lua_State *L, char *e, size_t size, const char *format, ...)
 }
 
 
-static void object_create_reftbl(userdata_t *u, lua_State *L)
+static bool object_create_reftbl(userdata_t *u, lua_State *L)
 {
-    lua_newtable(L);
-    u->refs.priv = luaL_ref(L, LUA_REGISTRYINDEX);
+    if (u->refs.priv == LUA_NOREF && !u->dead) {
+        lua_newtable(L);
+        u->refs.priv = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+
+    return u->refs.priv != LUA_NOREF;
 }
 
 
 static void object_delete_reftbl(userdata_t *u, lua_State *L)
 {
+    if (u->refs.priv == LUA_NOREF)
+        return;
+
     luaL_unref(L, LUA_REGISTRYINDEX, u->refs.priv);
     u->refs.priv = LUA_NOREF;
 }
@@ -1690,7 +1749,7 @@ int mrp_lua_object_ref_value(void *data, lua_State *L, int idx)
     userdata_t *u = userdata_get(data, CHECK);
     int ref;
 
-    if (u->refs.priv != LUA_NOREF) {
+    if (object_create_reftbl(u, L)) {
         lua_rawgeti(L, LUA_REGISTRYINDEX, u->refs.priv);
         lua_pushvalue(L, idx > 0 ? idx : idx - 1);
         ref = luaL_ref(L, -2);
@@ -1757,7 +1816,7 @@ int mrp_lua_object_getref(void *owner, void *data, lua_State *L, int ref)
     if (ref == LUA_NOREF || ref == LUA_REFNIL)
         return ref;
 
-    if (uo->refs.priv == LUA_NOREF || ud->refs.priv == LUA_NOREF)
+    if (uo->refs.priv == LUA_NOREF || !object_create_reftbl(ud, L))
         return LUA_NOREF;
 
     lua_rawgeti(L, LUA_REGISTRYINDEX, uo->refs.priv);
@@ -1772,10 +1831,17 @@ int mrp_lua_object_getref(void *owner, void *data, lua_State *L, int ref)
 }
 
 
-static void object_create_exttbl(userdata_t *u, lua_State *L)
+static bool object_create_exttbl(userdata_t *u, lua_State *L)
 {
-    lua_newtable(L);
-    u->refs.ext = luaL_ref(L, LUA_REGISTRYINDEX);
+    if (!(u->def->flags & MRP_LUA_CLASS_EXTENSIBLE) || u->dead)
+        return false;
+
+    if (u->refs.ext == LUA_NOREF) {
+        lua_newtable(L);
+        u->refs.ext = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+
+    return true;
 }
 
 
@@ -1822,7 +1888,7 @@ static int object_setext(void *data, lua_State *L, const char *name,
 {
     userdata_t *u = DATA_TO_USER(data);
 
-    if (u->refs.ext == LUA_NOREF) {
+    if (!object_create_exttbl(u, L)) {
         if (err)
             return seterr(L, err, esize, "trying to set user-defined field %s "
                           "for non-extensible object %s", name,
@@ -1863,7 +1929,7 @@ static int object_setiext(void *data, lua_State *L, int idx, int val)
 {
     userdata_t *u = DATA_TO_USER(data);
 
-    if (u->refs.ext == LUA_NOREF) {
+    if (!object_create_exttbl(u, L)) {
         return luaL_error(L, "trying to set user-defined index %d "
                           "for non-extensible object %s", idx,
                           u->def->class_name);
@@ -2509,7 +2575,7 @@ static inline int is_native(userdata_t *u, const char *name)
     int i;
 
     /*
-     * XXX TODO, ditto as for class_member() and class_bridge()
+     * XXX TODO, could use a lookup table like class_member() does
      */
 
     for (i = 0; i < u->def->nnative; i++)
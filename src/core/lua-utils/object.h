@@ -670,6 +670,7 @@ struct mrp_lua_classdef_s {
     const char   *type_name;
     int           type_id;
     const void   *type_meta;
+    const void   *udata_meta;
     const char   *userdata_id;
     size_t        userdata_size;
     luaL_reg     *methods;
@@ -690,6 +691,9 @@ struct mrp_lua_classdef_s {
     mrp_lua_class_bridge_t  *bridges;    /* bridged methods */
     int                      nbridge;    /* number of bridged methods */
     int                      brmeta;     /* reference to bridging metatable */
+    int                      mbrmap;     /* member name to index table ref */
+    int                      brmap;      /* bridge name to index table ref */
+    int                      brready;    /* whether bridges are set up */
     mrp_lua_class_flag_t     flags;      /* class member flags */
     mrp_lua_class_notify_t   notify;     /* member change notify callback */
     lua_CFunction            setfield;   /* overridden setfield, if any */
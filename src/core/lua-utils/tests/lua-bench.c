@@ -0,0 +1,553 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <lualib.h>
+#include <lauxlib.h>
+
+#include <murphy/common.h>
+
+#include <murphy/core/lua-utils/funcbridge.h>
+#include <murphy/core/lua-utils/object.h>
+#include <murphy/core/lua-decision/mdb.h>
+#include <murphy-db/mqi.h>
+
+/*
+ * Lua binding micro-benchmarks
+ *
+ * Measure the cost of the different kinds of C <-> Lua crossings our
+ * bindings do, per call, together with the number of allocations and
+ * bytes the Lua allocator sees per call. The Lua-driven cases run a
+ * tight Lua loop around the crossing and have the cost of an empty loop
+ * subtracted. The plain C function call case is a baseline for the
+ * rest: whatever a case costs above it is spent in our bindings.
+ */
+
+#define PLAIN_CLASS  MRP_LUA_CLASS(bench_plain, lua)
+#define MEMBER_CLASS MRP_LUA_CLASS(bench_member, lua)
+
+typedef struct {
+    int32_t value;
+} bench_obj_t;
+
+typedef struct {
+    size_t bytes;                        /* bytes allocated */
+    size_t count;                        /* number of allocations */
+} alloc_stat_t;
+
+typedef struct {
+    int            niter;                /* iterations per case */
+    const char    *only;                 /* run only the given case */
+    int            log_mask;
+    const char    *log_target;
+
+    lua_State     *L;
+    alloc_stat_t   alloc;                /* Lua allocator statistics */
+    int            args;                 /* stack index of first loop arg */
+    mrp_funcbridge_t *luafb;             /* Lua function bridge for C->Lua */
+} bench_t;
+
+typedef struct {
+    const char *name;                    /* case name */
+    const char *stmt;                    /* Lua loop body, or NULL */
+    int       (*run)(bench_t *b, int n); /* C loop, if stmt is NULL */
+} bench_case_t;
+
+
+static int  bench_obj_create(lua_State *L);
+static int  plain_getfield(lua_State *L);
+static int  plain_setfield(lua_State *L);
+static void bench_obj_destroy(void *data);
+
+MRP_LUA_METHOD_LIST_TABLE(bench_obj_methods,
+                          MRP_LUA_METHOD_CONSTRUCTOR(bench_obj_create));
+
+MRP_LUA_METHOD_LIST_TABLE(plain_overrides,
+                          MRP_LUA_OVERRIDE_CALL    (bench_obj_create)
+                          MRP_LUA_OVERRIDE_GETFIELD(plain_getfield)
+                          MRP_LUA_OVERRIDE_SETFIELD(plain_setfield));
+
+MRP_LUA_METHOD_LIST_TABLE(member_overrides,
+                          MRP_LUA_OVERRIDE_CALL    (bench_obj_create));
+
+MRP_LUA_MEMBER_LIST_TABLE(member_members,
+    MRP_LUA_CLASS_INTEGER("value", MRP_OFFSET(bench_obj_t, value), NULL, NULL,
+                          MRP_LUA_CLASS_NOFLAGS));
+
+MRP_LUA_CLASS_DEF(bench_plain, lua, bench_obj_t, bench_obj_destroy,
+                  bench_obj_methods, plain_overrides);
+
+MRP_LUA_DEFINE_CLASS(bench_member, lua, bench_obj_t, bench_obj_destroy,
+                     bench_obj_methods, member_overrides, member_members,
+                     NULL, NULL, NULL, NULL, MRP_LUA_CLASS_NOFLAGS);
+
+
+static int bench_obj_create(lua_State *L)
+{
+    return luaL_error(L, "benchmark objects can only be created from C");
+}
+
+
+static void bench_obj_destroy(void *data)
+{
+    MRP_UNUSED(data);
+}
+
+
+static int plain_getfield(lua_State *L)
+{
+    bench_obj_t *o = (bench_obj_t *)mrp_lua_check_object(L, PLAIN_CLASS, 1);
+    const char  *name = luaL_checkstring(L, 2);
+
+    if (!strcmp(name, "value"))
+        lua_pushinteger(L, o->value);
+    else
+        lua_pushnil(L);
+
+    return 1;
+}
+
+
+static int plain_setfield(lua_State *L)
+{
+    bench_obj_t *o = (bench_obj_t *)mrp_lua_check_object(L, PLAIN_CLASS, 1);
+    const char  *name = luaL_checkstring(L, 2);
+
+    if (strcmp(name, "value"))
+        return luaL_error(L, "unknown member '%s'", name);
+
+    o->value = luaL_checkinteger(L, 3);
+
+    return 0;
+}
+
+
+static int nop_cfunc(lua_State *L)
+{
+    MRP_UNUSED(L);
+
+    return 0;
+}
+
+
+static int check_cfunc(lua_State *L)
+{
+    mrp_lua_check_object(L, MEMBER_CLASS, 1);
+
+    return 0;
+}
+
+
+static bool add_bridged(lua_State *L, void *data, const char *signature,
+                        mrp_funcbridge_value_t *args, char *ret_type,
+                        mrp_funcbridge_value_t *ret_val)
+{
+    MRP_UNUSED(L);
+    MRP_UNUSED(data);
+    MRP_UNUSED(signature);
+
+    *ret_type = MRP_FUNCBRIDGE_INTEGER;
+    ret_val->integer = args[0].integer + args[1].integer;
+
+    return true;
+}
+
+
+static void *count_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    alloc_stat_t *st = (alloc_stat_t *)ud;
+
+    if (nsize == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    if (ptr == NULL) {                   /* osize is a type tag in 5.2+ */
+        st->bytes += nsize;
+        st->count++;
+    }
+    else if (nsize > osize) {
+        st->bytes += nsize - osize;
+        st->count++;
+    }
+
+    return realloc(ptr, nsize);
+}
+
+
+static uint64_t now_nsecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*
+ * C-driven cases
+ */
+
+static int run_bridge_c2lua(bench_t *b, int n)
+{
+    mrp_funcbridge_value_t args[2], ret;
+    char                   type;
+    int                    i;
+
+    for (i = 0; i < n; i++) {
+        args[0].integer = i;
+        args[1].integer = 1;
+
+        if (!mrp_funcbridge_call_from_c(b->L, b->luafb, "dd", args, &type,
+                                        &ret)) {
+            mrp_log_error("funcbridge call failed (%s)",
+                          type == MRP_FUNCBRIDGE_STRING ? ret.string : "?");
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static bench_case_t cases[] = {
+    { "empty loop"       , ""                              , NULL },
+    { "lua->c call"      , "nop(m)"                        , NULL },
+    { "check_object"     , "chk(m)"                        , NULL },
+    { "override getfield", "local x = p.value"             , NULL },
+    { "override setfield", "p.value = i"                   , NULL },
+    { "member getfield"  , "local x = m.value"             , NULL },
+    { "member setfield"  , "m.value = i"                   , NULL },
+    { "bridge lua->c"    , "local x = f(i, 1)"             , NULL },
+    { "bridge c->lua"    , NULL            , run_bridge_c2lua },
+    { "mdb table row set", "t[1] = { key = 'a', value = i }", NULL },
+    { "mdb select row get", "local x = s[1].value"         , NULL },
+    { NULL, NULL, NULL }
+};
+
+#define NLOOPARG 7                       /* nop, chk, p, m, f, t, s */
+
+
+/*
+ * setup
+ */
+
+static int setup(bench_t *b)
+{
+    static const char *mdb_setup =
+        "mdb.table { name = 'bench_rows', index = { 'key' },\n"
+        "            columns = { { 'key', mdb.string, 16 },\n"
+        "                        { 'value', mdb.integer } } }\n"
+        "mdb.table.bench_rows[1] = { key = 'a', value = 0 }\n"
+        "mdb.select { name = 'bench_sel', table = 'bench_rows',\n"
+        "             columns = { 'value' }, condition = \"key = 'a'\" }\n"
+        "return mdb.table.bench_rows, mdb.select.bench_sel\n";
+    lua_State *L;
+
+    if ((L = b->L = lua_newstate(count_alloc, &b->alloc)) == NULL) {
+        mrp_log_error("failed to create Lua state");
+        return FALSE;
+    }
+
+    luaL_openlibs(L);
+    mrp_create_funcbridge_class(L);
+    mrp_lua_create_object_class(L, PLAIN_CLASS);
+    mrp_lua_create_object_class(L, MEMBER_CLASS);
+    mrp_lua_create_mdb_class(L);
+    mrp_funcbridge_create_cfunc(L, "bench_add", "dd", add_bridged, NULL);
+
+    /* function bridge for the C->Lua case */
+    if (luaL_loadstring(L, "return function(a, b) return a + b end") ||
+        lua_pcall(L, 0, 1, 0)) {
+        mrp_log_error("failed to set up Lua function (%s)",
+                      lua_tostring(L, -1));
+        return FALSE;
+    }
+
+    b->luafb = mrp_funcbridge_create_luafunc(L, -1);
+    lua_pop(L, 1);
+
+    if (b->luafb == NULL) {
+        mrp_log_error("failed to create Lua function bridge");
+        return FALSE;
+    }
+
+    /* arguments passed to every Lua loop: nop, chk, p, m, f, t, s */
+    b->args = lua_gettop(L) + 1;
+
+    lua_pushcfunction(L, nop_cfunc);
+    lua_pushcfunction(L, check_cfunc);
+
+    if (mrp_lua_create_object(L, PLAIN_CLASS, NULL, 0) == NULL ||
+        mrp_lua_create_object(L, MEMBER_CLASS, NULL, 0) == NULL) {
+        mrp_log_error("failed to create benchmark objects");
+        return FALSE;
+    }
+
+    lua_getglobal(L, "builtin");
+    lua_getfield(L, -1, "method");
+    lua_getfield(L, -1, "bench_add");
+    lua_replace(L, -3);
+    lua_pop(L, 1);
+
+    if (luaL_loadstring(L, mdb_setup) || lua_pcall(L, 0, 2, 0)) {
+        mrp_log_error("failed to set up mdb table and select (%s)",
+                      lua_tostring(L, -1));
+        lua_pop(L, 1);
+        lua_pushnil(L);
+        lua_pushnil(L);
+    }
+
+    return TRUE;
+}
+
+
+/*
+ * running the cases
+ */
+
+static int run_lua_case(bench_t *b, bench_case_t *c, int n)
+{
+    lua_State *L = b->L;
+    char       src[512];
+    int        i;
+
+    snprintf(src, sizeof(src),
+             "local n, nop, chk, p, m, f, t, s = ...\n"
+             "for i = 1, n do %s end\n", c->stmt);
+
+    if (luaL_loadstring(L, src) != 0) {
+        mrp_log_error("failed to compile case '%s' (%s)", c->name,
+                      lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return FALSE;
+    }
+
+    lua_pushinteger(L, n);
+    for (i = 0; i < NLOOPARG; i++)
+        lua_pushvalue(L, b->args + i);
+
+    if (lua_pcall(L, 1 + NLOOPARG, 0, 0) != 0) {
+        mrp_log_error("case '%s' failed (%s)", c->name, lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static int run_case(bench_t *b, bench_case_t *c, uint64_t *nsecs,
+                    alloc_stat_t *alloc)
+{
+    uint64_t     start;
+    alloc_stat_t before;
+    int          ok;
+
+    /* warm up, then start from a clean heap */
+    if (!(c->stmt ? run_lua_case(b, c, 16) : c->run(b, 16)))
+        return FALSE;
+
+    lua_gc(b->L, LUA_GCCOLLECT, 0);
+
+    before = b->alloc;
+    start  = now_nsecs();
+    ok     = c->stmt ? run_lua_case(b, c, b->niter) : c->run(b, b->niter);
+    *nsecs = now_nsecs() - start;
+
+    alloc->bytes = b->alloc.bytes - before.bytes;
+    alloc->count = b->alloc.count - before.count;
+
+    return ok;
+}
+
+
+static void run_benchmarks(bench_t *b)
+{
+    bench_case_t *c;
+    alloc_stat_t  alloc;
+    uint64_t      nsecs, empty;
+    double        ns;
+
+    printf("%-20s %12s %12s %12s\n", "case", "ns/call", "allocs/call",
+           "bytes/call");
+
+    empty = 0;
+
+    for (c = cases; c->name != NULL; c++) {
+        /* always run the empty loop, it is the baseline for the others */
+        if (b->only != NULL && strcmp(b->only, c->name) && c != cases)
+            continue;
+
+        if (!run_case(b, c, &nsecs, &alloc)) {
+            printf("%-20s %12s\n", c->name, "failed");
+            continue;
+        }
+
+        ns = (double)nsecs / b->niter;
+
+        if (c == cases)
+            empty = nsecs;
+        else if (c->stmt != NULL)
+            ns -= (double)empty / b->niter;
+
+        printf("%-20s %12.1f %12.3f %12.1f\n", c->name, ns,
+               (double)alloc.count / b->niter,
+               (double)alloc.bytes / b->niter);
+        fflush(stdout);
+    }
+}
+
+
+static void print_usage(const char *argv0, int exit_code, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (fmt && *fmt) {
+        va_start(ap, fmt);
+        vprintf(fmt, ap);
+        va_end(ap);
+    }
+
+    printf("usage: %s [options]\n\n"
+           "The possible options are:\n"
+           "  -n, --iterations=N             number of calls per case\n"
+           "  -c, --case=NAME                run only the given case\n"
+           "  -t, --log-target=TARGET        log target to use\n"
+           "      TARGET is one of stderr,stdout,syslog, or a logfile path\n"
+           "  -l, --log-level=LEVELS         logging level to use\n"
+           "      LEVELS is a comma separated list of info, error and warning\n"
+           "  -v, --verbose                  increase logging verbosity\n"
+           "  -d, --debug                    enable given debug confguration\n"
+           "  -h, --help                     show help on usage\n",
+           argv0);
+
+    if (exit_code < 0)
+        return;
+    else
+        exit(exit_code);
+}
+
+
+static void parse_cmdline(bench_t *b, int argc, char **argv)
+{
+#   define OPTIONS "n:c:l:t:d:vh"
+    struct option options[] = {
+        { "iterations", required_argument, NULL, 'n' },
+        { "case"      , required_argument, NULL, 'c' },
+        { "log-level" , required_argument, NULL, 'l' },
+        { "log-target", required_argument, NULL, 't' },
+        { "verbose"   , optional_argument, NULL, 'v' },
+        { "debug"     , required_argument, NULL, 'd' },
+        { "help"      , no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    char *end;
+    int   opt;
+
+    mrp_clear(b);
+    b->niter      = 1000000;
+    b->log_mask   = MRP_LOG_MASK_ERROR;
+    b->log_target = MRP_LOG_TO_STDERR;
+
+    while ((opt = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+        switch (opt) {
+        case 'n':
+            b->niter = (int)strtol(optarg, &end, 10);
+            if ((end && *end) || b->niter <= 0)
+                print_usage(argv[0], EINVAL,
+                            "invalid number of iterations '%s'.\n", optarg);
+            break;
+
+        case 'c':
+            b->only = optarg;
+            break;
+
+        case 'v':
+            b->log_mask <<= 1;
+            b->log_mask  |= 1;
+            break;
+
+        case 'l':
+            b->log_mask = mrp_log_parse_levels(optarg);
+            if (b->log_mask < 0)
+                print_usage(argv[0], EINVAL, "invalid log level '%s'", optarg);
+            break;
+
+        case 't':
+            b->log_target = mrp_log_parse_target(optarg);
+            if (!b->log_target)
+                print_usage(argv[0], EINVAL, "invalid log target '%s'", optarg);
+            break;
+
+        case 'd':
+            mrp_debug_set_config(optarg);
+            mrp_debug_enable(TRUE);
+            break;
+
+        case 'h':
+            print_usage(argv[0], -1, "");
+            exit(0);
+            break;
+
+        default:
+            print_usage(argv[0], EINVAL, "invalid option '%c'", opt);
+        }
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    bench_t b;
+
+    parse_cmdline(&b, argc, argv);
+
+    mrp_log_set_mask(b.log_mask);
+    mrp_log_set_target(b.log_target);
+
+    if (mqi_open() != 0 || !setup(&b))
+        exit(1);
+
+    run_benchmarks(&b);
+
+    lua_close(b.L);
+
+    return 0;
+}
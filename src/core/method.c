@@ -48,6 +48,7 @@ typedef struct {
 
 typedef struct {
     __MRP_METHOD_FIELDS();               /* method fields */
+    int             sig;                 /* interned signature */
     mrp_list_hook_t hook;                /* to method table */
 } method_t;
 
@@ -55,7 +56,10 @@ typedef struct {
 static void purge_method_list(void *key, void *object);
 
 
-static mrp_htbl_t *methods = NULL;       /* hash table of method lists */
+static mrp_htbl_t  *methods    = NULL;   /* hash table of method lists */
+static mrp_htbl_t  *signatures = NULL;   /* interned signature ids */
+static char       **sigtbl     = NULL;   /* interned signatures by id */
+static int          nsig       = 0;      /* number of interned signatures */
 
 
 static int create_method_table(void)
@@ -78,8 +82,70 @@ static int create_method_table(void)
 
 MRP_EXIT static void destroy_method_table(void)
 {
+    int i;
+
     mrp_htbl_destroy(methods, TRUE);
     methods = NULL;
+
+    mrp_htbl_destroy(signatures, FALSE);
+    signatures = NULL;
+
+    for (i = 0; i < nsig; i++)
+        mrp_free(sigtbl[i]);
+    mrp_free(sigtbl);
+    sigtbl = NULL;
+    nsig   = 0;
+}
+
+
+static int intern_signature(const char *signature, int create)
+{
+    mrp_htbl_config_t  hcfg;
+    char              *sig;
+    void              *id;
+
+    /*
+     * Interned signatures are identified by small integers, 0 being no
+     * signature. Signatures are compared by id whenever methods are looked
+     * up, so exporting and importing needs no string comparisons unless
+     * the ids differ. Interned signatures are kept around until exit.
+     */
+
+    if (signature == NULL)
+        return 0;
+
+    if (signatures != NULL) {
+        if ((id = mrp_htbl_lookup(signatures, (void *)signature)) != NULL)
+            return (int)(ptrdiff_t)id;
+    }
+
+    if (!create)
+        return -1;
+
+    if (signatures == NULL) {
+        mrp_clear(&hcfg);
+        hcfg.comp = mrp_string_comp;
+        hcfg.hash = mrp_string_hash;
+        hcfg.free = NULL;
+
+        if ((signatures = mrp_htbl_create(&hcfg)) == NULL)
+            return -1;
+    }
+
+    if (mrp_reallocz(sigtbl, nsig, nsig + 1) == NULL)
+        return -1;
+
+    if ((sig = mrp_strdup(signature)) == NULL)
+        return -1;
+
+    if (!mrp_htbl_insert(signatures, sig, (void *)(ptrdiff_t)(nsig + 1))) {
+        mrp_free(sig);
+        return -1;
+    }
+
+    sigtbl[nsig++] = sig;
+
+    return nsig;
 }
 
 
@@ -103,8 +169,9 @@ static method_t *alloc_method(mrp_method_descr_t *method)
         mrp_list_init(&m->hook);
         m->name      = mrp_strdup(method->name);
         m->signature = mrp_strdup(method->signature);
+        m->sig       = intern_signature(method->signature, TRUE);
 
-        if (m->name != NULL &&
+        if (m->name != NULL && m->sig >= 0 &&
             (m->signature != NULL || method->signature == NULL)) {
             m->native_ptr = method->native_ptr;
             m->script_ptr = method->script_ptr;
@@ -215,16 +282,16 @@ static method_t *lookup_method(const char *name, const char *signature,
     method_list_t   *l;
     method_t        *m;
     mrp_list_hook_t *p, *n;
+    int              sig;
 
-    l = lookup_method_list(name);
+    l   = lookup_method_list(name);
+    sig = intern_signature(signature, FALSE);
 
-    if (l != NULL) {
+    if (l != NULL && sig >= 0) {
         mrp_list_foreach(&l->methods, p, n) {
             m = mrp_list_entry(p, typeof(*m), hook);
 
-            if (((m->signature == NULL && signature == NULL) ||
-                 (m->signature != NULL && signature != NULL &&
-                  !strcmp(m->signature, signature))) &&
+            if (m->sig == sig &&
                 m->native_ptr == native_ptr && m->script_ptr == script_ptr &&
                 m->plugin == plugin)
                 return m;
@@ -241,7 +308,7 @@ method_t *find_method(const char *name, const char *signature)
     method_t        *m;
     mrp_list_hook_t *p, *n;
     const char      *base;
-    int              plen;
+    int              plen, sig;
 
     base = strrchr(name, '.');
     if (base != NULL) {
@@ -253,13 +320,14 @@ method_t *find_method(const char *name, const char *signature)
         plen = 0;
     }
 
-    l = lookup_method_list(base);
+    l   = lookup_method_list(base);
+    sig = intern_signature(signature, FALSE);
 
     if (l != NULL) {
         mrp_list_foreach(&l->methods, p, n) {
             m = mrp_list_entry(p, typeof(*m), hook);
 
-            if (signature != NULL && m->signature != NULL)
+            if (signature != NULL && m->signature != NULL && m->sig != sig)
                 if (!check_signatures(signature, m->signature))
                     continue;
 
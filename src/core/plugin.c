@@ -36,11 +36,14 @@
 
 #include <murphy/common/list.h>
 #include <murphy/common/file-utils.h>
+#include <murphy/common/profile.h>
 #include <murphy/core/plugin.h>
 
 #define PLUGIN_PREFIX "plugin-"
 #define BUILTIN TRUE
 #define DYNAMIC FALSE
+#define DEPS_SEPARATORS ", \t[]\""
+#define MAX_DEPTH 16
 
 #define __PARANOID_BLACKLIST_CHECK__
 
@@ -57,6 +60,8 @@ static int export_plugin_methods(mrp_plugin_t *plugin);
 static int remove_plugin_methods(mrp_plugin_t *plugin);
 static int import_plugin_methods(mrp_plugin_t *plugin);
 static int release_plugin_methods(mrp_plugin_t *plugin);
+static int schedule_plugin(mrp_plugin_t *plugin);
+static void wake_plugins(mrp_context_t *ctx);
 
 
 /*
@@ -69,6 +74,27 @@ static int release_plugin_methods(mrp_plugin_t *plugin);
 static MRP_LIST_HOOK(builtin_plugins);
 
 
+/*
+ * plugin startup
+ *
+ * Plugins are started in dependency order. A plugin with pending
+ * dependencies is put on hold (WAITING) and gets started once all of
+ * them are running. A plugin can also defer signalling its readiness
+ * (STARTING), in which case the daemon proceeds to its mainloop while
+ * the plugin finishes its startup and plugins depending on it wait.
+ */
+
+typedef enum {
+    DEPS_READY = 0,                      /* all dependencies running */
+    DEPS_PENDING,                        /* some dependencies starting */
+    DEPS_FAILED,                         /* some dependency failed */
+} deps_state_t;
+
+static int starting;                     /* in mrp_start_plugins */
+static int booting;                      /* startup still pending */
+static int startup_failed;               /* critical plugin failed */
+
+
 /*
  * plugin-related events
  */
@@ -350,6 +376,7 @@ mrp_plugin_t *mrp_load_plugin(mrp_context_t *ctx, const char *name,
     void                *handle;
     mrp_console_group_t *cmds;
     char                 grpbuf[PATH_MAX], *cmdgrp;
+    int                  prof;
 
     if (name == NULL)
         return NULL;
@@ -372,7 +399,9 @@ mrp_plugin_t *mrp_load_plugin(mrp_context_t *ctx, const char *name,
     snprintf(path, sizeof(path), "%s/%s%s.so", ctx->plugin_dir,
              PLUGIN_PREFIX, name);
 
+    prof    = mrp_profile_begin("dlopen plugin %s", name);
     dynamic = open_dynamic(ctx, name, &handle);
+    mrp_profile_end(prof);
     builtin = open_builtin(ctx, name);
 
     if (dynamic != NULL) {
@@ -461,7 +490,8 @@ mrp_plugin_t *mrp_load_plugin(mrp_context_t *ctx, const char *name,
         emit_plugin_event(PLUGIN_EVENT_LOADED, plugin);
 
         if (ctx->state == MRP_STATE_STARTING || ctx->state == MRP_STATE_RUNNING)
-            mrp_start_plugin(plugin);
+            if (!plugin->lazy)
+                schedule_plugin(plugin);
 
         return plugin;
     }
@@ -528,7 +558,7 @@ int mrp_request_plugin(mrp_context_t *ctx, const char *name,
 
     if ((plugin = find_plugin_instance(ctx, instance)) != NULL) {
         if (instance == name || !strcmp(plugin->descriptor->name, name))
-            return TRUE;
+            return mrp_plugin_use(plugin);
     }
 
     return (mrp_load_plugin(ctx, name, instance, NULL, 0) != NULL);
@@ -590,8 +620,10 @@ int mrp_unload_plugin(mrp_plugin_t *plugin)
 
             emit_plugin_event(PLUGIN_EVENT_UNLOADED, plugin);
 
-            if (plugin->handle != NULL)
+            if (plugin->handle != NULL) {
+                mrp_debug_forget_module(plugin->handle);
                 dlclose(plugin->handle);
+            }
 
             if (plugin->cmds != NULL) {
                 mrp_console_del_group(plugin->ctx, plugin->cmds);
@@ -600,9 +632,14 @@ int mrp_unload_plugin(mrp_plugin_t *plugin)
                 mrp_free(plugin->cmds);
             }
 
-            release_plugin_methods(plugin);
+            if (plugin->imported)
+                release_plugin_methods(plugin);
             remove_plugin_methods(plugin);
 
+            for (i = 0; i < plugin->ndep; i++)
+                mrp_free(plugin->deps[i]);
+            mrp_free(plugin->deps);
+
             mrp_free(plugin->instance);
             mrp_free(plugin->path);
             mrp_free(plugin);
@@ -617,7 +654,121 @@ int mrp_unload_plugin(mrp_plugin_t *plugin)
 }
 
 
-int mrp_start_plugins(mrp_context_t *ctx)
+static void fail_plugin(mrp_plugin_t *plugin)
+{
+    mrp_context_t *ctx = plugin->ctx;
+
+    plugin->state = MRP_PLUGIN_FAILED;
+    emit_plugin_event(PLUGIN_EVENT_FAILED, plugin);
+
+    if (!plugin->may_fail) {
+        if (starting)
+            startup_failed = TRUE;
+        else if (booting) {
+            mrp_log_error("Critical plugin %s failed to start, exiting.",
+                          plugin->instance);
+            mrp_mainloop_quit(ctx->ml, 1);
+        }
+    }
+
+    wake_plugins(ctx);
+}
+
+
+static deps_state_t check_dependencies(mrp_plugin_t *plugin)
+{
+    mrp_plugin_t *dep;
+    deps_state_t  state;
+    int           i;
+
+    state = DEPS_READY;
+
+    for (i = 0; i < plugin->ndep; i++) {
+        dep = find_plugin_instance(plugin->ctx, plugin->deps[i]);
+
+        if (dep == NULL) {
+            mrp_log_error("Plugin %s depends on unknown plugin %s.",
+                          plugin->instance, plugin->deps[i]);
+            return DEPS_FAILED;
+        }
+
+        if (dep->state == MRP_PLUGIN_LOADED)
+            mrp_plugin_use(dep);
+
+        switch (dep->state) {
+        case MRP_PLUGIN_RUNNING:
+            break;
+        case MRP_PLUGIN_LOADED:
+        case MRP_PLUGIN_WAITING:
+        case MRP_PLUGIN_STARTING:
+            state = DEPS_PENDING;
+            break;
+        default:
+            mrp_log_error("Plugin %s depends on failed plugin %s.",
+                          plugin->instance, dep->instance);
+            return DEPS_FAILED;
+        }
+    }
+
+    return state;
+}
+
+
+static int schedule_plugin(mrp_plugin_t *plugin)
+{
+    if (plugin->state != MRP_PLUGIN_LOADED &&
+        plugin->state != MRP_PLUGIN_WAITING)
+        return plugin->state != MRP_PLUGIN_FAILED;
+
+    if (!plugin->imported) {
+        if (!import_plugin_methods(plugin)) {
+            fail_plugin(plugin);
+            return FALSE;
+        }
+        plugin->imported = TRUE;
+    }
+
+    /* mark us first, so that dependency cycles don't recurse forever */
+    plugin->state = MRP_PLUGIN_WAITING;
+
+    switch (check_dependencies(plugin)) {
+    case DEPS_READY:
+        return mrp_start_plugin(plugin);
+
+    case DEPS_PENDING:
+        mrp_debug("plugin %s waiting for its dependencies", plugin->instance);
+        return TRUE;
+
+    default:
+        fail_plugin(plugin);
+        return FALSE;
+    }
+}
+
+
+static int waits_for_starting(mrp_plugin_t *plugin, int depth)
+{
+    mrp_plugin_t *dep;
+    int           i;
+
+    if (plugin->state == MRP_PLUGIN_STARTING)
+        return TRUE;
+
+    if (plugin->state != MRP_PLUGIN_WAITING || depth <= 0)
+        return FALSE;
+
+    for (i = 0; i < plugin->ndep; i++) {
+        dep = find_plugin_instance(plugin->ctx, plugin->deps[i]);
+
+        if (dep != NULL && waits_for_starting(dep, depth - 1))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+static void check_stalled(mrp_context_t *ctx)
 {
     mrp_list_hook_t *p, *n;
     mrp_plugin_t    *plugin;
@@ -625,61 +776,233 @@ int mrp_start_plugins(mrp_context_t *ctx)
     mrp_list_foreach(&ctx->plugins, p, n) {
         plugin = mrp_list_entry(p, typeof(*plugin), hook);
 
-        if (!import_plugin_methods(plugin)) {
-            if (!plugin->may_fail)
-                return FALSE;
-            else
-                goto unload;
+        if (plugin->state == MRP_PLUGIN_WAITING &&
+            !waits_for_starting(plugin, MAX_DEPTH)) {
+            mrp_log_error("Plugin %s is part of a dependency cycle.",
+                          plugin->instance);
+            fail_plugin(plugin);
         }
+    }
+}
 
-        if (!mrp_start_plugin(plugin)) {
-            if (!plugin->may_fail)
-                return FALSE;
-            else {
-            unload:
-                mrp_unload_plugin(plugin);
-            }
+
+static void wake_plugins(mrp_context_t *ctx)
+{
+    static int       busy, again;
+    mrp_list_hook_t *p, *n;
+    mrp_plugin_t    *plugin;
+
+    if (busy) {
+        again = TRUE;
+        return;
+    }
+
+    busy = TRUE;
+
+    do {
+        again = FALSE;
+
+        mrp_list_foreach(&ctx->plugins, p, n) {
+            plugin = mrp_list_entry(p, typeof(*plugin), hook);
+
+            if (plugin->state == MRP_PLUGIN_WAITING)
+                schedule_plugin(plugin);
         }
+    } while (again);
+
+    busy = FALSE;
+
+    if (!starting) {
+        check_stalled(ctx);
+
+        if (booting && !mrp_plugins_pending(ctx))
+            booting = FALSE;
+    }
+}
+
+
+static void plugin_started(mrp_plugin_t *plugin)
+{
+    plugin->state = MRP_PLUGIN_RUNNING;
+    emit_plugin_event(PLUGIN_EVENT_STARTED, plugin);
+
+    wake_plugins(plugin->ctx);
+}
+
+
+int mrp_start_plugins(mrp_context_t *ctx)
+{
+    mrp_list_hook_t *p, *n;
+    mrp_plugin_t    *plugin;
+
+    starting       = TRUE;
+    booting        = TRUE;
+    startup_failed = FALSE;
+
+    mrp_list_foreach(&ctx->plugins, p, n) {
+        plugin = mrp_list_entry(p, typeof(*plugin), hook);
+
+        if (plugin->state == MRP_PLUGIN_LOADED && !plugin->lazy)
+            schedule_plugin(plugin);
 
         /* XXX TODO: argh, ugly kludge for plugins loading plugins... */
         if (plugin->hook.next != n)
             n = plugin->hook.next;
     }
 
-    return TRUE;
+    starting = FALSE;
+    check_stalled(ctx);
+
+    if (!mrp_plugins_pending(ctx))
+        booting = FALSE;
+
+    return !startup_failed;
 }
 
 
 int mrp_start_plugin(mrp_plugin_t *plugin)
 {
+    int prof, success;
+
     if (plugin != NULL) {
-        if (plugin->state == MRP_PLUGIN_LOADED) {
-            if (!plugin->descriptor->init(plugin)) {
+        if (plugin->state == MRP_PLUGIN_LOADED ||
+            plugin->state == MRP_PLUGIN_WAITING) {
+            plugin->state    = MRP_PLUGIN_STARTING;
+            plugin->deferred = FALSE;
+
+            prof    = mrp_profile_begin("init plugin %s", plugin->instance);
+            success = plugin->descriptor->init(plugin);
+            mrp_profile_end(prof);
+
+            if (!success) {
                 mrp_log_error("Failed to start plugin %s (%s).",
                               plugin->instance, plugin->descriptor->name);
 
-                emit_plugin_event(PLUGIN_EVENT_FAILED, plugin);
+                fail_plugin(plugin);
                 return FALSE;
             }
-            else {
-                plugin->state = MRP_PLUGIN_RUNNING;
-                emit_plugin_event(PLUGIN_EVENT_STARTED, plugin);
-            }
+
+            if (plugin->deferred)
+                mrp_log_info("Plugin %s is starting asynchronously.",
+                             plugin->instance);
+            else
+                plugin_started(plugin);
         }
 
-        return TRUE;
+        return plugin->state != MRP_PLUGIN_FAILED;
     }
     else
         return FALSE;
 }
 
 
+int mrp_plugin_use(mrp_plugin_t *plugin)
+{
+    mrp_context_t *ctx;
+
+    if (plugin == NULL)
+        return FALSE;
+
+    ctx = plugin->ctx;
+
+    switch (plugin->state) {
+    case MRP_PLUGIN_LOADED:
+        plugin->lazy = FALSE;
+        if (ctx->state == MRP_STATE_STARTING || ctx->state == MRP_STATE_RUNNING)
+            return schedule_plugin(plugin);
+        return TRUE;
+
+    case MRP_PLUGIN_WAITING:
+    case MRP_PLUGIN_STARTING:
+    case MRP_PLUGIN_RUNNING:
+        return TRUE;
+
+    default:
+        return FALSE;
+    }
+}
+
+
+void mrp_plugin_defer_ready(mrp_plugin_t *plugin)
+{
+    if (plugin->state == MRP_PLUGIN_STARTING)
+        plugin->deferred = TRUE;
+}
+
+
+void mrp_plugin_ready(mrp_plugin_t *plugin, int success)
+{
+    if (plugin->state != MRP_PLUGIN_STARTING || !plugin->deferred)
+        return;
+
+    plugin->deferred = FALSE;
+
+    if (success) {
+        mrp_log_info("Plugin %s is ready.", plugin->instance);
+        plugin_started(plugin);
+    }
+    else {
+        mrp_log_error("Plugin %s (%s) failed to become ready.",
+                      plugin->instance, plugin->descriptor->name);
+        plugin->descriptor->exit(plugin);
+        fail_plugin(plugin);
+    }
+}
+
+
+int mrp_plugins_pending(mrp_context_t *ctx)
+{
+    mrp_list_hook_t *p, *n;
+    mrp_plugin_t    *plugin;
+    int              cnt;
+
+    cnt = 0;
+    mrp_list_foreach(&ctx->plugins, p, n) {
+        plugin = mrp_list_entry(p, typeof(*plugin), hook);
+
+        if (plugin->state == MRP_PLUGIN_WAITING ||
+            plugin->state == MRP_PLUGIN_STARTING)
+            cnt++;
+    }
+
+    return cnt;
+}
+
+
+int mrp_plugin_add_dependency(mrp_plugin_t *plugin, const char *instance)
+{
+    int i;
+
+    for (i = 0; i < plugin->ndep; i++)
+        if (!strcmp(plugin->deps[i], instance))
+            return TRUE;
+
+    if (!mrp_reallocz(plugin->deps, plugin->ndep, plugin->ndep + 1))
+        return FALSE;
+
+    if ((plugin->deps[plugin->ndep] = mrp_strdup(instance)) == NULL)
+        return FALSE;
+
+    plugin->ndep++;
+
+    return TRUE;
+}
+
+
+void mrp_plugin_set_lazy(mrp_plugin_t *plugin, int lazy)
+{
+    plugin->lazy = lazy ? TRUE : FALSE;
+}
+
+
 int mrp_stop_plugin(mrp_plugin_t *plugin)
 {
     if (plugin != NULL) {
         if (plugin->refcnt <= 1) {
             emit_plugin_event(PLUGIN_EVENT_STOPPING, plugin);
-            plugin->descriptor->exit(plugin);
+            if (plugin->state == MRP_PLUGIN_RUNNING ||
+                plugin->state == MRP_PLUGIN_STARTING)
+                plugin->descriptor->exit(plugin);
             plugin->refcnt = 0;
             plugin->state = MRP_PLUGIN_STOPPED;
             emit_plugin_event(PLUGIN_EVENT_STOPPED, plugin);
@@ -985,6 +1308,61 @@ static int parse_undeclared_arg(mrp_plugin_arg_t *arg, mrp_plugin_arg_t *pa)
 }
 
 
+static int is_startup_arg(mrp_plugin_arg_t *arg)
+{
+    return (!strcmp(arg->key, MRP_PLUGIN_ARG_DEPENDS) ||
+            !strcmp(arg->key, MRP_PLUGIN_ARG_LAZY));
+}
+
+
+static int parse_startup_arg(mrp_plugin_t *plugin, mrp_plugin_arg_t *arg)
+{
+    char  dep[256];
+    char *b, *e;
+    int   len;
+
+    if (!strcmp(arg->key, MRP_PLUGIN_ARG_LAZY)) {
+        if (arg->str == NULL || !strcasecmp(arg->str, "TRUE"))
+            mrp_plugin_set_lazy(plugin, TRUE);
+        else if (!strcasecmp(arg->str, "FALSE"))
+            mrp_plugin_set_lazy(plugin, FALSE);
+        else
+            return FALSE;
+
+        return TRUE;
+    }
+
+    if (arg->str == NULL)
+        return FALSE;
+
+    /* accept both 'a, b' and a stringified Lua array '["a","b"]' */
+    b = arg->str;
+    while (*b) {
+        while (*b && strchr(DEPS_SEPARATORS, *b))
+            b++;
+
+        for (e = b; *e && !strchr(DEPS_SEPARATORS, *e); e++)
+            ;
+
+        if ((len = e - b) == 0)
+            break;
+
+        if (len >= (int)sizeof(dep))
+            return FALSE;
+
+        strncpy(dep, b, len);
+        dep[len] = '\0';
+
+        if (!mrp_plugin_add_dependency(plugin, dep))
+            return FALSE;
+
+        b = e;
+    }
+
+    return TRUE;
+}
+
+
 static int parse_plugin_args(mrp_plugin_t *plugin,
                              mrp_plugin_arg_t *argv, int argc)
 {
@@ -992,7 +1370,19 @@ static int parse_plugin_args(mrp_plugin_t *plugin,
     mrp_plugin_arg_t   *valid, *args, *pa, *a, *rest;
     int                 i, j, cnt;
 
-    if (argv == NULL) {
+    for (i = cnt = 0, a = argv; i < argc; i++, a++) {
+        if (is_startup_arg(a)) {
+            if (!parse_startup_arg(plugin, a)) {
+                mrp_log_error("Invalid argument '%s' for plugin '%s'.",
+                              a->key, plugin->instance);
+                return FALSE;
+            }
+        }
+        else
+            cnt++;
+    }
+
+    if (argv == NULL || cnt == 0) {
         plugin->args = plugin->descriptor->args;
         return TRUE;
     }
@@ -1000,7 +1390,7 @@ static int parse_plugin_args(mrp_plugin_t *plugin,
     descr = plugin->descriptor;
     valid = descr->args;
 
-    if (valid == NULL && argv != NULL) {
+    if (valid == NULL) {
         mrp_log_error("Plugin '%s' (%s) does not take any arguments.",
                       plugin->instance, descr->name);
         return FALSE;
@@ -1029,6 +1419,9 @@ static int parse_plugin_args(mrp_plugin_t *plugin,
     rest = NULL;
     j    = 0;
     for (i = 0, a = argv; i < argc; i++, a++) {
+        if (is_startup_arg(a))
+            continue;
+
         for (cnt = 0, pa = NULL; pa == NULL && cnt < descr->narg; cnt++) {
             if (args[j].type != MRP_PLUGIN_ARG_TYPE_UNDECL) {
                 if (!strcmp(a->key, args[j].key))
@@ -277,8 +277,24 @@ typedef enum {
     MRP_PLUGIN_LOADED = 0,                     /* has been loaded */
     MRP_PLUGIN_RUNNING,                        /* has been started */
     MRP_PLUGIN_STOPPED,                        /* has been stopped */
+    MRP_PLUGIN_WAITING,                        /* waiting for dependencies */
+    MRP_PLUGIN_STARTING,                       /* waiting to become ready */
+    MRP_PLUGIN_FAILED,                         /* failed to start */
 } mrp_plugin_state_t;
 
+
+/*
+ * reserved startup arguments, accepted by every plugin
+ *
+ * depends-on: comma-separated list of plugin instances that must be
+ *             running before the plugin is started
+ * lazy:       don't start the plugin with the others, but only once it
+ *             is requested, depended on or explicitly used
+ */
+
+#define MRP_PLUGIN_ARG_DEPENDS "depends-on"
+#define MRP_PLUGIN_ARG_LAZY    "lazy"
+
 struct mrp_plugin_s {
     char                *path;                 /* plugin path */
     char                *instance;             /* plugin instance */
@@ -292,6 +308,11 @@ struct mrp_plugin_s {
     mrp_plugin_arg_t    *args;                 /* plugin arguments */
     mrp_console_group_t *cmds;                 /* default console commands */
     int                  may_fail : 1;         /* load / start may fail */
+    int                  lazy : 1;             /* start only on first use */
+    int                  deferred : 1;         /* signals readiness later */
+    int                  imported : 1;         /* methods imported */
+    char               **deps;                 /* instances depended on */
+    int                  ndep;                 /* number of dependencies */
 };
 
 
@@ -433,6 +454,19 @@ int mrp_plugin_running(mrp_context_t *ctx, const char *name);
 int mrp_stop_plugin(mrp_plugin_t *plugin);
 int mrp_request_plugin(mrp_context_t *ctx, const char *name,
                        const char *instance);
+
+/*
+ * A plugin that finishes its startup asynchronously calls
+ * mrp_plugin_defer_ready() from its init function and mrp_plugin_ready()
+ * once it is done. Plugins depending on it are started only then, while
+ * the rest of the daemon is already running.
+ */
+int mrp_plugin_add_dependency(mrp_plugin_t *plugin, const char *instance);
+void mrp_plugin_set_lazy(mrp_plugin_t *plugin, int lazy);
+int mrp_plugin_use(mrp_plugin_t *plugin);
+void mrp_plugin_defer_ready(mrp_plugin_t *plugin);
+void mrp_plugin_ready(mrp_plugin_t *plugin, int success);
+int mrp_plugins_pending(mrp_context_t *ctx);
 void mrp_block_blacklisted_plugins(mrp_context_t *ctx);
 
 mrp_plugin_arg_t *mrp_plugin_find_undecl_arg(mrp_plugin_arg_t *undecl,
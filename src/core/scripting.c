@@ -48,31 +48,34 @@ static const char *default_interpreter = "simple"; /* the default interpreter */
 
 /*
  * a context variable
+ *
+ * The variable id is a 1-based index to the table of variables and every
+ * variable carries its current value in its slot, so accessing a variable
+ * by id is a plain array lookup.
  */
 
 typedef struct {
-    const char        *name;             /* variable name */
-    mrp_script_type_t  type;             /* type if declared */
-    int                id;               /* variable id */
+    const char         *name;            /* variable name */
+    mrp_script_type_t   type;            /* type if declared */
+    int                 id;              /* variable id */
+    mrp_script_value_t  value;           /* current value */
+    int                 set;             /* whether value is set */
 } context_var_t;
 
 
 /*
- * a context frame (a set of context variable values)
+ * an undo record for a context variable assignment
+ *
+ * Assignments save the previous value of the variable to a stack of undo
+ * records. A context frame is just the depth of the undo stack at the time
+ * the frame was pushed, and popping a frame unwinds the stack to that depth.
  */
 
-typedef struct context_value_s context_value_t;
-struct context_value_s {
+typedef struct {
     int                 id;              /* variable id */
-    mrp_script_value_t  value;           /* value for this variable */
-    context_value_t    *next;            /* next value in this frame */
-};
-
-typedef struct context_frame_s context_frame_t;
-struct context_frame_s {
-    context_value_t *values;             /* hook to more value */
-    context_frame_t *prev;               /* previous frame */
-};
+    mrp_script_value_t  value;           /* previous value */
+    int                 set;             /* whether previous value was set */
+} context_undo_t;
 
 
 /*
@@ -83,7 +86,12 @@ struct mrp_context_tbl_s {
     context_var_t   *variables;          /* known/declared context variables */
     int              nvariable;          /* number of variables */
     mrp_htbl_t      *names;              /* variable name to id mapping */
-    context_frame_t *frame;              /* active frame */
+    context_undo_t  *undo;               /* stack of undo records */
+    int              nundo;              /* undo stack depth */
+    int              maxundo;            /* allocated undo records */
+    int             *frames;             /* undo stack depth of each frame */
+    int              nframe;             /* number of active frames */
+    int              maxframe;           /* allocated frames */
 };
 
 
@@ -250,7 +258,6 @@ mrp_context_tbl_t *mrp_create_context_table(void)
         hcfg.hash = mrp_string_hash;
         hcfg.free = NULL;
 
-        tbl->frame = NULL;
         tbl->names = mrp_htbl_create(&hcfg);
 
         if (tbl->names != NULL)
@@ -265,11 +272,20 @@ mrp_context_tbl_t *mrp_create_context_table(void)
 
 void mrp_destroy_context_table(mrp_context_tbl_t *tbl)
 {
+    int i;
+
     if (tbl != NULL) {
         while (mrp_pop_context_frame(tbl) == 0)
             ;
 
         mrp_htbl_destroy(tbl->names, FALSE);
+
+        for (i = 0; i < tbl->nvariable; i++)
+            mrp_free((char *)tbl->variables[i].name);
+
+        mrp_free(tbl->variables);
+        mrp_free(tbl->undo);
+        mrp_free(tbl->frames);
         mrp_free(tbl);
     }
 }
@@ -309,12 +325,7 @@ int mrp_declare_context_variable(mrp_context_tbl_t *tbl, const char *name,
         return -1;
     }
     else {
-        size_t o, n;
-
-        o = sizeof(*tbl->variables) * tbl->nvariable;
-        n = sizeof(*tbl->variables) * (tbl->nvariable + 1);
-
-        if (!mrp_reallocz(tbl->variables, o, n))
+        if (!mrp_reallocz(tbl->variables, tbl->nvariable, tbl->nvariable + 1))
             return -1;
 
         var = tbl->variables + tbl->nvariable++;
@@ -336,44 +347,46 @@ int mrp_declare_context_variable(mrp_context_tbl_t *tbl, const char *name,
 
 int mrp_push_context_frame(mrp_context_tbl_t *tbl)
 {
-    context_frame_t *f;
-
-    f = mrp_allocz(sizeof(*f));
+    int n;
 
-    if (f != NULL) {
-        f->values  = NULL;
-        f->prev    = tbl->frame;
-        tbl->frame = f;
+    if (tbl->nframe >= tbl->maxframe) {
+        n = tbl->maxframe ? 2 * tbl->maxframe : 8;
 
-        mrp_debug("pushed new context frame...");
+        if (!mrp_reallocz(tbl->frames, tbl->maxframe, n))
+            return -1;
 
-        return 0;
+        tbl->maxframe = n;
     }
-    else
-        return -1;
+
+    tbl->frames[tbl->nframe++] = tbl->nundo;
+
+    mrp_debug("pushed new context frame...");
+
+    return 0;
 }
 
 
 int mrp_pop_context_frame(mrp_context_tbl_t *tbl)
 {
-    context_frame_t *f;
-    context_value_t *v, *n;
+    context_undo_t *u;
+    context_var_t  *var;
+    int             depth;
 
-    f = tbl->frame;
+    if (tbl->nframe > 0) {
+        depth = tbl->frames[--tbl->nframe];
 
-    if (f != NULL) {
-        for (v = f->values; v != NULL; v = n) {
-            n = v->next;
+        while (tbl->nundo > depth) {
+            u   = tbl->undo + --tbl->nundo;
+            var = tbl->variables + u->id - 1;
 
-            if (v->value.type == MRP_SCRIPT_TYPE_STRING)
-                mrp_free(v->value.str);
+            if (var->set && var->value.type == MRP_SCRIPT_TYPE_STRING)
+                mrp_free(var->value.str);
 
-            mrp_debug("popped variable <%d>", v->id);
-            mrp_free(v);
-        }
+            var->value = u->value;
+            var->set   = u->set;
 
-        tbl->frame = f->prev;
-        mrp_free(f);
+            mrp_debug("popped variable <%d>", u->id);
+        }
 
         mrp_debug("popped context frame");
 
@@ -394,17 +407,14 @@ int get_context_id(mrp_context_tbl_t *tbl, const char *name)
 
 int get_context_value(mrp_context_tbl_t *tbl, int id, mrp_script_value_t *value)
 {
-    context_frame_t *f;
-    context_value_t *v;
+    context_var_t *var;
 
     if (0 < id && id <= tbl->nvariable) {
-        for (f = tbl->frame; f != NULL; f = f->prev) {
-            for (v = f->values; v != NULL; v = v->next) {
-                if (v->id == id) {
-                    *value = v->value;
-                    return 0;
-                }
-            }
+        var = tbl->variables + id - 1;
+
+        if (var->set) {
+            *value = var->value;
+            return 0;
         }
     }
 
@@ -417,10 +427,11 @@ int get_context_value(mrp_context_tbl_t *tbl, int id, mrp_script_value_t *value)
 
 int set_context_value(mrp_context_tbl_t *tbl, int id, mrp_script_value_t *value)
 {
-    context_frame_t *f;
-    context_var_t   *var;
-    context_value_t *val;
-    char             vbuf[64];
+    context_var_t      *var;
+    context_undo_t     *u;
+    mrp_script_value_t  v;
+    char                vbuf[64];
+    int                 n;
 
     if (!(0 < id && id <= tbl->nvariable)) {
         errno = ENOENT;
@@ -433,32 +444,37 @@ int set_context_value(mrp_context_tbl_t *tbl, int id, mrp_script_value_t *value)
         return -1;
     }
 
-    f = tbl->frame;
-    if (f != NULL) {
-        val = mrp_allocz(sizeof(*val));
-
-        if (val != NULL) {
-            val->id    = id;
-            val->value = *value;
+    if (tbl->nframe == 0) {
+        errno = ENOSPC;
+        return -1;
+    }
 
-            if (val->value.type != MRP_SCRIPT_TYPE_STRING ||
-                ((val->value.str = mrp_strdup(val->value.str)) != NULL)) {
-                val->next = f->values;
-                f->values = val;
+    if (tbl->nundo >= tbl->maxundo) {
+        n = tbl->maxundo ? 2 * tbl->maxundo : 16;
 
-                mrp_debug("set &%s=%s", var->name,
-                          mrp_print_value(vbuf, sizeof(vbuf), value));
+        if (!mrp_reallocz(tbl->undo, tbl->maxundo, n))
+            return -1;
 
-                return 0;
-            }
-            else
-                mrp_free(val);
-        }
+        tbl->maxundo = n;
     }
-    else
-        errno = ENOSPC;
 
-    return -1;
+    v = *value;
+
+    if (v.type == MRP_SCRIPT_TYPE_STRING && (v.str = mrp_strdup(v.str)) == NULL)
+        return -1;
+
+    u = tbl->undo + tbl->nundo++;
+    u->id    = id;
+    u->value = var->value;
+    u->set   = var->set;
+
+    var->value = v;
+    var->set   = TRUE;
+
+    mrp_debug("set &%s=%s", var->name,
+              mrp_print_value(vbuf, sizeof(vbuf), value));
+
+    return 0;
 }
 
 
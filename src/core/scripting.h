@@ -146,6 +146,23 @@ char *mrp_print_value(char *buf, size_t size, mrp_script_value_t *value);
  * a script interpreter as exposed to the resolver
  */
 
+/*
+ * interpreter flags
+ *
+ * MRP_INTERPRETER_CONCURRENT: scriptlets of the interpreter can be executed
+ *     concurrently with each other in worker threads. Such scriptlets must
+ *     neither modify the context table (no frames or variable assignments)
+ *     nor access the database, and they cannot take the Lua lock.
+ */
+#define MRP_INTERPRETER_CONCURRENT 0x1
+
+/*
+ * Successful execute status of a scriptlet which found that the result of
+ * its target did not change. Targets depending on it are then not updated
+ * unless something else of theirs has changed.
+ */
+#define MRP_SCRIPT_UNCHANGED 2
+
 struct mrp_interpreter_s {
     mrp_list_hook_t    hook;             /* to list of interpreters */
     const char        *name;             /* interpreter identifier */
@@ -155,6 +172,7 @@ struct mrp_interpreter_s {
     int  (*prepare)(mrp_scriptlet_t *script);
     int  (*execute)(mrp_scriptlet_t *script, mrp_context_tbl_t *ctbl);
     void (*cleanup)(mrp_scriptlet_t *script);
+    int                flags;            /* MRP_INTERPRETER_* flags */
 };
 
 /** Macro to automatically register an interpreter on startup. */
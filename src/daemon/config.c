@@ -29,6 +29,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdarg.h>
@@ -41,6 +42,7 @@
 #include <getopt.h>
 
 #include <murphy/common/log.h>
+#include <murphy/common/profile.h>
 #include <murphy/core/context.h>
 #include <murphy/core/plugin.h>
 #include <murphy/daemon/config.h>
@@ -76,8 +78,15 @@ static void print_usage(mrp_context_t *ctx, const char *argv0, int exit_code,
            "      If omitted, defaults to '%s'.\n"
            "  -P, --plugin-dir=PATH          load plugins from DIR\n"
            "      The default plugin directory is '%s'.\n"
+           "  -S, --state-dir=PATH           persistent state directory\n"
+           "      The default state directory is '%s'.\n"
+           "  -O, --precompile[=PATH]        precompile Lua files and exit\n"
+           "      PATH is a file or directory, defaults to the config dir.\n"
+           "  -T, --profile-startup[=PATH]   profile the startup phases\n"
+           "      Writes a Chrome trace to PATH, or a report to stderr.\n"
            "  -t, --log-target=TARGET        log target to use\n"
            "      TARGET is one of stderr,stdout,syslog, or a logfile path\n"
+           "      prefixed with async: messages are written by a thread\n"
            "  -l, --log-level=LEVELS         logging level to use\n"
            "      LEVELS is a comma separated list of info, error and warning\n"
            "  -v, --verbose                  increase logging verbosity\n"
@@ -96,8 +105,12 @@ static void print_usage(mrp_context_t *ctx, const char *argv0, int exit_code,
            "  -R, --no-poststart-load        "
                     "disable post-startup plugin loading\n"
            "  -p, --disable-console          disable Murphy debug console\n"
+           "  -r, --realtime=SETTINGS        run the mainloop in real-time mode\n"
+           "      SETTINGS is a comma separated list of cpu=N[-M], fifo=PRIO,\n"
+           "      lock, reserve=SIZE[k|M] and objects=N\n"
            "  -V, --valgrind                 run through valgrind\n",
-           argv0, ctx->config_file, ctx->config_dir, ctx->plugin_dir);
+           argv0, ctx->config_file, ctx->config_dir, ctx->plugin_dir,
+           ctx->state_dir ? ctx->state_dir : "<none>");
 
     if (exit_code < 0)
         return;
@@ -189,6 +202,68 @@ static void print_plugin_help(mrp_context_t *ctx, int detailed)
 }
 
 
+static void parse_realtime(mrp_context_t *ctx, char *argv0, const char *spec)
+{
+    char          buf[256], *key, *val, *next, *end;
+    unsigned long lo, hi;
+
+    if (snprintf(buf, sizeof(buf), "%s", spec) >= (int)sizeof(buf))
+        print_usage(ctx, argv0, EINVAL, "real-time settings too long");
+
+    for (key = buf; key != NULL && *key; key = next) {
+        if ((next = strchr(key, ',')) != NULL)
+            *next++ = '\0';
+
+        if ((val = strchr(key, '=')) != NULL)
+            *val++ = '\0';
+
+        errno = 0;
+
+        if (!strcmp(key, "lock") && val == NULL)
+            ctx->rt_lock = true;
+        else if (!strcmp(key, "cpu") && val != NULL) {
+            lo = hi = strtoul(val, &end, 10);
+            if (*end == '-')
+                hi = strtoul(end + 1, &end, 10);
+            if (*end || errno || end == val || lo > hi || hi > 63)
+                goto invalid;
+            while (lo <= hi)
+                ctx->rt_cpus |= 1ULL << lo++;
+        }
+        else if (!strcmp(key, "fifo") && val != NULL) {
+            ctx->rt_priority = (int)strtol(val, &end, 10);
+            if (*end || errno || end == val ||
+                ctx->rt_priority < 1 || ctx->rt_priority > 99)
+                goto invalid;
+        }
+        else if (!strcmp(key, "reserve") && val != NULL) {
+            ctx->rt_reserve = strtoul(val, &end, 10);
+            if (errno || end == val)
+                goto invalid;
+            switch (*end) {
+            case 'k': ctx->rt_reserve *= 1024;        end++; break;
+            case 'M': ctx->rt_reserve *= 1024 * 1024; end++; break;
+            }
+            if (*end)
+                goto invalid;
+        }
+        else if (!strcmp(key, "objects") && val != NULL) {
+            ctx->rt_objects = (int)strtol(val, &end, 10);
+            if (*end || errno || end == val || ctx->rt_objects < 0)
+                goto invalid;
+        }
+        else
+            goto invalid;
+    }
+
+    return;
+
+ invalid:
+    print_usage(ctx, argv0, EINVAL, "invalid real-time setting '%s%s%s'",
+                key, val ? "=" : "", val ? val : "");
+}
+
+
 static void config_set_defaults(mrp_context_t *ctx, char *argv0)
 {
     static char cfg_file[PATH_MAX], cfg_dir[PATH_MAX], plugin_dir[PATH_MAX];
@@ -213,6 +288,7 @@ static void config_set_defaults(mrp_context_t *ctx, char *argv0)
         ctx->config_file = cfg_file;
         ctx->config_dir  = cfg_dir;
         ctx->plugin_dir  = plugin_dir;
+        ctx->state_dir   = NULL;
         ctx->log_mask    = MRP_LOG_UPTO(MRP_LOG_INFO);
         ctx->log_target  = MRP_LOG_TO_STDERR;
         ctx->foreground  = TRUE;
@@ -221,6 +297,7 @@ static void config_set_defaults(mrp_context_t *ctx, char *argv0)
         ctx->config_file = MRP_DEFAULT_CONFIG_FILE;
         ctx->config_dir  = MRP_DEFAULT_CONFIG_DIR;
         ctx->plugin_dir  = MRP_DEFAULT_PLUGIN_DIR;
+        ctx->state_dir   = MRP_DEFAULT_STATE_DIR;
         ctx->log_mask    = MRP_LOG_MASK_ERROR;
         ctx->log_target  = MRP_LOG_TO_STDERR;
     }
@@ -229,11 +306,14 @@ static void config_set_defaults(mrp_context_t *ctx, char *argv0)
 
 void mrp_parse_cmdline(mrp_context_t *ctx, int argc, char **argv, char **envp)
 {
-#   define OPTIONS "c:C:l:t:fP:a:vd:hHqB:I:E:w:i:e:RpV"
+#   define OPTIONS "c:C:l:t:fP:S:O::T::a:vd:hHqB:I:E:w:i:e:Rpr:V"
     struct option options[] = {
         { "config-file"      , required_argument, NULL, 'c' },
         { "config-dir"       , required_argument, NULL, 'C' },
         { "plugin-dir"       , required_argument, NULL, 'P' },
+        { "state-dir"        , required_argument, NULL, 'S' },
+        { "precompile"       , optional_argument, NULL, 'O' },
+        { "profile-startup"  , optional_argument, NULL, 'T' },
         { "log-level"        , required_argument, NULL, 'l' },
         { "log-target"       , required_argument, NULL, 't' },
         { "verbose"          , optional_argument, NULL, 'v' },
@@ -252,6 +332,7 @@ void mrp_parse_cmdline(mrp_context_t *ctx, int argc, char **argv, char **envp)
         { "whitelist-dynamic", required_argument, NULL, 'e' },
         { "no-poststart-load", no_argument      , NULL, 'R' },
         { "disable-console"  , no_argument      , NULL, 'p' },
+        { "realtime"         , required_argument, NULL, 'r' },
         { "valgrind"         , optional_argument, NULL, 'V' },
         { NULL, 0, NULL, 0 }
     };
@@ -296,6 +377,20 @@ void mrp_parse_cmdline(mrp_context_t *ctx, int argc, char **argv, char **envp)
             ctx->plugin_dir = optarg;
             break;
 
+        case 'S':
+            SAVE_OPTARG("-S", optarg);
+            ctx->state_dir = optarg;
+            break;
+
+        case 'O':
+            ctx->precompile = optarg ? optarg : "";
+            break;
+
+        case 'T':
+            ctx->profile_startup = optarg ? optarg : "";
+            mrp_profile_start();
+            break;
+
         case 'v':
             SAVE_OPT("-v");
             ctx->log_mask <<= 1;
@@ -397,6 +492,12 @@ void mrp_parse_cmdline(mrp_context_t *ctx, int argc, char **argv, char **envp)
             SAVE_OPT("-p");
             ctx->disable_console = TRUE;
             break;
+
+        case 'r':
+            SAVE_OPTARG("-r", optarg);
+            parse_realtime(ctx, argv[0], optarg);
+            break;
+
         case 'V':
             valgrind(optarg, argc, argv, optind, saved_argc, saved_argv, envp);
             break;
@@ -37,6 +37,10 @@
 #    define MRP_DEFAULT_CONFIG_DIR  SYSCONFDIR"/murphy"
 #endif
 
+#ifndef MRP_DEFAULT_STATE_DIR
+#    define MRP_DEFAULT_STATE_DIR   LOCALSTATEDIR"/lib/murphy"
+#endif
+
 #ifndef MRP_DEFAULT_CONFIG_FILE
 #    define MRP_DEFAULT_CONFIG_FILE MRP_DEFAULT_CONFIG_DIR"/murphy.conf"
 #endif
@@ -27,15 +27,30 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <signal.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
 #include <murphy/common/macros.h>
 #include <murphy/common/log.h>
+#include <murphy/common/mm.h>
 #include <murphy/common/mainloop.h>
 #include <murphy/common/utils.h>
+#include <murphy/common/profile.h>
+#include <murphy/common/socket-utils.h>
 #include <murphy/core/context.h>
 #include <murphy/core/plugin.h>
+#include <murphy/core/lua-utils/include.h>
+#include <murphy/core/lua-bindings/murphy.h>
 #include <murphy/resolver/resolver.h>
 #include <murphy/daemon/config.h>
 #include <murphy/daemon/daemon.h>
@@ -70,13 +85,119 @@ static int emit_daemon_event(mrp_context_t *ctx, int idx)
 }
 
 
+static char **daemon_argv;               /* for re-executing ourselves */
+static pid_t   handover_pid;             /* instance being handed over to */
+
+
+static void handover_ready_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
+                              void *user_data)
+{
+    mrp_mainloop_t *ml = mrp_get_io_watch_mainloop(w);
+    char            c;
+    ssize_t         n;
+
+    MRP_UNUSED(events);
+    MRP_UNUSED(user_data);
+
+    do {
+        n = read(fd, &c, 1);
+    } while (n < 0 && errno == EINTR);
+
+    mrp_del_io_watch(w);
+    close(fd);
+
+    if (n == 1) {
+        mrp_log_info("New instance %u is up and running, stopping...",
+                     (unsigned int)handover_pid);
+        mrp_mainloop_quit(ml, 0);
+    }
+    else {
+        mrp_log_error("New instance %u failed to start, keeping running.",
+                      (unsigned int)handover_pid);
+        waitpid(handover_pid, NULL, WNOHANG);
+    }
+
+    handover_pid = 0;
+}
+
+
+/*
+ * Hand our listening sockets over to a new instance of ourselves. We keep
+ * serving until the new instance tells us it is running, so a failing
+ * upgrade leaves the service up. Only the sockets are handed over: clients
+ * connected to us lose their connections and need to reconnect and set up
+ * their state (resource sets, watches) again with the new instance.
+ */
+
+static void handover(mrp_mainloop_t *ml)
+{
+    mrp_io_event_t events = MRP_IO_EVENT_IN | MRP_IO_EVENT_HUP;
+    pid_t          pid;
+    int            ready;
+
+    if (handover_pid != 0) {
+        mrp_log_warning("Already handing over to instance %u.",
+                        (unsigned int)handover_pid);
+        return;
+    }
+
+    pid = mrp_handover_exec("/proc/self/exe", daemon_argv, &ready);
+
+    if (pid < 0) {
+        mrp_log_error("Failed to hand over to a new instance (%d: %s).",
+                      errno, strerror(errno));
+        return;
+    }
+
+    if (mrp_add_io_watch(ml, ready, events, handover_ready_cb, NULL) == NULL) {
+        mrp_log_error("Failed to wait for new instance %u, stopping...",
+                      (unsigned int)pid);
+        close(ready);
+        mrp_mainloop_quit(ml, 0);
+        return;
+    }
+
+    handover_pid = pid;
+
+    mrp_log_info("Handed over listening sockets to new instance %u, "
+                 "waiting for it to start...", (unsigned int)pid);
+}
+
+
+static void dump_heap_profile(mrp_context_t *ctx)
+{
+    static int  seq;
+    const char *dir;
+    char        path[PATH_MAX];
+    FILE       *fp;
+
+    if (mrp_mm_sample_rate() == 0) {
+        mrp_log_warning("Allocation sampling is off, no heap profile.");
+        return;
+    }
+
+    dir = ctx->state_dir && *ctx->state_dir ? ctx->state_dir : "/tmp";
+    snprintf(path, sizeof(path), "%s/murphyd.%u.%04d.heap", dir,
+             (unsigned int)getpid(), seq++);
+
+    if ((fp = fopen(path, "w")) == NULL) {
+        mrp_log_error("Failed to open heap profile '%s' (%d: %s).", path,
+                      errno, strerror(errno));
+        return;
+    }
+
+    mrp_mm_sample_dump(fp);
+    fclose(fp);
+
+    mrp_log_info("Heap profile written to '%s'.", path);
+}
+
+
 static void signal_handler(mrp_sighandler_t *h, int signum, void *user_data)
 {
     mrp_mainloop_t *ml  = mrp_get_sighandler_mainloop(h);
     mrp_context_t  *ctx = (mrp_context_t *)user_data;
 
-    MRP_UNUSED(ctx);
-
     switch (signum) {
     case SIGINT:
         mrp_log_info("Got SIGINT, stopping...");
@@ -90,6 +211,20 @@ static void signal_handler(mrp_sighandler_t *h, int signum, void *user_data)
         mrp_log_info("Got SIGTERM, stopping...");
         mrp_mainloop_quit(ml, 0);
         break;
+
+    case SIGHUP:
+        mrp_log_info("Got SIGHUP, reloading Lua configuration...");
+        mrp_lua_reload_config();
+        break;
+
+    case SIGUSR1:
+        dump_heap_profile(ctx);
+        break;
+
+    case SIGUSR2:
+        mrp_log_info("Got SIGUSR2, handing over to a new instance...");
+        handover(ml);
+        break;
     }
 }
 
@@ -115,6 +250,9 @@ static void setup_signals(mrp_context_t *ctx)
 {
     mrp_add_sighandler(ctx->ml, SIGINT , signal_handler, ctx);
     mrp_add_sighandler(ctx->ml, SIGTERM, signal_handler, ctx);
+    mrp_add_sighandler(ctx->ml, SIGHUP , signal_handler, ctx);
+    mrp_add_sighandler(ctx->ml, SIGUSR1, signal_handler, ctx);
+    mrp_add_sighandler(ctx->ml, SIGUSR2, signal_handler, ctx);
 }
 
 
@@ -124,14 +262,49 @@ static void parse_cmdline(mrp_context_t *ctx, int argc, char **argv, char **env)
 }
 
 
+static void setup_lua_cache(mrp_context_t *ctx)
+{
+    char dir[PATH_MAX];
+
+    if (ctx->state_dir == NULL || !*ctx->state_dir)
+        return;
+
+    snprintf(dir, sizeof(dir), "%s/lua-cache", ctx->state_dir);
+
+    if (mrp_lua_set_bytecode_cache(dir) == 0)
+        mrp_log_info("Using Lua bytecode cache '%s'.", dir);
+}
+
+
+static void precompile_lua(mrp_context_t *ctx)
+{
+    const char *path;
+
+    if (ctx->precompile == NULL)
+        return;
+
+    path = *ctx->precompile ? ctx->precompile : ctx->config_dir;
+
+    if (mrp_lua_precompile(path) < 0) {
+        mrp_log_error("Failed to precompile Lua files in '%s'.", path);
+        exit(1);
+    }
+
+    exit(0);
+}
+
+
 static void load_configuration(mrp_context_t *ctx)
 {
     mrp_cfgfile_t *cfg;
+    int            prof;
 
     mrp_context_setstate(ctx, MRP_STATE_LOADING);
     emit_daemon_event(ctx, DAEMON_EVENT_LOADING);
 
-    cfg = mrp_parse_cfgfile(ctx->config_file);
+    prof = mrp_profile_begin("parse configuration");
+    cfg  = mrp_parse_cfgfile(ctx->config_file);
+    mrp_profile_end(prof);
 
     if (cfg != NULL) {
         mrp_log_info("Blacklisted plugins of any type: %s",
@@ -149,10 +322,14 @@ static void load_configuration(mrp_context_t *ctx)
 
         mrp_block_blacklisted_plugins(ctx);
 
+        prof = mrp_profile_begin("execute configuration");
+
         if (!mrp_exec_cfgfile(ctx, cfg)) {
             mrp_log_error("Failed to execute configuration.");
             exit(1);
         }
+
+        mrp_profile_end(prof);
     }
     else {
         mrp_log_error("Failed to parse configuration file '%s'.",
@@ -170,7 +347,11 @@ static void create_ruleset(mrp_context_t *ctx)
 
 static void load_ruleset(mrp_context_t *ctx)
 {
+    int prof;
+
     if (ctx->resolver_ruleset != NULL) {
+        prof = mrp_profile_begin("load resolver ruleset");
+
         if (mrp_resolver_parse(ctx->r, ctx, ctx->resolver_ruleset))
             mrp_log_info("Loaded resolver ruleset '%s'.",
                          ctx->resolver_ruleset);
@@ -179,17 +360,30 @@ static void load_ruleset(mrp_context_t *ctx)
                           ctx->resolver_ruleset);
             exit(1);
         }
+
+        mrp_profile_end(prof);
     }
 }
 
 
 static void start_plugins(mrp_context_t *ctx)
 {
+    int pending, prof;
+
     mrp_context_setstate(ctx, MRP_STATE_STARTING);
     emit_daemon_event(ctx, DAEMON_EVENT_STARTING);
 
-    if (mrp_start_plugins(ctx))
-        mrp_log_info("Successfully started all loaded plugins.");
+    prof = mrp_profile_begin("start plugins");
+
+    if (mrp_start_plugins(ctx)) {
+        mrp_profile_end(prof);
+
+        if ((pending = mrp_plugins_pending(ctx)) > 0)
+            mrp_log_info("Started all loaded plugins, %d still pending.",
+                         pending);
+        else
+            mrp_log_info("Successfully started all loaded plugins.");
+    }
     else {
         mrp_log_error("Some plugins failed to start.");
         exit(1);
@@ -224,7 +418,11 @@ static void daemonize(mrp_context_t *ctx)
 
 static void prepare_ruleset(mrp_context_t *ctx)
 {
+    int prof;
+
     if (ctx->r != NULL) {
+        prof = mrp_profile_begin("prepare resolver ruleset");
+
         if (mrp_resolver_prepare(ctx->r))
             mrp_log_info("Ruleset prepared for resolution.");
         else {
@@ -235,6 +433,111 @@ static void prepare_ruleset(mrp_context_t *ctx)
             mrp_log_error("Failed to enable resolver autoupdate.");
             exit(1);
         }
+
+        mrp_profile_end(prof);
+    }
+}
+
+
+static void dump_startup_profile(mrp_context_t *ctx)
+{
+    FILE *fp;
+
+    if (ctx->profile_startup == NULL)
+        return;
+
+    if (*ctx->profile_startup) {
+        if ((fp = fopen(ctx->profile_startup, "w")) != NULL) {
+            mrp_profile_dump(fp, MRP_TRACE_FORMAT_CHROME);
+            fclose(fp);
+            mrp_log_info("Startup profile written to '%s'.",
+                         ctx->profile_startup);
+        }
+        else
+            mrp_log_error("Failed to open startup profile '%s' (%d: %s).",
+                          ctx->profile_startup, errno, strerror(errno));
+    }
+    else
+        mrp_profile_dump(stderr, MRP_TRACE_FORMAT_TEXT);
+
+    mrp_profile_stop();
+}
+
+
+#define RT_STACK_PREFAULT (256 * 1024)  /* stack to prefault when locking */
+
+static void prefault_stack(void)
+{
+    volatile char stack[RT_STACK_PREFAULT];
+    size_t        i;
+
+    for (i = 0; i < sizeof(stack); i += 4096)
+        stack[i] = 0;
+}
+
+
+static void setup_realtime(mrp_context_t *ctx)
+{
+    struct sched_param param;
+    cpu_set_t          cpus;
+    int                cpu, err;
+
+    /*
+     * Notes:
+     *     This needs to be done after daemonizing, since memory locks are
+     *     not inherited over fork(2). We go real-time only after all the
+     *     memory has been set up, so that the page faults and allocations
+     *     of the setup itself don't run at real-time priority.
+     */
+
+    if (ctx->rt_cpus != 0) {
+        CPU_ZERO(&cpus);
+
+        for (cpu = 0; cpu < 64; cpu++)
+            if (ctx->rt_cpus & (1ULL << cpu))
+                CPU_SET(cpu, &cpus);
+
+        err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+        if (err != 0) {
+            mrp_log_error("Failed to pin mainloop to CPUs 0x%llx (%d: %s).",
+                          (unsigned long long)ctx->rt_cpus, err, strerror(err));
+            exit(1);
+        }
+    }
+
+    if (ctx->rt_reserve != 0 && !mrp_mm_reserve(ctx->rt_reserve)) {
+        mrp_log_error("Failed to reserve %zu bytes of memory.",
+                      ctx->rt_reserve);
+        exit(1);
+    }
+
+    if (ctx->rt_objects != 0 && !mrp_objpool_reserve(ctx->rt_objects))
+        mrp_log_warning("Failed to pre-grow all object pools.");
+
+    if (ctx->rt_lock) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+            mrp_log_error("Failed to lock memory (%d: %s).",
+                          errno, strerror(errno));
+            exit(1);
+        }
+
+        prefault_stack();
+    }
+
+    if (ctx->rt_priority != 0) {
+        param.sched_priority = ctx->rt_priority;
+        err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+        if (err != 0) {
+            mrp_log_error("Failed to switch mainloop to SCHED_FIFO "
+                          "priority %d (%d: %s).", ctx->rt_priority,
+                          err, strerror(err));
+            exit(1);
+        }
+
+        mrp_log_info("Running mainloop with SCHED_FIFO priority %d.",
+                     ctx->rt_priority);
     }
 }
 
@@ -243,6 +546,7 @@ static void run_mainloop(mrp_context_t *ctx)
 {
     mrp_context_setstate(ctx, MRP_STATE_RUNNING);
     emit_daemon_event(ctx, DAEMON_EVENT_RUNNING);
+    mrp_handover_ready();
     mrp_mainloop_run(ctx->ml);
 }
 
@@ -281,19 +585,24 @@ int main(int argc, char *argv[], char *envp[])
 {
     mrp_context_t *ctx;
 
+    daemon_argv = argv;
     ctx = create_context();
 
     setup_signals(ctx);
     create_ruleset(ctx);
     parse_cmdline(ctx, argc, argv, envp);
+    setup_lua_cache(ctx);
+    precompile_lua(ctx);
     load_configuration(ctx);
     start_plugins(ctx);
     load_ruleset(ctx);
     prepare_ruleset(ctx);
+    dump_startup_profile(ctx);
     setup_logging(ctx);
     daemonize(ctx);
     set_linebuffered(stdout);
     set_nonbuffered(stderr);
+    setup_realtime(ctx);
     run_mainloop(ctx);
     stop_plugins(ctx);
 
@@ -67,8 +67,10 @@ int mdb_hash_table_destroy(mdb_hash_t *);
 int mdb_hash_table_reset(mdb_hash_t *);
 void *mdb_hash_table_iterate(mdb_hash_t *, void **, void **);
 int mdb_hash_table_print(mdb_hash_t *, char *, int);
+int mdb_hash_table_print_statistics(mdb_hash_t *, char *, int);
 
 int mdb_hash_add(mdb_hash_t *, int, void *, void *);
+int mdb_hash_reserve(mdb_hash_t *, int);
 void *mdb_hash_delete(mdb_hash_t *, int, void *);
 void *mdb_hash_get_data(mdb_hash_t *, int, void *);
 
@@ -33,6 +33,14 @@
 #include <murphy-db/mqi-types.h>
 
 typedef struct mdb_table_s mdb_table_t;
+typedef struct mdb_cursor_s mdb_cursor_t;
+
+typedef struct {
+    uint64_t  begun;            /* transactions started */
+    uint64_t  committed;        /* transactions committed successfully */
+    uint64_t  rolledback;       /* transactions rolled back */
+    uint64_t  failed;           /* commits that failed */
+} mdb_transaction_stats_t;
 
 
 int mdb_trigger_add_column_callback(mdb_table_t *, int, mqi_trigger_cb_t,
@@ -46,26 +54,48 @@ int mdb_trigger_add_table_callback(mqi_trigger_cb_t, void *);
 int mdb_trigger_delete_table_callback(mqi_trigger_cb_t, void *);
 int mdb_trigger_add_transaction_callback(mqi_trigger_cb_t, void *);
 int mdb_trigger_delete_transaction_callback(mqi_trigger_cb_t, void *);
+int mdb_trigger_add_changeset_callback(mdb_table_t *, const mqi_bitfld_t *,
+                                       mqi_trigger_cb_t, void *,
+                                       mqi_column_desc_t *);
+int mdb_trigger_delete_changeset_callback(mdb_table_t *, mqi_trigger_cb_t,
+                                          void *);
 
 uint32_t mdb_transaction_begin(void);
 int mdb_transaction_commit(uint32_t);
 int mdb_transaction_rollback(uint32_t);
 uint32_t mdb_transaction_get_depth(void);
+int mdb_transaction_get_statistics(mdb_transaction_stats_t *);
+
+int mdb_log_set_limit(uint32_t);
+uint32_t mdb_log_get_limit(void);
+uint32_t mdb_log_get_pending(void);
+int mdb_log_print_statistics(char *, int);
 
 
 mdb_table_t *mdb_table_create(char *, char **, mqi_column_def_t *);
 int mdb_table_register_handle(mdb_table_t *, mqi_handle_t);
 int mdb_table_drop(mdb_table_t *);
 int mdb_table_create_index(mdb_table_t *, char **);
+int mdb_table_create_secondary_index(mdb_table_t *, char *, mqi_index_type_t,
+                                     char **);
+int mdb_table_drop_secondary_index(mdb_table_t *, char *);
 int mdb_table_describe(mdb_table_t *, mqi_column_def_t *, int);
 int mdb_table_insert(mdb_table_t *, int, mqi_column_desc_t *, void **);
 int mdb_table_select(mdb_table_t *, mqi_cond_entry_t *,
                      mqi_column_desc_t *, void *, int, int);
 int mdb_table_select_by_index(mdb_table_t *, mqi_variable_t *,
                               mqi_column_desc_t *, void *);
+mdb_cursor_t *mdb_table_select_open(mdb_table_t *, mqi_cond_entry_t *,
+                                    mqi_column_desc_t *);
+int mdb_table_select_next(mdb_cursor_t *, void *, int, int);
+void mdb_table_select_close(mdb_cursor_t *);
+mdb_cursor_t *mdb_table_snapshot_open(mdb_table_t *, mqi_cond_entry_t *,
+                                      mqi_column_desc_t *);
 int mdb_table_update(mdb_table_t *, mqi_cond_entry_t *,
                      mqi_column_desc_t *, void *);
 int mdb_table_delete(mdb_table_t *, mqi_cond_entry_t *);
+int mdb_table_make_persistent(mdb_table_t *, const char *);
+int mdb_table_compact(mdb_table_t *);
 
 
 mdb_table_t *mdb_table_find(char *);
@@ -76,6 +106,7 @@ mqi_data_type_t mdb_table_get_column_type(mdb_table_t *, int);
 int mdb_table_get_column_size(mdb_table_t *, int);
 uint32_t mdb_table_get_stamp(mdb_table_t *);
 int mdb_table_print_rows(mdb_table_t *, char *, int);
+int mdb_table_print_hash_statistics(mdb_table_t *, char *, int);
 
 
 #endif /* __MDB_MDB_H__ */
@@ -39,7 +39,7 @@
 /** maximum number of rows a query can produce */
 #define MQI_QUERY_RESULT_MAX   8192
 /** the maximum number columns a table can have */
-#define MQI_COLUMN_MAX         ((int)(sizeof(mqi_bitfld_t) * 8))
+#define MQI_COLUMN_MAX         128
 /** maximum length of a condition table (i.e. array of mqi_cond_entry_t) */
 #define MQI_COND_MAX           64
 #define MQL_PARAMETER_MAX      16
@@ -65,7 +65,9 @@
 #define MQI_OFFSET(structure, member)  \
     ((int)((char *)((&((structure *)0)->member)) - (char *)0))
 
-#define MQI_BIT(b)            (((mqi_bitfld_t)1) << (b))
+/** number of columns a single word of a column mask covers */
+#define MQI_BITFLD_BITS       64
+#define MQI_BITFLD_WORDS      (MQI_COLUMN_MAX / MQI_BITFLD_BITS)
 
 #define MQL_BIND_INDEX_BITS   8
 #define MQL_BIND_INDEX_MAX    (1 << MQL_BIND_INDEX_BITS)
@@ -76,6 +78,7 @@
 
 #define MQI_COLUMN_KEY        (1UL << 0)
 #define MQI_COLUMN_AUTOINCR   (1UL << 1)
+#define MQI_COLUMN_INTERNED   (1UL << 2)
 
 enum mqi_data_type_e {
     mqi_error = -1,    /* not a data type; used to return error conditions */
@@ -88,6 +91,11 @@ enum mqi_data_type_e {
     mqi_blob,
 };
 
+enum mqi_index_type_e {
+    mqi_index_hash = 0,         /* equality lookups */
+    mqi_index_ordered,          /* equality and range lookups */
+};
+
 enum mqi_operator_e {
     mqi_done = 0,
     mqi_end  = mqi_done,
@@ -117,15 +125,17 @@ enum mqi_event_type_e {
     mqi_table_created,
     mqi_table_dropped,
     mqi_transaction_start,
-    mqi_transaction_end
+    mqi_transaction_end,
+    mqi_changeset
 };
 
 
 
 typedef uint32_t  mqi_handle_t;
-typedef uint32_t  mqi_bitfld_t;
+typedef struct mqi_bitfld_s          mqi_bitfld_t;
 
 typedef enum mqi_data_type_e         mqi_data_type_t;
+typedef enum mqi_index_type_e        mqi_index_type_t;
 typedef struct mqi_column_def_s      mqi_column_def_t;
 typedef struct mqi_column_desc_s     mqi_column_desc_t;
 
@@ -142,16 +152,27 @@ typedef struct mqi_change_select_s   mqi_change_select_t;
 typedef struct mqi_change_coldsc_s   mqi_change_coldsc_t;
 typedef union mqi_change_data_u      mqi_change_data_t;
 typedef struct mqi_change_value_s    mqi_change_value_t;
+typedef struct mqi_change_s          mqi_change_t;
 
 typedef struct mqi_column_event_s    mqi_column_event_t;
 typedef struct mqi_row_event_s       mqi_row_event_t;
 typedef struct mqi_table_event_s     mqi_table_event_t;
 typedef struct mqi_transact_event_s  mqi_transact_event_t;
+typedef struct mqi_changeset_event_s mqi_changeset_event_t;
 
 typedef void (*mqi_trigger_cb_t)(mqi_event_t *, void *);
 
 
 
+/*
+ * column masks, one bit per column. Tables rarely have more than 64
+ * columns, so the operations below check the first word before they
+ * bother looking at the rest
+ */
+struct mqi_bitfld_s {
+    uint64_t w[MQI_BITFLD_WORDS];
+};
+
 struct mqi_column_def_s {
     const char      *name;
     mqi_data_type_t  type;
@@ -243,6 +264,27 @@ struct mqi_transact_event_s {
     uint32_t          depth;
 };
 
+/*
+ * the changes a committed transaction made to a table, in the order
+ * they were made; old points to the selected columns of the row before
+ * the change, new_ to the row as it was committed. They are NULL if
+ * there is no such row (insert/delete)
+ */
+struct mqi_change_s {
+    mqi_event_type_t  event;    /* row inserted/deleted or column changed */
+    mqi_bitfld_t      colmask;  /* changed columns of an update */
+    void             *old;
+    void             *new_;
+};
+
+struct mqi_changeset_event_s {
+    mqi_event_type_t    event;
+    mqi_change_table_t  table;
+    uint32_t            depth;
+    int                 nchange;
+    mqi_change_t       *changes;
+};
+
 
 union mqi_event_u {
     mqi_event_type_t     event;
@@ -250,9 +292,110 @@ union mqi_event_u {
     mqi_row_event_t      row;
     mqi_table_event_t    table;
     mqi_transact_event_t transact;
+    mqi_changeset_event_t changeset;
 };
 
 
+static inline void mqi_bitfld_clear(mqi_bitfld_t *m)
+{
+    int i;
+
+    for (i = 0;  i < MQI_BITFLD_WORDS;  i++)
+        m->w[i] = 0;
+}
+
+static inline void mqi_bitfld_fill(mqi_bitfld_t *m)
+{
+    int i;
+
+    for (i = 0;  i < MQI_BITFLD_WORDS;  i++)
+        m->w[i] = ~(uint64_t)0;
+}
+
+static inline void mqi_bitfld_set(mqi_bitfld_t *m, int b)
+{
+    m->w[b / MQI_BITFLD_BITS] |= (uint64_t)1 << (b % MQI_BITFLD_BITS);
+}
+
+static inline bool mqi_bitfld_test(const mqi_bitfld_t *m, int b)
+{
+    return (m->w[b / MQI_BITFLD_BITS] >> (b % MQI_BITFLD_BITS)) & 1;
+}
+
+static inline bool mqi_bitfld_empty(const mqi_bitfld_t *m)
+{
+    int i;
+
+    if (m->w[0])
+        return false;
+
+    for (i = 1;  i < MQI_BITFLD_WORDS;  i++) {
+        if (m->w[i])
+            return false;
+    }
+
+    return true;
+}
+
+/* true if m1 and m2 have any bits in common */
+static inline bool mqi_bitfld_overlap(const mqi_bitfld_t *m1,
+                                      const mqi_bitfld_t *m2)
+{
+    int i;
+
+    if (m1->w[0] & m2->w[0])
+        return true;
+
+    for (i = 1;  i < MQI_BITFLD_WORDS;  i++) {
+        if (m1->w[i] & m2->w[i])
+            return true;
+    }
+
+    return false;
+}
+
+/* true if all bits of sub are set in m */
+static inline bool mqi_bitfld_contains(const mqi_bitfld_t *m,
+                                       const mqi_bitfld_t *sub)
+{
+    int i;
+
+    for (i = 0;  i < MQI_BITFLD_WORDS;  i++) {
+        if ((m->w[i] & sub->w[i]) != sub->w[i])
+            return false;
+    }
+
+    return true;
+}
+
+static inline void mqi_bitfld_or(mqi_bitfld_t *dst, const mqi_bitfld_t *src)
+{
+    int i;
+
+    for (i = 0;  i < MQI_BITFLD_WORDS;  i++)
+        dst->w[i] |= src->w[i];
+}
+
+/* index of the first bit set at or above b, or -1 if there is none */
+static inline int mqi_bitfld_next(const mqi_bitfld_t *m, int b)
+{
+    uint64_t w;
+    int      i;
+
+    for (i = b / MQI_BITFLD_BITS;  i < MQI_BITFLD_WORDS;  i++) {
+        w = m->w[i];
+
+        if (i == b / MQI_BITFLD_BITS)
+            w &= ~(uint64_t)0 << (b % MQI_BITFLD_BITS);
+
+        if (w)
+            return i * MQI_BITFLD_BITS + __builtin_ctzll(w);
+    }
+
+    return -1;
+}
+
+
 const char *mqi_data_type_str(mqi_data_type_t);
 
 int mqi_data_compare_integer(int, void *, void *);
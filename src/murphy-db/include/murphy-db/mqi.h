@@ -41,6 +41,8 @@
 #define MQI_ANY               (MQI_PERSISTENT | MQI_TEMPORARY)
 #define MQI_TABLE_TYPE_MASK   (MQI_PERSISTENT | MQI_TEMPORARY)
 
+typedef struct mqi_cursor_s mqi_cursor_t;
+
 
 #define MQI_COLUMN_DEFINITION(name, type...)  \
     {name, type, 0}
@@ -147,6 +149,10 @@
 #define MQI_SELECT_BY_INDEX(columns, table, idxvars, result)    \
     mqi_select_by_index(table, idxvars, columns, result)
 
+#define MQI_SELECT_NEXT(cursor, result)                         \
+    mqi_select_next(cursor, result,                             \
+                    sizeof(result[0]), MQI_DIMENSION(result))
+
 #define MQI_UPDATE(table, column_descs, data, where)            \
     mqi_update(table, where, column_descs, data)
 
@@ -157,6 +163,7 @@
 
 int mqi_open(void);
 int mqi_close(void);
+int mqi_set_persistent_directory(const char *);
 
 int mqi_show_tables(uint32_t, char **, int);
 
@@ -166,10 +173,14 @@ int mqi_create_row_trigger(mqi_handle_t, mqi_trigger_cb_t, void *,
                            mqi_column_desc_t *);
 int mqi_create_column_trigger(mqi_handle_t, int, mqi_trigger_cb_t, void *,
                               mqi_column_desc_t *);
+int mqi_create_changeset_trigger(mqi_handle_t, const mqi_bitfld_t *,
+                                 mqi_trigger_cb_t, void *,
+                                 mqi_column_desc_t *);
 int mqi_drop_transaction_trigger(mqi_trigger_cb_t, void *);
 int mqi_drop_table_trigger(mqi_trigger_cb_t, void *);
 int mqi_drop_row_trigger(mqi_handle_t, mqi_trigger_cb_t,void *);
 int mqi_drop_column_trigger(mqi_handle_t, int, mqi_trigger_cb_t, void *);
+int mqi_drop_changeset_trigger(mqi_handle_t, mqi_trigger_cb_t, void *);
 mqi_handle_t mqi_begin_transaction(void);
 int mqi_commit_transaction(mqi_handle_t);
 int mqi_rollback_transaction(mqi_handle_t);
@@ -177,7 +188,11 @@ mqi_handle_t mqi_get_transaction_handle(void);
 uint32_t mqi_get_transaction_depth(void);
 mqi_handle_t mqi_create_table(char *, uint32_t, char **, mqi_column_def_t *);
 int mqi_create_index(mqi_handle_t, char **);
+int mqi_create_secondary_index(mqi_handle_t, char *, mqi_index_type_t, char **);
+int mqi_drop_secondary_index(mqi_handle_t, char *);
 int mqi_drop_table(mqi_handle_t);
+mqi_handle_t mqi_create_view(char *, mqi_handle_t, mqi_cond_entry_t *, char **);
+int mqi_refresh_view(mqi_handle_t);
 int mqi_describe(mqi_handle_t, mqi_column_def_t *, int);
 int mqi_insert_into(mqi_handle_t, int, mqi_column_desc_t *, void **);
 int mqi_delete_from(mqi_handle_t, mqi_cond_entry_t *);
@@ -186,6 +201,12 @@ int mqi_select(mqi_handle_t, mqi_cond_entry_t *, mqi_column_desc_t *,
                void *, int, int);
 int mqi_select_by_index(mqi_handle_t, mqi_variable_t *,
                         mqi_column_desc_t *, void *);
+mqi_cursor_t *mqi_select_open(mqi_handle_t, mqi_cond_entry_t *,
+                              mqi_column_desc_t *);
+mqi_cursor_t *mqi_snapshot_open(mqi_handle_t, mqi_cond_entry_t *,
+                                mqi_column_desc_t *);
+int mqi_select_next(mqi_cursor_t *, void *, int, int);
+void mqi_select_close(mqi_cursor_t *);
 
 mqi_handle_t mqi_get_table_handle(char *);
 int mqi_get_column_index(mqi_handle_t, char *);
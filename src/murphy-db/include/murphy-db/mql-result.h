@@ -82,12 +82,24 @@ int              mql_result_columns_get_length(mql_result_t *, int);
 int              mql_result_rows_get_row_column_count(mql_result_t *);
 mqi_data_type_t  mql_result_rows_get_row_column_type(mql_result_t *, int);
 int              mql_result_rows_get_row_column_index(mql_result_t *, int);
+int              mql_result_rows_get_row_column_offset(mql_result_t *, int);
+void            *mql_result_rows_get_data(mql_result_t *, int *);
 int              mql_result_rows_get_row_count(mql_result_t *);
 const char      *mql_result_rows_get_string(mql_result_t*, int,int, char*,int);
 int32_t          mql_result_rows_get_integer(mql_result_t *, int,int);
 uint32_t         mql_result_rows_get_unsigned(mql_result_t *, int,int);
 double           mql_result_rows_get_floating(mql_result_t *, int,int);
 
+void            *mql_result_rows_pack(mql_result_t *, size_t *);
+int              mql_packed_rows_check(const void *, size_t);
+int              mql_packed_rows_get_row_count(const void *);
+int              mql_packed_rows_get_column_count(const void *);
+mqi_data_type_t  mql_packed_rows_get_column_type(const void *, int);
+const char      *mql_packed_rows_get_string(const void *, int, int);
+int32_t          mql_packed_rows_get_integer(const void *, int, int);
+uint32_t         mql_packed_rows_get_unsigned(const void *, int, int);
+double           mql_packed_rows_get_floating(const void *, int, int);
+
 const char      *mql_result_string_get(mql_result_t *);
 
 int              mql_result_list_get_length(mql_result_t *);
@@ -98,6 +110,8 @@ double           mql_result_list_get_floating(mql_result_t *, int);
 
 mqi_event_type_t mql_result_event_get_type(mql_result_t *);
 mql_result_t    *mql_result_event_get_changed_rows(mql_result_t *);
+mql_result_t    *mql_result_event_get_changeset_rows(mql_result_t *,
+                                                     mqi_event_type_t);
 
 void             mql_result_free(mql_result_t *);
 
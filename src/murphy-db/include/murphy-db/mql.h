@@ -156,6 +156,24 @@ mql_result_t *mql_exec_string(mql_result_type_t result_type,
  */
 mql_statement_t *mql_precompile(const char *statement);
 
+/**
+ * @brief set the size of the statement cache of mql_exec_string()
+ *
+ * mql_exec_string() keeps the precompiled form of the SELECT, INSERT,
+ * REPLACE, UPDATE, DELETE, SHOW TABLES and DESCRIBE statements it
+ * executes, keyed by the statement text with the whitespace collapsed.
+ * Executing the same statement again skips the parsing. When the cache
+ * is full the least recently used statement is dropped. The statements
+ * of a table are dropped together with the table.
+ *
+ * @param [in] size  is the maximum number of cached statements. 0 turns
+ *                   the caching off.
+ *
+ * @return mql_set_statement_cache_size() returns 0 on success or -1 if
+ *         the size was invalid.
+ */
+int mql_set_statement_cache_size(int size);
+
 
 #endif  /* __MQL_MQL_H__ */
 
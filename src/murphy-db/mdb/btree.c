@@ -0,0 +1,750 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+
+#define _GNU_SOURCE
+#include <string.h>
+
+#include <murphy-db/assert.h>
+#include "btree.h"
+
+/*
+ * A node fits in a few cache lines, so a lookup touches only a handful
+ * of lines per level and even large tables stay just a few levels deep.
+ * Nodes have room for one extra key, ie. they are split after an insert
+ * overflows them.
+ */
+#define NODE_MAX  32
+#define NODE_MIN  (NODE_MAX / 2)
+
+/*
+ * The separator keys[i] of an inner node is always the smallest key of
+ * the subtree children[i+1]. Since the keys are just pointers, this makes
+ * sure that a separator never refers to a key that is no longer in the
+ * tree.
+ */
+struct mdb_btree_node_s {
+    int                       leaf;
+    int                       nkey;
+    void                     *keys[NODE_MAX + 1];
+    union {
+        mdb_btree_node_t     *children[NODE_MAX + 2];
+        struct {
+            void             *data[NODE_MAX + 1];
+            mdb_btree_node_t *next;
+        };
+    };
+};
+
+struct mdb_btree_s {
+    mdb_btree_compare_t  comp;
+    void                *user_data;
+    mdb_btree_node_t    *root;
+    int                  height;
+    int                  nentry;
+    mdb_btree_node_t    *spare;    /* preallocated nodes for splits */
+    int                  nspare;
+};
+
+
+typedef struct {
+    void *key;
+    void *data;
+} pair_t;
+
+static void free_nodes(mdb_btree_node_t *);
+static void sort_pairs(mdb_btree_t *, int, pair_t *, pair_t *, int);
+static int rebuild(mdb_btree_t *, int, int, void **, void **);
+static mdb_btree_node_t *build_tree(pair_t *, int, int *);
+
+
+mdb_btree_t *mdb_btree_create(mdb_btree_compare_t comp, void *user_data)
+{
+    mdb_btree_t *bt;
+
+    MDB_CHECKARG(comp, NULL);
+
+    if (!(bt = calloc(1, sizeof(*bt)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    bt->comp      = comp;
+    bt->user_data = user_data;
+
+    return bt;
+}
+
+void mdb_btree_destroy(mdb_btree_t *bt)
+{
+    mdb_btree_node_t *node;
+
+    if (!bt)
+        return;
+
+    mdb_btree_reset(bt);
+
+    while ((node = bt->spare)) {
+        bt->spare = node->children[0];
+        free(node);
+    }
+
+    free(bt);
+}
+
+void mdb_btree_reset(mdb_btree_t *bt)
+{
+    MDB_CHECKARG(bt,);
+
+    if (bt->root)
+        free_nodes(bt->root);
+
+    bt->root   = NULL;
+    bt->height = 0;
+    bt->nentry = 0;
+}
+
+int mdb_btree_get_size(mdb_btree_t *bt)
+{
+    MDB_CHECKARG(bt, -1);
+
+    return bt->nentry;
+}
+
+
+static void free_nodes(mdb_btree_node_t *node)
+{
+    int i;
+
+    if (!node->leaf) {
+        for (i = 0;  i <= node->nkey;  i++)
+            free_nodes(node->children[i]);
+    }
+
+    free(node);
+}
+
+/* an insert splits at most one node per level and adds a new root */
+static int reserve_nodes(mdb_btree_t *bt)
+{
+    mdb_btree_node_t *node;
+
+    while (bt->nspare < bt->height + 1) {
+        if (!(node = malloc(sizeof(*node)))) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        node->children[0] = bt->spare;
+        bt->spare = node;
+        bt->nspare++;
+    }
+
+    return 0;
+}
+
+static mdb_btree_node_t *get_node(mdb_btree_t *bt, int leaf)
+{
+    mdb_btree_node_t *node = bt->spare;
+
+    bt->spare = node->children[0];
+    bt->nspare--;
+
+    memset(node, 0, sizeof(*node));
+    node->leaf = leaf;
+
+    return node;
+}
+
+/* number of keys in node less than key (or less or equal if strict) */
+static int node_bound(mdb_btree_t *bt, mdb_btree_node_t *node, int klen,
+                      void *key, int strict)
+{
+    int lo, hi, mid, cmp;
+
+    for (lo = 0, hi = node->nkey;  lo < hi; ) {
+        mid = (lo + hi) / 2;
+        cmp = bt->comp(bt->user_data, klen, node->keys[mid], key);
+
+        if (cmp < 0 || (strict && cmp == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static void *subtree_min(mdb_btree_node_t *node)
+{
+    while (!node->leaf)
+        node = node->children[0];
+
+    return node->keys[0];
+}
+
+static void split_node(mdb_btree_t *bt, mdb_btree_node_t *node,
+                       void **sepp, mdb_btree_node_t **rightp)
+{
+    mdb_btree_node_t *right = get_node(bt, node->leaf);
+    int               half  = node->nkey / 2;
+
+    if (node->leaf) {
+        right->nkey = node->nkey - half;
+        memcpy(right->keys, node->keys + half, right->nkey * sizeof(void *));
+        memcpy(right->data, node->data + half, right->nkey * sizeof(void *));
+        right->next = node->next;
+        node->next  = right;
+        node->nkey  = half;
+        *sepp = right->keys[0];
+    }
+    else {
+        /* the middle key moves up to the parent */
+        right->nkey = node->nkey - half - 1;
+        memcpy(right->keys, node->keys + half + 1,
+               right->nkey * sizeof(void *));
+        memcpy(right->children, node->children + half + 1,
+               (right->nkey + 1) * sizeof(void *));
+        node->nkey = half;
+        *sepp = node->keys[half];
+    }
+
+    *rightp = right;
+}
+
+static int insert_node(mdb_btree_t *bt, mdb_btree_node_t *node, int klen,
+                       void *key, void *data, void **sepp,
+                       mdb_btree_node_t **rightp)
+{
+    mdb_btree_node_t *right;
+    void             *sep;
+    int               pos, n;
+
+    /* equal keys are inserted after the existing ones */
+    pos = node_bound(bt, node, klen, key, 1);
+    n   = node->nkey - pos;
+
+    if (node->leaf) {
+        memmove(node->keys + pos + 1, node->keys + pos, n * sizeof(void *));
+        memmove(node->data + pos + 1, node->data + pos, n * sizeof(void *));
+        node->keys[pos] = key;
+        node->data[pos] = data;
+    }
+    else {
+        if (!insert_node(bt, node->children[pos], klen, key,data, &sep,&right))
+            return 0;
+
+        memmove(node->keys + pos + 1, node->keys + pos, n * sizeof(void *));
+        memmove(node->children + pos + 2, node->children + pos + 1,
+                n * sizeof(void *));
+        node->keys[pos]         = sep;
+        node->children[pos + 1] = right;
+    }
+
+    if (++node->nkey <= NODE_MAX)
+        return 0;
+
+    split_node(bt, node, sepp, rightp);
+
+    return 1;
+}
+
+int mdb_btree_insert(mdb_btree_t *bt, int klen, void *key, void *data)
+{
+    mdb_btree_node_t *root, *right;
+    void             *sep;
+
+    MDB_CHECKARG(bt && key && data, -1);
+
+    if (reserve_nodes(bt) < 0)
+        return -1;
+
+    if (!bt->root) {
+        bt->root   = get_node(bt, 1);
+        bt->height = 1;
+    }
+
+    if (insert_node(bt, bt->root, klen, key, data, &sep, &right)) {
+        root = get_node(bt, 0);
+
+        root->nkey        = 1;
+        root->keys[0]     = sep;
+        root->children[0] = bt->root;
+        root->children[1] = right;
+
+        bt->root = root;
+        bt->height++;
+    }
+
+    bt->nentry++;
+
+    return 0;
+}
+
+
+/*
+ * Bulk insertion sorts the new entries, merges them with the ones already
+ * in the tree and builds the whole tree anew, bottom up and with evenly
+ * filled nodes. That is linear in the size of the tree, so small batches
+ * (or any batch, if we run out of memory) are inserted one by one.
+ */
+int mdb_btree_insert_bulk(mdb_btree_t *bt, int klen, int n,
+                          void **keys, void **data)
+{
+    int i;
+
+    MDB_CHECKARG(bt && n >= 0 && (!n || (keys && data)), -1);
+
+    if (n > 0 && n >= bt->nentry / 8 && rebuild(bt, klen, n, keys,data) == 0)
+        return 0;
+
+    for (i = 0;  i < n;  i++) {
+        if (mdb_btree_insert(bt, klen, keys[i], data[i]) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int rebuild(mdb_btree_t *bt, int klen, int n, void **keys,void **data)
+{
+    mdb_btree_node_t *root;
+    mdb_btree_iter_t  it;
+    pair_t           *all, *tmp;
+    int               total, height;
+    int               i, j, k;
+
+    total = bt->nentry + n;
+    all   = malloc(total * sizeof(*all));
+    tmp   = malloc(n * sizeof(*tmp));
+
+    if (!all || !tmp) {
+        free(all);
+        free(tmp);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* the old entries go to the end, the sorted new ones are merged in */
+    mdb_btree_first(bt, &it);
+
+    for (i = n;  i < total;  i++)
+        all[i].data = mdb_btree_next(&it, &all[i].key);
+
+    for (i = 0;  i < n;  i++) {
+        tmp[i].key  = keys[i];
+        tmp[i].data = data[i];
+    }
+
+    sort_pairs(bt, klen, tmp, all, n);
+
+    /* equal keys: the old entries precede the new ones */
+    for (i = n, j = 0, k = 0;  j < n;  k++) {
+        if (i < total && bt->comp(bt->user_data, klen,
+                                  all[i].key, tmp[j].key) <= 0)
+            all[k] = all[i++];
+        else
+            all[k] = tmp[j++];
+    }
+
+    root = build_tree(all, total, &height);
+
+    free(all);
+    free(tmp);
+
+    if (!root)
+        return -1;
+
+    if (bt->root)
+        free_nodes(bt->root);
+
+    bt->root   = root;
+    bt->height = height;
+    bt->nentry = total;
+
+    return 0;
+}
+
+/* stable merge sort, tmp has room for at least half of the pairs */
+static void sort_pairs(mdb_btree_t *bt, int klen, pair_t *p, pair_t *tmp,
+                       int n)
+{
+    int half = n / 2;
+    int i, j, k;
+
+    if (n < 2)
+        return;
+
+    sort_pairs(bt, klen, p, tmp, half);
+    sort_pairs(bt, klen, p + half, tmp, n - half);
+
+    memcpy(tmp, p, half * sizeof(*p));
+
+    for (i = 0, j = half, k = 0;  i < half;  k++) {
+        if (j < n && bt->comp(bt->user_data, klen, p[j].key, tmp[i].key) < 0)
+            p[k] = p[j++];
+        else
+            p[k] = tmp[i++];
+    }
+}
+
+/*
+ * Distributing the entries (children) evenly over the minimal number of
+ * nodes keeps every node but the root at least half full.
+ */
+static mdb_btree_node_t *build_tree(pair_t *p, int n, int *heightp)
+{
+    mdb_btree_node_t  *node, **level;
+    void             **mins;
+    int                nnode, nchild, per, extra, height;
+    int                i, j, k;
+
+    nnode = (n + NODE_MAX - 1) / NODE_MAX;
+    level = malloc(nnode * sizeof(*level));
+    mins  = malloc(nnode * sizeof(*mins));
+
+    if (!level || !mins)
+        goto nomem;
+
+    per   = n / nnode;
+    extra = n % nnode;
+
+    for (i = k = 0;  i < nnode;  i++) {
+        if (!(node = calloc(1, sizeof(*node)))) {
+            for (j = 0;  j < i;  j++)
+                free(level[j]);
+            goto nomem;
+        }
+
+        node->leaf = 1;
+        node->nkey = per + (i < extra ? 1 : 0);
+
+        for (j = 0;  j < node->nkey;  j++, k++) {
+            node->keys[j] = p[k].key;
+            node->data[j] = p[k].data;
+        }
+
+        if (i > 0)
+            level[i - 1]->next = node;
+
+        level[i] = node;
+        mins[i]  = node->keys[0];
+    }
+
+    for (height = 1;  nnode > 1;  height++) {
+        nchild = nnode;
+        nnode  = (nchild + NODE_MAX) / (NODE_MAX + 1);
+        per    = nchild / nnode;
+        extra  = nchild % nnode;
+
+        /* the new level overwrites the consumed part of the old one */
+        for (i = k = 0;  i < nnode;  i++) {
+            if (!(node = calloc(1, sizeof(*node)))) {
+                for (j = 0;  j < i;  j++)
+                    free_nodes(level[j]);
+                for (j = k;  j < nchild;  j++)
+                    free_nodes(level[j]);
+                goto nomem;
+            }
+
+            node->nkey = per + (i < extra ? 1 : 0) - 1;
+
+            for (j = 0;  j <= node->nkey;  j++) {
+                node->children[j] = level[k + j];
+
+                if (j > 0)
+                    node->keys[j - 1] = mins[k + j];
+            }
+
+            mins[i]  = mins[k];
+            level[i] = node;
+            k += node->nkey + 1;
+        }
+    }
+
+    node = level[0];
+
+    free(level);
+    free(mins);
+
+    *heightp = height;
+
+    return node;
+
+ nomem:
+    free(level);
+    free(mins);
+    errno = ENOMEM;
+    return NULL;
+}
+
+
+static void fix_separator(mdb_btree_node_t *node, int i)
+{
+    if (i > 0)
+        node->keys[i - 1] = subtree_min(node->children[i]);
+}
+
+static void borrow_from_left(mdb_btree_node_t *node, int i)
+{
+    mdb_btree_node_t *child = node->children[i];
+    mdb_btree_node_t *left  = node->children[i - 1];
+    int               n     = child->nkey;
+
+    memmove(child->keys + 1, child->keys, n * sizeof(void *));
+
+    if (child->leaf) {
+        memmove(child->data + 1, child->data, n * sizeof(void *));
+        child->keys[0] = left->keys[left->nkey - 1];
+        child->data[0] = left->data[left->nkey - 1];
+        node->keys[i - 1] = child->keys[0];
+    }
+    else {
+        memmove(child->children + 1, child->children, (n+1) * sizeof(void *));
+        child->keys[0]     = node->keys[i - 1];
+        child->children[0] = left->children[left->nkey];
+        node->keys[i - 1]  = left->keys[left->nkey - 1];
+    }
+
+    left->nkey--;
+    child->nkey++;
+}
+
+static void borrow_from_right(mdb_btree_node_t *node, int i)
+{
+    mdb_btree_node_t *child = node->children[i];
+    mdb_btree_node_t *right = node->children[i + 1];
+    int               n     = right->nkey - 1;
+
+    if (child->leaf) {
+        child->keys[child->nkey] = right->keys[0];
+        child->data[child->nkey] = right->data[0];
+        memmove(right->keys, right->keys + 1, n * sizeof(void *));
+        memmove(right->data, right->data + 1, n * sizeof(void *));
+        node->keys[i] = right->keys[0];
+    }
+    else {
+        child->keys[child->nkey]         = node->keys[i];
+        child->children[child->nkey + 1] = right->children[0];
+        node->keys[i] = right->keys[0];
+        memmove(right->keys, right->keys + 1, n * sizeof(void *));
+        memmove(right->children, right->children + 1, (n+1) * sizeof(void *));
+    }
+
+    right->nkey--;
+    child->nkey++;
+}
+
+/* merge children[i+1] into children[i] */
+static void merge_children(mdb_btree_node_t *node, int i)
+{
+    mdb_btree_node_t *left  = node->children[i];
+    mdb_btree_node_t *right = node->children[i + 1];
+    int               n;
+
+    if (left->leaf) {
+        memcpy(left->keys + left->nkey, right->keys,
+               right->nkey * sizeof(void *));
+        memcpy(left->data + left->nkey, right->data,
+               right->nkey * sizeof(void *));
+        left->nkey += right->nkey;
+        left->next  = right->next;
+    }
+    else {
+        left->keys[left->nkey] = node->keys[i];
+        memcpy(left->keys + left->nkey + 1, right->keys,
+               right->nkey * sizeof(void *));
+        memcpy(left->children + left->nkey + 1, right->children,
+               (right->nkey + 1) * sizeof(void *));
+        left->nkey += right->nkey + 1;
+    }
+
+    free(right);
+
+    n = node->nkey - i - 1;
+    memmove(node->keys + i, node->keys + i + 1, n * sizeof(void *));
+    memmove(node->children + i + 1, node->children + i + 2,
+            n * sizeof(void *));
+    node->nkey--;
+}
+
+static void rebalance(mdb_btree_node_t *node, int i)
+{
+    /* the smallest key of the child might have been removed */
+    fix_separator(node, i);
+
+    if (node->children[i]->nkey >= NODE_MIN)
+        return;
+
+    if (i > 0 && node->children[i - 1]->nkey > NODE_MIN)
+        borrow_from_left(node, i);
+    else if (i < node->nkey && node->children[i + 1]->nkey > NODE_MIN)
+        borrow_from_right(node, i);
+    else if (i > 0)
+        merge_children(node, i - 1);
+    else
+        merge_children(node, i);
+}
+
+static void *delete_node(mdb_btree_t *bt, mdb_btree_node_t *node, int klen,
+                         void *key, void *data)
+{
+    void *found;
+    int   lo, hi, i;
+
+    lo = node_bound(bt, node, klen, key, 0);
+
+    if (node->leaf) {
+        for (i = lo;  i < node->nkey;  i++) {
+            if (bt->comp(bt->user_data, klen, node->keys[i], key))
+                break;
+
+            if (!data || node->data[i] == data) {
+                found = node->data[i];
+
+                memmove(node->keys + i, node->keys + i + 1,
+                        (node->nkey - i - 1) * sizeof(void *));
+                memmove(node->data + i, node->data + i + 1,
+                        (node->nkey - i - 1) * sizeof(void *));
+                node->nkey--;
+
+                return found;
+            }
+        }
+
+        return NULL;
+    }
+
+    /* entries with equal keys might be spread over several subtrees */
+    hi = node_bound(bt, node, klen, key, 1);
+
+    for (i = lo;  i <= hi;  i++) {
+        if ((found = delete_node(bt, node->children[i], klen, key, data))) {
+            rebalance(node, i);
+            return found;
+        }
+    }
+
+    return NULL;
+}
+
+void *mdb_btree_delete(mdb_btree_t *bt, int klen, void *key, void *data)
+{
+    mdb_btree_node_t *root;
+    void             *found;
+
+    MDB_CHECKARG(bt && key, NULL);
+
+    if (!bt->root || !(found = delete_node(bt, bt->root, klen, key, data))) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    root = bt->root;
+
+    if (!root->nkey) {
+        if (root->leaf) {
+            bt->root   = NULL;
+            bt->height = 0;
+        }
+        else {
+            bt->root = root->children[0];
+            bt->height--;
+        }
+
+        free(root);
+    }
+
+    bt->nentry--;
+
+    return found;
+}
+
+
+/*
+ * Iterators are invalidated by any change to the tree.
+ */
+void mdb_btree_first(mdb_btree_t *bt, mdb_btree_iter_t *it)
+{
+    mdb_btree_node_t *node;
+
+    MDB_CHECKARG(bt && it,);
+
+    for (node = bt->root;  node && !node->leaf;  node = node->children[0])
+        ;
+
+    it->leaf = node;
+    it->pos  = 0;
+}
+
+/* position at the first entry with a key greater (or equal, if !strict) */
+void mdb_btree_seek(mdb_btree_t *bt, int klen, void *key, int strict,
+                    mdb_btree_iter_t *it)
+{
+    mdb_btree_node_t *node;
+
+    MDB_CHECKARG(bt && key && it,);
+
+    for (node = bt->root;  node && !node->leaf; )
+        node = node->children[node_bound(bt, node, klen, key, strict)];
+
+    it->leaf = node;
+    it->pos  = node ? node_bound(bt, node, klen, key, strict) : 0;
+}
+
+void *mdb_btree_next(mdb_btree_iter_t *it, void **keyp)
+{
+    mdb_btree_node_t *leaf;
+
+    MDB_CHECKARG(it, NULL);
+
+    while ((leaf = it->leaf) && it->pos >= leaf->nkey) {
+        it->leaf = leaf->next;
+        it->pos  = 0;
+    }
+
+    if (!leaf)
+        return NULL;
+
+    if (keyp)
+        *keyp = leaf->keys[it->pos];
+
+    return leaf->data[it->pos++];
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MDB_BTREE_H__
+#define __MDB_BTREE_H__
+
+/*
+ * B+tree of (key, data) pointer pairs
+ *
+ * Entries live in the leaves, which are chained for ordered scans. Equal
+ * keys are allowed and are kept in insertion order. Keys are not copied,
+ * so they must stay valid (and unchanged) while they are in the tree.
+ */
+
+typedef struct mdb_btree_s      mdb_btree_t;
+typedef struct mdb_btree_node_s mdb_btree_node_t;
+
+typedef int (*mdb_btree_compare_t)(void *, int, void *, void *);
+
+typedef struct {
+    mdb_btree_node_t *leaf;
+    int               pos;
+} mdb_btree_iter_t;
+
+
+mdb_btree_t *mdb_btree_create(mdb_btree_compare_t, void *);
+void mdb_btree_destroy(mdb_btree_t *);
+void mdb_btree_reset(mdb_btree_t *);
+int mdb_btree_get_size(mdb_btree_t *);
+
+int mdb_btree_insert(mdb_btree_t *, int, void *, void *);
+int mdb_btree_insert_bulk(mdb_btree_t *, int, int, void **, void **);
+void *mdb_btree_delete(mdb_btree_t *, int, void *, void *);
+
+void mdb_btree_first(mdb_btree_t *, mdb_btree_iter_t *);
+void mdb_btree_seek(mdb_btree_t *, int, void *, int, mdb_btree_iter_t *);
+void *mdb_btree_next(mdb_btree_iter_t *, void **);
+
+
+#endif /* __MDB_BTREE_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
@@ -43,7 +43,9 @@
 #include "column.h"
 #include "index.h"
 #include "table.h"
+#include "intern.h"
 
+static const char *fit_string(mdb_column_t *, const char *, char *);
 static int print_blob(uint8_t *, int data, char *, int);
 
 int mdb_column_write(mdb_column_t      *dst_desc, void *dst_data,
@@ -64,6 +66,25 @@ int mdb_column_write(mdb_column_t      *dst_desc, void *dst_data,
             if(__builtin_expect(*((char**)src) == NULL, 0))
                 src = &empty;
 
+            if (MDB_COLUMN_INTERNED(dst_desc)) {
+                char      buf[MDB_COLUMN_LENGTH_MAX + 1];
+                uint32_t  id, old = *(uint32_t *)dst;
+
+                id = mdb_intern_add(fit_string(dst_desc,*(char **)src,buf));
+
+                if (id == MDB_INTERN_NONE)
+                    goto identical;
+
+                if (id == old) {
+                    mdb_intern_unref(id);
+                    goto identical;
+                }
+
+                *(uint32_t *)dst = id;
+                mdb_intern_unref(old);
+                break;
+            }
+
             if (!**(char **)src && !*(char *)dst)
                 goto identical;
 
@@ -116,6 +137,28 @@ int mdb_column_write(mdb_column_t      *dst_desc, void *dst_data,
 }
 
 
+void mdb_column_write_key(mdb_column_t      *dst_desc, void *dst_data,
+                          mqi_column_desc_t *src_desc, void *src_data)
+{
+    char  buf[MDB_COLUMN_LENGTH_MAX + 1];
+    char *str;
+
+    /*
+     * keys are compared against the rows but never stored, so they
+     * must not hold a reference; a string which is not in the
+     * dictionary will not match any id
+     */
+    if (!dst_desc || !MDB_COLUMN_INTERNED(dst_desc))
+        mdb_column_write(dst_desc, dst_data, src_desc, src_data);
+    else if (dst_data && src_desc && src_desc->offset >= 0 && src_data) {
+        str = *(char **)(src_data + src_desc->offset);
+
+        *(uint32_t *)(dst_data + dst_desc->offset) =
+            mdb_intern_find(fit_string(dst_desc, str ? str : "", buf));
+    }
+}
+
+
 void mdb_column_read(mqi_column_desc_t *dst_desc, void *dst_data,
                      mdb_column_t      *src_desc, void *src_data)
 {
@@ -130,7 +173,10 @@ void mdb_column_read(mqi_column_desc_t *dst_desc, void *dst_data,
         switch (src_desc->type) {
 
         case mqi_varchar:
-            *(char **)dst = (char *)src;
+            if (MDB_COLUMN_INTERNED(src_desc))
+                *(char **)dst = (char *)mdb_intern_string(*(uint32_t *)src);
+            else
+                *(char **)dst = (char *)src;
             break;
 
         case mqi_integer:
@@ -167,7 +213,8 @@ int mdb_column_print_header(mdb_column_t *cdesc, char *buf, int len)
         r = 0;
     else {
         switch (cdesc->type) {
-        case mqi_varchar:  l = cdesc->length;                       break;
+        case mqi_varchar:  l = MDB_COLUMN_INTERNED(cdesc) ?
+                                  cdesc->maxlen : cdesc->length;    break;
         case mqi_integer:  l = 11;                                  break;
         case mqi_unsignd:  l = 11;                                  break;
         case mqi_blob:     l = cdesc->length > 0 ? (cdesc->length * 3) - 1 : 0;
@@ -195,7 +242,13 @@ int mdb_column_print(mdb_column_t *cdesc, void *data, char *buf, int len)
         l = cdesc->length;
 
         switch (cdesc->type) {
-        case mqi_varchar:  r = snprintf(buf,len, "%*s", l, (char *)d);   break;
+        case mqi_varchar:
+            if (MDB_COLUMN_INTERNED(cdesc))
+                r = snprintf(buf,len, "%*s", cdesc->maxlen,
+                             mdb_intern_string(*(uint32_t *)d));
+            else
+                r = snprintf(buf,len, "%*s", l, (char *)d);
+            break;
         case mqi_integer:  r = snprintf(buf,len, "%11d", *(int32_t *)d); break;
         case mqi_unsignd:  r = snprintf(buf,len, " %10u",*(uint32_t*)d); break;
         case mqi_blob:     r = print_blob(d,cdesc->length, buf,len);     break;
@@ -206,6 +259,19 @@ int mdb_column_print(mdb_column_t *cdesc, void *data, char *buf, int len)
     return r;
 }
 
+static const char *fit_string(mdb_column_t *cdesc, const char *str, char *buf)
+{
+    int len = cdesc->maxlen - 1;
+
+    if (strnlen(str, len + 1) <= (size_t)len)
+        return str;
+
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+
+    return buf;
+}
+
 static int print_blob(uint8_t *data, int data_len, char *buf, int buflen)
 {
     MQI_UNUSED(data);
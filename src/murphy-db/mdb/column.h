@@ -43,9 +43,13 @@ typedef struct {
     int              length;
     int              offset;
     uint32_t         flags;
+    int              maxlen;    /* max. string length + 1 if interned */
 } mdb_column_t;
 
+#define MDB_COLUMN_INTERNED(c)  ((c)->flags & MQI_COLUMN_INTERNED)
+
 int mdb_column_write(mdb_column_t *, void *, mqi_column_desc_t *, void *);
+void mdb_column_write_key(mdb_column_t *, void *, mqi_column_desc_t *, void *);
 void mdb_column_read(mqi_column_desc_t *, void *, mdb_column_t *, void *);
 int  mdb_column_print_header(mdb_column_t *, char *, int);
 int  mdb_column_print(mdb_column_t *, void *, char *, int);
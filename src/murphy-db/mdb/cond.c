@@ -46,6 +46,7 @@
 #include "index.h"
 #include "table.h"
 #include "cond.h"
+#include "intern.h"
 
 
 typedef struct {
@@ -61,6 +62,51 @@ typedef struct {
 
 #define PRECEDENCE_DATA 256
 
+/*
+ * instructions of compiled conditions
+ */
+enum {
+    COND_CONST = 0,             /* r = value */
+    COND_COLUMN_INTEGER,        /* r = integer column at offset */
+    COND_COLUMN_UNSIGNED,       /* r = unsigned column at offset */
+    COND_COLUMN_VARCHAR,        /* r = varchar column at offset */
+    COND_COLUMN_INTERNED,       /* r = string of interned column at offset */
+    COND_VARIABLE_INTEGER,      /* r = *var */
+    COND_VARIABLE_UNSIGNED,     /* r = *var */
+    COND_VARIABLE_VARCHAR,      /* r = *var */
+    COND_COMPARE_INTEGER,       /* r = src1 <relop> src2 */
+    COND_COMPARE_UNSIGNED,      /* r = src1 <relop> src2 */
+    COND_COMPARE_VARCHAR,       /* r = src1 <relop> src2 */
+    COND_AND,                   /* r = src1 && src2 */
+    COND_OR,                    /* r = src1 || src2 */
+    COND_NOT,                   /* r = !src1 */
+    COND_NOT_VARCHAR,           /* r = !src1 || !src1[0] */
+    COND_BOOLEAN,               /* r = src1 ? 1 : 0 */
+    COND_BOOLEAN_VARCHAR,       /* r = src1 ? 1 : 0 */
+};
+
+/* relop masks: bit 0 for less, bit 1 for equal, bit 2 for greater */
+#define COND_MASK_LESS    0x1
+#define COND_MASK_EQUAL   0x2
+#define COND_MASK_GREATER 0x4
+
+typedef union {
+    int32_t      integer;
+    uint32_t     unsignd;
+    const char  *varchar;
+} cond_register_t;
+
+typedef struct {
+    mdb_table_t      *tbl;
+    mqi_cond_entry_t *ce;
+    mdb_cond_prog_t  *prog;
+} cond_compiler_t;
+
+typedef struct {
+    mqi_data_type_t  type;      /* type of the value */
+    int              reg;       /* register holding the value */
+} cond_node_t;
+
 typedef struct {
     int                precedence; /* 256 => data, precedence otherwise */
     union {
@@ -76,6 +122,8 @@ static int cond_binary_logicop(mqi_operator_t, cond_stack_t *,
                                cond_stack_t *);
 static int cond_unary_logicop(mqi_operator_t, cond_stack_t *);
 
+static int compile_expression(cond_compiler_t *, int, cond_node_t *);
+
 int mdb_cond_evaluate(mdb_table_t *tbl, mqi_cond_entry_t **cond_ptr,void *data)
 {
     static int precedence[mqi_operator_max] = {
@@ -106,15 +154,17 @@ int mdb_cond_evaluate(mdb_table_t *tbl, mqi_cond_entry_t **cond_ptr,void *data)
         switch (cond->type) {
 
         case mqi_operator:
-            pr  = precedence[cond->u.operator_];
-            sp += cond_eval(sp, lastop, pr);
+            pr = precedence[cond->u.operator_];
+
+            /* a subexpression is an operand, it does not reduce anything */
+            if (cond->u.operator_ != mqi_begin)
+                sp += cond_eval(sp, lastop, pr);
 
             switch (cond->u.operator_) {
 
             case mqi_begin:
                 cond++;
                 result = mdb_cond_evaluate(tbl, &cond, data);
-                cond++;
 
                 sp->data.v.integer = result >= 0 ? result : 0;
                 sp->precedence   = PRECEDENCE_DATA;
@@ -389,6 +439,678 @@ static int cond_unary_logicop(mqi_operator_t op, cond_stack_t *v)
     return 0;
 }
 
+
+static int precedence_of(mqi_cond_entry_t *ce)
+{
+    if (ce->type != mqi_operator)
+        return -1;
+
+    switch (ce->u.operator_) {
+    case mqi_and:                    return 2;
+    case mqi_or:                     return 3;
+    case mqi_less: case mqi_leq:
+    case mqi_eq:   case mqi_geq:
+    case mqi_gt:                     return 4;
+    default:                         return -1;
+    }
+}
+
+static int emit(cond_compiler_t *c, int code, int src1, int src2)
+{
+    mdb_cond_prog_t  *prog = c->prog;
+    mdb_cond_instr_t *instr;
+
+    if (prog->ninstr >= MDB_COND_INSTR_MAX)
+        return -1;
+
+    instr = prog->instr + prog->ninstr;
+
+    memset(instr, 0, sizeof(*instr));
+    instr->code = code;
+    instr->src1 = src1;
+    instr->src2 = src2;
+
+    return prog->ninstr++;
+}
+
+static int emit_const(cond_compiler_t *c, int32_t value, cond_node_t *node)
+{
+    node->type = mqi_integer;
+
+    if ((node->reg = emit(c, COND_CONST, -1, -1)) < 0)
+        return -1;
+
+    c->prog->instr[node->reg].value = value;
+
+    return 0;
+}
+
+/*
+ * Force a node to 0 or 1 the way subexpressions and the whole condition
+ * evaluate in the interpreter, ie. by the truth value of the operand.
+ */
+static int make_boolean(cond_compiler_t *c, cond_node_t *node)
+{
+    int code;
+
+    if (node->type == mqi_varchar)
+        code = COND_BOOLEAN_VARCHAR;
+    else if (c->prog->instr[node->reg].code < COND_COMPARE_INTEGER)
+        code = COND_BOOLEAN;
+    else
+        return 0;         /* comparisons and logical operations yield 0/1 */
+
+    node->type = mqi_integer;
+    node->reg  = emit(c, code, node->reg, -1);
+
+    return node->reg < 0 ? -1 : 0;
+}
+
+static int compile_operand(cond_compiler_t *c, cond_node_t *node)
+{
+    mqi_cond_entry_t *ce = c->ce;
+    mdb_column_t     *col;
+    mqi_variable_t   *var;
+    int               code;
+
+    switch (ce->type) {
+
+    case mqi_column:
+        if (ce->u.column < 0 || ce->u.column >= c->tbl->ncolumn)
+            return -1;
+
+        col = c->tbl->columns + ce->u.column;
+        node->type = col->type;
+
+        /* floating and blob operands are left for the interpreter */
+        switch (col->type) {
+        case mqi_varchar: code = MDB_COLUMN_INTERNED(col) ?
+                              COND_COLUMN_INTERNED : COND_COLUMN_VARCHAR;
+                                                       break;
+        case mqi_integer: code = COND_COLUMN_INTEGER;  break;
+        case mqi_unsignd: code = COND_COLUMN_UNSIGNED; break;
+        default:                                       return -1;
+        }
+
+        if ((node->reg = emit(c, code, -1, -1)) < 0)
+            return -1;
+
+        c->prog->instr[node->reg].offset = col->offset;
+        c->ce++;
+        return 0;
+
+    case mqi_variable:
+        var = &ce->u.variable;
+
+        /* so are unbound variables */
+        if (!var->v.generic)
+            return -1;
+
+        node->type = var->type;
+
+        switch (var->type) {
+        case mqi_varchar: code = COND_VARIABLE_VARCHAR;  break;
+        case mqi_integer: code = COND_VARIABLE_INTEGER;  break;
+        case mqi_unsignd: code = COND_VARIABLE_UNSIGNED; break;
+        default:                                         return -1;
+        }
+
+        if ((node->reg = emit(c, code, -1, -1)) < 0)
+            return -1;
+
+        c->prog->instr[node->reg].var = var->v.generic;
+        c->ce++;
+        return 0;
+
+    case mqi_operator:
+        switch (ce->u.operator_) {
+
+        case mqi_begin:
+            c->ce++;
+
+            if (compile_expression(c, 0, node) < 0)
+                return -1;
+
+            if (c->ce->type != mqi_operator || c->ce->u.operator_ != mqi_end)
+                return -1;
+
+            c->ce++;
+
+            return make_boolean(c, node);
+
+        case mqi_not:
+            c->ce++;
+
+            if (compile_operand(c, node) < 0)
+                return -1;
+
+            code = (node->type == mqi_varchar) ? COND_NOT_VARCHAR : COND_NOT;
+
+            node->type = mqi_integer;
+            node->reg  = emit(c, code, node->reg, -1);
+
+            return node->reg < 0 ? -1 : 0;
+
+        default:
+            return -1;
+        }
+
+    default:
+        return -1;
+    }
+}
+
+/*
+ * Equality of an interned column with another interned column or with a
+ * variable is decided by the ids, the latter looked up when compiling;
+ * a string which is not in the dictionary cannot match any row.
+ */
+static int compile_interned_eq(cond_compiler_t *c,
+                               cond_node_t *lhs, cond_node_t *rhs)
+{
+    mdb_cond_instr_t *l = c->prog->instr + lhs->reg;
+    mdb_cond_instr_t *r = c->prog->instr + rhs->reg;
+    mdb_cond_instr_t *col, *var;
+    const char       *str;
+
+    if (lhs->type != mqi_varchar)
+        return 0;
+
+    if (l->code == COND_COLUMN_INTERNED && r->code == COND_COLUMN_INTERNED) {
+        l->code = r->code = COND_COLUMN_UNSIGNED;
+        return 1;
+    }
+
+    if (l->code == COND_COLUMN_INTERNED && r->code == COND_VARIABLE_VARCHAR)
+        col = l, var = r;
+    else if (r->code == COND_COLUMN_INTERNED && l->code==COND_VARIABLE_VARCHAR)
+        col = r, var = l;
+    else
+        return 0;
+
+    str = *(const char **)var->var;
+
+    col->code  = COND_COLUMN_UNSIGNED;
+    var->code  = COND_CONST;
+    var->value = (int32_t)mdb_intern_find(str ? str : "");
+
+    return 1;
+}
+
+static int compile_binary(cond_compiler_t *c, mqi_operator_t op,
+                          cond_node_t *lhs, cond_node_t *rhs)
+{
+    int code, mask;
+
+    if (lhs->type != rhs->type)
+        return emit_const(c, 0, lhs);
+
+    mask = 0;
+
+    switch (op) {
+    case mqi_and:
+    case mqi_or:
+        if (lhs->type != mqi_integer && lhs->type != mqi_unsignd)
+            return emit_const(c, 0, lhs);
+        code = (op == mqi_and) ? COND_AND : COND_OR;
+        break;
+
+    case mqi_less: mask = COND_MASK_LESS;                     goto relop;
+    case mqi_leq:  mask = COND_MASK_LESS | COND_MASK_EQUAL;   goto relop;
+    case mqi_eq:   mask = COND_MASK_EQUAL;                    goto relop;
+    case mqi_geq:  mask = COND_MASK_GREATER | COND_MASK_EQUAL; goto relop;
+    case mqi_gt:   mask = COND_MASK_GREATER;                  goto relop;
+    relop:
+        if (op == mqi_eq && compile_interned_eq(c, lhs, rhs)) {
+            code = COND_COMPARE_UNSIGNED;
+            break;
+        }
+
+        switch (lhs->type) {
+        case mqi_varchar: code = COND_COMPARE_VARCHAR;  break;
+        case mqi_integer: code = COND_COMPARE_INTEGER;  break;
+        default:          code = COND_COMPARE_UNSIGNED; break;
+        }
+        break;
+
+    default:
+        return -1;
+    }
+
+    lhs->type = mqi_integer;
+
+    if ((lhs->reg = emit(c, code, lhs->reg, rhs->reg)) < 0)
+        return -1;
+
+    c->prog->instr[lhs->reg].mask = mask;
+
+    return 0;
+}
+
+/*
+ * Precedence climbing with the same precedences and the same (right)
+ * associativity as the interpreter in mdb_cond_evaluate().
+ */
+static int compile_expression(cond_compiler_t *c, int min, cond_node_t *node)
+{
+    cond_node_t     rhs;
+    mqi_operator_t  op;
+    int             pr;
+
+    if (compile_operand(c, node) < 0)
+        return -1;
+
+    while ((pr = precedence_of(c->ce)) >= min && pr > 0) {
+        op = c->ce->u.operator_;
+        c->ce++;
+
+        if (compile_expression(c, pr, &rhs) < 0)
+            return -1;
+
+        if (compile_binary(c, op, node, &rhs) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int operand_of(mdb_cond_prog_t *prog, int reg)
+{
+    switch (prog->instr[reg].code) {
+    case COND_CONST:
+    case COND_VARIABLE_INTEGER:
+    case COND_VARIABLE_UNSIGNED:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static int column_of(mdb_cond_prog_t *prog, int reg)
+{
+    switch (prog->instr[reg].code) {
+    case COND_COLUMN_INTEGER:
+    case COND_COLUMN_UNSIGNED:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Check whether a comparison is a column compared to a value. Returns
+ * the register of the column or -1, with the register of the value and
+ * the mask as seen with the column on the left.
+ */
+static int compare_term(mdb_cond_prog_t *prog, int reg, int *valp, int *maskp)
+{
+    mdb_cond_instr_t *instr = prog->instr + reg;
+    int               mask  = instr->mask;
+
+    if (instr->code != COND_COMPARE_INTEGER &&
+        instr->code != COND_COMPARE_UNSIGNED)
+        return -1;
+
+    if (column_of(prog, instr->src1) && operand_of(prog, instr->src2)) {
+        *valp  = instr->src2;
+        *maskp = mask;
+        return instr->src1;
+    }
+
+    if (column_of(prog, instr->src2) && operand_of(prog, instr->src1)) {
+        *valp  = instr->src1;
+        *maskp = (mask & COND_MASK_EQUAL) |
+            ((mask & COND_MASK_LESS)    ? COND_MASK_GREATER : 0) |
+            ((mask & COND_MASK_GREATER) ? COND_MASK_LESS    : 0);
+        return instr->src2;
+    }
+
+    return -1;
+}
+
+static int collect_in_list(mdb_cond_prog_t *prog, int reg,
+                           mdb_cond_term_t *t)
+{
+    mdb_cond_instr_t *instr = prog->instr + reg;
+    int               col, val, mask, sign;
+
+    if (instr->code == COND_OR)
+        return collect_in_list(prog, instr->src1, t) &&
+            collect_in_list(prog, instr->src2, t);
+
+    if ((col = compare_term(prog, reg, &val, &mask)) < 0)
+        return 0;
+
+    sign = (instr->code == COND_COMPARE_INTEGER);
+
+    if (mask != COND_MASK_EQUAL || t->nvalue >= MDB_COND_IN_MAX)
+        return 0;
+
+    if (t->nvalue == 0) {
+        t->offset = prog->instr[col].offset;
+        t->sign   = sign;
+    }
+    else if (t->offset != prog->instr[col].offset || t->sign != sign)
+        return 0;
+
+    t->value[t->nvalue++] = val;
+
+    return 1;
+}
+
+static int add_term(mdb_cond_prog_t *prog, int reg)
+{
+    mdb_cond_instr_t *instr = prog->instr + reg;
+    mdb_cond_term_t  *t;
+    int               col, val, mask;
+
+    if (prog->nterm >= MDB_COND_TERM_MAX)
+        return 0;
+
+    t = prog->term + prog->nterm;
+    memset(t, 0, sizeof(*t));
+
+    if (instr->code == COND_OR) {
+        if (!collect_in_list(prog, reg, t))
+            return 0;
+    }
+    else {
+        if ((col = compare_term(prog, reg, &val, &mask)) < 0)
+            return 0;
+
+        t->offset   = prog->instr[col].offset;
+        t->sign     = (instr->code == COND_COMPARE_INTEGER);
+        t->mask     = mask;
+        t->value[0] = val;
+    }
+
+    prog->nterm++;
+
+    return 1;
+}
+
+static void collect_terms(mdb_cond_prog_t *prog, int reg)
+{
+    mdb_cond_instr_t *instr = prog->instr + reg;
+
+    if (instr->code == COND_AND) {
+        collect_terms(prog, instr->src1);
+        collect_terms(prog, instr->src2);
+    }
+    else if (!add_term(prog, reg))
+        prog->exact = 0;
+}
+
+int mdb_cond_compile(mdb_table_t      *tbl,
+                     mqi_cond_entry_t *cond,
+                     mdb_cond_prog_t  *prog)
+{
+    cond_compiler_t c;
+    cond_node_t     root;
+
+    MDB_CHECKARG(tbl && cond && prog, -1);
+
+    prog->tbl      = tbl;
+    prog->cond     = cond;
+    prog->compiled = 0;
+    prog->result   = -1;
+    prog->ninstr   = 0;
+    prog->exact    = 0;
+    prog->nterm    = 0;
+
+    c.tbl  = tbl;
+    c.ce   = cond;
+    c.prog = prog;
+
+    if (compile_expression(&c, 0, &root) < 0 ||
+        c.ce->type != mqi_operator || c.ce->u.operator_ != mqi_end)
+    {
+        /* leave it to the interpreter */
+        prog->ninstr = 0;
+        return 0;
+    }
+
+    if (make_boolean(&c, &root) < 0) {
+        prog->ninstr = 0;
+        return 0;
+    }
+
+    prog->result   = root.reg;
+    prog->compiled = 1;
+    prog->exact    = 1;
+
+    collect_terms(prog, root.reg);
+
+    return 0;
+}
+
+static inline int compare_varchar(const char *s1, const char *s2)
+{
+    if (s1 == s2)
+        return 0;
+    else if (!s1 || !s2)
+        return (s1 ? 1 : 0) - (s2 ? 1 : 0);
+    else
+        return strcmp(s1, s2);
+}
+
+#define COMPARE(a, b)  ((a) < (b) ? COND_MASK_LESS :                  \
+                        ((a) == (b) ? COND_MASK_EQUAL : COND_MASK_GREATER))
+
+int mdb_cond_execute(mdb_cond_prog_t *prog, void *data)
+{
+    cond_register_t   reg[MDB_COND_INSTR_MAX];
+    mdb_cond_instr_t *instr;
+    cond_register_t  *r, *s1, *s2;
+    mqi_cond_entry_t *ce;
+    int               cmp, i;
+
+    MDB_CHECKARG(prog && data, -1);
+
+    if (!prog->compiled) {
+        ce = prog->cond;
+        return mdb_cond_evaluate(prog->tbl, &ce, data);
+    }
+
+    for (i = 0, instr = prog->instr;  i < prog->ninstr;  i++, instr++) {
+        r  = reg + i;
+        s1 = reg + instr->src1;
+        s2 = reg + instr->src2;
+
+        switch (instr->code) {
+        case COND_CONST:
+            r->integer = instr->value;
+            break;
+
+        case COND_COLUMN_INTEGER:
+            r->integer = *(int32_t *)(data + instr->offset);
+            break;
+        case COND_COLUMN_UNSIGNED:
+            r->unsignd = *(uint32_t *)(data + instr->offset);
+            break;
+        case COND_COLUMN_VARCHAR:
+            r->varchar = (const char *)(data + instr->offset);
+            break;
+        case COND_COLUMN_INTERNED:
+            r->varchar = mdb_intern_string(*(uint32_t *)(data+instr->offset));
+            break;
+
+        case COND_VARIABLE_INTEGER:
+            r->integer = *(int32_t *)instr->var;
+            break;
+        case COND_VARIABLE_UNSIGNED:
+            r->unsignd = *(uint32_t *)instr->var;
+            break;
+        case COND_VARIABLE_VARCHAR:
+            r->varchar = *(const char **)instr->var;
+            break;
+
+        case COND_COMPARE_INTEGER:
+            cmp = COMPARE(s1->integer, s2->integer);
+            r->integer = (instr->mask & cmp) ? 1 : 0;
+            break;
+        case COND_COMPARE_UNSIGNED:
+            cmp = COMPARE(s1->unsignd, s2->unsignd);
+            r->integer = (instr->mask & cmp) ? 1 : 0;
+            break;
+        case COND_COMPARE_VARCHAR:
+            cmp = compare_varchar(s1->varchar, s2->varchar);
+            cmp = COMPARE(cmp, 0);
+            r->integer = (instr->mask & cmp) ? 1 : 0;
+            break;
+
+        case COND_AND:
+            r->integer = s1->unsignd && s2->unsignd;
+            break;
+        case COND_OR:
+            r->integer = s1->unsignd || s2->unsignd;
+            break;
+        case COND_NOT:
+            r->integer = s1->unsignd ? 0 : 1;
+            break;
+        case COND_NOT_VARCHAR:
+            r->integer = s1->varchar && s1->varchar[0] ? 0 : 1;
+            break;
+        case COND_BOOLEAN:
+            r->integer = s1->unsignd ? 1 : 0;
+            break;
+        case COND_BOOLEAN_VARCHAR:
+            r->integer = s1->varchar ? 1 : 0;
+            break;
+
+        default:
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    return reg[prog->result].integer ? 1 : 0;
+}
+
+/*
+ * Block scanning: the terms of the condition are checked column-wise
+ * for a block of rows at a time, by branch-free loops over a contiguous
+ * copy of the column that the compiler can vectorize. Signed values are
+ * biased to make their order unsigned, so a range check is a single
+ * unsigned comparison. Rows passing the terms are checked with the full
+ * program if the terms are not the whole condition.
+ */
+
+#define SIGN_BIAS 0x80000000U
+
+static inline uint32_t term_value(mdb_cond_prog_t *prog, int reg)
+{
+    mdb_cond_instr_t *instr = prog->instr + reg;
+
+    if (instr->code == COND_CONST)
+        return (uint32_t)instr->value;
+    else
+        return *(uint32_t *)instr->var;
+}
+
+static int term_range(mdb_cond_term_t *t, uint32_t v,
+                      uint32_t *lop, uint32_t *hip)
+{
+    uint32_t lo = 0, hi = UINT32_MAX;
+
+    if (t->mask & COND_MASK_EQUAL)
+        lo = hi = v;
+
+    if (t->mask & COND_MASK_LESS) {
+        lo = 0;
+        if (!(t->mask & COND_MASK_EQUAL)) {
+            if (v == 0)
+                return 0;
+            hi = v - 1;
+        }
+    }
+
+    if (t->mask & COND_MASK_GREATER) {
+        hi = UINT32_MAX;
+        if (!(t->mask & COND_MASK_EQUAL)) {
+            if (v == UINT32_MAX)
+                return 0;
+            lo = v + 1;
+        }
+    }
+
+    *lop = lo;
+    *hip = hi;
+
+    return 1;
+}
+
+static int scan_term(mdb_cond_prog_t *prog, mdb_cond_term_t *t,
+                     mdb_row_t **rows, int nrow, uint8_t *sel)
+{
+    uint32_t col[MDB_COND_BLOCK];
+    uint8_t  hit[MDB_COND_BLOCK];
+    uint32_t bias = t->sign ? SIGN_BIAS : 0;
+    uint32_t lo, hi, span, v;
+    int      i, j;
+
+    for (i = 0; i < nrow; i++)
+        col[i] = *(uint32_t *)(rows[i]->data + t->offset) ^ bias;
+
+    if (t->nvalue == 0) {
+        if (!term_range(t, term_value(prog, t->value[0]) ^ bias, &lo, &hi))
+            return 0;
+
+        span = hi - lo;
+
+        for (i = 0; i < nrow; i++)
+            sel[i] &= (col[i] - lo) <= span;
+    }
+    else {
+        memset(hit, 0, nrow);
+
+        for (j = 0; j < t->nvalue; j++) {
+            v = term_value(prog, t->value[j]) ^ bias;
+
+            for (i = 0; i < nrow; i++)
+                hit[i] |= col[i] == v;
+        }
+
+        for (i = 0; i < nrow; i++)
+            sel[i] &= hit[i];
+    }
+
+    return 1;
+}
+
+/*
+ * Evaluate the condition for a block of at most MDB_COND_BLOCK rows.
+ * sel[i] is set to 1 for the rows that match and to 0 for the rest,
+ * including rows the condition cannot be evaluated for. Returns the
+ * number of matching rows.
+ */
+int mdb_cond_scan(mdb_cond_prog_t *prog, mdb_row_t **rows, int nrow,
+                  uint8_t *sel)
+{
+    int i, n;
+
+    MDB_CHECKARG(prog && rows && sel &&
+                 nrow >= 0 && nrow <= MDB_COND_BLOCK, -1);
+
+    memset(sel, 1, nrow);
+
+    for (i = 0; i < prog->nterm; i++) {
+        if (!scan_term(prog, prog->term + i, rows, nrow, sel)) {
+            memset(sel, 0, nrow);
+            return 0;
+        }
+    }
+
+    for (i = 0, n = 0; i < nrow; i++) {
+        if (sel[i] && !prog->exact)
+            sel[i] = mdb_cond_execute(prog, rows[i]->data) > 0;
+
+        n += sel[i];
+    }
+
+    return n;
+}
+
 /*
  * Local Variables:
  * c-basic-offset: 4
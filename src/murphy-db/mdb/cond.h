@@ -32,9 +32,65 @@
 
 #include <murphy-db/mqi-types.h>
 #include <murphy-db/mdb.h>
+#include "row.h"
+
+
+#define MDB_COND_INSTR_MAX  (2 * (MQI_COND_MAX + 1))
+#define MDB_COND_TERM_MAX   8   /* scan terms of a condition, at most */
+#define MDB_COND_IN_MAX     8   /* values of an IN-list term, at most */
+#define MDB_COND_BLOCK      64  /* rows scanned in one go, at most */
+
+typedef struct mdb_cond_prog_s mdb_cond_prog_t;
+
+/*
+ * A condition compiled to a linear register program. Every instruction
+ * stores its result to the register with the same index as the
+ * instruction itself, so the program needs no register allocation.
+ */
+typedef struct {
+    int              code;      /* operation, see cond.c */
+    int              mask;      /* comparisons: accepted results */
+    int              src1;      /* register of the 1st operand */
+    int              src2;      /* register of the 2nd operand */
+    union {
+        int          offset;    /* column loads: offset in the row */
+        void        *var;       /* variable loads: the variable */
+        int32_t      value;     /* constants */
+    };
+} mdb_cond_instr_t;
+
+/*
+ * A conjunct of the condition the block scanner can check by itself: an
+ * integer or unsigned column compared to a constant or a variable (a
+ * range), or equality of a column to any of a few values (an IN-list,
+ * ie. an or of equalities). The values are taken from the registers of
+ * the operands when scanning, as variables can change between scans.
+ */
+typedef struct {
+    int              offset;    /* offset of the column in the row */
+    int              sign;      /* whether the comparison is signed */
+    int              mask;      /* ranges: accepted results, column 1st */
+    int              nvalue;    /* 0 for ranges, length of IN-lists */
+    int              value[MDB_COND_IN_MAX]; /* registers of the values */
+} mdb_cond_term_t;
+
+struct mdb_cond_prog_s {
+    mdb_table_t      *tbl;
+    mqi_cond_entry_t *cond;     /* fallback if the compilation failed */
+    int               compiled;
+    int               result;   /* register of the result */
+    int               ninstr;
+    mdb_cond_instr_t  instr[MDB_COND_INSTR_MAX];
+    int               exact;    /* whether the terms are the condition */
+    int               nterm;
+    mdb_cond_term_t   term[MDB_COND_TERM_MAX];
+};
 
 
 int mdb_cond_evaluate(mdb_table_t *, mqi_cond_entry_t **, void *);
+int mdb_cond_compile(mdb_table_t *, mqi_cond_entry_t *, mdb_cond_prog_t *);
+int mdb_cond_execute(mdb_cond_prog_t *, void *);
+int mdb_cond_scan(mdb_cond_prog_t *, mdb_row_t **, int, uint8_t *);
 
 
 #endif /* __MDB_COND_H__ */
@@ -35,6 +35,8 @@
 
 #define _GNU_SOURCE
 #include <string.h>
+#include <unistd.h>
+#include <sys/auxv.h>
 
 #include <murphy-db/assert.h>
 #include <murphy-db/hash.h>
@@ -44,9 +46,14 @@
 #define HASH_STATISTICS
 #endif
 
+#define HASH_GROW_LOAD     2    /* grow above this many entries per chain */
+#define HASH_SHRINK_LOAD   8    /* shrink below 1/this entries per chain */
+#define HASH_REHASH_STEP   4    /* chains to rehash per insert/delete */
+
 typedef struct mdb_hash_entry_s {
     mdb_dlist_t  clink;         /* hash link, ie. chaining */
     mdb_dlist_t  elink;         /* entry link, ie. linking all entries */
+    int          klen;          /* key length, needed for rehashing */
     void        *key;
     void        *data;
 } hash_entry_t;
@@ -69,13 +76,28 @@ struct mdb_hash_s {
     mdb_hash_print_t     hprint;
     struct {
         mdb_dlist_t head;
+        int         count;
 #ifdef HASH_STATISTICS
         int         curr;
         int         max;
 #endif
     }                    entries;
+    int                  min_nchain; /* do not shrink below this */
+    int                  reserved;   /* do not shrink while reserved */
+    struct {                         /* chains being rehashed, if any */
+        hash_chain_t    *chains;
+        int              nchain;
+        int              bits;
+        int              next;       /* next chain to rehash */
+    }                    old;
+#ifdef HASH_STATISTICS
+    struct {
+        int              grow;
+        int              shrink;
+    }                    resize;
+#endif
     int                  nchain;
-    hash_chain_t         chains[0];
+    hash_chain_t        *chains;
 };
 
 
@@ -118,31 +140,136 @@ static table_size_t  sizes[]          = {
     {  877, 10}, {  881, 10}, {  883, 10}, {  887, 10}, {  907, 10},
     {  911, 10}, {  919, 10}, {  929, 10}, {  937, 10}, {  941, 10},
     {  947, 10}, {  953, 10}, {  967, 10}, {  971, 10}, {  977, 10},
-    {  983, 10}, {  991, 10}, {  997, 10}, {65535, 16}
-};
-static uint32_t  charmap[256] = {
-    /*        00  01  02  03  04  05  06  07  08  09  0a  0b  0c  0d  0e  0f */
-    /* 00 */   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
-    /* 10 */   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
-    /* 20 */   0,  0,  0,  0,  0,  0,  0,  0, 52, 53, 54, 55, 56, 37, 40, 50,
-    /* 30 */   1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 41,  0, 42, 43, 44, 45,
-    /* 40 */  46, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25,
-    /* 50 */  26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 47, 48, 49, 51, 38,
-    /* 60 */   0, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25,
-    /* 70 */  26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 57, 58, 59, 60,  0,
-    /* 80 */   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
-    /* 90 */   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
-    /* a0 */   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
-    /* b0 */   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
-    /* c0 */   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
-    /* d0 */   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
-    /* e0 */   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
-    /* f0 */   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0
+    {  983, 10}, {  991, 10}, {  997, 10}, { 1021, 10}, { 2039, 11},
+    { 4093, 12}, { 8191, 13}, {16381, 14}, {32749, 15}, {65521, 16},
+    {65535, 16}
 };
 
+/*
+ * wyhash-style multiply-mix hashing for strings and blobs, seeded per
+ * process. Every input byte contributes, unlike the old 33x+c scheme
+ * which folded case and lost the leading bytes of long keys. Inputs
+ * longer than 48 bytes are consumed in three independent lanes.
+ */
+#define HASH_P0 0xa0761d6478bd642fULL
+#define HASH_P1 0xe7037ed1a0b428dbULL
+#define HASH_P2 0x8ebc6af09c88c6e3ULL
+#define HASH_P3 0x589965cc75374cc3ULL
+
+static uint64_t hash_seed = HASH_P3;
+
+static inline void hash_mum(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)*a * *b;
+
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t  = rl + (rm0 << 32), c = t < rl, lo, hi;
+
+    lo  = t + (rm1 << 32);
+    c  += lo < t;
+    hi  = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    *a  = lo;
+    *b  = hi;
+#endif
+}
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b)
+{
+    hash_mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t hash_r8(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hash_r4(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t hash_bytes(const void *data, size_t size)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint64_t       seed, a, b, s1, s2;
+    size_t         i;
+
+    seed = hash_seed ^ hash_mix(hash_seed ^ HASH_P0, HASH_P1);
+
+    if (size <= 16) {
+        if (size >= 4) {
+            i = (size >> 3) << 2;
+            a = (hash_r4(p) << 32) | hash_r4(p + i);
+            b = (hash_r4(p + size - 4) << 32) | hash_r4(p + size - 4 - i);
+        }
+        else if (size > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[size >> 1] << 8) |
+                p[size - 1];
+            b = 0;
+        }
+        else
+            a = b = 0;
+    }
+    else {
+        i = size;
+
+        if (i > 48) {
+            s1 = s2 = seed;
+            do {
+                seed = hash_mix(hash_r8(p)      ^ HASH_P1, hash_r8(p +  8) ^ seed);
+                s1   = hash_mix(hash_r8(p + 16) ^ HASH_P2, hash_r8(p + 24) ^ s1);
+                s2   = hash_mix(hash_r8(p + 32) ^ HASH_P3, hash_r8(p + 40) ^ s2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= s1 ^ s2;
+        }
+
+        while (i > 16) {
+            seed = hash_mix(hash_r8(p) ^ HASH_P1, hash_r8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+
+        a = hash_r8(p + i - 16);
+        b = hash_r8(p + i - 8);
+    }
+
+    a ^= HASH_P1;
+    b ^= seed;
+    hash_mum(&a, &b);
+
+    return hash_mix(a ^ HASH_P0 ^ size, b ^ HASH_P1);
+}
+
+static void __attribute__((constructor)) hash_init_seed(void)
+{
+    uint64_t s = (uint64_t)getpid() ^ (uint64_t)(uintptr_t)&s;
+    const uint8_t *rnd = (const uint8_t *)getauxval(AT_RANDOM);
+
+    if (rnd != NULL)
+        memcpy(&s, rnd, sizeof(s));
+
+    hash_seed = hash_mix(s ^ HASH_P0, HASH_P2);
+}
+
 static void htable_reset(mdb_hash_t *, int);
 static table_size_t *get_table_size(int);
-static int print_chain(mdb_hash_t *, int, char *, int);
+static int print_chain(mdb_hash_t *, hash_chain_t *, int, char *, int);
+static hash_entry_t *find_entry(mdb_hash_t *, int, void *, hash_chain_t **);
+static void rehash_start(mdb_hash_t *, int);
+static void rehash_step(mdb_hash_t *, int);
+static void check_load(mdb_hash_t *);
 
 
 mdb_hash_t *mdb_hash_table_create(int                  max_entries,
@@ -152,7 +279,6 @@ mdb_hash_t *mdb_hash_table_create(int                  max_entries,
 {
     mdb_hash_t   *htbl;
     table_size_t *ts;
-    size_t        size;
     int           i;
 
     MDB_CHECKARG(hfunc && hcomp && hprint &&
@@ -163,19 +289,20 @@ mdb_hash_t *mdb_hash_table_create(int                  max_entries,
         return NULL;
     }
 
-    size = sizeof(mdb_hash_t) + sizeof(hash_chain_t) * ts->nchain;
-    htbl = calloc(1, size);
-
-    if (!htbl) {
+    if (!(htbl = calloc(1, sizeof(mdb_hash_t))) ||
+        !(htbl->chains = calloc(ts->nchain, sizeof(hash_chain_t))))
+    {
+        free(htbl);
         errno = ENOMEM;
         return NULL;
     }
 
-    htbl->bits   = ts->bits;
-    htbl->nchain = ts->nchain;
-    htbl->hfunc  = hfunc;
-    htbl->hcomp  = hcomp;
-    htbl->hprint = hprint;
+    htbl->bits       = ts->bits;
+    htbl->nchain     = ts->nchain;
+    htbl->min_nchain = ts->nchain;
+    htbl->hfunc      = hfunc;
+    htbl->hcomp      = hcomp;
+    htbl->hprint     = hprint;
 
     MDB_DLIST_INIT(htbl->entries.head);
 
@@ -190,6 +317,7 @@ int mdb_hash_table_destroy(mdb_hash_t *htbl)
     MDB_CHECKARG(htbl, -1);
 
     htable_reset(htbl, 0);
+    free(htbl->chains);
     free(htbl);
 
     return 0;
@@ -245,9 +373,70 @@ int mdb_hash_table_print(mdb_hash_t *htbl, char *buf, int len)
             || htbl->chains[i].entries.max > 0
 #endif
             )
-            p += print_chain(htbl, i, p, e-p);
+            p += print_chain(htbl, htbl->chains + i, i, p, e-p);
+    }
+
+    if (htbl->old.chains && p < e) {
+        p += snprintf(p, e-p, "   being rehashed:\n");
+
+        for (i = htbl->old.next;  i < htbl->old.nchain && p < e;  i++) {
+            if (!MDB_DLIST_EMPTY(htbl->old.chains[i].head))
+                p += print_chain(htbl, htbl->old.chains + i, i, p, e-p);
+        }
+    }
+
+    return p - buf;
+}
+
+int mdb_hash_table_print_statistics(mdb_hash_t *htbl, char *buf, int len)
+{
+    hash_chain_t *chain;
+    hash_entry_t *entry;
+    char *p, *e;
+    int   nentry, nused, depth, maxdepth;
+    int   i;
+
+    MDB_CHECKARG(htbl && buf && len > 0, 0);
+
+    e = (p = buf) + len;
+    *buf = '\0';
+
+    nentry = nused = maxdepth = 0;
+
+    for (i = 0;  i < htbl->nchain;  i++) {
+        chain = htbl->chains + i;
+        depth = 0;
+
+        MDB_DLIST_FOR_EACH(hash_entry_t, clink, entry, &chain->head)
+            depth++;
+
+        if (depth > 0)
+            nused++;
+        if (depth > maxdepth)
+            maxdepth = depth;
+
+        nentry += depth;
     }
 
+    p += snprintf(p, e-p, "   chains: %d, %d in use, %d entries\n",
+                  htbl->nchain, nused, nentry);
+
+    if (p < e)
+        p += snprintf(p, e-p, "   chain depth: %d.%02d average, %d max\n",
+                      nused ? nentry / nused : 0,
+                      nused ? (nentry * 100 / nused) % 100 : 0,
+                      maxdepth);
+#ifdef HASH_STATISTICS
+    if (p < e)
+        p += snprintf(p, e-p, "   entries: %d, %d max\n"
+                      "   resized: grown %d, shrunk %d times\n",
+                      htbl->entries.curr, htbl->entries.max,
+                      htbl->resize.grow, htbl->resize.shrink);
+#endif
+    if (htbl->old.chains && p < e)
+        p += snprintf(p, e-p, "   rehashing: %d of %d old chains done\n",
+                      htbl->old.next, htbl->old.nchain);
+
     return p - buf;
 }
 
@@ -259,17 +448,14 @@ int mdb_hash_add(mdb_hash_t *htbl, int klen, void *key, void *data)
 
     MDB_CHECKARG(htbl && key && klen >= 0 && data, -1);
 
-    index = htbl->hfunc(htbl->bits, htbl->nchain, klen, key);
-    chain = htbl->chains + index;
+    rehash_step(htbl, HASH_REHASH_STEP);
 
-    MDB_DLIST_FOR_EACH(hash_entry_t, clink, entry, &chain->head) {
-        if (htbl->hcomp(klen, key, entry->key) == 0) {
-            if (data == entry->data)
-                return 0;
-            else {
-                errno = EEXIST;
-                return -1;
-            }
+    if ((entry = find_entry(htbl, klen, key, NULL))) {
+        if (data == entry->data)
+            return 0;
+        else {
+            errno = EEXIST;
+            return -1;
         }
     }
 
@@ -277,12 +463,18 @@ int mdb_hash_add(mdb_hash_t *htbl, int klen, void *key, void *data)
         errno = ENOMEM;
         return -1;
     }
+    entry->klen = klen;
     entry->key  = key;
     entry->data = data;
 
+    index = htbl->hfunc(htbl->bits, htbl->nchain, klen, key);
+    chain = htbl->chains + index;
+
     MDB_DLIST_APPEND(hash_entry_t, clink, entry, &chain->head);
     MDB_DLIST_APPEND(hash_entry_t, elink, entry, &htbl->entries.head);
 
+    htbl->entries.count++;
+
 #ifdef HASH_STATISTICS
     if (++chain->entries.curr > chain->entries.max)
         chain->entries.max = chain->entries.curr;
@@ -291,61 +483,85 @@ int mdb_hash_add(mdb_hash_t *htbl, int klen, void *key, void *data)
         htbl->entries.max = htbl->entries.curr;
 #endif
 
+    check_load(htbl);
+
+    return 0;
+}
+
+/*
+ * Make room for nentry more entries with a single resize instead of the
+ * stepwise growing of the individual insertions, and keep the table from
+ * shrinking until the reservation is released with nentry == 0.
+ */
+int mdb_hash_reserve(mdb_hash_t *htbl, int nentry)
+{
+    int nchain;
+
+    MDB_CHECKARG(htbl && nentry >= 0, -1);
+
+    if (!(htbl->reserved = nentry))
+        return 0;
+
+    nchain = (htbl->entries.count + nentry) / HASH_GROW_LOAD;
+
+    if (nchain > 65535)
+        nchain = 65535;
+
+    if (nchain > htbl->nchain) {
+        rehash_step(htbl, htbl->old.nchain);
+        rehash_start(htbl, nchain);
+        rehash_step(htbl, htbl->old.nchain);
+    }
+
     return 0;
 }
 
 void *mdb_hash_delete(mdb_hash_t *htbl, int klen, void *key)
 {
     hash_entry_t *entry;
-    hash_entry_t *n;
     hash_chain_t *chain;
-    int           index;
     void         *data;
 
     MDB_CHECKARG(htbl && klen >= 0 && key, NULL);
 
-    index = htbl->hfunc(htbl->bits, htbl->nchain, klen, key);
-    chain = htbl->chains + index;
+    rehash_step(htbl, HASH_REHASH_STEP);
 
-    MDB_DLIST_FOR_EACH_SAFE(hash_entry_t, clink, entry,n, &chain->head) {
-        if (htbl->hcomp(klen, key, entry->key) == 0) {
-            if (!(data = entry->data))
-                break;
+    if (!(entry = find_entry(htbl, klen, key, &chain)) ||
+        !(data = entry->data))
+    {
+        errno = ENOENT;
+        return NULL;
+    }
 
-            MDB_DLIST_UNLINK(hash_entry_t, clink, entry);
-            MDB_DLIST_UNLINK(hash_entry_t, elink, entry);
-            free(entry);
+    MDB_DLIST_UNLINK(hash_entry_t, clink, entry);
+    MDB_DLIST_UNLINK(hash_entry_t, elink, entry);
+    free(entry);
+
+    htbl->entries.count--;
 
 #ifdef HASH_STATISTICS
-            if (--chain->entries.curr < 0)
-                chain->entries.curr = 0;
+    if (--chain->entries.curr < 0)
+        chain->entries.curr = 0;
 
-            if (--htbl->entries.curr < 0)
-                htbl->entries.curr = 0;
+    if (--htbl->entries.curr < 0)
+        htbl->entries.curr = 0;
+#else
+    (void)chain;
 #endif
-            return data;
-        }
-    }
 
-    errno = ENOENT;
-    return NULL;
+    check_load(htbl);
+
+    return data;
 }
 
 void *mdb_hash_get_data(mdb_hash_t *htbl, int klen, void *key)
 {
     hash_entry_t *entry;
-    hash_chain_t *chain;
-    int           index;
 
     MDB_CHECKARG(htbl && klen >= 0 && key, NULL);
 
-    index = htbl->hfunc(htbl->bits, htbl->nchain, klen, key);
-    chain = htbl->chains + index;
-
-    MDB_DLIST_FOR_EACH(hash_entry_t, clink, entry, &chain->head) {
-        if (htbl->hcomp(klen, key, entry->key) == 0)
-            return entry->data;
-    }
+    if ((entry = find_entry(htbl, klen, key, NULL)))
+        return entry->data;
 
     errno = ENOENT;
     return NULL;
@@ -375,38 +591,16 @@ int mdb_hash_function_unsignd(int bits, int nchain, int klen, void *key)
 
 int mdb_hash_function_string(int bits, int nchain, int klen, void *key)
 {
-    typedef union {
-        uint64_t wide;
-        uint8_t  narrow[8];
-    } hash_t;
+    const char *varchar = (const char *)key;
+    int         hashval = 0;
 
     (void)klen;
 
-    uint8_t *varchar = (uint8_t *)key;
-    int      hashval = 0;
-    hash_t   h;
-    int      shift;
-
     if (varchar && bits >= 1 && bits <= 16 &&
         nchain > (1 << (bits-1)) && nchain < (1 << bits))
     {
-        uint8_t s;
-        int     i;
-
-        for (h.wide = 0; (s = *varchar); varchar++)
-            h.wide = 33ULL * h.wide + (uint64_t)charmap[s];
-
-        if (bits <= 8) {
-            hashval = h.narrow[0] ^ h.narrow[1] ^ h.narrow[2] ^ h.narrow[3] ^
-                      h.narrow[4] ^ h.narrow[5] ^ h.narrow[6] ^ h.narrow[7];
-        }
-        else {
-            shift = (nchain + 7) / 8;
-            for (hashval = h.narrow[0], i = 1;   i < 8;  i++)
-                hashval ^= h.narrow[i] << (i * shift);
-        }
-
-        hashval %= nchain;
+        hashval = (int)(hash_bytes(varchar, strlen(varchar)) %
+                        (uint64_t)nchain);
     }
 
     return hashval;
@@ -437,34 +631,12 @@ int mdb_hash_function_varchar(int bits, int nchain, int klen, void *key)
 
 int mdb_hash_function_blob(int bits, int nchain, int klen, void *key)
 {
-    typedef union {
-        uint64_t wide;
-        uint8_t  narrow[8];
-    } hash_t;
-
-    uint8_t *data  = (uint8_t *)key;
-    int      hashval = 0;
-    hash_t   h;
-    int      shift;
-    int      i;
-
-    if (klen > 0 && data && bits >= 1 && bits <= 16 &&
+    int hashval = 0;
+
+    if (klen > 0 && key && bits >= 1 && bits <= 16 &&
         nchain > (1 << (bits-1)) && nchain < (1 << bits))
     {
-        for (i = 0, h.wide = 0;   i < klen;   i++)
-            h.wide = 33ULL * h.wide + (uint64_t)data[i];
-
-        if (bits <= 8) {
-            hashval = h.narrow[0] ^ h.narrow[1] ^ h.narrow[2] ^ h.narrow[3] ^
-                      h.narrow[4] ^ h.narrow[5] ^ h.narrow[6] ^ h.narrow[7];
-        }
-        else {
-            shift = (nchain + 7) / 8;
-            for (hashval = h.narrow[0], i = 1;   i < 8;  i++)
-                hashval ^= h.narrow[i] << (i * shift);
-        }
-
-        hashval %= nchain;
+        hashval = (int)(hash_bytes(key, (size_t)klen) % (uint64_t)nchain);
     }
 
     return hashval;
@@ -479,7 +651,7 @@ static void htable_reset(mdb_hash_t *htbl, int do_chain_statistics)
 #ifdef HASH_STATISTICS
     int i;
 #else
-    (void)do_statistics;
+    (void)do_chain_statistics;
 #endif
 
     MDB_DLIST_FOR_EACH_SAFE(hash_entry_t, elink, entry,n, &htbl->entries.head){
@@ -488,6 +660,11 @@ static void htable_reset(mdb_hash_t *htbl, int do_chain_statistics)
         free(entry);
     }
 
+    htbl->entries.count = 0;
+
+    free(htbl->old.chains);
+    memset(&htbl->old, 0, sizeof(htbl->old));
+
 #ifdef HASH_STATISTICS
     if (do_chain_statistics) {
         for (i = 0;   i < htbl->nchain;   i++) {
@@ -537,9 +714,145 @@ static table_size_t *get_table_size(int max_entries)
     return sizes + idx;
 }
 
-static int print_chain(mdb_hash_t *htbl, int index, char *buf, int len)
+static hash_entry_t *find_entry(mdb_hash_t    *htbl,
+                                int            klen,
+                                void          *key,
+                                hash_chain_t **chain_ret)
+{
+    hash_entry_t *entry;
+    hash_chain_t *chain;
+    int           index;
+
+    index = htbl->hfunc(htbl->bits, htbl->nchain, klen, key);
+    chain = htbl->chains + index;
+
+    MDB_DLIST_FOR_EACH(hash_entry_t, clink, entry, &chain->head) {
+        if (htbl->hcomp(klen, key, entry->key) == 0)
+            goto found;
+    }
+
+    if (htbl->old.chains) {
+        index = htbl->hfunc(htbl->old.bits, htbl->old.nchain, klen, key);
+
+        if (index >= htbl->old.next) {
+            chain = htbl->old.chains + index;
+
+            MDB_DLIST_FOR_EACH(hash_entry_t, clink, entry, &chain->head) {
+                if (htbl->hcomp(klen, key, entry->key) == 0)
+                    goto found;
+            }
+        }
+    }
+
+    return NULL;
+
+ found:
+    if (chain_ret)
+        *chain_ret = chain;
+
+    return entry;
+}
+
+/*
+ * Resizing is done incrementally: the new chains take over at once and
+ * every subsequent insertion and deletion moves a few of the old chains
+ * over until all of them have been rehashed.
+ */
+static void rehash_start(mdb_hash_t *htbl, int max_entries)
+{
+    table_size_t *ts;
+    hash_chain_t *chains;
+    int           i;
+
+    if (!(ts = get_table_size(max_entries)) || ts->nchain == htbl->nchain)
+        return;
+
+    if (htbl->old.chains)
+        rehash_step(htbl, htbl->old.nchain);
+
+    if (!(chains = calloc(ts->nchain, sizeof(hash_chain_t))))
+        return;                 /* not fatal, we just stay at this size */
+
+#ifdef HASH_STATISTICS
+    if (ts->nchain > htbl->nchain)
+        htbl->resize.grow++;
+    else
+        htbl->resize.shrink++;
+#endif
+
+    htbl->old.chains  = htbl->chains;
+    htbl->old.nchain  = htbl->nchain;
+    htbl->old.bits    = htbl->bits;
+    htbl->old.next    = 0;
+
+    htbl->chains = chains;
+    htbl->nchain = ts->nchain;
+    htbl->bits   = ts->bits;
+
+    for (i = 0;  i < htbl->nchain;  i++)
+        MDB_DLIST_INIT(htbl->chains[i].head);
+}
+
+static void rehash_step(mdb_hash_t *htbl, int nchain)
+{
+    hash_chain_t *chain, *nc;
+    hash_entry_t *entry, *n;
+    int           index;
+
+    if (!htbl->old.chains)
+        return;
+
+    while (nchain-- > 0 && htbl->old.next < htbl->old.nchain) {
+        chain = htbl->old.chains + htbl->old.next++;
+
+        MDB_DLIST_FOR_EACH_SAFE(hash_entry_t, clink, entry,n, &chain->head) {
+            index = htbl->hfunc(htbl->bits,htbl->nchain, entry->klen,entry->key);
+            nc    = htbl->chains + index;
+
+            MDB_DLIST_UNLINK(hash_entry_t, clink, entry);
+            MDB_DLIST_APPEND(hash_entry_t, clink, entry, &nc->head);
+
+#ifdef HASH_STATISTICS
+            if (++nc->entries.curr > nc->entries.max)
+                nc->entries.max = nc->entries.curr;
+#endif
+        }
+    }
+
+    if (htbl->old.next >= htbl->old.nchain) {
+        free(htbl->old.chains);
+        memset(&htbl->old, 0, sizeof(htbl->old));
+    }
+}
+
+static void check_load(mdb_hash_t *htbl)
+{
+    int count = htbl->entries.count;
+    int size;
+
+    if (htbl->old.chains)
+        return;                 /* one resize at a time */
+
+    if (count > HASH_GROW_LOAD * htbl->nchain) {
+        if (htbl->nchain < 65535)
+            rehash_start(htbl, 2 * htbl->nchain);
+    }
+    else if (htbl->nchain > htbl->min_nchain && !htbl->reserved &&
+             count * HASH_SHRINK_LOAD < htbl->nchain)
+    {
+        if ((size = 2 * count) < htbl->min_nchain)
+            size = htbl->min_nchain;
+
+        rehash_start(htbl, size);
+    }
+}
+
+static int print_chain(mdb_hash_t   *htbl,
+                       hash_chain_t *chain,
+                       int           index,
+                       char         *buf,
+                       int           len)
 {
-    hash_chain_t *chain = htbl->chains + index;
     hash_entry_t *entry;
     char *p, *e;
     char key[256];
@@ -54,6 +54,12 @@
 #define INDEX_HASH_RESET(ix)        mdb_hash_table_reset(ix->hash)
 #define INDEX_SEQUENCE_RESET(ix)    mdb_sequence_table_reset(ix->sequence)
 
+#define SECONDARY_ALL_COLUMNS       NULL
+#define SECONDARY_BUCKETS_MIN       16
+
+static void reset_secondary(mdb_secindex_t *);
+static void flush_bulk(mdb_index_t *);
+
 
 
 int mdb_index_create(mdb_table_t *tbl, char **index_columns)
@@ -83,7 +89,7 @@ int mdb_index_create(mdb_table_t *tbl, char **index_columns)
         col->flags |= MQI_COLUMN_KEY;
 
         if (i == 0) {
-            type = col->type;
+            type = MDB_COLUMN_INTERNED(col) ? mqi_unsignd : col->type;
             beg  = col->offset;
             end  = beg + col->length;
         }
@@ -180,7 +186,8 @@ void mdb_index_drop(mdb_table_t *tbl)
 
 void mdb_index_reset(mdb_table_t *tbl)
 {
-    mdb_index_t *ix;
+    mdb_index_t    *ix;
+    mdb_secindex_t *si;
 
     MDB_CHECKARG(tbl,);
 
@@ -190,13 +197,16 @@ void mdb_index_reset(mdb_table_t *tbl)
         INDEX_HASH_RESET(ix);
         INDEX_SEQUENCE_RESET(ix);
     }
+
+    for (si = tbl->secondary;  si;  si = si->next)
+        reset_secondary(si);
 }
 
 
-int mdb_index_insert(mdb_table_t   *tbl,
-                     mdb_row_t     *row,
-                     mqi_bitfld_t   cmask,
-                     int            ignore)
+int mdb_index_insert(mdb_table_t        *tbl,
+                     mdb_row_t          *row,
+                     const mqi_bitfld_t *cmask,
+                     int                 ignore)
 {
     mdb_index_t    *ix;
     int             lgh;
@@ -210,8 +220,11 @@ int mdb_index_insert(mdb_table_t   *tbl,
 
     ix = &tbl->index;
 
-    if (!MDB_INDEX_DEFINED(ix))
+    if (!MDB_INDEX_DEFINED(ix)) {
+        if (mdb_index_insert_secondary(tbl, row, SECONDARY_ALL_COLUMNS) < 0)
+            return -1;
         return 1;               /* fake a sucessful insertion */
+    }
 
     hash = ix->hash;
     seq  = ix->sequence;
@@ -219,7 +232,17 @@ int mdb_index_insert(mdb_table_t   *tbl,
     key  = (void *)row->data + ix->offset;
 
     if (mdb_hash_add(hash, lgh,key, row) == 0) {
-        mdb_sequence_add(seq, lgh,key, row);
+        if (ix->bulk.rows) {
+            if (ix->bulk.nrow >= ix->bulk.size)
+                flush_bulk(ix);
+            ix->bulk.rows[ix->bulk.nrow++] = row;
+        }
+        else
+            mdb_sequence_add(seq, lgh,key, row);
+
+        if (mdb_index_insert_secondary(tbl, row, SECONDARY_ALL_COLUMNS) < 0)
+            return -1;
+
         return 1;
     }
 
@@ -236,6 +259,9 @@ int mdb_index_insert(mdb_table_t   *tbl,
             return -1;
         }
 
+        /* the duplicate might be one of the rows added in bulk */
+        flush_bulk(ix);
+
         if (!(old = mdb_hash_delete(hash, lgh,key)) ||
             (old != mdb_sequence_delete(seq, lgh,key)))
         {
@@ -244,6 +270,8 @@ int mdb_index_insert(mdb_table_t   *tbl,
             return -1;
         }
         else {
+            mdb_index_delete_secondary(tbl, old, SECONDARY_ALL_COLUMNS);
+
             if (mdb_row_delete(tbl, old, 0,0) < 0 ||
                 mdb_log_change(tbl, txdepth, mdb_log_update,cmask,old,row) < 0)
             {
@@ -253,6 +281,9 @@ int mdb_index_insert(mdb_table_t   *tbl,
 
             mdb_hash_add(hash, lgh,key, row);
             mdb_sequence_add(seq, lgh,key, row);
+
+            if (mdb_index_insert_secondary(tbl,row,SECONDARY_ALL_COLUMNS) < 0)
+                return -1;
         }
     }
     else { /* duplicate insertion is an error. keep the original row */
@@ -264,6 +295,74 @@ int mdb_index_insert(mdb_table_t   *tbl,
     return 0;
 }
 
+/*
+ * While inserting in bulk the hash is sized for all the rows at once and
+ * adding the rows to the sequence is deferred, so that they are merged
+ * into it in a single sorted pass.
+ */
+int mdb_index_bulk_begin(mdb_table_t *tbl, int nrow)
+{
+    mdb_index_t *ix;
+
+    MDB_CHECKARG(tbl && nrow > 0, -1);
+
+    ix = &tbl->index;
+
+    if (!MDB_INDEX_DEFINED(ix) || ix->bulk.rows)
+        return 0;
+
+    ix->bulk.rows = malloc(nrow * sizeof(*ix->bulk.rows));
+    ix->bulk.keys = malloc(nrow * sizeof(*ix->bulk.keys));
+
+    if (!ix->bulk.rows || !ix->bulk.keys) {
+        free(ix->bulk.rows);
+        free(ix->bulk.keys);
+        memset(&ix->bulk, 0, sizeof(ix->bulk));
+        errno = ENOMEM;
+        return -1;
+    }
+
+    ix->bulk.nrow = 0;
+    ix->bulk.size = nrow;
+
+    mdb_hash_reserve(ix->hash, nrow);
+
+    return 0;
+}
+
+void mdb_index_bulk_end(mdb_table_t *tbl)
+{
+    mdb_index_t *ix;
+
+    MDB_CHECKARG(tbl,);
+
+    ix = &tbl->index;
+
+    if (!ix->bulk.rows)
+        return;
+
+    flush_bulk(ix);
+    mdb_hash_reserve(ix->hash, 0);
+
+    free(ix->bulk.rows);
+    free(ix->bulk.keys);
+    memset(&ix->bulk, 0, sizeof(ix->bulk));
+}
+
+static void flush_bulk(mdb_index_t *ix)
+{
+    int lgh = ix->length;
+    int i;
+
+    for (i = 0;  i < ix->bulk.nrow;  i++)
+        ix->bulk.keys[i] = (void *)ix->bulk.rows[i]->data + ix->offset;
+
+    mdb_sequence_add_bulk(ix->sequence, lgh, ix->bulk.nrow,
+                          ix->bulk.keys, (void **)ix->bulk.rows);
+
+    ix->bulk.nrow = 0;
+}
+
 int mdb_index_delete(mdb_table_t *tbl, mdb_row_t *row)
 {
     mdb_index_t    *ix;
@@ -276,6 +375,8 @@ int mdb_index_delete(mdb_table_t *tbl, mdb_row_t *row)
 
     ix = &tbl->index;
 
+    mdb_index_delete_secondary(tbl, row, SECONDARY_ALL_COLUMNS);
+
     if (!MDB_INDEX_DEFINED(ix))
         return 0;
 
@@ -336,6 +437,464 @@ int mdb_index_print(mdb_table_t *tbl, char *buf, int len)
 }
 
 
+/*
+ * secondary indexes
+ */
+
+static int column_compare(mdb_column_t *col, void *a, void *b)
+{
+    switch (col->type) {
+    case mqi_varchar:
+        if (MDB_COLUMN_INTERNED(col))     /* only compared for equality */
+            return *(uint32_t *)a != *(uint32_t *)b;
+        return strncmp((char *)a, (char *)b, col->length);
+    case mqi_integer:
+        return *(int32_t *)a < *(int32_t *)b ? -1 :
+            (*(int32_t *)a > *(int32_t *)b ? 1 : 0);
+    case mqi_unsignd:
+        return *(uint32_t *)a < *(uint32_t *)b ? -1 :
+            (*(uint32_t *)a > *(uint32_t *)b ? 1 : 0);
+    case mqi_floating:
+        return *(double *)a < *(double *)b ? -1 :
+            (*(double *)a > *(double *)b ? 1 : 0);
+    default:
+        return memcmp(a, b, col->length);
+    }
+}
+
+static int key_compare(mdb_table_t *tbl, mdb_secindex_t *si, int ncolumn,
+                       void *a, void *b)
+{
+    mdb_column_t *col;
+    int           i, cmp;
+
+    for (i = 0;  i < ncolumn;  i++) {
+        col = tbl->columns + si->columns[i];
+
+        if ((cmp = column_compare(col, a + col->offset, b + col->offset)))
+            return cmp;
+    }
+
+    return 0;
+}
+
+static uint32_t key_hash(mdb_table_t *tbl, mdb_secindex_t *si, void *data)
+{
+    mdb_column_t *col;
+    uint8_t      *p;
+    uint32_t      h;
+    int           i, j, len;
+
+    for (h = 2166136261U, i = 0;  i < si->ncolumn;  i++) {
+        col = tbl->columns + si->columns[i];
+        p   = (uint8_t *)data + col->offset;
+
+        if (col->type == mqi_varchar && !MDB_COLUMN_INTERNED(col))
+            len = strnlen((char *)p, col->length);
+        else
+            len = col->length;
+
+        for (j = 0;  j < len;  j++)
+            h = (h ^ p[j]) * 16777619U;
+
+        h = (h ^ 0xff) * 16777619U;
+    }
+
+    return h;
+}
+
+static int secondary_compare(void *user_data, int ncolumn, void *a, void *b)
+{
+    mdb_secindex_t *si = (mdb_secindex_t *)user_data;
+
+    return key_compare(si->table, si, ncolumn, a, b);
+}
+
+static int rehash_secondary(mdb_table_t *tbl, mdb_secindex_t *si, int nbucket)
+{
+    mdb_secentry_t **buckets, *e, *n, **tail;
+    int              i;
+
+    MQI_UNUSED(tbl);
+
+    if (!(buckets = calloc(nbucket, sizeof(*buckets)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* keep the relative order of the entries with the same key */
+    for (i = 0;  i < si->nbucket;  i++) {
+        for (e = si->buckets[i];  e;  e = n) {
+            n = e->next;
+            e->next = NULL;
+
+            for (tail = buckets + (e->hash % nbucket);  *tail; )
+                tail = &(*tail)->next;
+
+            *tail = e;
+        }
+    }
+
+    free(si->buckets);
+    si->buckets = buckets;
+    si->nbucket = nbucket;
+
+    return 0;
+}
+
+static int add_to_secondary(mdb_table_t *tbl, mdb_secindex_t *si,
+                            mdb_row_t *row)
+{
+    mdb_secentry_t  *e, **tail;
+
+    if (si->type == mqi_index_hash) {
+        if (si->nentry >= 2 * si->nbucket &&
+            rehash_secondary(tbl, si, 2 * si->nbucket) < 0)
+            return -1;
+
+        if (!(e = calloc(1, sizeof(*e)))) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        e->hash = key_hash(tbl, si, row->data);
+        e->row  = row;
+
+        for (tail = si->buckets + (e->hash % si->nbucket);  *tail; )
+            tail = &(*tail)->next;
+
+        *tail = e;
+        si->nentry++;
+    }
+    else {
+        if (mdb_btree_insert(si->tree, si->ncolumn, row->data, row) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static void remove_from_secondary(mdb_table_t *tbl, mdb_secindex_t *si,
+                                  mdb_row_t *row)
+{
+    mdb_secentry_t **prev, *e;
+    uint32_t         hash;
+
+    if (si->type == mqi_index_hash) {
+        hash = key_hash(tbl, si, row->data);
+
+        for (prev = si->buckets + (hash % si->nbucket);  (e = *prev); ) {
+            if (e->row == row) {
+                *prev = e->next;
+                free(e);
+                si->nentry--;
+                return;
+            }
+            prev = &e->next;
+        }
+    }
+    else
+        mdb_btree_delete(si->tree, si->ncolumn, row->data, row);
+}
+
+static void reset_secondary(mdb_secindex_t *si)
+{
+    mdb_secentry_t *e, *n;
+    int             i;
+
+    for (i = 0;  i < si->nbucket;  i++) {
+        for (e = si->buckets[i];  e;  e = n) {
+            n = e->next;
+            free(e);
+        }
+        si->buckets[i] = NULL;
+    }
+
+    si->nentry = 0;
+
+    if (si->tree)
+        mdb_btree_reset(si->tree);
+}
+
+static void free_secondary(mdb_secindex_t *si)
+{
+    if (si) {
+        reset_secondary(si);
+        free(si->buckets);
+        mdb_btree_destroy(si->tree);
+        free(si->columns);
+        free(si->name);
+        free(si);
+    }
+}
+
+int mdb_index_create_secondary(mdb_table_t      *tbl,
+                               char             *name,
+                               mqi_index_type_t  type,
+                               char            **index_columns)
+{
+    mdb_secindex_t  *si, **tail;
+    mdb_row_t       *row;
+    int              i, idx;
+
+    MDB_CHECKARG(tbl && name && index_columns && index_columns[0], -1);
+    MDB_CHECKARG(type == mqi_index_hash || type == mqi_index_ordered, -1);
+
+    for (tail = &tbl->secondary;  *tail;  tail = &(*tail)->next) {
+        if (!strcmp((*tail)->name, name)) {
+            errno = EEXIST;
+            return -1;
+        }
+    }
+
+    if (!(si = calloc(1, sizeof(*si)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (i = 0;  index_columns[i];  i++)
+        ;
+
+    si->type    = type;
+    si->name    = strdup(name);
+    si->columns = calloc(i, sizeof(*si->columns));
+
+    if (!si->name || !si->columns)
+        goto nomem;
+
+    for (i = 0;  index_columns[i];  i++) {
+        if (i >= MQI_COLUMN_MAX ||
+            !(idx = mdb_hash_get_data(tbl->chash,0,index_columns[i]) - NULL))
+        {
+            free_secondary(si);
+            errno = ENOENT;
+            return -1;
+        }
+
+        si->columns[i] = --idx;
+        mqi_bitfld_set(&si->cmask, idx);
+
+        /* interned strings are not ordered by their ids */
+        if (type == mqi_index_ordered && MDB_COLUMN_INTERNED(tbl->columns+idx)) {
+            free_secondary(si);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    si->ncolumn = i;
+
+    if (type == mqi_index_hash) {
+        si->nbucket = SECONDARY_BUCKETS_MIN;
+
+        if (!(si->buckets = calloc(si->nbucket, sizeof(*si->buckets))))
+            goto nomem;
+    }
+    else {
+        si->table = tbl;
+
+        if (!(si->tree = mdb_btree_create(secondary_compare, si)))
+            goto nomem;
+    }
+
+    MDB_DLIST_FOR_EACH(mdb_row_t, link, row, &tbl->rows) {
+        if (add_to_secondary(tbl, si, row) < 0)
+            goto nomem;
+    }
+
+    *tail = si;
+
+    return 0;
+
+ nomem:
+    free_secondary(si);
+    errno = ENOMEM;
+    return -1;
+}
+
+int mdb_index_drop_secondary(mdb_table_t *tbl, char *name)
+{
+    mdb_secindex_t **prev, *si;
+
+    MDB_CHECKARG(tbl && name, -1);
+
+    for (prev = &tbl->secondary;  (si = *prev);  prev = &si->next) {
+        if (!strcmp(si->name, name)) {
+            *prev = si->next;
+            free_secondary(si);
+            return 0;
+        }
+    }
+
+    errno = ENOENT;
+    return -1;
+}
+
+void mdb_index_drop_secondaries(mdb_table_t *tbl)
+{
+    mdb_secindex_t *si, *n;
+
+    MDB_CHECKARG(tbl,);
+
+    for (si = tbl->secondary;  si;  si = n) {
+        n = si->next;
+        free_secondary(si);
+    }
+
+    tbl->secondary = NULL;
+}
+
+int mdb_index_insert_secondary(mdb_table_t        *tbl,
+                               mdb_row_t          *row,
+                               const mqi_bitfld_t *cmask)
+{
+    mdb_secindex_t *si;
+
+    MDB_CHECKARG(tbl && row, -1);
+
+    for (si = tbl->secondary;  si;  si = si->next) {
+        if ((!cmask || mqi_bitfld_overlap(&si->cmask, cmask)) &&
+            add_to_secondary(tbl, si, row) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+int mdb_index_delete_secondary(mdb_table_t        *tbl,
+                               mdb_row_t          *row,
+                               const mqi_bitfld_t *cmask)
+{
+    mdb_secindex_t *si;
+
+    MDB_CHECKARG(tbl && row, -1);
+
+    for (si = tbl->secondary;  si;  si = si->next) {
+        if (!cmask || mqi_bitfld_overlap(&si->cmask, cmask))
+            remove_from_secondary(tbl, si, row);
+    }
+
+    return 0;
+}
+
+/* collect the rows from the iterator up to (and maybe including) end */
+static int collect_rows(mdb_secindex_t *si, mdb_btree_iter_t *it, int ncolumn,
+                        void *end, int inclusive, mdb_row_t ***rowsp)
+{
+    mdb_row_t **rows, **tmp, *row;
+    void       *key;
+    int         n, nalloc, cmp;
+
+    rows   = NULL;
+    nalloc = 0;
+
+    for (n = 0;  (row = mdb_btree_next(it, &key));  n++) {
+        if (end) {
+            cmp = key_compare(si->table, si, ncolumn, key, end);
+
+            if (cmp > 0 || (cmp == 0 && !inclusive))
+                break;
+        }
+
+        if (n >= nalloc) {
+            nalloc = nalloc ? 2 * nalloc : 8;
+
+            if (!(tmp = realloc(rows, nalloc * sizeof(*rows)))) {
+                free(rows);
+                errno = ENOMEM;
+                return -1;
+            }
+
+            rows = tmp;
+        }
+
+        rows[n] = row;
+    }
+
+    *rowsp = rows;
+
+    return n;
+}
+
+/*
+ * Look up the rows where all the index columns match the ones in key. The
+ * key is laid out like the data of a row of the table. The returned array
+ * of rows is owned by the caller.
+ */
+int mdb_index_secondary_lookup(mdb_table_t     *tbl,
+                               mdb_secindex_t  *si,
+                               void            *key,
+                               mdb_row_t     ***rowsp)
+{
+    mdb_secentry_t   *e;
+    mdb_row_t       **rows, **tmp;
+    mdb_btree_iter_t  it;
+    uint32_t          hash;
+    int               n, nalloc;
+
+    MDB_CHECKARG(tbl && si && key && rowsp, -1);
+
+    if (si->type == mqi_index_ordered) {
+        mdb_btree_seek(si->tree, si->ncolumn, key, 0, &it);
+
+        return collect_rows(si, &it, si->ncolumn, key, 1, rowsp);
+    }
+
+    hash   = key_hash(tbl, si, key);
+    rows   = NULL;
+    nalloc = 0;
+
+    for (n = 0, e = si->buckets[hash % si->nbucket];  e;  e = e->next) {
+        if (e->hash != hash ||
+            key_compare(tbl, si, si->ncolumn, e->row->data, key))
+            continue;
+
+        if (n >= nalloc) {
+            nalloc = nalloc ? 2 * nalloc : 8;
+
+            if (!(tmp = realloc(rows, nalloc * sizeof(*rows)))) {
+                free(rows);
+                errno = ENOMEM;
+                return -1;
+            }
+
+            rows = tmp;
+        }
+
+        rows[n++] = e->row;
+    }
+
+    *rowsp = rows;
+
+    return n;
+}
+
+/*
+ * Look up the rows where the first column of an ordered index is in the
+ * given range. Either end of the range can be omitted by passing NULL.
+ */
+int mdb_index_secondary_range(mdb_table_t     *tbl,
+                              mdb_secindex_t  *si,
+                              void            *low,
+                              int              low_inclusive,
+                              void            *high,
+                              int              high_inclusive,
+                              mdb_row_t     ***rowsp)
+{
+    mdb_btree_iter_t it;
+
+    MDB_CHECKARG(tbl && si && rowsp, -1);
+    MDB_CHECKARG(si->type == mqi_index_ordered, -1);
+
+    if (low)
+        mdb_btree_seek(si->tree, 1, low, !low_inclusive, &it);
+    else
+        mdb_btree_first(si->tree, &it);
+
+    return collect_rows(si, &it, 1, high, high_inclusive, rowsp);
+}
+
+
 /*
  * Local Variables:
  * c-basic-offset: 4
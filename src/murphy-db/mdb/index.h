@@ -37,6 +37,7 @@
 #include <murphy-db/mdb.h>
 
 #include "row.h"
+#include "btree.h"
 
 #define MDB_INDEX_LENGTH_MAX 8192
 
@@ -50,17 +51,65 @@ typedef struct {
     mdb_sequence_t  *sequence;
     int              ncolumn;
     int             *columns;   /* sorted */
+    struct {                    /* bulk insertion, see mdb_index_bulk_begin */
+        mdb_row_t  **rows;      /* rows not yet in the sequence */
+        void       **keys;
+        int          nrow;
+        int          size;
+    } bulk;
 } mdb_index_t;
 
+typedef struct mdb_secentry_s mdb_secentry_t;
+typedef struct mdb_secindex_s mdb_secindex_t;
+
+struct mdb_secentry_s {
+    mdb_secentry_t  *next;
+    uint32_t         hash;
+    mdb_row_t       *row;
+};
+
+/*
+ * secondary indexes are non-unique: hash indexes chain the rows with
+ * the same key, ordered indexes keep the rows sorted by the key columns
+ */
+struct mdb_secindex_s {
+    mdb_secindex_t   *next;
+    char             *name;
+    mqi_index_type_t  type;
+    int               ncolumn;
+    int              *columns;  /* in definition order */
+    mqi_bitfld_t      cmask;    /* mask of index columns */
+    mdb_secentry_t  **buckets;  /* hash index */
+    int               nbucket;
+    int               nentry;
+    mdb_btree_t      *tree;     /* ordered index */
+    mdb_table_t      *table;    /* for comparing the keys in the tree */
+};
+
 
 int mdb_index_create(mdb_table_t *, char **);
 void mdb_index_drop(mdb_table_t *);
 void mdb_index_reset(mdb_table_t *);
-int mdb_index_insert(mdb_table_t *, mdb_row_t *, mqi_bitfld_t, int);
+int mdb_index_insert(mdb_table_t *, mdb_row_t *, const mqi_bitfld_t *, int);
 int mdb_index_delete(mdb_table_t *, mdb_row_t *);
+int mdb_index_bulk_begin(mdb_table_t *, int);
+void mdb_index_bulk_end(mdb_table_t *);
 mdb_row_t *mdb_index_get_row(mdb_table_t *, int, void *);
 int mdb_index_print(mdb_table_t *, char *, int);
 
+int mdb_index_create_secondary(mdb_table_t *, char *, mqi_index_type_t,
+                               char **);
+int mdb_index_drop_secondary(mdb_table_t *, char *);
+void mdb_index_drop_secondaries(mdb_table_t *);
+int mdb_index_insert_secondary(mdb_table_t *, mdb_row_t *,
+                               const mqi_bitfld_t *);
+int mdb_index_delete_secondary(mdb_table_t *, mdb_row_t *,
+                               const mqi_bitfld_t *);
+int mdb_index_secondary_lookup(mdb_table_t *, mdb_secindex_t *, void *,
+                               mdb_row_t ***);
+int mdb_index_secondary_range(mdb_table_t *, mdb_secindex_t *,
+                              void *, int, void *, int, mdb_row_t ***);
+
 
 #endif /* __MDB_INDEX_H__ */
 
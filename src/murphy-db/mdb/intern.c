@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define _GNU_SOURCE
+#include <string.h>
+
+#include <murphy-db/assert.h>
+#include <murphy-db/hash.h>
+#include "intern.h"
+
+#define INTERN_HASH_CHAINS  1024
+#define INTERN_ALLOC_MIN    64
+
+typedef struct {
+    uint32_t  id;
+    uint32_t  refs;
+    char      str[0];
+} entry_t;
+
+static mdb_hash_t  *hash;                /* string => entry */
+static entry_t    **entries;             /* id => entry, slot 0 unused */
+static uint32_t     nentry = 1;          /* ids handed out so far */
+static uint32_t     nalloc;
+static uint32_t    *freeids;             /* ids of freed entries */
+static uint32_t     nfree;
+static int          count;
+
+
+uint32_t mdb_intern_add(const char *str)
+{
+    entry_t  *e;
+    void     *p;
+    uint32_t  id, n;
+    size_t    len;
+
+    if (!str || !*str)
+        return MDB_INTERN_EMPTY;
+
+    if (!hash && !(hash = MDB_HASH_TABLE_CREATE(string, INTERN_HASH_CHAINS)))
+        return MDB_INTERN_NONE;
+
+    if ((e = mdb_hash_get_data(hash, 0,(void *)str))) {
+        e->refs++;
+        return e->id;
+    }
+
+    if (nfree > 0)
+        id = freeids[--nfree];
+    else {
+        if (nentry >= nalloc) {
+            n = nalloc ? 2 * nalloc : INTERN_ALLOC_MIN;
+
+            if (!(p = realloc(entries, sizeof(entries[0]) * n))) {
+                errno = ENOMEM;
+                return MDB_INTERN_NONE;
+            }
+
+            entries = p;
+
+            if (!(p = realloc(freeids, sizeof(freeids[0]) * n))) {
+                errno = ENOMEM;
+                return MDB_INTERN_NONE;
+            }
+
+            freeids = p;
+            nalloc  = n;
+        }
+
+        id = nentry++;
+    }
+
+    len = strlen(str) + 1;
+
+    if (!(e = malloc(sizeof(*e) + len)))
+        goto failed;
+
+    e->id   = id;
+    e->refs = 1;
+    memcpy(e->str, str, len);
+
+    if (mdb_hash_add(hash, 0,e->str, e) < 0) {
+        free(e);
+        goto failed;
+    }
+
+    entries[id] = e;
+    count++;
+
+    return id;
+
+ failed:
+    freeids[nfree++] = id;
+    errno = ENOMEM;
+    return MDB_INTERN_NONE;
+}
+
+
+uint32_t mdb_intern_find(const char *str)
+{
+    entry_t *e;
+
+    if (!str)
+        return MDB_INTERN_NONE;
+
+    if (!*str)
+        return MDB_INTERN_EMPTY;
+
+    if (!hash || !(e = mdb_hash_get_data(hash, 0,(void *)str)))
+        return MDB_INTERN_NONE;
+
+    return e->id;
+}
+
+
+void mdb_intern_ref(uint32_t id)
+{
+    if (id != MDB_INTERN_EMPTY && id < nentry && entries[id])
+        entries[id]->refs++;
+}
+
+
+void mdb_intern_unref(uint32_t id)
+{
+    entry_t *e;
+
+    if (id == MDB_INTERN_EMPTY || id >= nentry || !(e = entries[id]))
+        return;
+
+    if (--e->refs > 0)
+        return;
+
+    mdb_hash_delete(hash, 0,e->str);
+    entries[id] = NULL;
+    freeids[nfree++] = id;
+    count--;
+
+    free(e);
+}
+
+
+const char *mdb_intern_string(uint32_t id)
+{
+    if (id != MDB_INTERN_EMPTY && id < nentry && entries[id])
+        return entries[id]->str;
+
+    return "";
+}
+
+
+int mdb_intern_count(void)
+{
+    return count;
+}
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
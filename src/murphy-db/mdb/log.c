@@ -72,11 +72,57 @@ typedef struct {
     mqi_bitfld_t    colmask;
     union {
         mdb_row_t   *before;
-        mdb_opcnt_t *cnt;
+        mdb_opcnt_t  cnt;
     };
     mdb_row_t      *after;
 } change_t;
 
+/*
+ * log headers and changes are carved out of chunks and recycled through
+ * a free list, so a transaction does not need to go to the allocator for
+ * every change. The chunks are released once nothing is in use and the
+ * pool has grown beyond LOG_POOL_KEEP items.
+ */
+#define LOG_POOL_CHUNK   128
+#define LOG_POOL_KEEP    (8 * LOG_POOL_CHUNK)
+
+typedef union log_item_u  log_item_t;
+typedef struct log_chunk_s log_chunk_t;
+
+union log_item_u {
+    log_item_t  *next;
+    tx_log_t     tx;
+    tbl_log_t    tbl;
+    change_t     change;
+};
+
+struct log_chunk_s {
+    log_chunk_t *next;
+    log_item_t   items[LOG_POOL_CHUNK];
+};
+
+typedef struct {
+    log_chunk_t *chunks;
+    log_item_t  *free;
+    uint32_t     nitem;         /* all the items in the chunks */
+    uint32_t     nused;         /* items currently in use */
+} log_pool_t;
+
+#ifdef LOG_STATISTICS
+typedef struct {
+    uint64_t     nchange;       /* changes logged */
+    uint64_t     nreuse;        /* items taken from the free list */
+    uint64_t     nchunk;        /* chunks allocated */
+    uint64_t     nrelease;      /* times the pool was released */
+    uint64_t     noverflow;     /* transactions aborted by the limit */
+    uint32_t     peak;          /* most changes pending at once */
+} log_stats_t;
+
+#define LOG_STAT(s)   (log_stats.s)
+#else
+#define LOG_STAT(s)   (log_dummy)
+#endif
+
 
 
 static inline log_t *new_log(mdb_dlist_t *, mdb_dlist_t *, uint32_t, int);
@@ -86,9 +132,24 @@ static tx_log_t *get_tx_log(uint32_t);
 static tbl_log_t *get_tbl_log(mdb_dlist_t *, mdb_dlist_t *, uint32_t,
                               mdb_table_t *);
 static void delete_tx_log(uint32_t);
+static void *alloc_item(void);
+static void free_item(void *);
+static change_t *new_change(void);
+static void delete_change(change_t *);
 
 static MDB_DLIST_HEAD(tx_head);
 
+static log_pool_t  log_pool;
+static uint32_t    log_limit;       /* max. pending changes, 0 = no limit */
+static uint32_t    log_pending;     /* changes in the open transactions */
+static uint32_t    overflow_depth;  /* transaction that hit the limit */
+
+#ifdef LOG_STATISTICS
+static log_stats_t log_stats;
+#else
+static uint64_t    log_dummy;
+#endif
+
 int mdb_log_create(mdb_table_t *tbl)
 {
     MDB_CHECKARG(tbl, -1);
@@ -99,12 +160,12 @@ int mdb_log_create(mdb_table_t *tbl)
 }
 
 
-int mdb_log_change(mdb_table_t    *tbl,
-                   uint32_t        depth,
-                   mdb_log_type_t  type,
-                   mqi_bitfld_t    colmask,
-                   mdb_row_t      *before,
-                   mdb_row_t      *after)
+int mdb_log_change(mdb_table_t        *tbl,
+                   uint32_t            depth,
+                   mdb_log_type_t      type,
+                   const mqi_bitfld_t *colmask,
+                   mdb_row_t          *before,
+                   mdb_row_t          *after)
 {
     tx_log_t  *txlog;
     tbl_log_t *tblog;
@@ -121,16 +182,18 @@ int mdb_log_change(mdb_table_t    *tbl,
         return -1;
     }
 
-    if (!(change = calloc(1, sizeof(change_t)))) {
-        errno = ENOMEM;
+    if (!(change = new_change()))
         return -1;
-    }
 
     change->type    = type;
-    change->colmask = colmask;
     change->before  = before;
     change->after   = after;
 
+    if (colmask)
+        change->colmask = *colmask;
+    else
+        mqi_bitfld_clear(&change->colmask);
+
     switch (type) {
     case mdb_log_insert: tbl->cnt.inserts++; break;
     case mdb_log_delete: tbl->cnt.deletes++; break;
@@ -140,9 +203,100 @@ int mdb_log_change(mdb_table_t    *tbl,
 
     MDB_DLIST_PREPEND(change_t, link, change, &tblog->changes);
 
+    if (++log_pending > LOG_STAT(peak))
+        LOG_STAT(peak) = log_pending;
+
+    LOG_STAT(nchange)++;
+
+    return 0;
+}
+
+
+int mdb_log_check_limit(uint32_t depth)
+{
+    if (!depth || !log_limit || log_pending < log_limit)
+        return 0;
+
+    if (!overflow_depth || depth < overflow_depth) {
+        if (!overflow_depth)
+            LOG_STAT(noverflow)++;
+
+        overflow_depth = depth;
+    }
+
+    errno = EOVERFLOW;
+    return -1;
+}
+
+
+int mdb_log_clear_overflow(uint32_t depth)
+{
+    int overflow;
+
+    if (!overflow_depth || depth > overflow_depth)
+        return false;
+
+    overflow = (depth == overflow_depth);
+    overflow_depth = 0;
+
+    return overflow;
+}
+
+
+int mdb_log_set_limit(uint32_t limit)
+{
+    log_limit = limit;
+
     return 0;
 }
 
+
+uint32_t mdb_log_get_limit(void)
+{
+    return log_limit;
+}
+
+uint32_t mdb_log_get_pending(void)
+{
+    return log_pending;
+}
+
+
+int mdb_log_print_statistics(char *buf, int len)
+{
+#define PRINT(args...)  if (e > p) p += snprintf(p, e-p, args)
+
+    char *p, *e;
+
+    MDB_CHECKARG(buf && len > 0, 0);
+
+    e = (p = buf) + len;
+    *buf = '\0';
+
+    PRINT("transaction log:\n");
+    PRINT("   pending changes: %u", log_pending);
+    PRINT(log_limit ? " (limit %u)\n" : " (no limit)\n", log_limit);
+
+    PRINT("   pool: %u items, %u in use, %u free\n", log_pool.nitem,
+          log_pool.nused, log_pool.nitem - log_pool.nused);
+
+#ifdef LOG_STATISTICS
+    PRINT("   changes logged: %llu, peak pending: %u\n",
+          (unsigned long long)log_stats.nchange, log_stats.peak);
+    PRINT("   items reused: %llu, chunks allocated: %llu, "
+          "pool released: %llu times\n",
+          (unsigned long long)log_stats.nreuse,
+          (unsigned long long)log_stats.nchunk,
+          (unsigned long long)log_stats.nrelease);
+    PRINT("   transactions over the limit: %llu\n",
+          (unsigned long long)log_stats.noverflow);
+#endif
+
+    return p - buf;
+
+#undef PRINT
+}
+
 mdb_log_entry_t *mdb_log_transaction_iterate(uint32_t   depth,
                                              void     **cursor_ptr,
                                              bool       forward,
@@ -154,6 +308,7 @@ mdb_log_entry_t *mdb_log_transaction_iterate(uint32_t   depth,
         mdb_dlist_t     *chead;
         mdb_dlist_t     *hlink;
         mdb_dlist_t     *clink;
+        mdb_opcnt_t      cnt;
         mdb_log_entry_t  entry;
     } cursor_t;
 
@@ -229,12 +384,18 @@ mdb_log_entry_t *mdb_log_transaction_iterate(uint32_t   depth,
 
             entry->change  = change->type;
             entry->colmask = change->colmask;
-            entry->before  = change->before;
             entry->after   = change->after;
 
+            if (change->type != mdb_log_start)
+                entry->before = change->before;
+            else {
+                cursor->cnt = change->cnt;
+                entry->cnt  = &cursor->cnt;
+            }
+
             if (delete) {
                 MDB_DLIST_UNLINK(change_t, link, change);
-                free(change);
+                delete_change(change);
             }
 
             return entry;
@@ -273,6 +434,7 @@ mdb_log_entry_t *mdb_log_table_iterate(mdb_table_t  *tbl,
         mdb_dlist_t     *chead;
         mdb_dlist_t     *vlink;
         mdb_dlist_t     *clink;
+        mdb_opcnt_t      cnt;
         mdb_log_entry_t  entry;
     } cursor_t;
 
@@ -331,12 +493,18 @@ mdb_log_entry_t *mdb_log_table_iterate(mdb_table_t  *tbl,
 
             entry->change  = change->type;
             entry->colmask = change->colmask;
-            entry->before  = change->before;
             entry->after   = change->after;
 
+            if (change->type != mdb_log_start)
+                entry->before = change->before;
+            else {
+                cursor->cnt = change->cnt;
+                entry->cnt  = &cursor->cnt;
+            }
+
             if (delete) {
                 MDB_DLIST_UNLINK(change_t, link, change);
-                free(change);
+                delete_change(change);
             }
 
             return entry;
@@ -372,7 +540,11 @@ static inline log_t *new_log(mdb_dlist_t *vhead,
 {
     log_t *log;
 
-    if ((log = calloc(1, size))) {
+    MDB_ASSERT(size <= (int)sizeof(log_item_t), EINVAL, NULL);
+
+    if ((log = alloc_item())) {
+        memset(log, 0, size);
+
         MDB_DLIST_APPEND(mdb_log_t, vlink, log, vhead);
 
         if (hhead)
@@ -391,7 +563,7 @@ static inline void delete_log(log_t *log)
     MDB_DLIST_UNLINK(log_t, vlink, log);
     MDB_DLIST_UNLINK(log_t, hlink, log);
 
-    free(log);
+    free_item(log);
 }
 
 
@@ -433,19 +605,13 @@ static tbl_log_t *get_tbl_log(mdb_dlist_t *vhead,
             log->table = tbl;
             MDB_DLIST_INIT(log->changes);
 
-            if (!(change = calloc(1, sizeof(change_t)))) {
-                errno = ENOMEM;
-                return NULL;
-            }
-
-            if (!(change->cnt = calloc(1, sizeof(*change->cnt)))) {
-                free(change);
-                errno = ENOMEM;
+            if (!(change = new_change())) {
+                delete_log((log_t *)log);
                 return NULL;
             }
 
             change->type = mdb_log_start;
-            *change->cnt = tbl->cnt;
+            change->cnt  = tbl->cnt;
             tbl->cnt.stamp++;
 
             MDB_DLIST_PREPEND(change_t, link, change, &log->changes);
@@ -479,6 +645,81 @@ static void delete_tx_log(uint32_t depth)
 }
 
 
+static void *alloc_item(void)
+{
+    log_chunk_t *chunk;
+    log_item_t  *item;
+    int          i;
+
+    if ((item = log_pool.free))
+        LOG_STAT(nreuse)++;
+    else {
+        if (!(chunk = malloc(sizeof(*chunk)))) {
+            errno = ENOMEM;
+            return NULL;
+        }
+
+        chunk->next = log_pool.chunks;
+        log_pool.chunks = chunk;
+        log_pool.nitem += LOG_POOL_CHUNK;
+
+        for (i = 0;  i < LOG_POOL_CHUNK - 1;  i++)
+            chunk->items[i].next = chunk->items + i + 1;
+        chunk->items[i].next = NULL;
+
+        item = chunk->items;
+
+        LOG_STAT(nchunk)++;
+    }
+
+    log_pool.free = item->next;
+    log_pool.nused++;
+
+    return item;
+}
+
+static void free_item(void *ptr)
+{
+    log_item_t  *item = ptr;
+    log_chunk_t *chunk;
+
+    if (!item)
+        return;
+
+    item->next = log_pool.free;
+    log_pool.free = item;
+
+    if (--log_pool.nused == 0 && log_pool.nitem > LOG_POOL_KEEP) {
+        while ((chunk = log_pool.chunks)) {
+            log_pool.chunks = chunk->next;
+            free(chunk);
+        }
+
+        log_pool.free  = NULL;
+        log_pool.nitem = 0;
+
+        LOG_STAT(nrelease)++;
+    }
+}
+
+static change_t *new_change(void)
+{
+    change_t *change;
+
+    if ((change = alloc_item()))
+        memset(change, 0, sizeof(*change));
+
+    return change;
+}
+
+static void delete_change(change_t *change)
+{
+    if (change->type != mdb_log_start && log_pending > 0)
+        log_pending--;
+
+    free_item(change);
+}
+
 
 /*
  * Local Variables:
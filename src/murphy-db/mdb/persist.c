@@ -0,0 +1,826 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define _GNU_SOURCE
+#include <string.h>
+
+#include <murphy-db/assert.h>
+#include "persist.h"
+#include "table.h"
+#include "index.h"
+#include "log.h"
+
+#define PERSIST_SNAPSHOT_MAGIC  0x4d444253  /* 'MDBS' */
+#define PERSIST_WAL_MAGIC       0x4d444257  /* 'MDBW' */
+#define PERSIST_VERSION         1
+#define PERSIST_HEADER_SIZE     64
+
+#define PERSIST_BUFFER_MIN      4096
+#define PERSIST_COMPACT_MIN     (64 * 1024)
+
+#define CHECKSUM_INIT           2166136261U
+#define CHECKSUM_PRIME          16777619U
+
+
+/*
+ * both files start with this header; it is padded to PERSIST_HEADER_SIZE
+ * so that the row images that follow it stay aligned when mapped
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t schema;        /* hash of the table layout */
+    uint32_t gen;           /* snapshot generation the file belongs to */
+    uint32_t dlgh;          /* length of the row images */
+    uint32_t nrow;          /* number of rows in a snapshot */
+    uint32_t unused[10];
+} file_header_t;
+
+typedef struct {
+    uint32_t op;            /* mdb_persist_op_t */
+    uint32_t length;        /* length of the row image that follows */
+    uint32_t check;         /* checksum of the above and the image */
+} record_t;
+
+struct mdb_persist_s {
+    mdb_table_t  *tbl;
+    char         *snap_path;
+    char         *temp_path;
+    char         *wal_path;
+    int           fd;       /* write-ahead log */
+    uint32_t      schema;
+    uint32_t      gen;
+    off_t         walsize;
+    uint8_t      *buf;      /* records not written to the log yet */
+    size_t        used;
+    size_t        size;
+    mdb_dlist_t   dirty;    /* on dirty_tables while buf is not empty */
+};
+
+
+static int load_snapshot(mdb_persist_t *);
+static int open_wal(mdb_persist_t *);
+static int reset_wal(mdb_persist_t *);
+static int append_record(mdb_persist_t *, mdb_persist_op_t, mdb_row_t *);
+static int write_records(mdb_persist_t *);
+static int flush_records(mdb_persist_t *);
+static int compact(mdb_persist_t *);
+static int put_row(mdb_table_t *, void *);
+static int del_row(mdb_table_t *, void *);
+static uint32_t table_schema(mdb_table_t *);
+static uint32_t checksum(uint32_t, const void *, size_t);
+static uint32_t record_checksum(uint32_t, const void *, uint32_t);
+static int check_header(mdb_persist_t *, file_header_t *, uint32_t);
+static void set_header(mdb_persist_t *, file_header_t *, uint32_t, uint32_t,
+                       uint32_t);
+static int write_all(int, const void *, size_t);
+static char *make_path(const char *, const char *, const char *);
+static void destroy_persist(mdb_persist_t *);
+
+
+static MDB_DLIST_HEAD(dirty_tables);
+static int npersist;
+
+
+int mdb_table_make_persistent(mdb_table_t *tbl, const char *dir)
+{
+    mdb_persist_t *p;
+    mdb_row_t     *row, *n;
+    int            err;
+
+    MDB_CHECKARG(tbl && dir && dir[0], -1);
+
+    if (tbl->persist) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    /*
+     * the log records are applied by primary key on reload, and the
+     * ids of interned strings would mean nothing after a restart
+     */
+    if (!MDB_TABLE_HAS_INDEX(tbl) || tbl->ninterned > 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!MDB_DLIST_EMPTY(tbl->rows)) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (!(p = calloc(1, sizeof(mdb_persist_t)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    p->tbl    = tbl;
+    p->fd     = -1;
+    p->schema = table_schema(tbl);
+    MDB_DLIST_INIT(p->dirty);
+
+    if (!(p->snap_path = make_path(dir, tbl->name, ".snapshot")) ||
+        !(p->temp_path = make_path(dir, tbl->name, ".snapshot.tmp")) ||
+        !(p->wal_path  = make_path(dir, tbl->name, ".wal")))
+        goto error;
+
+    if (load_snapshot(p) < 0 || open_wal(p) < 0)
+        goto error;
+
+    tbl->persist = p;
+    npersist++;
+
+    return 0;
+
+ error:
+    err = errno;
+
+    mdb_index_reset(tbl);
+
+    MDB_DLIST_FOR_EACH_SAFE(mdb_row_t, link, row,n, &tbl->rows)
+        mdb_row_delete(tbl, row, 0, 1);
+
+    tbl->nrow = 0;
+
+    destroy_persist(p);
+
+    errno = err;
+    return -1;
+}
+
+int mdb_table_compact(mdb_table_t *tbl)
+{
+    MDB_CHECKARG(tbl, -1);
+
+    if (!tbl->persist) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* a snapshot must not have uncommitted changes in it */
+    if (mdb_transaction_get_depth() > 0) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    return compact(tbl->persist);
+}
+
+
+int mdb_persist_change(mdb_table_t *tbl, mdb_persist_op_t op, mdb_row_t *row)
+{
+    if (mdb_persist_append(tbl, op, row) < 0)
+        return -1;
+
+    return mdb_persist_flush(tbl);
+}
+
+/* like mdb_persist_change, but leave writing it to mdb_persist_flush */
+int mdb_persist_append(mdb_table_t *tbl, mdb_persist_op_t op, mdb_row_t *row)
+{
+    mdb_persist_t *p;
+
+    /* transactional changes are logged when they get committed */
+    if (!(p = tbl->persist) || mdb_transaction_get_depth() > 0)
+        return 0;
+
+    return append_record(p, op, row);
+}
+
+int mdb_persist_flush(mdb_table_t *tbl)
+{
+    mdb_persist_t *p;
+
+    if (!(p = tbl->persist) || mdb_transaction_get_depth() > 0)
+        return 0;
+
+    return flush_records(p);
+}
+
+int mdb_persist_transaction(uint32_t depth)
+{
+    mdb_log_entry_t *en;
+    mdb_index_t     *ix;
+    mdb_persist_t   *p;
+    void            *cursor;
+    int              sts = 0, s;
+
+    if (!npersist)
+        return 0;
+
+    /*
+     * The changes are logged newest first, so walk them backwards. The
+     * images are the final contents of the rows, not the ones the changes
+     * left behind. Replaying them in order still ends up in the committed
+     * state, as the last record of every key is what the key has after
+     * the commit.
+     */
+    MDB_TRANSACTION_LOG_FOR_EACH(depth, en, MDB_BACKWARD, cursor) {
+
+        if (!(p = en->table->persist))
+            continue;
+
+        switch (en->change) {
+
+        case mdb_log_insert:
+            s = append_record(p, mdb_persist_put, en->after);
+            break;
+
+        case mdb_log_update:
+            ix = &en->table->index;
+            s  = 0;
+
+            if (en->before && memcmp(en->before->data + ix->offset,
+                                     en->after->data + ix->offset, ix->length))
+                s = append_record(p, mdb_persist_del, en->before);
+
+            if (s == 0)
+                s = append_record(p, mdb_persist_put, en->after);
+            break;
+
+        case mdb_log_delete:
+            s = append_record(p, mdb_persist_del, en->before);
+            break;
+
+        default:
+            s = 0;
+            break;
+        }
+
+        if (sts == 0)
+            sts = s;
+    }
+
+    return sts;
+}
+
+int mdb_persist_flush_all(void)
+{
+    mdb_persist_t *p, *n;
+    int            sts = 0;
+
+    if (!npersist)
+        return 0;
+
+    MDB_DLIST_FOR_EACH_SAFE(mdb_persist_t, dirty, p,n, &dirty_tables) {
+        if (flush_records(p) < 0)
+            sts = -1;
+    }
+
+    return sts;
+}
+
+void mdb_persist_close(mdb_table_t *tbl)
+{
+    mdb_persist_t *p;
+
+    if (!tbl || !(p = tbl->persist))
+        return;
+
+    write_records(p);
+
+    tbl->persist = NULL;
+    npersist--;
+
+    destroy_persist(p);
+}
+
+
+static int load_snapshot(mdb_persist_t *p)
+{
+    mdb_table_t   *tbl  = p->tbl;
+    void          *map  = MAP_FAILED;
+    file_header_t *hdr;
+    uint8_t       *data;
+    struct stat    st;
+    uint32_t       i;
+    int            fd, err;
+
+    if ((fd = open(p->snap_path, O_RDONLY | O_CLOEXEC)) < 0) {
+        if (errno != ENOENT)
+            return -1;
+
+        p->gen = 0;
+        return 0;
+    }
+
+    if (fstat(fd, &st) < 0)
+        goto error;
+
+    if (st.st_size < PERSIST_HEADER_SIZE) {
+        errno = EINVAL;
+        goto error;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (map == MAP_FAILED)
+        goto error;
+
+    hdr = map;
+
+    if (check_header(p, hdr, PERSIST_SNAPSHOT_MAGIC) <= 0 ||
+        st.st_size != PERSIST_HEADER_SIZE + (off_t)hdr->nrow * tbl->dlgh)
+    {
+        errno = EINVAL;
+        goto error;
+    }
+
+    data = (uint8_t *)map + PERSIST_HEADER_SIZE;
+
+    for (i = 0;  i < hdr->nrow;  i++, data += tbl->dlgh) {
+        if (put_row(tbl, data) < 0)
+            goto error;
+    }
+
+    p->gen = hdr->gen;
+
+    munmap(map, st.st_size);
+    close(fd);
+
+    return 0;
+
+ error:
+    err = errno;
+
+    if (map != MAP_FAILED)
+        munmap(map, st.st_size);
+
+    close(fd);
+
+    errno = err;
+    return -1;
+}
+
+static int open_wal(mdb_persist_t *p)
+{
+    mdb_table_t   *tbl = p->tbl;
+    void          *map;
+    file_header_t *hdr;
+    record_t      *rec;
+    uint8_t       *data;
+    struct stat    st;
+    off_t          valid, end;
+    int            sts;
+
+    p->fd = open(p->wal_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    if (p->fd < 0 || fstat(p->fd, &st) < 0)
+        return -1;
+
+    valid = 0;
+
+    if (st.st_size >= PERSIST_HEADER_SIZE) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, p->fd, 0);
+
+        if (map == MAP_FAILED)
+            return -1;
+
+        hdr = map;
+
+        if ((sts = check_header(p, hdr, PERSIST_WAL_MAGIC)) < 0) {
+            munmap(map, st.st_size);
+            return -1;
+        }
+
+        /* a log of an older generation is already in the snapshot */
+        if (sts > 0 && hdr->gen == p->gen) {
+            valid = PERSIST_HEADER_SIZE;
+
+            for (;;) {
+                end = valid + sizeof(record_t) + tbl->dlgh;
+
+                if (end > st.st_size)
+                    break;
+
+                rec  = (record_t *)((uint8_t *)map + valid);
+                data = (uint8_t *)(rec + 1);
+
+                if (rec->length != (uint32_t)tbl->dlgh ||
+                    rec->check  != record_checksum(rec->op, data, rec->length))
+                    break;
+
+                if (rec->op == mdb_persist_put)
+                    sts = put_row(tbl, data);
+                else if (rec->op == mdb_persist_del)
+                    sts = del_row(tbl, data);
+                else
+                    break;
+
+                if (sts < 0) {
+                    munmap(map, st.st_size);
+                    return -1;
+                }
+
+                valid = end;
+            }
+        }
+
+        munmap(map, st.st_size);
+    }
+
+    if (!valid)
+        return reset_wal(p);
+
+    /* drop whatever got torn at the end of the log */
+    if (valid < st.st_size && ftruncate(p->fd, valid) < 0)
+        return -1;
+
+    p->walsize = valid;
+
+    return 0;
+}
+
+static int reset_wal(mdb_persist_t *p)
+{
+    file_header_t hdr;
+
+    set_header(p, &hdr, PERSIST_WAL_MAGIC, p->gen, 0);
+
+    if (ftruncate(p->fd, 0) < 0 || write_all(p->fd, &hdr, sizeof(hdr)) < 0)
+        return -1;
+
+    p->walsize = sizeof(hdr);
+
+    return 0;
+}
+
+static int append_record(mdb_persist_t    *p,
+                         mdb_persist_op_t  op,
+                         mdb_row_t        *row)
+{
+    int       dlgh = p->tbl->dlgh;
+    size_t    need = sizeof(record_t) + dlgh;
+    size_t    size;
+    uint8_t  *buf;
+    record_t *rec;
+
+    if (p->used + need > p->size) {
+        for (size = p->size ? p->size : PERSIST_BUFFER_MIN;
+             size < p->used + need;
+             size *= 2)
+            ;
+
+        if (!(buf = realloc(p->buf, size))) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        p->buf  = buf;
+        p->size = size;
+    }
+
+    rec = (record_t *)(p->buf + p->used);
+
+    rec->op     = op;
+    rec->length = dlgh;
+    rec->check  = record_checksum(op, row->data, dlgh);
+
+    memcpy(rec + 1, row->data, dlgh);
+
+    p->used += need;
+
+    if (MDB_DLIST_EMPTY(p->dirty))
+        MDB_DLIST_APPEND(mdb_persist_t, dirty, p, &dirty_tables);
+
+    return 0;
+}
+
+static int write_records(mdb_persist_t *p)
+{
+    int err;
+
+    if (!MDB_DLIST_EMPTY(p->dirty))
+        MDB_DLIST_UNLINK(mdb_persist_t, dirty, p);
+
+    if (!p->used)
+        return 0;
+
+    if (write_all(p->fd, p->buf, p->used) < 0) {
+        err = errno;
+        p->used = 0;
+
+        /* don't leave a torn record behind for the next ones */
+        if (ftruncate(p->fd, p->walsize) < 0)
+            err = errno;
+
+        errno = err;
+        return -1;
+    }
+
+    p->walsize += p->used;
+    p->used = 0;
+
+    return 0;
+}
+
+static int flush_records(mdb_persist_t *p)
+{
+    mdb_table_t *tbl = p->tbl;
+
+    if (write_records(p) < 0)
+        return -1;
+
+    if (mdb_transaction_get_depth() == 0              &&
+        p->walsize > PERSIST_COMPACT_MIN              &&
+        p->walsize > 2 * (off_t)tbl->nrow * tbl->dlgh)
+        return compact(p);
+
+    return 0;
+}
+
+static int compact(mdb_persist_t *p)
+{
+    mdb_table_t   *tbl = p->tbl;
+    file_header_t  hdr;
+    mdb_row_t     *row;
+    uint8_t       *buf;
+    size_t         used;
+    uint32_t       nrow;
+    int            fd, err;
+
+    if (write_records(p) < 0)
+        return -1;
+
+    nrow = 0;
+    MDB_DLIST_FOR_EACH(mdb_row_t, link, row, &tbl->rows)
+        nrow++;
+
+    if ((fd = open(p->temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   0644)) < 0)
+        return -1;
+
+    set_header(p, &hdr, PERSIST_SNAPSHOT_MAGIC, p->gen + 1, nrow);
+
+    if (write_all(fd, &hdr, sizeof(hdr)) < 0)
+        goto error;
+
+    /* the (empty) record buffer doubles as a staging area for the rows */
+    if (p->size < PERSIST_BUFFER_MIN + (size_t)tbl->dlgh) {
+        if (!(buf = realloc(p->buf, PERSIST_BUFFER_MIN + tbl->dlgh))) {
+            errno = ENOMEM;
+            goto error;
+        }
+
+        p->buf  = buf;
+        p->size = PERSIST_BUFFER_MIN + tbl->dlgh;
+    }
+
+    used = 0;
+
+    MDB_DLIST_FOR_EACH(mdb_row_t, link, row, &tbl->rows) {
+        if (used + tbl->dlgh > p->size) {
+            if (write_all(fd, p->buf, used) < 0)
+                goto error;
+            used = 0;
+        }
+
+        memcpy(p->buf + used, row->data, tbl->dlgh);
+        used += tbl->dlgh;
+    }
+
+    if (write_all(fd, p->buf, used) < 0 || fsync(fd) < 0)
+        goto error;
+
+    close(fd);
+    fd = -1;
+
+    if (rename(p->temp_path, p->snap_path) < 0)
+        goto error;
+
+    /*
+     * From here on the snapshot has everything. If we crash before the
+     * log is reset, its older generation makes sure it gets ignored.
+     */
+    p->gen++;
+
+    return reset_wal(p);
+
+ error:
+    err = errno;
+
+    if (fd >= 0)
+        close(fd);
+
+    unlink(p->temp_path);
+
+    errno = err;
+    return -1;
+}
+
+static int put_row(mdb_table_t *tbl, void *data)
+{
+    mdb_index_t *ix = &tbl->index;
+    mdb_row_t   *row;
+
+    if ((row = mdb_index_get_row(tbl, ix->length, data + ix->offset))) {
+        if (mdb_index_delete(tbl, row) < 0)
+            return -1;
+
+        memcpy(row->data, data, tbl->dlgh);
+
+        return mdb_index_insert(tbl, row, 0, 0) < 0 ? -1 : 0;
+    }
+
+    if (!(row = mdb_row_create(tbl)))
+        return -1;
+
+    memcpy(row->data, data, tbl->dlgh);
+
+    if (mdb_index_insert(tbl, row, 0, 0) < 0)
+        return -1;
+
+    tbl->nrow++;
+
+    return 0;
+}
+
+static int del_row(mdb_table_t *tbl, void *data)
+{
+    mdb_index_t *ix = &tbl->index;
+    mdb_row_t   *row;
+
+    if (!(row = mdb_index_get_row(tbl, ix->length, data + ix->offset)))
+        return 0;
+
+    if (mdb_row_delete(tbl, row, 1, 1) < 0)
+        return -1;
+
+    tbl->nrow--;
+
+    return 0;
+}
+
+static uint32_t table_schema(mdb_table_t *tbl)
+{
+    mdb_column_t *col;
+    uint32_t      h, v[4];
+    int           i;
+
+    h = CHECKSUM_INIT;
+
+    for (i = 0;  i < tbl->ncolumn;  i++) {
+        col = tbl->columns + i;
+
+        v[0] = col->type;
+        v[1] = col->length;
+        v[2] = col->offset;
+        v[3] = 0;
+
+        h = checksum(h, col->name, strlen(col->name) + 1);
+        h = checksum(h, v, sizeof(v));
+    }
+
+    v[0] = tbl->dlgh;
+    v[1] = tbl->index.offset;
+    v[2] = tbl->index.length;
+    v[3] = tbl->ncolumn;
+
+    return checksum(h, v, sizeof(v));
+}
+
+static uint32_t checksum(uint32_t h, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    const uint8_t *e = p + size;
+
+    while (p < e) {
+        h ^= *p++;
+        h *= CHECKSUM_PRIME;
+    }
+
+    return h;
+}
+
+static uint32_t record_checksum(uint32_t op, const void *data, uint32_t length)
+{
+    uint32_t v[2] = { op, length };
+
+    return checksum(checksum(CHECKSUM_INIT, v, sizeof(v)), data, length);
+}
+
+/*
+ * Returns 1 for a usable header, 0 for one that is not ours (or is
+ * damaged) and -1 if it belongs to a table with a different layout.
+ */
+static int check_header(mdb_persist_t *p, file_header_t *hdr, uint32_t magic)
+{
+    if (hdr->magic != magic || hdr->version != PERSIST_VERSION)
+        return 0;
+
+    if (hdr->schema != p->schema || hdr->dlgh != (uint32_t)p->tbl->dlgh) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 1;
+}
+
+static void set_header(mdb_persist_t *p,
+                       file_header_t *hdr,
+                       uint32_t       magic,
+                       uint32_t       gen,
+                       uint32_t       nrow)
+{
+    memset(hdr, 0, sizeof(*hdr));
+
+    hdr->magic   = magic;
+    hdr->version = PERSIST_VERSION;
+    hdr->schema  = p->schema;
+    hdr->gen     = gen;
+    hdr->dlgh    = p->tbl->dlgh;
+    hdr->nrow    = nrow;
+}
+
+static int write_all(int fd, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    ssize_t        n;
+
+    while (size > 0) {
+        if ((n = write(fd, p, size)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        p    += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+static char *make_path(const char *dir, const char *name, const char *suffix)
+{
+    size_t  len = strlen(dir) + strlen(name) + strlen(suffix) + 2;
+    char   *path;
+
+    if (!(path = malloc(len))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    snprintf(path, len, "%s/%s%s", dir, name, suffix);
+
+    return path;
+}
+
+static void destroy_persist(mdb_persist_t *p)
+{
+    if (!MDB_DLIST_EMPTY(p->dirty))
+        MDB_DLIST_UNLINK(mdb_persist_t, dirty, p);
+
+    if (p->fd >= 0)
+        close(p->fd);
+
+    free(p->snap_path);
+    free(p->temp_path);
+    free(p->wal_path);
+    free(p->buf);
+    free(p);
+}
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MDB_PERSIST_H__
+#define __MDB_PERSIST_H__
+
+/*
+ * Persistent tables
+ *
+ * A persistent table has a snapshot and a write-ahead log in its
+ * directory. The snapshot is a header followed by the raw row data, so
+ * it can be mapped and loaded without any parsing. The log holds full
+ * row images which are put (inserted or replaced) or deleted by their
+ * primary key when the log is replayed on top of the snapshot.
+ */
+
+#include <murphy-db/mdb.h>
+#include "row.h"
+
+typedef struct mdb_persist_s mdb_persist_t;
+
+typedef enum {
+    mdb_persist_put = 'P',
+    mdb_persist_del = 'D',
+} mdb_persist_op_t;
+
+
+int mdb_persist_change(mdb_table_t *, mdb_persist_op_t, mdb_row_t *);
+int mdb_persist_append(mdb_table_t *, mdb_persist_op_t, mdb_row_t *);
+int mdb_persist_flush(mdb_table_t *);
+int mdb_persist_transaction(uint32_t);
+int mdb_persist_flush_all(void);
+void mdb_persist_close(mdb_table_t *);
+
+
+#endif /* __MDB_PERSIST_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
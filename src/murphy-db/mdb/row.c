@@ -42,19 +42,118 @@
 #include "table.h"
 #include "index.h"
 #include "column.h"
+#include "intern.h"
 
 
 
+#define ROWPOOL_CACHELINE   64
+#define ROWPOOL_SLOTS_MIN   8
+#define ROWPOOL_CHUNK_MAX   (64 * 1024)
+
+struct mdb_rowchunk_s {
+    mdb_rowchunk_t *next;
+    uint8_t         pad[ROWPOOL_CACHELINE - sizeof(mdb_rowchunk_t *)];
+    uint8_t         slots[0];
+};
+
+
+void mdb_row_pool_init(mdb_rowpool_t *pool, int dlgh)
+{
+    int size = sizeof(mdb_row_t) + dlgh;
+
+    /*
+     * Round the slots up so that no row straddles a cache line more
+     * than it has to: small rows get a power of two size that divides
+     * the cache line, bigger ones a multiple of the cache line.
+     */
+    if (size > ROWPOOL_CACHELINE)
+        size = (size + ROWPOOL_CACHELINE - 1) & ~(ROWPOOL_CACHELINE - 1);
+    else {
+        int slot = 16;
+
+        while (slot < size)
+            slot <<= 1;
+
+        size = slot;
+    }
+
+    memset(pool, 0, sizeof(*pool));
+
+    pool->size  = size;
+    pool->nslot = ROWPOOL_SLOTS_MIN;
+}
+
+void mdb_row_pool_done(mdb_rowpool_t *pool)
+{
+    mdb_rowchunk_t *chunk, *next;
+
+    for (chunk = pool->chunks;  chunk;  chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+
+    pool->chunks = NULL;
+    pool->next   = NULL;
+    pool->end    = NULL;
+    pool->free   = NULL;
+    pool->nslot  = ROWPOOL_SLOTS_MIN;
+}
+
+static mdb_row_t *alloc_row(mdb_table_t *tbl)
+{
+    mdb_rowpool_t  *pool = &tbl->rowpool;
+    mdb_rowchunk_t *chunk;
+    mdb_row_t      *row;
+    void           *mem;
+
+    if ((row = pool->free))
+        pool->free = (mdb_row_t *)row->link.next;
+    else {
+        if (pool->next >= pool->end) {
+            if (posix_memalign(&mem, ROWPOOL_CACHELINE, sizeof(*chunk) +
+                               (size_t)pool->size * pool->nslot)) {
+                errno = ENOMEM;
+                return NULL;
+            }
+
+            chunk = mem;
+            chunk->next  = pool->chunks;
+            pool->chunks = chunk;
+            pool->next   = chunk->slots;
+            pool->end    = chunk->slots + (size_t)pool->size * pool->nslot;
+
+            if (pool->size * pool->nslot * 2 <= ROWPOOL_CHUNK_MAX)
+                pool->nslot *= 2;
+        }
+
+        row = (mdb_row_t *)pool->next;
+        pool->next += pool->size;
+    }
+
+    memset(row, 0, pool->size);
+
+    return row;
+}
+
+static void free_row(mdb_table_t *tbl, mdb_row_t *row)
+{
+    mdb_rowpool_t *pool = &tbl->rowpool;
+
+    mdb_row_unref_strings(tbl, row->data);
+
+    row->link.next = (mdb_dlist_t *)pool->free;
+    pool->free = row;
+}
+
+
 mdb_row_t *mdb_row_create(mdb_table_t *tbl)
 {
     mdb_row_t *row;
 
     MDB_CHECKARG(tbl, NULL);
 
-    if (!(row = calloc(1, sizeof(mdb_row_t) + tbl->dlgh))) {
-        errno = ENOMEM;
+    if (!(row = alloc_row(tbl)))
         return NULL;
-    }
 
     MDB_DLIST_APPEND(mdb_row_t, link, row, &tbl->rows);
 
@@ -67,13 +166,12 @@ mdb_row_t *mdb_row_duplicate(mdb_table_t *tbl, mdb_row_t *row)
 
     MDB_CHECKARG(tbl && row, NULL);
 
-    if (!(dup = calloc(1, sizeof(mdb_row_t) + tbl->dlgh))) {
-        errno = ENOMEM;
+    if (!(dup = alloc_row(tbl)))
         return NULL;
-    }
 
     MDB_DLIST_INIT(dup->link);
     memcpy(dup->data, row->data, tbl->dlgh);
+    mdb_row_ref_strings(tbl, dup->data);
 
     return dup;
 }
@@ -85,18 +183,22 @@ int mdb_row_delete(mdb_table_t *tbl,
 {
     int sts = 0;
 
-    (void)tbl;
-
-    MDB_CHECKARG(row, -1);
+    MDB_CHECKARG(tbl && row, -1);
 
     if (index_update && mdb_index_delete(tbl, row) < 0)
         sts = -1;
 
-    if (!MDB_DLIST_EMPTY(row->link))
+    if (!MDB_DLIST_EMPTY(row->link)) {
         MDB_DLIST_UNLINK(mdb_row_t, link, row);
 
-    if (free_it)
-        free(row);
+        /* invalidates the open select cursors of the table */
+        tbl->rowgen++;
+    }
+
+    if (free_it) {
+        MDB_TABLE_PRESERVE_ROW(tbl, row);
+        free_row(tbl, row);
+    }
     else
         MDB_DLIST_INIT(row->link);
 
@@ -120,19 +222,23 @@ int mdb_row_update(mdb_table_t       *tbl,
 
     columns = tbl->columns;
 
+    MDB_TABLE_PRESERVE_ROW(tbl, row);
+
     if (index_update)
         mdb_index_delete(tbl, row);
 
     cmod = 0;
-    for (cmask = i = 0;  (cidx = (source_dsc = cds + i)->cindex) >= 0;  i++) {
-        cmask |= (((mqi_bitfld_t)1) << cidx);
+    mqi_bitfld_clear(&cmask);
+
+    for (i = 0;  (cidx = (source_dsc = cds + i)->cindex) >= 0;  i++) {
+        mqi_bitfld_set(&cmask, cidx);
         cmod |= mdb_column_write(columns + cidx, row->data, source_dsc, data);
     }
 
     if (index_update) {
-        if (mdb_index_insert(tbl, row, cmask, 0) < 0) {
+        if (mdb_index_insert(tbl, row, &cmask, 0) < 0) {
             if (cmask_ret)
-                *cmask_ret = 0;
+                mqi_bitfld_clear(cmask_ret);
             return -1;
         }
     }
@@ -150,10 +256,14 @@ int mdb_row_copy_over(mdb_table_t *tbl, mdb_row_t *dst, mdb_row_t *src)
 {
     MDB_CHECKARG(tbl && dst && src, -1);
 
+    MDB_TABLE_PRESERVE_ROW(tbl, dst);
+
     if (mdb_index_delete(tbl, dst) < 0)
         return -1;
 
+    mdb_row_unref_strings(tbl, dst->data);
     memcpy(dst->data, src->data, tbl->dlgh);
+    mdb_row_ref_strings(tbl, dst->data);
 
     if (mdb_index_insert(tbl, dst, 0, 0) < 0)
         return -1;
@@ -161,6 +271,33 @@ int mdb_row_copy_over(mdb_table_t *tbl, mdb_row_t *dst, mdb_row_t *src)
     return 0;
 }
 
+void mdb_row_ref_strings(mdb_table_t *tbl, void *data)
+{
+    mdb_column_t *col;
+    int           i;
+
+    if (!tbl->ninterned)
+        return;
+
+    for (i = 0, col = tbl->columns;  i < tbl->ncolumn;  i++, col++) {
+        if (MDB_COLUMN_INTERNED(col))
+            mdb_intern_ref(*(uint32_t *)(data + col->offset));
+    }
+}
+
+void mdb_row_unref_strings(mdb_table_t *tbl, void *data)
+{
+    mdb_column_t *col;
+    int           i;
+
+    if (!tbl->ninterned)
+        return;
+
+    for (i = 0, col = tbl->columns;  i < tbl->ncolumn;  i++, col++) {
+        if (MDB_COLUMN_INTERNED(col))
+            mdb_intern_unref(*(uint32_t *)(data + col->offset));
+    }
+}
 
 /*
  * Local Variables:
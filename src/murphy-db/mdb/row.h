@@ -41,12 +41,32 @@ struct mdb_row_s {
     uint8_t      data[0];
 };
 
+/*
+ * per-table row storage: rows are carved out of chunks that grow
+ * geometrically, and deleted rows are recycled via a free list
+ */
+typedef struct mdb_rowchunk_s mdb_rowchunk_t;
+
+typedef struct {
+    int              size;      /* size of a row slot */
+    int              nslot;     /* number of slots in the next chunk */
+    mdb_rowchunk_t  *chunks;    /* all the allocated chunks */
+    uint8_t         *next;      /* next unused slot in the latest chunk */
+    uint8_t         *end;       /* end of the latest chunk */
+    mdb_row_t       *free;      /* recycled rows, chained by link.next */
+} mdb_rowpool_t;
+
+void mdb_row_pool_init(mdb_rowpool_t *, int);
+void mdb_row_pool_done(mdb_rowpool_t *);
+
 mdb_row_t *mdb_row_create(mdb_table_t *);
 mdb_row_t *mdb_row_duplicate(mdb_table_t *, mdb_row_t *);
 int mdb_row_delete(mdb_table_t *, mdb_row_t *, int, int);
 int mdb_row_update(mdb_table_t *, mdb_row_t *, mqi_column_desc_t *,
                    void *, int, mqi_bitfld_t *);
 int mdb_row_copy_over(mdb_table_t *, mdb_row_t *, mdb_row_t *);
+void mdb_row_ref_strings(mdb_table_t *, void *);
+void mdb_row_unref_strings(mdb_table_t *, void *);
 
 #endif /* __MDB_ROW_H__ */
 
@@ -43,25 +43,30 @@
 #include <murphy-db/assert.h>
 #include <murphy-db/sequence.h>
 
-typedef struct mdb_sequence_entry_s {
-    void         *key;
-    void         *data;
-} sequence_entry_t;
+#include "btree.h"
 
 
+/*
+ * the entries are kept in a B+tree, so adding and deleting entries
+ * does not need to shift the rest of the sequence around
+ */
 struct mdb_sequence_s {
-    int                     alloc;
     mdb_sequence_compare_t  scomp;
     mdb_sequence_print_t    sprint;
 #ifdef SEQUENCE_STATISTICS
     int                     max_entry;
 #endif
-    int                     size;
-    int                     nentry;
-    sequence_entry_t       *entries;
+    mdb_btree_t            *tree;
 };
 
 
+static int sequence_compare(void *user_data, int klen, void *a, void *b)
+{
+    mdb_sequence_t *seq = (mdb_sequence_t *)user_data;
+
+    return seq->scomp(klen, a, b);
+}
+
 
 mdb_sequence_t *mdb_sequence_table_create(int                    alloc,
                                           mdb_sequence_compare_t scomp,
@@ -69,6 +74,7 @@ mdb_sequence_t *mdb_sequence_table_create(int                    alloc,
 {
     mdb_sequence_t *seq;
 
+    /* alloc is not needed by the tree; it is only checked for sanity */
     MDB_CHECKARG(scomp && sprint && alloc > 0 && alloc < 65536, NULL);
 
     if (!(seq = calloc(1, sizeof(mdb_sequence_t)))) {
@@ -76,10 +82,14 @@ mdb_sequence_t *mdb_sequence_table_create(int                    alloc,
         return NULL;
     }
 
-    seq->alloc  = alloc;
     seq->scomp  = scomp;
     seq->sprint = sprint;
 
+    if (!(seq->tree = mdb_btree_create(sequence_compare, seq))) {
+        free(seq);
+        return NULL;
+    }
+
     return seq;
 }
 
@@ -87,7 +97,7 @@ int mdb_sequence_table_destroy(mdb_sequence_t *seq)
 {
     MDB_CHECKARG(seq, -1);
 
-    free(seq->entries);
+    mdb_btree_destroy(seq->tree);
     free(seq);
 
     return 0;
@@ -97,25 +107,23 @@ int mdb_sequence_table_get_size(mdb_sequence_t *seq)
 {
     MDB_CHECKARG(seq, -1);
 
-    return seq->nentry;
+    return mdb_btree_get_size(seq->tree);
 }
 
 int mdb_sequence_table_reset(mdb_sequence_t *seq)
 {
     MDB_CHECKARG(seq, -1);
 
-    free(seq->entries);
-
-    seq->size    = 0;
-    seq->nentry  = 0;
-    seq->entries = NULL;
+    mdb_btree_reset(seq->tree);
 
     return 0;
 }
 
 int mdb_sequence_table_print(mdb_sequence_t *seq, char *buf, int len)
 {
-    sequence_entry_t *entry;
+    mdb_btree_iter_t  it;
+    void             *ekey;
+    void             *data;
     char             *p, *e;
     int               i;
     char              key[256];
@@ -125,12 +133,12 @@ int mdb_sequence_table_print(mdb_sequence_t *seq, char *buf, int len)
     e = (p = buf) + len;
     *buf = '\0';
 
-    for (i = 0;  i < seq->nentry && p < e;  i++) {
-        entry = seq->entries + i;
+    mdb_btree_first(seq->tree, &it);
 
-        seq->sprint(entry->key, key, sizeof(key));
+    for (i = 0;  p < e && (data = mdb_btree_next(&it, &ekey));  i++) {
+        seq->sprint(ekey, key, sizeof(key));
 
-        p += snprintf(p, e-p, "   %05d: '%s' / %p\n", i, key, entry->data);
+        p += snprintf(p, e-p, "   %05d: '%s' / %p\n", i, key, data);
     }
 
     return p - buf;
@@ -138,61 +146,30 @@ int mdb_sequence_table_print(mdb_sequence_t *seq, char *buf, int len)
 
 int mdb_sequence_add(mdb_sequence_t *seq, int klen, void *key, void *data)
 {
-    sequence_entry_t *entry;
-    int               nentry;
-    size_t            old_size;
-    size_t            length;
-    int               cmp;
-    int               min, max, i;
-
     MDB_CHECKARG(seq && key && data, -1);
 
-    nentry = seq->nentry++;
+    if (mdb_btree_insert(seq->tree, klen, key, data) < 0)
+        return -1;
 
-    if ((nentry + 1) > seq->size) {
-        old_size = seq->size;
-        seq->size += seq->alloc;
-        length = sizeof(sequence_entry_t) * seq->size;
-
-        if (!(seq->entries = realloc(seq->entries, length))) {
-            seq->nentry = 0;
-            errno = ENOMEM;
-            return 0;
-        }
-
-
-        memset(seq->entries + old_size, 0, 
-               length - (old_size * sizeof(sequence_entry_t)));
-    }
-
-    for (min = 0,  i = (max = nentry)/2;   ;    i = (min+max)/2) {
-        if (!(cmp = seq->scomp(klen, key, seq->entries[i].key)))
-            break;
-
-        if (i == min) {
-            if (cmp > 0)
-                i = max;
-            break;
-        }
-
-        if (cmp < 0)
-            max = i;
-        else
-            min = i;
-    }
+#ifdef SEQUENCE_STATISTICS
+    if (mdb_btree_get_size(seq->tree) > seq->max_entry)
+        seq->max_entry = mdb_btree_get_size(seq->tree);
+#endif
 
-    entry = seq->entries + i;
+    return 0;
+}
 
-    if (i < nentry) {
-        memmove(entry+1, entry, sizeof(sequence_entry_t) * (nentry - i));
-    }
+int mdb_sequence_add_bulk(mdb_sequence_t *seq, int klen, int n,
+                          void **keys, void **data)
+{
+    MDB_CHECKARG(seq && n >= 0, -1);
 
-    entry->key  = key;
-    entry->data = data;
+    if (mdb_btree_insert_bulk(seq->tree, klen, n, keys, data) < 0)
+        return -1;
 
 #ifdef SEQUENCE_STATISTICS
-    if (seq->nentry > seq->max_entry)
-        seq->max_entry = seq->nentry;
+    if (mdb_btree_get_size(seq->tree) > seq->max_entry)
+        seq->max_entry = mdb_btree_get_size(seq->tree);
 #endif
 
     return 0;
@@ -200,70 +177,9 @@ int mdb_sequence_add(mdb_sequence_t *seq, int klen, void *key, void *data)
 
 void *mdb_sequence_delete(mdb_sequence_t *seq, int klen, void *key)
 {
-    sequence_entry_t *entry;
-    int               i;
-    int               min, max;
-    int               cmp;
-    int               found;
-    void             *data;
-    size_t            length;
-
     MDB_CHECKARG(seq && key, NULL);
 
-    for (found = 0, min = 0, i = (max = seq->nentry)/2;  ;  i = (min+max)/2) {
-        entry = seq->entries + i;
-
-        if (!(cmp = seq->scomp(klen, key, entry->key))) {
-            found = 1;
-            break;
-        }
-
-        if (i == min) {
-            if (i != max) {
-                entry = seq->entries + max;
-                if (!seq->scomp(klen, key, entry->key))
-                    found = 1;
-            }
-            break;
-        }
-
-        if (cmp < 0)
-            max = i;
-        else
-            min = i;
-    }
-
-    if (!found) {
-        errno = ENOENT;
-        return NULL;
-    }
-
-    data = entry->data;
-
-    if (--seq->nentry <= 0) {
-        free(seq->entries);
-
-        seq->size    = 0;
-        seq->nentry  = 0;
-        seq->entries = NULL;
-    }
-    else {
-        if (i < seq->nentry) {
-            length = sizeof(sequence_entry_t) * (seq->nentry - i);
-            memmove(entry, entry+1, length);
-        }
-
-        if (seq->nentry <= (seq->size - seq->alloc)) {
-            length = sizeof(sequence_entry_t) * (seq->size -= seq->alloc);
-
-            if (!(seq->entries = realloc(seq->entries, length))) {
-                seq->nentry = 0;
-                errno = ENOMEM;
-            }
-        }
-    }
-
-    return data;
+    return mdb_btree_delete(seq->tree, klen, key, NULL);
 }
 
 
@@ -278,23 +194,32 @@ void *mdb_sequence_iterate(mdb_sequence_t *seq, void **cursor_ptr)
 
     static cursor_t   empty_cursor;
 
+    mdb_btree_iter_t  it;
     size_t            length;
     cursor_t         *cursor;
+    int               nentry;
     int               i;
 
     MDB_CHECKARG(seq && cursor_ptr, NULL);
 
+    /*
+     * the entries are copied to the cursor, so that the sequence can
+     * be modified while iterating over it
+     */
     if (!(cursor = *cursor_ptr)) {
-        length = sizeof(cursor_t) + sizeof(void *) * seq->nentry;
+        nentry = mdb_btree_get_size(seq->tree);
+        length = sizeof(cursor_t) + sizeof(void *) * nentry;
 
         if (!(cursor = malloc(length)))
             return NULL;
 
         cursor->index = 0;
-        cursor->nentry = seq->nentry;
+        cursor->nentry = nentry;
+
+        mdb_btree_first(seq->tree, &it);
 
-        for (i = 0;  i < seq->nentry;  i++)
-            cursor->entries[i] = seq->entries[i].data;
+        for (i = 0;  i < nentry;  i++)
+            cursor->entries[i] = mdb_btree_next(&it, NULL);
 
         *cursor_ptr = cursor;
     }
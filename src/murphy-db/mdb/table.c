@@ -46,12 +46,53 @@
 
 #define TABLE_STATISTICS
 
+#define TABLE_BULK_MIN    16       /* rows to insert in bulk, at least */
+
 
 typedef struct {
     int          indexed;
     void        *cursor;
 } table_iterator_t;
 
+typedef struct {
+    int             cindex;
+    mqi_operator_t  op;
+    mqi_variable_t *var;
+} cond_term_t;
+
+typedef struct {
+    mdb_row_t   *single;
+    mdb_row_t  **rows;
+    int          nrow;
+} plan_t;
+
+typedef struct {
+    mdb_row_t   *row;               /* the row in the table */
+    mdb_row_t   *copy;              /* its content when the snapshot was
+                                       taken, if it changed since then */
+} snapshot_entry_t;
+
+struct mdb_cursor_s {
+    mdb_table_t       *tbl;
+    mqi_column_desc_t *cds;
+    mqi_cond_entry_t  *cond;
+    mdb_cond_prog_t    prog;
+    int                planned;     /* candidates come from the plan */
+    plan_t             plan;
+    int                next;        /* next candidate in the plan */
+    table_iterator_t   it;
+    int                done;
+    uint32_t           rowgen;      /* tbl->rowgen when opened */
+    /* snapshot cursors */
+    mdb_dlist_t        link;        /* to tbl->snapshots */
+    int                snapshot;
+    int                error;       /* snapshot could not be kept up */
+    snapshot_entry_t  *entries;     /* the matching rows in scan order */
+    snapshot_entry_t **byaddr;      /* the same sorted by row address */
+    int                nentry;
+    int                pos;         /* next entry to return */
+};
+
 
 static mdb_hash_t *table_hash;
 static int         table_count;
@@ -61,6 +102,10 @@ static mdb_row_t *table_iterator(mdb_table_t *, table_iterator_t *);
 #if 0
 static int table_print_info(mdb_table_t *, char *, int);
 #endif
+static int plan_query(mdb_table_t *, mqi_cond_entry_t *, plan_t *);
+static void plan_done(plan_t *);
+static mdb_row_t *cursor_next_row(mdb_cursor_t *);
+static void detach_snapshots(mdb_table_t *);
 static int select_conditional(mdb_table_t *, mqi_cond_entry_t *,
                               mqi_column_desc_t *,void *, int, int);
 static int select_all(mdb_table_t *, mqi_column_desc_t  *, void *, int, int);
@@ -123,7 +168,7 @@ mdb_table_t *mdb_table_create(char *name,
         }
     }
 
-    if (!ncolumn) {
+    if (!ncolumn || ncolumn > MQI_COLUMN_MAX) {
         errno = EINVAL;
         return NULL;
     }
@@ -149,8 +194,23 @@ mdb_table_t *mdb_table_create(char *name,
         cdef = cdefs  + i;
         col  = columns + i;
 
+        if (cdef->type == mqi_varchar && (cdef->flags & MQI_COLUMN_INTERNED)) {
+            col->flags  = MQI_COLUMN_INTERNED;
+            col->maxlen = cdef->length + 1;
+            tbl->ninterned++;
+        }
+
         switch (cdef->type) {
-        case mqi_varchar:  length = cdef->length + 1;  align = 1;    break;
+        case mqi_varchar:
+            if (MDB_COLUMN_INTERNED(col)) {
+                length = sizeof(uint32_t);
+                align  = 4;
+            }
+            else {
+                length = cdef->length + 1;
+                align  = 1;
+            }
+            break;
         case mqi_integer:  length = sizeof(int32_t);   align = 4;    break;
         case mqi_unsignd:  length = sizeof(uint32_t);  align = 4;    break;
         case mqi_floating: length = sizeof(double);    align = 4;    break;
@@ -178,6 +238,8 @@ mdb_table_t *mdb_table_create(char *name,
     tbl->dlgh      = dlgh;
 
     MDB_DLIST_INIT(tbl->rows);
+    MDB_DLIST_INIT(tbl->snapshots);
+    mdb_row_pool_init(&tbl->rowpool, dlgh);
     mdb_log_create(tbl);
     mdb_trigger_init(&tbl->trigger, ncolumn);
 
@@ -246,6 +308,9 @@ int mdb_table_create_index(mdb_table_t *tbl, char **index_columns)
         return -1;
 
     MDB_DLIST_FOR_EACH_SAFE(mdb_row_t, link, row,n, &tbl->rows) {
+        /* mdb_index_insert() puts the row to the secondaries as well */
+        mdb_index_delete_secondary(tbl, row, NULL);
+
         if (mdb_index_insert(tbl, row, 0, 0) < 0) {
             if ((error = errno) != EEXIST)
                 return -1;
@@ -260,6 +325,23 @@ int mdb_table_create_index(mdb_table_t *tbl, char **index_columns)
     return 0;
 }
 
+int mdb_table_create_secondary_index(mdb_table_t      *tbl,
+                                     char             *name,
+                                     mqi_index_type_t  type,
+                                     char            **index_columns)
+{
+    MDB_CHECKARG(tbl && name && name[0] && index_columns && index_columns[0],
+                 -1);
+
+    return mdb_index_create_secondary(tbl, name, type, index_columns);
+}
+
+int mdb_table_drop_secondary_index(mdb_table_t *tbl, char *name)
+{
+    MDB_CHECKARG(tbl && name, -1);
+
+    return mdb_index_drop_secondary(tbl, name);
+}
 
 int mdb_table_describe(mdb_table_t *tbl, mqi_column_def_t *defs, int len)
 {
@@ -275,7 +357,7 @@ int mdb_table_describe(mdb_table_t *tbl, mqi_column_def_t *defs, int len)
 
         def->name   = col->name;
         def->type   = col->type;
-        def->length = col->length;
+        def->length = MDB_COLUMN_INTERNED(col) ? col->maxlen : col->length;
         def->flags  = col->flags;
 
         if (def->type == mqi_varchar && def->length > 0)
@@ -296,35 +378,63 @@ int mdb_table_insert(mdb_table_t        *tbl,
     int           nrow;
     int           ninsert;
     mqi_bitfld_t  cmask;
+    int           bulk;
     int           i;
 
     MDB_CHECKARG(tbl && cds && data && data[0], -1);
 
+    if (mdb_log_check_limit(txdepth) < 0)
+        return -1;
+
+    /*
+     * Inserting many rows at once, the primary index is sized and merged
+     * for all of them in one go and the persistent log is written once.
+     * The transaction log still needs an entry per row for rolling back,
+     * but the triggers fire at commit anyway, as a single change set.
+     */
+    for (i = 1;  data[i] && i < TABLE_BULK_MIN;  i++)
+        ;
+
+    if (i >= TABLE_BULK_MIN) {
+        while (data[i])
+            i++;
+
+        bulk = (mdb_index_bulk_begin(tbl, i) == 0);
+    }
+    else
+        bulk = 0;
+
     for (i = 0, error = 0, ninsert = 0;    data[i];    i++) {
         if (!(row = mdb_row_create(tbl))) {
-            errno = ENOMEM;
-            return -1;
+            error = ENOMEM;
+            break;
         }
 
         mdb_row_update(tbl, row, cds, data[i], 0, &cmask);
 
-        if ((nrow = mdb_index_insert(tbl, row, cmask, ignore)) < 0) {
+        if ((nrow = mdb_index_insert(tbl, row, &cmask, ignore)) < 0) {
             if ((error = errno) != EEXIST)
-                return -1;
+                break;
 
             ninsert = -1;
         }
         else if (nrow > 0) {
             tbl->nrow++;
 
-            if (mdb_log_change(tbl,txdepth,mdb_log_insert,cmask,NULL,row) < 0)
+            if (mdb_log_change(tbl,txdepth,mdb_log_insert,&cmask,NULL,row) < 0 ||
+                mdb_persist_append(tbl, mdb_persist_put, row) < 0)
                 ninsert = -1;
             else
                 ninsert += (ninsert >= 0) ? 1 : 0;
         }
-
     }
 
+    if (bulk)
+        mdb_index_bulk_end(tbl);
+
+    if (mdb_persist_flush(tbl) < 0 && !error)
+        ninsert = -1;
+
     if (error) {
         errno = error;
         return -1;
@@ -386,12 +496,231 @@ int mdb_table_select_by_index(mdb_table_t *tbl,
             return -1;
         }
 
-        mdb_column_write(col, data, &src, var->v.generic);
+        mdb_column_write_key(col, data, &src, var->v.generic);
     }
 
     return select_by_index(tbl, idxlen,idxval, cds, result);
 }
 
+/*
+ * Select cursors hand out the matching rows in batches, so the caller
+ * does not need a buffer for the whole result. The condition and the
+ * column descriptors are used as they are and must stay valid until the
+ * cursor is closed. Removing rows from the table invalidates the cursor,
+ * rows inserted after opening the cursor may or may not be returned.
+ */
+mdb_cursor_t *mdb_table_select_open(mdb_table_t       *tbl,
+                                    mqi_cond_entry_t  *cond,
+                                    mqi_column_desc_t *cds)
+{
+    mdb_cursor_t *c;
+
+    MDB_CHECKARG(tbl && cds, NULL);
+
+    if (!(c = calloc(1, sizeof(mdb_cursor_t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    c->tbl    = tbl;
+    c->cds    = cds;
+    c->cond   = cond;
+    c->rowgen = tbl->rowgen;
+
+    if (cond) {
+        if (mdb_cond_compile(tbl, cond, &c->prog) < 0) {
+            free(c);
+            return NULL;
+        }
+
+        c->planned = plan_query(tbl, cond, &c->plan);
+    }
+
+    return c;
+}
+
+int mdb_table_select_next(mdb_cursor_t *c, void *results, int size, int dim)
+{
+    mdb_table_t       *tbl;
+    mdb_row_t         *row;
+    snapshot_entry_t  *e;
+    mqi_column_desc_t *result_dsc;
+    void              *result;
+    int                nresult;
+    int                cindex;
+    int                i;
+
+    MDB_CHECKARG(c && results && size > 0 && dim > 0, -1);
+
+    if (c->error) {
+        errno = c->error;
+        return -1;
+    }
+
+    tbl = c->tbl;
+
+    if (c->snapshot) {
+        for (nresult = 0;  nresult < dim && c->pos < c->nentry;  nresult++) {
+            e      = c->entries + c->pos++;
+            row    = e->copy ? e->copy : e->row;
+            result = results + (size * nresult);
+
+            for (i = 0; (cindex = (result_dsc = c->cds + i)->cindex) >= 0; i++)
+                mdb_column_read(result_dsc, result, tbl->columns + cindex,
+                                row->data);
+        }
+
+        return nresult;
+    }
+
+    if (c->done)
+        return 0;
+
+    if (c->rowgen != tbl->rowgen) {
+        errno = ESTALE;
+        return -1;
+    }
+
+    for (nresult = 0;  nresult < dim;  nresult++) {
+        if (!(row = cursor_next_row(c)))
+            break;
+
+        result = results + (size * nresult);
+
+        for (i = 0;  (cindex = (result_dsc = c->cds + i)->cindex) >= 0;  i++)
+            mdb_column_read(result_dsc, result, tbl->columns+cindex, row->data);
+    }
+
+    return nresult;
+}
+
+void mdb_table_select_close(mdb_cursor_t *c)
+{
+    int i;
+
+    if (!c)
+        return;
+
+    /* an exhausted sequence cursor is released by the iterator itself */
+    if (!c->done && c->it.indexed && c->it.cursor)
+        mdb_sequence_cursor_destroy(NULL, &c->it.cursor);
+
+    if (c->planned)
+        plan_done(&c->plan);
+
+    if (c->snapshot) {
+        /* the table might have been dropped, taking the copies with it */
+        if (c->tbl) {
+            MDB_DLIST_UNLINK(mdb_cursor_t, link, c);
+
+            for (i = 0;  i < c->nentry;  i++) {
+                if (c->entries[i].copy)
+                    mdb_row_delete(c->tbl, c->entries[i].copy, 0, 1);
+            }
+        }
+
+        free(c->entries);
+        free(c->byaddr);
+    }
+
+    free(c);
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    uintptr_t ra = (uintptr_t)(*(snapshot_entry_t **)a)->row;
+    uintptr_t rb = (uintptr_t)(*(snapshot_entry_t **)b)->row;
+
+    return ra < rb ? -1 : (ra > rb ? 1 : 0);
+}
+
+/*
+ * Snapshot cursors return the rows that matched the condition when the
+ * cursor was opened, with the content they had at that point. Instead of
+ * copying the rows up front, a row is copied only when it is about to be
+ * changed or freed while a snapshot still refers to it. Snapshot cursors
+ * are not invalidated by changes to the table.
+ */
+mdb_cursor_t *mdb_table_snapshot_open(mdb_table_t       *tbl,
+                                      mqi_cond_entry_t  *cond,
+                                      mqi_column_desc_t *cds)
+{
+    mdb_cursor_t     *c;
+    mdb_row_t        *row;
+    snapshot_entry_t *entries;
+    int               nalloc;
+    int               i;
+
+    if (!(c = mdb_table_select_open(tbl, cond, cds)))
+        return NULL;
+
+    for (nalloc = 0;  (row = cursor_next_row(c));  c->nentry++) {
+        if (c->nentry >= nalloc) {
+            nalloc  = nalloc ? 2 * nalloc : 16;
+            entries = realloc(c->entries, nalloc * sizeof(*entries));
+
+            if (!entries)
+                goto nomem;
+
+            c->entries = entries;
+        }
+
+        c->entries[c->nentry].row  = row;
+        c->entries[c->nentry].copy = NULL;
+    }
+
+    if (c->nentry > 0) {
+        if (!(c->byaddr = malloc(c->nentry * sizeof(*c->byaddr))))
+            goto nomem;
+
+        for (i = 0;  i < c->nentry;  i++)
+            c->byaddr[i] = c->entries + i;
+
+        qsort(c->byaddr, c->nentry, sizeof(*c->byaddr), compare_entries);
+    }
+
+    if (c->planned) {
+        plan_done(&c->plan);
+        c->planned = 0;
+    }
+
+    c->snapshot = 1;
+    MDB_DLIST_APPEND(mdb_cursor_t, link, c, &tbl->snapshots);
+
+    return c;
+
+ nomem:
+    free(c->entries);
+    free(c->byaddr);
+    mdb_table_select_close(c);
+    errno = ENOMEM;
+    return NULL;
+}
+
+/*
+ * Called before a row of the table is changed or freed while there are
+ * open snapshots on the table.
+ */
+void mdb_table_preserve_row(mdb_table_t *tbl, mdb_row_t *row)
+{
+    mdb_cursor_t      *c;
+    snapshot_entry_t   key, *kp, **ep;
+
+    key.row = row;
+    kp      = &key;
+
+    MDB_DLIST_FOR_EACH(mdb_cursor_t, link, c, &tbl->snapshots) {
+        if (!c->nentry || c->error)
+            continue;
+
+        ep = bsearch(&kp, c->byaddr, c->nentry, sizeof(*c->byaddr),
+                     compare_entries);
+
+        if (ep && !(*ep)->copy && !((*ep)->copy = mdb_row_duplicate(tbl,row)))
+            c->error = ENOMEM;
+    }
+}
+
 int mdb_table_update(mdb_table_t       *tbl,
                      mqi_cond_entry_t  *cond,
                      mqi_column_desc_t *cds,
@@ -405,6 +734,8 @@ int mdb_table_update(mdb_table_t       *tbl,
 
     MDB_CHECKARG(tbl, -1);
 
+    if (mdb_log_check_limit(mdb_transaction_get_depth()) < 0)
+        return -1;
 
     if (MDB_TABLE_HAS_INDEX(tbl)) {
         for (i = 0;   (cindex = cds[i].cindex) >= 0;    i++) {
@@ -430,6 +761,9 @@ int mdb_table_delete(mdb_table_t *tbl, mqi_cond_entry_t *cond)
 
     MDB_CHECKARG(tbl, -1);
 
+    if (mdb_log_check_limit(mdb_transaction_get_depth()) < 0)
+        return -1;
+
     if (cond)
         ndelete = delete_conditional(tbl, cond);
     else
@@ -477,9 +811,13 @@ mqi_data_type_t mdb_table_get_column_type(mdb_table_t *tbl, int colidx)
 
 int mdb_table_get_column_size(mdb_table_t *tbl, int colidx)
 {
+    mdb_column_t *col;
+
     MDB_CHECKARG(tbl && colidx >= 0 && colidx < tbl->ncolumn, -1);
 
-    return tbl->columns[colidx].length;
+    col = tbl->columns + colidx;
+
+    return MDB_COLUMN_INTERNED(col) ? col->maxlen : col->length;
 }
 
 uint32_t mdb_table_get_stamp(mdb_table_t *tbl)
@@ -523,6 +861,30 @@ int mdb_table_print_rows(mdb_table_t *tbl, char *buf, int len)
     return p - buf;
 }
 
+int mdb_table_print_hash_statistics(mdb_table_t *tbl, char *buf, int len)
+{
+#define PRINT(args...)  if (e > p) p += snprintf(p, e-p, args)
+
+    char *p, *e;
+
+    MDB_CHECKARG(tbl && buf && len > 0, 0);
+
+    e = (p = buf) + len;
+    *buf = '\0';
+
+    PRINT("table '%s' index hash:\n", tbl->name);
+
+    if (!MDB_INDEX_DEFINED(&tbl->index)) {
+        PRINT("   no index\n");
+    }
+    else if (e > p)
+        p += mdb_hash_table_print_statistics(tbl->index.hash, p, e-p);
+
+    return p - buf;
+
+#undef PRINT
+}
+
 
 static void destroy_table(mdb_table_t *tbl)
 {
@@ -530,13 +892,20 @@ static void destroy_table(mdb_table_t *tbl)
     mdb_column_t *cols;
     int           i;
 
+    mdb_persist_close(tbl);
+
     mdb_index_drop(tbl);
+    mdb_index_drop_secondaries(tbl);
 
     mdb_hash_table_destroy(tbl->chash);
 
+    detach_snapshots(tbl);
+
     MDB_DLIST_FOR_EACH_SAFE(mdb_row_t, link, row,n, &tbl->rows)
         mdb_row_delete(tbl, row, 0, 1);
 
+    mdb_row_pool_done(&tbl->rowpool);
+
     for (i = 0, cols = tbl->columns;   i < tbl->ncolumn;    i++)
         free(cols[i].name);
 
@@ -611,6 +980,394 @@ static int table_print_info(mdb_table_t *tbl, char *buf, int len)
 #endif
 
 
+static int is_operator(mqi_cond_entry_t *ce, mqi_operator_t op)
+{
+    return ce->type == mqi_operator && ce->u.operator_ == op;
+}
+
+static int is_operand(mqi_cond_entry_t *ce)
+{
+    return ce->type == mqi_column || ce->type == mqi_variable;
+}
+
+static int is_relop(mqi_cond_entry_t *ce)
+{
+    if (ce->type != mqi_operator)
+        return 0;
+
+    switch (ce->u.operator_) {
+    case mqi_less: case mqi_leq: case mqi_eq: case mqi_geq: case mqi_gt:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static mqi_operator_t flip_relop(mqi_operator_t op)
+{
+    switch (op) {
+    case mqi_less: return mqi_gt;
+    case mqi_leq:  return mqi_geq;
+    case mqi_geq:  return mqi_leq;
+    case mqi_gt:   return mqi_less;
+    default:       return op;
+    }
+}
+
+/*
+ * Collect the 'column <relop> variable' terms of a condition, if at its
+ * top level the condition is a conjunction. Returns the number of terms,
+ * or -1 if the condition can't be used for index lookups.
+ */
+static int cond_terms(mdb_table_t *tbl, mqi_cond_entry_t *cond,
+                      cond_term_t *terms, int max)
+{
+    mqi_cond_entry_t *ce, *col, *var;
+    mqi_operator_t    op;
+    int               depth, boundary, nterm;
+
+    nterm    = 0;
+    depth    = 0;
+    boundary = 1;
+
+    for (ce = cond;  ;  ce++) {
+        if (ce->type == mqi_operator) {
+            switch (ce->u.operator_) {
+            case mqi_begin:
+                depth++;
+                boundary = 0;
+                continue;
+            case mqi_end:
+                if (depth-- == 0)
+                    return nterm;
+                continue;
+            case mqi_or:
+            case mqi_not:
+                if (depth == 0)
+                    return -1;
+                continue;
+            default:
+                if (depth == 0)
+                    boundary = (ce->u.operator_ == mqi_and);
+                continue;
+            }
+        }
+
+        if (!is_operand(ce))
+            return -1;
+
+        if (depth > 0)
+            continue;
+
+        if (boundary && is_relop(ce + 1) && is_operand(ce + 2) &&
+            (is_operator(ce + 3, mqi_and) || is_operator(ce + 3, mqi_end)))
+        {
+            op = ce[1].u.operator_;
+
+            if (ce->type == mqi_column) {
+                col = ce;
+                var = ce + 2;
+            }
+            else {
+                col = ce + 2;
+                var = ce;
+                op  = flip_relop(op);
+            }
+
+            if (col->type == mqi_column && var->type == mqi_variable &&
+                var->u.variable.v.generic != NULL &&
+                tbl->columns[col->u.column].type == var->u.variable.type &&
+                nterm < max)
+            {
+                terms[nterm].cindex = col->u.column;
+                terms[nterm].op     = op;
+                terms[nterm].var    = &var->u.variable;
+                nterm++;
+            }
+
+            ce += 2;
+        }
+
+        boundary = 0;
+    }
+}
+
+static void write_key(mdb_table_t *tbl, void *key, cond_term_t *term)
+{
+    mqi_column_desc_t src;
+
+    src.cindex = term->cindex;
+    src.offset = 0;
+
+    mdb_column_write_key(tbl->columns + term->cindex, key, &src,
+                         term->var->v.generic);
+}
+
+/* whether the variable can be stored in the column without truncation */
+static int fits_column(mdb_table_t *tbl, cond_term_t *term)
+{
+    mdb_column_t *col = tbl->columns + term->cindex;
+    char         *str;
+
+    if (col->type != mqi_varchar)
+        return 1;
+
+    str = *term->var->v.varchar;
+
+    if (MDB_COLUMN_INTERNED(col))
+        return str == NULL || (int)strlen(str) < col->maxlen;
+
+    return str == NULL || (int)strlen(str) < col->length;
+}
+
+static int plan_by_primary(mdb_table_t *tbl, cond_term_t *terms, int nterm,
+                           plan_t *plan)
+{
+    mdb_index_t       *ix = &tbl->index;
+    cond_term_t       *eq[MQI_COLUMN_MAX];
+    mqi_column_desc_t  src;
+    char               idxval[MDB_INDEX_LENGTH_MAX];
+    void              *data;
+    int                i, j, nvar;
+
+    if (!MDB_TABLE_HAS_INDEX(tbl) || ix->ncolumn > MQI_COLUMN_MAX)
+        return 0;
+
+    for (i = 0, nvar = 0;  i < ix->ncolumn;  i++) {
+        for (j = 0, eq[i] = NULL;  j < nterm && !eq[i];  j++) {
+            if (terms[j].cindex == ix->columns[i] && terms[j].op == mqi_eq) {
+                eq[i] = terms + j;
+                nvar++;
+            }
+        }
+    }
+
+    if (nvar != ix->ncolumn)
+        return 0;
+
+    memset(idxval, 0, ix->length);
+    data = idxval - ix->offset;
+    src.offset = 0;
+
+    for (i = 0;  i < ix->ncolumn;  i++) {
+        src.cindex = ix->columns[i];
+        mdb_column_write_key(tbl->columns + src.cindex, data, &src,
+                             eq[i]->var->v.generic);
+    }
+
+    plan->single = mdb_index_get_row(tbl, ix->length, idxval);
+    plan->rows   = &plan->single;
+    plan->nrow   = plan->single ? 1 : 0;
+
+    return 1;
+}
+
+static int plan_by_secondary(mdb_table_t *tbl, cond_term_t *terms, int nterm,
+                             plan_t *plan)
+{
+    mdb_secindex_t *si;
+    mqi_bitfld_t    eqmask;
+    void           *key, *low, *high;
+    int             lowinc, highinc;
+    int             i, c, n;
+
+    key = alloca(3 * tbl->dlgh);
+    memset(key, 0, 3 * tbl->dlgh);
+
+    mqi_bitfld_clear(&eqmask);
+
+    for (i = 0;  i < nterm;  i++) {
+        c = terms[i].cindex;
+
+        if (terms[i].op == mqi_eq && !mqi_bitfld_test(&eqmask, c)) {
+            write_key(tbl, key, terms + i);
+            mqi_bitfld_set(&eqmask, c);
+        }
+    }
+
+    /* prefer an index with an equality on all of its columns */
+    for (si = tbl->secondary;  si;  si = si->next) {
+        if (mqi_bitfld_contains(&eqmask, &si->cmask)) {
+            n = mdb_index_secondary_lookup(tbl, si, key, &plan->rows);
+            goto found;
+        }
+    }
+
+    /* otherwise try a range on the first column of an ordered index */
+    for (si = tbl->secondary;  si;  si = si->next) {
+        if (si->type != mqi_index_ordered)
+            continue;
+
+        low  = NULL;
+        high = NULL;
+        lowinc = highinc = 0;
+
+        for (i = 0;  i < nterm;  i++) {
+            if (terms[i].cindex != si->columns[0] || !fits_column(tbl, terms+i))
+                continue;
+
+            switch (terms[i].op) {
+            case mqi_eq:
+            case mqi_geq:
+            case mqi_gt:
+                low    = key + tbl->dlgh;
+                lowinc = (terms[i].op != mqi_gt);
+                write_key(tbl, low, terms + i);
+                if (terms[i].op != mqi_eq)
+                    break;
+                /* intentional fall over */
+            case mqi_leq:
+            case mqi_less:
+                high    = key + 2 * tbl->dlgh;
+                highinc = (terms[i].op != mqi_less);
+                write_key(tbl, high, terms + i);
+                break;
+            default:
+                break;
+            }
+        }
+
+        if (low || high) {
+            n = mdb_index_secondary_range(tbl, si, low, lowinc, high, highinc,
+                                          &plan->rows);
+            goto found;
+        }
+    }
+
+    return 0;
+
+ found:
+    if (n < 0)
+        return 0;
+
+    plan->nrow = n;
+
+    return 1;
+}
+
+/*
+ * Try to find the candidate rows for a condition using the table indexes
+ * instead of scanning the whole table. The caller still has to evaluate
+ * the full condition on all candidate rows.
+ *
+ * Returns 1 if the indexes were used (plan is set up with the candidates),
+ * 0 if the whole table needs to be scanned.
+ */
+static int plan_query(mdb_table_t *tbl, mqi_cond_entry_t *cond, plan_t *plan)
+{
+    cond_term_t terms[MQI_COND_MAX];
+    int         nterm;
+
+    plan->single = NULL;
+    plan->rows   = NULL;
+    plan->nrow   = 0;
+
+    if (!MDB_TABLE_HAS_INDEX(tbl) && !tbl->secondary)
+        return 0;
+
+    if ((nterm = cond_terms(tbl, cond, terms, MQI_COND_MAX)) <= 0)
+        return 0;
+
+    if (plan_by_primary(tbl, terms, nterm, plan))
+        return 1;
+
+    return plan_by_secondary(tbl, terms, nterm, plan);
+}
+
+static void plan_done(plan_t *plan)
+{
+    if (plan->rows != &plan->single)
+        free(plan->rows);
+
+    plan->rows = NULL;
+    plan->nrow = 0;
+}
+
+static mdb_row_t *cursor_next_row(mdb_cursor_t *c)
+{
+    mdb_row_t *row;
+
+    while (!c->done) {
+        if (!c->planned)
+            row = table_iterator(c->tbl, &c->it);
+        else if (c->next < c->plan.nrow)
+            row = c->plan.rows[c->next++];
+        else
+            row = NULL;
+
+        if (!row)
+            c->done = 1;
+        else if (!c->cond || mdb_cond_execute(&c->prog, row->data) > 0)
+            return row;
+    }
+
+    return NULL;
+}
+
+/* the rows and their copies go away with the table */
+static void detach_snapshots(mdb_table_t *tbl)
+{
+    mdb_cursor_t *c, *n;
+
+    MDB_DLIST_FOR_EACH_SAFE(mdb_cursor_t, link, c,n, &tbl->snapshots) {
+        MDB_DLIST_UNLINK(mdb_cursor_t, link, c);
+        c->tbl   = NULL;
+        c->error = ENOENT;
+    }
+}
+
+/* fetch the next block of rows for mdb_cond_scan */
+static int table_block(mdb_table_t *tbl, table_iterator_t *it,
+                       mdb_row_t **rows)
+{
+    int n;
+
+    for (n = 0;  n < MDB_COND_BLOCK;  n++) {
+        if (!(rows[n] = table_iterator(tbl, it)))
+            break;
+    }
+
+    return n;
+}
+
+static int select_rows(mdb_table_t       *tbl,
+                       mdb_cond_prog_t   *prog,
+                       mdb_row_t        **rows,
+                       int                nrow,
+                       mqi_column_desc_t *cds,
+                       void              *results,
+                       int                size,
+                       int                dim,
+                       int               *nresultp)
+{
+    mdb_column_t      *columns = tbl->columns;
+    uint8_t            sel[MDB_COND_BLOCK];
+    void              *result;
+    mqi_column_desc_t *result_dsc;
+    int                cindex;
+    int                i, j;
+
+    if (mdb_cond_scan(prog, rows, nrow, sel) <= 0)
+        return 0;
+
+    for (j = 0;  j < nrow;  j++) {
+        if (!sel[j])
+            continue;
+
+        if (*nresultp >= dim) {
+            errno = EOVERFLOW;
+            return -1;
+        }
+
+        result = results + (size * (*nresultp)++);
+
+        for (i = 0;  (cindex = (result_dsc = cds + i)->cindex) >= 0;   i++)
+            mdb_column_read(result_dsc, result, columns+cindex, rows[j]->data);
+    }
+
+    return 0;
+}
+
 static int select_conditional(mdb_table_t       *tbl,
                               mqi_cond_entry_t  *cond,
                               mqi_column_desc_t *cds,
@@ -618,29 +1375,43 @@ static int select_conditional(mdb_table_t       *tbl,
                               int                size,
                               int                dim)
 {
-    mdb_column_t      *columns = tbl->columns;
-    mdb_row_t         *row;
-    mqi_cond_entry_t  *ce;
+    mdb_row_t         *rows[MDB_COND_BLOCK];
+    mdb_cond_prog_t    prog;
     table_iterator_t   it;
     int                nresult;
-    void              *result;
-    mqi_column_desc_t *result_dsc;
-    int                cindex;
-    int                i;
+    plan_t             plan;
+    int                nrow;
+    int                j;
+
+    if (mdb_cond_compile(tbl, cond, &prog) < 0)
+        return -1;
 
-    for (it.cursor = NULL, nresult = 0;  (row = table_iterator(tbl, &it)); ) {
-        ce = cond;
-        if (mdb_cond_evaluate(tbl, &ce, row->data)) {
-            if (nresult >= dim) {
-                errno = EOVERFLOW;
+    /* rows are matched a block at a time, see mdb_cond_scan */
+    if (plan_query(tbl, cond, &plan)) {
+        for (j = 0, nresult = 0;  j < plan.nrow;  j += nrow) {
+            nrow = plan.nrow - j;
+
+            if (nrow > MDB_COND_BLOCK)
+                nrow = MDB_COND_BLOCK;
+
+            if (select_rows(tbl, &prog, plan.rows + j, nrow,
+                            cds, results, size, dim, &nresult) < 0) {
+                plan_done(&plan);
                 return -1;
             }
+        }
 
-            result = results + (size * nresult++);
+        plan_done(&plan);
 
-            for (i = 0;  (cindex = (result_dsc = cds + i)->cindex) >= 0;   i++)
-                mdb_column_read(result_dsc, result, columns+cindex, row->data);
-        }
+        return nresult;
+    }
+
+    for (it.cursor = NULL, nresult = 0;
+         (nrow = table_block(tbl, &it, rows)); )
+    {
+        if (select_rows(tbl, &prog, rows, nrow,
+                        cds, results, size, dim, &nresult) < 0)
+            return -1;
     }
 
     return nresult;
@@ -705,13 +1476,75 @@ static int update_conditional(mdb_table_t       *tbl,
                               int                index_update)
 {
     mdb_row_t        *row;
-    mqi_cond_entry_t *ce;
+    mdb_row_t        *rows[MDB_COND_BLOCK];
+    uint8_t           sel[MDB_COND_BLOCK];
+    mdb_cond_prog_t   prog;
     table_iterator_t  it;
-    int               nupdate, changed;
+    plan_t            plan;
+    int               nupdate, changed, nrow, i, j;
+
+    if (mdb_cond_compile(tbl, cond, &prog) < 0)
+        return -1;
+
+    /*
+     * The rows of the plan are fixed, so they can be matched a block at
+     * a time. When iterating the table, updating the index can reorder
+     * the rows under the iterator, so then we go row by row.
+     */
+    if (plan_query(tbl, cond, &plan)) {
+        for (i = 0, nupdate = 0;  i < plan.nrow;  i += nrow) {
+            nrow = plan.nrow - i;
+
+            if (nrow > MDB_COND_BLOCK)
+                nrow = MDB_COND_BLOCK;
+
+            if (mdb_cond_scan(&prog, plan.rows + i, nrow, sel) <= 0)
+                continue;
+
+            for (j = 0;  j < nrow;  j++) {
+                if (!sel[j])
+                    continue;
+
+                row = plan.rows[i + j];
+                changed = update_single_row(tbl, row, cds, data, index_update);
+
+                if (changed < 0)
+                    nupdate = -1;
+                else
+                    nupdate += (nupdate >= 0) ? changed : 0;
+            }
+        }
+
+        plan_done(&plan);
+
+        return nupdate;
+    }
+
+    if (!index_update) {
+        for (it.cursor = NULL, nupdate = 0;
+             (nrow = table_block(tbl, &it, rows)); )
+        {
+            if (mdb_cond_scan(&prog, rows, nrow, sel) <= 0)
+                continue;
+
+            for (j = 0;  j < nrow;  j++) {
+                if (!sel[j])
+                    continue;
+
+                changed = update_single_row(tbl, rows[j], cds, data, 0);
+
+                if (changed < 0)
+                    nupdate = -1;
+                else
+                    nupdate += (nupdate >= 0) ? changed : 0;
+            }
+        }
+
+        return nupdate;
+    }
 
     for (it.cursor = NULL, nupdate = 0;  (row = table_iterator(tbl, &it)); ) {
-        ce = cond;
-        if (mdb_cond_evaluate(tbl, &ce, row->data)) {
+        if (mdb_cond_execute(&prog, row->data)) {
             changed = update_single_row(tbl, row, cds, data, index_update);
 
             if (changed < 0)
@@ -757,20 +1590,43 @@ static int update_single_row(mdb_table_t       *tbl,
 {
     mdb_row_t   *before  = NULL;
     uint32_t     txdepth = mdb_transaction_get_depth();
-    mqi_bitfld_t cmask;
-    int          changed;
+    mqi_bitfld_t cmask, umask;
+    int          changed, i;
 
     if (txdepth > 0 && !(before = mdb_row_duplicate(tbl, row)))
         return -1;
 
+    /* the log entry of the old key has to go before the key changes */
+    if (index_update && mdb_persist_change(tbl, mdb_persist_del, row) < 0)
+        return -1;
+
+    /*
+     * A primary index update re-indexes the row in all indexes. Otherwise
+     * we need to re-index the row in the affected secondary indexes.
+     */
+    mqi_bitfld_clear(&umask);
+
+    for (i = 0;  cds[i].cindex >= 0;  i++)
+        mqi_bitfld_set(&umask, cds[i].cindex);
+
+    if (!index_update)
+        mdb_index_delete_secondary(tbl, row, &umask);
+
     changed = mdb_row_update(tbl, row, cds, data, index_update, &cmask);
 
+    if (!index_update && changed >= 0 &&
+        mdb_index_insert_secondary(tbl, row, &umask) < 0)
+        changed = -1;
+
     if (changed <= 0) {
+        if (index_update)
+            mdb_persist_change(tbl, mdb_persist_put, row);
         mdb_row_delete(tbl, before, 0, 1);
         return changed;
     }
 
-    if (mdb_log_change(tbl, txdepth, mdb_log_update, cmask, before, row) < 0)
+    if (mdb_log_change(tbl, txdepth, mdb_log_update, &cmask, before, row) < 0 ||
+        mdb_persist_change(tbl, mdb_persist_put, row) < 0)
         return -1;
 
     return 1;
@@ -780,13 +1636,34 @@ static int delete_conditional(mdb_table_t *tbl, mqi_cond_entry_t *cond)
 {
     table_iterator_t  it;
     mdb_row_t        *row;
-    mqi_cond_entry_t *ce;
-    int               ndelete;
+    mdb_cond_prog_t   prog;
+    plan_t            plan;
+    int               ndelete, i;
+
+    if (mdb_cond_compile(tbl, cond, &prog) < 0)
+        return -1;
+
+    if (plan_query(tbl, cond, &plan)) {
+        for (i = 0, ndelete = 0;  i < plan.nrow;  i++) {
+            row = plan.rows[i];
+
+            if (mdb_cond_execute(&prog, row->data) <= 0)
+                continue;
+
+            if (delete_single_row(tbl, row, 1) < 0)
+                ndelete = -1;
+            else
+                ndelete += (ndelete >= 0) ? 1 : 0;
+        }
+
+        plan_done(&plan);
+
+        return ndelete;
+    }
 
     for (it.cursor = NULL, ndelete = 0; (row = table_iterator(tbl, &it)); )
     {
-        ce = cond;
-        if (mdb_cond_evaluate(tbl, &ce, row->data)) {
+        if (mdb_cond_execute(&prog, row->data)) {
             if (delete_single_row(tbl, row, 1) < 0)
                 ndelete = -1;
             else
@@ -819,10 +1696,12 @@ static int delete_single_row(mdb_table_t *tbl, mdb_row_t *row,int index_update)
 {
     uint32_t txdepth = mdb_transaction_get_depth();
 
+    mdb_persist_change(tbl, mdb_persist_del, row);
+
     mdb_row_delete(tbl, row, index_update, !txdepth);
 
     if (txdepth)
-        mdb_log_change(tbl, txdepth, mdb_log_delete, 0, row, NULL);
+        mdb_log_change(tbl, txdepth, mdb_log_delete, NULL, row, NULL);
 
     return 0;
 }
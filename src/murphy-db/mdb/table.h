@@ -37,25 +37,41 @@
 #include "column.h"
 #include "log.h"
 #include "trigger.h"
+#include "persist.h"
 
 #define MDB_TABLE_HAS_INDEX(t)  MDB_INDEX_DEFINED(&t->index)
 
+#define MDB_TABLE_PRESERVE_ROW(t, r)                            \
+    do {                                                        \
+        if (!MDB_DLIST_EMPTY((t)->snapshots))                   \
+            mdb_table_preserve_row(t, r);                       \
+    } while (0)
+
 struct mdb_table_s {
     mqi_handle_t  handle;
     char         *name;
     mdb_index_t   index;
+    mdb_secindex_t *secondary;   /* secondary indexes */
     mdb_hash_t   *chash;         /* hash table for column names */
     int           ncolumn;
     mdb_column_t *columns;
     int           dlgh;          /* length of row data */
+    int           ninterned;     /* number of interned columns */
     int           nrow;
+    uint32_t      rowgen;        /* bumped whenever a row is removed */
     mdb_dlist_t   rows;
+    mdb_rowpool_t rowpool;       /* storage for the rows */
+    mdb_dlist_t   snapshots;     /* open snapshot cursors */
     mdb_dlist_t   logs;         /* transaction logs */
+    mdb_persist_t *persist;      /* snapshot and log, if persistent */
     mdb_opcnt_t   cnt;
     mdb_trigger_t trigger;      /* must be the last: it has a array[0] @end  */
 };
 
 
+void mdb_table_preserve_row(mdb_table_t *, mdb_row_t *);
+
+
 #endif /* __MDB_TABLE_H__ */
 
 /*
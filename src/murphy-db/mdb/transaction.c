@@ -43,9 +43,21 @@
 
 #define TRANSACTION_STATISTICS
 
+#ifdef TRANSACTION_STATISTICS
+#define TX_STAT(s)   (tx_stats.s)
+#else
+#define TX_STAT(s)   (tx_dummy)
+#endif
+
 
 static uint32_t txdepth;
 
+#ifdef TRANSACTION_STATISTICS
+static mdb_transaction_stats_t tx_stats;
+#else
+static uint64_t tx_dummy;
+#endif
+
 static int destroy_row(mdb_table_t *, mdb_row_t *);
 static int remove_row(mdb_table_t *, mdb_row_t *);
 static int add_row(mdb_table_t *, mdb_row_t *);
@@ -55,12 +67,14 @@ static int check_stamp(mdb_log_entry_t *);
 
 uint32_t mdb_transaction_begin(void)
 {
+    TX_STAT(begun)++;
+
     return ++txdepth;
 }
 
 int mdb_transaction_commit(uint32_t depth)
 {
-#define DATA_MAX  (MQI_COLUMN_MAX * MQI_QUERY_RESULT_MAX)
+#define DATA_MAX  (MQI_COLUMN_MAX * (MDB_COLUMN_LENGTH_MAX + 1))
 #define CHECK_TRIGGER_START(en) do {                    \
         if (!start_triggered) {                         \
             start_triggered = true;                     \
@@ -85,6 +99,17 @@ int mdb_transaction_commit(uint32_t depth)
 
     MDB_CHECKARG(depth > 0 && depth == txdepth, -1);
 
+    /* a transaction that ran over the log limit can only be rolled back */
+    if (mdb_log_clear_overflow(depth)) {
+        mdb_transaction_rollback(depth);
+        TX_STAT(failed)++;
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    if (mdb_persist_transaction(depth) < 0)
+        sts = -1;
+
     MDB_TRANSACTION_LOG_FOR_EACH_DELETE(depth, en, MDB_BACKWARD, cursor) {
 
         if (!(before = en->before))
@@ -98,25 +123,30 @@ int mdb_transaction_commit(uint32_t depth)
         case mdb_log_insert:
             CHECK_TRIGGER_START(en);
             mdb_trigger_row_insert(en->table, after);
-            mdb_trigger_column_change(en->table, en->colmask, before, after);
+            mdb_trigger_column_change(en->table, &en->colmask, before, after);
+            mdb_trigger_changeset_collect(en->table, mqi_row_inserted,
+                                          &en->colmask, NULL, en->after);
             s = 0;
             break;
 
         case mdb_log_update:
             CHECK_TRIGGER_START(en);
-            mdb_trigger_column_change(en->table, en->colmask, before, after);
+            mdb_trigger_column_change(en->table, &en->colmask, before, after);
+            mdb_trigger_changeset_collect(en->table, mqi_column_changed,
+                                          &en->colmask, en->before, en->after);
             s = destroy_row(en->table, en->before);
             break;
 
         case mdb_log_delete:
             CHECK_TRIGGER_START(en);
             mdb_trigger_row_delete(en->table, before);
+            mdb_trigger_changeset_collect(en->table, mqi_row_deleted,
+                                          NULL, en->before, NULL);
             s = destroy_row(en->table, en->before);
             break;
 
         case mdb_log_start:
             check_stamp(en);
-            free(en->cnt);
             s = 0;
             break;
 
@@ -131,8 +161,18 @@ int mdb_transaction_commit(uint32_t depth)
 
     txdepth--;
 
+    if (mdb_persist_flush_all() < 0 && sts == 0)
+        sts = -1;
+
+    mdb_trigger_changeset_deliver(depth);
+
     CHECK_TRIGGER_END();
 
+    if (sts == 0)
+        TX_STAT(committed)++;
+    else
+        TX_STAT(failed)++;
+
     return sts;
 
 #undef DATA_MAX
@@ -147,6 +187,8 @@ int mdb_transaction_rollback(uint32_t depth)
 
     MDB_CHECKARG(depth > 0 && depth == txdepth, -1);
 
+    mdb_log_clear_overflow(depth);
+
     MDB_TRANSACTION_LOG_FOR_EACH_DELETE(depth, en, MDB_FORWARD, cursor) {
 
         tbl = en->table;
@@ -166,6 +208,8 @@ int mdb_transaction_rollback(uint32_t depth)
 
     txdepth--;
 
+    TX_STAT(rolledback)++;
+
     return sts;
 }
 
@@ -200,6 +244,19 @@ uint32_t mdb_transaction_get_depth(void)
     return txdepth;
 }
 
+int mdb_transaction_get_statistics(mdb_transaction_stats_t *stats)
+{
+    MDB_CHECKARG(stats, -1);
+
+#ifdef TRANSACTION_STATISTICS
+    *stats = tx_stats;
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif
+
+    return 0;
+}
+
 static int destroy_row(mdb_table_t *tbl, mdb_row_t *row)
 {
     MDB_CHECKARG(tbl && row && MDB_DLIST_EMPTY(row->link), -1);
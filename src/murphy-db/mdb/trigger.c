@@ -45,6 +45,10 @@
 #define LOG_TRIGGER
 #endif
 
+#define CHANGESET_NO_IMAGE   ((size_t)-1)
+#define CHANGESET_CHANGES    32
+#define CHANGESET_POOL       4096
+
 typedef struct callback_s         callback_t;
 typedef struct select_s           select_t;
 
@@ -52,6 +56,7 @@ typedef struct column_trigger_s   column_trigger_t;
 typedef struct row_trigger_s      row_trigger_t;
 typedef struct table_trigger_s    table_trigger_t;
 typedef struct transact_trigger_s transact_trigger_t;
+typedef struct changeset_trigger_s changeset_trigger_t;
 
 struct callback_s {
     mqi_trigger_cb_t  function;
@@ -86,36 +91,45 @@ struct transact_trigger_s {
     callback_t   callback;
 };
 
+struct changeset_trigger_s {
+    mdb_dlist_t   link;
+    callback_t    callback;
+    mqi_bitfld_t  colmask;      /* updates of other columns are filtered */
+    select_t      select;
+};
 
-static int8_t lowest_bit_in[256] = {
-    /*         0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F */
-    /*        -------------------------------------------------------------- */
-    /* 00 */  -1,  0,  1,  0,  2,  0,  1,  0,  3,  0,  1,  0,  2,  0,  1,  0,
-    /* 10 */   4,  0,  1,  0,  2,  0,  1,  0,  3,  0,  1,  0,  2,  0,  1,  0,
-    /* 20 */   5,  0,  1,  0,  2,  0,  1,  0,  3,  0,  1,  0,  2,  0,  1,  0,
-    /* 30 */   4,  0,  1,  0,  2,  0,  1,  0,  3,  0,  1,  0,  2,  0,  1,  0,
-    /* 40 */   6,  0,  1,  0,  2,  0,  1,  0,  3,  0,  1,  0,  2,  0,  1,  0,
-    /* 50 */   4,  0,  1,  0,  2,  0,  1,  0,  3,  0,  1,  0,  2,  0,  1,  0,
-    /* 60 */   5,  0,  1,  0,  2,  0,  1,  0,  3,  0,  1,  0,  2,  0,  1,  0,
-    /* 70 */   4,  0,  1,  0,  2,  0,  1,  0,  3,  0,  1,  0,  2,  0,  1,  0,
-    /* 80 */   7,  0,  1,  0,  2,  0,  1,  0,  3,  0,  1,  0,  2,  0,  1,  0,
-    /* 90 */   4,  0,  1,  0,  2,  0,  1,  0,  3,  0,  1,  0,  2,  0,  1,  0,
-    /* A0 */   5,  0,  1,  0,  2,  0,  1,  0,  3,  0,  1,  0,  2,  0,  1,  0,
-    /* B0 */   4,  0,  1,  0,  2,  0,  1,  0,  3,  0,  1,  0,  2,  0,  1,  0,
-    /* C0 */   6,  0,  1,  0,  2,  0,  1,  0,  3,  0,  1,  0,  2,  0,  1,  0,
-    /* D0 */   4,  0,  1,  0,  2,  0,  1,  0,  3,  0,  1,  0,  2,  0,  1,  0,
-    /* E0 */   5,  0,  1,  0,  2,  0,  1,  0,  3,  0,  1,  0,  2,  0,  1,  0,
-    /* F0 */   4,  0,  1,  0,  2,  0,  1,  0,  3,  0,  1,  0,  2,  0,  1,  0,
+typedef struct {
+    mqi_event_type_t  event;
+    mqi_bitfld_t      colmask;
+    size_t            old;      /* offsets of the row images in the pool */
+    size_t            new_;
+} pending_change_t;
+
+struct mdb_changeset_s {
+    mdb_dlist_t       link;     /* on pending_changesets */
+    mdb_table_t      *tbl;
+    pending_change_t *changes;
+    int               nchange;
+    int               nalloc;
+    uint8_t          *pool;     /* copies of the changed rows */
+    size_t            used;
+    size_t            size;
 };
 
 
 static MDB_DLIST_HEAD(table_change_triggers);
 static MDB_DLIST_HEAD(transact_change_triggers);
+static MDB_DLIST_HEAD(pending_changesets);
 
 static int get_select_params(mdb_table_t *, mqi_column_desc_t *, int *, int *);
 static void row_change(mqi_event_type_t, mdb_table_t *, mdb_row_t *);
 static void table_change(mqi_event_type_t, mdb_table_t *);
 static void transaction_change(mqi_event_type_t, uint32_t);
+static void changeset_deliver(mdb_changeset_t *, uint32_t);
+static size_t changeset_copy(mdb_changeset_t *, mdb_row_t *);
+static void changeset_unref(mdb_changeset_t *, size_t);
+static void changeset_release(mdb_changeset_t *);
+static int changeset_wants(changeset_trigger_t *, pending_change_t *);
 
 
 void mdb_trigger_init(mdb_trigger_t *trigger, int ncol)
@@ -125,22 +139,42 @@ void mdb_trigger_init(mdb_trigger_t *trigger, int ncol)
     if (!trigger || ncol < 1)
         return;
 
+    MDB_DLIST_INIT(trigger->changeset);
     MDB_DLIST_INIT(trigger->row_change);
 
+    trigger->pending = NULL;
+
     for (i = 0;  i < ncol;  i++)
         MDB_DLIST_INIT(trigger->column_change[i]);
 }
 
 void mdb_trigger_reset(mdb_trigger_t *trigger, int ncol)
 {
+    changeset_trigger_t *st, *o;
     row_trigger_t *rt, *n;
     column_trigger_t *ct, *m;
+    mdb_changeset_t *cs;
     mdb_dlist_t *head;
     int i;
 
     if (!trigger || ncol < 1)
         return;
 
+    MDB_DLIST_FOR_EACH_SAFE(changeset_trigger_t, link, st,o,
+                            &trigger->changeset) {
+        MDB_DLIST_UNLINK(changeset_trigger_t, link, st);
+        free(st);
+    }
+
+    if ((cs = trigger->pending)) {
+        MDB_DLIST_UNLINK(mdb_changeset_t, link, cs);
+        changeset_release(cs);
+        free(cs->changes);
+        free(cs->pool);
+        free(cs);
+        trigger->pending = NULL;
+    }
+
     MDB_DLIST_FOR_EACH_SAFE(row_trigger_t, link, rt,n, &trigger->row_change) {
         MDB_DLIST_UNLINK(row_trigger_t, link, rt);
         free(rt);
@@ -422,10 +456,91 @@ int mdb_trigger_delete_transaction_callback(mqi_trigger_cb_t  cb_function,
     return -1;
 }
 
-void mdb_trigger_column_change(mdb_table_t  *tbl,
-                               mqi_bitfld_t  colmask,
-                               mdb_row_t    *before,
-                               mdb_row_t    *after)
+int mdb_trigger_add_changeset_callback(mdb_table_t        *tbl,
+                                       const mqi_bitfld_t *colmask,
+                                       mqi_trigger_cb_t    cb_function,
+                                       void               *cb_data,
+                                       mqi_column_desc_t  *cds)
+{
+    changeset_trigger_t *tr;
+    size_t cdsiz;
+    int length, ncd;
+    mdb_dlist_t *head;
+
+    MDB_CHECKARG(tbl && cb_function, -1);
+
+    if (!cds)
+        ncd = length = 0;
+    else {
+        if (get_select_params(tbl, cds, &ncd, &length) < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    cdsiz = sizeof(mqi_column_desc_t) * ncd;
+    head  = &tbl->trigger.changeset;
+
+    MDB_DLIST_FOR_EACH(changeset_trigger_t, link, tr, head) {
+        if (cb_function == tr->callback.function &&
+            cb_data == tr->callback.user_data)
+        {
+            errno = EEXIST;
+            return -1;
+        }
+    }
+
+    if (!(tr = calloc(1, sizeof(changeset_trigger_t) + cdsiz))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    MDB_DLIST_APPEND(changeset_trigger_t, link, tr, head);
+
+    tr->callback.function = cb_function;
+    tr->callback.user_data = cb_data;
+
+    if (colmask)
+        tr->colmask = *colmask;
+
+    tr->select.length = length;
+    tr->select.cdsiz = cdsiz;
+
+    if (ncd > 0)
+        memcpy(tr->select.column, cds, cdsiz);
+
+    return 0;
+}
+
+int mdb_trigger_delete_changeset_callback(mdb_table_t      *tbl,
+                                          mqi_trigger_cb_t  cb_function,
+                                          void             *cb_data)
+{
+    changeset_trigger_t *tr, *n;
+    mdb_dlist_t *head;
+
+    MDB_CHECKARG(tbl && cb_function, -1);
+
+    head = &tbl->trigger.changeset;
+
+    MDB_DLIST_FOR_EACH_SAFE(changeset_trigger_t, link, tr,n, head) {
+        if (cb_function == tr->callback.function &&
+            cb_data == tr->callback.user_data)
+        {
+            MDB_DLIST_UNLINK(changeset_trigger_t, link, tr);
+            free(tr);
+            return 0;
+        }
+    }
+
+    errno = ENOENT;
+    return -1;
+}
+
+void mdb_trigger_column_change(mdb_table_t        *tbl,
+                               const mqi_bitfld_t *colmask,
+                               mdb_row_t          *before,
+                               mdb_row_t          *after)
 {
     mqi_event_t         evt;
     mdb_dlist_t        *hd;
@@ -435,10 +550,9 @@ void mdb_trigger_column_change(mdb_table_t  *tbl,
     mqi_column_event_t *ce;
     int                 cx;
     int                 sx;
-    mqi_bitfld_t        mask, byte;
-    int                 i,j,k;
+    int                 k;
 
-    if (!tbl || !colmask || !before || !after)
+    if (!tbl || !colmask || !before || !after || mqi_bitfld_empty(colmask))
         return;
 
     memset(&evt, 0, sizeof(evt));
@@ -454,36 +568,32 @@ void mdb_trigger_column_change(mdb_table_t  *tbl,
     if (!ce->select.data)
         return;
 
-    for (mask = colmask, i = 0;     mask != 0;     mask >>= 8, i += 8) {
-        byte = mask & 0xff;
-
-        while ((j = lowest_bit_in[byte]) >= 0) {
-            byte &= ~MQI_BIT(j);
-            cx  = i + j;
-            col = tbl->columns + cx;
-            hd  = tbl->trigger.column_change + cx;
+    for (cx = mqi_bitfld_next(colmask, 0);  cx >= 0 && cx < tbl->ncolumn;
+         cx = mqi_bitfld_next(colmask, cx + 1))
+    {
+        col = tbl->columns + cx;
+        hd  = tbl->trigger.column_change + cx;
 
-            MDB_DLIST_FOR_EACH(column_trigger_t, link, tr, hd) {
-                ce->column.index = cx;
-                ce->column.name  = tbl->columns[cx].name;
+        MDB_DLIST_FOR_EACH(column_trigger_t, link, tr, hd) {
+            ce->column.index = cx;
+            ce->column.name  = tbl->columns[cx].name;
 
-                ce->value.type = tbl->columns[cx].type;
+            ce->value.type = tbl->columns[cx].type;
 
-                cd.cindex = cx;
-                cd.offset = 0;
+            cd.cindex = cx;
+            cd.offset = 0;
 
-                mdb_column_read(&cd, &ce->value.old, col, before->data);
-                mdb_column_read(&cd, &ce->value.new_, col, after->data );
+            mdb_column_read(&cd, &ce->value.old, col, before->data);
+            mdb_column_read(&cd, &ce->value.new_, col, after->data );
 
-                if (tr->select.length > 0) {
-                    for (k = 0; (sx = tr->select.column[k].cindex) >= 0;  k++){
-                        mdb_column_read(tr->select.column + k, ce->select.data,
-                                        tbl->columns + sx, after->data);
-                    }
+            if (tr->select.length > 0) {
+                for (k = 0;  (sx = tr->select.column[k].cindex) >= 0;  k++) {
+                    mdb_column_read(tr->select.column + k, ce->select.data,
+                                    tbl->columns + sx, after->data);
                 }
-
-                tr->callback.function(&evt, tr->callback.user_data);
             }
+
+            tr->callback.function(&evt, tr->callback.user_data);
         }
     }
 }
@@ -524,6 +634,99 @@ void mdb_trigger_transaction_end(uint32_t depth)
     transaction_change(mqi_transaction_end, depth);
 }
 
+/*
+ * Changes of tables with change-set triggers are copied aside while a
+ * transaction is committed and are delivered as one event per table,
+ * after all the changes are in place.
+ */
+void mdb_trigger_changeset_collect(mdb_table_t        *tbl,
+                                   mqi_event_type_t    event,
+                                   const mqi_bitfld_t *colmask,
+                                   mdb_row_t          *before,
+                                   mdb_row_t          *after)
+{
+    mdb_changeset_t     *cs;
+    changeset_trigger_t *tr;
+    pending_change_t    *ch;
+    pending_change_t     change;
+    void                *changes;
+    int                  nalloc;
+    bool                 wanted;
+
+    if (!tbl || MDB_DLIST_EMPTY(tbl->trigger.changeset))
+        return;
+
+    change.event = event;
+
+    if (colmask)
+        change.colmask = *colmask;
+    else
+        mqi_bitfld_clear(&change.colmask);
+
+    wanted = false;
+
+    MDB_DLIST_FOR_EACH(changeset_trigger_t, link, tr, &tbl->trigger.changeset){
+        if ((wanted = changeset_wants(tr, &change)))
+            break;
+    }
+
+    if (!wanted)
+        return;
+
+    if (!(cs = tbl->trigger.pending)) {
+        if (!(cs = calloc(1, sizeof(mdb_changeset_t))))
+            return;
+
+        MDB_DLIST_INIT(cs->link);
+        cs->tbl = tbl;
+
+        tbl->trigger.pending = cs;
+    }
+
+    if (cs->nchange >= cs->nalloc) {
+        nalloc = cs->nalloc ? cs->nalloc * 2 : CHANGESET_CHANGES;
+
+        if (!(changes = realloc(cs->changes, sizeof(*ch) * nalloc)))
+            return;
+
+        cs->changes = changes;
+        cs->nalloc  = nalloc;
+    }
+
+    change.old  = before ? changeset_copy(cs, before) : CHANGESET_NO_IMAGE;
+    change.new_ = after  ? changeset_copy(cs, after)  : CHANGESET_NO_IMAGE;
+
+    if ((before && change.old  == CHANGESET_NO_IMAGE) ||
+        (after  && change.new_ == CHANGESET_NO_IMAGE))
+    {
+        changeset_unref(cs, change.old);
+        changeset_unref(cs, change.new_);
+        return;
+    }
+
+    cs->changes[cs->nchange++] = change;
+
+    if (MDB_DLIST_EMPTY(cs->link))
+        MDB_DLIST_APPEND(mdb_changeset_t, link, cs, &pending_changesets);
+}
+
+void mdb_trigger_changeset_deliver(uint32_t depth)
+{
+    mdb_changeset_t *cs;
+
+    /*
+     * callbacks can commit transactions of their own, which deliver (and
+     * unlink) further pending change sets, so always take the first one
+     */
+    while (!MDB_DLIST_EMPTY(pending_changesets)) {
+        cs = MDB_LIST_RELOCATE(mdb_changeset_t, link, pending_changesets.next);
+        MDB_DLIST_UNLINK(mdb_changeset_t, link, cs);
+
+        changeset_deliver(cs, depth);
+        changeset_release(cs);
+    }
+}
+
 static int get_select_params(mdb_table_t       *tbl,
                              mqi_column_desc_t *cds,
                              int               *ncd_ret,
@@ -619,6 +822,148 @@ static void transaction_change(mqi_event_type_t event, uint32_t depth)
     }
 }
 
+static void changeset_deliver(mdb_changeset_t *cs, uint32_t depth)
+{
+    mdb_table_t           *tbl = cs->tbl;
+    mqi_event_t            evt;
+    mqi_changeset_event_t *se;
+    changeset_trigger_t   *tr;
+    pending_change_t      *ch;
+    mqi_change_t          *changes, *c;
+    uint8_t               *data;
+    int                    length;
+    int                    nchange;
+    int                    i, k, sx;
+
+    memset(&evt, 0, sizeof(evt));
+    se = &evt.changeset;
+
+    se->event = mqi_changeset;
+    se->depth = depth;
+
+    se->table.handle = tbl->handle;
+    se->table.name   = tbl->name;
+
+    MDB_DLIST_FOR_EACH(changeset_trigger_t, link, tr, &tbl->trigger.changeset){
+        for (i = nchange = 0;  i < cs->nchange;  i++) {
+            if (changeset_wants(tr, cs->changes + i))
+                nchange++;
+        }
+
+        if (!nchange)
+            continue;
+
+        /*
+         * keep the selected rows aligned for the floating columns and
+         * leave room for the pointer of a short varchar at the end
+         */
+        length = (tr->select.length + sizeof(void *) + 7) & ~7;
+
+        if (!(changes = malloc((sizeof(*c) + 2 * length) * nchange)))
+            continue;
+
+        data = (uint8_t *)(changes + nchange);
+
+        for (i = 0, c = changes;  i < cs->nchange;  i++) {
+            ch = cs->changes + i;
+
+            if (!changeset_wants(tr, ch))
+                continue;
+
+            c->event   = ch->event;
+            c->colmask = ch->colmask;
+            c->old     = NULL;
+            c->new_    = NULL;
+
+            if (length > 0) {
+                if (ch->old != CHANGESET_NO_IMAGE) {
+                    c->old = data;
+                    data  += length;
+
+                    for (k = 0; (sx = tr->select.column[k].cindex) >= 0; k++){
+                        mdb_column_read(tr->select.column + k, c->old,
+                                        tbl->columns + sx, cs->pool + ch->old);
+                    }
+                }
+
+                if (ch->new_ != CHANGESET_NO_IMAGE) {
+                    c->new_ = data;
+                    data   += length;
+
+                    for (k = 0; (sx = tr->select.column[k].cindex) >= 0; k++){
+                        mdb_column_read(tr->select.column + k, c->new_,
+                                        tbl->columns + sx, cs->pool +ch->new_);
+                    }
+                }
+            }
+
+            c++;
+        }
+
+        se->nchange = nchange;
+        se->changes = changes;
+
+        tr->callback.function(&evt, tr->callback.user_data);
+
+        free(changes);
+    }
+}
+
+static size_t changeset_copy(mdb_changeset_t *cs, mdb_row_t *row)
+{
+    size_t   dlgh = cs->tbl->dlgh;
+    size_t   size, offs;
+    uint8_t *pool;
+
+    if (cs->used + dlgh > cs->size) {
+        for (size = cs->size ? cs->size : CHANGESET_POOL;
+             size < cs->used + dlgh;
+             size *= 2)
+            ;
+
+        if (!(pool = realloc(cs->pool, size)))
+            return CHANGESET_NO_IMAGE;
+
+        cs->pool = pool;
+        cs->size = size;
+    }
+
+    offs = cs->used;
+    memcpy(cs->pool + offs, row->data, dlgh);
+    mdb_row_ref_strings(cs->tbl, cs->pool + offs);
+    cs->used += dlgh;
+
+    return offs;
+}
+
+static void changeset_unref(mdb_changeset_t *cs, size_t offs)
+{
+    if (offs != CHANGESET_NO_IMAGE)
+        mdb_row_unref_strings(cs->tbl, cs->pool + offs);
+}
+
+static void changeset_release(mdb_changeset_t *cs)
+{
+    pending_change_t *ch;
+    int               i;
+
+    for (i = 0, ch = cs->changes;  i < cs->nchange;  i++, ch++) {
+        changeset_unref(cs, ch->old);
+        changeset_unref(cs, ch->new_);
+    }
+
+    cs->nchange = 0;
+    cs->used    = 0;
+}
+
+static int changeset_wants(changeset_trigger_t *tr, pending_change_t *ch)
+{
+    if (ch->event != mqi_column_changed || mqi_bitfld_empty(&tr->colmask))
+        return true;
+
+    return mqi_bitfld_overlap(&tr->colmask, &ch->colmask);
+}
+
 /*
  * Local Variables:
  * c-basic-offset: 4
@@ -35,15 +35,19 @@
 
 
 
+typedef struct mdb_changeset_s mdb_changeset_t;
+
 typedef struct {
-    mdb_dlist_t   row_change;
-    mdb_dlist_t   column_change[0];
+    mdb_dlist_t      changeset;     /* per transaction change-set triggers */
+    mdb_changeset_t *pending;       /* changes collected at commit */
+    mdb_dlist_t      row_change;
+    mdb_dlist_t      column_change[0];
 } mdb_trigger_t;
 
 void mdb_trigger_init(mdb_trigger_t *, int);
 void mdb_trigger_reset(mdb_trigger_t *, int);
 
-void mdb_trigger_column_change(mdb_table_t*, mqi_bitfld_t,
+void mdb_trigger_column_change(mdb_table_t*, const mqi_bitfld_t *,
                                mdb_row_t *, mdb_row_t *);
 
 void mdb_trigger_row_delete(mdb_table_t *, mdb_row_t *);
@@ -55,6 +59,11 @@ void mdb_trigger_table_drop(mdb_table_t *);
 void mdb_trigger_transaction_start(uint32_t);
 void mdb_trigger_transaction_end(uint32_t);
 
+void mdb_trigger_changeset_collect(mdb_table_t *, mqi_event_type_t,
+                                   const mqi_bitfld_t *, mdb_row_t *,
+                                   mdb_row_t *);
+void mdb_trigger_changeset_deliver(uint32_t);
+
 #endif /* __MDB_TRIGGER_H__ */
 
 /*
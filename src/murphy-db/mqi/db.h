@@ -37,17 +37,24 @@ typedef struct {
                               mqi_column_desc_t *);
     int (*create_column_trigger)(void *, int, mqi_trigger_cb_t, void *,
                                  mqi_column_desc_t *);
+    int (*create_changeset_trigger)(void *, const mqi_bitfld_t *,
+                                    mqi_trigger_cb_t, void *,
+                                    mqi_column_desc_t *);
     int (*drop_transaction_trigger)(mqi_trigger_cb_t, void *);
     int (*drop_table_trigger)(mqi_trigger_cb_t, void *);
     int (*drop_row_trigger)(void *, mqi_trigger_cb_t, void *);
     int (*drop_column_trigger)(void *, int, mqi_trigger_cb_t, void *);
+    int (*drop_changeset_trigger)(void *, mqi_trigger_cb_t, void *);
     uint32_t (*begin_transaction)(void);
     int (*commit_transaction)(uint32_t);
     int (*rollback_transaction)(uint32_t);
     uint32_t (*get_transaction_id)(void);
     void *(*create_table)(char *, char **, mqi_column_def_t *);
     int (*register_table_handle)(void *, mqi_handle_t);
+    int (*make_persistent)(void *, const char *);
     int (*create_index)(void *, char **);
+    int (*create_secondary_index)(void *, char *, mqi_index_type_t, char **);
+    int (*drop_secondary_index)(void *, char *);
     int (*drop_table)(void *);
     int (*describe)(void *, mqi_column_def_t *, int);
     int (*insert_into)(void *, int, mqi_column_desc_t *, void **);
@@ -55,6 +62,10 @@ typedef struct {
                   void *, int, int);
     int (*select_by_index)(void *, mqi_variable_t *,
                            mqi_column_desc_t *, void *);
+    void *(*select_open)(void *, mqi_cond_entry_t *, mqi_column_desc_t *);
+    int (*select_next)(void *, void *, int, int);
+    void (*select_close)(void *);
+    void *(*snapshot_open)(void *, mqi_cond_entry_t *, mqi_column_desc_t *);
     int (*update)(void *, mqi_cond_entry_t *, mqi_column_desc_t *,void*);
     int (*delete_from)(void *, mqi_cond_entry_t *);
     void *(*find_table)(char *);
@@ -48,17 +48,25 @@ static int      create_row_trigger(void *, mqi_trigger_cb_t, void *,
                                    mqi_column_desc_t *);
 static int      create_column_trigger(void *, int, mqi_trigger_cb_t, void *,
                                       mqi_column_desc_t *);
+static int      create_changeset_trigger(void *, const mqi_bitfld_t *,
+                                         mqi_trigger_cb_t, void *,
+                                         mqi_column_desc_t *);
 static int      drop_transaction_trigger(mqi_trigger_cb_t, void *);
 static int      drop_table_trigger(mqi_trigger_cb_t, void *);
 static int      drop_row_trigger(void *, mqi_trigger_cb_t, void *);
 static int      drop_column_trigger(void*, int, mqi_trigger_cb_t, void *);
+static int      drop_changeset_trigger(void *, mqi_trigger_cb_t, void *);
 static uint32_t begin_transaction(void);
 static int      commit_transaction(uint32_t);
 static int      rollback_transaction(uint32_t);
 static uint32_t get_transaction_id(void);
 static void *   create_table(char *, char **, mqi_column_def_t *);
 static int      register_table_handle(void *, mqi_handle_t);
+static int      make_persistent(void *, const char *);
 static int      create_index(void *, char **);
+static int      create_secondary_index(void *, char *, mqi_index_type_t,
+                                       char **);
+static int      drop_secondary_index(void *, char *);
 static int      drop_table(void *);
 static int      describe(void *, mqi_column_def_t *, int);
 static int      insert_into(void *, int, mqi_column_desc_t *, void **);
@@ -66,6 +74,10 @@ static int      select_general(void *, mqi_cond_entry_t *, mqi_column_desc_t *,
                                void *, int, int);
 static int      select_by_index(void *, mqi_variable_t *, mqi_column_desc_t *,
                                  void *);
+static void *   select_open(void *, mqi_cond_entry_t *, mqi_column_desc_t *);
+static int      select_next(void *, void *, int, int);
+static void     select_close(void *);
+static void *   snapshot_open(void *, mqi_cond_entry_t *, mqi_column_desc_t *);
 static int      update(void *, mqi_cond_entry_t *, mqi_column_desc_t*,void*);
 static int      delete_from(void *, mqi_cond_entry_t *);
 static void *   find_table(char *);
@@ -82,22 +94,31 @@ static mqi_db_functbl_t functbl = {
     create_table_trigger,
     create_row_trigger,
     create_column_trigger,
+    create_changeset_trigger,
     drop_transaction_trigger,
     drop_table_trigger,
     drop_row_trigger,
     drop_column_trigger,
+    drop_changeset_trigger,
     begin_transaction,
     commit_transaction,
     rollback_transaction,
     get_transaction_id,
     create_table,
     register_table_handle,
+    make_persistent,
     create_index,
+    create_secondary_index,
+    drop_secondary_index,
     drop_table,
     describe,
     insert_into,
     select_general,
     select_by_index,
+    select_open,
+    select_next,
+    select_close,
+    snapshot_open,
     update,
     delete_from,
     find_table,
@@ -145,6 +166,16 @@ static int create_column_trigger(void *t,
                                          cb, data, cds);
 }
 
+static int create_changeset_trigger(void *t,
+                                    const mqi_bitfld_t *colmask,
+                                    mqi_trigger_cb_t cb,
+                                    void *data,
+                                    mqi_column_desc_t *cds)
+{
+    return mdb_trigger_add_changeset_callback((mdb_table_t *)t, colmask,
+                                              cb, data, cds);
+}
+
 static int drop_transaction_trigger(mqi_trigger_cb_t cb, void *data)
 {
     return mdb_trigger_delete_transaction_callback(cb, data);
@@ -168,6 +199,11 @@ static int drop_column_trigger(void *t,
     return mdb_trigger_delete_column_callback((mdb_table_t *)t,colidx,cb,data);
 }
 
+static int drop_changeset_trigger(void *t, mqi_trigger_cb_t cb, void *data)
+{
+    return mdb_trigger_delete_changeset_callback((mdb_table_t *)t, cb, data);
+}
+
 static uint32_t begin_transaction(void)
 {
     uint32_t depth = mdb_transaction_begin();
@@ -205,6 +241,11 @@ static int register_table_handle(void *t, mqi_handle_t handle)
     return mdb_table_register_handle((mdb_table_t *)t, handle);
 }
 
+static int make_persistent(void *t, const char *dir)
+{
+    return mdb_table_make_persistent((mdb_table_t *)t, dir);
+}
+
 
 
 static int create_index(void *t, char **index_columns)
@@ -212,6 +253,20 @@ static int create_index(void *t, char **index_columns)
     return mdb_table_create_index((mdb_table_t *)t, index_columns);
 }
 
+static int create_secondary_index(void             *t,
+                                  char             *name,
+                                  mqi_index_type_t  type,
+                                  char            **index_columns)
+{
+    return mdb_table_create_secondary_index((mdb_table_t *)t, name, type,
+                                            index_columns);
+}
+
+static int drop_secondary_index(void *t, char *name)
+{
+    return mdb_table_drop_secondary_index((mdb_table_t *)t, name);
+}
+
 static int drop_table(void *t)
 {
     return mdb_table_drop((mdb_table_t *)t);
@@ -248,6 +303,30 @@ static int select_by_index(void              *t,
     return mdb_table_select_by_index((mdb_table_t *)t, idxvars, cds, result);
 }
 
+static void *select_open(void              *t,
+                         mqi_cond_entry_t  *cond,
+                         mqi_column_desc_t *cds)
+{
+    return mdb_table_select_open((mdb_table_t *)t, cond, cds);
+}
+
+static int select_next(void *c, void *results, int size, int dim)
+{
+    return mdb_table_select_next((mdb_cursor_t *)c, results, size, dim);
+}
+
+static void select_close(void *c)
+{
+    mdb_table_select_close((mdb_cursor_t *)c);
+}
+
+static void *snapshot_open(void              *t,
+                           mqi_cond_entry_t  *cond,
+                           mqi_column_desc_t *cds)
+{
+    return mdb_table_snapshot_open((mdb_table_t *)t, cond, cds);
+}
+
 
 static int update(void              *t,
                   mqi_cond_entry_t  *cond,
@@ -27,13 +27,13 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
-
-#define _GNU_SOURCE
 #include <string.h>
+#include <pthread.h>
 
 #include <murphy-db/assert.h>
 #include <murphy-db/handle.h>
@@ -73,15 +73,29 @@
         mqi_table_t *t;                                                     \
         mqi_db_t *db;                                                       \
         if (!(t = mdb_handle_get_data(table_handle, h)) || !(db = t->db)) { \
+            db_unlock();                                                    \
             errno = ENOENT;                                                 \
             return errval;                                                  \
         }                                                                   \
         if (!(tbl = t->handle) || !(ftb = db->functbl)) {                   \
+            db_unlock();                                                    \
             errno = EIO;                                                    \
             return errval;                                                  \
         }                                                                   \
     } while(0)
 
+#define READ_LOCK(errval)                                               \
+    do {                                                                \
+        if (db_rdlock() < 0)                                            \
+            return errval;                                              \
+    } while (0)
+
+#define WRITE_LOCK(errval)                                              \
+    do {                                                                \
+        if (db_wrlock() < 0)                                            \
+            return errval;                                              \
+    } while (0)
+
 typedef struct {
     const char       *engine;
     uint32_t          flags;
@@ -91,6 +105,7 @@ typedef struct {
 typedef struct {
     mqi_db_t    *db;
     void        *handle;
+    uint32_t     flags;
 } mqi_table_t;
 
 typedef struct {
@@ -98,8 +113,19 @@ typedef struct {
     uint32_t txid[MAX_DB];
 } mqi_transaction_t;
 
+struct mqi_cursor_s {
+    mqi_handle_t      table;
+    void             *tbl;
+    mqi_db_functbl_t *ftb;
+    void             *cursor;    /* backend cursor */
+    int               snapshot;
+};
+
 
 static int db_register(const char *, uint32_t, mqi_db_functbl_t *);
+static int db_rdlock(void);
+static int db_wrlock(void);
+static void db_unlock(void);
 
 
 static int        ndb;
@@ -109,22 +135,45 @@ mdb_hash_t        *table_name_hash;
 mdb_handle_map_t  *transact_handle;
 mqi_transaction_t  txstack[MQI_TXDEPTH_MAX];
 int                txdepth;
+static char       *persistent_dir;
+
+/*
+ * The whole database is guarded by a single reader/writer lock. Anything
+ * that changes tables, indices or triggers takes it for writing, while
+ * selects and other queries only take it for reading, so these can run
+ * in other threads concurrently with each other. A transaction keeps the
+ * write lock from begin to commit or rollback, which makes the thread that
+ * started it the sole owner of the transaction state. Locking is tracked
+ * per thread, so triggers fired during a commit can use the API freely.
+ */
+static pthread_rwlock_t db_lock;
+static __thread int     rdlocked;
+static __thread int     wrlocked;
 
 
 int mqi_open(void)
 {
+    pthread_rwlockattr_t attr;
+
     if (!ndb && !dbs) {
         if (!(dbs = calloc(MAX_DB, sizeof(mqi_db_t)))) {
             errno = ENOMEM;
             return -1;
         }
 
+        /* don't let a steady stream of readers starve the mainloop */
+        pthread_rwlockattr_init(&attr);
+        pthread_rwlockattr_setkind_np(&attr,
+                              PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+        pthread_rwlock_init(&db_lock, &attr);
+        pthread_rwlockattr_destroy(&attr);
+
         table_handle = MDB_HANDLE_MAP_CREATE();
         table_name_hash = MDB_HASH_TABLE_CREATE(varchar, 256);
 
         transact_handle = MDB_HANDLE_MAP_CREATE();
 
-        if (db_register("MurphyDB", MQI_TEMPORARY, mdb_backend_init()) < 0) {
+        if (db_register("MurphyDB", MQI_ANY, mdb_backend_init()) < 0) {
             errno = EIO;
             return -1;
         }
@@ -153,8 +202,28 @@ int mqi_close(void)
 
         dbs = NULL;
         ndb = 0;
+
+        free(persistent_dir);
+        persistent_dir = NULL;
+
+        pthread_rwlock_destroy(&db_lock);
+    }
+
+    return 0;
+}
+
+int mqi_set_persistent_directory(const char *dir)
+{
+    char *dup = NULL;
+
+    if (dir && !(dup = strdup(dir))) {
+        errno = ENOMEM;
+        return -1;
     }
 
+    free(persistent_dir);
+    persistent_dir = dup;
+
     return 0;
 }
 
@@ -163,7 +232,6 @@ int mqi_show_tables(uint32_t flags, char **buf, int len)
 {
     mqi_handle_t h;
     mqi_table_t *tbl;
-    mqi_db_t *db;
     void *data;
     char *name;
     void *cursor;
@@ -173,8 +241,11 @@ int mqi_show_tables(uint32_t flags, char **buf, int len)
     MDB_CHECKARG(buf && len > 0, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    READ_LOCK(-1);
+
     MDB_HASH_TABLE_FOR_EACH_WITH_KEY(table_name_hash, data, name, cursor) {
         if (i >= len) {
+            db_unlock();
             errno = EOVERFLOW;
             return -1;
         }
@@ -182,10 +253,10 @@ int mqi_show_tables(uint32_t flags, char **buf, int len)
         if ((h = data - NULL) == MQI_HANDLE_INVALID)
             continue;
 
-        if (!(tbl = mdb_handle_get_data(table_handle, h)) || !(db = tbl->db))
+        if (!(tbl = mdb_handle_get_data(table_handle, h)) || !tbl->db)
             continue;
 
-        if (!(DB_TYPE(db) & flags))
+        if (!(tbl->flags & flags))
             continue;
 
         for (j = 0; j < i;  j++) {
@@ -199,6 +270,8 @@ int mqi_show_tables(uint32_t flags, char **buf, int len)
         i++;
     }
 
+    db_unlock();
+
     return i;
 }
 
@@ -212,6 +285,8 @@ int mqi_create_transaction_trigger(mqi_trigger_cb_t callback, void *user_data)
     MDB_CHECKARG(callback, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    WRITE_LOCK(-1);
+
     for (i = 0;  i < ndb;  i++) {
         db  = dbs + i;
         ftb = db->functbl;
@@ -225,10 +300,14 @@ int mqi_create_transaction_trigger(mqi_trigger_cb_t callback, void *user_data)
                 ftb->drop_transaction_trigger(callback, user_data);
             }
 
+            db_unlock();
+
             return -1;
         }
     }
 
+    db_unlock();
+
     return 0;
 }
 
@@ -241,6 +320,8 @@ int mqi_create_table_trigger(mqi_trigger_cb_t callback, void *user_data)
     MDB_CHECKARG(callback, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    WRITE_LOCK(-1);
+
     for (i = 0;  i < ndb;  i++) {
         db  = dbs + i;
         ftb = db->functbl;
@@ -254,10 +335,14 @@ int mqi_create_table_trigger(mqi_trigger_cb_t callback, void *user_data)
                 ftb->drop_table_trigger(callback, user_data);
             }
 
+            db_unlock();
+
             return -1;
         }
     }
 
+    db_unlock();
+
     return 0;
 }
 
@@ -269,13 +354,19 @@ int mqi_create_row_trigger(mqi_handle_t h,
 {
     mqi_db_functbl_t *ftb;
     void             *tbl;
+    int               sts;
 
     MDB_CHECKARG(h != MDB_HANDLE_INVALID && callback, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    WRITE_LOCK(-1);
     GET_TABLE(tbl, ftb, h, -1);
 
-    return ftb->create_row_trigger(tbl, callback, user_data, cds);
+    sts = ftb->create_row_trigger(tbl, callback, user_data, cds);
+
+    db_unlock();
+
+    return sts;
 }
 
 
@@ -287,13 +378,44 @@ int mqi_create_column_trigger(mqi_handle_t h,
 {
     mqi_db_functbl_t *ftb;
     void             *tbl;
+    int               sts;
 
     MDB_CHECKARG(h != MDB_HANDLE_INVALID && callback, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    WRITE_LOCK(-1);
     GET_TABLE(tbl, ftb, h, -1);
 
-    return ftb->create_column_trigger(tbl, colidx, callback, user_data, cds);
+    sts = ftb->create_column_trigger(tbl, colidx, callback, user_data, cds);
+
+    db_unlock();
+
+    return sts;
+}
+
+
+int mqi_create_changeset_trigger(mqi_handle_t h,
+                                 const mqi_bitfld_t *colmask,
+                                 mqi_trigger_cb_t callback,
+                                 void *user_data,
+                                 mqi_column_desc_t *cds)
+{
+    mqi_db_functbl_t *ftb;
+    void             *tbl;
+    int               sts;
+
+    MDB_CHECKARG(h != MDB_HANDLE_INVALID && callback, -1);
+    MDB_PREREQUISITE(dbs && ndb > 0, -1);
+
+    WRITE_LOCK(-1);
+    GET_TABLE(tbl, ftb, h, -1);
+
+    sts = ftb->create_changeset_trigger(tbl, colmask, callback, user_data,
+                                        cds);
+
+    db_unlock();
+
+    return sts;
 }
 
 
@@ -307,6 +429,8 @@ int mqi_drop_transaction_trigger(mqi_trigger_cb_t callback, void *user_data)
     MDB_CHECKARG(callback, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    WRITE_LOCK(-1);
+
     for (sts = 0, i = 0;  i < ndb;  i++) {
         db  = dbs + i;
         ftb = db->functbl;
@@ -315,6 +439,8 @@ int mqi_drop_transaction_trigger(mqi_trigger_cb_t callback, void *user_data)
             sts = -1;
     }
 
+    db_unlock();
+
     return sts;
 }
 
@@ -329,6 +455,8 @@ int mqi_drop_table_trigger(mqi_trigger_cb_t callback, void *user_data)
     MDB_CHECKARG(callback, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    WRITE_LOCK(-1);
+
     for (sts = 0, i = 0;  i < ndb;  i++) {
         db  = dbs + i;
         ftb = db->functbl;
@@ -337,6 +465,8 @@ int mqi_drop_table_trigger(mqi_trigger_cb_t callback, void *user_data)
             sts = -1;
     }
 
+    db_unlock();
+
     return sts;
 }
 
@@ -347,13 +477,19 @@ int mqi_drop_row_trigger(mqi_handle_t h,
 {
     mqi_db_functbl_t *ftb;
     void             *tbl;
+    int               sts;
 
     MDB_CHECKARG(h != MDB_HANDLE_INVALID && callback, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    WRITE_LOCK(-1);
     GET_TABLE(tbl, ftb, h, -1);
 
-    return ftb->drop_row_trigger(tbl, callback, user_data);
+    sts = ftb->drop_row_trigger(tbl, callback, user_data);
+
+    db_unlock();
+
+    return sts;
 }
 
 
@@ -364,13 +500,41 @@ int mqi_drop_column_trigger(mqi_handle_t h,
 {
     mqi_db_functbl_t *ftb;
     void             *tbl;
+    int               sts;
+
+    MDB_CHECKARG(h != MDB_HANDLE_INVALID && callback, -1);
+    MDB_PREREQUISITE(dbs && ndb > 0, -1);
+
+    WRITE_LOCK(-1);
+    GET_TABLE(tbl, ftb, h, -1);
+
+    sts = ftb->drop_column_trigger(tbl, colidx, callback, user_data);
+
+    db_unlock();
+
+    return sts;
+}
+
+
+int mqi_drop_changeset_trigger(mqi_handle_t h,
+                               mqi_trigger_cb_t callback,
+                               void *user_data)
+{
+    mqi_db_functbl_t *ftb;
+    void             *tbl;
+    int               sts;
 
     MDB_CHECKARG(h != MDB_HANDLE_INVALID && callback, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    WRITE_LOCK(-1);
     GET_TABLE(tbl, ftb, h, -1);
 
-    return ftb->drop_column_trigger(tbl, colidx, callback, user_data);
+    sts = ftb->drop_changeset_trigger(tbl, callback, user_data);
+
+    db_unlock();
+
+    return sts;
 }
 
 
@@ -383,7 +547,15 @@ mqi_handle_t mqi_begin_transaction(void)
     int                i;
 
     MDB_PREREQUISITE(dbs && ndb > 0 && transact_handle, MQI_HANDLE_INVALID);
-    MDB_ASSERT(txdepth < MQI_TXDEPTH_MAX - 1, EOVERFLOW, MQI_HANDLE_INVALID);
+
+    /* released by the corresponding commit or rollback */
+    WRITE_LOCK(MQI_HANDLE_INVALID);
+
+    if (txdepth >= MQI_TXDEPTH_MAX - 1) {
+        db_unlock();
+        errno = EOVERFLOW;
+        return MQI_HANDLE_INVALID;
+    }
 
     depth = txdepth++;
     tx = txstack + depth;
@@ -412,7 +584,8 @@ int mqi_commit_transaction(mqi_handle_t h)
 
     MDB_CHECKARG(h != MQI_HANDLE_INVALID && depth < MQI_TXDEPTH_MAX, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
-    MDB_ASSERT(txdepth > 0 && depth == (uint32_t)txdepth - 1, EBADSLT, -1);
+    MDB_ASSERT(wrlocked && txdepth > 0 && depth == (uint32_t)txdepth - 1,
+               EBADSLT, -1);
 
     tx = txstack + depth;
 
@@ -428,6 +601,8 @@ int mqi_commit_transaction(mqi_handle_t h)
 
     txdepth--;
 
+    db_unlock();
+
     return err;
 }
 
@@ -443,7 +618,8 @@ int mqi_rollback_transaction(mqi_handle_t h)
 
     MDB_CHECKARG(h != MQI_HANDLE_INVALID && depth < MQI_TXDEPTH_MAX, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
-    MDB_ASSERT(txdepth > 0 && depth == (uint32_t)txdepth - 1, EBADSLT, -1);
+    MDB_ASSERT(wrlocked && txdepth > 0 && depth == (uint32_t)txdepth - 1,
+               EBADSLT, -1);
 
     tx = txstack + depth;
 
@@ -459,6 +635,8 @@ int mqi_rollback_transaction(mqi_handle_t h)
 
     txdepth--;
 
+    db_unlock();
+
     return err;
 }
 
@@ -467,7 +645,7 @@ mqi_handle_t mqi_get_transaction_handle(void)
     uint32_t           depth;
     mqi_transaction_t *tx;
 
-    MDB_CHECKARG(txdepth > 0, MQI_HANDLE_INVALID);
+    MDB_CHECKARG(wrlocked && txdepth > 0, MQI_HANDLE_INVALID);
     MDB_PREREQUISITE(dbs && ndb > 0, MQI_HANDLE_INVALID);
 
     depth = txdepth - 1;
@@ -479,7 +657,8 @@ mqi_handle_t mqi_get_transaction_handle(void)
 
 uint32_t mqi_get_transaction_depth(void)
 {
-    return txdepth;
+    /* transactions of other threads are invisible to us */
+    return wrlocked ? txdepth : 0;
 }
 
 
@@ -493,11 +672,17 @@ mqi_handle_t mqi_create_table(char *name,
     mqi_table_t      *tbl = NULL;
     mqi_handle_t      h = MQI_HANDLE_INVALID;
     char             *namedup = NULL;
+    int               persistent;
     int               i;
 
     MDB_CHECKARG(name && cdefs, MQI_HANDLE_INVALID);
     MDB_PREREQUISITE(dbs && ndb > 0, MQI_HANDLE_INVALID);
 
+    persistent = ((flags & MQI_TABLE_TYPE_MASK) == MQI_PERSISTENT);
+
+    /* persistent tables need somewhere to keep their data */
+    MDB_ASSERT(!persistent || persistent_dir, EINVAL, MQI_HANDLE_INVALID);
+
     for (i = 0, ftb = NULL;  i < ndb;  i++) {
         db = dbs + i;
 
@@ -512,8 +697,14 @@ mqi_handle_t mqi_create_table(char *name,
     if(!(tbl = calloc(1, sizeof(mqi_table_t))))
         return MQI_HANDLE_INVALID;
 
+    if (db_wrlock() < 0) {
+        free(tbl);
+        return MQI_HANDLE_INVALID;
+    }
+
     tbl->db = db;
     tbl->handle = NULL;
+    tbl->flags = persistent ? MQI_PERSISTENT : MQI_TEMPORARY;
 
     if (!(namedup = strdup(name)))
         goto cleanup;
@@ -521,6 +712,9 @@ mqi_handle_t mqi_create_table(char *name,
     if (!(tbl->handle = ftb->create_table(name, index_columns, cdefs)))
         goto cleanup;
 
+    if (persistent && ftb->make_persistent(tbl->handle, persistent_dir) < 0)
+        goto cleanup;
+
     if ((h = mdb_handle_add(table_handle, tbl)) == MQI_HANDLE_INVALID)
         goto cleanup;
 
@@ -531,6 +725,8 @@ mqi_handle_t mqi_create_table(char *name,
 
     ftb->register_table_handle(tbl->handle, h);
 
+    db_unlock();
+
     return h;
 
  cleanup:
@@ -544,6 +740,8 @@ mqi_handle_t mqi_create_table(char *name,
         free(tbl);
     }
 
+    db_unlock();
+
     return MDB_HANDLE_INVALID;
 }
 
@@ -552,13 +750,60 @@ int mqi_create_index(mqi_handle_t h, char **index_columns)
 {
     mqi_db_functbl_t *ftb;
     void             *tbl;
+    int               sts;
 
     MDB_CHECKARG(h != MDB_HANDLE_INVALID && index_columns, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    WRITE_LOCK(-1);
     GET_TABLE(tbl, ftb, h, -1);
 
-    return ftb->create_index(tbl, index_columns);
+    sts = ftb->create_index(tbl, index_columns);
+
+    db_unlock();
+
+    return sts;
+}
+
+int mqi_create_secondary_index(mqi_handle_t      h,
+                               char             *name,
+                               mqi_index_type_t  type,
+                               char            **index_columns)
+{
+    mqi_db_functbl_t *ftb;
+    void             *tbl;
+    int               sts;
+
+    MDB_CHECKARG(h != MDB_HANDLE_INVALID && name && index_columns, -1);
+    MDB_PREREQUISITE(dbs && ndb > 0, -1);
+
+    WRITE_LOCK(-1);
+    GET_TABLE(tbl, ftb, h, -1);
+
+    sts = ftb->create_secondary_index(tbl, name, type, index_columns);
+
+    db_unlock();
+
+    return sts;
+}
+
+int mqi_drop_secondary_index(mqi_handle_t h, char *name)
+{
+    mqi_db_functbl_t *ftb;
+    void             *tbl;
+    int               sts;
+
+    MDB_CHECKARG(h != MDB_HANDLE_INVALID && name, -1);
+    MDB_PREREQUISITE(dbs && ndb > 0, -1);
+
+    WRITE_LOCK(-1);
+    GET_TABLE(tbl, ftb, h, -1);
+
+    sts = ftb->drop_secondary_index(tbl, name);
+
+    db_unlock();
+
+    return sts;
 }
 
 int mqi_drop_table(mqi_handle_t h)
@@ -573,8 +818,12 @@ int mqi_drop_table(mqi_handle_t h)
     MDB_CHECKARG(h != MDB_HANDLE_INVALID, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
-    if (!(tbl = mdb_handle_delete(table_handle, h)))
+    WRITE_LOCK(-1);
+
+    if (!(tbl = mdb_handle_delete(table_handle, h))) {
+        db_unlock();
         return -1;
+    }
 
     ftb = tbl->db->functbl;
 
@@ -584,10 +833,13 @@ int mqi_drop_table(mqi_handle_t h)
             sts = ftb->drop_table(tbl->handle);
             free(name);
             free(tbl);
+            db_unlock();
             return sts;
         }
     }
 
+    db_unlock();
+
     return -1;
 }
 
@@ -595,13 +847,19 @@ int mqi_describe(mqi_handle_t h, mqi_column_def_t *defs, int len)
 {
     mqi_db_functbl_t *ftb;
     void             *tbl;
+    int               sts;
 
     MDB_CHECKARG(h != MDB_HANDLE_INVALID && defs && len > 0, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    READ_LOCK(-1);
     GET_TABLE(tbl, ftb, h, -1);
 
-    return ftb->describe(tbl, defs, len);
+    sts = ftb->describe(tbl, defs, len);
+
+    db_unlock();
+
+    return sts;
 }
 
 int mqi_insert_into(mqi_handle_t         h,
@@ -611,13 +869,19 @@ int mqi_insert_into(mqi_handle_t         h,
 {
     mqi_db_functbl_t *ftb;
     void             *tbl;
+    int               sts;
 
     MDB_CHECKARG(h != MDB_HANDLE_INVALID && cds && data && data[0], -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    WRITE_LOCK(-1);
     GET_TABLE(tbl, ftb, h, -1);
 
-    return ftb->insert_into(tbl, ignore, cds, data);
+    sts = ftb->insert_into(tbl, ignore, cds, data);
+
+    db_unlock();
+
+    return sts;
 }
 
 int mqi_select(mqi_handle_t       h,
@@ -629,14 +893,20 @@ int mqi_select(mqi_handle_t       h,
 {
     mqi_db_functbl_t *ftb;
     void             *tbl;
+    int               sts;
 
     MDB_CHECKARG(h != MDB_HANDLE_INVALID && cds &&
                  rows && rowsize > 0 && dim > 0, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    READ_LOCK(-1);
     GET_TABLE(tbl, ftb, h, -1);
 
-    return ftb->select(tbl, cond, cds, rows, rowsize, dim);
+    sts = ftb->select(tbl, cond, cds, rows, rowsize, dim);
+
+    db_unlock();
+
+    return sts;
 }
 
 int mqi_select_by_index(mqi_handle_t       h,
@@ -646,13 +916,117 @@ int mqi_select_by_index(mqi_handle_t       h,
 {
     mqi_db_functbl_t *ftb;
     void             *tbl;
+    int               sts;
 
     MDB_CHECKARG(h != MDB_HANDLE_INVALID && idxvars && cds && result, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    READ_LOCK(-1);
     GET_TABLE(tbl, ftb, h, -1);
 
-    return ftb->select_by_index(tbl, idxvars, cds, result);
+    sts = ftb->select_by_index(tbl, idxvars, cds, result);
+
+    db_unlock();
+
+    return sts;
+}
+
+static mqi_cursor_t *open_cursor(mqi_handle_t       h,
+                                 mqi_cond_entry_t  *cond,
+                                 mqi_column_desc_t *cds,
+                                 int                snapshot)
+{
+    mqi_db_functbl_t *ftb;
+    void             *tbl;
+    mqi_cursor_t     *c;
+
+    MDB_CHECKARG(h != MDB_HANDLE_INVALID && cds, NULL);
+    MDB_PREREQUISITE(dbs && ndb > 0, NULL);
+
+    /* snapshots get linked to the table, so they need exclusive access */
+    if ((snapshot ? db_wrlock() : db_rdlock()) < 0)
+        return NULL;
+
+    GET_TABLE(tbl, ftb, h, NULL);
+
+    if (!(c = calloc(1, sizeof(mqi_cursor_t)))) {
+        db_unlock();
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (snapshot)
+        c->cursor = ftb->snapshot_open(tbl, cond, cds);
+    else
+        c->cursor = ftb->select_open(tbl, cond, cds);
+
+    db_unlock();
+
+    if (!c->cursor) {
+        free(c);
+        return NULL;
+    }
+
+    c->table    = h;
+    c->tbl      = tbl;
+    c->ftb      = ftb;
+    c->snapshot = snapshot;
+
+    return c;
+}
+
+mqi_cursor_t *mqi_select_open(mqi_handle_t       h,
+                              mqi_cond_entry_t  *cond,
+                              mqi_column_desc_t *cds)
+{
+    return open_cursor(h, cond, cds, 0);
+}
+
+mqi_cursor_t *mqi_snapshot_open(mqi_handle_t       h,
+                                mqi_cond_entry_t  *cond,
+                                mqi_column_desc_t *cds)
+{
+    return open_cursor(h, cond, cds, 1);
+}
+
+int mqi_select_next(mqi_cursor_t *c, void *rows, int rowsize, int dim)
+{
+    mqi_db_functbl_t *ftb;
+    void             *tbl;
+    int               sts;
+
+    MDB_CHECKARG(c && rows && rowsize > 0 && dim > 0, -1);
+    MDB_PREREQUISITE(dbs && ndb > 0, -1);
+
+    READ_LOCK(-1);
+    GET_TABLE(tbl, ftb, c->table, -1);
+
+    if (tbl != c->tbl) {
+        /* the table has been dropped meanwhile */
+        db_unlock();
+        errno = ENOENT;
+        return -1;
+    }
+
+    sts = ftb->select_next(c->cursor, rows, rowsize, dim);
+
+    db_unlock();
+
+    return sts;
+}
+
+void mqi_select_close(mqi_cursor_t *c)
+{
+    if (c) {
+        if ((c->snapshot ? db_wrlock() : db_rdlock()) < 0)
+            return;
+
+        c->ftb->select_close(c->cursor);
+
+        db_unlock();
+
+        free(c);
+    }
 }
 
 int mqi_update(mqi_handle_t       h,
@@ -662,26 +1036,38 @@ int mqi_update(mqi_handle_t       h,
 {
     mqi_db_functbl_t *ftb;
     void             *tbl;
+    int               sts;
 
     MDB_CHECKARG(h != MDB_HANDLE_INVALID && cds && data, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    WRITE_LOCK(-1);
     GET_TABLE(tbl, ftb, h, -1);
 
-    return ftb->update(tbl, cond, cds, data);
+    sts = ftb->update(tbl, cond, cds, data);
+
+    db_unlock();
+
+    return sts;
 }
 
 int mqi_delete_from(mqi_handle_t h, mqi_cond_entry_t *cond)
 {
     mqi_db_functbl_t *ftb;
     void             *tbl;
+    int               sts;
 
     MDB_CHECKARG(h != MDB_HANDLE_INVALID, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    WRITE_LOCK(-1);
     GET_TABLE(tbl, ftb, h, -1);
 
-    return ftb->delete_from(tbl, cond);
+    sts = ftb->delete_from(tbl, cond);
+
+    db_unlock();
+
+    return sts;
 }
 
 mqi_handle_t mqi_get_table_handle(char *table_name)
@@ -691,8 +1077,12 @@ mqi_handle_t mqi_get_table_handle(char *table_name)
     MDB_CHECKARG(table_name, MQI_HANDLE_INVALID);
     MDB_PREREQUISITE(dbs && ndb > 0, MQI_HANDLE_INVALID);
 
+    READ_LOCK(MQI_HANDLE_INVALID);
+
     data = mdb_hash_get_data(table_name_hash, 0,table_name);
 
+    db_unlock();
+
     if (data != NULL)
         return data - NULL;
     else
@@ -704,95 +1094,195 @@ int mqi_get_column_index(mqi_handle_t h, char *column_name)
 {
     mqi_db_functbl_t *ftb;
     void             *tbl;
+    int               sts;
 
     MDB_CHECKARG(h != MDB_HANDLE_INVALID && column_name, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    READ_LOCK(-1);
     GET_TABLE(tbl, ftb, h, -1);
 
-    return ftb->get_column_index(tbl, column_name);
+    sts = ftb->get_column_index(tbl, column_name);
+
+    db_unlock();
+
+    return sts;
 }
 
 int mqi_get_table_size(mqi_handle_t h)
 {
     mqi_db_functbl_t *ftb;
     void             *tbl;
+    int               sts;
 
     MDB_CHECKARG(h != MDB_HANDLE_INVALID, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    READ_LOCK(-1);
     GET_TABLE(tbl, ftb, h, -1);
 
-    return  ftb->get_table_size(tbl);
+    sts = ftb->get_table_size(tbl);
+
+    db_unlock();
+
+    return sts;
 }
 
 uint32_t mqi_get_table_stamp(mqi_handle_t h)
 {
     mqi_db_functbl_t *ftb;
     void             *tbl;
+    uint32_t          sts;
 
     MDB_CHECKARG(h != MDB_HANDLE_INVALID, MQI_STAMP_NONE);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    READ_LOCK(-1);
     GET_TABLE(tbl, ftb, h, -1);
 
-    return  ftb->get_table_stamp(tbl);
+    sts = ftb->get_table_stamp(tbl);
+
+    db_unlock();
+
+    return sts;
 }
 
 char *mqi_get_column_name(mqi_handle_t h, int colidx)
 {
     mqi_db_functbl_t *ftb;
     void             *tbl;
+    char             *name;
 
     MDB_CHECKARG(h != MDB_HANDLE_INVALID && colidx >= 0, NULL);
     MDB_PREREQUISITE(dbs && ndb > 0, NULL);
 
+    READ_LOCK(NULL);
     GET_TABLE(tbl, ftb, h, NULL);
 
-    return  ftb->get_column_name(tbl, colidx);
+    name = ftb->get_column_name(tbl, colidx);
+
+    db_unlock();
+
+    return name;
 }
 
 mqi_data_type_t mqi_get_column_type(mqi_handle_t h, int colidx)
 {
     mqi_db_functbl_t *ftb;
     void             *tbl;
+    mqi_data_type_t   sts;
 
     MDB_CHECKARG(h != MDB_HANDLE_INVALID && colidx >= 0, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    READ_LOCK(-1);
     GET_TABLE(tbl, ftb, h, -1);
 
-    return  ftb->get_column_type(tbl, colidx);
+    sts = ftb->get_column_type(tbl, colidx);
+
+    db_unlock();
+
+    return sts;
 }
 
 int mqi_get_column_size(mqi_handle_t h, int colidx)
 {
     mqi_db_functbl_t *ftb;
     void             *tbl;
+    int               sts;
 
     MDB_CHECKARG(h != MDB_HANDLE_INVALID && colidx >= 0, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    READ_LOCK(-1);
     GET_TABLE(tbl, ftb, h, -1);
 
-    return  ftb->get_column_size(tbl, colidx);
+    sts = ftb->get_column_size(tbl, colidx);
+
+    db_unlock();
+
+    return sts;
 }
 
 int mqi_print_rows(mqi_handle_t h, char *buf, int len)
 {
     mqi_db_functbl_t *ftb;
     void             *tbl;
+    int               sts;
 
     MDB_CHECKARG(h != MDB_HANDLE_INVALID && buf && len > 0, -1);
     MDB_PREREQUISITE(dbs && ndb > 0, -1);
 
+    READ_LOCK(-1);
     GET_TABLE(tbl, ftb, h, -1);
 
-    return ftb->print_rows(tbl, buf, len);
+    sts = ftb->print_rows(tbl, buf, len);
+
+    db_unlock();
+
+    return sts;
 }
 
 
 
+static int db_rdlock(void)
+{
+    int err;
+
+    if (wrlocked) {
+        wrlocked++;
+        return 0;
+    }
+
+    if (rdlocked++ > 0)
+        return 0;
+
+    if ((err = pthread_rwlock_rdlock(&db_lock)) != 0) {
+        rdlocked--;
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int db_wrlock(void)
+{
+    int err;
+
+    if (wrlocked) {
+        wrlocked++;
+        return 0;
+    }
+
+    /* a read lock can't be upgraded without risking a deadlock */
+    if (rdlocked) {
+        errno = EDEADLK;
+        return -1;
+    }
+
+    if ((err = pthread_rwlock_wrlock(&db_lock)) != 0) {
+        errno = err;
+        return -1;
+    }
+
+    wrlocked = 1;
+
+    return 0;
+}
+
+static void db_unlock(void)
+{
+    if (wrlocked) {
+        if (--wrlocked == 0)
+            pthread_rwlock_unlock(&db_lock);
+    }
+    else if (rdlocked) {
+        if (--rdlocked == 0)
+            pthread_rwlock_unlock(&db_lock);
+    }
+}
+
 static int db_register(const char       *engine,
                        uint32_t          flags,
                        mqi_db_functbl_t *functbl)
@@ -0,0 +1,667 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define _GNU_SOURCE
+#include <string.h>
+
+#include <murphy-db/assert.h>
+#include <murphy-db/list.h>
+#include <murphy-db/mqi.h>
+
+#define VIEW_BATCH     64
+#define SLOT_ALIGN(l)  (((l) + 7) & ~7)
+
+/*
+ * A materialized view is an ordinary temporary table holding the result
+ * of 'SELECT columns FROM source WHERE condition'. It is kept up to date
+ * from the change sets of the source table. If the view contains every
+ * key column of the source, each changed row is looked up by its key and
+ * only the corresponding row of the view is replaced or deleted. Otherwise
+ * the view is repopulated from scratch whenever the source changes. The
+ * view is updated in a transaction of its own, so triggers on the view
+ * fire like on any other table.
+ */
+typedef struct {
+    mqi_data_type_t  type;
+    union {
+        char        *varchar;
+        int32_t      integer;
+        uint32_t     unsignd;
+        double       floating;
+    } v;
+} value_t;
+
+typedef struct {
+    mdb_dlist_t        link;
+    mqi_handle_t       handle;              /* view table */
+    mqi_handle_t       source;              /* source table */
+    mqi_column_desc_t *select;              /* source columns to row */
+    mqi_column_desc_t *insert;              /* view columns to row */
+    int                rowsize;
+    mqi_cond_entry_t  *where;               /* copy of condition or NULL */
+    int                nwhere;              /* entries with the end */
+    value_t           *values;              /* storage of its variables */
+    int                nvalue;
+    int                nkey;                /* 0 if not maintained by key */
+    mqi_data_type_t    ktypes[MQI_COLUMN_MAX];
+    mqi_column_desc_t *image;               /* key columns to key buffer */
+    int                keysize;
+    void              *keybuf;
+    void              *rowbuf;
+    mqi_cond_entry_t  *lookup;              /* source: key AND (where) */
+    mqi_cond_entry_t  *match;               /* view: key */
+} view_t;
+
+static int init(void);
+static void table_event_cb(mqi_event_t *, void *);
+static void changeset_cb(mqi_event_t *, void *);
+static view_t *find_view(mqi_handle_t);
+static int copy_where(view_t *, mqi_cond_entry_t *, mqi_bitfld_t *);
+static int setup_keys(view_t *, mqi_column_def_t *, int, int *, int);
+static mqi_cond_entry_t *key_condition(view_t *, int *, mqi_cond_entry_t *);
+static int populate(view_t *);
+static int update_row(view_t *, mqi_change_t *);
+static bool keys_differ(view_t *, void *, void *);
+static void destroy_view(view_t *);
+
+static MDB_DLIST_HEAD(views);
+static bool registered;
+
+
+mqi_handle_t mqi_create_view(char *name,
+                             mqi_handle_t source,
+                             mqi_cond_entry_t *where,
+                             char **columns)
+{
+    mqi_column_def_t  sdefs[MQI_COLUMN_MAX + 1];
+    mqi_column_def_t  vdefs[MQI_COLUMN_MAX + 1];
+    int               cols[MQI_COLUMN_MAX];
+    char             *keys[MQI_COLUMN_MAX + 1];
+    view_t           *view;
+    mqi_bitfld_t      colmask;
+    int               nsrc, ncol, nkey;
+    int               offs, cx, i, j;
+
+    MDB_CHECKARG(name && source != MQI_HANDLE_INVALID, MQI_HANDLE_INVALID);
+
+    if (init() < 0)
+        return MQI_HANDLE_INVALID;
+
+    if ((nsrc = mqi_describe(source, sdefs, MQI_COLUMN_MAX)) <= 0)
+        return MQI_HANDLE_INVALID;
+
+    if (!columns) {
+        for (ncol = 0;  ncol < nsrc;  ncol++)
+            cols[ncol] = ncol;
+    }
+    else {
+        for (ncol = 0;  columns[ncol];  ncol++) {
+            MDB_ASSERT(ncol < MQI_COLUMN_MAX, EOVERFLOW, MQI_HANDLE_INVALID);
+
+            if ((cx = mqi_get_column_index(source, columns[ncol])) < 0)
+                return MQI_HANDLE_INVALID;
+
+            for (i = 0;  i < ncol;  i++)
+                MDB_ASSERT(cols[i] != cx, EEXIST, MQI_HANDLE_INVALID);
+
+            cols[ncol] = cx;
+        }
+
+        MDB_CHECKARG(ncol > 0, MQI_HANDLE_INVALID);
+    }
+
+    if (!(view = calloc(1, sizeof(view_t))))
+        return MQI_HANDLE_INVALID;
+
+    MDB_DLIST_INIT(view->link);
+    view->handle = MQI_HANDLE_INVALID;
+    view->source = source;
+
+    view->select = calloc(ncol + 1, sizeof(mqi_column_desc_t));
+    view->insert = calloc(ncol + 1, sizeof(mqi_column_desc_t));
+
+    if (!view->select || !view->insert)
+        goto failed;
+
+    mqi_bitfld_clear(&colmask);
+
+    for (i = offs = 0;  i < ncol;  i++) {
+        cx = cols[i];
+
+        vdefs[i] = sdefs[cx];
+        vdefs[i].flags &= ~MQI_COLUMN_KEY;
+
+        view->select[i].cindex = cx;
+        view->select[i].offset = offs;
+        view->insert[i].cindex = i;
+        view->insert[i].offset = offs;
+
+        if (sdefs[cx].type == mqi_blob)
+            offs += SLOT_ALIGN(sdefs[cx].length);
+        else
+            offs += SLOT_ALIGN(sizeof(double));
+
+        mqi_bitfld_set(&colmask, cx);
+    }
+
+    memset(vdefs + ncol, 0, sizeof(vdefs[0]));
+    view->select[ncol].cindex = view->insert[ncol].cindex = -1;
+    view->rowsize = offs;
+
+    if (where && copy_where(view, where, &colmask) < 0)
+        goto failed;
+
+    /* maintain by key if the view has all the key columns of the source */
+    for (i = nkey = 0;  i < nsrc;  i++) {
+        if (!(sdefs[i].flags & MQI_COLUMN_KEY))
+            continue;
+
+        for (j = 0;  j < ncol;  j++) {
+            if (cols[j] == i)
+                break;
+        }
+
+        if (j >= ncol || sdefs[i].type == mqi_blob) {
+            nkey = 0;
+            break;
+        }
+
+        keys[nkey++] = (char *)sdefs[i].name;
+    }
+
+    keys[nkey] = NULL;
+
+    if (nkey > 0 && setup_keys(view, sdefs, nsrc, cols, ncol) < 0)
+        goto failed;
+
+    view->handle = mqi_create_table(name, MQI_TEMPORARY,
+                                    nkey ? keys : NULL, vdefs);
+
+    if (view->handle == MQI_HANDLE_INVALID)
+        goto failed;
+
+    if (mqi_create_changeset_trigger(source, &colmask, changeset_cb, view,
+                                     view->image) < 0)
+        goto failed;
+
+    MDB_DLIST_APPEND(view_t, link, view, &views);
+
+    if (populate(view) < 0) {
+        mqi_drop_table(view->handle);
+        return MQI_HANDLE_INVALID;
+    }
+
+    return view->handle;
+
+ failed:
+    if (view->handle != MQI_HANDLE_INVALID)
+        mqi_drop_table(view->handle);
+
+    destroy_view(view);
+
+    return MQI_HANDLE_INVALID;
+}
+
+
+int mqi_refresh_view(mqi_handle_t h)
+{
+    view_t *view;
+
+    MDB_CHECKARG(h != MQI_HANDLE_INVALID, -1);
+
+    if (!(view = find_view(h))) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    MDB_PREREQUISITE(view->source != MQI_HANDLE_INVALID, -1);
+
+    return populate(view);
+}
+
+
+static int init(void)
+{
+    if (!registered) {
+        if (mqi_create_table_trigger(table_event_cb, NULL) < 0)
+            return -1;
+
+        registered = true;
+    }
+
+    return 0;
+}
+
+
+static void table_event_cb(mqi_event_t *evt, void *user_data)
+{
+    mqi_table_event_t *te = &evt->table;
+    view_t            *view, *n;
+
+    (void)user_data;
+
+    if (te->event != mqi_table_dropped)
+        return;
+
+    MDB_DLIST_FOR_EACH_SAFE(view_t, link, view,n, &views) {
+        if (view->handle == te->table.handle) {
+            if (view->source != MQI_HANDLE_INVALID)
+                mqi_drop_changeset_trigger(view->source, changeset_cb, view);
+
+            MDB_DLIST_UNLINK(view_t, link, view);
+            destroy_view(view);
+        }
+        else if (view->source == te->table.handle) {
+            /* the view keeps its last contents */
+            view->source = MQI_HANDLE_INVALID;
+        }
+    }
+}
+
+
+static void changeset_cb(mqi_event_t *evt, void *user_data)
+{
+    mqi_changeset_event_t *ce   = &evt->changeset;
+    view_t                *view = user_data;
+    mqi_handle_t           tx;
+    int                    i;
+
+    if (ce->event != mqi_changeset || view->source == MQI_HANDLE_INVALID)
+        return;
+
+    if (!view->nkey) {
+        populate(view);
+        return;
+    }
+
+    if ((tx = mqi_begin_transaction()) == MQI_HANDLE_INVALID)
+        return;
+
+    for (i = 0;  i < ce->nchange;  i++) {
+        if (update_row(view, ce->changes + i) < 0) {
+            /* fall back to repopulating the whole view */
+            mqi_rollback_transaction(tx);
+            populate(view);
+            return;
+        }
+    }
+
+    mqi_commit_transaction(tx);
+}
+
+
+static view_t *find_view(mqi_handle_t h)
+{
+    view_t *view;
+
+    MDB_DLIST_FOR_EACH(view_t, link, view, &views) {
+        if (view->handle == h)
+            return view;
+    }
+
+    return NULL;
+}
+
+
+static int copy_where(view_t *view, mqi_cond_entry_t *where,
+                      mqi_bitfld_t *colmask)
+{
+    mqi_cond_entry_t *ce;
+    mqi_variable_t   *var;
+    value_t          *val;
+    int               depth, nentry, nvalue;
+    int               i;
+
+    for (i = depth = nvalue = 0;  ;  i++) {
+        ce = where + i;
+
+        MDB_ASSERT(i < MQI_COND_MAX, EOVERFLOW, -1);
+
+        if (ce->type == mqi_variable)
+            nvalue++;
+        else if (ce->type == mqi_operator) {
+            if (ce->u.operator_ == mqi_begin)
+                depth++;
+            else if (ce->u.operator_ == mqi_end && depth-- == 0)
+                break;
+        }
+    }
+
+    nentry = view->nwhere = i + 1;
+
+    view->where  = calloc(nentry, sizeof(mqi_cond_entry_t));
+    view->values = calloc(nvalue ? nvalue : 1, sizeof(value_t));
+
+    if (!view->where || !view->values)
+        return -1;
+
+    memcpy(view->where, where, nentry * sizeof(mqi_cond_entry_t));
+
+    for (i = 0;  i < nentry;  i++) {
+        ce = view->where + i;
+
+        if (ce->type == mqi_column) {
+            MDB_ASSERT(ce->u.column >= 0 && ce->u.column < MQI_COLUMN_MAX,
+                       EINVAL, -1);
+            mqi_bitfld_set(colmask, ce->u.column);
+            continue;
+        }
+
+        if (ce->type != mqi_variable)
+            continue;
+
+        var = &ce->u.variable;
+        val = view->values + view->nvalue++;
+        val->type = var->type;
+
+        switch (var->type) {
+        case mqi_varchar:
+            if (!(val->v.varchar = strdup(*var->v.varchar)))
+                return -1;
+            var->v.varchar = &val->v.varchar;
+            break;
+        case mqi_integer:
+            val->v.integer = *var->v.integer;
+            var->v.integer = &val->v.integer;
+            break;
+        case mqi_unsignd:
+            val->v.unsignd = *var->v.unsignd;
+            var->v.unsignd = &val->v.unsignd;
+            break;
+        case mqi_floating:
+            val->v.floating = *var->v.floating;
+            var->v.floating = &val->v.floating;
+            break;
+        default:
+            /* blobs have no length in the condition to copy them by */
+            val->type = mqi_unknown;
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int setup_keys(view_t *view, mqi_column_def_t *sdefs, int nsrc,
+                      int *cols, int ncol)
+{
+    int scols[MQI_COLUMN_MAX];
+    int vcols[MQI_COLUMN_MAX];
+    int nkey, offs, i, j;
+
+    for (i = nkey = 0;  i < nsrc;  i++) {
+        if (!(sdefs[i].flags & MQI_COLUMN_KEY))
+            continue;
+
+        for (j = 0;  j < ncol && cols[j] != i;  j++)
+            ;
+
+        scols[nkey] = i;
+        vcols[nkey] = j;
+        view->ktypes[nkey] = sdefs[i].type;
+        nkey++;
+    }
+
+    /* key terms, 'AND (' and the condition closed by its own end */
+    if (4 * nkey + (view->where ? 2 + view->nwhere : 0) > MQI_COND_MAX)
+        return 0;
+
+    view->image = calloc(nkey + 1, sizeof(mqi_column_desc_t));
+
+    if (!view->image)
+        return -1;
+
+    for (i = offs = 0;  i < nkey;  i++) {
+        view->image[i].cindex = scols[i];
+        view->image[i].offset = offs;
+        offs += SLOT_ALIGN(sizeof(double));
+    }
+
+    view->image[nkey].cindex = -1;
+    view->keysize = offs;
+
+    if (!(view->keybuf = calloc(1, offs)) ||
+        !(view->rowbuf = calloc(1, view->rowsize)))
+        return -1;
+
+    view->nkey = nkey;
+
+    if (!(view->lookup = key_condition(view, scols, view->where)) ||
+        !(view->match  = key_condition(view, vcols, NULL)))
+        return -1;
+
+    return 0;
+}
+
+
+static mqi_cond_entry_t *key_condition(view_t *view, int *cols,
+                                       mqi_cond_entry_t *where)
+{
+    mqi_cond_entry_t *cond, *ce;
+    int               n, i;
+
+    n = 4 * view->nkey + (where ? 2 + view->nwhere : 0);
+
+    if (!(cond = calloc(n, sizeof(mqi_cond_entry_t))))
+        return NULL;
+
+    for (i = 0, ce = cond;  i < view->nkey;  i++) {
+        if (i > 0) {
+            ce->type = mqi_operator;
+            ce->u.operator_ = mqi_and;
+            ce++;
+        }
+
+        ce->type = mqi_column;
+        ce->u.column = cols[i];
+        ce++;
+
+        ce->type = mqi_operator;
+        ce->u.operator_ = mqi_eq;
+        ce++;
+
+        ce->type = mqi_variable;
+        ce->u.variable.type = view->ktypes[i];
+        ce->u.variable.v.generic = view->keybuf + view->image[i].offset;
+        ce++;
+    }
+
+    if (where) {
+        ce->type = mqi_operator;
+        ce->u.operator_ = mqi_and;
+        ce++;
+
+        ce->type = mqi_operator;
+        ce->u.operator_ = mqi_begin;
+        ce++;
+
+        memcpy(ce, where, view->nwhere * sizeof(mqi_cond_entry_t));
+        ce += view->nwhere;
+    }
+
+    ce->type = mqi_operator;
+    ce->u.operator_ = mqi_end;
+
+    return cond;
+}
+
+
+static int populate(view_t *view)
+{
+    void         *data[VIEW_BATCH + 1];
+    void         *rows   = NULL;
+    mqi_cursor_t *cursor = NULL;
+    mqi_handle_t  tx;
+    int           n, i;
+
+    if ((tx = mqi_begin_transaction()) == MQI_HANDLE_INVALID)
+        return -1;
+
+    if (mqi_delete_from(view->handle, NULL) < 0)
+        goto failed;
+
+    if (!(rows = malloc(view->rowsize * VIEW_BATCH)))
+        goto failed;
+
+    if (!(cursor = mqi_select_open(view->source, view->where, view->select)))
+        goto failed;
+
+    while ((n = mqi_select_next(cursor, rows, view->rowsize, VIEW_BATCH)) > 0) {
+        for (i = 0;  i < n;  i++)
+            data[i] = rows + (i * view->rowsize);
+        data[n] = NULL;
+
+        if (mqi_insert_into(view->handle, 0, view->insert, data) < 0)
+            goto failed;
+    }
+
+    if (n < 0)
+        goto failed;
+
+    mqi_select_close(cursor);
+    free(rows);
+
+    return mqi_commit_transaction(tx);
+
+ failed:
+    mqi_select_close(cursor);
+    free(rows);
+    mqi_rollback_transaction(tx);
+
+    return -1;
+}
+
+
+static int update_row(view_t *view, mqi_change_t *c)
+{
+    void *data[2];
+    int   n;
+
+    if (c->new_) {
+        memcpy(view->keybuf, c->new_, view->keysize);
+
+        n = mqi_select(view->source, view->lookup, view->select,
+                       view->rowbuf, view->rowsize, 1);
+
+        if (n < 0)
+            return -1;
+
+        if (n > 0) {
+            data[0] = view->rowbuf;
+            data[1] = NULL;
+
+            if (mqi_insert_into(view->handle, 1, view->insert, data) < 0)
+                return -1;
+        }
+        else if (mqi_delete_from(view->handle, view->match) < 0)
+            return -1;
+    }
+
+    if (c->old && (!c->new_ || keys_differ(view, c->old, c->new_))) {
+        memcpy(view->keybuf, c->old, view->keysize);
+
+        if (mqi_delete_from(view->handle, view->match) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static bool keys_differ(view_t *view, void *a, void *b)
+{
+    int i, offs;
+
+    for (i = 0;  i < view->nkey;  i++) {
+        offs = view->image[i].offset;
+
+        switch (view->ktypes[i]) {
+        case mqi_varchar:
+            if (strcmp(*(char **)(a + offs), *(char **)(b + offs)))
+                return true;
+            break;
+        case mqi_integer:
+            if (*(int32_t *)(a + offs) != *(int32_t *)(b + offs))
+                return true;
+            break;
+        case mqi_unsignd:
+            if (*(uint32_t *)(a + offs) != *(uint32_t *)(b + offs))
+                return true;
+            break;
+        case mqi_floating:
+            if (*(double *)(a + offs) != *(double *)(b + offs))
+                return true;
+            break;
+        default:
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+static void destroy_view(view_t *view)
+{
+    int i;
+
+    if (view) {
+        for (i = 0;  i < view->nvalue;  i++) {
+            if (view->values[i].type == mqi_varchar)
+                free(view->values[i].v.varchar);
+        }
+
+        free(view->select);
+        free(view->insert);
+        free(view->where);
+        free(view->values);
+        free(view->image);
+        free(view->keybuf);
+        free(view->rowbuf);
+        free(view->lookup);
+        free(view->match);
+        free(view);
+    }
+}
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include <murphy-db/assert.h>
+#include <murphy-db/list.h>
+#include <murphy-db/hash.h>
+#include <murphy-db/mqi.h>
+#include <murphy-db/mql.h>
+#include "mql-parser.h"
+
+#ifndef MQL_CACHE_HASH_CHAINS
+#define MQL_CACHE_HASH_CHAINS  64
+#endif
+
+#ifndef MQL_CACHE_SIZE
+#define MQL_CACHE_SIZE         64
+#endif
+
+#define MQL_CACHE_TEXT_MAX     1024
+
+/*
+ * Statements executed by mql_exec_string() that can be precompiled
+ * (SELECT, INSERT, REPLACE, UPDATE, DELETE, SHOW TABLES and DESCRIBE
+ * without parameters) are kept here precompiled, keyed by their normalised
+ * text, and the least recently used one is evicted when the cache is full.
+ * Entries of a table are thrown away when the table is dropped. An entry
+ * in use is only marked stale and freed once its execution is over, as
+ * executing a statement can fire triggers that run further statements.
+ */
+typedef struct {
+    mdb_dlist_t       link;         /* LRU list, most recent first */
+    mql_statement_t  *statement;
+    mqi_handle_t      table;
+    int               busy;
+    bool              stale;
+    char              text[0];
+} entry_t;
+
+static int init(void);
+static void table_event_cb(mqi_event_t *, void *);
+static bool normalise(const char *, char *, int);
+static void shrink(void);
+static void evict(entry_t *);
+static void purge(entry_t *);
+
+static mdb_hash_t *entries;
+static MDB_DLIST_HEAD(lru);
+static int         nentry;
+static int         maxentry = MQL_CACHE_SIZE;
+static bool        registered;
+
+
+int mql_set_statement_cache_size(int size)
+{
+    MDB_CHECKARG(size >= 0, -1);
+
+    maxentry = size;
+    shrink();
+
+    return 0;
+}
+
+
+mql_result_t *mql_cache_exec_string(mql_result_type_t type, const char *str)
+{
+    char             text[MQL_CACHE_TEXT_MAX];
+    entry_t         *e;
+    mql_statement_t *s;
+    mql_result_t    *result;
+    size_t           len;
+
+    if (!maxentry || !normalise(str, text, sizeof(text)) || init() < 0)
+        return NULL;
+
+    if (!(e = mdb_hash_get_data(entries, 0,text))) {
+        if (!(s = mql_precompile(text)))
+            return NULL;
+
+        len = strlen(text) + 1;
+
+        if (!(e = calloc(1, sizeof(entry_t) + len))) {
+            mql_statement_free(s);
+            return NULL;
+        }
+
+        memcpy(e->text, text, len);
+        e->statement = s;
+        e->table     = mql_statement_get_table(s);
+
+        if (mdb_hash_add(entries, 0,e->text, e) < 0) {
+            mql_statement_free(s);
+            free(e);
+            return NULL;
+        }
+
+        MDB_DLIST_INIT(e->link);
+        nentry++;
+    }
+
+    MDB_DLIST_UNLINK(entry_t, link, e);
+    MDB_DLIST_PREPEND(entry_t, link, e, &lru);
+
+    e->busy++;
+    shrink();
+
+    result = mql_exec_statement(type, e->statement);
+    e->busy--;
+
+    if (e->stale && !e->busy)
+        purge(e);
+
+    return result;
+}
+
+
+static int init(void)
+{
+    if (!entries) {
+        entries = MDB_HASH_TABLE_CREATE(string, MQL_CACHE_HASH_CHAINS);
+        MDB_PREREQUISITE(entries, -1);
+    }
+
+    if (!registered) {
+        if (mqi_create_table_trigger(table_event_cb, NULL) < 0)
+            return -1;
+
+        registered = true;
+    }
+
+    return 0;
+}
+
+
+static void table_event_cb(mqi_event_t *evt, void *user_data)
+{
+    mqi_table_event_t *te = &evt->table;
+    entry_t           *e, *n;
+
+    (void)user_data;
+
+    if (te->event != mqi_table_dropped)
+        return;
+
+    MDB_DLIST_FOR_EACH_SAFE(entry_t, link, e,n, &lru) {
+        if (!e->stale && e->table == te->table.handle) {
+            if (e->busy) {
+                mdb_hash_delete(entries, 0,e->text);
+                e->stale = true;
+            }
+            else
+                evict(e);
+        }
+    }
+}
+
+
+static bool normalise(const char *str, char *buf, int len)
+{
+    static const char *cacheable[] = {
+        "select", "insert", "replace", "update", "delete",
+        "show", "describe", NULL
+    };
+
+    const char  *s;
+    char        *p, *e;
+    char         quote;
+    size_t       l;
+    int          i;
+
+    for (s = str;  isspace(*s);  s++)
+        ;
+
+    for (i = 0;  cacheable[i];  i++) {
+        l = strlen(cacheable[i]);
+
+        if (!strncasecmp(s, cacheable[i], l) && (!s[l] || isspace(s[l])))
+            break;
+    }
+
+    if (!cacheable[i])
+        return false;
+
+    e = (p = buf) + len - 1;
+    quote = 0;
+
+    for (;  *s;  s++) {
+        if (p >= e)
+            return false;
+
+        if (quote) {
+            if (*s == quote)
+                quote = 0;
+        }
+        else {
+            if (*s == '\'' || *s == '"')
+                quote = *s;
+            else if (*s == '%' || *s == ';')
+                return false;   /* parameters or several statements */
+            else if (isspace(*s)) {
+                while (isspace(s[1]))
+                    s++;
+                if (!s[1])
+                    break;
+                *p++ = ' ';
+                continue;
+            }
+        }
+
+        *p++ = *s;
+    }
+
+    *p = '\0';
+
+    return !quote;
+}
+
+
+static void shrink(void)
+{
+    mdb_dlist_t *l, *p;
+    entry_t     *e;
+
+    for (l = lru.prev;  l != &lru && nentry > maxentry;  l = p) {
+        p = l->prev;
+        e = MDB_LIST_RELOCATE(entry_t, link, l);
+
+        if (!e->busy && !e->stale)
+            evict(e);
+    }
+}
+
+
+static void evict(entry_t *e)
+{
+    mdb_hash_delete(entries, 0,e->text);
+    purge(e);
+}
+
+
+static void purge(entry_t *e)
+{
+    MDB_DLIST_UNLINK(entry_t, link, e);
+    mql_statement_free(e->statement);
+    free(e);
+
+    nentry--;
+}
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
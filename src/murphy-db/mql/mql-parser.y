@@ -8,8 +8,8 @@
 #include <unistd.h>
 #include <string.h>
 #include <ctype.h>
-#include <alloca.h>
 #include <errno.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <libgen.h>
 
@@ -88,6 +88,7 @@ static uint32_t     table_flags;
 
 static char                  *trigger_name;
 static struct mql_callback_s *callback;
+static mqi_bitfld_t           changeset_mask;
 
 static mqi_column_def_t   coldefs[MQI_COLUMN_MAX + 1];
 static mqi_column_def_t  *coldef = coldefs;
@@ -95,9 +96,13 @@ static mqi_column_def_t  *coldef = coldefs;
 static char              *colnams[MQI_COLUMN_MAX + 1];
 static int                ncolnam;
 
+static char              *index_name;
+static mqi_index_type_t   index_type;
+
 static mqi_cond_entry_t   conds[MQI_COND_MAX + 1];
 static mqi_cond_entry_t  *cond = conds;
 static int                binds;
+static int                limit;
 
 static input_t            inputs[MQI_COLUMN_MAX];
 static int                ninput;
@@ -158,14 +163,19 @@ static FILE        *mqlout;
 %token <string>   TKN_TABLE
 %token <string>   TKN_TABLES
 %token <string>   TKN_INDEX
+%token <string>   TKN_ORDERED
 %token <string>   TKN_ROWS
+%token <string>   TKN_CHANGES
 %token <string>   TKN_COLUMN
 %token <string>   TKN_TRIGGER
+%token <string>   TKN_VIEW
+%token <string>   TKN_AS
 %token <string>   TKN_INSERT
 %token <string>   TKN_SELECT
 %token <string>   TKN_INTO
 %token <string>   TKN_FROM
 %token <string>   TKN_WHERE
+%token <string>   TKN_LIMIT
 %token <string>   TKN_VALUES
 %token <string>   TKN_SET
 %token <string>   TKN_ON
@@ -175,6 +185,7 @@ static FILE        *mqlout;
 %token <string>   TKN_TEMPORARY
 %token <string>   TKN_CALLBACK
 %token <string>   TKN_VARCHAR
+%token <string>   TKN_INTERNED
 %token <string>   TKN_INTEGER
 %token <string>   TKN_UNSIGNED
 %token <string>   TKN_REAL
@@ -239,7 +250,11 @@ static FILE        *mqlout;
     mql_statement_t *mql_make_select_statement(mqi_handle_t, int, int,
                                                mqi_cond_entry_t *, int,
                                                char **, mqi_data_type_t *,
-                                               int *, mqi_column_desc_t *);
+                                               int *, mqi_column_desc_t *,
+                                               int);
+
+    mqi_handle_t mql_statement_get_table(mql_statement_t *);
+    mql_result_t *mql_cache_exec_string(mql_result_type_t, const char *);
 
     mql_result_t *mql_result_success_create(void);
     mql_result_t *mql_result_error_create(int, const char *, ...);
@@ -249,11 +264,18 @@ static FILE        *mqlout;
     mql_result_t *mql_result_event_row_change_create(mqi_event_type_t,
                                                      mqi_handle_t,
                                                      mql_result_t *);
+    mql_result_t *mql_result_event_changeset_create(mqi_handle_t,
+                                                    mql_result_t *,
+                                                    mql_result_t *,
+                                                    mql_result_t *);
     mql_result_t *mql_result_event_table_create(mqi_event_type_t,mqi_handle_t);
     mql_result_t *mql_result_event_transaction_create(mqi_event_type_t);
     mql_result_t *mql_result_columns_create(int, mqi_column_def_t *);
     mql_result_t *mql_result_rows_create(int, mqi_column_desc_t*,
                                          mqi_data_type_t*,int*,int,int,void*);
+    mql_result_t *mql_result_rows_create_from_cursor(int, mqi_column_desc_t*,
+                                                     mqi_data_type_t*, int*,
+                                                     int, mqi_cursor_t*, int);
     mql_result_t *mql_result_string_create_table_list(int, char **);
     mql_result_t *mql_result_string_create_column_change(const char *,
                                                          const char *,
@@ -264,6 +286,10 @@ static FILE        *mqlout;
                                                       mql_result_t *);
     mql_result_t *mql_result_string_create_table_change(mqi_event_type_t,
                                                         const char *);
+    mql_result_t *mql_result_string_create_changeset(const char *,
+                                                     mql_result_t *,
+                                                     mql_result_t *,
+                                                     mql_result_t *);
     mql_result_t *mql_result_string_create_transaction_change(
                                                             mqi_event_type_t);
     mql_result_t *mql_result_string_create_column_list(int, mqi_column_def_t*);
@@ -282,6 +308,11 @@ static FILE        *mqlout;
     int mql_create_row_trigger(char *, mqi_handle_t, mql_callback_t *,
                                int, char **, mqi_column_desc_t *,
                                mqi_data_type_t *, int *, int);
+    int mql_create_changeset_trigger(char *, mqi_handle_t,
+                                     const mqi_bitfld_t *,
+                                     mql_callback_t *,
+                                     int, char **, mqi_column_desc_t *,
+                                     mqi_data_type_t *, int *, int);
     int mql_create_table_trigger(char *, mql_callback_t *);
     int mql_create_transaction_trigger(char *, mql_callback_t *);
 
@@ -381,6 +412,7 @@ create_statement:
   create_table_statement
 | create_index_statement
 | create_trigger_statement
+| create_view_statement
 ; 
 
 /*#toplevel#*/
@@ -388,15 +420,38 @@ create_table_statement: TKN_CREATE create_table table_definition
 ;
 
 /*#toplevel#*/
-create_index_statement: TKN_CREATE create_index index_definition
+create_index_statement:
+  TKN_CREATE create_index index_definition
+| TKN_CREATE create_index index_name secondary_index_definition
+| TKN_CREATE create_ordered_index index_name secondary_index_definition
 ;
 
+/*#toplevel#*/
+create_view_statement:
+  TKN_CREATE TKN_VIEW TKN_IDENTIFIER TKN_AS
+  select columns TKN_FROM table_name where_clause {
+    mqi_cond_entry_t *where;
+
+    if (binds > 0)
+        MQL_ERROR(EINVAL, "views can't have parameters");
+
+    colnams[ncolnam] = NULL;
+    where = (cond == conds) ? NULL : conds;
+
+    if (mqi_create_view($3, table, where, ncolnam ? colnams : NULL) ==
+        MQI_HANDLE_INVALID)
+        MQL_ERROR(errno, "Can't create view: %s\n", strerror(errno));
+    else
+        MQL_SUCCESS;
+};
+
 /*#toplevel#*/
 create_trigger_statement:
   create_transaction_trigger
 | create_table_trigger
 | create_row_trigger
 | create_column_trigger
+| create_changeset_trigger
 ;
 
 
@@ -404,6 +459,7 @@ create_trigger_statement:
 
 create_table: table_flags TKN_TABLE {
     coldef = coldefs;
+    memset(coldef, 0, sizeof(mqi_column_def_t));
     
     if (table_flags == MQI_ANY)
         table_flags = MQI_TEMPORARY;
@@ -441,6 +497,11 @@ column_name: TKN_IDENTIFIER {
 /*#toplevel#*/
 column_type:
   varchar       { coldef->type = mqi_varchar;   coldef->length = $1; }
+| TKN_INTERNED varchar {
+    coldef->type   = mqi_varchar;
+    coldef->length = $2;
+    coldef->flags  = MQI_COLUMN_INTERNED;
+}
 | TKN_INTEGER   { coldef->type = mqi_integer;   coldef->length = 0;  }
 | TKN_UNSIGNED  { coldef->type = mqi_unsignd;   coldef->length = 0;  }
 | TKN_REAL      { coldef->type = mqi_floating;  coldef->length = 0;  }
@@ -458,7 +519,17 @@ blob: TKN_BLOB TKN_LEFT_PAREN TKN_NUMBER TKN_RIGHT_PAREN {
 /* create index */
 
 create_index: TKN_INDEX {
-    ncolnam = 0;
+    ncolnam    = 0;
+    index_type = mqi_index_hash;
+};
+
+create_ordered_index: TKN_ORDERED TKN_INDEX {
+    ncolnam    = 0;
+    index_type = mqi_index_ordered;
+};
+
+index_name: TKN_IDENTIFIER {
+    index_name = $1;
 };
 
 index_definition: TKN_ON table_name TKN_LEFT_PAREN column_list TKN_RIGHT_PAREN
@@ -471,6 +542,18 @@ index_definition: TKN_ON table_name TKN_LEFT_PAREN column_list TKN_RIGHT_PAREN
         MQL_SUCCESS;
 };
 
+secondary_index_definition:
+  TKN_ON table_name TKN_LEFT_PAREN column_list TKN_RIGHT_PAREN
+{
+    colnams[ncolnam] = NULL;
+
+    if (mqi_create_secondary_index(table, index_name, index_type, colnams) < 0)
+        MQL_ERROR(errno, "failed to create index '%s': %s", index_name,
+                  strerror(errno));
+    else
+        MQL_SUCCESS;
+};
+
 
 /* create trigger */
 
@@ -490,6 +573,10 @@ create_row_trigger: TKN_CREATE create_trigger row_trigger
 create_column_trigger: TKN_CREATE create_trigger column_trigger
 ;
 
+/*#toplevel#*/
+create_changeset_trigger: TKN_CREATE create_trigger changeset_trigger
+;
+
 create_trigger: TKN_TRIGGER TKN_IDENTIFIER TKN_ON {
     if (mode != mql_mode_exec)
         MQL_ERROR(EPERM, "only mql_exec_string() can create triggers");
@@ -498,6 +585,7 @@ create_trigger: TKN_TRIGGER TKN_IDENTIFIER TKN_ON {
         ncolnam = 0;
         trigger_name = $2;
         callback = NULL;
+        mqi_bitfld_clear(&changeset_mask);
     }
 };
 
@@ -588,6 +676,50 @@ column_trigger: TKN_COLUMN TKN_IDENTIFIER TKN_IN table_name callback
 };
 
 
+changeset_trigger: TKN_CHANGES TKN_IN table_name changeset_columns callback
+                   trigger_select
+{
+    int rowsize;
+    int colsizes[MQI_COLUMN_MAX + 1];
+    mqi_data_type_t coltypes[MQI_COLUMN_MAX + 1];
+    char errbuf[256];
+    int sts;
+
+    sts = set_select_variables(&rowsize, coltypes,colsizes,
+                               errbuf, sizeof(errbuf));
+    if (sts < 0)
+        MQL_ERROR(errno, "%s", errbuf);
+
+    sts = mql_create_changeset_trigger(trigger_name, table, &changeset_mask,
+                                       callback, ncolnam,colnams,
+                                       coldescs, coltypes, colsizes,
+                                       rowsize);
+    if (sts < 0)
+        MQL_ERROR(errno, "failed to create changeset trigger: %s",
+                  strerror(errno));
+    else
+        MQL_SUCCESS;
+};
+
+changeset_columns:
+  /* all columns */
+| TKN_COLUMN changeset_column_list
+;
+
+changeset_column_list:
+  changeset_column
+| changeset_column_list TKN_COMMA changeset_column
+;
+
+changeset_column: TKN_IDENTIFIER {
+    int colidx;
+
+    if ((colidx = mqi_get_column_index(table, $1)) < 0)
+        MQL_ERROR(errno, "do not know changeset column '%s'", $1);
+    else
+        mqi_bitfld_set(&changeset_mask, colidx);
+};
+
 callback: TKN_CALLBACK TKN_IDENTIFIER {
     if (!(callback = mql_find_callback($2))) {
         MQL_ERROR(ENOENT, "can't find callback '%s'", $2);
@@ -628,7 +760,11 @@ drop_table_statement: TKN_DROP TKN_TABLE  table_name {
 /* drop index */
 
 /*#toplevel#*/
-drop_index_statement: TKN_DROP TKN_INDEX table_name {
+drop_index_statement: TKN_DROP TKN_INDEX TKN_IDENTIFIER TKN_ON table_name {
+    if (mqi_drop_secondary_index(table, $3) < 0)
+        MQL_ERROR(errno, "failed to drop index '%s': %s", $3, strerror(errno));
+    else
+        MQL_SUCCESS;
 };
 
 
@@ -950,71 +1086,64 @@ delete: TKN_DELETE TKN_FROM {
  *
  */
 /*#toplevel#*/
-select_statement: select columns TKN_FROM table_name where_clause {
+select_statement: select columns TKN_FROM table_name where_clause limit_clause {
     int colsizes[MQI_COLUMN_MAX + 1];
     mqi_data_type_t coltypes[MQI_COLUMN_MAX + 1];
     mqi_cond_entry_t *where;
+    mqi_cursor_t *cursor;
+    mql_result_t *rows;
     int rowsize;
-    int tsiz;
-    size_t rsiz;
-    void *rows;
     char errbuf[256];
     int sts;
     int n;
 
 
-    if ((tsiz = mqi_get_table_size(table)) < 0)
-        MQL_ERROR(errno, "can't get table size: %s", strerror(errno));
-
-
     sts = set_select_variables(&rowsize, coltypes,colsizes,
                                errbuf, sizeof(errbuf));
     if (sts < 0)
         MQL_ERROR(errno, "%s", errbuf);
 
+    where = (cond == conds) ? NULL : conds;
 
-    if (mode != mql_mode_precompile && mode != mql_mode_exec && !tsiz) {
-        if (mode == mql_mode_parser)
-            fprintf(mqlout, "no rows\n");
+    if (mode == mql_mode_precompile) {
+        statement = mql_make_select_statement(table, rowsize,
+                                              cond - conds, where,
+                                              ncolnam, colnams, coltypes,
+                                              colsizes, coldescs, limit);
     }
     else {
-        rsiz  = tsiz * rowsize;
-        rows  = alloca(rsiz);
-        where = (cond == conds) ? NULL : conds;
-
-        if (mode != mql_mode_precompile) {
-            if (tsiz != 0) {
-                if ((n = mqi_select(table, where,
-                                    coldescs, rows, rowsize, tsiz)) < 0)
-                    MQL_ERROR(errno, "select failed: %s", strerror(errno));
-            }
-            else
-                n = 0;
-        }
+        if (!(cursor = mqi_select_open(table, where, coldescs)))
+            MQL_ERROR(errno, "select failed: %s", strerror(errno));
 
-        switch (mode) {
-        case mql_mode_parser:
-            fprintf(mqlout, "Selected %d rows:\n", n);
-            print_query_result(coldescs, coltypes, colsizes, n, rowsize, rows);
-            break;
-        case mql_mode_exec:
-            if (rtype == mql_result_rows) {
-                result = mql_result_rows_create(ncolnam, coldescs, coltypes,
-                                                colsizes, n, rowsize, rows);
-            }
+        rows = mql_result_rows_create_from_cursor(ncolnam, coldescs, coltypes,
+                                                  colsizes, rowsize,
+                                                  cursor, limit);
+        mqi_select_close(cursor);
+
+        if (!rows)
+            MQL_ERROR(errno, "select failed: %s", strerror(errno));
+
+        n = mql_result_rows_get_row_count(rows);
+
+        if (mode == mql_mode_parser) {
+            if (!n)
+                fprintf(mqlout, "no rows\n");
             else {
-                result = mql_result_string_create_row_list(ncolnam, colnams,
-                                                           coldescs, coltypes,
-                                                           colsizes,
-                                                           n, rowsize, rows);
+                fprintf(mqlout, "Selected %d rows:\n", n);
+                print_query_result(coldescs, coltypes, colsizes, n, rowsize,
+                                   mql_result_rows_get_data(rows, &rowsize));
             }
-            break;
-        case mql_mode_precompile:
-            statement = mql_make_select_statement(table, rowsize,
-                                                  cond - conds, where,
-                                                  ncolnam, colnams, coltypes,
-                                                  colsizes, coldescs); 
-            break;
+            mql_result_free(rows);
+        }
+        else if (rtype == mql_result_rows)
+            result = rows;
+        else {
+            result = mql_result_string_create_row_list(ncolnam, colnams,
+                                        coldescs, coltypes, colsizes, n,
+                                        rowsize,
+                                        mql_result_rows_get_data(rows,
+                                                                 &rowsize));
+            mql_result_free(rows);
         }
     }
 };
@@ -1029,6 +1158,7 @@ select: TKN_SELECT {
     nfloat = 0;
     cond = conds;
     binds = 0;
+    limit = -1;
 };
 
 columns:
@@ -1141,6 +1271,21 @@ where_clause:
   };
 
 
+/***********************************
+ *
+ * Limit clause
+ *
+ */
+limit_clause:
+  /* no limit clause */ {
+  }
+| TKN_LIMIT TKN_NUMBER {
+    if ($2 < 0 || $2 > INT_MAX)
+        MQL_ERROR(EINVAL, "invalid limit %lld", $2);
+    limit = $2;
+  };
+
+
 /*#toplevel#*/
 conditional_expression:
   relational_expression
@@ -1369,6 +1514,9 @@ mql_result_t *mql_exec_string(mql_result_type_t result_type, const char *str)
                   result_type == mql_result_string  ) && 
                  str, NULL);
 
+    if ((result = mql_cache_exec_string(result_type, str)))
+        return result;
+
     mode = mql_mode_exec;
     result = NULL;
     rtype  = result_type;
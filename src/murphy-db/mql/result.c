@@ -34,6 +34,7 @@
 #include <alloca.h>
 #include <ctype.h>
 #include <errno.h>
+#include <endian.h>
 
 #include <murphy-db/assert.h>
 #include <murphy-db/mql-result.h>
@@ -46,6 +47,7 @@ typedef struct result_event_s          result_event_t;
 typedef struct result_event_colchg_s   result_event_colchg_t;
 typedef struct result_event_rowchg_s   result_event_rowchg_t;
 typedef struct result_event_table_s    result_event_table_t;
+typedef struct result_event_chgset_s   result_event_chgset_t;
 typedef struct result_event_transact_s result_event_transact_t;
 typedef struct result_columns_s        result_columns_t;
 typedef struct result_rows_s           result_rows_t;
@@ -97,6 +99,15 @@ struct result_event_table_s {
     mqi_handle_t          table;
 };
 
+struct result_event_chgset_s {
+    mql_result_type_t     type;
+    mqi_event_type_t      event;
+    mqi_handle_t          table;
+    mql_result_t         *inserted;
+    mql_result_t         *deleted;
+    mql_result_t         *updated;
+};
+
 struct result_event_transact_s {
     mql_result_type_t     type;
     mqi_event_type_t      event;
@@ -138,8 +149,30 @@ struct result_list_s {
     }                     value;
 };
 
+/*
+ * packed rows, ie. the blob produced by mql_result_rows_pack(): the header,
+ * the column types, the blob offsets of the columns and then the columns
+ * one after the other, each 8-byte aligned. Integers and unsigneds are
+ * 32-bit, floatings are doubles and varchars are 32-bit blob offsets of
+ * zero terminated strings stored at the end of the blob. Everything is
+ * little-endian so the blob can be passed around as is and read in place.
+ */
+#define PACKED_MAGIC   0x314c514d         /* 'MQL1' */
+#define PACKED_ALIGN(n, a)  (((n) + (a) - 1) & ~((size_t)(a) - 1))
+
+typedef struct {
+    uint32_t              magic;
+    uint32_t              size;
+    uint32_t              nrow;
+    uint16_t              ncol;
+    uint16_t              flags;
+    uint8_t               types[0];
+} __attribute__ ((packed)) packed_rows_t;   /* can be unaligned in place */
+
 static inline mqi_data_type_t get_column_type(result_rows_t *, int);
 static inline void *get_column_address(result_rows_t *, int, int);
+static inline size_t packed_column_offset(const packed_rows_t *, int);
+static inline const void *packed_cell(const void *, int, int, int *);
 
 
 int mql_result_is_success(mql_result_t *r)
@@ -249,6 +282,22 @@ mql_result_t *mql_result_event_get_changed_rows(mql_result_t *r)
     return rowchg_ev->select;
 }
 
+mql_result_t *mql_result_event_get_changeset_rows(mql_result_t     *r,
+                                                  mqi_event_type_t  kind)
+{
+    result_event_chgset_t *cs = (result_event_chgset_t *)r;
+
+    if (!r || r->type != mql_result_event || cs->event != mqi_changeset)
+        return NULL;
+
+    switch (kind) {
+    case mqi_row_inserted:    return cs->inserted;
+    case mqi_row_deleted:     return cs->deleted;
+    case mqi_column_changed:  return cs->updated;
+    default:                  return NULL;
+    }
+}
+
 mql_result_t *mql_result_event_column_change_create(mqi_handle_t        table,
                                                     int                 column,
                                                     mqi_change_value_t *value,
@@ -340,6 +389,34 @@ mql_result_t *mql_result_event_row_change_create(mqi_event_type_t    event,
 }
 
 
+mql_result_t *mql_result_event_changeset_create(mqi_handle_t   table,
+                                               mql_result_t  *inserted,
+                                               mql_result_t  *deleted,
+                                               mql_result_t  *updated)
+{
+    result_event_chgset_t *rslt;
+
+    MDB_CHECKARG(table != MQI_HANDLE_INVALID &&
+                 (!inserted || inserted->type == mql_result_rows) &&
+                 (!deleted  || deleted->type  == mql_result_rows) &&
+                 (!updated  || updated->type  == mql_result_rows), NULL);
+
+    if (!(rslt = calloc(1, sizeof(result_event_chgset_t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    rslt->type     = mql_result_event;
+    rslt->event    = mqi_changeset;
+    rslt->table    = table;
+    rslt->inserted = inserted;
+    rslt->deleted  = deleted;
+    rslt->updated  = updated;
+
+    return (mql_result_t *)rslt;
+}
+
+
 mql_result_t *mql_result_event_table_create(mqi_event_type_t  event,
                                             mqi_handle_t      table)
 {
@@ -521,6 +598,90 @@ mql_result_t *mql_result_rows_create(int                ncol,
 }
 
 
+mql_result_t *mql_result_rows_create_from_cursor(int                ncol,
+                                                 mqi_column_desc_t *coldescs,
+                                                 mqi_data_type_t   *coltypes,
+                                                 int               *colsizes,
+                                                 int                rowsize,
+                                                 mqi_cursor_t      *cursor,
+                                                 int                limit)
+{
+    result_rows_t     *rslt;
+    result_rows_t     *r;
+    column_desc_t     *col;
+    mqi_column_desc_t *cd;
+    size_t             offs;
+    int                dim;
+    int                nrow;
+    int                n;
+    int                i;
+
+    MDB_CHECKARG(ncol >  0 && coldescs && coltypes && colsizes &&
+                 rowsize > 0 && cursor, NULL);
+
+    /*
+     * the rows are fetched straight into the result buffer which
+     * grows geometrically; a negative limit means 'no limit'
+     */
+    offs = sizeof(result_rows_t) + sizeof(column_desc_t) * ncol;
+    dim  = (limit >= 0 && limit < 32) ? limit : 32;
+    nrow = 0;
+
+    if (!(rslt = calloc(1, offs + (size_t)rowsize * dim))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    while (dim > nrow) {
+        n = mqi_select_next(cursor, (char *)rslt + offs + rowsize * nrow,
+                            rowsize, dim - nrow);
+        if (n < 0) {
+            free(rslt);
+            return NULL;
+        }
+
+        if (!n)
+            break;
+
+        if ((nrow += n) < dim)
+            continue;
+
+        if (limit >= 0 && nrow >= limit)
+            break;
+
+        dim *= 2;
+
+        if (limit >= 0 && dim > limit)
+            dim = limit;
+
+        if (!(r = realloc(rslt, offs + (size_t)rowsize * dim))) {
+            free(rslt);
+            errno = ENOMEM;
+            return NULL;
+        }
+
+        rslt = r;
+    }
+
+    rslt->type    = mql_result_rows;
+    rslt->rowsize = rowsize;
+    rslt->ncol    = ncol;
+    rslt->nrow    = nrow;
+    rslt->data    = rslt->cols + ncol;
+
+    for (i = 0;   i < ncol;  i++) {
+        col = rslt->cols + i;
+        cd  = coldescs + i;
+
+        col->cindex = cd->cindex;
+        col->type   = coltypes[i];
+        col->offset = cd->offset;
+    }
+
+    return (mql_result_t *)rslt;
+}
+
+
 int mql_result_rows_get_row_column_count(mql_result_t *r)
 {
     result_rows_t *rslt = (result_rows_t *)r;
@@ -550,6 +711,27 @@ int mql_result_rows_get_row_column_index(mql_result_t *r, int colidx)
     return rslt->cols[colidx].cindex;
 }
 
+int mql_result_rows_get_row_column_offset(mql_result_t *r, int colidx)
+{
+    result_rows_t *rslt = (result_rows_t *)r;
+
+    MDB_CHECKARG(rslt && rslt->type == mql_result_rows &&
+                 colidx >= 0 && rslt->ncol > colidx, -1);
+
+    return rslt->cols[colidx].offset;
+}
+
+void *mql_result_rows_get_data(mql_result_t *r, int *rowsize)
+{
+    result_rows_t *rslt = (result_rows_t *)r;
+
+    MDB_CHECKARG(rslt && rslt->type == mql_result_rows && rowsize, NULL);
+
+    *rowsize = rslt->rowsize;
+
+    return rslt->data;
+}
+
 int mql_result_rows_get_row_count(mql_result_t *r)
 {
     result_rows_t *rslt = (result_rows_t *)r;
@@ -685,6 +867,259 @@ double mql_result_rows_get_floating(mql_result_t *r, int colidx, int rowidx)
 }
 
 
+void *mql_result_rows_pack(mql_result_t *r, size_t *sizep)
+{
+    result_rows_t *rslt = (result_rows_t *)r;
+    packed_rows_t *pr;
+    uint8_t       *blob;
+    uint32_t       u32, *coloffs;
+    uint64_t       u64;
+    size_t         offs, strs, size, width;
+    const char    *str;
+    void          *addr;
+    int            i, j;
+
+    MDB_CHECKARG(rslt && rslt->type == mql_result_rows && sizep, NULL);
+
+    offs = PACKED_ALIGN(sizeof(packed_rows_t) + rslt->ncol, 4);
+    offs = PACKED_ALIGN(offs + sizeof(uint32_t) * rslt->ncol, 8);
+    size = offs;
+    strs = 0;
+
+    for (i = 0;  i < rslt->ncol;  i++) {
+        switch (get_column_type(rslt, i)) {
+        case mqi_varchar:
+            for (j = 0;  j < rslt->nrow;  j++)
+                strs += strlen(*(char **)get_column_address(rslt, i, j)) + 1;
+            /* fall through */
+        case mqi_integer:
+        case mqi_unsignd:
+            width = sizeof(uint32_t);
+            break;
+        case mqi_floating:
+            width = sizeof(double);
+            break;
+        default:
+            errno = EINVAL;
+            return NULL;
+        }
+
+        size += PACKED_ALIGN(width * rslt->nrow, 8);
+    }
+
+    strs += size;
+
+    MDB_ASSERT(strs <= UINT32_MAX && rslt->ncol <= UINT16_MAX,
+               EOVERFLOW, NULL);
+
+    if (!(blob = calloc(1, strs))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    pr = (packed_rows_t *)blob;
+    pr->magic = htole32(PACKED_MAGIC);
+    pr->size  = htole32(strs);
+    pr->nrow  = htole32(rslt->nrow);
+    pr->ncol  = htole16(rslt->ncol);
+
+    coloffs = (uint32_t *)(blob + PACKED_ALIGN(sizeof(*pr) + rslt->ncol, 4));
+    strs    = size;
+
+    for (i = 0;  i < rslt->ncol;  i++) {
+        pr->types[i] = get_column_type(rslt, i);
+        coloffs[i]   = htole32(offs);
+
+        for (j = 0;  j < rslt->nrow;  j++) {
+            addr = get_column_address(rslt, i, j);
+
+            switch (pr->types[i]) {
+            case mqi_varchar:
+                str = *(char **)addr;
+                u32 = htole32(strs);
+                memcpy(blob + offs, &u32, sizeof(u32));
+                strcpy((char *)blob + strs, str);
+                strs += strlen(str) + 1;
+                offs += sizeof(u32);
+                break;
+            case mqi_integer:
+            case mqi_unsignd:
+                memcpy(&u32, addr, sizeof(u32));
+                u32 = htole32(u32);
+                memcpy(blob + offs, &u32, sizeof(u32));
+                offs += sizeof(u32);
+                break;
+            case mqi_floating:
+                memcpy(&u64, addr, sizeof(u64));
+                u64 = htole64(u64);
+                memcpy(blob + offs, &u64, sizeof(u64));
+                offs += sizeof(u64);
+                break;
+            }
+        }
+
+        offs = PACKED_ALIGN(offs, 8);
+    }
+
+    *sizep = strs;
+
+    return blob;
+}
+
+
+int mql_packed_rows_check(const void *blob, size_t size)
+{
+    const packed_rows_t *pr = (const packed_rows_t *)blob;
+    const uint8_t       *p  = (const uint8_t *)blob;
+    size_t               hdr, offs, width;
+    uint32_t             u32, nrow;
+    uint16_t             ncol;
+    int                  i, j;
+
+    MDB_CHECKARG(blob && size >= sizeof(*pr), -1);
+
+    ncol = le16toh(pr->ncol);
+    nrow = le32toh(pr->nrow);
+    hdr  = PACKED_ALIGN(sizeof(*pr) + ncol, 4) + sizeof(uint32_t) * ncol;
+
+    MDB_ASSERT(le32toh(pr->magic) == PACKED_MAGIC &&
+               le32toh(pr->size)  == size && hdr <= size, EINVAL, -1);
+
+    for (i = 0;  i < ncol;  i++) {
+        switch (pr->types[i]) {
+        case mqi_varchar:
+        case mqi_integer:
+        case mqi_unsignd:  width = sizeof(uint32_t);  break;
+        case mqi_floating: width = sizeof(double);    break;
+        default:           errno = EINVAL;            return -1;
+        }
+
+        offs = packed_column_offset(pr, i);
+
+        MDB_ASSERT(offs >= hdr && offs <= size && (offs & 7) == 0 &&
+                   nrow <= (size - offs) / width, EINVAL, -1);
+
+        if (pr->types[i] != mqi_varchar)
+            continue;
+
+        MDB_ASSERT(!nrow || !p[size - 1], EINVAL, -1);
+
+        for (j = 0;  j < (int)nrow;  j++) {
+            memcpy(&u32, p + offs + sizeof(u32) * j, sizeof(u32));
+            MDB_ASSERT(le32toh(u32) < size, EINVAL, -1);
+        }
+    }
+
+    return 0;
+}
+
+
+int mql_packed_rows_get_row_count(const void *blob)
+{
+    const packed_rows_t *pr = (const packed_rows_t *)blob;
+
+    MDB_CHECKARG(pr, -1);
+
+    return le32toh(pr->nrow);
+}
+
+
+int mql_packed_rows_get_column_count(const void *blob)
+{
+    const packed_rows_t *pr = (const packed_rows_t *)blob;
+
+    MDB_CHECKARG(pr, -1);
+
+    return le16toh(pr->ncol);
+}
+
+
+mqi_data_type_t mql_packed_rows_get_column_type(const void *blob, int colidx)
+{
+    const packed_rows_t *pr = (const packed_rows_t *)blob;
+
+    MDB_CHECKARG(pr && colidx >= 0 && colidx < le16toh(pr->ncol), -1);
+
+    return pr->types[colidx];
+}
+
+
+const char *mql_packed_rows_get_string(const void *blob, int colidx,int rowidx)
+{
+    const void *cell;
+    uint32_t    offs;
+    int         type;
+
+    if (!(cell = packed_cell(blob, colidx, rowidx, &type)))
+        return NULL;
+
+    MDB_ASSERT(type == mqi_varchar, EINVAL, NULL);
+
+    memcpy(&offs, cell, sizeof(offs));
+
+    return (const char *)blob + le32toh(offs);
+}
+
+
+int32_t mql_packed_rows_get_integer(const void *blob, int colidx, int rowidx)
+{
+    return (int32_t)mql_packed_rows_get_unsigned(blob, colidx, rowidx);
+}
+
+
+uint32_t mql_packed_rows_get_unsigned(const void *blob, int colidx,int rowidx)
+{
+    const void *cell;
+    uint32_t    u32;
+    int         type;
+
+    if (!(cell = packed_cell(blob, colidx, rowidx, &type)))
+        return 0;
+
+    switch (type) {
+    case mqi_integer:
+    case mqi_unsignd:
+        memcpy(&u32, cell, sizeof(u32));
+        return le32toh(u32);
+    case mqi_floating:
+        return (uint32_t)mql_packed_rows_get_floating(blob, colidx, rowidx);
+    default:
+        errno = EINVAL;
+        return 0;
+    }
+}
+
+
+double mql_packed_rows_get_floating(const void *blob, int colidx, int rowidx)
+{
+    const void *cell;
+    uint64_t    u64;
+    uint32_t    u32;
+    double      dbl;
+    int         type;
+
+    if (!(cell = packed_cell(blob, colidx, rowidx, &type)))
+        return 0.0;
+
+    switch (type) {
+    case mqi_integer:
+        memcpy(&u32, cell, sizeof(u32));
+        return (int32_t)le32toh(u32);
+    case mqi_unsignd:
+        memcpy(&u32, cell, sizeof(u32));
+        return le32toh(u32);
+    case mqi_floating:
+        memcpy(&u64, cell, sizeof(u64));
+        u64 = le64toh(u64);
+        memcpy(&dbl, &u64, sizeof(dbl));
+        return dbl;
+    default:
+        errno = EINVAL;
+        return 0.0;
+    }
+}
+
+
 mql_result_t *mql_result_string_create_table_list(int n, char **names)
 {
     static const char *no_tables = "no tables\n";
@@ -986,6 +1421,92 @@ mql_result_t *mql_result_string_create_table_change(mqi_event_type_t    event,
 #undef EVENT
 }
 
+mql_result_t *mql_result_string_create_changeset(const char   *table,
+                                                mql_result_t *inserted,
+                                                mql_result_t *deleted,
+                                                mql_result_t *updated)
+{
+#define EVENT   0
+#define TABLE   1
+#define FLDS    2
+
+    static const char *hstr[FLDS]  = {" event", "table"};
+    static int         hlen[FLDS]  = {    6   ,    5   };
+    static const char *title[3]    = {"inserted", "deleted", "updated"};
+
+    result_string_t *rs[3];
+    size_t           slen[3];
+    result_string_t *rslt;
+
+    int              len[FLDS];
+    const char      *cstr[FLDS];
+    int              cw[FLDS];
+    int              linlen;
+    size_t           ssiz;
+    size_t           size;
+    char            *p;
+    int              i;
+
+    MDB_CHECKARG(table &&
+                 (!inserted || inserted->type == mql_result_string) &&
+                 (!deleted  || deleted->type  == mql_result_string) &&
+                 (!updated  || updated->type  == mql_result_string), NULL);
+
+    rs[0] = (result_string_t *)inserted;
+    rs[1] = (result_string_t *)deleted;
+    rs[2] = (result_string_t *)updated;
+
+    cstr[EVENT] = "'changeset'";
+    cstr[TABLE] = table;
+
+    for (i = 0;  i < FLDS;  i++)
+        len[i] = strlen(cstr[i]);
+
+    for (linlen = (FLDS-1) * 2 + 1,  i = 0;   i < FLDS;   i++)
+        linlen += (cw[i] = len[i] > hlen[i] ?  len[i] : hlen[i]);
+
+    for (ssiz = 0, i = 0;  i < 3;  i++) {
+        if (rs[i])
+            ssiz += strlen(title[i]) + 3 + (slen[i] = strlen(rs[i]->string));
+    }
+
+    size = linlen * 3 + ssiz + 1;
+
+    if (!(rslt = calloc(1, sizeof(result_string_t) + size))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    p = rslt->string;
+
+    for (i = 0;  i < FLDS;  i++)
+        p += sprintf(p, "%-*s%s", cw[i],  hstr[i], i == FLDS-1 ? "\n" : "  ");
+
+    memset(p, '-', linlen-1);
+    p[linlen-1] = '\n';
+    p += linlen;
+
+    for (i = 0;  i < FLDS;  i++)
+        p += sprintf(p, "%-*s%s", cw[i], cstr[i], i == FLDS-1 ? "\n" : "  ");
+
+    for (i = 0;  i < 3;  i++) {
+        if (rs[i]) {
+            p += sprintf(p, "\n%s:\n", title[i]);
+            memcpy(p, rs[i]->string, slen[i]);
+            p += slen[i];
+        }
+    }
+
+    rslt->type = mql_result_string;
+    rslt->length = p - rslt->string;
+
+    return (mql_result_t *)rslt;
+
+#undef FLDS
+#undef TABLE
+#undef EVENT
+}
+
 mql_result_t *mql_result_string_create_transaction_change(mqi_event_type_t evt)
 {
     static const char *hstr  = " event";
@@ -1444,6 +1965,7 @@ double mql_result_list_get_floating(mql_result_t *r, int idx)
 void mql_result_free(mql_result_t *r)
 {
     result_event_colchg_t *colchg = (result_event_colchg_t *)r;
+    result_event_chgset_t *chgset = (result_event_chgset_t *)r;
     mql_result_t          *select;
 
     if (r) {
@@ -1454,6 +1976,11 @@ void mql_result_free(mql_result_t *r)
                 if (select && select->type == mql_result_rows)
                     mql_result_free(colchg->select);
             }
+            else if (chgset->event == mqi_changeset) {
+                mql_result_free(chgset->inserted);
+                mql_result_free(chgset->deleted);
+                mql_result_free(chgset->updated);
+            }
         }
 
         free(r);
@@ -1471,6 +1998,31 @@ static void *get_column_address(result_rows_t *rslt, int cx, int rx)
     return rslt->data + (rslt->rowsize * rx + rslt->cols[cx].offset);
 }
 
+static size_t packed_column_offset(const packed_rows_t *pr, int cx)
+{
+    const uint8_t *p = (const uint8_t *)pr;
+    uint32_t       offs;
+
+    p += PACKED_ALIGN(sizeof(*pr) + le16toh(pr->ncol), 4);
+    memcpy(&offs, p + sizeof(offs) * cx, sizeof(offs));
+
+    return le32toh(offs);
+}
+
+static const void *packed_cell(const void *blob, int cx, int rx, int *typep)
+{
+    const packed_rows_t *pr = (const packed_rows_t *)blob;
+    size_t               width;
+
+    MDB_CHECKARG(pr && cx >= 0 && cx < le16toh(pr->ncol) &&
+                 rx >= 0 && rx < (int)le32toh(pr->nrow), NULL);
+
+    *typep = pr->types[cx];
+    width  = (*typep == mqi_floating) ? sizeof(double) : sizeof(uint32_t);
+
+    return (const uint8_t *)blob + packed_column_offset(pr, cx) + width * rx;
+}
+
 /*
  * Local Variables:
  * c-basic-offset: 4
@@ -31,7 +31,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
-#include <alloca.h>
 #include <errno.h>
 
 #include <murphy-db/assert.h>
@@ -102,6 +101,7 @@ typedef struct {
     mqi_data_type_t     *coltypes;
     int                 *colsizes;
     mqi_cond_entry_t    *cond;
+    int                  limit;
     int                  nbind;
     value_t              values[0];
 } select_statement_t;
@@ -378,7 +378,8 @@ mql_statement_t *mql_make_select_statement(mqi_handle_t       table,
                                            char             **colnames,
                                            mqi_data_type_t   *coltypes,
                                            int               *colsizes,
-                                           mqi_column_desc_t *columns)
+                                           mqi_column_desc_t *columns,
+                                           int                limit)
 {
     select_statement_t *sel;
     value_t *bindv;
@@ -436,6 +437,7 @@ mql_statement_t *mql_make_select_statement(mqi_handle_t       table,
     sel->coltypes = (mqi_data_type_t *)(sel->colnames + ncolumn);
     sel->colsizes = (int *)(sel->coltypes + ncolumn);
     sel->cond     = (mqi_cond_entry_t *)(sel->colsizes + ncolumn);
+    sel->limit    = limit;
     sel->nbind    = nbind;
 
     strpool = (char *)(sel->cond + ncond);
@@ -565,6 +567,21 @@ void mql_statement_free(mql_statement_t *s)
 }
 
 
+mqi_handle_t mql_statement_get_table(mql_statement_t *s)
+{
+    MDB_CHECKARG(s, MQI_HANDLE_INVALID);
+
+    switch (s->type) {
+    case mql_statement_describe: return ((describe_statement_t *)s)->table;
+    case mql_statement_insert:   return ((insert_statement_t *)s)->table;
+    case mql_statement_update:   return ((update_statement_t *)s)->table;
+    case mql_statement_delete:   return ((delete_statement_t *)s)->table;
+    case mql_statement_select:   return ((select_statement_t *)s)->table;
+    default:                     return MQI_HANDLE_INVALID;
+    }
+}
+
+
 static void count_column_values(mqi_column_desc_t *cds,
                                 mqi_data_type_t   *coltypes,
                                 void              *data,
@@ -914,46 +931,37 @@ static mql_result_t *exec_delete(delete_statement_t *d)
 static mql_result_t *exec_select(mql_result_type_t type, select_statement_t *s)
 {
     mql_result_t *rslt;
-    int           maxrow;
-    int           nrow;
-    void         *rows;
+    mql_result_t *rows;
+    mqi_cursor_t *cursor;
+    int           rowsize;
 
-    if ((maxrow = mqi_get_table_size(s->table)) < 0)
-        rslt = mql_result_error_create(ENOENT, "can't access table");
-    else {
-        if (!maxrow) {
-            rows = alloca(s->rowsize);
-            nrow = 0;
-        }
-        else {
-            rows = alloca(maxrow * s->rowsize);
-            nrow = mqi_select(s->table, s->cond, s->columns,
-                              rows, s->rowsize, maxrow);
-        }
+    if (type != mql_result_rows && type != mql_result_string) {
+        return mql_result_error_create(EINVAL, "select failed: invalid"
+                                       " result type %d", type);
+    }
 
-       if (nrow < 0) {
-           rslt = mql_result_error_create(errno, "select error: %s",
-                                          strerror(errno));
-        }
-        else {
-            switch (type) {
-            case mql_result_rows:
-                rslt = mql_result_rows_create(s->ncolumn, s->columns,
+    if (!(cursor = mqi_select_open(s->table, s->cond, s->columns)))
+        return mql_result_error_create(errno, "can't access table");
+
+    rows = mql_result_rows_create_from_cursor(s->ncolumn, s->columns,
                                               s->coltypes, s->colsizes,
-                                              nrow, s->rowsize, rows);
-                break;
-            case mql_result_string:
-                rslt = mql_result_string_create_row_list(
-                                         s->ncolumn, s->colnames, s->columns,
-                                         s->coltypes, s->colsizes,
-                                         nrow, s->rowsize, rows);
-                break;
-            default:
-                rslt = mql_result_error_create(EINVAL, "select failed: invalid"
-                                               " result type %d", type);
-                break;
-            }
-        }
+                                              s->rowsize, cursor, s->limit);
+    mqi_select_close(cursor);
+
+    if (!rows)
+        return mql_result_error_create(errno, "select error: %s",
+                                       strerror(errno));
+
+    if (type == mql_result_rows)
+        rslt = rows;
+    else {
+        rslt = mql_result_string_create_row_list(
+                                 s->ncolumn, s->colnames, s->columns,
+                                 s->coltypes, s->colsizes,
+                                 mql_result_rows_get_row_count(rows),
+                                 s->rowsize,
+                                 mql_result_rows_get_data(rows, &rowsize));
+        mql_result_free(rows);
     }
 
     return rslt;
@@ -56,6 +56,7 @@ typedef struct trigger_s             transact_trigger_t;
 typedef struct trigger_s             table_trigger_t;
 typedef struct row_trigger_s         row_trigger_t;
 typedef struct column_trigger_s      column_trigger_t;
+typedef struct changeset_trigger_s   changeset_trigger_t;
 
 
 struct mql_callback_s {
@@ -74,6 +75,7 @@ enum trigger_type_e {
     trigger_table,
     trigger_row,
     trigger_column,
+    trigger_changeset,
 
     trigger_last
 };
@@ -122,6 +124,14 @@ struct column_trigger_s {
     uint8_t      data[0];
 };
 
+struct changeset_trigger_s {
+    TRIGGER_COMMON;
+    mqi_handle_t table;
+    mqi_bitfld_t colmask;
+    select_t     select;
+    uint8_t      data[0];
+};
+
 
 static mdb_hash_t *callbacks;
 static mdb_hash_t *triggers;
@@ -131,6 +141,7 @@ static mql_callback_t *ref_callback(mql_callback_t *);
 
 static void column_event_callback(mqi_event_t *, void *);
 static void row_event_callback(mqi_event_t *, void *);
+static void changeset_event_callback(mqi_event_t *, void *);
 static void table_event_callback(mqi_event_t *, void *);
 static void transaction_event_callback(mqi_event_t *, void *);
 
@@ -389,6 +400,99 @@ int mql_create_row_trigger(char              *name,
 }
 
 
+int mql_create_changeset_trigger(char               *name,
+                                 mqi_handle_t        table,
+                                 const mqi_bitfld_t *colmask,
+                                 mql_callback_t     *callback,
+                                 int                 nselcol,
+                                 char              **selcolnams,
+                                 mqi_column_desc_t  *selcoldscs,
+                                 mqi_data_type_t    *selcoltypes,
+                                 int                *selcolsizes,
+                                 int                 rowsize)
+{
+    changeset_trigger_t *tr;
+    size_t nlens[MQI_COLUMN_MAX];
+    size_t asiz;
+    size_t nsiz;
+    size_t dsiz;
+    size_t tsiz;
+    size_t ssiz;
+    size_t size;
+    uint8_t *data;
+    int sts;
+    int i;
+
+    MDB_CHECKARG(name && table != MQI_HANDLE_INVALID && callback &&
+                 nselcol > 0 && nselcol < MQI_COLUMN_MAX &&
+                 selcoldscs && selcolsizes && rowsize > 0, -1);
+
+    if (!triggers) {
+        triggers = MDB_HASH_TABLE_CREATE(string, MQL_TRIGGER_HASH_CHAINS);
+        MDB_PREREQUISITE(triggers, -1);
+    }
+
+    nsiz = asiz = sizeof(char *) * nselcol;
+
+    for (i = 0;  i < nselcol;  i++)
+        nsiz += (nlens[i] = strlen(selcolnams[i]) + 1);
+
+    dsiz = sizeof(mqi_column_desc_t) * (nselcol + 1);
+    tsiz = sizeof(mqi_data_type_t) * nselcol;
+    ssiz = sizeof(int) * nselcol;
+    size = sizeof(changeset_trigger_t) + nsiz + dsiz + tsiz + ssiz;
+
+    if (!(tr = calloc(1, size))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    tr->name     = strdup(name);
+    tr->type     = trigger_changeset;
+    tr->callback = ref_callback(callback);
+
+    tr->table = table;
+
+    if (colmask)
+        tr->colmask = *colmask;
+
+    data = tr->data;
+
+    tr->select.column.ncol  = nselcol;
+    tr->select.column.names = (char **)data;
+    tr->select.column.descs = (mqi_column_desc_t *)(data += asiz);
+    tr->select.column.types = (mqi_data_type_t *)(data += dsiz);
+    tr->select.column.sizes = (int *)(data += tsiz);
+
+    tr->select.strpool.addr = (char *)(data += ssiz);
+    tr->select.strpool.size = nsiz - asiz;
+
+    tr->select.rowsize = rowsize;
+
+    memcpy(tr->select.column.descs, selcoldscs , dsiz);
+    memcpy(tr->select.column.types, selcoltypes, tsiz);
+    memcpy(tr->select.column.sizes, selcolsizes, ssiz);
+
+    for (i = 0;   i < nselcol;   i++) {
+        tr->select.column.names[i] = (char *)data;
+        memcpy(data, selcolnams[i], nlens[i]);
+        data += nlens[i];
+    }
+
+    if (!tr->name || mdb_hash_add(triggers, 0,tr->name, tr) < 0) {
+        unref_callback(tr->callback);
+        free(tr->name);
+        free(tr);
+        return -1;
+    }
+
+    sts = mqi_create_changeset_trigger(table, &tr->colmask,
+                                       changeset_event_callback, tr,
+                                       tr->select.column.descs);
+    return sts;
+}
+
+
 int mql_create_table_trigger(char *name, mql_callback_t *callback)
 {
     table_trigger_t *tr;
@@ -623,6 +727,122 @@ static void row_event_callback(mqi_event_t *evt, void *user_data)
 
 
 
+static void changeset_event_callback(mqi_event_t *evt, void *user_data)
+{
+    static mqi_event_type_t kinds[3] = {
+        mqi_row_inserted, mqi_row_deleted, mqi_column_changed
+    };
+
+    mqi_changeset_event_t *se;
+    changeset_trigger_t   *tr;
+    mql_callback_t        *cb;
+    select_t              *s;
+    mqi_change_t          *c;
+    mql_result_t          *rsel[3];
+    mql_result_t          *rslt;
+    uint8_t               *rows;
+    uint8_t               *dst;
+    void                  *image;
+    int                    nrow;
+    int                    k, i;
+
+    if (!evt || !user_data)
+        return;
+
+    se = &evt->changeset;
+    tr = (changeset_trigger_t *)user_data;
+    cb = tr->callback;
+    s  = &tr->select;
+
+    if (se->event  != mqi_changeset     ||
+        tr->type   != trigger_changeset ||
+        (cb->rtype != mql_result_event && cb->rtype != mql_result_string))
+    {
+        return;
+    }
+
+    if (!(rows = malloc(s->rowsize * (se->nchange ? se->nchange : 1))))
+        return;
+
+    /*
+     * split the change set to the inserted, deleted and updated rows
+     * keeping their order; updates are reported with their new image
+     */
+    for (k = 0;  k < 3;  k++) {
+        rsel[k] = NULL;
+
+        for (i = nrow = 0, dst = rows;   i < se->nchange;   i++) {
+            c = se->changes + i;
+
+            if (c->event != kinds[k])
+                continue;
+
+            if (!(image = (kinds[k] == mqi_row_deleted) ? c->old : c->new_))
+                continue;
+
+            memcpy(dst, image, s->rowsize);
+            dst += s->rowsize;
+            nrow++;
+        }
+
+        if (!nrow)
+            continue;
+
+        if (cb->rtype == mql_result_event) {
+            rsel[k] = mql_result_rows_create(s->column.ncol,
+                                             s->column.descs,
+                                             s->column.types,
+                                             s->column.sizes,
+                                             nrow,
+                                             s->rowsize,
+                                             rows);
+        }
+        else {
+            rsel[k] = mql_result_string_create_row_list(s->column.ncol,
+                                                        s->column.names,
+                                                        s->column.descs,
+                                                        s->column.types,
+                                                        s->column.sizes,
+                                                        nrow,
+                                                        s->rowsize,
+                                                        rows);
+        }
+
+        if (!mql_result_is_success(rsel[k])) {
+            free(rsel[k]);
+            rsel[k] = NULL;
+        }
+    }
+
+    free(rows);
+
+    if (cb->rtype == mql_result_event) {
+        rslt = mql_result_event_changeset_create(se->table.handle,
+                                                 rsel[0], rsel[1], rsel[2]);
+        if (!rslt) {
+            for (k = 0;  k < 3;  k++)
+                free(rsel[k]);
+        }
+        else {
+            cb->function(rslt, cb->user_data);
+            mql_result_free(rslt);
+        }
+    }
+    else {
+        rslt = mql_result_string_create_changeset(se->table.name,
+                                                  rsel[0], rsel[1], rsel[2]);
+        if (rslt) {
+            cb->function(rslt, cb->user_data);
+            free(rslt);
+        }
+
+        for (k = 0;  k < 3;  k++)
+            free(rsel[k]);
+    }
+}
+
+
+
 static void table_event_callback(mqi_event_t *evt, void *user_data)
 {
     mqi_table_event_t *te;
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Compare the interpreted and the compiled evaluation of conditions.
+ *
+ * Usage: bench-mdb-cond [number of rows [number of rounds]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <murphy-db/mqi.h>
+#include <murphy-db/mdb.h>
+
+#include "mdb/column.h"
+#include "mdb/index.h"
+#include "mdb/table.h"
+#include "mdb/cond.h"
+
+#define DEFAULT_ROWS     10000
+#define DEFAULT_ROUNDS   100
+
+typedef struct {
+    const char *sex;
+    const char *name;
+    uint32_t    id;
+    int32_t     score;
+} record_t;
+
+MQI_COLUMN_DEFINITION_LIST(coldefs,
+    MQI_COLUMN_DEFINITION( "sex"  , MQI_VARCHAR(8)  ),
+    MQI_COLUMN_DEFINITION( "name" , MQI_VARCHAR(16) ),
+    MQI_COLUMN_DEFINITION( "id"   , MQI_UNSIGNED    ),
+    MQI_COLUMN_DEFINITION( "score", MQI_INTEGER     )
+);
+
+MQI_COLUMN_SELECTION_LIST(insert_columns,
+    MQI_COLUMN_SELECTOR( 0, record_t, sex   ),
+    MQI_COLUMN_SELECTOR( 1, record_t, name  ),
+    MQI_COLUMN_SELECTOR( 2, record_t, id    ),
+    MQI_COLUMN_SELECTOR( 3, record_t, score )
+);
+
+static const char *female = "female";
+static uint32_t    low    = 100;
+static uint32_t    high   = 5000;
+static int32_t     limit  = 0;
+static int32_t     floor_ = -50;
+static uint32_t    id1    = 17;
+static uint32_t    id2    = 4242;
+
+MQI_WHERE_CLAUSE(where,
+    MQI_EQUAL( MQI_COLUMN(0), MQI_STRING_VAR(female) ) MQI_AND
+    MQI_OPERATOR(begin),
+        MQI_LESS( MQI_COLUMN(2), MQI_UNSIGNED_VAR(low) ) MQI_OR
+        MQI_GREATER( MQI_COLUMN(2), MQI_UNSIGNED_VAR(high) )
+    MQI_OPERATOR(end),
+    MQI_AND
+    MQI_GREATER_OR_EQUAL( MQI_COLUMN(3), MQI_INTEGER_VAR(limit) )
+);
+
+/* a condition the block scanner checks entirely by itself */
+MQI_WHERE_CLAUSE(scan_where,
+    MQI_GREATER( MQI_COLUMN(3), MQI_INTEGER_VAR(floor_) ) MQI_AND
+    MQI_LESS_OR_EQUAL( MQI_COLUMN(3), MQI_INTEGER_VAR(limit) ) MQI_AND
+    MQI_OPERATOR(begin),
+        MQI_EQUAL( MQI_COLUMN(2), MQI_UNSIGNED_VAR(id1) ) MQI_OR
+        MQI_EQUAL( MQI_COLUMN(2), MQI_UNSIGNED_VAR(high) ) MQI_OR
+        MQI_EQUAL( MQI_COLUMN(2), MQI_UNSIGNED_VAR(id2) ) MQI_OR
+        MQI_EQUAL( MQI_COLUMN(2), MQI_UNSIGNED_VAR(low) )
+    MQI_OPERATOR(end),
+);
+
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static mdb_table_t *create_table(int nrow)
+{
+    mdb_table_t *tbl;
+    record_t     rec, *recs[2] = { &rec, NULL };
+    char         name[16];
+    int          i;
+
+    if (!(tbl = mdb_table_create("bench", NULL, coldefs)))
+        return NULL;
+
+    for (i = 0;  i < nrow;  i++) {
+        snprintf(name, sizeof(name), "name-%d", i);
+
+        rec.sex   = (i & 1) ? "male" : "female";
+        rec.name  = name;
+        rec.id    = (uint32_t)rand() % 10000;
+        rec.score = rand() % 200 - 100;
+
+        if (mdb_table_insert(tbl, 0, insert_columns, (void **)recs) < 0)
+            return NULL;
+    }
+
+    return tbl;
+}
+
+static int bench(const char *name, mdb_table_t *tbl, mqi_cond_entry_t *where,
+                 int nrow, int nround)
+{
+    mdb_row_t        *row, *n;
+    mdb_row_t        *rows[MDB_COND_BLOCK];
+    uint8_t           sel[MDB_COND_BLOCK];
+    mqi_cond_entry_t *ce;
+    mdb_cond_prog_t   prog;
+    int               i, nblk, ninterp, ncompiled, nscanned;
+    double            t0, t1, t2, t3;
+
+    ninterp = ncompiled = nscanned = 0;
+
+    t0 = now();
+
+    for (i = 0;  i < nround;  i++) {
+        MDB_DLIST_FOR_EACH_SAFE(mdb_row_t, link, row,n, &tbl->rows) {
+            ce = where;
+            ninterp += mdb_cond_evaluate(tbl, &ce, row->data) > 0;
+        }
+    }
+
+    t1 = now();
+
+    for (i = 0;  i < nround;  i++) {
+        mdb_cond_compile(tbl, where, &prog);
+
+        MDB_DLIST_FOR_EACH_SAFE(mdb_row_t, link, row,n, &tbl->rows) {
+            ncompiled += mdb_cond_execute(&prog, row->data) > 0;
+        }
+    }
+
+    t2 = now();
+
+    for (i = 0;  i < nround;  i++) {
+        mdb_cond_compile(tbl, where, &prog);
+        nblk = 0;
+
+        MDB_DLIST_FOR_EACH_SAFE(mdb_row_t, link, row,n, &tbl->rows) {
+            rows[nblk++] = row;
+
+            if (nblk == MDB_COND_BLOCK) {
+                nscanned += mdb_cond_scan(&prog, rows, nblk, sel);
+                nblk = 0;
+            }
+        }
+
+        if (nblk > 0)
+            nscanned += mdb_cond_scan(&prog, rows, nblk, sel);
+    }
+
+    t3 = now();
+
+    printf("%s: %d rows, %d rounds, %d matches/round, %d scan terms%s\n",
+           name, nrow, nround, ninterp / nround, prog.nterm,
+           prog.exact ? " (exact)" : "");
+    printf("interpreted: %8.2f ns/row\n", (t1 - t0) * 1e9 / nrow / nround);
+    printf("compiled:    %8.2f ns/row\n", (t2 - t1) * 1e9 / nrow / nround);
+    printf("scanned:     %8.2f ns/row\n", (t3 - t2) * 1e9 / nrow / nround);
+
+    if (ninterp != ncompiled || ninterp != nscanned) {
+        printf("mismatch: %d vs. %d vs. %d matches\n", ninterp, ncompiled,
+               nscanned);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    mdb_table_t *tbl;
+    int          nrow, nround, status;
+
+    nrow   = argc > 1 ? atoi(argv[1]) : DEFAULT_ROWS;
+    nround = argc > 2 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+
+    if (nrow <= 0 || nround <= 0) {
+        fprintf(stderr, "usage: %s [rows [rounds]]\n", argv[0]);
+        return 1;
+    }
+
+    srand(1);
+
+    if (!(tbl = create_table(nrow))) {
+        fprintf(stderr, "failed to create table: %s\n", strerror(errno));
+        return 1;
+    }
+
+    status = 0;
+
+    if (bench("mixed", tbl, where, nrow, nround) < 0)
+        status = 1;
+
+    if (bench("numeric", tbl, scan_where, nrow, nround) < 0)
+        status = 1;
+
+    mdb_table_drop(tbl);
+
+    return status;
+}
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
@@ -0,0 +1,604 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measure the throughput and latency of the basic database operations
+ * through the public MQI and MQL interfaces over a range of table sizes.
+ *
+ * Usage: bench-mdb [-s sizes] [-l lookups] [-k keyed ops] [-r rounds]
+ *                  [-f text|csv|json]
+ *
+ * Every measurement is printed as one record with the name of the test,
+ * the table size, the number of operations, the elapsed time and the time
+ * per operation, which makes it easy to diff runs or to feed them to a
+ * regression checker (-f csv or -f json for one JSON object per line).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <murphy-db/mqi.h>
+#include <murphy-db/mql.h>
+
+#define DEFAULT_SIZES    "10,100,1000,10000,100000,1000000"
+#define DEFAULT_LOOKUPS  100000
+#define DEFAULT_KEYED    1000
+#define DEFAULT_ROUNDS   10
+#define MAX_SIZES        16
+#define SCAN_CHUNK       256
+
+typedef enum {
+    FORMAT_TEXT = 0,
+    FORMAT_CSV,
+    FORMAT_JSON,
+} format_t;
+
+typedef struct {
+    uint32_t    id;
+    int32_t     value;
+    const char *name;
+} record_t;
+
+MQI_COLUMN_DEFINITION_LIST(coldefs,
+    MQI_COLUMN_DEFINITION( "id"   , MQI_UNSIGNED    ),
+    MQI_COLUMN_DEFINITION( "value", MQI_INTEGER     ),
+    MQI_COLUMN_DEFINITION( "name" , MQI_VARCHAR(16) )
+);
+
+MQI_INDEX_DEFINITION(indexdef,
+    MQI_INDEX_COLUMN( "id" )
+);
+
+MQI_COLUMN_SELECTION_LIST(all_columns,
+    MQI_COLUMN_SELECTOR( 0, record_t, id    ),
+    MQI_COLUMN_SELECTOR( 1, record_t, value ),
+    MQI_COLUMN_SELECTOR( 2, record_t, name  )
+);
+
+MQI_COLUMN_SELECTION_LIST(value_column,
+    MQI_COLUMN_SELECTOR( 1, record_t, value )
+);
+
+static uint32_t key;
+static int32_t  threshold;
+
+MQI_WHERE_CLAUSE(by_key,
+    MQI_EQUAL( MQI_COLUMN(0), MQI_UNSIGNED_VAR(key) )
+);
+
+MQI_WHERE_CLAUSE(by_value,
+    MQI_LESS( MQI_COLUMN(1), MQI_INTEGER_VAR(threshold) )
+);
+
+MQI_INDEX_VALUE(index_key,
+    MQI_UNSIGNED_VAL(key)
+);
+
+static format_t format;
+static int      ntrigger_fired;
+
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+
+static void report(const char *test, int nrow, long nop, double t)
+{
+    double ns = nop > 0 ? t * 1e9 / nop : 0.0;
+
+    switch (format) {
+    case FORMAT_CSV:
+        printf("%s,%d,%ld,%.6f,%.2f\n", test, nrow, nop, t, ns);
+        break;
+    case FORMAT_JSON:
+        printf("{\"test\":\"%s\",\"rows\":%d,\"ops\":%ld,\"seconds\":%.6f,"
+               "\"ns_per_op\":%.2f}\n", test, nrow, nop, t, ns);
+        break;
+    default:
+        printf("%-24s %8d rows %9ld ops %10.6f s %12.2f ns/op\n",
+               test, nrow, nop, t, ns);
+        break;
+    }
+
+    fflush(stdout);
+}
+
+
+static uint32_t random_key(int nrow)
+{
+    return (uint32_t)(rand() % nrow);
+}
+
+
+static mqi_handle_t bench_insert(int nrow)
+{
+    mqi_handle_t  tbl;
+    record_t      rec, *recs[2] = { &rec, NULL };
+    char          name[16];
+    double        t0;
+    int           i;
+
+    if ((tbl = MQI_CREATE_TABLE("bench", MQI_TEMPORARY,
+                                coldefs, indexdef)) == MQI_HANDLE_INVALID)
+        return MQI_HANDLE_INVALID;
+
+    t0 = now();
+
+    for (i = 0;  i < nrow;  i++) {
+        snprintf(name, sizeof(name), "name-%d", i);
+
+        rec.id    = i;
+        rec.value = rand() % 1000;
+        rec.name  = name;
+
+        if (MQI_INSERT_INTO(tbl, all_columns, recs) < 0) {
+            mqi_drop_table(tbl);
+            return MQI_HANDLE_INVALID;
+        }
+    }
+
+    report("insert", nrow, nrow, now() - t0);
+
+    return tbl;
+}
+
+
+static int bench_lookup(mqi_handle_t tbl, int nrow, int nlookup)
+{
+    record_t rec;
+    double   t0;
+    int      i, n;
+
+    t0 = now();
+
+    for (i = n = 0;  i < nlookup;  i++) {
+        key = random_key(nrow);
+        n  += MQI_SELECT_BY_INDEX(all_columns, tbl, index_key, &rec);
+    }
+
+    report("select-by-index", nrow, nlookup, now() - t0);
+
+    return n == nlookup ? 0 : -1;
+}
+
+
+static int bench_select(mqi_handle_t tbl, int nrow, int nkeyed, int nround)
+{
+    record_t      recs[SCAN_CHUNK];
+    mqi_cursor_t *c;
+    double        t0;
+    long          nsel;
+    int           i, n;
+
+    t0   = now();
+    nsel = 0;
+
+    for (i = 0;  i < nround;  i++) {
+        if (!(c = mqi_select_open(tbl, NULL, all_columns)))
+            return -1;
+
+        while ((n = MQI_SELECT_NEXT(c, recs)) > 0)
+            nsel += n;
+
+        mqi_select_close(c);
+    }
+
+    report("select-scan", nrow, nsel, now() - t0);
+
+    t0        = now();
+    threshold = 10;
+
+    for (i = 0;  i < nround;  i++) {
+        if (!(c = mqi_select_open(tbl, by_value, all_columns)))
+            return -1;
+
+        while (MQI_SELECT_NEXT(c, recs) > 0)
+            ;
+
+        mqi_select_close(c);
+    }
+
+    report("select-where-scan", nrow, (long)nround * nrow, now() - t0);
+
+    t0 = now();
+
+    for (i = 0;  i < nkeyed;  i++) {
+        key = random_key(nrow);
+
+        if (MQI_SELECT(all_columns, tbl, by_key, recs) != 1)
+            return -1;
+    }
+
+    report("select-where-key", nrow, nkeyed, now() - t0);
+
+    return 0;
+}
+
+
+static int bench_mql(int nrow, int nkeyed)
+{
+    static const char *select = "SELECT id, value FROM bench WHERE id = 1";
+    mql_statement_t *s;
+    mql_result_t    *r;
+    double           t0;
+    int              i;
+
+    t0 = now();
+
+    for (i = 0;  i < nkeyed;  i++) {
+        if (!(s = mql_precompile(select)))
+            return -1;
+        mql_statement_free(s);
+    }
+
+    report("mql-precompile", nrow, nkeyed, now() - t0);
+
+    if (!(s = mql_precompile(select)))
+        return -1;
+
+    t0 = now();
+
+    for (i = 0;  i < nkeyed;  i++) {
+        r = mql_exec_statement(mql_result_rows, s);
+
+        if (!mql_result_is_success(r)) {
+            mql_result_free(r);
+            mql_statement_free(s);
+            return -1;
+        }
+
+        mql_result_free(r);
+    }
+
+    report("mql-exec-precompiled", nrow, nkeyed, now() - t0);
+
+    mql_statement_free(s);
+
+    t0 = now();
+
+    for (i = 0;  i < nkeyed;  i++) {
+        r = mql_exec_string(mql_result_rows, select);
+
+        if (!mql_result_is_success(r)) {
+            mql_result_free(r);
+            return -1;
+        }
+
+        mql_result_free(r);
+    }
+
+    report("mql-exec-string", nrow, nkeyed, now() - t0);
+
+    return 0;
+}
+
+
+static void trigger_cb(mqi_event_t *evt, void *user_data)
+{
+    (void)evt;
+    (void)user_data;
+
+    ntrigger_fired++;
+}
+
+
+static int bench_commit(mqi_handle_t tbl, int nrow, int nround)
+{
+    static int ntriggers[] = { 0, 1, 4, 16 };
+    record_t     rec;
+    mqi_handle_t tx;
+    char         test[64];
+    double       t0, t;
+    int          i, j, k, ntrig, nchange;
+
+    nchange = nrow < 100 ? nrow : 100;
+
+    for (i = ntrig = 0;  i < (int)MQI_DIMENSION(ntriggers);  i++) {
+        for (;  ntrig < ntriggers[i];  ntrig++) {
+            if (mqi_create_column_trigger(tbl, 1, trigger_cb,
+                                          (void *)(ptrdiff_t)(ntrig + 1),
+                                          all_columns) < 0)
+                return -1;
+        }
+
+        t = 0.0;
+        ntrigger_fired = 0;
+
+        for (j = 0;  j < nround;  j++) {
+            if ((tx = MQI_BEGIN) == MQI_HANDLE_INVALID)
+                return -1;
+
+            for (k = 0;  k < nchange;  k++) {
+                key       = random_key(nrow);
+                rec.value = j;
+
+                if (MQI_UPDATE(tbl, value_column, &rec, by_key) < 0)
+                    return -1;
+            }
+
+            t0 = now();
+
+            if (MQI_COMMIT(tx) < 0)
+                return -1;
+
+            t += now() - t0;
+        }
+
+        if (ntrig > 0 && !ntrigger_fired) {
+            errno = ENOENT;
+            return -1;
+        }
+
+        snprintf(test, sizeof(test), "commit-%d-triggers", ntrig);
+        report(test, nrow, nround, t);
+    }
+
+    for (i = 1;  i <= ntrig;  i++)
+        mqi_drop_column_trigger(tbl, 1, trigger_cb, (void *)(ptrdiff_t)i);
+
+    return 0;
+}
+
+
+static int bench_update(mqi_handle_t tbl, int nrow, int nkeyed)
+{
+    record_t rec;
+    double   t0;
+    int      i;
+
+    t0 = now();
+
+    for (i = 0;  i < nkeyed;  i++) {
+        key       = random_key(nrow);
+        rec.value = i;
+
+        if (MQI_UPDATE(tbl, value_column, &rec, by_key) < 0)
+            return -1;
+    }
+
+    report("update-where-key", nrow, nkeyed, now() - t0);
+
+    rec.value = -1;
+    t0        = now();
+
+    if (MQI_UPDATE(tbl, value_column, &rec, NULL) < 0)
+        return -1;
+
+    report("update-all", nrow, nrow, now() - t0);
+
+    return 0;
+}
+
+
+static int bench_delete(mqi_handle_t tbl, int nrow, int nkeyed)
+{
+    double t0;
+    int    i, n;
+
+    t0 = now();
+
+    for (i = n = 0;  i < nkeyed && i < nrow;  i++) {
+        key = (uint32_t)i;
+
+        if (MQI_DELETE(tbl, by_key) < 0)
+            return -1;
+
+        n++;
+    }
+
+    report("delete-where-key", nrow, n, now() - t0);
+
+    t0 = now();
+
+    if ((n = MQI_DELETE(tbl, NULL)) < 0)
+        return -1;
+
+    report("delete-all", nrow, n, now() - t0);
+
+    return 0;
+}
+
+
+static int run(int nrow, int nlookup, int nkeyed, int nround)
+{
+    mqi_handle_t tbl;
+    const char  *failed;
+
+    if ((tbl = bench_insert(nrow)) == MQI_HANDLE_INVALID) {
+        failed = "insert";
+        goto fail;
+    }
+
+    if (bench_lookup(tbl, nrow, nlookup) < 0) {
+        failed = "select-by-index";
+        goto fail;
+    }
+
+    if (bench_select(tbl, nrow, nkeyed, nround) < 0) {
+        failed = "select";
+        goto fail;
+    }
+
+    if (bench_mql(nrow, nkeyed) < 0) {
+        failed = "mql";
+        goto fail;
+    }
+
+    if (bench_commit(tbl, nrow, nround) < 0) {
+        failed = "commit";
+        goto fail;
+    }
+
+    if (bench_update(tbl, nrow, nkeyed) < 0) {
+        failed = "update";
+        goto fail;
+    }
+
+    if (bench_delete(tbl, nrow, nkeyed) < 0) {
+        failed = "delete";
+        goto fail;
+    }
+
+    mqi_drop_table(tbl);
+
+    return 0;
+
+ fail:
+    fprintf(stderr, "%s benchmark failed with %d rows: %s\n", failed, nrow,
+            strerror(errno));
+
+    if (tbl != MQI_HANDLE_INVALID)
+        mqi_drop_table(tbl);
+
+    return -1;
+}
+
+
+static int parse_sizes(char *str, int *sizes, int max)
+{
+    char *p, *e;
+    int   n;
+
+    for (p = str, n = 0;  *p && n < max;  p = e) {
+        sizes[n] = (int)strtol(p, &e, 10);
+
+        if (e == p || sizes[n] <= 0 || (*e && *e != ','))
+            return -1;
+
+        n++;
+
+        if (*e)
+            e++;
+    }
+
+    return *p ? -1 : n;
+}
+
+
+static void usage(const char *argv0, int exit_code)
+{
+    fprintf(stderr, "usage: %s [-s sizes] [-l lookups] [-k keyed-ops] "
+            "[-r rounds] [-f text|csv|json]\n"
+            "  -s  comma-separated table sizes (default %s)\n"
+            "  -l  number of index lookups per size (default %d)\n"
+            "  -k  number of keyed updates, deletes, selects and MQL "
+            "statements (default %d)\n"
+            "  -r  number of rounds for scans and commits (default %d)\n"
+            "  -f  output format (default text)\n",
+            argv0, DEFAULT_SIZES, DEFAULT_LOOKUPS, DEFAULT_KEYED,
+            DEFAULT_ROUNDS);
+
+    exit(exit_code);
+}
+
+
+int main(int argc, char **argv)
+{
+    char defsizes[] = DEFAULT_SIZES;
+    int  sizes[MAX_SIZES];
+    int  nsize, nlookup, nkeyed, nround, opt, i;
+
+    nsize   = parse_sizes(defsizes, sizes, MAX_SIZES);
+    nlookup = DEFAULT_LOOKUPS;
+    nkeyed  = DEFAULT_KEYED;
+    nround  = DEFAULT_ROUNDS;
+
+    while ((opt = getopt(argc, argv, "s:l:k:r:f:h")) != -1) {
+        switch (opt) {
+        case 's':
+            if ((nsize = parse_sizes(optarg, sizes, MAX_SIZES)) <= 0)
+                usage(argv[0], 1);
+            break;
+        case 'l':
+            if ((nlookup = atoi(optarg)) <= 0)
+                usage(argv[0], 1);
+            break;
+        case 'k':
+            if ((nkeyed = atoi(optarg)) <= 0)
+                usage(argv[0], 1);
+            break;
+        case 'r':
+            if ((nround = atoi(optarg)) <= 0)
+                usage(argv[0], 1);
+            break;
+        case 'f':
+            if (!strcmp(optarg, "text"))
+                format = FORMAT_TEXT;
+            else if (!strcmp(optarg, "csv"))
+                format = FORMAT_CSV;
+            else if (!strcmp(optarg, "json"))
+                format = FORMAT_JSON;
+            else
+                usage(argv[0], 1);
+            break;
+        case 'h':
+            usage(argv[0], 0);
+        default:
+            usage(argv[0], 1);
+        }
+    }
+
+    if (mqi_open() < 0) {
+        fprintf(stderr, "failed to open database: %s\n", strerror(errno));
+        return 1;
+    }
+
+    if (format == FORMAT_CSV)
+        printf("test,rows,ops,seconds,ns_per_op\n");
+
+    srand(1);
+
+    for (i = 0;  i < nsize;  i++)
+        if (run(sizes[i], nlookup, nkeyed, nround) < 0)
+            return 1;
+
+    mqi_close();
+
+    return 0;
+}
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
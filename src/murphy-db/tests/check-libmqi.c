@@ -32,6 +32,7 @@
 #include <string.h>
 #include <errno.h>
 #include <libgen.h>
+#include <unistd.h>
 
 #include <check.h>
 
@@ -81,6 +82,13 @@ typedef struct {
     const char    *first_name;
 } query_t;
 
+typedef struct {
+    uint32_t       id;
+    int32_t        s;
+    uint32_t       u;
+    const char    *parity;
+} scan_row_t;
+
 
 MQI_COLUMN_DEFINITION_LIST(persons_coldefs,
     MQI_COLUMN_DEFINITION( "sex"        , MQI_VARCHAR(6)  ),
@@ -109,6 +117,20 @@ MQI_COLUMN_SELECTION_LIST(persons_select_columns,
     MQI_COLUMN_SELECTOR( 2, query_t, first_name  )
 );
 
+MQI_COLUMN_DEFINITION_LIST(scan_coldefs,
+    MQI_COLUMN_DEFINITION( "id"    , MQI_UNSIGNED   ),
+    MQI_COLUMN_DEFINITION( "s"     , MQI_INTEGER    ),
+    MQI_COLUMN_DEFINITION( "u"     , MQI_UNSIGNED   ),
+    MQI_COLUMN_DEFINITION( "parity", MQI_VARCHAR(4) )
+);
+
+MQI_COLUMN_SELECTION_LIST(scan_columns,
+    MQI_COLUMN_SELECTOR( 0, scan_row_t, id     ),
+    MQI_COLUMN_SELECTOR( 1, scan_row_t, s      ),
+    MQI_COLUMN_SELECTOR( 2, scan_row_t, u      ),
+    MQI_COLUMN_SELECTOR( 3, scan_row_t, parity )
+);
+
 static record_t chuck = {"male"  , "Chuck", "Norris" , 1100, "cno@texas.us"  };
 static record_t gary  = {"male"  , "Gary", "Cooper"  ,  700, "gco@heaven.org"};
 static record_t elvis = {"male"  , "Elvis", "Presley",  600, "epr@heaven.org"};
@@ -131,6 +153,14 @@ static int          ntrigger;
 static trigger_t    triggers[256];
 static int          nseq = 32;
 static int          nnest = MQI_TXDEPTH_MAX - 1;
+static int          changeset_calls;
+static int          changeset_inserts;
+
+#define SCAN_NROW 150
+static scan_row_t   scan_rows[SCAN_NROW];
+static int32_t      scan_sv, scan_lo, scan_hi, scan_sin[3];
+static uint32_t     scan_uv, scan_ulo, scan_uin[3];
+static const char  *scan_odd = "odd";
 
 
 static Suite *libmqi_suite(void);
@@ -141,6 +171,26 @@ static void   transaction_event_cb(mqi_event_t *, void *);
 static void   table_event_cb(mqi_event_t *, void *);
 static void   row_event_cb(mqi_event_t *, void *);
 static void   column_event_cb(mqi_event_t *, void *);
+static void   changeset_event_cb(mqi_event_t *, void *);
+static void   check_scan(mqi_handle_t, mqi_cond_entry_t *,
+                         int (*)(scan_row_t *), int, const char *);
+static int    scan_s_less(scan_row_t *);
+static int    scan_s_leq(scan_row_t *);
+static int    scan_s_eq(scan_row_t *);
+static int    scan_s_geq(scan_row_t *);
+static int    scan_s_gt(scan_row_t *);
+static int    scan_u_less(scan_row_t *);
+static int    scan_u_leq(scan_row_t *);
+static int    scan_u_eq(scan_row_t *);
+static int    scan_u_geq(scan_row_t *);
+static int    scan_u_gt(scan_row_t *);
+static int    scan_swapped(scan_row_t *);
+static int    scan_s_between(scan_row_t *);
+static int    scan_u_in(scan_row_t *);
+static int    scan_s_in_and_range(scan_row_t *);
+static int    scan_mixed_varchar(scan_row_t *);
+static int    scan_mixed_or(scan_row_t *);
+static int    scan_mixed_not(scan_row_t *);
 
 
 int main(int argc, char **argv)
@@ -462,6 +512,146 @@ END_TEST
 
 
 
+START_TEST(indexed_select_from_persons)
+{
+    static uint32_t badid = 1;
+
+    MQI_WHERE_CLAUSE(where,
+        MQI_EQUAL( MQI_STRING_VAR(elvis.first_name), MQI_COLUMN(2) ) MQI_AND
+        MQI_EQUAL( MQI_COLUMN(3), MQI_UNSIGNED_VAR(elvis.id)       ) MQI_AND
+        MQI_EQUAL( MQI_COLUMN(1), MQI_STRING_VAR(elvis.family_name))
+    );
+
+    MQI_WHERE_CLAUSE(nomatch,
+        MQI_EQUAL( MQI_COLUMN(1), MQI_STRING_VAR(elvis.family_name) ) MQI_AND
+        MQI_EQUAL( MQI_COLUMN(2), MQI_STRING_VAR(elvis.first_name ) ) MQI_AND
+        MQI_EQUAL( MQI_COLUMN(3), MQI_UNSIGNED_VAR(badid)           )
+    );
+
+    query_t rows[32];
+    int n;
+
+    PREREQUISITE(replace_in_persons);
+
+    n = MQI_SELECT(persons_select_columns, persons, where, rows);
+
+    fail_if(n < 0, "error (%s)", strerror(errno));
+
+    fail_if(n != 1, "selected %d rows but the right number would be 1", n);
+
+    fail_if(strcmp(rows[0].first_name, elvis.first_name) ||
+            strcmp(rows[0].family_name, elvis.family_name) ||
+            rows[0].id != elvis.id, "selected the wrong row (%s %s %u)",
+            rows[0].first_name, rows[0].family_name, rows[0].id);
+
+    n = MQI_SELECT(persons_select_columns, persons, nomatch, rows);
+
+    fail_if(n != 0, "selected %d rows but the right number would be 0", n);
+}
+END_TEST
+
+
+
+START_TEST(secondary_index_select_from_persons)
+{
+    static const char *male = "male";
+    static uint32_t    low  = 500;
+    static uint32_t    high = 1100;
+
+    static char *sex_column[] = { "sex", NULL };
+    static char *id_column[]  = { "id" , NULL };
+
+    MQI_WHERE_CLAUSE(males,
+        MQI_EQUAL( MQI_COLUMN(0), MQI_STRING_VAR(male) )
+    );
+
+    MQI_WHERE_CLAUSE(range,
+        MQI_GREATER_OR_EQUAL( MQI_COLUMN(3), MQI_UNSIGNED_VAR(low) ) MQI_AND
+        MQI_LESS( MQI_COLUMN(3), MQI_UNSIGNED_VAR(high) )
+    );
+
+    query_t rows[32];
+    int n, sts;
+
+    PREREQUISITE(replace_in_persons);
+
+    sts = mqi_create_secondary_index(persons, "by_sex", mqi_index_hash,
+                                     sex_column);
+    fail_if(sts < 0, "failed to create hash index (%s)", strerror(errno));
+
+    sts = mqi_create_secondary_index(persons, "by_id", mqi_index_ordered,
+                                     id_column);
+    fail_if(sts < 0, "failed to create ordered index (%s)", strerror(errno));
+
+    sts = mqi_create_secondary_index(persons, "by_id", mqi_index_hash,
+                                     sex_column);
+    fail_if(sts == 0 || errno != EEXIST, "duplicate index name was accepted");
+
+    n = MQI_SELECT(persons_select_columns, persons, males, rows);
+
+    fail_if(n < 0, "error (%s)", strerror(errno));
+
+    fail_if(n != 4, "selected %d rows but the right number would be 4", n);
+
+    n = MQI_SELECT(persons_select_columns, persons, range, rows);
+
+    fail_if(n < 0, "error (%s)", strerror(errno));
+
+    fail_if(n != 2, "selected %d rows but the right number would be 2", n);
+
+    fail_if(rows[0].id != tom.id || rows[1].id != elvis.id,
+            "ordered index returned rows in wrong order (%u, %u)",
+            rows[0].id, rows[1].id);
+
+    sts = mqi_drop_secondary_index(persons, "by_id");
+    fail_if(sts < 0, "failed to drop index (%s)", strerror(errno));
+
+    n = MQI_SELECT(persons_select_columns, persons, range, rows);
+
+    fail_if(n != 2, "selected %d rows after dropping the index "
+            "but the right number would be 2", n);
+}
+END_TEST
+
+START_TEST(nested_condition_select_from_persons)
+{
+    static const char *male  = "male";
+    static uint32_t    limit = 550;
+
+    MQI_WHERE_CLAUSE(senior_males,
+        MQI_OPERATOR(begin),
+            MQI_GREATER( MQI_COLUMN(3), MQI_UNSIGNED_VAR(limit) )
+        MQI_OPERATOR(end),
+        MQI_AND
+        MQI_EQUAL( MQI_COLUMN(0), MQI_STRING_VAR(male) )
+    );
+
+    MQI_WHERE_CLAUSE(juniors,
+        MQI_OPERATOR(not),
+        MQI_OPERATOR(begin),
+            MQI_GREATER( MQI_COLUMN(3), MQI_UNSIGNED_VAR(limit) )
+        MQI_OPERATOR(end),
+    );
+
+    query_t rows[32];
+    int n;
+
+    PREREQUISITE(replace_in_persons);
+
+    n = MQI_SELECT(persons_select_columns, persons, senior_males, rows);
+
+    fail_if(n < 0, "error (%s)", strerror(errno));
+
+    fail_if(n != 2, "selected %d rows but the right number would be 2", n);
+
+    n = MQI_SELECT(persons_select_columns, persons, juniors, rows);
+
+    fail_if(n < 0, "error (%s)", strerror(errno));
+
+    fail_if(n != 3, "selected %d rows but the right number would be 3", n);
+}
+END_TEST
+
 START_TEST(update_in_persons)
 {
     MQI_WHERE_CLAUSE(where,
@@ -870,6 +1060,821 @@ START_TEST(nested_transactions)
 END_TEST
 
 
+START_TEST(persistent_table_reload)
+{
+    static uint32_t idlimit = 100;
+
+    MQI_WHERE_CLAUSE(where,
+        MQI_LESS( MQI_COLUMN(3), MQI_UNSIGNED_VAR(idlimit) )
+    );
+
+    char          dir[] = "/tmp/check-libmqi-XXXXXX";
+    char          path[256];
+    mqi_handle_t  saved, trh;
+    query_t      *r, rows[32];
+    int           i, n;
+
+    PREREQUISITE(open_db);
+
+    fail_if(!mkdtemp(dir), "can't create directory (%s)", strerror(errno));
+    fail_if(mqi_set_persistent_directory(dir) < 0, "errno (%s)",
+            strerror(errno));
+
+    saved = MQI_CREATE_TABLE("saved_persons", MQI_PERSISTENT,
+                             persons_coldefs, persons_indexdef);
+
+    fail_if(saved == MQI_HANDLE_INVALID, "errno (%s)", strerror(errno));
+
+    trh = mqi_begin_transaction();
+    n   = MQI_INSERT_INTO(saved, persons_insert_columns, artists);
+
+    fail_if(n != MQI_DIMENSION(artists)-1, "insertion failed (%s)",
+            strerror(errno));
+    fail_if(mqi_commit_transaction(trh) < 0, "commit failed (%s)",
+            strerror(errno));
+
+    n = MQI_DELETE(saved, where);
+
+    fail_if(n != 1, "deleted %d rows but supposed to 1", n);
+    fail_if(mqi_drop_table(saved) < 0, "errno (%s)", strerror(errno));
+
+    saved = MQI_CREATE_TABLE("saved_persons", MQI_PERSISTENT,
+                             persons_coldefs, persons_indexdef);
+
+    fail_if(saved == MQI_HANDLE_INVALID, "reload failed (%s)",
+            strerror(errno));
+
+    n = MQI_SELECT(persons_select_columns, saved, MQI_ALL, rows);
+
+    fail_if(n != MQI_DIMENSION(artists)-2, "reloaded %d rows but supposed "
+            "to %d", n, MQI_DIMENSION(artists)-2);
+
+    for (i = 0;  i < n;  i++) {
+        r = rows + i;
+
+        fail_if(r->id < idlimit, "deleted row with id %u came back", r->id);
+    }
+
+    mqi_drop_table(saved);
+    mqi_set_persistent_directory(NULL);
+
+    snprintf(path, sizeof(path), "%s/saved_persons.wal", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/saved_persons.snapshot", dir);
+    unlink(path);
+    rmdir(dir);
+}
+END_TEST
+
+
+START_TEST(changeset_trigger)
+{
+    mqi_handle_t  chgs, trh;
+    int           n;
+
+    PREREQUISITE(open_db);
+
+    chgs = MQI_CREATE_TABLE("changed_persons", MQI_TEMPORARY,
+                            persons_coldefs, persons_indexdef);
+
+    fail_if(chgs == MQI_HANDLE_INVALID, "errno (%s)", strerror(errno));
+
+    n = mqi_create_changeset_trigger(chgs, 0, changeset_event_cb, NULL,
+                                     persons_select_columns);
+
+    fail_if(n < 0, "errno (%s)", strerror(errno));
+
+    changeset_calls = changeset_inserts = 0;
+
+    trh = mqi_begin_transaction();
+    n   = MQI_INSERT_INTO(chgs, persons_insert_columns, artists);
+
+    fail_if(n != MQI_DIMENSION(artists)-1, "insertion failed (%s)",
+            strerror(errno));
+    fail_if(changeset_calls, "changes were delivered before commit");
+    fail_if(mqi_commit_transaction(trh) < 0, "commit failed (%s)",
+            strerror(errno));
+    fail_if(changeset_calls != 1, "%d change sets were delivered but "
+            "supposed to 1", changeset_calls);
+    fail_if(changeset_inserts != MQI_DIMENSION(artists)-1, "%d inserts "
+            "were delivered but supposed to %d", changeset_inserts,
+            MQI_DIMENSION(artists)-1);
+
+    trh = mqi_begin_transaction();
+    MQI_DELETE(chgs, MQI_ALL);
+
+    fail_if(mqi_rollback_transaction(trh) < 0, "rollback failed (%s)",
+            strerror(errno));
+    fail_if(changeset_calls != 1, "rolled back changes were delivered");
+
+    mqi_drop_changeset_trigger(chgs, changeset_event_cb, NULL);
+    mqi_drop_table(chgs);
+}
+END_TEST
+
+
+START_TEST(materialized_view)
+{
+    static char     *female = "female";
+    static char     *male   = "male";
+    static record_t  marilyn = {"female", "Marilyn", "Monroe", 1200,
+                                "mmo@heaven.org"};
+    static record_t *newcomers[] = {&marilyn, NULL};
+    static char     *view_columns[] = {"first_name", "family_name", "id", NULL};
+
+    MQI_WHERE_CLAUSE(females,
+        MQI_EQUAL( MQI_COLUMN(0), MQI_STRING_VAR(female) )
+    );
+
+    MQI_WHERE_CLAUSE(greta_row,
+        MQI_EQUAL( MQI_COLUMN(2), MQI_STRING_VAR(greta.first_name) )
+    );
+
+    MQI_WHERE_CLAUSE(rita_row,
+        MQI_EQUAL( MQI_COLUMN(2), MQI_STRING_VAR(rita.first_name) )
+    );
+
+    MQI_COLUMN_SELECTION_LIST(view_select_columns,
+        MQI_COLUMN_SELECTOR( 2, query_t, id          ),
+        MQI_COLUMN_SELECTOR( 1, query_t, family_name ),
+        MQI_COLUMN_SELECTOR( 0, query_t, first_name  )
+    );
+
+    MQI_COLUMN_SELECTION_LIST(sex_column,
+        MQI_COLUMN_SELECTOR( 0, record_t, sex )
+    );
+
+    record_t      change = {NULL, NULL, NULL, 0, NULL};
+    query_t       rows[32];
+    mqi_handle_t  src, view, trh;
+    int           n, i;
+
+    PREREQUISITE(open_db);
+
+    src = MQI_CREATE_TABLE("view_persons", MQI_TEMPORARY,
+                           persons_coldefs, persons_indexdef);
+
+    fail_if(src == MQI_HANDLE_INVALID, "errno (%s)", strerror(errno));
+
+    trh = mqi_begin_transaction();
+    n   = MQI_INSERT_INTO(src, persons_insert_columns, artists);
+
+    fail_if(n != MQI_DIMENSION(artists)-1, "insertion failed (%s)",
+            strerror(errno));
+    fail_if(mqi_commit_transaction(trh) < 0, "commit failed (%s)",
+            strerror(errno));
+
+    female = "female";
+    view   = mqi_create_view("female_persons", src, females, view_columns);
+    female = "nobody";
+
+    fail_if(view == MQI_HANDLE_INVALID, "view creation failed (%s)",
+            strerror(errno));
+
+    n = MQI_SELECT(view_select_columns, view, MQI_ALL, rows);
+
+    fail_if(n != 2, "view has %d rows but supposed to have 2", n);
+
+    n = mqi_create_changeset_trigger(view, 0, changeset_event_cb, NULL,
+                                     view_select_columns);
+
+    fail_if(n < 0, "errno (%s)", strerror(errno));
+
+    changeset_calls = changeset_inserts = 0;
+
+    trh = mqi_begin_transaction();
+
+    fail_if(MQI_INSERT_INTO(src, persons_insert_columns, newcomers) != 1,
+            "insertion failed (%s)", strerror(errno));
+    fail_if(MQI_DELETE(src, greta_row) != 1, "deletion failed (%s)",
+            strerror(errno));
+    fail_if(mqi_commit_transaction(trh) < 0, "commit failed (%s)",
+            strerror(errno));
+
+    fail_if(changeset_calls != 1, "%d change sets were delivered for the "
+            "view but supposed to 1", changeset_calls);
+    fail_if(changeset_inserts != 1, "%d inserts were delivered for the "
+            "view but supposed to 1", changeset_inserts);
+
+    n = MQI_SELECT(view_select_columns, view, MQI_ALL, rows);
+
+    fail_if(n != 2, "view has %d rows but supposed to have 2", n);
+
+    for (i = 0;  i < n;  i++) {
+        fail_if(strcmp(rows[i].first_name, "Rita") &&
+                strcmp(rows[i].first_name, "Marilyn"),
+                "unexpected row '%s %s' in view", rows[i].first_name,
+                rows[i].family_name);
+    }
+
+    change.sex = male;
+
+    trh = mqi_begin_transaction();
+
+    fail_if(MQI_UPDATE(src, sex_column, &change, rita_row) != 1,
+            "update failed (%s)", strerror(errno));
+    fail_if(mqi_commit_transaction(trh) < 0, "commit failed (%s)",
+            strerror(errno));
+
+    n = MQI_SELECT(view_select_columns, view, MQI_ALL, rows);
+
+    fail_if(n != 1, "view has %d rows but supposed to have 1", n);
+    fail_if(strcmp(rows[0].first_name, "Marilyn"), "unexpected row '%s %s' "
+            "in view", rows[0].first_name, rows[0].family_name);
+
+    fail_if(mqi_refresh_view(view) < 0, "refresh failed (%s)",
+            strerror(errno));
+
+    n = MQI_SELECT(view_select_columns, view, MQI_ALL, rows);
+
+    fail_if(n != 1, "view has %d rows after refresh but supposed to have 1",
+            n);
+
+    mqi_drop_changeset_trigger(view, changeset_event_cb, NULL);
+    mqi_drop_table(view);
+
+    fail_if(mqi_refresh_view(view) == 0, "dropped view was refreshed");
+
+    mqi_drop_table(src);
+}
+END_TEST
+
+
+
+START_TEST(interned_columns)
+{
+    static char     *female = "female";
+    static char     *nobody = "nobody";
+    static record_t  nameless = {"female", "Greta", "Garbo", 2001,
+                                 "nobody@nowhere.org"};
+    static record_t *duplicates[] = {&nameless, NULL};
+
+    MQI_COLUMN_DEFINITION_LIST(interned_coldefs,
+        MQI_COLUMN_DEFINITION( "sex"        , MQI_VARCHAR(6)  ),
+        MQI_COLUMN_DEFINITION( "family_name", MQI_VARCHAR(12) ),
+        MQI_COLUMN_DEFINITION( "first_name" , MQI_VARCHAR(12) ),
+        MQI_COLUMN_DEFINITION( "id"         , MQI_UNSIGNED    ),
+        MQI_COLUMN_DEFINITION( "email"      , MQI_VARCHAR(24) )
+    );
+
+    MQI_WHERE_CLAUSE(females,
+        MQI_EQUAL( MQI_COLUMN(0), MQI_STRING_VAR(female) )
+    );
+
+    MQI_WHERE_CLAUSE(nobodies,
+        MQI_EQUAL( MQI_COLUMN(0), MQI_STRING_VAR(nobody) )
+    );
+
+    MQI_WHERE_CLAUSE(rita_row,
+        MQI_EQUAL( MQI_COLUMN(2), MQI_STRING_VAR(rita.first_name) )
+    );
+
+    MQI_WHERE_CLAUSE(greta_row,
+        MQI_EQUAL( MQI_COLUMN(2), MQI_STRING_VAR(greta.first_name) )
+    );
+
+    MQI_COLUMN_SELECTION_LIST(sex_column,
+        MQI_COLUMN_SELECTOR( 0, record_t, sex )
+    );
+
+    static char *by_sex[] = {"sex", NULL};
+
+    record_t          change = {NULL, NULL, NULL, 0, NULL};
+    mqi_column_def_t  cols[8];
+    query_t           rows[32];
+    mqi_handle_t      table, trh;
+    int               i, n;
+
+    PREREQUISITE(open_db);
+
+    for (i = 0;  i < 3;  i++)
+        interned_coldefs[i].flags = MQI_COLUMN_INTERNED;
+
+    table = MQI_CREATE_TABLE("interned_persons", MQI_TEMPORARY,
+                             interned_coldefs, persons_indexdef);
+
+    fail_if(table == MQI_HANDLE_INVALID, "errno (%s)", strerror(errno));
+
+    n = MQI_DESCRIBE(table, cols);
+
+    fail_if(n != MQI_DIMENSION(interned_coldefs) - 1, "describe failed (%s)",
+            strerror(errno));
+    fail_if(cols[0].length != 6 || !(cols[0].flags & MQI_COLUMN_INTERNED),
+            "interned column is described with length %d, flags 0x%x",
+            cols[0].length, cols[0].flags);
+
+    trh = mqi_begin_transaction();
+    n   = MQI_INSERT_INTO(table, persons_insert_columns, artists);
+
+    fail_if(n != MQI_DIMENSION(artists)-1, "insertion failed (%s)",
+            strerror(errno));
+    fail_if(mqi_commit_transaction(trh) < 0, "commit failed (%s)",
+            strerror(errno));
+
+    fail_if(MQI_INSERT_INTO(table, persons_insert_columns, duplicates) > 0,
+            "duplicate was inserted despite of the primary index");
+
+    n = MQI_SELECT(persons_select_columns, table, females, rows);
+
+    fail_if(n != 2, "selected %d females but supposed to 2", n);
+
+    for (i = 0;  i < n;  i++) {
+        fail_if(strcmp(rows[i].first_name, "Greta") &&
+                strcmp(rows[i].first_name, "Rita"),
+                "unexpected row '%s %s' selected", rows[i].first_name,
+                rows[i].family_name);
+    }
+
+    n = MQI_SELECT(persons_select_columns, table, nobodies, rows);
+
+    fail_if(n != 0, "selected %d rows by a string never stored", n);
+
+    fail_if(mqi_create_secondary_index(table, "by_sex_ordered",
+                                       mqi_index_ordered, by_sex) == 0,
+            "ordered index was created on an interned column");
+    fail_if(mqi_create_secondary_index(table, "by_sex", mqi_index_hash,
+                                       by_sex) < 0,
+            "index creation failed (%s)", strerror(errno));
+
+    change.sex = "male";
+
+    trh = mqi_begin_transaction();
+
+    fail_if(MQI_UPDATE(table, sex_column, &change, rita_row) != 1,
+            "update failed (%s)", strerror(errno));
+    fail_if(mqi_commit_transaction(trh) < 0, "commit failed (%s)",
+            strerror(errno));
+
+    n = MQI_SELECT(persons_select_columns, table, females, rows);
+
+    fail_if(n != 1 || strcmp(rows[0].first_name, "Greta"),
+            "selected %d females after the update but supposed to 1", n);
+
+    trh = mqi_begin_transaction();
+
+    fail_if(MQI_DELETE(table, greta_row) != 1, "deletion failed (%s)",
+            strerror(errno));
+    fail_if(mqi_rollback_transaction(trh) < 0, "rollback failed (%s)",
+            strerror(errno));
+
+    n = MQI_SELECT(persons_select_columns, table, females, rows);
+
+    fail_if(n != 1 || strcmp(rows[0].first_name, "Greta"),
+            "selected %d females after the rollback but supposed to 1", n);
+
+    mqi_drop_table(table);
+}
+END_TEST
+
+
+
+START_TEST(bulk_insert)
+{
+#define NBULK 600
+    typedef struct {
+        uint32_t    id;
+        const char *name;
+    } bulk_row_t;
+
+    MQI_COLUMN_DEFINITION_LIST(bulk_coldefs,
+        MQI_COLUMN_DEFINITION( "id"  , MQI_UNSIGNED    ),
+        MQI_COLUMN_DEFINITION( "name", MQI_VARCHAR(16) )
+    );
+
+    MQI_INDEX_DEFINITION(bulk_indexdef,
+        MQI_INDEX_COLUMN("id")
+    );
+
+    MQI_COLUMN_SELECTION_LIST(bulk_columns,
+        MQI_COLUMN_SELECTOR( 0, bulk_row_t, id   ),
+        MQI_COLUMN_SELECTOR( 1, bulk_row_t, name )
+    );
+
+    static bulk_row_t  records[NBULK];
+    static bulk_row_t *data[NBULK + 1];
+    static bulk_row_t  rows[NBULK + 1];
+    mqi_handle_t       table, trh;
+    mqi_variable_t     key;
+    bulk_row_t         row;
+    uint32_t           id;
+    int                i, n;
+
+    PREREQUISITE(open_db);
+
+    table = MQI_CREATE_TABLE("bulk_rows", MQI_TEMPORARY,
+                             bulk_coldefs, bulk_indexdef);
+
+    fail_if(table == MQI_HANDLE_INVALID, "errno (%s)", strerror(errno));
+
+    /* the first half in some scrambled order */
+    for (i = 0;  i < NBULK / 2;  i++) {
+        records[i].id   = (i * 7) % (NBULK / 2) * 2;
+        records[i].name = "first";
+        data[i] = records + i;
+    }
+    data[i] = NULL;
+
+    trh = mqi_begin_transaction();
+    n   = MQI_INSERT_INTO(table, bulk_columns, data);
+
+    fail_if(n != NBULK / 2, "inserted %d rows but supposed to %d (%s)",
+            n, NBULK / 2, strerror(errno));
+    fail_if(mqi_commit_transaction(trh) < 0, "commit failed (%s)",
+            strerror(errno));
+
+    /* the rest interleaved with the first half, replacing every 10th row */
+    for (i = 0;  i < NBULK / 2;  i++) {
+        records[i].id   = (i * 11) % (NBULK / 2) * 2 + (i % 10 ? 1 : 0);
+        records[i].name = "second";
+    }
+
+    trh = mqi_begin_transaction();
+    n   = MQI_REPLACE(table, bulk_columns, data);
+
+    fail_if(n != NBULK / 2 - NBULK / 20, "inserted %d new rows but supposed "
+            "to %d (%s)", n, NBULK / 2 - NBULK / 20, strerror(errno));
+    fail_if(mqi_commit_transaction(trh) < 0, "commit failed (%s)",
+            strerror(errno));
+
+    n = MQI_SELECT(bulk_columns, table, MQI_ALL, rows);
+
+    fail_if(n != NBULK - NBULK / 20, "selected %d rows but supposed to %d",
+            n, NBULK - NBULK / 20);
+
+    for (i = 1;  i < n;  i++)
+        fail_if(rows[i-1].id >= rows[i].id, "rows are not in index order "
+                "(%u before %u)", rows[i-1].id, rows[i].id);
+
+    for (id = 0;  id < NBULK;  id += 37) {
+        key.type      = mqi_unsignd;
+        key.v.unsignd = &id;
+
+        n = mqi_select_by_index(table, &key, bulk_columns, &row);
+
+        if (id % 2 == 0 && (id / 2) % 10)
+            fail_if(n != 1 || strcmp(row.name, "first"),
+                    "row %u was not found or replaced", id);
+        else if (id % 2 == 0 || id % 20 != 1)
+            fail_if(n != 1 || strcmp(row.name, "second"),
+                    "row %u was not found or not replaced", id);
+    }
+
+    /* rolling back a bulk insertion, with a duplicate in the batch */
+    for (i = 0;  i < NBULK / 2;  i++)
+        records[i].id = NBULK + i;
+    records[NBULK / 2 - 1].id = NBULK;
+
+    trh = mqi_begin_transaction();
+
+    fail_if(MQI_INSERT_INTO(table, bulk_columns, data) >= 0 ||
+            errno != EEXIST, "duplicate in the batch was not refused");
+    fail_if(mqi_rollback_transaction(trh) < 0, "rollback failed (%s)",
+            strerror(errno));
+
+    n = MQI_SELECT(bulk_columns, table, MQI_ALL, rows);
+
+    fail_if(n != NBULK - NBULK / 20, "%d rows after the rollback but "
+            "supposed to %d", n, NBULK - NBULK / 20);
+
+    mqi_drop_table(table);
+#undef NBULK
+}
+END_TEST
+
+
+START_TEST(wide_table)
+{
+#define NWIDE   100
+#define NWROW   8
+#define HIGHCOL 95
+    static char              names[MQI_COLUMN_MAX + 1][8];
+    static mqi_column_def_t  defs[MQI_COLUMN_MAX + 2];
+    static mqi_column_desc_t cds[NWIDE + 1];
+    static uint32_t          values[NWROW][NWIDE];
+    static uint32_t         *data[NWROW + 1];
+    static char             *index_columns[] = { "c0", NULL };
+    static char             *high_column[]   = { "c90", NULL };
+
+    static uint32_t key = 5 * 1000 + 90;
+
+    MQI_WHERE_CLAUSE(by_high,
+        MQI_EQUAL( MQI_COLUMN(90), MQI_UNSIGNED_VAR(key) )
+    );
+
+    MQI_WHERE_CLAUSE(first_row,
+        MQI_EQUAL( MQI_COLUMN(0), MQI_UNSIGNED_VAR(values[0][0]) )
+    );
+
+    mqi_column_desc_t  upd[2] = { { HIGHCOL, 0 }, { -1, 0 } };
+    mqi_column_desc_t  sel[3] = { { 0, 0 }, { 90, 4 }, { -1, 0 } };
+    mqi_bitfld_t       mask;
+    mqi_handle_t       table, trh;
+    uint32_t           rows[NWROW][2];
+    uint32_t           v;
+    int                i, j, n;
+
+    PREREQUISITE(open_db);
+
+    for (i = 0;  i <= MQI_COLUMN_MAX;  i++) {
+        snprintf(names[i], sizeof(names[i]), "c%d", i);
+        defs[i].name = names[i];
+        defs[i].type = mqi_unsignd;
+    }
+
+    /* one column too many */
+    table = mqi_create_table("too_wide", MQI_TEMPORARY, NULL, defs);
+
+    fail_if(table != MQI_HANDLE_INVALID, "table with %d columns was created",
+            MQI_COLUMN_MAX + 1);
+
+    memset(defs + NWIDE, 0, sizeof(defs[0]));
+
+    table = mqi_create_table("wide", MQI_TEMPORARY, index_columns, defs);
+
+    fail_if(table == MQI_HANDLE_INVALID, "errno (%s)", strerror(errno));
+    fail_if(mqi_create_secondary_index(table, "by_c90", mqi_index_hash,
+                                       high_column) < 0,
+            "failed to create index (%s)", strerror(errno));
+
+    for (j = 0;  j < NWIDE;  j++) {
+        cds[j].cindex = j;
+        cds[j].offset = j * sizeof(uint32_t);
+    }
+    cds[j].cindex = -1;
+
+    for (i = 0;  i < NWROW;  i++) {
+        for (j = 0;  j < NWIDE;  j++)
+            values[i][j] = i * 1000 + j;
+        data[i] = values[i];
+    }
+    data[i] = NULL;
+
+    n = mqi_insert_into(table, 0, cds, (void **)data);
+
+    fail_if(n != NWROW, "inserted %d rows but supposed to %d (%s)",
+            n, NWROW, strerror(errno));
+
+    n = mqi_select(table, by_high, sel, rows, sizeof(rows[0]), NWROW);
+
+    fail_if(n != 1 || rows[0][0] != 5000 || rows[0][1] != key,
+            "lookup by a high column returned %d rows", n);
+
+    /* change sets filtered by a column beyond the first word */
+    mqi_bitfld_clear(&mask);
+    mqi_bitfld_set(&mask, HIGHCOL);
+
+    fail_if(mqi_create_changeset_trigger(table, &mask, changeset_event_cb,
+                                         NULL, sel) < 0,
+            "errno (%s)", strerror(errno));
+
+    changeset_calls = 0;
+
+    v = 1;
+    upd[0].cindex = 40;
+
+    trh = mqi_begin_transaction();
+    mqi_update(table, first_row, upd, &v);
+    mqi_commit_transaction(trh);
+
+    fail_if(changeset_calls, "update of a filtered column was delivered");
+
+    upd[0].cindex = HIGHCOL;
+
+    trh = mqi_begin_transaction();
+    n = mqi_update(table, first_row, upd, &v);
+    mqi_commit_transaction(trh);
+
+    fail_if(n != 1, "updated %d rows but supposed to 1", n);
+    fail_if(changeset_calls != 1, "update of column %d was not delivered",
+            HIGHCOL);
+
+    mqi_drop_changeset_trigger(table, changeset_event_cb, NULL);
+    mqi_drop_table(table);
+#undef HIGHCOL
+#undef NWROW
+#undef NWIDE
+}
+END_TEST
+
+START_TEST(cond_scan)
+{
+    static const int32_t  sbound[] = {
+        INT32_MIN, INT32_MIN + 1, -2, -1, 0, 1, 2, INT32_MAX - 1, INT32_MAX
+    };
+    static const uint32_t ubound[] = {
+        0, 1, 2, 0x7fffffff, 0x80000000, 0x80000001,
+        UINT32_MAX - 1, UINT32_MAX
+    };
+    static char *u_column[] = { "u", NULL };
+
+    MQI_WHERE_CLAUSE(s_less,
+        MQI_LESS( MQI_COLUMN(1), MQI_INTEGER_VAR(scan_sv) )
+    );
+    MQI_WHERE_CLAUSE(s_leq,
+        MQI_LESS_OR_EQUAL( MQI_COLUMN(1), MQI_INTEGER_VAR(scan_sv) )
+    );
+    MQI_WHERE_CLAUSE(s_eq,
+        MQI_EQUAL( MQI_COLUMN(1), MQI_INTEGER_VAR(scan_sv) )
+    );
+    MQI_WHERE_CLAUSE(s_geq,
+        MQI_GREATER_OR_EQUAL( MQI_COLUMN(1), MQI_INTEGER_VAR(scan_sv) )
+    );
+    MQI_WHERE_CLAUSE(s_gt,
+        MQI_GREATER( MQI_COLUMN(1), MQI_INTEGER_VAR(scan_sv) )
+    );
+    MQI_WHERE_CLAUSE(u_less,
+        MQI_LESS( MQI_COLUMN(2), MQI_UNSIGNED_VAR(scan_uv) )
+    );
+    MQI_WHERE_CLAUSE(u_leq,
+        MQI_LESS_OR_EQUAL( MQI_COLUMN(2), MQI_UNSIGNED_VAR(scan_uv) )
+    );
+    MQI_WHERE_CLAUSE(u_eq,
+        MQI_EQUAL( MQI_COLUMN(2), MQI_UNSIGNED_VAR(scan_uv) )
+    );
+    MQI_WHERE_CLAUSE(u_geq,
+        MQI_GREATER_OR_EQUAL( MQI_COLUMN(2), MQI_UNSIGNED_VAR(scan_uv) )
+    );
+    MQI_WHERE_CLAUSE(u_gt,
+        MQI_GREATER( MQI_COLUMN(2), MQI_UNSIGNED_VAR(scan_uv) )
+    );
+    /* the values on the left */
+    MQI_WHERE_CLAUSE(swapped,
+        MQI_LESS( MQI_INTEGER_VAR(scan_sv), MQI_COLUMN(1) ) MQI_AND
+        MQI_GREATER_OR_EQUAL( MQI_UNSIGNED_VAR(scan_uv), MQI_COLUMN(2) )
+    );
+    MQI_WHERE_CLAUSE(s_between,
+        MQI_GREATER_OR_EQUAL( MQI_COLUMN(1), MQI_INTEGER_VAR(scan_lo) ) MQI_AND
+        MQI_LESS_OR_EQUAL( MQI_COLUMN(1), MQI_INTEGER_VAR(scan_hi) )    MQI_AND
+        MQI_GREATER( MQI_COLUMN(2), MQI_UNSIGNED_VAR(scan_uv) )
+    );
+    MQI_WHERE_CLAUSE(u_in,
+        MQI_OPERATOR(begin),
+            MQI_EQUAL( MQI_COLUMN(2), MQI_UNSIGNED_VAR(scan_uin[0]) ) MQI_OR
+            MQI_EQUAL( MQI_COLUMN(2), MQI_UNSIGNED_VAR(scan_uin[1]) ) MQI_OR
+            MQI_EQUAL( MQI_COLUMN(2), MQI_UNSIGNED_VAR(scan_uin[2]) )
+        MQI_OPERATOR(end),
+    );
+    MQI_WHERE_CLAUSE(s_in_and_range,
+        MQI_OPERATOR(begin),
+            MQI_EQUAL( MQI_COLUMN(1), MQI_INTEGER_VAR(scan_sin[0]) ) MQI_OR
+            MQI_EQUAL( MQI_COLUMN(1), MQI_INTEGER_VAR(scan_sin[1]) ) MQI_OR
+            MQI_EQUAL( MQI_COLUMN(1), MQI_INTEGER_VAR(scan_sin[2]) )
+        MQI_OPERATOR(end),
+        MQI_AND
+        MQI_LESS_OR_EQUAL( MQI_COLUMN(2), MQI_UNSIGNED_VAR(scan_uv) )
+    );
+    /* a range and a varchar comparison the scan leaves to the program */
+    MQI_WHERE_CLAUSE(mixed_varchar,
+        MQI_GREATER( MQI_COLUMN(1), MQI_INTEGER_VAR(scan_sv) ) MQI_AND
+        MQI_EQUAL( MQI_COLUMN(3), MQI_STRING_VAR(scan_odd) )
+    );
+    /* a range and an or of ranges over different columns */
+    MQI_WHERE_CLAUSE(mixed_or,
+        MQI_OPERATOR(begin),
+            MQI_LESS( MQI_COLUMN(1), MQI_INTEGER_VAR(scan_sv) ) MQI_OR
+            MQI_GREATER( MQI_COLUMN(2), MQI_UNSIGNED_VAR(scan_uv) )
+        MQI_OPERATOR(end),
+        MQI_AND
+        MQI_GREATER_OR_EQUAL( MQI_COLUMN(2), MQI_UNSIGNED_VAR(scan_ulo) )
+    );
+    /* a range and a negated range */
+    MQI_WHERE_CLAUSE(mixed_not,
+        MQI_OPERATOR(not),
+        MQI_OPERATOR(begin),
+            MQI_GREATER( MQI_COLUMN(2), MQI_UNSIGNED_VAR(scan_uv) )
+        MQI_OPERATOR(end),
+        MQI_AND
+        MQI_GREATER_OR_EQUAL( MQI_COLUMN(1), MQI_INTEGER_VAR(scan_sv) )
+    );
+
+    static scan_row_t *data[SCAN_NROW + 1];
+    mqi_handle_t       table, empty;
+    int                nsb = MQI_DIMENSION(sbound);
+    int                nub = MQI_DIMENSION(ubound);
+    int                pass, i, j, n;
+
+    PREREQUISITE(open_db);
+
+    table = mqi_create_table("scan", MQI_TEMPORARY, NULL, scan_coldefs);
+    empty = mqi_create_table("scan_empty", MQI_TEMPORARY, NULL, scan_coldefs);
+
+    fail_if(table == MQI_HANDLE_INVALID || empty == MQI_HANDLE_INVALID,
+            "errno (%s)", strerror(errno));
+
+    /* boundary values interleaved with spread ones, over several blocks */
+    for (i = 0;  i < SCAN_NROW;  i++) {
+        scan_rows[i].id     = i;
+        scan_rows[i].s      = (i % 3) ? (int32_t)(i * 2654435761U) :
+                                        sbound[(i / 3) % nsb];
+        scan_rows[i].u      = (i % 3) != 1 ? i * 40503U * 65537U :
+                                             ubound[(i / 3) % nub];
+        scan_rows[i].parity = (i & 1) ? "odd" : "even";
+        data[i] = scan_rows + i;
+    }
+    data[i] = NULL;
+
+    n = mqi_insert_into(table, 0, scan_columns, (void **)data);
+
+    fail_if(n != SCAN_NROW, "inserted %d rows but supposed to %d (%s)",
+            n, SCAN_NROW, strerror(errno));
+
+    /* first by scanning the whole table, then the rows of a range index */
+    for (pass = 0;  pass < 2;  pass++) {
+        if (pass == 1)
+            fail_if(mqi_create_secondary_index(table, "by_u",
+                                               mqi_index_ordered,
+                                               u_column) < 0,
+                    "failed to create index (%s)", strerror(errno));
+
+        for (i = 0;  i < nsb;  i++) {
+            scan_sv = sbound[i];
+
+            check_scan(table, s_less, scan_s_less, SCAN_NROW, "s <");
+            check_scan(table, s_leq , scan_s_leq , SCAN_NROW, "s <=");
+            check_scan(table, s_eq  , scan_s_eq  , SCAN_NROW, "s ==");
+            check_scan(table, s_geq , scan_s_geq , SCAN_NROW, "s >=");
+            check_scan(table, s_gt  , scan_s_gt  , SCAN_NROW, "s >");
+        }
+
+        for (i = 0;  i < nub;  i++) {
+            scan_uv = ubound[i];
+
+            check_scan(table, u_less, scan_u_less, SCAN_NROW, "u <");
+            check_scan(table, u_leq , scan_u_leq , SCAN_NROW, "u <=");
+            check_scan(table, u_eq  , scan_u_eq  , SCAN_NROW, "u ==");
+            check_scan(table, u_geq , scan_u_geq , SCAN_NROW, "u >=");
+            check_scan(table, u_gt  , scan_u_gt  , SCAN_NROW, "u >");
+        }
+
+        for (i = 0;  i < nsb;  i++) {
+            scan_sv = sbound[i];
+            scan_uv = ubound[(i + 5) % nub];
+
+            check_scan(table, swapped, scan_swapped, SCAN_NROW,
+                       "swapped operands");
+        }
+
+        for (i = 0;  i < nsb;  i++) {
+            for (j = 0;  j < nsb;  j++) {
+                scan_lo = sbound[i];
+                scan_hi = sbound[j];
+                scan_uv = ubound[(i + j) % nub];
+
+                check_scan(table, s_between, scan_s_between, SCAN_NROW,
+                           "s between");
+            }
+        }
+
+        for (i = 0;  i < nub;  i++) {
+            scan_uin[0] = ubound[i];
+            scan_uin[1] = ubound[(i + 3) % nub];
+            scan_uin[2] = scan_rows[i * 3 + 2].u;
+
+            check_scan(table, u_in, scan_u_in, SCAN_NROW, "u in");
+        }
+
+        for (i = 0;  i < nsb;  i++) {
+            scan_sin[0] = sbound[i];
+            scan_sin[1] = sbound[(i + 4) % nsb];
+            scan_sin[2] = scan_rows[i * 3 + 1].s;
+            scan_uv     = ubound[i % nub];
+
+            check_scan(table, s_in_and_range, scan_s_in_and_range, SCAN_NROW,
+                       "s in and u <=");
+        }
+
+        for (i = 0;  i < nsb;  i++) {
+            scan_sv  = sbound[i];
+            scan_uv  = ubound[i % nub];
+            scan_ulo = ubound[(i + 2) % nub];
+
+            check_scan(table, mixed_varchar, scan_mixed_varchar, SCAN_NROW,
+                       "s > and parity ==");
+            check_scan(table, mixed_or, scan_mixed_or, SCAN_NROW,
+                       "s < or u > and u >=");
+            check_scan(table, mixed_not, scan_mixed_not, SCAN_NROW,
+                       "not u > and s >=");
+        }
+    }
+
+    scan_sv  = 0;
+    scan_uv  = 0;
+    scan_lo  = INT32_MIN;
+    scan_hi  = INT32_MAX;
+    scan_ulo = 0;
+
+    check_scan(empty, s_geq      , scan_s_geq      , 0, "empty s >=");
+    check_scan(empty, u_geq      , scan_u_geq      , 0, "empty u >=");
+    check_scan(empty, s_between  , scan_s_between  , 0, "empty s between");
+    check_scan(empty, u_in       , scan_u_in       , 0, "empty u in");
+    check_scan(empty, mixed_or   , scan_mixed_or   , 0, "empty mixed");
+
+    mqi_drop_table(empty);
+    mqi_drop_table(table);
+}
+END_TEST
+
+
 
 static Suite *libmqi_suite(void)
 {
@@ -896,6 +1901,9 @@ static TCase *basic_tests(void)
     tcase_add_test(tc, filtered_select_from_persons);
     tcase_add_test(tc, full_select_from_persons);
     tcase_add_test(tc, select_from_persons_by_index);
+    tcase_add_test(tc, indexed_select_from_persons);
+    tcase_add_test(tc, secondary_index_select_from_persons);
+    tcase_add_test(tc, nested_condition_select_from_persons);
     tcase_add_test(tc, update_in_persons);
     tcase_add_test(tc, delete_from_persons);
     tcase_add_test(tc, transaction_rollback);
@@ -904,6 +1912,13 @@ static TCase *basic_tests(void)
     tcase_add_test(tc, column_trigger);
     tcase_add_test(tc, sequential_transactions);
     tcase_add_test(tc, nested_transactions);
+    tcase_add_test(tc, persistent_table_reload);
+    tcase_add_test(tc, changeset_trigger);
+    tcase_add_test(tc, materialized_view);
+    tcase_add_test(tc, interned_columns);
+    tcase_add_test(tc, bulk_insert);
+    tcase_add_test(tc, wide_table);
+    tcase_add_test(tc, cond_scan);
 
     return tc;
 }
@@ -929,6 +1944,93 @@ static void print_rows(int n, query_t *rows)
     printf("--------------------------------------\n");
 }
 
+/*
+ * Check a select against evaluating the condition row by row in C. The
+ * first nrow of scan_rows are supposed to be in the table.
+ */
+static void check_scan(mqi_handle_t      table,
+                       mqi_cond_entry_t *where,
+                       int             (*match)(scan_row_t *),
+                       int               nrow,
+                       const char       *what)
+{
+    scan_row_t rows[SCAN_NROW];
+    uint8_t    seen[SCAN_NROW];
+    uint32_t   id;
+    int        i, n, nmatch;
+
+    n = MQI_SELECT(scan_columns, table, where, rows);
+
+    fail_if(n < 0, "%s: error (%s)", what, strerror(errno));
+
+    memset(seen, 0, sizeof(seen));
+
+    for (i = 0;  i < n;  i++) {
+        id = rows[i].id;
+
+        fail_if(id >= (uint32_t)nrow || seen[id]++,
+                "%s: bogus or duplicate row %u selected", what, id);
+        fail_if(rows[i].s != scan_rows[id].s || rows[i].u != scan_rows[id].u,
+                "%s: row %u selected with wrong values", what, id);
+        fail_unless(match(scan_rows + id),
+                    "%s: row %u (s=%d, u=%u) should not match",
+                    what, id, scan_rows[id].s, scan_rows[id].u);
+    }
+
+    for (i = 0, nmatch = 0;  i < nrow;  i++)
+        nmatch += match(scan_rows + i) ? 1 : 0;
+
+    fail_if(n != nmatch, "%s: selected %d rows but the right number "
+            "would be %d", what, n, nmatch);
+}
+
+static int scan_s_less(scan_row_t *r) { return r->s <  scan_sv; }
+static int scan_s_leq (scan_row_t *r) { return r->s <= scan_sv; }
+static int scan_s_eq  (scan_row_t *r) { return r->s == scan_sv; }
+static int scan_s_geq (scan_row_t *r) { return r->s >= scan_sv; }
+static int scan_s_gt  (scan_row_t *r) { return r->s >  scan_sv; }
+static int scan_u_less(scan_row_t *r) { return r->u <  scan_uv; }
+static int scan_u_leq (scan_row_t *r) { return r->u <= scan_uv; }
+static int scan_u_eq  (scan_row_t *r) { return r->u == scan_uv; }
+static int scan_u_geq (scan_row_t *r) { return r->u >= scan_uv; }
+static int scan_u_gt  (scan_row_t *r) { return r->u >  scan_uv; }
+
+static int scan_swapped(scan_row_t *r)
+{
+    return scan_sv < r->s && scan_uv >= r->u;
+}
+
+static int scan_s_between(scan_row_t *r)
+{
+    return r->s >= scan_lo && r->s <= scan_hi && r->u > scan_uv;
+}
+
+static int scan_u_in(scan_row_t *r)
+{
+    return r->u == scan_uin[0] || r->u == scan_uin[1] || r->u == scan_uin[2];
+}
+
+static int scan_s_in_and_range(scan_row_t *r)
+{
+    return (r->s == scan_sin[0] || r->s == scan_sin[1] ||
+            r->s == scan_sin[2]) && r->u <= scan_uv;
+}
+
+static int scan_mixed_varchar(scan_row_t *r)
+{
+    return r->s > scan_sv && !strcmp(r->parity, scan_odd);
+}
+
+static int scan_mixed_or(scan_row_t *r)
+{
+    return (r->s < scan_sv || r->u > scan_uv) && r->u >= scan_ulo;
+}
+
+static int scan_mixed_not(scan_row_t *r)
+{
+    return !(r->u > scan_uv) && r->s >= scan_sv;
+}
+
 
 static void print_triggers(void)
 {
@@ -1172,6 +2274,27 @@ static void column_event_cb(mqi_event_t *evt, void *user_data)
 #undef PRINT_VALUE
 }
 
+static void changeset_event_cb(mqi_event_t *evt, void *user_data)
+{
+    mqi_changeset_event_t *se = &evt->changeset;
+    int i;
+
+    (void)user_data;
+
+    if (evt->event != mqi_changeset) {
+        if (verbose)
+            printf("invalid event %d for changeset trigger\n", evt->event);
+        return;
+    }
+
+    changeset_calls++;
+
+    for (i = 0;  i < se->nchange;  i++) {
+        if (se->changes[i].event == mqi_row_inserted && se->changes[i].new_)
+            changeset_inserts++;
+    }
+}
+
 /*
  * Local Variables:
  * c-basic-offset: 4
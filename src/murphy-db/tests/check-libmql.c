@@ -475,6 +475,71 @@ START_TEST(exec_precompiled_full_select_from_persons)
 }
 END_TEST
 
+START_TEST(exec_limited_select_from_persons)
+{
+    mql_result_t *r;
+    int n;
+
+    PREREQUISITE(make_persons);
+
+    r = mql_exec_string(mql_result_rows, "SELECT id, first_name FROM persons"
+                                         " LIMIT 2");
+
+    fail_unless(mql_result_is_success(r), "exec error: %s",
+                mql_result_error_get_message(r));
+
+    if ((n = mql_result_rows_get_row_count(r)) != 2)
+        fail("row number mismatch (2 vs. %d)", n);
+
+    mql_result_free(r);
+}
+END_TEST
+
+START_TEST(pack_select_from_persons)
+{
+    mql_result_t *r;
+    void         *blob;
+    size_t        size;
+    int           i, n;
+
+    PREREQUISITE(make_persons);
+
+    r = mql_exec_string(mql_result_rows, "SELECT id, first_name FROM persons");
+
+    fail_unless(mql_result_is_success(r), "exec error: %s",
+                mql_result_error_get_message(r));
+
+    blob = mql_result_rows_pack(r, &size);
+
+    fail_unless(blob != NULL, "failed to pack rows (%d): %s",
+                errno, strerror(errno));
+    fail_unless(mql_packed_rows_check(blob, size) == 0,
+                "packed rows failed validation");
+    fail_unless(mql_packed_rows_check(blob, size - 1) < 0,
+                "truncated packed rows passed validation");
+
+    if ((n = mql_packed_rows_get_row_count(blob)) != persons_nrow)
+        fail("row number mismatch (%d vs. %d)", persons_nrow, n);
+
+    fail_unless(mql_packed_rows_get_column_count(blob) == 2 &&
+                mql_packed_rows_get_column_type(blob, 0) == mqi_unsignd &&
+                mql_packed_rows_get_column_type(blob, 1) == mqi_varchar,
+                "column mismatch in packed rows");
+
+    for (i = 0;  i < n;  i++) {
+        fail_unless(mql_packed_rows_get_unsigned(blob, 0, i) ==
+                    mql_result_rows_get_unsigned(r, 0, i),
+                    "id mismatch in packed row %d", i);
+        fail_unless(!strcmp(mql_packed_rows_get_string(blob, 1, i),
+                            mql_result_rows_get_string(r, 1, i, NULL, 0)),
+                    "first_name mismatch in packed row %d", i);
+    }
+
+    free(blob);
+    mql_result_free(r);
+}
+END_TEST
+
 START_TEST(exec_precompiled_update_persons)
 {
     static uint32_t    id         = 2000;
@@ -896,6 +961,8 @@ static TCase *basic_tests(void)
     tcase_add_test(tc, precompile_insert_into_persons);
     tcase_add_test(tc, exec_precompiled_filtered_select_from_persons);
     tcase_add_test(tc, exec_precompiled_full_select_from_persons);
+    tcase_add_test(tc, exec_limited_select_from_persons);
+    tcase_add_test(tc, pack_select_from_persons);
     tcase_add_test(tc, exec_precompiled_update_persons);
     tcase_add_test(tc, exec_precompiled_delete_from_persons);
     tcase_add_test(tc, exec_precompiled_insert_into_persons);
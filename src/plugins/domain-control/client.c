@@ -57,8 +57,11 @@
  * a pending request
  */
 
-typedef struct {
-    mrp_list_hook_t         hook;        /* hook to pending request queue */
+#define PENDING_MIN 16                   /* initial size of pending ring */
+
+typedef struct domctl_pending_s {
+    mrp_list_hook_t         hook;        /* to held or coalesced requests */
+    mrp_list_hook_t         merged;      /* requests coalesced into this one */
     uint32_t                seqno;       /* sequence number/request id */
     int                     invoke : 1;  /* whether a pending invocation */
     union {
@@ -90,7 +93,14 @@ static void closed_cb(mrp_transport_t *t, int error, void *user_data);
 
 static int queue_pending(mrp_domctl_t *dc, uint32_t seq,
                          mrp_domctl_status_cb_t cb, void *user_data);
+static pending_request_t *alloc_pending(int invoke, void *cb, void *user_data);
+static void free_pending(pending_request_t *pending);
+static int insert_pending(mrp_domctl_t *dc, pending_request_t *pending);
 static int notify_pending(mrp_domctl_t *dc, msg_t *msg);
+static int hold_data(mrp_domctl_t *dc, mrp_domctl_data_t *tables, int ntable,
+                     mrp_domctl_status_cb_t cb, void *user_data);
+static int must_hold(mrp_domctl_t *dc, mrp_domctl_data_t *tables, int ntable);
+static int flush_held(mrp_domctl_t *dc, int force);
 static int queue_invoke(mrp_domctl_t *dc, uint32_t seq,
                         mrp_domctl_return_cb_t cb, void *user_data);
 static void purge_pending(mrp_domctl_t *dc);
@@ -112,16 +122,22 @@ mrp_domctl_t *mrp_domctl_create(const char *name, mrp_mainloop_t *ml,
     dc = mrp_allocz(sizeof(*dc));
 
     if (dc != NULL) {
-        mrp_list_init(&dc->pending);
+        mrp_list_init(&dc->held_reqs);
         dc->ml = ml;
 
         dc->name    = mrp_strdup(name);
         dc->tables  = mrp_allocz_array(typeof(*dc->tables) , ntable);
         dc->watches = mrp_allocz_array(typeof(*dc->watches), nwatch);
+        dc->cache   = mrp_allocz_array(typeof(*dc->cache)  , nwatch);
+        dc->mirrors = mrp_allocz_array(typeof(*dc->mirrors), nwatch);
+        dc->held    = mrp_allocz_array(typeof(*dc->held)   , ntable);
 
         if (dc->name != NULL &&
             (dc->tables  != NULL || ntable == 0) &&
-            (dc->watches != NULL || nwatch == 0)) {
+            (dc->watches != NULL || nwatch == 0) &&
+            (dc->cache   != NULL || nwatch == 0) &&
+            (dc->mirrors != NULL || nwatch == 0) &&
+            (dc->held    != NULL || ntable == 0)) {
             for (i = 0; i < ntable; i++) {
                 st = tables + i;
                 dt = dc->tables + i;
@@ -144,6 +160,8 @@ mrp_domctl_t *mrp_domctl_create(const char *name, mrp_mainloop_t *ml,
                 dw->mql_columns = mrp_strdup(sw->mql_columns);
                 dw->mql_where   = mrp_strdup(sw->mql_where ? sw->mql_where:"");
                 dw->max_rows    = sw->max_rows;
+                dw->min_interval = sw->min_interval;
+                dw->max_latency  = sw->max_latency;
 
                 if (!dw->table || !dw->mql_columns || !dw->mql_where)
                     break;
@@ -168,6 +186,9 @@ mrp_domctl_t *mrp_domctl_create(const char *name, mrp_mainloop_t *ml,
 }
 
 
+static void clear_cache(domctl_cache_t *c);
+
+
 static void destroy_domctl(mrp_domctl_t *dc)
 {
     int i;
@@ -180,6 +201,7 @@ static void destroy_domctl(mrp_domctl_t *dc)
         mrp_free((char *)dc->tables[i].mql_index);
     }
     mrp_free(dc->tables);
+    mrp_free(dc->held);
 
     for (i = 0; i < dc->nwatch; i++) {
         mrp_free((char *)dc->watches[i].table);
@@ -188,6 +210,19 @@ static void destroy_domctl(mrp_domctl_t *dc)
     }
     mrp_free(dc->watches);
 
+    if (dc->cache != NULL) {
+        for (i = 0; i < dc->nwatch; i++)
+            clear_cache(dc->cache + i);
+        mrp_free(dc->cache);
+    }
+
+    if (dc->mirrors != NULL) {
+        for (i = 0; i < dc->nwatch; i++)
+            if (dc->mirrors[i].name != NULL)
+                mirror_close(dc->mirrors + i);
+        mrp_free(dc->mirrors);
+    }
+
     mrp_free(dc->name);
     mrp_free(dc);
 }
@@ -217,6 +252,9 @@ void mrp_domctl_destroy(mrp_domctl_t *dc)
 static void notify_disconnect(mrp_domctl_t *dc, uint32_t errcode,
                               const char *errmsg)
 {
+    /* requests in flight or held back will never be answered */
+    purge_pending(dc);
+
     DOMCTL_MARK_BUSY(dc, {
             dc->connected = FALSE;
             dc->connect_cb(dc, FALSE, errcode, errmsg, dc->user_data);
@@ -247,6 +285,11 @@ static int domctl_register(mrp_domctl_t *dc)
     reg.ntable  = dc->ntable;
     reg.watches = dc->watches;
     reg.nwatch  = dc->nwatch;
+    reg.flags   = MSG_REGISTER_DELTA | MSG_REGISTER_PACKED;
+
+    /* only clients on the same host can read our mirrors */
+    if (dc->ttype != NULL && !strcmp(dc->ttype, "unxs"))
+        reg.flags |= MSG_REGISTER_MIRROR;
 
     msg = msg_encode_message((msg_t *)&reg);
 
@@ -354,17 +397,59 @@ void mrp_domctl_disconnect(mrp_domctl_t *dc)
         dc->t         = NULL;
         dc->connected = FALSE;
     }
+
+    purge_pending(dc);
 }
 
 
-int mrp_domctl_set_data(mrp_domctl_t *dc, mrp_domctl_data_t *tables, int ntable,
-                     mrp_domctl_status_cb_t cb, void *user_data)
+int mrp_domctl_set_pipelining(mrp_domctl_t *dc, int window, int coalesce)
+{
+    if (window < 0)
+        return FALSE;
+
+    dc->window   = window;
+    dc->coalesce = coalesce ? TRUE : FALSE;
+
+    return flush_held(dc, FALSE);
+}
+
+
+static int send_data(mrp_domctl_t *dc, mrp_domctl_data_t *tables, int ntable,
+                     uint32_t seq)
 {
     set_msg_t  set;
     mrp_msg_t *msg;
-    uint32_t   seq = dc->seqno++;
     int        success, i;
 
+    mrp_clear(&set);
+    set.type   = MSG_TYPE_SET;
+    set.seq    = seq;
+    set.tables = tables;
+    set.ntable = ntable;
+
+    msg = msg_encode_message((msg_t *)&set);
+
+    if (msg != NULL) {
+        success = mrp_transport_send(dc->t, msg);
+        mrp_msg_unref(msg);
+
+        if (success)
+            for (i = 0; i < ntable; i++)
+                dc->held[tables[i].id].seq = seq;
+
+        return success;
+    }
+    else
+        return FALSE;
+}
+
+
+int mrp_domctl_set_data(mrp_domctl_t *dc, mrp_domctl_data_t *tables, int ntable,
+                     mrp_domctl_status_cb_t cb, void *user_data)
+{
+    uint32_t seq;
+    int      success, i;
+
     if (!dc->connected)
         return FALSE;
 
@@ -373,13 +458,49 @@ int mrp_domctl_set_data(mrp_domctl_t *dc, mrp_domctl_data_t *tables, int ntable,
             return FALSE;
     }
 
-    mrp_clear(&set);
-    set.type   = MSG_TYPE_SET;
-    set.seq    = seq;
-    set.tables = tables;
-    set.ntable = ntable;
+    if (must_hold(dc, tables, ntable))
+        return hold_data(dc, tables, ntable, cb, user_data);
 
-    msg = msg_encode_message((msg_t *)&set);
+    seq     = dc->seqno++;
+    success = send_data(dc, tables, ntable, seq);
+
+    if (success)
+        queue_pending(dc, seq, cb, user_data);
+
+    return success;
+}
+
+
+int mrp_domctl_update_data(mrp_domctl_t *dc, mrp_domctl_delta_t *tables,
+                           int ntable, mrp_domctl_status_cb_t cb,
+                           void *user_data)
+{
+    update_msg_t  update;
+    mrp_msg_t    *msg;
+    uint32_t      seq;
+    int           success, i;
+
+    if (!dc->connected)
+        return FALSE;
+
+    for (i = 0; i < ntable; i++) {
+        if (tables[i].id < 0 || tables[i].id >= dc->ntable)
+            return FALSE;
+    }
+
+    /* deltas must not overtake held back data */
+    if (!flush_held(dc, TRUE))
+        return FALSE;
+
+    seq = dc->seqno++;
+
+    mrp_clear(&update);
+    update.type   = MSG_TYPE_UPDATE;
+    update.seq    = seq;
+    update.tables = tables;
+    update.ntable = ntable;
+
+    msg = msg_encode_message((msg_t *)&update);
 
     if (msg != NULL) {
         success = mrp_transport_send(dc->t, msg);
@@ -401,7 +522,7 @@ int mrp_domctl_invoke(mrp_domctl_t *dc, const char *name, int narg,
 {
     invoke_msg_t  invoke;
     mrp_msg_t    *msg;
-    uint32_t      seq = dc->seqno++;
+    uint32_t      seq;
     int           success;
 
     if (!dc->connected)
@@ -410,6 +531,12 @@ int mrp_domctl_invoke(mrp_domctl_t *dc, const char *name, int narg,
     if (reply_cb == NULL && user_data != NULL)
         return FALSE;
 
+    /* let the invoked method see any held back data */
+    if (!flush_held(dc, TRUE))
+        return FALSE;
+
+    seq = dc->seqno++;
+
     mrp_clear(&invoke);
     invoke.type  = MSG_TYPE_INVOKE;
     invoke.seq   = seq;
@@ -500,9 +627,349 @@ static void process_nak(mrp_domctl_t *dc, nak_msg_t *nak)
 }
 
 
+static void free_row(mrp_domctl_value_t *row, int ncolumn)
+{
+    int i;
+
+    if (row != NULL) {
+        for (i = 0; i < ncolumn; i++)
+            if (row[i].type == MRP_DOMCTL_STRING)
+                mrp_free((char *)row[i].str);
+
+        mrp_free(row);
+    }
+}
+
+
+static void clear_cache(domctl_cache_t *c)
+{
+    int i;
+
+    for (i = 0; i < c->nrow; i++)
+        free_row(c->rows[i], c->ncolumn);
+
+    mrp_free(c->rows);
+
+    c->rows   = NULL;
+    c->nrow   = 0;
+    c->nalloc = 0;
+    c->valid  = FALSE;
+}
+
+
+static int copy_columns(mrp_domctl_value_t *dst, mrp_domctl_value_t *src,
+                        int ncolumn, uint32_t mask)
+{
+    char *str;
+    int   i;
+
+    for (i = 0; i < ncolumn; i++) {
+        if (i < 32 && !(mask & (1U << i)))
+            continue;
+
+        if (src[i].type == MRP_DOMCTL_STRING) {
+            if ((str = mrp_strdup(src[i].str)) == NULL)
+                return FALSE;
+        }
+        else
+            str = NULL;
+
+        if (dst[i].type == MRP_DOMCTL_STRING)
+            mrp_free((char *)dst[i].str);
+
+        dst[i] = src[i];
+
+        if (str != NULL)
+            dst[i].str = str;
+    }
+
+    return TRUE;
+}
+
+
+static int add_row(domctl_cache_t *c, mrp_domctl_value_t *src)
+{
+    mrp_domctl_value_t  *row;
+    int                  nalloc;
+
+    if (c->nrow >= c->nalloc) {
+        nalloc = c->nalloc ? 2 * c->nalloc : 16;
+
+        if (!mrp_reallocz(c->rows, c->nalloc, nalloc))
+            return FALSE;
+
+        c->nalloc = nalloc;
+    }
+
+    if ((row = mrp_allocz_array(mrp_domctl_value_t, c->ncolumn)) == NULL)
+        return FALSE;
+
+    if (!copy_columns(row, src, c->ncolumn, (uint32_t)-1)) {
+        free_row(row, c->ncolumn);
+        return FALSE;
+    }
+
+    c->rows[c->nrow++] = row;
+
+    return TRUE;
+}
+
+
+static int same_key(mrp_domctl_value_t *a, mrp_domctl_value_t *b, int ncolumn,
+                    uint32_t keymask)
+{
+    int i;
+
+    for (i = 0; i < ncolumn && i < 32; i++) {
+        if (!(keymask & (1U << i)))
+            continue;
+
+        if (a[i].type != b[i].type)
+            return FALSE;
+
+        switch (a[i].type) {
+        case MRP_DOMCTL_STRING:
+            if (strcmp(a[i].str, b[i].str))
+                return FALSE;
+            break;
+        case MRP_DOMCTL_INTEGER:
+            if (a[i].s32 != b[i].s32)
+                return FALSE;
+            break;
+        case MRP_DOMCTL_UNSIGNED:
+            if (a[i].u32 != b[i].u32)
+                return FALSE;
+            break;
+        case MRP_DOMCTL_DOUBLE:
+            if (a[i].dbl != b[i].dbl)
+                return FALSE;
+            break;
+        default:
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static int find_row(domctl_cache_t *c, mrp_domctl_value_t *key,
+                    uint32_t keymask)
+{
+    int i;
+
+    for (i = 0; i < c->nrow; i++)
+        if (same_key(c->rows[i], key, c->ncolumn, keymask))
+            return i;
+
+    return -1;
+}
+
+
+static int replace_cache(domctl_cache_t *c, mrp_domctl_data_t *d,
+                         uint32_t seq)
+{
+    int i;
+
+    clear_cache(c);
+    c->ncolumn = d->ncolumn;
+
+    for (i = 0; i < d->nrow; i++) {
+        if (!add_row(c, d->rows[i])) {
+            clear_cache(c);
+            return FALSE;
+        }
+    }
+
+    c->seq   = seq;
+    c->valid = TRUE;
+
+    return TRUE;
+}
+
+
+static int apply_changes(domctl_cache_t *c, mrp_domctl_data_t *d,
+                         notify_delta_t *nd)
+{
+    mrp_domctl_value_t *row;
+    int                 i, r;
+
+    if (!c->valid || nd->seq != c->seq + 1 || d->ncolumn != c->ncolumn)
+        return FALSE;
+
+    for (i = 0; i < d->nrow; i++) {
+        row = d->rows[i];
+        r   = find_row(c, row, nd->keymask);
+
+        switch (nd->ops[i]) {
+        case MRP_DOMCTL_ROW_INSERT:
+            if (r >= 0) {
+                if (!copy_columns(c->rows[r], row, c->ncolumn, (uint32_t)-1))
+                    return FALSE;
+            }
+            else {
+                if (!add_row(c, row))
+                    return FALSE;
+            }
+            break;
+
+        case MRP_DOMCTL_ROW_UPDATE:
+            if (r < 0)
+                return FALSE;
+            if (!copy_columns(c->rows[r], row, c->ncolumn, nd->colmask[i]))
+                return FALSE;
+            break;
+
+        case MRP_DOMCTL_ROW_DELETE:
+            if (r >= 0) {
+                free_row(c->rows[r], c->ncolumn);
+                c->rows[r] = c->rows[--c->nrow];
+                c->rows[c->nrow] = NULL;
+            }
+            break;
+
+        default:
+            return FALSE;
+        }
+    }
+
+    c->seq = nd->seq;
+
+    return TRUE;
+}
+
+
+static void request_resync(mrp_domctl_t *dc)
+{
+    resync_msg_t  resync;
+    mrp_msg_t    *msg;
+
+    mrp_clear(&resync);
+    resync.type = MSG_TYPE_RESYNC;
+    resync.seq  = 0;
+
+    msg = msg_encode_message((msg_t *)&resync);
+
+    if (msg != NULL) {
+        mrp_transport_send(dc->t, msg);
+        mrp_msg_unref(msg);
+    }
+}
+
+
+/*
+ * For a mirrored table the server only tells us the name of the mirror
+ * and the generation of the latest data. Copy the data out of the mirror
+ * and replace our cached contents with it.
+ */
+static int read_mirror(mrp_domctl_t *dc, domctl_cache_t *c, int id,
+                       notify_mirror_t *nm)
+{
+    mirror_shm_t      *m = dc->mirrors + id;
+    mrp_domctl_data_t  d;
+    void              *blob;
+    size_t             size;
+    uint32_t           gen;
+    int                ok;
+
+    if (m->name != NULL && strcmp(m->name, nm->name))
+        mirror_close(m);
+
+    if (m->name == NULL && !mirror_open(m, nm->name))
+        return FALSE;
+
+    if ((blob = mirror_read(m, &size, &gen)) == NULL)
+        return FALSE;
+
+    /*
+     * We might get already newer data than what we were notified about.
+     * That's fine, we'll just get the same data again with the next one.
+     */
+    if ((int32_t)(gen - nm->gen) < 0) {
+        mrp_free(blob);
+        return FALSE;
+    }
+
+    mrp_clear(&d);
+
+    if ((ok = msg_decode_packed(blob, size, &d))) {
+        d.id = id;
+        ok   = replace_cache(c, &d, c->seq);
+
+        if (d.rows != NULL)
+            mrp_free(d.rows[0]);
+        mrp_free(d.rows);
+    }
+
+    mrp_free(blob);
+
+    return ok;
+}
+
+
 static void process_notify(mrp_domctl_t *dc, notify_msg_t *notify)
 {
-    dc->watch_cb(dc, notify->tables, notify->ntable, dc->user_data);
+    mrp_domctl_data_t *tables, *d;
+    notify_delta_t    *nd;
+    domctl_cache_t    *c;
+    int                ntable, resync, ok, i;
+
+    if (notify->deltas == NULL && notify->mirrors == NULL) {
+        dc->watch_cb(dc, notify->tables, notify->ntable, dc->user_data);
+        return;
+    }
+
+    /*
+     * The server sends us either the full contents of a watched table or
+     * the rows changed since the last notification. Keep the contents of
+     * our watches cached, apply any changes to them, and pass the watch
+     * callback always the full set of rows. If we ever miss a change, we
+     * ask the server to resync us with full notifications.
+     */
+
+    tables = alloca(notify->ntable * sizeof(*tables));
+    ntable = 0;
+    resync = FALSE;
+
+    for (i = 0; i < notify->ntable; i++) {
+        d  = notify->tables + i;
+        nd = notify->deltas ? notify->deltas + i : NULL;
+
+        if (d->id < 0 || d->id >= dc->nwatch)
+            continue;
+
+        c = dc->cache + d->id;
+
+        if (notify->mirrors != NULL && notify->mirrors[i].name != NULL)
+            ok = read_mirror(dc, c, d->id, notify->mirrors + i);
+        else if (nd == NULL)
+            ok = replace_cache(c, d, c->seq);
+        else if (nd->full)
+            ok = replace_cache(c, d, nd->seq);
+        else
+            ok = apply_changes(c, d, nd);
+
+        if (!ok) {
+            mrp_log_warning("Domain controller out of sync for table %s.",
+                            dc->watches[d->id].table);
+            c->valid = FALSE;
+            resync   = TRUE;
+            continue;
+        }
+
+        tables[ntable].id      = d->id;
+        tables[ntable].coldefs = NULL;
+        tables[ntable].ncolumn = c->ncolumn;
+        tables[ntable].rows    = c->rows;
+        tables[ntable].nrow    = c->nrow;
+        ntable++;
+    }
+
+    if (resync)
+        request_resync(dc);
+
+    if (ntable > 0)
+        dc->watch_cb(dc, tables, ntable, dc->user_data);
 }
 
 
@@ -675,8 +1142,7 @@ static void closed_cb(mrp_transport_t *t, int error, void *user_data)
 }
 
 
-static int queue_pending(mrp_domctl_t *dc, uint32_t seq,
-                         mrp_domctl_status_cb_t cb, void *user_data)
+static pending_request_t *alloc_pending(int invoke, void *cb, void *user_data)
 {
     pending_request_t *pending;
 
@@ -684,85 +1150,202 @@ static int queue_pending(mrp_domctl_t *dc, uint32_t seq,
 
     if (pending != NULL) {
         mrp_list_init(&pending->hook);
+        mrp_list_init(&pending->merged);
 
-        pending->invoke    = false;
-        pending->seqno     = seq;
-        pending->cb.status = cb;
+        pending->invoke    = invoke ? true : false;
         pending->user_data = user_data;
 
-        mrp_list_append(&dc->pending, &pending->hook);
+        if (invoke)
+            pending->cb.ret    = cb;
+        else
+            pending->cb.status = cb;
+    }
 
-        return TRUE;
+    return pending;
+}
+
+
+static void free_pending(pending_request_t *pending)
+{
+    mrp_list_hook_t   *p, *n;
+    pending_request_t *merged;
+
+    mrp_list_foreach(&pending->merged, p, n) {
+        merged = mrp_list_entry(p, typeof(*merged), hook);
+
+        mrp_list_delete(&merged->hook);
+        mrp_free(merged);
+    }
+
+    mrp_list_delete(&pending->hook);
+    mrp_free(pending);
+}
+
+
+/*
+ * Outstanding requests are kept in a ring indexed by sequence number. The
+ * ring is grown (and rehashed) whenever a new request would collide with a
+ * much older one that is still unanswered.
+ */
+
+static int insert_pending(mrp_domctl_t *dc, pending_request_t *pending)
+{
+    pending_request_t **ring;
+    uint32_t            size, slot, i;
+
+    if (dc->npending > 0) {
+        slot = pending->seqno & (dc->npending - 1);
+
+        if (dc->pending[slot] == NULL) {
+            dc->pending[slot] = pending;
+            dc->ninflight++;
+
+            return TRUE;
+        }
+
+        size = 2 * dc->npending;
     }
     else
+        size = PENDING_MIN;
+
+ retry:
+    if ((ring = mrp_allocz_array(pending_request_t *, size)) == NULL)
         return FALSE;
+
+    for (i = 0; i < dc->npending; i++) {
+        if (dc->pending[i] == NULL)
+            continue;
+
+        slot = dc->pending[i]->seqno & (size - 1);
+
+        if (ring[slot] != NULL) {
+            mrp_free(ring);
+            size *= 2;
+            goto retry;
+        }
+
+        ring[slot] = dc->pending[i];
+    }
+
+    slot = pending->seqno & (size - 1);
+
+    if (ring[slot] != NULL) {
+        mrp_free(ring);
+        size *= 2;
+        goto retry;
+    }
+
+    ring[slot] = pending;
+
+    mrp_free(dc->pending);
+    dc->pending  = ring;
+    dc->npending = size;
+    dc->ninflight++;
+
+    return TRUE;
+}
+
+
+static pending_request_t *lookup_pending(mrp_domctl_t *dc, uint32_t seq)
+{
+    pending_request_t *pending;
+
+    if (dc->npending == 0)
+        return NULL;
+
+    pending = dc->pending[seq & (dc->npending - 1)];
+
+    if (pending == NULL || pending->seqno != seq)
+        return NULL;
+
+    return pending;
+}
+
+
+static pending_request_t *remove_pending(mrp_domctl_t *dc, uint32_t seq)
+{
+    pending_request_t *pending;
+
+    if ((pending = lookup_pending(dc, seq)) != NULL) {
+        dc->pending[seq & (dc->npending - 1)] = NULL;
+        dc->ninflight--;
+    }
+
+    return pending;
+}
+
+
+static int queue_pending(mrp_domctl_t *dc, uint32_t seq,
+                         mrp_domctl_status_cb_t cb, void *user_data)
+{
+    pending_request_t *pending;
+
+    pending = alloc_pending(false, cb, user_data);
+
+    if (pending != NULL) {
+        pending->seqno = seq;
+
+        if (insert_pending(dc, pending))
+            return TRUE;
+
+        mrp_free(pending);
+    }
+
+    return FALSE;
+}
+
+
+static void complete_request(mrp_domctl_t *dc, pending_request_t *pending,
+                             msg_t *msg)
+{
+    if (!pending->invoke) {
+        if (pending->cb.status == NULL)
+            return;
+
+        if (msg->any.type == MSG_TYPE_ACK)
+            pending->cb.status(dc, 0, NULL, pending->user_data);
+        else
+            pending->cb.status(dc, msg->nak.error, msg->nak.msg,
+                               pending->user_data);
+    }
+    else
+        pending->cb.ret(dc, msg->ret.error, msg->ret.retval,
+                        msg->ret.narg, msg->ret.args, pending->user_data);
 }
 
 
 static int notify_pending(mrp_domctl_t *dc, msg_t *msg)
 {
     mrp_list_hook_t   *p, *n;
-    pending_request_t *pending;
-    uint32_t           seq;
-    int                error, status;
-    const char        *message;
-    int                narg;
-    mrp_domctl_arg_t  *args;
+    pending_request_t *pending, *merged;
     int                success;
 
-    seq = msg->any.seq;
+    if ((pending = remove_pending(dc, msg->any.seq)) == NULL)
+        return FALSE;
 
-    mrp_list_foreach(&dc->pending, p, n) {
-        pending = mrp_list_entry(p, typeof(*pending), hook);
+    if (!pending->invoke)
+        success = (msg->any.type == MSG_TYPE_ACK ||
+                   msg->any.type == MSG_TYPE_NAK);
+    else
+        success = (msg->any.type == MSG_TYPE_RETURN);
 
-        if (pending->seqno != seq)
-            continue;
+    DOMCTL_MARK_BUSY(dc, {
+            if (success) {
+                complete_request(dc, pending, msg);
 
-        if (!pending->invoke) {
-            switch (msg->any.type) {
-            case MSG_TYPE_ACK:
-                error   = 0;
-                message = NULL;
-                goto notify;
-            case MSG_TYPE_NAK:
-                error   = msg->nak.error;
-                message = msg->nak.msg;
-            notify:
-                DOMCTL_MARK_BUSY(dc, {
-                        pending->cb.status(dc, error, message,
-                                           pending->user_data);
-                    });
-                success = TRUE;
-                break;
-            default:
-                success = FALSE;
-                break;
-            }
-        }
-        else {
-            if (msg->any.type == MSG_TYPE_RETURN) {
-                error  = msg->ret.error;
-                status = msg->ret.retval;
-                narg   = msg->ret.narg;
-                args   = msg->ret.args;
-
-                DOMCTL_MARK_BUSY(dc, {
-                        pending->cb.ret(dc, error, status, narg, args,
-                                        pending->user_data);
-                    });
-                success = TRUE;
+                mrp_list_foreach(&pending->merged, p, n) {
+                    merged = mrp_list_entry(p, typeof(*merged), hook);
+                    complete_request(dc, merged, msg);
+                }
             }
-            else
-                success = FALSE;
-        }
 
-        mrp_list_delete(&pending->hook);
-        mrp_free(pending);
+            free_pending(pending);
 
-        return success;
-    }
+            if (!dc->destroyed && dc->connected)
+                flush_held(dc, FALSE);
+        });
 
-    return FALSE;
+    return success;
 }
 
 
@@ -774,22 +1357,18 @@ static int queue_invoke(mrp_domctl_t *dc, uint32_t seq,
     if (cb == NULL)
         return TRUE;
 
-    pending = mrp_allocz(sizeof(*pending));
+    pending = alloc_pending(true, cb, user_data);
 
     if (pending != NULL) {
-        mrp_list_init(&pending->hook);
+        pending->seqno = seq;
 
-        pending->invoke    = true;
-        pending->seqno     = seq;
-        pending->cb.ret    = cb;
-        pending->user_data = user_data;
-
-        mrp_list_append(&dc->pending, &pending->hook);
+        if (insert_pending(dc, pending))
+            return TRUE;
 
-        return TRUE;
+        mrp_free(pending);
     }
-    else
-        return FALSE;
+
+    return FALSE;
 }
 
 
@@ -797,11 +1376,172 @@ static void purge_pending(mrp_domctl_t *dc)
 {
     mrp_list_hook_t   *p, *n;
     pending_request_t *pending;
+    uint32_t           i;
+
+    for (i = 0; i < dc->npending; i++)
+        if (dc->pending[i] != NULL)
+            free_pending(dc->pending[i]);
+
+    mrp_free(dc->pending);
+    dc->pending   = NULL;
+    dc->npending  = 0;
+    dc->ninflight = 0;
 
-    mrp_list_foreach(&dc->pending, p, n) {
+    mrp_list_foreach(&dc->held_reqs, p, n) {
         pending = mrp_list_entry(p, typeof(*pending), hook);
+        free_pending(pending);
+    }
+
+    for (i = 0; i < (uint32_t)dc->ntable; i++) {
+        clear_cache(&dc->held[i].data);
+        dc->held[i].seq = 0;
+    }
+
+    dc->nheld = 0;
+}
+
+
+/*
+ * With pipelining set up, set requests which do not fit the window, or
+ * which would update a table with a set request already in flight, are
+ * held back. Held back data is kept per table, so any later data for the
+ * same table simply replaces the earlier one, and the whole lot is sent
+ * as a single request once the requests in the way get answered.
+ */
+
+static int table_in_flight(mrp_domctl_t *dc, int id)
+{
+    uint32_t seq = dc->held[id].seq;
+
+    return seq != 0 && lookup_pending(dc, seq) != NULL;
+}
+
+
+static int must_hold(mrp_domctl_t *dc, mrp_domctl_data_t *tables, int ntable)
+{
+    int i, id;
+
+    if (dc->window > 0 && dc->ninflight >= dc->window)
+        return TRUE;
+
+    for (i = 0; i < ntable; i++) {
+        id = tables[i].id;
+
+        if (dc->held[id].data.valid)
+            return TRUE;
+
+        if (dc->coalesce && table_in_flight(dc, id))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+static int hold_data(mrp_domctl_t *dc, mrp_domctl_data_t *tables, int ntable,
+                     mrp_domctl_status_cb_t cb, void *user_data)
+{
+    pending_request_t *pending;
+    domctl_cache_t    *held;
+    int                i;
+
+    if ((pending = alloc_pending(false, cb, user_data)) == NULL)
+        return FALSE;
+
+    for (i = 0; i < ntable; i++) {
+        held = &dc->held[tables[i].id].data;
+
+        if (!held->valid)
+            dc->nheld++;
+
+        if (!replace_cache(held, tables + i, 0)) {
+            dc->nheld--;
+            mrp_free(pending);
+            return FALSE;
+        }
+    }
+
+    mrp_list_append(&dc->held_reqs, &pending->hook);
+
+    return TRUE;
+}
+
+
+static int flush_held(mrp_domctl_t *dc, int force)
+{
+    mrp_domctl_data_t *tables;
+    pending_request_t *pending, *merged;
+    mrp_list_hook_t   *p, *n;
+    domctl_cache_t    *held;
+    uint32_t           seq;
+    int                ntable, i;
+
+    if (dc->nheld == 0)
+        return TRUE;
+
+    if (!force) {
+        if (dc->window > 0 && dc->ninflight >= dc->window)
+            return TRUE;
+
+        for (i = 0; i < dc->ntable; i++)
+            if (dc->held[i].data.valid && dc->coalesce &&
+                table_in_flight(dc, i))
+                return TRUE;
+    }
 
+    if (!dc->connected)
+        return FALSE;
+
+    tables = alloca(dc->nheld * sizeof(*tables));
+
+    for (i = ntable = 0; i < dc->ntable; i++) {
+        held = &dc->held[i].data;
+
+        if (!held->valid)
+            continue;
+
+        mrp_clear(tables + ntable);
+        tables[ntable].id      = i;
+        tables[ntable].ncolumn = held->ncolumn;
+        tables[ntable].rows    = held->rows;
+        tables[ntable].nrow    = held->nrow;
+        ntable++;
+    }
+
+    seq = dc->seqno++;
+
+    if (!send_data(dc, tables, ntable, seq))
+        return FALSE;
+
+    /* attach all held requests to the first one */
+    if (!mrp_list_empty(&dc->held_reqs)) {
+        pending = mrp_list_entry(dc->held_reqs.next, typeof(*pending), hook);
         mrp_list_delete(&pending->hook);
-        mrp_free(pending);
     }
+    else
+        pending = alloc_pending(false, NULL, NULL);
+
+    for (i = 0; i < dc->ntable; i++)
+        clear_cache(&dc->held[i].data);
+
+    dc->nheld = 0;
+
+    if (pending == NULL)
+        return FALSE;
+
+    pending->seqno = seq;
+
+    mrp_list_foreach(&dc->held_reqs, p, n) {
+        merged = mrp_list_entry(p, typeof(*merged), hook);
+
+        mrp_list_delete(&merged->hook);
+        mrp_list_append(&pending->merged, &merged->hook);
+    }
+
+    if (!insert_pending(dc, pending)) {
+        free_pending(pending);
+        return FALSE;
+    }
+
+    return TRUE;
 }
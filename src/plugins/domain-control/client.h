@@ -63,6 +63,8 @@ typedef struct {
     const char *mql_columns;             /* column list for select */
     const char *mql_where;               /* where clause for select */
     int         max_rows;                /* max number of rows to select */
+    uint32_t    min_interval;            /* min. msecs between notifications */
+    uint32_t    max_latency;             /* msecs to coalesce changes for */
 } mrp_domctl_watch_t;
 
 #define MRP_DOMCTL_WATCH(_table, _columns, _where, _max_rows) {       \
@@ -72,6 +74,22 @@ typedef struct {
         .max_rows    = _max_rows               ,                      \
     }
 
+/*
+ * A rate-limited watch of a frequently changing table. Changes to the
+ * table are coalesced for max_latency milliseconds after the first one
+ * and notifications are sent at least min_interval milliseconds apart.
+ * Either way, only the latest state of the table is sent.
+ */
+#define MRP_DOMCTL_WATCH_RATE(_table, _columns, _where, _max_rows,    \
+                              _min_interval, _max_latency) {          \
+        .table        = _table                  ,                     \
+        .mql_columns  = _columns ? _columns : "",                     \
+        .mql_where    = _where   ? _where   : "",                     \
+        .max_rows     = _max_rows               ,                     \
+        .min_interval = _min_interval           ,                     \
+        .max_latency  = _max_latency            ,                     \
+    }
+
 
 /*
  * table data
@@ -86,6 +104,30 @@ typedef struct {
 } mrp_domctl_data_t;
 
 
+/*
+ * incremental table updates
+ *
+ * Rows to update or delete are looked up by the index columns of the
+ * table, so these operations are only possible for tables created with
+ * an index. A row is always sent in full but for deletions only its index
+ * columns are used.
+ */
+
+typedef enum {
+    MRP_DOMCTL_ROW_INSERT = 0,           /* insert a new row */
+    MRP_DOMCTL_ROW_UPDATE,               /* update a row by its index */
+    MRP_DOMCTL_ROW_DELETE,               /* delete a row by its index */
+} mrp_domctl_rowop_t;
+
+typedef struct {
+    int                  id;             /* table id */
+    int                  ncolumn;        /* columns per row */
+    mrp_domctl_value_t **rows;           /* row data */
+    mrp_domctl_rowop_t  *ops;            /* operation for each row */
+    int                  nrow;           /* number of rows */
+} mrp_domctl_delta_t;
+
+
 /** Opaque policy domain controller type. */
 typedef struct mrp_domctl_s mrp_domctl_t;
 
@@ -98,7 +140,11 @@ typedef void (*mrp_domctl_connect_cb_t)(mrp_domctl_t *dc, int connection,
 typedef void (*mrp_domctl_status_cb_t)(mrp_domctl_t *dc, int errcode,
                                        const char *errmsg, void *user_data);
 
-/** Callback type for data change notifications. */
+/**
+ * Callback type for data change notifications. Only the changed watched
+ * tables are passed to the callback, always with the full current set
+ * of rows. The order of rows is not preserved between notifications.
+ */
 typedef void (*mrp_domctl_watch_cb_t)(mrp_domctl_t *dc,
                                       mrp_domctl_data_t *tables, int ntable,
                                       void *user_data);
@@ -161,6 +207,21 @@ void mrp_domctl_disconnect(mrp_domctl_t *dc);
 int mrp_domctl_set_data(mrp_domctl_t *dc, mrp_domctl_data_t *tables, int ntable,
                         mrp_domctl_status_cb_t status_cb, void *user_data);
 
+/**
+ * Set up request pipelining. At most window requests (0 for no limit) are
+ * kept in flight, further set requests are held back until an earlier one
+ * gets acknowledged. If coalesce is non-zero, set requests for tables with
+ * an unacknowledged set request in flight are held back, too. Held back
+ * set requests are coalesced, keeping only the latest data for each table,
+ * and sent as a single request with all their callbacks attached to it.
+ */
+int mrp_domctl_set_pipelining(mrp_domctl_t *dc, int window, int coalesce);
+
+/** Incrementally update the given tables with the provided row changes. */
+int mrp_domctl_update_data(mrp_domctl_t *dc, mrp_domctl_delta_t *tables,
+                           int ntable, mrp_domctl_status_cb_t status_cb,
+                           void *user_data);
+
 /** Invoke a proxied method. */
 int mrp_domctl_invoke(mrp_domctl_t *dc, const char *method, int narg,
                       mrp_domctl_arg_t *args, mrp_domctl_return_cb_t return_cb,
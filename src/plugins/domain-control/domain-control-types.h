@@ -40,13 +40,41 @@
 #include <murphy-db/mql.h>
 
 #include "client.h"
+#include "shm-mirror.h"
 
 typedef struct pep_proxy_s pep_proxy_t;
 typedef struct pep_table_s pep_table_t;
 typedef struct pep_watch_s pep_watch_t;
+typedef struct pep_mirror_s pep_mirror_t;
 typedef struct pdp_s       pdp_t;
 typedef union  msg_u       msg_t;
 
+/*
+ * cached contents of a watched table (on the client side)
+ */
+
+typedef struct {
+    uint32_t             seq;            /* last notification sequence */
+    bool                 valid;          /* whether in sync with the server */
+    int                  ncolumn;        /* columns per row */
+    mrp_domctl_value_t **rows;           /* cached rows */
+    int                  nrow;           /* number of cached rows */
+    int                  nalloc;         /* number of allocated row slots */
+} domctl_cache_t;
+
+
+/*
+ * an owned table with data held back by request pipelining (client side)
+ */
+
+typedef struct {
+    domctl_cache_t       data;           /* held, not yet sent, table data */
+    uint32_t             seq;            /* last set request sent for table */
+} domctl_held_t;
+
+typedef struct domctl_pending_s domctl_pending_t;
+
+
 /*
  * a domain controller (on the client side)
  */
@@ -65,17 +93,41 @@ struct mrp_domctl_s {
     int                      ntable;     /* number of owned tables */
     mrp_domctl_watch_t      *watches;    /* watched tables */
     int                      nwatch;     /* number of watched tables */
+    domctl_cache_t          *cache;      /* cached watched table contents */
+    mirror_shm_t            *mirrors;    /* mirrors of watched tables */
     mrp_domctl_connect_cb_t  connect_cb; /* connection state change callback */
     mrp_domctl_watch_cb_t    watch_cb;   /* watched table change callback */
     void                    *user_data;  /* opqaue user data for callbacks */
     int                      busy;       /* non-zero if a callback is active */
     int                      destroyed:1;/* non-zero if destroy pending */
     uint32_t                 seqno;      /* request sequence number */
-    mrp_list_hook_t          pending;    /* queue of outstanding requests */
+    domctl_pending_t       **pending;    /* outstanding requests by seqno */
+    uint32_t                 npending;   /* size of pending ring */
+    int                      ninflight;  /* number of outstanding requests */
+    int                      window;     /* max. outstanding set requests */
+    int                      coalesce:1; /* hold sets of unacked tables */
+    domctl_held_t           *held;       /* held data for owned tables */
+    int                      nheld;      /* number of tables with held data */
+    mrp_list_hook_t          held_reqs;  /* held set requests */
     mrp_list_hook_t          methods;    /* registered proxied methods */
 };
 
 
+/*
+ * a changed row of a tracked table
+ */
+
+typedef struct {
+    mrp_list_hook_t     hook;            /* to list of changed rows */
+    char               *key;             /* row key as a string */
+    mrp_domctl_value_t *values;          /* row with only key columns set */
+    int                 nvalue;          /* number of columns in values */
+    mqi_bitfld_t        mask;            /* mask of changed columns */
+    int                 inserted : 1;    /* whether a row was inserted */
+    int                 deleted : 1;     /* whether a row was deleted */
+} pep_change_t;
+
+
 /*
  * a table associated with or tracked by an enforcement point
  */
@@ -89,9 +141,32 @@ struct pep_table_s {
     mqi_column_def_t   *columns;         /* column definitions */
     mqi_column_desc_t  *coldesc;         /* column descriptors */
     int                 ncolumn;         /* number of columns */
-    int                 idx_col;         /* column index of index column */
+    int                *idx_cols;        /* column indices of index columns */
+    int                 nidx_col;        /* number of index columns */
+    mqi_column_desc_t  *upddesc;         /* descriptors of non-index columns */
     mrp_list_hook_t     watches;         /* watches for this table */
     bool                changed;         /* whether has unsynced changes */
+    mrp_list_hook_t     changes;         /* changed rows since last notify */
+    mrp_htbl_t         *chash;           /* changed rows by key */
+    int                 nchange;         /* number of changed rows */
+    bool                resync;          /* changes not tracked, resync all */
+    mrp_list_hook_t     mirrors;         /* shared-memory mirrors */
+};
+
+
+/*
+ * a shared-memory mirror of a watched table selection
+ */
+
+struct pep_mirror_s {
+    mrp_list_hook_t  hook;               /* to table mirror list */
+    pep_table_t     *table;              /* table being mirrored */
+    char            *mql_columns;        /* column list to select */
+    char            *mql_where;          /* where clause for select */
+    int              refcnt;             /* number of watches using this */
+    mirror_shm_t     shm;                /* shared memory region */
+    uint32_t         gen;                /* last published generation */
+    bool             stale;              /* needs to be republished */
 };
 
 
@@ -109,6 +184,19 @@ struct pep_watch_s {
     mrp_list_hook_t  tbl_hook;           /* hook to table watch list */
     mrp_list_hook_t  pep_hook;           /* hook to proxy watch list */
     bool             notify;             /* whether to notify this watch */
+    int             *columns;            /* table columns of the selection */
+    int              ncolumn;            /* number of selected columns */
+    mqi_bitfld_t     keymask;            /* key columns in the selection */
+    int              delta;              /* can notify deltas, -1 unknown */
+    uint32_t         seq;                /* notification sequence number */
+    bool             resync;             /* needs a full notification */
+    pep_mirror_t    *mirror;             /* shared mirror, if any */
+    uint32_t         mgen;               /* last mirror generation sent */
+    uint32_t         min_interval;       /* min. msecs between notifications */
+    uint32_t         max_latency;        /* msecs to coalesce changes for */
+    uint64_t         last_notify;        /* time of last notification */
+    uint64_t         first_change;       /* time of first unsent change */
+    bool             pending;            /* has unsent (held) changes */
 };
 
 
@@ -121,6 +209,11 @@ typedef struct {
     void (*unref)(void *data);
     int  (*create_notify)(pep_proxy_t *proxy);
     int  (*update_notify)(pep_proxy_t *proxy, int tblid, mql_result_t *r);
+    int  (*full_notify)(pep_proxy_t *proxy, pep_watch_t *w, mql_result_t *r);
+    int  (*delta_notify)(pep_proxy_t *proxy, pep_watch_t *w, int nrow,
+                         mrp_domctl_rowop_t *ops, mqi_bitfld_t *masks,
+                         mrp_domctl_value_t **rows);
+    int  (*mirror_notify)(pep_proxy_t *proxy, pep_watch_t *w);
     int  (*send_notify)(pep_proxy_t *proxy);
     void (*free_notify)(pep_proxy_t *proxy);
 } proxy_ops_t;
@@ -143,6 +236,9 @@ struct pep_proxy_s {
     int                notify_ncolumn;   /* total columns in notification */
     int                notify_fail : 1;  /* notification failure */
     int                notify : 1;       /* whether has pending notifications */
+    int                delta : 1;        /* whether client takes deltas */
+    int                packed : 1;       /* whether client takes packed rows */
+    int                mirror : 1;       /* whether client reads mirrors */
 };
 
 
@@ -161,9 +257,12 @@ struct pdp_s {
     mrp_htbl_t      *watched;            /* tracked tables by name */
     mrp_deferred_t  *notify;             /* deferred notification */
     bool             notify_scheduled;   /* is notification scheduled? */
+    mrp_timer_t     *holdoff;            /* timer for held notifications */
     void            *reh;                /* resolver event handler */
     int              ractive;            /* resolver active */
     bool             rblocked;           /* resolver blocked update */
+    bool             mirror;             /* publish shared-memory mirrors */
+    uint32_t         nmirror;            /* mirrors created so far */
 };
 
 
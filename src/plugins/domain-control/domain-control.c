@@ -31,6 +31,7 @@
 
 #include <murphy/common/mm.h>
 #include <murphy/common/log.h>
+#include <murphy/common/socket-utils.h>
 #include <murphy/common/wsck-transport.h>
 
 #include <murphy/resolver/resolver.h>
@@ -113,7 +114,8 @@ static void del_resolver_trigger(pdp_t *pdp)
 
 pdp_t *create_domain_control(mrp_context_t *ctx,
                              const char *extaddr, const char *intaddr,
-                             const char *wrtaddr, const char *httpdir)
+                             const char *wrtaddr, const char *httpdir,
+                             int mirror)
 {
     pdp_t *pdp;
 
@@ -122,6 +124,7 @@ pdp_t *create_domain_control(mrp_context_t *ctx,
     if (pdp != NULL) {
         pdp->ctx     = ctx;
         pdp->address = extaddr;
+        pdp->mirror  = mirror;
 
         if (init_proxies(pdp) && init_tables(pdp)) {
 
@@ -174,6 +177,7 @@ void destroy_domain_control(pdp_t *pdp)
         destroy_transport(pdp->extt);
         destroy_transport(pdp->intt);
         destroy_transport(pdp->wrtt);
+        mrp_del_timer(pdp->holdoff);
 
         mrp_free(pdp);
     }
@@ -254,6 +258,11 @@ static void process_register(pep_proxy_t *proxy, register_msg_t *reg)
     int         error;
     const char *errmsg;
 
+    proxy->delta  = (reg->flags & MSG_REGISTER_DELTA)  ? 1 : 0;
+    proxy->packed = (reg->flags & MSG_REGISTER_PACKED) ? 1 : 0;
+    proxy->mirror = (proxy->pdp->mirror &&
+                     (reg->flags & MSG_REGISTER_MIRROR)) ? 1 : 0;
+
     if (register_proxy(proxy, reg->name, reg->tables, reg->ntable,
                        reg->watches, reg->nwatch, &error, &errmsg)) {
         msg_send_ack(proxy, reg->seq);
@@ -283,6 +292,37 @@ static void process_set(pep_proxy_t *proxy, set_msg_t *set)
 }
 
 
+static void process_update(pep_proxy_t *proxy, update_msg_t *update)
+{
+    int         error;
+    const char *errmsg;
+
+    if (update_proxy_tables(proxy, update->tables, update->ntable,
+                            &error, &errmsg)) {
+        msg_send_ack(proxy, update->seq);
+    }
+    else
+        msg_send_nak(proxy, update->seq, error, errmsg);
+}
+
+
+static void process_resync(pep_proxy_t *proxy, resync_msg_t *resync)
+{
+    mrp_list_hook_t *p, *n;
+    pep_watch_t     *w;
+
+    MRP_UNUSED(resync);
+
+    mrp_list_foreach(&proxy->watches, p, n) {
+        w = mrp_list_entry(p, typeof(*w), pep_hook);
+        w->resync = true;
+    }
+
+    proxy->notify = true;
+    schedule_notification(proxy->pdp);
+}
+
+
 static void process_invoke(pep_proxy_t *proxy, invoke_msg_t *invoke)
 {
     mrp_context_t          *ctx = proxy->pdp->ctx;
@@ -370,6 +410,12 @@ static void process_message(pep_proxy_t *proxy, msg_t *msg)
     case MSG_TYPE_SET:
         process_set(proxy, &msg->set);
         break;
+    case MSG_TYPE_UPDATE:
+        process_update(proxy, &msg->update);
+        break;
+    case MSG_TYPE_RESYNC:
+        process_resync(proxy, &msg->resync);
+        break;
     case MSG_TYPE_INVOKE:
         process_invoke(proxy, &msg->invoke);
         break;
@@ -412,7 +458,12 @@ static int invoke_handler(void *handler_data, const char *domain,
     invoke.narg  = narg;
     invoke.args  = args;
 
-    return msg_send_message(proxy, (msg_t *)&invoke);
+    if (!msg_send_message(proxy, (msg_t *)&invoke)) {
+        proxy_dequeue_pending(proxy, id, &return_cb, &user_data);
+        return FALSE;
+    }
+
+    return TRUE;
 }
 
 
@@ -444,7 +495,43 @@ static int msg_op_update_notify(pep_proxy_t *proxy, int tblid, mql_result_t *r)
 {
     int n;
 
-    n = msg_update_notify((mrp_msg_t *)proxy->notify_msg, tblid, r);
+    n = msg_update_notify((mrp_msg_t *)proxy->notify_msg, tblid, r,
+                          proxy->packed);
+
+    if (n >= 0) {
+        proxy->notify_ncolumn += n;
+        proxy->notify_ntable++;
+    }
+
+    return n;
+}
+
+
+static int msg_op_full_notify(pep_proxy_t *proxy, pep_watch_t *w,
+                              mql_result_t *r)
+{
+    int n;
+
+    n = msg_full_notify((mrp_msg_t *)proxy->notify_msg, w->id, w->seq, r,
+                        proxy->packed);
+
+    if (n >= 0) {
+        proxy->notify_ncolumn += n;
+        proxy->notify_ntable++;
+    }
+
+    return n;
+}
+
+
+static int msg_op_delta_notify(pep_proxy_t *proxy, pep_watch_t *w, int nrow,
+                               mrp_domctl_rowop_t *ops, mqi_bitfld_t *masks,
+                               mrp_domctl_value_t **rows)
+{
+    int n;
+
+    n = msg_delta_notify((mrp_msg_t *)proxy->notify_msg, w->id, w->seq,
+                         w->ncolumn, &w->keymask, nrow, ops, masks, rows);
 
     if (n >= 0) {
         proxy->notify_ncolumn += n;
@@ -455,6 +542,20 @@ static int msg_op_update_notify(pep_proxy_t *proxy, int tblid, mql_result_t *r)
 }
 
 
+static int msg_op_mirror_notify(pep_proxy_t *proxy, pep_watch_t *w)
+{
+    int n;
+
+    n = msg_mirror_notify((mrp_msg_t *)proxy->notify_msg, w->id,
+                          w->mirror->shm.name, w->mirror->gen);
+
+    if (n >= 0)
+        proxy->notify_ntable++;
+
+    return n;
+}
+
+
 static int msg_op_send_notify(pep_proxy_t *proxy)
 {
     mrp_msg_t *msg     = proxy->notify_msg;
@@ -482,6 +583,9 @@ static void msg_connect_cb(mrp_transport_t *t, void *user_data)
         .unref         = msg_op_unref_msg,
         .create_notify = msg_op_create_notify,
         .update_notify = msg_op_update_notify,
+        .full_notify   = msg_op_full_notify,
+        .delta_notify  = msg_op_delta_notify,
+        .mirror_notify = msg_op_mirror_notify,
         .send_notify   = msg_op_send_notify,
         .free_notify   = msg_op_free_notify,
     };
@@ -729,6 +833,8 @@ static mrp_transport_t *create_transport(pdp_t *pdp, const char *address)
     socklen_t            alen;
     int                  flags;
     const char          *type;
+    int                  cork = TRUE;
+    int                  fd;
 
     t    = NULL;
     alen = mrp_transport_resolve(NULL, address, &addr, sizeof(addr), &type);
@@ -759,11 +865,38 @@ static mrp_transport_t *create_transport(pdp_t *pdp, const char *address)
         flags |= MRP_TRANSPORT_MODE_CUSTOM;
     }
 
+    /* socket-activated sockets are picked by address, names can't hold ':' */
+    fd = mrp_activated_socket(NULL, &addr.any, alen);
+
+    if (fd >= 0) {
+        t = mrp_transport_create_from(pdp->ctx->ml, type, &fd, e, pdp, flags,
+                                      MRP_TRANSPORT_LISTENED);
+
+        if (t != NULL) {
+            if (e == &msg_evt)
+                mrp_transport_setopt(t, MRP_TRANSPORT_OPT_CORK, &cork);
+
+            mrp_log_info("Using socket-activated transport for '%s'.",
+                         address);
+            mrp_handover_register(NULL, &addr.any, alen);
+            return t;
+        }
+
+        mrp_log_error("Failed to use socket-activated transport '%s'.",
+                      address);
+        return NULL;
+    }
+
     t = mrp_transport_create(pdp->ctx->ml, type, e, pdp, flags);
 
     if (t != NULL) {
-        if (mrp_transport_bind(t, &addr, alen) && mrp_transport_listen(t, 4))
+        if (e == &msg_evt)
+            mrp_transport_setopt(t, MRP_TRANSPORT_OPT_CORK, &cork);
+
+        if (mrp_transport_bind(t, &addr, alen) && mrp_transport_listen(t, 0)) {
+            mrp_handover_register(NULL, &addr.any, alen);
             return t;
+        }
         else {
             mrp_log_error("Failed to bind to transport address '%s'.", address);
             mrp_transport_destroy(t);
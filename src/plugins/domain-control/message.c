@@ -92,6 +92,14 @@ mrp_msg_t *msg_encode_register(register_msg_t *reg)
         mrp_msg_append(msg, MSG_UINT16(MAXROWS, w->max_rows));
     }
 
+    mrp_msg_append(msg, MSG_UINT32(FLAGS, reg->flags));
+
+    /* rate limits trail everything else, so older servers ignore them */
+    for (i = 0, w = reg->watches; i < reg->nwatch; i++, w++) {
+        mrp_msg_append(msg, MSG_UINT32(MININTVL, w->min_interval));
+        mrp_msg_append(msg, MSG_UINT32(MAXLAT  , w->max_latency));
+    }
+
     return msg;
 }
 
@@ -104,7 +112,7 @@ msg_t *msg_decode_register(mrp_msg_t *msg)
     mrp_domctl_watch_t *w;
     char               *name, *table, *columns, *index, *where;
     uint16_t            ntable, nwatch, max_rows;
-    uint32_t            seqno;
+    uint32_t            seqno, flags, min_interval, max_latency;
     int                 i;
 
     it = NULL;
@@ -165,6 +173,22 @@ msg_t *msg_decode_register(mrp_msg_t *msg)
 
     reg->nwatch = nwatch;
 
+    /* flags are optional, older clients do not send them */
+    if (mrp_msg_iterate_get(msg, &it, MSG_UINT32(FLAGS, &flags), MSG_END))
+        reg->flags = flags;
+
+    /* so are per-watch rate limits */
+    for (i = 0, w = reg->watches; i < nwatch; i++, w++) {
+        if (!mrp_msg_iterate_get(msg, &it,
+                                 MSG_UINT32(MININTVL, &min_interval),
+                                 MSG_UINT32(MAXLAT  , &max_latency),
+                                 MSG_END))
+            break;
+
+        w->min_interval = min_interval;
+        w->max_latency  = max_latency;
+    }
+
     reg->wire       = mrp_msg_ref(msg);
     reg->unref_wire = msg_unref_wire;
 
@@ -533,6 +557,278 @@ msg_t *msg_decode_set(mrp_msg_t *msg)
 }
 
 
+void msg_free_update(msg_t *msg)
+{
+    update_msg_t *update = (update_msg_t *)msg;
+    int           values_freed, i;
+
+    if (update != NULL) {
+        values_freed = FALSE;
+        for (i = 0; i < update->ntable; i++) {
+            if (update->tables == NULL)
+                break;
+
+            if (update->tables[i].rows != NULL) {
+                if (!values_freed && update->tables[i].nrow > 0 &&
+                    update->tables[i].rows[0] != NULL) {
+                    mrp_free(update->tables[i].rows[0]);
+                    values_freed = TRUE;
+                }
+                mrp_free(update->tables[i].rows);
+            }
+            mrp_free(update->tables[i].ops);
+        }
+
+        mrp_free(update->tables);
+        unref_wire((msg_t *)update);
+        mrp_free(update);
+    }
+}
+
+
+mrp_msg_t *msg_encode_update(update_msg_t *update)
+{
+    mrp_msg_t          *msg;
+    mrp_domctl_value_t *rows, *col;
+    uint16_t            utable, utotal, tid, ncol, nrow;
+    uint8_t             op;
+    int                 i, r, c;
+
+    utable = update->ntable;
+    utotal = 0;
+
+    msg = mrp_msg_create(MSG_UINT16(MSGTYPE, MSG_TYPE_UPDATE),
+                         MSG_UINT32(MSGSEQ , update->seq),
+                         MSG_UINT16(NCHANGE, utable),
+                         MSG_UINT16(NTOTAL , 0),
+                         MSG_END);
+
+    if (msg == NULL)
+        return NULL;
+
+    for (i = 0; i < update->ntable; i++) {
+        tid  = update->tables[i].id;
+        ncol = update->tables[i].ncolumn;
+        nrow = update->tables[i].nrow;
+
+        if (!mrp_msg_append(msg, MSG_UINT16(TBLID, tid))  ||
+            !mrp_msg_append(msg, MSG_UINT16(NROW , nrow)) ||
+            !mrp_msg_append(msg, MSG_UINT16(NCOL , ncol)))
+            goto fail;
+
+        for (r = 0; r < nrow; r++) {
+            rows = update->tables[i].rows[r];
+            op   = update->tables[i].ops[r];
+
+            if (!mrp_msg_append(msg, MSG_UINT8(ROWOP, op)))
+                goto fail;
+
+            for (c = 0; c < ncol; c++) {
+                col = rows + c;
+
+#define HANDLE_TYPE(pt, t, m)                                           \
+                case MRP_DOMCTL_##pt:                                   \
+                    if (!mrp_msg_append(msg, MSG_##t(DATA,col->m)))     \
+                        goto fail;                                      \
+                    break
+
+                switch (col->type) {
+                    HANDLE_TYPE(STRING  , STRING, str);
+                    HANDLE_TYPE(INTEGER , SINT32, s32);
+                    HANDLE_TYPE(UNSIGNED, UINT32, u32);
+                    HANDLE_TYPE(DOUBLE  , DOUBLE, dbl);
+                default:
+                    goto fail;
+                }
+#undef HANDLE_TYPE
+            }
+        }
+
+        utotal += nrow * ncol;
+    }
+
+    mrp_msg_set(msg, MSG_UINT16(NTOTAL, utotal));
+
+    return msg;
+
+ fail:
+    mrp_msg_unref(msg);
+    return NULL;
+}
+
+
+msg_t *msg_decode_update(mrp_msg_t *msg)
+{
+    update_msg_t       *update;
+    void               *it;
+    mrp_domctl_delta_t *d;
+    mrp_domctl_value_t *values, *v;
+    uint64_t            columns_so_far;
+    uint32_t            seqno;
+    uint16_t            ntable, ntotal, nrow, ncol, tblid, type;
+    uint8_t             op;
+    int                 t, r, c;
+    mrp_msg_value_t     value;
+
+    it = NULL;
+    columns_so_far = 0;
+
+    if (!mrp_msg_iterate_get(msg, &it,
+                             MSG_UINT32(MSGSEQ , &seqno),
+                             MSG_UINT16(NCHANGE, &ntable),
+                             MSG_UINT16(NTOTAL , &ntotal),
+                             MSG_END))
+        return NULL;
+
+    update = mrp_allocz(sizeof(*update));
+
+    if (update == NULL)
+        return NULL;
+
+    values         = NULL;
+    update->type   = MSG_TYPE_UPDATE;
+    update->seq    = seqno;
+    update->tables = mrp_allocz(sizeof(*update->tables) * ntable);
+
+    if (update->tables == NULL && ntable != 0)
+        goto fail;
+
+    values = mrp_allocz(sizeof(*values) * ntotal);
+
+    if (values == NULL && ntotal != 0)
+        goto fail;
+
+    d = update->tables;
+    v = values;
+
+    for (t = 0; t < ntable; t++) {
+        if (!mrp_msg_iterate_get(msg, &it,
+                                 MSG_UINT16(TBLID, &tblid),
+                                 MSG_UINT16(NROW , &nrow ),
+                                 MSG_UINT16(NCOL , &ncol ),
+                                 MSG_END))
+            goto fail;
+
+        update->ntable = t + 1;
+
+        d->id      = tblid;
+        d->ncolumn = ncol;
+        d->nrow    = nrow;
+        d->rows    = mrp_allocz(sizeof(*d->rows) * nrow);
+        d->ops     = mrp_allocz(sizeof(*d->ops) * nrow);
+
+        if ((d->rows == NULL || d->ops == NULL) && nrow)
+            goto fail;
+
+        /* Check if we go over the possible total */
+        if (columns_so_far + (nrow * ncol) > ntotal)
+            goto fail;
+
+        columns_so_far += nrow * ncol;
+
+        for (r = 0; r < nrow; r++) {
+            if (!mrp_msg_iterate_get(msg, &it,
+                                     MSG_UINT8(ROWOP, &op),
+                                     MSG_END))
+                goto fail;
+
+            if (op > MRP_DOMCTL_ROW_DELETE)
+                goto fail;
+
+            d->ops[r]  = op;
+            d->rows[r] = v;
+
+            for (c = 0; c < ncol; c++) {
+                if (!mrp_msg_iterate_get(msg, &it,
+                                         MSG_ANY(DATA, &type, &value),
+                                         MSG_END))
+                    goto fail;
+
+                switch (type) {
+                case MRP_MSG_FIELD_STRING:
+                    v->type = MRP_DOMCTL_STRING;
+                    v->str  = value.str;
+                    break;
+                case MRP_MSG_FIELD_SINT32:
+                    v->type = MRP_DOMCTL_INTEGER;
+                    v->s32  = value.s32;
+                    break;
+                case MRP_MSG_FIELD_UINT32:
+                    v->type = MRP_DOMCTL_UNSIGNED;
+                    v->u32  = value.u32;
+                    break;
+                case MRP_MSG_FIELD_DOUBLE:
+                    v->type = MRP_DOMCTL_DOUBLE;
+                    v->dbl  = value.dbl;
+                    break;
+                default:
+                    goto fail;
+                }
+
+                v++;
+            }
+        }
+
+        d++;
+    }
+
+    update->wire       = mrp_msg_ref(msg);
+    update->unref_wire = msg_unref_wire;
+
+    return (msg_t *)update;
+
+ fail:
+    for (t = 0; t < update->ntable; t++) {
+        mrp_free(update->tables[t].rows);
+        update->tables[t].rows = NULL;
+    }
+    mrp_free(values);
+    msg_free_update((msg_t *)update);
+
+    return NULL;
+}
+
+
+void msg_free_resync(msg_t *msg)
+{
+    resync_msg_t *resync = (resync_msg_t *)msg;
+
+    if (resync != NULL) {
+        unref_wire(msg);
+        mrp_free(resync);
+    }
+}
+
+
+mrp_msg_t *msg_encode_resync(resync_msg_t *resync)
+{
+    return mrp_msg_create(MSG_UINT16(MSGTYPE, MSG_TYPE_RESYNC),
+                          MSG_UINT32(MSGSEQ , resync->seq),
+                          MSG_END);
+}
+
+
+msg_t *msg_decode_resync(mrp_msg_t *msg)
+{
+    resync_msg_t *resync;
+    uint32_t      seqno;
+
+    if (!mrp_msg_get(msg, MSG_UINT32(MSGSEQ, &seqno), MSG_END))
+        return NULL;
+
+    resync = mrp_allocz(sizeof(*resync));
+
+    if (resync != NULL) {
+        resync->type       = MSG_TYPE_RESYNC;
+        resync->seq        = seqno;
+        resync->wire       = mrp_msg_ref(msg);
+        resync->unref_wire = msg_unref_wire;
+    }
+
+    return (msg_t *)resync;
+}
+
+
 void msg_free_notify(msg_t *msg)
 {
     notify_msg_t *notify = (notify_msg_t *)msg;
@@ -548,9 +844,16 @@ void msg_free_notify(msg_t *msg)
                 }
                 mrp_free(notify->tables[i].rows);
             }
+
+            if (notify->deltas != NULL) {
+                mrp_free(notify->deltas[i].ops);
+                mrp_free(notify->deltas[i].colmask);
+            }
         }
 
         mrp_free(notify->tables);
+        mrp_free(notify->deltas);
+        mrp_free(notify->mirrors);
         unref_wire((msg_t *)notify);
         mrp_free(notify);
     }
@@ -575,7 +878,27 @@ mrp_msg_t *msg_create_notify(void)
 }
 
 
-int msg_update_notify(mrp_msg_t *msg, int tblid, mql_result_t *r)
+static int append_packed(mrp_msg_t *msg, mql_result_t *r)
+{
+    void   *blob;
+    size_t  size;
+    int     success;
+
+    if ((blob = mql_result_rows_pack(r, &size)) == NULL)
+        return FALSE;
+
+    success = mrp_msg_append(msg, MSG_BLOB(PACKED, size, blob));
+    mrp_debug("packed %d rows in %zu bytes",
+              mql_result_rows_get_row_count(r), size);
+
+    free(blob);
+
+    return success;
+}
+
+
+static int append_result(mrp_msg_t *msg, int tblid, int delta, uint32_t seq,
+                         mql_result_t *r, int packed)
 {
     uint16_t    tid, nrow, ncol;
     int         types[MQI_COLUMN_MAX];
@@ -598,6 +921,19 @@ int msg_update_notify(mrp_msg_t *msg, int tblid, mql_result_t *r)
         !mrp_msg_append(msg, MSG_UINT16(NCOL , ncol)))
         goto fail;
 
+    if (delta) {
+        if (!mrp_msg_append(msg, MSG_UINT32(WSEQ, seq)) ||
+            !mrp_msg_append(msg, MSG_BOOL(FULL, TRUE)))
+            goto fail;
+    }
+
+    if (packed && nrow > 0 && ncol > 0) {
+        if (!append_packed(msg, r))
+            goto fail;
+
+        return nrow * ncol;
+    }
+
     for (i = 0; i < ncol; i++)
         types[i] = mql_result_rows_get_row_column_type(r, i);
 
@@ -687,19 +1023,194 @@ int msg_update_notify(mrp_msg_t *msg, int tblid, mql_result_t *r)
 }
 
 
+int msg_update_notify(mrp_msg_t *msg, int tblid, mql_result_t *r, int packed)
+{
+    return append_result(msg, tblid, FALSE, 0, r, packed);
+}
+
+
+int msg_full_notify(mrp_msg_t *msg, int tblid, uint32_t seq, mql_result_t *r,
+                    int packed)
+{
+    return append_result(msg, tblid, TRUE, seq, r, packed);
+}
+
+
+int msg_delta_notify(mrp_msg_t *msg, int tblid, uint32_t seq, int ncol,
+                     mqi_bitfld_t *keymask, int nrow, mrp_domctl_rowop_t *ops,
+                     mqi_bitfld_t *masks, mrp_domctl_value_t **rows)
+{
+    mrp_domctl_value_t *col;
+    uint32_t            kmask, cmask;
+    uint16_t            tid, urow, ucol;
+    uint8_t             op;
+    int                 r, c;
+
+    if (ncol > MSG_DELTA_MAXCOL)
+        return -1;
+
+    tid   = tblid;
+    urow  = nrow;
+    ucol  = ncol;
+    kmask = (uint32_t)keymask->w[0];
+
+    if (!mrp_msg_append(msg, MSG_UINT16(TBLID  , tid))     ||
+        !mrp_msg_append(msg, MSG_UINT16(NROW   , urow))    ||
+        !mrp_msg_append(msg, MSG_UINT16(NCOL   , ucol))    ||
+        !mrp_msg_append(msg, MSG_UINT32(WSEQ   , seq))     ||
+        !mrp_msg_append(msg, MSG_BOOL(FULL     , FALSE))   ||
+        !mrp_msg_append(msg, MSG_UINT32(KEYMASK, kmask)))
+        goto fail;
+
+    for (r = 0; r < nrow; r++) {
+        op    = ops[r];
+        cmask = (uint32_t)masks[r].w[0];
+
+        if (!mrp_msg_append(msg, MSG_UINT8(ROWOP   , op))      ||
+            !mrp_msg_append(msg, MSG_UINT32(COLMASK, cmask)))
+            goto fail;
+
+        for (c = 0; c < ncol; c++) {
+            if (!mqi_bitfld_test(masks + r, c))
+                continue;
+
+            col = rows[r] + c;
+
+#define HANDLE_TYPE(pt, t, m)                                           \
+            case MRP_DOMCTL_##pt:                                       \
+                if (!mrp_msg_append(msg, MSG_##t(DATA, col->m)))        \
+                    goto fail;                                          \
+                break
+
+            switch (col->type) {
+                HANDLE_TYPE(STRING  , STRING, str);
+                HANDLE_TYPE(INTEGER , SINT32, s32);
+                HANDLE_TYPE(UNSIGNED, UINT32, u32);
+                HANDLE_TYPE(DOUBLE  , DOUBLE, dbl);
+            default:
+                goto fail;
+            }
+#undef HANDLE_TYPE
+        }
+    }
+
+    return nrow * ncol;
+
+ fail:
+    return -1;
+}
+
+
+int msg_mirror_notify(mrp_msg_t *msg, int tblid, const char *name,
+                      uint32_t gen)
+{
+    uint16_t tid = tblid;
+
+    if (!mrp_msg_append(msg, MSG_UINT16(TBLID , tid))  ||
+        !mrp_msg_append(msg, MSG_UINT16(NROW  , 0))    ||
+        !mrp_msg_append(msg, MSG_UINT16(NCOL  , 0))    ||
+        !mrp_msg_append(msg, MSG_STRING(MIRROR, name)) ||
+        !mrp_msg_append(msg, MSG_UINT32(MGEN  , gen)))
+        return -1;
+
+    return 0;
+}
+
+
+static int decode_packed(void *blob, size_t size, int nrow, int ncol,
+                         mrp_domctl_value_t **rows, mrp_domctl_value_t *v)
+{
+    int r, c;
+
+    if (mql_packed_rows_check(blob, size) < 0 ||
+        mql_packed_rows_get_row_count(blob) != nrow ||
+        mql_packed_rows_get_column_count(blob) != ncol)
+        return FALSE;
+
+    for (r = 0; r < nrow; r++) {
+        rows[r] = v;
+
+        for (c = 0; c < ncol; c++, v++) {
+            switch (mql_packed_rows_get_column_type(blob, c)) {
+            case mqi_string:
+                v->type = MRP_DOMCTL_STRING;
+                v->str  = mql_packed_rows_get_string(blob, c, r);
+                break;
+            case mqi_integer:
+                v->type = MRP_DOMCTL_INTEGER;
+                v->s32  = mql_packed_rows_get_integer(blob, c, r);
+                break;
+            case mqi_unsignd:
+                v->type = MRP_DOMCTL_UNSIGNED;
+                v->u32  = mql_packed_rows_get_unsigned(blob, c, r);
+                break;
+            case mqi_floating:
+                v->type = MRP_DOMCTL_DOUBLE;
+                v->dbl  = mql_packed_rows_get_floating(blob, c, r);
+                break;
+            default:
+                return FALSE;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+
+int msg_decode_packed(void *blob, size_t size, mrp_domctl_data_t *d)
+{
+    mrp_domctl_value_t *values;
+    int                 nrow, ncol;
+
+    if (mql_packed_rows_check(blob, size) < 0)
+        return FALSE;
+
+    nrow = mql_packed_rows_get_row_count(blob);
+    ncol = mql_packed_rows_get_column_count(blob);
+
+    d->ncolumn = ncol;
+    d->nrow    = nrow;
+    d->rows    = nrow ? mrp_allocz_array(mrp_domctl_value_t *, nrow) : NULL;
+    values     = nrow && ncol ?
+        mrp_allocz_array(mrp_domctl_value_t, nrow * ncol) : NULL;
+
+    if ((d->rows == NULL || values == NULL) && nrow && ncol)
+        goto fail;
+
+    if (!decode_packed(blob, size, nrow, ncol, d->rows, values))
+        goto fail;
+
+    return TRUE;
+
+ fail:
+    mrp_free(values);
+    mrp_free(d->rows);
+    d->rows = NULL;
+    d->nrow = 0;
+
+    return FALSE;
+}
+
+
 msg_t *msg_decode_notify(mrp_msg_t *msg)
 {
     notify_msg_t       *notify;
     mrp_domctl_data_t  *d;
+    notify_delta_t     *nd;
     mrp_domctl_value_t *values, *v;
-    void               *it;
+    void               *it, *peek;
     uint64_t            columns_so_far;
-    uint32_t            seqno;
+    uint32_t            seqno, wseq, keymask, colmask, mgen;
+    char               *mname;
     uint16_t            ntable, ntotal, nrow, ncol;
-    uint16_t            tblid;
+    uint16_t            tblid, tag;
+    uint8_t             op;
+    bool                full;
     int                 t, r, c;
     uint16_t            type;
     mrp_msg_value_t     value;
+    size_t              size;
 
     it = NULL;
     columns_so_far = 0;
@@ -755,10 +1266,111 @@ msg_t *msg_decode_notify(mrp_msg_t *msg)
         /* If we are not overflowing, add ncol to count */
         columns_so_far += nrow * ncol;
 
+        /* check for a mirrored table (sent only to mirroring clients) */
+        peek = it;
+
+        if (mrp_msg_iterate(msg, &peek, &tag, &type, &value, NULL) &&
+            tag == MSGTAG_MIRROR) {
+            if (nrow != 0)
+                goto fail;
+
+            if (notify->mirrors == NULL) {
+                notify->mirrors = mrp_allocz_array(notify_mirror_t, ntable);
+
+                if (notify->mirrors == NULL)
+                    goto fail;
+            }
+
+            if (!mrp_msg_iterate_get(msg, &it,
+                                     MSG_STRING(MIRROR, &mname),
+                                     MSG_UINT32(MGEN  , &mgen),
+                                     MSG_END))
+                goto fail;
+
+            notify->mirrors[t].name = mname;
+            notify->mirrors[t].gen  = mgen;
+            d++;
+            continue;
+        }
+
+        /* check for change information (sent only to delta clients) */
+        peek = it;
+        nd   = NULL;
+
+        if (mrp_msg_iterate(msg, &peek, &tag, &type, &value, NULL) &&
+            tag == MSGTAG_WSEQ) {
+            if (notify->deltas == NULL) {
+                notify->deltas = mrp_allocz_array(notify_delta_t, ntable);
+
+                if (notify->deltas == NULL)
+                    goto fail;
+            }
+
+            if (!mrp_msg_iterate_get(msg, &it,
+                                     MSG_UINT32(WSEQ, &wseq),
+                                     MSG_BOOL(FULL  , &full),
+                                     MSG_END))
+                goto fail;
+
+            nd       = notify->deltas + t;
+            nd->seq  = wseq;
+            nd->full = full;
+
+            if (!full) {
+                if (!mrp_msg_iterate_get(msg, &it,
+                                         MSG_UINT32(KEYMASK, &keymask),
+                                         MSG_END))
+                    goto fail;
+
+                nd->keymask = keymask;
+                nd->ops     = mrp_allocz_array(mrp_domctl_rowop_t, nrow);
+                nd->colmask = mrp_allocz_array(uint32_t, nrow);
+
+                if ((nd->ops == NULL || nd->colmask == NULL) && nrow != 0)
+                    goto fail;
+            }
+        }
+
+        /* check for rows packed in a single blob (full tables only) */
+        peek = it;
+
+        if ((nd == NULL || nd->full) &&
+            mrp_msg_iterate(msg, &peek, &tag, &type, &value, &size) &&
+            tag == MSGTAG_PACKED) {
+            if (type != MRP_MSG_FIELD_BLOB ||
+                !decode_packed(value.blb, size, nrow, ncol, d->rows, v))
+                goto fail;
+
+            it  = peek;
+            v  += nrow * ncol;
+            d++;
+            continue;
+        }
+
         for (r = 0; r < nrow; r++) {
             d->rows[r] = v;
+            colmask    = (uint32_t)-1;
+
+            if (nd != NULL && !nd->full) {
+                if (!mrp_msg_iterate_get(msg, &it,
+                                         MSG_UINT8(ROWOP   , &op),
+                                         MSG_UINT32(COLMASK, &colmask),
+                                         MSG_END))
+                    goto fail;
+
+                if (op > MRP_DOMCTL_ROW_DELETE)
+                    goto fail;
+
+                nd->ops[r]     = op;
+                nd->colmask[r] = colmask;
+            }
 
             for (c = 0; c < ncol; c++) {
+                if (c < 32 && !(colmask & (1U << c))) {
+                    v++;
+                    continue;
+                }
+
                 if (!mrp_msg_iterate_get(msg, &it,
                                          MSG_ANY(DATA, &type, &value),
                                          MSG_END))
@@ -800,6 +1412,14 @@ msg_t *msg_decode_notify(mrp_msg_t *msg)
     return (msg_t *)notify;
 
  fail:
+    if (notify->deltas != NULL) {
+        for (t = 0; t < ntable; t++) {
+            mrp_free(notify->deltas[t].ops);
+            mrp_free(notify->deltas[t].colmask);
+        }
+        mrp_free(notify->deltas);
+        notify->deltas = NULL;
+    }
     msg_free_notify((msg_t *)notify);
     mrp_free(values);
 
@@ -1144,6 +1764,8 @@ msg_t *msg_decode_message(mrp_msg_t *msg)
         case MSG_TYPE_REGISTER:   return msg_decode_register(msg);
         case MSG_TYPE_UNREGISTER: return msg_decode_unregister(msg);
         case MSG_TYPE_SET:        return msg_decode_set(msg);
+        case MSG_TYPE_UPDATE:     return msg_decode_update(msg);
+        case MSG_TYPE_RESYNC:     return msg_decode_resync(msg);
         case MSG_TYPE_NOTIFY:     return msg_decode_notify(msg);
         case MSG_TYPE_ACK:        return msg_decode_ack(msg);
         case MSG_TYPE_NAK:        return msg_decode_nak(msg);
@@ -1163,6 +1785,8 @@ mrp_msg_t *msg_encode_message(msg_t *msg)
     case MSG_TYPE_REGISTER:   return msg_encode_register(&msg->reg);
     case MSG_TYPE_UNREGISTER: return msg_encode_unregister(&msg->unreg);
     case MSG_TYPE_SET:        return msg_encode_set(&msg->set);
+    case MSG_TYPE_UPDATE:     return msg_encode_update(&msg->update);
+    case MSG_TYPE_RESYNC:     return msg_encode_resync(&msg->resync);
     case MSG_TYPE_NOTIFY:     return msg_encode_notify(&msg->notify);
     case MSG_TYPE_ACK:        return msg_encode_ack(&msg->ack);
     case MSG_TYPE_NAK:        return msg_encode_nak(&msg->nak);
@@ -1180,6 +1804,8 @@ void msg_free_message(msg_t *msg)
         case MSG_TYPE_REGISTER:   msg_free_register(msg);   break;
         case MSG_TYPE_UNREGISTER: msg_free_unregister(msg); break;
         case MSG_TYPE_SET:        msg_free_set(msg);        break;
+        case MSG_TYPE_UPDATE:     msg_free_update(msg);     break;
+        case MSG_TYPE_RESYNC:     msg_free_resync(msg);     break;
         case MSG_TYPE_NOTIFY:     msg_free_notify(msg);     break;
         case MSG_TYPE_ACK:        msg_free_ack(msg);        break;
         case MSG_TYPE_NAK:        msg_free_nak(msg);        break;
@@ -1213,7 +1839,7 @@ msg_t *json_decode_register(mrp_json_t *msg)
     mrp_domctl_watch_t *w;
     int                 seqno;
     char               *name, *table, *columns, *index, *where;
-    int                 ntable, nwatch, max_rows;
+    int                 ntable, nwatch, max_rows, min_interval, max_latency;
     mrp_json_t         *arr, *tbl, *wch;
     int                 i;
 
@@ -1281,6 +1907,13 @@ msg_t *json_decode_register(mrp_json_t *msg)
         }
         else
             goto fail;
+
+        if (mrp_json_get_integer(wch, "mininterval", &min_interval) &&
+            min_interval > 0)
+            w->min_interval = min_interval;
+        if (mrp_json_get_integer(wch, "maxlatency", &max_latency) &&
+            max_latency > 0)
+            w->max_latency = max_latency;
     }
 
     reg->nwatch = nwatch;
@@ -46,6 +46,8 @@ typedef enum {
     MSG_TYPE_NAK,
     MSG_TYPE_INVOKE,
     MSG_TYPE_RETURN,
+    MSG_TYPE_UPDATE,
+    MSG_TYPE_RESYNC,
 } msg_type_t;
 
 typedef enum {
@@ -62,6 +64,9 @@ typedef enum {
     MSGTAG_INDEX    = 0x9,           /* index definition */
     MSGTAG_WHERE    = 0xa,           /* where clause for select */
     MSGTAG_MAXROWS  = 0xb,           /* max number of rows to select */
+    MSGTAG_FLAGS    = 0xc,           /* registration flags */
+    MSGTAG_MININTVL = 0xd,           /* min. interval between notifications */
+    MSGTAG_MAXLAT   = 0xe,           /* max. latency of coalesced changes */
 
     /* fixed tags in NAKs */
     MSGTAG_ERRCODE  = 0x3,           /* error code */
@@ -74,6 +79,14 @@ typedef enum {
     MSGTAG_NROW    = 0x6,            /* number of table rows */
     MSGTAG_NCOL    = 0x7,            /* number of columns in a row */
     MSGTAG_DATA    = 0x8,            /* a data column */
+    MSGTAG_ROWOP   = 0x9,            /* row operation in table updates */
+    MSGTAG_WSEQ    = 0xa,            /* per-watch notification sequence */
+    MSGTAG_FULL    = 0xb,            /* full table, not just changes */
+    MSGTAG_KEYMASK = 0xc,            /* mask of key columns */
+    MSGTAG_COLMASK = 0xd,            /* mask of columns present in a row */
+    MSGTAG_PACKED  = 0xe,            /* all rows packed in a single blob */
+    MSGTAG_MIRROR  = 0xf,            /* shared-memory mirror name */
+    MSGTAG_MGEN    = 0x10,           /* generation of mirrored data */
 
     /* fixed tags in invoke and return messages */
     MSGTAG_METHOD  = 0x3,            /* method name */
@@ -99,9 +112,18 @@ typedef enum {
 #define MSG_ANY(tag, typep, valp) MRP_MSG_TAG_ANY(MSGTAG_##tag, typep, valp)
 #define MSG_ARRAY(tag, type, size, arr) \
     MRP_MSG_TAGGED(MSGTAG_##tag, type, size, arr)
+#define MSG_BLOB(tag, size, blob) \
+    MRP_MSG_TAGGED(MSGTAG_##tag, MRP_MSG_FIELD_BLOB, size, blob)
 
 #define MSG_END MRP_MSG_END
 
+/* registration flags */
+#define MSG_REGISTER_DELTA  0x1          /* client understands deltas */
+#define MSG_REGISTER_PACKED 0x2          /* client takes packed rows */
+#define MSG_REGISTER_MIRROR 0x4          /* client reads shared mirrors */
+
+#define MSG_DELTA_MAXCOL    32           /* delta column masks are 32 bits */
+
 #define COMMON_MSG_FIELDS                /* common message fields */      \
     msg_type_t  type;                    /* message type */               \
     uint32_t    seq;                     /* message sequence number */    \
@@ -117,6 +139,7 @@ typedef struct {
     int                 ntable;          /* number of tables */
     mrp_domctl_watch_t *watches;         /* watched tables */
     int                 nwatch;          /* number of watches */
+    uint32_t            flags;           /* MSG_REGISTER_* flags */
 } register_msg_t;
 
 
@@ -132,9 +155,60 @@ typedef struct {
 } set_msg_t;
 
 
+typedef struct {
+    COMMON_MSG_FIELDS;
+    mrp_domctl_delta_t *tables;          /* row changes for tables */
+    int                 ntable;          /* number of tables */
+} update_msg_t;
+
+
+typedef struct {
+    COMMON_MSG_FIELDS;
+} resync_msg_t;
+
+
+/*
+ * change information for a table in a notification
+ *
+ * Notifications sent to clients which registered with MSG_REGISTER_DELTA
+ * carry a sequence number per table and either the full table or only the
+ * rows changed since the previous notification. For changed rows only the
+ * key columns and the changed columns are present (cf. colmask).
+ *
+ * Clients which registered with MSG_REGISTER_PACKED get the rows of full
+ * tables as a single MSGTAG_PACKED blob of mql_result_rows_pack() instead
+ * of one MSGTAG_DATA field per column. The decoded values then point into
+ * the blob of the on-wire message.
+ */
+
+typedef struct {
+    uint32_t            seq;             /* notification sequence number */
+    int                 full;            /* whether full table contents */
+    uint32_t            keymask;         /* mask of key columns */
+    mrp_domctl_rowop_t *ops;             /* operation for each row */
+    uint32_t           *colmask;         /* columns present in each row */
+} notify_delta_t;
+
+
+/*
+ * mirror information for a table in a notification
+ *
+ * Clients which registered with MSG_REGISTER_MIRROR might get, instead of
+ * any rows, only the name of a shared-memory mirror (cf. shm-mirror.h) and
+ * the generation of the data published there for a table.
+ */
+
+typedef struct {
+    const char         *name;            /* mirror name, NULL if no mirror */
+    uint32_t            gen;             /* generation of published data */
+} notify_mirror_t;
+
+
 typedef struct {
     COMMON_MSG_FIELDS;
     mrp_domctl_data_t *tables;           /* data in changed tables */
+    notify_delta_t    *deltas;           /* change info, if any, per table */
+    notify_mirror_t   *mirrors;          /* mirror info, if any, per table */
     int                ntable;           /* number of changed tables */
 } notify_msg_t;
 
@@ -179,6 +253,8 @@ union msg_u {
     register_msg_t   reg;
     unregister_msg_t unreg;
     set_msg_t        set;
+    update_msg_t     update;
+    resync_msg_t     resync;
     notify_msg_t     notify;
     ack_msg_t        ack;
     nak_msg_t        nak;
@@ -194,7 +270,15 @@ msg_t *json_decode_message(mrp_json_t *msg);
 void msg_free_message(msg_t *msg);
 
 mrp_msg_t *msg_create_notify(void);
-int msg_update_notify(mrp_msg_t *msg, int tblid, mql_result_t *r);
+int msg_update_notify(mrp_msg_t *msg, int tblid, mql_result_t *r, int packed);
+int msg_full_notify(mrp_msg_t *msg, int tblid, uint32_t seq, mql_result_t *r,
+                    int packed);
+int msg_delta_notify(mrp_msg_t *msg, int tblid, uint32_t seq, int ncol,
+                     mqi_bitfld_t *keymask, int nrow, mrp_domctl_rowop_t *ops,
+                     mqi_bitfld_t *masks, mrp_domctl_value_t **rows);
+int msg_mirror_notify(mrp_msg_t *msg, int tblid, const char *name,
+                      uint32_t gen);
+int msg_decode_packed(void *blob, size_t size, mrp_domctl_data_t *d);
 
 mrp_json_t *json_create_notify(void);
 int json_update_notify(mrp_json_t *msg, int tblid, mql_result_t *r);
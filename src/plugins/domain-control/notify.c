@@ -27,8 +27,13 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
 #include <murphy/common/mm.h>
 #include <murphy/common/log.h>
+#include <murphy/common/metrics.h>
 
 #include <murphy-db/mql-result.h>
 
@@ -36,6 +41,10 @@
 #include "message.h"
 #include "table.h"
 #include "notify.h"
+#include "domain-control.h"
+
+static mrp_metric_t *notifications;
+static mrp_metric_t *notify_failures;
 
 
 static void prepare_proxy_notification(pep_proxy_t *proxy)
@@ -85,20 +94,366 @@ static int collect_watch_notification(pep_watch_t *w)
 }
 
 
+static int select_watch_columns(pep_watch_t *w)
+{
+    pep_table_t *t = w->table;
+    const char  *p, *e;
+    int          len, i, j, n;
+
+    mrp_free(w->columns);
+    w->columns = NULL;
+    w->ncolumn = 0;
+    mqi_bitfld_clear(&w->keymask);
+
+    if (t->h == MQI_HANDLE_INVALID || t->nidx_col == 0 || w->mql_where[0])
+        return FALSE;
+
+    if ((w->columns = mrp_allocz_array(int, t->ncolumn)) == NULL)
+        return FALSE;
+
+    n = 0;
+    p = w->mql_columns;
+
+    while (*p) {
+        while (*p == ',' || *p == ' ' || *p == '\t')
+            p++;
+
+        for (e = p; *e && *e != ',' && *e != ' ' && *e != '\t'; e++)
+            ;
+
+        if ((len = e - p) == 0)
+            break;
+
+        if (len == 1 && *p == '*') {
+            if (n != 0)
+                return FALSE;
+
+            for (n = 0; n < t->ncolumn; n++)
+                w->columns[n] = n;
+
+            p = e;
+            continue;
+        }
+
+        for (i = 0; i < t->ncolumn; i++)
+            if (!strncmp(t->columns[i].name, p, len) &&
+                !t->columns[i].name[len])
+                break;
+
+        if (i >= t->ncolumn || n >= t->ncolumn)
+            return FALSE;
+
+        w->columns[n++] = i;
+        p = e;
+    }
+
+    w->ncolumn = n;
+
+    /* delta notifications carry 32-bit column masks on the wire */
+    if (w->ncolumn > MSG_DELTA_MAXCOL)
+        return FALSE;
+
+    /* we can only send deltas if the row key is part of the selection */
+    for (i = 0; i < t->nidx_col; i++) {
+        for (j = 0; j < w->ncolumn; j++)
+            if (w->columns[j] == t->idx_cols[i])
+                break;
+
+        if (j >= w->ncolumn)
+            return FALSE;
+
+        mqi_bitfld_set(&w->keymask, j);
+    }
+
+    return TRUE;
+}
+
+
+static int collect_watch_full(pep_watch_t *w)
+{
+    pep_proxy_t  *proxy = w->proxy;
+    mql_result_t *r     = NULL;
+    int           n;
+
+    mrp_debug("sending full %s watch to %s", w->table->name, proxy->name);
+
+    if (proxy->notify_msg == NULL) {
+        if (!proxy->ops->create_notify(proxy))
+            goto fail;
+    }
+
+    if (w->table->h != MQI_HANDLE_INVALID) {
+        if (!exec_mql(mql_result_rows, &r, "select %s from %s%s%s",
+                      w->mql_columns, w->table->name,
+                      w->mql_where[0] ? " where " : "", w->mql_where)) {
+            mrp_debug("select from table %s failed", w->table->name);
+            goto fail;
+        }
+    }
+
+    w->seq++;
+    n = proxy->ops->full_notify(proxy, w, r);
+
+    if (r != NULL)
+        mql_result_free(r);
+
+    if (n >= 0) {
+        w->resync = false;
+        return TRUE;
+    }
+    else {
+    fail:
+        proxy->ops->free_notify(proxy);
+        proxy->notify_fail = true;
+
+        return FALSE;
+    }
+}
+
+
+static int collect_watch_delta(pep_watch_t *w)
+{
+    pep_proxy_t         *proxy = w->proxy;
+    pep_table_t         *t     = w->table;
+    mrp_domctl_value_t   row[MQI_COLUMN_MAX];
+    mrp_domctl_value_t  *values, *src, **rows;
+    mrp_domctl_rowop_t  *ops;
+    mqi_bitfld_t        *masks, mask;
+    mrp_list_hook_t     *p, *n;
+    pep_change_t        *c;
+    int                  nrow, found, changed, i, j, status;
+
+    if (t->nchange == 0)
+        return TRUE;
+
+    mrp_debug("sending %d changed rows of %s watch to %s", t->nchange,
+              t->name, proxy->name);
+
+    values = mrp_allocz_array(mrp_domctl_value_t, t->nchange * w->ncolumn);
+    rows   = mrp_allocz_array(mrp_domctl_value_t *, t->nchange);
+    ops    = mrp_allocz_array(mrp_domctl_rowop_t, t->nchange);
+    masks  = mrp_allocz_array(mqi_bitfld_t, t->nchange);
+    status = FALSE;
+    nrow   = 0;
+
+    if (values == NULL || rows == NULL || ops == NULL || masks == NULL)
+        goto out;
+
+    mrp_list_foreach(&t->changes, p, n) {
+        c = mrp_list_entry(p, typeof(*c), hook);
+
+        if ((found = fetch_table_row(t, c->values, row)) < 0)
+            goto out;
+
+        if (found) {
+            if (c->inserted || c->deleted) {
+                ops[nrow] = MRP_DOMCTL_ROW_INSERT;
+                mqi_bitfld_clear(&mask);
+
+                for (j = 0; j < w->ncolumn; j++)
+                    mqi_bitfld_set(&mask, j);
+            }
+            else {
+                ops[nrow] = MRP_DOMCTL_ROW_UPDATE;
+                mask      = w->keymask;
+                changed   = FALSE;
+
+                for (j = 0; j < w->ncolumn; j++) {
+                    if (mqi_bitfld_test(&c->mask, w->columns[j]) &&
+                        !mqi_bitfld_test(&w->keymask, j)) {
+                        mqi_bitfld_set(&mask, j);
+                        changed = TRUE;
+                    }
+                }
+
+                if (!changed)              /* no selected column changed */
+                    continue;
+            }
+
+            src = row;
+        }
+        else {
+            ops[nrow] = MRP_DOMCTL_ROW_DELETE;
+            mask      = w->keymask;
+            src       = c->values;
+        }
+
+        rows[nrow]  = values + nrow * w->ncolumn;
+        masks[nrow] = mask;
+
+        for (j = 0; j < w->ncolumn; j++) {
+            i = w->columns[j];
+
+            if (mqi_bitfld_test(&mask, j))
+                rows[nrow][j] = src[i];
+        }
+
+        nrow++;
+    }
+
+    if (nrow > 0) {
+        if (proxy->notify_msg == NULL) {
+            if (!proxy->ops->create_notify(proxy))
+                goto out;
+        }
+
+        w->seq++;
+
+        if (proxy->ops->delta_notify(proxy, w, nrow, ops, masks, rows) < 0)
+            goto out;
+    }
+
+    status = TRUE;
+
+ out:
+    mrp_free(values);
+    mrp_free(rows);
+    mrp_free(ops);
+    mrp_free(masks);
+
+    if (!status) {
+        proxy->ops->free_notify(proxy);
+        proxy->notify_fail = true;
+    }
+
+    return status;
+}
+
+
+/*
+ * For mirroring clients the rows of a watch are packed and published in a
+ * shared-memory mirror, at most once per notification round however many
+ * clients share the mirror, and the clients only get the generation of the
+ * published data. If the table does not exist or something goes wrong, we
+ * fall back to sending the rows.
+ */
+static int publish_mirror(pep_mirror_t *m)
+{
+    pep_table_t  *t = m->table;
+    mql_result_t *r = NULL;
+    void         *blob;
+    size_t        size;
+    uint32_t      gen;
+
+    if (t->h == MQI_HANDLE_INVALID)
+        return FALSE;
+
+    if (!exec_mql(mql_result_rows, &r, "select %s from %s%s%s",
+                  m->mql_columns, t->name,
+                  m->mql_where[0] ? " where " : "", m->mql_where)) {
+        mrp_debug("select from table %s failed", t->name);
+        return FALSE;
+    }
+
+    blob = mql_result_rows_pack(r, &size);
+    mql_result_free(r);
+
+    if (blob == NULL)
+        return FALSE;
+
+    gen = mirror_publish(&m->shm, blob, size);
+    free(blob);
+
+    if (!gen)
+        return FALSE;
+
+    mrp_debug("published %zu bytes of %s as generation %u in %s", size,
+              t->name, gen, m->shm.name);
+
+    m->gen   = gen;
+    m->stale = false;
+
+    return TRUE;
+}
+
+
+static int collect_watch_mirror(pep_watch_t *w)
+{
+    pep_proxy_t  *proxy = w->proxy;
+    pep_mirror_t *m     = w->mirror;
+
+    if (m->stale && !publish_mirror(m))
+        return -1;
+
+    if (w->mgen == m->gen && !w->resync)
+        return TRUE;
+
+    if (proxy->notify_msg == NULL) {
+        if (!proxy->ops->create_notify(proxy))
+            goto fail;
+    }
+
+    if (proxy->ops->mirror_notify(proxy, w) < 0)
+        goto fail;
+
+    w->mgen   = m->gen;
+    w->resync = false;
+
+    return TRUE;
+
+ fail:
+    proxy->ops->free_notify(proxy);
+    proxy->notify_fail = true;
+
+    return FALSE;
+}
+
+
+/*
+ * Clients that can take changes get a full notification only when
+ * (re)subscribed, when they explicitly ask for a resync, or when we
+ * could not track changes of a table (table created or dropped, the
+ * key of a row changed, or simply too many changes). Otherwise only
+ * the rows changed since the last notification are sent. Watches with
+ * a where clause or without the table key selected are always sent in
+ * full.
+ */
+static int collect_watch_changes(pep_watch_t *w)
+{
+    pep_table_t *t = w->table;
+
+    if (w->delta < 0 || t->resync)
+        w->delta = select_watch_columns(w);
+
+    if (!w->delta || w->resync || t->resync)
+        return collect_watch_full(w);
+
+    if (!t->changed)
+        return TRUE;
+
+    return collect_watch_delta(w);
+}
+
+
 static int send_proxy_notification(pep_proxy_t *proxy)
 {
     if (proxy->notify_msg == NULL)
         return TRUE;
 
+    if (MRP_UNLIKELY(notifications == NULL)) {
+        notifications =
+            mrp_metric_counter("murphy_domain_control_notifications_total",
+                               "Number of notifications sent to clients.");
+        notify_failures =
+            mrp_metric_counter("murphy_domain_control_notify_failures_total",
+                               "Number of notifications failed to send.");
+    }
+
     if (!proxy->notify_fail) {
         mrp_debug("notifying client %s", proxy->name);
 
-        proxy->ops->send_notify(proxy);
+        if (proxy->ops->send_notify(proxy))
+            mrp_metric_inc(notifications);
+        else
+            mrp_metric_inc(notify_failures);
+
         proxy->ops->free_notify(proxy);
     }
-    else
+    else {
         mrp_log_error("Failed to generate/send notification to %s.",
                       proxy->name);
+        mrp_metric_inc(notify_failures);
+    }
 
     proxy->notify_msg     = NULL;
     proxy->notify_ntable  = 0;
@@ -109,15 +464,123 @@ static int send_proxy_notification(pep_proxy_t *proxy)
 }
 
 
+/*
+ * Rate-limited watches
+ *
+ * A watch with a minimum interval or maximum latency set does not get
+ * notified right away about changes. Instead the changes are held back
+ * until the coalescing window (max_latency) opened by the first of them
+ * has passed and at least min_interval has elapsed since the previous
+ * notification. Whatever accumulated meanwhile is then sent in a single
+ * notification, which thus always reflects the latest state of the table.
+ */
+
+static uint64_t time_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+static inline bool watch_rate_limited(pep_watch_t *w)
+{
+    return w->min_interval != 0 || w->max_latency != 0;
+}
+
+
+static uint64_t watch_due(pep_watch_t *w)
+{
+    uint64_t coalesced, spaced;
+
+    coalesced = w->first_change + w->max_latency;
+    spaced    = w->last_notify ? w->last_notify + w->min_interval : 0;
+
+    return coalesced > spaced ? coalesced : spaced;
+}
+
+
+static void holdoff_cb(mrp_timer_t *tmr, void *user_data)
+{
+    pdp_t *pdp = (pdp_t *)user_data;
+
+    mrp_del_timer(tmr);
+    pdp->holdoff = NULL;
+
+    schedule_notification(pdp);
+}
+
+
+static void arm_holdoff(pdp_t *pdp, uint64_t due, uint64_t now)
+{
+    unsigned int msecs = due > now ? (unsigned int)(due - now) : 0;
+
+    mrp_debug("holding back notifications for %u msecs", msecs);
+
+    if (pdp->holdoff != NULL)
+        mrp_mod_timer(pdp->holdoff, msecs);
+    else
+        pdp->holdoff = mrp_add_timer(pdp->ctx->ml, msecs, holdoff_cb, pdp);
+}
+
+
+/*
+ * Decide what to do with the accumulated changes of a table once all
+ * watches have been processed. If every watch of the table is still
+ * holding them back, we keep the changes around so they will coalesce
+ * with any further ones. Otherwise they are consumed and any watch
+ * holding back is marked for a full resync, since the deltas it would
+ * need are gone.
+ */
+static bool table_changes_held(pep_table_t *t)
+{
+    mrp_list_hook_t *p, *n;
+    pep_watch_t     *w;
+    bool             held, consumed;
+
+    held = consumed = false;
+
+    mrp_list_foreach(&t->watches, p, n) {
+        w = mrp_list_entry(p, typeof(*w), tbl_hook);
+
+        if (w->pending)
+            held = true;
+        else
+            consumed = true;
+    }
+
+    if (!held || !consumed)
+        return held;
+
+    mrp_list_foreach(&t->watches, p, n) {
+        w = mrp_list_entry(p, typeof(*w), tbl_hook);
+
+        if (w->pending)
+            w->resync = true;
+    }
+
+    return false;
+}
+
+
 void notify_table_changes(pdp_t *pdp)
 {
     mrp_list_hook_t *p, *n, *wp, *wn;
     pep_proxy_t     *proxy;
     pep_table_t     *t;
     pep_watch_t     *w;
+    pep_mirror_t    *m;
+    uint64_t         now, due, next;
+    bool             held;
+    int              status;
 
     mrp_debug("notifying clients about table changes");
 
+    now  = time_now();
+    next = 0;
+
     mrp_list_foreach(&pdp->proxies, p, n) {
         proxy = mrp_list_entry(p, typeof(*proxy), hook);
         prepare_proxy_notification(proxy);
@@ -132,9 +595,19 @@ void notify_table_changes(pdp_t *pdp)
         if (!t->changed)
             continue;
 
+        mrp_list_foreach(&t->mirrors, wp, wn) {
+            m = mrp_list_entry(wp, typeof(*m), hook);
+            m->stale = true;
+        }
+
         mrp_list_foreach(&t->watches, wp, wn) {
             w = mrp_list_entry(wp, typeof(*w), tbl_hook);
             w->proxy->notify = true;
+
+            if (watch_rate_limited(w) && !w->pending) {
+                w->pending      = true;
+                w->first_change = now;
+            }
         }
     }
 
@@ -145,20 +618,68 @@ void notify_table_changes(pdp_t *pdp)
                   proxy->notify ? "" : "no ");
 
         if (proxy->notify) {
+            held = false;
+
             mrp_list_foreach(&proxy->watches, wp, wn) {
                 w = mrp_list_entry(wp, typeof(*w), pep_hook);
-                if (!collect_watch_notification(w))
-                    break;
+
+                if (w->pending) {
+                    if ((due = watch_due(w)) > now) {
+                        if (next == 0 || due < next)
+                            next = due;
+                        held = true;
+                        continue;
+                    }
+
+                    w->pending     = false;
+                    w->last_notify = now;
+                }
+                else if (w->resync && watch_rate_limited(w))
+                    w->last_notify = now;
+
+                if (w->mirror != NULL && proxy->ops->mirror_notify != NULL) {
+                    if ((status = collect_watch_mirror(w)) == FALSE)
+                        break;
+                    if (status > 0)
+                        continue;
+
+                    w->resync = true;
+                }
+
+                if (proxy->delta && proxy->ops->delta_notify != NULL) {
+                    if (!collect_watch_changes(w))
+                        break;
+                }
+                else {
+                    if (!collect_watch_notification(w))
+                        break;
+                }
+            }
+
+            /* if we could not notify, the client is out of sync */
+            if (proxy->notify_fail) {
+                mrp_list_foreach(&proxy->watches, wp, wn) {
+                    w = mrp_list_entry(wp, typeof(*w), pep_hook);
+                    w->resync = true;
+                }
             }
 
             send_proxy_notification(proxy);
 
-            proxy->notify = false;
+            proxy->notify = held;
         }
     }
 
     mrp_list_foreach(&pdp->tables, p, n) {
         t = mrp_list_entry(p, typeof(*t), hook);
+
+        if (t->changed && table_changes_held(t))
+            continue;
+
         t->changed = false;
+        reset_table_changes(t);
     }
+
+    if (next != 0)
+        arm_holdoff(pdp, next, now);
 }
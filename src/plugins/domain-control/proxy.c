@@ -32,6 +32,7 @@
 #include <murphy/common/log.h>
 #include <murphy/common/mm.h>
 #include <murphy/common/list.h>
+#include <murphy/common/metrics.h>
 
 #include "domain-control-types.h"
 #include "table.h"
@@ -51,11 +52,17 @@ typedef struct {
 
 static void purge_pending(pep_proxy_t *proxy);
 
+static mrp_metric_t *clients;
+
 
 int init_proxies(pdp_t *pdp)
 {
     mrp_list_init(&pdp->proxies);
 
+    if (clients == NULL)
+        clients = mrp_metric_gauge("murphy_domain_control_clients",
+                                   "Number of connected clients.");
+
     return TRUE;
 }
 
@@ -83,6 +90,7 @@ pep_proxy_t *create_proxy(pdp_t *pdp)
         proxy->seqno = 1;
 
         mrp_list_append(&pdp->proxies, &proxy->hook);
+        mrp_metric_inc(clients);
     }
 
     return proxy;
@@ -95,6 +103,7 @@ void destroy_proxy(pep_proxy_t *proxy)
 
     if (proxy != NULL) {
         mrp_list_delete(&proxy->hook);
+        mrp_metric_dec(clients);
 
         for (i = 0; i < proxy->ntable; i++)
             destroy_proxy_table(proxy->tables + i);
@@ -156,7 +165,8 @@ int register_proxy(pep_proxy_t *proxy, char *name,
 
     for (i = 0, w = watches; i < nwatch; i++, w++) {
         if (create_proxy_watch(proxy, i, w->table, w->mql_columns,
-                               w->mql_where, w->max_rows, error, errmsg))
+                               w->mql_where, w->max_rows, w->min_interval,
+                               w->max_latency, error, errmsg))
             mrp_log_info("Client %s subscribed for table %s.", proxy->name,
                          w->table);
         else
@@ -246,10 +256,12 @@ static void purge_pending(pep_proxy_t *proxy)
     mrp_list_hook_t *p, *n;
     pending_t       *pending;
 
+    /* let the callers know they are not getting a reply */
     mrp_list_foreach(&proxy->pending, p, n) {
         pending = mrp_list_entry(p, typeof(*pending), hook);
 
         mrp_list_delete(&pending->hook);
+        pending->cb(MRP_DOMAIN_NOTFOUND, 0, 0, NULL, pending->user_data);
         mrp_free(pending);
     }
 }
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
+#include <murphy/common/log.h>
+
+#include "shm-mirror.h"
+
+#define MIN_ROOM    4096                 /* minimum room for slot data */
+#define MAX_RETRIES 16                   /* max. attempts to read a slot */
+
+
+static int map_region(mirror_shm_t *m, size_t size)
+{
+    void *map;
+    int   prot;
+
+    prot = m->writer ? PROT_READ | PROT_WRITE : PROT_READ;
+    map  = mmap(NULL, size, prot, MAP_SHARED, m->fd, 0);
+
+    if (map == MAP_FAILED)
+        return FALSE;
+
+    if (m->hdr != NULL)
+        munmap(m->hdr, m->mapped);
+
+    m->hdr    = map;
+    m->mapped = size;
+
+    return TRUE;
+}
+
+
+int mirror_create(mirror_shm_t *m, const char *name)
+{
+    int flags = O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC;
+
+    mrp_clear(m);
+    m->fd     = -1;
+    m->writer = TRUE;
+    m->name   = mrp_strdup(name);
+
+    if (m->name == NULL)
+        return FALSE;
+
+    m->fd = shm_open(name, flags, 0644);
+
+    /* a stale region left behind by a crashed daemon */
+    if (m->fd < 0 && errno == EEXIST) {
+        shm_unlink(name);
+        m->fd = shm_open(name, flags, 0644);
+    }
+
+    if (m->fd < 0)
+        goto fail;
+
+    if (ftruncate(m->fd, sizeof(*m->hdr)) < 0 ||
+        !map_region(m, sizeof(*m->hdr)))
+        goto fail;
+
+    m->hdr->magic   = MIRROR_MAGIC;
+    m->hdr->version = MIRROR_VERSION;
+    m->hdr->size    = sizeof(*m->hdr);
+
+    return TRUE;
+
+ fail:
+    mrp_log_error("Failed to create table mirror %s (%d: %s).", name,
+                  errno, strerror(errno));
+    mirror_close(m);
+
+    return FALSE;
+}
+
+
+uint32_t mirror_publish(mirror_shm_t *m, const void *data, size_t size)
+{
+    mirror_hdr_t  *hdr = m->hdr;
+    mirror_slot_t *s;
+    uint32_t       gen, seq, room;
+    size_t         total;
+    int            i;
+
+    if ((gen = hdr->gen + 1) == 0)
+        gen = 1;
+
+    i   = gen & 1;
+    s   = hdr->slots + i;
+    seq = s->seq + 1;
+
+    __atomic_store_n(&s->seq, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (s->room < size) {
+        for (room = MIN_ROOM; room < size; room <<= 1)
+            if (!room)
+                goto fail;
+
+        total = (size_t)hdr->size + room;
+
+        if (total > UINT32_MAX || ftruncate(m->fd, total) < 0 ||
+            !map_region(m, total))
+            goto fail;
+
+        hdr = m->hdr;
+        s   = hdr->slots + i;
+
+        s->offs   = hdr->size;
+        s->room   = room;
+        hdr->size = total;
+    }
+
+    memcpy((char *)hdr + s->offs, data, size);
+    s->size = size;
+    s->gen  = gen;
+
+    __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&hdr->gen, gen, __ATOMIC_RELEASE);
+
+    return gen;
+
+ fail:
+    /* leave the slot consistent with its old contents */
+    __atomic_store_n(&m->hdr->slots[i].seq, seq + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+
+int mirror_open(mirror_shm_t *m, const char *name)
+{
+    struct stat st;
+
+    mrp_clear(m);
+    m->fd   = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    m->name = mrp_strdup(name);
+
+    if (m->fd < 0 || m->name == NULL)
+        goto fail;
+
+    if (fstat(m->fd, &st) < 0 || (size_t)st.st_size < sizeof(*m->hdr) ||
+        !map_region(m, st.st_size))
+        goto fail;
+
+    if (m->hdr->magic != MIRROR_MAGIC || m->hdr->version != MIRROR_VERSION) {
+        errno = EINVAL;
+        goto fail;
+    }
+
+    return TRUE;
+
+ fail:
+    mrp_log_error("Failed to open table mirror %s (%d: %s).", name,
+                  errno, strerror(errno));
+    mirror_close(m);
+
+    return FALSE;
+}
+
+
+void *mirror_read(mirror_shm_t *m, size_t *sizep, uint32_t *genp)
+{
+    mirror_slot_t *s;
+    uint32_t       gen, seq, offs, size;
+    struct stat    st;
+    void          *buf;
+    size_t         room;
+    int            i;
+
+    buf  = NULL;
+    room = 0;
+
+    for (i = 0; i < MAX_RETRIES; i++) {
+        gen = __atomic_load_n(&m->hdr->gen, __ATOMIC_ACQUIRE);
+
+        if (gen == 0) {
+            errno = EAGAIN;
+            break;
+        }
+
+        s   = m->hdr->slots + (gen & 1);
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+
+        if (seq & 1)
+            continue;
+
+        gen  = s->gen;
+        offs = s->offs;
+        size = s->size;
+
+        if ((size_t)offs + size > m->mapped) {
+            if (fstat(m->fd, &st) < 0 || !map_region(m, st.st_size))
+                break;
+            continue;
+        }
+
+        if (size > room) {
+            mrp_free(buf);
+
+            if ((buf = mrp_alloc(size)) == NULL)
+                return NULL;
+
+            room = size;
+        }
+
+        memcpy(buf, (char *)m->hdr + offs, size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq)
+            continue;
+
+        *sizep = size;
+        *genp  = gen;
+
+        return buf;
+    }
+
+    if (i >= MAX_RETRIES)
+        errno = EBUSY;
+
+    mrp_free(buf);
+
+    return NULL;
+}
+
+
+void mirror_close(mirror_shm_t *m)
+{
+    if (m->hdr != NULL)
+        munmap(m->hdr, m->mapped);
+
+    if (m->fd >= 0)
+        close(m->fd);
+
+    if (m->writer && m->name != NULL)
+        shm_unlink(m->name);
+
+    mrp_free(m->name);
+    mrp_clear(m);
+    m->fd = -1;
+}
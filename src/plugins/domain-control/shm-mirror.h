@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MURPHY_DOMAIN_CONTROL_SHM_MIRROR_H__
+#define __MURPHY_DOMAIN_CONTROL_SHM_MIRROR_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * a shared-memory table mirror
+ *
+ * For co-located clients the server can publish the rows of a watched
+ * table selection, packed by mql_result_rows_pack(), into a POSIX shared
+ * memory object and send the client only the generation of the new data.
+ *
+ * The region is double buffered. The writer always fills the slot not
+ * holding the latest generation, then publishes the new generation in the
+ * header. Every slot is protected by a sequence counter which is odd while
+ * the slot is being written, so a reader which was too slow to copy a slot
+ * before the writer came back to it notices this and retries. A slot which
+ * is too small for new data gets a new, larger area at the end of the
+ * region, so the area of the other slot is never touched while readers
+ * might be copying it.
+ */
+
+#define MIRROR_MAGIC   0x4d444d52        /* 'MDMR' */
+#define MIRROR_VERSION 1
+
+typedef struct {
+    uint32_t seq;                        /* odd while being written */
+    uint32_t gen;                        /* generation of the slot data */
+    uint32_t offs;                       /* data offset within the region */
+    uint32_t size;                       /* data size */
+    uint32_t room;                       /* room for data at offs */
+} mirror_slot_t;
+
+typedef struct {
+    uint32_t      magic;                 /* MIRROR_MAGIC */
+    uint32_t      version;               /* MIRROR_VERSION */
+    uint32_t      size;                  /* total size of the region */
+    uint32_t      gen;                   /* latest published generation */
+    mirror_slot_t slots[2];              /* double buffered data */
+} mirror_hdr_t;
+
+typedef struct {
+    char         *name;                  /* shared memory object name */
+    int           fd;                    /* shared memory object */
+    mirror_hdr_t *hdr;                   /* mapped region */
+    size_t        mapped;                /* size of mapping */
+    int           writer;                /* whether we're the writer */
+} mirror_shm_t;
+
+/* create a new mirror region for writing */
+int mirror_create(mirror_shm_t *m, const char *name);
+
+/* publish new data in the region, return its generation or 0 on error */
+uint32_t mirror_publish(mirror_shm_t *m, const void *data, size_t size);
+
+/* open an existing mirror region for reading */
+int mirror_open(mirror_shm_t *m, const char *name);
+
+/* read a copy of the latest data from the region */
+void *mirror_read(mirror_shm_t *m, size_t *sizep, uint32_t *genp);
+
+/* close (and if we created it, remove) the region */
+void mirror_close(mirror_shm_t *m);
+
+#endif /* __MURPHY_DOMAIN_CONTROL_SHM_MIRROR_H__ */
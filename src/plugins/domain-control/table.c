@@ -28,9 +28,13 @@
  */
 
 #include <errno.h>
+#include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <murphy/common/debug.h>
+#include <murphy/common/log.h>
 #include <murphy/common/mm.h>
 #include <murphy/common/hashtbl.h>
 #include <murphy/common/utils.h>
@@ -48,13 +52,216 @@
         goto fail;                              \
     } while (0)
 
+#define MAX_TRACKED_CHANGES 1024         /* resync table above this */
+
 static pep_table_t *lookup_watch_table(pdp_t *pdp, const char *name);
+static int get_table_description(pep_table_t *t);
+static int get_index_columns(pep_table_t *t);
+static void free_table_description(pep_table_t *t);
+static pep_mirror_t *get_table_mirror(pdp_t *pdp, pep_table_t *t,
+                                      const char *mql_columns,
+                                      const char *mql_where);
+static void put_table_mirror(pep_mirror_t *m);
 
 /*
  * proxied and tracked tables
  */
 
 
+static mrp_domctl_type_t column_type(mqi_data_type_t type)
+{
+    switch (type) {
+    case mqi_varchar:  return MRP_DOMCTL_STRING;
+    case mqi_integer:  return MRP_DOMCTL_INTEGER;
+    case mqi_unsignd:  return MRP_DOMCTL_UNSIGNED;
+    case mqi_floating: return MRP_DOMCTL_DOUBLE;
+    default:           return MRP_DOMCTL_END;
+    }
+}
+
+
+static int row_key(pep_table_t *t, mrp_domctl_value_t *row, char *buf,
+                   size_t size)
+{
+    mrp_domctl_value_t *v;
+    char               *p;
+    int                 i, l, n;
+
+    p = buf;
+    l = (int)size;
+
+    for (i = 0; i < t->nidx_col; i++) {
+        v = row + t->idx_cols[i];
+
+        switch (t->columns[t->idx_cols[i]].type) {
+        case mqi_varchar:
+            n = snprintf(p, l, "%s\x1f", v->str ? v->str : "");
+            break;
+        case mqi_integer:
+            n = snprintf(p, l, "%d\x1f", v->s32);
+            break;
+        case mqi_unsignd:
+            n = snprintf(p, l, "%u\x1f", v->u32);
+            break;
+        case mqi_floating:
+            n = snprintf(p, l, "%a\x1f", v->dbl);
+            break;
+        default:
+            return -1;
+        }
+
+        if (n < 0 || n >= l)
+            return -1;
+
+        p += n;
+        l -= n;
+    }
+
+    return (int)(p - buf);
+}
+
+
+static void free_change(pep_change_t *c)
+{
+    int i;
+
+    if (c == NULL)
+        return;
+
+    mrp_list_delete(&c->hook);
+
+    if (c->values != NULL) {
+        for (i = 0; i < c->nvalue; i++)
+            if (c->values[i].type == MRP_DOMCTL_STRING)
+                mrp_free((char *)c->values[i].str);
+        mrp_free(c->values);
+    }
+
+    mrp_free(c->key);
+    mrp_free(c);
+}
+
+
+void reset_table_changes(pep_table_t *t)
+{
+    mrp_list_hook_t *p, *n;
+    pep_change_t    *c;
+
+    if (t->chash != NULL)
+        mrp_htbl_reset(t->chash, FALSE);
+
+    mrp_list_foreach(&t->changes, p, n) {
+        c = mrp_list_entry(p, typeof(*c), hook);
+        free_change(c);
+    }
+
+    t->nchange = 0;
+    t->resync  = false;
+}
+
+
+static pep_change_t *track_change(pep_table_t *t, mrp_domctl_value_t *row)
+{
+    pep_change_t *c;
+    char          key[1024];
+    int           i, col;
+
+    if (row_key(t, row, key, sizeof(key)) < 0)
+        return NULL;
+
+    if ((c = mrp_htbl_lookup(t->chash, key)) != NULL)
+        return c;
+
+    if (t->nchange >= MAX_TRACKED_CHANGES)
+        return NULL;
+
+    if ((c = mrp_allocz(sizeof(*c))) == NULL)
+        return NULL;
+
+    mrp_list_init(&c->hook);
+
+    c->key    = mrp_strdup(key);
+    c->values = mrp_allocz_array(mrp_domctl_value_t, t->ncolumn);
+    c->nvalue = t->ncolumn;
+
+    if (c->key == NULL || c->values == NULL)
+        goto fail;
+
+    for (i = 0; i < t->nidx_col; i++) {
+        col = t->idx_cols[i];
+
+        c->values[col]      = row[col];
+        c->values[col].type = column_type(t->columns[col].type);
+
+        if (c->values[col].type == MRP_DOMCTL_STRING) {
+            c->values[col].str = mrp_strdup(row[col].str ? row[col].str : "");
+
+            if (c->values[col].str == NULL)
+                goto fail;
+        }
+    }
+
+    if (!mrp_htbl_insert(t->chash, c->key, c))
+        goto fail;
+
+    mrp_list_append(&t->changes, &c->hook);
+    t->nchange++;
+
+    return c;
+
+ fail:
+    free_change(c);
+    return NULL;
+}
+
+
+static void record_change(pep_table_t *t, mqi_event_t *e)
+{
+    mrp_domctl_value_t *row;
+    pep_change_t       *c;
+    int                 col, i;
+
+    if (t->resync || t->chash == NULL || t->nidx_col == 0)
+        return;
+
+    switch (e->event) {
+    case mqi_column_changed:
+        col = e->column.column.index;
+
+        for (i = 0; i < t->nidx_col; i++) {
+            if (t->idx_cols[i] == col) {
+                t->resync = true;
+                return;
+            }
+        }
+
+        row = e->column.select.data;
+        break;
+
+    case mqi_row_inserted:
+    case mqi_row_deleted:
+        row = e->row.select.data;
+        break;
+
+    default:
+        t->resync = true;
+        return;
+    }
+
+    if ((c = track_change(t, row)) == NULL) {
+        t->resync = true;
+        return;
+    }
+
+    switch (e->event) {
+    case mqi_column_changed: mqi_bitfld_set(&c->mask, col); break;
+    case mqi_row_inserted:   c->inserted = true;            break;
+    case mqi_row_deleted:    c->deleted  = true;            break;
+    default:                                                break;
+    }
+}
+
+
 static void table_change_cb(mqi_event_t *e, void *tptr)
 {
     static const char *events[] = {
@@ -73,6 +280,8 @@ static void table_change_cb(mqi_event_t *e, void *tptr)
         t->changed = true;
         mrp_debug("table '%s' changed by %s event", t->name, events[e->event]);
     }
+
+    record_change(t, e);
 }
 
 
@@ -97,14 +306,18 @@ static int add_table_triggers(pep_table_t *t)
         return -1;
     }
 
-    if (mdb_trigger_add_row_callback(tbl, table_change_cb, t, NULL)) {
+    /*
+     * Have the triggers pass us the full changed row (laid out as an
+     * array of mrp_domctl_value_t's), so we can track changes by key.
+     */
+    if (mdb_trigger_add_row_callback(tbl, table_change_cb, t, t->coldesc)) {
         errno = EINVAL;
         return -1;
     }
 
     for (i = 0; i < ncol; i++) {
         if (mdb_trigger_add_column_callback(tbl, i, table_change_cb,
-                                            t, NULL) < 0) {
+                                            t, t->coldesc) < 0) {
             mdb_trigger_delete_row_callback(tbl, table_change_cb, t);
             errno = EINVAL;
             return -1;
@@ -161,8 +374,17 @@ static void table_event_cb(mqi_event_t *e, void *user_data)
     if (t != NULL) {
         t->changed = true;
 
+        reset_table_changes(t);
+        t->resync = true;
+
         if (e->event == mqi_table_created) {
             t->h = h;
+
+            free_table_description(t);
+
+            if (get_table_description(t))
+                get_index_columns(t);
+
             add_table_triggers(t);
         }
         else {
@@ -341,6 +563,56 @@ static int get_table_description(pep_table_t *t)
 }
 
 
+static void free_table_description(pep_table_t *t)
+{
+    mrp_free(t->columns);
+    mrp_free(t->coldesc);
+    mrp_free(t->idx_cols);
+    mrp_free(t->upddesc);
+
+    t->columns  = NULL;
+    t->coldesc  = NULL;
+    t->ncolumn  = 0;
+    t->idx_cols = NULL;
+    t->nidx_col = 0;
+    t->upddesc  = NULL;
+}
+
+
+static int get_index_columns(pep_table_t *t)
+{
+    int i, j, n;
+
+    t->idx_cols = mrp_allocz_array(typeof(*t->idx_cols), t->ncolumn);
+    t->upddesc  = mrp_allocz_array(typeof(*t->upddesc), t->ncolumn + 1);
+
+    if (t->idx_cols == NULL || t->upddesc == NULL)
+        return FALSE;
+
+    for (i = n = 0; i < t->ncolumn; i++)
+        if (t->columns[i].flags & MQI_COLUMN_KEY)
+            t->idx_cols[n++] = i;
+
+    t->nidx_col = n;
+
+    for (i = j = 0; i < t->ncolumn; i++) {
+        for (n = 0; n < t->nidx_col; n++)
+            if (t->idx_cols[n] == i)
+                break;
+
+        if (n < t->nidx_col)
+            continue;
+
+        t->upddesc[j++] = t->coldesc[i];
+    }
+
+    t->upddesc[j].cindex = -1;
+    t->upddesc[j].offset = 0;
+
+    return TRUE;
+}
+
+
 int create_proxy_table(pep_table_t *t, int *errcode, const char **errmsg)
 {
     mrp_list_init(&t->hook);
@@ -360,6 +632,9 @@ int create_proxy_table(pep_table_t *t, int *errcode, const char **errmsg)
         if (!get_table_description(t))
             FAIL(EINVAL, "DB error: failed to get table description");
 
+        if (!get_index_columns(t))
+            FAIL(EINVAL, "DB error: failed to get table index columns");
+
         return TRUE;
     }
     else
@@ -382,12 +657,17 @@ void destroy_proxy_table(pep_table_t *t)
 
     mrp_free(t->columns);
     mrp_free(t->coldesc);
+    mrp_free(t->idx_cols);
+    mrp_free(t->upddesc);
     mrp_free(t->name);
 
-    t->name    = NULL;
-    t->h       = MQI_HANDLE_INVALID;
-    t->columns = NULL;
-    t->ncolumn = 0;
+    t->name     = NULL;
+    t->h        = MQI_HANDLE_INVALID;
+    t->columns  = NULL;
+    t->ncolumn  = 0;
+    t->idx_cols = NULL;
+    t->nidx_col = 0;
+    t->upddesc  = NULL;
 }
 
 
@@ -410,21 +690,31 @@ void destroy_proxy_tables(pep_proxy_t *proxy)
 
 pep_table_t *create_watch_table(pdp_t *pdp, const char *name)
 {
-    pep_table_t *t;
+    pep_table_t       *t;
+    mrp_htbl_config_t  hcfg;
 
     t = mrp_allocz(sizeof(*t));
 
     if (t != NULL) {
         mrp_list_init(&t->hook);
         mrp_list_init(&t->watches);
+        mrp_list_init(&t->changes);
+        mrp_list_init(&t->mirrors);
+
+        mrp_clear(&hcfg);
+        hcfg.comp = mrp_string_comp;
+        hcfg.hash = mrp_string_hash;
 
-        t->h    = MQI_HANDLE_INVALID;
-        t->name = mrp_strdup(name);
+        t->h      = MQI_HANDLE_INVALID;
+        t->name   = mrp_strdup(name);
+        t->chash  = mrp_htbl_create(&hcfg);
+        t->resync = true;
 
-        if (t->name == NULL)
+        if (t->name == NULL || t->chash == NULL)
             goto fail;
 
-        get_table_description(t);
+        if (get_table_description(t))
+            get_index_columns(t);
 
         if (t->h != MQI_HANDLE_INVALID)
             add_table_triggers(t);
@@ -458,8 +748,10 @@ static void destroy_table_watches(pep_table_t *t)
             mrp_list_delete(&w->tbl_hook);
             mrp_list_delete(&w->pep_hook);
 
+            put_table_mirror(w->mirror);
             mrp_free(w->mql_columns);
             mrp_free(w->mql_where);
+            mrp_free(w->columns);
             mrp_free(w);
         }
     }
@@ -475,6 +767,12 @@ void destroy_watch_table(pdp_t *pdp, pep_table_t *t)
         mrp_htbl_remove(pdp->watched, t->name, FALSE);
 
     destroy_table_watches(t);
+
+    reset_table_changes(t);
+    mrp_htbl_destroy(t->chash, FALSE);
+    t->chash = NULL;
+
+    free_table_description(t);
 }
 
 
@@ -497,6 +795,7 @@ static void purge_watch_table_cb(void *key, void *entry)
 int create_proxy_watch(pep_proxy_t *proxy, int id,
                        const char *table, const char *mql_columns,
                        const char *mql_where, int max_rows,
+                       uint32_t min_interval, uint32_t max_latency,
                        int *error, const char **errmsg)
 {
     pdp_t       *pdp = proxy->pdp;
@@ -524,9 +823,13 @@ int create_proxy_watch(pep_proxy_t *proxy, int id,
         w->mql_columns  = mrp_strdup(mql_columns);
         w->mql_where    = mrp_strdup(mql_where ? mql_where : "");
         w->max_rows     = max_rows;
+        w->min_interval = min_interval;
+        w->max_latency  = max_latency;
         w->proxy        = proxy;
         w->id           = id;
         w->notify       = true;
+        w->delta        = -1;
+        w->resync       = true;
 
         if (w->mql_columns == NULL || w->mql_where == NULL)
             goto fail;
@@ -534,6 +837,11 @@ int create_proxy_watch(pep_proxy_t *proxy, int id,
         mrp_list_append(&t->watches, &w->tbl_hook);
         mrp_list_append(&proxy->watches, &w->pep_hook);
 
+        /* without a mirror the client simply gets its rows over the wire */
+        if (proxy->mirror && t != NULL)
+            w->mirror = get_table_mirror(pdp, t, w->mql_columns,
+                                         w->mql_where);
+
         return TRUE;
     }
     else {
@@ -564,12 +872,83 @@ void destroy_proxy_watches(pep_proxy_t *proxy)
             mrp_list_delete(&w->tbl_hook);
             mrp_list_delete(&w->pep_hook);
 
+            put_table_mirror(w->mirror);
+            mrp_free(w->mql_columns);
+            mrp_free(w->mql_where);
+            mrp_free(w->columns);
             mrp_free(w);
         }
     }
 }
 
 
+/*
+ * Watches of mirroring clients with identical selections share a mirror,
+ * so the rows of a selection are packed and published only once however
+ * many clients are watching it.
+ */
+
+static pep_mirror_t *get_table_mirror(pdp_t *pdp, pep_table_t *t,
+                                      const char *mql_columns,
+                                      const char *mql_where)
+{
+    mrp_list_hook_t *p, *n;
+    pep_mirror_t    *m;
+    char             name[64];
+
+    mrp_list_foreach(&t->mirrors, p, n) {
+        m = mrp_list_entry(p, typeof(*m), hook);
+
+        if (!strcmp(m->mql_columns, mql_columns) &&
+            !strcmp(m->mql_where, mql_where)) {
+            m->refcnt++;
+            return m;
+        }
+    }
+
+    if ((m = mrp_allocz(sizeof(*m))) == NULL)
+        return NULL;
+
+    mrp_list_init(&m->hook);
+    m->table       = t;
+    m->mql_columns = mrp_strdup(mql_columns);
+    m->mql_where   = mrp_strdup(mql_where);
+    m->refcnt      = 1;
+    m->stale       = true;
+
+    snprintf(name, sizeof(name), "/murphy-domctl-%u-%u",
+             (unsigned int)getpid(), ++pdp->nmirror);
+
+    if (m->mql_columns == NULL || m->mql_where == NULL ||
+        !mirror_create(&m->shm, name)) {
+        mrp_free(m->mql_columns);
+        mrp_free(m->mql_where);
+        mrp_free(m);
+
+        return NULL;
+    }
+
+    mrp_list_append(&t->mirrors, &m->hook);
+
+    mrp_log_info("Mirroring table %s in %s.", t->name, name);
+
+    return m;
+}
+
+
+static void put_table_mirror(pep_mirror_t *m)
+{
+    if (m == NULL || --m->refcnt > 0)
+        return;
+
+    mrp_list_delete(&m->hook);
+    mirror_close(&m->shm);
+    mrp_free(m->mql_columns);
+    mrp_free(m->mql_where);
+    mrp_free(m);
+}
+
+
 static void reset_proxy_tables(pep_proxy_t *proxy)
 {
     int i;
@@ -582,18 +961,23 @@ static void reset_proxy_tables(pep_proxy_t *proxy)
 static int insert_into_table(pep_table_t *t,
                              mrp_domctl_value_t **rows, int nrow)
 {
-    void *data[2];
-    int   i;
+    void **data;
+    int    i, n;
 
-    data[1] = NULL;
+    if (nrow <= 0)
+        return TRUE;
 
-    for (i = 0; i < nrow; i++) {
-        data[0] = rows[i];
-        if (mqi_insert_into(t->h, 0, t->coldesc, data) != 1)
-            return FALSE;
-    }
+    if ((data = mrp_allocz_array(void *, nrow + 1)) == NULL)
+        return FALSE;
 
-    return TRUE;
+    for (i = 0; i < nrow; i++)
+        data[i] = rows[i];
+
+    n = mqi_insert_into(t->h, 0, t->coldesc, data);
+
+    mrp_free(data);
+
+    return n == nrow;
 }
 
 
@@ -643,3 +1027,153 @@ int set_proxy_tables(pep_proxy_t *proxy, mrp_domctl_data_t *tables, int ntable,
 
     return FALSE;
 }
+
+
+static void index_condition(pep_table_t *t, mrp_domctl_value_t *row,
+                            mqi_cond_entry_t *cond);
+
+
+int fetch_table_row(pep_table_t *t, mrp_domctl_value_t *key,
+                    mrp_domctl_value_t *row)
+{
+    mqi_cond_entry_t cond[4 * MQI_COLUMN_MAX + 1];
+    int              n, i;
+
+    if (t->h == MQI_HANDLE_INVALID || t->nidx_col == 0)
+        return -1;
+
+    index_condition(t, key, cond);
+    n = mqi_select(t->h, cond, t->coldesc, row, sizeof(*row) * t->ncolumn, 1);
+
+    if (n == 1) {
+        for (i = 0; i < t->ncolumn; i++)
+            row[i].type = column_type(t->columns[i].type);
+    }
+
+    return n;
+}
+
+
+static void index_condition(pep_table_t *t, mrp_domctl_value_t *row,
+                            mqi_cond_entry_t *cond)
+{
+    mqi_cond_entry_t *ce = cond;
+    int               i, c;
+
+    for (i = 0; i < t->nidx_col; i++) {
+        c = t->idx_cols[i];
+
+        if (i > 0) {
+            ce->type        = mqi_operator;
+            ce->u.operator_ = mqi_and;
+            ce++;
+        }
+
+        ce->type     = mqi_column;
+        ce->u.column = c;
+        ce++;
+
+        ce->type        = mqi_operator;
+        ce->u.operator_ = mqi_eq;
+        ce++;
+
+        ce->type                 = mqi_variable;
+        ce->u.variable.type      = t->columns[c].type;
+        ce->u.variable.flags     = 0;
+        ce->u.variable.v.generic = &row[c].str;
+        ce++;
+    }
+
+    ce->type        = mqi_operator;
+    ce->u.operator_ = mqi_end;
+}
+
+
+static int update_table(pep_table_t *t, mrp_domctl_delta_t *delta)
+{
+    mqi_cond_entry_t    cond[4 * MQI_COLUMN_MAX + 1];
+    mrp_domctl_value_t *row;
+    void               *data[2];
+    int                 i;
+
+    data[1] = NULL;
+
+    for (i = 0; i < delta->nrow; i++) {
+        row = delta->rows[i];
+
+        switch (delta->ops[i]) {
+        case MRP_DOMCTL_ROW_INSERT:
+            data[0] = row;
+            if (mqi_insert_into(t->h, 0, t->coldesc, data) != 1)
+                return FALSE;
+            break;
+
+        case MRP_DOMCTL_ROW_UPDATE:
+            /*
+             * Only the non-index columns are written. MDB itself takes
+             * care of not logging or triggering anything for rows where
+             * none of the columns actually change.
+             */
+            if (t->nidx_col == 0)
+                return FALSE;
+            if (t->upddesc[0].cindex < 0)
+                break;
+            index_condition(t, row, cond);
+            if (mqi_update(t->h, cond, t->upddesc, row) < 0)
+                return FALSE;
+            break;
+
+        case MRP_DOMCTL_ROW_DELETE:
+            if (t->nidx_col == 0)
+                return FALSE;
+            index_condition(t, row, cond);
+            if (mqi_delete_from(t->h, cond) < 0)
+                return FALSE;
+            break;
+
+        default:
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+int update_proxy_tables(pep_proxy_t *proxy, mrp_domctl_delta_t *tables,
+                        int ntable, int *error, const char **errmsg)
+{
+    mqi_handle_t    tx;
+    pep_table_t    *t;
+    int             i, id;
+
+    tx = mqi_begin_transaction();
+
+    if (tx != MQI_HANDLE_INVALID) {
+        for (i = 0; i < ntable; i++) {
+            id = tables[i].id;
+
+            if (id < 0 || id >= proxy->ntable)
+                goto fail;
+
+            t = proxy->tables + id;
+
+            if (tables[i].ncolumn != t->ncolumn)
+                goto fail;
+
+            if (!update_table(t, tables + i))
+                goto fail;
+        }
+
+        mqi_commit_transaction(tx);
+
+        return TRUE;
+
+    fail:
+        *error  = EINVAL;
+        *errmsg = "failed to update tables";
+        mqi_rollback_transaction(tx);
+    }
+
+    return FALSE;
+}
@@ -43,6 +43,7 @@ int create_proxy_table(pep_table_t *t, int *errcode, const char **errmsg);
 int create_proxy_watch(pep_proxy_t *proxy, int id,
                        const char *table, const char *mql_columns,
                        const char *mql_where, int max_rows,
+                       uint32_t min_interval, uint32_t max_latency,
                        int *error, const char **errmsg);
 
 void destroy_watch_table(pdp_t *pdp, pep_table_t *t);
@@ -55,6 +56,14 @@ void destroy_proxy_watches(pep_proxy_t *proxy);
 int set_proxy_tables(pep_proxy_t *proxy, mrp_domctl_data_t *tables, int ntable,
                      int *error, const char **errmsg);
 
+int update_proxy_tables(pep_proxy_t *proxy, mrp_domctl_delta_t *tables,
+                        int ntable, int *error, const char **errmsg);
+
+int fetch_table_row(pep_table_t *t, mrp_domctl_value_t *key,
+                    mrp_domctl_value_t *row);
+
+void reset_table_changes(pep_table_t *t);
+
 int exec_mql(mql_result_type_t type, mql_result_t **resultp,
              const char *format, ...);
 
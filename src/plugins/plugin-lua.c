@@ -34,7 +34,9 @@
 #include <sys/stat.h>
 
 #include <murphy/common/macros.h>
+#include <murphy/common/profile.h>
 #include <murphy/core/plugin.h>
+#include <murphy/core/lua-utils/include.h>
 #include <murphy/core/lua-bindings/murphy.h>
 
 #define LUAR_INTERPRETER_NAME "lua"
@@ -43,14 +45,21 @@
 enum {
     ARG_CONFIG,                          /* configuration file */
     ARG_RESOLVER,                        /* enable resolver lua support */
+    ARG_ALLOCATOR,                       /* Lua allocator: pool or heap */
+    ARG_GC_MODE,                         /* GC mode */
+    ARG_GC_PAUSE,                        /* GC pause, 0 for default */
+    ARG_GC_STEPMUL,                      /* GC step multiplier, 0 for default */
+    ARG_GC_IDLE_STEP,                    /* kB per idle GC step, 0 disables */
 };
 
 
 static int load_config(lua_State *L, const char *path)
 {
-    int success;
+    int success, prof;
 
-    if (!luaL_loadfile(L, path) && !lua_pcall(L, 0, 0, 0))
+    prof = mrp_profile_begin("load Lua configuration %s", path);
+
+    if (!mrp_lua_load_file(L, path) && !lua_pcall(L, 0, 0, 0))
         success = TRUE;
     else {
         mrp_log_error("plugin-lua: failed to load config file %s.", path);
@@ -60,6 +69,8 @@ static int load_config(lua_State *L, const char *path)
         success = FALSE;
     }
 
+    mrp_profile_end(prof);
+
     return success;
 }
 
@@ -144,14 +155,33 @@ static int plugin_init(mrp_plugin_t *plugin)
         .cleanup = luaR_cleanup,
         .data    = NULL
     };
-    mrp_plugin_arg_t *args = plugin->args;
-    const char       *cfg  = args[ARG_CONFIG].str;
-    int               res  = args[ARG_RESOLVER].bln;
-    lua_State        *L;
+    mrp_plugin_arg_t    *args  = plugin->args;
+    const char          *cfg   = args[ARG_CONFIG].str;
+    int                  res   = args[ARG_RESOLVER].bln;
+    const char          *alloc = args[ARG_ALLOCATOR].str;
+    mrp_lua_gc_config_t  gc;
+    lua_State           *L;
+
+    if (!strcmp(alloc, "heap"))
+        mrp_lua_set_allocator(MRP_LUA_ALLOC_HEAP);
+    else if (!strcmp(alloc, "pool"))
+        mrp_lua_set_allocator(MRP_LUA_ALLOC_POOL);
+    else {
+        mrp_log_error("plugin-lua: invalid allocator '%s'.", alloc);
+        return FALSE;
+    }
 
     L = mrp_lua_set_murphy_context(plugin->ctx);
 
     if (L != NULL) {
+        gc.mode      = args[ARG_GC_MODE].str;
+        gc.pause     = args[ARG_GC_PAUSE].i32;
+        gc.stepmul   = args[ARG_GC_STEPMUL].i32;
+        gc.idle_step = args[ARG_GC_IDLE_STEP].i32;
+
+        if (!mrp_lua_set_gc(&gc))
+            return FALSE;
+
         if (res) {
             interpreter.data = L;
 
@@ -196,6 +226,11 @@ static void plugin_exit(mrp_plugin_t *plugin)
 static mrp_plugin_arg_t plugin_args[] = {
     MRP_PLUGIN_ARGIDX(ARG_CONFIG  , STRING,  "config",  DEFAULT_CONFIG),
     MRP_PLUGIN_ARGIDX(ARG_RESOLVER, BOOL  , "resolver",TRUE),
+    MRP_PLUGIN_ARGIDX(ARG_ALLOCATOR, STRING, "allocator"   , "pool"),
+    MRP_PLUGIN_ARGIDX(ARG_GC_MODE, STRING  , "gc-mode"     , "incremental"),
+    MRP_PLUGIN_ARGIDX(ARG_GC_PAUSE, INT32  , "gc-pause"    , 0),
+    MRP_PLUGIN_ARGIDX(ARG_GC_STEPMUL, INT32, "gc-stepmul"  , 0),
+    MRP_PLUGIN_ARGIDX(ARG_GC_IDLE_STEP, INT32, "gc-idle-step", 0),
 };
 
 MURPHY_REGISTER_PLUGIN("lua",
@@ -0,0 +1,515 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <murphy/common.h>
+#include <murphy/common/metrics.h>
+#include <murphy/core.h>
+
+#include <murphy-db/mdb.h>
+
+#define DEFAULT_ADDRESS "unxs:@murphy-metrics"    /* default address */
+#define REQUEST_MAX     2048                      /* max. request size */
+
+/*
+ * The metrics plugin serves the registered metrics in the Prometheus text
+ * exposition format over a stream socket. A client either sends an HTTP
+ * GET request, to which an HTTP response is sent, or anything terminated
+ * by an empty line, in which case the plain metrics are sent. Either way
+ * the connection is closed once the response has been written out.
+ */
+
+typedef struct {
+    mrp_context_t   *ctx;                 /* murphy context */
+    const char      *address;             /* listening address */
+    int              sock;                /* listening socket */
+    mrp_io_watch_t  *w;                   /* listening socket watch */
+    mrp_list_hook_t  clients;             /* connected clients */
+    mrp_metric_t    *metrics[8];          /* metrics we registered */
+    int              nmetric;             /* number of metrics */
+} metrics_t;
+
+typedef struct {
+    mrp_list_hook_t  hook;                /* to list of clients */
+    metrics_t       *data;                /* plugin data */
+    int              sock;                /* client socket */
+    mrp_io_watch_t  *w;                   /* client socket watch */
+    char             req[REQUEST_MAX];    /* request being read */
+    size_t           nreq;                /* amount of request read */
+    char            *rsp;                 /* response being written */
+    size_t           nrsp;                /* response size */
+    size_t           sent;                /* amount of response written */
+} client_t;
+
+
+static void client_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
+                      void *user_data);
+
+
+static void close_client(client_t *c)
+{
+    mrp_list_delete(&c->hook);
+    mrp_del_io_watch(c->w);
+    close(c->sock);
+    free(c->rsp);                        /* allocated by open_memstream */
+    mrp_free(c);
+}
+
+
+/*
+ * memory charged to allocation accounting tags, as labeled gauges
+ */
+
+typedef struct {
+    FILE *fp;                            /* stream to dump to */
+    int   objs;                          /* dump blocks instead of bytes */
+} tag_dump_t;
+
+
+static int dump_tag_cb(const mrp_mm_tag_stat_t *st, void *user_data)
+{
+    tag_dump_t *d = (tag_dump_t *)user_data;
+
+    fprintf(d->fp, "murphy_mm_tag_%s{tag=\"%s\"} %lld\n",
+            d->objs ? "blocks" : "bytes", st->name,
+            (long long)(d->objs ? st->objs : st->bytes));
+
+    return TRUE;
+}
+
+
+static void dump_tags(FILE *fp)
+{
+    tag_dump_t d;
+
+    if (!mrp_mm_accounting())
+        return;
+
+    d.fp   = fp;
+    d.objs = FALSE;
+
+    fprintf(fp, "# HELP murphy_mm_tag_bytes Live bytes charged to a tag.\n"
+            "# TYPE murphy_mm_tag_bytes gauge\n");
+    mrp_mm_tag_foreach(dump_tag_cb, &d);
+
+    d.objs = TRUE;
+
+    fprintf(fp, "# HELP murphy_mm_tag_blocks Live blocks charged to a tag.\n"
+            "# TYPE murphy_mm_tag_blocks gauge\n");
+    mrp_mm_tag_foreach(dump_tag_cb, &d);
+}
+
+
+static int prepare_response(client_t *c)
+{
+    char   *body;
+    size_t  size;
+    FILE   *fp;
+    int     http;
+
+    if ((fp = open_memstream(&body, &size)) == NULL)
+        return FALSE;
+
+    mrp_metrics_dump(fp);
+    dump_tags(fp);
+    fclose(fp);
+
+    http = !strncmp(c->req, "GET ", 4);
+
+    if (!http) {
+        c->rsp  = body;
+        c->nrsp = size;
+
+        return TRUE;
+    }
+
+    if ((fp = open_memstream(&c->rsp, &c->nrsp)) == NULL) {
+        free(body);
+        return FALSE;
+    }
+
+    fprintf(fp, "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %zu\r\n"
+            "Connection: close\r\n"
+            "\r\n", size);
+    fwrite(body, 1, size, fp);
+    fclose(fp);
+
+    free(body);
+
+    return TRUE;
+}
+
+
+static int write_response(client_t *c)
+{
+    mrp_mainloop_t *ml = c->data->ctx->ml;
+    ssize_t         n;
+
+    while (c->sent < c->nrsp) {
+        n = write(c->sock, c->rsp + c->sent, c->nrsp - c->sent);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                return FALSE;
+
+            /* socket buffer full, wait until we can write again */
+            if (c->w != NULL && c->nreq != 0) {
+                mrp_del_io_watch(c->w);
+                c->w    = mrp_add_io_watch(ml, c->sock, MRP_IO_EVENT_OUT,
+                                           client_cb, c);
+                c->nreq = 0;
+            }
+
+            return c->w != NULL;
+        }
+
+        c->sent += n;
+    }
+
+    return FALSE;
+}
+
+
+static void client_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
+                      void *user_data)
+{
+    client_t *c = (client_t *)user_data;
+    ssize_t   n;
+
+    MRP_UNUSED(w);
+
+    if (c->rsp != NULL) {
+        if (!write_response(c))
+            close_client(c);
+        return;
+    }
+
+    if (events & MRP_IO_EVENT_IN) {
+        n = read(fd, c->req + c->nreq, sizeof(c->req) - 1 - c->nreq);
+
+        if (n <= 0) {
+            if (n < 0 && (errno == EAGAIN || errno == EINTR))
+                return;
+            close_client(c);
+            return;
+        }
+
+        c->nreq += n;
+        c->req[c->nreq] = '\0';
+
+        if (!strstr(c->req, "\r\n\r\n") && !strstr(c->req, "\n\n") &&
+            strcmp(c->req, "\n") && c->nreq < sizeof(c->req) - 1)
+            return;
+
+        if (!prepare_response(c) || !write_response(c))
+            close_client(c);
+    }
+    else if (events & MRP_IO_EVENT_HUP)
+        close_client(c);
+}
+
+
+static void connection_cb(mrp_io_watch_t *w, int fd, mrp_io_event_t events,
+                          void *user_data)
+{
+    metrics_t      *data = (metrics_t *)user_data;
+    mrp_mainloop_t *ml   = data->ctx->ml;
+    client_t       *c;
+    int             sock;
+
+    MRP_UNUSED(w);
+    MRP_UNUSED(events);
+
+    if ((sock = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0) {
+        mrp_log_error("metrics: failed to accept connection (%d: %s).",
+                      errno, strerror(errno));
+        return;
+    }
+
+    if ((c = mrp_allocz(sizeof(*c))) != NULL) {
+        mrp_list_init(&c->hook);
+        c->data = data;
+        c->sock = sock;
+        c->w    = mrp_add_io_watch(ml, sock,
+                                   MRP_IO_EVENT_IN | MRP_IO_EVENT_HUP,
+                                   client_cb, c);
+
+        if (c->w != NULL) {
+            mrp_list_append(&data->clients, &c->hook);
+            return;
+        }
+
+        mrp_free(c);
+    }
+
+    close(sock);
+}
+
+
+static int setup_socket(metrics_t *data)
+{
+    mrp_sockaddr_t  addr;
+    socklen_t       alen;
+    const char     *type;
+    int             on;
+
+    alen = mrp_transport_resolve(NULL, data->address, &addr, sizeof(addr),
+                                 &type);
+
+    if (alen <= 0 || (strcmp(type, "unxs") && strcmp(type, "tcp4") &&
+                      strcmp(type, "tcp6"))) {
+        mrp_log_error("metrics: invalid address '%s'.", data->address);
+        return FALSE;
+    }
+
+    data->sock = socket(addr.any.sa_family,
+                        SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (data->sock < 0)
+        goto fail;
+
+    on = 1;
+    setsockopt(data->sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    /* remove any stale (non-abstract) socket left behind by a previous run */
+    if (addr.any.sa_family == AF_UNIX && addr.unx.sun_path[0])
+        unlink(addr.unx.sun_path);
+
+    if (bind(data->sock, &addr.any, alen) < 0 || listen(data->sock, 4) < 0)
+        goto fail;
+
+    data->w = mrp_add_io_watch(data->ctx->ml, data->sock, MRP_IO_EVENT_IN,
+                               connection_cb, data);
+
+    if (data->w != NULL)
+        return TRUE;
+
+ fail:
+    mrp_log_error("metrics: failed to listen on '%s' (%d: %s).",
+                  data->address, errno, strerror(errno));
+
+    if (data->sock >= 0)
+        close(data->sock);
+    data->sock = -1;
+
+    return FALSE;
+}
+
+
+/*
+ * metrics maintained elsewhere, exported as callback metrics
+ */
+
+static int64_t mdb_stat_cb(void *user_data)
+{
+    mdb_transaction_stats_t stats;
+    ptrdiff_t               offs = (ptrdiff_t)user_data;
+
+    if (mdb_transaction_get_statistics(&stats) < 0)
+        return 0;
+
+    return *(uint64_t *)((char *)&stats + offs);
+}
+
+
+static int64_t mdb_pending_cb(void *user_data)
+{
+    MRP_UNUSED(user_data);
+
+    return mdb_log_get_pending();
+}
+
+
+static int64_t log_dropped_cb(void *user_data)
+{
+    MRP_UNUSED(user_data);
+
+    return (int64_t)mrp_log_get_dropped();
+}
+
+
+static int64_t log_suppressed_cb(void *user_data)
+{
+    MRP_UNUSED(user_data);
+
+    return (int64_t)mrp_log_get_suppressed();
+}
+
+
+static void register_metrics(metrics_t *data)
+{
+#define COUNTER MRP_METRIC_COUNTER
+#define GAUGE   MRP_METRIC_GAUGE
+#define MDB_STAT(field) mdb_stat_cb,                                    \
+        (void *)offsetof(mdb_transaction_stats_t, field)
+
+    static struct {
+        const char        *name;
+        const char        *help;
+        mrp_metric_type_t  type;
+        mrp_metric_cb_t    cb;
+        void              *user_data;
+    } metrics[] = {
+        { "murphy_mdb_transactions_total", "Number of MDB transactions.",
+          COUNTER, MDB_STAT(begun)                                        },
+        { "murphy_mdb_commits_total", "Number of MDB transactions committed.",
+          COUNTER, MDB_STAT(committed)                                    },
+        { "murphy_mdb_rollbacks_total",
+          "Number of MDB transactions rolled back.",
+          COUNTER, MDB_STAT(rolledback)                                   },
+        { "murphy_mdb_commit_failures_total",
+          "Number of failed MDB transaction commits.",
+          COUNTER, MDB_STAT(failed)                                       },
+        { "murphy_mdb_pending_changes",
+          "Number of changes in open MDB transactions.",
+          GAUGE, mdb_pending_cb, NULL                                     },
+        { "murphy_log_dropped_total",
+          "Number of asynchronous log messages dropped.",
+          COUNTER, log_dropped_cb, NULL                                   },
+        { "murphy_log_suppressed_total",
+          "Number of log messages suppressed by rate limiting.",
+          COUNTER, log_suppressed_cb, NULL                                },
+    };
+    mrp_metric_t *m;
+    size_t        i;
+
+    for (i = 0; i < MRP_ARRAY_SIZE(metrics); i++) {
+        m = mrp_metric_callback(metrics[i].name, metrics[i].help,
+                                metrics[i].type, metrics[i].cb,
+                                metrics[i].user_data);
+
+        if (m != NULL && data->nmetric < (int)MRP_ARRAY_SIZE(data->metrics))
+            data->metrics[data->nmetric++] = m;
+    }
+
+#undef MDB_STAT
+#undef GAUGE
+#undef COUNTER
+}
+
+
+static void unregister_metrics(metrics_t *data)
+{
+    while (data->nmetric > 0)
+        mrp_metric_unregister(data->metrics[--data->nmetric]);
+}
+
+
+enum {
+    ARG_ADDRESS,                         /* address to serve metrics on */
+};
+
+
+static int metrics_init(mrp_plugin_t *plugin)
+{
+    metrics_t *data;
+
+    if ((data = mrp_allocz(sizeof(*data))) == NULL)
+        return FALSE;
+
+    mrp_list_init(&data->clients);
+    data->ctx     = plugin->ctx;
+    data->address = plugin->args[ARG_ADDRESS].str;
+    data->sock    = -1;
+
+    if (!setup_socket(data)) {
+        mrp_free(data);
+        return FALSE;
+    }
+
+    register_metrics(data);
+
+    mrp_log_info("metrics: serving metrics on '%s'.", data->address);
+
+    plugin->data = data;
+
+    return TRUE;
+}
+
+
+static void metrics_exit(mrp_plugin_t *plugin)
+{
+    metrics_t       *data = (metrics_t *)plugin->data;
+    mrp_list_hook_t *p, *n;
+    client_t        *c;
+
+    if (data == NULL)
+        return;
+
+    mrp_list_foreach(&data->clients, p, n) {
+        c = mrp_list_entry(p, typeof(*c), hook);
+        close_client(c);
+    }
+
+    unregister_metrics(data);
+
+    mrp_del_io_watch(data->w);
+    close(data->sock);
+
+    mrp_free(data);
+    plugin->data = NULL;
+}
+
+
+#define METRICS_DESCRIPTION "Prometheus-style metrics exporter for Murphy."
+#define METRICS_HELP \
+    "The metrics plugin serves the counters, gauges and histograms in\n"  \
+    "the Murphy metrics registry in the Prometheus text format over HTTP\n"\
+    "on a TCP or UNIX stream socket."
+#define METRICS_VERSION MRP_VERSION_INT(0, 0, 1)
+#define METRICS_AUTHORS "Krisztian Litkey <kli@iki.fi>"
+
+
+static mrp_plugin_arg_t metrics_args[] = {
+    MRP_PLUGIN_ARGIDX(ARG_ADDRESS, STRING, "address", DEFAULT_ADDRESS),
+};
+
+
+MURPHY_REGISTER_PLUGIN("metrics",
+                       METRICS_VERSION, METRICS_DESCRIPTION,
+                       METRICS_AUTHORS, METRICS_HELP, MRP_SINGLETON,
+                       metrics_init, metrics_exit,
+                       metrics_args, MRP_ARRAY_SIZE(metrics_args),
+                       NULL, 0, NULL, 0, NULL);
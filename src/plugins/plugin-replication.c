@@ -0,0 +1,1712 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <alloca.h>
+
+#include <murphy/common.h>
+#include <murphy/core.h>
+
+#include <murphy-db/mqi.h>
+
+#define DEFAULT_ADDRESS "unxs:@murphy-replication" /* default address */
+#define DEFAULT_MAXLAG  64               /* max. unacknowledged messages */
+#define DEFAULT_OUTQ    (256 * 1024)     /* output queue high watermark */
+#define DEFAULT_RETRY   5                /* reconnect interval (seconds) */
+#define SNAPSHOT_BATCH  64               /* rows fetched at a time */
+
+/*
+ * MDB table replication
+ *
+ * A publishing daemon streams the committed change-sets of selected
+ * tables to the replicas connected to it. A replica subscribes to some
+ * of these tables, gets a snapshot of each to bootstrap from, and then
+ * applies every subsequent change-set as a single transaction, so its
+ * local triggers see each replicated transaction once. Updates only
+ * write the columns that changed.
+ *
+ * Each table has its own change-set sequence number. A replica that
+ * sees a gap in the sequence asks for a new snapshot of the table. The
+ * publisher bounds how far a replica can fall behind: once a replica
+ * has more than max-lag messages unacknowledged, or its transport is
+ * congested, the publisher stops streaming deltas to it and sends fresh
+ * snapshots of the affected tables once it has caught up.
+ *
+ * Replication topologies must be trees: a replica may republish the
+ * tables it replicates, but tables must not be replicated in a cycle.
+ */
+
+typedef enum {
+    MSG_SUBSCRIBE = 1,                   /* replica subscribes to tables */
+    MSG_SNAPSHOT,                        /* full contents of a table */
+    MSG_CHANGES,                         /* change-set of a transaction */
+    MSG_ACK,                             /* replica acknowledges messages */
+    MSG_RESYNC,                          /* replica asks for new snapshots */
+} msg_type_t;
+
+enum {
+    TAG_MSGTYPE = 1,                     /* message type */
+    TAG_COUNT,                           /* acknowledged messages */
+    TAG_NTABLE,                          /* number of tables */
+    TAG_TABLE,                           /* table name */
+    TAG_SEQ,                             /* change-set sequence number */
+    TAG_NCOLUMN,                         /* number of columns */
+    TAG_COLNAME,                         /* column name */
+    TAG_COLTYPE,                         /* column type */
+    TAG_COLLEN,                          /* column length */
+    TAG_COLFLAGS,                        /* column flags */
+    TAG_NROW,                            /* number of rows */
+    TAG_NCHANGE,                         /* number of changes */
+    TAG_CHANGE,                          /* change type */
+    TAG_NVALUE,                          /* number of updated columns */
+    TAG_COLUMN,                          /* updated column */
+    TAG_VALUE,                           /* column value */
+};
+
+typedef enum {
+    CHANGE_INSERT = 1,                   /* row inserted */
+    CHANGE_DELETE,                       /* row deleted */
+    CHANGE_UPDATE,                       /* columns of a row updated */
+} change_type_t;
+
+typedef struct repl_s repl_t;
+
+/*
+ * A row is laid out as one mqi_change_data_t per column, both in the
+ * change-sets we get from our triggers and the rows we write to MDB.
+ */
+typedef mqi_change_data_t value_t;
+
+typedef struct {
+    mrp_list_hook_t    hook;             /* to published/replicated tables */
+    repl_t            *r;                /* replication context */
+    char              *name;             /* table name */
+    mqi_handle_t       h;                /* table handle, if table exists */
+    mqi_column_def_t  *columns;          /* column definitions */
+    mqi_column_desc_t *coldesc;          /* row layout */
+    int                ncolumn;          /* number of columns */
+    int               *keys;             /* index columns */
+    int                nkey;             /* number of index columns */
+    uint32_t           seq;              /* last change-set sequence number */
+    bool               synced;           /* replica is bootstrapped */
+} table_t;
+
+typedef struct {
+    mrp_list_hook_t  hook;               /* to list of replicas */
+    repl_t          *r;                  /* replication context */
+    mrp_transport_t *t;                  /* transport to replica */
+    table_t        **tables;             /* subscribed tables */
+    bool            *dirty;              /* table needs a snapshot */
+    int              ntable;             /* number of subscribed tables */
+    uint32_t         sent;               /* messages sent */
+    uint32_t         acked;              /* messages acknowledged */
+    bool             congested;          /* output queue congested */
+    bool             lagging;            /* deltas suspended */
+} peer_t;
+
+struct repl_s {
+    mrp_context_t   *ctx;                /* murphy context */
+    uint32_t         max_lag;            /* max. unacknowledged messages */
+    size_t           outq;               /* output queue high watermark */
+    /* publishing */
+    const char      *address;            /* address to serve replicas on */
+    mrp_transport_t *lt;                 /* listening transport */
+    mrp_list_hook_t  published;          /* published tables */
+    mrp_list_hook_t  peers;              /* connected replicas */
+    /* replicating */
+    const char      *upstream;           /* address to replicate from */
+    mrp_sockaddr_t   addr;               /* resolved upstream address */
+    socklen_t        alen;               /* address length */
+    const char      *ttype;              /* upstream transport type */
+    mrp_transport_t *ut;                 /* transport to upstream */
+    mrp_timer_t     *rt;                 /* reconnect timer */
+    int              retry;              /* reconnect interval */
+    mrp_list_hook_t  replicated;         /* replicated tables */
+    uint32_t         applied;            /* messages received from upstream */
+    mrp_deferred_t  *ack;                /* acknowledgement, if pending */
+};
+
+static void table_event_cb(mqi_event_t *e, void *user_data);
+static void changes_cb(mqi_event_t *e, void *user_data);
+static int send_snapshot(peer_t *p, int idx);
+
+
+/*
+ * tables
+ */
+
+static table_t *create_table(repl_t *r, mrp_list_hook_t *list,
+                             const char *name)
+{
+    table_t *t;
+
+    if ((t = mrp_allocz(sizeof(*t))) == NULL)
+        return NULL;
+
+    mrp_list_init(&t->hook);
+    t->r    = r;
+    t->h    = MQI_HANDLE_INVALID;
+    t->name = mrp_strdup(name);
+
+    if (t->name == NULL) {
+        mrp_free(t);
+        return NULL;
+    }
+
+    mrp_list_append(list, &t->hook);
+
+    return t;
+}
+
+
+static void forget_table(table_t *t)
+{
+    int i;
+
+    if (t->columns != NULL)
+        for (i = 0; i < t->ncolumn; i++)
+            mrp_free((char *)t->columns[i].name);
+
+    mrp_free(t->columns);
+    mrp_free(t->coldesc);
+    mrp_free(t->keys);
+
+    t->columns = NULL;
+    t->coldesc = NULL;
+    t->keys    = NULL;
+    t->ncolumn = 0;
+    t->nkey    = 0;
+}
+
+
+static void destroy_table(table_t *t)
+{
+    mrp_list_delete(&t->hook);
+    forget_table(t);
+    mrp_free(t->name);
+    mrp_free(t);
+}
+
+
+static table_t *lookup_table(mrp_list_hook_t *list, const char *name)
+{
+    mrp_list_hook_t *p, *n;
+    table_t         *t;
+
+    mrp_list_foreach(list, p, n) {
+        t = mrp_list_entry(p, typeof(*t), hook);
+
+        if (!strcmp(t->name, name))
+            return t;
+    }
+
+    return NULL;
+}
+
+
+static int create_tables(repl_t *r, mrp_list_hook_t *list, const char *names)
+{
+    char        name[128];
+    const char *b, *e;
+    size_t      l;
+
+    if (names == NULL)
+        return TRUE;
+
+    b = names;
+
+    while (*b) {
+        while (*b == ',' || *b == ' ' || *b == '\t')
+            b++;
+
+        if (!*b)
+            break;
+
+        for (e = b; *e && *e != ',' && *e != ' ' && *e != '\t'; e++)
+            ;
+
+        if ((l = e - b) >= sizeof(name)) {
+            mrp_log_error("replication: invalid table name '%*.*s'.",
+                          (int)l, (int)l, b);
+            return FALSE;
+        }
+
+        strncpy(name, b, l);
+        name[l] = '\0';
+
+        if (lookup_table(list, name) == NULL &&
+            create_table(r, list, name) == NULL)
+            return FALSE;
+
+        b = e;
+    }
+
+    return TRUE;
+}
+
+
+/*
+ * Get the columns and the index of a table and set up the row layout
+ * we use for it.
+ */
+static int describe_table(table_t *t)
+{
+    mqi_column_def_t defs[MQI_COLUMN_MAX];
+    int              ncolumn, i;
+
+    forget_table(t);
+
+    ncolumn = mqi_describe(t->h, defs, MQI_COLUMN_MAX);
+
+    if (ncolumn <= 0)
+        return FALSE;
+
+    t->columns = mrp_allocz_array(mqi_column_def_t , ncolumn);
+    t->coldesc = mrp_allocz_array(mqi_column_desc_t, ncolumn + 1);
+    t->keys    = mrp_allocz_array(int              , ncolumn);
+
+    if (t->columns == NULL || t->coldesc == NULL || t->keys == NULL)
+        goto fail;
+
+    for (i = 0; i < ncolumn; i++) {
+        if (defs[i].type == mqi_blob) {
+            mrp_log_error("replication: can't replicate blob column %s.%s.",
+                          t->name, defs[i].name);
+            goto fail;
+        }
+
+        t->columns[i]        = defs[i];
+        t->columns[i].name   = mrp_strdup(defs[i].name);
+        t->coldesc[i].cindex = i;
+        t->coldesc[i].offset = i * sizeof(value_t);
+        t->ncolumn++;
+
+        if (t->columns[i].name == NULL)
+            goto fail;
+
+        if (defs[i].flags & MQI_COLUMN_KEY)
+            t->keys[t->nkey++] = i;
+    }
+
+    t->coldesc[i].cindex = -1;
+    t->coldesc[i].offset = 0;
+
+    return TRUE;
+
+ fail:
+    forget_table(t);
+    return FALSE;
+}
+
+
+/*
+ * messages
+ */
+
+static int append_value(mrp_msg_t *msg, mqi_data_type_t type, value_t *v)
+{
+    switch (type) {
+    case mqi_varchar:
+        return mrp_msg_append(msg, MRP_MSG_TAG_STRING(TAG_VALUE,
+                                                      v->varchar ?
+                                                      v->varchar : ""));
+    case mqi_integer:
+        return mrp_msg_append(msg, MRP_MSG_TAG_SINT32(TAG_VALUE, v->integer));
+    case mqi_unsignd:
+        return mrp_msg_append(msg, MRP_MSG_TAG_UINT32(TAG_VALUE, v->unsignd));
+    case mqi_floating:
+        return mrp_msg_append(msg, MRP_MSG_TAG_DOUBLE(TAG_VALUE, v->floating));
+    default:
+        return FALSE;
+    }
+}
+
+
+static int append_key(mrp_msg_t *msg, table_t *t, value_t *row)
+{
+    int i, c;
+
+    if (t->nkey == 0) {
+        for (c = 0; c < t->ncolumn; c++)
+            if (!append_value(msg, t->columns[c].type, row + c))
+                return FALSE;
+    }
+    else {
+        for (i = 0; i < t->nkey; i++) {
+            c = t->keys[i];
+
+            if (!append_value(msg, t->columns[c].type, row + c))
+                return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static int next_field(mrp_msg_t *msg, void **it, uint16_t tag, uint16_t type,
+                      mrp_msg_value_t *v)
+{
+    uint16_t ftag, ftype;
+    size_t   size;
+
+    if (!mrp_msg_iterate(msg, it, &ftag, &ftype, v, &size))
+        return FALSE;
+
+    return ftag == tag && ftype == type;
+}
+
+
+static int get_value(mrp_msg_t *msg, void **it, mqi_data_type_t type,
+                     value_t *v)
+{
+    mrp_msg_value_t mv;
+
+    switch (type) {
+    case mqi_varchar:
+        if (!next_field(msg, it, TAG_VALUE, MRP_MSG_FIELD_STRING, &mv))
+            return FALSE;
+        v->varchar = mv.str;
+        return TRUE;
+    case mqi_integer:
+        if (!next_field(msg, it, TAG_VALUE, MRP_MSG_FIELD_SINT32, &mv))
+            return FALSE;
+        v->integer = mv.s32;
+        return TRUE;
+    case mqi_unsignd:
+        if (!next_field(msg, it, TAG_VALUE, MRP_MSG_FIELD_UINT32, &mv))
+            return FALSE;
+        v->unsignd = mv.u32;
+        return TRUE;
+    case mqi_floating:
+        if (!next_field(msg, it, TAG_VALUE, MRP_MSG_FIELD_DOUBLE, &mv))
+            return FALSE;
+        v->floating = mv.dbl;
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+
+static int get_key(mrp_msg_t *msg, void **it, table_t *t, value_t *row)
+{
+    int i, c;
+
+    if (t->nkey == 0) {
+        for (c = 0; c < t->ncolumn; c++)
+            if (!get_value(msg, it, t->columns[c].type, row + c))
+                return FALSE;
+    }
+    else {
+        for (i = 0; i < t->nkey; i++) {
+            c = t->keys[i];
+
+            if (!get_value(msg, it, t->columns[c].type, row + c))
+                return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static mrp_msg_t *table_list_msg(msg_type_t type, table_t **tables, int n)
+{
+    mrp_msg_t *msg;
+    int        i;
+
+    msg = mrp_msg_create(MRP_MSG_TAG_UINT16(TAG_MSGTYPE, type),
+                         MRP_MSG_TAG_UINT16(TAG_NTABLE , n),
+                         MRP_MSG_END);
+
+    for (i = 0; msg != NULL && i < n; i++) {
+        if (!mrp_msg_append(msg, MRP_MSG_TAG_STRING(TAG_TABLE,
+                                                    tables[i]->name))) {
+            mrp_msg_unref(msg);
+            msg = NULL;
+        }
+    }
+
+    return msg;
+}
+
+
+/*
+ * publishing: replicas and backpressure
+ */
+
+static int peer_send(peer_t *p, mrp_msg_t *msg)
+{
+    if (!mrp_transport_send(p->t, msg))
+        return FALSE;
+
+    p->sent++;
+
+    if (!p->lagging && p->sent - p->acked > p->r->max_lag) {
+        mrp_log_warning("replication: replica lagging (%u messages behind), "
+                        "suspending deltas.", p->sent - p->acked);
+        p->lagging = true;
+    }
+
+    return TRUE;
+}
+
+
+static void peer_check_resume(peer_t *p)
+{
+    int i;
+
+    if (!p->lagging || p->congested || p->acked != p->sent)
+        return;
+
+    mrp_log_info("replication: replica caught up, resynchronizing.");
+
+    p->lagging = false;
+
+    for (i = 0; i < p->ntable && !p->lagging; i++)
+        if (p->dirty[i])
+            send_snapshot(p, i);
+}
+
+
+static void resync_table(peer_t *p, int idx)
+{
+    if (p->lagging)
+        p->dirty[idx] = true;
+    else
+        send_snapshot(p, idx);
+}
+
+
+static int send_snapshot(peer_t *p, int idx)
+{
+    table_t      *t = p->tables[idx];
+    mrp_msg_t    *msg;
+    mqi_cursor_t *c;
+    value_t      *rows;
+    uint32_t      nrow;
+    int           n, i, j, success;
+
+    p->dirty[idx] = false;
+
+    if (t->h == MQI_HANDLE_INVALID || t->columns == NULL)
+        return TRUE;
+
+    msg = mrp_msg_create(MRP_MSG_TAG_UINT16(TAG_MSGTYPE, MSG_SNAPSHOT),
+                         MRP_MSG_TAG_STRING(TAG_TABLE  , t->name),
+                         MRP_MSG_TAG_UINT32(TAG_SEQ    , t->seq),
+                         MRP_MSG_TAG_UINT16(TAG_NCOLUMN, t->ncolumn),
+                         MRP_MSG_END);
+
+    if (msg == NULL)
+        return FALSE;
+
+    for (i = 0; i < t->ncolumn; i++) {
+        mrp_msg_append(msg, MRP_MSG_TAG_STRING(TAG_COLNAME ,
+                                               t->columns[i].name));
+        mrp_msg_append(msg, MRP_MSG_TAG_UINT16(TAG_COLTYPE ,
+                                               t->columns[i].type));
+        mrp_msg_append(msg, MRP_MSG_TAG_UINT32(TAG_COLLEN  ,
+                                               t->columns[i].length));
+        mrp_msg_append(msg, MRP_MSG_TAG_UINT32(TAG_COLFLAGS,
+                                               t->columns[i].flags));
+    }
+
+    mrp_msg_append(msg, MRP_MSG_TAG_UINT32(TAG_NROW, 0));
+
+    rows = mrp_allocz(SNAPSHOT_BATCH * t->ncolumn * sizeof(*rows));
+    c    = mqi_snapshot_open(t->h, NULL, t->coldesc);
+
+    if (rows == NULL || c == NULL) {
+        mrp_free(rows);
+        mqi_select_close(c);
+        mrp_msg_unref(msg);
+        return FALSE;
+    }
+
+    nrow    = 0;
+    success = TRUE;
+
+    while (success && (n = mqi_select_next(c, rows,
+                                           t->ncolumn * sizeof(*rows),
+                                           SNAPSHOT_BATCH)) > 0) {
+        for (i = 0; success && i < n; i++)
+            for (j = 0; success && j < t->ncolumn; j++)
+                success = append_value(msg, t->columns[j].type,
+                                       rows + i * t->ncolumn + j);
+        nrow += n;
+    }
+
+    mqi_select_close(c);
+    mrp_free(rows);
+
+    if (success) {
+        mrp_msg_set(msg, MRP_MSG_TAG_UINT32(TAG_NROW, nrow));
+        success = peer_send(p, msg);
+    }
+
+    mrp_msg_unref(msg);
+
+    mrp_debug("sent snapshot of %s (#%u, %u rows)", t->name, t->seq, nrow);
+
+    return success;
+}
+
+
+static mrp_msg_t *changes_msg(table_t *t, mqi_changeset_event_t *cs)
+{
+    mrp_msg_t    *msg;
+    mqi_change_t *c;
+    value_t      *old, *new;
+    uint16_t      n;
+    int           i, col, success;
+
+    msg = mrp_msg_create(MRP_MSG_TAG_UINT16(TAG_MSGTYPE, MSG_CHANGES),
+                         MRP_MSG_TAG_STRING(TAG_TABLE  , t->name),
+                         MRP_MSG_TAG_UINT32(TAG_SEQ    , t->seq),
+                         MRP_MSG_TAG_UINT32(TAG_NCHANGE, cs->nchange),
+                         MRP_MSG_END);
+
+    if (msg == NULL)
+        return NULL;
+
+    for (i = 0, success = TRUE; success && i < cs->nchange; i++) {
+        c   = cs->changes + i;
+        old = c->old;
+        new = c->new_;
+
+        switch (c->event) {
+        case mqi_row_inserted:
+            success = mrp_msg_append(msg, MRP_MSG_TAG_UINT16(TAG_CHANGE,
+                                                             CHANGE_INSERT));
+            for (col = 0; success && col < t->ncolumn; col++)
+                success = append_value(msg, t->columns[col].type, new + col);
+            break;
+
+        case mqi_row_deleted:
+            success = mrp_msg_append(msg, MRP_MSG_TAG_UINT16(TAG_CHANGE,
+                                                             CHANGE_DELETE)) &&
+                append_key(msg, t, old);
+            break;
+
+        case mqi_column_changed:
+            for (col = 0, n = 0; col < t->ncolumn; col++)
+                if (mqi_bitfld_test(&c->colmask, col))
+                    n++;
+
+            success = mrp_msg_append(msg, MRP_MSG_TAG_UINT16(TAG_CHANGE,
+                                                             CHANGE_UPDATE)) &&
+                append_key(msg, t, old) &&
+                mrp_msg_append(msg, MRP_MSG_TAG_UINT16(TAG_NVALUE, n));
+
+            for (col = 0; success && col < t->ncolumn; col++) {
+                if (!mqi_bitfld_test(&c->colmask, col))
+                    continue;
+
+                success = mrp_msg_append(msg, MRP_MSG_TAG_UINT16(TAG_COLUMN,
+                                                                 col)) &&
+                    append_value(msg, t->columns[col].type, new + col);
+            }
+            break;
+
+        default:
+            success = FALSE;
+            break;
+        }
+    }
+
+    if (!success) {
+        mrp_msg_unref(msg);
+        msg = NULL;
+    }
+
+    return msg;
+}
+
+
+static void changes_cb(mqi_event_t *e, void *user_data)
+{
+    table_t         *t   = (table_t *)user_data;
+    repl_t          *r   = t->r;
+    mrp_msg_t       *msg = NULL;
+    mrp_list_hook_t *p, *n;
+    peer_t          *peer;
+    int              i;
+
+    if (e->event != mqi_changeset)
+        return;
+
+    t->seq++;
+
+    mrp_list_foreach(&r->peers, p, n) {
+        peer = mrp_list_entry(p, typeof(*peer), hook);
+
+        for (i = 0; i < peer->ntable; i++)
+            if (peer->tables[i] == t)
+                break;
+
+        if (i >= peer->ntable)
+            continue;
+
+        if (peer->lagging) {
+            peer->dirty[i] = true;
+            continue;
+        }
+
+        if (msg == NULL && (msg = changes_msg(t, &e->changeset)) == NULL) {
+            mrp_log_error("replication: failed to encode changes of %s.",
+                          t->name);
+            peer->dirty[i] = true;
+            continue;
+        }
+
+        if (!peer_send(peer, msg))
+            peer->dirty[i] = true;
+    }
+
+    mrp_msg_unref(msg);
+}
+
+
+static void publish_table(table_t *t, mqi_handle_t h)
+{
+    mrp_list_hook_t *p, *n;
+    peer_t          *peer;
+    int              i;
+
+    t->h = h;
+
+    if (!describe_table(t)) {
+        mrp_log_error("replication: can't publish table %s.", t->name);
+        t->h = MQI_HANDLE_INVALID;
+        return;
+    }
+
+    if (mqi_create_changeset_trigger(h, NULL, changes_cb, t, t->coldesc) < 0) {
+        mrp_log_error("replication: failed to track changes of table %s.",
+                      t->name);
+        forget_table(t);
+        t->h = MQI_HANDLE_INVALID;
+        return;
+    }
+
+    mrp_log_info("replication: publishing table %s.", t->name);
+
+    mrp_list_foreach(&t->r->peers, p, n) {
+        peer = mrp_list_entry(p, typeof(*peer), hook);
+
+        for (i = 0; i < peer->ntable; i++)
+            if (peer->tables[i] == t)
+                resync_table(peer, i);
+    }
+}
+
+
+static void unpublish_table(table_t *t)
+{
+    if (t->h != MQI_HANDLE_INVALID) {
+        mqi_drop_changeset_trigger(t->h, changes_cb, t);
+        t->h = MQI_HANDLE_INVALID;
+    }
+
+    forget_table(t);
+}
+
+
+static void table_event_cb(mqi_event_t *e, void *user_data)
+{
+    repl_t  *r = (repl_t *)user_data;
+    table_t *t;
+
+    t = lookup_table(&r->published, e->table.table.name);
+
+    if (t == NULL)
+        return;
+
+    switch (e->event) {
+    case mqi_table_created:
+        publish_table(t, e->table.table.handle);
+        break;
+
+    case mqi_table_dropped:
+        /* the triggers of the table are gone with it */
+        t->h = MQI_HANDLE_INVALID;
+        forget_table(t);
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+static void destroy_peer(peer_t *p)
+{
+    mrp_list_delete(&p->hook);
+    mrp_transport_destroy(p->t);
+    mrp_free(p->tables);
+    mrp_free(p->dirty);
+    mrp_free(p);
+}
+
+
+static void peer_subscribe(peer_t *p, mrp_msg_t *msg, void *it)
+{
+    repl_t          *r = p->r;
+    mrp_msg_value_t  v;
+    uint16_t         ntable;
+    table_t         *t;
+    int              i;
+
+    if (!next_field(msg, &it, TAG_NTABLE, MRP_MSG_FIELD_UINT16, &v))
+        goto malformed;
+
+    ntable = v.u16;
+
+    mrp_free(p->tables);
+    mrp_free(p->dirty);
+    p->tables = mrp_allocz_array(table_t *, ntable);
+    p->dirty  = mrp_allocz_array(bool     , ntable);
+    p->ntable = 0;
+    p->sent   = p->acked = 0;
+
+    if ((p->tables == NULL || p->dirty == NULL) && ntable > 0) {
+        destroy_peer(p);
+        return;
+    }
+
+    for (i = 0; i < ntable; i++) {
+        if (!next_field(msg, &it, TAG_TABLE, MRP_MSG_FIELD_STRING, &v))
+            goto malformed;
+
+        if ((t = lookup_table(&r->published, v.str)) == NULL) {
+            mrp_log_warning("replication: replica subscribed to unpublished "
+                            "table %s.", v.str);
+            continue;
+        }
+
+        p->tables[p->ntable] = t;
+        p->dirty[p->ntable]  = true;
+        p->ntable++;
+    }
+
+    p->lagging = false;
+
+    for (i = 0; i < p->ntable && !p->lagging; i++)
+        send_snapshot(p, i);
+
+    return;
+
+ malformed:
+    mrp_log_error("replication: malformed subscription from replica.");
+    destroy_peer(p);
+}
+
+
+static void peer_resync(peer_t *p, mrp_msg_t *msg, void *it)
+{
+    mrp_msg_value_t v;
+    uint16_t        ntable;
+    int             i, j;
+
+    if (!next_field(msg, &it, TAG_NTABLE, MRP_MSG_FIELD_UINT16, &v))
+        return;
+
+    ntable = v.u16;
+
+    for (i = 0; i < ntable; i++) {
+        if (!next_field(msg, &it, TAG_TABLE, MRP_MSG_FIELD_STRING, &v))
+            return;
+
+        for (j = 0; j < p->ntable; j++)
+            if (!strcmp(p->tables[j]->name, v.str))
+                resync_table(p, j);
+    }
+}
+
+
+static void peer_recv_cb(mrp_transport_t *t, mrp_msg_t *msg, void *user_data)
+{
+    peer_t          *p  = (peer_t *)user_data;
+    void            *it = NULL;
+    mrp_msg_value_t  v;
+
+    MRP_UNUSED(t);
+
+    if (!next_field(msg, &it, TAG_MSGTYPE, MRP_MSG_FIELD_UINT16, &v)) {
+        mrp_log_error("replication: malformed message from replica.");
+        return;
+    }
+
+    switch (v.u16) {
+    case MSG_SUBSCRIBE:
+        peer_subscribe(p, msg, it);
+        break;
+
+    case MSG_RESYNC:
+        peer_resync(p, msg, it);
+        break;
+
+    case MSG_ACK:
+        if (next_field(msg, &it, TAG_COUNT, MRP_MSG_FIELD_UINT32, &v)) {
+            p->acked = v.u32;
+            peer_check_resume(p);
+        }
+        break;
+
+    default:
+        mrp_log_error("replication: unexpected message 0x%x from replica.",
+                      v.u16);
+        break;
+    }
+}
+
+
+static void peer_closed_cb(mrp_transport_t *t, int error, void *user_data)
+{
+    peer_t *p = (peer_t *)user_data;
+
+    MRP_UNUSED(t);
+
+    if (error)
+        mrp_log_error("replication: connection to replica closed (%d: %s).",
+                      error, strerror(error));
+    else
+        mrp_log_info("replication: connection to replica closed.");
+
+    destroy_peer(p);
+}
+
+
+static void peer_outq_cb(mrp_transport_t *t, int congested, void *user_data)
+{
+    peer_t *p = (peer_t *)user_data;
+
+    MRP_UNUSED(t);
+
+    p->congested = congested;
+
+    if (congested) {
+        if (!p->lagging)
+            mrp_log_warning("replication: replica congested, "
+                            "suspending deltas.");
+        p->lagging = true;
+    }
+    else
+        peer_check_resume(p);
+}
+
+
+static void peer_connect_cb(mrp_transport_t *lt, void *user_data)
+{
+    repl_t                      *r = (repl_t *)user_data;
+    mrp_transport_outq_notify_t  notify;
+    peer_t                      *p;
+    size_t                       low;
+
+    if ((p = mrp_allocz(sizeof(*p))) == NULL)
+        return;
+
+    mrp_list_init(&p->hook);
+    p->r = r;
+    p->t = mrp_transport_accept(lt, p, MRP_TRANSPORT_REUSEADDR |
+                                MRP_TRANSPORT_NONBLOCK);
+
+    if (p->t == NULL) {
+        /* we get called until we run out of pending connections */
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            mrp_log_error("replication: failed to accept replica "
+                          "connection.");
+        mrp_free(p);
+        return;
+    }
+
+    notify.cb        = peer_outq_cb;
+    notify.user_data = p;
+    low              = r->outq / 4;
+
+    mrp_transport_setopt(p->t, MRP_TRANSPORT_OPT_OUTQ_HIGH  , &r->outq);
+    mrp_transport_setopt(p->t, MRP_TRANSPORT_OPT_OUTQ_LOW   , &low);
+    mrp_transport_setopt(p->t, MRP_TRANSPORT_OPT_OUTQ_NOTIFY, &notify);
+
+    mrp_list_append(&r->peers, &p->hook);
+
+    mrp_log_info("replication: accepted replica connection.");
+}
+
+
+static int start_publishing(repl_t *r)
+{
+    static mrp_transport_evt_t evt = {
+        { .recvmsg     = peer_recv_cb },
+        { .recvmsgfrom = NULL         },
+        .connection    = peer_connect_cb,
+        .closed        = peer_closed_cb,
+    };
+
+    mrp_list_hook_t *p, *n;
+    table_t         *t;
+    mrp_sockaddr_t   addr;
+    socklen_t        alen;
+    const char      *type;
+    mqi_handle_t     h;
+
+    if (mrp_list_empty(&r->published))
+        return TRUE;
+
+    alen = mrp_transport_resolve(NULL, r->address, &addr, sizeof(addr), &type);
+
+    if (alen <= 0) {
+        mrp_log_error("replication: failed to resolve address '%s'.",
+                      r->address);
+        return FALSE;
+    }
+
+    r->lt = mrp_transport_create(r->ctx->ml, type, &evt, r,
+                                 MRP_TRANSPORT_REUSEADDR);
+
+    if (r->lt == NULL || !mrp_transport_bind(r->lt, &addr, alen) ||
+        !mrp_transport_listen(r->lt, 0)) {
+        mrp_log_error("replication: failed to listen on '%s'.", r->address);
+        return FALSE;
+    }
+
+    if (mqi_create_table_trigger(table_event_cb, r) < 0) {
+        mrp_log_error("replication: failed to track table creation.");
+        return FALSE;
+    }
+
+    mrp_list_foreach(&r->published, p, n) {
+        t = mrp_list_entry(p, typeof(*t), hook);
+
+        if ((h = mqi_get_table_handle(t->name)) != MQI_HANDLE_INVALID)
+            publish_table(t, h);
+    }
+
+    mrp_log_info("replication: serving replicas on '%s'.", r->address);
+
+    return TRUE;
+}
+
+
+static void stop_publishing(repl_t *r)
+{
+    mrp_list_hook_t *p, *n;
+    table_t         *t;
+
+    mrp_list_foreach(&r->peers, p, n)
+        destroy_peer(mrp_list_entry(p, peer_t, hook));
+
+    mrp_list_foreach(&r->published, p, n) {
+        t = mrp_list_entry(p, typeof(*t), hook);
+
+        unpublish_table(t);
+        destroy_table(t);
+    }
+
+    if (r->lt != NULL) {
+        mqi_drop_table_trigger(table_event_cb, r);
+        mrp_transport_destroy(r->lt);
+        r->lt = NULL;
+    }
+}
+
+
+/*
+ * replicating
+ */
+
+static void ack_cb(mrp_deferred_t *d, void *user_data)
+{
+    repl_t    *r = (repl_t *)user_data;
+    mrp_msg_t *msg;
+
+    mrp_del_deferred(d);
+    r->ack = NULL;
+
+    if (r->ut == NULL)
+        return;
+
+    msg = mrp_msg_create(MRP_MSG_TAG_UINT16(TAG_MSGTYPE, MSG_ACK),
+                         MRP_MSG_TAG_UINT32(TAG_COUNT  , r->applied),
+                         MRP_MSG_END);
+
+    if (msg != NULL) {
+        mrp_transport_send(r->ut, msg);
+        mrp_msg_unref(msg);
+    }
+}
+
+
+static void request_resync(repl_t *r, table_t *t)
+{
+    mrp_msg_t *msg;
+
+    t->synced = false;
+
+    if ((msg = table_list_msg(MSG_RESYNC, &t, 1)) != NULL) {
+        mrp_transport_send(r->ut, msg);
+        mrp_msg_unref(msg);
+    }
+}
+
+
+static int check_columns(table_t *t, mqi_column_def_t *defs, int ncolumn)
+{
+    int i;
+
+    if (t->ncolumn != ncolumn)
+        return FALSE;
+
+    for (i = 0; i < ncolumn; i++)
+        if (strcmp(t->columns[i].name, defs[i].name) ||
+            t->columns[i].type != defs[i].type)
+            return FALSE;
+
+    return TRUE;
+}
+
+
+/*
+ * Make sure we have a local table matching the columns in a snapshot,
+ * creating one with the same columns and index if necessary.
+ */
+static int prepare_table(table_t *t, mqi_column_def_t *defs, int ncolumn)
+{
+    char *index[MQI_COLUMN_MAX + 1];
+    int   i, n;
+
+    if (t->h == MQI_HANDLE_INVALID)
+        t->h = mqi_get_table_handle(t->name);
+
+    if (t->h == MQI_HANDLE_INVALID) {
+        for (i = n = 0; i < ncolumn; i++)
+            if (defs[i].flags & MQI_COLUMN_KEY)
+                index[n++] = (char *)defs[i].name;
+        index[n] = NULL;
+
+        for (i = 0; i < ncolumn; i++)
+            defs[i].flags &= MQI_COLUMN_INTERNED;
+
+        t->h = mqi_create_table(t->name, MQI_TEMPORARY, n ? index : NULL,
+                                defs);
+
+        if (t->h == MQI_HANDLE_INVALID) {
+            mrp_log_error("replication: failed to create table %s.", t->name);
+            return FALSE;
+        }
+
+        mrp_log_info("replication: created replicated table %s.", t->name);
+    }
+
+    if (t->columns == NULL && !describe_table(t)) {
+        t->h = MQI_HANDLE_INVALID;
+        return FALSE;
+    }
+
+    if (!check_columns(t, defs, ncolumn)) {
+        mrp_log_error("replication: columns of table %s don't match "
+                      "upstream.", t->name);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static void apply_snapshot(repl_t *r, table_t *t, mrp_msg_t *msg, void *it)
+{
+    mqi_column_def_t  defs[MQI_COLUMN_MAX + 1];
+    mrp_msg_value_t   v;
+    uint32_t          seq, nrow, i;
+    int               ncolumn, c;
+    value_t          *rows;
+    void            **data;
+    mqi_handle_t      tx;
+
+    if (!next_field(msg, &it, TAG_SEQ, MRP_MSG_FIELD_UINT32, &v))
+        goto malformed;
+    seq = v.u32;
+
+    if (!next_field(msg, &it, TAG_NCOLUMN, MRP_MSG_FIELD_UINT16, &v) ||
+        v.u16 == 0 || v.u16 > MQI_COLUMN_MAX)
+        goto malformed;
+    ncolumn = v.u16;
+
+    memset(defs, 0, sizeof(defs));
+
+    for (c = 0; c < ncolumn; c++) {
+        if (!next_field(msg, &it, TAG_COLNAME, MRP_MSG_FIELD_STRING, &v))
+            goto malformed;
+        defs[c].name = v.str;
+        if (!next_field(msg, &it, TAG_COLTYPE, MRP_MSG_FIELD_UINT16, &v))
+            goto malformed;
+        defs[c].type = v.u16;
+        if (!next_field(msg, &it, TAG_COLLEN, MRP_MSG_FIELD_UINT32, &v))
+            goto malformed;
+        defs[c].length = v.u32;
+        if (!next_field(msg, &it, TAG_COLFLAGS, MRP_MSG_FIELD_UINT32, &v))
+            goto malformed;
+        defs[c].flags = v.u32;
+    }
+
+    if (!next_field(msg, &it, TAG_NROW, MRP_MSG_FIELD_UINT32, &v))
+        goto malformed;
+    nrow = v.u32;
+
+    if (!prepare_table(t, defs, ncolumn))
+        return;
+
+    rows = mrp_allocz((size_t)nrow * ncolumn * sizeof(*rows));
+    data = mrp_allocz((nrow + 1) * sizeof(*data));
+
+    if ((rows == NULL && nrow > 0) || data == NULL) {
+        mrp_free(rows);
+        mrp_free(data);
+        return;
+    }
+
+    for (i = 0; i < nrow; i++) {
+        data[i] = rows + i * ncolumn;
+
+        for (c = 0; c < ncolumn; c++) {
+            if (!get_value(msg, &it, t->columns[c].type,
+                           rows + i * ncolumn + c)) {
+                mrp_free(rows);
+                mrp_free(data);
+                goto malformed;
+            }
+        }
+    }
+
+    tx = mqi_begin_transaction();
+
+    if (mqi_delete_from(t->h, NULL) < 0 ||
+        (nrow > 0 && mqi_insert_into(t->h, 1, t->coldesc, data) < 0)) {
+        mrp_log_error("replication: failed to load snapshot of %s.", t->name);
+        mqi_rollback_transaction(tx);
+    }
+    else {
+        mqi_commit_transaction(tx);
+        t->seq    = seq;
+        t->synced = true;
+        mrp_debug("loaded snapshot of %s (#%u, %u rows)", t->name, seq, nrow);
+    }
+
+    mrp_free(rows);
+    mrp_free(data);
+
+    return;
+
+ malformed:
+    mrp_log_error("replication: malformed snapshot of %s.", t->name);
+}
+
+
+static int key_condition(table_t *t, value_t *row, mqi_cond_entry_t *cond)
+{
+    mqi_cond_entry_t *e = cond;
+    int               i, c, n;
+
+    n = t->nkey ? t->nkey : t->ncolumn;
+
+    for (i = 0; i < n; i++) {
+        c = t->nkey ? t->keys[i] : i;
+
+        if (i > 0) {
+            e->type        = mqi_operator;
+            e->u.operator_ = mqi_and;
+            e++;
+        }
+
+        e->type     = mqi_column;
+        e->u.column = c;
+        e++;
+
+        e->type        = mqi_operator;
+        e->u.operator_ = mqi_eq;
+        e++;
+
+        e->type                = mqi_variable;
+        e->u.variable.type     = t->columns[c].type;
+        e->u.variable.flags    = 0;
+        e->u.variable.v.generic = row + c;
+        e++;
+    }
+
+    e->type        = mqi_operator;
+    e->u.operator_ = mqi_end;
+
+    return TRUE;
+}
+
+
+static int apply_change(table_t *t, mrp_msg_t *msg, void **it,
+                        value_t *old, value_t *new, mqi_cond_entry_t *cond,
+                        mqi_column_desc_t *cds)
+{
+    mrp_msg_value_t  v;
+    void            *data[2];
+    uint16_t         nvalue, i;
+    int              c;
+
+    if (!next_field(msg, it, TAG_CHANGE, MRP_MSG_FIELD_UINT16, &v))
+        return FALSE;
+
+    switch (v.u16) {
+    case CHANGE_INSERT:
+        for (c = 0; c < t->ncolumn; c++)
+            if (!get_value(msg, it, t->columns[c].type, new + c))
+                return FALSE;
+
+        data[0] = new;
+        data[1] = NULL;
+
+        return mqi_insert_into(t->h, 1, t->coldesc, data) > 0;
+
+    case CHANGE_DELETE:
+        if (!get_key(msg, it, t, old) || !key_condition(t, old, cond))
+            return FALSE;
+
+        return mqi_delete_from(t->h, cond) >= 0;
+
+    case CHANGE_UPDATE:
+        if (!get_key(msg, it, t, old) || !key_condition(t, old, cond))
+            return FALSE;
+
+        if (!next_field(msg, it, TAG_NVALUE, MRP_MSG_FIELD_UINT16, &v) ||
+            v.u16 > t->ncolumn)
+            return FALSE;
+
+        nvalue = v.u16;
+
+        for (i = 0; i < nvalue; i++) {
+            if (!next_field(msg, it, TAG_COLUMN, MRP_MSG_FIELD_UINT16, &v) ||
+                (c = v.u16) >= t->ncolumn ||
+                !get_value(msg, it, t->columns[c].type, new + c))
+                return FALSE;
+
+            cds[i] = t->coldesc[c];
+        }
+
+        cds[i].cindex = -1;
+        cds[i].offset = 0;
+
+        if (nvalue == 0)
+            return TRUE;
+
+        /*
+         * Only the changed columns are written, so only their triggers
+         * fire. An update can legitimately change nothing, if an earlier
+         * change in the same set already left the row in its final state.
+         */
+        return mqi_update(t->h, cond, cds, new) >= 0;
+
+    default:
+        return FALSE;
+    }
+}
+
+
+static void apply_changes(repl_t *r, table_t *t, mrp_msg_t *msg, void *it)
+{
+    mrp_msg_value_t    v;
+    uint32_t           seq, nchange, i;
+    value_t           *old, *new;
+    mqi_cond_entry_t  *cond;
+    mqi_column_desc_t *cds;
+    mqi_handle_t       tx;
+    int                success;
+
+    if (!t->synced)
+        return;
+
+    if (!next_field(msg, &it, TAG_SEQ, MRP_MSG_FIELD_UINT32, &v))
+        goto malformed;
+    seq = v.u32;
+
+    if (!next_field(msg, &it, TAG_NCHANGE, MRP_MSG_FIELD_UINT32, &v))
+        goto malformed;
+    nchange = v.u32;
+
+    if (seq != t->seq + 1) {
+        mrp_log_warning("replication: change-set #%u of %s out of sequence "
+                        "(expected #%u), resynchronizing.", seq, t->name,
+                        t->seq + 1);
+        request_resync(r, t);
+        return;
+    }
+
+    old  = alloca(t->ncolumn * sizeof(*old));
+    new  = alloca(t->ncolumn * sizeof(*new));
+    cond = alloca((4 * t->ncolumn + 1) * sizeof(*cond));
+    cds  = alloca((t->ncolumn + 1) * sizeof(*cds));
+
+    tx      = mqi_begin_transaction();
+    success = TRUE;
+
+    for (i = 0; success && i < nchange; i++)
+        success = apply_change(t, msg, &it, old, new, cond, cds);
+
+    if (success) {
+        mqi_commit_transaction(tx);
+        t->seq = seq;
+    }
+    else {
+        mqi_rollback_transaction(tx);
+        mrp_log_error("replication: failed to apply change-set #%u of %s, "
+                      "resynchronizing.", seq, t->name);
+        request_resync(r, t);
+    }
+
+    return;
+
+ malformed:
+    mrp_log_error("replication: malformed change-set of %s.", t->name);
+    request_resync(r, t);
+}
+
+
+static void upstream_recv_cb(mrp_transport_t *tp, mrp_msg_t *msg,
+                             void *user_data)
+{
+    repl_t          *r  = (repl_t *)user_data;
+    void            *it = NULL;
+    mrp_msg_value_t  v;
+    uint16_t         type;
+    table_t         *t;
+
+    MRP_UNUSED(tp);
+
+    if (!next_field(msg, &it, TAG_MSGTYPE, MRP_MSG_FIELD_UINT16, &v)) {
+        mrp_log_error("replication: malformed message from upstream.");
+        return;
+    }
+
+    type = v.u16;
+
+    if (type != MSG_SNAPSHOT && type != MSG_CHANGES) {
+        mrp_log_error("replication: unexpected message 0x%x from upstream.",
+                      type);
+        return;
+    }
+
+    r->applied++;
+
+    if (r->ack == NULL)
+        r->ack = mrp_add_deferred(r->ctx->ml, ack_cb, r);
+
+    if (!next_field(msg, &it, TAG_TABLE, MRP_MSG_FIELD_STRING, &v) ||
+        (t = lookup_table(&r->replicated, v.str)) == NULL)
+        return;
+
+    if (type == MSG_SNAPSHOT)
+        apply_snapshot(r, t, msg, it);
+    else
+        apply_changes(r, t, msg, it);
+}
+
+
+static void upstream_recvfrom_cb(mrp_transport_t *tp, mrp_msg_t *msg,
+                                 mrp_sockaddr_t *addr, socklen_t addrlen,
+                                 void *user_data)
+{
+    MRP_UNUSED(addr);
+    MRP_UNUSED(addrlen);
+
+    /* the transport layer insists on having this for connecting clients */
+    upstream_recv_cb(tp, msg, user_data);
+}
+
+
+static int start_reconnect(repl_t *r);
+
+
+static void upstream_closed_cb(mrp_transport_t *tp, int error,
+                               void *user_data)
+{
+    repl_t          *r = (repl_t *)user_data;
+    mrp_list_hook_t *p, *n;
+    table_t         *t;
+
+    MRP_UNUSED(tp);
+
+    if (error)
+        mrp_log_error("replication: connection to upstream closed (%d: %s).",
+                      error, strerror(error));
+    else
+        mrp_log_info("replication: connection to upstream closed.");
+
+    mrp_transport_destroy(r->ut);
+    r->ut = NULL;
+
+    mrp_list_foreach(&r->replicated, p, n) {
+        t = mrp_list_entry(p, typeof(*t), hook);
+        t->synced = false;
+    }
+
+    start_reconnect(r);
+}
+
+
+static int subscribe(repl_t *r)
+{
+    static mrp_transport_evt_t evt = {
+        { .recvmsg     = upstream_recv_cb     },
+        { .recvmsgfrom = upstream_recvfrom_cb },
+        .closed        = upstream_closed_cb,
+    };
+
+    mrp_list_hook_t  *p, *n;
+    table_t         **tables;
+    mrp_msg_t        *msg;
+    int               ntable, success;
+
+    r->ut = mrp_transport_create(r->ctx->ml, r->ttype, &evt, r, 0);
+
+    if (r->ut == NULL)
+        return FALSE;
+
+    if (!mrp_transport_connect(r->ut, &r->addr, r->alen)) {
+        mrp_transport_destroy(r->ut);
+        r->ut = NULL;
+        return FALSE;
+    }
+
+    ntable = 0;
+    mrp_list_foreach(&r->replicated, p, n)
+        ntable++;
+
+    tables = alloca(ntable * sizeof(*tables));
+    ntable = 0;
+
+    mrp_list_foreach(&r->replicated, p, n)
+        tables[ntable++] = mrp_list_entry(p, table_t, hook);
+
+    r->applied = 0;
+    msg        = table_list_msg(MSG_SUBSCRIBE, tables, ntable);
+    success    = msg != NULL && mrp_transport_send(r->ut, msg);
+
+    mrp_msg_unref(msg);
+
+    if (!success) {
+        mrp_transport_destroy(r->ut);
+        r->ut = NULL;
+        return FALSE;
+    }
+
+    mrp_log_info("replication: replicating %d tables from '%s'.", ntable,
+                 r->upstream);
+
+    return TRUE;
+}
+
+
+static void reconnect_cb(mrp_timer_t *tmr, void *user_data)
+{
+    repl_t *r = (repl_t *)user_data;
+
+    if (subscribe(r)) {
+        mrp_del_timer(tmr);
+        r->rt = NULL;
+    }
+}
+
+
+static int start_reconnect(repl_t *r)
+{
+    if (r->rt == NULL)
+        r->rt = mrp_add_timer(r->ctx->ml, 1000 * r->retry, reconnect_cb, r);
+
+    return r->rt != NULL;
+}
+
+
+static int start_replicating(repl_t *r)
+{
+    if (mrp_list_empty(&r->replicated))
+        return TRUE;
+
+    if (r->upstream == NULL) {
+        mrp_log_error("replication: tables to replicate but no upstream.");
+        return FALSE;
+    }
+
+    r->alen = mrp_transport_resolve(NULL, r->upstream, &r->addr,
+                                    sizeof(r->addr), &r->ttype);
+
+    if (r->alen <= 0) {
+        mrp_log_error("replication: failed to resolve upstream '%s'.",
+                      r->upstream);
+        return FALSE;
+    }
+
+    if (!subscribe(r)) {
+        mrp_log_warning("replication: upstream '%s' not available, "
+                        "retrying in %d seconds.", r->upstream, r->retry);
+        return start_reconnect(r);
+    }
+
+    return TRUE;
+}
+
+
+static void stop_replicating(repl_t *r)
+{
+    mrp_list_hook_t *p, *n;
+
+    mrp_del_timer(r->rt);
+    r->rt = NULL;
+    mrp_del_deferred(r->ack);
+    r->ack = NULL;
+
+    if (r->ut != NULL) {
+        mrp_transport_destroy(r->ut);
+        r->ut = NULL;
+    }
+
+    mrp_list_foreach(&r->replicated, p, n)
+        destroy_table(mrp_list_entry(p, table_t, hook));
+}
+
+
+/*
+ * plugin
+ */
+
+enum {
+    ARG_PUBLISH,                         /* tables to publish */
+    ARG_ADDRESS,                         /* address to serve replicas on */
+    ARG_REPLICATE,                       /* tables to replicate */
+    ARG_UPSTREAM,                        /* address to replicate from */
+    ARG_MAXLAG,                          /* max. unacknowledged messages */
+    ARG_OUTQ,                            /* output queue high watermark */
+    ARG_RETRY,                           /* reconnect interval */
+};
+
+
+static void replication_exit(mrp_plugin_t *plugin);
+
+
+static int replication_init(mrp_plugin_t *plugin)
+{
+    mrp_plugin_arg_t *args = plugin->args;
+    repl_t           *r;
+
+    if ((r = mrp_allocz(sizeof(*r))) == NULL)
+        return FALSE;
+
+    mrp_list_init(&r->published);
+    mrp_list_init(&r->peers);
+    mrp_list_init(&r->replicated);
+
+    r->ctx      = plugin->ctx;
+    r->address  = args[ARG_ADDRESS].str;
+    r->upstream = args[ARG_UPSTREAM].str;
+    r->max_lag  = args[ARG_MAXLAG].u32 ? args[ARG_MAXLAG].u32 : 1;
+    r->outq     = args[ARG_OUTQ].u32;
+    r->retry    = args[ARG_RETRY].u32 ? (int)args[ARG_RETRY].u32 : 1;
+
+    plugin->data = r;
+
+    if (mqi_open() != 0) {
+        mrp_log_error("replication: failed to open MDB.");
+        goto fail;
+    }
+
+    if (!create_tables(r, &r->published , args[ARG_PUBLISH].str) ||
+        !create_tables(r, &r->replicated, args[ARG_REPLICATE].str))
+        goto fail;
+
+    if (!start_publishing(r) || !start_replicating(r))
+        goto fail;
+
+    return TRUE;
+
+ fail:
+    replication_exit(plugin);
+    return FALSE;
+}
+
+
+static void replication_exit(mrp_plugin_t *plugin)
+{
+    repl_t *r = (repl_t *)plugin->data;
+
+    if (r == NULL)
+        return;
+
+    stop_replicating(r);
+    stop_publishing(r);
+
+    mrp_free(r);
+    plugin->data = NULL;
+}
+
+
+#define REPLICATION_DESCRIPTION "MDB table replication between Murphy daemons."
+#define REPLICATION_HELP \
+    "The replication plugin streams the committed changes of the tables\n" \
+    "listed in 'publish' to the replicas connected to 'address'. It also\n"\
+    "replicates the tables listed in 'replicate' from the daemon serving\n"\
+    "them on 'upstream'. A replica falling more than 'max-lag' messages\n" \
+    "behind is resynchronized with snapshots once it has caught up."
+#define REPLICATION_VERSION MRP_VERSION_INT(0, 0, 1)
+#define REPLICATION_AUTHORS "Krisztian Litkey <kli@iki.fi>"
+
+
+static mrp_plugin_arg_t replication_args[] = {
+    MRP_PLUGIN_ARGIDX(ARG_PUBLISH  , STRING, "publish"   , NULL           ),
+    MRP_PLUGIN_ARGIDX(ARG_ADDRESS  , STRING, "address"   , DEFAULT_ADDRESS),
+    MRP_PLUGIN_ARGIDX(ARG_REPLICATE, STRING, "replicate" , NULL           ),
+    MRP_PLUGIN_ARGIDX(ARG_UPSTREAM , STRING, "upstream"  , NULL           ),
+    MRP_PLUGIN_ARGIDX(ARG_MAXLAG   , UINT32, "max-lag"   , DEFAULT_MAXLAG ),
+    MRP_PLUGIN_ARGIDX(ARG_OUTQ     , UINT32, "outq-limit", DEFAULT_OUTQ   ),
+    MRP_PLUGIN_ARGIDX(ARG_RETRY    , UINT32, "retry"     , DEFAULT_RETRY  ),
+};
+
+
+MURPHY_REGISTER_PLUGIN("replication",
+                       REPLICATION_VERSION, REPLICATION_DESCRIPTION,
+                       REPLICATION_AUTHORS, REPLICATION_HELP, MRP_SINGLETON,
+                       replication_init, replication_exit,
+                       replication_args, MRP_ARRAY_SIZE(replication_args),
+                       NULL, 0, NULL, 0, NULL);
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
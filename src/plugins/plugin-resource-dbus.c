@@ -43,6 +43,8 @@
 #include <murphy/common/dbus-libdbus.h>
 
 #include <murphy/resource/client-api.h>
+#include <murphy/resource/manager-api.h>
+#include <murphy/resource/resource-set.h>
 
 
 #define MURPHY_PATH_BASE "/org/murphy/resource"
@@ -57,6 +59,8 @@
 
 #define MANAGER_CREATE_RESOURCE_SET "createResourceSet"
 #define MANAGER_GET_PROPERTIES      "getProperties"
+#define MANAGER_SUBSCRIBE_OWNER     "subscribeOwner"
+#define MANAGER_UNSUBSCRIBE_OWNER   "unsubscribeOwner"
 
 #define RSET_SET_PROPERTY           "setProperty"
 #define RSET_GET_PROPERTIES         "getProperties"
@@ -64,6 +68,8 @@
 #define RSET_REQUEST                "request"
 #define RSET_RELEASE                "release"
 #define RSET_DELETE                 "delete"
+#define RSET_SUBSCRIBE              "subscribe"
+#define RSET_UNSUBSCRIBE            "unsubscribe"
 
 #define RESOURCE_SET_PROPERTY       "setProperty"
 #define RESOURCE_GET_PROPERTIES     "getProperties"
@@ -82,6 +88,7 @@
 #define PROP_ATTRIBUTES_CONF        "attributes_conf"
 
 #define SIG_PROPERTYCHANGED         "propertyChanged"
+#define SIG_OWNERCHANGED            "ownerChanged"
 
 enum {
     ARG_DR_BUS,
@@ -89,9 +96,11 @@ enum {
     ARG_DR_TRACK_CLIENTS,
     ARG_DR_DEFAULT_ZONE,
     ARG_DR_DEFAULT_CLASS,
+    ARG_DR_ON_DEMAND_SIGNALS,
 };
 
 typedef struct manager_o_s manager_o_t;
+typedef struct resource_o_s resource_o_t;
 
 typedef struct {
     /* configuration */
@@ -102,6 +111,7 @@ typedef struct {
     const char *default_class;
 
     bool tracking;
+    bool on_demand; /* only signal resource sets with subscribers */
 
     int has_classes;
 
@@ -110,6 +120,10 @@ typedef struct {
 
     /* murphy integration */
     mrp_mainloop_t *ml;
+
+    /* pending property change notifications */
+    mrp_list_hook_t changed;
+    mrp_deferred_t *flush;
 } dbus_data_t;
 
 typedef struct property_o_s {
@@ -125,6 +139,12 @@ typedef struct property_o_s {
 
     dbus_data_t *ctx;
 
+    /* hook to pending property change notifications */
+    mrp_list_hook_t hook;
+
+    /* subscribers of the owning resource set, NULL for the manager */
+    mrp_list_hook_t *subscribers;
+
     /* function to free the value */
     void (*free_data)(void *data);
 
@@ -141,11 +161,25 @@ struct manager_o_s {
     property_o_t *rsets_prop;
     property_o_t *available_classes_prop;
 
+    /* resource owner subscriptions */
+    mrp_list_hook_t owner_subs;
+
     /* resource library */
     const char *zone;
     mrp_resource_client_t *client;
 };
 
+typedef struct {
+    mrp_list_hook_t hook;
+    char *name; /* subscriber */
+    char *zone;
+    char *resource;
+
+    manager_o_t *mgr; /* backpointer */
+
+    mrp_resource_owner_watch_t *watch;
+} owner_sub_o_t;
+
 typedef struct {
     uint32_t next_id; /* next resource id */
     char *path;
@@ -154,6 +188,7 @@ typedef struct {
     manager_o_t *mgr; /* backpointer */
 
     mrp_htbl_t *resources;
+    resource_o_t *by_id[MRP_RESOURCE_MAX]; /* resources by definition id */
 
     property_o_t *resources_prop;
     property_o_t *available_resources_prop;
@@ -172,10 +207,21 @@ typedef struct {
 
     /* whether we have encountered an error in the library calls */
     bool error;
+
+    /* clients that have subscribed to our signals */
+    mrp_list_hook_t subscribers;
 } resource_set_o_t;
 
 typedef struct {
+    mrp_list_hook_t hook;
+    char *name;
+
+    resource_set_o_t *rset; /* backpointer */
+} subscriber_o_t;
+
+struct resource_o_s {
     char *path;
+    uint32_t id; /* resource definition id */
 
     resource_set_o_t *rset; /* backpointer */
 
@@ -185,11 +231,12 @@ typedef struct {
     property_o_t *name_prop;
     property_o_t *arguments_prop;
     property_o_t *conf_prop;
-} resource_o_t;
+};
 
 static int mgr_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *msg, void *data);
 static int rset_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *msg, void *data);
 static int resource_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *msg, void *data);
+static int object_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *msg, void *data);
 static void dbus_name_cb(mrp_dbus_t *dbus, const char *name, int up,
                           const char *owner, void *user_data);
 
@@ -507,12 +554,29 @@ static bool get_property_dict_entry(property_o_t *prop, mrp_dbus_msg_t *reply)
 }
 
 
+static bool property_observed(dbus_data_t *ctx, property_o_t *prop)
+{
+    /*
+     * Notes:
+     *   There is no way for us to see the match rules other clients have
+     *   added on the bus. With on-demand signals enabled, clients need to
+     *   subscribe to a resource set to get the signals of the set and its
+     *   resources, and we don't even marshal signals nobody has asked for.
+     */
+
+    if (!ctx->on_demand || !prop->subscribers)
+        return TRUE;
+
+    return !mrp_list_empty(prop->subscribers);
+}
+
+
 static void trigger_property_changed_signal(dbus_data_t *ctx,
         property_o_t *prop)
 {
     mrp_dbus_msg_t *sig;
 
-    if (!prop)
+    if (!prop || !property_observed(ctx, prop))
         return;
 
     mrp_log_info("propertyChanged signal (%s)", prop->name);
@@ -530,11 +594,77 @@ static void trigger_property_changed_signal(dbus_data_t *ctx,
 }
 
 
+static void flush_property_changes(mrp_deferred_t *d, void *user_data)
+{
+    dbus_data_t *ctx = user_data;
+    mrp_list_hook_t *p, *n;
+    property_o_t *prop;
+
+    mrp_disable_deferred(d);
+
+    mrp_list_foreach(&ctx->changed, p, n) {
+        prop = mrp_list_entry(p, typeof(*prop), hook);
+        mrp_list_delete(&prop->hook);
+
+        trigger_property_changed_signal(ctx, prop);
+    }
+}
+
+
+static void queue_property_changed_signal(dbus_data_t *ctx,
+        property_o_t *prop)
+{
+    /*
+     * Notes:
+     *   A single arbitration round typically changes the status of every
+     *   resource in a set, and a property can change more than once while
+     *   we process one event. Instead of sending a signal for every single
+     *   change, we collect the changed properties and send one signal for
+     *   each of them, with its latest value, once we are back in the
+     *   mainloop.
+     */
+
+    if (!mrp_list_empty(&prop->hook) || !property_observed(ctx, prop))
+        return;
+
+    if (!ctx->flush) {
+        ctx->flush = mrp_add_deferred(ctx->ml, flush_property_changes, ctx);
+
+        if (!ctx->flush) {
+            trigger_property_changed_signal(ctx, prop);
+            return;
+        }
+    }
+    else
+        mrp_enable_deferred(ctx->flush);
+
+    mrp_list_append(&ctx->changed, &prop->hook);
+}
+
+
+static bool property_value_equal(property_o_t *prop, void *value)
+{
+    if (!prop->value || !value)
+        return FALSE;
+
+    if (strcmp(prop->dbus_sig, "s") == 0)
+        return strcmp(prop->value, value) == 0;
+
+    if (strcmp(prop->dbus_sig, "b") == 0)
+        return *(bool *) prop->value == *(bool *) value;
+
+    /* arrays and maps are considered always changed */
+    return FALSE;
+}
+
+
 static void destroy_property(property_o_t *prop)
 {
     if (!prop)
         return;
 
+    mrp_list_delete(&prop->hook);
+
     mrp_free(prop->dbus_sig);
     mrp_free(prop->interface);
     mrp_free(prop->path);
@@ -547,8 +677,9 @@ static void destroy_property(property_o_t *prop)
 }
 
 
-static property_o_t *create_property(dbus_data_t *ctx, char *path,
-        const char *interface, const char *sig, const char *name, void *value,
+static property_o_t *create_property(dbus_data_t *ctx,
+        mrp_list_hook_t *subscribers, char *path, const char *interface,
+        const char *sig, const char *name, void *value,
         void (*free_data)(void *data))
 {
     property_o_t *prop = mrp_allocz(sizeof(property_o_t));
@@ -556,6 +687,8 @@ static property_o_t *create_property(dbus_data_t *ctx, char *path,
     if (!prop)
         goto error;
 
+    mrp_list_init(&prop->hook);
+
     prop->dbus_sig = mrp_strdup(sig);
     prop->interface = mrp_strdup(interface);
     prop->path = mrp_strdup(path);
@@ -564,13 +697,14 @@ static property_o_t *create_property(dbus_data_t *ctx, char *path,
     prop->value = value;
 
     prop->ctx = ctx;
+    prop->subscribers = subscribers;
 
     prop->free_data = free_data;
 
     if (!prop->dbus_sig || !prop->name || !prop->value)
         goto error;
 
-    trigger_property_changed_signal(ctx, prop);
+    queue_property_changed_signal(ctx, prop);
 
     return prop;
 
@@ -592,12 +726,18 @@ static void update_property(property_o_t *prop, void *value)
     /* the value is of the same type so we'll use the same function for
      * freeing it */
 
+    if (property_value_equal(prop, value)) {
+        if (prop->free_data && value != prop->value)
+            prop->free_data(value);
+        return;
+    }
+
     if (prop->free_data)
         prop->free_data(prop->value);
 
     prop->value = value;
 
-    trigger_property_changed_signal(prop->ctx, prop);
+    queue_property_changed_signal(prop->ctx, prop);
 }
 
 
@@ -608,15 +748,9 @@ static void destroy_resource(resource_o_t *resource)
 
     mrp_log_info("destroy resource %s", resource->path);
 
-    mrp_dbus_remove_method(resource->rset->mgr->ctx->dbus, resource->path,
-            RESOURCE_IFACE, RESOURCE_GET_PROPERTIES, resource_cb,
-            resource->rset->mgr->ctx);
-    mrp_dbus_remove_method(resource->rset->mgr->ctx->dbus, resource->path,
-            RESOURCE_IFACE, RESOURCE_SET_PROPERTY, resource_cb,
-            resource->rset->mgr->ctx);
-    mrp_dbus_remove_method(resource->rset->mgr->ctx->dbus, resource->path,
-            RESOURCE_IFACE, RESOURCE_DELETE, resource_cb,
-            resource->rset->mgr->ctx);
+    if (resource->id < MRP_RESOURCE_MAX &&
+            resource->rset->by_id[resource->id] == resource)
+        resource->rset->by_id[resource->id] = NULL;
 
     destroy_property(resource->mandatory_prop);
     destroy_property(resource->shared_prop);
@@ -667,6 +801,27 @@ static resource_o_t *get_resource_by_name(resource_set_o_t *rset,
     return s.resource;
 }
 
+
+static resource_o_t *get_resource_by_id(resource_set_o_t *rset,
+        uint32_t id, const char *name)
+{
+    resource_o_t *res;
+
+    /* fall back to searching by name if the index has no entry */
+
+    if (id < MRP_RESOURCE_MAX && (res = rset->by_id[id]) != NULL)
+        return res;
+
+    return get_resource_by_name(rset, name);
+}
+
+
+static void index_resource(resource_set_o_t *rset, resource_o_t *resource)
+{
+    if (resource->id < MRP_RESOURCE_MAX && !rset->by_id[resource->id])
+        rset->by_id[resource->id] = resource;
+}
+
 static void update_resources(resource_set_o_t *rset, mrp_resource_mask_t grant,
         mrp_resource_mask_t advice)
 {
@@ -696,7 +851,7 @@ static void update_resources(resource_set_o_t *rset, mrp_resource_mask_t grant,
 
         /* search the matching resource set object */
 
-        res = get_resource_by_name(rset, name);
+        res = get_resource_by_id(rset, mrp_resource_get_id(resource), name);
 
         if (!res) {
             mrp_log_error("Resource %s not found", name);
@@ -750,8 +905,8 @@ static void event_cb(uint32_t request_id, mrp_resource_set_t *set, void *data)
 
     MRP_UNUSED(request_id);
 
-    mrp_log_info("Event for %s: grant 0x%08x, advice 0x%08x",
-        rset->path, grant, advice);
+    mrp_log_info("Event for %s: grant 0x%08llx, advice 0x%08llx",
+        rset->path, (unsigned long long)grant, (unsigned long long)advice);
 
     if (!rset->set || !rset->committed) {
 
@@ -868,7 +1023,7 @@ static resource_o_t * create_resource(resource_set_o_t *rset,
     map_conf.nbucket = 0;
     map_conf.nentry = 10;
 
-    resource->mandatory_prop = create_property(rset->mgr->ctx, buf,
+    resource->mandatory_prop = create_property(rset->mgr->ctx, &rset->subscribers, buf,
             RESOURCE_IFACE, "b", PROP_MANDATORY, mandatory, free_value);
 
     if (!resource->mandatory_prop) {
@@ -880,7 +1035,7 @@ static resource_o_t * create_resource(resource_set_o_t *rset,
 
     resource->mandatory_prop->writable = TRUE;
 
-    resource->shared_prop = create_property(rset->mgr->ctx, buf,
+    resource->shared_prop = create_property(rset->mgr->ctx, &rset->subscribers, buf,
             RESOURCE_IFACE, "b", PROP_SHARED, shared, free_value);
 
     if (!resource->shared_prop) {
@@ -891,7 +1046,7 @@ static resource_o_t * create_resource(resource_set_o_t *rset,
 
     resource->shared_prop->writable = TRUE;
 
-    resource->name_prop = create_property(rset->mgr->ctx, buf,
+    resource->name_prop = create_property(rset->mgr->ctx, &rset->subscribers, buf,
             RESOURCE_IFACE, "s", PROP_NAME, name, free_value);
 
     if (!resource->name_prop) {
@@ -899,7 +1054,7 @@ static resource_o_t * create_resource(resource_set_o_t *rset,
         goto error;
     }
 
-    resource->status_prop = create_property(rset->mgr->ctx, buf,
+    resource->status_prop = create_property(rset->mgr->ctx, &rset->subscribers, buf,
             RESOURCE_IFACE, "s", PROP_STATUS, "pending", NULL);
 
     if (!resource->status_prop)
@@ -912,6 +1067,7 @@ static resource_o_t * create_resource(resource_set_o_t *rset,
     i = attrs;
 
     resource->rset = rset;
+    resource->id = resource_id;
     resource->path = mrp_strdup(buf);
 
     if (!resource->path)
@@ -949,14 +1105,14 @@ static resource_o_t * create_resource(resource_set_o_t *rset,
         i++;
     }
 
-    resource->conf_prop = create_property(rset->mgr->ctx, buf,
+    resource->conf_prop = create_property(rset->mgr->ctx, &rset->subscribers, buf,
             RESOURCE_IFACE, "a{sv}", PROP_ATTRIBUTES_CONF, conf, free_map);
 
     if (!resource->conf_prop) {
         goto error;
     }
 
-    resource->arguments_prop = create_property(rset->mgr->ctx, buf,
+    resource->arguments_prop = create_property(rset->mgr->ctx, &rset->subscribers, buf,
             RESOURCE_IFACE, "a{sv}", PROP_ATTRIBUTES, conf, NULL);
 
     if (!resource->arguments_prop) {
@@ -976,9 +1132,94 @@ error:
 }
 
 
+static void subscriber_name_cb(mrp_dbus_t *dbus, const char *name, int up,
+                          const char *owner, void *user_data);
+
+static void destroy_subscriber(subscriber_o_t *s)
+{
+    dbus_data_t *ctx = s->rset->mgr->ctx;
+
+    mrp_list_delete(&s->hook);
+
+    if (ctx->tracking)
+        mrp_dbus_forget_name(ctx->dbus, s->name, subscriber_name_cb, s);
+
+    mrp_free(s->name);
+    mrp_free(s);
+}
+
+
+static subscriber_o_t *find_subscriber(resource_set_o_t *rset,
+        const char *name)
+{
+    mrp_list_hook_t *p, *n;
+    subscriber_o_t *s;
+
+    mrp_list_foreach(&rset->subscribers, p, n) {
+        s = mrp_list_entry(p, typeof(*s), hook);
+
+        if (strcmp(s->name, name) == 0)
+            return s;
+    }
+
+    return NULL;
+}
+
+
+static bool add_subscriber(resource_set_o_t *rset, const char *name)
+{
+    dbus_data_t *ctx = rset->mgr->ctx;
+    subscriber_o_t *s;
+
+    if (!name)
+        return FALSE;
+
+    if (find_subscriber(rset, name))
+        return TRUE;
+
+    s = mrp_allocz(sizeof(subscriber_o_t));
+
+    if (!s)
+        return FALSE;
+
+    mrp_list_init(&s->hook);
+    s->rset = rset;
+    s->name = mrp_strdup(name);
+
+    if (!s->name) {
+        mrp_free(s);
+        return FALSE;
+    }
+
+    mrp_list_append(&rset->subscribers, &s->hook);
+
+    /* forget about subscribers that leave the bus */
+    if (ctx->tracking)
+        mrp_dbus_follow_name(ctx->dbus, s->name, subscriber_name_cb, s);
+
+    return TRUE;
+}
+
+
+static void subscriber_name_cb(mrp_dbus_t *dbus, const char *name, int up,
+                          const char *owner, void *user_data)
+{
+    subscriber_o_t *s = user_data;
+
+    MRP_UNUSED(dbus);
+    MRP_UNUSED(owner);
+
+    if (up == 0) {
+        mrp_log_info("subscriber %s of rset %s is gone", name, s->rset->path);
+        destroy_subscriber(s);
+    }
+}
+
+
 static void destroy_rset(resource_set_o_t *rset)
 {
     dbus_data_t *ctx;
+    mrp_list_hook_t *p, *n;
 
     if (!rset)
         return;
@@ -987,18 +1228,9 @@ static void destroy_rset(resource_set_o_t *rset)
 
     mrp_log_info("destroy rset %s", rset->path);
 
-    mrp_dbus_remove_method(ctx->dbus, rset->path, RSET_IFACE, RSET_DELETE,
-            rset_cb, ctx);
-    mrp_dbus_remove_method(ctx->dbus, rset->path, RSET_IFACE, RSET_RELEASE,
-            rset_cb, ctx);
-    mrp_dbus_remove_method(ctx->dbus, rset->path, RSET_IFACE, RSET_REQUEST,
-            rset_cb, ctx);
-    mrp_dbus_remove_method(ctx->dbus, rset->path, RSET_IFACE, RSET_ADD_RESOURCE,
-            rset_cb, ctx);
-    mrp_dbus_remove_method(ctx->dbus, rset->path, RSET_IFACE, RSET_SET_PROPERTY,
-            rset_cb, ctx);
-    mrp_dbus_remove_method(ctx->dbus, rset->path, RSET_IFACE,
-            RSET_GET_PROPERTIES, rset_cb, ctx);
+    mrp_list_foreach(&rset->subscribers, p, n) {
+        destroy_subscriber(mrp_list_entry(p, subscriber_o_t, hook));
+    }
 
     if (rset->resources)
         mrp_htbl_destroy(rset->resources, TRUE);
@@ -1042,6 +1274,8 @@ static resource_set_o_t * create_rset(manager_o_t *mgr, uint32_t id,
     if (!rset)
         goto error;
 
+    mrp_list_init(&rset->subscribers);
+
     ret = snprintf(buf, MAX_PATH_LENGTH, "%s/%u", MURPHY_PATH_BASE, id);
 
     if (ret < 0 || ret >= MAX_PATH_LENGTH)
@@ -1069,13 +1303,13 @@ static resource_set_o_t * create_rset(manager_o_t *mgr, uint32_t id,
         goto error;
     resources_arr[0] = NULL;
 
-    rset->resources_prop = create_property(mgr->ctx, rset->path,
+    rset->resources_prop = create_property(mgr->ctx, &rset->subscribers, rset->path,
             RSET_IFACE, "ao", PROP_RESOURCES, resources_arr, free_string_array);
 
     if (!rset->resources_prop)
         goto error;
 
-    rset->class_prop = create_property(mgr->ctx, rset->path,
+    rset->class_prop = create_property(mgr->ctx, &rset->subscribers, rset->path,
             RSET_IFACE, "s", PROP_CLASS,
             mrp_strdup(rset->mgr->ctx->default_class), free_value);
 
@@ -1084,7 +1318,7 @@ static resource_set_o_t * create_rset(manager_o_t *mgr, uint32_t id,
 
     rset->class_prop->writable = TRUE;
 
-    rset->status_prop = create_property(mgr->ctx, rset->path,
+    rset->status_prop = create_property(mgr->ctx, &rset->subscribers, rset->path,
             RSET_IFACE, "s", PROP_STATUS, "pending", NULL);
 
     if (!rset->status_prop)
@@ -1098,7 +1332,7 @@ static resource_set_o_t * create_rset(manager_o_t *mgr, uint32_t id,
         goto error;
 
     rset->available_resources_prop = create_property(mgr->ctx,
-            rset->path, RSET_IFACE, "as", PROP_AVAILABLE_RESOURCES,
+            &rset->subscribers, rset->path, RSET_IFACE, "as", PROP_AVAILABLE_RESOURCES,
             available_resources_arr, free_string_array);
 
     if (!rset->available_resources_prop)
@@ -1811,25 +2045,9 @@ static int rset_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *msg, void *data)
         if (!resource)
             goto error_reply;
 
-        if (!mrp_dbus_export_method(ctx->dbus, resource->path,
-                    RESOURCE_IFACE, RESOURCE_GET_PROPERTIES, resource_cb,
-                    ctx)) {
-            destroy_resource(resource);
-            goto error_reply;
-        }
-        if (!mrp_dbus_export_method(ctx->dbus, resource->path,
-                    RESOURCE_IFACE, RESOURCE_SET_PROPERTY, resource_cb, ctx)) {
-            destroy_resource(resource);
-            goto error_reply;
-        }
-        if (!mrp_dbus_export_method(ctx->dbus, resource->path,
-                    RESOURCE_IFACE, RESOURCE_DELETE, resource_cb, ctx)) {
-            destroy_resource(resource);
-            goto error_reply;
-        }
-
         mrp_htbl_insert(rset->resources, (void *) resource->path,
                 resource);
+        index_resource(rset, resource);
         update_property(rset->resources_prop, htbl_keys(rset->resources));
 
         reply = mrp_dbus_msg_method_return(dbus, msg);
@@ -1903,6 +2121,37 @@ static int rset_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *msg, void *data)
         mrp_dbus_send_msg(dbus, reply);
         mrp_dbus_msg_unref(reply);
     }
+    else if (strcmp(member, RSET_SUBSCRIBE) == 0) {
+        mrp_log_info("Subscribing to rset %s", path);
+
+        if (!add_subscriber(rset, mrp_dbus_msg_sender(msg))) {
+            error_msg = "Failed to subscribe to resource set";
+            goto error_reply;
+        }
+
+        reply = mrp_dbus_msg_method_return(dbus, msg);
+        if (!reply)
+            goto error;
+
+        mrp_dbus_send_msg(dbus, reply);
+        mrp_dbus_msg_unref(reply);
+    }
+    else if (strcmp(member, RSET_UNSUBSCRIBE) == 0) {
+        const char *sender = mrp_dbus_msg_sender(msg);
+        subscriber_o_t *subscriber;
+
+        mrp_log_info("Unsubscribing from rset %s", path);
+
+        if (sender && (subscriber = find_subscriber(rset, sender)))
+            destroy_subscriber(subscriber);
+
+        reply = mrp_dbus_msg_method_return(dbus, msg);
+        if (!reply)
+            goto error;
+
+        mrp_dbus_send_msg(dbus, reply);
+        mrp_dbus_msg_unref(reply);
+    }
     else if (strcmp(member, RSET_SET_PROPERTY) == 0) {
         char *name = NULL;
         char *value = NULL;
@@ -1992,7 +2241,7 @@ static int update_classes(dbus_data_t *ctx, property_o_t **prop)
         goto error;
     }
 
-    res_classes_prop = create_property(ctx, MURPHY_PATH_BASE,
+    res_classes_prop = create_property(ctx, NULL, MURPHY_PATH_BASE,
             MANAGER_IFACE, "as", PROP_AVAILABLE_CLASSES,
             res_classes_array, free_string_array);
     if (!res_classes_prop) {
@@ -2021,6 +2270,142 @@ error:
     return arr_has_content;
 }
 
+static void owner_sub_name_cb(mrp_dbus_t *dbus, const char *name, int up,
+                              const char *owner, void *user_data);
+
+static void destroy_owner_sub(owner_sub_o_t *s)
+{
+    dbus_data_t *ctx = s->mgr->ctx;
+
+    mrp_list_delete(&s->hook);
+
+    if (ctx->tracking)
+        mrp_dbus_forget_name(ctx->dbus, s->name, owner_sub_name_cb, s);
+
+    mrp_resource_owner_unwatch(s->watch);
+
+    mrp_free(s->name);
+    mrp_free(s->zone);
+    mrp_free(s->resource);
+    mrp_free(s);
+}
+
+
+static owner_sub_o_t *find_owner_sub(manager_o_t *mgr, const char *name,
+        const char *zone, const char *resource)
+{
+    mrp_list_hook_t *p, *n;
+    owner_sub_o_t *s;
+
+    mrp_list_foreach(&mgr->owner_subs, p, n) {
+        s = mrp_list_entry(p, typeof(*s), hook);
+
+        if (strcmp(s->name, name) == 0 && strcmp(s->zone, zone) == 0 &&
+                strcmp(s->resource, resource) == 0)
+            return s;
+    }
+
+    return NULL;
+}
+
+
+static void owner_sub_name_cb(mrp_dbus_t *dbus, const char *name, int up,
+                              const char *owner, void *user_data)
+{
+    owner_sub_o_t *s = user_data;
+
+    MRP_UNUSED(dbus);
+    MRP_UNUSED(owner);
+
+    if (up == 0) {
+        mrp_log_info("owner subscriber %s of %s/%s is gone", name, s->zone,
+                s->resource);
+        destroy_owner_sub(s);
+    }
+}
+
+
+static bool append_owner(mrp_dbus_msg_t *msg, const char *zone,
+        const char *resource, mrp_resource_set_t *owner)
+{
+    uint32_t rset_id = owner ? mrp_get_resource_set_id(owner) : 0;
+    const char *class = owner && owner->class.ptr ?
+        mrp_application_class_get_name(owner->class.ptr) : "";
+
+    return
+        mrp_dbus_msg_append_basic(msg, MRP_DBUS_TYPE_STRING, (void *) zone) &&
+        mrp_dbus_msg_append_basic(msg, MRP_DBUS_TYPE_STRING,
+                (void *) resource) &&
+        mrp_dbus_msg_append_basic(msg, MRP_DBUS_TYPE_UINT32, &rset_id) &&
+        mrp_dbus_msg_append_basic(msg, MRP_DBUS_TYPE_STRING, (void *) class);
+}
+
+
+static void owner_changed_cb(uint32_t zoneid, uint32_t resid,
+        mrp_resource_set_t *owner, void *user_data)
+{
+    owner_sub_o_t *s = user_data;
+    dbus_data_t *ctx = s->mgr->ctx;
+    mrp_dbus_msg_t *sig;
+
+    MRP_UNUSED(zoneid);
+    MRP_UNUSED(resid);
+
+    sig = mrp_dbus_msg_signal(ctx->dbus, s->name, MURPHY_PATH_BASE,
+            MANAGER_IFACE, SIG_OWNERCHANGED);
+
+    if (!sig)
+        return;
+
+    if (append_owner(sig, s->zone, s->resource, owner))
+        mrp_dbus_send_msg(ctx->dbus, sig);
+    else
+        mrp_log_error("failed to create %s signal", SIG_OWNERCHANGED);
+
+    mrp_dbus_msg_unref(sig);
+}
+
+
+static owner_sub_o_t *add_owner_sub(manager_o_t *mgr, const char *name,
+        const char *zone, const char *resource, uint32_t zoneid,
+        uint32_t resid)
+{
+    dbus_data_t *ctx = mgr->ctx;
+    owner_sub_o_t *s;
+
+    if ((s = find_owner_sub(mgr, name, zone, resource)) != NULL)
+        return s;
+
+    s = mrp_allocz(sizeof(owner_sub_o_t));
+
+    if (!s)
+        return NULL;
+
+    mrp_list_init(&s->hook);
+    s->mgr = mgr;
+    s->name = mrp_strdup(name);
+    s->zone = mrp_strdup(zone);
+    s->resource = mrp_strdup(resource);
+    s->watch = mrp_resource_owner_watch(zoneid, resid, owner_changed_cb, s);
+
+    if (!s->name || !s->zone || !s->resource || !s->watch) {
+        mrp_resource_owner_unwatch(s->watch);
+        mrp_free(s->name);
+        mrp_free(s->zone);
+        mrp_free(s->resource);
+        mrp_free(s);
+        return NULL;
+    }
+
+    mrp_list_append(&mgr->owner_subs, &s->hook);
+
+    if (ctx->tracking)
+        mrp_dbus_follow_name(ctx->dbus, s->name, owner_sub_name_cb, s);
+
+    return s;
+}
+
+
 static int mgr_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *msg, void *data)
 {
     const char *member = mrp_dbus_msg_member(msg);
@@ -2079,37 +2464,6 @@ static int mgr_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *msg, void *data)
         if (!rset)
             goto error_reply;
 
-        if (!mrp_dbus_export_method(ctx->dbus, rset->path,
-                    RSET_IFACE, RSET_GET_PROPERTIES, rset_cb, ctx)) {
-            destroy_rset(rset);
-            goto error_reply;
-        }
-        if (!mrp_dbus_export_method(ctx->dbus, rset->path,
-                    RSET_IFACE, RSET_SET_PROPERTY, rset_cb, ctx)) {
-            destroy_rset(rset);
-            goto error_reply;
-        }
-        if (!mrp_dbus_export_method(ctx->dbus, rset->path,
-                    RSET_IFACE, RSET_ADD_RESOURCE, rset_cb, ctx)) {
-            destroy_rset(rset);
-            goto error_reply;
-        }
-        if (!mrp_dbus_export_method(ctx->dbus, rset->path,
-                    RSET_IFACE, RSET_REQUEST, rset_cb, ctx)) {
-            destroy_rset(rset);
-            goto error_reply;
-        }
-        if (!mrp_dbus_export_method(ctx->dbus, rset->path,
-                    RSET_IFACE, RSET_RELEASE, rset_cb, ctx)) {
-            destroy_rset(rset);
-            goto error_reply;
-        }
-        if (!mrp_dbus_export_method(ctx->dbus, rset->path,
-                    RSET_IFACE, RSET_DELETE, rset_cb, ctx)) {
-            destroy_rset(rset);
-            goto error_reply;
-        }
-
         mrp_htbl_insert(ctx->mgr->rsets, (void *) rset->path, rset);
         update_property(ctx->mgr->rsets_prop, htbl_keys(ctx->mgr->rsets));
 
@@ -2133,6 +2487,53 @@ static int mgr_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *msg, void *data)
 
         mrp_log_info("created resource set %s\n", rset->path);
     }
+    else if (strcmp(member, MANAGER_SUBSCRIBE_OWNER) == 0 ||
+            strcmp(member, MANAGER_UNSUBSCRIBE_OWNER) == 0) {
+        const char *sender = mrp_dbus_msg_sender(msg);
+        const char *zone, *resource;
+        uint32_t zoneid, resid;
+        owner_sub_o_t *s;
+
+        if (!sender ||
+                !mrp_dbus_msg_read_basic(msg, MRP_DBUS_TYPE_STRING, &zone) ||
+                !mrp_dbus_msg_read_basic(msg, MRP_DBUS_TYPE_STRING, &resource))
+            goto error_reply;
+
+        zoneid = mrp_zone_get_id_by_name(zone);
+        resid = mrp_resource_definition_get_resource_id_by_name(resource);
+
+        if (zoneid == MRP_ZONE_ID_INVALID || resid == MRP_RESOURCE_ID_INVALID)
+            goto error_reply;
+
+        reply = mrp_dbus_msg_method_return(dbus, msg);
+
+        if (!reply)
+            goto error;
+
+        if (strcmp(member, MANAGER_SUBSCRIBE_OWNER) == 0) {
+            if (!add_owner_sub(ctx->mgr, sender, zone, resource, zoneid,
+                        resid)) {
+                mrp_dbus_msg_unref(reply);
+                goto error_reply;
+            }
+
+            /* reply with the current owner to avoid a race with the signal */
+            if (!append_owner(reply, zone, resource,
+                        mrp_resource_owner_get_set(zoneid, resid))) {
+                mrp_dbus_msg_unref(reply);
+                goto error_reply;
+            }
+        }
+        else {
+            s = find_owner_sub(ctx->mgr, sender, zone, resource);
+
+            if (s)
+                destroy_owner_sub(s);
+        }
+
+        mrp_dbus_send_msg(dbus, reply);
+        mrp_dbus_msg_unref(reply);
+    }
 
     return TRUE;
 
@@ -2155,17 +2556,103 @@ error:
 }
 
 
+/*
+ * Resource set and resource methods are not exported per object. Instead
+ * a single wildcard handler per method dispatches the calls by path, so
+ * creating and deleting objects does not touch the D-Bus handler tables.
+ */
+
+static struct {
+    const char *iface;
+    const char *member;
+} object_methods[] = {
+    { RSET_IFACE    , RSET_GET_PROPERTIES     },
+    { RSET_IFACE    , RSET_SET_PROPERTY       },
+    { RSET_IFACE    , RSET_ADD_RESOURCE       },
+    { RSET_IFACE    , RSET_REQUEST            },
+    { RSET_IFACE    , RSET_RELEASE            },
+    { RSET_IFACE    , RSET_DELETE             },
+    { RSET_IFACE    , RSET_SUBSCRIBE          },
+    { RSET_IFACE    , RSET_UNSUBSCRIBE        },
+    { RESOURCE_IFACE, RESOURCE_GET_PROPERTIES },
+    { RESOURCE_IFACE, RESOURCE_SET_PROPERTY   },
+    { RESOURCE_IFACE, RESOURCE_DELETE         },
+    { NULL, NULL }
+};
+
+
+static int object_cb(mrp_dbus_t *dbus, mrp_dbus_msg_t *msg, void *data)
+{
+    const char *path = mrp_dbus_msg_path(msg);
+    const char *iface = mrp_dbus_msg_interface(msg);
+    dbus_data_t *ctx = data;
+    char buf[MAX_PATH_LENGTH];
+    resource_set_o_t *rset;
+    uint32_t rset_id, resource_id;
+    int ret;
+
+    /* returning FALSE lets other handlers (or D-Bus itself) deal with it */
+
+    if (!path || !ctx->mgr)
+        return FALSE;
+
+    if (parse_path(path, &rset_id, &resource_id)) {
+        if (iface && strcmp(iface, RESOURCE_IFACE) != 0)
+            return FALSE;
+
+        ret = snprintf(buf, MAX_PATH_LENGTH, "%s/%u", MURPHY_PATH_BASE,
+                rset_id);
+
+        if (ret < 0 || ret >= MAX_PATH_LENGTH)
+            return FALSE;
+
+        rset = mrp_htbl_lookup(ctx->mgr->rsets, buf);
+
+        if (!rset || !mrp_htbl_lookup(rset->resources, (void *) path))
+            return FALSE;
+
+        return resource_cb(dbus, msg, data);
+    }
+    else {
+        if (iface && strcmp(iface, RSET_IFACE) != 0)
+            return FALSE;
+
+        if (!mrp_htbl_lookup(ctx->mgr->rsets, (void *) path))
+            return FALSE;
+
+        return rset_cb(dbus, msg, data);
+    }
+}
+
+
 static void destroy_manager(manager_o_t *mgr)
 {
+    mrp_list_hook_t *p, *n;
+    int i;
+
     if (!mgr)
         return;
 
+    mrp_list_foreach(&mgr->owner_subs, p, n) {
+        destroy_owner_sub(mrp_list_entry(p, owner_sub_o_t, hook));
+    }
+
     mrp_dbus_remove_method(mgr->ctx->dbus, MURPHY_PATH_BASE,
             MANAGER_IFACE, MANAGER_CREATE_RESOURCE_SET, mgr_cb, mgr->ctx);
 
     mrp_dbus_remove_method(mgr->ctx->dbus, MURPHY_PATH_BASE,
             MANAGER_IFACE, MANAGER_GET_PROPERTIES, mgr_cb, mgr->ctx);
 
+    mrp_dbus_remove_method(mgr->ctx->dbus, MURPHY_PATH_BASE,
+            MANAGER_IFACE, MANAGER_SUBSCRIBE_OWNER, mgr_cb, mgr->ctx);
+
+    mrp_dbus_remove_method(mgr->ctx->dbus, MURPHY_PATH_BASE,
+            MANAGER_IFACE, MANAGER_UNSUBSCRIBE_OWNER, mgr_cb, mgr->ctx);
+
+    for (i = 0; object_methods[i].member != NULL; i++)
+        mrp_dbus_remove_method(mgr->ctx->dbus, "", object_methods[i].iface,
+                object_methods[i].member, object_cb, mgr->ctx);
+
     mrp_htbl_destroy(mgr->rsets, TRUE);
     destroy_property(mgr->rsets_prop);
     destroy_property(mgr->available_classes_prop);
@@ -2187,6 +2674,7 @@ static manager_o_t *create_manager(dbus_data_t *ctx)
         goto error;
 
     mgr->ctx = ctx;
+    mrp_list_init(&mgr->owner_subs);
 
     rset_arr = mrp_allocz(sizeof(char **));
     if (!rset_arr)
@@ -2195,7 +2683,7 @@ static manager_o_t *create_manager(dbus_data_t *ctx)
 
     /* FIXME: duplication of code? */
 
-    mgr->rsets_prop = create_property(ctx, MURPHY_PATH_BASE, MANAGER_IFACE,
+    mgr->rsets_prop = create_property(ctx, NULL, MURPHY_PATH_BASE, MANAGER_IFACE,
             "ao", PROP_RESOURCE_SETS, rset_arr, free_string_array);
 
     if (!mgr->rsets_prop)
@@ -2243,13 +2731,17 @@ static int dbus_resource_init(mrp_plugin_t *plugin)
     mrp_plugin_arg_t *args = plugin->args;
     dbus_data_t *ctx = mrp_allocz(sizeof(dbus_data_t));
     mrp_dbus_err_t err;
+    int i;
 
     if (!ctx)
         goto error;
 
+    mrp_list_init(&ctx->changed);
+
     ctx->ml = plugin->ctx->ml;
     ctx->addr = args[ARG_DR_SERVICE].str;
     ctx->tracking = args[ARG_DR_TRACK_CLIENTS].bln;
+    ctx->on_demand = args[ARG_DR_ON_DEMAND_SIGNALS].bln;
     ctx->default_zone = args[ARG_DR_DEFAULT_ZONE].str;
     ctx->default_class = args[ARG_DR_DEFAULT_CLASS].str;
     ctx->bus = args[ARG_DR_BUS].str;
@@ -2292,11 +2784,31 @@ static int dbus_resource_init(mrp_plugin_t *plugin)
        goto error;
     }
 
+    if (!mrp_dbus_export_method(ctx->dbus, MURPHY_PATH_BASE,
+                MANAGER_IFACE, MANAGER_SUBSCRIBE_OWNER, mgr_cb, ctx) ||
+        !mrp_dbus_export_method(ctx->dbus, MURPHY_PATH_BASE,
+                MANAGER_IFACE, MANAGER_UNSUBSCRIBE_OWNER, mgr_cb, ctx)) {
+       mrp_log_error("Failed to register manager object");
+       goto error;
+    }
+
+    for (i = 0; object_methods[i].member != NULL; i++) {
+        if (!mrp_dbus_export_method(ctx->dbus, "", object_methods[i].iface,
+                    object_methods[i].member, object_cb, ctx)) {
+            mrp_log_error("Failed to register resource set method %s",
+                    object_methods[i].member);
+            goto error;
+        }
+    }
+
+    plugin->data = ctx;
+
     return TRUE;
 
 error:
     if (ctx) {
         destroy_manager(ctx->mgr);
+        mrp_del_deferred(ctx->flush);
         mrp_free(ctx);
     }
 
@@ -2308,12 +2820,14 @@ static void dbus_resource_exit(mrp_plugin_t *plugin)
 {
     dbus_data_t *ctx = plugin->data;
 
+    /* the manager and resource sets still need the bus for cleanup */
+    destroy_manager(ctx->mgr);
+    mrp_del_deferred(ctx->flush);
+
     mrp_dbus_release_name(ctx->dbus, ctx->addr, NULL);
     mrp_dbus_unref(ctx->dbus);
     ctx->dbus = NULL;
 
-    mrp_htbl_destroy(ctx->mgr->rsets, TRUE);
-    destroy_manager(ctx->mgr);
     mrp_free(ctx);
 
     plugin->data = NULL;
@@ -2334,6 +2848,8 @@ static mrp_plugin_arg_t args[] = {
     MRP_PLUGIN_ARGIDX(ARG_DR_DEFAULT_ZONE, STRING, "default_zone", "default"),
     MRP_PLUGIN_ARGIDX(ARG_DR_DEFAULT_CLASS, STRING, "default_class", "default"),
     MRP_PLUGIN_ARGIDX(ARG_DR_TRACK_CLIENTS, BOOL, "dbus_track", TRUE),
+    MRP_PLUGIN_ARGIDX(ARG_DR_ON_DEMAND_SIGNALS, BOOL, "dbus_on_demand_signals",
+                      FALSE),
 };
 
 
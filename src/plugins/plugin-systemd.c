@@ -1,5 +1,6 @@
 #include <stdlib.h>
-#include <syslog.h>
+#include <string.h>
+#include <sys/uio.h>
 
 #include <systemd/sd-daemon.h>
 #include <systemd/sd-journal.h>
@@ -7,29 +8,76 @@
 #include <murphy/common.h>
 #include <murphy/core.h>
 
-static void sdlogger(void *data, mrp_log_level_t level, const char *file,
-                     int line, const char *func, const char *format, va_list ap)
+#define MESSAGE_MAX 1024
+
+static size_t field(char *buf, size_t size, const char *name, size_t nlen,
+                    const char *val, size_t vlen)
+{
+    if (nlen + vlen >= size)
+        vlen = size - nlen - 1;
+
+    memcpy(buf, name, nlen);
+    memcpy(buf + nlen, val, vlen);
+    buf[nlen + vlen] = '\0';
+
+    return nlen + vlen;
+}
+
+#define FIELD(_iov, _buf, _name, _val, _len) do {                         \
+        (_iov)->iov_base = _buf;                                          \
+        (_iov)->iov_len  = field(_buf, sizeof(_buf), _name "=",           \
+                                 sizeof(_name "=") - 1, _val, _len);      \
+    } while (0)
+
+
+static void sdwriter(void *data, mrp_log_level_t level, const char *file,
+                     int line, const char *func, const char *msg, size_t len)
 {
-    va_list cp;
-    int     prio;
-    char    filebuf[1024], linebuf[64];
+    static char  *prio[] = {
+        [MRP_LOG_ERROR]   = "PRIORITY=3",
+        [MRP_LOG_WARNING] = "PRIORITY=4",
+        [MRP_LOG_INFO]    = "PRIORITY=6",
+        [MRP_LOG_DEBUG]   = "PRIORITY=7",
+    };
+    struct iovec  iov[5];
+    char          filebuf[512], linebuf[32], funcbuf[256];
+    char          msgbuf[MESSAGE_MAX];
+    int           n;
 
     MRP_UNUSED(data);
 
-    va_copy(cp, ap);
-    switch (level) {
-    case MRP_LOG_ERROR:   prio = LOG_ERR;     break;
-    case MRP_LOG_WARNING: prio = LOG_WARNING; break;
-    case MRP_LOG_INFO:    prio = LOG_INFO;    break;
-    case MRP_LOG_DEBUG:   prio = LOG_DEBUG;   break;
-    default:              prio = LOG_INFO;
+    /*
+     * Notes:
+     *     Every journal field needs to be a single NAME=value chunk, so we
+     *     do have to copy the values after the names. The message is taken
+     *     as is, without going through printf again.
+     */
+
+    n = 0;
+
+    iov[n].iov_base = prio[level <= MRP_LOG_DEBUG ? level : MRP_LOG_INFO];
+    iov[n].iov_len  = strlen(iov[n].iov_base);
+    n++;
+
+    FIELD(iov + n, msgbuf, "MESSAGE", msg, len);
+    n++;
+
+    if (file != NULL && *file) {
+        FIELD(iov + n, filebuf, "CODE_FILE", file, strlen(file));
+        n++;
+
+        iov[n].iov_base = linebuf;
+        iov[n].iov_len  = snprintf(linebuf, sizeof(linebuf), "CODE_LINE=%d",
+                                   line);
+        n++;
     }
 
-    snprintf(filebuf, sizeof(filebuf), "CODE_FILE=%s", file);
-    snprintf(linebuf, sizeof(linebuf), "CODE_LINE=%d", line);
-    sd_journal_printv_with_location(prio, filebuf, linebuf, func, format, cp);
+    if (func != NULL && *func) {
+        FIELD(iov + n, funcbuf, "CODE_FUNC", func, strlen(func));
+        n++;
+    }
 
-    va_end(cp);
+    sd_journal_sendv(iov, n);
 }
 
 
@@ -37,7 +85,7 @@ static int sdlogger_init(mrp_plugin_t *plugin)
 {
     MRP_UNUSED(plugin);
 
-    if (mrp_log_register_target("systemd", sdlogger, NULL))
+    if (mrp_log_register_writer("systemd", sdwriter, NULL))
         mrp_log_info("systemd: registered logging target.");
     else
         mrp_log_error("systemd: failed to register logging target.");
@@ -118,16 +118,10 @@ mrp_res_string_array_t * mrp_res_list_attribute_names(
 {
     int i;
     mrp_res_string_array_t *ret;
-    mrp_res_context_t *cx = NULL;
 
     if (!res)
         return NULL;
 
-    cx = res->priv->set->priv->cx;
-
-    if (!cx)
-        return NULL;
-
     ret = mrp_allocz(sizeof(mrp_res_string_array_t));
 
     if (!ret)
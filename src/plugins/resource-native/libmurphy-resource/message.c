@@ -55,7 +55,7 @@ bool fetch_resource_set_state(mrp_msg_t *msg, void **pcursor,
 
 
 bool fetch_resource_set_mask(mrp_msg_t *msg, void **pcursor,
-                                    int mask_type, uint32_t *pmask)
+                                    int mask_type, uint64_t *pmask)
 {
     uint16_t expected_tag;
     uint16_t tag;
@@ -69,14 +69,16 @@ bool fetch_resource_set_mask(mrp_msg_t *msg, void **pcursor,
     default:       /* don't know what to fetch */              return false;
     }
 
+    /* masks are sent as UINT64 only if there are more than 32 resources */
     if (!mrp_msg_iterate(msg, pcursor, &tag, &type, &value, &size) ||
-        tag != expected_tag || type != MRP_MSG_FIELD_UINT32)
+        tag != expected_tag ||
+        (type != MRP_MSG_FIELD_UINT32 && type != MRP_MSG_FIELD_UINT64))
     {
         *pmask = 0;
         return false;
     }
 
-    *pmask = value.u32;
+    *pmask = type == MRP_MSG_FIELD_UINT32 ? value.u32 : value.u64;
     return true;
 }
 
@@ -279,8 +281,8 @@ static int priv_res_to_mrp_res(uint32_t id, resource_def_t *src, mrp_res_resourc
 }
 
 
-mrp_res_resource_set_t *resource_query_response(mrp_res_context_t *cx,
-        mrp_msg_t *msg, void **pcursor)
+mrp_res_resource_set_t *resource_query_response(mrp_msg_t *msg,
+        void **pcursor)
 {
     int             status;
     uint32_t        dim, i;
@@ -289,9 +291,6 @@ mrp_res_resource_set_t *resource_query_response(mrp_res_context_t *cx,
     resource_def_t *src;
     mrp_res_resource_set_t *arr = NULL;
 
-    if (!cx)
-        goto failed;
-
     if (!fetch_status(msg, pcursor, &status))
         goto failed;
 
@@ -329,7 +328,7 @@ mrp_res_resource_set_t *resource_query_response(mrp_res_context_t *cx,
 
         arr->application_class = NULL;
         arr->state = MRP_RES_RESOURCE_LOST;
-        arr->priv->cx = cx;
+        arr->priv->cx = NULL; /* shared by all contexts */
         arr->priv->num_resources = dim;
 
         arr->priv->resources = mrp_allocz_array(mrp_res_resource_t *, dim);
@@ -388,11 +387,13 @@ mrp_res_string_array_t *class_query_response(mrp_msg_t *msg, void **pcursor)
 
 
 bool create_resource_set_response(mrp_msg_t *msg,
-        mrp_res_resource_set_t *rset, void **pcursor)
+        mrp_res_resource_set_t *rset, void **pcursor, int *pstatus)
 {
     int status;
     uint32_t rset_id;
 
+    *pstatus = EINVAL;
+
     if (!fetch_status(msg, pcursor, &status) || (status == 0 &&
         !fetch_resource_set_id(msg, pcursor, &rset_id)))
     {
@@ -400,6 +401,8 @@ bool create_resource_set_response(mrp_msg_t *msg,
         goto error;
     }
 
+    *pstatus = status;
+
     if (status) {
         mrp_res_error("creation of resource set failed. error code %u",status);
         goto error;
@@ -414,12 +417,14 @@ error:
 
 
 mrp_res_resource_set_t *acquire_resource_set_response(mrp_msg_t *msg,
-            mrp_res_context_t *cx, void **pcursor)
+            mrp_res_context_t *cx, void **pcursor, int *pstatus)
 {
     int status;
     uint32_t rset_id;
     mrp_res_resource_set_t *rset = NULL;
 
+    *pstatus = EINVAL;
+
     if (!fetch_resource_set_id(msg, pcursor, &rset_id) ||
         !fetch_status(msg, pcursor, &status))
     {
@@ -427,6 +432,8 @@ mrp_res_resource_set_t *acquire_resource_set_response(mrp_msg_t *msg,
         goto error;
     }
 
+    *pstatus = status;
+
     if (status) {
         mrp_res_error("acquiring of resource set failed. error code %u",status);
         goto error;
@@ -453,12 +460,15 @@ int acquire_resource_set_request(mrp_res_context_t *cx,
         mrp_res_resource_set_t *rset)
 {
     mrp_msg_t *msg = NULL;
+    uint32_t seqno;
 
-    if (!cx->priv->connected)
+    if (!cx->priv->conn->connected)
         return -1;
 
+    seqno = alloc_seqno(cx);
+
     msg = mrp_msg_create(
-            RESPROTO_SEQUENCE_NO, MRP_MSG_FIELD_UINT32, cx->priv->next_seqno,
+            RESPROTO_SEQUENCE_NO, MRP_MSG_FIELD_UINT32, seqno,
             RESPROTO_REQUEST_TYPE, MRP_MSG_FIELD_UINT16,
                     RESPROTO_ACQUIRE_RESOURCE_SET,
             RESPROTO_RESOURCE_SET_ID, MRP_MSG_FIELD_UINT32, rset->priv->id,
@@ -467,10 +477,9 @@ int acquire_resource_set_request(mrp_res_context_t *cx,
     if (!msg)
         return -1;
 
-    rset->priv->seqno = cx->priv->next_seqno;
-    cx->priv->next_seqno++;
+    rset->priv->seqno = seqno;
 
-    if (!mrp_transport_send(cx->priv->transp, msg))
+    if (!mrp_transport_send(cx->priv->conn->transp, msg))
         goto error;
 
     mrp_msg_unref(msg);
@@ -486,12 +495,15 @@ int release_resource_set_request(mrp_res_context_t *cx,
         mrp_res_resource_set_t *rset)
 {
     mrp_msg_t *msg = NULL;
+    uint32_t seqno;
 
-    if (!cx->priv->connected)
+    if (!cx->priv->conn->connected)
         return -1;
 
+    seqno = alloc_seqno(cx);
+
     msg = mrp_msg_create(
-            RESPROTO_SEQUENCE_NO, MRP_MSG_FIELD_UINT32, cx->priv->next_seqno,
+            RESPROTO_SEQUENCE_NO, MRP_MSG_FIELD_UINT32, seqno,
             RESPROTO_REQUEST_TYPE, MRP_MSG_FIELD_UINT16,
                     RESPROTO_RELEASE_RESOURCE_SET,
             RESPROTO_RESOURCE_SET_ID, MRP_MSG_FIELD_UINT32, rset->priv->id,
@@ -500,10 +512,9 @@ int release_resource_set_request(mrp_res_context_t *cx,
     if (!msg)
         return -1;
 
-    rset->priv->seqno = cx->priv->next_seqno;
-    cx->priv->next_seqno++;
+    rset->priv->seqno = seqno;
 
-    if (!mrp_transport_send(cx->priv->transp, msg))
+    if (!mrp_transport_send(cx->priv->conn->transp, msg))
         goto error;
 
     mrp_msg_unref(msg);
@@ -521,18 +532,21 @@ int create_resource_set_request(mrp_res_context_t *cx,
     mrp_msg_t *msg = NULL;
     uint32_t i;
     uint32_t rset_flags = 0;
+    uint32_t seqno;
 
     if (!cx || !rset)
         return -1;
 
-    if (!cx->priv->connected)
+    if (!cx->priv->conn->connected)
         return -1;
 
     if (rset->priv->autorelease)
         rset_flags |= RESPROTO_RSETFLAG_AUTORELEASE;
 
+    seqno = alloc_seqno(cx);
+
     msg = mrp_msg_create(
-            RESPROTO_SEQUENCE_NO, MRP_MSG_FIELD_UINT32, cx->priv->next_seqno,
+            RESPROTO_SEQUENCE_NO, MRP_MSG_FIELD_UINT32, seqno,
             RESPROTO_REQUEST_TYPE, MRP_MSG_FIELD_UINT16,
                     RESPROTO_CREATE_RESOURCE_SET,
             RESPROTO_RESOURCE_FLAGS, MRP_MSG_FIELD_UINT32, rset_flags,
@@ -544,8 +558,7 @@ int create_resource_set_request(mrp_res_context_t *cx,
     if (!msg)
         return -1;
 
-    rset->priv->seqno = cx->priv->next_seqno;
-    cx->priv->next_seqno++;
+    rset->priv->seqno = seqno;
 
     for (i = 0; i < rset->priv->num_resources; i++) {
         int j;
@@ -607,7 +620,7 @@ int create_resource_set_request(mrp_res_context_t *cx,
             goto error;
     }
 
-    if (!mrp_transport_send(cx->priv->transp, msg))
+    if (!mrp_transport_send(cx->priv->conn->transp, msg))
         goto error;
 
     mrp_msg_unref(msg);
@@ -619,11 +632,11 @@ error:
 }
 
 
-int get_application_classes_request(mrp_res_context_t *cx)
+int get_application_classes_request(mrp_res_connection_t *conn)
 {
     mrp_msg_t *msg = NULL;
 
-    if (!cx->priv->connected)
+    if (!conn->connected)
         goto error;
 
     msg = mrp_msg_create(RESPROTO_SEQUENCE_NO, MRP_MSG_FIELD_UINT32, 0,
@@ -633,7 +646,7 @@ int get_application_classes_request(mrp_res_context_t *cx)
     if (!msg)
         goto error;
 
-    if (!mrp_transport_send(cx->priv->transp, msg))
+    if (!mrp_transport_send(conn->transp, msg))
         goto error;
 
     mrp_msg_unref(msg);
@@ -645,11 +658,11 @@ error:
 }
 
 
-int get_available_resources_request(mrp_res_context_t *cx)
+int get_available_resources_request(mrp_res_connection_t *conn)
 {
     mrp_msg_t *msg = NULL;
 
-    if (!cx->priv->connected)
+    if (!conn->connected)
         goto error;
 
     msg = mrp_msg_create(RESPROTO_SEQUENCE_NO, MRP_MSG_FIELD_UINT32, 0,
@@ -660,7 +673,7 @@ int get_available_resources_request(mrp_res_context_t *cx)
     if (!msg)
         goto error;
 
-    if (!mrp_transport_send(cx->priv->transp, msg))
+    if (!mrp_transport_send(conn->transp, msg))
         goto error;
 
     mrp_msg_unref(msg);
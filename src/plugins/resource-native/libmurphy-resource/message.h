@@ -41,7 +41,7 @@ bool fetch_resource_set_state(mrp_msg_t *msg, void **pcursor,
                                      mrp_resproto_state_t *pstate);
 
 bool fetch_resource_set_mask(mrp_msg_t *msg, void **pcursor,
-                                    int mask_type, uint32_t *pmask);
+                                    int mask_type, uint64_t *pmask);
 
 bool fetch_resource_set_id(mrp_msg_t *msg, void **pcursor, uint32_t *pid);
 
@@ -63,16 +63,16 @@ bool fetch_resource_name(mrp_msg_t *msg, void **pcursor,
 
 /* handling of the message responses */
 
-mrp_res_resource_set_t *resource_query_response(mrp_res_context_t *cx,
-        mrp_msg_t *msg, void **pcursor);
+mrp_res_resource_set_t *resource_query_response(mrp_msg_t *msg,
+        void **pcursor);
 
 mrp_res_string_array_t *class_query_response(mrp_msg_t *msg, void **pcursor);
 
 bool create_resource_set_response(mrp_msg_t *msg,
-        mrp_res_resource_set_t *rset, void **pcursor);
+        mrp_res_resource_set_t *rset, void **pcursor, int *pstatus);
 
 mrp_res_resource_set_t *acquire_resource_set_response(mrp_msg_t *msg,
-            mrp_res_context_t *cx, void **pcursor);
+            mrp_res_context_t *cx, void **pcursor, int *pstatus);
 
 /* requests to the server */
 
@@ -85,8 +85,8 @@ int release_resource_set_request(mrp_res_context_t *cx,
 int create_resource_set_request(mrp_res_context_t *cx,
         mrp_res_resource_set_t *rset);
 
-int get_application_classes_request(mrp_res_context_t *cx);
+int get_application_classes_request(mrp_res_connection_t *conn);
 
-int get_available_resources_request(mrp_res_context_t *cx);
+int get_available_resources_request(mrp_res_connection_t *conn);
 
 #endif
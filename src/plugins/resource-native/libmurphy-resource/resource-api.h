@@ -137,6 +137,21 @@ typedef void (*mrp_res_state_callback_t) (mrp_res_context_t *cx,
 typedef void (*mrp_res_resource_callback_t) (mrp_res_context_t *cx,
         const mrp_res_resource_set_t *rs, void *userdata);
 
+/**
+ * Prototype for request completion callback. It is called once the
+ * server has replied to an acquire or release request. The resource
+ * set is borrowed from the library: it is valid only for the duration
+ * of the callback and must not be modified. Use mrp_res_copy_resource_set
+ * if you need to keep it.
+ *
+ * @param cx murphy connection context.
+ * @param rs resource set the request was made for.
+ * @param status 0 if the request succeeded, an error code otherwise.
+ * @param userdata data you gave when making the request.
+ */
+typedef void (*mrp_res_request_callback_t) (mrp_res_context_t *cx,
+        const mrp_res_resource_set_t *rs, int status, void *userdata);
+
 /**
  * Connect to murphy. You have to wait for the callback
  * to check that state is connected.
@@ -283,6 +298,38 @@ int mrp_res_acquire_resource_set(const mrp_res_resource_set_t *rs);
  */
 int mrp_res_release_resource_set(mrp_res_resource_set_t *rs);
 
+/**
+ * Acquire resources without waiting for earlier requests to complete.
+ * Any number of acquire and release requests can be outstanding on a
+ * connection, also for the same resource set. They are sent in the
+ * order they were made and each reply is matched to its request by
+ * the sequence number. Resource callbacks are not delivered for the
+ * set while requests for it are outstanding, so intermediate states
+ * are not reported.
+ *
+ * @param rs resource set you want to acquire.
+ * @param cb callback to call when the request completes, or NULL.
+ * @param userdata data passed to the callback.
+ *
+ * @return murphy error code.
+ */
+int mrp_res_acquire_resource_set_async(const mrp_res_resource_set_t *rs,
+        mrp_res_request_callback_t cb, void *userdata);
+
+/**
+ * Release resources without waiting for earlier requests to complete.
+ * See mrp_res_acquire_resource_set_async for how the requests are
+ * ordered and completed.
+ *
+ * @param rs resource set you want to release.
+ * @param cb callback to call when the request completes, or NULL.
+ * @param userdata data passed to the callback.
+ *
+ * @return murphy error code.
+ */
+int mrp_res_release_resource_set_async(const mrp_res_resource_set_t *rs,
+        mrp_res_request_callback_t cb, void *userdata);
+
 
 /**
  * Get a resource set unique server-side id. The id information is
@@ -306,6 +353,21 @@ int mrp_res_release_resource_set(mrp_res_resource_set_t *rs);
 int mrp_res_get_resource_set_id(mrp_res_resource_set_t *rs);
 
 
+/**
+ * Get the current state of a resource set. If the resource manager
+ * publishes resource set states in shared memory, the state is read
+ * from there without a round-trip to the server and it can be more
+ * recent than the state reported by the last resource callback.
+ * Otherwise the state of the last received update is returned.
+ *
+ * @param rs resource set whose state is queried.
+ *
+ * @return current state of the resource set.
+ **/
+mrp_res_resource_state_t mrp_res_get_resource_set_state(
+        const mrp_res_resource_set_t *rs);
+
+
 /**
  * Create new resource by name and init all other fields.
  * Created resource will be automatically added to
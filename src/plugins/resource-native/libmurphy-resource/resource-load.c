@@ -0,0 +1,766 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Load generator for the native resource protocol. A number of simulated
+ * clients, each with a connection of its own to the daemon, issue a random
+ * mix of acquire and release requests and set churn (deleting a set and
+ * creating a new one in its place), either in a closed loop (next request
+ * of a client after its previous one completed and the think time passed)
+ * or in an open loop (requests of a client issued at a fixed rate no matter
+ * what). The tool reports
+ *
+ *   - request latency: from sending a request until its reply arrives,
+ *   - revoke latency: from a competing acquire request being sent until
+ *     the client losing its resources gets notified about it, and
+ *   - daemon CPU time per 1000 requests, if the daemon pid is given.
+ *
+ * Usage: resource-api-load [options], see resource-api-load --help
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <murphy/plugins/resource-native/libmurphy-resource/resource-api.h>
+
+#define DEFAULT_CLIENTS    8
+#define DEFAULT_SETS       2
+#define DEFAULT_REQUESTS   10000
+#define DEFAULT_ACQUIRE    45
+#define DEFAULT_RELEASE    45
+#define DEFAULT_THINK      0
+#define MAX_SET_RESOURCES  2
+
+typedef struct load_s   load_t;
+typedef struct client_s client_t;
+
+typedef enum {
+    OP_ACQUIRE = 0,
+    OP_RELEASE,
+    OP_CHURN,
+} op_t;
+
+typedef struct {
+    uint64_t *samples;                   /* latency samples, nsec */
+    int       nsample;                   /* number of samples */
+    int       size;                      /* allocated number of samples */
+} samples_t;
+
+typedef struct {
+    client_t               *c;           /* client of this set */
+    mrp_res_resource_set_t *rset;        /* library resource set */
+    bool                    granted;     /* last seen state was acquired */
+    int                     pending;     /* outstanding requests */
+} set_t;
+
+struct client_s {
+    load_t            *load;             /* load generator */
+    int                id;               /* client index */
+    mrp_res_context_t *cx;               /* resource context */
+    bool               connected;        /* whether connected */
+    set_t             *sets;             /* resource sets */
+    mrp_timer_t       *timer;            /* request timer */
+};
+
+typedef struct {
+    set_t    *s;                         /* set of the request */
+    op_t      op;                        /* request type */
+    uint64_t  start;                     /* when the request was sent */
+} request_t;
+
+struct load_s {
+    int              nclient;            /* number of clients */
+    int              nset;               /* sets per client */
+    int              requests;           /* number of requests to issue */
+    int              acquire;            /* acquire percentage */
+    int              release;            /* release percentage */
+    int              think;              /* think time, usec */
+    int              rate;               /* open loop rate per client, 0 */
+    pid_t            pid;                /* daemon pid, or 0 */
+    unsigned         seed;               /* random seed */
+
+    mrp_mainloop_t  *ml;
+    client_t        *clients;
+    int              nconnected;         /* clients connected */
+    const char     **classes;            /* application classes */
+    int              nclass;
+    const char     **resources;          /* resource names */
+    int              nresource;
+
+    int              issued;             /* requests issued */
+    int              completed;          /* requests completed */
+    int              failed;             /* requests failed */
+    int              churned;            /* sets churned */
+    samples_t        latency;            /* request latencies */
+    samples_t        revoke;             /* revoke latencies */
+    uint64_t         last_acquire;       /* last acquire sent, nsec */
+    client_t        *last_acquirer;      /* client of last acquire */
+    uint64_t         started;            /* start of measurement */
+    uint64_t         stopped;            /* end of measurement */
+    long             cpu_start;          /* daemon CPU at start, ticks */
+    long             cpu_end;            /* daemon CPU at end, ticks */
+};
+
+
+static void print_usage(const char *argv0, int exit_code, const char *fmt,
+                        ...)
+{
+    va_list ap;
+
+    if (fmt && *fmt) {
+        va_start(ap, fmt);
+        vprintf(fmt, ap);
+        va_end(ap);
+    }
+
+    printf("usage: %s [options]\n\n"
+           "The possible options are:\n"
+           "  -c, --clients=N        number of clients (default %d)\n"
+           "  -s, --sets=N           resource sets per client (default %d)\n"
+           "  -n, --requests=N       number of requests (default %d)\n"
+           "  -m, --mix=A:R          acquire and release percentage, the\n"
+           "                         rest is set churn (default %d:%d)\n"
+           "  -t, --think=USEC       think time in closed loop (default %d)\n"
+           "  -o, --open-loop=RATE   open loop, RATE requests/s per client\n"
+           "  -p, --pid=PID          pid of the daemon, for CPU usage\n"
+           "  -S, --seed=N           random seed (default 1)\n"
+           "  -h, --help             show help on usage\n",
+           argv0, DEFAULT_CLIENTS, DEFAULT_SETS, DEFAULT_REQUESTS,
+           DEFAULT_ACQUIRE, DEFAULT_RELEASE, DEFAULT_THINK);
+
+    if (exit_code < 0)
+        return;
+    else
+        exit(exit_code);
+}
+
+
+static int parse_int(const char *argv0, const char *opt, const char *arg,
+                     int min, int max)
+{
+    char *end;
+    long  val;
+
+    val = strtol(arg, &end, 10);
+
+    if (*end || val < min || val > max)
+        print_usage(argv0, EINVAL, "invalid %s '%s' (range %d - %d)\n",
+                    opt, arg, min, max);
+
+    return (int)val;
+}
+
+
+static void parse_mix(load_t *l, const char *argv0, const char *arg)
+{
+    char *end;
+
+    l->acquire = (int)strtol(arg, &end, 10);
+
+    if (*end != ':')
+        print_usage(argv0, EINVAL, "invalid request mix '%s'\n", arg);
+
+    l->release = (int)strtol(end + 1, &end, 10);
+
+    if (*end || l->acquire < 0 || l->release < 0 ||
+        l->acquire + l->release > 100)
+        print_usage(argv0, EINVAL, "invalid request mix '%s'\n", arg);
+}
+
+
+static void parse_cmdline(load_t *l, int argc, char **argv)
+{
+#   define OPTIONS "c:s:n:m:t:o:p:S:h"
+    struct option options[] = {
+        { "clients"  , required_argument, NULL, 'c' },
+        { "sets"     , required_argument, NULL, 's' },
+        { "requests" , required_argument, NULL, 'n' },
+        { "mix"      , required_argument, NULL, 'm' },
+        { "think"    , required_argument, NULL, 't' },
+        { "open-loop", required_argument, NULL, 'o' },
+        { "pid"      , required_argument, NULL, 'p' },
+        { "seed"     , required_argument, NULL, 'S' },
+        { "help"     , no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+
+    mrp_clear(l);
+
+    l->nclient  = DEFAULT_CLIENTS;
+    l->nset     = DEFAULT_SETS;
+    l->requests = DEFAULT_REQUESTS;
+    l->acquire  = DEFAULT_ACQUIRE;
+    l->release  = DEFAULT_RELEASE;
+    l->think    = DEFAULT_THINK;
+    l->seed     = 1;
+
+    while ((opt = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+        switch (opt) {
+        case 'c':
+            l->nclient = parse_int(argv[0], "client count", optarg, 1, 4096);
+            break;
+        case 's':
+            l->nset = parse_int(argv[0], "set count", optarg, 1, 64);
+            break;
+        case 'n':
+            l->requests = parse_int(argv[0], "request count", optarg,
+                                    1, 100000000);
+            break;
+        case 'm':
+            parse_mix(l, argv[0], optarg);
+            break;
+        case 't':
+            l->think = parse_int(argv[0], "think time", optarg,
+                                 0, 60 * 1000000);
+            break;
+        case 'o':
+            l->rate = parse_int(argv[0], "request rate", optarg, 1, 1000000);
+            break;
+        case 'p':
+            l->pid = (pid_t)parse_int(argv[0], "pid", optarg, 1, 0x7fffffff);
+            break;
+        case 'S':
+            l->seed = (unsigned)parse_int(argv[0], "seed", optarg,
+                                          0, 0x7fffffff);
+            break;
+        case 'h':
+            print_usage(argv[0], 0, "");
+            break;
+        default:
+            print_usage(argv[0], EINVAL, "");
+            break;
+        }
+    }
+}
+
+
+static uint64_t now_nsec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static long daemon_cpu(pid_t pid)
+{
+    char           path[64], buf[1024], *p;
+    FILE          *fp;
+    unsigned long  utime, stime;
+    size_t         n;
+
+    if (pid <= 0)
+        return -1;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+
+    if ((fp = fopen(path, "r")) == NULL)
+        return -1;
+
+    n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[n] = '\0';
+
+    /* utime and stime are the 12th and 13th fields after the command */
+    if ((p = strrchr(buf, ')')) == NULL ||
+        sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+               &utime, &stime) != 2)
+        return -1;
+
+    return (long)(utime + stime);
+}
+
+
+static void add_sample(samples_t *s, uint64_t value)
+{
+    if (s->nsample >= s->size) {
+        if (!mrp_reallocz(s->samples, s->size, s->size ? 2 * s->size : 1024)) {
+            fprintf(stderr, "failed to allocate latency buffer\n");
+            exit(ENOMEM);
+        }
+
+        s->size = s->size ? 2 * s->size : 1024;
+    }
+
+    s->samples[s->nsample++] = value;
+}
+
+
+static int cmp_latency(const void *p1, const void *p2)
+{
+    uint64_t l1 = *(const uint64_t *)p1;
+    uint64_t l2 = *(const uint64_t *)p2;
+
+    return (l1 < l2) ? -1 : (l1 > l2 ? 1 : 0);
+}
+
+
+static double percentile(samples_t *s, double p)
+{
+    int idx = (int)(p / 100.0 * (s->nsample - 1) + 0.5);
+
+    return s->samples[idx] / 1000.0;
+}
+
+
+static void stop(load_t *l)
+{
+    if (l->stopped)
+        return;
+
+    l->stopped = now_nsec();
+    l->cpu_end = daemon_cpu(l->pid);
+
+    mrp_mainloop_quit(l->ml, 0);
+}
+
+
+static void resource_cb(mrp_res_context_t *cx, const mrp_res_resource_set_t *rs,
+                        void *user_data)
+{
+    set_t  *s = (set_t *)user_data;
+    load_t *l = s->c->load;
+    bool    granted;
+
+    MRP_UNUSED(cx);
+
+    granted = (rs->state == MRP_RES_RESOURCE_ACQUIRED);
+
+    /* lost our resources to someone else */
+    if (s->granted && !granted && !s->pending && l->last_acquire &&
+        l->last_acquirer != s->c && l->started)
+        add_sample(&l->revoke, now_nsec() - l->last_acquire);
+
+    s->granted = granted;
+}
+
+
+static void schedule(client_t *c);
+
+
+static void request_cb(mrp_res_context_t *cx, const mrp_res_resource_set_t *rs,
+                       int status, void *user_data)
+{
+    request_t *req = (request_t *)user_data;
+    set_t     *s   = req->s;
+    load_t    *l   = s->c->load;
+
+    MRP_UNUSED(cx);
+    MRP_UNUSED(rs);
+
+    add_sample(&l->latency, now_nsec() - req->start);
+
+    if (status != 0)
+        l->failed++;
+
+    s->pending--;
+    l->completed++;
+
+    if (!l->rate)
+        schedule(s->c);
+
+    mrp_free(req);
+
+    if (l->completed + l->churned >= l->requests)
+        stop(l);
+}
+
+
+static int create_set(client_t *c, set_t *s)
+{
+    load_t             *l = c->load;
+    mrp_res_resource_t *res;
+    const char         *name;
+    int                 i, n, first;
+
+    s->c       = c;
+    s->granted = false;
+    s->pending = 0;
+    s->rset    = mrp_res_create_resource_set(c->cx,
+                                             l->classes[rand() % l->nclass],
+                                             resource_cb, s);
+
+    if (s->rset == NULL)
+        return -1;
+
+    n     = 1 + rand() % MRP_MIN(MAX_SET_RESOURCES, l->nresource);
+    first = rand() % l->nresource;
+
+    for (i = 0; i < n; i++) {
+        name = l->resources[(first + i) % l->nresource];
+        res  = mrp_res_create_resource(s->rset, name, true, false);
+
+        if (res == NULL)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static void issue(client_t *c)
+{
+    load_t    *l = c->load;
+    set_t     *s;
+    request_t *req;
+    op_t       op;
+    int        r, i;
+
+    r = rand() % 100;
+
+    if (r < l->acquire)
+        op = OP_ACQUIRE;
+    else if (r < l->acquire + l->release)
+        op = OP_RELEASE;
+    else
+        op = OP_CHURN;
+
+    /* pick a set in a state the request makes sense for */
+    for (i = 0, s = c->sets + rand() % l->nset; i < l->nset; i++) {
+        if (op == OP_CHURN && !s->pending)
+            break;
+        if (op == OP_ACQUIRE && !s->granted)
+            break;
+        if (op == OP_RELEASE && s->granted)
+            break;
+
+        s = c->sets + (s - c->sets + 1) % l->nset;
+    }
+
+    if (i >= l->nset) {
+        if (op == OP_CHURN) {
+            schedule(c);
+            return;
+        }
+
+        op = (op == OP_ACQUIRE ? OP_RELEASE : OP_ACQUIRE);
+    }
+
+    l->issued++;
+
+    if (op == OP_CHURN) {
+        mrp_res_delete_resource_set(s->rset);
+
+        if (create_set(c, s) < 0) {
+            fprintf(stderr, "failed to create resource set\n");
+            exit(1);
+        }
+
+        l->churned++;
+
+        if (l->completed + l->churned >= l->requests)
+            stop(l);
+        else if (!l->rate)
+            schedule(c);
+
+        return;
+    }
+
+    if ((req = mrp_allocz(sizeof(*req))) == NULL) {
+        fprintf(stderr, "failed to allocate request\n");
+        exit(ENOMEM);
+    }
+
+    req->s     = s;
+    req->op    = op;
+    req->start = now_nsec();
+
+    if (op == OP_ACQUIRE) {
+        l->last_acquire  = req->start;
+        l->last_acquirer = c;
+        r = mrp_res_acquire_resource_set_async(s->rset, request_cb, req);
+    }
+    else
+        r = mrp_res_release_resource_set_async(s->rset, request_cb, req);
+
+    if (r < 0) {
+        mrp_free(req);
+        l->failed++;
+        l->completed++;
+
+        if (l->completed + l->churned >= l->requests)
+            stop(l);
+        else if (!l->rate)
+            schedule(c);
+
+        return;
+    }
+
+    s->pending++;
+}
+
+
+static void timer_cb(mrp_timer_t *t, void *user_data)
+{
+    client_t *c = (client_t *)user_data;
+    load_t   *l = c->load;
+
+    if (!l->rate)
+        mrp_stop_timer(t);
+
+    if (l->stopped || l->issued >= l->requests)
+        return;
+
+    issue(c);
+}
+
+
+static void schedule(client_t *c)
+{
+    load_t *l = c->load;
+
+    if (l->stopped || l->issued >= l->requests)
+        return;
+
+    mrp_mod_timer_usecs(c->timer, l->think > 0 ? (uint64_t)l->think : 1);
+}
+
+
+static int query_definitions(load_t *l, mrp_res_context_t *cx)
+{
+    const mrp_res_string_array_t *classes;
+    const mrp_res_resource_set_t *all;
+    mrp_res_string_array_t       *names;
+    int                           i;
+
+    if (l->classes != NULL)
+        return 0;
+
+    classes = mrp_res_list_application_classes(cx);
+    all     = mrp_res_list_resources(cx);
+
+    if (classes == NULL || classes->num_strings == 0 || all == NULL)
+        return -1;
+
+    if ((names = mrp_res_list_resource_names(all)) == NULL ||
+        names->num_strings == 0)
+        return -1;
+
+    l->classes   = mrp_allocz_array(const char *, classes->num_strings);
+    l->resources = mrp_allocz_array(const char *, names->num_strings);
+
+    if (l->classes == NULL || l->resources == NULL)
+        return -1;
+
+    for (i = 0; i < classes->num_strings; i++)
+        l->classes[i] = mrp_strdup(classes->strings[i]);
+    l->nclass = classes->num_strings;
+
+    for (i = 0; i < names->num_strings; i++)
+        l->resources[i] = mrp_strdup(names->strings[i]);
+    l->nresource = names->num_strings;
+
+    mrp_res_free_string_array(names);
+
+    return 0;
+}
+
+
+static void start(load_t *l)
+{
+    client_t *c;
+    uint64_t  period;
+    int       i;
+
+    printf("%d clients connected, starting %s loop load\n", l->nclient,
+           l->rate ? "open" : "closed");
+
+    l->cpu_start = daemon_cpu(l->pid);
+    l->started   = now_nsec();
+
+    period = l->rate ? 1000000 / l->rate : 1;
+
+    for (i = 0; i < l->nclient; i++) {
+        c = l->clients + i;
+        c->timer = mrp_add_timer_usecs(l->ml, period, 0, timer_cb, c);
+
+        if (c->timer == NULL) {
+            fprintf(stderr, "failed to create request timer\n");
+            exit(1);
+        }
+    }
+}
+
+
+static void state_cb(mrp_res_context_t *cx, mrp_res_error_t err,
+                     void *user_data)
+{
+    client_t *c = (client_t *)user_data;
+    load_t   *l = c->load;
+    int       i;
+
+    if (err != MRP_RES_ERROR_NONE || cx->state == MRP_RES_DISCONNECTED) {
+        fprintf(stderr, "client #%d: connection to the daemon lost\n", c->id);
+        stop(l);
+        return;
+    }
+
+    if (c->connected)
+        return;
+
+    c->connected = true;
+
+    if (query_definitions(l, cx) < 0) {
+        fprintf(stderr, "failed to query classes and resources\n");
+        stop(l);
+        return;
+    }
+
+    for (i = 0; i < l->nset; i++) {
+        if (create_set(c, c->sets + i) < 0) {
+            fprintf(stderr, "failed to create resource set\n");
+            stop(l);
+            return;
+        }
+    }
+
+    if (++l->nconnected == l->nclient)
+        start(l);
+}
+
+
+static int setup_clients(load_t *l)
+{
+    client_t *c;
+    int       i;
+
+    l->clients = mrp_allocz_array(client_t, l->nclient);
+
+    if (l->clients == NULL)
+        return -1;
+
+    for (i = 0; i < l->nclient; i++) {
+        c       = l->clients + i;
+        c->load = l;
+        c->id   = i;
+        c->sets = mrp_allocz_array(set_t, l->nset);
+
+        if (c->sets == NULL)
+            return -1;
+
+        if ((c->cx = mrp_res_create(l->ml, state_cb, c)) == NULL) {
+            fprintf(stderr, "failed to create resource context #%d\n", i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static void report(load_t *l)
+{
+    double secs, ticks;
+
+    secs = (l->stopped - l->started) / 1e9;
+
+    printf("clients %d, sets/client %d, mix %d:%d:%d, %s\n", l->nclient,
+           l->nset, l->acquire, l->release, 100 - l->acquire - l->release,
+           l->rate ? "open loop" : "closed loop");
+    printf("requests:     %d completed, %d failed, %d churned (%.0f/s)\n",
+           l->completed, l->failed, l->churned,
+           secs > 0 ? (l->completed + l->churned) / secs : 0.0);
+
+    if (l->latency.nsample > 0) {
+        qsort(l->latency.samples, l->latency.nsample, sizeof(uint64_t),
+              cmp_latency);
+        printf("latency usec: p50 %.2f, p90 %.2f, p99 %.2f, p99.9 %.2f, "
+               "max %.2f\n", percentile(&l->latency, 50),
+               percentile(&l->latency, 90), percentile(&l->latency, 99),
+               percentile(&l->latency, 99.9), percentile(&l->latency, 100));
+    }
+
+    if (l->revoke.nsample > 0) {
+        qsort(l->revoke.samples, l->revoke.nsample, sizeof(uint64_t),
+              cmp_latency);
+        printf("revoke usec:  p50 %.2f, p90 %.2f, p99 %.2f, p99.9 %.2f, "
+               "max %.2f (%d revokes)\n", percentile(&l->revoke, 50),
+               percentile(&l->revoke, 90), percentile(&l->revoke, 99),
+               percentile(&l->revoke, 99.9), percentile(&l->revoke, 100),
+               l->revoke.nsample);
+    }
+    else
+        printf("revoke usec:  no revokes\n");
+
+    if (l->cpu_start >= 0 && l->cpu_end >= 0 && l->pid > 0) {
+        ticks = (double)(l->cpu_end - l->cpu_start);
+        printf("daemon CPU:   %.2f msec/1k requests\n",
+               ticks * 1000.0 / sysconf(_SC_CLK_TCK) * 1000.0 /
+               MRP_MAX(l->completed + l->churned, 1));
+    }
+    else
+        printf("daemon CPU:   not available (use --pid)\n");
+}
+
+
+int main(int argc, char **argv)
+{
+    load_t l;
+    int    i;
+
+    parse_cmdline(&l, argc, argv);
+
+    srand(l.seed);
+
+    mrp_log_set_mask(MRP_LOG_MASK_ERROR);
+
+    if ((l.ml = mrp_mainloop_create()) == NULL)
+        exit(1);
+
+    if (setup_clients(&l) < 0)
+        exit(1);
+
+    mrp_mainloop_run(l.ml);
+
+    if (l.started)
+        report(&l);
+
+    for (i = 0; i < l.nclient; i++) {
+        mrp_del_timer(l.clients[i].timer);
+        mrp_res_destroy(l.clients[i].cx);
+        mrp_free(l.clients[i].sets);
+    }
+
+    mrp_free(l.clients);
+    mrp_mainloop_destroy(l.ml);
+
+    return l.started ? 0 : 1;
+}
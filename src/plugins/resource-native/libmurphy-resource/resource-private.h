@@ -44,6 +44,15 @@ typedef enum {
     MRP_RES_PENDING_OPERATION_RELEASE,
 } pending_operation_t;
 
+typedef struct {
+    mrp_list_hook_t hook;               /* to pending_requests */
+    mrp_res_resource_set_t *rset;       /* library resource set */
+    pending_operation_t op;             /* requested operation */
+    uint32_t seqno;                     /* 0 until the request is sent */
+    mrp_res_request_callback_t cb;      /* completion callback */
+    void *user_data;
+} pending_request_t;
+
 typedef struct {
     const char *name;
     mrp_res_attribute_type_t type; /* s:char *, i:int32_t, u:uint32_t, f:double */
@@ -98,31 +107,64 @@ struct mrp_res_resource_set_private_s {
     uint32_t num_resources;
     mrp_res_resource_t **resources;
 
-    pending_operation_t waiting_for;
+    /* number of acquire/release requests not completed yet */
+    uint32_t num_pending;
 
     mrp_list_hook_t hook;
 };
 
-struct mrp_res_context_private_s {
-    int connection_id;
+/*
+ * The contexts of a process share a single connection to the server,
+ * together with the class and resource definitions queried over it.
+ * The sequence numbers of requests carry the tag of the issuing context
+ * in their topmost bits, so that the replies can be routed back to it.
+ */
 
-    /* mapping of server-side resource set numbers to library resource sets */
-    mrp_htbl_t *rset_mapping;
+#define SEQNO_TAG_SHIFT 20
+#define SEQNO_TAG_MAX   ((1 << (32 - SEQNO_TAG_SHIFT)) - 1)
+#define SEQNO_MASK      ((1 << SEQNO_TAG_SHIFT) - 1)
 
-    /* mapping of library resource sets to client resource sets */
-    mrp_htbl_t *internal_rset_mapping;
+typedef struct mrp_res_connection_s mrp_res_connection_t;
 
-    mrp_res_state_callback_t cb;
-    void *user_data;
+struct mrp_res_connection_s {
+    int refcnt;
+    mrp_list_hook_t hook; /* to the list of connections */
 
     mrp_mainloop_t *ml;
     mrp_sockaddr_t saddr;
     mrp_transport_t *transp;
     bool connected;
 
+    /* definitions shared by all contexts, NULL until queried */
     mrp_res_string_array_t *master_classes;
     mrp_res_resource_set_t *master_resource_set;
 
+    /* resource set states published by the server, if available */
+    struct mrp_resproto_stateshm_s *stateshm;
+
+    /* contexts using this connection */
+    mrp_list_hook_t contexts;
+    uint32_t next_tag;
+    uint32_t notify_mark;
+};
+
+struct mrp_res_context_private_s {
+    mrp_res_context_t *pub; /* composition */
+    mrp_res_connection_t *conn; /* shared connection */
+    mrp_list_hook_t hook; /* to the contexts of the connection */
+    uint32_t tag; /* tag in the sequence numbers of our requests */
+    uint32_t notify_mark;
+    mrp_deferred_t *connect_cb;
+
+    /* mapping of server-side resource set numbers to library resource sets */
+    mrp_htbl_t *rset_mapping;
+
+    /* mapping of library resource sets to client resource sets */
+    mrp_htbl_t *internal_rset_mapping;
+
+    mrp_res_state_callback_t cb;
+    void *user_data;
+
     /* sometimes we need to know which query was answered */
     uint32_t next_seqno;
 
@@ -130,8 +172,13 @@ struct mrp_res_context_private_s {
     uint32_t next_internal_id;
 
     mrp_list_hook_t pending_sets;
+
+    /* acquire/release requests in the order they were issued */
+    mrp_list_hook_t pending_requests;
 };
 
+uint32_t alloc_seqno(mrp_res_context_t *cx);
+
 uint32_t p_to_u(const void *p);
 void *u_to_p(uint32_t u);
 
@@ -28,6 +28,10 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <murphy/resource/protocol.h>
 #include "resource-api.h"
@@ -83,13 +87,96 @@ uint32_t int_hash(const void *key)
 }
 
 
+static mrp_res_context_t *find_context(mrp_res_connection_t *conn,
+        uint32_t seqno)
+{
+    mrp_res_context_private_t *priv;
+    mrp_list_hook_t *p, *n;
+    uint32_t tag = seqno >> SEQNO_TAG_SHIFT;
+
+    mrp_list_foreach(&conn->contexts, p, n) {
+        priv = mrp_list_entry(p, typeof(*priv), hook);
+
+        if (priv->tag == tag)
+            return priv->pub;
+    }
+
+    return NULL;
+}
+
+
+static mrp_res_resource_set_t *find_resource_set(mrp_res_connection_t *conn,
+        uint32_t rset_id, mrp_res_context_t **pcx)
+{
+    mrp_res_context_private_t *priv;
+    mrp_res_resource_set_t *rset;
+    mrp_list_hook_t *p, *n;
+
+    mrp_list_foreach(&conn->contexts, p, n) {
+        priv = mrp_list_entry(p, typeof(*priv), hook);
+        rset = mrp_htbl_lookup(priv->rset_mapping, u_to_p(rset_id));
+
+        if (rset) {
+            *pcx = priv->pub;
+            return rset;
+        }
+    }
+
+    return NULL;
+}
+
+
+uint32_t alloc_seqno(mrp_res_context_t *cx)
+{
+    uint32_t seqno = cx->priv->next_seqno++ & SEQNO_MASK;
+
+    return (cx->priv->tag << SEQNO_TAG_SHIFT) | seqno;
+}
+
+
+/*
+ * Call the state callback of the contexts of the connection which are in
+ * the given state (or all of them if from is negative), switching them to
+ * the given new state (unless to is negative). Callbacks may create or
+ * destroy contexts, so we restart after each one and skip the contexts
+ * we have already visited.
+ */
+static void notify_contexts(mrp_res_connection_t *conn, int from, int to,
+        mrp_res_error_t err)
+{
+    mrp_res_context_private_t *priv;
+    mrp_list_hook_t *p, *n;
+    uint32_t mark = ++conn->notify_mark;
+
+ restart:
+    mrp_list_foreach(&conn->contexts, p, n) {
+        priv = mrp_list_entry(p, typeof(*priv), hook);
+
+        if (priv->notify_mark == mark)
+            continue;
+
+        priv->notify_mark = mark;
+
+        if (from >= 0 && (int) priv->pub->state != from)
+            continue;
+
+        if (to >= 0)
+            priv->pub->state = (mrp_res_connection_state_t) to;
+
+        priv->cb(priv->pub, err, priv->user_data);
+        goto restart;
+    }
+}
+
+
 static void resource_event(mrp_msg_t *msg,
-        mrp_res_context_t *cx,
+        mrp_res_connection_t *conn,
         int32_t seqno,
         void **pcursor)
 {
+    mrp_res_context_t *cx = NULL;
     uint32_t rset_id;
-    uint32_t grant, advice;
+    uint64_t grant, advice;
     mrp_resproto_state_t state;
     uint16_t tag;
     uint16_t type;
@@ -99,7 +186,7 @@ static void resource_event(mrp_msg_t *msg,
     const char *resnam;
     mrp_res_attribute_t attrs[ATTRIBUTE_MAX + 1];
     int n_attrs;
-    uint32_t mask, all = 0x0, mandatory = 0x0;
+    uint64_t mask;
     uint32_t i;
     mrp_res_resource_set_t *rset;
 
@@ -115,7 +202,7 @@ static void resource_event(mrp_msg_t *msg,
 
     /* Update our "master copy" of the resource set. */
 
-    rset = mrp_htbl_lookup(cx->priv->rset_mapping, u_to_p(rset_id));
+    rset = find_resource_set(conn, rset_id, &cx);
 
     if (!rset) {
         mrp_res_info("resource event outside the resource set lifecycle");
@@ -188,11 +275,7 @@ static void resource_event(mrp_msg_t *msg,
     {
         mrp_res_resource_t *res = rset->priv->resources[i];
 
-        mask  = (1UL << res->priv->server_id);
-        all  |= mask;
-
-        if (res->priv->mandatory)
-            mandatory |= mask;
+        mask = ((uint64_t)1 << res->priv->server_id);
 
         if (grant & mask) {
             res->state = MRP_RES_RESOURCE_ACQUIRED;
@@ -202,18 +285,10 @@ static void resource_event(mrp_msg_t *msg,
         }
     }
 
-    mrp_res_info("advice = 0x%08x, grant = 0x%08x, mandatory = 0x%08x, all = 0x%08x",
-            advice, grant, mandatory, all);
+    mrp_res_info("advice = 0x%08llx, grant = 0x%08llx",
+            (unsigned long long)advice, (unsigned long long)grant);
 
-    if (grant) {
-        rset->state = MRP_RES_RESOURCE_ACQUIRED;
-    }
-    else if (advice == mandatory) {
-        rset->state = MRP_RES_RESOURCE_AVAILABLE;
-    }
-    else {
-        rset->state = MRP_RES_RESOURCE_LOST;
-    }
+    rset->state = resource_set_state_from_masks(rset, grant, advice);
 
     /* Check the resource set state. If the set is under construction
      * (we are waiting for "acquire" or "release" message), do not do the
@@ -223,7 +298,7 @@ static void resource_event(mrp_msg_t *msg,
 #if 0
     print_resource_set(rset);
 #endif
-    if (!rset->priv->seqno) {
+    if (!rset->priv->num_pending) {
         if (rset->priv->cb) {
             increase_ref(cx, rset);
             rset->priv->cb(cx, rset, rset->priv->user_data);
@@ -238,25 +313,63 @@ static void resource_event(mrp_msg_t *msg,
 }
 
 
+static void unref_connection(mrp_res_connection_t *conn);
+
+
+/*
+ * A resource set was created for a context that has been destroyed since.
+ * Nobody is going to use the set, so ask the server to get rid of it.
+ */
+static void destroy_orphaned_set(mrp_res_connection_t *conn, mrp_msg_t *msg,
+        void **pcursor)
+{
+    mrp_msg_t *req;
+    uint32_t rset_id;
+    int status;
+
+    if (!fetch_status(msg, pcursor, &status) || status != 0 ||
+            !fetch_resource_set_id(msg, pcursor, &rset_id))
+        return;
+
+    req = mrp_msg_create(
+            RESPROTO_SEQUENCE_NO, MRP_MSG_FIELD_UINT32, 0,
+            RESPROTO_REQUEST_TYPE, MRP_MSG_FIELD_UINT16,
+                    RESPROTO_DESTROY_RESOURCE_SET,
+            RESPROTO_RESOURCE_SET_ID, MRP_MSG_FIELD_UINT32, rset_id,
+            RESPROTO_MESSAGE_END);
+
+    if (!req)
+        return;
+
+    mrp_transport_send(conn->transp, req);
+    mrp_msg_unref(req);
+}
+
+
 static void recvfrom_msg(mrp_transport_t *transp, mrp_msg_t *msg,
                          mrp_sockaddr_t *addr, socklen_t addrlen,
                          void *user_data)
 {
-    mrp_res_context_t *cx = user_data;
+    mrp_res_connection_t *conn = user_data;
+    mrp_res_context_t *cx = NULL;
     void *cursor = NULL;
     uint32_t seqno;
     uint16_t req;
+    int status;
     mrp_res_error_t err = MRP_RES_ERROR_INTERNAL;
 
     MRP_UNUSED(transp);
     MRP_UNUSED(addr);
     MRP_UNUSED(addrlen);
 
+    /* keep the connection around while the callbacks run */
+    conn->refcnt++;
+
     if (!fetch_seqno(msg, &cursor, &seqno) ||
                 !fetch_request(msg, &cursor, &req))
         goto error;
 
-    mrp_res_info("received message %d for %p", req, cx);
+    mrp_res_info("received message %d for connection %p", req, conn);
 
     err = MRP_RES_ERROR_MALFORMED;
 
@@ -265,17 +378,22 @@ static void recvfrom_msg(mrp_transport_t *transp, mrp_msg_t *msg,
 
             mrp_res_info("received QUERY_RESOURCES response");
 
-            cx->priv->master_resource_set =
-                    resource_query_response(cx, msg, &cursor);
-            if (!cx->priv->master_resource_set)
+            if (conn->master_resource_set)
+                break;
+
+            conn->master_resource_set = resource_query_response(msg, &cursor);
+            if (!conn->master_resource_set)
                 goto error;
             break;
         case RESPROTO_QUERY_CLASSES:
 
             mrp_res_info("received QUERY_CLASSES response");
 
-            cx->priv->master_classes = class_query_response(msg, &cursor);
-            if (!cx->priv->master_classes)
+            if (conn->master_classes)
+                break;
+
+            conn->master_classes = class_query_response(msg, &cursor);
+            if (!conn->master_classes)
                 goto error;
             break;
         case RESPROTO_CREATE_RESOURCE_SET:
@@ -286,6 +404,11 @@ static void recvfrom_msg(mrp_transport_t *transp, mrp_msg_t *msg,
 
             mrp_res_info("received CREATE_RESOURCE_SET response");
 
+            if (!(cx = find_context(conn, seqno))) {
+                destroy_orphaned_set(conn, msg, &cursor);
+                break;
+            }
+
             /* get the correct resource set from the pending_sets list */
 
             mrp_list_foreach(&cx->priv->pending_sets, p, n) {
@@ -304,30 +427,18 @@ static void recvfrom_msg(mrp_transport_t *transp, mrp_msg_t *msg,
 
             mrp_list_delete(&rset->priv->hook);
 
-            if (!create_resource_set_response(msg, rset, &cursor))
+            if (!create_resource_set_response(msg, rset, &cursor, &status)) {
+                fail_pending_requests(cx, rset, status);
                 goto error;
+            }
 
             mrp_htbl_insert(cx->priv->rset_mapping,
                     u_to_p(rset->priv->id), rset);
 
-            /* TODO: if the operation was "acquire", do that. Otherwise
-             * release. */
+            /* send the acquire and release requests made meanwhile */
 
-            if (rset->priv->waiting_for == MRP_RES_PENDING_OPERATION_ACQUIRE) {
-                rset->priv->waiting_for = MRP_RES_PENDING_OPERATION_NONE;
-                if (acquire_resource_set_request(cx, rset) < 0) {
-                    goto error;
-                }
-            }
-            else if (rset->priv->waiting_for == MRP_RES_PENDING_OPERATION_RELEASE) {
-                rset->priv->waiting_for = MRP_RES_PENDING_OPERATION_NONE;
-                if (release_resource_set_request(cx, rset) < 0) {
-                    goto error;
-                }
-            }
-            else {
+            if (send_pending_requests(cx, rset) < 0)
                 goto error;
-            }
             break;
         }
         case RESPROTO_ACQUIRE_RESOURCE_SET:
@@ -336,14 +447,16 @@ static void recvfrom_msg(mrp_transport_t *transp, mrp_msg_t *msg,
 
             mrp_res_info("received ACQUIRE_RESOURCE_SET response");
 
-            rset = acquire_resource_set_response(msg, cx, &cursor);
+            if (!(cx = find_context(conn, seqno)))
+                break;
+
+            rset = acquire_resource_set_response(msg, cx, &cursor, &status);
+            complete_request(cx, seqno, status);
 
             if (!rset) {
                 goto error;
             }
 
-            rset->priv->seqno = 0;
-
             break;
         }
         case RESPROTO_RELEASE_RESOURCE_SET:
@@ -351,21 +464,22 @@ static void recvfrom_msg(mrp_transport_t *transp, mrp_msg_t *msg,
             mrp_res_resource_set_t *rset;
             mrp_res_info("received RELEASE_RESOURCE_SET response");
 
-            rset = acquire_resource_set_response(msg, cx, &cursor);
+            if (!(cx = find_context(conn, seqno)))
+                break;
+
+            rset = acquire_resource_set_response(msg, cx, &cursor, &status);
+            complete_request(cx, seqno, status);
 
             if (!rset) {
                 goto error;
             }
 
-            /* TODO: make new releases fail until seqno == 0 */
-            rset->priv->seqno = 0;
-
             break;
         }
         case RESPROTO_RESOURCES_EVENT:
             mrp_res_info("received RESOURCES_EVENT response");
 
-            resource_event(msg, cx, seqno, &cursor);
+            resource_event(msg, conn, seqno, &cursor);
             break;
         case RESPROTO_DESTROY_RESOURCE_SET:
             mrp_res_info("received DESTROY_RESOURCE_SET response");
@@ -375,18 +489,22 @@ static void recvfrom_msg(mrp_transport_t *transp, mrp_msg_t *msg,
             break;
     }
 
-    if (cx->state == MRP_RES_DISCONNECTED &&
-            cx->priv->master_classes &&
-            cx->priv->master_resource_set) {
-        cx->state = MRP_RES_CONNECTED;
-        cx->priv->cb(cx, MRP_RES_ERROR_NONE, cx->priv->user_data);
-    }
+    if (conn->master_classes && conn->master_resource_set)
+        notify_contexts(conn, MRP_RES_DISCONNECTED, MRP_RES_CONNECTED,
+                MRP_RES_ERROR_NONE);
 
+    unref_connection(conn);
     return;
 
 error:
     mrp_res_error("error processing a message from the server");
-    cx->priv->cb(cx, err, cx->priv->user_data);
+
+    if (cx)
+        cx->priv->cb(cx, err, cx->priv->user_data);
+    else
+        notify_contexts(conn, -1, -1, err);
+
+    unref_connection(conn);
 }
 
 
@@ -396,18 +514,199 @@ static void recv_msg(mrp_transport_t *t, mrp_msg_t *msg, void *user_data)
 }
 
 
+/*
+ * Map the resource set states published by the server, if any. This is
+ * purely an optimization, so failing to map the segment is not an error.
+ */
+static void map_state_segment(mrp_res_connection_t *conn)
+{
+    const char *name = mrp_resource_get_default_stateshm();
+    mrp_resproto_stateshm_t *shm;
+    struct stat st;
+    int fd;
+
+    if ((fd = shm_open(name, O_RDONLY, 0)) < 0)
+        return;
+
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(*shm))
+        shm = MAP_FAILED;
+    else
+        shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (shm == MAP_FAILED)
+        return;
+
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) !=
+            RESPROTO_STATESHM_MAGIC || shm->nslot != RESPROTO_STATESHM_NSLOT) {
+        munmap(shm, sizeof(*shm));
+        return;
+    }
+
+    mrp_res_info("using resource set states published in '%s'", name);
+
+    conn->stateshm = shm;
+}
+
+
+static void unmap_state_segment(mrp_res_connection_t *conn)
+{
+    if (conn->stateshm) {
+        munmap(conn->stateshm, sizeof(*conn->stateshm));
+        conn->stateshm = NULL;
+    }
+}
+
+
 void closed_evt(mrp_transport_t *transp, int error, void *user_data)
 {
-    mrp_res_context_t *cx = user_data;
+    mrp_res_connection_t *conn = user_data;
     MRP_UNUSED(transp);
     MRP_UNUSED(error);
 
-    mrp_res_error("connection closed for %p", cx);
-    cx->priv->connected = FALSE;
+    mrp_res_error("connection %p closed", conn);
+    conn->connected = FALSE;
+
+    /* new contexts need to set up a connection of their own */
+    mrp_list_delete(&conn->hook);
+
+    /* the states are stale once the server is gone */
+    unmap_state_segment(conn);
+
+    conn->refcnt++;
+    notify_contexts(conn, MRP_RES_CONNECTED, MRP_RES_DISCONNECTED,
+            MRP_RES_ERROR_CONNECTION_LOST);
+    unref_connection(conn);
+}
+
+
+/*
+ * shared connections
+ */
+
+static MRP_LIST_HOOK(connections);
+
+
+static mrp_res_connection_t *create_connection(mrp_mainloop_t *ml)
+{
+    static mrp_transport_evt_t evt = {
+        { .recvmsg     = recv_msg },
+        { .recvmsgfrom = recvfrom_msg },
+        .closed        = closed_evt,
+        .connection    = NULL
+    };
+
+    int alen;
+    const char *type;
+    mrp_res_connection_t *conn = mrp_allocz(sizeof(mrp_res_connection_t));
+
+    if (!conn)
+        return NULL;
+
+    conn->refcnt = 1;
+    conn->ml = ml;
+    mrp_list_init(&conn->hook);
+    mrp_list_init(&conn->contexts);
+
+    /* connect to Murphy */
+
+    alen = mrp_transport_resolve(NULL, mrp_resource_get_default_address(),
+            &conn->saddr, sizeof(conn->saddr), &type);
+
+    conn->transp = mrp_transport_create(conn->ml, type, &evt, conn, 0);
+
+    if (!conn->transp)
+        goto error;
+
+    if (!mrp_transport_connect(conn->transp, &conn->saddr, alen))
+        goto error;
+
+    conn->connected = TRUE;
+
+    map_state_segment(conn);
+
+    if (get_application_classes_request(conn) < 0 ||
+            get_available_resources_request(conn) < 0)
+        goto error;
+
+    mrp_list_append(&connections, &conn->hook);
+
+    return conn;
+
+error:
+    unref_connection(conn);
+
+    return NULL;
+}
+
+
+static mrp_res_connection_t *get_connection(mrp_mainloop_t *ml)
+{
+    mrp_res_connection_t *conn;
+    mrp_list_hook_t *p, *n;
+
+    mrp_list_foreach(&connections, p, n) {
+        conn = mrp_list_entry(p, typeof(*conn), hook);
+
+        if (conn->ml == ml && conn->connected) {
+            conn->refcnt++;
+            return conn;
+        }
+    }
+
+    return create_connection(ml);
+}
+
+
+static void unref_connection(mrp_res_connection_t *conn)
+{
+    if (--conn->refcnt > 0)
+        return;
+
+    mrp_list_delete(&conn->hook);
+
+    if (conn->transp)
+        mrp_transport_destroy(conn->transp);
+
+    unmap_state_segment(conn);
+
+    free_resource_set(conn->master_resource_set);
+    mrp_res_free_string_array(conn->master_classes);
+
+    mrp_free(conn);
+}
+
+
+static uint32_t alloc_context_tag(mrp_res_connection_t *conn)
+{
+    uint32_t tag, i;
+
+    /* rotate through the tags so that late replies to a destroyed
+     * context are not mistaken for replies to a new one */
+    for (i = 0; i < SEQNO_TAG_MAX; i++) {
+        tag = conn->next_tag++ % SEQNO_TAG_MAX + 1;
+
+        if (!find_context(conn, tag << SEQNO_TAG_SHIFT))
+            return tag;
+    }
+
+    return 0;
+}
+
+
+static void connected_cb(mrp_deferred_t *d, void *user_data)
+{
+    mrp_res_context_t *cx = user_data;
+    mrp_res_connection_t *conn = cx->priv->conn;
+
+    mrp_del_deferred(d);
+    cx->priv->connect_cb = NULL;
 
-    if (cx->state == MRP_RES_CONNECTED) {
-        cx->state = MRP_RES_DISCONNECTED;
-        cx->priv->cb(cx, MRP_RES_ERROR_CONNECTION_LOST, cx->priv->user_data);
+    if (cx->state == MRP_RES_DISCONNECTED && conn->connected &&
+            conn->master_classes && conn->master_resource_set) {
+        cx->state = MRP_RES_CONNECTED;
+        cx->priv->cb(cx, MRP_RES_ERROR_NONE, cx->priv->user_data);
     }
 }
 
@@ -419,10 +718,13 @@ static void destroy_context(mrp_res_context_t *cx)
 
     if (cx->priv) {
 
-        if (cx->priv->transp)
-            mrp_transport_destroy(cx->priv->transp);
+        if (cx->priv->connect_cb)
+            mrp_del_deferred(cx->priv->connect_cb);
 
-        delete_resource_set(cx->priv->master_resource_set);
+        purge_pending_requests(cx, NULL);
+
+        if (cx->priv->conn && cx->priv->rset_mapping)
+            destroy_server_resource_sets(cx);
 
         /* FIXME: is this the way we want to free all resources and
          * resource sets? */
@@ -432,7 +734,10 @@ static void destroy_context(mrp_res_context_t *cx)
         if (cx->priv->internal_rset_mapping)
             mrp_htbl_destroy(cx->priv->internal_rset_mapping, true);
 
-        mrp_res_free_string_array(cx->priv->master_classes);
+        if (cx->priv->conn) {
+            mrp_list_delete(&cx->priv->hook);
+            unref_connection(cx->priv->conn);
+        }
 
         mrp_free(cx->priv);
     }
@@ -458,16 +763,8 @@ mrp_res_context_t *mrp_res_create(mrp_mainloop_t *ml,
                        mrp_res_state_callback_t cb,
                        void *userdata)
 {
-    static mrp_transport_evt_t evt = {
-        { .recvmsg     = recv_msg },
-        { .recvmsgfrom = recvfrom_msg },
-        .closed        = closed_evt,
-        .connection    = NULL
-    };
-
-    int alen;
-    const char *type;
     mrp_htbl_config_t conf;
+    mrp_res_connection_t *conn;
     mrp_res_context_t *cx = mrp_allocz(sizeof(mrp_res_context_t));
 
     if (!cx)
@@ -478,10 +775,12 @@ mrp_res_context_t *mrp_res_create(mrp_mainloop_t *ml,
     if (!cx->priv)
         goto error;
 
+    cx->priv->pub = cx;
     cx->priv->next_seqno = 1;
+    mrp_list_init(&cx->priv->hook);
+    mrp_list_init(&cx->priv->pending_sets);
+    mrp_list_init(&cx->priv->pending_requests);
     cx->priv->next_internal_id = 1;
-    cx->priv->ml = ml;
-    cx->priv->connection_id = 0;
     cx->priv->cb = cb;
     cx->priv->user_data = userdata;
 
@@ -509,32 +808,35 @@ mrp_res_context_t *mrp_res_create(mrp_mainloop_t *ml,
     if (!cx->priv->internal_rset_mapping)
         goto error;
 
-    /* connect to Murphy */
-
-    alen = mrp_transport_resolve(NULL, mrp_resource_get_default_address(),
-            &cx->priv->saddr, sizeof(cx->priv->saddr), &type);
+    /* share the connection of the other contexts, or set up a new one */
 
-    cx->priv->transp = mrp_transport_create(cx->priv->ml, type,
-                                          &evt, cx, 0);
+    conn = get_connection(ml);
 
-    if (!cx->priv->transp)
+    if (!conn)
         goto error;
 
-    if (!mrp_transport_connect(cx->priv->transp, &cx->priv->saddr, alen))
+    cx->priv->conn = conn;
+    cx->priv->tag = alloc_context_tag(conn);
+    mrp_list_append(&conn->contexts, &cx->priv->hook);
+
+    if (!cx->priv->tag) {
+        mrp_res_error("too many contexts on one connection");
         goto error;
+    }
 
-    cx->priv->connected = TRUE;
     cx->state = MRP_RES_DISCONNECTED;
 
-    if (get_application_classes_request(cx) < 0 || get_available_resources_request(cx) < 0) {
-        goto error;
+    /* if the definitions are already there, we are ready right away */
+    if (conn->master_classes && conn->master_resource_set) {
+        cx->priv->connect_cb = mrp_add_deferred(ml, connected_cb, cx);
+
+        if (!cx->priv->connect_cb)
+            goto error;
     }
 
     /* TODO: this needs to be gotten from an environment variable */
     cx->zone = "driver";
 
-    mrp_list_init(&cx->priv->pending_sets);
-
     return cx;
 
 error:
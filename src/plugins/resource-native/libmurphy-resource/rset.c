@@ -97,13 +97,13 @@ static int destroy_resource_set_request(mrp_res_context_t *cx,
 {
     mrp_msg_t *msg = NULL;
 
-    if (!cx->priv->connected)
+    if (!cx->priv->conn->connected)
         goto error;
 
-    rset->priv->seqno = cx->priv->next_seqno;
+    rset->priv->seqno = alloc_seqno(cx);
 
     msg = mrp_msg_create(
-            RESPROTO_SEQUENCE_NO, MRP_MSG_FIELD_UINT32, cx->priv->next_seqno++,
+            RESPROTO_SEQUENCE_NO, MRP_MSG_FIELD_UINT32, rset->priv->seqno,
             RESPROTO_REQUEST_TYPE, MRP_MSG_FIELD_UINT16,
                     RESPROTO_DESTROY_RESOURCE_SET,
             RESPROTO_RESOURCE_SET_ID, MRP_MSG_FIELD_UINT32, rset->priv->id,
@@ -112,7 +112,7 @@ static int destroy_resource_set_request(mrp_res_context_t *cx,
     if (!msg)
         goto error;
 
-    if (!mrp_transport_send(cx->priv->transp, msg))
+    if (!mrp_transport_send(cx->priv->conn->transp, msg))
         goto error;
 
     mrp_msg_unref(msg);
@@ -124,6 +124,26 @@ error:
 }
 
 
+static int destroy_server_set_cb(void *key, void *object, void *user_data)
+{
+    mrp_res_context_t *cx = user_data;
+    mrp_res_resource_set_t *rset = object;
+
+    MRP_UNUSED(key);
+
+    destroy_resource_set_request(cx, rset);
+
+    return MRP_HTBL_ITER_MORE;
+}
+
+
+void destroy_server_resource_sets(mrp_res_context_t *cx)
+{
+    /* the connection outlives the context, so clean up after it */
+    mrp_htbl_foreach(cx->priv->rset_mapping, destroy_server_set_cb, cx);
+}
+
+
 void decrease_ref(mrp_res_context_t *cx,
         mrp_res_resource_set_t *rset)
 {
@@ -136,6 +156,9 @@ void decrease_ref(mrp_res_context_t *cx,
         mrp_log_info("delete the server resource set now");
         destroy_resource_set_request(cx, rset);
 
+        /* nobody is left to be notified about the pending requests */
+        purge_pending_requests(cx, rset);
+
         /* if a rset is deleted, remove it from the pending sets */
         mrp_list_delete(&rset->priv->hook);
 
@@ -344,7 +367,7 @@ static mrp_res_resource_set_t *create_resource_set(
     mrp_res_resource_set_t *rs;
     mrp_res_resource_set_t *internal;
 
-    if (cx->priv->master_resource_set == NULL)
+    if (cx->priv->conn->master_resource_set == NULL)
         return NULL;
 
     rs = mrp_allocz(sizeof(mrp_res_resource_set_t));
@@ -369,9 +392,9 @@ static mrp_res_resource_set_t *create_resource_set(
     rs->priv->autorelease = FALSE;
 
     rs->priv->resources = mrp_allocz_array(mrp_res_resource_t *,
-            cx->priv->master_resource_set->priv->num_resources);
+            cx->priv->conn->master_resource_set->priv->num_resources);
 
-    rs->priv->waiting_for = MRP_RES_PENDING_OPERATION_NONE;
+    rs->priv->num_pending = 0;
 
     mrp_list_init(&rs->priv->hook);
 
@@ -457,6 +480,184 @@ error:
     return -1;
 }
 
+
+/*
+ * pending requests
+ *
+ * Acquire and release requests are kept in the order they were made
+ * until the server replies to them, and replies are matched to requests
+ * by the sequence number. Requests for a set which does not exist on the
+ * server yet are sent once the set has been created.
+ */
+
+static int send_request(mrp_res_context_t *cx, pending_request_t *req)
+{
+    mrp_res_resource_set_t *rset = req->rset;
+    int ret;
+
+    if (req->op == MRP_RES_PENDING_OPERATION_ACQUIRE)
+        ret = acquire_resource_set_request(cx, rset);
+    else
+        ret = release_resource_set_request(cx, rset);
+
+    if (ret < 0)
+        return -1;
+
+    req->seqno = rset->priv->seqno;
+
+    return 0;
+}
+
+
+static void free_request(pending_request_t *req)
+{
+    mrp_list_delete(&req->hook);
+    req->rset->priv->num_pending--;
+    mrp_free(req);
+}
+
+
+static void finish_request(mrp_res_context_t *cx, pending_request_t *req,
+        int status)
+{
+    mrp_res_resource_set_t *rset = req->rset;
+    mrp_res_request_callback_t cb = req->cb;
+    void *user_data = req->user_data;
+
+    free_request(req);
+
+    if (cb) {
+        increase_ref(cx, rset);
+        cb(cx, rset, status, user_data);
+        decrease_ref(cx, rset);
+    }
+}
+
+
+static pending_request_t *find_unsent_request(mrp_res_context_t *cx,
+        mrp_res_resource_set_t *rset)
+{
+    mrp_list_hook_t *p, *n;
+    pending_request_t *req;
+
+    mrp_list_foreach(&cx->priv->pending_requests, p, n) {
+        req = mrp_list_entry(p, pending_request_t, hook);
+
+        if (req->rset == rset && !req->seqno)
+            return req;
+    }
+
+    return NULL;
+}
+
+
+int submit_request(mrp_res_context_t *cx, mrp_res_resource_set_t *rset,
+        pending_operation_t op, mrp_res_request_callback_t cb,
+        void *user_data)
+{
+    pending_request_t *req;
+
+    if (!cx->priv->conn->connected)
+        return -1;
+
+    req = mrp_allocz(sizeof(pending_request_t));
+
+    if (!req)
+        return -1;
+
+    mrp_list_init(&req->hook);
+    req->rset = rset;
+    req->op = op;
+    req->cb = cb;
+    req->user_data = user_data;
+
+    if (rset->priv->id) {
+        /* the set exists on the server, send the request right away */
+
+        if (send_request(cx, req) < 0)
+            goto error;
+    }
+    else if (mrp_list_empty(&rset->priv->hook)) {
+        /* Create the resource set on the server. The request is sent
+         * when the set has been created. */
+
+        mrp_list_append(&cx->priv->pending_sets, &rset->priv->hook);
+
+        if (create_resource_set_request(cx, rset) < 0) {
+            mrp_res_error("creating resource set failed");
+            mrp_list_delete(&rset->priv->hook);
+            goto error;
+        }
+    }
+
+    mrp_list_append(&cx->priv->pending_requests, &req->hook);
+    rset->priv->num_pending++;
+
+    return 0;
+
+error:
+    mrp_free(req);
+    return -1;
+}
+
+
+int send_pending_requests(mrp_res_context_t *cx, mrp_res_resource_set_t *rset)
+{
+    pending_request_t *req;
+
+    while ((req = find_unsent_request(cx, rset)) != NULL) {
+        if (send_request(cx, req) < 0) {
+            fail_pending_requests(cx, rset, EIO);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+void fail_pending_requests(mrp_res_context_t *cx,
+        mrp_res_resource_set_t *rset, int status)
+{
+    pending_request_t *req;
+
+    /* the callbacks may change the queue, so always restart the lookup */
+
+    while ((req = find_unsent_request(cx, rset)) != NULL)
+        finish_request(cx, req, status);
+}
+
+
+void complete_request(mrp_res_context_t *cx, uint32_t seqno, int status)
+{
+    mrp_list_hook_t *p, *n;
+    pending_request_t *req;
+
+    mrp_list_foreach(&cx->priv->pending_requests, p, n) {
+        req = mrp_list_entry(p, pending_request_t, hook);
+
+        if (req->seqno == seqno) {
+            finish_request(cx, req, status);
+            return;
+        }
+    }
+}
+
+
+void purge_pending_requests(mrp_res_context_t *cx,
+        mrp_res_resource_set_t *rset)
+{
+    mrp_list_hook_t *p, *n;
+    pending_request_t *req;
+
+    mrp_list_foreach(&cx->priv->pending_requests, p, n) {
+        req = mrp_list_entry(p, pending_request_t, hook);
+
+        if (!rset || req->rset == rset)
+            free_request(req);
+    }
+}
+
 /* public API */
 
 const mrp_res_string_array_t * mrp_res_list_application_classes(
@@ -465,7 +666,7 @@ const mrp_res_string_array_t * mrp_res_list_application_classes(
     if (!cx)
         return NULL;
 
-    return cx->priv->master_classes;
+    return cx->priv->conn->master_classes;
 }
 
 
@@ -489,8 +690,8 @@ mrp_res_resource_t *mrp_res_create_resource(
     if (cx == NULL || name == NULL)
         return NULL;
 
-    for (i = 0; i < cx->priv->master_resource_set->priv->num_resources; i++) {
-        proto = cx->priv->master_resource_set->priv->resources[i];
+    for (i = 0; i < cx->priv->conn->master_resource_set->priv->num_resources; i++) {
+        proto = cx->priv->conn->master_resource_set->priv->resources[i];
         if (strcmp(proto->name, name) == 0) {
             found = true;
             server_id = proto->priv->server_id;
@@ -553,6 +754,10 @@ mrp_res_resource_set_t *mrp_res_copy_resource_set(
 
     cx = original->priv->cx;
 
+    /* the shared master set does not belong to any context */
+    if (!cx)
+        goto error;
+
     /* increase the reference count of the library resource set */
 
     internal = mrp_htbl_lookup(cx->priv->internal_rset_mapping,
@@ -577,16 +782,17 @@ const mrp_res_resource_set_t * mrp_res_list_resources(
     if (cx == NULL || cx->priv == NULL)
         return NULL;
 
-    return cx->priv->master_resource_set;
+    return cx->priv->conn->master_resource_set;
 }
 
 
-int mrp_res_release_resource_set(mrp_res_resource_set_t *original)
+static int release_resource_set(const mrp_res_resource_set_t *original,
+        mrp_res_request_callback_t cb, void *userdata)
 {
     mrp_res_resource_set_t *internal_set = NULL;
     mrp_res_context_t *cx = original->priv->cx;
 
-    if (!cx || !cx->priv->connected)
+    if (!cx || !cx->priv->conn->connected)
         goto error;
 
     if (!original->priv->internal_id)
@@ -600,47 +806,32 @@ int mrp_res_release_resource_set(mrp_res_resource_set_t *original)
 
     update_library_resource_set(cx, original, internal_set);
 
-    if (internal_set->priv->id) {
-        return release_resource_set_request(cx, internal_set);
-    }
-    else {
-        mrp_list_hook_t *p, *n;
-        mrp_res_resource_set_private_t *pending_rset;
-        bool found = FALSE;
+    /* If the set doesn't exist on the server yet, it is created first
+     * and the releasing is continued when the set is created. */
 
-        /* Create the resource set if it doesn't already exist on the
-         * server. The releasing is continued when the set is created.
-         */
-
-        /* only append if not already present in the list */
+    if (submit_request(cx, internal_set, MRP_RES_PENDING_OPERATION_RELEASE,
+            cb, userdata) < 0)
+        goto error;
 
-        mrp_list_foreach(&cx->priv->pending_sets, p, n) {
-            pending_rset = mrp_list_entry(p, mrp_res_resource_set_private_t, hook);
-            if (pending_rset == internal_set->priv) {
-                found = TRUE;
-                break;
-            }
-        }
+    return 0;
 
-        if (!found) {
-            mrp_list_append(&cx->priv->pending_sets, &internal_set->priv->hook);
-        }
+error:
+    mrp_res_error("mrp_release_resources error");
 
-        internal_set->priv->waiting_for = MRP_RES_PENDING_OPERATION_RELEASE;
+    return -1;
+}
 
-        if (create_resource_set_request(cx, internal_set) < 0) {
-            mrp_res_error("creating resource set failed");
-            mrp_list_delete(&internal_set->priv->hook);
-            goto error;
-        }
 
-        return 0;
-    }
+int mrp_res_release_resource_set(mrp_res_resource_set_t *original)
+{
+    return release_resource_set(original, NULL, NULL);
+}
 
-error:
-    mrp_res_error("mrp_release_resources error");
 
-    return -1;
+int mrp_res_release_resource_set_async(const mrp_res_resource_set_t *original,
+        mrp_res_request_callback_t cb, void *userdata)
+{
+    return release_resource_set(original, cb, userdata);
 }
 
 
@@ -788,13 +979,13 @@ bool mrp_res_set_autorelease(bool status,
 }
 
 
-int mrp_res_acquire_resource_set(
-                const mrp_res_resource_set_t *original)
+static int acquire_resource_set(const mrp_res_resource_set_t *original,
+        mrp_res_request_callback_t cb, void *userdata)
 {
     mrp_res_resource_set_t *rset;
     mrp_res_context_t *cx = original->priv->cx;
 
-    if (!cx->priv->connected) {
+    if (!cx || !cx->priv->conn->connected) {
         mrp_res_error("not connected to server");
         goto error;
     }
@@ -812,53 +1003,24 @@ int mrp_res_acquire_resource_set(
 #if 0
     print_resource_set(rset);
 #endif
-    if (rset->priv->id) {
-        /* the set has been already created on server */
+    if (rset->priv->id && !rset->priv->num_pending &&
+            rset->state == MRP_RES_RESOURCE_ACQUIRED) {
+        /* already requested, updating is not supported yet */
+        mrp_res_error("trying to re-acquire already acquired set");
 
-        if (rset->state == MRP_RES_RESOURCE_ACQUIRED) {
-            /* already requested, updating is not supported yet */
-            mrp_res_error("trying to re-acquire already acquired set");
-
-            /* TODO: when supported by backend
-             * type = RESPROTO_UPDATE_RESOURCE_SET
-             */
-            goto error;
-        }
-        else {
-            /* re-acquire a lost or released set */
-            return acquire_resource_set_request(cx, rset);
-        }
+        /* TODO: when supported by backend
+         * type = RESPROTO_UPDATE_RESOURCE_SET
+         */
+        goto error;
     }
-    else {
-        mrp_list_hook_t *p, *n;
-        mrp_res_resource_set_private_t *pending_rset;
-        bool found = FALSE;
-
-        /* Create the resource set. The acquisition is continued
-         * when the set is created. */
-
-        /* only append if not already present in the list */
-
-        mrp_list_foreach(&cx->priv->pending_sets, p, n) {
-            pending_rset = mrp_list_entry(p, mrp_res_resource_set_private_t, hook);
-            if (pending_rset == rset->priv) {
-                found = TRUE;
-                break;
-            }
-        }
-
-        if (!found) {
-            mrp_list_append(&cx->priv->pending_sets, &rset->priv->hook);
-        }
 
-        rset->priv->waiting_for = MRP_RES_PENDING_OPERATION_ACQUIRE;
+    /* Re-acquire a lost or released set. If the set doesn't exist on the
+     * server yet, it is created first and the acquisition is continued
+     * when the set is created. */
 
-        if (create_resource_set_request(cx, rset) < 0) {
-            mrp_res_error("creating resource set failed");
-            mrp_list_delete(&rset->priv->hook);
-            goto error;
-        }
-    }
+    if (submit_request(cx, rset, MRP_RES_PENDING_OPERATION_ACQUIRE,
+            cb, userdata) < 0)
+        goto error;
 
     return 0;
 
@@ -868,6 +1030,20 @@ error:
 }
 
 
+int mrp_res_acquire_resource_set(
+                const mrp_res_resource_set_t *original)
+{
+    return acquire_resource_set(original, NULL, NULL);
+}
+
+
+int mrp_res_acquire_resource_set_async(const mrp_res_resource_set_t *original,
+        mrp_res_request_callback_t cb, void *userdata)
+{
+    return acquire_resource_set(original, cb, userdata);
+}
+
+
 int mrp_res_get_resource_set_id(mrp_res_resource_set_t *rs)
 {
     mrp_res_resource_set_t *internal_set;
@@ -886,3 +1062,61 @@ int mrp_res_get_resource_set_id(mrp_res_resource_set_t *rs)
 
     return internal_set->priv->id;
 }
+
+
+mrp_res_resource_state_t resource_set_state_from_masks(
+        const mrp_res_resource_set_t *rset, uint64_t grant, uint64_t advice)
+{
+    mrp_res_resource_t *res;
+    uint64_t mandatory = 0x0;
+    uint32_t i;
+
+    for (i = 0; i < rset->priv->num_resources; i++) {
+        res = rset->priv->resources[i];
+
+        if (res->priv->mandatory)
+            mandatory |= ((uint64_t)1 << res->priv->server_id);
+    }
+
+    if (grant)
+        return MRP_RES_RESOURCE_ACQUIRED;
+    else if (advice == mandatory)
+        return MRP_RES_RESOURCE_AVAILABLE;
+    else
+        return MRP_RES_RESOURCE_LOST;
+}
+
+
+mrp_res_resource_state_t mrp_res_get_resource_set_state(
+        const mrp_res_resource_set_t *rs)
+{
+    mrp_res_resource_set_t *internal_set;
+    mrp_res_context_t *cx = NULL;
+    mrp_resproto_stateslot_t *slot;
+    uint32_t state;
+    uint64_t grant, advice;
+
+    if (!rs || !rs->priv || !rs->priv->cx)
+        return MRP_RES_RESOURCE_LOST;
+
+    cx = rs->priv->cx;
+
+    internal_set = mrp_htbl_lookup(cx->priv->internal_rset_mapping,
+            u_to_p(rs->priv->internal_id));
+
+    if (!internal_set || !internal_set->priv)
+        return rs->state;
+
+    /* not created on the server side yet or no published states */
+    if (!internal_set->priv->id || !cx->priv->conn->stateshm)
+        return internal_set->state;
+
+    slot = mrp_resproto_stateshm_slot(cx->priv->conn->stateshm,
+            internal_set->priv->id);
+
+    if (!mrp_resproto_stateshm_read(slot, internal_set->priv->id,
+            &state, &grant, &advice))
+        return internal_set->state;
+
+    return resource_set_state_from_masks(internal_set, grant, advice);
+}
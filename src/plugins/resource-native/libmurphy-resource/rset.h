@@ -52,6 +52,8 @@ void decrease_ref(mrp_res_context_t *cx,
 
 void free_resource_set(mrp_res_resource_set_t *rset);
 
+void destroy_server_resource_sets(mrp_res_context_t *cx);
+
 void delete_resource_set(mrp_res_resource_set_t *rs);
 
 mrp_res_resource_set_t *resource_set_copy(
@@ -60,4 +62,22 @@ mrp_res_resource_set_t *resource_set_copy(
 mrp_res_resource_t *get_resource_by_name(mrp_res_resource_set_t *rset,
         const char *name);
 
+int submit_request(mrp_res_context_t *cx, mrp_res_resource_set_t *rset,
+        pending_operation_t op, mrp_res_request_callback_t cb,
+        void *user_data);
+
+int send_pending_requests(mrp_res_context_t *cx,
+        mrp_res_resource_set_t *rset);
+
+void fail_pending_requests(mrp_res_context_t *cx,
+        mrp_res_resource_set_t *rset, int status);
+
+void complete_request(mrp_res_context_t *cx, uint32_t seqno, int status);
+
+void purge_pending_requests(mrp_res_context_t *cx,
+        mrp_res_resource_set_t *rset);
+
+mrp_res_resource_state_t resource_set_state_from_masks(
+        const mrp_res_resource_set_t *rset, uint64_t grant, uint64_t advice);
+
 #endif
@@ -30,6 +30,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include <lualib.h>
 #include <lauxlib.h>
@@ -39,10 +42,12 @@
 #include <murphy/common/mainloop.h>
 #include <murphy/common/msg.h>
 #include <murphy/common/transport.h>
+#include <murphy/common/socket-utils.h>
 #include <murphy/common/debug.h>
 #include <murphy/core/plugin.h>
 #include <murphy/core/console.h>
 #include <murphy/core/lua-bindings/murphy.h>
+#include <murphy/daemon/daemon.h>
 
 #include <murphy-db/mql.h>
 #include <murphy-db/mqi.h>
@@ -70,36 +75,107 @@ enum {
 
 enum {
     ARG_ADDRESS,
+    ARG_STATESHM,
+    ARG_ARBITERS,
 };
 
 
+enum {
+    QUERY_RESOURCES = 0,
+    QUERY_CLASSES,
+    QUERY_ZONES,
+    QUERY_MAX
+};
+
+typedef struct {
+    uint32_t         generation;         /* definition generation of reply */
+    mrp_msg_tmpl_t  *tmpl;               /* pre-encoded query reply */
+} query_reply_t;
+
 typedef struct {
     mrp_plugin_t      *plugin;
     mrp_event_bus_t   *plugin_bus;
     mrp_event_watch_t *w;
+    mrp_event_watch_t *cfgw;             /* end of configuration, if loading */
     mrp_sockaddr_t     saddr;
     socklen_t          alen;
     const char        *atyp;
     mrp_transport_t   *listen;
     mrp_list_hook_t    clients;
+    mrp_resproto_stateshm_t *shm;        /* published set states, if any */
+    const char        *shmname;          /* name of the state segment */
+    query_reply_t      replies[QUERY_MAX]; /* cached query replies */
+    mrp_mm_tag_t      *mmtag;            /* memory accounting tag */
 } resource_data_t;
 
 typedef struct {
     mrp_list_hook_t        list;
     resource_data_t       *data;
-    uint32_t               id;
     mrp_resource_client_t *rscli;
     mrp_transport_t       *transp;
+    mrp_list_hook_t        events;
+    mrp_list_hook_t        templates;
+    mrp_list_hook_t        owner_subs;
+    uint32_t               next_tmpl;
+    mrp_mm_tag_t          *mmtag;
+    uint32_t               id;
 } client_t;
 
+typedef struct {
+    mrp_list_hook_t  hook;               /* to list of cached events */
+    uint32_t         rset_id;            /* resource set id */
+    uint64_t         fprint;             /* fingerprint of static part */
+    mrp_msg_tmpl_t  *tmpl;               /* pre-encoded event message */
+} event_tmpl_t;
+
+typedef struct {
+    uint32_t         flags;              /* RESPROTO_RSETFLAG_* */
+    uint32_t         priority;           /* resource set priority */
+    const char      *class;              /* application class */
+    const char      *zone;               /* zone */
+} set_header_t;
+
+typedef struct {
+    char            *name;               /* resource name */
+    bool             shared;             /* shared or exclusive */
+    bool             mandatory;          /* mandatory or optional */
+    uint32_t         nattr;              /* number of attributes */
+    mrp_attr_t      *attrs;              /* attributes, NULL-name terminated */
+} tmpl_resource_t;
+
+typedef struct {
+    mrp_list_hook_t  hook;               /* to list of client templates */
+    uint32_t         id;                 /* template id */
+    char            *name;               /* template name */
+    set_header_t     hdr;                /* resource set header */
+    uint32_t         nres;               /* number of resources */
+    tmpl_resource_t  res[MRP_RESOURCE_MAX]; /* pre-validated resources */
+} rset_tmpl_t;
+
+typedef struct {
+    mrp_list_hook_t             hook;    /* to list of client subscriptions */
+    client_t                   *client;  /* subscribing client */
+    uint32_t                    zoneid;  /* zone id */
+    uint32_t                    resid;   /* resource id */
+    mrp_resource_owner_watch_t *watch;   /* owner watch */
+} owner_sub_t;
+
+typedef bool (*add_resources_cb_t)(mrp_resource_set_t *, void *);
+
 
 static void print_zones_cb(mrp_console_t *, void *, int, char **argv);
 static void print_classes_cb(mrp_console_t *, void *, int, char **argv);
 static void print_sets_cb(mrp_console_t *, void *, int, char **argv);
 static void print_owners_cb(mrp_console_t *, void *, int, char **argv);
 static void print_resources_cb(mrp_console_t *, void *, int, char **argv);
+static void print_latency_cb(mrp_console_t *, void *, int, char **argv);
 
 static void resource_event_handler(uint32_t, mrp_resource_set_t *, void *);
+static void drop_event_template(client_t *, uint32_t);
+static void purge_event_templates(client_t *);
+static void publish_state(client_t *, uint32_t, uint32_t, uint64_t, uint64_t);
+static void unpublish_state(client_t *, uint32_t);
+static void unpublish_client_states(client_t *);
 
 
 MRP_CONSOLE_GROUP(resource_group, "resource", NULL, NULL, {
@@ -131,6 +207,13 @@ MRP_CONSOLE_GROUP(resource_group, "resource", NULL, NULL, {
                           "all their attributes. The data sources for the "
                           "printout are the internal data structures of the "
                           "resource library"),
+        MRP_TOKENIZED_CMD("latency" , print_latency_cb , FALSE,
+                          "latency [reset]", "prints grant latencies",
+                          "prints for each zone and application class the "
+                          "latency histograms of acquire and release "
+                          "requests, broken down to the queueing, policy, "
+                          "resource manager, database and delivery stages. "
+                          "With reset the collected latencies are cleared."),
 
 });
 
@@ -159,53 +242,93 @@ static void print_zones_cb(mrp_console_t *c, void *user_data,
 }
 
 
+static void stream_classes(mrp_console_t *c, bool with_rsets)
+{
+    char *buf;
+    int   size, len;
+
+    /*
+     * Print into a buffer big enough for everything, then let the console
+     * stream it out chunk by chunk instead of writing it all out at once.
+     */
+
+    for (size = 8192, buf = NULL;  ;  size *= 2) {
+        mrp_free(buf);
+
+        if (!(buf = mrp_alloc(size))) {
+            printf("Failed to allocate print buffer.\n");
+            return;
+        }
+
+        if ((len = mrp_application_class_print(buf, size, with_rsets)) < size)
+            break;
+    }
+
+    if (mrp_console_stream_buffer(c, buf, len) < 0)
+        printf("Failed to stream application classes.\n");
+}
+
+
 static void print_classes_cb(mrp_console_t *c, void *user_data,
                              int argc, char **argv)
 {
-    char buf[8192];
-
-    MRP_UNUSED(c);
     MRP_UNUSED(user_data);
     MRP_UNUSED(argc);
     MRP_UNUSED(argv);
 
-    mrp_application_class_print(buf, sizeof(buf), false);
-
-    printf("%s", buf);
+    stream_classes(c, false);
 }
 
 
 static void print_sets_cb(mrp_console_t *c, void *user_data,
                           int argc, char **argv)
 {
-    static int size = 8192;
-    char       buf[size];
-
-    MRP_UNUSED(c);
     MRP_UNUSED(user_data);
     MRP_UNUSED(argc);
     MRP_UNUSED(argv);
 
-    if (mrp_application_class_print(buf, sizeof(buf), true) >= size)
-        size *= 2;
+    stream_classes(c, true);
+}
+
+
+static int stream_owners_cb(mrp_console_t *c, void *user_data)
+{
+    uint32_t *zid = (uint32_t *)user_data;
+    char      buf[8192];
+
+    if (c == NULL) {
+        mrp_free(zid);
+        return FALSE;
+    }
+
+    if (*zid == 0)
+        printf("Resource owners:\n");
+
+    if (mrp_resource_owner_print_zone(*zid, buf, sizeof(buf)) <= 0)
+        return FALSE;
 
     printf("%s", buf);
+    (*zid)++;
+
+    return TRUE;
 }
 
 
 static void print_owners_cb(mrp_console_t *c, void *user_data,
                             int argc, char **argv)
 {
-    char buf[2048];
+    uint32_t *zid;
 
-    MRP_UNUSED(c);
     MRP_UNUSED(user_data);
     MRP_UNUSED(argc);
     MRP_UNUSED(argv);
 
-    mrp_resource_owner_print(buf, sizeof(buf));
-
-    printf("%s", buf);
+    /* print the owners of one zone per mainloop iteration */
+    if (!(zid = mrp_allocz(sizeof(*zid))) ||
+        mrp_console_stream(c, stream_owners_cb, zid) < 0) {
+        mrp_free(zid);
+        printf("Failed to stream resource owners.\n");
+    }
 }
 
 
@@ -258,6 +381,30 @@ static void print_resources_cb(mrp_console_t *c, void *user_data,
 }
 
 
+static void print_latency_cb(mrp_console_t *c, void *user_data,
+                             int argc, char **argv)
+{
+    char buf[16384];
+
+    MRP_UNUSED(c);
+    MRP_UNUSED(user_data);
+
+    if (argc == 3 && !strcmp(argv[2], "reset")) {
+        mrp_grant_latency_reset();
+        printf("Grant latencies cleared.\n");
+        return;
+    }
+
+    if (argc != 2) {
+        printf("usage: resource latency [reset]\n");
+        return;
+    }
+
+    mrp_grant_latency_print(buf, sizeof(buf));
+    printf("%s", buf);
+}
+
+
 #if 0
 static int set_default_configuration(void)
 {
@@ -318,27 +465,16 @@ static int set_default_configuration(void)
 }
 #endif
 
-static void reply_with_array(client_t *client, mrp_msg_t *msg,
-                             uint16_t tag, const char **arr)
+static bool write_array(mrp_msg_t *msg, uint16_t tag, const char **arr)
 {
-    resource_data_t *data   = client->data;
-    mrp_plugin_t    *plugin = data->plugin;
-    uint16_t         dim;
-    bool             s;
+    uint16_t dim;
 
     for (dim = 0;  arr[dim];  dim++)
         ;
 
-    s  = mrp_msg_append(msg, MRP_MSG_TAG_SINT16(RESPROTO_REQUEST_STATUS, 0));
-    s &= mrp_msg_append(msg, MRP_MSG_TAG_STRING_ARRAY(tag, dim, arr));
-
-    if (!s) {
-        mrp_log_error("%s: failed to build reply", plugin->instance);
-        return;
-    }
-
-    if (!mrp_transport_send(client->transp, msg))
-        mrp_log_error("%s: failed to send reply", plugin->instance);
+    return
+        mrp_msg_append(msg, MRP_MSG_TAG_SINT16(RESPROTO_REQUEST_STATUS, 0)) &&
+        mrp_msg_append(msg, MRP_MSG_TAG_STRING_ARRAY(tag, dim, arr));
 }
 
 static void reply_with_status(client_t *client, mrp_msg_t *msg, int16_t err)
@@ -399,74 +535,153 @@ static bool write_attributes(mrp_msg_t *msg, mrp_attr_t *attrs)
 }
 
 
-static void query_resources_request(client_t *client, mrp_msg_t *req)
+static bool write_resources(mrp_msg_t *msg)
 {
 #define PUSH(m, tag, typ, val)    \
     mrp_msg_append(m, MRP_MSG_TAG_##typ(RESPROTO_##tag, val))
 
-
-    resource_data_t  *data   = client->data;
-    mrp_plugin_t     *plugin = data->plugin;
-    const char      **names;
-    mrp_attr_t       *attrs;
-    mrp_attr_t        buf[ATTRIBUTE_MAX];
-    uint32_t          resid;
+    const char **names;
+    mrp_attr_t  *attrs;
+    mrp_attr_t   buf[ATTRIBUTE_MAX];
+    uint32_t     resid;
+    bool         ok;
 
     if (!(names = mrp_resource_definition_get_all_names(0, NULL)))
-        reply_with_status(client, req, ENOMEM);
-    else {
-        if (!PUSH(req, REQUEST_STATUS, SINT16, 0))
-            goto failed;
-        else {
-            for (resid = 0;   names[resid];   resid++) {
-                attrs = mrp_resource_definition_read_all_attributes(
-                                                    resid, ATTRIBUTE_MAX, buf);
+        return false;
 
-                if (!PUSH(req, RESOURCE_NAME, STRING, names[resid]) ||
-                    !write_attributes(req, attrs))
-                    goto failed;
-            }
+    ok = PUSH(msg, REQUEST_STATUS, SINT16, 0);
 
-            if (!mrp_transport_send(client->transp, req))
-                mrp_log_error("%s: failed to send reply", plugin->instance);
+    for (resid = 0;  ok && names[resid];  resid++) {
+        attrs = mrp_resource_definition_read_all_attributes(resid,
+                                                            ATTRIBUTE_MAX,buf);
 
-            mrp_free(names);
-        }
+        ok = PUSH(msg, RESOURCE_NAME, STRING, names[resid]) &&
+             write_attributes(msg, attrs);
     }
 
-    return;
-
- failed:
-    mrp_log_error("%s: can't build recource query reply message",
-                  plugin->instance);
     mrp_free(names);
 
+    return ok;
 
 #undef PUSH
 }
 
-static void query_classes_request(client_t *client, mrp_msg_t *req)
+static bool write_classes(mrp_msg_t *msg)
 {
     const char **names = mrp_application_class_get_all_names(0, NULL);
+    bool         ok;
 
     if (!names)
-        reply_with_status(client, req, ENOMEM);
-    else {
-        reply_with_array(client, req, RESPROTO_CLASS_NAME, names);
-        mrp_free(names);
-    }
+        return false;
+
+    ok = write_array(msg, RESPROTO_CLASS_NAME, names);
+    mrp_free(names);
+
+    return ok;
 }
 
-static void query_zones_request(client_t *client, mrp_msg_t *req)
+static bool write_zones(mrp_msg_t *msg)
 {
     const char **names = mrp_zone_get_all_names(0, NULL);
+    bool         ok;
 
     if (!names)
-        reply_with_status(client, req, ENOMEM);
-    else {
-        reply_with_array(client, req, RESPROTO_ZONE_NAME, names);
-        mrp_free(names);
+        return false;
+
+    ok = write_array(msg, RESPROTO_ZONE_NAME, names);
+    mrp_free(names);
+
+    return ok;
+}
+
+
+/*
+ * cached query replies
+ *
+ * Every client queries the resources, classes and zones when it connects,
+ * and the replies only change when something new gets defined. We keep the
+ * replies pre-encoded together with the definition generation they were
+ * built for and only patch the sequence number before sending them.
+ */
+
+static query_reply_t *get_query_reply(client_t *client, uint16_t reqtyp,
+                                      bool (*write)(mrp_msg_t *))
+{
+#define FIELD(tag, typ, val)      \
+    RESPROTO_##tag, MRP_MSG_FIELD_##typ, val
+
+    resource_data_t *data = client->data;
+    query_reply_t   *r;
+    mrp_msg_t       *msg;
+    uint32_t         gen;
+
+    switch (reqtyp) {
+    case RESPROTO_QUERY_RESOURCES: r = data->replies + QUERY_RESOURCES; break;
+    case RESPROTO_QUERY_CLASSES:   r = data->replies + QUERY_CLASSES;   break;
+    case RESPROTO_QUERY_ZONES:     r = data->replies + QUERY_ZONES;     break;
+    default:                       return NULL;
+    }
+
+    gen = mrp_resource_definitions_get_generation();
+
+    if (r->tmpl != NULL && r->generation == gen)
+        return r;
+
+    mrp_msg_tmpl_destroy(r->tmpl);
+    r->tmpl = NULL;
+
+    msg = mrp_msg_create(FIELD( SEQUENCE_NO , UINT32, 0      ),
+                         FIELD( REQUEST_TYPE, UINT16, reqtyp ),
+                         RESPROTO_MESSAGE_END                );
+
+    if (msg != NULL) {
+        if (write(msg)) {
+            r->tmpl       = mrp_msg_tmpl_create(msg);
+            r->generation = gen;
+        }
+
+        mrp_msg_unref(msg);
+    }
+
+    return r->tmpl != NULL ? r : NULL;
+
+#undef FIELD
+}
+
+static void purge_query_replies(resource_data_t *data)
+{
+    int i;
+
+    for (i = 0;  i < QUERY_MAX;  i++) {
+        mrp_msg_tmpl_destroy(data->replies[i].tmpl);
+        data->replies[i].tmpl = NULL;
+    }
+}
+
+static void query_request(client_t *client, mrp_msg_t *req, uint32_t seqno,
+                          uint16_t reqtyp, bool (*write)(mrp_msg_t *))
+{
+    resource_data_t *data   = client->data;
+    mrp_plugin_t    *plugin = data->plugin;
+    query_reply_t   *r;
+
+    if ((r = get_query_reply(client, reqtyp, write)) != NULL) {
+        if (!mrp_msg_tmpl_set(r->tmpl, RESPROTO_SEQUENCE_NO,
+                              MRP_MSG_FIELD_UINT32, seqno) ||
+            !mrp_transport_sendtmpl(client->transp, r->tmpl))
+            mrp_log_error("%s: failed to send reply", plugin->instance);
+        return;
+    }
+
+    /* no cached reply, build the reply in the request itself */
+    if (!write(req)) {
+        mrp_log_error("%s: can't build query reply message",
+                      plugin->instance);
+        return;
     }
+
+    if (!mrp_transport_send(client->transp, req))
+        mrp_log_error("%s: failed to send reply", plugin->instance);
 }
 
 static int read_attribute(mrp_msg_t *req, mrp_attr_t *attr, void **pcurs)
@@ -540,7 +755,9 @@ static int read_attribute(mrp_msg_t *req, mrp_attr_t *attr, void **pcurs)
 }
 
 
-static int read_resource(mrp_resource_set_t *rset, mrp_msg_t *req,void **pcurs)
+static int read_resource_spec(mrp_msg_t *req, void **pcurs,
+                              const char **namep, bool *mandp, bool *sharedp,
+                              mrp_attr_t *attrs)
 {
     uint16_t        tag;
     uint16_t        type;
@@ -549,7 +766,6 @@ static int read_resource(mrp_resource_set_t *rset, mrp_msg_t *req,void **pcurs)
     const char     *name;
     bool            mand;
     bool            shared;
-    mrp_attr_t      attrs[ATTRIBUTE_MAX + 1];
     uint32_t        i;
     int             arst;
 
@@ -578,6 +794,27 @@ static int read_resource(mrp_resource_set_t *rset, mrp_msg_t *req,void **pcurs)
 
     memset(attrs + i, 0, sizeof(mrp_attr_t));
 
+    *namep   = name;
+    *mandp   = mand;
+    *sharedp = shared;
+
+    return arst;
+}
+
+
+static int read_resource(mrp_resource_set_t *rset, mrp_msg_t *req,void **pcurs)
+{
+    const char     *name;
+    bool            mand;
+    bool            shared;
+    mrp_attr_t      attrs[ATTRIBUTE_MAX + 1];
+    int             arst;
+
+    arst = read_resource_spec(req, pcurs, &name, &mand, &shared, attrs);
+
+    if (arst == RESOURCE_LAST)
+        return arst;
+
     if (arst > 0) {
         if (mrp_resource_set_add_resource(rset, name, shared, attrs, mand) < 0)
             arst = RESOURCE_ERROR;
@@ -589,129 +826,707 @@ static int read_resource(mrp_resource_set_t *rset, mrp_msg_t *req,void **pcurs)
 }
 
 
-static void create_resource_set_request(client_t *client, mrp_msg_t *req,
-                                        uint32_t seqno, void **pcurs)
+static bool read_set_header(mrp_msg_t *req, void **pcurs, set_header_t *hdr)
 {
-    static uint16_t reqtyp = RESPROTO_CREATE_RESOURCE_SET;
-
-    resource_data_t        *data   = client->data;
-    mrp_plugin_t           *plugin = data->plugin;
-    mrp_resource_set_t     *rset   = 0;
-    mrp_msg_t              *rpl;
-    uint32_t                flags;
-    uint32_t                priority;
-    const char             *class;
-    const char             *zone;
-    uint16_t                tag;
-    uint16_t                type;
-    size_t                  size;
-    mrp_msg_value_t         value;
-    uint32_t                rsid;
-    int                     arst;
-    int32_t                 status;
-    bool                    auto_release;
-    bool                    auto_acquire;
-    bool                    dont_wait;
-    mrp_resource_event_cb_t event_cb;
-
-    MRP_ASSERT(client, "invalid argument");
-    MRP_ASSERT(client->rscli, "confused with data structures");
-
-    rsid = MRP_RESOURCE_ID_INVALID;
-    status = EINVAL;
-
+    uint16_t        tag;
+    uint16_t        type;
+    size_t          size;
+    mrp_msg_value_t value;
 
     if (!mrp_msg_iterate(req, pcurs, &tag, &type, &value, &size) ||
         tag != RESPROTO_RESOURCE_FLAGS || type != MRP_MSG_FIELD_UINT32)
-        goto reply;
+        return false;
 
-    flags = value.u32;
+    hdr->flags = value.u32;
 
     if (!mrp_msg_iterate(req, pcurs, &tag, &type, &value, &size) ||
         tag != RESPROTO_RESOURCE_PRIORITY || type != MRP_MSG_FIELD_UINT32)
-        goto reply;
+        return false;
 
-    priority = value.u32;
+    hdr->priority = value.u32;
 
     if (!mrp_msg_iterate(req, pcurs, &tag, &type, &value, &size) ||
         tag != RESPROTO_CLASS_NAME || type != MRP_MSG_FIELD_STRING)
-        goto reply;
+        return false;
 
-    class = value.str;
+    hdr->class = value.str;
 
     if (!mrp_msg_iterate(req, pcurs, &tag, &type, &value, &size) ||
         tag != RESPROTO_ZONE_NAME || type != MRP_MSG_FIELD_STRING)
-        goto reply;
+        return false;
 
-    zone = value.str;
+    hdr->zone = value.str;
 
     mrp_log_info("resource-set flags:%u priority:%u class:'%s' zone:'%s'",
-                 flags, priority, class, zone);
+                 hdr->flags, hdr->priority, hdr->class, hdr->zone);
+
+    return true;
+}
+
+
+/*
+ * Create a resource set with the given header, populate it with add and
+ * reply with the outcome. A NULL header means the request was invalid.
+ */
+static void create_set_and_reply(client_t *client, uint32_t seqno,
+                                 set_header_t *hdr, add_resources_cb_t add,
+                                 void *add_data)
+{
+    static uint16_t reqtyp = RESPROTO_CREATE_RESOURCE_SET;
+
+    resource_data_t        *data   = client->data;
+    mrp_plugin_t           *plugin = data->plugin;
+    mrp_resource_set_t     *rset   = 0;
+    mrp_msg_t              *rpl;
+    uint32_t                rsid;
+    int32_t                 status;
+    bool                    auto_release;
+    bool                    auto_acquire;
+    bool                    dont_wait;
+    mrp_resource_event_cb_t event_cb;
+
+    rsid = MRP_RESOURCE_ID_INVALID;
+    status = EINVAL;
 
-    auto_release = (flags & RESPROTO_RSETFLAG_AUTORELEASE);
-    auto_acquire = (flags & RESPROTO_RSETFLAG_AUTOACQUIRE);
-    dont_wait    = (flags & RESPROTO_RSETFLAG_DONTWAIT);
+    if (!hdr)
+        goto reply;
+
+    auto_release = (hdr->flags & RESPROTO_RSETFLAG_AUTORELEASE);
+    auto_acquire = (hdr->flags & RESPROTO_RSETFLAG_AUTOACQUIRE);
+    dont_wait    = (hdr->flags & RESPROTO_RSETFLAG_DONTWAIT);
 
-    if (flags & RESPROTO_RSETFLAG_NOEVENTS)
+    if (hdr->flags & RESPROTO_RSETFLAG_NOEVENTS)
         event_cb = NULL;
     else
         event_cb = resource_event_handler;
 
     rset = mrp_resource_set_create(client->rscli, auto_release, dont_wait,
-                                   priority, event_cb, client);
+                                   hdr->priority, event_cb, client);
     if (!rset)
         goto reply;
 
     rsid = mrp_get_resource_set_id(rset);
+    publish_state(client, rsid, RESPROTO_RELEASE, 0, 0);
 
-    while ((arst = read_resource(rset, req, pcurs)) == 0)
-        ;
+    /* hold back events until the client has got the set id */
+    mrp_resource_client_block_events(client->rscli);
 
-    if (arst > 0) {
+    if (add(rset, add_data)) {
         if (auto_acquire)
             mrp_resource_set_acquire(rset,seqno);
-        if (mrp_application_class_add_resource_set(class,zone,rset,seqno) == 0)
+        if (mrp_application_class_add_resource_set(hdr->class, hdr->zone,
+                                                   rset, seqno) == 0)
             status = 0;
     }
 
  reply:
-    rpl = mrp_msg_create(MRP_MSG_TAG_UINT32( RESPROTO_SEQUENCE_NO    , seqno ),
+    rpl = mrp_msg_create_arena(mrp_mainloop_arena(plugin->ctx->ml),
+                         MRP_MSG_TAG_UINT32( RESPROTO_SEQUENCE_NO    , seqno ),
                          MRP_MSG_TAG_UINT16( RESPROTO_REQUEST_TYPE   , reqtyp),
                          MRP_MSG_TAG_SINT16( RESPROTO_REQUEST_STATUS , status),
                          MRP_MSG_TAG_UINT32( RESPROTO_RESOURCE_SET_ID, rsid  ),
                          RESPROTO_MESSAGE_END                                );
-    if (!rpl || !mrp_transport_send(client->transp, rpl)) {
+    if (!rpl || !mrp_transport_send(client->transp, rpl))
         mrp_log_error("%s: failed to send reply", plugin->instance);
-        return;
-    }
 
-    mrp_msg_unref(rpl);
+    if (rpl)
+        mrp_msg_unref(rpl);
 
-    if (status != 0)
+    if (status != 0 && rset != NULL) {
+        unpublish_state(client, rsid);
         mrp_resource_set_destroy(rset);
+    }
+
+    if (rset != NULL)
+        mrp_resource_client_allow_events(client->rscli);
 }
 
-static void destroy_resource_set_request(client_t *client, mrp_msg_t *req,
-                                         void **pcurs)
+
+typedef struct {
+    mrp_msg_t  *req;
+    void      **pcurs;
+} msg_resources_t;
+
+static bool add_resources_from_msg(mrp_resource_set_t *rset, void *user_data)
 {
-    uint16_t            tag;
-    uint16_t            type;
-    size_t              size;
-    mrp_msg_value_t     value;
-    uint32_t            rset_id;
-    mrp_resource_set_t *rset;
+    msg_resources_t *src = (msg_resources_t *)user_data;
+    int              arst;
+
+    while ((arst = read_resource(rset, src->req, src->pcurs)) == 0)
+        ;
+
+    return arst > 0;
+}
+
+
+static void create_resource_set_request(client_t *client, mrp_msg_t *req,
+                                        uint32_t seqno, void **pcurs)
+{
+    set_header_t    hdr;
+    msg_resources_t src;
 
     MRP_ASSERT(client, "invalid argument");
     MRP_ASSERT(client->rscli, "confused with data structures");
 
-    if (!mrp_msg_iterate(req, pcurs, &tag, &type, &value, &size) ||
-        tag != RESPROTO_RESOURCE_SET_ID || type != MRP_MSG_FIELD_UINT32)
-    {
-        reply_with_status(client, req, EINVAL);
-        return;
-    }
+    src.req   = req;
+    src.pcurs = pcurs;
 
-    rset_id = value.u32;
+    create_set_and_reply(client, seqno,
+                         read_set_header(req, pcurs, &hdr) ? &hdr : NULL,
+                         add_resources_from_msg, &src);
+}
+
+
+/*
+ * resource set templates
+ */
+
+static rset_tmpl_t *find_set_template(client_t *client, uint32_t id,
+                                      const char *name)
+{
+    mrp_list_hook_t *p, *n;
+    rset_tmpl_t     *t;
+
+    mrp_list_foreach(&client->templates, p, n) {
+        t = mrp_list_entry(p, typeof(*t), hook);
+
+        if (name ? !strcmp(t->name, name) : t->id == id)
+            return t;
+    }
+
+    return NULL;
+}
+
+
+static void free_set_template(rset_tmpl_t *t)
+{
+    tmpl_resource_t *r;
+    uint32_t         i, j;
+
+    if (t == NULL)
+        return;
+
+    mrp_list_delete(&t->hook);
+
+    for (i = 0, r = t->res;  i < t->nres;  i++, r++) {
+        for (j = 0;  j < r->nattr;  j++) {
+            mrp_free((char *)r->attrs[j].name);
+            if (r->attrs[j].type == mqi_string)
+                mrp_free((char *)r->attrs[j].value.string);
+        }
+        mrp_free(r->attrs);
+        mrp_free(r->name);
+    }
+
+    mrp_free((char *)t->hdr.class);
+    mrp_free((char *)t->hdr.zone);
+    mrp_free(t->name);
+    mrp_free(t);
+}
+
+
+static void purge_set_templates(client_t *client)
+{
+    mrp_list_hook_t *p, *n;
+
+    mrp_list_foreach(&client->templates, p, n)
+        free_set_template(mrp_list_entry(p, rset_tmpl_t, hook));
+}
+
+
+/* check a resource against the definitions and store it in the template */
+static int add_template_resource(rset_tmpl_t *t, const char *name, bool mand,
+                                 bool shared, mrp_attr_t *attrs)
+{
+    tmpl_resource_t *r;
+    uint32_t         rid, n, i;
+
+    if (t->nres >= MRP_RESOURCE_MAX)
+        return E2BIG;
+
+    rid = mrp_resource_definition_get_resource_id_by_name(name);
+
+    if (rid == MRP_RESOURCE_ID_INVALID)
+        return ENOENT;
+
+    for (n = 0;  attrs[n].name;  n++) {
+        if (mrp_resource_definition_get_attribute_id_by_name(rid,
+                             attrs[n].name) == MRP_ATTRIBUTE_ID_INVALID)
+            return ENOENT;
+    }
+
+    r = t->res + t->nres++;
+
+    r->mandatory = mand;
+    r->shared    = shared;
+    r->name      = mrp_strdup(name);
+    r->attrs     = mrp_allocz_array(mrp_attr_t, n + 1);
+
+    if (!r->name || !r->attrs)
+        return ENOMEM;
+
+    for (i = 0;  i < n;  i++) {
+        r->attrs[i]      = attrs[i];
+        r->attrs[i].name = mrp_strdup(attrs[i].name);
+
+        if (attrs[i].type == mqi_string)
+            r->attrs[i].value.string = mrp_strdup(attrs[i].value.string);
+
+        r->nattr++;
+
+        if (!r->attrs[i].name ||
+            (attrs[i].type == mqi_string && !r->attrs[i].value.string))
+            return ENOMEM;
+    }
+
+    return 0;
+}
+
+
+static void register_template_request(client_t *client, mrp_msg_t *req,
+                                      uint32_t seqno, void **pcurs)
+{
+    static uint16_t reqtyp = RESPROTO_REGISTER_TEMPLATE;
+
+    resource_data_t *data   = client->data;
+    mrp_plugin_t    *plugin = data->plugin;
+    rset_tmpl_t     *t      = NULL;
+    mrp_msg_t       *rpl;
+    uint16_t         tag;
+    uint16_t         type;
+    size_t           size;
+    mrp_msg_value_t  value;
+    set_header_t     hdr;
+    const char      *name;
+    bool             mand;
+    bool             shared;
+    mrp_attr_t       attrs[ATTRIBUTE_MAX + 1];
+    uint32_t         id;
+    int32_t          status;
+    int              arst;
+
+    MRP_ASSERT(client, "invalid argument");
+
+    id     = 0;
+    status = EINVAL;
+
+    if (!mrp_msg_iterate(req, pcurs, &tag, &type, &value, &size) ||
+        tag != RESPROTO_TEMPLATE_NAME || type != MRP_MSG_FIELD_STRING)
+        goto reply;
+
+    if ((t = find_set_template(client, 0, value.str)) != NULL) {
+        id     = t->id;
+        status = 0;
+        t      = NULL;
+        goto reply;
+    }
+
+    if (!(t = mrp_allocz(sizeof(*t)))) {
+        status = ENOMEM;
+        goto reply;
+    }
+
+    mrp_list_init(&t->hook);
+    t->name = mrp_strdup(value.str);
+
+    if (!read_set_header(req, pcurs, &hdr))
+        goto reply;
+
+    t->hdr.flags    = hdr.flags;
+    t->hdr.priority = hdr.priority;
+    t->hdr.class    = mrp_strdup(hdr.class);
+    t->hdr.zone     = mrp_strdup(hdr.zone);
+
+    if (!t->name || !t->hdr.class || !t->hdr.zone) {
+        status = ENOMEM;
+        goto reply;
+    }
+
+    while ((arst = read_resource_spec(req, pcurs, &name, &mand, &shared,
+                                      attrs)) != RESOURCE_LAST) {
+        if (arst <= 0)
+            goto reply;
+
+        if ((status = add_template_resource(t, name, mand, shared, attrs)))
+            goto reply;
+
+        status = EINVAL;
+    }
+
+    t->id  = ++client->next_tmpl;
+    id     = t->id;
+    status = 0;
+
+    mrp_list_append(&client->templates, &t->hook);
+    t = NULL;
+
+    mrp_log_info("%s: registered resource set template %u",
+                 plugin->instance, id);
+
+ reply:
+    free_set_template(t);
+
+    rpl = mrp_msg_create_arena(mrp_mainloop_arena(plugin->ctx->ml),
+                         MRP_MSG_TAG_UINT32( RESPROTO_SEQUENCE_NO    , seqno ),
+                         MRP_MSG_TAG_UINT16( RESPROTO_REQUEST_TYPE   , reqtyp),
+                         MRP_MSG_TAG_SINT16( RESPROTO_REQUEST_STATUS , status),
+                         MRP_MSG_TAG_UINT32( RESPROTO_TEMPLATE_ID    , id    ),
+                         RESPROTO_MESSAGE_END                                );
+
+    if (!rpl || !mrp_transport_send(client->transp, rpl))
+        mrp_log_error("%s: failed to send reply", plugin->instance);
+
+    if (rpl)
+        mrp_msg_unref(rpl);
+}
+
+
+typedef struct {
+    rset_tmpl_t  *tmpl;
+    mrp_attr_t  **attrs;
+} tmpl_resources_t;
+
+static bool add_resources_from_template(mrp_resource_set_t *rset,
+                                        void *user_data)
+{
+    tmpl_resources_t *src = (tmpl_resources_t *)user_data;
+    tmpl_resource_t  *r;
+    uint32_t          i;
+
+    for (i = 0, r = src->tmpl->res;  i < src->tmpl->nres;  i++, r++) {
+        if (mrp_resource_set_add_resource(rset, r->name, r->shared,
+                                          src->attrs[i], r->mandatory) < 0)
+            return false;
+    }
+
+    return true;
+}
+
+
+/* apply the attribute overrides of the request on copies of the template */
+static bool read_overrides(rset_tmpl_t *t, mrp_msg_t *req, void **pcurs,
+                           mrp_attr_t **attrs, uint32_t *nattr,
+                           mrp_attr_t **bufp)
+{
+    uint16_t         tag;
+    uint16_t         type;
+    size_t           size;
+    mrp_msg_value_t  value;
+    mrp_attr_t       attr, *a;
+    tmpl_resource_t *r;
+    uint32_t         rid, i, j;
+    int              arst;
+
+    while (mrp_msg_iterate(req, pcurs, &tag, &type, &value, &size)) {
+        if (tag != RESPROTO_RESOURCE_NAME || type != MRP_MSG_FIELD_STRING)
+            return false;
+
+        for (i = 0, r = t->res;  i < t->nres;  i++, r++)
+            if (!strcmp(r->name, value.str))
+                break;
+
+        if (i >= t->nres)
+            return false;
+
+        if (attrs[i] == r->attrs) {
+            if (*bufp == NULL) {
+                *bufp = mrp_allocz_array(mrp_attr_t,
+                                         t->nres * (ATTRIBUTE_MAX + 1));
+                if (*bufp == NULL)
+                    return false;
+            }
+
+            attrs[i] = *bufp + i * (ATTRIBUTE_MAX + 1);
+            memcpy(attrs[i], r->attrs, (r->nattr + 1) * sizeof(mrp_attr_t));
+        }
+
+        rid = mrp_resource_definition_get_resource_id_by_name(r->name);
+
+        while ((arst = read_attribute(req, &attr, pcurs)) == ATTRIBUTE_OK) {
+            if (mrp_resource_definition_get_attribute_id_by_name(rid,
+                                  attr.name) == MRP_ATTRIBUTE_ID_INVALID)
+                return false;
+
+            for (j = 0, a = attrs[i];  j < nattr[i];  j++, a++)
+                if (!strcmp(a->name, attr.name))
+                    break;
+
+            if (j >= nattr[i]) {
+                if (nattr[i] >= ATTRIBUTE_MAX)
+                    return false;
+                nattr[i]++;
+            }
+
+            *a = attr;
+        }
+
+        if (arst != ATTRIBUTE_LAST)
+            return false;
+
+        memset(attrs[i] + nattr[i], 0, sizeof(mrp_attr_t));
+    }
+
+    return true;
+}
+
+
+static void create_from_template_request(client_t *client, mrp_msg_t *req,
+                                         uint32_t seqno, void **pcurs)
+{
+    uint16_t          tag;
+    uint16_t          type;
+    size_t            size;
+    mrp_msg_value_t   value;
+    rset_tmpl_t      *t;
+    mrp_attr_t       *attrs[MRP_RESOURCE_MAX];
+    uint32_t          nattr[MRP_RESOURCE_MAX];
+    mrp_attr_t       *buf;
+    tmpl_resources_t  src;
+    uint32_t          i;
+    bool              ok;
+
+    MRP_ASSERT(client, "invalid argument");
+    MRP_ASSERT(client->rscli, "confused with data structures");
+
+    t   = NULL;
+    buf = NULL;
+    ok  = false;
+
+    if (mrp_msg_iterate(req, pcurs, &tag, &type, &value, &size) &&
+        tag == RESPROTO_TEMPLATE_ID && type == MRP_MSG_FIELD_UINT32)
+        t = find_set_template(client, value.u32, NULL);
+
+    if (t != NULL) {
+        for (i = 0;  i < t->nres;  i++) {
+            attrs[i] = t->res[i].attrs;
+            nattr[i] = t->res[i].nattr;
+        }
+
+        ok = read_overrides(t, req, pcurs, attrs, nattr, &buf);
+    }
+
+    src.tmpl  = t;
+    src.attrs = attrs;
+
+    create_set_and_reply(client, seqno, ok ? &t->hdr : NULL,
+                         add_resources_from_template, &src);
+
+    mrp_free(buf);
+}
+
+
+static void unregister_template_request(client_t *client, mrp_msg_t *req,
+                                        uint32_t seqno, void **pcurs)
+{
+    uint16_t         tag;
+    uint16_t         type;
+    size_t           size;
+    mrp_msg_value_t  value;
+    rset_tmpl_t     *t;
+    int32_t          status;
+
+    MRP_UNUSED(seqno);
+
+    if (!mrp_msg_iterate(req, pcurs, &tag, &type, &value, &size) ||
+        tag != RESPROTO_TEMPLATE_ID || type != MRP_MSG_FIELD_UINT32)
+        status = EINVAL;
+    else if (!(t = find_set_template(client, value.u32, NULL)))
+        status = ENOENT;
+    else {
+        free_set_template(t);
+        status = 0;
+    }
+
+    reply_with_status(client, req, status);
+}
+
+
+/*
+ * resource owner subscriptions
+ */
+
+static bool read_owner_spec(mrp_msg_t *req, void **pcurs, uint32_t *zoneidp,
+                            uint32_t *residp)
+{
+    uint16_t         tag;
+    uint16_t         type;
+    size_t           size;
+    mrp_msg_value_t  value;
+
+    if (!mrp_msg_iterate(req, pcurs, &tag, &type, &value, &size) ||
+        tag != RESPROTO_ZONE_NAME || type != MRP_MSG_FIELD_STRING)
+        return false;
+
+    *zoneidp = mrp_zone_get_id_by_name(value.str);
+
+    if (!mrp_msg_iterate(req, pcurs, &tag, &type, &value, &size) ||
+        tag != RESPROTO_RESOURCE_NAME || type != MRP_MSG_FIELD_STRING)
+        return false;
+
+    *residp = mrp_resource_definition_get_resource_id_by_name(value.str);
+
+    return true;
+}
+
+
+static owner_sub_t *find_owner_sub(client_t *client, uint32_t zoneid,
+                                   uint32_t resid)
+{
+    mrp_list_hook_t *p, *n;
+    owner_sub_t     *s;
+
+    mrp_list_foreach(&client->owner_subs, p, n) {
+        s = mrp_list_entry(p, typeof(*s), hook);
+
+        if (s->zoneid == zoneid && s->resid == resid)
+            return s;
+    }
+
+    return NULL;
+}
+
+
+static void free_owner_sub(owner_sub_t *s)
+{
+    mrp_list_delete(&s->hook);
+    mrp_resource_owner_unwatch(s->watch);
+    mrp_free(s);
+}
+
+
+static void purge_owner_subs(client_t *client)
+{
+    mrp_list_hook_t *p, *n;
+
+    mrp_list_foreach(&client->owner_subs, p, n)
+        free_owner_sub(mrp_list_entry(p, owner_sub_t, hook));
+}
+
+
+static bool append_owner(mrp_msg_t *msg, uint32_t zoneid, uint32_t resid,
+                         mrp_resource_set_t *owner)
+{
+    uint32_t    rset_id = owner ? mrp_get_resource_set_id(owner) : 0;
+    const char *class   = owner && owner->class.ptr ?
+        mrp_application_class_get_name(owner->class.ptr) : "";
+
+    return
+        mrp_msg_append(msg, MRP_MSG_TAG_UINT32(RESPROTO_ZONE_ID, zoneid)) &&
+        mrp_msg_append(msg, MRP_MSG_TAG_UINT32(RESPROTO_RESOURCE_ID, resid)) &&
+        mrp_msg_append(msg, MRP_MSG_TAG_UINT32(RESPROTO_RESOURCE_SET_ID,
+                                               rset_id)) &&
+        mrp_msg_append(msg, MRP_MSG_TAG_STRING(RESPROTO_CLASS_NAME, class));
+}
+
+
+static void owner_changed(uint32_t zoneid, uint32_t resid,
+                          mrp_resource_set_t *owner, void *user_data)
+{
+    static uint16_t reqtyp = RESPROTO_OWNER_EVENT;
+
+    owner_sub_t     *s      = (owner_sub_t *)user_data;
+    client_t        *client = s->client;
+    mrp_plugin_t    *plugin = client->data->plugin;
+    mrp_msg_t       *msg;
+
+    msg = mrp_msg_create_arena(mrp_mainloop_arena(plugin->ctx->ml),
+                         MRP_MSG_TAG_UINT32( RESPROTO_SEQUENCE_NO    , 0     ),
+                         MRP_MSG_TAG_UINT16( RESPROTO_REQUEST_TYPE   , reqtyp),
+                         RESPROTO_MESSAGE_END                                );
+
+    if (!msg || !append_owner(msg, zoneid, resid, owner) ||
+        !mrp_transport_send(client->transp, msg))
+        mrp_log_error("%s: failed to send owner event", plugin->instance);
+
+    if (msg)
+        mrp_msg_unref(msg);
+}
+
+
+static void subscribe_owner_request(client_t *client, mrp_msg_t *req,
+                                    void **pcurs)
+{
+    mrp_plugin_t *plugin = client->data->plugin;
+    owner_sub_t  *s;
+    uint32_t      zoneid, resid;
+    int16_t       status;
+
+    if (!read_owner_spec(req, pcurs, &zoneid, &resid))
+        status = EINVAL;
+    else if (zoneid == MRP_ZONE_ID_INVALID || resid == MRP_RESOURCE_ID_INVALID)
+        status = ENOENT;
+    else if ((s = find_owner_sub(client, zoneid, resid)) != NULL)
+        status = 0;
+    else if (!(s = mrp_allocz(sizeof(*s))))
+        status = ENOMEM;
+    else {
+        mrp_list_init(&s->hook);
+        s->client = client;
+        s->zoneid = zoneid;
+        s->resid  = resid;
+        s->watch  = mrp_resource_owner_watch(zoneid, resid, owner_changed, s);
+
+        if (s->watch != NULL) {
+            mrp_list_append(&client->owner_subs, &s->hook);
+            status = 0;
+        }
+        else {
+            mrp_free(s);
+            status = ENOMEM;
+        }
+    }
+
+    if (!mrp_msg_append(req, MRP_MSG_TAG_SINT16(RESPROTO_REQUEST_STATUS,
+                                                status)) ||
+        (status == 0 &&
+         !append_owner(req, zoneid, resid,
+                       mrp_resource_owner_get_set(zoneid, resid))) ||
+        !mrp_transport_send(client->transp, req))
+        mrp_log_error("%s: failed to create or send reply", plugin->instance);
+}
+
+
+static void unsubscribe_owner_request(client_t *client, mrp_msg_t *req,
+                                      void **pcurs)
+{
+    owner_sub_t *s;
+    uint32_t     zoneid, resid;
+    int16_t      status;
+
+    if (!read_owner_spec(req, pcurs, &zoneid, &resid))
+        status = EINVAL;
+    else if (!(s = find_owner_sub(client, zoneid, resid)))
+        status = ENOENT;
+    else {
+        free_owner_sub(s);
+        status = 0;
+    }
+
+    reply_with_status(client, req, status);
+}
+
+
+static void destroy_resource_set_request(client_t *client, mrp_msg_t *req,
+                                         void **pcurs)
+{
+    uint16_t            tag;
+    uint16_t            type;
+    size_t              size;
+    mrp_msg_value_t     value;
+    uint32_t            rset_id;
+    mrp_resource_set_t *rset;
+
+    MRP_ASSERT(client, "invalid argument");
+    MRP_ASSERT(client->rscli, "confused with data structures");
+
+    if (!mrp_msg_iterate(req, pcurs, &tag, &type, &value, &size) ||
+        tag != RESPROTO_RESOURCE_SET_ID || type != MRP_MSG_FIELD_UINT32)
+    {
+        reply_with_status(client, req, EINVAL);
+        return;
+    }
+
+    rset_id = value.u32;
 
     if (!(rset = mrp_resource_client_find_set(client->rscli, rset_id))) {
         reply_with_status(client, req, ENOENT);
@@ -721,6 +1536,8 @@ static void destroy_resource_set_request(client_t *client, mrp_msg_t *req,
     reply_with_status(client, req, 0);
 
     mrp_resource_set_destroy(rset);
+    drop_event_template(client, rset_id);
+    unpublish_state(client, rset_id);
 }
 
 
@@ -752,6 +1569,7 @@ static void acquire_resource_set_request(client_t *client, mrp_msg_t *req,
         return;
     }
 
+    mrp_resource_set_stamp_request(rset);
     reply_with_status(client, req, 0);
 
     if (acquire)
@@ -760,13 +1578,90 @@ static void acquire_resource_set_request(client_t *client, mrp_msg_t *req,
         mrp_resource_set_release(rset, seqno);
 }
 
+static void batch_request(client_t *client, mrp_msg_t *req, uint32_t seqno,
+                          void **pcurs)
+{
+    uint16_t            tag;
+    uint16_t            type;
+    size_t              size;
+    mrp_msg_value_t     value;
+    uint32_t            rset_id;
+    mrp_resource_set_t *rset;
+    void               *start;
+    int                 nreq;
+
+    MRP_ASSERT(client, "invalid argument");
+    MRP_ASSERT(client->rscli, "confused with data structures");
+
+    /*
+     * The request is a list of (resource set id, requested state) pairs.
+     * Check all of them before doing anything so that a batch is either
+     * applied as a whole or rejected as a whole.
+     */
+
+    start = *pcurs;
+    nreq  = 0;
+
+    while (mrp_msg_iterate(req, pcurs, &tag, &type, &value, &size)) {
+        if (tag != RESPROTO_RESOURCE_SET_ID || type != MRP_MSG_FIELD_UINT32) {
+            reply_with_status(client, req, EINVAL);
+            return;
+        }
+
+        rset_id = value.u32;
+
+        if (!mrp_msg_iterate(req, pcurs, &tag, &type, &value, &size) ||
+            tag != RESPROTO_RESOURCE_STATE || type != MRP_MSG_FIELD_UINT16 ||
+            (value.u16 != RESPROTO_ACQUIRE && value.u16 != RESPROTO_RELEASE))
+        {
+            reply_with_status(client, req, EINVAL);
+            return;
+        }
+
+        if (!mrp_resource_client_find_set(client->rscli, rset_id)) {
+            reply_with_status(client, req, ENOENT);
+            return;
+        }
+
+        nreq++;
+    }
+
+    if (!nreq) {
+        reply_with_status(client, req, EINVAL);
+        return;
+    }
+
+    reply_with_status(client, req, 0);
+
+    *pcurs = start;
+
+    mrp_resource_set_begin_batch();
+
+    while (nreq-- > 0) {
+        mrp_msg_iterate(req, pcurs, &tag, &type, &value, &size);
+        rset_id = value.u32;
+        mrp_msg_iterate(req, pcurs, &tag, &type, &value, &size);
+
+        if (!(rset = mrp_resource_client_find_set(client->rscli, rset_id)))
+            continue;
+
+        if (value.u16 == RESPROTO_ACQUIRE)
+            mrp_resource_set_acquire(rset, seqno);
+        else
+            mrp_resource_set_release(rset, seqno);
+    }
+
+    mrp_resource_set_commit_batch();
+}
+
 static void connection_evt(mrp_transport_t *listen, void *user_data)
 {
     static uint32_t  id;
 
     resource_data_t *data   = (resource_data_t *)user_data;
     mrp_plugin_t    *plugin = data->plugin;
-    int              flags  = MRP_TRANSPORT_REUSEADDR | MRP_TRANSPORT_NONBLOCK;
+    int              flags  = MRP_TRANSPORT_REUSEADDR | MRP_TRANSPORT_NONBLOCK |
+                              MRP_TRANSPORT_ARENA;
     client_t        *client = mrp_allocz(sizeof(client_t));
     char             name[256];
 
@@ -777,13 +1672,18 @@ static void connection_evt(mrp_transport_t *listen, void *user_data)
     }
 
     client->data = data;
+    mrp_list_init(&client->events);
+    mrp_list_init(&client->templates);
+    mrp_list_init(&client->owner_subs);
 
     snprintf(name, sizeof(name), "client%u", (client->id = ++id));
+    client->mmtag = mrp_mm_tag_create(name, data->mmtag);
     client->rscli = mrp_resource_client_create(name, client);
 
     if (!(client->transp = mrp_transport_accept(listen, client, flags))) {
         mrp_log_error("%s: failed to accept new connection", plugin->instance);
         mrp_resource_client_destroy(client->rscli);
+        mrp_mm_tag_destroy(client->mmtag);
         mrp_free(client);
         return;
     }
@@ -808,6 +1708,11 @@ static void closed_evt(mrp_transport_t *transp, int error, void *user_data)
         mrp_log_info("%s: peer closed connection", plugin->instance);
 
     mrp_resource_client_destroy(client->rscli);
+    purge_event_templates(client);
+    purge_set_templates(client);
+    purge_owner_subs(client);
+    unpublish_client_states(client);
+    mrp_mm_tag_destroy(client->mmtag);
 
     mrp_list_delete(&client->list);
     mrp_free(client);
@@ -832,6 +1737,7 @@ static void recvfrom_msg(mrp_transport_t *transp, mrp_msg_t *msg,
     uint16_t                type;
     size_t                  size;
     mrp_msg_value_t         value;
+    mrp_mm_tag_t           *mmtag;
 
 
     MRP_UNUSED(addr);
@@ -839,6 +1745,9 @@ static void recvfrom_msg(mrp_transport_t *transp, mrp_msg_t *msg,
 
     MRP_ASSERT(client->transp == transp, "confused with data structures");
 
+    /* charge whatever the request allocates to the requesting client */
+    mmtag = mrp_mm_tag_set(client->mmtag);
+
     mrp_log_info("%s: received a message", plugin->instance);
     mrp_msg_dump(msg, stdout);
 
@@ -849,7 +1758,7 @@ static void recvfrom_msg(mrp_transport_t *transp, mrp_msg_t *msg,
     else {
         mrp_log_warning("%s: malformed message. Bad or missing "
                         "sequence number", plugin->instance);
-        return;
+        goto out;
     }
 
     if (mrp_msg_iterate(msg, &cursor, &tag, &type, &value, &size) &&
@@ -858,21 +1767,21 @@ static void recvfrom_msg(mrp_transport_t *transp, mrp_msg_t *msg,
     else {
         mrp_log_warning("%s: malformed message. Bad or missing "
                         "request type", plugin->instance);
-        return;
+        goto out;
     }
 
     switch (reqtyp) {
 
     case RESPROTO_QUERY_RESOURCES:
-        query_resources_request(client, msg);
+        query_request(client, msg, seqno, reqtyp, write_resources);
         break;
 
     case RESPROTO_QUERY_CLASSES:
-        query_classes_request(client, msg);
+        query_request(client, msg, seqno, reqtyp, write_classes);
         break;
 
     case RESPROTO_QUERY_ZONES:
-        query_zones_request(client, msg);
+        query_request(client, msg, seqno, reqtyp, write_zones);
         break;
 
     case RESPROTO_CREATE_RESOURCE_SET:
@@ -891,11 +1800,38 @@ static void recvfrom_msg(mrp_transport_t *transp, mrp_msg_t *msg,
         acquire_resource_set_request(client, msg, seqno, false, &cursor);
         break;
 
+    case RESPROTO_BATCH_REQUEST:
+        batch_request(client, msg, seqno, &cursor);
+        break;
+
+    case RESPROTO_REGISTER_TEMPLATE:
+        register_template_request(client, msg, seqno, &cursor);
+        break;
+
+    case RESPROTO_CREATE_FROM_TEMPLATE:
+        create_from_template_request(client, msg, seqno, &cursor);
+        break;
+
+    case RESPROTO_UNREGISTER_TEMPLATE:
+        unregister_template_request(client, msg, seqno, &cursor);
+        break;
+
+    case RESPROTO_SUBSCRIBE_OWNER:
+        subscribe_owner_request(client, msg, &cursor);
+        break;
+
+    case RESPROTO_UNSUBSCRIBE_OWNER:
+        unsubscribe_owner_request(client, msg, &cursor);
+        break;
+
     default:
         mrp_log_warning("%s: unsupported request type %d",
                         plugin->instance, reqtyp);
         break;
     }
+
+ out:
+    mrp_mm_tag_set(mmtag);
 }
 
 static void recv_msg(mrp_transport_t *transp, mrp_msg_t *msg, void *user_data)
@@ -904,6 +1840,181 @@ static void recv_msg(mrp_transport_t *transp, mrp_msg_t *msg, void *user_data)
 }
 
 
+/*
+ * cached resource event templates
+ *
+ * Resource events for a set usually differ only in the sequence number,
+ * state and grant/advice masks. We keep the last event of each set
+ * pre-encoded and only patch these fields in place as long as everything
+ * else (the reported resources and their attributes) stays the same.
+ */
+
+static inline uint64_t fprint_data(uint64_t h, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+
+    while (size-- > 0) {
+        h ^= *p++;
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+
+static inline uint64_t fprint_str(uint64_t h, const char *str)
+{
+    return fprint_data(h, str ? str : "", (str ? strlen(str) : 0) + 1);
+}
+
+
+static uint64_t fprint_attributes(uint64_t h, mrp_attr_t *attrs)
+{
+    mrp_attr_t *a;
+
+    for (a = attrs;  a->name;  a++) {
+        h = fprint_str(h, a->name);
+        h = fprint_data(h, &a->type, sizeof(a->type));
+
+        switch (a->type) {
+        case mqi_string:
+            h = fprint_str(h, a->value.string);
+            break;
+        case mqi_integer:
+            h = fprint_data(h, &a->value.integer, sizeof(a->value.integer));
+            break;
+        case mqi_unsignd:
+            h = fprint_data(h, &a->value.unsignd, sizeof(a->value.unsignd));
+            break;
+        case mqi_floating:
+            h = fprint_data(h, &a->value.floating, sizeof(a->value.floating));
+            break;
+        default:
+            break;
+        }
+    }
+
+    return h;
+}
+
+
+static event_tmpl_t *find_event_template(client_t *client, uint32_t rset_id)
+{
+    mrp_list_hook_t *p, *n;
+    event_tmpl_t    *e;
+
+    mrp_list_foreach(&client->events, p, n) {
+        e = mrp_list_entry(p, typeof(*e), hook);
+
+        if (e->rset_id == rset_id)
+            return e;
+    }
+
+    return NULL;
+}
+
+
+static void free_event_template(event_tmpl_t *e)
+{
+    mrp_list_delete(&e->hook);
+    mrp_msg_tmpl_destroy(e->tmpl);
+    mrp_free(e);
+}
+
+
+static void drop_event_template(client_t *client, uint32_t rset_id)
+{
+    event_tmpl_t *e;
+
+    if ((e = find_event_template(client, rset_id)) != NULL)
+        free_event_template(e);
+}
+
+
+static void purge_event_templates(client_t *client)
+{
+    mrp_list_hook_t *p, *n;
+
+    mrp_list_foreach(&client->events, p, n) {
+        free_event_template(mrp_list_entry(p, event_tmpl_t, hook));
+    }
+}
+
+
+static void store_event_template(client_t *client, uint32_t rset_id,
+                                 uint64_t fprint, mrp_msg_tmpl_t *tmpl)
+{
+    event_tmpl_t *e;
+
+    if ((e = find_event_template(client, rset_id)) == NULL) {
+        if ((e = mrp_allocz(sizeof(*e))) == NULL) {
+            mrp_msg_tmpl_destroy(tmpl);
+            return;
+        }
+
+        mrp_list_init(&e->hook);
+        mrp_list_append(&client->events, &e->hook);
+        e->rset_id = rset_id;
+    }
+    else
+        mrp_msg_tmpl_destroy(e->tmpl);
+
+    e->fprint = fprint;
+    e->tmpl   = tmpl;
+}
+
+
+static bool patch_event_template(mrp_msg_tmpl_t *tmpl, uint32_t reqid,
+                                 uint16_t state, mrp_resource_mask_t grant,
+                                 mrp_resource_mask_t advice, bool wide)
+{
+#define PATCH(tag, typ, val) \
+    mrp_msg_tmpl_set(tmpl, RESPROTO_##tag, MRP_MSG_FIELD_##typ, val)
+
+    if (!PATCH(SEQUENCE_NO   , UINT32, reqid) ||
+        !PATCH(RESOURCE_STATE, UINT16, state))
+        return false;
+
+    if (wide)
+        return
+            PATCH(RESOURCE_GRANT , UINT64, (uint64_t)grant ) &&
+            PATCH(RESOURCE_ADVICE, UINT64, (uint64_t)advice);
+    else
+        return
+            PATCH(RESOURCE_GRANT , UINT32, (uint32_t)grant ) &&
+            PATCH(RESOURCE_ADVICE, UINT32, (uint32_t)advice);
+
+#undef PATCH
+}
+
+
+/*
+ * Append the grant and advice masks of an event. They are sent as UINT32,
+ * which is all clients predating wider masks understand, unless the set
+ * uses resources above the first 32. As the width follows from the masks,
+ * which are part of the event fingerprint, a cached event template always
+ * has the width an event with a matching fingerprint needs.
+ */
+
+static bool append_event_masks(mrp_msg_t *msg, mrp_resource_mask_t grant,
+                               mrp_resource_mask_t advice, bool wide)
+{
+#define PUSH(m, tag, typ, val)    \
+    mrp_msg_append(m, MRP_MSG_TAG_##typ(RESPROTO_##tag, val))
+
+    if (wide)
+        return
+            PUSH(msg, RESOURCE_GRANT , UINT64, (uint64_t)grant ) &&
+            PUSH(msg, RESOURCE_ADVICE, UINT64, (uint64_t)advice);
+    else
+        return
+            PUSH(msg, RESOURCE_GRANT , UINT32, (uint32_t)grant ) &&
+            PUSH(msg, RESOURCE_ADVICE, UINT32, (uint32_t)advice);
+
+#undef PUSH
+}
+
+
 static void resource_event_handler(uint32_t reqid, mrp_resource_set_t *rset,
                                    void *userdata)
 {
@@ -921,9 +2032,14 @@ static void resource_event_handler(uint32_t reqid, mrp_resource_set_t *rset,
     mrp_resource_mask_t advice;
     mrp_resource_mask_t mask;
     mrp_resource_mask_t all;
+    bool                wide;
     mrp_msg_t          *msg;
+    mrp_msg_tmpl_t     *tmpl;
+    event_tmpl_t       *cached;
     mrp_resource_t     *res;
+    uint32_t            rset_id;
     uint32_t            id;
+    uint64_t            fprint;
     const char         *name;
     void               *curs;
     mrp_attr_t          attrs[ATTRIBUTE_MAX + 1];
@@ -932,29 +2048,71 @@ static void resource_event_handler(uint32_t reqid, mrp_resource_set_t *rset,
 
     data   = client->data;
     plugin = data->plugin;
+    msg    = NULL;
 
-    reqtyp = RESPROTO_RESOURCES_EVENT;
-    id     = mrp_get_resource_set_id(rset);
-    grant  = mrp_get_resource_set_grant(rset);
-    advice = mrp_get_resource_set_advice(rset);
+    reqtyp  = RESPROTO_RESOURCES_EVENT;
+    rset_id = mrp_get_resource_set_id(rset);
+    grant   = mrp_get_resource_set_grant(rset);
+    advice  = mrp_get_resource_set_advice(rset);
 
     if (mrp_get_resource_set_state(rset) == mrp_resource_acquire)
         state = RESPROTO_ACQUIRE;
     else
         state = RESPROTO_RELEASE;
 
-    msg = mrp_msg_create(FIELD( SEQUENCE_NO    , UINT32, reqid  ),
-                         FIELD( REQUEST_TYPE   , UINT16, reqtyp ),
-                         FIELD( RESOURCE_SET_ID, UINT32, id     ),
-                         FIELD( RESOURCE_STATE , UINT16, state  ),
-                         FIELD( RESOURCE_GRANT , UINT32, grant  ),
-                         FIELD( RESOURCE_ADVICE, UINT32, advice ),
-                         RESPROTO_MESSAGE_END                   );
+    all  = grant | advice;
+    wide = (all >> 32) != 0;
+
+    publish_state(client, rset_id, state, grant, advice);
+
+    /*
+     * Fingerprint the part of the event which is not patched in place.
+     * If it matches the cached template of the set, just patch and send
+     * the template.
+     */
+
+    fprint = fprint_data(0xcbf29ce484222325ULL, &all, sizeof(all));
+    curs   = NULL;
+
+    while ((res = mrp_resource_set_iterate_resources(rset, &curs))) {
+        mask = mrp_resource_get_mask(res);
+
+        if (!(all & mask))
+            continue;
+
+        id = mrp_resource_get_id(res);
+
+        if (!mrp_resource_read_all_attributes(res, ATTRIBUTE_MAX + 1, attrs))
+            goto failed;
+
+        fprint = fprint_data(fprint, &id, sizeof(id));
+        fprint = fprint_str(fprint, mrp_resource_get_name(res));
+        fprint = fprint_attributes(fprint, attrs);
+    }
+
+    cached = find_event_template(client, rset_id);
+
+    if (cached != NULL && cached->fprint == fprint) {
+        if (!patch_event_template(cached->tmpl, reqid, state, grant, advice,
+                                  wide))
+            goto failed;
+
+        if (!mrp_transport_sendtmpl(client->transp, cached->tmpl))
+            goto failed;
+
+        return;
+    }
+
+    msg = mrp_msg_create_arena(mrp_mainloop_arena(plugin->ctx->ml),
+                         FIELD( SEQUENCE_NO    , UINT32, reqid   ),
+                         FIELD( REQUEST_TYPE   , UINT16, reqtyp  ),
+                         FIELD( RESOURCE_SET_ID, UINT32, rset_id ),
+                         FIELD( RESOURCE_STATE , UINT16, state   ),
+                         RESPROTO_MESSAGE_END                    );
 
-    if (!msg)
+    if (!msg || !append_event_masks(msg, grant, advice, wide))
         goto failed;
 
-    all = grant | advice;
     curs = NULL;
 
     while ((res = mrp_resource_set_iterate_resources(rset, &curs))) {
@@ -977,8 +2135,18 @@ static void resource_event_handler(uint32_t reqid, mrp_resource_set_t *rset,
                  goto failed;
     }
 
-    if (!mrp_transport_send(client->transp, msg))
-        goto failed;
+    if ((tmpl = mrp_msg_tmpl_create(msg)) != NULL) {
+        store_event_template(client, rset_id, fprint, tmpl);
+
+        if (!mrp_transport_sendtmpl(client->transp, tmpl))
+            goto failed;
+    }
+    else {
+        drop_event_template(client, rset_id);
+
+        if (!mrp_transport_send(client->transp, msg))
+            goto failed;
+    }
 
     mrp_msg_unref(msg);
 
@@ -994,6 +2162,124 @@ static void resource_event_handler(uint32_t reqid, mrp_resource_set_t *rset,
 }
 
 
+/*
+ * resource set states in shared memory
+ *
+ * The state of each resource set is written to the segment before the
+ * corresponding event is sent, so local clients can read the current
+ * grant/advice of their sets without waiting for or asking the server.
+ */
+
+static void publish_state(client_t *client, uint32_t rset_id, uint32_t state,
+                          uint64_t grant, uint64_t advice)
+{
+    mrp_resproto_stateshm_t  *shm = client->data->shm;
+    mrp_resproto_stateslot_t *slot;
+
+    if (shm == NULL || rset_id == MRP_RESOURCE_ID_INVALID)
+        return;
+
+    slot = mrp_resproto_stateshm_slot(shm, rset_id);
+    mrp_resproto_stateshm_write(slot, rset_id, client->id,
+                                state, grant, advice);
+}
+
+
+static void unpublish_state(client_t *client, uint32_t rset_id)
+{
+    mrp_resproto_stateshm_t  *shm = client->data->shm;
+    mrp_resproto_stateslot_t *slot;
+
+    if (shm == NULL || rset_id == MRP_RESOURCE_ID_INVALID)
+        return;
+
+    slot = mrp_resproto_stateshm_slot(shm, rset_id);
+
+    if (slot->rset_id == rset_id)
+        mrp_resproto_stateshm_write(slot, 0, 0, RESPROTO_RELEASE, 0, 0);
+}
+
+
+static void unpublish_client_states(client_t *client)
+{
+    mrp_resproto_stateshm_t  *shm = client->data->shm;
+    mrp_resproto_stateslot_t *slot;
+    uint32_t                  i;
+
+    if (shm == NULL)
+        return;
+
+    for (i = 0;  i < RESPROTO_STATESHM_NSLOT;  i++) {
+        slot = shm->slots + i;
+
+        if (slot->rset_id != 0 && slot->owner == client->id)
+            mrp_resproto_stateshm_write(slot, 0, 0, RESPROTO_RELEASE, 0, 0);
+    }
+}
+
+
+static int initiate_state_segment(mrp_plugin_t *plugin)
+{
+    resource_data_t *data = (resource_data_t *)plugin->data;
+    const char      *name = mrp_resource_get_default_stateshm();
+    size_t           size = sizeof(*data->shm);
+    void            *shm;
+    int              fd;
+
+    if (!plugin->args[ARG_STATESHM].bln)
+        return 0;
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+        mrp_log_error("%s: failed to create state segment '%s' (%d: %s)",
+                      plugin->instance, name, errno, strerror(errno));
+        return -1;
+    }
+
+    if (ftruncate(fd, size) < 0)
+        shm = MAP_FAILED;
+    else
+        shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (shm == MAP_FAILED) {
+        mrp_log_error("%s: failed to map state segment '%s' (%d: %s)",
+                      plugin->instance, name, errno, strerror(errno));
+        shm_unlink(name);
+        return -1;
+    }
+
+    data->shm     = shm;
+    data->shmname = name;
+
+    data->shm->nslot = RESPROTO_STATESHM_NSLOT;
+    __atomic_store_n(&data->shm->magic, RESPROTO_STATESHM_MAGIC,
+                     __ATOMIC_RELEASE);
+
+    mrp_log_info("%s: publishing resource set states in '%s'",
+                 plugin->instance, name);
+
+    return 0;
+}
+
+
+static void cleanup_state_segment(mrp_plugin_t *plugin)
+{
+    resource_data_t *data = (resource_data_t *)plugin->data;
+
+    if (data == NULL || data->shm == NULL)
+        return;
+
+    munmap(data->shm, sizeof(*data->shm));
+    shm_unlink(data->shmname);
+
+    data->shm     = NULL;
+    data->shmname = NULL;
+}
+
+
 
 static int initiate_transport(mrp_plugin_t *plugin)
 {
@@ -1010,6 +2296,8 @@ static int initiate_transport(mrp_plugin_t *plugin)
     const char       *addr  = args[ARG_ADDRESS].str;
     int               flags = MRP_TRANSPORT_REUSEADDR;
     bool              stream;
+    int               cork  = TRUE;
+    int               fd;
 
     if (addr == NULL)
         addr = mrp_resource_get_default_address();
@@ -1032,6 +2320,32 @@ static int initiate_transport(mrp_plugin_t *plugin)
         evt.closed = closed_evt;
     }
 
+    /* use the socket if we were socket-activated, clients queue up on it */
+    fd = mrp_activated_socket(plugin->instance, &data->saddr.any, data->alen);
+
+    if (fd >= 0) {
+        data->listen = mrp_transport_create_from(ctx->ml, data->atyp, &fd,
+                                                 &evt, data, flags,
+                                                 stream ?
+                                                 MRP_TRANSPORT_LISTENED : 0);
+
+        if (!data->listen) {
+            mrp_log_error("%s: can't use socket-activated transport",
+                          plugin->instance);
+            return -1;
+        }
+
+        if (stream)
+            mrp_transport_setopt(data->listen, MRP_TRANSPORT_OPT_CORK, &cork);
+
+        mrp_log_info("%s: using socket-activated transport for %s",
+                     plugin->instance, addr);
+
+        mrp_handover_register(plugin->instance, &data->saddr.any, data->alen);
+
+        return 0;
+    }
+
     data->listen = mrp_transport_create(ctx->ml, data->atyp, &evt, data,flags);
 
     if (!data->listen) {
@@ -1039,6 +2353,10 @@ static int initiate_transport(mrp_plugin_t *plugin)
         return -1;
     }
 
+    /* coalesce the events of an arbitration pass per client connection */
+    if (stream)
+        mrp_transport_setopt(data->listen, MRP_TRANSPORT_OPT_CORK, &cork);
+
     if (!mrp_transport_bind(data->listen, &data->saddr, data->alen)) {
         mrp_log_error("%s: can't bind to address %s", plugin->instance, addr);
         return -1;
@@ -1051,6 +2369,8 @@ static int initiate_transport(mrp_plugin_t *plugin)
 
     mrp_log_info("%s: listening for connections on %s", plugin->instance,addr);
 
+    mrp_handover_register(plugin->instance, &data->saddr.any, data->alen);
+
     return 0;
 }
 
@@ -1062,6 +2382,51 @@ static void initiate_lua_configuration(mrp_plugin_t *plugin)
     mrp_resource_configuration_init();
 }
 
+static void end_configuration(mrp_plugin_t *plugin)
+{
+    resource_data_t *data = (resource_data_t *)plugin->data;
+
+    if (data->cfgw) {
+        mrp_event_del_watch(data->cfgw);
+        data->cfgw = NULL;
+
+        mrp_resource_configuration_end();
+    }
+}
+
+static void daemon_event_cb(mrp_event_watch_t *w, uint32_t id, int format,
+                            void *event_data, void *user_data)
+{
+    MRP_UNUSED(w);
+    MRP_UNUSED(id);
+    MRP_UNUSED(format);
+    MRP_UNUSED(event_data);
+
+    end_configuration((mrp_plugin_t *)user_data);
+}
+
+/*
+ * If we are loaded with the daemon configuration, batch the database
+ * work of the resource configuration until the configuration is loaded.
+ */
+static void begin_configuration(mrp_plugin_t *plugin)
+{
+    resource_data_t *data = (resource_data_t *)plugin->data;
+    mrp_event_bus_t *bus;
+
+    if (plugin->ctx->state != MRP_STATE_LOADING)
+        return;
+
+    if (!(bus = mrp_event_bus_get(plugin->ctx->ml, MRP_DAEMON_BUS)))
+        return;
+
+    data->cfgw = mrp_event_add_watch(bus, mrp_event_id(MRP_DAEMON_STARTING),
+                                     daemon_event_cb, plugin);
+
+    if (data->cfgw)
+        mrp_resource_configuration_begin();
+}
+
 static void event_cb(mrp_event_watch_t *w, uint32_t id, int format,
                      void *event_data, void *user_data)
 {
@@ -1097,6 +2462,7 @@ static void event_cb(mrp_event_watch_t *w, uint32_t id, int format,
 #endif
 
                     initiate_lua_configuration(plugin);
+                    initiate_state_segment(plugin);
                     initiate_transport(plugin);
                 }
             }
@@ -1172,12 +2538,19 @@ static int resource_init(mrp_plugin_t *plugin)
     }
 
     data->plugin = plugin;
+    data->mmtag  = mrp_mm_tag_create("resource", NULL);
     mrp_list_init(&data->clients);
 
     plugin->data = data;
 
+    if (mrp_resource_owner_set_arbiters(plugin->ctx->ml,
+                                        plugin->args[ARG_ARBITERS].i32) < 0)
+        mrp_log_warning("%s: failed to create zone arbiter threads, "
+                        "arbitrating zones serially.", plugin->instance);
+
     register_events(plugin);
     subscribe_events(plugin);
+    begin_configuration(plugin);
     initiate_lua_configuration(plugin);
 
     return TRUE;
@@ -1189,7 +2562,12 @@ static void resource_exit(mrp_plugin_t *plugin)
     mrp_log_info("%s() called for test instance '%s'...", __FUNCTION__,
                  plugin->instance);
 
+    end_configuration(plugin);
     unsubscribe_events(plugin);
+    cleanup_state_segment(plugin);
+    purge_query_replies(plugin->data);
+    mrp_resource_owner_set_arbiters(NULL, 0);
+    mrp_mm_tag_destroy(((resource_data_t *)plugin->data)->mmtag);
 }
 
 
@@ -1200,9 +2578,13 @@ static void resource_exit(mrp_plugin_t *plugin)
 
 #define DEF_CONFIG_FILE      "/etc/murphy/resource.conf"
 #define DEF_ADDRESS          NULL
+#define DEF_STATESHM         FALSE
+#define DEF_ARBITERS         0
 
 static mrp_plugin_arg_t args[] = {
-    MRP_PLUGIN_ARGIDX( ARG_ADDRESS, STRING, "address", DEF_ADDRESS ),
+    MRP_PLUGIN_ARGIDX( ARG_ADDRESS , STRING, "address"  , DEF_ADDRESS  ),
+    MRP_PLUGIN_ARGIDX( ARG_STATESHM, BOOL  , "state-shm", DEF_STATESHM ),
+    MRP_PLUGIN_ARGIDX( ARG_ARBITERS, INT32 , "arbiters" , DEF_ARBITERS ),
 };
 
 
@@ -581,7 +581,7 @@ static bool fetch_resource_set_state(mrp_msg_t *msg, void **pcursor,
 
 
 static bool fetch_resource_set_mask(mrp_msg_t *msg, void **pcursor,
-                                    int mask_type, mrp_resproto_state_t *pmask)
+                                    int mask_type, uint64_t *pmask)
 {
     uint16_t expected_tag;
     uint16_t tag;
@@ -595,14 +595,16 @@ static bool fetch_resource_set_mask(mrp_msg_t *msg, void **pcursor,
     default:       /* don't know what to fetch */              return false;
     }
 
+    /* masks are sent as UINT64 only if there are more than 32 resources */
     if (!mrp_msg_iterate(msg, pcursor, &tag, &type, &value, &size) ||
-        tag != expected_tag || type != MRP_MSG_FIELD_UINT32)
+        tag != expected_tag ||
+        (type != MRP_MSG_FIELD_UINT32 && type != MRP_MSG_FIELD_UINT64))
     {
         *pmask = 0;
         return false;
     }
 
-    *pmask = value.u32;
+    *pmask = type == MRP_MSG_FIELD_UINT32 ? value.u32 : value.u64;
     return true;
 }
 
@@ -903,7 +905,7 @@ static void resource_event(client_t *client, uint32_t seqno, mrp_msg_t *msg,
                            void **pcursor)
 {
     uint32_t rset;
-    uint32_t grant, advice;
+    uint64_t grant, advice;
     mrp_resproto_state_t state;
     const char *str_state;
     uint16_t tag;
@@ -915,7 +917,7 @@ static void resource_event(client_t *client, uint32_t seqno, mrp_msg_t *msg,
     attribute_t attrs[ATTRIBUTE_MAX + 1];
     attribute_array_t *list;
     char buf[4096];
-    uint32_t mask;
+    uint64_t mask;
     int cnt;
 
     printf("\nResource event (request no %u):\n", seqno);
@@ -934,8 +936,8 @@ static void resource_event(client_t *client, uint32_t seqno, mrp_msg_t *msg,
 
     printf("   resource-set ID  : %u\n"  , rset);
     printf("   state            : %s\n"  , str_state);
-    printf("   grant mask       : 0x%x\n", grant);
-    printf("   advice mask      : 0x%x\n", advice);
+    printf("   grant mask       : 0x%llx\n", (unsigned long long)grant);
+    printf("   advice mask      : 0x%llx\n", (unsigned long long)advice);
     printf("   resources        :");
 
     cnt = 0;
@@ -946,13 +948,13 @@ static void resource_event(client_t *client, uint32_t seqno, mrp_msg_t *msg,
             goto malformed;
 
         resid = value.u32;
-        mask  = (1UL <<  resid);
+        mask  = ((uint64_t)1 << resid);
 
         if (!cnt++)
             printf("\n");
 
         printf("      %02u name       : %s\n", resid, resnam);
-        printf("         mask       : 0x%x\n", mask);
+        printf("         mask       : 0x%llx\n", (unsigned long long)mask);
         printf("         grant      : %s\n", (grant & mask)  ? "yes" : "no");
         printf("         advice     : %savailable\n",
                (advice & mask)  ? "" : "not ");
@@ -35,6 +35,9 @@
 #include <sys/stat.h>
 
 #include <murphy/common/macros.h>
+#include <murphy/common/debug.h>
+#include <murphy/common/hashtbl.h>
+#include <murphy/common/utils.h>
 #include <murphy/common/transport.h>
 #include <murphy/common/wsck-transport.h>
 #include <murphy/common/json.h>
@@ -67,10 +70,29 @@ enum {
     ARG_HTTPDIR,                         /* content directory for HTTP */
     ARG_SSLCERT,                         /* path to SSL certificate */
     ARG_SSLPKEY,                         /* path to SSL private key */
-    ARG_SSLCA                            /* path to SSL CA */
+    ARG_SSLCA,                           /* path to SSL CA */
+    ARG_DEFLATE                          /* allow websocket compression */
 };
 
 
+/*
+ * cached query replies
+ */
+
+enum {
+    QUERY_RESOURCES = 0,                 /* resource query reply */
+    QUERY_CLASSES,                       /* class query reply */
+    QUERY_ZONES,                         /* zone query reply */
+    QUERY_MAX
+};
+
+typedef struct {
+    uint32_t  generation;                /* definition generation of reply */
+    char     *body;                      /* reply following the seq field */
+    size_t    size;                      /* length of body */
+} query_reply_t;
+
+
 /*
  * WRT resource context
  */
@@ -85,11 +107,15 @@ typedef struct {
     const char      *sslcert;            /* path to SSL certificate */
     const char      *sslpkey;            /* path to SSL private key */
     const char      *sslca;              /* path to SSL CA */
-
+    int              deflate;            /* allow websocket compression */
+    query_reply_t    replies[QUERY_MAX]; /* cached query replies */
+    mrp_htbl_t      *requests;           /* request handlers by type */
+    mrp_json_writer_t w;                 /* writer for hot-path messages */
 } wrt_data_t;
 
 
 typedef struct {
+    wrt_data_t            *data;         /* WRT resource context */
     int                    id;           /* client id */
     int                    seq;          /* last request sequence number */
     mrp_context_t         *ctx;          /* murphy context */
@@ -98,14 +124,13 @@ typedef struct {
     mrp_list_hook_t        hook;         /* to list of clients */
     /*
      * Notes:
-     *    The resource infra sends the first event for a resource set
-     *    out-of-order, before it has acknowledged the creation of the
-     *    set and let the client know the resource set id. We use the
-     *    field below to suppress this event and force emitting an event
-     *    for the resource set right after we have acked the creation request.
+     *    The resource infra would send the first event for a resource set
+     *    before we have acknowledged its creation and let the client know
+     *    the resource set id. We block the events of the client while the
+     *    set is being created and use the field below to make the first
+     *    event, delivered after the ack, report all resources of the set.
      */
-    mrp_resource_set_t *rset;            /* resource set being created */
-    int                 force_all;       /* flag for */
+    mrp_resource_set_t *rset;            /* set to send a full event for */
 } wrt_client_t;
 
 
@@ -130,7 +155,11 @@ typedef struct {
 } errbuf_t;
 
 
+typedef void (*request_handler_t)(wrt_client_t *c, mrp_json_t *req);
+
+
 static int send_message(wrt_client_t *c, mrp_json_t *msg);
+static int send_written(wrt_client_t *c);
 
 static void ignore_invalid_request(wrt_client_t *c, mrp_json_t *req, ...)
 {
@@ -185,6 +214,35 @@ static mrp_json_t *alloc_reply(const char *type, int seq)
 }
 
 
+static mrp_json_writer_t *begin_reply(wrt_client_t *c, const char *type,
+                                      int seq)
+{
+    mrp_json_writer_t *w = &c->data->w;
+
+    mrp_json_writer_reset(w);
+
+    if (mrp_json_write_object_begin(w, NULL)        &&
+        mrp_json_write_string      (w, "type", type) &&
+        mrp_json_write_integer     (w, "seq" , seq))
+        return w;
+
+    mrp_log_error("Failed to write WRT resource reply.");
+
+    return NULL;
+}
+
+
+static void status_reply(wrt_client_t *c, const char *type, int seq)
+{
+    mrp_json_writer_t *w;
+
+    if ((w = begin_reply(c, type, seq)) != NULL) {
+        if (mrp_json_write_integer(w, "status", 0))
+            send_written(c);
+    }
+}
+
+
 static void error_reply(wrt_client_t *c, const char *type, int seq, int code,
                         const char *fmt, ...)
 {
@@ -211,184 +269,211 @@ static void error_reply(wrt_client_t *c, const char *type, int seq, int code,
 }
 
 
-static void query_resources(wrt_client_t *c, mrp_json_t *req)
+/*
+ * Every client queries the resources, classes and zones when it connects,
+ * and the replies only change when something new gets defined. We keep
+ * the replies serialized, except for the type and sequence number, along
+ * with the definition generation they were built for.
+ */
+
+static int write_resources(mrp_json_writer_t *w)
 {
-    const char  *type = RESWRT_QUERY_RESOURCES;
-    mrp_json_t  *reply, *rarr, *r, *ao;
     const char **resources;
-    int          seq, cnt;
     mrp_attr_t  *attrs, *a;
     mrp_attr_t   buf[ATTRIBUTE_MAX];
     uint32_t     id;
+    int          ok;
 
-    if (!mrp_json_get_integer(req, "seq", &seq)) {
-        ignore_invalid_request(c, req, "missing 'seq' field");
-        return;
-    }
-
-    rarr = r = ao = NULL;
     resources = mrp_resource_definition_get_all_names(0, NULL);
 
-    if (resources == NULL) {
-        error_reply(c, type, seq, ENOMEM, "failed to query class names");
-        return;
-    }
+    if (resources == NULL)
+        return FALSE;
 
-    reply = alloc_reply(type, seq);
+    ok = mrp_json_write_array_begin(w, "resources");
 
-    if (reply == NULL)
-        return;
+    for (id = 0; ok && resources[id]; id++) {
+        attrs = mrp_resource_definition_read_all_attributes(id,
+                                                            ATTRIBUTE_MAX, buf);
 
-    rarr = mrp_json_create(MRP_JSON_ARRAY);
+        ok = mrp_json_write_object_begin(w, NULL) &&
+            mrp_json_write_string(w, "name", resources[id]);
 
-    if (rarr == NULL)
-        goto fail;
+        if (ok && attrs[0].name != NULL) {
+            ok = mrp_json_write_object_begin(w, "attributes");
 
-    for (id = 0; resources[id]; id++) {
-        r = mrp_json_create(MRP_JSON_OBJECT);
+            for (a = attrs; ok && a->name; a++) {
+                switch (a->type) {
+                case mqi_string:
+                    ok = mrp_json_write_string(w, a->name, a->value.string);
+                    break;
+                case mqi_integer:
+                case mqi_unsignd:
+                    ok = mrp_json_write_integer(w, a->name, a->value.integer);
+                    break;
+                case mqi_floating:
+                    ok = mrp_json_write_double(w, a->name, a->value.floating);
+                    break;
+                default:
+                    mrp_log_error("attribute '%s' of resource '%s' "
+                                  "has unknown type %d", a->name,
+                                  resources[id], a->type);
+                    break;
+                }
+            }
 
-        if (r == NULL)
-            goto fail;
+            ok = ok && mrp_json_write_object_end(w);
+        }
 
-        if (!mrp_json_add_string (r, "name", resources[id]))
-            goto fail;
+        ok = ok && mrp_json_write_object_end(w);
+    }
 
-        attrs = mrp_resource_definition_read_all_attributes(id,
-                                                            ATTRIBUTE_MAX, buf);
+    ok = ok && mrp_json_write_array_end(w);
 
-        ao = mrp_json_create(MRP_JSON_OBJECT);
+    mrp_free(resources);
 
-        if (ao == NULL)
-            goto fail;
+    return ok;
+}
 
-        for (a = attrs, cnt = 0; a->name; a++, cnt++) {
-            switch (a->type) {
-            case mqi_string:
-                if (!mrp_json_add_string(ao, a->name, a->value.string))
-                    goto fail;
 
-                break;
-            case mqi_integer:
-            case mqi_unsignd:
-                if (!mrp_json_add_integer(ao, a->name, a->value.integer))
-                    goto fail;
-                break;
-            case mqi_floating:
-                if (!mrp_json_add_double(ao, a->name, a->value.floating))
-                    goto fail;
-                break;
-            default:
-                mrp_log_error("attribute '%s' of resource '%s' "
-                              "has unknown type %d", a->name, resources[id],
-                              a->type);
-                break;
-            }
-        }
+static int write_names(mrp_json_writer_t *w, const char *key,
+                       const char **names)
+{
+    int i, ok;
 
-        if (cnt > 0)
-            mrp_json_add(r, "attributes", ao);
-        else
-            mrp_json_unref(ao);
+    if (names == NULL)
+        return FALSE;
 
-        ao = NULL;
+    ok = mrp_json_write_array_begin(w, key);
 
-        if (!mrp_json_array_append(rarr, r))
-            goto fail;
-        else
-            r = NULL;
-    }
+    for (i = 0; ok && names[i] != NULL; i++)
+        ok = mrp_json_write_string(w, NULL, names[i]);
 
-    if (mrp_json_add_integer(reply, "status"   , 0)) {
-        mrp_json_add        (reply, "resources", rarr);
-        send_message(c, reply);
-    }
+    ok = ok && mrp_json_write_array_end(w);
 
-    mrp_json_unref(reply);
-    mrp_free(resources);
-    return;
+    mrp_free(names);
 
- fail:
-    mrp_json_unref(reply);
-    mrp_json_unref(rarr);
-    mrp_json_unref(r);
-    mrp_json_unref(ao);
-    mrp_free(resources);
+    return ok;
 }
 
 
-static void query_classes(wrt_client_t *c, mrp_json_t *req)
+static query_reply_t *get_query_reply(wrt_data_t *data, int query)
 {
-    const char  *type = RESWRT_QUERY_CLASSES;
-    mrp_json_t  *reply;
-    const char **classes;
-    size_t       nclass;
-    int          seq;
-
-    if (!mrp_json_get_integer(req, "seq", &seq)) {
-        ignore_invalid_request(c, req, "missing 'seq' field");
-        return;
+    query_reply_t     *r = data->replies + query;
+    mrp_json_writer_t  w;
+    const char        *s;
+    size_t             size;
+    uint32_t           gen;
+    int                ok;
+
+    gen = mrp_resource_definitions_get_generation();
+
+    if (r->body != NULL && r->generation == gen)
+        return r;
+
+    mrp_free(r->body);
+    r->body = NULL;
+
+    if (!mrp_json_writer_init(&w, 1024))
+        return NULL;
+
+    ok = mrp_json_write_object_begin(&w, NULL) &&
+        mrp_json_write_integer(&w, "status", 0);
+
+    switch (query) {
+    case QUERY_RESOURCES:
+        ok = ok && write_resources(&w);
+        break;
+    case QUERY_CLASSES:
+        ok = ok && write_names(&w, "classes",
+                               mrp_application_class_get_all_names(0, NULL));
+        break;
+    case QUERY_ZONES:
+        ok = ok && write_names(&w, "zones", mrp_zone_get_all_names(0, NULL));
+        break;
+    default:
+        ok = FALSE;
     }
 
-    classes = mrp_application_class_get_all_names(0, NULL);
+    ok = ok && mrp_json_write_object_end(&w);
 
-    if (classes == NULL) {
-        error_reply(c, type, seq, ENOMEM, "failed to query class names");
-        return;
+    /* keep everything after the opening brace */
+    if (ok && (s = mrp_json_writer_output(&w, &size)) != NULL) {
+        if ((r->body = mrp_strdup(s + 1)) != NULL) {
+            r->size       = size - 1;
+            r->generation = gen;
+        }
     }
 
-    reply = alloc_reply(type, seq);
+    mrp_json_writer_cleanup(&w);
 
-    if (reply == NULL)
-        return;
+    return r->body != NULL ? r : NULL;
+}
 
-    nclass = 0;
-    for (nclass = 0; classes[nclass] != NULL; nclass++)
-        ;
 
-    if (mrp_json_add_integer     (reply, "status" , 0) &&
-        mrp_json_add_string_array(reply, "classes", classes, nclass))
-        send_message(c, reply);
+static void purge_query_replies(wrt_data_t *data)
+{
+    int i;
 
-    mrp_json_unref(reply);
-    mrp_free(classes);
+    for (i = 0; i < QUERY_MAX; i++) {
+        mrp_free(data->replies[i].body);
+        data->replies[i].body = NULL;
+    }
 }
 
 
-static void query_zones(wrt_client_t *c, mrp_json_t *req)
+static void query_reply(wrt_client_t *c, mrp_json_t *req, const char *type,
+                        int query)
 {
-    const char  *type = RESWRT_QUERY_ZONES;
-    mrp_json_t  *reply;
-    const char **zones;
-    size_t       nzone;
-    int          seq;
+    query_reply_t *r;
+    char           head[128], *msg;
+    int            seq, len;
 
     if (!mrp_json_get_integer(req, "seq", &seq)) {
         ignore_invalid_request(c, req, "missing 'seq' field");
         return;
     }
 
-    zones = mrp_zone_get_all_names(0, NULL);
-
-    if (zones == NULL) {
-        error_reply(c, type, seq, ENOMEM, "failed to query zone names");
+    if ((r = get_query_reply(c->data, query)) == NULL) {
+        error_reply(c, type, seq, ENOMEM, "failed to query %s",
+                    query == QUERY_RESOURCES ? "resources" :
+                    query == QUERY_CLASSES   ? "class names" : "zone names");
         return;
     }
 
-    reply = alloc_reply(type, seq);
+    len = snprintf(head, sizeof(head), "{\"type\":\"%s\",\"seq\":%d%s",
+                   type, seq, r->size > 1 ? "," : "");
 
-    if (reply == NULL)
+    if (len < 0 || len >= (int)sizeof(head) ||
+        (msg = mrp_alloc(len + r->size + 1)) == NULL) {
         mrp_log_error("Failed to allocate WRT resource reply.");
+        return;
+    }
+
+    memcpy(msg, head, len);
+    memcpy(msg + len, r->body, r->size + 1);
+
+    mrp_debug("sending WRT resource message: %s", msg);
+
+    mrp_transport_sendraw(c->t, msg, len + r->size);
+    mrp_free(msg);
+}
+
+
+static void query_resources(wrt_client_t *c, mrp_json_t *req)
+{
+    query_reply(c, req, RESWRT_QUERY_RESOURCES, QUERY_RESOURCES);
+}
+
 
-    nzone = 0;
-    for (nzone = 0; zones[nzone] != NULL; nzone++)
-        ;
+static void query_classes(wrt_client_t *c, mrp_json_t *req)
+{
+    query_reply(c, req, RESWRT_QUERY_CLASSES, QUERY_CLASSES);
+}
 
-    if (mrp_json_add_integer     (reply, "status", 0) &&
-        mrp_json_add_string_array(reply, "zones" , zones, nzone))
-        send_message(c, reply);
 
-    mrp_json_unref(reply);
-    mrp_free(zones);
+static void query_zones(wrt_client_t *c, mrp_json_t *req)
+{
+    query_reply(c, req, RESWRT_QUERY_ZONES, QUERY_ZONES);
 }
 
 
@@ -442,49 +527,46 @@ static int parse_attributes(mrp_json_t *ja, mrp_attr_t *attrs, size_t max,
 }
 
 
-static int append_attributes(mrp_json_t *o, mrp_attr_t *attrs, errbuf_t *e)
+static int write_attributes(mrp_json_writer_t *w, mrp_attr_t *attrs,
+                            errbuf_t *e)
 {
-    mrp_json_t *a;
     mrp_attr_t *attr;
+    int         success;
 
     if (attrs->name == NULL)
         return 0;
 
-    a = mrp_json_create(MRP_JSON_OBJECT);
-
-    if (a == NULL)
-        return error(e, ENOMEM, "failed to create attributes object");
+    if (!mrp_json_write_object_begin(w, "attributes"))
+        goto fail;
 
     for (attr = attrs; attr->name != NULL; attr++) {
         switch (attr->type) {
         case mqi_string:
-            if (!mrp_json_add_string(a, attr->name, attr->value.string))
-                goto fail;
+            success = mrp_json_write_string(w, attr->name,
+                                            attr->value.string);
             break;
         case mqi_integer:
-            if (!mrp_json_add_integer(a, attr->name, attr->value.integer))
-                goto fail;
-            break;
         case mqi_unsignd:
-            if (!mrp_json_add_integer(a, attr->name, attr->value.integer))
-                goto fail;
+            success = mrp_json_write_integer(w, attr->name,
+                                             attr->value.integer);
             break;
         case mqi_floating:
-            if (!mrp_json_add_double(a, attr->name, attr->value.floating))
-                goto fail;
+            success = mrp_json_write_double(w, attr->name,
+                                            attr->value.floating);
             break;
         default:
-            goto fail;
+            success = FALSE;
         }
+
+        if (!success)
+            goto fail;
     }
 
-    mrp_json_add(o, "attributes", a);
-    return 0;
+    if (mrp_json_write_object_end(w))
+        return 0;
 
  fail:
-    mrp_json_unref(a);
-
-    return error(e, EINVAL, "failed to append attribtues");
+    return error(e, EINVAL, "failed to write attributes");
 }
 
 
@@ -569,134 +651,115 @@ static int parse_resource_definition(mrp_json_t *jr, resdef_t *d, errbuf_t *e)
 }
 
 
-static int block_resource_set_events(wrt_client_t *c, mrp_resource_set_t *rset)
+/*
+ * Resource masks are 64 bits wide but JavaScript can only do bitwise
+ * operations on 32-bit integers. We send the low word of a mask as key
+ * and the high word, if non-zero, as key_hi.
+ */
+static int write_mask(mrp_json_writer_t *w, const char *key, const char *hikey,
+                      mrp_resource_mask_t mask)
 {
-    if (c->rset == NULL) {
-        c->rset = rset;
-        return TRUE;
-    }
-    else
+    if (!mrp_json_write_unsigned(w, key, (uint32_t)mask))
         return FALSE;
-}
 
-
-static int allow_resource_set_events(wrt_client_t *c, mrp_resource_set_t *rset)
-{
-    if (c->rset == rset) {
-        c->rset = NULL;
-        return TRUE;
-    }
-    else
+    if ((mask >> 32) != 0 &&
+        !mrp_json_write_unsigned(w, hikey, (uint32_t)(mask >> 32)))
         return FALSE;
-}
 
-
-static int resource_set_events_blocked(wrt_client_t *c, mrp_resource_set_t *rs)
-{
-    return c->rset == rs;
+    return TRUE;
 }
 
 
 static void emit_resource_set_event(wrt_client_t *c, uint32_t reqid,
                                     mrp_resource_set_t *rset, int force_all)
 {
-    const char     *type = RESWRT_EVENT;
-    int             seq  = (int)reqid;
-    mrp_json_t     *msg, *rarr, *r;
-    int             rsid;
-    const char     *state;
-    int             grant, advice, all, mask;
-    errbuf_t        e;
-    mrp_resource_t *res;
-    void           *it;
-    const char     *name;
-    mrp_attr_t      attrs[ATTRIBUTE_MAX + 1];
+    const char        *type = RESWRT_EVENT;
+    int                seq  = (int)reqid;
+    mrp_json_writer_t *w;
+    int                rsid;
+    const char        *state;
+    mrp_resource_mask_t grant, advice, all, mask;
+    int                nres;
+    errbuf_t           e;
+    mrp_resource_t    *res;
+    void              *it;
+    const char        *name;
+    mrp_attr_t         attrs[ATTRIBUTE_MAX + 1];
 
     mrp_debug("event for resource set %p of client %p", rset, c);
 
-    if (resource_set_events_blocked(c, rset)) {
-        mrp_debug("suppressing event for unacknowledged resource set");
-        return;
-    }
-
     if (mrp_get_resource_set_state(rset) == mrp_resource_acquire)
         state = RESWRT_STATE_GRANTED;
     else
         state = RESWRT_STATE_RELEASE;
 
     rsid   = (int)mrp_get_resource_set_id(rset);
-    grant  = (int)mrp_get_resource_set_grant(rset);
-    advice = (int)mrp_get_resource_set_advice(rset);
+    grant  = mrp_get_resource_set_grant(rset);
+    advice = mrp_get_resource_set_advice(rset);
 
-    msg = alloc_reply(type, seq);
+    w = begin_reply(c, type, seq);
 
-    if (msg == NULL)
+    if (w == NULL)
         return;
 
-    rarr = r = NULL;
-
-    if (mrp_json_add_integer(msg, "id"    , rsid ) &&
-        mrp_json_add_string (msg, "state" , state) &&
-        mrp_json_add_integer(msg, "grant" , grant) &&
-        mrp_json_add_integer(msg, "advice", advice)) {
-
-        all = grant | advice;
-        it  = NULL;
-
-        while ((res = mrp_resource_set_iterate_resources(rset, &it)) != NULL) {
-            mask = mrp_resource_get_mask(res);
-
-            if (!(mask & all) && !force_all)
-                continue;
-
-            name = mrp_resource_get_name(res);
+    if (!mrp_json_write_integer(w, "id"    , rsid  ) ||
+        !mrp_json_write_string (w, "state" , state ) ||
+        !write_mask(w, "grant" , "grant_hi" , grant ) ||
+        !write_mask(w, "advice", "advice_hi", advice))
+        goto fail;
 
-            if (!mrp_resource_read_all_attributes(res, ATTRIBUTE_MAX+1, attrs))
-                goto fail;
+    all  = grant | advice;
+    it   = NULL;
+    nres = 0;
 
-            if (rarr == NULL) {
-                rarr = mrp_json_create(MRP_JSON_ARRAY);
-                if (rarr == NULL)
-                    goto fail;
-            }
+    while ((res = mrp_resource_set_iterate_resources(rset, &it)) != NULL) {
+        mask = mrp_resource_get_mask(res);
 
-            r = mrp_json_create(MRP_JSON_OBJECT);
+        if (!(mask & all) && !force_all)
+            continue;
 
-            if (r == NULL)
-                goto fail;
-
-            if (!mrp_json_add_string (r, "name", name) ||
-                (force_all && !mrp_json_add_integer(r, "mask", mask)))
-                goto fail;
+        name = mrp_resource_get_name(res);
 
-            if (append_attributes(r, attrs, &e) != 0)
-                goto fail;
+        if (!mrp_resource_read_all_attributes(res, ATTRIBUTE_MAX+1, attrs))
+            goto fail;
 
-            if (!mrp_json_array_append(rarr, r))
+        if (nres++ == 0) {
+            if (!mrp_json_write_array_begin(w, "resources"))
                 goto fail;
-            else
-                r = NULL;
         }
 
-        if (rarr != NULL)
-            mrp_json_add(msg, "resources", rarr);
+        if (!mrp_json_write_object_begin(w, NULL)        ||
+            !mrp_json_write_string      (w, "name", name) ||
+            (force_all && !write_mask(w, "mask", "mask_hi", mask)))
+            goto fail;
 
-        send_message(c, msg);
-        mrp_json_unref(msg);
+        if (write_attributes(w, attrs, &e) != 0)
+            goto fail;
 
-        return;
+        if (!mrp_json_write_object_end(w))
+            goto fail;
     }
 
+    if (nres > 0 && !mrp_json_write_array_end(w))
+        goto fail;
+
+    send_written(c);
+    return;
+
  fail:
-    mrp_json_unref(msg);
-    mrp_json_unref(rarr);
-    mrp_json_unref(r);
+    mrp_log_error("Failed to write WRT resource set event.");
 }
 
 
 static void event_cb(uint32_t reqid, mrp_resource_set_t *rset, void *user_data)
 {
-    emit_resource_set_event((wrt_client_t *)user_data, reqid, rset, FALSE);
+    wrt_client_t *c = (wrt_client_t *)user_data;
+    int           force_all;
+
+    if ((force_all = (c->rset == rset)))
+        c->rset = NULL;
+
+    emit_resource_set_event(c, reqid, rset, force_all);
 }
 
 
@@ -828,14 +891,15 @@ static void create_set(wrt_client_t *c, mrp_json_t *req)
             }
         }
 
-        block_resource_set_events(c, rset);
-        /* suppress events for this resource set (client does not know id) */
-        c->rset = rset;
+        /* hold back events until the client knows the set id */
+        mrp_resource_client_block_events(c->rsc);
 
         /* add resource set to class/zone */
         if (mrp_application_class_add_resource_set(appclass, zone, rset, seq)) {
             error_reply(c, type, seq, EINVAL, "failed to add set to class");
-            goto fail;
+            mrp_resource_set_destroy(rset);
+            mrp_resource_client_allow_events(c->rsc);
+            return;
         }
         else {
             reply = alloc_reply(type, seq);
@@ -845,12 +909,14 @@ static void create_set(wrt_client_t *c, mrp_json_t *req)
                     mrp_json_add_integer(reply, "id", rsid)) {
                     send_message(c, reply);
 
-                    allow_resource_set_events(c, rset);
-                    emit_resource_set_event(c, seq, rset, TRUE);
+                    /* the first event of the set reports all resources */
+                    c->rset = rset;
+                    mrp_resource_set_post_event(rset, seq);
                 }
             }
 
             mrp_json_unref(reply);
+            mrp_resource_client_allow_events(c->rsc);
 
             return;
         }
@@ -901,7 +967,6 @@ static void acquire_set(wrt_client_t *c, mrp_json_t *req)
 {
     const char         *type = RESWRT_ACQUIRE_SET;
     int                 seq;
-    mrp_json_t         *reply;
     mrp_resource_set_t *rset;
     uint32_t            rsid;
 
@@ -919,13 +984,7 @@ static void acquire_set(wrt_client_t *c, mrp_json_t *req)
     rset = mrp_resource_client_find_set(c->rsc, rsid);
 
     if (rset != NULL) {
-        reply = alloc_reply(type, seq);
-
-        if (reply != NULL) {
-            if (mrp_json_add_integer(reply, "status", 0))
-                send_message(c, reply);
-        }
-
+        status_reply(c, type, seq);
         mrp_resource_set_acquire(rset, (uint32_t)seq);
     }
     else
@@ -937,7 +996,6 @@ static void release_set(wrt_client_t *c, mrp_json_t *req)
 {
     const char         *type = RESWRT_RELEASE_SET;
     int                 seq;
-    mrp_json_t         *reply;
     mrp_resource_set_t *rset;
     uint32_t            rsid;
 
@@ -955,13 +1013,7 @@ static void release_set(wrt_client_t *c, mrp_json_t *req)
     rset = mrp_resource_client_find_set(c->rsc, rsid);
 
     if (rset != NULL) {
-        reply = alloc_reply(type, seq);
-
-        if (reply != NULL) {
-            if (mrp_json_add_integer(reply, "status", 0))
-                send_message(c, reply);
-        }
-
+        status_reply(c, type, seq);
         mrp_resource_set_release(rset, (uint32_t)seq);
     }
     else
@@ -978,6 +1030,7 @@ static wrt_client_t *create_client(wrt_data_t *data, mrp_transport_t *lt)
 
     if (c != NULL) {
         mrp_list_init(&c->hook);
+        c->data = data;
 
         c->t = mrp_transport_accept(lt, c, MRP_TRANSPORT_REUSEADDR);
 
@@ -1047,31 +1100,36 @@ static void closed_evt(mrp_transport_t *t, int error, void *user_data)
 
 static int send_message(wrt_client_t *c, mrp_json_t *msg)
 {
-    const char *s;
-
-    s = mrp_json_object_to_string(msg);
-
-    mrp_log_info("sending WRT resource message:");
-    mrp_log_info("  %s", s);
+    mrp_debug("sending WRT resource message: %s",
+              mrp_json_object_to_string(msg));
 
     return mrp_transport_sendcustom(c->t, msg);
 }
 
 
-static void recv_evt(mrp_transport_t *t, void *data, void *user_data)
+static int send_written(wrt_client_t *c)
 {
-    wrt_client_t *c   = (wrt_client_t *)user_data;
-    mrp_json_t   *req = (mrp_json_t *)data;
-    const char   *type;
-    int           seq;
-    const char   *s;
+    mrp_json_writer_t *w = &c->data->w;
+    const char        *s;
+    size_t             size;
 
-    MRP_UNUSED(t);
+    if (!mrp_json_write_object_end(w) ||
+        (s = mrp_json_writer_output(w, &size)) == NULL) {
+        mrp_log_error("Failed to finalize WRT resource message.");
+        return FALSE;
+    }
+
+    mrp_debug("sending WRT resource message: %s", s);
+
+    return mrp_transport_sendraw(c->t, (void *)s, size);
+}
 
-    s = mrp_json_object_to_string((mrp_json_t *)data);
 
-    mrp_log_info("recived WRT resource message:");
-    mrp_log_info("  %s", s);
+static void handle_request(wrt_client_t *c, mrp_json_t *req)
+{
+    request_handler_t  handler;
+    const char        *type;
+    int                seq;
 
     if (!mrp_json_get_string (req, "type", &type) ||
         !mrp_json_get_integer(req, "seq" , &seq))
@@ -1084,26 +1142,82 @@ static void recv_evt(mrp_transport_t *t, void *data, void *user_data)
         else
             c->seq = seq;
 
-        if (!strcmp(type, RESWRT_QUERY_RESOURCES))
-            query_resources(c, req);
-        else if (!strcmp(type, RESWRT_QUERY_CLASSES))
-            query_classes(c, req);
-        else if (!strcmp(type, RESWRT_QUERY_ZONES))
-            query_zones(c, req);
-        else if (!strcmp(type, RESWRT_CREATE_SET))
-            create_set(c, req);
-        else if (!strcmp(type, RESWRT_DESTROY_SET))
-            destroy_set(c, req);
-        else if (!strcmp(type, RESWRT_ACQUIRE_SET))
-            acquire_set(c, req);
-        else if (!strcmp(type, RESWRT_RELEASE_SET))
-            release_set(c, req);
+        handler = mrp_htbl_lookup(c->data->requests, (void *)type);
+
+        if (handler != NULL)
+            handler(c, req);
         else
             ignore_unknown_request(c, req, type);
     }
 }
 
 
+static void recv_evt(mrp_transport_t *t, void *data, void *user_data)
+{
+    wrt_client_t *c   = (wrt_client_t *)user_data;
+    mrp_json_t   *req = (mrp_json_t *)data;
+    int           i, n;
+
+    MRP_UNUSED(t);
+
+    mrp_debug("received WRT resource message: %s",
+              mrp_json_object_to_string(req));
+
+    /* several requests can be batched into an array in a single frame */
+    if (mrp_json_is_type(req, MRP_JSON_ARRAY)) {
+        n = mrp_json_array_length(req);
+
+        for (i = 0; i < n; i++)
+            handle_request(c, mrp_json_array_get(req, i));
+    }
+    else
+        handle_request(c, req);
+}
+
+
+static int request_table_create(wrt_data_t *data)
+{
+    static struct {
+        const char        *type;
+        request_handler_t  handler;
+    } requests[] = {
+        { RESWRT_QUERY_RESOURCES, query_resources },
+        { RESWRT_QUERY_CLASSES  , query_classes   },
+        { RESWRT_QUERY_ZONES    , query_zones     },
+        { RESWRT_CREATE_SET     , create_set      },
+        { RESWRT_DESTROY_SET    , destroy_set     },
+        { RESWRT_ACQUIRE_SET    , acquire_set     },
+        { RESWRT_RELEASE_SET    , release_set     },
+    };
+
+    mrp_htbl_config_t hcfg;
+    size_t            i;
+
+    mrp_clear(&hcfg);
+    hcfg.comp    = mrp_string_comp;
+    hcfg.hash    = mrp_string_hash;
+    hcfg.free    = NULL;
+    hcfg.nbucket = 16;
+
+    if ((data->requests = mrp_htbl_create(&hcfg)) == NULL)
+        return FALSE;
+
+    for (i = 0; i < MRP_ARRAY_SIZE(requests); i++)
+        if (!mrp_htbl_insert(data->requests, (void *)requests[i].type,
+                             requests[i].handler))
+            return FALSE;
+
+    return TRUE;
+}
+
+
+static void request_table_destroy(wrt_data_t *data)
+{
+    mrp_htbl_destroy(data->requests, FALSE);
+    data->requests = NULL;
+}
+
+
 static int transport_create(wrt_data_t *data)
 {
     static mrp_transport_evt_t evt = {
@@ -1137,6 +1251,10 @@ static int transport_create(wrt_data_t *data)
                 mrp_transport_setopt(data->lt, MRP_WSCK_OPT_SSL_CA  , ca);
             }
 
+            if (data->deflate)
+                mrp_transport_setopt(data->lt, MRP_WSCK_OPT_DEFLATE,
+                                     &data->deflate);
+
             if (mrp_transport_bind(data->lt, &addr, len) &&
                 mrp_transport_listen(data->lt, 0)) {
                 mrp_log_info("Listening on transport '%s'...", data->addr);
@@ -1182,10 +1300,21 @@ static int plugin_init(mrp_plugin_t *plugin)
         data->sslcert = plugin->args[ARG_SSLCERT].str;
         data->sslpkey = plugin->args[ARG_SSLPKEY].str;
         data->sslca   = plugin->args[ARG_SSLCA].str;
+        data->deflate = plugin->args[ARG_DEFLATE].bln;
+
+        /*
+         * Notes:
+         *     Replies are written and sent synchronously, so a single
+         *     writer shared by all clients does instead of one per client.
+         */
+        if (!mrp_json_writer_init(&data->w, 1024))
+            goto fail;
 
-        if (!transport_create(data))
+        if (!request_table_create(data) || !transport_create(data))
             goto fail;
 
+        plugin->data = data;
+
         return TRUE;
     }
 
@@ -1193,6 +1322,8 @@ static int plugin_init(mrp_plugin_t *plugin)
  fail:
     if (data != NULL) {
         transport_destroy(data);
+        request_table_destroy(data);
+        mrp_json_writer_cleanup(&data->w);
 
         mrp_free(data);
     }
@@ -1206,6 +1337,9 @@ static void plugin_exit(mrp_plugin_t *plugin)
     wrt_data_t *data = (wrt_data_t *)plugin->data;
 
     transport_destroy(data);
+    request_table_destroy(data);
+    purge_query_replies(data);
+    mrp_json_writer_cleanup(&data->w);
 
     mrp_free(data);
 }
@@ -1221,7 +1355,8 @@ static mrp_plugin_arg_t plugin_args[] = {
     MRP_PLUGIN_ARGIDX(ARG_HTTPDIR, STRING, "httpdir", DEFAULT_HTTPDIR),
     MRP_PLUGIN_ARGIDX(ARG_SSLCERT, STRING, "sslcert", NULL),
     MRP_PLUGIN_ARGIDX(ARG_SSLPKEY, STRING, "sslpkey", NULL),
-    MRP_PLUGIN_ARGIDX(ARG_SSLCA  , STRING, "sslca"  , NULL)
+    MRP_PLUGIN_ARGIDX(ARG_SSLCA  , STRING, "sslca"  , NULL),
+    MRP_PLUGIN_ARGIDX(ARG_DEFLATE, BOOL  , "deflate", FALSE)
 
 };
 
@@ -213,9 +213,11 @@ WrtResourceSet.prototype.notify = function (msg) {
         if (!this.resources)
             this.resources = msg.resources;
 
-        this.state  = msg.state;
-        this.grant  = msg.grant;
-        this.advice = msg.advice;
+        this.state     = msg.state;
+        this.grant     = msg.grant;
+        this.grant_hi  = msg.grant_hi || 0;
+        this.advice    = msg.advice;
+        this.advice_hi = msg.advice_hi || 0;
 
         if (this.onstatechanged)
             this.onstatechanged(this.grant);
@@ -243,6 +245,12 @@ WrtResourceSet.prototype.notify = function (msg) {
 }
 
 
+/** Check if a resource is in a mask, the high words are for ids 32-63. */
+function wrt_mask_has(lo, hi, r) {
+    return (lo & r.mask) != 0 || (hi & r.mask_hi) != 0;
+}
+
+
 /** Map resources to names. */
 WrtResourceSet.prototype.ensure_resource_map = function () {
     var r;
@@ -259,6 +267,7 @@ WrtResourceSet.prototype.ensure_resource_map = function () {
         r = this.resources[i];
         this.resource_by_name[r.name] = {
             mask: r.mask,
+            mask_hi: r.mask_hi || 0,
             attributes: r.attributes
         }
     }
@@ -460,13 +469,13 @@ WrtResourceSet.prototype.release = function () {
 }
 
 
-/** Get the mask of granted resources. */
+/** Get the mask of granted resources (ids 0-31, the rest in grant_hi). */
 WrtResourceSet.prototype.getGrantedMask = function () {
     return this.grant;
 }
 
 
-/** Get the mask of allocable resources. */
+/** Get the mask of allocable resources (ids 0-31, the rest in advice_hi). */
 WrtResourceSet.prototype.getAllocableMask = function () {
     return this.advice;
 }
@@ -521,7 +530,7 @@ WrtResourceSet.prototype.getGrantedResourceNames = function () {
 
     for (var n in this.resource_by_name) {
         r = this.resource_by_name[n];
-        if (this.grant & r.mask)
+        if (wrt_mask_has(this.grant, this.grant_hi, r))
             names.push(n);
     }
 
@@ -539,7 +548,7 @@ WrtResourceSet.prototype.getAllocableResourceNames = function () {
 
     for (var n in this.resource_by_name) {
         r = this.resource_by_name[n];
-        if (this.advice & r.mask)
+        if (wrt_mask_has(this.advice, this.advice_hi, r))
             names.push(n);
     }
 
@@ -553,7 +562,7 @@ WrtResourceSet.prototype.isGranted = function (name) {
 
     r = this.resource_by_name[name];
 
-    if (this.grant & r.mask)
+    if (wrt_mask_has(this.grant, this.grant_hi, r))
         return true;
     else
         return false;
@@ -566,7 +575,7 @@ WrtResourceSet.prototype.isAllocable = function (name) {
 
     r = this.resource_by_name[name];
 
-    if (this.advice & r.mask)
+    if (wrt_mask_has(this.advice, this.advice_hi, r))
         return true;
     else
         return false;
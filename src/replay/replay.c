@@ -0,0 +1,680 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <alloca.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+#include <endian.h>
+
+#include <murphy/common.h>
+#include <murphy/common/transport-capture.h>
+
+#define BATCH_SIZE    64                 /* records to send per iteration */
+#define DRAIN_MSECS   1000               /* how long to wait for replies */
+
+
+/*
+ * a captured record and a replayed connection
+ */
+
+typedef struct {
+    mrp_capture_hdr_t  hdr;              /* record header */
+    void              *data;             /* record payload */
+} record_t;
+
+typedef struct replay_s replay_t;
+
+typedef struct {
+    replay_t        *r;                  /* replay we belong to */
+    uint32_t         id;                 /* capture connection id */
+    mrp_transport_t *t;                  /* replay transport */
+    int              framed;             /* needs length prefix */
+    int              closing;            /* close once replies are in */
+    uint64_t        *pending;            /* send times of pending frames */
+    size_t           npending;           /* number of pending frames */
+    size_t           head;               /* oldest pending frame */
+} conn_t;
+
+struct replay_s {
+    mrp_mainloop_t *ml;                  /* our mainloop */
+    const char     *file;                /* capture file */
+    const char     *server;              /* address to replay to */
+    double          speed;               /* replay speed, 0 = unthrottled */
+    int             drain;               /* reply drain timeout */
+    int             log_mask;            /* logging mask */
+    const char     *log_target;          /* logging target */
+
+    record_t       *records;             /* captured records */
+    size_t          nrecord;             /* number of records */
+    size_t          next;                /* next record to replay */
+    conn_t         *conns;               /* replayed connections */
+    size_t          nconn;               /* number of connections */
+
+    mrp_sockaddr_t  addr;                /* resolved server address */
+    socklen_t       alen;                /* address length */
+    const char     *type;                /* transport type */
+
+    mrp_timer_t    *timer;               /* replay/drain timer */
+    uint64_t        start;               /* start of replay */
+    uint64_t        end;                 /* end of replay */
+
+    uint64_t       *lat;                 /* reply latencies */
+    size_t          nlat;                /* number of latencies */
+    size_t          nsent;               /* number of frames sent */
+    size_t          nfail;               /* number of failed sends */
+    size_t          nreply;              /* number of replies */
+};
+
+
+static uint64_t time_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+
+/*
+ * capture file loading
+ */
+
+static int load_capture(replay_t *r)
+{
+    FILE     *fp;
+    char      magic[MRP_CAPTURE_MAGIC_LEN];
+    record_t *rec;
+    size_t    nalloc;
+    uint32_t  i;
+
+    if ((fp = fopen(r->file, "r")) == NULL) {
+        mrp_log_error("Failed to open %s (%d: %s).", r->file,
+                      errno, strerror(errno));
+        return FALSE;
+    }
+
+    if (fread(magic, sizeof(magic), 1, fp) != 1 ||
+        memcmp(magic, MRP_CAPTURE_MAGIC, sizeof(magic))) {
+        mrp_log_error("%s is not a Murphy transport capture.", r->file);
+        goto fail;
+    }
+
+    nalloc = 0;
+
+    for (;;) {
+        if (r->nrecord >= nalloc) {
+            nalloc = nalloc ? 2 * nalloc : 256;
+            if (!mrp_reallocz(r->records, r->nrecord, nalloc))
+                goto nomem;
+        }
+
+        rec = r->records + r->nrecord;
+
+        if (fread(&rec->hdr, sizeof(rec->hdr), 1, fp) != 1)
+            break;
+
+        mrp_capture_hdr_swap(&rec->hdr, FALSE);
+
+        if (rec->hdr.size > 0) {
+            if ((rec->data = mrp_allocz(rec->hdr.size)) == NULL)
+                goto nomem;
+
+            if (fread(rec->data, rec->hdr.size, 1, fp) != 1) {
+                mrp_log_warning("Truncated record at end of %s.", r->file);
+                mrp_free(rec->data);
+                rec->data = NULL;
+                break;
+            }
+        }
+
+        r->nrecord++;
+
+        if (rec->hdr.kind == MRP_CAPTURE_OPEN && rec->hdr.conn > r->nconn)
+            r->nconn = rec->hdr.conn;
+    }
+
+    fclose(fp);
+
+    if ((r->conns = mrp_allocz_array(conn_t, r->nconn + 1)) == NULL)
+        return FALSE;
+
+    for (i = 0; i <= r->nconn; i++) {
+        r->conns[i].r  = r;
+        r->conns[i].id = i;
+    }
+
+    mrp_log_info("Loaded %zu records of %zu connections from %s.",
+                 r->nrecord, r->nconn, r->file);
+
+    return TRUE;
+
+ nomem:
+    mrp_log_error("Failed to allocate memory for capture.");
+ fail:
+    fclose(fp);
+    return FALSE;
+}
+
+
+/*
+ * replies and latency
+ */
+
+static void conn_close(conn_t *c)
+{
+    if (c->t != NULL) {
+        mrp_transport_disconnect(c->t);
+        mrp_transport_destroy(c->t);
+        c->t = NULL;
+    }
+}
+
+
+static void reply_received(replay_t *r, conn_t *c, uint64_t now)
+{
+    r->nreply++;
+
+    /*
+     * Notes:
+     *     We can't tell replies from events the server sends on its own,
+     *     so we simply pair each incoming frame with the oldest frame we
+     *     sent on the connection and have not seen a reply to yet.
+     */
+
+    if (c->head < c->npending) {
+        if (!(r->nlat & (r->nlat - 1)) &&
+            !mrp_reallocz(r->lat, r->nlat, r->nlat ? 2 * r->nlat : 256))
+            return;
+        r->lat[r->nlat++] = now - c->pending[c->head++];
+    }
+
+    if (c->closing && c->head >= c->npending)
+        conn_close(c);
+}
+
+
+static void recv_evt(mrp_transport_t *t, void *data, size_t size,
+                     void *user_data)
+{
+    conn_t *c = (conn_t *)user_data;
+
+    MRP_UNUSED(t);
+    MRP_UNUSED(data);
+    MRP_UNUSED(size);
+
+    /* the transport has already split the incoming stream into frames */
+    reply_received(c->r, c, time_now());
+}
+
+
+static void recvfrom_evt(mrp_transport_t *t, void *data, size_t size,
+                         mrp_sockaddr_t *addr, socklen_t addrlen,
+                         void *user_data)
+{
+    MRP_UNUSED(addr);
+    MRP_UNUSED(addrlen);
+
+    recv_evt(t, data, size, user_data);
+}
+
+
+static void closed_evt(mrp_transport_t *t, int error, void *user_data)
+{
+    conn_t *c = (conn_t *)user_data;
+
+    MRP_UNUSED(t);
+
+    if (error)
+        mrp_log_warning("Connection #%u closed with error %d (%s).", c->id,
+                        error, strerror(error));
+    else
+        mrp_log_info("Connection #%u closed by server.", c->id);
+
+    mrp_transport_disconnect(t);
+    mrp_transport_destroy(t);
+    c->t = NULL;
+}
+
+
+/*
+ * replaying
+ */
+
+static void replay_open(replay_t *r, record_t *rec)
+{
+    static mrp_transport_evt_t evt = {
+        { .recvraw     = recv_evt     },
+        { .recvrawfrom = recvfrom_evt },
+        .closed        = closed_evt,
+        .connection    = NULL,
+    };
+
+    conn_t *c = r->conns + rec->hdr.conn;
+
+    if (rec->data != NULL && strcmp(rec->data, r->type))
+        mrp_log_warning("Replaying %s connection #%u over %s.",
+                        (char *)rec->data, c->id, r->type);
+
+    c->framed = strcmp(r->type, "seqpkt") != 0;
+    c->t      = mrp_transport_create(r->ml, r->type, &evt, c,
+                                     MRP_TRANSPORT_MODE_RAW);
+
+    if (c->t == NULL) {
+        mrp_log_error("Failed to create transport for connection #%u.", c->id);
+        return;
+    }
+
+    if (!mrp_transport_connect(c->t, &r->addr, r->alen)) {
+        mrp_log_error("Failed to connect to %s for connection #%u.",
+                      r->server, c->id);
+        mrp_transport_destroy(c->t);
+        c->t = NULL;
+    }
+}
+
+
+static void replay_frame(replay_t *r, record_t *rec)
+{
+    conn_t   *c = r->conns + rec->hdr.conn;
+    uint32_t  size;
+    char     *buf;
+    size_t    len;
+    int       sent;
+
+    if (c->t == NULL) {
+        r->nfail++;
+        return;
+    }
+
+    if (c->framed) {
+        len  = sizeof(size) + rec->hdr.size;
+        buf  = alloca(len);
+        size = htobe32(rec->hdr.size);
+        memcpy(buf, &size, sizeof(size));
+        memcpy(buf + sizeof(size), rec->data, rec->hdr.size);
+    }
+    else {
+        len = rec->hdr.size;
+        buf = rec->data;
+    }
+
+    sent = mrp_transport_sendraw(c->t, buf, len);
+
+    if (!sent) {
+        r->nfail++;
+        return;
+    }
+
+    if (!(c->npending & (c->npending - 1)) &&
+        !mrp_reallocz(c->pending, c->npending,
+                      c->npending ? 2 * c->npending : 16)) {
+        r->nfail++;
+        return;
+    }
+
+    c->pending[c->npending++] = time_now();
+    r->nsent++;
+}
+
+
+static void replay_close(replay_t *r, record_t *rec)
+{
+    conn_t *c = r->conns + rec->hdr.conn;
+
+    /*
+     * The capture records when the server noticed the client going away,
+     * which is after the client got its replies. If we are replaying faster
+     * than the server answers, hold on to the connection until we do.
+     */
+
+    if (c->head < c->npending)
+        c->closing = TRUE;
+    else
+        conn_close(c);
+}
+
+
+static void drain_cb(mrp_timer_t *t, void *user_data)
+{
+    replay_t *r = (replay_t *)user_data;
+
+    mrp_del_timer(t);
+    r->timer = NULL;
+
+    mrp_mainloop_quit(r->ml, 0);
+}
+
+
+static void replay_cb(mrp_timer_t *t, void *user_data)
+{
+    replay_t *r = (replay_t *)user_data;
+    record_t *rec;
+    uint64_t  now, due;
+    int       n;
+
+    now = time_now() - r->start;
+
+    for (n = 0; r->next < r->nrecord; n++) {
+        rec = r->records + r->next;
+
+        if (r->speed > 0) {
+            due = (uint64_t)(rec->hdr.usecs / r->speed);
+
+            if (due > now) {
+                mrp_mod_timer_usecs(t, due - now);
+                return;
+            }
+        }
+        else if (n >= BATCH_SIZE) {
+            mrp_mod_timer_usecs(t, 0);
+            return;
+        }
+
+        if (rec->hdr.conn == 0 || rec->hdr.conn > r->nconn) {
+            r->next++;
+            continue;
+        }
+
+        switch (rec->hdr.kind) {
+        case MRP_CAPTURE_OPEN:  replay_open(r, rec);  break;
+        case MRP_CAPTURE_FRAME: replay_frame(r, rec); break;
+        case MRP_CAPTURE_CLOSE: replay_close(r, rec); break;
+        default:                                      break;
+        }
+
+        r->next++;
+    }
+
+    r->end = time_now();
+
+    mrp_del_timer(t);
+    r->timer = mrp_add_timer(r->ml, r->drain, drain_cb, r);
+}
+
+
+/*
+ * reporting
+ */
+
+static int cmp_lat(const void *a, const void *b)
+{
+    uint64_t la = *(const uint64_t *)a, lb = *(const uint64_t *)b;
+
+    return la < lb ? -1 : (la > lb ? 1 : 0);
+}
+
+
+static void report(replay_t *r)
+{
+    uint64_t captured, replayed, sum;
+    size_t   i;
+
+    captured = r->nrecord ? r->records[r->nrecord - 1].hdr.usecs : 0;
+    replayed = r->end - r->start;
+
+    printf("connections:   %zu\n", r->nconn);
+    printf("frames sent:   %zu (%zu failed)\n", r->nsent, r->nfail);
+    printf("replies:       %zu\n", r->nreply);
+    printf("capture span:  %.3f s\n", captured / 1000000.0);
+    printf("replay span:   %.3f s (%+.3f s)\n", replayed / 1000000.0,
+           ((double)replayed - (double)captured) / 1000000.0);
+
+    if (replayed > 0)
+        printf("throughput:    %.1f frames/s\n",
+               r->nsent * 1000000.0 / replayed);
+
+    if (r->nlat == 0)
+        return;
+
+    qsort(r->lat, r->nlat, sizeof(r->lat[0]), cmp_lat);
+
+    for (i = 0, sum = 0; i < r->nlat; i++)
+        sum += r->lat[i];
+
+    printf("latency (us):  avg %llu, p50 %llu, p99 %llu, max %llu\n",
+           (unsigned long long)(sum / r->nlat),
+           (unsigned long long)r->lat[r->nlat / 2],
+           (unsigned long long)r->lat[(r->nlat * 99) / 100],
+           (unsigned long long)r->lat[r->nlat - 1]);
+}
+
+
+static void cleanup(replay_t *r)
+{
+    size_t i;
+
+    for (i = 0; i <= r->nconn && r->conns != NULL; i++) {
+        conn_close(r->conns + i);
+        mrp_free(r->conns[i].pending);
+    }
+
+    for (i = 0; i < r->nrecord; i++)
+        mrp_free(r->records[i].data);
+
+    mrp_free(r->conns);
+    mrp_free(r->records);
+    mrp_free(r->lat);
+    mrp_del_timer(r->timer);
+}
+
+
+/*
+ * command line processing
+ */
+
+static void signal_handler(mrp_sighandler_t *h, int signum, void *user_data)
+{
+    mrp_mainloop_t *ml = mrp_get_sighandler_mainloop(h);
+
+    MRP_UNUSED(user_data);
+
+    switch (signum) {
+    case SIGINT:
+        mrp_log_info("Got SIGINT, stopping...");
+        if (ml != NULL)
+            mrp_mainloop_quit(ml, 0);
+        else
+            exit(0);
+        break;
+    }
+}
+
+
+static void set_defaults(replay_t *r)
+{
+    mrp_clear(r);
+    r->speed      = 1.0;
+    r->drain      = DRAIN_MSECS;
+    r->log_mask   = MRP_LOG_UPTO(MRP_LOG_WARNING);
+    r->log_target = MRP_LOG_TO_STDERR;
+}
+
+
+static void print_usage(const char *argv0, int exit_code, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (fmt && *fmt) {
+        va_start(ap, fmt);
+        vprintf(fmt, ap);
+        va_end(ap);
+        printf("\n");
+    }
+
+    printf("usage: %s [options] -f <capture> -s <address>\n\n"
+           "The possible options are:\n"
+           "  -f, --file <path>              capture file to replay\n"
+           "  -s, --server <address>         server transport to replay to\n"
+           "  -x, --speed <factor>           replay speed, 0 for unthrottled\n"
+           "  -w, --wait <msecs>             time to wait for late replies\n"
+           "  -t, --log-target=TARGET        log target to use\n"
+           "      TARGET is one of stderr,stdout,syslog, or a logfile path\n"
+           "  -l, --log-level=LEVELS         logging level to use\n"
+           "      LEVELS is a comma separated list of info, error and warning\n"
+           "  -v, --verbose                  increase logging verbosity\n"
+           "  -h, --help                     show help on usage\n",
+           argv0);
+    printf("\n");
+    printf("Captures are recorded by murphyd when the %s\n",
+           MRP_TRANSPORT_CAPTURE_ENVVAR);
+    printf("environment variable is set to the path of the capture file.\n");
+
+    if (exit_code < 0)
+        return;
+    else
+        exit(exit_code);
+}
+
+
+static void parse_cmdline(replay_t *r, int argc, char **argv)
+{
+#   define OPTIONS "f:s:x:w:l:t:vh"
+    struct option options[] = {
+        { "file"      , required_argument, NULL, 'f' },
+        { "server"    , required_argument, NULL, 's' },
+        { "speed"     , required_argument, NULL, 'x' },
+        { "wait"      , required_argument, NULL, 'w' },
+        { "log-level" , required_argument, NULL, 'l' },
+        { "log-target", required_argument, NULL, 't' },
+        { "verbose"   , no_argument      , NULL, 'v' },
+        { "help"      , no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    char *end;
+    int   opt;
+
+    while ((opt = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+        switch (opt) {
+        case 'f':
+            r->file = optarg;
+            break;
+
+        case 's':
+            r->server = optarg;
+            break;
+
+        case 'x':
+            r->speed = strtod(optarg, &end);
+            if (*end || r->speed < 0)
+                print_usage(argv[0], EINVAL, "invalid speed '%s'", optarg);
+            break;
+
+        case 'w':
+            r->drain = (int)strtol(optarg, &end, 10);
+            if (*end || r->drain < 0)
+                print_usage(argv[0], EINVAL, "invalid wait '%s'", optarg);
+            break;
+
+        case 'v':
+            r->log_mask <<= 1;
+            r->log_mask  |= 1;
+            break;
+
+        case 'l':
+            r->log_mask = mrp_log_parse_levels(optarg);
+            if (r->log_mask < 0)
+                print_usage(argv[0], EINVAL, "invalid log level '%s'", optarg);
+            break;
+
+        case 't':
+            r->log_target = mrp_log_parse_target(optarg);
+            if (!r->log_target)
+                print_usage(argv[0], EINVAL, "invalid log target '%s'", optarg);
+            break;
+
+        case 'h':
+            print_usage(argv[0], 0, "");
+            break;
+
+        default:
+            print_usage(argv[0], EINVAL, "invalid option '%c'", opt);
+        }
+    }
+
+    if (r->file == NULL || r->server == NULL)
+        print_usage(argv[0], EINVAL, "capture file and server are required");
+}
+
+
+int main(int argc, char *argv[])
+{
+    replay_t r;
+
+    set_defaults(&r);
+    parse_cmdline(&r, argc, argv);
+
+    mrp_log_set_mask(r.log_mask);
+    mrp_log_set_target(r.log_target);
+
+    if (!load_capture(&r))
+        exit(1);
+
+    r.alen = mrp_transport_resolve(NULL, r.server, &r.addr, sizeof(r.addr),
+                                   &r.type);
+
+    if (r.alen <= 0) {
+        mrp_log_error("Failed to resolve address '%s'.", r.server);
+        exit(1);
+    }
+
+    if ((r.ml = mrp_mainloop_create()) == NULL) {
+        mrp_log_error("Failed to create mainloop.");
+        exit(1);
+    }
+
+    mrp_add_sighandler(r.ml, SIGINT, signal_handler, &r);
+
+    r.start = time_now();
+    r.timer = mrp_add_timer_usecs(r.ml, 0, 0, replay_cb, &r);
+
+    if (r.timer == NULL) {
+        mrp_log_error("Failed to create replay timer.");
+        exit(1);
+    }
+
+    mrp_mainloop_run(r.ml);
+
+    if (r.end == 0)
+        r.end = time_now();
+
+    report(&r);
+    cleanup(&r);
+    mrp_mainloop_destroy(r.ml);
+
+    return 0;
+}
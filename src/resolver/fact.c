@@ -38,11 +38,39 @@
 
 static int subscribe_db_events(mrp_resolver_t *r);
 static void unsubscribe_db_events(mrp_resolver_t *r);
+static void track_column(mrp_resolver_t *r, fact_t *f);
+static void untrack_column(mrp_resolver_t *r, fact_t *f);
+
+/*
+ * Notes:
+ *     A fact is normally a whole DB table ($table) and its stamp is the
+ *     stamp of the table, which changes on any write to the table. A fact
+ *     can also be a single column of a table ($table.column). The stamp of
+ *     such a fact is maintained by us and only changes when a transaction
+ *     changes the column, or inserts or deletes rows in the table. For
+ *     this we subscribe to the change triggers of all columns and rows of
+ *     the table, and save the table stamp every time one fires. If the
+ *     table stamp changes without any of our triggers firing, the table
+ *     was changed outside of a transaction and we can't tell what was
+ *     changed. In that case we conservatively consider the column changed.
+ *
+ *     If a table with the full dotted name of a fact exists, the fact is
+ *     for the whole table, for backward compatibility.
+ */
+
+static int column_fact_table(fact_t *f, const char *name)
+{
+    size_t len = f->column - 1 - (f->name + 1);
+
+    return !strncmp(f->name + 1, name, len) && name[len] == '\0';
+}
+
 
 int create_fact(mrp_resolver_t *r, char *fact)
 {
     int     i;
     fact_t *f;
+    char   *dot;
 
     subscribe_db_events(r);
 
@@ -56,13 +84,28 @@ int create_fact(mrp_resolver_t *r, char *fact)
         return FALSE;
 
     f = r->facts + r->nfact++;
-    f->name  = mrp_strdup(fact);
-    f->table = mqi_get_table_handle(f->name + 1);
+    f->name   = mrp_strdup(fact);
+    f->colidx = -1;
 
-    if (f->name != NULL)
-        return TRUE;
-    else
+    if (f->name == NULL)
         return FALSE;
+
+    f->table = mqi_get_table_handle(f->name + 1);
+
+    if (f->table == MQI_HANDLE_INVALID &&
+        (dot = strrchr(f->name, '.')) != NULL && dot[1] != '\0') {
+        char table[dot - f->name];
+
+        strncpy(table, f->name + 1, sizeof(table) - 1);
+        table[sizeof(table) - 1] = '\0';
+
+        f->column = dot + 1;
+        f->table  = mqi_get_table_handle(table);
+
+        track_column(r, f);
+    }
+
+    return TRUE;
 }
 
 
@@ -73,8 +116,10 @@ void destroy_facts(mrp_resolver_t *r)
 
     unsubscribe_db_events(r);
 
-    for (i = 0, f = r->facts; i < r->nfact; i++, f++)
+    for (i = 0, f = r->facts; i < r->nfact; i++, f++) {
+        untrack_column(r, f);
         mrp_free(f->name);
+    }
 
     mrp_free(r->facts);
 }
@@ -85,8 +130,18 @@ uint32_t fact_stamp(mrp_resolver_t *r, int id)
     fact_t   *fact = r->facts + id;
     uint32_t  stamp;
 
-    if (fact->table != MQI_HANDLE_INVALID)
+    if (fact->table != MQI_HANDLE_INVALID) {
         stamp = mqi_get_table_stamp(fact->table);
+
+        if (fact->colidx >= 0) {
+            if (stamp != fact->tstamp) {
+                fact->tstamp = stamp;
+                fact->stamp++;
+            }
+
+            stamp = fact->stamp;
+        }
+    }
     else
         stamp = 0; /* MQI_NO_STAMP */
 
@@ -123,13 +178,119 @@ static void update_fact_table(mrp_resolver_t *r, const char *name,
 
     for (i = 0, f = r->facts; i < r->nfact; i++, f++) {
         if (!strcmp(f->name + 1, name)) {
+            if (f->column != NULL) {
+                untrack_column(r, f);
+                f->column = NULL;
+            }
+
             f->table = tbl;
-            return;
+        }
+        else if (f->column != NULL && column_fact_table(f, name)) {
+            if (tbl == MQI_HANDLE_INVALID) {
+                f->colidx = -1;
+                f->stamp++;
+            }
+
+            f->table = tbl;
+            track_column(r, f);
         }
     }
 }
 
 
+static void column_event(mqi_event_t *e, void *user_data)
+{
+    mrp_resolver_t *r = (mrp_resolver_t *)user_data;
+    mqi_handle_t    tbl;
+    int             col, i;
+    fact_t         *f;
+
+    switch (e->event) {
+    case mqi_column_changed:
+        tbl = e->column.table.handle;
+        col = e->column.column.index;
+        break;
+    case mqi_row_inserted:
+    case mqi_row_deleted:
+        tbl = e->row.table.handle;
+        col = -1;
+        break;
+    default:
+        return;
+    }
+
+    for (i = 0, f = r->facts; i < r->nfact; i++, f++) {
+        if (f->table != tbl || f->colidx < 0)
+            continue;
+
+        if (col < 0 || col == f->colidx) {
+            mrp_debug("column fact '%s' changed", f->name);
+            f->stamp++;
+        }
+
+        f->tstamp = mqi_get_table_stamp(tbl);
+    }
+}
+
+
+static void track_column(mrp_resolver_t *r, fact_t *f)
+{
+    int i;
+
+    if (f->column == NULL || f->table == MQI_HANDLE_INVALID)
+        return;
+
+    f->colidx = mqi_get_column_index(f->table, f->column);
+
+    if (f->colidx < 0) {
+        mrp_log_error("No column '%s' for fact '%s', tracking whole table.",
+                      f->column, f->name);
+        return;
+    }
+
+    for (i = 0; mqi_get_column_name(f->table, i) != NULL; i++) {
+        if (mqi_create_column_trigger(f->table, i, column_event, r, NULL) < 0)
+            goto fail;
+    }
+
+    if (mqi_create_row_trigger(f->table, column_event, r, NULL) < 0)
+        goto fail;
+
+    /* never let the stamp go backwards when switching from the table stamp */
+    f->tstamp = mqi_get_table_stamp(f->table);
+    f->stamp  = MRP_MAX(f->stamp, f->tstamp) + 1;
+
+    return;
+
+ fail:
+    mrp_log_error("Failed to track column fact '%s', tracking whole table.",
+                  f->name);
+    untrack_column(r, f);
+}
+
+
+static void untrack_column(mrp_resolver_t *r, fact_t *f)
+{
+    fact_t *o;
+    int     i;
+
+    if (f->colidx < 0 || f->table == MQI_HANDLE_INVALID)
+        return;
+
+    f->colidx = -1;
+
+    /* the triggers are shared by all column facts of the same table */
+    for (i = 0, o = r->facts; i < r->nfact; i++, o++)
+        if (o->table == f->table && o->colidx >= 0)
+            return;
+
+    for (i = 0; mqi_get_column_name(f->table, i) != NULL; i++)
+        mqi_drop_column_trigger(f->table, i, column_event, r);
+
+    mqi_drop_row_trigger(f->table, column_event, r);
+}
+
+
 static void check_fact_tables(mrp_resolver_t *r)
 {
     fact_t *f;
@@ -0,0 +1,564 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <murphy/common/mm.h>
+#include <murphy/common/debug.h>
+#include <murphy/common/log.h>
+#include <murphy/common/profile.h>
+
+#include "resolver-types.h"
+#include "resolver.h"
+#include "fact.h"
+#include "target.h"
+#include "image.h"
+
+
+/*
+ * compiled resolver images
+ *
+ * An image is a snapshot of the resolver state right after the rule set
+ * has been parsed and the targets sorted: the targets with their
+ * dependencies and update scripts, the tracked facts and the sorted
+ * update orders of every target. It also records every input file that
+ * went into it (the rule file and everything it included) along with a
+ * hash of the file contents. As long as none of those have changed, the
+ * resolver is set up from the image, skipping parsing and sorting.
+ *
+ * The image is a flat sequence of little records: 32-bit integers in
+ * host byte order and strings stored as a length, the bytes and a
+ * terminating '\0' (length 0xffffffff for NULL). Images are only ever
+ * read back on the host that wrote them, so we don't bother with byte
+ * order or alignment.
+ */
+
+#define IMAGE_MAGIC   "MRPRSLV"
+#define IMAGE_VERSION 1
+#define NULL_STRING   0xffffffffU
+
+typedef struct {
+    const char *p;                       /* current read position */
+    const char *end;                     /* end of image */
+    int         error;                   /* whether we overran/failed */
+} cursor_t;
+
+
+static uint64_t hash_data(const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    uint64_t       h = 0xcbf29ce484222325ULL;
+
+    while (size-- > 0) {
+        h ^= *p++;
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+
+static int hash_file(const char *path, uint64_t *sizep, uint64_t *hashp)
+{
+    struct stat  st;
+    void        *data;
+    int          fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (data == MAP_FAILED)
+            return -1;
+
+        *hashp = hash_data(data, st.st_size);
+        munmap(data, st.st_size);
+    }
+    else {
+        close(fd);
+        *hashp = hash_data(NULL, 0);
+    }
+
+    *sizep = st.st_size;
+
+    return 0;
+}
+
+
+static uint32_t get_u32(cursor_t *c)
+{
+    uint32_t v;
+
+    if (c->error || c->end - c->p < (ptrdiff_t)sizeof(v)) {
+        c->error = TRUE;
+        return 0;
+    }
+
+    memcpy(&v, c->p, sizeof(v));
+    c->p += sizeof(v);
+
+    return v;
+}
+
+
+static uint64_t get_u64(cursor_t *c)
+{
+    uint64_t v;
+
+    if (c->error || c->end - c->p < (ptrdiff_t)sizeof(v)) {
+        c->error = TRUE;
+        return 0;
+    }
+
+    memcpy(&v, c->p, sizeof(v));
+    c->p += sizeof(v);
+
+    return v;
+}
+
+
+static const char *get_str(cursor_t *c)
+{
+    const char *s;
+    uint32_t    len;
+
+    if ((len = get_u32(c)) == NULL_STRING)
+        return NULL;
+
+    if (c->error || (uint64_t)(c->end - c->p) < (uint64_t)len + 1 ||
+        c->p[len] != '\0') {
+        c->error = TRUE;
+        return NULL;
+    }
+
+    s     = c->p;
+    c->p += len + 1;
+
+    return s;
+}
+
+
+/* Read an array of n ints, optionally followed by a -1 terminator. */
+static int *get_ints(cursor_t *c, int n, int terminate, int extra)
+{
+    int *arr;
+    int  i;
+
+    if (c->error || n < 0 || (c->end - c->p) / (ptrdiff_t)sizeof(int) < n) {
+        c->error = TRUE;
+        return NULL;
+    }
+
+    if ((arr = mrp_allocz_array(int, n + extra + (terminate ? 1 : 0))) == NULL) {
+        c->error = TRUE;
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++)
+        arr[i] = (int32_t)get_u32(c);
+
+    if (terminate)
+        arr[n] = -1;
+
+    return arr;
+}
+
+
+static void put_u32(FILE *fp, uint32_t v)
+{
+    fwrite(&v, sizeof(v), 1, fp);
+}
+
+
+static void put_u64(FILE *fp, uint64_t v)
+{
+    fwrite(&v, sizeof(v), 1, fp);
+}
+
+
+static void put_str(FILE *fp, const char *s)
+{
+    uint32_t len;
+
+    if (s == NULL) {
+        put_u32(fp, NULL_STRING);
+        return;
+    }
+
+    len = strlen(s);
+    put_u32(fp, len);
+    fwrite(s, 1, len + 1, fp);
+}
+
+
+static int count_ints(const int *arr)
+{
+    int n = 0;
+
+    if (arr != NULL)
+        while (arr[n] >= 0)
+            n++;
+
+    return n;
+}
+
+
+static void put_ints(FILE *fp, const int *arr, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        put_u32(fp, (uint32_t)arr[i]);
+}
+
+
+/*
+ * Check that the image is for the given rules and none of its inputs
+ * have changed. Leaves the cursor at the resolver state.
+ */
+static int check_image(cursor_t *c, const char *rules)
+{
+    const char *path;
+    uint64_t    size, hash, fsize, fhash;
+    uint32_t    ninput, i;
+
+    if (c->end - c->p < (ptrdiff_t)sizeof(IMAGE_MAGIC) ||
+        memcmp(c->p, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0)
+        return FALSE;
+
+    c->p += sizeof(IMAGE_MAGIC);
+
+    if (get_u32(c) != IMAGE_VERSION || get_u32(c) != sizeof(int))
+        return FALSE;
+
+    path = get_str(c);
+
+    if (path == NULL || strcmp(path, rules) != 0) {
+        mrp_debug("resolver image is for '%s', not '%s'",
+                  path ? path : "<none>", rules);
+        return FALSE;
+    }
+
+    ninput = get_u32(c);
+
+    for (i = 0; i < ninput && !c->error; i++) {
+        path = get_str(c);
+        size = get_u64(c);
+        hash = get_u64(c);
+
+        if (c->error || path == NULL)
+            return FALSE;
+
+        if (hash_file(path, &fsize, &fhash) < 0 ||
+            fsize != size || fhash != hash) {
+            mrp_log_info("Resolver input '%s' changed, ignoring image.", path);
+            return FALSE;
+        }
+    }
+
+    return !c->error;
+}
+
+
+static int build_from_image(mrp_resolver_t *r, cursor_t *c)
+{
+    const char **depends, *name, *type, *source, *fact;
+    target_t    *t;
+    int32_t      auto_update;
+    uint32_t     nfact, ntarget, ndepend, i, j;
+    int          nupdate, ntgt;
+
+    nfact       = get_u32(c);
+    ntarget     = get_u32(c);
+    auto_update = (int32_t)get_u32(c);
+
+    if (c->error || ntarget == 0 ||
+        auto_update < -1 || auto_update >= (int32_t)ntarget)
+        return -1;
+
+    for (i = 0; i < ntarget; i++) {
+        name    = get_str(c);
+        type    = get_str(c);
+        source  = get_str(c);
+        ndepend = get_u32(c);
+
+        if (c->error || name == NULL || ndepend > (uint32_t)(c->end - c->p))
+            return -1;
+
+        depends = NULL;
+
+        if (ndepend > 0) {
+            if ((depends = mrp_allocz_array(const char *, ndepend)) == NULL)
+                return -1;
+
+            for (j = 0; j < ndepend && !c->error; j++)
+                depends[j] = get_str(c);
+        }
+
+        if (c->error)
+            t = NULL;
+        else
+            t = create_target(r, name, depends, ndepend, type, source);
+
+        mrp_free(depends);
+
+        if (t == NULL)
+            return -1;
+
+        nupdate           = (int32_t)get_u32(c);
+        t->ndirect        = (int32_t)get_u32(c);
+        ntgt              = (int32_t)get_u32(c);
+        t->nupdate_fact   = nupdate;
+
+        if (c->error || nupdate < 0 || t->ndirect < 0 ||
+            t->ndirect > t->ndepend || ntgt < 1)
+            return -1;
+
+        if (nupdate > 0) {
+            t->update_facts = get_ints(c, nupdate, TRUE, 0);
+            t->fact_stamps  = mrp_allocz_array(uint32_t, nupdate);
+
+            if (t->fact_stamps == NULL)
+                return -1;
+        }
+
+        t->directs        = get_ints(c, t->ndirect, FALSE,
+                                     t->ndepend - t->ndirect + 1);
+        t->update_targets = get_ints(c, ntgt, TRUE, 0);
+
+        if (c->error)
+            return -1;
+
+        for (j = 0; j < (uint32_t)nupdate; j++)
+            if (t->update_facts[j] < 0 || t->update_facts[j] >= (int)nfact)
+                return -1;
+        for (j = 0; j < (uint32_t)ntgt; j++)
+            if (t->update_targets[j] < 0 ||
+                t->update_targets[j] >= (int)ntarget)
+                return -1;
+        for (j = 0; j < (uint32_t)t->ndirect; j++)
+            if (t->directs[j] < 0 || t->directs[j] >= nupdate)
+                return -1;
+    }
+
+    /* the facts were created along with the targets, in the same order */
+    if ((uint32_t)r->nfact != nfact)
+        return -1;
+
+    for (i = 0; i < nfact; i++) {
+        fact = get_str(c);
+
+        if (fact == NULL || strcmp(fact, r->facts[i].name) != 0)
+            return -1;
+    }
+
+    if (auto_update >= 0)
+        r->auto_update = r->targets + auto_update;
+
+    r->sorted = TRUE;
+
+    return c->error ? -1 : 0;
+}
+
+
+int load_resolver_image(mrp_resolver_t *r, const char *rules,
+                        const char *image)
+{
+    struct stat  st;
+    cursor_t     c;
+    void        *data;
+    int          fd, status, prof;
+
+    /* the image stores target and fact ids, so we need a pristine resolver */
+    if (r->ntarget != 0 || r->nfact != 0)
+        return -1;
+
+    if ((fd = open(image, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return -1;
+
+    prof    = mrp_profile_begin("load resolver image");
+    c.p     = data;
+    c.end   = c.p + st.st_size;
+    c.error = FALSE;
+
+    if (check_image(&c, rules)) {
+        status = build_from_image(r, &c);
+
+        /*
+         * Notes:
+         *     Once we started creating targets there is no going back
+         *     to parsing the rules with the same resolver, so we treat
+         *     a corrupt image as a fatal error at this point.
+         */
+
+        if (status < 0) {
+            mrp_log_error("Corrupt resolver image '%s'.", image);
+            status = -2;
+        }
+        else
+            mrp_log_info("Loaded resolver rules from image '%s'.", image);
+    }
+    else
+        status = -1;
+
+    mrp_profile_end(prof);
+    munmap(data, st.st_size);
+
+    return status;
+}
+
+
+int save_resolver_image(mrp_resolver_t *r, yy_res_parser_t *parser,
+                        const char *rules, const char *image)
+{
+    mrp_list_hook_t *p, *n;
+    yy_res_target_t *pt;
+    yy_res_input_t  *in;
+    target_t        *t;
+    char             tmp[PATH_MAX];
+    uint64_t         size, hash;
+    uint32_t         ninput;
+    int              i, j, auto_update;
+    FILE            *fp;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", image) >= (int)sizeof(tmp))
+        return -1;
+
+    for (in = parser->done, ninput = 0; in != NULL; in = in->prev)
+        ninput++;
+
+    auto_update = r->auto_update ? (int)(r->auto_update - r->targets) : -1;
+
+    if ((i = mkstemp(tmp)) < 0 || (fp = fdopen(i, "w")) == NULL) {
+        if (i >= 0) {
+            close(i);
+            unlink(tmp);
+        }
+        return -1;
+    }
+
+    fwrite(IMAGE_MAGIC, 1, sizeof(IMAGE_MAGIC), fp);
+    put_u32(fp, IMAGE_VERSION);
+    put_u32(fp, sizeof(int));
+    put_str(fp, rules);
+
+    put_u32(fp, ninput);
+    for (in = parser->done; in != NULL; in = in->prev) {
+        if (hash_file(in->name, &size, &hash) < 0)
+            goto fail;
+
+        put_str(fp, in->name);
+        put_u64(fp, size);
+        put_u64(fp, hash);
+    }
+
+    put_u32(fp, r->nfact);
+    put_u32(fp, r->ntarget);
+    put_u32(fp, (uint32_t)auto_update);
+
+    /* targets were created from the parsed ones, in the same order */
+    t = r->targets;
+    i = 0;
+    mrp_list_foreach(&parser->targets, p, n) {
+        pt = mrp_list_entry(p, typeof(*pt), hook);
+
+        if (i >= r->ntarget || strcmp(t->name, pt->name) != 0)
+            goto fail;
+
+        put_str(fp, t->name);
+        put_str(fp, pt->script_source ? pt->script_type : NULL);
+        put_str(fp, pt->script_source);
+
+        put_u32(fp, t->ndepend);
+        for (j = 0; j < t->ndepend; j++)
+            put_str(fp, t->depends[j]);
+
+        put_u32(fp, t->nupdate_fact);
+        put_u32(fp, t->ndirect);
+        put_u32(fp, count_ints(t->update_targets));
+        put_ints(fp, t->update_facts, t->nupdate_fact);
+        put_ints(fp, t->directs, t->ndirect);
+        put_ints(fp, t->update_targets, count_ints(t->update_targets));
+
+        t++;
+        i++;
+    }
+
+    if (i != r->ntarget)
+        goto fail;
+
+    for (i = 0; i < r->nfact; i++)
+        put_str(fp, r->facts[i].name);
+
+    if (ferror(fp) || fclose(fp) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+
+    if (rename(tmp, image) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+
+    mrp_log_info("Saved resolver image '%s'.", image);
+
+    return 0;
+
+ fail:
+    fclose(fp);
+    unlink(tmp);
+    return -1;
+}
@@ -31,9 +31,12 @@
 #define __MURPHY_RESOLVER_TYPES_H__
 
 #include <stdint.h>
+#include <pthread.h>
 
+#include <murphy/common/list.h>
 #include <murphy/common/mainloop.h>
 #include <murphy/common/hashtbl.h>
+#include <murphy/common/worker.h>
 #include <murphy/core/context.h>
 #include <murphy/core/scripting.h>
 
@@ -48,16 +51,20 @@ typedef struct fact_s   fact_t;          /* opaque type for tracked facts */
 struct target_s {
     char            *name;               /* target name */
     uint32_t         stamp;              /* touch-stamp */
+    uint32_t         changed;            /* stamp of last changing update */
     char           **depends;            /* dependencies stated in the input */
     int              ndepend;            /* number of dependencies */
     int             *update_facts;       /* facts to check when updating */
     int             *update_targets;     /* targets to check when updating */
     int             *directs;            /* direct dependencies */
     int              ndirect;            /* number of direct dependencies */
+    int              nupdate_fact;       /* number of update_facts */
+    int              level;              /* update level + 1, or 0 */
     uint32_t        *fact_stamps;        /* stamps of facts at last update */
     mrp_scriptlet_t *script;             /* update script if any, or NULL */
     int              prepared : 1;       /* ready for resolution */
     int              precompiled : 1;
+    int              stale : 1;          /* needs update regardless of facts */
 };
 
 
@@ -68,6 +75,9 @@ struct fact_s {
     char         *name;                  /* fact name */
     mqi_handle_t  table;                 /* associated DB table */
     uint32_t      stamp;                 /* touch-stamp */
+    char         *column;                /* tracked column, or NULL */
+    int           colidx;                /* tracked column index, or -1 */
+    uint32_t      tstamp;                /* table stamp at last change */
 };
 
 
@@ -80,9 +90,16 @@ struct mrp_resolver_s {
     int                nfact;            /* number of tracked facts */
     target_t          *auto_update;      /* target to resolve on fact changes */
     mrp_deferred_t    *auto_scheduled;   /* scheduled auto_update */
+    int                auto_pending;     /* whether auto_update is pending */
+    mrp_list_hook_t    pending;          /* pending coalesced updates */
     uint32_t           stamp;            /* update stamp */
     mrp_context_tbl_t *ctbl;             /* context variable table */
     int                level;            /* target update nesting level */
+    int                sorted;           /* whether targets have been sorted */
+    mrp_worker_pool_t *workers;          /* pool for concurrent updates */
+    pthread_mutex_t    wlock;            /* protects wbusy */
+    pthread_cond_t     wcond;            /* signalled when wbusy drops to 0 */
+    int                wbusy;            /* concurrent updates in progress */
 };
 
 
@@ -27,12 +27,15 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
 #include <errno.h>
 
 #include <murphy/common/mm.h>
 #include <murphy/common/debug.h>
 #include <murphy/common/log.h>
+#include <murphy/common/profile.h>
 
 #include "scanner.h"
 #include "resolver-types.h"
@@ -40,6 +43,7 @@
 #include "target-sorter.h"
 #include "fact.h"
 #include "resolver.h"
+#include "image.h"
 
 
 mrp_resolver_t *mrp_resolver_create(mrp_context_t *ctx)
@@ -49,6 +53,10 @@ mrp_resolver_t *mrp_resolver_create(mrp_context_t *ctx)
     r = mrp_allocz(sizeof(mrp_resolver_t));
 
     if (r != NULL) {
+        mrp_list_init(&r->pending);
+        pthread_mutex_init(&r->wlock, NULL);
+        pthread_cond_init(&r->wcond, NULL);
+
         r->ctx  = ctx;
         r->ctbl = mrp_create_context_table();
         r->bus  = mrp_event_bus_get(ctx->ml, MRP_RESOLVER_BUS);
@@ -56,6 +64,8 @@ mrp_resolver_t *mrp_resolver_create(mrp_context_t *ctx)
         if (r->ctbl != NULL && r->bus != NULL)
             return r;
 
+        pthread_cond_destroy(&r->wcond);
+        pthread_mutex_destroy(&r->wlock);
         mrp_free(r);
     }
 
@@ -66,7 +76,9 @@ mrp_resolver_t *mrp_resolver_create(mrp_context_t *ctx)
 mrp_resolver_t *mrp_resolver_parse(mrp_resolver_t *r, mrp_context_t *ctx,
                                    const char *path)
 {
-    yy_res_parser_t parser;
+    yy_res_parser_t  parser;
+    const char      *image;
+    int              status;
 
     mrp_clear(&parser);
 
@@ -77,10 +89,27 @@ mrp_resolver_t *mrp_resolver_parse(mrp_resolver_t *r, mrp_context_t *ctx,
             return NULL;
     }
 
+    /* try setting up from a compiled image if we have an up-to-date one */
+    if ((image = getenv(RESOLVER_IMAGE_ENVVAR)) != NULL && *image) {
+        status = load_resolver_image(r, path, image);
+
+        if (status == 0 && compile_target_scripts(r) == 0)
+            return r;
+
+        if (status != -1) {
+            mrp_resolver_destroy(r);
+            return NULL;
+        }
+    }
+
     if (parser_parse_file(&parser, path)) {
         if (create_targets(r, &parser) == 0 &&
             sort_targets(r)            == 0 &&
             compile_target_scripts(r)  == 0) {
+            if (image != NULL && *image &&
+                save_resolver_image(r, &parser, path, image) < 0)
+                mrp_log_warning("Failed to save resolver image '%s' (%s).",
+                                image, strerror(errno));
             parser_cleanup(&parser);
             return r;
         }
@@ -97,7 +126,13 @@ mrp_resolver_t *mrp_resolver_parse(mrp_resolver_t *r, mrp_context_t *ctx,
 
 int mrp_resolver_prepare(mrp_resolver_t *r)
 {
-    return (prepare_target_scripts(r) == 0);
+    int prof, status;
+
+    prof   = mrp_profile_begin("prepare resolver target scripts");
+    status = prepare_target_scripts(r);
+    mrp_profile_end(prof);
+
+    return (status == 0);
 }
 
 
@@ -108,6 +143,8 @@ void mrp_resolver_destroy(mrp_resolver_t *r)
         destroy_targets(r);
         destroy_facts(r);
 
+        pthread_cond_destroy(&r->wcond);
+        pthread_mutex_destroy(&r->wlock);
         mrp_free(r);
     }
 }
@@ -118,8 +155,16 @@ int mrp_resolver_add_target(mrp_resolver_t *r, const char *target,
                             const char *script_type,
                             const char *script_source)
 {
-    return (create_target(r, target, depend, ndepend,
-                          script_type, script_source) != NULL);
+    target_t *t;
+
+    t = create_target(r, target, depend, ndepend, script_type, script_source);
+
+    if (t == NULL)
+        return FALSE;
+
+    sort_new_target(r, t);
+
+    return TRUE;
 }
 
 
@@ -127,8 +172,16 @@ int mrp_resolver_add_alias(mrp_resolver_t *r, const char *target,
                            const char *alias)
 {
     const char *depend[1] = { target };
+    target_t   *t;
+
+    t = create_target(r, alias, depend, 1, NULL, NULL);
 
-    return (create_target(r, alias, depend, 1, NULL, NULL) != NULL);
+    if (t == NULL)
+        return FALSE;
+
+    sort_new_target(r, t);
+
+    return TRUE;
 }
 
 
@@ -160,6 +213,8 @@ int mrp_resolver_add_prepared_target(mrp_resolver_t *r, const char *target,
         t->precompiled = TRUE;
         t->prepared    = TRUE;
 
+        sort_new_target(r, t);
+
         return TRUE;
     }
 
@@ -173,6 +228,25 @@ int mrp_resolver_enable_autoupdate(mrp_resolver_t *r, const char *name)
 }
 
 
+int mrp_resolver_invalidate(mrp_resolver_t *r)
+{
+    return invalidate_targets(r);
+}
+
+
+int mrp_resolver_set_worker_pool(mrp_resolver_t *r, mrp_worker_pool_t *pool)
+{
+    if (r->level > 0) {
+        errno = EBUSY;
+        return FALSE;
+    }
+
+    r->workers = pool;
+
+    return TRUE;
+}
+
+
 int mrp_resolver_update_targetl(mrp_resolver_t *r, const char *target, ...)
 {
     const char         *name;
@@ -278,6 +352,28 @@ int mrp_resolver_update_targetv(mrp_resolver_t *r, const char *target,
 }
 
 
+int mrp_resolver_schedule_targetv(mrp_resolver_t *r, const char *target,
+                                  const char **variables,
+                                  mrp_script_value_t *values,
+                                  int nvariable,
+                                  mrp_resolver_update_cb_t cb,
+                                  void *user_data)
+{
+    int ids[nvariable > 0 ? nvariable : 1];
+    int i;
+
+    for (i = 0; i < nvariable; i++) {
+        if ((ids[i] = mrp_get_context_id(r->ctbl, variables[i])) <= 0) {
+            errno = ESRCH;
+            return FALSE;
+        }
+    }
+
+    return schedule_target_update(r, target, ids, values, nvariable,
+                                  cb, user_data);
+}
+
+
 void mrp_resolver_dump_targets(mrp_resolver_t *r, FILE *fp)
 {
     fprintf(fp, "%d target%s\n", r->ntarget, r->ntarget != 1 ? "s" : "");
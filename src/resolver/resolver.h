@@ -36,6 +36,7 @@
 typedef struct mrp_resolver_s mrp_resolver_t;
 
 #include <murphy/common/macros.h>
+#include <murphy/common/worker.h>
 #include <murphy/core/context.h>
 #include <murphy/core/scripting.h>
 
@@ -80,6 +81,9 @@ int mrp_resolver_add_alias(mrp_resolver_t *r, const char *target,
 /** Enable autoupdate, generate autoupdate target if needed. */
 int mrp_resolver_enable_autoupdate(mrp_resolver_t *r, const char *name);
 
+/** Mark all targets out of date and schedule an autoupdate. */
+int mrp_resolver_invalidate(mrp_resolver_t *r);
+
 /** Destroy the given resolver context, freeing all associated resources. */
 void mrp_resolver_destroy(mrp_resolver_t *r);
 
@@ -101,6 +105,30 @@ int mrp_resolver_update_targetv(mrp_resolver_t *r, const char *target,
                                 mrp_script_value_t *values,
                                 int nvariable);
 
+/** Callback to notify about the completion of a scheduled update. */
+typedef void (*mrp_resolver_update_cb_t)(mrp_resolver_t *r,
+                                         const char *target, int status,
+                                         void *user_data);
+
+/** Schedule an update of the given target. Updates scheduled for the
+    same target within the same mainloop iteration are coalesced into a
+    single update, with the context variables of later requests taking
+    precedence over earlier ones. The callback, if given, is called with
+    the status of the update, or -ECANCELED if the resolver is destroyed
+    before the update takes place. */
+int mrp_resolver_schedule_targetv(mrp_resolver_t *r, const char *target,
+                                  const char **variables,
+                                  mrp_script_value_t *values,
+                                  int nvariable,
+                                  mrp_resolver_update_cb_t cb,
+                                  void *user_data);
+
+/** Execute independent targets with MRP_INTERPRETER_CONCURRENT scripts
+    in parallel in the given worker pool during updates. The pool is not
+    owned by the resolver and must outlive it or be detached by passing
+    NULL, which also switches back to strictly sequential updates. */
+int mrp_resolver_set_worker_pool(mrp_resolver_t *r, mrp_worker_pool_t *pool);
+
 /** Declare a context variable with a given type. */
 int mrp_resolver_declare_variable(mrp_resolver_t *r, const char *name,
                                   mrp_script_type_t type);
@@ -64,6 +64,7 @@ void destroy_call(function_call_t *c)
     if (c != NULL) {
         mrp_list_delete(&c->hook);
         mrp_free(c->name);
+        mrp_free(c->frame);
         destroy_arguments(c->args, c->narg);
         mrp_free(c);
     }
@@ -159,55 +160,118 @@ int link_call(function_call_t *c)
     return TRUE;
 }
 
-int execute_call(function_call_t *c, mrp_context_tbl_t *tbl)
+int compile_call(function_call_t *c)
 {
-    mrp_script_env_t   env;
-    mrp_script_value_t args[c->narg];
-    arg_t             *a;
-    int                narg, n, status;
+    arg_t *a;
+    int    n;
 
-    if (MRP_UNLIKELY(c->script_ptr == NULL)) {
-        if (!link_call(c))
-            return -ENOENT;
+    /*
+     * Lower the call into a preallocated argument frame: constants are
+     * put into the frame once here, context variables get a slot of their
+     * own and are only fetched into it when the call is executed.
+     */
+
+    if (c->compiled)
+        return TRUE;
+
+    if (!link_call(c))
+        return FALSE;
+
+    if (c->narg > 0 && c->frame == NULL) {
+        if ((c->frame = mrp_allocz_array(typeof(*c->frame), c->narg)) == NULL)
+            return FALSE;
     }
 
-    mrp_push_context_frame(tbl);
+    c->nvalue = c->nset = 0;
 
-    for (n = narg = 0, a = c->args; n < (int)MRP_ARRAY_SIZE(args); n++, a++) {
+    for (n = 0, a = c->args; n < c->narg; n++, a++) {
         switch (a->type) {
         case ARG_CONST_VALUE:
-            args[narg++] = a->cst.value;
+            c->frame[c->nvalue++] = a->cst.value;
             break;
         case ARG_CONTEXT_VAR:
-            if (a->val.id <= 0)
-                a->val.id = mrp_get_context_id(tbl, a->val.name);
-            if (mrp_get_context_value(tbl, a->val.id, args + narg) < 0) {
+            a->val.slot = c->nvalue++;
+            break;
+        case ARG_CONTEXT_SET:
+            c->nset++;
+            break;
+        default:
+            errno = EINVAL;
+            return FALSE;
+        }
+    }
+
+    c->compiled = TRUE;
+
+    return TRUE;
+}
+
+
+static void bind_call(function_call_t *c, mrp_context_tbl_t *tbl)
+{
+    arg_t *a;
+    int    n;
+
+    for (n = 0, a = c->args; n < c->narg; n++, a++) {
+        if (a->type == ARG_CONTEXT_VAR)
+            a->val.id = mrp_get_context_id(tbl, a->val.name);
+        else if (a->type == ARG_CONTEXT_SET)
+            a->set.id = mrp_get_context_id(tbl, a->set.name);
+    }
+
+    c->tbl = tbl;
+}
+
+
+int execute_call(function_call_t *c, mrp_context_tbl_t *tbl)
+{
+    mrp_script_env_t  env;
+    arg_t            *a;
+    int               n, status;
+
+    if (MRP_UNLIKELY(!c->compiled)) {
+        if (!compile_call(c))
+            return -ENOENT;
+    }
+
+    if (MRP_UNLIKELY(c->tbl != tbl))
+        bind_call(c, tbl);
+
+    /* only assignments need a frame of their own to be undone in */
+    if (c->nset > 0)
+        mrp_push_context_frame(tbl);
+
+    status = 0;
+
+    for (n = 0, a = c->args; n < c->narg; n++, a++) {
+        switch (a->type) {
+        case ARG_CONTEXT_VAR:
+            if (mrp_get_context_value(tbl, a->val.id,
+                                      c->frame + a->val.slot) < 0) {
                 status = -ENOENT;
                 goto pop_frame;
             }
-            narg++;
             break;
         case ARG_CONTEXT_SET:
-            if (a->set.id <= 0)
-                a->set.id = mrp_get_context_id(tbl, a->set.name);
             if (mrp_set_context_value(tbl, a->set.id, &a->set.value) < 0) {
                 status = -errno;
                 goto pop_frame;
             }
+            break;
         default:
-            status = -EINVAL;
-            goto pop_frame;
+            break;
         }
     }
 
-    env.args = args;
-    env.narg = narg;
+    env.args = c->frame;
+    env.narg = c->nvalue;
     env.ctbl = tbl;
 
     status = c->script_ptr(c->plugin, c->name, &env);
 
  pop_frame:
-    mrp_pop_context_frame(tbl);
+    if (c->nset > 0)
+        mrp_pop_context_frame(tbl);
 
     return status;
 }
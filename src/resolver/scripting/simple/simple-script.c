@@ -93,15 +93,31 @@ static int simple_prepare(mrp_scriptlet_t *s)
     simple_script_t *ss = s->compiled;
     mrp_list_hook_t *p, *n;
     function_call_t *c;
+    int              ncall;
 
     if (ss != NULL) {
+        ncall = 0;
         mrp_list_foreach(&ss->statements, p, n) {
             c = mrp_list_entry(p, typeof(*c), hook);
 
-            if (!link_call(c)) {
+            if (!compile_call(c)) {
                 errno = ENOENT;
                 return -1;
             }
+
+            ncall++;
+        }
+
+        if (ss->calls == NULL && ncall > 0) {
+            ss->calls = mrp_allocz_array(typeof(*ss->calls), ncall);
+
+            if (ss->calls == NULL)
+                return -1;
+
+            mrp_list_foreach(&ss->statements, p, n) {
+                c = mrp_list_entry(p, typeof(*c), hook);
+                ss->calls[ss->ncall++] = c;
+            }
         }
 
         return 0;
@@ -118,9 +134,20 @@ static int simple_execute(mrp_scriptlet_t *s, mrp_context_tbl_t *tbl)
     simple_script_t *ss = s->compiled;
     mrp_list_hook_t *p, *n;
     function_call_t *c;
-    int              status;
+    int              status, i;
 
-    if (ss != NULL) {
+    if (ss == NULL)
+        return TRUE;
+
+    if (MRP_LIKELY(ss->calls != NULL)) {
+        for (i = 0; i < ss->ncall; i++) {
+            status = execute_call(ss->calls[i], tbl);
+
+            if (status <= 0)
+                return status;
+        }
+    }
+    else {
         mrp_list_foreach(&ss->statements, p, n) {
             c = mrp_list_entry(p, typeof(*c), hook);
 
@@ -137,10 +164,22 @@ static int simple_execute(mrp_scriptlet_t *s, mrp_context_tbl_t *tbl)
 
 static void simple_cleanup(mrp_scriptlet_t *s)
 {
-    MRP_UNUSED(s);
+    simple_script_t *ss = s->compiled;
+    mrp_list_hook_t *p, *n;
+    function_call_t *c;
+
     MRP_UNUSED(simple_dump);
 
-    return;
+    if (ss != NULL) {
+        mrp_list_foreach(&ss->statements, p, n) {
+            c = mrp_list_entry(p, typeof(*c), hook);
+            destroy_call(c);
+        }
+
+        mrp_free(ss->calls);
+        mrp_free(ss);
+        s->compiled = NULL;
+    }
 }
 
 MRP_REGISTER_INTERPRETER("simple",
@@ -33,11 +33,6 @@
 #include <murphy/core/plugin.h>
 #include <murphy/core/scripting.h>
 
-typedef struct {
-    mrp_list_hook_t statements;          /* list of (call) statements */
-} simple_script_t;
-
-
 typedef enum {
     ARG_UNKNOWN = 0,
     ARG_CONST_VALUE,
@@ -56,6 +51,7 @@ typedef struct {
     arg_type_t  type;                    /* ARG_CONTEXT_VAR */
     char       *name;                    /* name of variable */
     int         id;                      /* variable id */
+    int         slot;                    /* index in argument frame */
 } ctx_val_arg_t;
 
 
@@ -84,7 +80,20 @@ typedef struct {
     int          (*script_ptr)(mrp_plugin_t *plugin, const char *name,
                                mrp_script_env_t *env);
     mrp_plugin_t  *plugin;
+
+    mrp_script_value_t *frame;           /* preallocated argument frame */
+    int                 nvalue;          /* number of values in frame */
+    int                 nset;            /* number of context assignments */
+    int                 compiled;        /* whether frame is set up */
+    mrp_context_tbl_t  *tbl;             /* table variable ids are for */
 } function_call_t;
 
 
+typedef struct {
+    mrp_list_hook_t   statements;        /* list of (call) statements */
+    function_call_t **calls;             /* statements lowered to an array */
+    int               ncall;             /* number of calls */
+} simple_script_t;
+
+
 #endif /* __MURPHY_SIMPLE_SCRIPT_H__ */
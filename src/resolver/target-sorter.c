@@ -32,6 +32,9 @@
 #include <murphy/common/mm.h>
 #include <murphy/common/debug.h>
 #include <murphy/common/log.h>
+#include <murphy/common/hashtbl.h>
+#include <murphy/common/utils.h>
+#include <murphy/common/profile.h>
 
 #include "scanner.h"
 #include "resolver.h"
@@ -43,12 +46,21 @@
 
 /*
  * dependency graph used to determine target update orders
+ *
+ * The graph has a node for every fact and target, facts first. The
+ * dependencies of every node are stored in compressed sparse row format:
+ * the dependencies of node n are deps[first[n]] ... deps[first[n+1]-1].
+ * A dependency of -1 is a target we could not find.
  */
 
 typedef struct {
     mrp_resolver_t *r;                   /* resolver context */
-    int            *edges;               /* edges between nodes */
     int             nnode;               /* number of graph nodes */
+    int            *first;               /* first dependency of each node */
+    int            *deps;                /* dependencies of all nodes */
+    uint32_t       *mark;                /* node visit marks */
+    uint32_t        gen;                 /* current visit generation */
+    int            *order;               /* buffer for sorting results */
 } graph_t;
 
 
@@ -58,38 +70,51 @@ static void free_graph(graph_t *g);
 static void dump_graph(graph_t *g, FILE *fp);
 
 
+static inline int target_sorted(target_t *t)
+{
+    return t->update_targets != NULL;
+}
+
+
 int sort_targets(mrp_resolver_t *r)
 {
     graph_t *g;
-    int      i, status;
+    int      i, status, prof;
+
+    /*
+     * Notes:
+     *     Targets cannot be changed or removed once created, so the
+     *     update order of an already sorted target never changes. We
+     *     only need to sort the targets that have not been sorted yet.
+     */
 
-    g = build_graph(r);
+    for (i = 0; i < r->ntarget; i++)
+        if (!target_sorted(r->targets + i))
+            break;
+
+    if (i == r->ntarget)
+        return 0;
+
+    prof = mrp_profile_begin("sort resolver targets");
+    g    = build_graph(r);
 
     if (g != NULL) {
-        dump_graph(g, stdout);
+        mrp_debug_code(dump_graph(g, stdout));
 
         status = 0;
 
         for (i = 0; i < r->ntarget; i++) {
-            target_t *t = r->targets + i;
-
-            mrp_free(t->update_targets);
-            mrp_free(t->update_facts);
-            mrp_free(t->fact_stamps);
-            mrp_free(t->directs);
-            t->update_targets = NULL;
-            t->update_facts   = NULL;
-            t->fact_stamps    = NULL;
-            t->ndirect        = 0;
-        }
+            if (target_sorted(r->targets + i))
+                continue;
 
-        for (i = 0; i < r->ntarget; i++) {
             if (sort_graph(g, i) < 0) {
                 mrp_log_error("Failed to determine update order for "
                               "resolver target '%s'.", r->targets[i].name);
 
                 if (errno == ELOOP)
                     mrp_log_error("Cyclic dependency detected.");
+                else if (errno == ENOENT)
+                    mrp_log_error("Unknown dependency.");
 
                 status = -1;
                 break;
@@ -97,35 +122,40 @@ int sort_targets(mrp_resolver_t *r)
         }
 
         free_graph(g);
+
+        if (status == 0)
+            r->sorted = TRUE;
     }
     else
         status = -1;
 
+    mrp_profile_end(prof);
+
     return status;
 }
 
 
-static inline int fact_id(graph_t *g, char *fact)
+int sort_new_target(mrp_resolver_t *r, target_t *t)
 {
-    int i;
+    graph_t *g;
+    int      status;
 
-    for (i = 0; i < g->r->nfact; i++)
-        if (!strcmp(fact, g->r->facts[i].name))
-            return i;
+    /* we only sort newly added targets once the ruleset has been sorted */
+    if (!r->sorted)
+        return 0;
 
-    return -1;
-}
+    if ((g = build_graph(r)) == NULL)
+        return -1;
 
+    status = sort_graph(g, t - r->targets);
 
-static inline int target_id(graph_t *g, char *target)
-{
-    int i;
+    if (status < 0)
+        mrp_debug("could not sort new target '%s' yet (%s)", t->name,
+                  errno == ELOOP ? "cyclic dependency" : "unknown dependency");
 
-    for (i = 0; i < g->r->ntarget; i++)
-        if (!strcmp(target, g->r->targets[i].name))
-            return g->r->nfact + i;
+    free_graph(g);
 
-    return -1;
+    return status;
 }
 
 
@@ -138,384 +168,220 @@ static inline char *node_name(graph_t *g, int id)
 }
 
 
-static inline int node_id(graph_t *g, char *name)
-{
-    if (name[0] == '$')
-        return fact_id(g, name);
-    else
-        return target_id(g, name);
-}
-
-
-static inline int *edge_markp(graph_t *g, int n1, int n2)
-{
-    static int invalid = 0;
-
-    if (n1 >= 0 && n2 >= 0)
-        return g->edges + (n1 * g->nnode) + n2;
-    else
-        return &invalid;
-}
-
-
-static inline void mark_node(graph_t *g, int node)
-{
-    *edge_markp(g, node, node) = 1;
-}
-
-
-static inline void unmark_node(graph_t *g, int node)
-{
-    *edge_markp(g, node, node) = 0;
-}
-
-
-static inline int node_present(graph_t *g, int node)
-{
-    return *edge_markp(g, node, node) == 1;
-}
-
-
 static graph_t *build_graph(mrp_resolver_t *r)
 {
-    graph_t  *g;
-    int       tid, did, i, j;
-    target_t *t;
+    mrp_htbl_config_t  hcfg;
+    mrp_htbl_t        *names;
+    graph_t           *g;
+    target_t          *t;
+    void              *id;
+    int                nedge, tid, i, j;
+
+    mrp_clear(&hcfg);
+    hcfg.nentry = r->nfact + r->ntarget;
+    hcfg.comp   = mrp_string_comp;
+    hcfg.hash   = mrp_string_hash;
+    hcfg.free   = NULL;
+
+    if ((names = mrp_htbl_create(&hcfg)) == NULL)
+        return NULL;
 
     g = mrp_allocz(sizeof(*g));
 
-    if (g != NULL) {
-        g->r     = r;
-        g->nnode = r->nfact + r->ntarget;
-        g->edges = mrp_allocz(g->nnode * g->nnode * sizeof(*g->edges));
-
-        if (g->edges == NULL)
-            goto fail;
-
-        for (i = 0; i < r->ntarget; i++) {
-            t   = r->targets + i;
-            tid = r->nfact + i;
+    if (g == NULL)
+        goto fail;
 
-            for (j = 0; j < t->ndepend; j++) {
-                mrp_debug("adding edge: %s <- %s", t->depends[j], t->name);
-                did = node_id(g, t->depends[j]);
+    g->r     = r;
+    g->nnode = r->nfact + r->ntarget;
 
-                if (did < 0)
-                    goto fail;
+    for (i = 0, nedge = 0; i < r->ntarget; i++)
+        nedge += r->targets[i].ndepend;
 
-                *edge_markp(g, did, tid) = 1;
-            }
-        }
-    }
-
-    return g;
-
- fail:
-    if (g != NULL) {
-        mrp_free(g->edges);
-        mrp_free(g);
-    }
-    return NULL;
-}
+    g->first = mrp_allocz_array(int, g->nnode + 1);
+    g->deps  = mrp_allocz_array(int, nedge + 1);
+    g->mark  = mrp_allocz_array(uint32_t, g->nnode);
+    g->order = mrp_allocz_array(int, g->nnode);
 
+    if (!g->first || !g->deps || !g->mark || !g->order)
+        goto fail;
 
-static int mark_present_nodes(graph_t *g, int target_idx)
-{
-    int       tid, did, i;
-    target_t *t;
+    /* node ids are stored off by one, to keep them distinct from NULL */
+    for (i = 0; i < r->nfact; i++)
+        if (!mrp_htbl_insert(names, r->facts[i].name,
+                             (void *)(ptrdiff_t)(i + 1)))
+            goto fail;
 
-    tid = g->r->nfact + target_idx;
-    t   = g->r->targets + target_idx;
+    for (i = 0; i < r->ntarget; i++)
+        if (!mrp_htbl_insert(names, r->targets[i].name,
+                             (void *)(ptrdiff_t)(r->nfact + i + 1)))
+            goto fail;
 
-    if (node_present(g, tid))
-        return TRUE;
+    nedge = 0;
 
-    mark_node(g, tid);
+    for (i = 0; i < r->nfact; i++)
+        g->first[i] = nedge;
 
-    for (i = 0; i < t->ndepend; i++) {
-        did = node_id(g, t->depends[i]);
+    for (i = 0; i < r->ntarget; i++) {
+        t   = r->targets + i;
+        tid = r->nfact + i;
 
-        if (did < 0)
-            return FALSE;
+        g->first[tid] = nedge;
 
-        if (*t->depends[i] == '$')
-            mark_node(g, did);
-        else {
-            if (!mark_present_nodes(g, did - g->r->nfact))
-                return FALSE;
+        for (j = 0; j < t->ndepend; j++) {
+            mrp_debug("adding edge: %s <- %s", t->depends[j], t->name);
+            id = mrp_htbl_lookup(names, t->depends[j]);
+            g->deps[nedge++] = (int)(ptrdiff_t)id - 1;
         }
     }
 
-    return TRUE;
-}
+    g->first[g->nnode] = nedge;
 
+    mrp_htbl_destroy(names, FALSE);
 
-/*
- * queues we use for topological sorting
- */
+    return g;
 
-typedef struct {
-    int  size;                           /* max queue capacity */
-    int *items;                          /* queue item buffer */
-    int  head;                           /* push index */
-    int  tail;                           /* pop index */
-} que_t;
+ fail:
+    mrp_htbl_destroy(names, FALSE);
+    free_graph(g);
 
-#define EMPTY_QUE {.items = NULL }       /* initializer for empty queue */
+    return NULL;
+}
 
 
-static int que_init(que_t *q, int size)
+static int visit_node(graph_t *g, int node, int *norder)
 {
-    mrp_free(q->items);
+    int i, dep;
 
-    q->items = mrp_alloc(size * sizeof(*q->items));
+    /*
+     * Notes:
+     *     This is a depth-first traversal, which produces the nodes a
+     *     node depends on in a topological order (post-order), the node
+     *     itself being the last. Nodes being visited are marked with
+     *     gen, visited ones with gen + 1. Running into a node which is
+     *     being visited means a cyclic dependency.
+     */
 
-    if (q->items != NULL) {
-        q->size = size;
-        q->head = 0;
-        q->tail = 0;
+    if (g->mark[node] == g->gen + 1)
+        return 0;
 
-        return TRUE;
+    if (g->mark[node] == g->gen) {
+        errno = ELOOP;
+        return -1;
     }
-    else
-        return FALSE;
-}
-
-
-static void que_cleanup(que_t *q)
-{
-    mrp_free(q->items);
-    q->items = NULL;
-}
 
+    g->mark[node] = g->gen;
 
-static void que_push(que_t *q, int item)
-{
-    /* we know the max size, so we don't check for overflow here */
-    q->items[q->tail++] = item;
-    q->tail            %= q->size;
-}
+    for (i = g->first[node]; i < g->first[node + 1]; i++) {
+        if ((dep = g->deps[i]) < 0) {
+            errno = ENOENT;
+            return -1;
+        }
 
+        if (visit_node(g, dep, norder) < 0)
+            return -1;
+    }
 
-static int que_pop(que_t *q, int *itemp)
-{
-    if (q->head != q->tail) {
-        *itemp   = q->items[q->head++];
-        q->head %= q->size;
+    g->mark[node] = g->gen + 1;
+    g->order[(*norder)++] = node;
 
-        return TRUE;
-    }
-    else {
-        *itemp = -1;
-        return FALSE;
-    }
+    return 0;
 }
 
 
 static int sort_graph(graph_t *g, int target_idx)
 {
-    /*
-     * Notes:
-     *
-     *   We perform a topological sort of the dependency graph here
-     *   for our target with the given idx. We include only nodes
-     *   for facts and targets which are relevant for our target.
-     *   These are the ones which our target directly or indirectly
-     *   depends on. We use the otherwise unused diagonal (no target
-     *   can depend on itself) of our edge matrix to mark which nodes
-     *   are present in the graph. Then we use the following algorithm
-     *   to sort the subgraph of relevant nodes:
-     *
-     *       initialize que L to be empty
-     *       initialize que Q with all nodes without incoming edges
-     *       while Q is not empty
-     *           pop a node <n> from Q
-     *           push <n> to L
-     *           remove all edges that start from <n>
-     *           for all nodes <m> where we removed an incoming node
-     *               if <m> has no more incoming edges
-     *                   push <m> to Q
-     *
-     *       if there are any remaining edges
-     *           return an error about cyclic dependency
-     *       else
-     *           L is the sorted subgraph (our target is the last item in L)
-     *
-     *   The resulted sort order of our target is then used as the
-     *   dependency check/update order when the resolver is asked to
-     *   update that target.
-     */
-
-    target_t *target;
-    int       edges[g->nnode * g->nnode];
-    que_t     L = EMPTY_QUE, Q = EMPTY_QUE;
-    int       i, j, m, id, node, nedge, nfact, ntarget;
-
-    target = g->r->targets + target_idx;
+    mrp_resolver_t *r = g->r;
+    target_t       *target;
+    int             i, j, id, norder, nfact, ntarget;
 
-    /* save full graph */
-    memcpy(edges, g->edges, sizeof(edges));
+    target = r->targets + target_idx;
 
-    if (!que_init(&L, g->nnode + 1) || !que_init(&Q, g->nnode))
-        goto fail;
-
-    /* find and mark relevant nodes in the graph */
-    mark_present_nodes(g, target_idx);
-
-    mrp_debug("-- target %s --", target->name);
-    /*dump_graph(g, stdout);*/
-
-    /* push all relevant facts, they do not depend on anything */
-    for (i = 0; i < g->r->nfact; i++) {
-        id = i;
-        if (node_present(g, id)) {
-            que_push(&Q, id);
-            unmark_node(g, id);
-        }
-    }
-
-    /* push all relevant targets that have no dependencies */
-    for (i = 0; i < g->r->ntarget; i++) {
-        id = g->r->nfact + i;
-        if (g->r->targets[i].depends == NULL && node_present(g, id)) {
-            que_push(&Q, id);
-            unmark_node(g, id);
-        }
-    }
+    if (target_sorted(target))
+        return 0;
 
-    /* try sorting the marked subgraph */
-    while (que_pop(&Q, &node)) {
-        que_push(&L, node);
+    g->gen += 2;
+    norder  = 0;
 
-        mrp_debug("popped node %s", node_name(g, node));
-
-        for (m = 0; m < g->nnode; m++) {
-            if (m == node || !node_present(g, m))
-                continue;
-            *edge_markp(g, node, m) = 0;
-            nedge = 0;
-            for (j = 0; j < g->nnode; j++) {
-                if (j == m)
-                    continue;
-                if (node_present(g, j) && *edge_markp(g, j, m))
-                    nedge++;
-            }
-            if (nedge == 0) {
-                mrp_debug("node %s empty, pushing it", node_name(g, m));
-                que_push(&Q, m);
-                unmark_node(g, m);
-            }
-            else
-                mrp_debug("node %s not empty yet", node_name(g, m));
-        }
-    }
-
-    /* check if the subgraph has any remaining edges */
-    nedge = 0;
-    for (node = 0; node < g->nnode; node++) {
-        if (!node_present(g, node))
-            continue;
-        for (m = 0; m < g->nnode; m++) {
-            if (m == node || !node_present(g, m))
-                continue;
-            if (*edge_markp(g, node, m) == 1) {
-                errno = ELOOP;
-                goto fail;
-            }
-        }
-    }
+    if (visit_node(g, r->nfact + target_idx, &norder) < 0)
+        return -1;
 
     mrp_debug("----- %s: graph sorted successfully -----", target->name);
 
-    for (i = 0; i < L.tail; i++)
-        mrp_debug(" %s", node_name(g, L.items[i]));
+    for (i = 0; i < norder; i++)
+        mrp_debug(" %s", node_name(g, g->order[i]));
     mrp_debug("-----");
 
-    /* save the result in the given target */
-    if (L.tail > 0) {
-        nfact   = 0;
-        ntarget = 0;
+    /* save the result in the given target, facts first */
+    nfact   = 0;
+    ntarget = 0;
 
-        for (i = 0; i < L.tail; i++) {
-            if (L.items[i] < g->r->nfact)
-                nfact++;
-            else
-                ntarget++;
-        }
+    for (i = 0; i < norder; i++) {
+        if (g->order[i] < r->nfact)
+            nfact++;
+        else
+            ntarget++;
+    }
 
-        if (nfact > 0) {
-            target->update_facts = mrp_alloc_array(int, nfact + 1);
-            target->fact_stamps  = mrp_allocz_array(uint32_t, nfact);
+    if (nfact > 0) {
+        target->update_facts = mrp_alloc_array(int, nfact + 1);
+        target->fact_stamps  = mrp_allocz_array(uint32_t, nfact);
 
-            if (target->update_facts != NULL && target->fact_stamps != NULL) {
-                for (i = 0; i < nfact; i++)
-                    target->update_facts[i] = L.items[i];
-                target->update_facts[i] = -1;
-            }
-            else
-                goto fail;
-        }
-
-        if (ntarget > 0) {
-            target->update_targets = mrp_alloc_array(int, ntarget + 1);
-            if (target->update_targets != NULL) {
-                for (i = 0; i < ntarget; i++)
-                    target->update_targets[i] = L.items[nfact+i] - g->r->nfact;
-                target->update_targets[i] = -1;
-            }
-            else
-                goto fail;
-        }
+        if (target->update_facts == NULL || target->fact_stamps == NULL)
+            goto fail;
 
-        target->ndirect = 0;
-        target->directs = mrp_allocz_array(int, target->ndepend);
+        for (i = 0, j = 0; i < norder; i++)
+            if (g->order[i] < r->nfact)
+                target->update_facts[j++] = g->order[i];
+        target->update_facts[j] = -1;
+    }
 
-        if (target->ndepend == 0 || target->directs != NULL) {
-            fact_t   *f;
-            target_t *t;
+    target->nupdate_fact = nfact;
 
-            for (i = 0; i < target->ndepend; i++) {
-                if (*target->depends[i] != '$')
-                    continue;
+    /* direct fact dependencies, as indices to update_facts */
+    target->ndirect = 0;
+    target->directs = mrp_allocz_array(int, target->ndepend + 1);
 
-                f = lookup_fact(g->r, target->depends[i]);
+    if (target->directs == NULL)
+        goto fail;
 
-                if (f != NULL)
-                    target->directs[target->ndirect++] = f - g->r->facts;
-                else
-                    target->directs[target->ndirect++] = -1;
-            }
+    for (i = g->first[r->nfact + target_idx];
+         i < g->first[r->nfact + target_idx + 1]; i++) {
+        if ((id = g->deps[i]) >= r->nfact)
+            continue;
 
-            for (i = 0; i < target->ndepend; i++) {
-                if (*target->depends[i] == '$')
-                    continue;
+        for (j = 0; j < nfact; j++)
+            if (target->update_facts[j] == id)
+                target->directs[target->ndirect++] = j;
+    }
 
-                t = lookup_target(g->r, target->depends[i]);
+    target->update_targets = mrp_alloc_array(int, ntarget + 1);
 
-                if (t != NULL)
-                    target->directs[target->ndirect++] = g->r->nfact +
-                        t - g->r->targets;
-                else
-                    target->directs[target->ndirect++] = -1;
-            }
-        }
-        else
-            goto fail;
-    }
+    if (target->update_targets == NULL)
+        goto fail;
 
-    que_cleanup(&L);
-    que_cleanup(&Q);
+    for (i = 0, j = 0; i < norder; i++)
+        if (g->order[i] >= r->nfact)
+            target->update_targets[j++] = g->order[i] - r->nfact;
+    target->update_targets[j] = -1;
 
-    /* restore the original full graph */
-    memcpy(g->edges, edges, sizeof(edges));
+    /* make sure any targets we depend on are sorted, too */
+    for (i = 0; i < ntarget - 1; i++)
+        if (sort_graph(g, target->update_targets[i]) < 0)
+            return -1;
 
     return 0;
 
  fail:
-    que_cleanup(&L);
-    que_cleanup(&Q);
-
-    memcpy(g->edges, edges, sizeof(edges));
+    mrp_free(target->update_facts);
+    mrp_free(target->fact_stamps);
+    mrp_free(target->directs);
+    mrp_free(target->update_targets);
+    target->update_facts   = NULL;
+    target->fact_stamps    = NULL;
+    target->directs        = NULL;
+    target->update_targets = NULL;
+    target->nupdate_fact   = 0;
+    target->ndirect        = 0;
 
     return -1;
 }
@@ -524,7 +390,10 @@ static int sort_graph(graph_t *g, int target_idx)
 static void free_graph(graph_t *g)
 {
     if (g != NULL) {
-        mrp_free(g->edges);
+        mrp_free(g->first);
+        mrp_free(g->deps);
+        mrp_free(g->mark);
+        mrp_free(g->order);
         mrp_free(g);
     }
 }
@@ -536,15 +405,11 @@ static void dump_graph(graph_t *g, FILE *fp)
 
     fprintf(fp, "Graph edges:\n");
 
-    fprintf(fp, "  %20.20s ", "");
-    for (i = 0; i < g->nnode; i++)
-        fprintf(fp, " %d", i % 10);
-    fprintf(fp, "\n");
-
-    for (i = 0; i < g->nnode; i++) {
-        fprintf(fp, "  %20.20s: ", node_name(g, i));
-        for (j = 0; j < g->nnode; j++)
-            fprintf(fp, "%d ", *edge_markp(g, i, j));
+    for (i = g->r->nfact; i < g->nnode; i++) {
+        fprintf(fp, "  %20.20s:", node_name(g, i));
+        for (j = g->first[i]; j < g->first[i + 1]; j++)
+            fprintf(fp, " %s", g->deps[j] >= 0 ?
+                    node_name(g, g->deps[j]) : "<unknown>");
         fprintf(fp, "\n");
     }
 }
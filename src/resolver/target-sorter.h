@@ -34,5 +34,6 @@
 #include "resolver.h"
 
 int sort_targets(mrp_resolver_t *r);
+int sort_new_target(mrp_resolver_t *r, target_t *t);
 
 #endif /* __MURPHY_RESOLVER_TARGET_SORTER_H__ */
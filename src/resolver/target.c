@@ -101,6 +101,27 @@ static void purge_target(target_t *t)
 }
 
 
+/*
+ * a coalesced pending target update
+ */
+
+typedef struct {
+    mrp_list_hook_t     hook;            /* to list of pending updates */
+    int                 id;              /* target to update */
+    int                *ids;             /* context variable ids */
+    mrp_script_value_t *values;          /* context variable values */
+    int                 nvalue;          /* number of variables */
+    struct {
+        mrp_resolver_update_cb_t  cb;    /* completion callback */
+        void                     *user_data; /* opaque callback data */
+    } *cbs;                              /* completion callbacks */
+    int                 ncb;             /* number of callbacks */
+    int                 nrequest;        /* number of coalesced requests */
+} pending_update_t;
+
+static void purge_pending_updates(mrp_resolver_t *r);
+
+
 void destroy_targets(mrp_resolver_t *r)
 {
     target_t *t;
@@ -111,6 +132,8 @@ void destroy_targets(mrp_resolver_t *r)
 
     mrp_free(r->targets);
 
+    purge_pending_updates(r);
+
     if (r->auto_scheduled != NULL) {
         mrp_del_deferred(r->auto_scheduled);
         r->auto_scheduled = NULL;
@@ -312,7 +335,7 @@ static int older_than_facts(mrp_resolver_t *r, target_t *t)
      * facts have a newer stamp than the target.
      */
 
-    if (t->update_facts == NULL)
+    if (t->update_facts == NULL || t->stale)
         return TRUE;
     else {
 #ifdef CHECK_TRANSITIVE_CLOSURE_OF_FACTS
@@ -322,12 +345,10 @@ static int older_than_facts(mrp_resolver_t *r, target_t *t)
         }
 #else
         for (i = 0; i < t->ndirect; i++) {
-            id = t->directs[i];
+            id = t->update_facts[t->directs[i]];
 
-            if (id < r->nfact) {
-                if (fact_stamp(r, id) > t->fact_stamps[i])
-                    return TRUE;
-            }
+            if (fact_stamp(r, id) > t->fact_stamps[t->directs[i]])
+                return TRUE;
         }
 #endif
     }
@@ -351,7 +372,7 @@ static int older_than_targets(mrp_resolver_t *r, target_t *t)
     for (i = 0; (id = t->update_targets[i]) >= 0; i++) {
         dep = r->targets + id;
 
-        if (dep->stamp > t->stamp)
+        if (dep->changed > t->stamp)
             return TRUE;
     }
 
@@ -359,67 +380,264 @@ static int older_than_targets(mrp_resolver_t *r, target_t *t)
 }
 
 
-static void save_fact_stamps(mrp_resolver_t *r, target_t *t, uint32_t *buf)
+static uint32_t *save_fact_stamps(target_t *t, uint32_t *buf)
 {
-    int id, idx, i;
+    int i;
 
-    if (t->update_facts != NULL) {
-        id  = t - r->targets;
-        idx = id * r->nfact;
+    for (i = 0; i < t->nupdate_fact; i++)
+        *buf++ = t->fact_stamps[i];
 
-        for (i = 0; (id = t->update_facts[i]) >= 0; i++, idx++)
-            buf[idx] = t->fact_stamps[i];
-    }
+    return buf;
 }
 
 
-static void restore_fact_stamps(mrp_resolver_t *r, target_t *t, uint32_t *buf)
+static uint32_t *restore_fact_stamps(target_t *t, uint32_t *buf)
 {
-    int id, idx, i;
+    int i;
 
-    if (t->update_facts != NULL) {
-        id  = t - r->targets;
-        idx = id * r->nfact;
+    for (i = 0; i < t->nupdate_fact; i++)
+        t->fact_stamps[i] = *buf++;
 
-        for (i = 0; (id = t->update_facts[i]) >= 0; i++, idx++)
-            t->fact_stamps[i] = buf[idx];
-    }
+    return buf;
+}
+
+
+static int count_target_stamps(mrp_resolver_t *r, target_t *t)
+{
+    int i, id, n;
+
+    for (i = n = 0; (id = t->update_targets[i]) >= 0; i++)
+        n += r->targets[id].nupdate_fact;
+
+    return n;
 }
 
 
 static void save_target_stamps(mrp_resolver_t *r, target_t *t, uint32_t *buf)
 {
-    target_t *dep;
-    int       i, id;
+    int i, id;
 
-    for (i = 0; (id = t->update_targets[i]) >= 0; i++) {
-        dep = r->targets + id;
-        save_fact_stamps(r, dep, buf);
-    }
+    for (i = 0; (id = t->update_targets[i]) >= 0; i++)
+        buf = save_fact_stamps(r->targets + id, buf);
 }
 
 
 static void restore_target_stamps(mrp_resolver_t *r, target_t *t, uint32_t *buf)
 {
-    target_t *dep;
-    int       i, id;
+    int i, id;
 
-    for (i = 0; (id = t->update_targets[i]) >= 0; i++) {
-        dep = r->targets + id;
-        restore_fact_stamps(r, dep, buf);
-    }
+    for (i = 0; (id = t->update_targets[i]) >= 0; i++)
+        buf = restore_fact_stamps(r->targets + id, buf);
 }
 
 
-static void update_target_stamps(mrp_resolver_t *r, target_t *t)
+static void update_target_stamps(mrp_resolver_t *r, target_t *t, int status)
 {
     int i, id;
 
+    /*
+     * A target whose update script reports MRP_SCRIPT_UNCHANGED is up to
+     * date but does not count as changed, so targets depending on it are
+     * not updated because of it.
+     */
+
     if (t->update_facts != NULL)
         for (i = 0; (id = t->update_facts[i]) >= 0; i++)
             t->fact_stamps[i] = fact_stamp(r, id);
 
+    if (status != MRP_SCRIPT_UNCHANGED || t->stale)
+        t->changed = r->stamp;
+
     t->stamp = r->stamp;
+    t->stale = FALSE;
+}
+
+
+/*
+ * a target update run in a worker thread
+ */
+
+typedef struct {
+    mrp_resolver_t *r;                   /* resolver context */
+    target_t       *t;                   /* target to update */
+    int             status;              /* script execution status */
+} update_job_t;
+
+
+static inline int concurrent_target(target_t *t)
+{
+    mrp_scriptlet_t *s = t->script;
+
+    return (s != NULL && s->interpreter != NULL &&
+            (s->interpreter->flags & MRP_INTERPRETER_CONCURRENT));
+}
+
+
+static int target_level(mrp_resolver_t *r, target_t *t)
+{
+    target_t *dep;
+    int       i, id, level, l;
+
+    /*
+     * The level of a target is the length of the longest dependency
+     * chain leading to it. Targets on the same level do not depend on
+     * each other and can be updated in any order, or in parallel. Since
+     * targets are immutable, we calculate this only once.
+     */
+
+    if (t->level > 0)
+        return t->level - 1;
+
+    level = 0;
+
+    if (t->update_targets != NULL) {
+        for (i = 0; (id = t->update_targets[i]) >= 0; i++) {
+            dep = r->targets + id;
+
+            if (dep == t)
+                break;
+
+            l = target_level(r, dep) + 1;
+
+            if (l > level)
+                level = l;
+        }
+    }
+
+    t->level = level + 1;
+
+    return level;
+}
+
+
+static int run_update_job(void *user_data)
+{
+    update_job_t   *job = user_data;
+    mrp_resolver_t *r   = job->r;
+    int             status;
+
+    status = job->status = mrp_execute_script(job->t->script, r->ctbl);
+
+    pthread_mutex_lock(&r->wlock);
+    if (--r->wbusy == 0)
+        pthread_cond_signal(&r->wcond);
+    pthread_mutex_unlock(&r->wlock);
+
+    return status;
+}
+
+
+static int execute_concurrently(mrp_resolver_t *r, update_job_t *jobs, int n)
+{
+    int i, status;
+
+    /*
+     * Notes:
+     *   We hand all but the first job to the worker pool, execute the
+     *   first one ourselves, then wait for the rest to finish. If a job
+     *   cannot be submitted we simply execute it here, too.
+     */
+
+    for (i = 1; i < n; i++) {
+        jobs[i].r = r;
+
+        pthread_mutex_lock(&r->wlock);
+        r->wbusy++;
+        pthread_mutex_unlock(&r->wlock);
+
+        if (mrp_worker_submit(r->workers, run_update_job, NULL,
+                              jobs + i) == MRP_WORKER_JOB_INVALID) {
+            pthread_mutex_lock(&r->wlock);
+            r->wbusy--;
+            pthread_mutex_unlock(&r->wlock);
+
+            jobs[i].status = mrp_execute_script(jobs[i].t->script, r->ctbl);
+        }
+    }
+
+    jobs[0].status = mrp_execute_script(jobs[0].t->script, r->ctbl);
+
+    pthread_mutex_lock(&r->wlock);
+    while (r->wbusy > 0)
+        pthread_cond_wait(&r->wcond, &r->wlock);
+    pthread_mutex_unlock(&r->wlock);
+
+    status = TRUE;
+
+    for (i = 0; i < n; i++) {
+        if (jobs[i].status <= 0) {
+            if (status > 0)
+                status = jobs[i].status;
+        }
+        else
+            update_target_stamps(r, jobs[i].t, jobs[i].status);
+    }
+
+    return status;
+}
+
+
+static int update_levels(mrp_resolver_t *r, target_t *t, int *needs_update)
+{
+    update_job_t *jobs;
+    target_t     *dep;
+    int           ndep, nlevel, level, i, id, n, m, status;
+
+    /*
+     * Update the dependencies of t level by level. Concurrent targets
+     * on the same level are executed in parallel. Other targets, which
+     * might use the database or the context table, are executed only
+     * once the concurrent ones have finished.
+     */
+
+    for (ndep = 0; (id = t->update_targets[ndep]) >= 0; ndep++)
+        if (r->targets + id == t)
+            break;
+
+    jobs   = alloca((ndep + 1) * sizeof(jobs[0]));
+    nlevel = target_level(r, t);
+    status = TRUE;
+
+    for (level = 0; level < nlevel && status > 0; level++) {
+        n = m = 0;
+
+        for (i = 0; i < ndep; i++) {
+            id  = t->update_targets[i];
+            dep = r->targets + id;
+
+            if (target_level(r, dep) != level)
+                continue;
+
+            if (!older_than_facts(r, dep) && !older_than_targets(r, dep))
+                continue;
+
+            *needs_update = TRUE;
+
+            if (concurrent_target(dep))
+                jobs[n++].t = dep;
+            else
+                jobs[ndep - ++m].t = dep;
+        }
+
+        if (n > 1)
+            status = execute_concurrently(r, jobs, n);
+        else if (n == 1) {
+            status = mrp_execute_script(jobs[0].t->script, r->ctbl);
+
+            if (status > 0)
+                update_target_stamps(r, jobs[0].t, status);
+        }
+
+        for (i = ndep - 1; i >= ndep - m && status > 0; i--) {
+            dep    = jobs[i].t;
+            status = mrp_execute_script(dep->script, r->ctbl);
+
+            if (status > 0)
+                update_target_stamps(r, dep, status);
+        }
+    }
+
+    return status;
 }
 
 
@@ -427,12 +645,40 @@ static int update_target(mrp_resolver_t *r, target_t *t)
 {
     mqi_handle_t  tx;
     target_t     *dep;
-    uint32_t      stamps[r->ntarget * r->nfact];
-    int           i, id, status, needs_update, level;
+    uint32_t      buf[64], *stamps;
+    int           i, id, n, status, needs_update, level;
+
+    /*
+     * Notes:
+     *   We only need to save (and possibly restore) the fact stamps
+     *   of the targets we are about to update, so size the stamp
+     *   buffer by that set instead of by the full ruleset.
+     */
+
+    if (t->update_targets == NULL) {
+        if (sort_targets(r) != 0 || t->update_targets == NULL) {
+            errno = EINVAL;
+            return -EINVAL;
+        }
+    }
+
+    n = count_target_stamps(r, t);
+
+    if (n <= (int)MRP_ARRAY_SIZE(buf))
+        stamps = buf;
+    else {
+        stamps = mrp_alloc_array(uint32_t, n);
+
+        if (stamps == NULL)
+            return -ENOMEM;
+    }
 
     tx = start_transaction(r);
 
     if (tx == MQI_HANDLE_INVALID) {
+        if (stamps != buf)
+            mrp_free(stamps);
+
         if (errno != 0)
             return -errno;
         else
@@ -449,21 +695,25 @@ static int update_target(mrp_resolver_t *r, target_t *t)
     status       = TRUE;
     needs_update = older_than_facts(r, t);
 
-    for (i = 0; (id = t->update_targets[i]) >= 0; i++) {
-        dep = r->targets + id;
+    if (r->workers != NULL)
+        status = update_levels(r, t, &needs_update);
+    else {
+        for (i = 0; (id = t->update_targets[i]) >= 0; i++) {
+            dep = r->targets + id;
 
-        if (dep == t)
-            break;
+            if (dep == t)
+                break;
 
-        /*                              hmm... is this really needed? */
-        if (older_than_facts(r, dep) || older_than_targets(r, dep)) {
-            needs_update = TRUE;
-            status       = mrp_execute_script(dep->script, r->ctbl);
+            /*                          hmm... is this really needed? */
+            if (older_than_facts(r, dep) || older_than_targets(r, dep)) {
+                needs_update = TRUE;
+                status       = mrp_execute_script(dep->script, r->ctbl);
 
-            if (status <= 0)
-                break;
-            else
-                update_target_stamps(r, dep);
+                if (status <= 0)
+                    break;
+                else
+                    update_target_stamps(r, dep, status);
+            }
         }
     }
 
@@ -471,7 +721,7 @@ static int update_target(mrp_resolver_t *r, target_t *t)
         status = mrp_execute_script(t->script, r->ctbl);
 
         if (status > 0)
-            update_target_stamps(r, t);
+            update_target_stamps(r, t, status);
     }
 
     if (status <= 0) {
@@ -496,7 +746,10 @@ static int update_target(mrp_resolver_t *r, target_t *t)
 
     r->level--;
 
-    return status;
+    if (stamps != buf)
+        mrp_free(stamps);
+
+    return status > 0 ? TRUE : status;
 }
 
 
@@ -543,27 +796,153 @@ static int autoupdate_target(mrp_resolver_t *r)
 }
 
 
+static void free_pending_update(pending_update_t *u)
+{
+    int i;
+
+    mrp_list_delete(&u->hook);
+
+    for (i = 0; i < u->nvalue; i++)
+        if (u->values[i].type == MRP_SCRIPT_TYPE_STRING)
+            mrp_free(u->values[i].str);
+
+    mrp_free(u->ids);
+    mrp_free(u->values);
+    mrp_free(u->cbs);
+    mrp_free(u);
+}
+
+
+static void notify_pending_update(mrp_resolver_t *r, pending_update_t *u,
+                                  int status)
+{
+    const char *name = r->targets[u->id].name;
+    int         i;
+
+    for (i = 0; i < u->ncb; i++)
+        u->cbs[i].cb(r, name, status, u->cbs[i].user_data);
+}
+
+
+static int run_pending_update(mrp_resolver_t *r, pending_update_t *u)
+{
+    int i, status;
+
+    if (mrp_push_context_frame(r->ctbl) != 0)
+        return -1;
+
+    for (i = 0; i < u->nvalue; i++) {
+        if (mrp_set_context_value(r->ctbl, u->ids[i], u->values + i) < 0) {
+            status = -1;
+            goto pop_frame;
+        }
+    }
+
+    status = update_target_by_id(r, u->id);
+
+ pop_frame:
+    mrp_pop_context_frame(r->ctbl);
+
+    return status;
+}
+
+
+static void run_pending_updates(mrp_resolver_t *r)
+{
+    mrp_list_hook_t   pending, *p, *n;
+    pending_update_t *u;
+    int               status;
+
+    if (mrp_list_empty(&r->pending))
+        return;
+
+    /* take the current batch, anything scheduled from now on is for later */
+    mrp_list_move(&pending, &r->pending);
+
+    mrp_list_foreach(&pending, p, n) {
+        u = mrp_list_entry(p, typeof(*u), hook);
+
+        mrp_debug("running coalesced update of target %s (%d request%s)",
+                  r->targets[u->id].name, u->nrequest,
+                  u->nrequest == 1 ? "" : "s");
+
+        status = run_pending_update(r, u);
+        notify_pending_update(r, u, status);
+        free_pending_update(u);
+    }
+}
+
+
+static void purge_pending_updates(mrp_resolver_t *r)
+{
+    mrp_list_hook_t  *p, *n;
+    pending_update_t *u;
+
+    mrp_list_foreach(&r->pending, p, n) {
+        u = mrp_list_entry(p, typeof(*u), hook);
+
+        notify_pending_update(r, u, -ECANCELED);
+        free_pending_update(u);
+    }
+}
+
+
 static void autoupdate_cb(mrp_deferred_t *d, void *user_data)
 {
     mrp_resolver_t *r = (mrp_resolver_t *)user_data;
 
-    mrp_debug("running scheduled target autoupdate");
     mrp_disable_deferred(d);
-    autoupdate_target(r);
+
+    run_pending_updates(r);
+
+    if (r->auto_pending) {
+        r->auto_pending = FALSE;
+        mrp_debug("running scheduled target autoupdate");
+        autoupdate_target(r);
+    }
+}
+
+
+static int schedule_deferred(mrp_resolver_t *r)
+{
+    if (r->ctx != NULL && r->auto_scheduled == NULL)
+        r->auto_scheduled = mrp_add_deferred(r->ctx->ml, autoupdate_cb, r);
+
+    if (r->auto_scheduled == NULL)
+        return FALSE;
+
+    mrp_enable_deferred(r->auto_scheduled);
+
+    return TRUE;
+}
+
+
+int invalidate_targets(mrp_resolver_t *r)
+{
+    int i;
+
+    /*
+     * Mark every target out of date, so that the next update of any
+     * target runs the scripts of all of its dependencies, even if no
+     * fact has changed since. This is needed when the scripts have
+     * changed behind our back, eg. after the Lua policy was reloaded.
+     */
+
+    for (i = 0; i < r->ntarget; i++)
+        r->targets[i].stale = TRUE;
+
+    return schedule_target_autoupdate(r);
 }
 
 
 int schedule_target_autoupdate(mrp_resolver_t *r)
 {
     if (r->auto_update != NULL) {
-        if (r->ctx != NULL && r->auto_scheduled == NULL)
-            r->auto_scheduled = mrp_add_deferred(r->ctx->ml, autoupdate_cb, r);
-
-        if (r->auto_scheduled != NULL)
-            mrp_enable_deferred(r->auto_scheduled);
-        else
+        if (!schedule_deferred(r))
             return FALSE;
 
+        r->auto_pending = TRUE;
+
         mrp_debug("scheduled target autoupdate (%s)", r->auto_update->name);
     }
 
@@ -571,6 +950,113 @@ int schedule_target_autoupdate(mrp_resolver_t *r)
 }
 
 
+static pending_update_t *find_pending_update(mrp_resolver_t *r, int id)
+{
+    mrp_list_hook_t  *p, *n;
+    pending_update_t *u;
+
+    mrp_list_foreach(&r->pending, p, n) {
+        u = mrp_list_entry(p, typeof(*u), hook);
+
+        if (u->id == id)
+            return u;
+    }
+
+    return NULL;
+}
+
+
+static int merge_pending_value(pending_update_t *u, int id,
+                               mrp_script_value_t *value)
+{
+    mrp_script_value_t v = *value;
+    int                i;
+
+    if (v.type == MRP_SCRIPT_TYPE_STRING && (v.str = mrp_strdup(v.str)) == NULL)
+        return FALSE;
+
+    for (i = 0; i < u->nvalue; i++) {
+        if (u->ids[i] == id) {
+            if (u->values[i].type == MRP_SCRIPT_TYPE_STRING)
+                mrp_free(u->values[i].str);
+            u->values[i] = v;
+
+            return TRUE;
+        }
+    }
+
+    if (!mrp_reallocz(u->ids, u->nvalue, u->nvalue + 1) ||
+        !mrp_reallocz(u->values, u->nvalue, u->nvalue + 1)) {
+        if (v.type == MRP_SCRIPT_TYPE_STRING)
+            mrp_free(v.str);
+        return FALSE;
+    }
+
+    u->ids[u->nvalue]    = id;
+    u->values[u->nvalue] = v;
+    u->nvalue++;
+
+    return TRUE;
+}
+
+
+int schedule_target_update(mrp_resolver_t *r, const char *name, int *ids,
+                           mrp_script_value_t *values, int nvalue,
+                           mrp_resolver_update_cb_t cb, void *user_data)
+{
+    target_t         *t;
+    pending_update_t *u;
+    int               i, created;
+
+    if ((t = lookup_target(r, name)) == NULL) {
+        errno = ENOENT;
+        return FALSE;
+    }
+
+    if ((u = find_pending_update(r, t - r->targets)) == NULL) {
+        if ((u = mrp_allocz(sizeof(*u))) == NULL)
+            return FALSE;
+
+        mrp_list_init(&u->hook);
+        u->id   = t - r->targets;
+        created = TRUE;
+    }
+    else
+        created = FALSE;
+
+    for (i = 0; i < nvalue; i++)
+        if (!merge_pending_value(u, ids[i], values + i))
+            goto fail;
+
+    if (cb != NULL) {
+        if (!mrp_reallocz(u->cbs, u->ncb, u->ncb + 1))
+            goto fail;
+
+        u->cbs[u->ncb].cb        = cb;
+        u->cbs[u->ncb].user_data = user_data;
+        u->ncb++;
+    }
+
+    if (!schedule_deferred(r))
+        goto fail;
+
+    if (created)
+        mrp_list_append(&r->pending, &u->hook);
+
+    u->nrequest++;
+
+    mrp_debug("scheduled update of target %s", name);
+
+    return TRUE;
+
+ fail:
+    if (created)
+        free_pending_update(u);
+
+    return FALSE;
+}
+
+
 void dump_targets(mrp_resolver_t *r, FILE *fp)
 {
     int       i, j, idx;
@@ -609,11 +1095,8 @@ void dump_targets(mrp_resolver_t *r, FILE *fp)
             fprintf(fp, "  direct dependencies:");
             if (t->ndirect > 0) {
                 for (j = 0; j < t->ndirect; j++) {
-                    idx = t->directs[j];
-                    if (idx < r->nfact)
-                        fprintf(fp, " %s", r->facts[idx].name);
-                    else
-                        fprintf(fp, " %s", r->targets[idx-r->nfact].name);
+                    idx = t->update_facts[t->directs[j]];
+                    fprintf(fp, " %s", r->facts[idx].name);
                 }
                 fprintf(fp, "\n");
             }
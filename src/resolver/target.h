@@ -46,6 +46,10 @@ int prepare_target_scripts(mrp_resolver_t *r);
 int update_target_by_name(mrp_resolver_t *r, const char *name);
 int update_target_by_id(mrp_resolver_t *r, int id);
 int schedule_target_autoupdate(mrp_resolver_t *r);
+int invalidate_targets(mrp_resolver_t *r);
+int schedule_target_update(mrp_resolver_t *r, const char *name, int *ids,
+                           mrp_script_value_t *values, int nvalue,
+                           mrp_resolver_update_cb_t cb, void *user_data);
 
 target_t *lookup_target(mrp_resolver_t *s, const char *name);
 void dump_targets(mrp_resolver_t *r, FILE *fp);
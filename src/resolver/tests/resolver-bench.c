@@ -0,0 +1,773 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#define _GNU_SOURCE
+#include <getopt.h>
+
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+
+#include <murphy/common.h>
+#include <murphy/core/context.h>
+#include <murphy/core/method.h>
+#include <murphy/core/scripting.h>
+#include <murphy/resolver/resolver.h>
+#include <murphy-db/mqi.h>
+
+/*
+ * resolver benchmark
+ *
+ * Generate a synthetic dependency graph of facts and targets and measure
+ * what the resolver costs for it. The graph has a configurable number of
+ * facts and depth levels of width targets each. Every target depends on
+ * fan-in facts (first level) or targets (other levels) picked at random
+ * from the level below it, and a final target 'all' depends on the whole
+ * topmost level. We measure the time it takes to add the targets to the
+ * resolver, to prepare them, and to do the first update (which includes
+ * sorting the targets), the memory the resolver uses for the graph, and
+ * the latency of updating 'all' after a change to a single fact.
+ *
+ * The graph is generated for every interpreter asked for:
+ *
+ *   - none: targets without update scripts, the bare resolver overhead
+ *   - simple: simple scriptlets calling a no-op exported method
+ *   - lua: Lua scriptlets, compiled and run like plugin-lua does
+ *   - element: prepared targets calling a Lua update method, the way
+ *     elements of the Lua decision network are hooked to the resolver
+ */
+
+#define BENCH_TABLE "bench_fact"
+
+typedef enum {
+    INTERPRETER_NONE = 0,
+    INTERPRETER_SIMPLE,
+    INTERPRETER_LUA,
+    INTERPRETER_ELEMENT,
+    INTERPRETER_MAX
+} interpreter_t;
+
+static const char *interpreters[] = {
+    [INTERPRETER_NONE]    = "none",
+    [INTERPRETER_SIMPLE]  = "simple",
+    [INTERPRETER_LUA]     = "lua",
+    [INTERPRETER_ELEMENT] = "element",
+};
+
+typedef struct {
+    int            nfact;                /* number of facts */
+    int            width;                /* targets per level */
+    int            depth;                /* number of levels */
+    int            fanin;                /* dependencies per target */
+    int            nupdate;              /* number of fact changes */
+    unsigned int   seed;                 /* random seed for the graph */
+    int            interpreters;         /* mask of interpreters to run */
+    int            log_mask;
+    const char    *log_target;
+    int            debug;
+
+    mrp_context_t *ctx;                  /* murphy context */
+    lua_State     *L;                    /* Lua state for lua and element */
+    int            element_update;       /* element update method ref */
+    mqi_handle_t  *tables;               /* fact tables */
+    uint64_t       nexec;                /* number of scripts executed */
+} bench_t;
+
+
+typedef struct {
+    int32_t value;
+} fact_row_t;
+
+
+MQI_COLUMN_DEFINITION_LIST(fact_columns,
+    MQI_COLUMN_DEFINITION("value", MQI_INTEGER)
+);
+
+MQI_COLUMN_SELECTION_LIST(fact_selection,
+    MQI_COLUMN_SELECTOR(0, fact_row_t, value)
+);
+
+
+static bench_t *bench;
+
+
+static uint64_t now_usecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+
+/*
+ * interpreters
+ */
+
+static int simple_nop(mrp_plugin_t *plugin, const char *name,
+                      mrp_script_env_t *env)
+{
+    MRP_UNUSED(plugin);
+    MRP_UNUSED(name);
+    MRP_UNUSED(env);
+
+    bench->nexec++;
+
+    return TRUE;
+}
+
+
+static int lua_compile(mrp_scriptlet_t *script)
+{
+    lua_State *L = bench->L;
+
+    if (luaL_loadbuffer(L, script->source, strlen(script->source),
+                        "<resolver-bench scriptlet>") != 0) {
+        mrp_log_error("failed to compile Lua scriptlet (%s)",
+                      lua_tostring(L, -1));
+        lua_settop(L, 0);
+        return -EINVAL;
+    }
+
+    script->data = (void *)(ptrdiff_t)luaL_ref(L, LUA_REGISTRYINDEX);
+
+    return 0;
+}
+
+
+static int lua_prepare(mrp_scriptlet_t *script)
+{
+    MRP_UNUSED(script);
+
+    return 0;
+}
+
+
+static int lua_execute(mrp_scriptlet_t *script, mrp_context_tbl_t *ctbl)
+{
+    lua_State *L = bench->L;
+    int        success;
+
+    MRP_UNUSED(ctbl);
+
+    bench->nexec++;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, (int)(ptrdiff_t)script->data);
+    success = (lua_pcall(L, 0, 0, 0) == 0);
+    lua_settop(L, 0);
+
+    return success;
+}
+
+
+static void lua_cleanup(mrp_scriptlet_t *script)
+{
+    luaL_unref(bench->L, LUA_REGISTRYINDEX, (int)(ptrdiff_t)script->data);
+}
+
+
+static int element_execute(mrp_scriptlet_t *script, mrp_context_tbl_t *ctbl)
+{
+    lua_State *L = bench->L;
+    int        success;
+
+    MRP_UNUSED(ctbl);
+
+    bench->nexec++;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, bench->element_update);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, (int)(ptrdiff_t)script->data);
+    success = (lua_pcall(L, 1, 1, 0) == 0 && lua_toboolean(L, -1));
+    lua_settop(L, 0);
+
+    return success;
+}
+
+
+static mrp_interpreter_t lua_interpreter = {
+    .name    = "lua",
+    .compile = lua_compile,
+    .prepare = lua_prepare,
+    .execute = lua_execute,
+    .cleanup = lua_cleanup,
+};
+
+
+static mrp_interpreter_t element_interpreter = {
+    .name    = "bench_element",
+    .execute = element_execute,
+};
+
+
+static int setup_interpreters(bench_t *b)
+{
+    mrp_method_descr_t nop = {
+        .name       = "bench_nop",
+        .script_ptr = simple_nop,
+    };
+
+    if (mrp_export_method(&nop) < 0) {
+        mrp_log_error("failed to export simple method '%s'", nop.name);
+        return FALSE;
+    }
+
+    if ((b->L = luaL_newstate()) == NULL) {
+        mrp_log_error("failed to create Lua state");
+        return FALSE;
+    }
+
+    luaL_openlibs(b->L);
+
+    if (luaL_loadstring(b->L,
+                        "return function(self)\n"
+                        "    self.updates = self.updates + 1\n"
+                        "    return true\n"
+                        "end") != 0 || lua_pcall(b->L, 0, 1, 0) != 0) {
+        mrp_log_error("failed to set up element update method (%s)",
+                      lua_tostring(b->L, -1));
+        return FALSE;
+    }
+
+    b->element_update = luaL_ref(b->L, LUA_REGISTRYINDEX);
+
+    if (!mrp_resolver_register_interpreter(&lua_interpreter)) {
+        mrp_log_error("failed to register Lua interpreter");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static void cleanup_interpreters(bench_t *b)
+{
+    mrp_resolver_unregister_interpreter(lua_interpreter.name);
+
+    if (b->L != NULL)
+        lua_close(b->L);
+}
+
+
+/*
+ * facts
+ */
+
+static int create_fact_tables(bench_t *b)
+{
+    fact_row_t  row = { 0 }, *rows[2] = { &row, NULL };
+    char        name[64];
+    int         i;
+
+    b->tables = mrp_allocz_array(mqi_handle_t, b->nfact);
+
+    if (b->tables == NULL)
+        return FALSE;
+
+    for (i = 0; i < b->nfact; i++) {
+        snprintf(name, sizeof(name), BENCH_TABLE"%d", i);
+
+        b->tables[i] = MQI_CREATE_TABLE(name, MQI_TEMPORARY, fact_columns,
+                                        NULL);
+
+        if (b->tables[i] == MQI_HANDLE_INVALID ||
+            MQI_INSERT_INTO(b->tables[i], fact_selection, rows) != 1) {
+            mrp_log_error("failed to create fact table '%s' (%s)", name,
+                          strerror(errno));
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static void drop_fact_tables(bench_t *b)
+{
+    int i;
+
+    for (i = 0; i < b->nfact && b->tables != NULL; i++)
+        if (b->tables[i] != MQI_HANDLE_INVALID)
+            mqi_drop_table(b->tables[i]);
+
+    mrp_free(b->tables);
+    b->tables = NULL;
+}
+
+
+static int change_fact(bench_t *b, int idx)
+{
+    static int32_t value;
+    fact_row_t     row;
+    mqi_handle_t   tx;
+    int            n;
+
+    row.value = ++value;
+
+    tx = mqi_begin_transaction();
+    n  = MQI_UPDATE(b->tables[idx], fact_selection, &row, MQI_ALL);
+    mqi_commit_transaction(tx);
+
+    return n == 1;
+}
+
+
+/*
+ * graph generation
+ */
+
+static void pick_dependencies(int *picked, int npick, int pool,
+                              unsigned int *seed)
+{
+    int i, j, dep;
+
+    for (i = 0; i < npick; i++) {
+    retry:
+        dep = rand_r(seed) % pool;
+
+        for (j = 0; j < i; j++)
+            if (picked[j] == dep)
+                goto retry;
+
+        picked[i] = dep;
+    }
+}
+
+
+static int add_target(bench_t *b, mrp_resolver_t *r, interpreter_t type,
+                      const char *name, const char **depends, int ndepend)
+{
+    lua_State *L = b->L;
+    int        self;
+
+    switch (type) {
+    case INTERPRETER_NONE:
+        return mrp_resolver_add_target(r, name, depends, ndepend, NULL, NULL);
+
+    case INTERPRETER_SIMPLE:
+        return mrp_resolver_add_target(r, name, depends, ndepend, "simple",
+                                       "bench_nop(1)");
+
+    case INTERPRETER_LUA:
+        return mrp_resolver_add_target(r, name, depends, ndepend, "lua",
+                                       "local updated = true");
+
+    case INTERPRETER_ELEMENT:
+        lua_newtable(L);
+        lua_pushstring(L, name);
+        lua_setfield(L, -2, "name");
+        lua_pushinteger(L, 0);
+        lua_setfield(L, -2, "updates");
+        self = luaL_ref(L, LUA_REGISTRYINDEX);
+
+        if (mrp_resolver_add_prepared_target(r, name, depends, ndepend,
+                                             &element_interpreter, NULL,
+                                             (void *)(ptrdiff_t)self))
+            return TRUE;
+
+        luaL_unref(L, LUA_REGISTRYINDEX, self);
+        return FALSE;
+
+    default:
+        return FALSE;
+    }
+}
+
+
+static int generate_graph(bench_t *b, mrp_resolver_t *r, interpreter_t type)
+{
+    unsigned int  seed = b->seed;
+    int           npool, ndep, picked[b->fanin], i, j, l;
+    const char   *depends[b->width > b->fanin ? b->width : b->fanin];
+    char          names[2][b->width][32], facts[b->nfact][32], *name;
+
+    for (i = 0; i < b->nfact; i++)
+        snprintf(facts[i], sizeof(facts[i]), "$"BENCH_TABLE"%d", i);
+
+    for (l = 0; l < b->depth; l++) {
+        npool = (l == 0 ? b->nfact : b->width);
+        ndep  = (b->fanin < npool ? b->fanin : npool);
+
+        for (i = 0; i < b->width; i++) {
+            pick_dependencies(picked, ndep, npool, &seed);
+
+            for (j = 0; j < ndep; j++)
+                depends[j] = (l == 0 ? facts[picked[j]] :
+                              names[(l - 1) & 1][picked[j]]);
+
+            name = names[l & 1][i];
+            snprintf(name, sizeof(names[0][0]), "t%d_%d", l, i);
+
+            if (!add_target(b, r, type, name, depends, ndep)) {
+                mrp_log_error("failed to add target '%s'", name);
+                return FALSE;
+            }
+        }
+    }
+
+    for (i = 0; i < b->width; i++)
+        depends[i] = names[(b->depth - 1) & 1][i];
+
+    if (!add_target(b, r, type, "all", depends, b->width)) {
+        mrp_log_error("failed to add target 'all'");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+/*
+ * benchmarking
+ */
+
+static int tag_bytes(const mrp_mm_tag_stat_t *st, void *user_data)
+{
+    int64_t *bytes = (int64_t *)user_data;
+
+    if (!st->dead && !strcmp(st->name, "resolver-bench")) {
+        *bytes = st->bytes;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static int cmp_latency(const void *a, const void *b)
+{
+    uint64_t la = *(const uint64_t *)a, lb = *(const uint64_t *)b;
+
+    return la < lb ? -1 : (la > lb ? 1 : 0);
+}
+
+
+static void run_benchmark(bench_t *b, interpreter_t type)
+{
+    mrp_resolver_t *r;
+    mrp_mm_tag_t   *tag, *prev;
+    uint64_t        t0, t1, t2, t3, *lat, sum, nexec;
+    int64_t         bytes;
+    int             i, n;
+
+    lat = mrp_allocz_array(uint64_t, b->nupdate);
+
+    if (b->nupdate > 0 && lat == NULL) {
+        mrp_log_error("failed to allocate latency buffer");
+        return;
+    }
+
+    tag  = mrp_mm_tag_create("resolver-bench", NULL);
+    prev = mrp_mm_tag_set(tag);
+
+    t0 = now_usecs();
+
+    if ((r = mrp_resolver_create(b->ctx)) == NULL ||
+        !generate_graph(b, r, type)) {
+        printf("%-8s failed to generate graph\n", interpreters[type]);
+        goto out;
+    }
+
+    t1 = now_usecs();
+
+    if (!mrp_resolver_prepare(r)) {
+        printf("%-8s failed to prepare targets\n", interpreters[type]);
+        goto out;
+    }
+
+    t2 = now_usecs();
+
+    if (mrp_resolver_update_targetl(r, "all", NULL) <= 0) {
+        printf("%-8s failed to update targets\n", interpreters[type]);
+        goto out;
+    }
+
+    t3 = now_usecs();
+
+    mrp_mm_tag_set(prev);
+    prev  = NULL;
+    bytes = 0;
+    mrp_mm_tag_foreach(tag_bytes, &bytes);
+
+    nexec = b->nexec;
+
+    for (i = 0, n = 0; i < b->nupdate; i++) {
+        if (!change_fact(b, rand_r(&b->seed) % b->nfact)) {
+            mrp_log_error("failed to change fact");
+            break;
+        }
+
+        lat[n] = now_usecs();
+
+        if (mrp_resolver_update_targetl(r, "all", NULL) <= 0) {
+            mrp_log_error("failed to update targets");
+            break;
+        }
+
+        lat[n] = now_usecs() - lat[n];
+        n++;
+    }
+
+    nexec = b->nexec - nexec;
+
+    printf("%-8s build %.3f ms, prepare %.3f ms, sort+update %.3f ms, "
+           "%.1f kB\n", interpreters[type], (t1 - t0) / 1000.0,
+           (t2 - t1) / 1000.0, (t3 - t2) / 1000.0, bytes / 1024.0);
+
+    if (n > 0) {
+        qsort(lat, n, sizeof(lat[0]), cmp_latency);
+
+        for (i = 0, sum = 0; i < n; i++)
+            sum += lat[i];
+
+        printf("%-8s update avg %.1f, p50 %llu, p99 %llu, max %llu us, "
+               "%.1f scripts/update\n", interpreters[type],
+               (double)sum / n, (unsigned long long)lat[n / 2],
+               (unsigned long long)lat[(n * 99) / 100],
+               (unsigned long long)lat[n - 1], (double)nexec / n);
+    }
+
+ out:
+    if (prev != NULL)
+        mrp_mm_tag_set(prev);
+
+    mrp_resolver_destroy(r);
+    mrp_mm_tag_destroy(tag);
+    mrp_free(lat);
+}
+
+
+static void print_usage(const char *argv0, int exit_code, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (fmt && *fmt) {
+        va_start(ap, fmt);
+        vprintf(fmt, ap);
+        va_end(ap);
+    }
+
+    printf("usage: %s [options]\n\n"
+           "The possible options are:\n"
+           "  -F, --facts=N                  number of facts\n"
+           "  -W, --width=N                  number of targets per level\n"
+           "  -D, --depth=N                  number of target levels\n"
+           "  -f, --fan-in=N                 number of dependencies per target\n"
+           "  -n, --updates=N                number of single fact changes\n"
+           "  -S, --seed=N                   random seed for the graph\n"
+           "  -i, --interpreter=TYPE         interpreter to benchmark\n"
+           "      TYPE is one of none, simple, lua and element, default all\n"
+           "  -t, --log-target=TARGET        log target to use\n"
+           "      TARGET is one of stderr,stdout,syslog, or a logfile path\n"
+           "  -l, --log-level=LEVELS         logging level to use\n"
+           "      LEVELS is a comma separated list of info, error and warning\n"
+           "  -v, --verbose                  increase logging verbosity\n"
+           "  -d, --debug                    enable given debug confguration\n"
+           "  -h, --help                     show help on usage\n",
+           argv0);
+
+    if (exit_code < 0)
+        return;
+    else
+        exit(exit_code);
+}
+
+
+static void config_set_defaults(bench_t *b)
+{
+    mrp_clear(b);
+    b->nfact      = 64;
+    b->width      = 16;
+    b->depth      = 8;
+    b->fanin      = 4;
+    b->nupdate    = 1000;
+    b->seed       = 1;
+    b->log_mask   = MRP_LOG_MASK_ERROR;
+    b->log_target = MRP_LOG_TO_STDERR;
+}
+
+
+static int parse_count(const char *argv0, const char *arg, const char *what,
+                       int min)
+{
+    char *end;
+    int   n;
+
+    n = (int)strtol(arg, &end, 10);
+
+    if ((end && *end) || n < min)
+        print_usage(argv0, EINVAL, "invalid %s '%s'.\n", what, arg);
+
+    return n;
+}
+
+
+int parse_cmdline(bench_t *b, int argc, char **argv)
+{
+#   define OPTIONS "F:W:D:f:n:S:i:l:t:d:vh"
+    struct option options[] = {
+        { "facts"      , required_argument, NULL, 'F' },
+        { "width"      , required_argument, NULL, 'W' },
+        { "depth"      , required_argument, NULL, 'D' },
+        { "fan-in"     , required_argument, NULL, 'f' },
+        { "updates"    , required_argument, NULL, 'n' },
+        { "seed"       , required_argument, NULL, 'S' },
+        { "interpreter", required_argument, NULL, 'i' },
+        { "log-level"  , required_argument, NULL, 'l' },
+        { "log-target" , required_argument, NULL, 't' },
+        { "verbose"    , optional_argument, NULL, 'v' },
+        { "debug"      , required_argument, NULL, 'd' },
+        { "help"       , no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt, i;
+
+    config_set_defaults(b);
+
+    while ((opt = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+        switch (opt) {
+        case 'F':
+            b->nfact = parse_count(argv[0], optarg, "number of facts", 1);
+            break;
+
+        case 'W':
+            b->width = parse_count(argv[0], optarg, "graph width", 1);
+            break;
+
+        case 'D':
+            b->depth = parse_count(argv[0], optarg, "graph depth", 1);
+            break;
+
+        case 'f':
+            b->fanin = parse_count(argv[0], optarg, "fan-in", 1);
+            break;
+
+        case 'n':
+            b->nupdate = parse_count(argv[0], optarg, "number of updates", 0);
+            break;
+
+        case 'S':
+            b->seed = (unsigned int)parse_count(argv[0], optarg, "seed", 0);
+            break;
+
+        case 'i':
+            for (i = 0; i < INTERPRETER_MAX; i++)
+                if (!strcmp(optarg, interpreters[i]))
+                    break;
+            if (i == INTERPRETER_MAX)
+                print_usage(argv[0], EINVAL, "invalid interpreter '%s'.\n",
+                            optarg);
+            b->interpreters |= (1 << i);
+            break;
+
+        case 'v':
+            b->log_mask <<= 1;
+            b->log_mask  |= 1;
+            break;
+
+        case 'l':
+            b->log_mask = mrp_log_parse_levels(optarg);
+            if (b->log_mask < 0)
+                print_usage(argv[0], EINVAL, "invalid log level '%s'", optarg);
+            break;
+
+        case 't':
+            b->log_target = mrp_log_parse_target(optarg);
+            if (!b->log_target)
+                print_usage(argv[0], EINVAL, "invalid log target '%s'", optarg);
+            break;
+
+        case 'd':
+            b->debug = TRUE;
+            mrp_debug_set_config(optarg);
+            break;
+
+        case 'h':
+            print_usage(argv[0], -1, "");
+            exit(0);
+            break;
+
+        default:
+            print_usage(argv[0], EINVAL, "invalid option '%c'", opt);
+        }
+    }
+
+    if (b->interpreters == 0)
+        b->interpreters = (1 << INTERPRETER_MAX) - 1;
+
+    return TRUE;
+}
+
+
+int main(int argc, char *argv[])
+{
+    bench_t b;
+    int     i;
+
+    if (!parse_cmdline(&b, argc, argv))
+        exit(1);
+
+    bench = &b;
+
+    mrp_log_set_mask(b.log_mask);
+    mrp_log_set_target(b.log_target);
+
+    if (b.debug)
+        mrp_debug_enable(TRUE);
+
+    mrp_mm_account(TRUE);
+
+    if ((b.ctx = mrp_context_create()) == NULL) {
+        mrp_log_error("failed to create murphy context");
+        exit(1);
+    }
+
+    if (mqi_open() != 0 || !create_fact_tables(&b) ||
+        !setup_interpreters(&b))
+        exit(1);
+
+    printf("%d facts, %d levels of %d targets, fan-in %d, %d updates\n",
+           b.nfact, b.depth, b.width, b.fanin, b.nupdate);
+
+    for (i = 0; i < INTERPRETER_MAX; i++)
+        if (b.interpreters & (1 << i))
+            run_benchmark(&b, i);
+
+    cleanup_interpreters(&b);
+    drop_fact_tables(&b);
+    mrp_context_destroy(b.ctx);
+
+    return 0;
+}
@@ -35,6 +35,7 @@
 #include <murphy/common/hashtbl.h>
 #include <murphy/common/utils.h>
 #include <murphy/common/log.h>
+#include <murphy/common/profile.h>
 
 #include <murphy/resource/manager-api.h>
 #include <murphy/resource/client-api.h>
@@ -43,6 +44,7 @@
 #include <murphy-db/mqi.h>
 
 #include "application-class.h"
+#include "resource.h"
 #include "resource-set.h"
 #include "resource-owner.h"
 #include "zone.h"
@@ -58,15 +60,15 @@
  * sorting key bit layout
  *
  * +---------+----+----+--------+
- * | 31 - 29 | 28 | 27 | 26 - 0 |
+ * | 63 - 61 | 60 | 59 | 58 - 0 |
  * +---------+----+----+--------+
  *      |      |    |       |
- *      |      |    |       +---- 0x07ffffff stamp of the last request
- *      |      |    +------------ 0x08000000 state (set if acquiring)
- *      |      +----------------- 0x10000000 usage (set if shared)
- *      +------------------------ 0xe0000000 priority (0-7)
+ *      |      |    |       +---- 0x07ffffffffffffff stamp of the last request
+ *      |      |    +------------ 0x0800000000000000 state (set if acquiring)
+ *      |      +----------------- 0x1000000000000000 usage (set if shared)
+ *      +------------------------ 0xe000000000000000 priority (0-7)
  */
-#define MASK(b)   (((uint32_t)1 << (b)) - (uint32_t)1)
+#define MASK(b)   (((uint64_t)1 << (b)) - (uint64_t)1)
 
 #define STAMP_SHIFT     0
 #define STATE_SHIFT     (STAMP_SHIFT + MRP_KEY_STAMP_BITS)
@@ -78,10 +80,10 @@
 #define USAGE_MASK      MASK(MRP_KEY_USAGE_BITS)
 #define PRIORITY_MASK   MASK(MRP_KEY_PRIORITY_BITS)
 
-#define STAMP_KEY(p)    (((uint32_t)(p) & STAMP_MASK)    << STAMP_SHIFT)
-#define STATE_KEY(p)    (((uint32_t)(p) & STATE_MASK)    << STATE_SHIFT)
-#define USAGE_KEY(p)    (((uint32_t)(p) & USAGE_MASK)    << USAGE_SHIFT)
-#define PRIORITY_KEY(p) (((uint32_t)(p) & PRIORITY_MASK) << PRIORITY_SHIFT)
+#define STAMP_KEY(p)    (((uint64_t)(p) & STAMP_MASK)    << STAMP_SHIFT)
+#define STATE_KEY(p)    (((uint64_t)(p) & STATE_MASK)    << STATE_SHIFT)
+#define USAGE_KEY(p)    (((uint64_t)(p) & USAGE_MASK)    << USAGE_SHIFT)
+#define PRIORITY_KEY(p) (((uint64_t)(p) & PRIORITY_MASK) << PRIORITY_SHIFT)
 
 #define STAMP_MAX       STAMP_MASK
 
@@ -155,8 +157,10 @@ mrp_application_class_t *mrp_application_class_create(const char *name,
     class->share = share;
     class->order = order;
 
-    for (zone = 0;  zone < MRP_ZONE_MAX;  zone++)
+    for (zone = 0;  zone < MRP_ZONE_MAX;  zone++) {
         mrp_list_init(&class->resource_sets[zone]);
+        class->resource_tree[zone] = NULL;
+    }
 
     /* list do not have insert_before function,
        so don't be mislead by the name */
@@ -166,6 +170,8 @@ mrp_application_class_t *mrp_application_class_create(const char *name,
 
     insert_into_application_class_table(class->name, class->priority);
 
+    mrp_resource_definitions_changed();
+
     return class;
 }
 
@@ -285,9 +291,18 @@ int mrp_application_class_add_resource_set(const char *class_name,
     if (!(zone = mrp_zone_find_by_name(zone_name)))
         return -1;
 
+    if (rset->class.ptr) {
+        mrp_application_class_remove_resource_set(rset);
+        mrp_resource_owner_remove_contention(rset->zone, rset->class.ptr,
+                                             rset->resource.mask.all);
+    }
+
     rset->class.ptr = class;
     rset->zone = mrp_zone_get_id(zone);
 
+    mrp_resource_owner_add_contention(rset->zone, class,
+                                      rset->resource.mask.all);
+
     if (rset->state == mrp_resource_acquire)
         mrp_resource_set_acquire(rset, reqid);
     else {
@@ -306,46 +321,154 @@ int mrp_application_class_add_resource_set(const char *class_name,
     return 0;
 }
 
+/*
+ * Resource sets of a class within a zone are kept in a treap ordered by
+ * their sorting key, with ties broken by insertion order. The tree is only
+ * used to find the place of a set in the per-zone list in logarithmic time,
+ * iteration still walks the (sorted) list itself.
+ */
+
+static inline int tree_cmp(mrp_resource_set_t *a, mrp_resource_set_t *b)
+{
+    if (a->class.key != b->class.key)
+        return a->class.key < b->class.key ? -1 : +1;
+
+    if (a->class.seq != b->class.seq)
+        return a->class.seq < b->class.seq ? -1 : +1;
+
+    return 0;
+}
+
+static inline uint32_t tree_weight(mrp_resource_set_t *rset)
+{
+    return (uint32_t)((rset->class.seq * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+static mrp_resource_set_t *tree_insert(mrp_resource_set_t *root,
+                                       mrp_resource_set_t *rset,
+                                       mrp_resource_set_t **next)
+{
+    mrp_resource_set_t *child;
+
+    if (root == NULL)
+        return rset;
+
+    if (tree_cmp(rset, root) < 0) {
+        *next = root;
+        child = root->class.left = tree_insert(root->class.left, rset, next);
+
+        if (tree_weight(child) > tree_weight(root)) {
+            root->class.left = child->class.right;
+            child->class.right = root;
+            root = child;
+        }
+    }
+    else {
+        child = root->class.right = tree_insert(root->class.right, rset, next);
+
+        if (tree_weight(child) > tree_weight(root)) {
+            root->class.right = child->class.left;
+            child->class.left = root;
+            root = child;
+        }
+    }
+
+    return root;
+}
+
+static mrp_resource_set_t *tree_merge(mrp_resource_set_t *l,
+                                      mrp_resource_set_t *r)
+{
+    if (l == NULL)
+        return r;
+    if (r == NULL)
+        return l;
+
+    if (tree_weight(l) > tree_weight(r)) {
+        l->class.right = tree_merge(l->class.right, r);
+        return l;
+    }
+    else {
+        r->class.left = tree_merge(l, r->class.left);
+        return r;
+    }
+}
+
+static mrp_resource_set_t *tree_remove(mrp_resource_set_t *root,
+                                       mrp_resource_set_t *rset)
+{
+    int cmp;
+
+    if (root == NULL)
+        return NULL;
+
+    if ((cmp = tree_cmp(rset, root)) < 0)
+        root->class.left = tree_remove(root->class.left, rset);
+    else if (cmp > 0)
+        root->class.right = tree_remove(root->class.right, rset);
+    else
+        root = tree_merge(root->class.left, root->class.right);
+
+    return root;
+}
+
+void mrp_application_class_remove_resource_set(mrp_resource_set_t *rset)
+{
+    mrp_application_class_t *class;
+    mrp_resource_set_t **root;
+
+    MRP_ASSERT(rset, "invalid argument");
+
+    if (mrp_list_empty(&rset->class.list))
+        return;
+
+    class = rset->class.ptr;
+    root  = class->resource_tree + rset->zone;
+
+    *root = tree_remove(*root, rset);
+
+    mrp_list_delete(&rset->class.list);
+    rset->class.left = rset->class.right = NULL;
+}
+
 void mrp_application_class_move_resource_set(mrp_resource_set_t *rset)
 {
+    static uint64_t seq;
+
     mrp_application_class_t *class;
-    mrp_list_hook_t *list, *lentry, *n, *insert_before;
-    mrp_resource_set_t *rentry;
-    uint32_t key;
+    mrp_resource_set_t **root, *next;
     uint32_t zone;
 
     MRP_ASSERT(rset, "invalid argument");
 
-    mrp_list_delete(&rset->class.list);
+    mrp_application_class_remove_resource_set(rset);
 
     class = rset->class.ptr;
     zone  = rset->zone;
+    root  = class->resource_tree + zone;
+    next  = NULL;
 
-    list = insert_before = class->resource_sets + zone;
-    key  = mrp_application_class_get_sorting_key(rset);
+    rset->class.key = mrp_application_class_get_sorting_key(rset);
+    rset->class.seq = ++seq;
 
-    mrp_list_foreach_back(list, lentry, n) {
-        rentry = mrp_list_entry(lentry, mrp_resource_set_t, class.list);
-
-         if (key >= mrp_application_class_get_sorting_key(rentry))
-             break;
-
-         insert_before = lentry;
-    }
+    *root = tree_insert(*root, rset, &next);
 
-    mrp_list_append(insert_before, &rset->class.list);
+    if (next != NULL)
+        mrp_list_append(&next->class.list, &rset->class.list);
+    else
+        mrp_list_append(class->resource_sets + zone, &rset->class.list);
 }
 
-uint32_t mrp_application_class_get_sorting_key(mrp_resource_set_t *rset)
+uint64_t mrp_application_class_get_sorting_key(mrp_resource_set_t *rset)
 {
     mrp_application_class_t *class;
     bool     lifo;
-    uint32_t rqstamp;
-    uint32_t priority;
-    uint32_t usage;
-    uint32_t state;
-    uint32_t stamp;
-    uint32_t key;
+    uint64_t rqstamp;
+    uint64_t priority;
+    uint64_t usage;
+    uint64_t state;
+    uint64_t stamp;
+    uint64_t key;
 
     MRP_ASSERT(rset, "invalid argument");
 
@@ -455,8 +578,8 @@ static void init_name_hash(void)
 
     if (!name_hash) {
         cfg.nentry  = CLASS_MAX;
-        cfg.comp    = mrp_string_comp;
-        cfg.hash    = mrp_string_hash;
+        cfg.comp    = mrp_string_casecomp;
+        cfg.hash    = mrp_string_casehash;
         cfg.free    = NULL;
         cfg.nbucket = cfg.nentry / 2;
 
@@ -513,11 +636,14 @@ static mqi_handle_t get_database_table(void)
 
     static mqi_handle_t  table = MQI_HANDLE_INVALID;
     static char         *name  = "application_classes";
+    int                  prof;
 
     if (table == MQI_HANDLE_INVALID) {
         mqi_open();
 
+        prof  = mrp_profile_begin("create table %s", name);
         table = MQI_CREATE_TABLE(name, MQI_TEMPORARY, coldefs, indexdef);
+        mrp_profile_end(prof);
 
         if (table == MQI_HANDLE_INVALID)
             mrp_log_error("Can't create table '%s': %s", name,strerror(errno));
@@ -33,6 +33,7 @@
 #include <murphy/common/list.h>
 
 #include "data-types.h"
+#include "grant-latency.h"
 
 
 
@@ -44,6 +45,10 @@ struct mrp_application_class_s {
     bool                  modal;
     mrp_resource_order_t  order;
     mrp_list_hook_t       resource_sets[MRP_ZONE_MAX];
+    mrp_resource_set_t   *resource_tree[MRP_ZONE_MAX];
+    mrp_resource_mask_t   resources[MRP_ZONE_MAX]; /* used by sets in zone */
+    uint32_t             *usage[MRP_ZONE_MAX];     /* sets per resource */
+    mrp_grant_latency_t  *latency[MRP_ZONE_MAX];
 };
 
 mrp_application_class_t *mrp_application_class_find(const char *);
@@ -52,8 +57,9 @@ mrp_resource_set_t *
 mrp_application_class_iterate_rsets(mrp_application_class_t*,uint32_t,void**);
 
 void mrp_application_class_move_resource_set(mrp_resource_set_t *);
+void mrp_application_class_remove_resource_set(mrp_resource_set_t *);
 
-uint32_t mrp_application_class_get_sorting_key(mrp_resource_set_t *);
+uint64_t mrp_application_class_get_sorting_key(mrp_resource_set_t *);
 
 
 #endif  /* __MURPHY_APPLICATION_CLASS_H__ */
@@ -33,12 +33,15 @@
 
 #include <murphy/common/mm.h>
 #include <murphy/common/log.h>
+#include <murphy/common/intern.h>
 
 #include "attribute.h"
 #include "client-api.h"
 
 static mrp_attr_value_t *get_attr_value_from_list(mrp_attr_t *, const char *,
                                                   mqi_data_type_t);
+static int change_type(mrp_attr_def_t *, mrp_attr_value_t *,
+                       mrp_attr_value_t *);
 
 
 int mrp_attribute_copy_definitions(mrp_attr_def_t *from, mrp_attr_def_t *to)
@@ -50,7 +53,7 @@ int mrp_attribute_copy_definitions(mrp_attr_def_t *from, mrp_attr_def_t *to)
     if (from) {
         for (s = from, d = to;   s->name;   s++, d++) {
 
-            if (!(d->name = mrp_strdup(s->name)))
+            if (!(d->name = mrp_intern(s->name)))
                 goto no_memory;
 
             d->access = s->access;
@@ -59,7 +62,7 @@ int mrp_attribute_copy_definitions(mrp_attr_def_t *from, mrp_attr_def_t *to)
                 d->value = s->value;
             else {
                 if (!(d->value.string = mrp_strdup(s->value.string))) {
-                    mrp_free((void *)d->name);
+                    mrp_intern_unref(d->name);
                     memset(d, 0, sizeof(*d));
                     goto no_memory;
                 }
@@ -160,12 +163,13 @@ int mrp_attribute_set_values(mrp_attr_t      *values,
     mrp_attr_value_t *vsrc;
     mrp_attr_value_t *vdst;
     uint32_t i;
+    int changed;
 
 
     MRP_ASSERT(!nattr || (nattr > 0 && defs && attrs),
                "invalid arguments");
 
-    for (i = 0;  i < nattr;  i++) {
+    for (i = 0, changed = 0;  i < nattr;  i++) {
         adef = defs  + i;
         vdst = attrs + i;
 
@@ -173,6 +177,8 @@ int mrp_attribute_set_values(mrp_attr_t      *values,
             !(vsrc = get_attr_value_from_list(values, adef->name, adef->type)))
             vsrc = &adef->value; /* default value */
 
+        changed |= change_type(adef, vdst, vsrc);
+
         if (adef->type !=  mqi_string)
             *vdst = *vsrc;
         else if (vdst->string != vsrc->string) {
@@ -183,7 +189,62 @@ int mrp_attribute_set_values(mrp_attr_t      *values,
         }
     }
 
-    return 0;
+    return changed;
+}
+
+uint32_t mrp_attribute_find_index(const char     *name,
+                                  uint32_t        nattr,
+                                  mrp_attr_def_t *defs)
+{
+    uint32_t i;
+
+    MRP_ASSERT(!nattr || (nattr > 0 && defs), "invalid argument");
+
+    if (name) {
+        for (i = 0;  i < nattr;  i++) {
+            if (name == defs[i].name || !strcasecmp(name, defs[i].name))
+                return i;
+        }
+    }
+
+    return MRP_ATTRIBUTE_ID_INVALID;
+}
+
+int mrp_attribute_set_value(uint32_t          idx,
+                            mrp_attr_value_t *value,
+                            uint32_t          nattr,
+                            mrp_attr_def_t   *defs,
+                            mrp_attr_value_t *attrs)
+{
+    mrp_attr_def_t *adef;
+    mrp_attr_value_t *vdst;
+    const char *str;
+    int changed;
+
+    MRP_ASSERT(!nattr || (nattr > 0 && defs && attrs), "invalid arguments");
+    MRP_ASSERT(value, "invalid argument");
+
+    if (idx >= nattr)
+        return -1;
+
+    adef = defs  + idx;
+    vdst = attrs + idx;
+
+    if (!(adef->access & MRP_RESOURCE_WRITE))
+        return -1;
+
+    changed = change_type(adef, vdst, value);
+
+    if (adef->type != mqi_string)
+        *vdst = *value;
+    else if (vdst->string != value->string) {
+        if (!(str = mrp_strdup(value->string)))
+            return -1;
+        mrp_free((void *)vdst->string);
+        vdst->string = str;
+    }
+
+    return changed;
 }
 
 
@@ -239,7 +300,8 @@ static mrp_attr_value_t *get_attr_value_from_list(mrp_attr_t     *list,
 
     if (list) {
         for (attr = list;   attr->name;   attr++) {
-            if (!strcasecmp(name, attr->name) && type == attr->type)
+            if ((name == attr->name || !strcasecmp(name, attr->name)) &&
+                type == attr->type)
                 return &attr->value;
         }
     }
@@ -247,6 +309,33 @@ static mrp_attr_value_t *get_attr_value_from_list(mrp_attr_t     *list,
     return NULL;
 }
 
+static int change_type(mrp_attr_def_t   *adef,
+                       mrp_attr_value_t *vold,
+                       mrp_attr_value_t *vnew)
+{
+    bool same;
+
+    switch (adef->type) {
+    case mqi_string:
+        same = (vold->string == vnew->string) ||
+            (vold->string && vnew->string &&
+             !strcmp(vold->string, vnew->string));
+        break;
+    case mqi_integer:  same = (vold->integer  == vnew->integer );   break;
+    case mqi_unsignd:  same = (vold->unsignd  == vnew->unsignd );   break;
+    case mqi_floating: same = (vold->floating == vnew->floating);   break;
+    default:           same = true;                                 break;
+    }
+
+    if (same)
+        return 0;
+
+    if (adef->access & MRP_RESOURCE_INFO)
+        return MRP_ATTRIBUTE_CHANGED_INFO;
+    else
+        return MRP_ATTRIBUTE_CHANGED_POLICY;
+}
+
 void mrp_resource_set_free_attribute(mrp_attr_t *attr)
 {
     if (!attr)
@@ -259,32 +348,24 @@ mrp_attr_t *mrp_resource_set_get_attribute_by_name(
         mrp_resource_set_t *resource_set, const char *resource_name,
         const char *attribute_name)
 {
-    mrp_attr_t *attr = NULL, *attrs;
+    mrp_attr_t *attr;
     uint32_t res_id;
-    mrp_attr_t attr_buf[128];
-    uint32_t attr_idx = 0;
-
-    memset(attr_buf, 0, sizeof(attr_buf));
+    uint32_t attr_id;
 
-    res_id = mrp_resource_definition_get_resource_id_by_name(resource_name);
-    attrs = mrp_resource_definition_read_all_attributes(res_id, 128, attr_buf);
+    res_id  = mrp_resource_definition_get_resource_id_by_name(resource_name);
+    attr_id = mrp_resource_definition_get_attribute_id_by_name(res_id,
+                                                               attribute_name);
 
-    if (!attrs)
+    if (attr_id == MRP_ATTRIBUTE_ID_INVALID)
         return NULL;
 
-    while (attrs->name != NULL) {
-        if (strcmp(attrs->name, attribute_name) == 0) {
-
-            mrp_attr_t *buf = mrp_allocz(sizeof(mrp_attr_t));
-            mrp_resource_set_read_attribute(resource_set, resource_name,
-                    attr_idx, buf);
-
-            attr = buf;
+    if (!(attr = mrp_allocz(sizeof(mrp_attr_t))))
+        return NULL;
 
-            break;
-        }
-        attr_idx++;
-        attrs++;
+    if (!mrp_resource_set_read_attribute_by_id(resource_set, res_id, attr_id,
+                                               attr)) {
+        mrp_free(attr);
+        return NULL;
     }
 
     return attr;
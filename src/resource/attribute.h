@@ -38,8 +38,15 @@ mrp_attr_t *mrp_attribute_get_value(uint32_t, mrp_attr_t *, uint32_t,
                                     mrp_attr_def_t *, mrp_attr_value_t *);
 mrp_attr_t *mrp_attribute_get_all_values(uint32_t, mrp_attr_t *, uint32_t,
                                          mrp_attr_def_t *, mrp_attr_value_t *);
+/* what kind of attributes mrp_attribute_set_value{,s} changed */
+#define MRP_ATTRIBUTE_CHANGED_POLICY 0x1 /* policy-relevant attribute(s) */
+#define MRP_ATTRIBUTE_CHANGED_INFO   0x2 /* informational attribute(s) */
+
 int mrp_attribute_set_values(mrp_attr_t *, uint32_t, mrp_attr_def_t *,
                              mrp_attr_value_t *);
+uint32_t mrp_attribute_find_index(const char *, uint32_t, mrp_attr_def_t *);
+int mrp_attribute_set_value(uint32_t, mrp_attr_value_t *, uint32_t,
+                            mrp_attr_def_t *, mrp_attr_value_t *);
 
 int mrp_attribute_print(uint32_t, mrp_attr_def_t *, mrp_attr_value_t *,
                         char *, int);
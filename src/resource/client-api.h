@@ -39,6 +39,15 @@ void mrp_resource_client_destroy(mrp_resource_client_t *client);
 mrp_resource_set_t *mrp_resource_client_find_set(mrp_resource_client_t *client,
                                                  uint32_t resource_set_id);
 
+/*
+ * While the events of a client are blocked, the events of its resource
+ * sets are held back and coalesced, so that once events are allowed again
+ * every affected set gets a single event reflecting its final state.
+ * Blocking can be nested.
+ */
+void mrp_resource_client_block_events(mrp_resource_client_t *client);
+void mrp_resource_client_allow_events(mrp_resource_client_t *client);
+
 
 const char **mrp_zone_get_all_names(uint32_t buflen, const char **buf);
 
@@ -47,14 +56,31 @@ const char **mrp_resource_definition_get_all_names(uint32_t buflen,
 
 uint32_t mrp_resource_definition_get_resource_id_by_name(const char *name);
 
+uint32_t mrp_zone_get_id_by_name(const char *name);
+
 mrp_attr_t *
 mrp_resource_definition_read_all_attributes(uint32_t resource_id,
                                             uint32_t buflen,
                                             mrp_attr_t *buf);
 
+/*
+ * Attribute ids are the indices of the attributes in the resource
+ * definition. Resolve them once by name and use the *_by_id accessors
+ * to avoid name lookups on every access.
+ */
+uint32_t mrp_resource_definition_get_attribute_id_by_name(uint32_t resource_id,
+                                                          const char *name);
+
 const char **mrp_application_class_get_all_names(uint32_t buflen,
                                                  const char **buf);
 
+/*
+ * The definition generation is bumped whenever a resource, application
+ * class or zone gets defined. Anything derived from the definitions can
+ * be cached for as long as the generation stays the same.
+ */
+uint32_t mrp_resource_definitions_get_generation(void);
+
 int mrp_application_class_add_resource_set(const char *class_name,
                                            const char *zone_name,
                                            mrp_resource_set_t *resource_set,
@@ -68,6 +94,10 @@ mrp_resource_set_t *mrp_resource_set_create(mrp_resource_client_t *client,
                                             void *user_data);
 void mrp_resource_set_destroy(mrp_resource_set_t *resource_set);
 
+/* request an event for the set, coalesced with any pending one */
+void mrp_resource_set_post_event(mrp_resource_set_t *resource_set,
+                                 uint32_t request_id);
+
 uint32_t mrp_get_resource_set_id(mrp_resource_set_t *resource_set);
 
 mrp_resource_state_t
@@ -105,12 +135,34 @@ int mrp_resource_set_write_attributes(mrp_resource_set_t *resource_set,
                                       const char *resource_name,
                                       mrp_attr_t *attribute_list);
 
+mrp_attr_t *
+mrp_resource_set_read_attribute_by_id(mrp_resource_set_t *resource_set,
+                                      uint32_t resource_id,
+                                      uint32_t attribute_id,
+                                      mrp_attr_t *buf);
+
+int mrp_resource_set_write_attribute_by_id(mrp_resource_set_t *resource_set,
+                                           uint32_t resource_id,
+                                           uint32_t attribute_id,
+                                           mrp_attr_value_t *value);
+
+/* mark the receipt of a request, for measuring its latency */
+void mrp_resource_set_stamp_request(mrp_resource_set_t *resource_set);
+
 void mrp_resource_set_acquire(mrp_resource_set_t *resource_set,
                               uint32_t request_id);
 
 void mrp_resource_set_release(mrp_resource_set_t *resource_set,
                               uint32_t request_id);
 
+/*
+ * Batch the acquire and release requests issued between begin and commit.
+ * All pending requests of a zone are arbitrated in a single pass on commit
+ * and every affected resource set receives a single event. Batches nest.
+ */
+void mrp_resource_set_begin_batch(void);
+void mrp_resource_set_commit_batch(void);
+
 mrp_resource_t *
 mrp_resource_set_iterate_resources(mrp_resource_set_t *resource_set,void **it);
 
@@ -122,6 +174,20 @@ bool mrp_resource_is_shared(mrp_resource_t *resource);
 /* Find a resource set given the resource set id. */
 mrp_resource_set_t *mrp_resource_set_find_by_id(uint32_t id);
 
+/*
+ * An owner watch gets called with the zone id, the resource id and the
+ * new owning resource set (NULL if none) whenever arbitration changes
+ * the owner of the watched resource in the watched zone. Changes of the
+ * attributes of the owned resource alone are not reported. A watch can
+ * be removed, even from within a watch callback.
+ */
+mrp_resource_owner_watch_t *
+mrp_resource_owner_watch(uint32_t zone_id, uint32_t resource_id,
+                         mrp_resource_owner_watch_cb_t cb, void *user_data);
+void mrp_resource_owner_unwatch(mrp_resource_owner_watch_t *watch);
+mrp_resource_set_t *mrp_resource_owner_get_set(uint32_t zone_id,
+                                               uint32_t resource_id);
+
 /* Get a single attribute object that contains the current value. */
 mrp_attr_t *mrp_resource_set_get_attribute_by_name(
         mrp_resource_set_t *resource_set, const char *resource_name,
@@ -40,6 +40,9 @@ mrp_attr_t *mrp_resource_read_all_attributes(mrp_resource_t *resource,
                                              uint32_t buflen,
                                              mrp_attr_t *buf);
 int mrp_resource_write_attributes(mrp_resource_t *resource, mrp_attr_t *attrs);
+int mrp_resource_write_attribute(mrp_resource_t *resource,
+                                 uint32_t attribute_index,
+                                 mrp_attr_value_t *value);
 
 
 #endif  /* __MURPHY_RESOURCE_COMMON_API_H__ */
@@ -30,10 +30,21 @@
 #ifndef __MURPHY_RESOURCE_CONFIG_API_H__
 #define __MURPHY_RESOURCE_CONFIG_API_H__
 
+#include <murphy/common/mainloop.h>
+
 #include <murphy/resource/data-types.h>
 
 void mrp_resource_configuration_init(void);
 
+/*
+ * Bracket loading the configuration. Creating the database tables of the
+ * resources and delivering the database triggers for zones and classes
+ * is deferred until the outermost end, or until the first resource set
+ * is created, whichever comes first.
+ */
+void mrp_resource_configuration_begin(void);
+void mrp_resource_configuration_end(void);
+
 int mrp_zone_definition_create(mrp_attr_def_t *attrdefs);
 uint32_t mrp_zone_create(const char *name, mrp_attr_t *attrs);
 
@@ -46,6 +57,16 @@ mrp_application_class_t *mrp_application_class_create(const char *name,
 int mrp_application_class_print(char *buf, int len, bool with_resource_sets);
 
 int mrp_resource_owner_print(char *buf, int len);
+int mrp_resource_owner_print_zone(uint32_t zone, char *buf, int len);
+
+/*
+ * Use nthread worker threads (one per CPU if negative, none if 0) for
+ * arbitrating zones in parallel when recalculating all of them.
+ */
+int mrp_resource_owner_set_arbiters(mrp_mainloop_t *ml, int nthread);
+
+int mrp_grant_latency_print(char *buf, int len);
+void mrp_grant_latency_reset(void);
 
 
 #endif  /* __MURPHY_RESOURCE_CONFIG_API_H__ */
@@ -37,6 +37,7 @@
 
 #include <murphy/common.h>
 #include <murphy/common/debug.h>
+#include <murphy/common/profile.h>
 #include <murphy/core/lua-bindings/murphy.h>
 #include <murphy/core/lua-utils/object.h>
 
@@ -88,6 +89,7 @@ enum field_e {
     OWNERS,
     RECALC,
     VETO,
+    VETO_ZONE,
     ID
 };
 
@@ -208,6 +210,11 @@ static field_t field_name_to_type(const char *, size_t);
 
 static int method_recalc(lua_State *);
 
+static int reuse_on_reload(lua_State *, mrp_lua_classdef_t *, const char *,
+                           const char *);
+static void config_reloaded_cb(mrp_event_watch_t *, uint32_t, int, void *,
+                               void *);
+
 
 MRP_LUA_METHOD_LIST_TABLE (
     zone_attr_methods,       /* methodlist name */
@@ -318,8 +325,10 @@ void mrp_resource_configuration_init(void)
     static bool initialised = false;
 
     lua_State *L;
+    int prof;
 
     if (!initialised && (L =  mrp_lua_get_lua_state())) {
+        prof = mrp_profile_begin("create resource Lua classes");
 
         appclass_class_create(L);
         zone_class_create(L);
@@ -330,6 +339,11 @@ void mrp_resource_configuration_init(void)
 
         resource_methods_create(L);
 
+        mrp_profile_end(prof);
+
+        mrp_event_add_watch(NULL, mrp_event_id(MRP_LUA_CONFIG_RELOADED),
+                            config_reloaded_cb, NULL);
+
         mrp_debug("lua classes are ready for resource "
                   "configuration and management");
 
@@ -704,6 +718,10 @@ static int appclass_create(lua_State *L)
         luaL_error(L, "missing or wrong order field");
     if (priority < 0)
         luaL_error(L, "negative priority");
+    if (reuse_on_reload(L, APPCLASS_CLASS, "application class", name)) {
+        mrp_free((void *)name);
+        MRP_LUA_LEAVE(1);
+    }
     if (!mrp_application_class_create(name, priority, modal, share, order))
         luaL_error(L, "failed to create application class '%s'", name);
 
@@ -813,6 +831,11 @@ static int zone_create(lua_State *L)
 
     if (!name)
         luaL_error(L, "missing or wrong name field");
+    if (reuse_on_reload(L, ZONE_CLASS, "zone", name)) {
+        free_attrs(attrs);
+        mrp_free((void *)name);
+        MRP_LUA_LEAVE(1);
+    }
     if ((id = mrp_zone_create(name,attrs)) == MRP_ZONE_ID_INVALID)
         luaL_error(L, "failed to create zone");
 
@@ -909,8 +932,10 @@ static int zone_attr_create(lua_State *L)
 
     MRP_ASSERT(zone_attr_defs, "invocation prior to initialization");
 
-    if (zone_attr_defs->attrs)
-        luaL_error(L, "zone attributes already defined");
+    if (zone_attr_defs->attrs) {
+        if (!mrp_lua_reloading())
+            luaL_error(L, "zone attributes already defined");
+    }
     else {
         attrs = check_attrdefs(L, 2, &nattr);
 
@@ -1064,6 +1089,12 @@ static int resclass_create_from_lua(lua_State *L)
     if (!name)
         luaL_error(L, "missing or wrong name field");
 
+    if (reuse_on_reload(L, RESCLASS_CLASS, "resource class", name)) {
+        free_attrdefs(attrs);
+        mrp_free((void *)name);
+        MRP_LUA_LEAVE(1);
+    }
+
     id = mrp_resource_definition_create(name, shareable, attrs,ftbl,mgrdata);
 
     MRP_ASSERT(id < MRP_RESOURCE_MAX, "resource id is out of range");
@@ -1307,6 +1338,7 @@ static int resmethod_getfield(lua_State *L)
         else {
             switch (fld) {
             case VETO:
+            case VETO_ZONE:
             case RECALC:
                 lua_pushstring(L, name);
                 lua_rawget(L, 1);
@@ -1337,6 +1369,14 @@ static int resmethod_setfield(lua_State *L)
             method->veto = mrp_funcarray_check(L, -1);
             lua_rawset(L, 1);
             break;
+        case VETO_ZONE:
+            if (!lua_isnil(L, 3))
+                luaL_checktype(L, 3, LUA_TFUNCTION);
+            lua_pushstring(L, name);
+            lua_pushvalue(L, 3);
+            lua_rawset(L, 1);
+            method->veto_zone = !lua_isnil(L, 3);
+            break;
         default:
             luaL_error(L, "invalid method '%s'", name);
             break;
@@ -1353,6 +1393,7 @@ static void resmethod_destroy(void *data)
     MRP_LUA_ENTER;
 
     method->veto = NULL;
+    method->veto_zone = false;
 
     MRP_LUA_LEAVE_NOARG;
 }
@@ -1372,6 +1413,7 @@ static mrp_attr_def_t *check_attrdefs(lua_State *L, int t, int *ret_len)
     const char *string;
     const char *access;
     bool value_set;
+    bool info;
     int len;
     size_t size;
     size_t namlen;
@@ -1393,6 +1435,7 @@ static mrp_attr_def_t *check_attrdefs(lua_State *L, int t, int *ret_len)
         ad->access = MRP_RESOURCE_READ;
 
         value_set = false;
+        info = false;
 
         luaL_checktype(L, -1, LUA_TTABLE);
 
@@ -1445,12 +1488,26 @@ static mrp_attr_def_t *check_attrdefs(lua_State *L, int t, int *ret_len)
                         ad->type = mqi_error;
                 }
                 break;
+            case 4:
+                if (!(access = lua_tostring(L, -1)))
+                    ad->type = mqi_error;
+                else {
+                    if (!strcasecmp(access, "informational") ||
+                        !strcasecmp(access, "info"))
+                        info = true;
+                    else if (strcasecmp(access, "policy"))
+                        ad->type = mqi_error;
+                }
+                break;
             default:
                 ad->type = mqi_error;
                 break;
             }
         } /* for */
 
+        if (info)
+            ad->access |= MRP_RESOURCE_INFO;
+
         if (!value_set ||
             (ad->type != mqi_string  &&
              ad->type != mqi_integer &&
@@ -1604,6 +1661,38 @@ static int check_attrindex(lua_State *L, int arg, attr_def_t *def)
 }
 
 
+static int reuse_on_reload(lua_State *L, mrp_lua_classdef_t *def,
+                           const char *kind, const char *name)
+{
+    if (!mrp_lua_reloading())
+        return FALSE;
+
+    mrp_lua_find_object(L, def, name);
+
+    if (mrp_lua_to_object(L, def, -1) == NULL) {
+        lua_pop(L, 1);
+        return FALSE;
+    }
+
+    mrp_log_info("%s '%s' kept", kind, name);
+
+    return TRUE;
+}
+
+
+static void config_reloaded_cb(mrp_event_watch_t *w, uint32_t id, int format,
+                               void *data, void *user_data)
+{
+    MRP_UNUSED(w);
+    MRP_UNUSED(id);
+    MRP_UNUSED(format);
+    MRP_UNUSED(data);
+    MRP_UNUSED(user_data);
+
+    mrp_resource_owner_recalc_all();
+}
+
+
 static int check_boolean(lua_State *L, int idx)
 {
     if (!lua_isboolean(L, idx))
@@ -1710,6 +1799,8 @@ static field_t field_name_to_type(const char *name, size_t len)
             return MANDATORY;
         if (!strcmp(name, "shareable"))
             return SHAREABLE;
+        if (!strcmp(name, "veto_zone"))
+            return VETO_ZONE;
         break;
 
     case 10:
@@ -38,6 +38,7 @@ typedef struct mrp_lua_resmethod_s   mrp_lua_resmethod_t;
 
 struct mrp_lua_resmethod_s {
     mrp_funcarray_t *veto;
+    bool             veto_zone;
 };
 
 
@@ -39,16 +39,18 @@
  * Remember: this should be smaller than
  * sizeof(mrp_zone_mask_t) * 8
  */
-#define MRP_ZONE_MAX            8
-#define MRP_ZONE_MASK           (((mrp_zone_mask_t)1 << MRP_ZONE_MAX) - 1)
+#define MRP_ZONE_MAX            64
+#define MRP_ZONE_MASK           (~(mrp_zone_mask_t)0 >>                      \
+                                 (sizeof(mrp_zone_mask_t) * 8 - MRP_ZONE_MAX))
 
-#define MRP_KEY_STAMP_BITS      27
+#define MRP_KEY_STAMP_BITS      59
 #define MRP_KEY_STATE_BITS      1
 #define MRP_KEY_USAGE_BITS      1
 #define MRP_KEY_PRIORITY_BITS   3
 
 #define MRP_ZONE_ID_INVALID        (~(uint32_t)0)
 #define MRP_RESOURCE_ID_INVALID    (~(uint32_t)0)
+#define MRP_ATTRIBUTE_ID_INVALID   (~(uint32_t)0)
 #define MRP_RESOURCE_REQNO_INVALID (~(uint32_t)0)
 
 #define MRP_RESOURCE_MAX  (sizeof(mrp_resource_mask_t) * 8)
@@ -72,13 +74,15 @@ typedef struct mrp_resource_def_s       mrp_resource_def_t;
 typedef struct mrp_resource_s           mrp_resource_t;
 typedef struct mrp_resource_mgr_ftbl_s  mrp_resource_mgr_ftbl_t;
 typedef struct mrp_resource_mgr_s       mrp_resource_mgr_t;
+typedef struct mrp_resource_change_s    mrp_resource_change_t;
+typedef struct mrp_resource_owner_watch_s mrp_resource_owner_watch_t;
 
 typedef struct mrp_resource_ownersref_s mrp_resource_ownersref_t;
 typedef struct mrp_resource_setref_s    mrp_resource_setref_t;
 
-typedef uint32_t                        mrp_resource_mask_t;
+typedef uint64_t                        mrp_resource_mask_t;
 typedef uint32_t                        mrp_attribute_mask_t;
-typedef uint32_t                        mrp_zone_mask_t;
+typedef uint64_t                        mrp_zone_mask_t;
 
 
 enum mrp_resource_state_e {
@@ -92,7 +96,8 @@ enum mrp_resource_access_e {
     MRP_RESOURCE_ACCESS_NONE  = 0,
     MRP_RESOURCE_READ  = 1,
     MRP_RESOURCE_WRITE = 2,
-    MRP_RESOURCE_RW    = (MRP_RESOURCE_READ | MRP_RESOURCE_WRITE)
+    MRP_RESOURCE_RW    = (MRP_RESOURCE_READ | MRP_RESOURCE_WRITE),
+    MRP_RESOURCE_INFO  = 4,     /* changes do not affect arbitration */
 };
 
 enum mrp_resource_order_e {
@@ -123,6 +128,8 @@ struct mrp_attr_s {
 
 
 typedef void (*mrp_resource_event_cb_t)(uint32_t, mrp_resource_set_t *, void*);
+typedef void (*mrp_resource_owner_watch_cb_t)(uint32_t, uint32_t,
+                                              mrp_resource_set_t *, void *);
 
 enum mrp_resource_event_e {
     MRP_RESOURCE_EVENT_UNKNOWN = 0,
@@ -140,6 +147,23 @@ typedef bool (*mrp_manager_alloc_func_t)(mrp_zone_t *,mrp_resource_t *,void*);
 typedef void (*mrp_manager_free_func_t)(mrp_zone_t *,mrp_resource_t *,void *);
 typedef bool (*mrp_manager_advice_func_t)(mrp_zone_t *,mrp_resource_t*,void *);
 typedef void (*mrp_manager_commit_func_t)(mrp_zone_t *, void *);
+typedef void (*mrp_manager_changes_func_t)(mrp_zone_t *,
+                                           mrp_resource_change_t *, int,
+                                           void *);
+
+/*
+ * Change in the ownership of a resource of a zone by an arbitration pass.
+ * A NULL owner means the resource was not (or is no longer) owned. If the
+ * owner did not change, the attributes of the owned resource did.
+ */
+struct mrp_resource_change_s {
+    uint32_t                  resid;
+    struct {
+        mrp_application_class_t *class;
+        mrp_resource_set_t      *rset;
+        mrp_resource_t          *res;
+    }                         old, new;
+};
 
 struct mrp_resource_mgr_ftbl_s  {
     mrp_manager_notify_func_t   notify;
@@ -148,6 +172,13 @@ struct mrp_resource_mgr_ftbl_s  {
     mrp_manager_free_func_t     free;
     mrp_manager_advice_func_t   advice;
     mrp_manager_commit_func_t   commit;
+    /*
+     * Called once per arbitration pass, after commit, with all the
+     * ownership changes of the zone of every resource managed with the
+     * same function and user data, so a manager of several resources
+     * can enforce the outcome of a pass in one go.
+     */
+    mrp_manager_changes_func_t  changes;
 };
 
 
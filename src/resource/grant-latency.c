@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <murphy/common/mm.h>
+#include <murphy/common/debug.h>
+
+#include <murphy/resource/config-api.h>
+
+#include "grant-latency.h"
+#include "application-class.h"
+#include "zone.h"
+
+/*
+ * Grant latency is collected per application class and zone, for every
+ * stage into a histogram of power of two buckets: bucket i counts samples
+ * below 2^i usecs, the last one everything above. Percentiles are thus
+ * only accurate up to a factor of two, which is plenty to tell which stage
+ * dominates.
+ */
+
+#define BUCKET_MAX 24
+
+typedef struct {
+    uint32_t buckets[BUCKET_MAX];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+} stage_stats_t;
+
+struct mrp_grant_latency_s {
+    stage_stats_t stages[MRP_GRANT_STAGE_MAX];
+};
+
+static const char *stage_names[MRP_GRANT_STAGE_MAX] = {
+    [MRP_GRANT_STAGE_QUEUE]    = "queue",
+    [MRP_GRANT_STAGE_POLICY]   = "policy",
+    [MRP_GRANT_STAGE_MANAGER]  = "manager",
+    [MRP_GRANT_STAGE_DB]       = "db",
+    [MRP_GRANT_STAGE_DELIVERY] = "delivery",
+    [MRP_GRANT_STAGE_TOTAL]    = "total",
+};
+
+
+uint64_t mrp_grant_latency_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static void observe(stage_stats_t *st, uint64_t usecs)
+{
+    int i;
+
+    for (i = 0;  i < BUCKET_MAX - 1 && usecs >= ((uint64_t)1 << i);  i++)
+        ;
+
+    st->buckets[i]++;
+    st->count++;
+    st->sum += usecs;
+
+    if (usecs > st->max)
+        st->max = usecs;
+}
+
+
+void mrp_grant_latency_record(mrp_application_class_t *class, uint32_t zone,
+                              mrp_grant_stamps_t *stamps, uint64_t now)
+{
+    mrp_grant_latency_t *lat;
+    stage_stats_t       *st;
+    uint64_t             queue, delivery;
+
+    if (!class || zone >= MRP_ZONE_MAX || !stamps->received)
+        goto out;
+
+    if (!(lat = class->latency[zone])) {
+        if (!(lat = class->latency[zone] = mrp_allocz(sizeof(*lat))))
+            goto out;
+    }
+
+    st = lat->stages;
+
+    if (stamps->arbitrated) {
+        queue = stamps->arbitrated > stamps->received ?
+            stamps->arbitrated - stamps->received : 0;
+
+        observe(st + MRP_GRANT_STAGE_QUEUE  , queue);
+        observe(st + MRP_GRANT_STAGE_POLICY , stamps->policy);
+        observe(st + MRP_GRANT_STAGE_MANAGER, stamps->manager);
+        observe(st + MRP_GRANT_STAGE_DB     , stamps->db);
+    }
+
+    if (stamps->queued) {
+        delivery = now > stamps->queued ? now - stamps->queued : 0;
+        observe(st + MRP_GRANT_STAGE_DELIVERY, delivery);
+    }
+
+    observe(st + MRP_GRANT_STAGE_TOTAL,
+            now > stamps->received ? now - stamps->received : 0);
+
+    mrp_debug("grant latency of class '%s' in zone %u: %llu usecs",
+              class->name, zone,
+              (unsigned long long)(now - stamps->received));
+
+ out:
+    mrp_clear(stamps);
+}
+
+
+static void free_latency(mrp_application_class_t *class)
+{
+    uint32_t zone;
+
+    for (zone = 0;  zone < MRP_ZONE_MAX;  zone++) {
+        mrp_free(class->latency[zone]);
+        class->latency[zone] = NULL;
+    }
+}
+
+
+static uint64_t percentile(stage_stats_t *st, int pct)
+{
+    uint64_t target, seen;
+    int      i;
+
+    target = (st->count * pct + 99) / 100;
+    seen   = 0;
+
+    for (i = 0;  i < BUCKET_MAX - 1;  i++) {
+        if ((seen += st->buckets[i]) >= target)
+            return MRP_MIN((uint64_t)1 << i, st->max);
+    }
+
+    return st->max;
+}
+
+
+int mrp_grant_latency_print(char *buf, int len)
+{
+#define PRINT(fmt, args...) \
+    do { if (p<e) { p += snprintf(p, e-p, fmt , ##args); } } while (0)
+
+    mrp_application_class_t *class;
+    mrp_grant_latency_t *lat;
+    mrp_zone_t *zone;
+    stage_stats_t *st;
+    void *cursor;
+    uint32_t zid;
+    char *p, *e;
+    int i, n;
+
+    if (len <= 0)
+        return 0;
+
+    MRP_ASSERT(buf, "invalid argument");
+
+    e = (p = buf) + len;
+    n = 0;
+
+    PRINT("Grant latency (usecs, percentiles within a factor of 2):\n");
+
+    for (zid = 0;  zid < MRP_ZONE_MAX;  zid++) {
+        cursor = NULL;
+
+        while ((class = mrp_application_class_iterate_classes(&cursor))) {
+            if (!(lat = class->latency[zid]))
+                continue;
+
+            if (!lat->stages[MRP_GRANT_STAGE_TOTAL].count)
+                continue;
+
+            zone = mrp_zone_find_by_id(zid);
+
+            PRINT("  zone '%s', class '%s', %llu requests\n",
+                  zone ? zone->name : "<unknown>", class->name,
+                  (unsigned long long)lat->stages[MRP_GRANT_STAGE_TOTAL].count);
+            PRINT("    %-10s %10s %10s %10s %10s %10s\n",
+                  "stage", "mean", "p50", "p90", "p99", "max");
+
+            for (i = 0;  i < MRP_GRANT_STAGE_MAX;  i++) {
+                st = lat->stages + i;
+
+                if (!st->count)
+                    continue;
+
+                PRINT("    %-10s %10llu %10llu %10llu %10llu %10llu\n",
+                      stage_names[i],
+                      (unsigned long long)(st->sum / st->count),
+                      (unsigned long long)percentile(st, 50),
+                      (unsigned long long)percentile(st, 90),
+                      (unsigned long long)percentile(st, 99),
+                      (unsigned long long)st->max);
+            }
+
+            n++;
+        }
+    }
+
+    if (!n)
+        PRINT("  no requests recorded\n");
+
+    return p - buf;
+
+#undef PRINT
+}
+
+
+void mrp_grant_latency_reset(void)
+{
+    mrp_application_class_t *class;
+    void *cursor = NULL;
+
+    while ((class = mrp_application_class_iterate_classes(&cursor)))
+        free_latency(class);
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
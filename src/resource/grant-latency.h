@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MURPHY_GRANT_LATENCY_H__
+#define __MURPHY_GRANT_LATENCY_H__
+
+#include "data-types.h"
+
+/*
+ * Stages of an acquire or release request, from receiving it to writing
+ * out the event replying to it.
+ */
+enum mrp_grant_stage_e {
+    MRP_GRANT_STAGE_QUEUE = 0,      /* received until arbitration started */
+    MRP_GRANT_STAGE_POLICY,         /* arbitration, including Lua vetoes */
+    MRP_GRANT_STAGE_MANAGER,        /* manager transaction callbacks */
+    MRP_GRANT_STAGE_DB,             /* owner table updates */
+    MRP_GRANT_STAGE_DELIVERY,       /* event queued until reply written */
+    MRP_GRANT_STAGE_TOTAL,          /* received until reply written */
+    MRP_GRANT_STAGE_MAX
+};
+
+typedef enum mrp_grant_stage_e mrp_grant_stage_t;
+
+typedef struct mrp_grant_latency_s mrp_grant_latency_t;
+
+/* per request stage timestamps, carried in the resource set */
+typedef struct {
+    uint64_t received;              /* request received, 0 if untracked */
+    uint64_t arbitrated;            /* arbitration answering it started */
+    uint64_t queued;                /* reply event queued */
+    uint32_t policy;                /* usecs spent arbitrating */
+    uint32_t manager;               /* usecs spent in manager callbacks */
+    uint32_t db;                    /* usecs spent updating owner tables */
+} mrp_grant_stamps_t;
+
+
+uint64_t mrp_grant_latency_now(void);
+void mrp_grant_latency_record(mrp_application_class_t *, uint32_t,
+                              mrp_grant_stamps_t *, uint64_t);
+
+
+#endif  /* __MURPHY_GRANT_LATENCY_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ *
+ */
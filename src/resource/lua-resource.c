@@ -344,7 +344,7 @@ static int resource_set_add_resource(lua_State *L)
         goto error;
 
     resource->parent = rset;
-    resource->L = L;
+    resource->L = mrp_lua_main_state(L);
 
     resource->real_attributes = (attribute_lua_t *) mrp_lua_create_object(L,
             ATTRIBUTE_LUA_CLASS, NULL, 0);
@@ -354,7 +354,7 @@ static int resource_set_add_resource(lua_State *L)
 
     /* mrp_lua_object_ref_value(resource->real_attributes, L, 0); */
 
-    resource->real_attributes->L = L;
+    resource->real_attributes->L = mrp_lua_main_state(L);
     resource->real_attributes->parent = resource;
     resource->real_attributes->resource_set = rset;
     resource->real_attributes->initialized = TRUE;
@@ -501,7 +501,7 @@ static int resource_set_lua_create(lua_State *L)
     if (!rset)
         return luaL_error(L, "could not create Lua object");
 
-    rset->L = L;
+    rset->L = mrp_lua_main_state(L);
 
     /* user can affect these values */
     rset->zone = mrp_strdup("default");
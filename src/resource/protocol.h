@@ -38,6 +38,8 @@
 
 #define RESPROTO_DEFAULT_ADDRESS      "unxs:@murphy-resource-native"
 #define RESPROTO_DEFAULT_ADDRVAR      "MURPHY_RESOURCE_ADDRESS"
+#define RESPROTO_DEFAULT_STATESHM     "/murphy-resource-state"
+#define RESPROTO_DEFAULT_STATEVAR     "MURPHY_RESOURCE_STATESHM"
 
 
 #define RESPROTO_BIT(n)               ((uint32_t)1 << (n))
@@ -71,6 +73,9 @@
 #define RESPROTO_ATTRIBUTE_INDEX      RESPROTO_TAG(16)
 #define RESPROTO_ATTRIBUTE_NAME       RESPROTO_TAG(17)
 #define RESPROTO_ATTRIBUTE_VALUE      RESPROTO_TAG(18)
+#define RESPROTO_TEMPLATE_ID          RESPROTO_TAG(19)
+#define RESPROTO_TEMPLATE_NAME        RESPROTO_TAG(20)
+#define RESPROTO_ZONE_ID              RESPROTO_TAG(21)
 
 typedef enum {
     RESPROTO_QUERY_RESOURCES,
@@ -81,8 +86,51 @@ typedef enum {
     RESPROTO_ACQUIRE_RESOURCE_SET,
     RESPROTO_RELEASE_RESOURCE_SET,
     RESPROTO_RESOURCES_EVENT,
+    RESPROTO_BATCH_REQUEST,
+    RESPROTO_REGISTER_TEMPLATE,
+    RESPROTO_CREATE_FROM_TEMPLATE,
+    RESPROTO_UNREGISTER_TEMPLATE,
+    RESPROTO_SUBSCRIBE_OWNER,
+    RESPROTO_UNSUBSCRIBE_OWNER,
+    RESPROTO_OWNER_EVENT,
 } mrp_resproto_request_t;
 
+/*
+ * resource set templates
+ *
+ * A client that keeps creating resource sets of the same shape can
+ * register the shape once as a named template. REGISTER_TEMPLATE carries
+ * a TEMPLATE_NAME followed by the same fields as CREATE_RESOURCE_SET and
+ * is answered with a TEMPLATE_ID. Registering an existing name returns
+ * the id of the existing template. CREATE_FROM_TEMPLATE carries the
+ * TEMPLATE_ID, optionally followed by overrides, each being a
+ * RESOURCE_NAME with the attributes to override and a SECTION_END. It is
+ * answered like CREATE_RESOURCE_SET. Templates live until they are
+ * unregistered or the client disconnects.
+ */
+
+/*
+ * grant and advice masks
+ *
+ * Resource masks are 64 bits wide. RESOURCE_GRANT and RESOURCE_ADVICE are
+ * sent as UINT32 fields if the resource set only uses the first 32
+ * resources, as clients predating wider masks expect, and as UINT64
+ * fields otherwise. Clients must accept either.
+ */
+
+/*
+ * resource owner subscriptions
+ *
+ * A client interested in who owns a resource in a zone can subscribe to
+ * it with SUBSCRIBE_OWNER, carrying a ZONE_NAME and a RESOURCE_NAME. The
+ * reply carries the ZONE_ID and RESOURCE_ID used in the events, and the
+ * current owner as a RESOURCE_SET_ID (0 if there is none) and a
+ * CLASS_NAME (empty if there is none). After that an OWNER_EVENT with the
+ * same four fields and sequence number 0 is sent whenever the owner
+ * changes. UNSUBSCRIBE_OWNER, carrying the same fields as SUBSCRIBE_OWNER,
+ * cancels the subscription. Subscriptions end when the client disconnects.
+ */
+
 typedef enum {
     RESPROTO_RELEASE,
     RESPROTO_ACQUIRE,
@@ -99,6 +147,126 @@ static inline const char *mrp_resource_get_default_address(void)
         return addr;
 }
 
+static inline const char *mrp_resource_get_default_stateshm(void)
+{
+    const char *name;
+
+    if ((name = getenv(RESPROTO_DEFAULT_STATEVAR)) == NULL)
+        return RESPROTO_DEFAULT_STATESHM;
+    else
+        return name;
+}
+
+
+/*
+ * resource set states published in shared memory
+ *
+ * The resource manager can optionally publish the grant and advice masks
+ * of every resource set in a shared memory segment which the clients on
+ * the same host map read-only. A slot is selected by the low bits of the
+ * resource set id and carries the full id, so readers can tell whether
+ * the slot belongs to their set. Each slot is guarded by a sequence lock:
+ * the single writer keeps the sequence number odd while updating the slot
+ * and readers retry until they see the same even sequence number before
+ * and after reading the slot. The masks are stored as two 32-bit halves.
+ * The magic was bumped with the layout, so older readers ignore the
+ * segment instead of misreading it.
+ */
+
+#define RESPROTO_STATESHM_MAGIC       0x6d727332 /* 'mrs2' */
+#define RESPROTO_STATESHM_NSLOT       1024       /* must be a power of 2 */
+#define RESPROTO_STATESHM_RETRY       64         /* read attempts */
+
+typedef struct {
+    uint32_t seq;                        /* sequence lock */
+    uint32_t rset_id;                    /* resource set id, 0 if unused */
+    uint32_t owner;                      /* connection owning the set */
+    uint32_t state;                      /* mrp_resproto_state_t */
+    uint32_t grant;                      /* granted resources, low half */
+    uint32_t advice;                     /* grantable resources, low half */
+    uint32_t grant_hi;                   /* granted resources, high half */
+    uint32_t advice_hi;                  /* grantable resources, high half */
+} mrp_resproto_stateslot_t;
+
+typedef struct mrp_resproto_stateshm_s {
+    uint32_t                 magic;      /* RESPROTO_STATESHM_MAGIC */
+    uint32_t                 nslot;      /* RESPROTO_STATESHM_NSLOT */
+    mrp_resproto_stateslot_t slots[RESPROTO_STATESHM_NSLOT];
+} mrp_resproto_stateshm_t;
+
+
+static inline mrp_resproto_stateslot_t *
+mrp_resproto_stateshm_slot(const mrp_resproto_stateshm_t *shm, uint32_t rset_id)
+{
+    const mrp_resproto_stateslot_t *slot;
+
+    slot = shm->slots + (rset_id & (RESPROTO_STATESHM_NSLOT - 1));
+
+    return (mrp_resproto_stateslot_t *)slot;
+}
+
+static inline void mrp_resproto_stateshm_write(mrp_resproto_stateslot_t *slot,
+                                               uint32_t rset_id,
+                                               uint32_t owner,
+                                               uint32_t state,
+                                               uint64_t grant,
+                                               uint64_t advice)
+{
+    uint32_t seq = slot->seq;
+
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&slot->rset_id  , rset_id         , __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->owner    , owner           , __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->state    , state           , __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->grant    , (uint32_t)grant , __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->advice   , (uint32_t)advice, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->grant_hi , grant  >> 32    , __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->advice_hi, advice >> 32    , __ATOMIC_RELAXED);
+
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static inline bool mrp_resproto_stateshm_read(
+                                         const mrp_resproto_stateslot_t *slot,
+                                         uint32_t rset_id, uint32_t *state,
+                                         uint64_t *grant, uint64_t *advice)
+{
+    uint32_t seq, id, s, g, a, gh, ah;
+    int      retry;
+
+    for (retry = 0;  retry < RESPROTO_STATESHM_RETRY;  retry++) {
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        if (seq & 1)
+            continue;
+
+        id = __atomic_load_n(&slot->rset_id, __ATOMIC_RELAXED);
+        s  = __atomic_load_n(&slot->state  , __ATOMIC_RELAXED);
+        g  = __atomic_load_n(&slot->grant    , __ATOMIC_RELAXED);
+        a  = __atomic_load_n(&slot->advice   , __ATOMIC_RELAXED);
+        gh = __atomic_load_n(&slot->grant_hi , __ATOMIC_RELAXED);
+        ah = __atomic_load_n(&slot->advice_hi, __ATOMIC_RELAXED);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+            continue;
+
+        if (id != rset_id)
+            return false;
+
+        *state  = s;
+        *grant  = ((uint64_t)gh << 32) | g;
+        *advice = ((uint64_t)ah << 32) | a;
+
+        return true;
+    }
+
+    return false;
+}
+
 #endif  /* __MURPHY_RESOURCE_PROTOCOL_H__ */
 
 /*
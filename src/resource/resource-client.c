@@ -61,6 +61,7 @@ mrp_resource_client_t *mrp_resource_client_create(const char *name,
     client->name = dup_name;
     client->user_data = user_data;
     mrp_list_init(&client->resource_sets);
+    mrp_list_init(&client->held);
 
     mrp_list_append(&client_list, &client->list);
 
@@ -75,6 +76,26 @@ void mrp_resource_client_destroy(mrp_resource_client_t *client)
     if (client) {
         mrp_list_delete(&client->list);
 
+        /*
+         * Release all the sets in a single request batch, so that the
+         * zones get re-arbitrated once, after every set is released,
+         * instead of once per acquired set with the remaining sets of the
+         * client still holding on to their resources. The sets are only
+         * destroyed once the batch is committed: until then the owners
+         * of the zones still point to their resources.
+         */
+        mrp_resource_set_begin_batch();
+
+        mrp_list_foreach(&client->resource_sets, entry, n) {
+            rset = mrp_list_entry(entry, mrp_resource_set_t, client.list);
+            rset->event = NULL; /* nothing is sent to the client any more */
+
+            if (rset->state == mrp_resource_acquire)
+                mrp_resource_set_release(rset, MRP_RESOURCE_REQNO_INVALID);
+        }
+
+        mrp_resource_set_commit_batch();
+
         mrp_list_foreach(&client->resource_sets, entry, n) {
             rset = mrp_list_entry(entry, mrp_resource_set_t, client.list);
             mrp_resource_set_destroy(rset);
@@ -88,20 +109,40 @@ void mrp_resource_client_destroy(mrp_resource_client_t *client)
 
 mrp_resource_set_t *mrp_resource_client_find_set(mrp_resource_client_t *client,
                                                  uint32_t resource_set_id)
+{
+    mrp_resource_set_t *rset;
+
+    if (client && (rset = mrp_resource_set_find_by_id(resource_set_id))) {
+        if (rset->client.ptr == client)
+            return rset;
+    }
+
+    return NULL;
+}
+
+void mrp_resource_client_block_events(mrp_resource_client_t *client)
+{
+    MRP_ASSERT(client, "invalid argument");
+
+    client->blocked++;
+}
+
+void mrp_resource_client_allow_events(mrp_resource_client_t *client)
 {
     mrp_list_hook_t *entry, *n;
     mrp_resource_set_t *rset;
 
-    if (client) {
-        mrp_list_foreach(&client->resource_sets, entry, n) {
-            rset = mrp_list_entry(entry, mrp_resource_set_t, client.list);
+    MRP_ASSERT(client && client->blocked > 0, "invalid argument");
 
-            if (resource_set_id == rset->id)
-                return rset;
-        }
+    if (--client->blocked > 0)
+        return;
+
+    mrp_list_foreach(&client->held, entry, n) {
+        rset = mrp_list_entry(entry, mrp_resource_set_t, delivery.list);
+        mrp_resource_set_queue_event(rset, 0);
     }
 
-    return NULL;
+    mrp_resource_set_deliver_events();
 }
 
 /*
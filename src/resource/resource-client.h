@@ -40,6 +40,8 @@ struct mrp_resource_client_s {
     const char      *name;
     void            *user_data;
     mrp_list_hook_t  resource_sets;
+    int              blocked;       /* event window nesting level */
+    mrp_list_hook_t  held;          /* sets with events held back */
 };
 
 
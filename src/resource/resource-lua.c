@@ -97,10 +97,9 @@ static int  setref_setfield(lua_State *);
 static void setref_destroy(void *);
 static mrp_resource_setref_t *setref_check(lua_State *, int);
 
-static void init_id_hash(void);
-static int  add_to_id_hash(mrp_resource_setref_t *);
-static mrp_resource_setref_t *remove_from_id_hash(uint32_t);
-static mrp_resource_setref_t *find_in_id_hash(uint32_t);
+static int  add_to_id_table(mrp_resource_setref_t *);
+static mrp_resource_setref_t *remove_from_id_table(uint32_t);
+static mrp_resource_setref_t *find_in_id_table(uint32_t);
 
 static field_t field_check(lua_State *, int, const char **);
 static field_t field_name_to_type(const char *, size_t);
@@ -153,7 +152,10 @@ MRP_LUA_CLASS_DEF (
 );
 
 static mrp_resource_ownersref_t *resource_owners[MRP_ZONE_MAX];
-static mrp_htbl_t *id_hash;
+
+static int             gc_hold;       /* arbitration passes holding the GC */
+static bool            gc_stopped;    /* whether we stopped the collector */
+static mrp_deferred_t *gc_deferred;   /* for resuming the collector */
 
 void mrp_resource_lua_init(lua_State *L)
 {
@@ -163,8 +165,6 @@ void mrp_resource_lua_init(lua_State *L)
         owners_class_create(L);
         ownerref_class_create(L);
         setref_class_create(L);
-
-        init_id_hash();
     }
 }
 
@@ -190,20 +190,27 @@ bool mrp_resource_lua_veto(mrp_zone_t *zone,
     top = lua_gettop(L);
 
     if (zone && rset && owners && methods &&
-        (sref = find_in_id_hash(rset->id)) &&
+        (sref = find_in_id_table(rset->id)) &&
         (oref = owners_get(L, zone->id)))
     {
-        rref = reqset ? find_in_id_hash(reqset->id) : NULL;
+        rref = reqset ? find_in_id_table(reqset->id) : NULL;
         oref->owners = owners;
 
+        /*
+         * The handler is called as veto(zone_name, set, grant, owners,
+         * requesting_set, grant_hi), the grant of resources 0-31 being in
+         * grant and that of resources 32-63 in grant_hi, so both are exact
+         * as Lua numbers.
+         */
         if ((veto = methods->veto)) {
             args[i=0].string  = zone->name;
             args[++i].pointer = sref;
-            args[++i].integer = grant;
+            args[++i].floating = (uint32_t)grant;
             args[++i].pointer = oref;
             args[++i].pointer = rref;
+            args[++i].floating = (uint32_t)(grant >> 32);
 
-            success = mrp_funcarray_call_from_c(L, veto, "sodoo", args);
+            success = mrp_funcarray_call_from_c(L, veto, "sofoof", args);
 
             goto out;
         }
@@ -215,6 +222,179 @@ bool mrp_resource_lua_veto(mrp_zone_t *zone,
     return success;
 }
 
+bool mrp_resource_lua_has_veto(void)
+{
+    lua_State *L = mrp_lua_get_lua_state();
+    mrp_lua_resmethod_t *methods = mrp_lua_get_resource_methods();
+
+    return L && methods && methods->veto;
+}
+
+uint32_t mrp_resource_lua_veto_zone(mrp_zone_t *zone,
+                                    mrp_resource_owner_t *owners,
+                                    mrp_resource_set_t *reqset,
+                                    mrp_resource_set_t **rsets,
+                                    mrp_resource_mask_t *grants,
+                                    bool *vetoed,
+                                    uint32_t nrset)
+{
+    lua_State *L = mrp_lua_get_lua_state();
+    mrp_lua_resmethod_t *methods = mrp_lua_get_resource_methods();
+    mrp_resource_setref_t *sref, *rref;
+    mrp_resource_ownersref_t *oref;
+    uint32_t i, nveto;
+    int top, tbl, hitbl;
+    bool all;
+
+    /*
+     * The zone veto handler is called as
+     *
+     *     veto_zone(zone_name, grants, owners, requesting_set, grants_hi)
+     *
+     * where grants is a table of the candidate grant masks keyed by
+     * resource set. The handler vetoes a grant by setting its entry to
+     * false, or vetoes all of them by returning false. A Lua number can't
+     * hold a 64-bit mask exactly, so grants has the bits of resources
+     * 0-31 and grants_hi those of resources 32-63, like the grant and
+     * grant_hi arguments of the per-set veto handler.
+     */
+
+    if (!L || !zone || !owners || !methods || !methods->veto_zone)
+        return 0;
+
+    if (!(oref = owners_get(L, zone->id)))
+        return 0;
+
+    top = lua_gettop(L);
+    oref->owners = owners;
+    rref = reqset ? find_in_id_table(reqset->id) : NULL;
+
+    lua_createtable(L, 0, nrset);
+    tbl = lua_gettop(L);
+    lua_createtable(L, 0, nrset);
+    hitbl = lua_gettop(L);
+
+    for (i = 0;  i < nrset;  i++) {
+        if ((sref = find_in_id_table(rsets[i]->id))) {
+            mrp_lua_push_object(L, sref);
+            lua_pushnumber(L, (uint32_t)grants[i]);
+            lua_rawset(L, tbl);
+            mrp_lua_push_object(L, sref);
+            lua_pushnumber(L, (uint32_t)(grants[i] >> 32));
+            lua_rawset(L, hitbl);
+        }
+    }
+
+    mrp_lua_push_object(L, methods);
+    lua_pushliteral(L, "veto_zone");
+    lua_rawget(L, -2);
+    lua_remove(L, -2);
+
+    lua_pushstring(L, zone->name);
+    lua_pushvalue(L, tbl);
+    mrp_lua_push_object(L, oref);
+    if (rref)
+        mrp_lua_push_object(L, rref);
+    else
+        lua_pushnil(L);
+    lua_pushvalue(L, hitbl);
+
+    if (lua_pcall(L, 5, 1, 0) != 0) {
+        mrp_log_error("zone veto handler failed: %s", lua_tostring(L, -1));
+        all = true;
+    }
+    else
+        all = lua_isboolean(L, -1) && !lua_toboolean(L, -1);
+
+    for (i = nveto = 0;  i < nrset;  i++) {
+        if (all)
+            vetoed[i] = true;
+        else if ((sref = find_in_id_table(rsets[i]->id))) {
+            mrp_lua_push_object(L, sref);
+            lua_rawget(L, tbl);
+            vetoed[i] = lua_isboolean(L, -1) && !lua_toboolean(L, -1);
+            lua_pop(L, 1);
+        }
+
+        if (vetoed[i])
+            nveto++;
+    }
+
+    lua_settop(L, top);
+
+    return nveto;
+}
+
+bool mrp_resource_lua_has_zone_veto(void)
+{
+    lua_State *L = mrp_lua_get_lua_state();
+    mrp_lua_resmethod_t *methods = mrp_lua_get_resource_methods();
+
+    return L && methods && methods->veto_zone;
+}
+
+/*
+ * Lua garbage collection during arbitration
+ *
+ * All the policy of every zone runs in the single Lua state of the
+ * configuration, so a collection triggered by an allocation in a veto
+ * handler stalls the arbitration of the zone, and with it every request
+ * waiting to be answered. To keep this off the request path, we stop the
+ * collector for the duration of arbitration passes calling into Lua, and
+ * let it catch up with an incremental step from a deferred callback, once
+ * the events of the pass have been delivered.
+ */
+
+static void gc_resume_cb(mrp_deferred_t *d, void *user_data)
+{
+    lua_State *L = mrp_lua_get_lua_state();
+
+    MRP_UNUSED(user_data);
+
+    mrp_disable_deferred(d);
+
+    if (gc_hold || !gc_stopped)
+        return;
+
+    gc_stopped = false;
+
+    if (L != NULL) {
+        lua_gc(L, LUA_GCRESTART, 0);
+        lua_gc(L, LUA_GCSTEP, 0);
+    }
+}
+
+void mrp_resource_lua_hold_gc(void)
+{
+    lua_State *L = mrp_lua_get_lua_state();
+
+    if (L == NULL)
+        return;
+
+    if (gc_hold++ == 0 && !gc_stopped) {
+        lua_gc(L, LUA_GCSTOP, 0);
+        gc_stopped = true;
+    }
+}
+
+void mrp_resource_lua_release_gc(void)
+{
+    mrp_context_t *ctx;
+
+    if (gc_hold <= 0 || --gc_hold > 0 || !gc_stopped)
+        return;
+
+    if (gc_deferred != NULL)
+        mrp_enable_deferred(gc_deferred);
+    else {
+        if ((ctx = mrp_lua_get_murphy_context()) != NULL)
+            gc_deferred = mrp_add_deferred(ctx->ml, gc_resume_cb, NULL);
+
+        if (gc_deferred == NULL)
+            gc_resume_cb(NULL, NULL);
+    }
+}
+
 void mrp_resource_lua_set_owners(mrp_zone_t *zone,mrp_resource_owner_t *owners)
 {
     lua_State *L = mrp_lua_get_lua_state();
@@ -233,7 +413,7 @@ void mrp_resource_lua_register_resource_set(mrp_resource_set_t *rset)
 
     if ((ref = mrp_lua_create_object(L, SETREF_CLASS, NULL,rset->id))) {
         ref->rset = rset;
-        add_to_id_hash(ref);
+        add_to_id_table(ref);
     }
 }
 
@@ -244,7 +424,7 @@ void mrp_resource_lua_unregister_resource_set(mrp_resource_set_t *rset)
 
     MRP_ASSERT(rset, "invalid argument");
 
-    if ((ref = remove_from_id_hash(rset->id))) {
+    if ((ref = remove_from_id_table(rset->id))) {
         MRP_ASSERT(rset == ref->rset, "confused with data structures");
         mrp_lua_destroy_object(L, NULL,rset->id, ref);
         ref->rset = NULL;
@@ -260,7 +440,7 @@ void mrp_resource_lua_add_resource_to_resource_set(mrp_resource_set_t *rset,
 
     MRP_ASSERT(rset && res, "invalid argument");
 
-    ref = find_in_id_hash(rset->id);
+    ref = find_in_id_table(rset->id);
     def = res->def;
 
     if (ref && def) {
@@ -569,7 +749,7 @@ static void setref_destroy(void *data)
     MRP_LUA_ENTER;
 
     if (ref && (rset = ref->rset))
-        remove_from_id_hash(rset->id);
+        remove_from_id_table(rset->id);
 
     MRP_LUA_LEAVE_NOARG;
 }
@@ -580,35 +760,11 @@ static mrp_resource_setref_t *setref_check(lua_State *L, int idx)
 }
 
 
-static uint32_t ref_hash(const void *key)
-{
-    return (uint32_t)(key - NULL);
-}
-
-static int ref_comp(const void *key1, const void *key2)
-{
-    uint32_t k1 = key1 - NULL;
-    uint32_t k2 = key2 - NULL;
-
-    return (k1 == k2) ? 0 : ((k1 > k2) ? 1 : -1);
-}
-
-static void init_id_hash(void)
-{
-    mrp_htbl_config_t cfg;
-
-    cfg.nentry  = 32;
-    cfg.comp    = ref_comp;
-    cfg.hash    = ref_hash;
-    cfg.free    = NULL;
-    cfg.nbucket = cfg.nentry;
-
-    id_hash = mrp_htbl_create(&cfg);
-
-    MRP_ASSERT(id_hash, "failed to make id_hash for resource set refs");
-}
-
-static int add_to_id_hash(mrp_resource_setref_t *ref)
+/*
+ * The references are kept in the id table of the resource sets, see
+ * resource-set.c, so finding one is just an index into the table.
+ */
+static int add_to_id_table(mrp_resource_setref_t *ref)
 {
     mrp_resource_set_t *rset;
 
@@ -618,20 +774,27 @@ static int add_to_id_hash(mrp_resource_setref_t *ref)
 
     MRP_ASSERT(rset, "confused with data structures");
 
-    if (!mrp_htbl_insert(id_hash, NULL + rset->id, ref))
+    if (mrp_resource_set_find_by_id(rset->id) != rset)
         return -1;
 
+    mrp_resource_set_set_lua_ref(rset->id, ref);
+
     return 0;
 }
 
-static mrp_resource_setref_t *remove_from_id_hash(uint32_t id)
+static mrp_resource_setref_t *remove_from_id_table(uint32_t id)
 {
-    return id_hash ? mrp_htbl_remove(id_hash, NULL + id, false) : NULL;
+    mrp_resource_setref_t *ref = mrp_resource_set_get_lua_ref(id);
+
+    if (ref)
+        mrp_resource_set_set_lua_ref(id, NULL);
+
+    return ref;
 }
 
-static mrp_resource_setref_t *find_in_id_hash(uint32_t id)
+static mrp_resource_setref_t *find_in_id_table(uint32_t id)
 {
-    return id_hash ? mrp_htbl_lookup(id_hash, NULL + id) : NULL;
+    return mrp_resource_set_get_lua_ref(id);
 }
 
 
@@ -52,6 +52,16 @@ bool mrp_resource_lua_veto(mrp_zone_t *, mrp_resource_set_t *,
                            mrp_resource_owner_t *, mrp_resource_mask_t,
                            mrp_resource_set_t *);
 void mrp_resource_lua_set_owners(mrp_zone_t *, mrp_resource_owner_t *);
+bool mrp_resource_lua_has_veto(void);
+
+uint32_t mrp_resource_lua_veto_zone(mrp_zone_t *, mrp_resource_owner_t *,
+                                    mrp_resource_set_t *,
+                                    mrp_resource_set_t **,
+                                    mrp_resource_mask_t *, bool *, uint32_t);
+bool mrp_resource_lua_has_zone_veto(void);
+
+void mrp_resource_lua_hold_gc(void);
+void mrp_resource_lua_release_gc(void);
 
 void mrp_resource_lua_register_resource_set(mrp_resource_set_t *);
 void mrp_resource_lua_unregister_resource_set(mrp_resource_set_t *);
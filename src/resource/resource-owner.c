@@ -31,11 +31,17 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <time.h>
 
 #include <murphy/common/mm.h>
 #include <murphy/common/hashtbl.h>
 #include <murphy/common/utils.h>
 #include <murphy/common/log.h>
+#include <murphy/common/trace.h>
+#include <murphy/common/metrics.h>
+#include <murphy/common/profile.h>
+#include <murphy/common/mask.h>
+#include <murphy/common/worker.h>
 
 #include <murphy-db/mqi.h>
 
@@ -48,6 +54,7 @@
 #include "resource.h"
 #include "zone.h"
 #include "resource-lua.h"
+#include "grant-latency.h"
 
 #define NAME_LENGTH          24
 
@@ -65,11 +72,157 @@ typedef struct {
     mrp_attr_value_t  attrs[MQI_COLUMN_MAX];
 } owner_row_t;
 
-static mrp_resource_owner_t  resource_owners[MRP_ZONE_MAX * MRP_RESOURCE_MAX];
-static mqi_handle_t          owner_tables[MRP_RESOURCE_MAX];
+/*
+ * resource contention index
+ *
+ * For every zone we keep track of how many resource sets use each pair
+ * of resources together. Arbitration can only propagate from one resource
+ * to another through a resource set using both of them, so this is enough
+ * to find the closure of resources an acquire or a release can possibly
+ * affect. Resource sets outside this closure do not need to be evaluated.
+ * Each class also counts the sets using each resource in the zone, so
+ * classes without any set in the closure can be skipped altogether.
+ */
+typedef struct {
+    uint32_t            cnt[MRP_RESOURCE_MAX][MRP_RESOURCE_MAX];
+    mrp_resource_mask_t adj[MRP_RESOURCE_MAX];  /* bit j set if cnt[i][j] */
+} contention_t;
+
+/*
+ * arbitration outcome for a resource set during a zone update
+ */
+typedef struct {
+    mrp_resource_set_t  *rset;
+    mrp_resource_mask_t  grant;
+    mrp_resource_mask_t  advice;
+    bool                 force_release;
+    bool                 candidate;    /* granted, subject to the zone veto */
+    bool                 vetoed;       /* grant vetoed by the zone veto */
+} decision_t;
+
+/*
+ * owner change logs
+ *
+ * Owners are modified in place during a zone update. The first time an
+ * owner is modified in an update, its original value is saved in the
+ * commit log of the update, which is then used to find the owners that
+ * need to be updated in the database. While a resource set is being
+ * granted, the owners it touches are also saved in an undo log which is
+ * rolled back if the grant gets refused and dropped if it is accepted.
+ * Both logs only ever hold the owners actually touched by the update.
+ */
+typedef struct {
+    mrp_resource_owner_t *owner;        /* modified owner */
+    mrp_resource_owner_t  saved;        /* its value before modification */
+} owner_log_t;
+
+typedef struct {
+    owner_log_t *entries;               /* log entries */
+    uint32_t     nentry;                /* number of entries */
+} owner_journal_t;
+
+/*
+ * state of a zone update
+ *
+ * A zone update is done in three phases: preparation, arbitration, which
+ * decides the new owners and the outcome for every affected resource set,
+ * and applying the outcome, which updates the resource sets, queues their
+ * events and writes the owner tables. Only arbitration may run outside
+ * the mainloop thread.
+ */
+typedef struct {
+    uint32_t             zoneid;
+    mrp_zone_t          *zone;
+    mrp_resource_set_t  *reqset;           /* requesting set, if any */
+    uint32_t             reqid;            /* id of the request */
+    bool                 batch;            /* update for a request batch */
+    bool                 full;             /* full re-evaluation */
+    mrp_resource_mask_t  affected;         /* resources to re-evaluate */
+    uint32_t             rcnt;             /* number of resources */
+    owner_log_t          commit_entries[MRP_RESOURCE_MAX];
+    owner_journal_t      commit;           /* owners touched by the update */
+    decision_t          *decs;             /* outcomes of the update */
+    uint32_t             ndec;
+    uint32_t             maxdec;
+    bool                 set_owners;       /* Lua owners need to be reset */
+    uint64_t             started;          /* timings for grant latency */
+    uint64_t             policy;
+    uint64_t             manager;
+    uint64_t             db;
+} arbitration_t;
+
+/*
+ * owners of a zone
+ *
+ * Besides the owners themselves we keep track of the attribute stamp of
+ * every owning resource as it was last written to the owner tables, so
+ * that rows are only rewritten when the owner or its attributes actually
+ * change. The generation is bumped whenever any row of the zone changes.
+ */
+/*
+ * owner watches
+ *
+ * Watches are kept on a per-zone list and notified from apply_zone with
+ * the owner changes of the update. Watches removed while notifications
+ * are being delivered are only marked dead and get freed afterwards.
+ */
+struct mrp_resource_owner_watch_s {
+    mrp_list_hook_t                hook;     /* to zone watch list */
+    uint32_t                       zoneid;   /* watched zone */
+    uint32_t                       resid;    /* watched resource */
+    mrp_resource_owner_watch_cb_t  cb;       /* notification callback */
+    void                          *user_data;/* opaque callback data */
+    bool                           dead;     /* removed while notifying */
+};
+
+typedef struct {
+    mrp_resource_owner_t owners[MRP_RESOURCE_MAX]; /* current owners */
+    uint32_t             stamps[MRP_RESOURCE_MAX]; /* stamps in the tables */
+    uint32_t             generation;               /* owner generation */
+} zone_owners_t;
 
+/*
+ * Owner and contention tables are allocated per zone the first time the
+ * zone is touched, so only the zones actually in use take up memory.
+ */
+static zone_owners_t        *zone_owners[MRP_ZONE_MAX];
+static mqi_handle_t          owner_tables[MRP_RESOURCE_MAX];
+static mqi_column_desc_t    *owner_attr_cdsc[MRP_RESOURCE_MAX];
+static contention_t         *contention[MRP_ZONE_MAX];
+static uint32_t              owner_version;
+static mrp_metric_t         *arbitrations;
+static mrp_metric_t         *arbitration_usecs;
+static mrp_metric_t         *grant_changes;
+static mrp_metric_t         *early_denials;
+static mrp_worker_pool_t    *arbiters;
+static mrp_list_hook_t       owner_watches[MRP_ZONE_MAX];
+static int                   notifying;
+static int                   ndead_watch;
+
+static zone_owners_t *get_zone_owners(uint32_t);
 static mrp_resource_owner_t *get_owner(uint32_t, uint32_t);
-static void reset_owners(uint32_t, mrp_resource_owner_t *);
+static contention_t *get_contention(uint32_t);
+static void save_owner(owner_journal_t *, mrp_resource_owner_t *);
+static void reset_owners(uint32_t, owner_journal_t *, uint32_t,
+                         mrp_resource_mask_t);
+static bool prepare_zone(arbitration_t *, uint32_t, mrp_resource_set_t *,
+                         uint32_t, mrp_resource_mask_t, bool);
+static void arbitrate_zone(arbitration_t *, bool, bool);
+static void apply_zone(arbitration_t *);
+static void update_zone(uint32_t, mrp_resource_set_t *, uint32_t,
+                        mrp_resource_mask_t, bool);
+static bool parallel_arbitration(void);
+static bool veto_zone(mrp_zone_t *, mrp_resource_set_t *, decision_t *,
+                      uint32_t);
+static bool need_full_update(bool);
+static bool cannot_win(uint32_t, mrp_resource_set_t *);
+static void deny_request(mrp_resource_set_t *, uint32_t, uint64_t);
+static mrp_resource_mask_t contention_closure(uint32_t, mrp_resource_mask_t);
+static void init_metrics(void);
+static void notify_owner_watches(uint32_t, mrp_resource_change_t *, int);
+static uint64_t usecs_now(void);
+static void stamp_arbitration(mrp_resource_set_t *, uint64_t, uint64_t,
+                              uint64_t, uint64_t);
 static bool grant_ownership(mrp_resource_owner_t *, mrp_zone_t *,
                             mrp_application_class_t *, mrp_resource_set_t *,
                             mrp_resource_t *);
@@ -79,12 +232,14 @@ static bool advice_ownership(mrp_resource_owner_t *, mrp_zone_t *,
 
 static void manager_start_transaction(mrp_zone_t *);
 static void manager_end_transaction(mrp_zone_t *);
+static void manager_apply_changes(mrp_zone_t *, mrp_resource_change_t *, int);
 
 static void delete_resource_owner(mrp_zone_t *, mrp_resource_t *);
 static void insert_resource_owner(mrp_zone_t *, mrp_application_class_t *,
                                   mrp_resource_set_t *, mrp_resource_t *);
 static void update_resource_owner(mrp_zone_t *, mrp_application_class_t *,
                                   mrp_resource_set_t *, mrp_resource_t *);
+static mqi_column_desc_t *create_attr_descriptors(mrp_resource_def_t *);
 static void set_attr_descriptors(mqi_column_desc_t *, mrp_resource_t *);
 
 
@@ -110,6 +265,7 @@ int mrp_resource_owner_create_database_table(mrp_resource_def_t *rdef)
     mqi_handle_t table;
     char c, *p;
     size_t i,j;
+    int prof;
 
     if (!initialized) {
         mqi_open();
@@ -145,7 +301,11 @@ int mrp_resource_owner_create_database_table(mrp_resource_def_t *rdef)
 
     memset(coldefs + j, 0, sizeof(mqi_column_def_t));
 
+    owner_attr_cdsc[rdef->id] = create_attr_descriptors(rdef);
+
+    prof  = mrp_profile_begin("create table %s", name);
     table = MQI_CREATE_TABLE(name, MQI_TEMPORARY, coldefs, indexdef);
+    mrp_profile_end(prof);
 
     if (table == MQI_HANDLE_INVALID) {
         mrp_log_error("Can't create table '%s': %s", name, strerror(errno));
@@ -162,333 +322,1201 @@ void mrp_resource_owner_recalc(uint32_t zoneid)
     mrp_resource_owner_update_zone(zoneid, NULL, 0);
 }
 
+int mrp_resource_owner_set_arbiters(mrp_mainloop_t *ml, int nthread)
+{
+    mrp_worker_pool_destroy(arbiters);
+    arbiters = NULL;
+
+    if (nthread == 0)
+        return 0;
+
+    if (!(arbiters = mrp_worker_pool_create(ml, nthread < 0 ? 0 : nthread)))
+        return -1;
+
+    return 0;
+}
+
+static int arbitrate_job(void *user_data)
+{
+    arbitration_t *a = (arbitration_t *)user_data;
+
+    arbitrate_zone(a, false, false);
+
+    return 0;
+}
+
+void mrp_resource_owner_recalc_all(void)
+{
+    uint32_t zcnt = mrp_zone_count();
+    arbitration_t *arbs, *a;
+    uint64_t start, policy;
+    uint32_t zid;
+
+    if (!arbiters || zcnt < 2 || !parallel_arbitration()) {
+        for (zid = 0;  zid < zcnt;  zid++)
+            mrp_resource_owner_recalc(zid);
+        return;
+    }
+
+    if (!(arbs = mrp_allocz_array(arbitration_t, zcnt))) {
+        for (zid = 0;  zid < zcnt;  zid++)
+            mrp_resource_owner_recalc(zid);
+        return;
+    }
+
+    /*
+     * Without Lua veto handlers and resource managers zones are fully
+     * independent, so arbitrate them in parallel on the worker threads.
+     * Everything else, including all notifications, happens here in the
+     * mainloop thread, zone by zone like for a serial recalculation, and
+     * the queued events of all zones are delivered in one go at the end.
+     */
+
+    init_metrics();
+    start = usecs_now();
+
+    mrp_trace_begin("recalc-all", zcnt);
+
+    if (++owner_version == 0)
+        owner_version = 1;
+
+    for (zid = 0;  zid < zcnt;  zid++) {
+        a = arbs + zid;
+
+        if (!prepare_zone(a, zid, NULL, 0, 0, false))
+            continue;
+
+        a->started = start;
+        reset_owners(zid, &a->commit, a->rcnt, a->affected);
+
+        /* zones are independent, so we can do it here if we must */
+        if (!mrp_worker_submit(arbiters, arbitrate_job, NULL, a))
+            arbitrate_job(a);
+    }
+
+    if (mrp_worker_pool_wait(arbiters) < 0)
+        MRP_ASSERT(false, "failed to wait for zone arbitration");
+
+    policy = usecs_now() - start;
+
+    for (zid = 0;  zid < zcnt;  zid++) {
+        a = arbs + zid;
+
+        if (!a->zone)
+            continue;
+
+        a->policy = policy;
+        apply_zone(a);
+
+        mrp_metric_inc(arbitrations);
+    }
+
+    mrp_free(arbs);
+
+    mrp_resource_set_deliver_events();
+
+    mrp_trace_end("recalc-all", zcnt);
+
+    mrp_metric_observe(arbitration_usecs, usecs_now() - start);
+}
+
+static void update_class_usage(uint32_t zoneid,
+                               mrp_application_class_t *class,
+                               mrp_resource_mask_t mask, int delta)
+{
+    uint32_t *usage;
+    mrp_resource_mask_t bits;
+    uint32_t i;
+
+    if (!(usage = class->usage[zoneid])) {
+        usage = mrp_allocz(sizeof(uint32_t) * MRP_RESOURCE_MAX);
+
+        MRP_ASSERT(usage, "Memory alloc failure. Can't create class usage");
+
+        class->usage[zoneid] = usage;
+    }
+
+    for (bits = mask;  bits;  bits &= bits - 1) {
+        i = mrp_ffsll(bits) - 1;
+
+        if ((usage[i] += delta) > 0)
+            class->resources[zoneid] |=  ((mrp_resource_mask_t)1 << i);
+        else
+            class->resources[zoneid] &= ~((mrp_resource_mask_t)1 << i);
+    }
+}
+
+static void update_contention(uint32_t zoneid, mrp_application_class_t *class,
+                              mrp_resource_mask_t mask, int delta)
+{
+    contention_t *c;
+    mrp_resource_mask_t rows, cols;
+    uint32_t i, j;
+
+    MRP_ASSERT(zoneid < MRP_ZONE_MAX, "invalid argument");
+
+    if (class)
+        update_class_usage(zoneid, class, mask, delta);
+
+    c = get_contention(zoneid);
+
+    for (rows = mask;  rows;  rows &= rows - 1) {
+        i = mrp_ffsll(rows) - 1;
+
+        for (cols = mask;  cols;  cols &= cols - 1) {
+            j = mrp_ffsll(cols) - 1;
+
+            if ((c->cnt[i][j] += delta) > 0)
+                c->adj[i] |=  ((mrp_resource_mask_t)1 << j);
+            else
+                c->adj[i] &= ~((mrp_resource_mask_t)1 << j);
+        }
+    }
+}
+
+void mrp_resource_owner_add_contention(uint32_t zoneid,
+                                       mrp_application_class_t *class,
+                                       mrp_resource_mask_t mask)
+{
+    update_contention(zoneid, class, mask, 1);
+}
+
+void mrp_resource_owner_remove_contention(uint32_t zoneid,
+                                          mrp_application_class_t *class,
+                                          mrp_resource_mask_t mask)
+{
+    update_contention(zoneid, class, mask, -1);
+}
+
 void mrp_resource_owner_update_zone(uint32_t zoneid,
                                     mrp_resource_set_t *reqset,
                                     uint32_t reqid)
 {
-    typedef struct {
-        uint32_t replyid;
-        mrp_resource_set_t *rset;
-        bool move;
-    } event_t;
+    mrp_resource_mask_t reqmask = reqset ? reqset->resource.mask.all : 0;
+    uint64_t start;
+
+    init_metrics();
+    start = usecs_now();
+
+    if (reqset && cannot_win(zoneid, reqset)) {
+        mrp_debug("resource set #%u can't be granted in zone %u, denied "
+                  "without arbitration", reqset->id, zoneid);
+        deny_request(reqset, reqid, start);
+        mrp_metric_inc(early_denials);
+        return;
+    }
+
+    mrp_trace_begin("update-zone", zoneid, reqid, reqmask);
+    update_zone(zoneid, reqset, reqid, reqmask, false);
+    mrp_trace_end("update-zone", zoneid);
+
+    mrp_metric_inc(arbitrations);
+    mrp_metric_observe(arbitration_usecs, usecs_now() - start);
+}
 
-    mrp_resource_owner_t oldowners[MRP_RESOURCE_MAX];
-    mrp_resource_owner_t backup[MRP_RESOURCE_MAX];
+void mrp_resource_owner_update_zone_batch(uint32_t zoneid,
+                                          mrp_resource_mask_t reqmask)
+{
+    uint64_t start;
+
+    init_metrics();
+    start = usecs_now();
+
+    mrp_trace_begin("update-zone-batch", zoneid, reqmask);
+    update_zone(zoneid, NULL, 0, reqmask, true);
+    mrp_trace_end("update-zone-batch", zoneid);
+
+    mrp_metric_inc(arbitrations);
+    mrp_metric_observe(arbitration_usecs, usecs_now() - start);
+}
+
+static bool prepare_zone(arbitration_t *a, uint32_t zoneid,
+                         mrp_resource_set_t *reqset, uint32_t reqid,
+                         mrp_resource_mask_t reqmask, bool batch)
+{
     mrp_zone_t *zone;
+
+    MRP_ASSERT(zoneid < MRP_ZONE_MAX, "invalid argument");
+
+    memset(a, 0, sizeof(*a));
+
+    zone = mrp_zone_find_by_id(zoneid);
+
+    MRP_ASSERT(zone, "zone is not defined");
+
+    if (!mrp_get_resource_set_count())
+        return false;
+
+    a->zone   = zone;
+    a->zoneid = zoneid;
+    a->reqset = reqset;
+    a->reqid  = reqid;
+    a->batch  = batch;
+    a->rcnt   = mrp_resource_definition_count();
+    a->commit.entries = a->commit_entries;
+
+    /*
+     * Unless we need to do a full recalculation, we only re-evaluate the
+     * requesting resource set(s) and all the resource sets contending
+     * (even indirectly) for any of their resources. The ownership of all
+     * other resources in the zone stays intact.
+     */
+    if ((a->full = need_full_update(!reqset && !batch)))
+        a->affected = ~(mrp_resource_mask_t)0;
+    else
+        a->affected = contention_closure(zoneid, reqmask);
+
+    mrp_debug("%s update of zone %u (affected resources 0x%llx)",
+              a->full ? "full" : "incremental", zoneid,
+              (unsigned long long)a->affected);
+
+    return true;
+}
+
+static void arbitrate_zone(arbitration_t *a, bool set_veto, bool zone_veto)
+{
+    owner_log_t undo_entries[MRP_RESOURCE_MAX];
+    owner_journal_t undo = { undo_entries, 0 };
+    owner_log_t *log;
+    mrp_zone_t *zone = a->zone;
+    uint32_t zoneid = a->zoneid;
     mrp_application_class_t *class;
     mrp_resource_set_t *rset;
     mrp_resource_t *res;
     mrp_resource_def_t *rdef;
     mrp_resource_mgr_ftbl_t *ftbl;
-    mrp_resource_owner_t *owner, *old, *owners;
+    mrp_resource_owner_t *owner, *owners;
     mrp_resource_mask_t mask;
     mrp_resource_mask_t mandatory;
     mrp_resource_mask_t grant;
     mrp_resource_mask_t advice;
+    mrp_resource_mask_t logged;
+    decision_t *dec;
     void *clc, *rsc, *rc;
     uint32_t rid;
-    uint32_t rcnt;
+    bool force_release;
+    bool accept;
+
+    /*
+     * Arbitrate the zone, recording the outcome for each resource set.
+     * Apart from the Lua veto handlers and the resource managers, which
+     * are only called when arbitrating on the mainloop, this only touches
+     * the owners of the zone, so different zones can be arbitrated in
+     * parallel.
+     */
+    a->ndec = 0;
+    clc     = NULL;
+
+    while ((class = mrp_application_class_iterate_classes(&clc))) {
+        /* none of the sets of the class can be affected by this update */
+        if (!a->full && !a->batch &&
+            !(class->resources[zoneid] & a->affected) &&
+            (!a->reqset || a->reqset->class.ptr != class))
+            continue;
+
+        rsc = NULL;
+
+        while ((rset=mrp_application_class_iterate_rsets(class,zoneid,&rsc))) {
+            if (!a->full && rset != a->reqset && !rset->request.batched &&
+                !(rset->resource.mask.all & a->affected))
+                continue;
+
+            if (a->ndec >= a->maxdec) {
+                a->maxdec = a->maxdec ? 2 * a->maxdec : 16;
+                a->decs   = mrp_realloc(a->decs, sizeof(decision_t)*a->maxdec);
+
+                MRP_ASSERT(a->decs, "Memory alloc failure. Can't update zone");
+
+                memset(a->decs + a->ndec, 0,
+                       sizeof(decision_t) * (a->maxdec - a->ndec));
+            }
+
+            dec = a->decs + a->ndec++;
+            dec->rset = rset;
+            dec->candidate = false;
+
+            force_release = false;
+            mandatory = rset->resource.mask.mandatory;
+            grant = 0;
+            advice = 0;
+            rc = NULL;
+
+            switch (rset->state) {
+
+            case mrp_resource_acquire:
+                undo.nentry = 0;
+                logged = 0;
+
+                while ((res = mrp_resource_set_iterate_resources(rset, &rc))) {
+                    rdef  = res->def;
+                    rid   = rdef->id;
+                    mask  = (mrp_resource_mask_t)1 << rid;
+                    owner = get_owner(zoneid, rid);
+
+                    if (!(logged & mask)) {
+                        save_owner(&a->commit, owner);
+                        undo.entries[undo.nentry].owner = owner;
+                        undo.entries[undo.nentry].saved = *owner;
+                        undo.nentry++;
+                        logged |= mask;
+                    }
+
+                    if (grant_ownership(owner, zone, class, rset, res))
+                        grant |= ((mrp_resource_mask_t)1 << rid);
+                    else {
+                        if (owner->rset != rset)
+                            force_release |= owner->modal;
+                    }
+                }
+                owners = get_owner(zoneid, 0);
+
+                if ((grant & mandatory) != mandatory)
+                    accept = false;
+                else {
+                    accept = !set_veto ||
+                        mrp_resource_lua_veto(zone, rset, owners, grant,
+                                              a->reqset);
+
+                    if (accept && zone_veto)
+                        accept = dec->candidate = !dec->vetoed;
+                }
+
+                if (accept)
+                    advice = grant;
+                else {
+                    /* rollback, ie. restore the logged state */
+                    while (undo.nentry > 0) {
+                        log = undo.entries + --undo.nentry;
+                        *log->owner = log->saved;
+                    }
+
+                    rc = NULL;
+                    while ((res=mrp_resource_set_iterate_resources(rset,&rc))){
+                        rdef = res->def;
+                        rid = rdef->id;
+                        mask = (mrp_resource_mask_t)1 << rid;
+                        owner = get_owner(zoneid, rid);
+
+                        if ((grant & mask)) {
+                            if ((ftbl = rdef->manager.ftbl) && ftbl->free)
+                                ftbl->free(zone, res, rdef->manager.userdata);
+                        }
+
+                        if (advice_ownership(owner, zone, class, rset, res))
+                            advice |= mask;
+                    }
+
+                    grant = 0;
+
+                    if ((advice & mandatory) != mandatory)
+                        advice = 0;
+
+                    a->set_owners = true;
+                }
+                break;
+
+            case mrp_resource_release:
+                while ((res = mrp_resource_set_iterate_resources(rset, &rc))) {
+                    rdef  = res->def;
+                    rid   = rdef->id;
+                    owner = get_owner(zoneid, rid);
+
+                    if (advice_ownership(owner, zone, class, rset, res))
+                        advice |= ((mrp_resource_mask_t)1 << rid);
+                }
+                if ((advice & mandatory) != mandatory)
+                    advice = 0;
+                break;
+
+            default:
+                break;
+            }
+
+            dec->grant = grant;
+            dec->advice = advice;
+            dec->force_release = force_release;
+        } /* while rset */
+    } /* while class */
+}
+
+static void apply_zone(arbitration_t *a)
+{
+    typedef struct {
+        uint32_t replyid;
+        mrp_resource_set_t *rset;
+        bool move;
+    } event_t;
+
+    mrp_resource_change_t changes[MRP_RESOURCE_MAX];
+    mrp_resource_change_t *chg;
+    int nchange;
+    owner_log_t *log, *lastlog;
+    zone_owners_t *zo;
+    mrp_zone_t *zone = a->zone;
+    mrp_resource_set_t *rset;
+    mrp_resource_owner_t *owner, *old;
+    mrp_resource_mask_t grant;
+    mrp_resource_mask_t advice;
+    uint32_t rid;
     bool force_release;
     bool changed;
     bool move;
+    bool written;
     mrp_resource_event_t notify;
     uint32_t replyid;
     uint32_t nevent, maxev;
     event_t *events, *ev, *lastev;
+    decision_t *dec, *lastdec;
+    uint64_t stamp;
 
-    MRP_ASSERT(zoneid < MRP_ZONE_MAX, "invalid argument");
+    if (a->set_owners)
+        mrp_resource_lua_set_owners(zone, get_owner(a->zoneid, 0));
 
-    zone = mrp_zone_find_by_id(zoneid);
+    nevent = 0;
+    maxev  = 0;
+    events = NULL;
+
+    /*
+     * Update the resource sets according to the outcome.
+     */
+    for (lastdec = (dec = a->decs) + a->ndec;     dec < lastdec;     dec++) {
+        rset = dec->rset;
+        grant = dec->grant;
+        advice = dec->advice;
+        force_release = dec->force_release;
+
+        changed = false;
+        move    = false;
+        notify  = 0;
+        replyid = (a->reqset == rset && a->reqid == rset->request.id) ?
+            a->reqid : 0;
+
+        if (a->batch && rset->request.batched) {
+            replyid = rset->request.id;
+            rset->request.batched = false;
+        }
+
+
+        if (force_release) {
+            move = (rset->state != mrp_resource_release);
+            notify = move ? MRP_RESOURCE_EVENT_RELEASE : 0;
+            changed = move || rset->resource.mask.grant;
+            rset->state = mrp_resource_release;
+
+            if (rset->resource.mask.grant)
+                mrp_metric_inc(grant_changes);
+
+            rset->resource.mask.grant = 0;
+        }
+        else {
+            if (grant == rset->resource.mask.grant) {
+                if (rset->state == mrp_resource_acquire &&
+                    !grant && rset->dont_wait.current)
+                {
+                    rset->state = mrp_resource_release;
+                    rset->dont_wait.current = rset->dont_wait.client;
+
+                    notify = MRP_RESOURCE_EVENT_RELEASE;
+                    move = true;
+                }
+            }
+            else {
+                rset->resource.mask.grant = grant;
+                changed = true;
+
+                mrp_metric_inc(grant_changes);
+
+                if (rset->state != mrp_resource_release &&
+                    !grant && rset->auto_release.current)
+                {
+                    rset->state = mrp_resource_release;
+                    rset->auto_release.current = rset->auto_release.client;
+
+                    notify = MRP_RESOURCE_EVENT_RELEASE;
+                    move = true;
+                }
+            }
+        }
+
+        if (notify) {
+            mrp_resource_set_notify(rset, notify);
+        }
+
+        if (advice != rset->resource.mask.advice) {
+            rset->resource.mask.advice = advice;
+            changed = true;
+        }
+
+        if (replyid || changed) {
+            if (nevent >= maxev) {
+                maxev  = maxev ? 2 * maxev : 16;
+                events = mrp_realloc(events, sizeof(event_t) * maxev);
+
+                MRP_ASSERT(events, "Memory alloc failure. "
+                           "Can't update zone");
+            }
+
+            ev = events + nevent++;
+
+            ev->replyid = replyid;
+            ev->rset    = rset;
+            ev->move    = move;
+        }
+    }
+
+    mrp_free(a->decs);
+    a->decs = NULL;
+
+    for (lastev = (ev = events) + nevent;     ev < lastev;     ev++) {
+        rset = ev->rset;
+
+        if (ev->move)
+            mrp_application_class_move_resource_set(rset);
+
+        mrp_resource_set_updated(rset);
+        mrp_resource_set_queue_event(rset, ev->replyid);
+    }
+
+    stamp   = usecs_now();
+    zo      = get_zone_owners(a->zoneid);
+    written = false;
+    nchange = 0;
+
+    for (lastlog = (log = a->commit.entries) + a->commit.nentry;
+         log < lastlog;
+         log++)
+    {
+        owner = log->owner;
+        old   = &log->saved;
+        rid   = owner - zo->owners;
+
+        if (owner->class != old->class ||
+            owner->rset  != old->rset  ||
+            owner->res   != old->res     )
+        {
+            if (!owner->res)
+               delete_resource_owner(zone,old->res);
+            else if (!old->res)
+               insert_resource_owner(zone,owner->class,owner->rset,owner->res);
+            else
+               update_resource_owner(zone,owner->class,owner->rset,owner->res);
+        }
+        else if (owner->res && owner->res->stamp != zo->stamps[rid])
+            update_resource_owner(zone,owner->class,owner->rset,owner->res);
+        else
+            continue;
+
+        zo->stamps[rid] = owner->res ? owner->res->stamp : 0;
+        written = true;
+
+        chg = changes + nchange++;
+        chg->resid     = rid;
+        chg->old.class = old->class;
+        chg->old.rset  = old->rset;
+        chg->old.res   = old->res;
+        chg->new.class = owner->class;
+        chg->new.rset  = owner->rset;
+        chg->new.res   = owner->res;
+    }
+
+    if (written)
+        zo->generation++;
+
+    if (nchange > 0) {
+        manager_apply_changes(zone, changes, nchange);
+        notify_owner_watches(a->zoneid, changes, nchange);
+    }
+
+    a->db = usecs_now() - stamp;
+
+    for (lastev = (ev = events) + nevent;     ev < lastev;     ev++) {
+        if (ev->replyid)
+            stamp_arbitration(ev->rset, a->started, a->policy, a->manager,
+                              a->db);
+    }
+
+    mrp_free(events);
+}
+
+static void update_zone(uint32_t zoneid,
+                        mrp_resource_set_t *reqset,
+                        uint32_t reqid,
+                        mrp_resource_mask_t reqmask,
+                        bool batch)
+{
+    arbitration_t arb, *a = &arb;
+    uint64_t stamp, now;
+    bool set_veto;
+    bool zone_veto;
+
+    if (!prepare_zone(a, zoneid, reqset, reqid, reqmask, batch))
+        return;
+
+    if (++owner_version == 0)
+        owner_version = 1;
+
+    /*
+     * Time the policy, manager and database phases of the arbitration, to
+     * be attributed to the requests answered by it (cf. grant-latency.c).
+     */
+    a->started = usecs_now();
+
+    reset_owners(zoneid, &a->commit, a->rcnt, a->affected);
+    manager_start_transaction(a->zone);
+
+    stamp       = usecs_now();
+    a->manager += stamp - a->started;
+
+    set_veto = mrp_resource_lua_has_veto();
+    zone_veto = mrp_resource_lua_has_zone_veto();
+
+    if (set_veto || zone_veto)
+        mrp_resource_lua_hold_gc();
+
+    /*
+     * With a zone veto handler, instead of asking Lua about every grant
+     * separately, we ask about all the grants of the zone with a single
+     * call once arbitration is done. If any grant gets vetoed we
+     * arbitrate again, this time treating the vetoed sets as rejected,
+     * which lets others claim the resources they would have gotten. This
+     * repeats until no more grants are vetoed, which in practice is once.
+     */
+ arbitrate:
+    arbitrate_zone(a, set_veto, zone_veto);
+
+    if (a->set_owners) {
+        mrp_resource_lua_set_owners(a->zone, get_owner(zoneid, 0));
+        a->set_owners = false;
+    }
+
+    if (zone_veto && veto_zone(a->zone, reqset, a->decs, a->ndec)) {
+        reset_owners(zoneid, &a->commit, a->rcnt, a->affected);
+
+        now        = usecs_now();
+        a->policy += now - stamp;
+
+        manager_start_transaction(a->zone);
+
+        stamp       = usecs_now();
+        a->manager += stamp - now;
+
+        goto arbitrate;
+    }
+
+    now        = usecs_now();
+    a->policy += now - stamp;
+
+    manager_end_transaction(a->zone);
+
+    stamp       = usecs_now();
+    a->manager += stamp - now;
+
+    apply_zone(a);
+
+    mrp_resource_set_deliver_events();
+
+    if (set_veto || zone_veto)
+        mrp_resource_lua_release_gc();
+}
+
+int mrp_resource_owner_print(char *buf, int len)
+{
+    uint32_t zcnt, zid;
+    char *p, *e;
+
+    if (len <= 0)
+        return 0;
+
+    MRP_ASSERT(buf, "invalid argument");
+
+    zcnt = mrp_zone_count();
+
+    e = (p = buf) + len;
+
+    p += snprintf(p, e-p, "Resource owners:\n");
+
+    for (zid = 0;  zid < zcnt;  zid++) {
+        if (p < e)
+            p += mrp_resource_owner_print_zone(zid, p, e-p);
+    }
+
+    return p - buf;
+}
+
+
+int mrp_resource_owner_print_zone(uint32_t zid, char *buf, int len)
+{
+#define PRINT(fmt, args...)  if (p<e) { p += snprintf(p, e-p, fmt , ##args); }
+
+    mrp_zone_t *zone;
+    mrp_resource_owner_t *owner;
+    mrp_application_class_t *class;
+    mrp_resource_set_t *rset;
+    mrp_resource_t *res;
+    mrp_resource_def_t *rdef;
+    uint32_t rcnt, rid;
+    char *p, *e;
+
+    if (len <= 0 || zid >= mrp_zone_count())
+        return 0;
+
+    MRP_ASSERT(buf, "invalid argument");
+
+    rcnt = mrp_resource_definition_count();
+
+    e = (p = buf) + len;
+
+    zone = mrp_zone_find_by_id(zid);
+
+    if (!zone) {
+        PRINT("   Zone %u:\n", zid);
+    }
+    else {
+        PRINT("   Zone %s:", zone->name);
+        p += mrp_zone_attribute_print(zone, p, e-p);
+        PRINT("\n");
+    }
+
+    for (rid = 0;   rid < rcnt;   rid++) {
+        if (!(rdef = mrp_resource_definition_find_by_id(rid)))
+            continue;
+
+        PRINT("      %-15s: ", rdef->name);
+
+        owner = get_owner(zid, rid);
+
+        if (!(class = owner->class) ||
+            !(rset  = owner->rset ) ||
+            !(res   = owner->res  )    )
+        {
+            PRINT("<nobody>");
+        }
+        else {
+            MRP_ASSERT(rdef == res->def, "confused with data structures");
+
+            PRINT("%-15s", class->name);
+
+            p += mrp_resource_attribute_print(res, p, e-p);
+        }
+
+        PRINT("\n");
+    }
+
+    return p - buf;
+
+#undef PRINT
+}
+
+
+static zone_owners_t *get_zone_owners(uint32_t zone)
+{
+    zone_owners_t *zo;
+
+    MRP_ASSERT(zone < MRP_ZONE_MAX, "invalid argument");
+
+    if (!(zo = zone_owners[zone])) {
+        zo = mrp_allocz(sizeof(zone_owners_t));
+
+        MRP_ASSERT(zo, "Memory alloc failure. Can't create owner table");
+
+        zone_owners[zone] = zo;
+    }
+
+    return zo;
+}
+
+static mrp_resource_owner_t *get_owner(uint32_t zone, uint32_t resid)
+{
+    MRP_ASSERT(resid < MRP_RESOURCE_MAX, "invalid argument");
+
+    return get_zone_owners(zone)->owners + resid;
+}
+
+/*
+ * Rewrite the owner row of a resource after only its informational
+ * attributes have changed. These do not affect arbitration, so there is
+ * no need to recalculate the zone.
+ */
+void mrp_resource_owner_update_attributes(uint32_t zoneid, mrp_resource_t *res)
+{
+    zone_owners_t        *zo;
+    mrp_resource_owner_t *owner;
+    mrp_zone_t           *zone;
+
+    MRP_ASSERT(res, "invalid argument");
+
+    if (zoneid >= MRP_ZONE_MAX || !(zo = zone_owners[zoneid]))
+        return;
+
+    owner = zo->owners + res->def->id;
+
+    if (owner->res != res || !(zone = mrp_zone_find_by_id(zoneid)))
+        return;
+
+    update_resource_owner(zone, owner->class, owner->rset, res);
+    zo->generation++;
+}
+
+mrp_resource_owner_watch_t *
+mrp_resource_owner_watch(uint32_t zoneid, uint32_t resid,
+                         mrp_resource_owner_watch_cb_t cb, void *user_data)
+{
+    mrp_resource_owner_watch_t *w;
+    mrp_list_hook_t *watches;
+
+    if (zoneid >= MRP_ZONE_MAX || resid >= MRP_RESOURCE_MAX || !cb) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (!(w = mrp_allocz(sizeof(*w))))
+        return NULL;
+
+    watches = owner_watches + zoneid;
+
+    if (!watches->next)
+        mrp_list_init(watches);
+
+    mrp_list_init(&w->hook);
+    w->zoneid    = zoneid;
+    w->resid     = resid;
+    w->cb        = cb;
+    w->user_data = user_data;
+
+    mrp_list_append(watches, &w->hook);
 
-    MRP_ASSERT(zone, "zone is not defined");
+    return w;
+}
 
-    if (!(maxev = mrp_get_resource_set_count()))
+void mrp_resource_owner_unwatch(mrp_resource_owner_watch_t *w)
+{
+    if (!w || w->dead)
         return;
 
-    nevent = 0;
-    events = mrp_alloc(sizeof(event_t) * maxev);
-
-    MRP_ASSERT(events, "Memory alloc failure. Can't update zone");
+    if (notifying) {
+        w->dead = true;
+        ndead_watch++;
+        return;
+    }
 
-    reset_owners(zoneid, oldowners);
-    manager_start_transaction(zone);
+    mrp_list_delete(&w->hook);
+    mrp_free(w);
+}
 
-    rcnt = mrp_resource_definition_count();
-    clc  = NULL;
+mrp_resource_set_t *mrp_resource_owner_get_set(uint32_t zoneid, uint32_t resid)
+{
+    zone_owners_t *zo;
 
-    while ((class = mrp_application_class_iterate_classes(&clc))) {
-        rsc = NULL;
+    if (zoneid >= MRP_ZONE_MAX || resid >= MRP_RESOURCE_MAX ||
+        !(zo = zone_owners[zoneid]))
+        return NULL;
 
-        while ((rset=mrp_application_class_iterate_rsets(class,zoneid,&rsc))) {
-            force_release = false;
-            mandatory = rset->resource.mask.mandatory;
-            grant = 0;
-            advice = 0;
-            rc = NULL;
+    return zo->owners[resid].rset;
+}
 
-            switch (rset->state) {
+static void notify_owner_watches(uint32_t zoneid,
+                                 mrp_resource_change_t *changes, int nchange)
+{
+    mrp_list_hook_t *watches = owner_watches + zoneid;
+    mrp_list_hook_t *p, *n;
+    mrp_resource_owner_watch_t *w;
+    mrp_resource_change_t *chg;
+    int i;
 
-            case mrp_resource_acquire:
-                while ((res = mrp_resource_set_iterate_resources(rset, &rc))) {
-                    rdef  = res->def;
-                    rid   = rdef->id;
-                    owner = get_owner(zoneid, rid);
+    if (!watches->next || mrp_list_empty(watches))
+        return;
 
-                    backup[rid] = *owner;
+    notifying++;
 
-                    if (grant_ownership(owner, zone, class, rset, res))
-                        grant |= ((mrp_resource_mask_t)1 << rid);
-                    else {
-                        if (owner->rset != rset)
-                            force_release |= owner->modal;
-                    }
-                }
-                owners = get_owner(zoneid, 0);
-                if ((grant & mandatory) == mandatory &&
-                    mrp_resource_lua_veto(zone, rset, owners, grant, reqset))
-                {
-                    advice = grant;
-                }
-                else {
-                    /* rollback, ie. restore the backed up state */
-                    rc = NULL;
-                    while ((res=mrp_resource_set_iterate_resources(rset,&rc))){
-                        rdef = res->def;
-                        rid = rdef->id;
-                        mask = (mrp_resource_mask_t)1 << rid;
-                        owner = get_owner(zoneid, rid);
-                        *owner = backup[rid];
+    for (i = 0;  i < nchange;  i++) {
+        chg = changes + i;
 
-                        if ((grant & mask)) {
-                            if ((ftbl = rdef->manager.ftbl) && ftbl->free)
-                                ftbl->free(zone, res, rdef->manager.userdata);
-                        }
+        if (chg->old.rset == chg->new.rset && chg->old.res == chg->new.res)
+            continue;
 
-                        if (advice_ownership(owner, zone, class, rset, res))
-                            advice |= mask;
-                    }
+        mrp_list_foreach(watches, p, n) {
+            w = mrp_list_entry(p, typeof(*w), hook);
 
-                    grant = 0;
+            if (w->resid == chg->resid && !w->dead)
+                w->cb(zoneid, chg->resid, chg->new.rset, w->user_data);
+        }
+    }
 
-                    if ((advice & mandatory) != mandatory)
-                        advice = 0;
+    if (--notifying > 0 || !ndead_watch)
+        return;
 
-                    mrp_resource_lua_set_owners(zone, owners);
-                }
-                break;
+    for (zoneid = 0;  zoneid < MRP_ZONE_MAX && ndead_watch;  zoneid++) {
+        watches = owner_watches + zoneid;
 
-            case mrp_resource_release:
-                while ((res = mrp_resource_set_iterate_resources(rset, &rc))) {
-                    rdef  = res->def;
-                    rid   = rdef->id;
-                    owner = get_owner(zoneid, rid);
+        if (!watches->next)
+            continue;
 
-                    if (advice_ownership(owner, zone, class, rset, res))
-                        advice |= ((mrp_resource_mask_t)1 << rid);
-                }
-                if ((advice & mandatory) != mandatory)
-                    advice = 0;
-                break;
+        mrp_list_foreach(watches, p, n) {
+            w = mrp_list_entry(p, typeof(*w), hook);
 
-            default:
-                break;
+            if (w->dead) {
+                mrp_list_delete(&w->hook);
+                mrp_free(w);
+                ndead_watch--;
             }
+        }
+    }
+}
 
-            changed = false;
-            move    = false;
-            notify  = 0;
-            replyid = (reqset == rset && reqid == rset->request.id) ? reqid:0;
+uint32_t mrp_resource_owner_get_generation(uint32_t zoneid)
+{
+    zone_owners_t *zo;
 
+    if (zoneid >= MRP_ZONE_MAX || !(zo = zone_owners[zoneid]))
+        return 0;
 
-            if (force_release) {
-                move = (rset->state != mrp_resource_release);
-                notify = move ? MRP_RESOURCE_EVENT_RELEASE : 0;
-                changed = move || rset->resource.mask.grant;
-                rset->state = mrp_resource_release;
-                rset->resource.mask.grant = 0;
-            }
-            else {
-                if (grant == rset->resource.mask.grant) {
-                    if (rset->state == mrp_resource_acquire &&
-                        !grant && rset->dont_wait.current)
-                    {
-                        rset->state = mrp_resource_release;
-                        rset->dont_wait.current = rset->dont_wait.client;
-
-                        notify = MRP_RESOURCE_EVENT_RELEASE;
-                        move = true;
-                    }
-                }
-                else {
-                    rset->resource.mask.grant = grant;
-                    changed = true;
+    return zo->generation;
+}
 
-                    if (rset->state != mrp_resource_release &&
-                        !grant && rset->auto_release.current)
-                    {
-                        rset->state = mrp_resource_release;
-                        rset->auto_release.current = rset->auto_release.client;
+static contention_t *get_contention(uint32_t zone)
+{
+    contention_t *c;
 
-                        notify = MRP_RESOURCE_EVENT_RELEASE;
-                        move = true;
-                    }
-                }
-            }
+    if (!(c = contention[zone])) {
+        c = mrp_allocz(sizeof(contention_t));
 
-            if (notify) {
-                mrp_resource_set_notify(rset, notify);
-            }
+        MRP_ASSERT(c, "Memory alloc failure. Can't create contention index");
 
-            if (advice != rset->resource.mask.advice) {
-                rset->resource.mask.advice = advice;
-                changed = true;
-            }
+        contention[zone] = c;
+    }
 
-            if (replyid || changed) {
-                ev = events + nevent++;
+    return c;
+}
 
-                ev->replyid = replyid;
-                ev->rset    = rset;
-                ev->move    = move;
-            }
-        } /* while rset */
-    } /* while class */
+static void save_owner(owner_journal_t *journal, mrp_resource_owner_t *owner)
+{
+    owner_log_t *log;
 
-    manager_end_transaction(zone);
+    if (owner->version == owner_version)
+        return;
 
-    for (lastev = (ev = events) + nevent;     ev < lastev;     ev++) {
-        rset = ev->rset;
+    owner->version = owner_version;
 
-        if (ev->move)
-            mrp_application_class_move_resource_set(rset);
+    log = journal->entries + journal->nentry++;
+    log->owner = owner;
+    log->saved = *owner;
+}
 
-        mrp_resource_set_updated(rset);
+static void reset_owners(uint32_t zone, owner_journal_t *journal,
+                         uint32_t rcnt, mrp_resource_mask_t mask)
+{
+    mrp_resource_owner_t *owners = get_owner(zone, 0);
+    mrp_resource_owner_t *owner;
+    uint32_t i;
 
-        /* first we send out the revoke/deny events
-         * followed by the grants (in the next for loop)
-         */
-        if (rset->event && !rset->resource.mask.grant)
-            rset->event(ev->replyid, rset, rset->user_data);
-    }
+    if (rcnt < MRP_RESOURCE_MAX)
+        mask &= ((mrp_resource_mask_t)1 << rcnt) - 1;
 
-    for (lastev = (ev = events) + nevent;     ev < lastev;     ev++) {
-        rset = ev->rset;
+    for (;  mask;  mask &= mask - 1) {
+        i = mrp_ffsll(mask) - 1;
+        owner = owners + i;
+
+        save_owner(journal, owner);
 
-        if (rset->event && rset->resource.mask.grant)
-            rset->event(ev->replyid, rset, rset->user_data);
+        memset(owner, 0, sizeof(*owner));
+        owner->share   = true;
+        owner->version = owner_version;
     }
+}
 
-    mrp_free(events);
+static bool veto_zone(mrp_zone_t *zone, mrp_resource_set_t *reqset,
+                      decision_t *decs, uint32_t ndec)
+{
+    mrp_resource_set_t *rsets[ndec];
+    mrp_resource_mask_t grants[ndec];
+    decision_t *cands[ndec];
+    bool vetoed[ndec];
+    uint32_t i, n;
+
+    for (i = n = 0;  i < ndec;  i++) {
+        if (decs[i].candidate) {
+            rsets[n]  = decs[i].rset;
+            grants[n] = decs[i].grant;
+            vetoed[n] = false;
+            cands[n]  = decs + i;
+            n++;
+        }
+    }
 
-    for (rid = 0;  rid < rcnt;  rid++) {
-        owner = get_owner(zoneid, rid);
-        old   = oldowners + rid;
+    if (!n || !mrp_resource_lua_veto_zone(zone, get_owner(zone->id, 0), reqset,
+                                          rsets, grants, vetoed, n))
+        return false;
 
-        if (owner->class != old->class ||
-            owner->rset  != old->rset  ||
-            owner->res   != old->res     )
-        {
-            if (!owner->res)
-               delete_resource_owner(zone,old->res);
-            else if (!old->res)
-               insert_resource_owner(zone,owner->class,owner->rset,owner->res);
-            else
-               update_resource_owner(zone,owner->class,owner->rset,owner->res);
+    for (i = 0;  i < n;  i++) {
+        if (vetoed[i]) {
+            mrp_debug("grant 0x%llx of resource set %u vetoed in zone %s",
+                      (unsigned long long)grants[i], rsets[i]->id,
+                      zone->name);
+            cands[i]->vetoed = true;
         }
     }
+
+    return true;
 }
 
-int mrp_resource_owner_print(char *buf, int len)
+static bool parallel_arbitration(void)
 {
-#define PRINT(fmt, args...)  if (p<e) { p += snprintf(p, e-p, fmt , ##args); }
+    void *cursor = NULL;
 
-    mrp_zone_t *zone;
+    /*
+     * Lua veto handlers (there is a single Lua state) and resource
+     * managers are neither thread-safe nor prepared to be called for
+     * different zones at the same time.
+     */
+
+    if (mrp_resource_lua_has_veto() || mrp_resource_lua_has_zone_veto())
+        return false;
+
+    if (mrp_resource_definition_iterate_manager(&cursor))
+        return false;
+
+    return true;
+}
+
+static bool need_full_update(bool recalc)
+{
+    void *cursor = NULL;
+
+    /*
+     * We need to re-evaluate every resource set in the zone if
+     *   - there is no requesting set (ie. an explicit recalculation),
+     *   - there is a Lua veto handler, which can base its decisions on
+     *     the ownership of any resource in the zone,
+     *   - there are resource managers, which track the allocations of
+     *     a zone per transaction.
+     */
+
+    if (recalc)
+        return true;
+
+    if (mrp_resource_lua_has_veto() || mrp_resource_lua_has_zone_veto())
+        return true;
+
+    if (mrp_resource_definition_iterate_manager(&cursor))
+        return true;
+
+    return false;
+}
+
+static bool cannot_win(uint32_t zoneid, mrp_resource_set_t *rset)
+{
+    mrp_application_class_t *class = rset->class.ptr;
+    mrp_resource_mask_t mandatory = rset->resource.mask.mandatory;
     mrp_resource_owner_t *owner;
-    mrp_application_class_t *class;
-    mrp_resource_set_t *rset;
     mrp_resource_t *res;
-    mrp_resource_def_t *rdef;
-    uint32_t rcnt, rid;
-    uint32_t zcnt, zid;
-    char *p, *e;
+    void *rc;
+    uint32_t rid;
 
-    if (len <= 0)
-        return 0;
+    /*
+     * An acquiring set that is not waiting for its resources (dont_wait)
+     * or would not keep waiting for them once lost (autorelease) is
+     * usually rejected outright by arbitration, if the resources are
+     * already taken. We can tell this without arbitrating when one of
+     * its mandatory resources is held by a set of a higher priority class,
+     * either modally or without sharing. Such an owner is arbitrated
+     * before us and, since nothing else has changed in the zone, it will
+     * claim the resource again. We only try this when the outcome can't
+     * depend on anything else, ie. when there are no Lua veto handlers or
+     * resource managers.
+     */
 
-    MRP_ASSERT(buf, "invalid argument");
+    if (rset->state != mrp_resource_acquire || rset->request.batched)
+        return false;
 
-    rcnt = mrp_resource_definition_count();
-    zcnt = mrp_zone_count();
+    if (!rset->dont_wait.current && !rset->auto_release.current)
+        return false;
 
-    e = (p = buf) + len;
+    if (!class || !mandatory || rset->resource.mask.grant)
+        return false;
 
-    PRINT("Resource owners:\n");
+    if (need_full_update(false))
+        return false;
 
-    for (zid = 0;  zid < zcnt;  zid++) {
-        zone = mrp_zone_find_by_id(zid);
+    rc = NULL;
+    while ((res = mrp_resource_set_iterate_resources(rset, &rc))) {
+        rid = res->def->id;
 
-        if (!zone) {
-            PRINT("   Zone %u:\n", zid);
-        }
-        else {
-            PRINT("   Zone %s:", zone->name);
-            p += mrp_zone_attribute_print(zone, p, e-p);
-            PRINT("\n");
-        }
+        if (!(mandatory & ((mrp_resource_mask_t)1 << rid)))
+            continue;
 
-        for (rid = 0;   rid < rcnt;   rid++) {
-            if (!(rdef = mrp_resource_definition_find_by_id(rid)))
-                continue;
+        owner = get_owner(zoneid, rid);
 
-            PRINT("      %-15s: ", rdef->name);
+        if (!owner->class || !owner->rset || owner->rset == rset)
+            continue;
 
-            owner = get_owner(zid, rid);
+        if (owner->class->priority <= class->priority)
+            continue;
 
-            if (!(class = owner->class) ||
-                !(rset  = owner->rset ) ||
-                !(res   = owner->res  )    )
-            {
-                PRINT("<nobody>");
-            }
-            else {
-                MRP_ASSERT(rdef == res->def, "confused with data structures");
+        if (owner->modal || !owner->share)
+            return true;
+    }
 
-                PRINT("%-15s", class->name);
+    return false;
+}
 
-                p += mrp_resource_attribute_print(res, p, e-p);
-            }
+static void deny_request(mrp_resource_set_t *rset, uint32_t reqid,
+                         uint64_t started)
+{
+    uint32_t replyid;
+    bool changed;
+    bool move;
 
-            PRINT("\n");
-        }
-    }
+    /*
+     * Do to the set what apply_zone would do for an acquisition that did
+     * not get any of its mandatory resources (hence no advice either).
+     */
+    replyid = (reqid == rset->request.id) ? reqid : 0;
+    move    = false;
+    changed = (rset->resource.mask.advice != 0);
 
-    return p - buf;
+    rset->resource.mask.advice = 0;
 
-#undef PRINT
-}
+    if (rset->dont_wait.current) {
+        rset->state = mrp_resource_release;
+        rset->dont_wait.current = rset->dont_wait.client;
 
+        mrp_resource_set_notify(rset, MRP_RESOURCE_EVENT_RELEASE);
+        move = true;
+    }
 
-static mrp_resource_owner_t *get_owner(uint32_t zone, uint32_t resid)
-{
-    MRP_ASSERT(zone < MRP_ZONE_MAX && resid < MRP_RESOURCE_MAX,
-               "invalid argument");
+    if (move)
+        mrp_application_class_move_resource_set(rset);
+
+    if (replyid || changed) {
+        mrp_resource_set_updated(rset);
+        mrp_resource_set_queue_event(rset, replyid);
+
+        if (replyid)
+            stamp_arbitration(rset, started, 0, 0, 0);
+    }
 
-    return resource_owners + (zone * MRP_RESOURCE_MAX + resid);
+    mrp_resource_set_deliver_events();
 }
 
-static void reset_owners(uint32_t zone, mrp_resource_owner_t *oldowners)
+static mrp_resource_mask_t contention_closure(uint32_t zoneid,
+                                              mrp_resource_mask_t mask)
 {
-    mrp_resource_owner_t *owners = get_owner(zone, 0);
-    size_t size = sizeof(mrp_resource_owner_t) * MRP_RESOURCE_MAX;
-    size_t i;
+    contention_t *c = get_contention(zoneid);
+    mrp_resource_mask_t closure, pending, reach;
+    uint32_t i;
+
+    closure = pending = mask;
 
-    if (oldowners)
-        memcpy(oldowners, owners, size);
+    while (pending) {
+        i = mrp_ffsll(pending) - 1;
+        pending &= pending - 1;
 
-    memset(owners, 0, size);
+        reach    = c->adj[i] & ~closure;
+        closure |= reach;
+        pending |= reach;
+    }
 
-    for (i = 0;   i < MRP_RESOURCE_MAX;   i++)
-        owners[i].share = true;
+    return closure;
 }
 
 static bool grant_ownership(mrp_resource_owner_t    *owner,
@@ -627,6 +1655,56 @@ static void manager_end_transaction(mrp_zone_t *zone)
     }
 }
 
+static void manager_apply_changes(mrp_zone_t *zone,
+                                  mrp_resource_change_t *changes, int nchange)
+{
+    mrp_resource_mgr_ftbl_t *ftbl;
+    mrp_resource_def_t *rdef;
+    mrp_resource_change_t batch[nchange];
+    mrp_manager_changes_func_t cb;
+    void *userdata;
+    bool done[nchange];
+    int i, j, n;
+
+    /*
+     * Deliver the changes to each manager in a single call, collecting
+     * the changes of all the resources sharing the same manager callback
+     * and user data.
+     */
+
+    memset(done, 0, sizeof(done));
+
+    for (i = 0;  i < nchange;  i++) {
+        if (done[i])
+            continue;
+
+        done[i] = true;
+        rdef    = mrp_resource_definition_find_by_id(changes[i].resid);
+
+        if (!rdef || !(ftbl = rdef->manager.ftbl) || !(cb = ftbl->changes))
+            continue;
+
+        userdata = rdef->manager.userdata;
+        batch[0] = changes[i];
+        n        = 1;
+
+        for (j = i + 1;  j < nchange;  j++) {
+            if (done[j])
+                continue;
+
+            rdef = mrp_resource_definition_find_by_id(changes[j].resid);
+
+            if (rdef && (ftbl = rdef->manager.ftbl) && ftbl->changes == cb &&
+                rdef->manager.userdata == userdata) {
+                batch[n++] = changes[j];
+                done[j]    = true;
+            }
+        }
+
+        cb(zone, batch, n, userdata);
+    }
+}
+
 
 static void delete_resource_owner(mrp_zone_t *zone, mrp_resource_t *res)
 {
@@ -736,12 +1814,17 @@ static void update_resource_owner(mrp_zone_t *zone,
 }
 
 
-static void set_attr_descriptors(mqi_column_desc_t *cdsc, mrp_resource_t *res)
+static mqi_column_desc_t *create_attr_descriptors(mrp_resource_def_t *rdef)
 {
-    mrp_resource_def_t *rdef = res->def;
+    mqi_column_desc_t *cdsc;
     uint32_t i,j;
     int o;
 
+    cdsc = mrp_allocz(sizeof(mqi_column_desc_t) * (rdef->nattr + 1));
+
+    MRP_ASSERT(cdsc, "Memory alloc failure. Can't create attribute "
+               "descriptors");
+
     for (i = j = 0;  j < rdef->nattr;  j++) {
         switch (rdef->attrdefs[j].type) {
         case mqi_string:   o = MQI_OFFSET(owner_row_t,attrs[j].string);  break;
@@ -758,6 +1841,57 @@ static void set_attr_descriptors(mqi_column_desc_t *cdsc, mrp_resource_t *res)
 
     cdsc[i].cindex = -1;
     cdsc[i].offset =  1;
+
+    return cdsc;
+}
+
+static void set_attr_descriptors(mqi_column_desc_t *cdsc, mrp_resource_t *res)
+{
+    mrp_resource_def_t *rdef = res->def;
+
+    memcpy(cdsc, owner_attr_cdsc[rdef->id],
+           (rdef->nattr + 1) * sizeof(mqi_column_desc_t));
+}
+
+static void init_metrics(void)
+{
+    static const int64_t bounds[] = {
+        10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 100000
+    };
+
+    if (arbitrations != NULL)
+        return;
+
+    arbitrations = mrp_metric_counter("murphy_resource_arbitrations_total",
+                                      "Number of zone arbitration passes.");
+    arbitration_usecs =
+        mrp_metric_histogram("murphy_resource_arbitration_usecs",
+                             "Time spent in zone arbitration passes.",
+                             bounds, MRP_ARRAY_SIZE(bounds));
+    grant_changes = mrp_metric_counter("murphy_resource_grant_changes_total",
+                                       "Number of resource set grant changes.");
+    early_denials =
+        mrp_metric_counter("murphy_resource_early_denials_total",
+                           "Number of requests denied without arbitration.");
+}
+
+static uint64_t usecs_now(void)
+{
+    return mrp_grant_latency_now();
+}
+
+static void stamp_arbitration(mrp_resource_set_t *rset, uint64_t started,
+                              uint64_t policy, uint64_t manager, uint64_t db)
+{
+    mrp_grant_stamps_t *stamps = &rset->request.latency;
+
+    if (!stamps->received || stamps->arbitrated)
+        return;
+
+    stamps->arbitrated = started;
+    stamps->policy     = policy;
+    stamps->manager    = manager;
+    stamps->db         = db;
 }
 
 
@@ -45,11 +45,18 @@ struct mrp_resource_owner_s {
     bool                     modal;
     bool                     share;
     bool                     release;
+    uint32_t                 version;  /**< last update that saved this */
 };
 
 
 int  mrp_resource_owner_create_database_table(mrp_resource_def_t *);
 void mrp_resource_owner_update_zone(uint32_t, mrp_resource_set_t *, uint32_t);
+void mrp_resource_owner_update_zone_batch(uint32_t, mrp_resource_mask_t);
+void mrp_resource_owner_add_contention(uint32_t, mrp_application_class_t *,
+                                       mrp_resource_mask_t);
+void mrp_resource_owner_remove_contention(uint32_t, mrp_application_class_t *,
+                                          mrp_resource_mask_t);
+void mrp_resource_owner_update_attributes(uint32_t, mrp_resource_t *);
 
 
 #endif  /* __MURPHY_RESOURCE_OWNER_H__ */
@@ -29,12 +29,14 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 
 #include <murphy/common/mm.h>
-#include <murphy/common/hashtbl.h>
 #include <murphy/common/utils.h>
 #include <murphy/common/log.h>
 #include <murphy/common/mainloop.h>
+#include <murphy/common/metrics.h>
+#include <murphy/common/process.h>
 
 #include <murphy-db/mqi.h>
 
@@ -47,26 +49,97 @@
 #include "resource-client.h"
 #include "resource-owner.h"
 #include "resource-lua.h"
+#include "grant-latency.h"
 
 
-#define STAMP_MAX     ((uint32_t)1 << MRP_KEY_STAMP_BITS)
+#define STAMP_MAX     ((uint64_t)1 << MRP_KEY_STAMP_BITS)
 #define PRIORITY_MAX  ((uint32_t)1 << MRP_KEY_PRIORITY_BITS)
 
 
 static MRP_LIST_HOOK(resource_set_list);
+static MRP_LIST_HOOK(destroyed_sets);    /* sets to free after a batch */
 static uint32_t resource_set_count;
-static mrp_htbl_t *id_hash;
+static mrp_metric_t *requests;
 
-static int add_to_id_hash(mrp_resource_set_t *);
-static void remove_from_id_hash(mrp_resource_set_t *);
+/*
+ * resource set id table
+ *
+ * Resource set ids are made of a slot index into a dense table and the
+ * generation of the slot. The generation is bumped every time a slot is
+ * released, so stale ids of destroyed sets do not resolve to the new set
+ * in the same slot. Looking up a set by its id is thus just indexing the
+ * table. The Lua bridge keeps its reference to the set in the same slot.
+ * Ids are kept below 2^31 as the Lua bindings pass them around as int.
+ *
+ * Released slots are reused in FIFO order, and a slot whose generation
+ * would wrap around is retired instead of being reused, so no id is
+ * handed out twice. Only once every slot is taken or retired do the
+ * retired slots start over, ie. the whole id space wraps around.
+ */
+#define ID_SLOT_BITS  20
+#define ID_SLOT_MAX   ((uint32_t)1 << ID_SLOT_BITS)
+#define ID_GEN_MAX    ((uint32_t)1 << (31 - ID_SLOT_BITS))
+#define ID_SLOT(id)   ((id) & (ID_SLOT_MAX - 1))
+#define ID_GEN(id)    ((id) >> ID_SLOT_BITS)
+#define ID_MAKE(s, g) (((g) << ID_SLOT_BITS) | (s))
+
+typedef struct {
+    mrp_resource_set_t *rset;               /* set in this slot or NULL */
+    void               *luaref;             /* Lua reference of the set */
+    uint32_t            gen;                /* current slot generation */
+    uint32_t            next;               /* next free slot */
+} id_slot_t;
+
+static struct {
+    id_slot_t *slots;                       /* slot table */
+    uint32_t   nslot;                       /* slots in use or freed */
+    uint32_t   size;                        /* allocated slots */
+    uint32_t   free;                        /* first free slot */
+    uint32_t   last;                        /* last free slot */
+} id_table = { NULL, 0, 0, ID_SLOT_MAX, ID_SLOT_MAX };
+
+static struct {
+    uint32_t            depth;              /* begin/commit nesting level */
+    mrp_resource_mask_t mask[MRP_ZONE_MAX]; /* requested resources per zone */
+    bool                pending[MRP_ZONE_MAX]; /* zones with requests */
+} batch;
+
+/*
+ * client event delivery queues
+ *
+ * Client events are not sent while a zone is being updated. The affected
+ * resource sets are queued instead and get a single event each, reflecting
+ * their final state, once the update is done. Revocations are delivered
+ * before grants. Sets whose state changes while events are being delivered
+ * (eg. because a client made a new request from its callback) are queued
+ * again and get their next event once the current one has been consumed.
+ * Sets of clients with blocked events are parked on the held list of the
+ * client, still pending, until the client allows its events again.
+ */
+static struct {
+    mrp_list_hook_t revoke;                 /* sets without any grant */
+    mrp_list_hook_t grant;                  /* sets with some grant */
+    bool            busy;                   /* delivering events */
+} delivery = {
+    .revoke = MRP_LIST_INIT(delivery.revoke),
+    .grant  = MRP_LIST_INIT(delivery.grant),
+};
+
+static uint32_t add_to_id_table(mrp_resource_set_t *);
+static void remove_from_id_table(mrp_resource_set_t *);
+static id_slot_t *find_id_slot(uint32_t);
+static void free_id_slot(uint32_t);
+static void recycle_id_slots(void);
 
 static mrp_resource_t *find_resource_by_name(mrp_resource_set_t *,const char*);
-#if 0
 static mrp_resource_t *find_resource_by_id(mrp_resource_set_t *, uint32_t);
-#endif
 
-static uint32_t get_request_stamp(void);
+static void free_resource_set(mrp_resource_set_t *);
+static void request_update(mrp_resource_set_t *, uint32_t);
+static uint64_t get_request_stamp(void);
 static const char *state_str(mrp_resource_state_t);
+static void count_request(void);
+static void stamp_request(mrp_resource_set_t *);
 static void send_rset_event(mrp_resource_set_t *rset,
         mrp_resource_event_t ev);
 
@@ -82,19 +155,24 @@ mrp_resource_set_t *mrp_resource_set_create(mrp_resource_client_t *client,
                                             mrp_resource_event_cb_t event_cb,
                                             void *user_data)
 {
-    static uint32_t our_id;
-
     mrp_resource_set_t *rset;
 
     MRP_ASSERT(client, "invalid argument");
 
+    /* resource sets need the tables of the resources */
+    mrp_resource_configuration_flush();
+
     if (priority >= PRIORITY_MAX)
         priority = PRIORITY_MAX - 1;
 
     if (!(rset = mrp_allocz(sizeof(mrp_resource_set_t))))
         mrp_log_error("Memory alloc failure. Can't create resource set");
+    else if (!(rset->id = add_to_id_table(rset))) {
+        mrp_log_error("Can't create resource set: out of resource set ids");
+        mrp_free(rset);
+        rset = NULL;
+    }
     else {
-        rset->id = ++our_id;
 
         rset->dont_wait.current = dont_wait;
         rset->dont_wait.client  = dont_wait;
@@ -117,9 +195,10 @@ mrp_resource_set_t *mrp_resource_set_create(mrp_resource_client_t *client,
         rset->event = event_cb;
         rset->user_data = user_data;
 
+        mrp_list_init(&rset->delivery.list);
+
         resource_set_count++;
 
-        add_to_id_hash(rset);
         mrp_resource_lua_register_resource_set(rset);
 
         send_rset_event(rset, MRP_RESOURCE_EVENT_CREATED);
@@ -131,42 +210,78 @@ mrp_resource_set_t *mrp_resource_set_create(mrp_resource_client_t *client,
 void mrp_resource_set_destroy(mrp_resource_set_t *rset)
 {
     mrp_resource_state_t state;
-    mrp_list_hook_t *entry, *n;
-    mrp_resource_t *res;
 
     if (rset) {
         state = rset->state;
 
         rset->event = NULL; /* make sure nothing is sent any more */
+        mrp_list_delete(&rset->delivery.list);
 
         send_rset_event(rset, MRP_RESOURCE_EVENT_DESTROYED);
 
         mrp_resource_lua_unregister_resource_set(rset);
-        remove_from_id_hash(rset);
+        remove_from_id_table(rset);
 
         if (state == mrp_resource_acquire)
             mrp_resource_set_release(rset, MRP_RESOURCE_REQNO_INVALID);
 
-        mrp_list_foreach(&rset->resource.list, entry, n) {
-            res = mrp_list_entry(entry, mrp_resource_t, list);
-            mrp_resource_notify(res, rset, MRP_RESOURCE_EVENT_DESTROYED);
-            mrp_resource_destroy(res);
-        }
-
         mrp_list_delete(&rset->list);
         mrp_list_delete(&rset->client.list);
-        mrp_list_delete(&rset->class.list);
+        mrp_application_class_remove_resource_set(rset);
+
+        if (rset->class.ptr)
+            mrp_resource_owner_remove_contention(rset->zone, rset->class.ptr,
+                                                 rset->resource.mask.all);
+
+        /*
+         * Within a request batch the owners of the zone keep pointing to
+         * the set and its resources until the batch is committed, so the
+         * set is only freed then.
+         */
+        if (batch.depth > 0)
+            mrp_list_append(&destroyed_sets, &rset->list);
+        else
+            free_resource_set(rset);
+    }
+}
 
-        mrp_free(rset);
+static void free_resource_set(mrp_resource_set_t *rset)
+{
+    mrp_list_hook_t *entry, *n;
+    mrp_resource_t *res;
 
-        if (resource_set_count > 0)
-            resource_set_count--;
+    mrp_list_foreach(&rset->resource.list, entry, n) {
+        res = mrp_list_entry(entry, mrp_resource_t, list);
+        mrp_resource_notify(res, rset, MRP_RESOURCE_EVENT_DESTROYED);
+        mrp_resource_destroy(res);
     }
+
+    mrp_free(rset);
+
+    if (resource_set_count > 0)
+        resource_set_count--;
 }
 
 mrp_resource_set_t *mrp_resource_set_find_by_id(uint32_t id)
 {
-    return id_hash ? mrp_htbl_lookup(id_hash, NULL + id) : NULL;
+    id_slot_t *slot = find_id_slot(id);
+
+    return slot ? slot->rset : NULL;
+}
+
+void *mrp_resource_set_get_lua_ref(uint32_t id)
+{
+    id_slot_t *slot = find_id_slot(id);
+
+    return slot ? slot->luaref : NULL;
+}
+
+void mrp_resource_set_set_lua_ref(uint32_t id, void *luaref)
+{
+    id_slot_t *slot = find_id_slot(id);
+
+    if (slot)
+        slot->luaref = luaref;
 }
 
 uint32_t mrp_get_resource_set_id(mrp_resource_set_t *rset)
@@ -246,7 +361,7 @@ int mrp_resource_set_add_resource(mrp_resource_set_t *rset,
                                   mrp_attr_t         *attrs,
                                   bool                mandatory)
 {
-    uint32_t mask;
+    mrp_resource_mask_t mask;
     mrp_resource_t *res;
     uint32_t rsetid;
     bool autorel;
@@ -264,6 +379,13 @@ int mrp_resource_set_add_resource(mrp_resource_set_t *rset,
 
     mask = mrp_resource_get_mask(res);
 
+    if (rset->class.ptr) {
+        mrp_resource_owner_remove_contention(rset->zone, rset->class.ptr,
+                                             rset->resource.mask.all);
+        mrp_resource_owner_add_contention(rset->zone, rset->class.ptr,
+                                          rset->resource.mask.all | mask);
+    }
+
     rset->resource.mask.all       |= mask;
     rset->resource.mask.mandatory |= mandatory ? mask : 0;
     rset->resource.share          |= mrp_resource_is_shared(res);
@@ -311,27 +433,73 @@ int mrp_resource_set_write_attributes(mrp_resource_set_t *rset,
                                       mrp_attr_t *attrs)
 {
     mrp_resource_t *res;
+    int sts;
 
     MRP_ASSERT(rset && resnam && attrs, "invalid argument");
 
     if (!(res = find_resource_by_name(rset, resnam)))
         return -1;
 
-    if (mrp_resource_write_attributes(res, attrs) < 0)
+    if ((sts = mrp_resource_write_attributes(res, attrs)) < 0)
         return -1;
 
+    if (sts == MRP_ATTRIBUTE_CHANGED_INFO)
+        mrp_resource_owner_update_attributes(rset->zone, res);
+
+    return 0;
+}
+
+mrp_attr_t *mrp_resource_set_read_attribute_by_id(mrp_resource_set_t *rset,
+                                                  uint32_t resid,
+                                                  uint32_t attrid,
+                                                  mrp_attr_t *buf)
+{
+    mrp_resource_t *res;
+
+    MRP_ASSERT(rset, "invalid argument");
+
+    if (!(res = find_resource_by_id(rset, resid)))
+        return NULL;
+
+    if (attrid >= res->def->nattr)
+        return NULL;
+
+    return mrp_resource_read_attribute(res, attrid, buf);
+}
+
+int mrp_resource_set_write_attribute_by_id(mrp_resource_set_t *rset,
+                                           uint32_t resid,
+                                           uint32_t attrid,
+                                           mrp_attr_value_t *value)
+{
+    mrp_resource_t *res;
+    int sts;
+
+    MRP_ASSERT(rset && value, "invalid argument");
+
+    if (!(res = find_resource_by_id(rset, resid)))
+        return -1;
+
+    if ((sts = mrp_resource_write_attribute(res, attrid, value)) < 0)
+        return -1;
+
+    if (sts == MRP_ATTRIBUTE_CHANGED_INFO)
+        mrp_resource_owner_update_attributes(rset->zone, res);
+
     return 0;
 }
 
 void mrp_resource_set_acquire(mrp_resource_set_t *rset, uint32_t reqid)
 {
     mrp_resource_state_t old_state;
-    mqi_handle_t trh;
 
     MRP_ASSERT(rset, "invalid argument");
 
     mrp_debug("acquiring resource set #%d", rset->id);
 
+    count_request();
+    stamp_request(rset);
+
     old_state = rset->state;
     rset->state = mrp_resource_acquire;
 
@@ -344,26 +512,25 @@ void mrp_resource_set_acquire(mrp_resource_set_t *rset, uint32_t reqid)
         if (old_state != mrp_resource_acquire)
             mrp_resource_set_notify(rset, MRP_RESOURCE_EVENT_ACQUIRE);
 
-        trh = mqi_begin_transaction();
-        mrp_resource_owner_update_zone(rset->zone, rset, reqid);
-        mqi_commit_transaction(trh);
+        request_update(rset, reqid);
     }
 }
 
 void mrp_resource_set_release(mrp_resource_set_t *rset, uint32_t reqid)
 {
-    mqi_handle_t trh;
-
     MRP_ASSERT(rset, "invalid argument");
 
     mrp_debug("releasing resource set #%d", rset->id);
 
+    count_request();
+    stamp_request(rset);
+
     if (!rset->class.ptr)
         rset->state = mrp_resource_release;
     else {
         if (rset->state == mrp_resource_release) {
-            if (rset->event)
-                rset->event(reqid, rset, rset->user_data);
+            mrp_resource_set_queue_event(rset, reqid);
+            mrp_resource_set_deliver_events();
         }
         else {
             rset->state = mrp_resource_release;
@@ -374,13 +541,71 @@ void mrp_resource_set_release(mrp_resource_set_t *rset, uint32_t reqid)
 
             mrp_resource_set_notify(rset, MRP_RESOURCE_EVENT_RELEASE);
 
-            trh = mqi_begin_transaction();
-            mrp_resource_owner_update_zone(rset->zone, rset, reqid);
-            mqi_commit_transaction(trh);
+            request_update(rset, reqid);
         }
     }
 }
 
+void mrp_resource_set_begin_batch(void)
+{
+    batch.depth++;
+}
+
+void mrp_resource_set_commit_batch(void)
+{
+    mrp_list_hook_t *entry, *n;
+    mrp_resource_set_t *rset;
+    mqi_handle_t trh;
+    uint32_t zone;
+
+    if (!batch.depth || --batch.depth > 0)
+        return;
+
+    for (zone = 0;  zone < MRP_ZONE_MAX;  zone++) {
+        if (!batch.pending[zone])
+            continue;
+
+        mrp_debug("committing batched requests in zone %u", zone);
+
+        batch.pending[zone] = false;
+
+        trh = mqi_begin_transaction();
+        mrp_resource_owner_update_zone_batch(zone, batch.mask[zone]);
+        mqi_commit_transaction(trh);
+
+        batch.mask[zone] = 0;
+    }
+
+    mrp_list_foreach(&destroyed_sets, entry, n) {
+        rset = mrp_list_entry(entry, mrp_resource_set_t, list);
+        mrp_list_delete(&rset->list);
+        free_resource_set(rset);
+    }
+}
+
+/*
+ * Clients exiting together (eg. on a session logout) get their exits
+ * delivered in one batch by the pid watcher. Wrap those in a request batch
+ * so the affected zones are re-arbitrated only once. Sets destroyed by the
+ * exit callbacks are freed when the batch is committed.
+ */
+static void pid_exit_batch(bool begin, void *user_data)
+{
+    MRP_UNUSED(user_data);
+
+    if (begin)
+        mrp_resource_set_begin_batch();
+    else
+        mrp_resource_set_commit_batch();
+}
+
+static void register_pid_exit_batch(void) MRP_INIT;
+
+static void register_pid_exit_batch(void)
+{
+    mrp_pid_set_batch_handler(pid_exit_batch, NULL);
+}
+
 void mrp_resource_set_updated(mrp_resource_set_t *rset)
 {
     mrp_resource_t *res;
@@ -461,6 +686,96 @@ void mrp_resource_set_notify(mrp_resource_set_t *rset, mrp_resource_event_t ev)
         mrp_resource_notify(res, rset, ev);
 }
 
+void mrp_resource_set_queue_event(mrp_resource_set_t *rset, uint32_t replyid)
+{
+    mrp_list_hook_t *queue;
+
+    MRP_ASSERT(rset, "invalid argument");
+
+    if (!rset->event)
+        return;
+
+    if (replyid) {
+        rset->delivery.replyid = replyid;
+
+        if (rset->request.latency.received && !rset->request.latency.queued)
+            rset->request.latency.queued = mrp_grant_latency_now();
+    }
+
+    queue = rset->resource.mask.grant ? &delivery.grant : &delivery.revoke;
+
+    if (rset->delivery.pending)
+        mrp_list_delete(&rset->delivery.list);
+
+    mrp_list_append(queue, &rset->delivery.list);
+    rset->delivery.pending = true;
+}
+
+void mrp_resource_set_post_event(mrp_resource_set_t *rset, uint32_t replyid)
+{
+    mrp_resource_set_queue_event(rset, replyid);
+    mrp_resource_set_deliver_events();
+}
+
+void mrp_resource_set_deliver_events(void)
+{
+    mrp_list_hook_t *queue;
+    mrp_resource_set_t *rset;
+    mrp_application_class_t *class;
+    mrp_grant_stamps_t stamps;
+    uint32_t replyid;
+    uint32_t zone;
+
+    if (delivery.busy)
+        return;
+
+    delivery.busy = true;
+
+    for (;;) {
+        if (!mrp_list_empty(&delivery.revoke))
+            queue = &delivery.revoke;
+        else if (!mrp_list_empty(&delivery.grant))
+            queue = &delivery.grant;
+        else
+            break;
+
+        rset = mrp_list_entry(queue->next, mrp_resource_set_t, delivery.list);
+
+        mrp_list_delete(&rset->delivery.list);
+
+        if (rset->client.ptr && rset->client.ptr->blocked) {
+            mrp_debug("holding back event for resource set #%u", rset->id);
+            mrp_list_append(&rset->client.ptr->held, &rset->delivery.list);
+            continue;
+        }
+
+        replyid = rset->delivery.replyid;
+        rset->delivery.replyid = 0;
+        rset->delivery.pending = false;
+
+        mrp_debug("delivering event for resource set #%u", rset->id);
+
+        /* the handler might destroy the set, so take what we need first */
+        if (replyid && rset->request.latency.received) {
+            stamps = rset->request.latency;
+            class  = rset->class.ptr;
+            zone   = rset->zone;
+            mrp_clear(&rset->request.latency);
+        }
+        else
+            stamps.received = 0;
+
+        if (rset->event)
+            rset->event(replyid, rset, rset->user_data);
+
+        if (stamps.received)
+            mrp_grant_latency_record(class, zone, &stamps,
+                                     mrp_grant_latency_now());
+    }
+
+    delivery.busy = false;
+}
+
 void mrp_resource_set_request_auto_release(mrp_resource_set_t *rset,
                                            bool auto_release)
 {
@@ -484,7 +799,7 @@ int mrp_resource_set_print(mrp_resource_set_t *rset, size_t indent,
 
     mrp_resource_t *res;
     mrp_list_hook_t *resen, *n;
-    uint32_t mandatory;
+    mrp_resource_mask_t mandatory;
     char gap[] = "                         ";
     char *p, *e;
 
@@ -500,7 +815,8 @@ int mrp_resource_set_print(mrp_resource_set_t *rset, size_t indent,
 
     mandatory = rset->resource.mask.mandatory;
 
-    PRINT("%s%3u - 0x%02x/0x%02x 0x%02x/0x%02x 0x%08x %d %s%s%s %s\n",
+    PRINT("%s%3u - 0x%02" PRIx64 "/0x%02" PRIx64 " 0x%02" PRIx64 "/0x%02"
+          PRIx64 " 0x%016" PRIx64 " %d %s%s%s %s\n",
           gap, rset->id,
           rset->resource.mask.all, mandatory,
           rset->resource.mask.grant, rset->resource.mask.advice,
@@ -528,66 +844,119 @@ int mrp_resource_set_print(mrp_resource_set_t *rset, size_t indent,
 #undef PRINT
 }
 
-static uint32_t rset_hash(const void *key)
+static uint32_t add_to_id_table(mrp_resource_set_t *rset)
 {
-    return (uint32_t)(key - NULL);
-}
+    id_slot_t *slot, *slots;
+    uint32_t idx, size;
 
-static int rset_comp(const void *key1, const void *key2)
-{
-    uint32_t k1 = key1 - NULL;
-    uint32_t k2 = key2 - NULL;
+    MRP_ASSERT(rset, "invalid argument");
 
-    return (k1 == k2) ? 0 : ((k1 > k2) ? 1 : -1);
-}
+    if (id_table.free >= ID_SLOT_MAX && id_table.nslot >= ID_SLOT_MAX)
+        recycle_id_slots();
 
-static void init_id_hash(void)
-{
-    mrp_htbl_config_t cfg;
+    if ((idx = id_table.free) < ID_SLOT_MAX) {
+        slot = id_table.slots + idx;
 
-    if (!id_hash) {
-        cfg.nentry  = 32;
-        cfg.comp    = rset_comp;
-        cfg.hash    = rset_hash;
-        cfg.free    = NULL;
-        cfg.nbucket = cfg.nentry;
+        if ((id_table.free = slot->next) >= ID_SLOT_MAX)
+            id_table.last = ID_SLOT_MAX;
+    }
+    else {
+        if ((idx = id_table.nslot) >= ID_SLOT_MAX)
+            return 0;
+
+        if (idx >= id_table.size) {
+            size  = id_table.size ? 2 * id_table.size : 32;
+            slots = mrp_realloc(id_table.slots, size * sizeof(id_slot_t));
+
+            if (!slots)
+                return 0;
+
+            id_table.slots = slots;
+            id_table.size  = size;
+        }
 
-        id_hash = mrp_htbl_create(&cfg);
+        slot = id_table.slots + idx;
+        slot->gen = 1;
 
-        MRP_ASSERT(id_hash, "failed to make id_hash for resource sets");
+        id_table.nslot++;
     }
+
+    slot->rset   = rset;
+    slot->luaref = NULL;
+    slot->next   = ID_SLOT_MAX;
+
+    return ID_MAKE(idx, slot->gen);
 }
 
-static int add_to_id_hash(mrp_resource_set_t *rset)
+static void remove_from_id_table(mrp_resource_set_t *rset)
 {
-    MRP_ASSERT(rset, "invalid argument");
+    id_slot_t *slot;
+    uint32_t idx;
 
-    init_id_hash();
+    if (!rset || !(slot = find_id_slot(rset->id)))
+        return;
 
-    if (!mrp_htbl_insert(id_hash, NULL + rset->id, rset))
-        return -1;
+    MRP_ASSERT(slot->rset == rset, "confused with data structures when "
+               "deleting resource-set from id table");
 
-    return 0;
+    idx = ID_SLOT(rset->id);
+
+    slot->rset   = NULL;
+    slot->luaref = NULL;
+    slot->next   = ID_SLOT_MAX;
+
+    /* generation 0 is never used, so no valid id is ever 0 */
+    if (++slot->gen >= ID_GEN_MAX) {
+        slot->gen = 0;                      /* retired */
+        return;
+    }
+
+    free_id_slot(idx);
 }
 
-static void remove_from_id_hash(mrp_resource_set_t *rset)
+static void free_id_slot(uint32_t idx)
 {
-    mrp_resource_set_t *deleted;
+    if (id_table.last < ID_SLOT_MAX)
+        id_table.slots[id_table.last].next = idx;
+    else
+        id_table.free = idx;
 
-    if (id_hash && rset) {
-        deleted = mrp_htbl_remove(id_hash, NULL + rset->id, false);
+    id_table.last = idx;
+}
+
+static void recycle_id_slots(void)
+{
+    id_slot_t *slot;
+    uint32_t idx;
 
-        MRP_ASSERT(!deleted || deleted == rset, "confused with data "
-                   "structures when deleting resource-set from id hash");
+    mrp_log_info("resource set ids wrapped around, recycling retired slots");
 
-        /* in case we were not compiled with debug enabled */
-        if (deleted != rset) {
-            mrp_log_error("confused with data structures when deleting "
-                          "resource-set '%u' from id hash", rset->id);
+    for (idx = 0;  idx < id_table.nslot;  idx++) {
+        slot = id_table.slots + idx;
+
+        if (!slot->rset && !slot->gen) {
+            slot->gen = 1;
+            free_id_slot(idx);
         }
     }
 }
 
+static id_slot_t *find_id_slot(uint32_t id)
+{
+    id_slot_t *slot;
+    uint32_t idx = ID_SLOT(id);
+
+    if (idx >= id_table.nslot)
+        return NULL;
+
+    slot = id_table.slots + idx;
+
+    if (slot->gen != ID_GEN(id) || !slot->rset)
+        return NULL;
+
+    return slot;
+}
+
 static mrp_resource_t *find_resource_by_name(mrp_resource_set_t *rset,
                                              const char *name)
 {
@@ -610,7 +979,6 @@ static mrp_resource_t *find_resource_by_name(mrp_resource_set_t *rset,
     return NULL;
 }
 
-#if 0
 static mrp_resource_t *find_resource_by_id(mrp_resource_set_t *rset,
                                            uint32_t id)
 {
@@ -632,15 +1000,34 @@ static mrp_resource_t *find_resource_by_id(mrp_resource_set_t *rset,
 
     return NULL;
 }
-#endif
 
-static uint32_t get_request_stamp(void)
+static void request_update(mrp_resource_set_t *rset, uint32_t reqid)
 {
-    static uint32_t  stamp;
+    mqi_handle_t trh;
+
+    if (batch.depth > 0) {
+        /*
+         * Within a batch we just record the request. The zone gets
+         * updated once, for all pending requests, in commit_batch.
+         */
+        rset->request.batched      = true;
+        batch.pending[rset->zone]  = true;
+        batch.mask[rset->zone]    |= rset->resource.mask.all;
+        return;
+    }
+
+    trh = mqi_begin_transaction();
+    mrp_resource_owner_update_zone(rset->zone, rset, reqid);
+    mqi_commit_transaction(trh);
+}
+
+static uint64_t get_request_stamp(void)
+{
+    static uint64_t  stamp;
 
     mrp_list_hook_t *entry, *n;
     mrp_resource_set_t *rset;
-    uint32_t min;
+    uint64_t min;
 
     if ((min = stamp) >= STAMP_MAX) {
         mrp_log_info("rebasing resource set stamps");
@@ -664,6 +1051,49 @@ static uint32_t get_request_stamp(void)
     return stamp++;
 }
 
+static int64_t get_resource_set_count(void *user_data)
+{
+    MRP_UNUSED(user_data);
+
+    return resource_set_count;
+}
+
+static void count_request(void)
+{
+    if (MRP_UNLIKELY(requests == NULL)) {
+        requests = mrp_metric_counter("murphy_resource_requests_total",
+                                      "Number of resource set acquire and "
+                                      "release requests.");
+        mrp_metric_callback("murphy_resource_sets",
+                            "Number of resource sets.", MRP_METRIC_GAUGE,
+                            get_resource_set_count, NULL);
+    }
+
+    mrp_metric_inc(requests);
+}
+
+static void stamp_request(mrp_resource_set_t *rset)
+{
+    mrp_grant_stamps_t *stamps = &rset->request.latency;
+
+    /*
+     * Keep the receipt stamp of the front end, if it gave one for this
+     * request, otherwise start measuring here.
+     */
+    if (!stamps->received || stamps->arbitrated || stamps->queued) {
+        mrp_clear(stamps);
+        stamps->received = mrp_grant_latency_now();
+    }
+}
+
+void mrp_resource_set_stamp_request(mrp_resource_set_t *rset)
+{
+    MRP_ASSERT(rset, "invalid argument");
+
+    mrp_clear(&rset->request.latency);
+    rset->request.latency.received = mrp_grant_latency_now();
+}
+
 static const char *state_str(mrp_resource_state_t state)
 {
     switch(state) {
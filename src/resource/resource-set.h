@@ -33,6 +33,7 @@
 #include <murphy/common/list.h>
 
 #include "data-types.h"
+#include "grant-latency.h"
 
 /* event protocol */
 
@@ -74,23 +75,39 @@ struct mrp_resource_set_s {
         mrp_list_hook_t list;
         mrp_application_class_t *ptr;
         uint32_t priority;
+        uint64_t key;               /* sorting key within the class */
+        uint64_t seq;               /* insertion order, breaks key ties */
+        mrp_resource_set_t *left;   /* class zone tree links */
+        mrp_resource_set_t *right;
     }                               class;
     uint32_t                        zone;
     struct {
         uint32_t id;
-        uint32_t stamp;
+        uint64_t stamp;
+        bool batched;               /* pending in a request batch */
+        mrp_grant_stamps_t latency; /* stage timestamps of the request */
     }                               request;
     mrp_resource_event_cb_t         event;
     void                           *user_data;
+    struct {
+        mrp_list_hook_t list;       /* hook to the event delivery queue */
+        uint32_t replyid;           /* latest request to reply to */
+        bool pending;               /* state changed, event not sent yet */
+    }                               delivery;
 };
 
 
 mrp_resource_set_t *mrp_resource_set_find_by_id(uint32_t);
+void               *mrp_resource_set_get_lua_ref(uint32_t);
+void                mrp_resource_set_set_lua_ref(uint32_t, void *);
 mrp_resource_t     *mrp_resource_set_find_resource(uint32_t, const char *);
 uint32_t            mrp_get_resource_set_count(void);
 void                mrp_resource_set_updated(mrp_resource_set_t *);
 void                mrp_resource_set_notify(mrp_resource_set_t *,
                                             mrp_resource_event_t);
+void                mrp_resource_set_queue_event(mrp_resource_set_t *,
+                                                 uint32_t);
+void                mrp_resource_set_deliver_events(void);
 void                mrp_resource_set_request_auto_release(mrp_resource_set_t *,
                                                           bool);
 void                mrp_resource_set_request_dont_wait(mrp_resource_set_t *,
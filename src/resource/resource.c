@@ -34,11 +34,17 @@
 
 #include <murphy/common/mm.h>
 #include <murphy/common/log.h>
+#include <murphy/common/profile.h>
+#include <murphy/common/hashtbl.h>
+#include <murphy/common/utils.h>
+#include <murphy/common/intern.h>
+#include <murphy/common/mask.h>
 
 #include <murphy-db/mqi.h>
 
 #include <murphy/resource/client-api.h>
 #include <murphy/resource/manager-api.h>
+#include <murphy/resource/config-api.h>
 
 #include "resource.h"
 #include "resource-owner.h"
@@ -73,9 +79,15 @@ typedef struct {
 
 
 static uint32_t            resource_def_count;
+static uint32_t            definition_generation;
+static mrp_htbl_t         *resource_def_names;  /* case-folded name index */
 static mrp_resource_def_t *resource_def_table[RESOURCE_MAX];
 static MRP_LIST_HOOK(manager_list);
 static mqi_handle_t        resource_user_table[RESOURCE_MAX];
+static mqi_column_desc_t  *resource_user_attr_cdsc[RESOURCE_MAX];
+static int                 config_depth;        /* configuration nesting */
+static mqi_handle_t        config_tx = MQI_HANDLE_INVALID;
+static mrp_resource_mask_t config_tables;       /* tables to create */
 
 static uint32_t add_resource_definition(const char *, bool, uint32_t,
                                         mrp_resource_mgr_ftbl_t *, void *);
@@ -90,10 +102,13 @@ static mrp_attr_value_t *get_resource_attribute_default_value(mrp_resource_t*,
                                                               uint32_t);
 #endif
 
+static void flush_configuration(void);
 static int  resource_user_create_table(mrp_resource_def_t *);
 static void resource_user_insert(mrp_resource_t *, bool);
 static void resource_user_delete(mrp_resource_t *);
+static void resource_user_update_attributes(mrp_resource_t *);
 
+static mqi_column_desc_t *create_attr_descriptors(mrp_resource_def_t *);
 static void set_attr_descriptors(mqi_column_desc_t *, mrp_resource_t *);
 
 
@@ -127,31 +142,102 @@ uint32_t mrp_resource_definition_create(const char *name, bool shareable,
         if (mrp_attribute_copy_definitions(attrdefs, def->attrdefs) < 0)
             return MRP_RESOURCE_ID_INVALID;
 
-        resource_user_create_table(def);
-        mrp_resource_owner_create_database_table(def);
+        if (config_depth > 0)
+            config_tables |= ((mrp_resource_mask_t)1 << id);
+        else {
+            resource_user_create_table(def);
+            mrp_resource_owner_create_database_table(def);
+        }
+
+        mrp_resource_definitions_changed();
     }
 
     return id;
 }
 
-uint32_t mrp_resource_definition_count(void)
+/*
+ * While the configuration is being loaded, the tables of new resource
+ * definitions are created only once the configuration is complete, and
+ * the zones and application classes are inserted into the database in a
+ * single transaction. This way the database triggers (domain-control,
+ * resolver fact tracking, etc.) fire once for the whole configuration
+ * instead of once for every single step of it.
+ */
+void mrp_resource_configuration_begin(void)
 {
-    return resource_def_count;
+    if (config_depth++ == 0) {
+        mqi_open();
+        config_tx = mqi_begin_transaction();
+    }
 }
 
-mrp_resource_def_t *mrp_resource_definition_find_by_name(const char *name)
+void mrp_resource_configuration_end(void)
+{
+    if (config_depth > 0 && --config_depth == 0)
+        flush_configuration();
+}
+
+void mrp_resource_configuration_flush(void)
+{
+    if (config_depth > 0) {
+        mrp_debug("resource set created while loading the configuration");
+        config_depth = 0;
+        flush_configuration();
+    }
+}
+
+static void flush_configuration(void)
 {
     mrp_resource_def_t *def;
-    uint32_t            i;
+    mrp_resource_mask_t pending;
+    uint32_t id;
+    int prof;
+
+    prof = mrp_profile_begin("create resource tables");
+
+    for (pending = config_tables;  pending;  pending &= pending - 1) {
+        id  = mrp_ffsll(pending) - 1;
+        def = mrp_resource_definition_find_by_id(id);
+
+        MRP_ASSERT(def, "got confused with data structures");
+
+        resource_user_create_table(def);
+        mrp_resource_owner_create_database_table(def);
+    }
 
-    for (i = 0;  i < resource_def_count;  i++) {
-        def = resource_def_table[i];
+    config_tables = 0;
 
-        if (def && !strcasecmp(name, def->name))
-            return def;
+    if (config_tx != MQI_HANDLE_INVALID) {
+        if (mqi_commit_transaction(config_tx) < 0)
+            mrp_log_error("Failed to commit resource configuration: %s",
+                          strerror(errno));
+        config_tx = MQI_HANDLE_INVALID;
     }
 
-    return NULL;
+    mrp_profile_end(prof);
+}
+
+void mrp_resource_definitions_changed(void)
+{
+    definition_generation++;
+}
+
+uint32_t mrp_resource_definitions_get_generation(void)
+{
+    return definition_generation;
+}
+
+uint32_t mrp_resource_definition_count(void)
+{
+    return resource_def_count;
+}
+
+mrp_resource_def_t *mrp_resource_definition_find_by_name(const char *name)
+{
+    if (!resource_def_names || !name)
+        return NULL;
+
+    return mrp_htbl_lookup(resource_def_names, (void *)name);
 }
 
 uint32_t mrp_resource_definition_get_resource_id_by_name(const char *name)
@@ -216,6 +302,17 @@ const char **mrp_resource_definition_get_all_names(uint32_t buflen,
     return buf;
 }
 
+uint32_t mrp_resource_definition_get_attribute_id_by_name(uint32_t resid,
+                                                          const char *name)
+{
+    mrp_resource_def_t *rdef = mrp_resource_definition_find_by_id(resid);
+
+    if (!rdef)
+        return MRP_ATTRIBUTE_ID_INVALID;
+
+    return mrp_attribute_find_index(name, rdef->nattr, rdef->attrdefs);
+}
+
 mrp_attr_t *mrp_resource_definition_read_all_attributes(uint32_t resid,
                                                         uint32_t buflen,
                                                         mrp_attr_t *buf)
@@ -436,6 +533,39 @@ int mrp_resource_write_attributes(mrp_resource_t *res, mrp_attr_t *values)
         mrp_log_error("Memory alloc failure. Can't set attributes "
                       "of resource '%s'", rdef->name);
     }
+    else if (sts & MRP_ATTRIBUTE_CHANGED_POLICY)
+        res->stamp++;
+    else if (sts & MRP_ATTRIBUTE_CHANGED_INFO)
+        resource_user_update_attributes(res);
+
+    return sts;
+}
+
+int mrp_resource_write_attribute(mrp_resource_t   *res,
+                                 uint32_t          idx,
+                                 mrp_attr_value_t *value)
+{
+    mrp_resource_def_t *rdef;
+    int sts;
+
+    MRP_ASSERT(res && value, "invalid argument");
+
+    rdef = res->def;
+
+    MRP_ASSERT(rdef, "confused with data structures");
+
+    if ((sts = mrp_attribute_set_value(idx, value, rdef->nattr,
+                                       rdef->attrdefs, res->attrs)) < 0)
+    {
+        mrp_log_error("Can't set attribute %u of resource '%s'",
+                      idx, rdef->name);
+        return -1;
+    }
+
+    if (sts & MRP_ATTRIBUTE_CHANGED_POLICY)
+        res->stamp++;
+    else if (sts & MRP_ATTRIBUTE_CHANGED_INFO)
+        resource_user_update_attributes(res);
 
     return sts;
 }
@@ -481,7 +611,7 @@ void mrp_resource_notify(mrp_resource_t *res,
     }
 }
 
-int mrp_resource_print(mrp_resource_t *res, uint32_t mandatory,
+int mrp_resource_print(mrp_resource_t *res, mrp_resource_mask_t mandatory,
                        size_t indent, char *buf, int len)
 {
 #define PRINT(fmt, args...)  if (p<e) { p += snprintf(p, e-p, fmt , ##args); }
@@ -489,7 +619,7 @@ int mrp_resource_print(mrp_resource_t *res, uint32_t mandatory,
     mrp_resource_def_t *rdef;
     char gap[] = "                         ";
     char *p, *e;
-    uint32_t m;
+    mrp_resource_mask_t m;
 
     if (len <= 0)
         return 0;
@@ -506,7 +636,7 @@ int mrp_resource_print(mrp_resource_t *res, uint32_t mandatory,
     e = (p = buf) + len;
     m = ((mrp_resource_mask_t)1 << rdef->id);
 
-    PRINT("%s%s: 0x%02x %s %s", gap, rdef->name, m,
+    PRINT("%s%s: 0x%02llx %s %s", gap, rdef->name, (unsigned long long)m,
           (m & mandatory) ? "mandatory":"optional ",
           res->shared ? "shared  ":"exlusive");
 
@@ -557,7 +687,7 @@ static uint32_t add_resource_definition(const char *name,
 
     size = sizeof(mrp_resource_def_t) + sizeof(mrp_attr_def_t) * nattr;
 
-    if (!(def = mrp_allocz(size)) || !(dup_name = mrp_strdup(name))) {
+    if (!(def = mrp_allocz(size)) || !(dup_name = mrp_intern(name))) {
         mrp_log_error("Memory alloc failure. Can't add resource '%s'", name);
         return MRP_RESOURCE_ID_INVALID;
     }
@@ -583,6 +713,23 @@ static uint32_t add_resource_definition(const char *name,
 
     resource_def_table[id] = def;
 
+    if (!resource_def_names) {
+        mrp_htbl_config_t cfg;
+
+        cfg.nentry  = RESOURCE_MAX;
+        cfg.comp    = mrp_string_casecomp;
+        cfg.hash    = mrp_string_casehash;
+        cfg.free    = NULL;
+        cfg.nbucket = cfg.nentry / 2;
+
+        resource_def_names = mrp_htbl_create(&cfg);
+
+        MRP_ASSERT(resource_def_names, "failed to make name index for "
+                   "resource definitions");
+    }
+
+    mrp_htbl_insert(resource_def_names, (void *)def->name, def);
+
     if (!mgrftbl)
         mrp_list_init(&def->manager.list);
     else
@@ -666,6 +813,7 @@ static int resource_user_create_table(mrp_resource_def_t *rdef)
     mqi_handle_t table;
     char c, *p;
     size_t i,j;
+    int prof;
 
     if (!initialized) {
         mqi_open();
@@ -701,7 +849,11 @@ static int resource_user_create_table(mrp_resource_def_t *rdef)
 
     memset(coldefs + j, 0, sizeof(mqi_column_def_t));
 
+    resource_user_attr_cdsc[rdef->id] = create_attr_descriptors(rdef);
+
+    prof  = mrp_profile_begin("create table %s", name);
     table = MQI_CREATE_TABLE(name, MQI_TEMPORARY, coldefs, indexdef);
+    mrp_profile_end(prof);
 
     if (table == MQI_HANDLE_INVALID) {
         mrp_log_error("Can't create table '%s': %s", name, strerror(errno));
@@ -813,12 +965,43 @@ void mrp_resource_user_update(mrp_resource_t *res, int state, bool grant)
         mrp_log_error("can't update row in resource user table");
 }
 
-static void set_attr_descriptors(mqi_column_desc_t *cdsc, mrp_resource_t *res)
+/*
+ * Informational attributes do not take part in arbitration, so when only
+ * they change we write them straight to the user table instead of leaving
+ * it to the next update of the set.
+ */
+static void resource_user_update_attributes(mrp_resource_t *res)
 {
+    static uint32_t rsetid;
+
+    MQI_WHERE_CLAUSE(where,
+        MQI_EQUAL( MQI_COLUMN(RSETID_IDX), MQI_UNSIGNED_VAR(rsetid) )
+    );
+
     mrp_resource_def_t *rdef = res->def;
+    user_row_t row;
+    mqi_column_desc_t cdsc[MQI_COLUMN_MAX + 1];
+
+    rsetid = res->rsetid;
+
+    memcpy(row.attrs, res->attrs, rdef->nattr * sizeof(mrp_attr_value_t));
+    set_attr_descriptors(cdsc, res);
+
+    if (MQI_UPDATE(resource_user_table[rdef->id], cdsc, &row, where) != 1)
+        mrp_log_error("can't update attributes in resource user table");
+}
+
+static mqi_column_desc_t *create_attr_descriptors(mrp_resource_def_t *rdef)
+{
+    mqi_column_desc_t *cdsc;
     uint32_t i,j;
     int o;
 
+    cdsc = mrp_allocz(sizeof(mqi_column_desc_t) * (rdef->nattr + 1));
+
+    MRP_ASSERT(cdsc, "Memory alloc failure. Can't create attribute "
+               "descriptors");
+
     for (i = j = 0;  j < rdef->nattr;  j++) {
         switch (rdef->attrdefs[j].type) {
         case mqi_string:   o = MQI_OFFSET(user_row_t,attrs[j].string);  break;
@@ -835,6 +1018,16 @@ static void set_attr_descriptors(mqi_column_desc_t *cdsc, mrp_resource_t *res)
 
     cdsc[i].cindex = -1;
     cdsc[i].offset =  1;
+
+    return cdsc;
+}
+
+static void set_attr_descriptors(mqi_column_desc_t *cdsc, mrp_resource_t *res)
+{
+    mrp_resource_def_t *rdef = res->def;
+
+    memcpy(cdsc, resource_user_attr_cdsc[rdef->id],
+           (rdef->nattr + 1) * sizeof(mqi_column_desc_t));
 }
 
 
@@ -53,6 +53,7 @@ struct mrp_resource_s {
     uint32_t            rsetid;
     mrp_resource_def_t *def;
     bool                shared;
+    uint32_t            stamp;      /* bumped on every attribute write */
     mrp_attr_value_t    attrs[0];
 };
 
@@ -62,6 +63,8 @@ uint32_t            mrp_resource_definition_count(void);
 mrp_resource_def_t *mrp_resource_definition_find_by_name(const char *);
 mrp_resource_def_t *mrp_resource_definition_find_by_id(uint32_t);
 mrp_resource_def_t *mrp_resource_definition_iterate_manager(void **);
+void                mrp_resource_definitions_changed(void);
+void                mrp_resource_configuration_flush(void);
 
 
 mrp_resource_t     *mrp_resource_create(const char *, uint32_t, bool,
@@ -71,7 +74,7 @@ void                mrp_resource_destroy(mrp_resource_t *);
 void                mrp_resource_notify(mrp_resource_t *, mrp_resource_set_t *,
                                         mrp_resource_event_t);
 
-int                 mrp_resource_print(mrp_resource_t*, uint32_t,
+int                 mrp_resource_print(mrp_resource_t*, mrp_resource_mask_t,
                                        size_t, char *, int);
 int                 mrp_resource_attribute_print(mrp_resource_t *, char *,int);
 
@@ -0,0 +1,536 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Drive the resource library in-process with a random mix of acquire
+ * and release requests and report the arbitration latency, the number
+ * of memory allocations and the number of client events per request.
+ *
+ * Usage: resource-bench [options], see resource-bench --help
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include <murphy/common.h>
+#include <murphy/core/context.h>
+#include <murphy/core/lua-bindings/murphy.h>
+
+#include <murphy/resource/config-api.h>
+#include <murphy/resource/manager-api.h>
+#include <murphy/resource/client-api.h>
+
+#define DEFAULT_ZONES      1
+#define DEFAULT_CLASSES    4
+#define DEFAULT_SETS       8
+#define DEFAULT_RESOURCES  4
+#define DEFAULT_REQUESTS   100000
+#define DEFAULT_ACQUIRE    50
+#define MAX_SET_RESOURCES  3
+
+typedef struct {
+    int         zones;                   /* number of zones */
+    int         classes;                 /* number of application classes */
+    int         sets;                    /* resource sets per class and zone */
+    int         resources;               /* number of resource definitions */
+    int         requests;                /* number of requests to measure */
+    int         acquire;                 /* acquire percentage of requests */
+    unsigned    seed;                    /* random seed */
+    bool        veto;                    /* install a Lua veto */
+    const char *veto_file;               /* Lua veto script, or built-in */
+
+    mrp_context_t          *ctx;
+    mrp_resource_client_t  *client;
+    mrp_resource_set_t    **rsets;
+    int                     nrset;
+    uint64_t               *latency;     /* per-request latency, nsec */
+    uint64_t                nevent;      /* client events received */
+} bench_t;
+
+
+/*
+ * Allocation counting. We interpose the libc allocator so that every
+ * allocation gets counted, including those of the Lua interpreter and
+ * of the database, not just the ones going through mrp_alloc.
+ */
+
+#ifdef __GLIBC__
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+static bool     count_allocs;
+static uint64_t nalloc;
+
+void *malloc(size_t size)
+{
+    if (count_allocs)
+        nalloc++;
+
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    if (count_allocs)
+        nalloc++;
+
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (count_allocs && size)
+        nalloc++;
+
+    return __libc_realloc(ptr, size);
+}
+
+#define ALLOC_COUNTING 1
+
+#else
+
+static bool     count_allocs;
+static uint64_t nalloc;
+
+#define ALLOC_COUNTING 0
+
+#endif
+
+
+static const char *builtin_veto =
+    "resource.method.veto = {\n"
+    "    function(zone, rset, grant, owners, reqset)\n"
+    "        return true\n"
+    "    end\n"
+    "}\n";
+
+
+static void print_usage(const char *argv0, int exit_code, const char *fmt,
+                        ...)
+{
+    va_list ap;
+
+    if (fmt && *fmt) {
+        va_start(ap, fmt);
+        vprintf(fmt, ap);
+        va_end(ap);
+    }
+
+    printf("usage: %s [options]\n\n"
+           "The possible options are:\n"
+           "  -z, --zones=N          number of zones (default %d)\n"
+           "  -c, --classes=N        number of application classes "
+           "(default %d)\n"
+           "  -s, --sets=N           resource sets per class and zone "
+           "(default %d)\n"
+           "  -r, --resources=N      number of resources (default %d)\n"
+           "  -n, --requests=N       number of requests (default %d)\n"
+           "  -a, --acquire=P        percentage of acquire requests "
+           "(default %d)\n"
+           "  -S, --seed=N           random seed (default 1)\n"
+           "  -l, --lua-veto[=FILE]  install a Lua veto, the built-in one\n"
+           "                         or the one configured by FILE\n"
+           "  -h, --help             show help on usage\n",
+           argv0, DEFAULT_ZONES, DEFAULT_CLASSES, DEFAULT_SETS,
+           DEFAULT_RESOURCES, DEFAULT_REQUESTS, DEFAULT_ACQUIRE);
+
+    if (exit_code < 0)
+        return;
+    else
+        exit(exit_code);
+}
+
+
+static int parse_int(const char *argv0, const char *opt, const char *arg,
+                     int min, int max)
+{
+    char *end;
+    long  val;
+
+    val = strtol(arg, &end, 10);
+
+    if (*end || val < min || val > max)
+        print_usage(argv0, EINVAL, "invalid %s '%s' (range %d - %d)\n",
+                    opt, arg, min, max);
+
+    return (int)val;
+}
+
+
+static void parse_cmdline(bench_t *b, int argc, char **argv)
+{
+#   define OPTIONS "z:c:s:r:n:a:S:l::h"
+    struct option options[] = {
+        { "zones"    , required_argument, NULL, 'z' },
+        { "classes"  , required_argument, NULL, 'c' },
+        { "sets"     , required_argument, NULL, 's' },
+        { "resources", required_argument, NULL, 'r' },
+        { "requests" , required_argument, NULL, 'n' },
+        { "acquire"  , required_argument, NULL, 'a' },
+        { "seed"     , required_argument, NULL, 'S' },
+        { "lua-veto" , optional_argument, NULL, 'l' },
+        { "help"     , no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+
+    mrp_clear(b);
+
+    b->zones     = DEFAULT_ZONES;
+    b->classes   = DEFAULT_CLASSES;
+    b->sets      = DEFAULT_SETS;
+    b->resources = DEFAULT_RESOURCES;
+    b->requests  = DEFAULT_REQUESTS;
+    b->acquire   = DEFAULT_ACQUIRE;
+    b->seed      = 1;
+
+    while ((opt = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+        switch (opt) {
+        case 'z':
+            b->zones = parse_int(argv[0], "zone count", optarg,
+                                 1, MRP_ZONE_MAX);
+            break;
+        case 'c':
+            b->classes = parse_int(argv[0], "class count", optarg, 1, 64);
+            break;
+        case 's':
+            b->sets = parse_int(argv[0], "set count", optarg, 1, 100000);
+            break;
+        case 'r':
+            b->resources = parse_int(argv[0], "resource count", optarg,
+                                     1, MRP_RESOURCE_MAX);
+            break;
+        case 'n':
+            b->requests = parse_int(argv[0], "request count", optarg,
+                                    1, 100000000);
+            break;
+        case 'a':
+            b->acquire = parse_int(argv[0], "acquire percentage", optarg,
+                                   0, 100);
+            break;
+        case 'S':
+            b->seed = (unsigned)parse_int(argv[0], "seed", optarg,
+                                          0, 0x7fffffff);
+            break;
+        case 'l':
+            b->veto      = true;
+            b->veto_file = optarg;
+            break;
+        case 'h':
+            print_usage(argv[0], 0, "");
+            break;
+        default:
+            print_usage(argv[0], EINVAL, "");
+            break;
+        }
+    }
+}
+
+
+static void event_cb(uint32_t reqid, mrp_resource_set_t *rset, void *user_data)
+{
+    bench_t *b = (bench_t *)user_data;
+
+    MRP_UNUSED(reqid);
+    MRP_UNUSED(rset);
+
+    b->nevent++;
+}
+
+
+static int setup_lua(bench_t *b)
+{
+    lua_State *L;
+    int        status;
+
+    if (!(b->ctx = mrp_context_create())) {
+        fprintf(stderr, "failed to create murphy context\n");
+        return -1;
+    }
+
+    if (!(L = mrp_lua_set_murphy_context(b->ctx))) {
+        fprintf(stderr, "failed to set up Lua bindings\n");
+        return -1;
+    }
+
+    mrp_resource_configuration_init();
+
+    if (!b->veto)
+        return 0;
+
+    if (b->veto_file)
+        status = luaL_loadfile(L, b->veto_file);
+    else
+        status = luaL_loadstring(L, builtin_veto);
+
+    if (status || lua_pcall(L, 0, 0, 0)) {
+        fprintf(stderr, "failed to set up Lua veto: %s\n",
+                lua_tostring(L, -1));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int setup_resources(bench_t *b)
+{
+    mrp_resource_set_t *rset;
+    char                zone[64], class[64], name[64];
+    int                 nres, r, z, c, s, i;
+    uint32_t            used;
+
+    if (mrp_zone_definition_create(NULL) < 0) {
+        fprintf(stderr, "failed to create zone definition\n");
+        return -1;
+    }
+
+    for (z = 0;  z < b->zones;  z++) {
+        snprintf(zone, sizeof(zone), "zone%d", z);
+
+        if (mrp_zone_create(zone, NULL) == MRP_ZONE_ID_INVALID) {
+            fprintf(stderr, "failed to create zone '%s'\n", zone);
+            return -1;
+        }
+    }
+
+    for (c = 0;  c < b->classes;  c++) {
+        snprintf(class, sizeof(class), "class%d", c);
+
+        if (!mrp_application_class_create(class, c, false, false,
+                                          MRP_RESOURCE_ORDER_FIFO)) {
+            fprintf(stderr, "failed to create class '%s'\n", class);
+            return -1;
+        }
+    }
+
+    for (r = 0;  r < b->resources;  r++) {
+        snprintf(name, sizeof(name), "resource%d", r);
+
+        if (mrp_resource_definition_create(name, r & 1, NULL, NULL, NULL) ==
+            MRP_RESOURCE_ID_INVALID) {
+            fprintf(stderr, "failed to create resource '%s'\n", name);
+            return -1;
+        }
+    }
+
+    if (!(b->client = mrp_resource_client_create("resource-bench", b))) {
+        fprintf(stderr, "failed to create resource client\n");
+        return -1;
+    }
+
+    b->nrset = b->zones * b->classes * b->sets;
+    b->rsets = mrp_allocz_array(mrp_resource_set_t *, b->nrset);
+
+    if (!b->rsets)
+        return -1;
+
+    i = 0;
+
+    for (z = 0;  z < b->zones;  z++) {
+        snprintf(zone, sizeof(zone), "zone%d", z);
+
+        for (c = 0;  c < b->classes;  c++) {
+            snprintf(class, sizeof(class), "class%d", c);
+
+            for (s = 0;  s < b->sets;  s++) {
+                rset = mrp_resource_set_create(b->client, false, false, 0,
+                                               event_cb, b);
+                if (!rset) {
+                    fprintf(stderr, "failed to create resource set\n");
+                    return -1;
+                }
+
+                nres = 1 + rand() % MRP_MIN(b->resources, MAX_SET_RESOURCES);
+                used = 0;
+
+                while (nres > 0) {
+                    r = rand() % b->resources;
+
+                    if (used & (1U << r))
+                        continue;
+
+                    used |= (1U << r);
+                    nres--;
+
+                    snprintf(name, sizeof(name), "resource%d", r);
+
+                    if (mrp_resource_set_add_resource(rset, name,
+                                                      (r & 1) && (rand() & 1),
+                                                      NULL, !nres) < 0) {
+                        fprintf(stderr, "failed to add resource '%s'\n",
+                                name);
+                        return -1;
+                    }
+                }
+
+                if (mrp_application_class_add_resource_set(class, zone,
+                                                           rset, 0) < 0) {
+                    fprintf(stderr, "failed to add resource set to %s/%s\n",
+                            class, zone);
+                    return -1;
+                }
+
+                b->rsets[i++] = rset;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+static uint64_t now_nsec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static void run(bench_t *b)
+{
+    mrp_resource_set_t *rset;
+    uint64_t            start;
+    int                 i;
+
+    b->latency = mrp_allocz_array(uint64_t, b->requests);
+
+    if (!b->latency) {
+        fprintf(stderr, "failed to allocate latency buffer\n");
+        exit(ENOMEM);
+    }
+
+    /* don't let logging skew the measurements */
+    mrp_log_set_mask(0);
+
+    b->nevent    = 0;
+    nalloc       = 0;
+    count_allocs = true;
+
+    for (i = 0;  i < b->requests;  i++) {
+        rset = b->rsets[rand() % b->nrset];
+
+        start = now_nsec();
+
+        if (rand() % 100 < b->acquire)
+            mrp_resource_set_acquire(rset, i + 1);
+        else
+            mrp_resource_set_release(rset, i + 1);
+
+        b->latency[i] = now_nsec() - start;
+    }
+
+    count_allocs = false;
+
+    mrp_log_set_mask(MRP_LOG_MASK_ERROR);
+}
+
+
+static int cmp_latency(const void *p1, const void *p2)
+{
+    uint64_t l1 = *(const uint64_t *)p1;
+    uint64_t l2 = *(const uint64_t *)p2;
+
+    return (l1 < l2) ? -1 : (l1 > l2 ? 1 : 0);
+}
+
+
+static double percentile(bench_t *b, double p)
+{
+    int idx = (int)(p / 100.0 * (b->requests - 1) + 0.5);
+
+    return b->latency[idx] / 1000.0;
+}
+
+
+static void report(bench_t *b)
+{
+    uint64_t total;
+    int      i;
+
+    for (i = 0, total = 0;  i < b->requests;  i++)
+        total += b->latency[i];
+
+    qsort(b->latency, b->requests, sizeof(b->latency[0]), cmp_latency);
+
+    printf("zones %d, classes %d, sets/class/zone %d, resources %d, "
+           "acquire %d%%, Lua veto %s\n", b->zones, b->classes, b->sets,
+           b->resources, b->acquire,
+           !b->veto ? "off" : (b->veto_file ? b->veto_file : "built-in"));
+    printf("requests:     %d (%.0f/s)\n", b->requests,
+           total ? 1e9 * b->requests / total : 0.0);
+    printf("latency usec: mean %.2f, p50 %.2f, p90 %.2f, p99 %.2f, "
+           "p99.9 %.2f, max %.2f\n", total / 1000.0 / b->requests,
+           percentile(b, 50), percentile(b, 90), percentile(b, 99),
+           percentile(b, 99.9), percentile(b, 100));
+
+    if (ALLOC_COUNTING)
+        printf("allocations:  %.2f/request\n", (double)nalloc / b->requests);
+    else
+        printf("allocations:  not available\n");
+
+    printf("events:       %.2f/request (%llu total)\n",
+           (double)b->nevent / b->requests, (unsigned long long)b->nevent);
+}
+
+
+int main(int argc, char **argv)
+{
+    bench_t b;
+
+    parse_cmdline(&b, argc, argv);
+
+    srand(b.seed);
+
+    mrp_log_set_mask(MRP_LOG_MASK_ERROR);
+
+    if (setup_lua(&b) < 0 || setup_resources(&b) < 0)
+        exit(1);
+
+    run(&b);
+    report(&b);
+
+    return 0;
+}
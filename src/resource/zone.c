@@ -33,6 +33,7 @@
 
 #include <murphy/common/mm.h>
 #include <murphy/common/log.h>
+#include <murphy/common/profile.h>
 
 #include <murphy/resource/manager-api.h>
 #include <murphy/resource/client-api.h>
@@ -41,6 +42,7 @@
 #include <murphy-db/mqi.h>
 
 #include "zone.h"
+#include "resource.h"
 
 
 #define ATTRIBUTE_MAX  32
@@ -146,6 +148,8 @@ uint32_t mrp_zone_create(const char *name, mrp_attr_t *attrs)
 
     zone_table[zone->id] = zone;
 
+    mrp_resource_definitions_changed();
+
     return zone->id;
 }
 
@@ -172,6 +176,11 @@ mrp_zone_t *mrp_zone_find_by_name(const char *name)
     return NULL;
 }
 
+uint32_t mrp_zone_get_id_by_name(const char *name)
+{
+    return mrp_zone_get_id(mrp_zone_find_by_name(name));
+}
+
 uint32_t mrp_zone_get_id(mrp_zone_t *zone)
 {
     if (!zone)
@@ -282,6 +291,7 @@ static mqi_handle_t create_zone_table(mrp_zone_def_t *zdef)
     mqi_column_def_t *col;
     mrp_attr_def_t *atd;
     mqi_handle_t table;
+    int prof;
     size_t i,j;
 
     MRP_ASSERT(zdef, "invalid argument");
@@ -308,7 +318,9 @@ static mqi_handle_t create_zone_table(mrp_zone_def_t *zdef)
 
     memset(coldefs + j, 0, sizeof(mqi_column_def_t));
 
+    prof  = mrp_profile_begin("create table %s", name);
     table = MQI_CREATE_TABLE(name, MQI_TEMPORARY, coldefs, indexdef);
+    mrp_profile_end(prof);
 
     if (table == MQI_HANDLE_INVALID)
         mrp_log_error("Can't create table '%s': %s", name, strerror(errno));
@@ -0,0 +1,688 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Intel Corporation nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#define _GNU_SOURCE
+#include <getopt.h>
+
+/*
+ * data type codec generator
+ *
+ * Reads descriptions of custom data types (the ones registered with
+ * mrp_msg_register_type) and generates a specialised encoder/decoder
+ * pair for each of them, together with a data descriptor that has the
+ * generated functions hooked in. The generated code produces and accepts
+ * the same wire format as the interpreting mrp_data_encode/decode, so
+ * generated and interpreted peers can be mixed freely. A description
+ * looks like this:
+ *
+ *     # comment
+ *     type <C type> <descriptor variable> <tag>
+ *         <kind> <member>
+ *         array <kind> <member> <count member>
+ *     end
+ *
+ * where kind is one of string, bool, uint8, sint8, uint16, sint16,
+ * uint32, sint32, uint64, sint64 or double. Array counts must be
+ * integer members preceding the array. Sentinel-terminated arrays and
+ * blobs are not supported, types using them need to stay interpreted.
+ */
+
+#define MAX_MEMBERS 64
+#define MAX_TYPES   64
+#define MAX_LINE    1024
+#define MAX_NAME    128
+
+typedef enum {
+    KIND_NONE = 0,
+    KIND_STRING,
+    KIND_BOOL,
+    KIND_UINT8,
+    KIND_SINT8,
+    KIND_UINT16,
+    KIND_SINT16,
+    KIND_UINT32,
+    KIND_SINT32,
+    KIND_UINT64,
+    KIND_SINT64,
+    KIND_DOUBLE,
+} kind_t;
+
+
+typedef struct {
+    const char *name;                    /* name in descriptions */
+    const char *field;                   /* MRP_MSG_FIELD_* suffix */
+    const char *ctype;                   /* C type of the item */
+    const char *wtype;                   /* wire type */
+    const char *hton;                    /* host-to-wire conversion */
+    const char *ntoh;                    /* wire-to-host conversion */
+} kind_info_t;
+
+
+static kind_info_t kinds[] = {
+    [KIND_STRING] = { "string", "STRING", "char *"  , NULL      , NULL     ,
+                      NULL    },
+    [KIND_BOOL]   = { "bool"  , "BOOL"  , "bool"    , "uint32_t", "htobe32",
+                      "be32toh" },
+    [KIND_UINT8]  = { "uint8" , "UINT8" , "uint8_t" , "uint8_t" , ""       ,
+                      ""        },
+    [KIND_SINT8]  = { "sint8" , "SINT8" , "int8_t"  , "int8_t"  , ""       ,
+                      ""        },
+    [KIND_UINT16] = { "uint16", "UINT16", "uint16_t", "uint16_t", "htobe16",
+                      "be16toh" },
+    [KIND_SINT16] = { "sint16", "SINT16", "int16_t" , "uint16_t", "htobe16",
+                      "be16toh" },
+    [KIND_UINT32] = { "uint32", "UINT32", "uint32_t", "uint32_t", "htobe32",
+                      "be32toh" },
+    [KIND_SINT32] = { "sint32", "SINT32", "int32_t" , "uint32_t", "htobe32",
+                      "be32toh" },
+    [KIND_UINT64] = { "uint64", "UINT64", "uint64_t", "uint64_t", "htobe64",
+                      "be64toh" },
+    [KIND_SINT64] = { "sint64", "SINT64", "int64_t" , "uint64_t", "htobe64",
+                      "be64toh" },
+    [KIND_DOUBLE] = { "double", "DOUBLE", "double"  , "double"  , ""       ,
+                      ""        },
+};
+
+
+typedef struct {
+    char   name[MAX_NAME];               /* member name */
+    kind_t kind;                         /* member (or array item) kind */
+    int    array;                        /* whether an array */
+    int    count;                        /* index of count member */
+} member_t;
+
+typedef struct {
+    char     ctype[MAX_NAME];            /* C type name */
+    char     descr[MAX_NAME];            /* descriptor variable name */
+    char     tag[MAX_NAME];              /* type tag */
+    member_t members[MAX_MEMBERS];       /* members */
+    int      nmember;                    /* number of members */
+} type_t;
+
+typedef struct {
+    const char *input;                   /* description file */
+    const char *output;                  /* output path */
+    const char *include;                 /* header to include, if any */
+} config_t;
+
+
+static type_t types[MAX_TYPES];
+static int    ntype;
+
+
+static void fatal_error(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+
+    exit(1);
+}
+
+
+static void print_usage(const char *argv0, int exit_code, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (fmt && *fmt) {
+        va_start(ap, fmt);
+        vprintf(fmt, ap);
+        va_end(ap);
+    }
+
+    printf("usage: %s [options] <description-file>\n\n"
+           "The possible options are:\n"
+           "  -i, --include <header>       include header in generated code\n"
+           "  -o, --output <path>          write output to the given file\n"
+           "  -h, --help                   show this help on usage\n",
+           argv0);
+
+    if (exit_code < 0)
+        return;
+    else
+        exit(exit_code);
+}
+
+
+static void parse_cmdline(config_t *cfg, int argc, char **argv)
+{
+#   define OPTIONS "i:o:h"
+    struct option options[] = {
+        { "include", required_argument, NULL, 'i' },
+        { "output" , required_argument, NULL, 'o' },
+        { "help"   , no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+
+    memset(cfg, 0, sizeof(*cfg));
+
+    while ((opt = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+        switch (opt) {
+        case 'i':
+            cfg->include = optarg;
+            break;
+
+        case 'o':
+            cfg->output = optarg;
+            break;
+
+        case 'h':
+            print_usage(argv[0], -1, "");
+            exit(0);
+            break;
+
+        default:
+            print_usage(argv[0], EINVAL, "invalid option '%s'\n",
+                        argv[optind]);
+        }
+    }
+
+    if (optind != argc - 1)
+        print_usage(argv[0], EINVAL, "expecting a single description file\n");
+
+    cfg->input = argv[optind];
+}
+
+
+static kind_t parse_kind(const char *name)
+{
+    int i;
+
+    for (i = KIND_STRING; i <= KIND_DOUBLE; i++)
+        if (!strcmp(kinds[i].name, name))
+            return (kind_t)i;
+
+    return KIND_NONE;
+}
+
+
+static int find_member(type_t *t, const char *name)
+{
+    int i;
+
+    for (i = 0; i < t->nmember; i++)
+        if (!strcmp(t->members[i].name, name))
+            return i;
+
+    return -1;
+}
+
+
+static void copy_name(char *dst, const char *src, const char *path, int line)
+{
+    if (strlen(src) >= MAX_NAME)
+        fatal_error("%s:%d: name '%s' too long\n", path, line, src);
+
+    strcpy(dst, src);
+}
+
+
+static void parse_descriptions(const char *path)
+{
+    FILE     *fp;
+    char      buf[MAX_LINE], *tok[8], *p;
+    type_t   *t;
+    member_t *m;
+    int       line, ntok, cnt;
+
+    if ((fp = fopen(path, "r")) == NULL)
+        fatal_error("failed to open '%s' (%d: %s)\n", path,
+                    errno, strerror(errno));
+
+    t    = NULL;
+    line = 0;
+
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        line++;
+
+        if ((p = strchr(buf, '#')) != NULL)
+            *p = '\0';
+
+        for (ntok = 0, p = strtok(buf, " \t\n"); p != NULL && ntok < 8;
+             p = strtok(NULL, " \t\n"))
+            tok[ntok++] = p;
+
+        if (ntok == 0)
+            continue;
+
+        if (!strcmp(tok[0], "type")) {
+            if (t != NULL)
+                fatal_error("%s:%d: missing 'end' for type %s\n", path, line,
+                            t->ctype);
+            if (ntok != 4)
+                fatal_error("%s:%d: expecting 'type <C type> <descriptor> "
+                            "<tag>'\n", path, line);
+            if (ntype >= MAX_TYPES)
+                fatal_error("%s:%d: too many types\n", path, line);
+
+            t = types + ntype++;
+            copy_name(t->ctype, tok[1], path, line);
+            copy_name(t->descr, tok[2], path, line);
+            copy_name(t->tag  , tok[3], path, line);
+            continue;
+        }
+
+        if (t == NULL)
+            fatal_error("%s:%d: member outside of type\n", path, line);
+
+        if (!strcmp(tok[0], "end")) {
+            if (t->nmember == 0)
+                fatal_error("%s:%d: type %s has no members\n", path, line,
+                            t->ctype);
+            t = NULL;
+            continue;
+        }
+
+        if (t->nmember >= MAX_MEMBERS)
+            fatal_error("%s:%d: too many members\n", path, line);
+
+        m = t->members + t->nmember;
+
+        if (!strcmp(tok[0], "array")) {
+            if (ntok != 4)
+                fatal_error("%s:%d: expecting 'array <kind> <member> "
+                            "<count>'\n", path, line);
+
+            if ((m->kind = parse_kind(tok[1])) == KIND_NONE)
+                fatal_error("%s:%d: unknown kind '%s'\n", path, line, tok[1]);
+
+            cnt = find_member(t, tok[3]);
+
+            if (cnt < 0 || t->members[cnt].array ||
+                t->members[cnt].kind < KIND_UINT8 ||
+                t->members[cnt].kind > KIND_SINT32)
+                fatal_error("%s:%d: count '%s' is not a preceding integer "
+                            "member\n", path, line, tok[3]);
+
+            m->array = 1;
+            m->count = cnt;
+            copy_name(m->name, tok[2], path, line);
+        }
+        else {
+            if (ntok != 2)
+                fatal_error("%s:%d: expecting '<kind> <member>'\n",
+                            path, line);
+
+            if ((m->kind = parse_kind(tok[0])) == KIND_NONE)
+                fatal_error("%s:%d: unknown kind '%s'\n", path, line, tok[0]);
+
+            copy_name(m->name, tok[1], path, line);
+        }
+
+        if (find_member(t, m->name) >= 0)
+            fatal_error("%s:%d: duplicate member '%s'\n", path, line,
+                        m->name);
+
+        t->nmember++;
+    }
+
+    if (t != NULL)
+        fatal_error("%s: missing 'end' for type %s\n", path, t->ctype);
+
+    fclose(fp);
+}
+
+
+/*
+ * code generation
+ */
+
+static int has_kind(type_t *t, kind_t kind, int arrays_only)
+{
+    int i;
+
+    for (i = 0; i < t->nmember; i++)
+        if ((kind == KIND_NONE || t->members[i].kind == kind) &&
+            (!arrays_only || t->members[i].array))
+            return 1;
+
+    return 0;
+}
+
+
+static void emit_push_item(FILE *out, kind_t kind, const char *val,
+                           const char *indent)
+{
+    kind_info_t *k = kinds + kind;
+
+    switch (kind) {
+    case KIND_STRING:
+        fprintf(out, "%slen = strlen(%s) + 1;\n", indent, val);
+        fprintf(out, "%sMRP_MSGBUF_PUSH(&mb, htobe32(len), 1, nomem);\n",
+                indent);
+        fprintf(out, "%sMRP_MSGBUF_PUSH_DATA(&mb, %s, len, 1, nomem);\n",
+                indent, val);
+        break;
+
+    case KIND_BOOL:
+        fprintf(out, "%sMRP_MSGBUF_PUSH(&mb, htobe32(%s ? 1 : 0), 1, "
+                "nomem);\n", indent, val);
+        break;
+
+    default:
+        fprintf(out, "%sMRP_MSGBUF_PUSH(&mb, %s((%s)%s), 1, nomem);\n",
+                indent, k->hton, k->wtype, val);
+        break;
+    }
+}
+
+
+static void emit_encoder(FILE *out, type_t *t)
+{
+    member_t *m;
+    char      val[2 * MAX_NAME];
+    int       i;
+
+    fprintf(out,
+            "static size_t %s_encode(void **bufp, void *data, "
+            "size_t reserve)\n"
+            "{\n"
+            "    %s *d = data;\n"
+            "    mrp_msgbuf_t mb;\n", t->descr, t->ctype);
+
+    if (has_kind(t, KIND_STRING, 0))
+        fprintf(out, "    uint32_t len;\n");
+    if (has_kind(t, KIND_NONE, 1))
+        fprintf(out, "    uint32_t n, i;\n");
+
+    fprintf(out,
+            "\n"
+            "    if (!mrp_msgbuf_write(&mb, reserve + %d * "
+            "(2 * sizeof(uint16_t) + sizeof(uint64_t))))\n"
+            "        goto nomem;\n"
+            "\n"
+            "    if (reserve)\n"
+            "        mrp_msgbuf_reserve(&mb, reserve, 1);\n",
+            t->nmember);
+
+    for (i = 0, m = t->members; i < t->nmember; i++, m++) {
+        fprintf(out, "\n    /* %s */\n", m->name);
+        fprintf(out, "    MRP_MSGBUF_PUSH(&mb, htobe16((uint16_t)%d), 1, "
+                "nomem);\n", i + 1);
+
+        if (!m->array) {
+            snprintf(val, sizeof(val), "d->%s", m->name);
+            emit_push_item(out, m->kind, val, "    ");
+        }
+        else {
+            snprintf(val, sizeof(val), "d->%s[i]", m->name);
+            fprintf(out, "    n = (uint32_t)d->%s;\n",
+                    t->members[m->count].name);
+            fprintf(out, "    MRP_MSGBUF_PUSH(&mb, htobe32(n), 1, nomem);\n");
+            fprintf(out, "    for (i = 0; i < n; i++) {\n");
+            emit_push_item(out, m->kind, val, "        ");
+            fprintf(out, "    }\n");
+        }
+    }
+
+    fprintf(out,
+            "\n"
+            "    *bufp = mb.buf;\n"
+            "    return (size_t)(mb.p - mb.buf);\n"
+            "\n"
+            " nomem:\n"
+            "    *bufp = NULL;\n"
+            "    return 0;\n"
+            "}\n\n\n");
+}
+
+
+static void emit_pull_item(FILE *out, kind_t kind, const char *dst,
+                           const char *indent)
+{
+    kind_info_t *k = kinds + kind;
+
+    switch (kind) {
+    case KIND_STRING:
+        fprintf(out,
+                "%slen = be32toh(MRP_MSGBUF_PULL(&mb, uint32_t, 1, nodata));\n"
+                "%sif (len > 0) {\n"
+                "%s    value = MRP_MSGBUF_PULL_DATA(&mb, len, 1, nodata);\n"
+                "%s    if (((char *)value)[len - 1] != '\\0')\n"
+                "%s        goto invalid;\n"
+                "%s}\n"
+                "%selse\n"
+                "%s    value = \"\";\n"
+                "%sif ((%s = mrp_strdup(value)) == NULL)\n"
+                "%s    goto nomem;\n",
+                indent, indent, indent, indent, indent, indent, indent,
+                indent, indent, dst, indent);
+        break;
+
+    case KIND_BOOL:
+        fprintf(out, "%s%s = be32toh(MRP_MSGBUF_PULL(&mb, uint32_t, 1, "
+                "nodata)) ? 1 : 0;\n", indent, dst);
+        break;
+
+    default:
+        fprintf(out, "%s%s = (%s)%s(MRP_MSGBUF_PULL(&mb, %s, 1, nodata));\n",
+                indent, dst, k->ctype, k->ntoh, k->wtype);
+        break;
+    }
+}
+
+
+static void emit_cleanup(FILE *out, type_t *t)
+{
+    member_t *m;
+    int       i;
+
+    for (i = 0, m = t->members; i < t->nmember; i++, m++) {
+        if (m->array) {
+            if (m->kind == KIND_STRING) {
+                fprintf(out,
+                        "    if (d->%s != NULL)\n"
+                        "        for (i = 0; i < (uint32_t)d->%s; i++)\n"
+                        "            mrp_free(d->%s[i]);\n",
+                        m->name, t->members[m->count].name, m->name);
+            }
+            fprintf(out, "    mrp_free(d->%s);\n", m->name);
+        }
+        else if (m->kind == KIND_STRING)
+            fprintf(out, "    mrp_free(d->%s);\n", m->name);
+    }
+}
+
+
+static void emit_decoder(FILE *out, type_t *t)
+{
+    member_t *m;
+    char      dst[2 * MAX_NAME];
+    int       i, dyn;
+
+    dyn = has_kind(t, KIND_STRING, 0) || has_kind(t, KIND_NONE, 1);
+
+    fprintf(out,
+            "static void *%s_decode(void **bufp, size_t *sizep)\n"
+            "{\n"
+            "    %s *d;\n"
+            "    mrp_msgbuf_t mb;\n", t->descr, t->ctype);
+
+    if (has_kind(t, KIND_STRING, 0))
+        fprintf(out, "    uint32_t len;\n    void *value;\n");
+    if (has_kind(t, KIND_NONE, 1))
+        fprintf(out, "    uint32_t n, i;\n");
+
+    fprintf(out,
+            "\n"
+            "    if ((d = mrp_allocz(sizeof(*d))) == NULL)\n"
+            "        return NULL;\n"
+            "\n"
+            "    mrp_msgbuf_read(&mb, *bufp, *sizep);\n");
+
+    for (i = 0, m = t->members; i < t->nmember; i++, m++) {
+        fprintf(out, "\n    /* %s */\n", m->name);
+        fprintf(out,
+                "    if (be16toh(MRP_MSGBUF_PULL(&mb, uint16_t, 1, nodata)) "
+                "!= %d)\n"
+                "        goto invalid;\n", i + 1);
+
+        if (!m->array) {
+            snprintf(dst, sizeof(dst), "d->%s", m->name);
+            emit_pull_item(out, m->kind, dst, "    ");
+        }
+        else {
+            snprintf(dst, sizeof(dst), "d->%s[i]", m->name);
+            fprintf(out,
+                    "    n = be32toh(MRP_MSGBUF_PULL(&mb, uint32_t, 1, "
+                    "nodata));\n"
+                    "    if (n != (uint32_t)d->%s || n > mb.l)\n"
+                    "        goto invalid;\n"
+                    "    if (n > 0 && (d->%s = mrp_allocz(n * "
+                    "sizeof(d->%s[0]))) == NULL)\n"
+                    "        goto nomem;\n"
+                    "    for (i = 0; i < n; i++) {\n",
+                    t->members[m->count].name, m->name, m->name);
+            emit_pull_item(out, m->kind, dst, "        ");
+            fprintf(out, "    }\n");
+        }
+    }
+
+    fprintf(out,
+            "\n"
+            "    *bufp   = mb.buf;\n"
+            "    *sizep -= mb.p - mb.buf;\n"
+            "    return d;\n"
+            "\n"
+            " invalid:\n"
+            "    errno = EINVAL;\n"
+            " nodata:\n");
+
+    if (dyn) {
+        fprintf(out, " nomem:\n");
+        emit_cleanup(out, t);
+    }
+
+    fprintf(out,
+            "    mrp_free(d);\n"
+            "    return NULL;\n"
+            "}\n\n\n");
+}
+
+
+static void emit_descriptor(FILE *out, type_t *t)
+{
+    member_t *m;
+    int       i;
+
+    fprintf(out, "static mrp_data_member_t %s_members[] = {\n", t->descr);
+
+    for (i = 0, m = t->members; i < t->nmember; i++, m++) {
+        if (!m->array)
+            fprintf(out, "    MRP_DATA_MEMBER(%s, %s, MRP_MSG_FIELD_%s),\n",
+                    t->ctype, m->name, kinds[m->kind].field);
+        else
+            fprintf(out, "    MRP_DATA_ARRAY_COUNT(%s, %s, %s, "
+                    "MRP_MSG_FIELD_%s),\n", t->ctype, m->name,
+                    t->members[m->count].name, kinds[m->kind].field);
+    }
+
+    fprintf(out,
+            "};\n"
+            "\n"
+            "mrp_data_descr_t %s = {\n"
+            "    .size   = sizeof(%s),\n"
+            "    .tag    = %s,\n"
+            "    .fields = %s_members,\n"
+            "    .nfield = %d,\n"
+            "    .encode = %s_encode,\n"
+            "    .decode = %s_decode,\n"
+            "};\n\n\n",
+            t->descr, t->ctype, t->tag, t->descr, t->nmember, t->descr,
+            t->descr);
+}
+
+
+static void generate(FILE *out, config_t *cfg)
+{
+    int i;
+
+    fprintf(out,
+            "/*\n"
+            " * Generated by gen-data-codec from %s, do not edit.\n"
+            " */\n"
+            "\n"
+            "#include <stdint.h>\n"
+            "#include <string.h>\n"
+            "#include <errno.h>\n"
+            "#include <endian.h>\n"
+            "\n"
+            "#include <murphy/common/mm.h>\n"
+            "#include <murphy/common/msg.h>\n", cfg->input);
+
+    if (cfg->include != NULL)
+        fprintf(out, "\n#include \"%s\"\n", cfg->include);
+
+    fprintf(out, "\n\n");
+
+    for (i = 0; i < ntype; i++) {
+        emit_encoder(out, types + i);
+        emit_decoder(out, types + i);
+        emit_descriptor(out, types + i);
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    config_t  cfg;
+    FILE     *out;
+
+    parse_cmdline(&cfg, argc, argv);
+    parse_descriptions(cfg.input);
+
+    if (cfg.output != NULL) {
+        out = fopen(cfg.output, "w");
+
+        if (out == NULL)
+            fatal_error("failed to open '%s' (%d: %s)", cfg.output,
+                        errno, strerror(errno));
+    }
+    else
+        out = stdout;
+
+    generate(out, &cfg);
+
+    if (out != stdout) {
+        if (fclose(out) != 0)
+            fatal_error("failed to write '%s' (%d: %s)", cfg.output,
+                        errno, strerror(errno));
+    }
+
+    return 0;
+}